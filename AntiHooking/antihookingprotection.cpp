@@ -4,12 +4,20 @@
 #include <Windows.h>
 
 #include <detours.h>
+#include <wctype.h>
 
 typedef HMODULE (WINAPI *LoadLibraryAFunc)(LPCSTR lpLibFileName);
 typedef HMODULE (WINAPI *LoadLibraryWFunc)(LPCWSTR lpLibFileName);
 typedef HMODULE (WINAPI *LoadLibraryExAFunc)(LPCSTR lpLibFileName, HANDLE hFile, DWORD dwFlags);
 typedef HMODULE (WINAPI *LoadLibraryExWFunc)(LPCWSTR lpLibFileName, HANDLE hFile, DWORD dwFlags);
 
+// Must be a power of 2
+#define DECISION_CACHE_SIZE 256
+
+// The low byte of a cache entry holds the blacklist index + 1 (or 0 if
+// allowed) and the rest holds the module name hash. 0 is an empty slot.
+#define DECISION_INDEX_MASK 0xFFULL
+
 class AntiHookingProtection
 {
 public:
@@ -46,8 +54,69 @@ public:
         DetourTransactionCommit();
     }
 
+    static int getBlockedModules(AH_BLOCKED_MODULE* modules, int maxModules)
+    {
+        int count = 0;
+
+        for (int i = 0; i < ARRAYSIZE(k_BlacklistedDlls) && count < maxModules; i++) {
+            LONG attempts = InterlockedCompareExchange(&s_BlockedCount[i], 0, 0);
+            if (attempts != 0) {
+                modules[count].name = k_BlacklistedDlls[i];
+                modules[count].attempts = (unsigned int)attempts;
+                count++;
+            }
+        }
+
+        return count;
+    }
+
+    static void getFilterStats(unsigned int* calls, unsigned long long* totalTimeUs)
+    {
+        LARGE_INTEGER freq;
+        QueryPerformanceFrequency(&freq);
+
+        *calls = (unsigned int)InterlockedCompareExchange(&s_FilterCalls, 0, 0);
+        *totalTimeUs = (unsigned long long)InterlockedCompareExchange64(&s_FilterTicks, 0, 0) * 1000000 / freq.QuadPart;
+    }
+
 private:
     static bool isImageBlacklistedW(LPCWSTR lpLibFileName)
+    {
+        LARGE_INTEGER start, end;
+        QueryPerformanceCounter(&start);
+
+        int index = lookupBlacklistIndex(lpLibFileName);
+        if (index >= 0) {
+            InterlockedIncrement(&s_BlockedCount[index]);
+        }
+
+        QueryPerformanceCounter(&end);
+        InterlockedIncrement(&s_FilterCalls);
+        InterlockedExchangeAdd64(&s_FilterTicks, end.QuadPart - start.QuadPart);
+
+        return index >= 0;
+    }
+
+    static ULONG64 hashImageName(LPCWSTR dllName)
+    {
+        // FNV-1a over the case-folded name
+        ULONG64 hash = 14695981039346656037ULL;
+        for (; *dllName; dllName++) {
+            hash ^= towlower(*dllName);
+            hash *= 1099511628211ULL;
+        }
+
+        // Keep the hash clear of the index byte and never 0
+        hash &= ~DECISION_INDEX_MASK;
+        if (hash == 0) {
+            hash = DECISION_INDEX_MASK + 1;
+        }
+
+        return hash;
+    }
+
+    // Returns the index into k_BlacklistedDlls or -1 if the image is allowed
+    static int lookupBlacklistIndex(LPCWSTR lpLibFileName)
     {
         LPCWSTR dllName;
 
@@ -66,13 +135,36 @@ private:
         // library name does not include a file extension and the loader
         // automatically assumes .dll.
 
+        // Most calls are repeat loads of the same system DLLs, so check the
+        // cache before walking the blacklist. The blacklist only matches on
+        // the file name, so the name alone is a sufficient key.
+        ULONG64 hash = hashImageName(dllName);
+        int slot = (int)((hash >> 8) & (DECISION_CACHE_SIZE - 1));
+        for (int i = 0; i < DECISION_CACHE_SIZE; i++) {
+            LONG64 entry = InterlockedCompareExchange64(&s_DecisionCache[slot], 0, 0);
+            if (entry == 0) {
+                break;
+            }
+            else if (((ULONG64)entry & ~DECISION_INDEX_MASK) == hash) {
+                return (int)((ULONG64)entry & DECISION_INDEX_MASK) - 1;
+            }
+
+            slot = (slot + 1) & (DECISION_CACHE_SIZE - 1);
+        }
+
+        int index = -1;
         for (int i = 0; i < ARRAYSIZE(k_BlacklistedDlls); i++) {
             if (_wcsicmp(dllName, k_BlacklistedDlls[i]) == 0) {
-                return true;
+                index = i;
+                break;
             }
         }
 
-        return false;
+        // Claim the empty slot we stopped at. If we lose a race for it or
+        // the cache is full, we just don't cache this name.
+        InterlockedCompareExchange64(&s_DecisionCache[slot], (LONG64)(hash | (ULONG64)(index + 1)), 0);
+
+        return index;
     }
 
     static bool isImageBlacklistedA(LPCSTR lpLibFileName)
@@ -142,6 +234,10 @@ private:
     static LoadLibraryExAFunc s_RealLoadLibraryExA;
     static LoadLibraryExWFunc s_RealLoadLibraryExW;
 
+    static volatile LONG64 s_DecisionCache[DECISION_CACHE_SIZE];
+    static volatile LONG s_FilterCalls;
+    static volatile LONG64 s_FilterTicks;
+
     static constexpr LPCWSTR k_BlacklistedDlls[] = {
         // These A-Volute DLLs shipped with various audio driver packages improperly handle
         // D3D9 exclusive fullscreen in a way that causes CreateDeviceEx() to deadlock.
@@ -230,15 +326,31 @@ private:
         L"bdcamvk32.dll",
         L"bdcamvk64.dll",
     };
+
+    static volatile LONG s_BlockedCount[ARRAYSIZE(k_BlacklistedDlls)];
 };
 
 LoadLibraryAFunc AntiHookingProtection::s_RealLoadLibraryA;
 LoadLibraryWFunc AntiHookingProtection::s_RealLoadLibraryW;
 LoadLibraryExAFunc AntiHookingProtection::s_RealLoadLibraryExA;
 LoadLibraryExWFunc AntiHookingProtection::s_RealLoadLibraryExW;
+volatile LONG64 AntiHookingProtection::s_DecisionCache[DECISION_CACHE_SIZE];
+volatile LONG AntiHookingProtection::s_FilterCalls;
+volatile LONG64 AntiHookingProtection::s_FilterTicks;
+volatile LONG AntiHookingProtection::s_BlockedCount[ARRAYSIZE(AntiHookingProtection::k_BlacklistedDlls)];
 
 AH_EXPORT void AntiHookingDummyImport() {}
 
+AH_EXPORT int AntiHookingGetBlockedModules(AH_BLOCKED_MODULE* modules, int maxModules)
+{
+    return AntiHookingProtection::getBlockedModules(modules, maxModules);
+}
+
+AH_EXPORT void AntiHookingGetFilterStats(unsigned int* calls, unsigned long long* totalTimeUs)
+{
+    AntiHookingProtection::getFilterStats(calls, totalTimeUs);
+}
+
 extern "C"
 BOOL WINAPI DllMain(HINSTANCE hinstDLL, DWORD fdwReason, LPVOID lpvReserved)
 {
@@ -6,5 +6,18 @@
 #define AH_EXPORT  extern "C" __declspec(dllimport)
 #endif
 
+typedef struct _AH_BLOCKED_MODULE {
+    const wchar_t* name;
+    unsigned int attempts;
+} AH_BLOCKED_MODULE;
+
 AH_EXPORT void AntiHookingDummyImport();
 
+// Fills up to maxModules entries for blacklisted modules that we have
+// blocked at least once and returns the number of entries written.
+AH_EXPORT int AntiHookingGetBlockedModules(AH_BLOCKED_MODULE* modules, int maxModules);
+
+// Returns the number of LoadLibrary calls filtered and the total time
+// spent in the filter, so the cost of the hooks themselves is known.
+AH_EXPORT void AntiHookingGetFilterStats(unsigned int* calls, unsigned long long* totalTimeUs);
+
@@ -78,7 +78,7 @@ unix:if(!macx|disable-prebuilts) {
 
     !disable-ffmpeg {
         packagesExist(libavcodec) {
-            PKGCONFIG += libavcodec libavutil libswscale
+            PKGCONFIG += libavcodec libavformat libavutil libswscale
             CONFIG += ffmpeg
 
             !disable-libva {
@@ -139,6 +139,13 @@ unix:if(!macx|disable-prebuilts) {
             }
         }
 
+        !disable-pipewire {
+            packagesExist(libpipewire-0.3) {
+                PKGCONFIG += libpipewire-0.3
+                CONFIG += pipewire
+            }
+        }
+
         !disable-wayland {
             packagesExist(wayland-client) {
                 CONFIG += wayland
@@ -155,7 +162,8 @@ unix:if(!macx|disable-prebuilts) {
     }
 }
 win32 {
-    LIBS += -llibssl -llibcrypto -lSDL2 -lSDL2_ttf -lavcodec -lavutil -lswscale -lopus -ldxgi -ld3d11 -llibplacebo
+    LIBS += -llibssl -llibcrypto -lSDL2 -lSDL2_ttf -lavcodec -lavformat -lavutil -lswscale -lopus -ldxgi -ld3d11 -lsetupapi -llibplacebo
+    LIBS += avrt.lib
     CONFIG += ffmpeg libplacebo
 }
 win32:!winrt {
@@ -163,7 +171,7 @@ win32:!winrt {
 }
 macx {
     !disable-prebuilts {
-        LIBS += -lssl.3 -lcrypto.3 -lavcodec.62 -lavutil.60 -lswscale.9 -lopus -framework SDL2 -framework SDL2_ttf
+        LIBS += -lssl.3 -lcrypto.3 -lavcodec.62 -lavformat.62 -lavutil.60 -lswscale.9 -lopus -framework SDL2 -framework SDL2_ttf
         CONFIG += discord-rpc
     }
 
@@ -185,6 +193,8 @@ SOURCES += \
     backend/boxartmanager.cpp \
     backend/richpresencemanager.cpp \
     cli/commandlineparser.cpp \
+    cli/benchmarkaudio.cpp \
+    cli/benchmarklauncher.cpp \
     cli/listapps.cpp \
     cli/quitstream.cpp \
     cli/startstream.cpp \
@@ -194,21 +204,40 @@ SOURCES += \
     streaming/input/abstouch.cpp \
     streaming/input/gamepad.cpp \
     streaming/input/input.cpp \
+    streaming/input/inputlatency.cpp \
     streaming/input/keyboard.cpp \
     streaming/input/mouse.cpp \
+    streaming/input/relativemotion.cpp \
     streaming/input/reltouch.cpp \
     streaming/session.cpp \
     streaming/audio/audio.cpp \
+    streaming/audio/downmix.cpp \
+    streaming/audio/renderers/pcmconvert.cpp \
+    streaming/audio/renderers/pcmring.cpp \
     streaming/audio/renderers/sdlaud.cpp \
+    streaming/audio/renderers/sdlpullaud.cpp \
     gui/computermodel.cpp \
     gui/appmodel.cpp \
+    streaming/avsync.cpp \
+    streaming/hostclock.cpp \
+    streaming/bitratecontroller.cpp \
+    streaming/decoderload.cpp \
+    streaming/launchtimeline.cpp \
+    streaming/flightrecorder.cpp \
+    streaming/sessionreport.cpp \
+    streaming/metricsserver.cpp \
     streaming/bandwidth.cpp \
     streaming/streamutils.cpp \
     backend/autoupdatechecker.cpp \
+    backend/backgroundfetcher.cpp \
     path.cpp \
+    asynclogger.cpp \
+    startupprofiler.cpp \
     settings/mappingmanager.cpp \
     gui/sdlgamepadkeynavigation.cpp \
+    streaming/video/decodeunitcapture.cpp \
     streaming/video/overlaymanager.cpp \
+    streaming/video/perfgraph.cpp \
     backend/systemproperties.cpp \
     wm.cpp
 
@@ -229,24 +258,46 @@ HEADERS += \
     backend/boxartmanager.h \
     backend/richpresencemanager.h \
     cli/commandlineparser.h \
+    cli/benchmarkaudio.h \
+    cli/benchmarklauncher.h \
     cli/listapps.h \
     cli/quitstream.h \
     cli/startstream.h \
     settings/streamingpreferences.h \
     streaming/input/input.h \
+    streaming/input/inputlatency.h \
+    streaming/input/relativemotion.h \
     streaming/session.h \
+    streaming/audio/downmix.h \
+    streaming/audio/renderers/pcmconvert.h \
+    streaming/audio/renderers/pcmring.h \
     streaming/audio/renderers/renderer.h \
     streaming/audio/renderers/sdl.h \
+    streaming/audio/renderers/sdlpull.h \
     gui/computermodel.h \
     gui/appmodel.h \
     streaming/video/decoder.h \
+    streaming/video/latencyhistogram.h \
+    streaming/avsync.h \
+    streaming/hostclock.h \
+    streaming/bitratecontroller.h \
+    streaming/decoderload.h \
+    streaming/launchtimeline.h \
+    streaming/flightrecorder.h \
+    streaming/sessionreport.h \
+    streaming/metricsserver.h \
     streaming/bandwidth.h \
     streaming/streamutils.h \
     backend/autoupdatechecker.h \
+    backend/backgroundfetcher.h \
     path.h \
+    asynclogger.h \
+    startupprofiler.h \
     settings/mappingmanager.h \
     gui/sdlgamepadkeynavigation.h \
+    streaming/video/decodeunitcapture.h \
     streaming/video/overlaymanager.h \
+    streaming/video/perfgraph.h \
     backend/systemproperties.h
 
 # Platform-specific renderers and decoders
@@ -256,20 +307,45 @@ ffmpeg {
     DEFINES += HAVE_FFMPEG
     SOURCES += \
         streaming/video/ffmpeg.cpp \
+        streaming/video/decoderprobecache.cpp \
+        streaming/video/rendererpreferencecache.cpp \
+        streaming/video/softwaredecodeprofile.cpp \
         streaming/video/ffmpeg-renderers/genhwaccel.cpp \
         streaming/video/ffmpeg-renderers/sdlvid.cpp \
         streaming/video/ffmpeg-renderers/swframemapper.cpp \
         streaming/video/ffmpeg-renderers/pacer/pacer.cpp \
-        streaming/video/videorecorder.cpp
+        streaming/video/videorecorder.cpp \
+        streaming/video/bitstreamrecorder.cpp \
+        streaming/video/recordingfilewriter.cpp \
+        streaming/video/metricssink.cpp \
+        streaming/video/frametracer.cpp \
+        streaming/video/framepool.cpp \
+        streaming/video/qualityanalyzer.cpp \
+        streaming/video/spsrewriter.cpp \
+        cli/benchmarkvideo.cpp \
+        cli/benchmarkrenderer.cpp
 
     HEADERS += \
+        cli/benchmarkvideo.h \
+        cli/benchmarkrenderer.h \
         streaming/video/ffmpeg.h \
+        streaming/video/decoderprobecache.h \
+        streaming/video/rendererpreferencecache.h \
+        streaming/video/softwaredecodeprofile.h \
         streaming/video/ffmpeg-renderers/renderer.h \
+        streaming/video/ffmpeg-renderers/cscconstants.h \
         streaming/video/ffmpeg-renderers/genhwaccel.h \
         streaming/video/ffmpeg-renderers/sdlvid.h \
         streaming/video/ffmpeg-renderers/swframemapper.h \
         streaming/video/ffmpeg-renderers/pacer/pacer.h \
-        streaming/video/videorecorder.h
+        streaming/video/videorecorder.h \
+        streaming/video/bitstreamrecorder.h \
+        streaming/video/recordingfilewriter.h \
+        streaming/video/metricssink.h \
+        streaming/video/frametracer.h \
+        streaming/video/framepool.h \
+        streaming/video/qualityanalyzer.h \
+        streaming/video/spsrewriter.h
 }
 libva {
     message(VAAPI renderer selected)
@@ -333,7 +409,10 @@ libdrm {
     linux {
         !disable-masterhooks {
             message(Master hooks enabled)
+            QT += gui-private
+            DEFINES += HAVE_MASTERHOOKS
             SOURCES += masterhook.c masterhook_internal.c
+            HEADERS += masterhook.h
             LIBS += -ldl -pthread
         }
     }
@@ -394,6 +473,13 @@ config_SL {
 win32 {
     HEADERS += streaming/video/ffmpeg-renderers/dxutil.h
 }
+win32:!winrt {
+    message(WASAPI audio renderer selected)
+
+    DEFINES += HAVE_WASAPI
+    SOURCES += streaming/audio/renderers/wasapiaud.cpp
+    HEADERS += streaming/audio/renderers/wasapi.h
+}
 win32:!winrt {
     message(DXVA2 and D3D11VA renderers selected)
 
@@ -407,13 +493,22 @@ win32:!winrt {
         streaming/video/ffmpeg-renderers/d3d11va.h \
         streaming/video/ffmpeg-renderers/pacer/dxvsyncsource.h
 }
+macx {
+    message(CoreAudio renderer selected)
+
+    DEFINES += HAVE_COREAUDIO
+    LIBS += -framework AudioToolbox -framework AudioUnit -framework CoreAudio
+    SOURCES += streaming/audio/renderers/coreaudioaud.cpp
+    HEADERS += streaming/audio/renderers/coreaudio.h
+}
 macx {
     message(VideoToolbox renderer selected)
 
     SOURCES += \
         streaming/video/ffmpeg-renderers/vt_base.mm \
         streaming/video/ffmpeg-renderers/vt_avsamplelayer.mm \
-        streaming/video/ffmpeg-renderers/vt_metal.mm
+        streaming/video/ffmpeg-renderers/vt_metal.mm \
+        streaming/video/ffmpeg-renderers/vt_decoder.mm
 
     HEADERS += \
         streaming/video/ffmpeg-renderers/vt.h
@@ -444,12 +539,48 @@ gpuslow {
 
     DEFINES += GL_IS_SLOW VULKAN_IS_SLOW
 }
+linux {
+    message(evdev mouse input enabled)
+
+    DEFINES += HAVE_EVDEV_MOUSE
+    SOURCES += streaming/input/evdevmouse.cpp
+    HEADERS += streaming/input/evdevmouse.h
+}
+pipewire {
+    message(PipeWire audio renderer selected)
+
+    DEFINES += HAVE_PIPEWIRE
+    SOURCES += streaming/audio/renderers/pipewireaud.cpp
+    HEADERS += streaming/audio/renderers/pipewire.h
+}
 wayland {
     message(Wayland extensions enabled)
 
     DEFINES += HAS_WAYLAND
     SOURCES += streaming/video/ffmpeg-renderers/pacer/waylandvsyncsource.cpp
     HEADERS += streaming/video/ffmpeg-renderers/pacer/waylandvsyncsource.h
+
+    # Presentation feedback gives WaylandVsyncSource real scanout timing
+    packagesExist(wayland-protocols):packagesExist(wayland-scanner) {
+        WAYLAND_PROTOCOLS_DIR = $$system(pkg-config --variable=pkgdatadir wayland-protocols)
+        WAYLAND_SCANNER = $$system(pkg-config --variable=wayland_scanner wayland-scanner)
+        WAYLAND_CLIENT_PROTOCOLS += $$WAYLAND_PROTOCOLS_DIR/stable/presentation-time/presentation-time.xml
+
+        wayland_client_header.input = WAYLAND_CLIENT_PROTOCOLS
+        wayland_client_header.output = ${QMAKE_FILE_BASE}-client-protocol.h
+        wayland_client_header.commands = $$WAYLAND_SCANNER client-header ${QMAKE_FILE_IN} ${QMAKE_FILE_OUT}
+        wayland_client_header.CONFIG += no_link target_predeps
+        wayland_client_header.variable_out = HEADERS
+
+        wayland_client_code.input = WAYLAND_CLIENT_PROTOCOLS
+        wayland_client_code.output = ${QMAKE_FILE_BASE}-protocol.c
+        wayland_client_code.commands = $$WAYLAND_SCANNER private-code ${QMAKE_FILE_IN} ${QMAKE_FILE_OUT}
+        wayland_client_code.depends = ${QMAKE_FILE_BASE}-client-protocol.h
+        wayland_client_code.variable_out = SOURCES
+
+        QMAKE_EXTRA_COMPILERS += wayland_client_header wayland_client_code
+        DEFINES += HAS_WP_PRESENTATION
+    }
 }
 
 RESOURCES += \
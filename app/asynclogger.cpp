@@ -0,0 +1,190 @@
+#include "asynclogger.h"
+#include "streaming/streamutils.h"
+
+#include <string.h>
+
+// Longer messages are truncated so one message can't take the whole ring
+#define MAX_SLOTS_PER_MESSAGE (ASYNC_LOGGER_SLOTS / 8)
+
+// The logger thread also wakes up periodically in case it missed a wakeup
+#define CONSUMER_WAKE_INTERVAL_MS 100
+
+static thread_local bool t_IsLoggerThread = false;
+
+AsyncLogger::AsyncLogger()
+    : m_WriteFunction(nullptr),
+      m_FlushFunction(nullptr),
+      m_DequeuePosition(0)
+{
+    SDL_AtomicSet(&m_EnqueuePosition, 0);
+    SDL_AtomicSet(&m_ConsumerSleeping, 0);
+    SDL_AtomicSet(&m_DroppedMessages, 0);
+    SDL_AtomicSet(&m_Stopping, 0);
+
+    // Each slot's sequence is its position when it's free for writing,
+    // and one past its position once the message in it is ready.
+    // Positions wrap, so they're only ever compared by difference.
+    for (int i = 0; i < ASYNC_LOGGER_SLOTS; i++) {
+        SDL_AtomicSet(&m_Slots[i].sequence, i);
+    }
+
+    m_Text.reserve(ASYNC_LOGGER_SLOT_TEXT_SIZE * MAX_SLOTS_PER_MESSAGE);
+}
+
+void AsyncLogger::start(WriteFunction writeFunction, FlushFunction flushFunction)
+{
+    m_WriteFunction = writeFunction;
+    m_FlushFunction = flushFunction;
+    QThread::start();
+}
+
+void AsyncLogger::stop()
+{
+    if (!isRunning()) {
+        return;
+    }
+
+    SDL_AtomicSet(&m_Stopping, 1);
+    m_WakeSemaphore.release();
+    wait();
+}
+
+void AsyncLogger::log(const Record& record, const char* text, int length)
+{
+    int slotCount = SDL_max(1, (length + ASYNC_LOGGER_SLOT_TEXT_SIZE - 1) / ASYNC_LOGGER_SLOT_TEXT_SIZE);
+    if (slotCount > MAX_SLOTS_PER_MESSAGE) {
+        slotCount = MAX_SLOTS_PER_MESSAGE;
+        length = slotCount * ASYNC_LOGGER_SLOT_TEXT_SIZE;
+    }
+
+    // Reserve all of the message's slots at once so they're consecutive
+    int position;
+    for (;;) {
+        position = SDL_AtomicGet(&m_EnqueuePosition);
+
+        bool full = false;
+        bool stale = false;
+        for (int i = 0; i < slotCount; i++) {
+            int expected = position + i;
+            int diff = SDL_AtomicGet(&getSlot(expected).sequence) - expected;
+            if (diff < 0) {
+                full = true;
+                break;
+            }
+            else if (diff > 0) {
+                stale = true;
+                break;
+            }
+        }
+
+        if (full) {
+            // The logger thread can't make room for itself
+            if (!t_IsLoggerThread) {
+                SDL_AtomicIncRef(&m_DroppedMessages);
+                if (SDL_AtomicSet(&m_ConsumerSleeping, 0)) {
+                    m_WakeSemaphore.release();
+                }
+            }
+            return;
+        }
+        else if (!stale && SDL_AtomicCAS(&m_EnqueuePosition, position, position + slotCount)) {
+            break;
+        }
+    }
+
+    for (int i = 0; i < slotCount; i++) {
+        Slot& slot = getSlot(position + i);
+        int offset = i * ASYNC_LOGGER_SLOT_TEXT_SIZE;
+
+        slot.record = record;
+        slot.continuationSlots = slotCount - i - 1;
+        slot.length = SDL_min(length - offset, ASYNC_LOGGER_SLOT_TEXT_SIZE);
+        memcpy(slot.text, text + offset, slot.length);
+    }
+
+    // Publish the continuation slots first, since the consumer starts from the first one
+    for (int i = slotCount - 1; i >= 0; i--) {
+        SDL_AtomicSet(&getSlot(position + i).sequence, position + i + 1);
+    }
+
+    // Only pay for a wakeup if the logger thread is waiting for work
+    if (SDL_AtomicSet(&m_ConsumerSleeping, 0)) {
+        m_WakeSemaphore.release();
+    }
+}
+
+AsyncLogger::Slot& AsyncLogger::getSlot(int position)
+{
+    return m_Slots[(unsigned int)position % ASYNC_LOGGER_SLOTS];
+}
+
+bool AsyncLogger::isMessagePending()
+{
+    return SDL_AtomicGet(&getSlot(m_DequeuePosition).sequence) == m_DequeuePosition + 1;
+}
+
+int AsyncLogger::drain()
+{
+    int messages = 0;
+
+    while (isMessagePending()) {
+        Slot& first = getSlot(m_DequeuePosition);
+        Record record = first.record;
+        int slotCount = first.continuationSlots + 1;
+
+        // The continuation slots are published before the first one
+        m_Text.clear();
+        for (int i = 0; i < slotCount; i++) {
+            Slot& slot = getSlot(m_DequeuePosition + i);
+            m_Text.append(slot.text, slot.length);
+        }
+
+        // Hand the slots back to the producers before formatting
+        for (int i = 0; i < slotCount; i++) {
+            SDL_AtomicSet(&getSlot(m_DequeuePosition + i).sequence, m_DequeuePosition + i + ASYNC_LOGGER_SLOTS);
+        }
+        m_DequeuePosition += slotCount;
+
+        m_WriteFunction(record, m_Text);
+        messages++;
+    }
+
+    int droppedMessages = SDL_AtomicSet(&m_DroppedMessages, 0);
+    if (droppedMessages > 0) {
+        Record record = {};
+        record.source = Raw;
+        record.level = "";
+
+        m_Text = QByteArray::number(droppedMessages) + " log messages were dropped because the log queue was full\n";
+        m_WriteFunction(record, m_Text);
+        messages++;
+    }
+
+    return messages;
+}
+
+void AsyncLogger::run()
+{
+    t_IsLoggerThread = true;
+
+    // Keep the logging thread off the cores that the stream is using
+    StreamUtils::placeCurrentThread(StreamUtils::TPC_BACKGROUND);
+
+    for (;;) {
+        if (drain() > 0) {
+            m_FlushFunction();
+            continue;
+        }
+
+        // Async logging is turned off before we're stopped, so nothing else is coming
+        if (SDL_AtomicGet(&m_Stopping)) {
+            break;
+        }
+
+        SDL_AtomicSet(&m_ConsumerSleeping, 1);
+        if (!isMessagePending()) {
+            m_WakeSemaphore.tryAcquire(1, CONSUMER_WAKE_INTERVAL_MS);
+        }
+        SDL_AtomicSet(&m_ConsumerSleeping, 0);
+    }
+}
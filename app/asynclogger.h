@@ -0,0 +1,86 @@
+#pragma once
+
+#include <QByteArray>
+#include <QSemaphore>
+#include <QThread>
+
+#include "SDL_compat.h"
+
+// Number of ring slots. Messages longer than one slot take several.
+#define ASYNC_LOGGER_SLOTS 1024
+#define ASYNC_LOGGER_SLOT_TEXT_SIZE 480
+
+// A bounded multi-producer, single-consumer ring of log messages. Logging
+// threads copy the raw message text into preallocated slots without taking
+// locks or allocating, and the logger thread formats and writes them in
+// batches, flushing once per batch rather than once per line.
+//
+// When the ring is full, messages are dropped rather than making the producer
+// wait, since producers include the real-time audio, decoder and pacer threads
+// and the logger thread may not get to run on their cores. The logger thread
+// reports how many were dropped once it catches up.
+class AsyncLogger : private QThread
+{
+public:
+    enum Source {
+        Raw,
+        Sdl,
+        Qt,
+        FFmpeg,
+    };
+
+    struct Record {
+        Source source;
+        int timeMs;
+        int category;
+
+        // Must be a string literal
+        const char* level;
+    };
+
+    // Called on the logger thread with each message, then once per batch to flush
+    typedef void (*WriteFunction)(const Record& record, const QByteArray& text);
+    typedef void (*FlushFunction)();
+
+    AsyncLogger();
+
+    void start(WriteFunction writeFunction, FlushFunction flushFunction);
+
+    // Writes any queued messages and stops the logger thread
+    void stop();
+
+    void log(const Record& record, const char* text, int length);
+
+private:
+    struct Slot {
+        SDL_atomic_t sequence;
+        Record record;
+
+        // The number of slots that follow with the rest of the text
+        int continuationSlots;
+        int length;
+        char text[ASYNC_LOGGER_SLOT_TEXT_SIZE];
+    };
+
+    void run() override;
+
+    Slot& getSlot(int position);
+
+    // Returns the number of messages written
+    int drain();
+
+    bool isMessagePending();
+
+    Slot m_Slots[ASYNC_LOGGER_SLOTS];
+    SDL_atomic_t m_EnqueuePosition;
+    WriteFunction m_WriteFunction;
+    FlushFunction m_FlushFunction;
+    QSemaphore m_WakeSemaphore;
+    SDL_atomic_t m_ConsumerSleeping;
+    SDL_atomic_t m_DroppedMessages;
+    SDL_atomic_t m_Stopping;
+
+    // Only touched by the logger thread
+    int m_DequeuePosition;
+    QByteArray m_Text;
+};
@@ -1,7 +1,7 @@
 #pragma once
 
 #include <QObject>
-#include <QNetworkAccessManager>
+#include <QVector>
 
 class AutoUpdateChecker : public QObject
 {
@@ -14,10 +14,9 @@ public:
 signals:
     void onUpdateAvailable(QString newVersion, QString url);
 
-private slots:
-    void handleUpdateCheckRequestFinished(QNetworkReply* reply);
-
 private:
+    void handleUpdateManifestFetched(const QByteArray& data);
+
     void parseStringToVersionQuad(QString& string, QVector<int>& version);
 
     int compareVersion(QVector<int>& version1, QVector<int>& version2);
@@ -25,5 +24,4 @@ private:
     QString getPlatform();
 
     QVector<int> m_CurrentVersionQuad;
-    QNetworkAccessManager* m_Nam;
 };
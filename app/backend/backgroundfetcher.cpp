@@ -0,0 +1,174 @@
+#include "backgroundfetcher.h"
+#include "path.h"
+
+#include <QDateTime>
+#include <QNetworkReply>
+#include <QSettings>
+#include <QTimer>
+#include <QtDebug>
+
+#define SER_FETCHCACHE "backgroundfetch"
+#define SER_ETAG "etag"
+#define SER_LASTMODIFIED "lastmodified"
+#define SER_CHECKEDTIME "checked"
+
+BackgroundFetcher* BackgroundFetcher::get()
+{
+    static BackgroundFetcher* s_Fetcher = new BackgroundFetcher();
+    return s_Fetcher;
+}
+
+BackgroundFetcher::BackgroundFetcher(QObject *parent) :
+    QObject(parent),
+    m_Nam(nullptr),
+    m_RequestPending(false)
+{
+}
+
+void BackgroundFetcher::fetch(const QString& cacheFileName, const QUrl& url, int maxAgeSecs,
+                              QObject* receiver, Callback callback)
+{
+    FetchRequest request = { cacheFileName, url, receiver, callback };
+
+    // Our validators are only useful if we still have the data they describe
+    QSettings settings;
+    settings.beginGroup(SER_FETCHCACHE);
+    settings.beginGroup(cacheFileName);
+    if (Path::getCacheFileInfo(cacheFileName).size() > 0) {
+        qint64 checkedTime = settings.value(SER_CHECKEDTIME, 0).toLongLong();
+        qint64 ageSecs = (QDateTime::currentMSecsSinceEpoch() - checkedTime) / 1000;
+        if (ageSecs >= 0 && ageSecs < maxAgeSecs) {
+            qInfo() << "Using cached" << cacheFileName << "from" << ageSecs << "seconds ago";
+
+            // Keep the callback asynchronous like a real fetch
+            QTimer::singleShot(0, this, [this, request]() {
+                complete(request, Path::readCacheFile(request.cacheFileName), false);
+            });
+            return;
+        }
+    }
+    else {
+        settings.remove("");
+    }
+
+    m_Queue.enqueue(request);
+    if (!m_RequestPending) {
+        startNextRequest();
+    }
+}
+
+void BackgroundFetcher::startNextRequest()
+{
+    if (m_Queue.isEmpty()) {
+        // Delete the QNetworkAccessManager to free resources and
+        // prevent the bearer plugin from polling in the background.
+        if (m_Nam != nullptr) {
+            m_Nam->deleteLater();
+            m_Nam = nullptr;
+        }
+        return;
+    }
+
+    if (m_Nam == nullptr) {
+        m_Nam = new QNetworkAccessManager(this);
+
+        // Never communicate over HTTP
+        m_Nam->setStrictTransportSecurityEnabled(true);
+
+        // Allow HTTP redirects
+        m_Nam->setRedirectPolicy(QNetworkRequest::NoLessSafeRedirectPolicy);
+
+        connect(m_Nam, &QNetworkAccessManager::finished,
+                this, &BackgroundFetcher::handleRequestFinished);
+
+#if QT_VERSION >= QT_VERSION_CHECK(5, 14, 0) && QT_VERSION < QT_VERSION_CHECK(5, 15, 1) && !defined(QT_NO_BEARERMANAGEMENT)
+        // HACK: Set network accessibility to work around QTBUG-80947 (introduced in Qt 5.14.0 and fixed in Qt 5.15.1)
+        QT_WARNING_PUSH
+        QT_WARNING_DISABLE_DEPRECATED
+        m_Nam->setNetworkAccessible(QNetworkAccessManager::Accessible);
+        QT_WARNING_POP
+#endif
+    }
+
+    const FetchRequest& fetchRequest = m_Queue.head();
+    QNetworkRequest request(fetchRequest.url);
+
+#if QT_VERSION >= QT_VERSION_CHECK(5, 15, 0)
+    request.setAttribute(QNetworkRequest::Http2AllowedAttribute, true);
+#else
+    request.setAttribute(QNetworkRequest::HTTP2AllowedAttribute, true);
+#endif
+
+    // Nothing waits on these, so let anything else on the connection go first
+    request.setPriority(QNetworkRequest::LowPriority);
+
+    // Send the validators back exactly as the server gave them to us, so
+    // we don't depend on QNetworkRequest::IfModifiedSinceHeader (Qt 5.12+)
+    QSettings settings;
+    settings.beginGroup(SER_FETCHCACHE);
+    settings.beginGroup(fetchRequest.cacheFileName);
+    QByteArray etag = settings.value(SER_ETAG).toByteArray();
+    QByteArray lastModified = settings.value(SER_LASTMODIFIED).toByteArray();
+    if (!etag.isEmpty()) {
+        request.setRawHeader("If-None-Match", etag);
+    }
+    if (!lastModified.isEmpty()) {
+        request.setRawHeader("If-Modified-Since", lastModified);
+    }
+
+    // We'll get a callback when this is finished
+    m_Nam->get(request);
+    m_RequestPending = true;
+}
+
+void BackgroundFetcher::handleRequestFinished(QNetworkReply* reply)
+{
+    Q_ASSERT(reply->isFinished());
+    Q_ASSERT(!m_Queue.isEmpty());
+
+    // Queue the reply for deletion
+    reply->deleteLater();
+
+    FetchRequest request = m_Queue.dequeue();
+    m_RequestPending = false;
+
+    QSettings settings;
+    settings.beginGroup(SER_FETCHCACHE);
+    settings.beginGroup(request.cacheFileName);
+
+    if (reply->error() != QNetworkReply::NoError) {
+        qWarning() << "Failed to download" << request.url.toString() << ":" << reply->error();
+
+        // Retry next time, but fall back on whatever we have for now
+        complete(request, Path::readCacheFile(request.cacheFileName), false);
+    }
+    // If we get a 304 back, Qt will happily just tell us our request was
+    // successful and give us an empty response. Check the status code
+    // directly to prevent this.
+    else if (reply->attribute(QNetworkRequest::HttpStatusCodeAttribute) == 304) {
+        settings.setValue(SER_CHECKEDTIME, QDateTime::currentMSecsSinceEpoch());
+        complete(request, Path::readCacheFile(request.cacheFileName), false);
+    }
+    else {
+        QByteArray data = reply->readAll();
+        if (!data.isEmpty()) {
+            Path::writeCacheFile(request.cacheFileName, data);
+            settings.setValue(SER_ETAG, reply->rawHeader("ETag"));
+            settings.setValue(SER_LASTMODIFIED, reply->rawHeader("Last-Modified"));
+            settings.setValue(SER_CHECKEDTIME, QDateTime::currentMSecsSinceEpoch());
+        }
+
+        complete(request, data, true);
+    }
+
+    startNextRequest();
+}
+
+void BackgroundFetcher::complete(const FetchRequest& request, const QByteArray& data, bool updated)
+{
+    if (request.receiver.isNull() || data.isEmpty()) {
+        return;
+    }
+
+    request.callback(data, updated);
+}
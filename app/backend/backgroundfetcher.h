@@ -0,0 +1,58 @@
+#pragma once
+
+#include <QObject>
+#include <QNetworkAccessManager>
+#include <QPointer>
+#include <QQueue>
+#include <QUrl>
+
+#include <functional>
+
+// Downloads the small files we refresh from moonlight-stream.org (compatibility
+// data, gamepad mappings and the update manifest) for the rest of the app.
+//
+// Each response is saved in the cache directory along with its ETag and
+// Last-Modified headers. A fetch is answered from the cache without touching
+// the network while the cached copy is younger than the caller's maximum age,
+// and revalidated with If-None-Match/If-Modified-Since after that. Requests
+// that do go out are sent one at a time at low priority over a single
+// QNetworkAccessManager, which is freed again once the queue is empty.
+class BackgroundFetcher : public QObject
+{
+    Q_OBJECT
+
+public:
+    // Called on the main thread with the latest data we have. updated is true
+    // if it was just downloaded, or false if it came from the cache because
+    // it was still fresh, unchanged on the server, or couldn't be downloaded.
+    typedef std::function<void(const QByteArray& data, bool updated)> Callback;
+
+    static BackgroundFetcher* get();
+
+    // Fetches url into cacheFileName unless the cached copy is less than
+    // maxAgeSecs old. The callback is skipped if receiver is destroyed first
+    // or if there's no data at all.
+    void fetch(const QString& cacheFileName, const QUrl& url, int maxAgeSecs,
+               QObject* receiver, Callback callback);
+
+private slots:
+    void handleRequestFinished(QNetworkReply* reply);
+
+private:
+    struct FetchRequest {
+        QString cacheFileName;
+        QUrl url;
+        QPointer<QObject> receiver;
+        Callback callback;
+    };
+
+    explicit BackgroundFetcher(QObject *parent = nullptr);
+
+    void startNextRequest();
+
+    void complete(const FetchRequest& request, const QByteArray& data, bool updated);
+
+    QQueue<FetchRequest> m_Queue;
+    QNetworkAccessManager* m_Nam;
+    bool m_RequestPending;
+};
@@ -1,9 +1,37 @@
 #include "boxartmanager.h"
 #include "../path.h"
+#include "../streaming/streamutils.h"
 
 #include <QImageReader>
 #include <QImageWriter>
 
+// Box art is drawn at 200x267 in the app grid, so keep enough pixels for 2x displays
+#define BOX_ART_MAX_WIDTH 400
+#define BOX_ART_MAX_HEIGHT 534
+
+// Budget for decoded box art kept in memory, in KB
+#define IMAGE_CACHE_SIZE_KB (64 * 1024)
+
+// Enough for a couple of screens of the app grid in low memory mode
+#define LOW_MEMORY_IMAGE_CACHE_SIZE_KB (8 * 1024)
+
+QMutex BoxArtManager::s_ImageCacheLock;
+QCache<QString, QImage> BoxArtManager::s_ImageCache(IMAGE_CACHE_SIZE_KB);
+
+static int getImageCost(const QImage& image)
+{
+    return qMax(1, image.bytesPerLine() * image.height() / 1024);
+}
+
+static bool isPlaceholderSize(const QSize& size)
+{
+    // AppView.qml recognizes the placeholder images by these sizes,
+    // so they must be stored as-is.
+    return size == QSize(130, 180) || // GFE 2.0 placeholder image
+           size == QSize(628, 888) || // GFE 3.0 placeholder image
+           size == QSize(200, 266);   // Our no_app_image.png
+}
+
 BoxArtManager::BoxArtManager(QObject *parent) :
     QObject(parent),
     m_BoxArtDir(Path::getBoxArtCacheDir()),
@@ -17,6 +45,19 @@ BoxArtManager::BoxArtManager(QObject *parent) :
     if (!m_BoxArtDir.exists()) {
         m_BoxArtDir.mkpath(".");
     }
+
+    // Images are reloaded from the disk cache when evicted, so on low memory
+    // devices it's better to keep fewer of them decoded
+    QMutexLocker locker(&s_ImageCacheLock);
+    s_ImageCache.setMaxCost(StreamingPreferences::get()->lowMemoryMode ?
+                                LOW_MEMORY_IMAGE_CACHE_SIZE_KB : IMAGE_CACHE_SIZE_KB);
+}
+
+void BoxArtManager::getImageCacheUsage(int* usedKb, int* budgetKb)
+{
+    QMutexLocker locker(&s_ImageCacheLock);
+    *usedKb = s_ImageCache.totalCost();
+    *budgetKb = s_ImageCache.maxCost();
 }
 
 QString
@@ -36,15 +77,48 @@ BoxArtManager::getFilePathForBoxArt(NvComputer* computer, int appId)
     return dir.filePath(QString::number(appId) + ".png");
 }
 
+QString
+BoxArtManager::getImageId(NvComputer* computer, int appId)
+{
+    // This is also the path of the cached file relative to the cache directory
+    return computer->uuid + "/" + QString::number(appId);
+}
+
+QSet<int>&
+BoxArtManager::getCachedAppIds(NvComputer* computer)
+{
+    auto it = m_CachedAppIds.find(computer->uuid);
+    if (it == m_CachedAppIds.end()) {
+        QSet<int> appIds;
+
+        // List the directory once rather than checking for each file as
+        // the grid asks for it
+        QDir dir = m_BoxArtDir;
+        if (dir.cd(computer->uuid)) {
+            for (const QFileInfo& fileInfo : dir.entryInfoList(QStringList() << "*.png", QDir::Files)) {
+                bool ok;
+                int appId = fileInfo.completeBaseName().toInt(&ok);
+                if (ok && fileInfo.size() > 0) {
+                    appIds.insert(appId);
+                }
+            }
+        }
+
+        it = m_CachedAppIds.insert(computer->uuid, appIds);
+    }
+
+    return it.value();
+}
+
 class NetworkBoxArtLoadTask : public QObject, public QRunnable
 {
     Q_OBJECT
 
 public:
-    NetworkBoxArtLoadTask(BoxArtManager* boxArtManager, NvComputer* computer, NvApp& app)
+    NetworkBoxArtLoadTask(BoxArtManager* boxArtManager, NvComputer* computer, const QVector<NvApp>& apps)
         : m_Bam(boxArtManager),
           m_Computer(computer),
-          m_App(app)
+          m_Apps(apps)
     {
         connect(this, &NetworkBoxArtLoadTask::boxArtFetchCompleted,
                 boxArtManager, &BoxArtManager::handleBoxArtLoadComplete);
@@ -56,37 +130,93 @@ signals:
 private:
     void run()
     {
-        QUrl image = m_Bam->loadBoxArtFromNetwork(m_Computer, m_App.id);
-        if (image.isEmpty()) {
-            // Give it another shot if it fails once
-            image = m_Bam->loadBoxArtFromNetwork(m_Computer, m_App.id);
+        StreamUtils::placeCurrentThread(StreamUtils::TPC_BACKGROUND);
+
+        // Reuse one QNetworkAccessManager for the whole batch
+        QNetworkAccessManager nam;
+
+        for (const NvApp& app : m_Apps) {
+            QUrl image = m_Bam->loadBoxArtFromNetwork(&nam, m_Computer, app.id);
+            if (image.isEmpty()) {
+                // Give it another shot if it fails once
+                image = m_Bam->loadBoxArtFromNetwork(&nam, m_Computer, app.id);
+            }
+            emit boxArtFetchCompleted(m_Computer, app, image);
         }
-        emit boxArtFetchCompleted(m_Computer, m_App, image);
     }
 
     BoxArtManager* m_Bam;
     NvComputer* m_Computer;
-    NvApp m_App;
+    QVector<NvApp> m_Apps;
 };
 
 QUrl BoxArtManager::loadBoxArt(NvComputer* computer, NvApp& app)
 {
-    // Try to open the cached file if it exists and contains data
-    QFile cacheFile(getFilePathForBoxArt(computer, app.id));
-    if (cacheFile.exists() && cacheFile.size() > 0) {
-        return QUrl::fromLocalFile(cacheFile.fileName());
+    // Use the cached file if it exists and contains data
+    if (getCachedAppIds(computer).contains(app.id)) {
+        return QUrl("image://boxart/" + getImageId(computer, app.id));
     }
 
     // If we get here, we need to fetch asynchronously.
     // Kick off a worker on our thread pool to do just that.
-    NetworkBoxArtLoadTask* netLoadTask = new NetworkBoxArtLoadTask(this, computer, app);
-    m_ThreadPool.start(netLoadTask);
+    startNetworkLoads(computer, QVector<NvApp>() << app);
 
     // Return the placeholder then we can notify the caller
     // later when the real image is ready.
     return QUrl("qrc:/res/no_app_image.png");
 }
 
+void BoxArtManager::prefetchBoxArt(NvComputer* computer, const QVector<NvApp>& apps)
+{
+    QSet<int>& cachedAppIds = getCachedAppIds(computer);
+    QVector<NvApp> missingApps;
+
+    for (const NvApp& app : apps) {
+        if (!cachedAppIds.contains(app.id)) {
+            missingApps.append(app);
+        }
+    }
+
+    if (!missingApps.isEmpty()) {
+        qInfo() << "Prefetching box art for" << missingApps.count() << "apps on" << computer->name;
+        startNetworkLoads(computer, missingApps);
+    }
+}
+
+void BoxArtManager::startNetworkLoads(NvComputer* computer, const QVector<NvApp>& apps)
+{
+    // The grid asks for the same box art repeatedly while it's loading
+    QVector<NvApp> neededApps;
+    for (const NvApp& app : apps) {
+        QString imageId = getImageId(computer, app.id);
+        if (!m_PendingLoads.contains(imageId)) {
+            m_PendingLoads.insert(imageId);
+            neededApps.append(app);
+        }
+    }
+
+    // Split the work into one batch per pool thread. The apps are dealt out
+    // in order, so the ones at the top of the grid come back first.
+    int batchCount = qMin(neededApps.count(), m_ThreadPool.maxThreadCount());
+    for (int i = 0; i < batchCount; i++) {
+        QVector<NvApp> batch;
+        for (int j = i; j < neededApps.count(); j += batchCount) {
+            batch.append(neededApps[j]);
+        }
+        m_ThreadPool.start(new NetworkBoxArtLoadTask(this, computer, batch));
+    }
+}
+
+QUrl BoxArtManager::getFileUrl(QUrl boxArtUrl)
+{
+    if (boxArtUrl.scheme() != "image") {
+        return boxArtUrl;
+    }
+
+    // image://boxart/<uuid>/<app id> is <uuid>/<app id>.png in the cache directory
+    return QUrl::fromLocalFile(QDir(Path::getBoxArtCacheDir()).filePath(boxArtUrl.path().mid(1) + ".png"));
+}
+
 void BoxArtManager::deleteBoxArt(NvComputer* computer)
 {
     QDir dir(Path::getBoxArtCacheDir());
@@ -95,18 +225,29 @@ void BoxArtManager::deleteBoxArt(NvComputer* computer)
     if (dir.cd(computer->uuid)) {
         dir.removeRecursively();
     }
+
+    // Drop any decoded images for this computer too
+    QMutexLocker locker(&s_ImageCacheLock);
+    for (const QString& imageId : s_ImageCache.keys()) {
+        if (imageId.startsWith(computer->uuid + "/")) {
+            s_ImageCache.remove(imageId);
+        }
+    }
 }
 
 void BoxArtManager::handleBoxArtLoadComplete(NvComputer* computer, NvApp app, QUrl image)
 {
+    m_PendingLoads.remove(getImageId(computer, app.id));
+
     if (!image.isEmpty()) {
+        getCachedAppIds(computer).insert(app.id);
         emit boxArtLoadComplete(computer, app, image);
     }
 }
 
-QUrl BoxArtManager::loadBoxArtFromNetwork(NvComputer* computer, int appId)
+QUrl BoxArtManager::loadBoxArtFromNetwork(QNetworkAccessManager* nam, NvComputer* computer, int appId)
 {
-    NvHTTP http(computer);
+    NvHTTP http(computer, nam);
 
     QString cachePath = getFilePathForBoxArt(computer, appId);
     QImage image;
@@ -116,8 +257,21 @@ QUrl BoxArtManager::loadBoxArtFromNetwork(NvComputer* computer, int appId)
 
     // Cache the box art on disk if it loaded
     if (!image.isNull()) {
+        // Store it at the size the grid draws it, so we decode fewer pixels later
+        if (!isPlaceholderSize(image.size()) &&
+                (image.width() > BOX_ART_MAX_WIDTH || image.height() > BOX_ART_MAX_HEIGHT)) {
+            image = image.scaled(BOX_ART_MAX_WIDTH, BOX_ART_MAX_HEIGHT, Qt::KeepAspectRatio, Qt::SmoothTransformation);
+        }
+
         if (image.save(cachePath)) {
-            return QUrl::fromLocalFile(cachePath);
+            QString imageId = getImageId(computer, appId);
+
+            {
+                QMutexLocker locker(&s_ImageCacheLock);
+                s_ImageCache.insert(imageId, new QImage(image), getImageCost(image));
+            }
+
+            return QUrl("image://boxart/" + imageId);
         }
         else {
             // A failed save() may leave a zero byte file. Make sure that's removed.
@@ -128,4 +282,42 @@ QUrl BoxArtManager::loadBoxArtFromNetwork(NvComputer* computer, int appId)
     return QUrl();
 }
 
+BoxArtImageProvider::BoxArtImageProvider()
+    : QQuickImageProvider(QQuickImageProvider::Image,
+                          QQuickImageProvider::ForceAsynchronousImageLoading)
+{
+
+}
+
+QImage BoxArtImageProvider::requestImage(const QString& id, QSize* size, const QSize& requestedSize)
+{
+    QImage image;
+
+    {
+        QMutexLocker locker(&BoxArtManager::s_ImageCacheLock);
+        QImage* cachedImage = BoxArtManager::s_ImageCache.object(id);
+        if (cachedImage != nullptr) {
+            image = *cachedImage;
+        }
+    }
+
+    if (image.isNull()) {
+        image = QImageReader(QDir(Path::getBoxArtCacheDir()).filePath(id + ".png")).read();
+        if (!image.isNull()) {
+            QMutexLocker locker(&BoxArtManager::s_ImageCacheLock);
+            BoxArtManager::s_ImageCache.insert(id, new QImage(image), getImageCost(image));
+        }
+    }
+
+    if (size != nullptr) {
+        *size = image.size();
+    }
+
+    if (!image.isNull() && requestedSize.isValid()) {
+        image = image.scaled(requestedSize, Qt::KeepAspectRatio, Qt::SmoothTransformation);
+    }
+
+    return image;
+}
+
 #include "boxartmanager.moc"
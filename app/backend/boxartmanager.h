@@ -5,12 +5,16 @@
 #include <QImage>
 #include <QThreadPool>
 #include <QRunnable>
+#include <QCache>
+#include <QSet>
+#include <QQuickImageProvider>
 
 class BoxArtManager : public QObject
 {
     Q_OBJECT
 
     friend class NetworkBoxArtLoadTask;
+    friend class BoxArtImageProvider;
 
 public:
     explicit BoxArtManager(QObject *parent = nullptr);
@@ -18,10 +22,25 @@ public:
     QUrl
     loadBoxArt(NvComputer* computer, NvApp& app);
 
+    // Fetches box art we don't have cached yet for all of these apps in the
+    // background, so it's ready before the grid scrolls to them
+    void
+    prefetchBoxArt(NvComputer* computer, const QVector<NvApp>& apps);
+
     static
     void
     deleteBoxArt(NvComputer* computer);
 
+    // Reports the size of decoded box art held in memory and its budget
+    static
+    void
+    getImageCacheUsage(int* usedKb, int* budgetKb);
+
+    // Converts a URL from loadBoxArt() into one that works outside of QML
+    static
+    QUrl
+    getFileUrl(QUrl boxArtUrl);
+
 signals:
     void
     boxArtLoadComplete(NvComputer* computer, NvApp app, QUrl image);
@@ -34,11 +53,40 @@ private slots:
 
 private:
     QUrl
-    loadBoxArtFromNetwork(NvComputer* computer, int appId);
+    loadBoxArtFromNetwork(QNetworkAccessManager* nam, NvComputer* computer, int appId);
 
     QString
     getFilePathForBoxArt(NvComputer* computer, int appId);
 
+    static
+    QString
+    getImageId(NvComputer* computer, int appId);
+
+    // Lists the box art that's on disk for this computer the first time it's needed
+    QSet<int>&
+    getCachedAppIds(NvComputer* computer);
+
+    void
+    startNetworkLoads(NvComputer* computer, const QVector<NvApp>& apps);
+
     QDir m_BoxArtDir;
     QThreadPool m_ThreadPool;
+
+    // Only touched on the main thread
+    QHash<QString, QSet<int>> m_CachedAppIds;
+    QSet<QString> m_PendingLoads;
+
+    // Decoded images shared by all instances and the image provider
+    static QMutex s_ImageCacheLock;
+    static QCache<QString, QImage> s_ImageCache;
+};
+
+// Serves image://boxart/<uuid>/<app id> from the decoded image cache,
+// reading from the disk cache on a QML loader thread on a miss.
+class BoxArtImageProvider : public QQuickImageProvider
+{
+public:
+    BoxArtImageProvider();
+
+    QImage requestImage(const QString& id, QSize* size, const QSize& requestedSize) override;
 };
@@ -2,196 +2,579 @@
 #include "boxartmanager.h"
 #include "nvhttp.h"
 #include "nvpairingmanager.h"
+#include "../path.h"
+#include "../startupprofiler.h"
+#include "../streaming/streamutils.h"
 
 #include <Limelight.h>
 #include <QtEndian>
 
 #include <QThread>
 #include <QThreadPool>
+#include <QEventLoop>
+#include <QTcpSocket>
+#include <QNetworkProxy>
 #include <QCoreApplication>
 #include <QRandomGenerator>
+#include <QCryptographicHash>
+
+#include <algorithm>
+#include <climits>
+#include <functional>
 
 #define SER_HOSTS "hosts"
 #define SER_HOSTS_BACKUP "hostsbackup"
+// This lives inside the host array group, so anything that rewrites the
+// array without knowing about the cache (like an older version) invalidates it.
+#define SER_HOSTCACHEGEN SER_HOSTS "/cachegen"
 
-class PcMonitorThread : public QThread
-{
-    Q_OBJECT
+#define SER_MDNSCACHE "mdnscache"
+#define SER_MDNSHOSTNAME "hostname"
+#define SER_MDNSADDRESSES "addresses"
+
+#define HOST_CACHE_FILE "hosts.bin"
+#define HOST_CACHE_MAGIC 0x4D4C4843 // "MLHC"
+#define HOST_CACHE_VERSION 1
+
+// How long to wait for more host changes before writing them out
+#define HOSTS_FLUSH_DELAY_MS 1000
 
 #define TRIES_BEFORE_OFFLINING 2
 #define POLLS_PER_APPLIST_FETCH 10
 
-public:
-    PcMonitorThread(NvComputer* computer)
-        : m_Computer(computer)
-    {
-        setObjectName("Polling thread for " + computer->name);
+#define POLL_INTERVAL_MS 3000
+#define MAX_OFFLINE_BACKOFF_MS 60000
+#define DEFAULT_POLL_CONCURRENCY 4
+
+#define PROBE_STAGGER_MS 250
+#define PROBE_TIMEOUT_MS 2000
+
+ComputerPollingScheduler::ComputerPollingScheduler()
+    : m_Concurrency(DEFAULT_POLL_CONCURRENCY),
+      m_Stopping(false)
+{
+    bool ok;
+    int concurrency = qEnvironmentVariableIntValue("ML_POLL_CONCURRENCY", &ok);
+    if (ok && concurrency > 0) {
+        m_Concurrency = concurrency;
     }
 
-private:
-    bool tryPollComputer(QNetworkAccessManager* nam, NvAddress address, bool& changed)
-    {
-        NvHTTP http(address, 0, m_Computer->serverCert, nam);
+    m_Clock.start();
+}
 
-        QString serverInfo;
-        try {
-            serverInfo = http.getServerInfo(NvHTTP::NvLogLevel::NVLL_NONE, true);
-        } catch (...) {
-            return false;
+ComputerPollingScheduler::~ComputerPollingScheduler()
+{
+    interrupt();
+
+    for (PollingWorkerThread* worker : m_Workers) {
+        worker->wait();
+        delete worker;
+    }
+
+    for (Entry* entry : m_Entries) {
+        delete entry;
+    }
+}
+
+void ComputerPollingScheduler::startWorkers()
+{
+    // Workers are started on demand and then stay around until we're
+    // destroyed. They sleep on m_Condition while there's nothing to poll.
+    if (!m_Workers.isEmpty() || m_Stopping) {
+        return;
+    }
+
+    qInfo() << "Starting" << m_Concurrency << "polling workers";
+
+    for (int i = 0; i < m_Concurrency; i++) {
+        PollingWorkerThread* worker = new PollingWorkerThread(this, i);
+        m_Workers.append(worker);
+        worker->start();
+    }
+}
+
+void ComputerPollingScheduler::startPolling(NvComputer* computer)
+{
+    QMutexLocker locker(&m_Mutex);
+
+    Entry* entry = m_Entries.value(computer->uuid);
+    if (entry == nullptr) {
+        entry = new Entry();
+        entry->computer = computer;
+        entry->busy = false;
+
+        // Always fetch the applist the first time
+        entry->pollsSinceLastAppListFetch = POLLS_PER_APPLIST_FETCH;
+        m_Entries[computer->uuid] = entry;
+    }
+
+    entry->active = true;
+    entry->pollRequested = true;
+    entry->nextPollTime = 0;
+    entry->backoffMs = POLL_INTERVAL_MS;
+
+    startWorkers();
+    m_Condition.wakeAll();
+}
+
+void ComputerPollingScheduler::stopPollingAsync()
+{
+    QMutexLocker locker(&m_Mutex);
+
+    // Polls in progress will finish, but nothing new will be scheduled
+    for (Entry* entry : m_Entries) {
+        entry->active = false;
+        entry->pollRequested = false;
+    }
+}
+
+void ComputerPollingScheduler::pollNow(NvComputer* computer)
+{
+    QMutexLocker locker(&m_Mutex);
+
+    Entry* entry = m_Entries.value(computer->uuid);
+    if (entry == nullptr || !entry->active) {
+        return;
+    }
+
+    // If a poll is already running, this schedules another right after it
+    entry->pollRequested = true;
+    entry->nextPollTime = 0;
+    entry->backoffMs = POLL_INTERVAL_MS;
+    m_Condition.wakeAll();
+}
+
+void ComputerPollingScheduler::removeComputer(NvComputer* computer)
+{
+    QMutexLocker locker(&m_Mutex);
+
+    Entry* entry = m_Entries.value(computer->uuid);
+    if (entry == nullptr) {
+        return;
+    }
+
+    entry->active = false;
+    while (entry->busy) {
+        m_Condition.wait(&m_Mutex);
+    }
+
+    m_Entries.remove(computer->uuid);
+    delete entry;
+}
+
+void ComputerPollingScheduler::interrupt()
+{
+    QMutexLocker locker(&m_Mutex);
+
+    m_Stopping = true;
+    m_Condition.wakeAll();
+}
+
+ComputerPollingScheduler::Entry* ComputerPollingScheduler::waitForDueEntry()
+{
+    while (!m_Stopping) {
+        qint64 now = m_Clock.elapsed();
+        Entry* nextEntry = nullptr;
+
+        // Take the host that has been waiting the longest. Hosts that were
+        // just discovered or that the user acted on are due right away.
+        for (Entry* entry : m_Entries) {
+            if (!entry->active || entry->busy) {
+                continue;
+            }
+
+            if (nextEntry == nullptr || entry->nextPollTime < nextEntry->nextPollTime) {
+                nextEntry = entry;
+            }
         }
 
-        NvComputer newState(http, serverInfo);
+        if (nextEntry == nullptr) {
+            m_Condition.wait(&m_Mutex);
+        }
+        else if (nextEntry->nextPollTime > now) {
+            m_Condition.wait(&m_Mutex, (unsigned long)(nextEntry->nextPollTime - now));
+        }
+        else {
+            return nextEntry;
+        }
+    }
 
-        // Ensure the machine that responded is the one we intended to contact
-        if (m_Computer->uuid != newState.uuid) {
-            qInfo() << "Found unexpected PC" << newState.name << "looking for" << m_Computer->name;
-            return false;
+    return nullptr;
+}
+
+bool ComputerPollingScheduler::isPollCancelled(Entry* entry)
+{
+    QMutexLocker locker(&m_Mutex);
+    return m_Stopping || !entry->active;
+}
+
+QVector<NvAddress> ComputerPollingScheduler::probeAddresses(Entry* entry, const QVector<NvAddress>& addresses)
+{
+    // Try the addresses that answered quickest last time first, then the ones
+    // we haven't measured (in their normal order), then the ones that failed.
+    QVector<NvAddress> ranked = addresses;
+    auto rank = [entry](const NvAddress& address) {
+        int rttMs = entry->addressRttMs.value(address.toString(), INT_MAX - 1);
+        return rttMs < 0 ? INT_MAX : rttMs;
+    };
+    std::stable_sort(ranked.begin(), ranked.end(), [&rank](const NvAddress& a, const NvAddress& b) {
+        return rank(a) < rank(b);
+    });
+
+    // Forget addresses the host doesn't have anymore
+    QMutableHashIterator<QString, int> i(entry->addressRttMs);
+    while (i.hasNext()) {
+        i.next();
+        if (std::none_of(ranked.begin(), ranked.end(), [&i](const NvAddress& a) { return a.toString() == i.key(); })) {
+            i.remove();
+        }
+    }
+
+    QEventLoop loop;
+    QElapsedTimer timer;
+    QVector<QTcpSocket*> sockets;
+    QVector<qint64> startTimes;
+    int winner = -1;
+    int failed = 0;
+
+    timer.start();
+
+    // Start the next connection attempt. This happens on a timer, or right
+    // away when the previous attempt fails.
+    std::function<void()> startNext = [&]() {
+        if (winner >= 0 || sockets.size() >= ranked.size()) {
+            return;
         }
 
-        changed = m_Computer->update(newState);
+        int index = sockets.size();
+        QTcpSocket* socket = new QTcpSocket();
+        socket->setProxy(QNetworkProxy::NoProxy);
+        sockets.append(socket);
+        startTimes.append(timer.elapsed());
+
+        connect(socket, &QTcpSocket::connected, &loop, [&, index]() {
+            if (winner < 0) {
+                winner = index;
+
+                int rttMs = (int)(timer.elapsed() - startTimes[index]);
+                int oldRttMs = entry->addressRttMs.value(ranked[index].toString(), -1);
+                entry->addressRttMs[ranked[index].toString()] = oldRttMs < 0 ? rttMs : (oldRttMs * 3 + rttMs) / 4;
+            }
+            loop.quit();
+        });
+#if QT_VERSION >= QT_VERSION_CHECK(5, 15, 0)
+        connect(socket, &QTcpSocket::errorOccurred, &loop, [&, index](QAbstractSocket::SocketError) {
+#else
+        connect(socket, QOverload<QAbstractSocket::SocketError>::of(&QAbstractSocket::error), &loop, [&, index](QAbstractSocket::SocketError) {
+#endif
+            if (winner >= 0) {
+                return;
+            }
+
+            entry->addressRttMs[ranked[index].toString()] = -1;
+            if (++failed == ranked.size()) {
+                loop.quit();
+            }
+            else {
+                startNext();
+            }
+        });
+
+        socket->connectToHost(ranked[index].address(), ranked[index].port());
+    };
+
+    QTimer staggerTimer;
+    connect(&staggerTimer, &QTimer::timeout, &loop, startNext);
+    QTimer::singleShot(PROBE_TIMEOUT_MS, &loop, &QEventLoop::quit);
+    connect(QCoreApplication::instance(), &QCoreApplication::aboutToQuit, &loop, &QEventLoop::quit);
+
+    startNext();
+    if (winner < 0 && failed < ranked.size()) {
+        staggerTimer.start(PROBE_STAGGER_MS);
+        loop.exec(QEventLoop::ExcludeUserInputEvents);
+        staggerTimer.stop();
+    }
+
+    for (QTcpSocket* socket : sockets) {
+        socket->abort();
+        delete socket;
+    }
+
+    if (winner < 0) {
+        // Attempts that never connected count as failures
+        for (int i = 0; i < sockets.size(); i++) {
+            entry->addressRttMs[ranked[i].toString()] = -1;
+        }
+        return QVector<NvAddress>();
+    }
+
+    // Poll the first address to connect, then fall back to the others in case
+    // something else is listening there. Skip the ones we know are unreachable.
+    QVector<NvAddress> result;
+    result.append(ranked[winner]);
+    for (int i = 0; i < ranked.size(); i++) {
+        if (i != winner && entry->addressRttMs.value(ranked[i].toString(), 0) >= 0) {
+            result.append(ranked[i]);
+        }
+    }
+    return result;
+}
+
+bool ComputerPollingScheduler::tryPollComputer(QNetworkAccessManager* nam, Entry* entry, NvAddress address, bool& changed)
+{
+    NvComputer* computer = entry->computer;
+    NvHTTP http(address, 0, computer->serverCert, nam);
+    http.setConnectionReuse(!computer->isNvidiaServerSoftware);
+
+    QString serverInfo;
+    try {
+        serverInfo = http.getServerInfo(NvHTTP::NvLogLevel::NVLL_NONE, true);
+    } catch (...) {
+        return false;
+    }
+
+    // Most polls return exactly what the last one did. If this online host
+    // answered the same way from the same address, there's nothing to update.
+    QByteArray serverInfoHash = QCryptographicHash::hash(serverInfo.toUtf8(), QCryptographicHash::Sha1);
+    if (computer->state == NvComputer::CS_ONLINE &&
+            address == entry->lastServerInfoAddress &&
+            serverInfoHash == entry->lastServerInfoHash) {
+        changed = false;
         return true;
     }
 
-    bool updateAppList(QNetworkAccessManager* nam, bool& changed)
-    {
-        NvHTTP http(m_Computer, nam);
+    NvComputer newState(http, serverInfo);
 
-        QVector<NvApp> appList;
+    // Ensure the machine that responded is the one we intended to contact
+    if (computer->uuid != newState.uuid) {
+        qInfo() << "Found unexpected PC" << newState.name << "looking for" << computer->name;
+        return false;
+    }
 
-        try {
-            appList = http.getAppList();
-            if (appList.isEmpty()) {
+    changed = computer->update(newState);
+
+    entry->lastServerInfoHash = serverInfoHash;
+    entry->lastServerInfoAddress = address;
+    return true;
+}
+
+bool ComputerPollingScheduler::updateAppList(QNetworkAccessManager* nam, Entry* entry, bool& changed)
+{
+    NvComputer* computer = entry->computer;
+    NvHTTP http(computer, nam);
+
+    QString appListXml;
+    QVector<NvApp> appList;
+
+    try {
+        appListXml = http.getAppListXml();
+
+        // Don't parse and compare the list again if the host sent the same one
+        QByteArray appListHash = QCryptographicHash::hash(appListXml.toUtf8(), QCryptographicHash::Sha1);
+        if (appListHash == entry->lastAppListHash && !computer->appList.isEmpty()) {
+            changed = false;
+            return true;
+        }
+
+        appList = NvHTTP::parseAppList(appListXml);
+        if (appList.isEmpty()) {
+            return false;
+        }
+
+        entry->lastAppListHash = appListHash;
+    } catch (...) {
+        return false;
+    }
+
+    QWriteLocker lock(&computer->lock);
+    changed = computer->updateAppList(appList);
+    return true;
+}
+
+bool ComputerPollingScheduler::pollComputer(QNetworkAccessManager* nam, Entry* entry)
+{
+    // The entry's computer can only be deleted after removeComputer(),
+    // which waits for us to clear the busy flag.
+    NvComputer* computer = entry->computer;
+
+    bool stateChanged = false;
+    bool online = false;
+    bool wasOnline = computer->state == NvComputer::CS_ONLINE;
+    for (int i = 0; i < (wasOnline ? TRIES_BEFORE_OFFLINING : 1) && !online; i++) {
+        for (auto& address : probeAddresses(entry, computer->uniqueAddresses())) {
+            if (isPollCancelled(entry)) {
                 return false;
             }
-        } catch (...) {
-            return false;
+
+            if (tryPollComputer(nam, entry, address, stateChanged)) {
+                if (!wasOnline) {
+                    qInfo() << computer->name << "is now online at" << computer->activeAddress.toString();
+                }
+                online = true;
+                break;
+            }
         }
+    }
 
-        QWriteLocker lock(&m_Computer->lock);
-        changed = m_Computer->updateAppList(appList);
-        return true;
+    // Check if we failed after all retry attempts
+    // Note: we don't need to acquire the read lock here,
+    // because we're on the writing thread.
+    if (!online && computer->state != NvComputer::CS_OFFLINE) {
+        qInfo() << computer->name << "is now offline";
+        computer->state = NvComputer::CS_OFFLINE;
+        stateChanged = true;
     }
 
-    void run() override
-    {
-        // Reduce the power and performance impact of our
-        // computer status polling while it's running.
-        setPriority(QThread::LowPriority);
+    // Grab the applist if it's empty or it's been long enough that we need to refresh
+    entry->pollsSinceLastAppListFetch++;
+    if (computer->state == NvComputer::CS_ONLINE &&
+            computer->pairState == NvComputer::PS_PAIRED &&
+            (computer->appList.isEmpty() || entry->pollsSinceLastAppListFetch >= POLLS_PER_APPLIST_FETCH)) {
+        // Notify prior to the app list poll since it may take a while, and we don't
+        // want to delay onlining of a machine, especially if we already have a cached list.
+        if (stateChanged) {
+            emit computerStateChanged(computer);
+            stateChanged = false;
+        }
+
+        if (updateAppList(nam, entry, stateChanged)) {
+            entry->pollsSinceLastAppListFetch = 0;
+        }
+    }
+
+    if (stateChanged) {
+        // Tell anyone listening that we've changed state
+        emit computerStateChanged(computer);
+    }
+
+    return online;
+}
+
+void PollingWorkerThread::run()
+{
+    // Reduce the power and performance impact of our
+    // computer status polling while it's running.
+    setPriority(QThread::LowPriority);
 #if QT_VERSION >= QT_VERSION_CHECK(6, 9, 0)
-        setServiceLevel(QThread::QualityOfService::Eco);
+    setServiceLevel(QThread::QualityOfService::Eco);
 #endif
+    StreamUtils::placeCurrentThread(StreamUtils::TPC_BACKGROUND);
 
-        // Share the QNetworkAccessManager to conserve resources when polling.
-        // Each instance creates a worker thread, so sharing them ensures that
-        // we are not spamming a new thread for every single polling attempt.
-        //
-        // Since QThread inherit the priority of the current thread, this also
-        // ensures that the NAM's worker thread will inherit our lower priority.
-        QNetworkAccessManager nam;
+    // Share the QNetworkAccessManager between all hosts polled by this worker.
+    // Each instance creates a worker thread, so sharing them ensures that
+    // we are not spamming a new thread for every single polling attempt.
+    //
+    // Since QThread inherit the priority of the current thread, this also
+    // ensures that the NAM's worker thread will inherit our lower priority.
+    QNetworkAccessManager nam;
 
-        // Always fetch the applist the first time
-        int pollsSinceLastAppListFetch = POLLS_PER_APPLIST_FETCH;
-        while (!isInterruptionRequested()) {
-            bool stateChanged = false;
-            bool online = false;
-            bool wasOnline = m_Computer->state == NvComputer::CS_ONLINE;
-            for (int i = 0; i < (wasOnline ? TRIES_BEFORE_OFFLINING : 1) && !online; i++) {
-                for (auto& address : m_Computer->uniqueAddresses()) {
-                    if (isInterruptionRequested()) {
-                        return;
-                    }
+    QMutexLocker locker(&m_Scheduler->m_Mutex);
+    for (;;) {
+        ComputerPollingScheduler::Entry* entry = m_Scheduler->waitForDueEntry();
+        if (entry == nullptr) {
+            break;
+        }
 
-                    if (tryPollComputer(&nam, address, stateChanged)) {
-                        if (!wasOnline) {
-                            qInfo() << m_Computer->name << "is now online at" << m_Computer->activeAddress.toString();
-                        }
-                        online = true;
-                        break;
-                    }
-                }
-            }
+        entry->busy = true;
+        entry->pollRequested = false;
 
-            // Check if we failed after all retry attempts
-            // Note: we don't need to acquire the read lock here,
-            // because we're on the writing thread.
-            if (!online && m_Computer->state != NvComputer::CS_OFFLINE) {
-                qInfo() << m_Computer->name << "is now offline";
-                m_Computer->state = NvComputer::CS_OFFLINE;
-                stateChanged = true;
-            }
-
-            // Grab the applist if it's empty or it's been long enough that we need to refresh
-            pollsSinceLastAppListFetch++;
-            if (m_Computer->state == NvComputer::CS_ONLINE &&
-                    m_Computer->pairState == NvComputer::PS_PAIRED &&
-                    (m_Computer->appList.isEmpty() || pollsSinceLastAppListFetch >= POLLS_PER_APPLIST_FETCH)) {
-                // Notify prior to the app list poll since it may take a while, and we don't
-                // want to delay onlining of a machine, especially if we already have a cached list.
-                if (stateChanged) {
-                    emit computerStateChanged(m_Computer);
-                    stateChanged = false;
-                }
+        locker.unlock();
+        bool online = m_Scheduler->pollComputer(&nam, entry);
+        locker.relock();
 
-                if (updateAppList(&nam, stateChanged)) {
-                    pollsSinceLastAppListFetch = 0;
-                }
-            }
+        entry->busy = false;
 
-            if (stateChanged) {
-                // Tell anyone listening that we've changed state
-                emit computerStateChanged(m_Computer);
+        // Back off exponentially while the host stays offline, unless
+        // someone asked for another poll while this one was running
+        if (entry->pollRequested) {
+            entry->nextPollTime = 0;
+        }
+        else {
+            if (online) {
+                entry->backoffMs = POLL_INTERVAL_MS;
             }
-
-            // Wait a bit to poll again, but do it in 100 ms chunks
-            // so we can be interrupted reasonably quickly.
-            // FIXME: QWaitCondition would be better.
-            for (int i = 0; i < 30 && !isInterruptionRequested(); i++) {
-                QThread::msleep(100);
+            entry->nextPollTime = m_Scheduler->m_Clock.elapsed() + entry->backoffMs;
+            if (!online) {
+                entry->backoffMs = qMin(entry->backoffMs * 2, MAX_OFFLINE_BACKOFF_MS);
             }
         }
-    }
-
-signals:
-   void computerStateChanged(NvComputer* computer);
 
-private:
-    NvComputer* m_Computer;
-};
+        // Wake removeComputer() and any workers waiting on this entry
+        m_Scheduler->m_Condition.wakeAll();
+    }
+}
 
 ComputerManager::ComputerManager(StreamingPreferences* prefs)
     : m_Prefs(prefs),
       m_PollingRef(0),
+      m_PollingStarted(false),
+      m_PollScheduler(new ComputerPollingScheduler()),
       m_MdnsBrowser(nullptr),
       m_CompatFetcher(nullptr),
-      m_NeedsDelayedFlush(false)
+      m_NeedsDelayedFlush(false),
+      m_NeedsFullFlush(true)
 {
     QSettings settings;
 
+    m_HostCacheGeneration = settings.value(SER_HOSTCACHEGEN).toUInt();
+
     // If there's a hosts backup copy, we must have failed to commit
     // a previous update before exiting. Restore the backup now.
     int hosts = settings.beginReadArray(SER_HOSTS_BACKUP);
-    if (hosts == 0) {
-        // If there's no host backup, read from the primary location.
+    bool restoringBackup = hosts != 0;
+    settings.endArray();
+
+    // The binary host cache is much quicker to load than QSettings (especially
+    // from the registry on Windows), but we only trust it when it was written
+    // along with the last successful update of the primary host list.
+    if (restoringBackup || !loadHostCache()) {
+        hosts = settings.beginReadArray(restoringBackup ? SER_HOSTS_BACKUP : SER_HOSTS);
+
+        // Inflate our hosts from QSettings
+        for (int i = 0; i < hosts; i++) {
+            settings.setArrayIndex(i);
+            NvComputer* computer = new NvComputer(settings);
+            m_KnownHosts[computer->uuid] = computer;
+        }
         settings.endArray();
-        hosts = settings.beginReadArray(SER_HOSTS);
     }
 
-    // Inflate our hosts from QSettings
-    for (int i = 0; i < hosts; i++) {
-        settings.setArrayIndex(i);
-        NvComputer* computer = new NvComputer(settings);
-        m_KnownHosts[computer->uuid] = computer;
+    for (const NvComputer* computer : m_KnownHosts) {
         m_LastSerializedHosts[computer->uuid] = *computer;
     }
+
+    // Load the addresses that mDNS hostnames resolved to last time
+    int mdnsHosts = settings.beginReadArray(SER_MDNSCACHE);
+    for (int i = 0; i < mdnsHosts; i++) {
+        settings.setArrayIndex(i);
+
+        QVector<QHostAddress> addresses;
+        for (const QString& address : settings.value(SER_MDNSADDRESSES).toStringList()) {
+            QHostAddress hostAddress(address);
+            if (!hostAddress.isNull()) {
+                addresses.append(hostAddress);
+            }
+        }
+
+        if (!addresses.isEmpty()) {
+            m_MdnsAddressCache.insert(settings.value(SER_MDNSHOSTNAME).toString(), addresses);
+        }
+    }
     settings.endArray();
 
-    // Fetch latest compatibility data asynchronously
-    m_CompatFetcher.start();
+    // Fetch latest compatibility data asynchronously. It isn't
+    // needed until we stream, so it can wait for the UI to show.
+    StartupProfiler::runWhenInteractive(&m_CompatFetcher, [this]() {
+        m_CompatFetcher.start();
+    });
 
     // Start the delayed flush thread to handle saveHosts() calls
     m_DelayedFlushThread = new DelayedFlushThread(this);
     m_DelayedFlushThread->start();
 
+    connect(m_PollScheduler, &ComputerPollingScheduler::computerStateChanged,
+            this, &ComputerManager::handleComputerStateChanged);
+
     // To quit in a timely manner, we must block additional requests
     // after we receive the aboutToQuit() signal. This is necessary
     // because NvHTTP uses aboutToQuit() to abort requests in progress
@@ -230,15 +613,8 @@ ComputerManager::~ComputerManager()
     delete m_MdnsBrowser;
     m_MdnsBrowser = nullptr;
 
-    // Interrupt polling
-    for (ComputerPollingEntry* entry : m_PollEntries) {
-        entry->interrupt();
-    }
-
-    // Delete all polling entries (and associated threads)
-    for (ComputerPollingEntry* entry : m_PollEntries) {
-        delete entry;
-    }
+    // Stop polling and wait for the workers
+    delete m_PollScheduler;
 
     // Destroy all NvComputer objects now that polling is halted
     for (NvComputer* computer : m_KnownHosts) {
@@ -248,6 +624,9 @@ ComputerManager::~ComputerManager()
 
 void DelayedFlushThread::run() {
     for (;;) {
+        bool fullFlush;
+        QSet<QString> dirtyHosts;
+
         // Wait for a delayed flush request or an interruption
         {
             QMutexLocker locker(&m_ComputerManager->m_DelayedFlushMutex);
@@ -263,9 +642,31 @@ void DelayedFlushThread::run() {
                 break;
             }
 
+            // Hosts tend to change in bursts (like when they all come online at once),
+            // so wait a bit to write them out together. Don't wait if we're exiting.
+            QElapsedTimer delayTimer;
+            delayTimer.start();
+            while (!QThread::currentThread()->isInterruptionRequested() && delayTimer.elapsed() < HOSTS_FLUSH_DELAY_MS) {
+                m_ComputerManager->m_DelayedFlushCondition.wait(&m_ComputerManager->m_DelayedFlushMutex,
+                                                                HOSTS_FLUSH_DELAY_MS - delayTimer.elapsed());
+            }
+
             // Reset the delayed flush flag to ensure any racing saveHosts() call will set it again
             m_ComputerManager->m_NeedsDelayedFlush = false;
 
+            // We can only update hosts in place if the list itself is the same one we last wrote
+            fullFlush = m_ComputerManager->m_NeedsFullFlush;
+            if (m_ComputerManager->m_LastSerializedHosts.count() != m_ComputerManager->m_KnownHosts.count()) {
+                fullFlush = true;
+            }
+            for (const NvComputer* computer : m_ComputerManager->m_KnownHosts) {
+                if (!m_ComputerManager->m_LastSerializedHosts.contains(computer->uuid)) {
+                    fullFlush = true;
+                }
+            }
+            m_ComputerManager->m_NeedsFullFlush = false;
+            dirtyHosts.swap(m_ComputerManager->m_DirtyHosts);
+
             // Update the last serialized hosts map under the delayed flush mutex
             m_ComputerManager->m_LastSerializedHosts.clear();
             for (const NvComputer* computer : m_ComputerManager->m_KnownHosts) {
@@ -277,38 +678,117 @@ void DelayedFlushThread::run() {
         }
 
         // Perform the flush
+        QByteArray hostCache;
         {
             QSettings settings;
 
-            // First, write to the backup location
-            settings.beginWriteArray(SER_HOSTS_BACKUP);
-            {
-                QReadLocker lock(&m_ComputerManager->m_Lock);
-                int i = 0;
-                for (const NvComputer* computer : m_ComputerManager->m_KnownHosts) {
-                    settings.setArrayIndex(i++);
-                    computer->serialize(settings, false);
+            if (fullFlush) {
+                // First, write to the backup location
+                settings.beginWriteArray(SER_HOSTS_BACKUP);
+                {
+                    QReadLocker lock(&m_ComputerManager->m_Lock);
+                    int i = 0;
+                    for (const NvComputer* computer : m_ComputerManager->m_KnownHosts) {
+                        settings.setArrayIndex(i++);
+                        computer->serialize(settings, false);
+                    }
                 }
-            }
-            settings.endArray();
+                settings.endArray();
+
+                // Next, write to the primary location
+                settings.remove(SER_HOSTS);
+                settings.beginWriteArray(SER_HOSTS);
+                {
+                    QReadLocker lock(&m_ComputerManager->m_Lock);
+                    int i = 0;
+                    for (const NvComputer* computer : m_ComputerManager->m_KnownHosts) {
+                        settings.setArrayIndex(i++);
+                        computer->serialize(settings, true);
+                    }
+                    hostCache = m_ComputerManager->serializeHostCache(m_ComputerManager->m_HostCacheGeneration + 1);
+                }
+                settings.endArray();
 
-            // Next, write to the primary location
-            settings.remove(SER_HOSTS);
-            settings.beginWriteArray(SER_HOSTS);
-            {
+                // Finally, delete the backup copy
+                settings.remove(SER_HOSTS_BACKUP);
+            }
+            else {
+                // The array is in the same order as m_KnownHosts, so we can
+                // rewrite just the hosts that changed where they are.
                 QReadLocker lock(&m_ComputerManager->m_Lock);
+                settings.beginWriteArray(SER_HOSTS, m_ComputerManager->m_KnownHosts.count());
                 int i = 0;
                 for (const NvComputer* computer : m_ComputerManager->m_KnownHosts) {
-                    settings.setArrayIndex(i++);
-                    computer->serialize(settings, true);
+                    if (dirtyHosts.contains(computer->uuid)) {
+                        settings.setArrayIndex(i);
+                        computer->serialize(settings, true);
+                    }
+                    i++;
                 }
+                settings.endArray();
+                hostCache = m_ComputerManager->serializeHostCache(m_ComputerManager->m_HostCacheGeneration + 1);
             }
-            settings.endArray();
 
-            // Finally, delete the backup copy
-            settings.remove(SER_HOSTS_BACKUP);
+            // Tie the host cache to this version of the host list
+            settings.setValue(SER_HOSTCACHEGEN, ++m_ComputerManager->m_HostCacheGeneration);
         }
+
+        Path::writeCacheFile(HOST_CACHE_FILE, hostCache);
+    }
+}
+
+// Must hold m_Lock for read
+QByteArray ComputerManager::serializeHostCache(quint32 generation)
+{
+    QByteArray data;
+    QDataStream stream(&data, QIODevice::WriteOnly);
+    stream.setVersion(QDataStream::Qt_5_0);
+
+    stream << (quint32)HOST_CACHE_MAGIC << (quint32)HOST_CACHE_VERSION << generation << (qint32)m_KnownHosts.count();
+    for (const NvComputer* computer : m_KnownHosts) {
+        computer->serialize(stream);
     }
+
+    return data;
+}
+
+bool ComputerManager::loadHostCache()
+{
+    QByteArray data = Path::readCacheFile(HOST_CACHE_FILE);
+    if (data.isEmpty()) {
+        return false;
+    }
+
+    QDataStream stream(data);
+    stream.setVersion(QDataStream::Qt_5_0);
+
+    quint32 magic, version, generation;
+    qint32 hostCount;
+    stream >> magic >> version >> generation >> hostCount;
+    if (stream.status() != QDataStream::Ok || magic != HOST_CACHE_MAGIC || version != HOST_CACHE_VERSION) {
+        qWarning() << "Ignoring invalid host cache";
+        return false;
+    }
+    else if (generation != m_HostCacheGeneration) {
+        qInfo() << "Host cache is out of date";
+        return false;
+    }
+
+    QMap<QString, NvComputer*> hosts;
+    for (int i = 0; i < hostCount && stream.status() == QDataStream::Ok; i++) {
+        NvComputer* computer = new NvComputer(stream);
+        delete hosts.value(computer->uuid);
+        hosts[computer->uuid] = computer;
+    }
+
+    if (stream.status() != QDataStream::Ok) {
+        qWarning() << "Host cache is corrupt";
+        qDeleteAll(hosts);
+        return false;
+    }
+
+    m_KnownHosts = hosts;
+    return true;
 }
 
 void ComputerManager::saveHosts()
@@ -318,6 +798,7 @@ void ComputerManager::saveHosts()
     // Punt to a worker thread because QSettings on macOS can take ages (> 500 ms)
     // to persist our host list to disk (especially when a host has a bunch of apps).
     QMutexLocker locker(&m_DelayedFlushMutex);
+    m_NeedsFullFlush = true;
     m_NeedsDelayedFlush = true;
     m_DelayedFlushCondition.wakeOne();
 }
@@ -366,6 +847,23 @@ void ComputerManager::startPolling()
         return;
     }
 
+    // Discovery and polling wait until the UI has been shown
+    lock.unlock();
+    StartupProfiler::runWhenInteractive(this, [this]() {
+        QWriteLocker lock(&m_Lock);
+
+        // Polling may have been stopped (or already started again) in the meantime
+        if (m_PollingRef > 0 && !m_PollingStarted) {
+            startDiscoveryAndPolling();
+        }
+    });
+}
+
+// Must hold m_Lock for write
+void ComputerManager::startDiscoveryAndPolling()
+{
+    m_PollingStarted = true;
+
     if (m_Prefs->enableMdns) {
         // Start an MDNS query for GameStream hosts
         m_MdnsServer.reset(new QMdnsEngine::Server());
@@ -374,9 +872,12 @@ void ComputerManager::startPolling()
                 this, [this](const QMdnsEngine::Service& service) {
             qInfo() << "Discovered mDNS host:" << service.hostname();
 
-            MdnsPendingComputer* pendingComputer = new MdnsPendingComputer(m_MdnsServer, service);
+            MdnsPendingComputer* pendingComputer = new MdnsPendingComputer(m_MdnsServer, service,
+                                                                           m_MdnsAddressCache.value(service.hostname()));
             connect(pendingComputer, &MdnsPendingComputer::resolvedHost,
                     this, &ComputerManager::handleMdnsServiceResolved);
+            connect(pendingComputer, &MdnsPendingComputer::resolutionFinished,
+                    this, &ComputerManager::handleMdnsResolutionFinished);
             m_PendingResolution.append(pendingComputer);
         });
     }
@@ -384,7 +885,7 @@ void ComputerManager::startPolling()
         qWarning() << "mDNS is disabled by user preference";
     }
 
-    // Start polling threads for each known host
+    // Start polling each known host
     QMapIterator<QString, NvComputer*> i(m_KnownHosts);
     while (i.hasNext()) {
         i.next();
@@ -395,26 +896,11 @@ void ComputerManager::startPolling()
 // Must hold m_Lock for write
 void ComputerManager::startPollingComputer(NvComputer* computer)
 {
-    if (m_PollingRef == 0) {
+    if (!m_PollingStarted) {
         return;
     }
 
-    ComputerPollingEntry* pollingEntry;
-
-    if (!m_PollEntries.contains(computer->uuid)) {
-        pollingEntry = m_PollEntries[computer->uuid] = new ComputerPollingEntry();
-    }
-    else {
-        pollingEntry = m_PollEntries[computer->uuid];
-    }
-
-    if (!pollingEntry->isActive()) {
-        PcMonitorThread* thread = new PcMonitorThread(computer);
-        connect(thread, &PcMonitorThread::computerStateChanged,
-                this, &ComputerManager::handleComputerStateChanged);
-        pollingEntry->setActiveThread(thread);
-        thread->start();
-    }
+    m_PollScheduler->startPolling(computer);
 }
 
 void ComputerManager::handleMdnsServiceResolved(MdnsPendingComputer* computer,
@@ -451,20 +937,51 @@ void ComputerManager::handleMdnsServiceResolved(MdnsPendingComputer* computer,
         }
     }
 
+    // Remember where this host was for next time
+    if (m_MdnsAddressCache.value(computer->hostname()) != addresses) {
+        m_MdnsAddressCache.insert(computer->hostname(), addresses);
+        saveMdnsAddressCache();
+    }
+}
+
+void ComputerManager::handleMdnsResolutionFinished(MdnsPendingComputer* computer)
+{
     m_PendingResolution.removeOne(computer);
     computer->deleteLater();
 }
 
+void ComputerManager::saveMdnsAddressCache()
+{
+    QSettings settings;
+
+    settings.remove(SER_MDNSCACHE);
+    settings.beginWriteArray(SER_MDNSCACHE);
+    int i = 0;
+    for (auto it = m_MdnsAddressCache.constBegin(); it != m_MdnsAddressCache.constEnd(); ++it) {
+        QStringList addresses;
+        for (const QHostAddress& address : it.value()) {
+            addresses.append(address.toString());
+        }
+
+        settings.setArrayIndex(i++);
+        settings.setValue(SER_MDNSHOSTNAME, it.key());
+        settings.setValue(SER_MDNSADDRESSES, addresses);
+    }
+    settings.endArray();
+}
+
 void ComputerManager::saveHost(NvComputer *computer)
 {
     // If no serializable properties changed, don't bother saving hosts
     QMutexLocker lock(&m_DelayedFlushMutex);
     QReadLocker computerLock(&computer->lock);
     if (!m_LastSerializedHosts.value(computer->uuid).isEqualSerialized(*computer)) {
-        // Queue a request for a delayed flush to QSettings outside of the lock
         computerLock.unlock();
-        lock.unlock();
-        saveHosts();
+
+        // Queue a request for a delayed flush of just this host
+        m_DirtyHosts.insert(computer->uuid);
+        m_NeedsDelayedFlush = true;
+        m_DelayedFlushCondition.wakeOne();
     }
 }
 
@@ -502,29 +1019,25 @@ public:
 
     void run()
     {
-        ComputerPollingEntry* pollingEntry;
-
         // Only do the minimum amount of work while holding the writer lock.
         // We must release it before calling saveHosts().
         {
             QWriteLocker lock(&m_ComputerManager->m_Lock);
 
-            pollingEntry = m_ComputerManager->m_PollEntries.take(m_Computer->uuid);
-
             m_ComputerManager->m_KnownHosts.remove(m_Computer->uuid);
         }
 
         // Persist the new host list with this computer deleted
         m_ComputerManager->saveHosts();
 
-        // Delete the polling entry first. This will stop all polling threads too.
-        delete pollingEntry;
+        // Stop polling first. This waits for a poll in progress to finish.
+        m_ComputerManager->m_PollScheduler->removeComputer(m_Computer);
 
         // Delete cached box art
         BoxArtManager::deleteBoxArt(m_Computer);
 
         // Finally, delete the computer itself. This must be done
-        // last because the polling thread might be using it.
+        // last because a polling worker might have been using it.
         delete m_Computer;
     }
 
@@ -559,15 +1072,18 @@ void ComputerManager::clientSideAttributeUpdated(NvComputer* computer)
     handleComputerStateChanged(computer);
 }
 
+void ComputerManager::refreshHost(NvComputer* computer)
+{
+    m_PollScheduler->pollNow(computer);
+}
+
 void ComputerManager::handleAboutToQuit()
 {
     QReadLocker lock(&m_Lock);
 
-    // Interrupt polling threads immediately, so they
+    // Interrupt polling immediately, so the workers
     // avoid making additional requests while quitting
-    for (ComputerPollingEntry* entry : m_PollEntries) {
-        entry->interrupt();
-    }
+    m_PollScheduler->interrupt();
 }
 
 class PendingPairingTask : public QObject, public QRunnable
@@ -614,6 +1130,9 @@ private:
                // Persist the newly pinned server certificate for this host
                m_ComputerManager->saveHost(m_Computer);
 
+               // Pick up the new pair state and app list right away
+               m_ComputerManager->refreshHost(m_Computer);
+
                emit pairingCompleted(m_Computer, nullptr);
                break;
            }
@@ -695,15 +1214,104 @@ void ComputerManager::quitRunningApp(NvComputer* computer)
     QThreadPool::globalInstance()->start(quit);
 }
 
+class DirectHostProbeTask : public QObject, public QRunnable
+{
+    Q_OBJECT
+
+public:
+    DirectHostProbeTask(ComputerManager* computerManager, NvComputer* computer, NvAddress address)
+        : m_Computer(computer),
+          m_Address(address)
+    {
+        connect(this, &DirectHostProbeTask::probeCompleted,
+                computerManager, &ComputerManager::handleHostProbeCompleted);
+    }
+
+signals:
+    void probeCompleted(NvComputer* computer, bool online);
+
+private:
+    void run()
+    {
+        QSslCertificate serverCert;
+        bool isNvidiaServerSoftware;
+        {
+            QReadLocker lock(&m_Computer->lock);
+            serverCert = m_Computer->serverCert;
+            isNvidiaServerSoftware = m_Computer->isNvidiaServerSoftware;
+        }
+
+        NvHTTP http(m_Address, 0, serverCert);
+        http.setConnectionReuse(!isNvidiaServerSoftware);
+
+        QString serverInfo;
+        try {
+            serverInfo = http.getServerInfo(NvHTTP::NVLL_ERROR, true);
+        } catch (...) {
+            emit probeCompleted(m_Computer, false);
+            return;
+        }
+
+        NvComputer newState(http, serverInfo);
+
+        // Ensure the machine that responded is the one we intended to contact
+        if (m_Computer->uuid != newState.uuid) {
+            qInfo() << "Found unexpected PC" << newState.name << "looking for" << m_Computer->name;
+            emit probeCompleted(m_Computer, false);
+            return;
+        }
+
+        m_Computer->update(newState);
+
+        // We only need the app list if we've never fetched one, since
+        // callers can't find an app otherwise. The saved list is fine.
+        if (m_Computer->pairState == NvComputer::PS_PAIRED && m_Computer->appList.isEmpty()) {
+            try {
+                NvHTTP appHttp(m_Computer);
+                QVector<NvApp> appList = appHttp.getAppList();
+
+                QWriteLocker lock(&m_Computer->lock);
+                m_Computer->updateAppList(appList);
+            } catch (...) {
+                // Polling will fetch it later
+            }
+        }
+
+        emit probeCompleted(m_Computer, true);
+    }
+
+    NvComputer* m_Computer;
+    NvAddress m_Address;
+};
+
+void ComputerManager::probeHostDirectly(NvComputer* computer, NvAddress address)
+{
+    DirectHostProbeTask* probe = new DirectHostProbeTask(this, computer, address);
+    QThreadPool::globalInstance()->start(probe);
+}
+
+void ComputerManager::handleHostProbeCompleted(NvComputer* computer, bool online)
+{
+    // Let the caller know about the host before it sees the state change,
+    // just like when a seeker finds the host by polling.
+    emit hostProbeCompleted(computer, online);
+
+    if (online) {
+        handleComputerStateChanged(computer);
+    }
+}
+
 void ComputerManager::stopPollingAsync()
 {
     QWriteLocker lock(&m_Lock);
 
     Q_ASSERT(m_PollingRef > 0);
-    if (--m_PollingRef > 0) {
+    if (--m_PollingRef > 0 || !m_PollingStarted) {
         return;
     }
 
+    m_PollingStarted = false;
+
     // Delete machines that haven't been resolved yet
     while (!m_PendingResolution.isEmpty()) {
         MdnsPendingComputer* computer = m_PendingResolution.first();
@@ -716,10 +1324,8 @@ void ComputerManager::stopPollingAsync()
     m_MdnsBrowser = nullptr;
     m_MdnsServer.reset();
 
-    // Interrupt all threads, but don't wait for them to terminate
-    for (ComputerPollingEntry* entry : m_PollEntries) {
-        entry->interrupt();
-    }
+    // Stop polling, but don't wait for polls in progress to finish
+    m_PollScheduler->stopPollingAsync();
 }
 
 void ComputerManager::addNewHostManually(QString address)
@@ -929,6 +1535,10 @@ private:
                     emit computerAddCompleted(true, false);
                 }
 
+                // A host we already know just announced itself or was added again
+                // by the user, so check on it now instead of waiting out its backoff.
+                m_ComputerManager->refreshHost(existingComputer);
+
                 // Tell our client if something changed
                 if (changed) {
                     qInfo() << existingComputer->name << "is now at" << existingComputer->activeAddress.toString();
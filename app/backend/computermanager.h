@@ -17,6 +17,8 @@
 #include <QTimer>
 #include <QMutex>
 #include <QWaitCondition>
+#include <QElapsedTimer>
+#include <QSet>
 
 class ComputerManager;
 
@@ -43,12 +45,33 @@ class MdnsPendingComputer : public QObject
 
 public:
     explicit MdnsPendingComputer(const QSharedPointer<QMdnsEngine::Server> server,
-                                 const QMdnsEngine::Service& service)
+                                 const QMdnsEngine::Service& service,
+                                 const QVector<QHostAddress>& cachedAddresses)
         : m_Hostname(service.hostname()),
           m_Port(service.port()),
           m_ServerWeak(server),
-          m_Resolver(nullptr)
+          m_Resolver(nullptr),
+          m_CachedAddresses(cachedAddresses)
     {
+        m_TimeoutTimer.setSingleShot(true);
+        connect(&m_TimeoutTimer, &QTimer::timeout,
+                this, &MdnsPendingComputer::handleResolvedTimeout);
+
+        m_SettleTimer.setSingleShot(true);
+        m_SettleTimer.setInterval(MDNS_SETTLE_MS);
+        connect(&m_SettleTimer, &QTimer::timeout,
+                this, &MdnsPendingComputer::finishResolving);
+
+        // If we know where this host was last time, add it right away
+        // and let the resolution below correct us if it has moved.
+        if (!m_CachedAddresses.isEmpty()) {
+            qInfo() << "Using cached addresses for" << hostname() << m_CachedAddresses;
+            QTimer::singleShot(0, this, [this]() {
+                QVector<QHostAddress> addresses = m_CachedAddresses;
+                emit resolvedHost(this, addresses);
+            });
+        }
+
         // Start resolving
         resolve();
     }
@@ -80,23 +103,71 @@ private slots:
             else {
                 qWarning() << "Giving up on resolving" << hostname() << "after repeated failures";
                 cleanup();
+                emit resolutionFinished(this);
             }
         }
         else {
-            Q_ASSERT(!m_Addresses.isEmpty());
-            emit resolvedHost(this, m_Addresses);
+            finishResolving();
         }
     }
 
     void handleResolvedAddress(const QHostAddress& address)
     {
+        if (m_Addresses.contains(address)) {
+            return;
+        }
+
         qInfo() << "Resolved" << hostname() << "to" << address;
         m_Addresses.push_back(address);
+
+        bool hasV4 = false, hasV6 = false;
+        for (const QHostAddress& resolvedAddress : m_Addresses) {
+            if (resolvedAddress.protocol() == QAbstractSocket::IPv4Protocol) {
+                hasV4 = true;
+            }
+            else if (resolvedAddress.protocol() == QAbstractSocket::IPv6Protocol) {
+                hasV6 = true;
+            }
+        }
+
+        // The A and AAAA records are queried together. Once both have
+        // answered there's nothing more to wait for, otherwise give the
+        // other family a moment to arrive.
+        if (hasV4 && hasV6) {
+            finishResolving();
+        }
+        else if (!m_SettleTimer.isActive()) {
+            m_SettleTimer.start();
+        }
+    }
+
+    void finishResolving()
+    {
+        m_TimeoutTimer.stop();
+        m_SettleTimer.stop();
+        cleanup();
+
+        // Only add the host again if the cache had it somewhere else
+        bool changed = m_Addresses.size() != m_CachedAddresses.size();
+        for (const QHostAddress& address : m_Addresses) {
+            if (!m_CachedAddresses.contains(address)) {
+                changed = true;
+            }
+        }
+
+        if (changed) {
+            Q_ASSERT(!m_Addresses.isEmpty());
+            emit resolvedHost(this, m_Addresses);
+        }
+
+        emit resolutionFinished(this);
     }
 
 signals:
     void resolvedHost(MdnsPendingComputer*,QVector<QHostAddress>&);
 
+    void resolutionFinished(MdnsPendingComputer*);
+
 private:
     void cleanup()
     {
@@ -123,89 +194,129 @@ private:
         m_Resolver = new QMdnsEngine::Resolver(m_Server.data(), m_Hostname);
         connect(m_Resolver, &QMdnsEngine::Resolver::resolved,
                 this, &MdnsPendingComputer::handleResolvedAddress);
-        QTimer::singleShot(2000, this, &MdnsPendingComputer::handleResolvedTimeout);
+        m_TimeoutTimer.start(MDNS_RESOLVE_TIMEOUT_MS);
     }
 
+    // How long to wait for the other address family after the first answer
+    static const int MDNS_SETTLE_MS = 150;
+
+    static const int MDNS_RESOLVE_TIMEOUT_MS = 2000;
+
     QByteArray m_Hostname;
     uint16_t m_Port;
     QWeakPointer<QMdnsEngine::Server> m_ServerWeak;
     QSharedPointer<QMdnsEngine::Server> m_Server;
     QMdnsEngine::Resolver* m_Resolver;
     QVector<QHostAddress> m_Addresses;
+    QVector<QHostAddress> m_CachedAddresses;
+    QTimer m_TimeoutTimer;
+    QTimer m_SettleTimer;
     int m_Retries = 10;
 };
 
-class ComputerPollingEntry
+class ComputerPollingScheduler;
+
+class PollingWorkerThread : public QThread
 {
+    Q_OBJECT
+
 public:
-    ComputerPollingEntry()
-        : m_ActiveThread(nullptr)
+    PollingWorkerThread(ComputerPollingScheduler* scheduler, int index)
+        : m_Scheduler(scheduler)
     {
-
+        setObjectName(QString("Polling worker %1").arg(index));
     }
 
-    virtual ~ComputerPollingEntry()
-    {
-        interrupt();
+    void run();
 
-        // interrupt() should have taken care of this
-        Q_ASSERT(m_ActiveThread == nullptr);
+private:
+    ComputerPollingScheduler* m_Scheduler;
+};
 
-        for (QThread* thread : m_InactiveList) {
-            thread->wait();
-            delete thread;
-        }
-    }
+// Polls every known host from a small pool of shared worker threads rather
+// than one thread per host. Hosts are queued by the time of their next poll,
+// and offline hosts back off exponentially so they cost less the longer they
+// stay gone. The concurrency limit defaults to 4 and can be set with
+// ML_POLL_CONCURRENCY.
+//
+// Each poll first races TCP connections to all of the host's addresses,
+// starting them a little apart in order of how fast they answered before,
+// so an unreachable address doesn't hold up the one that works.
+class ComputerPollingScheduler : public QObject
+{
+    Q_OBJECT
 
-    bool isActive()
-    {
-        cleanInactiveList();
+    friend class PollingWorkerThread;
 
-        return m_ActiveThread != nullptr;
-    }
+public:
+    ComputerPollingScheduler();
 
-    void setActiveThread(QThread* thread)
-    {
-        cleanInactiveList();
+    // Stops and waits for the workers
+    virtual ~ComputerPollingScheduler();
 
-        Q_ASSERT(!isActive());
-        m_ActiveThread = thread;
-    }
+    // Starts polling the computer (if it isn't already) and polls it immediately
+    void startPolling(NvComputer* computer);
 
-    void interrupt()
-    {
-        cleanInactiveList();
+    // Stops polling all computers without waiting for polls in progress
+    void stopPollingAsync();
 
-        if (m_ActiveThread != nullptr) {
-            // Interrupt the active thread
-            m_ActiveThread->requestInterruption();
+    // Polls the computer as soon as a worker is free and resets its backoff
+    void pollNow(NvComputer* computer);
 
-            // Place it on the inactive list awaiting death
-            m_InactiveList.append(m_ActiveThread);
+    // Waits for any poll in progress, so the computer can be deleted afterwards
+    void removeComputer(NvComputer* computer);
 
-            m_ActiveThread = nullptr;
-        }
-    }
+    // Stops the workers without waiting for them to finish
+    void interrupt();
+
+signals:
+    void computerStateChanged(NvComputer* computer);
 
 private:
-    void cleanInactiveList()
-    {
-        QMutableListIterator<QThread*> i(m_InactiveList);
+    struct Entry {
+        NvComputer* computer;
+        bool active;
+        bool busy;
+        bool pollRequested;
+        qint64 nextPollTime;
+        int backoffMs;
+        int pollsSinceLastAppListFetch;
 
-        // Reap any threads that have finished
-        while (i.hasNext()) {
-            i.next();
+        // Smoothed connect time for each address, or -1 if it last failed.
+        // Only touched by the worker polling this entry.
+        QHash<QString, int> addressRttMs;
 
-            QThread* thread = i.value();
-            if (thread->isFinished()) {
-                delete thread;
-                i.remove();
-            }
-        }
-    }
+        // Hash of the last serverinfo response and the address it came from
+        QByteArray lastServerInfoHash;
+        NvAddress lastServerInfoAddress;
+
+        // Hash of the last applist response that was applied
+        QByteArray lastAppListHash;
+    };
+
+    // Must hold m_Mutex
+    void startWorkers();
+
+    // Must hold m_Mutex. Returns nullptr if we're stopping.
+    Entry* waitForDueEntry();
+
+    bool isPollCancelled(Entry* entry);
+
+    QVector<NvAddress> probeAddresses(Entry* entry, const QVector<NvAddress>& addresses);
+
+    bool pollComputer(QNetworkAccessManager* nam, Entry* entry);
+
+    bool tryPollComputer(QNetworkAccessManager* nam, Entry* entry, NvAddress address, bool& changed);
+
+    bool updateAppList(QNetworkAccessManager* nam, Entry* entry, bool& changed);
 
-    QThread* m_ActiveThread;
-    QList<QThread*> m_InactiveList;
+    int m_Concurrency;
+    QElapsedTimer m_Clock;
+    QMutex m_Mutex;
+    QWaitCondition m_Condition;
+    QMap<QString, Entry*> m_Entries;
+    QVector<PollingWorkerThread*> m_Workers;
+    bool m_Stopping;
 };
 
 class ComputerManager : public QObject
@@ -216,6 +327,7 @@ class ComputerManager : public QObject
     friend class PendingAddTask;
     friend class PendingPairingTask;
     friend class DelayedFlushThread;
+    friend class DirectHostProbeTask;
 
 public:
     explicit ComputerManager(StreamingPreferences* prefs);
@@ -245,9 +357,20 @@ public:
 
     void clientSideAttributeUpdated(NvComputer* computer);
 
+    // Polls the computer right away after the user has done something that
+    // is likely to change its state, like waking it
+    void refreshHost(NvComputer* computer);
+
+    // Checks a saved host at a single address without starting polling or
+    // discovery. hostProbeCompleted() is emitted with the result, followed
+    // by computerStateChanged() if the host was online.
+    void probeHostDirectly(NvComputer* computer, NvAddress address);
+
 signals:
     void computerStateChanged(NvComputer* computer);
 
+    void hostProbeCompleted(NvComputer* computer, bool online);
+
     void pairingCompleted(NvComputer* computer, QString error);
 
     void computerAddCompleted(QVariant success, QVariant detectedPortBlocking);
@@ -259,29 +382,46 @@ private slots:
 
     void handleComputerStateChanged(NvComputer* computer);
 
+    void handleHostProbeCompleted(NvComputer* computer, bool online);
+
     void handleMdnsServiceResolved(MdnsPendingComputer* computer, QVector<QHostAddress>& addresses);
 
+    void handleMdnsResolutionFinished(MdnsPendingComputer* computer);
+
 private:
     void saveHosts();
 
     void saveHost(NvComputer* computer);
 
+    QByteArray serializeHostCache(quint32 generation);
+
+    bool loadHostCache();
+
     QHostAddress getBestGlobalAddressV6(QVector<QHostAddress>& addresses);
 
+    void saveMdnsAddressCache();
+
     void startPollingComputer(NvComputer* computer);
 
+    void startDiscoveryAndPolling();
+
     StreamingPreferences* m_Prefs;
     int m_PollingRef;
+    bool m_PollingStarted;
     QReadWriteLock m_Lock;
     QMap<QString, NvComputer*> m_KnownHosts;
-    QMap<QString, ComputerPollingEntry*> m_PollEntries;
+    ComputerPollingScheduler* m_PollScheduler;
     QHash<QString, NvComputer> m_LastSerializedHosts; // Protected by m_DelayedFlushMutex
     QSharedPointer<QMdnsEngine::Server> m_MdnsServer;
     QMdnsEngine::Browser* m_MdnsBrowser;
     QVector<MdnsPendingComputer*> m_PendingResolution;
+    QHash<QString, QVector<QHostAddress>> m_MdnsAddressCache; // Only touched on the main thread
     CompatFetcher m_CompatFetcher;
     DelayedFlushThread* m_DelayedFlushThread;
     QMutex m_DelayedFlushMutex; // Lock ordering: Must never be acquired while holding NvComputer lock
     QWaitCondition m_DelayedFlushCondition;
     bool m_NeedsDelayedFlush;
+    bool m_NeedsFullFlush; // Protected by m_DelayedFlushMutex
+    QSet<QString> m_DirtyHosts; // Protected by m_DelayedFlushMutex
+    quint32 m_HostCacheGeneration; // Only touched by the delayed flush thread after startup
 };
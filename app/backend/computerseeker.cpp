@@ -4,7 +4,9 @@
 
 ComputerSeeker::ComputerSeeker(ComputerManager *manager, QString computerName, QObject *parent)
     : QObject(parent), m_ComputerManager(manager), m_ComputerName(computerName),
-      m_TimeoutTimer(new QTimer(this))
+      m_TimeoutTimer(new QTimer(this)),
+      m_ProbedComputer(nullptr),
+      m_Polling(false)
 {
     // If we know this computer, send a WOL packet to wake it up in case it is asleep.
     for (NvComputer * computer: m_ComputerManager->getComputers()) {
@@ -23,12 +25,81 @@ ComputerSeeker::ComputerSeeker(ComputerManager *manager, QString computerName, Q
 void ComputerSeeker::start(int timeout)
 {
     m_TimeoutTimer->start(timeout);
+
+    // If we were given the address of a paired host that we already know,
+    // try that address alone first. This skips mDNS and polling of every
+    // other saved host, which makes scripted launches much faster. If the
+    // probe fails, we fall back to seeking the host normally.
+    NvAddress address;
+    m_ProbedComputer = findDirectAddressHost(address);
+    if (m_ProbedComputer != nullptr) {
+        connect(m_ComputerManager, &ComputerManager::hostProbeCompleted,
+                this, &ComputerSeeker::onHostProbeCompleted);
+        m_ComputerManager->probeHostDirectly(m_ProbedComputer, address);
+        return;
+    }
+
+    startSeeking();
+}
+
+void ComputerSeeker::startSeeking()
+{
     // Seek desired computer by both connecting to it directly (this may fail
     // if m_ComputerName is UUID, or the name that doesn't resolve to an IP
     // address) and by polling it using mDNS, hopefully one of these methods
     // would find the host
     m_ComputerManager->addNewHostManually(m_ComputerName);
     m_ComputerManager->startPolling();
+    m_Polling = true;
+}
+
+void ComputerSeeker::stopSeeking()
+{
+    m_TimeoutTimer->stop();
+    if (m_Polling) {
+        m_ComputerManager->stopPollingAsync();
+        m_Polling = false;
+    }
+}
+
+void ComputerSeeker::onHostProbeCompleted(NvComputer *computer, bool online)
+{
+    if (computer != m_ProbedComputer || !m_TimeoutTimer->isActive()) {
+        return;
+    }
+
+    m_ProbedComputer = nullptr;
+    disconnect(m_ComputerManager, &ComputerManager::hostProbeCompleted,
+               this, &ComputerSeeker::onHostProbeCompleted);
+
+    if (online) {
+        stopSeeking();
+        emit computerFound(computer);
+    }
+    else {
+        startSeeking();
+    }
+}
+
+NvComputer *ComputerSeeker::findDirectAddressHost(NvAddress& address) const
+{
+    QString value = m_ComputerName.toLower();
+
+    for (NvComputer *computer : m_ComputerManager->getComputers()) {
+        // We need a pinned certificate to trust the host without pairing
+        if (computer->pairState != NvComputer::PS_PAIRED || computer->serverCert.isNull()) {
+            continue;
+        }
+
+        for (const NvAddress& addr : computer->uniqueAddresses()) {
+            if (addr.address().toLower() == value || addr.toString().toLower() == value) {
+                address = addr;
+                return computer;
+            }
+        }
+    }
+
+    return nullptr;
 }
 
 void ComputerSeeker::onComputerUpdated(NvComputer *computer)
@@ -37,8 +108,7 @@ void ComputerSeeker::onComputerUpdated(NvComputer *computer)
         return;
     }
     if (matchComputer(computer) && isOnline(computer)) {
-        m_ComputerManager->stopPollingAsync();
-        m_TimeoutTimer->stop();
+        stopSeeking();
         emit computerFound(computer);
     }
 }
@@ -67,7 +137,6 @@ bool ComputerSeeker::isOnline(NvComputer *computer) const
 
 void ComputerSeeker::onTimeout()
 {
-    m_TimeoutTimer->stop();
-    m_ComputerManager->stopPollingAsync();
+    stopSeeking();
     emit errorTimeout();
 }
@@ -3,6 +3,7 @@
 #include <QObject>
 
 class ComputerManager;
+class NvAddress;
 class NvComputer;
 class QTimer;
 
@@ -20,9 +21,13 @@ signals:
 
 private slots:
     void onComputerUpdated(NvComputer *computer);
+    void onHostProbeCompleted(NvComputer *computer, bool online);
     void onTimeout();
 
 private:
+    void startSeeking();
+    void stopSeeking();
+    NvComputer *findDirectAddressHost(NvAddress& address) const;
     bool matchComputer(NvComputer *computer) const;
     bool isOnline(NvComputer *computer) const;
 
@@ -30,4 +35,6 @@ private:
     ComputerManager *m_ComputerManager;
     QString m_ComputerName;
     QTimer *m_TimeoutTimer;
+    NvComputer *m_ProbedComputer;
+    bool m_Polling;
 };
@@ -1,7 +1,10 @@
 #include "identitymanager.h"
 #include "utils.h"
+#include "path.h"
 
 #include <QDebug>
+#include <QRunnable>
+#include <QThreadPool>
 
 #include <openssl/pem.h>
 #include <openssl/rsa.h>
@@ -12,13 +15,27 @@
 #define SER_CERT "certificate"
 #define SER_KEY "key"
 
+// Optional keypair provisioned alongside the app (e.g. by a device image)
+// that is imported instead of generating a new one on first launch.
+#define PREGEN_CERT_FILE "identity_cert.pem"
+#define PREGEN_KEY_FILE "identity_key.pem"
+
 IdentityManager* IdentityManager::s_Im = nullptr;
+QMutex IdentityManager::s_ImLock;
+
+class IdentityPreloadTask : public QRunnable
+{
+    void run() override
+    {
+        IdentityManager::get();
+    }
+};
 
 IdentityManager*
 IdentityManager::get()
 {
-    // This will always be called first on the main thread,
-    // so it's safe to initialize without locks.
+    QMutexLocker locker(&s_ImLock);
+
     if (s_Im == nullptr) {
         s_Im = new IdentityManager();
     }
@@ -26,8 +43,46 @@ IdentityManager::get()
     return s_Im;
 }
 
+void
+IdentityManager::preload()
+{
+    // Generating a new RSA key can take several seconds on slow ARM
+    // devices, so keep it off the UI thread.
+    QThreadPool::globalInstance()->start(new IdentityPreloadTask());
+}
+
+bool IdentityManager::importCredentials(QSettings& settings)
+{
+    QByteArray cert = Path::readDataFile(PREGEN_CERT_FILE);
+    QByteArray key = Path::readDataFile(PREGEN_KEY_FILE);
+
+    if (cert.isEmpty() || key.isEmpty()) {
+        return false;
+    }
+
+    m_CachedPemCert = cert;
+    m_CachedPrivateKey = key;
+    m_CachedSslCert.clear();
+    m_CachedSslKey.clear();
+
+    if (getSslCertificate().isNull() || getSslKey().isNull()) {
+        qWarning() << "Pre-generated credentials are unreadable";
+        return false;
+    }
+
+    settings.setValue(SER_CERT, m_CachedPemCert);
+    settings.setValue(SER_KEY, m_CachedPrivateKey);
+
+    qInfo() << "Imported pre-generated identity credentials";
+    return true;
+}
+
 void IdentityManager::createCredentials(QSettings& settings)
 {
+    if (importCredentials(settings)) {
+        return;
+    }
+
     X509* cert = X509_new();
     THROW_BAD_ALLOC_IF_NULL(cert);
 
@@ -95,6 +150,10 @@ void IdentityManager::createCredentials(QSettings& settings)
     BIO_free(biokey);
     BIO_free(biocert);
 
+    // Drop anything parsed from the old credentials
+    m_CachedSslCert.clear();
+    m_CachedSslKey.clear();
+
     // Check that the new keypair is valid before persisting it
     if (getSslCertificate().isNull()) {
         qFatal("Newly generated certificate is unreadable");
@@ -136,6 +195,16 @@ IdentityManager::IdentityManager()
     if (getSslKey().isNull()) {
         qFatal("Private key is unreadable");
     }
+
+    // Build the SSL configuration once, since QSslConfiguration is implicitly
+    // shared and every NvHTTP request would otherwise rebuild it.
+    m_SslConfig = QSslConfiguration::defaultConfiguration();
+    m_SslConfig.setLocalCertificate(m_CachedSslCert);
+    m_SslConfig.setPrivateKey(m_CachedSslKey);
+
+    // Allow TLS session resumption to skip full handshakes with the host
+    m_SslConfig.setSslOption(QSsl::SslOptionDisableSessionSharing, false);
+    m_SslConfig.setSslOption(QSsl::SslOptionDisableSessionTickets, false);
 }
 
 QSslCertificate
@@ -184,10 +253,7 @@ IdentityManager::getSslKey()
 QSslConfiguration
 IdentityManager::getSslConfig()
 {
-    QSslConfiguration sslConfig(QSslConfiguration::defaultConfiguration());
-    sslConfig.setLocalCertificate(getSslCertificate());
-    sslConfig.setPrivateKey(getSslKey());
-    return sslConfig;
+    return m_SslConfig;
 }
 
 QString
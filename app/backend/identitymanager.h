@@ -4,6 +4,7 @@
 #include <QSslCertificate>
 #include <QSslKey>
 #include <QSettings>
+#include <QMutex>
 
 class IdentityManager
 {
@@ -24,9 +25,18 @@ public:
     IdentityManager*
     get();
 
+    // Loads (or generates) the client identity on a worker thread.
+    // Callers of get() will block until it is ready.
+    static
+    void
+    preload();
+
 private:
     IdentityManager();
 
+    bool
+    importCredentials(QSettings& settings);
+
     QSslCertificate
     getSslCertificate();
 
@@ -36,14 +46,16 @@ private:
     void
     createCredentials(QSettings& settings);
 
-    // Initialized in constructor
+    // Initialized in constructor and immutable afterwards
     QByteArray m_CachedPrivateKey;
     QByteArray m_CachedPemCert;
+    QSslCertificate m_CachedSslCert;
+    QSslKey m_CachedSslKey;
+    QSslConfiguration m_SslConfig;
 
     // Lazy initialized
     QString m_CachedUniqueId;
-    QSslCertificate m_CachedSslCert;
-    QSslKey m_CachedSslKey;
 
     static IdentityManager* s_Im;
+    static QMutex s_ImLock;
 };
@@ -17,6 +17,11 @@ NvApp::NvApp(QSettings& settings)
     directLaunch = settings.value(SER_DIRECTLAUNCH).toBool();
 }
 
+NvApp::NvApp(QDataStream& stream)
+{
+    stream >> name >> id >> hdrSupported >> isAppCollectorGame >> hidden >> directLaunch;
+}
+
 void NvApp::serialize(QSettings& settings) const
 {
     settings.setValue(SER_APPNAME, name);
@@ -26,3 +31,8 @@ void NvApp::serialize(QSettings& settings) const
     settings.setValue(SER_HIDDEN, hidden);
     settings.setValue(SER_DIRECTLAUNCH, directLaunch);
 }
+
+void NvApp::serialize(QDataStream& stream) const
+{
+    stream << name << id << hdrSupported << isAppCollectorGame << hidden << directLaunch;
+}
@@ -1,12 +1,14 @@
 #pragma once
 
 #include <QSettings>
+#include <QDataStream>
 
 class NvApp
 {
 public:
     NvApp() {}
     explicit NvApp(QSettings& settings);
+    explicit NvApp(QDataStream& stream);
 
     bool operator==(const NvApp& other) const
     {
@@ -31,6 +33,9 @@ public:
     void
     serialize(QSettings& settings) const;
 
+    void
+    serialize(QDataStream& stream) const;
+
     int id = 0;
     QString name;
     bool hdrSupported = false;
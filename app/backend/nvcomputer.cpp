@@ -6,6 +6,17 @@
 #include <QHostInfo>
 #include <QNetworkInterface>
 #include <QNetworkProxy>
+#include <QThread>
+
+#ifdef Q_OS_LINUX
+#include <cerrno>
+#include <netinet/in.h>
+#include <sys/socket.h>
+#endif
+
+// Routers report MTU problems asynchronously, so give them time between probes
+#define PMTU_PROBE_ROUNDS 3
+#define PMTU_PROBE_WAIT_MS 50
 
 #define SER_NAME "hostname"
 #define SER_UUID "uuid"
@@ -51,6 +62,40 @@ NvComputer::NvComputer(QSettings& settings)
     settings.endArray();
     sortAppList();
 
+    resetEphemeralState();
+}
+
+NvComputer::NvComputer(QDataStream& stream)
+{
+    QString localAddr, remoteAddr, ipv6Addr, manualAddr;
+    quint16 localPort, remotePort, ipv6Port, manualPort;
+    QByteArray serverCertPem;
+    qint32 appCount;
+
+    stream >> this->name >> this->uuid >> this->hasCustomName >> this->macAddress
+           >> localAddr >> localPort >> remoteAddr >> remotePort
+           >> ipv6Addr >> ipv6Port >> manualAddr >> manualPort
+           >> serverCertPem >> this->isNvidiaServerSoftware >> appCount;
+
+    this->localAddress = NvAddress(localAddr, localPort);
+    this->remoteAddress = NvAddress(remoteAddr, remotePort);
+    this->ipv6Address = NvAddress(ipv6Addr, ipv6Port);
+    this->manualAddress = NvAddress(manualAddr, manualPort);
+    this->serverCert = QSslCertificate(serverCertPem);
+
+    if (stream.status() == QDataStream::Ok && appCount >= 0) {
+        this->appList.reserve(appCount);
+        for (int i = 0; i < appCount && stream.status() == QDataStream::Ok; i++) {
+            this->appList.append(NvApp(stream));
+        }
+    }
+    sortAppList();
+
+    resetEphemeralState();
+}
+
+void NvComputer::resetEphemeralState()
+{
     this->currentGameId = 0;
     this->pairState = PS_UNKNOWN;
     this->state = CS_UNKNOWN;
@@ -74,6 +119,22 @@ void NvComputer::setRemoteAddress(QHostAddress address)
     this->remoteAddress = NvAddress(address, this->externalPort);
 }
 
+void NvComputer::serialize(QDataStream& stream) const
+{
+    QReadLocker lock(&this->lock);
+
+    stream << name << uuid << hasCustomName << macAddress
+           << localAddress.address() << localAddress.port()
+           << remoteAddress.address() << remoteAddress.port()
+           << ipv6Address.address() << ipv6Address.port()
+           << manualAddress.address() << manualAddress.port()
+           << serverCert.toPem() << isNvidiaServerSoftware << (qint32)appList.count();
+
+    for (const NvApp& app : appList) {
+        app.serialize(stream);
+    }
+}
+
 void NvComputer::serialize(QSettings& settings, bool serializeApps) const
 {
     QReadLocker lock(&this->lock);
@@ -129,16 +190,19 @@ void NvComputer::sortAppList()
 
 NvComputer::NvComputer(NvHTTP& http, QString serverInfo)
 {
+    // Parse the whole response once rather than rescanning it for each field
+    QHash<QString, QString> serverInfoStrings = NvHTTP::getXmlStrings(serverInfo);
+
     this->serverCert = http.serverCert();
 
     this->hasCustomName = false;
-    this->name = NvHTTP::getXmlString(serverInfo, "hostname");
+    this->name = serverInfoStrings.value("hostname");
     if (this->name.isEmpty()) {
         this->name = "UNKNOWN";
     }
 
-    this->uuid = NvHTTP::getXmlString(serverInfo, "uniqueid");
-    QString newMacString = NvHTTP::getXmlString(serverInfo, "mac");
+    this->uuid = serverInfoStrings.value("uniqueid");
+    QString newMacString = serverInfoStrings.value("mac");
     if (newMacString != "00:00:00:00:00:00") {
         QStringList macOctets = newMacString.split(':');
         for (const QString& macOctet : macOctets) {
@@ -146,7 +210,7 @@ NvComputer::NvComputer(NvHTTP& http, QString serverInfo)
         }
     }
 
-    QString codecSupport = NvHTTP::getXmlString(serverInfo, "ServerCodecModeSupport");
+    QString codecSupport = serverInfoStrings.value("ServerCodecModeSupport");
     if (!codecSupport.isEmpty()) {
         this->serverCodecModeSupport = codecSupport.toInt();
     }
@@ -155,7 +219,7 @@ NvComputer::NvComputer(NvHTTP& http, QString serverInfo)
         this->serverCodecModeSupport = SCM_H264;
     }
 
-    QString maxLumaPixelsHEVC = NvHTTP::getXmlString(serverInfo, "MaxLumaPixelsHEVC");
+    QString maxLumaPixelsHEVC = serverInfoStrings.value("MaxLumaPixelsHEVC");
     if (!maxLumaPixelsHEVC.isEmpty()) {
         this->maxLumaPixelsHEVC = maxLumaPixelsHEVC.toInt();
     }
@@ -171,24 +235,24 @@ NvComputer::NvComputer(NvHTTP& http, QString serverInfo)
     });
 
     // We can get an IPv4 loopback address if we're using the GS IPv6 Forwarder
-    this->localAddress = NvAddress(NvHTTP::getXmlString(serverInfo, "LocalIP"), http.httpPort());
+    this->localAddress = NvAddress(serverInfoStrings.value("LocalIP"), http.httpPort());
     if (this->localAddress.address().startsWith("127.")) {
         this->localAddress = NvAddress();
     }
 
-    QString httpsPort = NvHTTP::getXmlString(serverInfo, "HttpsPort");
+    QString httpsPort = serverInfoStrings.value("HttpsPort");
     if (httpsPort.isEmpty() || (this->activeHttpsPort = httpsPort.toUShort()) == 0) {
         this->activeHttpsPort = DEFAULT_HTTPS_PORT;
     }
 
     // This is an extension which is not present in GFE. It is present for Sunshine to be able
     // to support dynamic HTTP WAN ports without requiring the user to manually enter the port.
-    QString remotePortStr = NvHTTP::getXmlString(serverInfo, "ExternalPort");
+    QString remotePortStr = serverInfoStrings.value("ExternalPort");
     if (remotePortStr.isEmpty() || (this->externalPort = remotePortStr.toUShort()) == 0) {
         this->externalPort = http.httpPort();
     }
 
-    QString remoteAddress = NvHTTP::getXmlString(serverInfo, "ExternalIP");
+    QString remoteAddress = serverInfoStrings.value("ExternalIP");
     if (!remoteAddress.isEmpty()) {
         this->remoteAddress = NvAddress(remoteAddress, this->externalPort);
     }
@@ -199,14 +263,14 @@ NvComputer::NvComputer(NvHTTP& http, QString serverInfo)
     // Real Nvidia host software (GeForce Experience and RTX Experience) both use the 'Mjolnir'
     // codename in the state field and no version of Sunshine does. We can use this to bypass
     // some assumptions about Nvidia hardware that don't apply to Sunshine hosts.
-    this->isNvidiaServerSoftware = NvHTTP::getXmlString(serverInfo, "state").contains("MJOLNIR");
+    this->isNvidiaServerSoftware = serverInfoStrings.value("state").contains("MJOLNIR");
 
-    this->pairState = NvHTTP::getXmlString(serverInfo, "PairStatus") == "1" ?
+    this->pairState = serverInfoStrings.value("PairStatus") == "1" ?
                 PS_PAIRED : PS_NOT_PAIRED;
-    this->currentGameId = NvHTTP::getCurrentGame(serverInfo);
-    this->appVersion = NvHTTP::getXmlString(serverInfo, "appversion");
-    this->gfeVersion = NvHTTP::getXmlString(serverInfo, "GfeVersion");
-    this->gpuModel = NvHTTP::getXmlString(serverInfo, "gputype");
+    this->currentGameId = NvHTTP::getCurrentGame(serverInfoStrings);
+    this->appVersion = serverInfoStrings.value("appversion");
+    this->gfeVersion = serverInfoStrings.value("GfeVersion");
+    this->gpuModel = serverInfoStrings.value("gputype");
     this->activeAddress = http.address();
     this->state = NvComputer::CS_ONLINE;
     this->pendingQuit = false;
@@ -457,6 +521,81 @@ NvComputer::ReachabilityType NvComputer::getActiveAddressReachability() const
     }
 }
 
+int NvComputer::probeActiveAddressMaxDatagramSize() const
+{
+#ifdef Q_OS_LINUX
+    NvAddress copyOfActiveAddress;
+
+    {
+        QReadLocker readLocker(&lock);
+
+        if (activeAddress.isNull()) {
+            return 0;
+        }
+
+        copyOfActiveAddress = activeAddress;
+    }
+
+    QUdpSocket s;
+    s.setProxy(QNetworkProxy::NoProxy);
+
+    // The video port is 9 above the HTTP port. Nothing is listening there
+    // until the stream starts, and hosts ignore stray datagrams on it.
+    s.connectToHost(copyOfActiveAddress.address(), copyOfActiveAddress.port() + 9);
+    if (!s.waitForConnected(3000)) {
+        qWarning() << "Unable to resolve address for path MTU probe";
+        return 0;
+    }
+
+    bool ipv6 = s.peerAddress().protocol() == QAbstractSocket::IPv6Protocol;
+    int level = ipv6 ? IPPROTO_IPV6 : IPPROTO_IP;
+    int mtuOption = ipv6 ? IPV6_MTU : IP_MTU;
+
+    // Set DF on everything we send, so oversized probes are reported back
+    // to us instead of being fragmented on the way
+    int pmtuDisc = ipv6 ? IPV6_PMTUDISC_DO : IP_PMTUDISC_DO;
+    if (setsockopt((int)s.socketDescriptor(), level,
+                   ipv6 ? IPV6_MTU_DISCOVER : IP_MTU_DISCOVER,
+                   &pmtuDisc, sizeof(pmtuDisc)) < 0) {
+        qWarning() << "Unable to enable path MTU discovery:" << errno;
+        return 0;
+    }
+
+    int headerSize = (ipv6 ? 40 : 20) + 8;
+    int mtu = 0;
+    for (int i = 0; i < PMTU_PROBE_ROUNDS; i++) {
+        // This starts at the MTU of the route and drops as routers tell us
+        // the path can't carry our probes
+        socklen_t mtuLen = sizeof(mtu);
+        if (getsockopt((int)s.socketDescriptor(), level, mtuOption, &mtu, &mtuLen) < 0 || mtu <= headerSize) {
+            qWarning() << "Unable to query path MTU:" << errno;
+            return 0;
+        }
+
+        // A probe that's too big for a link we know about fails immediately
+        // and the path MTU is updated, so just go around again
+        QByteArray probe(mtu - headerSize, 0);
+        if (s.write(probe) < 0 && s.error() != QAbstractSocket::DatagramTooLargeError) {
+            qWarning() << "Path MTU probe failed:" << s.errorString();
+            return 0;
+        }
+
+        QThread::msleep(PMTU_PROBE_WAIT_MS);
+    }
+
+    socklen_t mtuLen = sizeof(mtu);
+    if (getsockopt((int)s.socketDescriptor(), level, mtuOption, &mtu, &mtuLen) < 0) {
+        return 0;
+    }
+
+    qInfo() << "Path MTU to" << s.peerAddress() << "is" << mtu;
+    return mtu > headerSize ? mtu - headerSize : 0;
+#else
+    // There's no portable way to read back what the OS learned
+    return 0;
+#endif
+}
+
 bool NvComputer::updateAppList(QVector<NvApp> newAppList) {
     if (appList == newAppList) {
         return false;
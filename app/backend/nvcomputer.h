@@ -20,9 +20,10 @@ public:
 
 class NvComputer
 {
-    friend class PcMonitorThread;
+    friend class ComputerPollingScheduler;
     friend class ComputerManager;
     friend class PendingQuitTask;
+    friend class DirectHostProbeTask;
 
 private:
     void sortAppList();
@@ -44,6 +45,10 @@ public:
 
     explicit NvComputer(QSettings& settings);
 
+    // Reads a host written by serialize(QDataStream&). Check the stream
+    // status afterwards to see if it was valid.
+    explicit NvComputer(QDataStream& stream);
+
     void
     setRemoteAddress(QHostAddress);
 
@@ -63,12 +68,22 @@ public:
     ReachabilityType
     getActiveAddressReachability() const;
 
+    // Returns the largest UDP payload that fits the path MTU to the active
+    // address, as learned by sending don't-fragment probes to the host's
+    // video port, or 0 if unknown
+    int
+    probeActiveAddressMaxDatagramSize() const;
+
     QVector<NvAddress>
     uniqueAddresses() const;
 
     void
     serialize(QSettings& settings, bool serializeApps) const;
 
+    // Writes the same attributes as serialize(QSettings&) for the host cache
+    void
+    serialize(QDataStream& stream) const;
+
     // Caller is responsible for synchronizing read access to both hosts
     bool
     isEqualSerialized(const NvComputer& that) const;
@@ -119,5 +134,7 @@ public:
     mutable CopySafeReadWriteLock lock;
 
 private:
+    void resetEphemeralState();
+
     uint16_t externalPort;
 };
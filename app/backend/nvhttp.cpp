@@ -18,9 +18,13 @@
 #define RESUME_TIMEOUT_MS 30000
 #define QUIT_TIMEOUT_MS 30000
 
+// How long an idle connection is kept for hosts that allow connection reuse
+#define KEEPALIVE_TIMEOUT_SECS 15
+
 NvHTTP::NvHTTP(NvAddress address, uint16_t httpsPort, QSslCertificate serverCert, QNetworkAccessManager* nam) :
     m_Nam(nam ? nam : new QNetworkAccessManager(this)),
-    m_ServerCert(serverCert)
+    m_ServerCert(serverCert),
+    m_ConnectionReuse(false)
 {
     m_BaseUrlHttp.setScheme("http");
     m_BaseUrlHttps.setScheme("https");
@@ -36,7 +40,7 @@ NvHTTP::NvHTTP(NvAddress address, uint16_t httpsPort, QSslCertificate serverCert
 NvHTTP::NvHTTP(NvComputer* computer, QNetworkAccessManager* nam) :
     NvHTTP(computer->activeAddress, computer->activeHttpsPort, computer->serverCert, nam)
 {
-
+    setConnectionReuse(!computer->isNvidiaServerSoftware);
 }
 
 void NvHTTP::setServerCert(QSslCertificate serverCert)
@@ -44,6 +48,14 @@ void NvHTTP::setServerCert(QSslCertificate serverCert)
     m_ServerCert = serverCert;
 }
 
+void NvHTTP::setConnectionReuse(bool enabled)
+{
+    // ML_HTTP_KEEPALIVE=0 turns this off for hosts that turn out not to like it
+    static const bool allowed = qgetenv("ML_HTTP_KEEPALIVE") != "0";
+
+    m_ConnectionReuse = enabled && allowed;
+}
+
 void NvHTTP::setAddress(NvAddress address)
 {
     Q_ASSERT(!address.isNull());
@@ -104,14 +116,20 @@ NvHTTP::parseQuad(QString quad)
 
 int
 NvHTTP::getCurrentGame(QString serverInfo)
+{
+    return getCurrentGame(getXmlStrings(serverInfo));
+}
+
+int
+NvHTTP::getCurrentGame(const QHash<QString, QString>& serverInfoStrings)
 {
     // GFE 2.8 started keeping currentgame set to the last game played. As a result, it no longer
     // has the semantics that its name would indicate. To contain the effects of this change as much
     // as possible, we'll force the current game to zero if the server isn't in a streaming session.
-    QString serverState = getXmlString(serverInfo, "state");
+    QString serverState = serverInfoStrings.value("state");
     if (serverState != nullptr && serverState.endsWith("_SERVER_BUSY"))
     {
-        return getXmlString(serverInfo, "currentgame").toInt();
+        return serverInfoStrings.value("currentgame").toInt();
     }
     else
     {
@@ -286,6 +304,12 @@ NvHTTP::getDisplayModeList(QString serverInfo)
 
 QVector<NvApp>
 NvHTTP::getAppList()
+{
+    return parseAppList(getAppListXml());
+}
+
+QString
+NvHTTP::getAppListXml()
 {
     QString appxml = openConnectionToString(m_BaseUrlHttps,
                                             "applist",
@@ -294,6 +318,12 @@ NvHTTP::getAppList()
                                             NvLogLevel::NVLL_ERROR);
     verifyResponseStatus(appxml);
 
+    return appxml;
+}
+
+QVector<NvApp>
+NvHTTP::parseAppList(QString appxml)
+{
     QXmlStreamReader xmlReader(appxml);
     QVector<NvApp> apps;
     while (!xmlReader.atEnd()) {
@@ -414,6 +444,44 @@ NvHTTP::getXmlString(QString xml,
     return nullptr;
 }
 
+QHash<QString, QString>
+NvHTTP::getXmlStrings(QString xml)
+{
+    QXmlStreamReader xmlReader(xml);
+    QHash<QString, QString> strings;
+    QString elementName;
+    QString elementText;
+
+    while (!xmlReader.atEnd())
+    {
+        switch (xmlReader.readNext())
+        {
+        case QXmlStreamReader::StartElement:
+            elementName = xmlReader.name().toString();
+            elementText.clear();
+            break;
+
+        case QXmlStreamReader::Characters:
+            elementText += xmlReader.text();
+            break;
+
+        case QXmlStreamReader::EndElement:
+            // The name is cleared after the first end tag, so only leaf elements are stored
+            if (!elementName.isEmpty() && !strings.contains(elementName))
+            {
+                strings.insert(elementName, elementText);
+            }
+            elementName.clear();
+            break;
+
+        default:
+            break;
+        }
+    }
+
+    return strings;
+}
+
 void NvHTTP::handleSslErrors(QNetworkReply* reply, const QList<QSslError>& errors)
 {
     bool ignoreErrors = true;
@@ -484,7 +552,14 @@ NvHTTP::openConnection(QUrl baseUrl,
     QNetworkRequest request(url);
 
     // Add our client certificate
-    request.setSslConfiguration(IdentityManager::get()->getSslConfig());
+    QSslConfiguration sslConfig = IdentityManager::get()->getSslConfig();
+    if (m_ConnectionReuse) {
+        // Let new connections resume the TLS session instead of doing the
+        // full handshake with our client certificate again
+        sslConfig.setSslOption(QSsl::SslOptionDisableSessionSharing, false);
+        sslConfig.setSslOption(QSsl::SslOptionDisableSessionTickets, false);
+    }
+    request.setSslConfiguration(sslConfig);
 
 #if QT_VERSION >= QT_VERSION_CHECK(6, 0, 0)
     // Disable HTTP/2 (GFE 3.22 doesn't like it) and Qt 6 enables it by default
@@ -495,7 +570,8 @@ NvHTTP::openConnection(QUrl baseUrl,
     // Use fine-grained idle timeouts to avoid calling QNetworkAccessManager::clearAccessCache(),
     // which tears down the NAM's global thread each time. We must not keep persistent connections
     // or GFE will puke.
-    request.setAttribute(QNetworkRequest::ConnectionCacheExpiryTimeoutSecondsAttribute, 0);
+    request.setAttribute(QNetworkRequest::ConnectionCacheExpiryTimeoutSecondsAttribute,
+                         m_ConnectionReuse ? KEEPALIVE_TIMEOUT_SECS : 0);
 #endif
 
     auto sslErrorsConnection = connect(m_Nam, &QNetworkAccessManager::sslErrors, this, &NvHTTP::handleSslErrors);
@@ -524,7 +600,9 @@ NvHTTP::openConnection(QUrl baseUrl,
 
 #if QT_VERSION < QT_VERSION_CHECK(6, 3, 0)
     // If we couldn't use fine-grained connection idle timeouts, kill them all now
-    m_Nam->clearAccessCache();
+    if (!m_ConnectionReuse) {
+        m_Nam->clearAccessCache();
+    }
 #endif
     disconnect(sslErrorsConnection);
 
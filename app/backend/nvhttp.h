@@ -7,6 +7,7 @@
 #include <Limelight.h>
 
 #include <QUrl>
+#include <QHash>
 #include <QNetworkAccessManager>
 #include <QNetworkReply>
 
@@ -117,6 +118,10 @@ public:
     int
     getCurrentGame(QString serverInfo);
 
+    static
+    int
+    getCurrentGame(const QHash<QString, QString>& serverInfoStrings);
+
     QString
     getServerInfo(NvLogLevel logLevel, bool fastFail = false);
 
@@ -129,6 +134,12 @@ public:
     getXmlString(QString xml,
                  QString tagName);
 
+    // Reads the text of every leaf element in a single pass. Like
+    // getXmlString(), the first element with a given name wins.
+    static
+    QHash<QString, QString>
+    getXmlStrings(QString xml);
+
     static
     QByteArray
     getXmlStringFromHex(QString xml,
@@ -143,6 +154,10 @@ public:
 
     void setServerCert(QSslCertificate serverCert);
 
+    // Keeps connections (and TLS sessions) open between requests. GFE breaks
+    // if we keep persistent connections, so this is only for other hosts.
+    void setConnectionReuse(bool enabled);
+
     void setAddress(NvAddress address);
     void setHttpsPort(uint16_t port);
 
@@ -175,6 +190,14 @@ public:
     QVector<NvApp>
     getAppList();
 
+    // Fetches the raw applist XML, so callers can skip parsing an unchanged list
+    QString
+    getAppListXml();
+
+    static
+    QVector<NvApp>
+    parseAppList(QString appxml);
+
     QImage
     getBoxArt(int appId);
 
@@ -198,4 +221,5 @@ private:
     NvAddress m_Address;
     QNetworkAccessManager* m_Nam;
     QSslCertificate m_ServerCert;
+    bool m_ConnectionReuse;
 };
@@ -12,7 +12,10 @@
 #define REQUEST_TIMEOUT_MS 5000
 
 NvPairingManager::NvPairingManager(NvComputer* computer) :
-    m_Http(computer)
+    m_Http(computer),
+    m_ServerCert(nullptr),
+    m_NetworkTimeMs(0),
+    m_LocalTimeMs(0)
 {
     QByteArray cert = IdentityManager::get()->getCertificate();
     BIO *bio = BIO_new_mem_buf(cert.data(), -1);
@@ -35,10 +38,22 @@ NvPairingManager::NvPairingManager(NvComputer* computer) :
     {
         throw std::runtime_error("Unable to load private key");
     }
+
+    m_ClientCertHex = cert.toHex();
+    m_ClientCertSignature = getSignatureFromCert(m_Cert);
+
+    m_CipherCtx = EVP_CIPHER_CTX_new();
+    THROW_BAD_ALLOC_IF_NULL(m_CipherCtx);
+
+    m_DigestCtx = EVP_MD_CTX_create();
+    THROW_BAD_ALLOC_IF_NULL(m_DigestCtx);
 }
 
 NvPairingManager::~NvPairingManager()
 {
+    EVP_CIPHER_CTX_free(m_CipherCtx);
+    EVP_MD_CTX_destroy(m_DigestCtx);
+    X509_free(m_ServerCert);
     X509_free(m_Cert);
     EVP_PKEY_free(m_PrivateKey);
 }
@@ -55,24 +70,18 @@ QByteArray
 NvPairingManager::encrypt(const QByteArray& plaintext, const QByteArray& key)
 {
     QByteArray ciphertext(plaintext.size(), 0);
-    EVP_CIPHER_CTX* cipher;
     int ciphertextLen;
 
-    cipher = EVP_CIPHER_CTX_new();
-    THROW_BAD_ALLOC_IF_NULL(cipher);
-
-    EVP_EncryptInit(cipher, EVP_aes_128_ecb(), reinterpret_cast<const unsigned char*>(key.data()), NULL);
-    EVP_CIPHER_CTX_set_padding(cipher, 0);
+    EVP_EncryptInit_ex(m_CipherCtx, EVP_aes_128_ecb(), NULL, reinterpret_cast<const unsigned char*>(key.data()), NULL);
+    EVP_CIPHER_CTX_set_padding(m_CipherCtx, 0);
 
-    EVP_EncryptUpdate(cipher,
+    EVP_EncryptUpdate(m_CipherCtx,
                       reinterpret_cast<unsigned char*>(ciphertext.data()),
                       &ciphertextLen,
                       reinterpret_cast<const unsigned char*>(plaintext.data()),
                       plaintext.length());
     Q_ASSERT(ciphertextLen == ciphertext.length());
 
-    EVP_CIPHER_CTX_free(cipher);
-
     return ciphertext;
 }
 
@@ -80,40 +89,24 @@ QByteArray
 NvPairingManager::decrypt(const QByteArray& ciphertext, const QByteArray& key)
 {
     QByteArray plaintext(ciphertext.size(), 0);
-    EVP_CIPHER_CTX* cipher;
     int plaintextLen;
 
-    cipher = EVP_CIPHER_CTX_new();
-    THROW_BAD_ALLOC_IF_NULL(cipher);
-
-    EVP_DecryptInit(cipher, EVP_aes_128_ecb(), reinterpret_cast<const unsigned char*>(key.data()), NULL);
-    EVP_CIPHER_CTX_set_padding(cipher, 0);
+    EVP_DecryptInit_ex(m_CipherCtx, EVP_aes_128_ecb(), NULL, reinterpret_cast<const unsigned char*>(key.data()), NULL);
+    EVP_CIPHER_CTX_set_padding(m_CipherCtx, 0);
 
-    EVP_DecryptUpdate(cipher,
+    EVP_DecryptUpdate(m_CipherCtx,
                       reinterpret_cast<unsigned char*>(plaintext.data()),
                       &plaintextLen,
                       reinterpret_cast<const unsigned char*>(ciphertext.data()),
                       ciphertext.length());
     Q_ASSERT(plaintextLen == plaintext.length());
 
-    EVP_CIPHER_CTX_free(cipher);
-
     return plaintext;
 }
 
 QByteArray
-NvPairingManager::getSignatureFromPemCert(const QByteArray& certificate)
+NvPairingManager::getSignatureFromCert(X509* cert)
 {
-#if (OPENSSL_VERSION_NUMBER < 0x10100000L)
-    BIO* bio = BIO_new_mem_buf(const_cast<char*>(certificate.data()), -1);
-#else
-    BIO* bio = BIO_new_mem_buf(certificate.data(), -1);
-#endif
-    THROW_BAD_ALLOC_IF_NULL(bio);
-
-    X509* cert = PEM_read_bio_X509(bio, nullptr, nullptr, nullptr);
-    BIO_free_all(bio);
-
 #if (OPENSSL_VERSION_NUMBER < 0x10002000L)
     ASN1_BIT_STRING *asnSignature = cert->signature;
 #elif (OPENSSL_VERSION_NUMBER < 0x10100000L)
@@ -124,39 +117,31 @@ NvPairingManager::getSignatureFromPemCert(const QByteArray& certificate)
     X509_get0_signature(&asnSignature, NULL, cert);
 #endif
 
-    QByteArray signature(reinterpret_cast<char*>(asnSignature->data), asnSignature->length);
-
-    X509_free(cert);
-
-    return signature;
+    return QByteArray(reinterpret_cast<const char*>(asnSignature->data), asnSignature->length);
 }
 
-bool
-NvPairingManager::verifySignature(const QByteArray& data, const QByteArray& signature, const QByteArray& serverCertificate)
+void
+NvPairingManager::resetDigestContext()
 {
 #if (OPENSSL_VERSION_NUMBER < 0x10100000L)
-    BIO* bio = BIO_new_mem_buf(const_cast<char*>(serverCertificate.data()), -1);
+    EVP_MD_CTX_cleanup(m_DigestCtx);
 #else
-    BIO* bio = BIO_new_mem_buf(serverCertificate.data(), -1);
+    EVP_MD_CTX_reset(m_DigestCtx);
 #endif
-    THROW_BAD_ALLOC_IF_NULL(bio);
-
-    X509* cert = PEM_read_bio_X509(bio, nullptr, nullptr, nullptr);
-    BIO_free_all(bio);
+}
 
-    EVP_PKEY* pubKey = X509_get_pubkey(cert);
+bool
+NvPairingManager::verifySignature(const QByteArray& data, const QByteArray& signature, X509* serverCert)
+{
+    EVP_PKEY* pubKey = X509_get_pubkey(serverCert);
     THROW_BAD_ALLOC_IF_NULL(pubKey);
 
-    EVP_MD_CTX* mdctx = EVP_MD_CTX_create();
-    THROW_BAD_ALLOC_IF_NULL(mdctx);
-
-    EVP_DigestVerifyInit(mdctx, nullptr, EVP_sha256(), nullptr, pubKey);
-    EVP_DigestVerifyUpdate(mdctx, data.data(), data.length());
-    int result = EVP_DigestVerifyFinal(mdctx, reinterpret_cast<unsigned char*>(const_cast<char*>(signature.data())), signature.length());
+    resetDigestContext();
+    EVP_DigestVerifyInit(m_DigestCtx, nullptr, EVP_sha256(), nullptr, pubKey);
+    EVP_DigestVerifyUpdate(m_DigestCtx, data.data(), data.length());
+    int result = EVP_DigestVerifyFinal(m_DigestCtx, reinterpret_cast<unsigned char*>(const_cast<char*>(signature.data())), signature.length());
 
     EVP_PKEY_free(pubKey);
-    EVP_MD_CTX_destroy(mdctx);
-    X509_free(cert);
 
     return result > 0;
 }
@@ -164,23 +149,35 @@ NvPairingManager::verifySignature(const QByteArray& data, const QByteArray& sign
 QByteArray
 NvPairingManager::signMessage(const QByteArray& message)
 {
-    EVP_MD_CTX *ctx = EVP_MD_CTX_create();
-    THROW_BAD_ALLOC_IF_NULL(ctx);
-
-    EVP_DigestSignInit(ctx, NULL, EVP_sha256(), NULL, m_PrivateKey);
-    EVP_DigestSignUpdate(ctx, reinterpret_cast<unsigned char*>(const_cast<char*>(message.data())), message.length());
+    resetDigestContext();
+    EVP_DigestSignInit(m_DigestCtx, NULL, EVP_sha256(), NULL, m_PrivateKey);
+    EVP_DigestSignUpdate(m_DigestCtx, reinterpret_cast<unsigned char*>(const_cast<char*>(message.data())), message.length());
 
     size_t signatureLength = 0;
-    EVP_DigestSignFinal(ctx, NULL, &signatureLength);
+    EVP_DigestSignFinal(m_DigestCtx, NULL, &signatureLength);
 
     QByteArray signature((int)signatureLength, 0);
-    EVP_DigestSignFinal(ctx, reinterpret_cast<unsigned char*>(signature.data()), &signatureLength);
-
-    EVP_MD_CTX_destroy(ctx);
+    EVP_DigestSignFinal(m_DigestCtx, reinterpret_cast<unsigned char*>(signature.data()), &signatureLength);
 
     return signature;
 }
 
+QString
+NvPairingManager::openPairingRequest(const char* phase, const QUrl& baseUrl, const QString& arguments, int timeoutMs)
+{
+    // Everything since the last request finished was local work
+    qint64 localMs = m_PhaseTimer.restart();
+
+    QString response = m_Http.openConnectionToString(baseUrl, "pair", arguments, timeoutMs);
+
+    qint64 networkMs = m_PhaseTimer.restart();
+    m_LocalTimeMs += localMs;
+    m_NetworkTimeMs += networkMs;
+
+    qInfo() << "Pairing phase" << phase << "took" << localMs << "ms locally and" << networkMs << "ms on the network";
+    return response;
+}
+
 QByteArray
 NvPairingManager::saltPin(const QByteArray& salt, QString pin)
 {
@@ -190,6 +187,10 @@ NvPairingManager::saltPin(const QByteArray& salt, QString pin)
 NvPairingManager::PairState
 NvPairingManager::pair(QString appVersion, QString pin, QSslCertificate& serverCert)
 {
+    m_PhaseTimer.start();
+    m_NetworkTimeMs = 0;
+    m_LocalTimeMs = 0;
+
     int serverMajorVersion = NvHTTP::parseQuad(appVersion).at(0);
     qInfo() << "Pairing with server generation:" << serverMajorVersion;
 
@@ -208,17 +209,20 @@ NvPairingManager::pair(QString appVersion, QString pin, QSslCertificate& serverC
         hashLength = 20;
     }
 
-    QByteArray salt = generateRandomBytes(16);
+    // Get the salt, challenge and client secret in one go
+    QByteArray randomBytes = generateRandomBytes(48);
+    QByteArray salt = randomBytes.left(16);
     QByteArray saltedPin = saltPin(salt, pin);
 
     QByteArray aesKey = QCryptographicHash::hash(saltedPin, hashAlgo).constData();
     aesKey.truncate(16);
 
-    QString getCert = m_Http.openConnectionToString(m_Http.m_BaseUrlHttp,
-                                                    "pair",
-                                                    "devicename=roth&updateState=1&phrase=getservercert&salt=" +
-                                                    salt.toHex() + "&clientcert=" + IdentityManager::get()->getCertificate().toHex(),
-                                                    0);
+    // The network time for this phase includes waiting for the user to enter the PIN
+    QString getCert = openPairingRequest("getservercert",
+                                         m_Http.m_BaseUrlHttp,
+                                         "devicename=roth&updateState=1&phrase=getservercert&salt=" +
+                                         salt.toHex() + "&clientcert=" + m_ClientCertHex,
+                                         0);
     NvHTTP::verifyResponseStatus(getCert);
     if (NvHTTP::getXmlString(getCert, "paired") != "1")
     {
@@ -243,17 +247,34 @@ NvPairingManager::pair(QString appVersion, QString pin, QSslCertificate& serverC
         return PairState::FAILED;
     }
 
+    // Parse the cert for OpenSSL once for both the signature check and the PIN check
+#if (OPENSSL_VERSION_NUMBER < 0x10100000L)
+    BIO* bio = BIO_new_mem_buf(const_cast<char*>(serverCertStr.data()), -1);
+#else
+    BIO* bio = BIO_new_mem_buf(serverCertStr.data(), -1);
+#endif
+    THROW_BAD_ALLOC_IF_NULL(bio);
+
+    X509_free(m_ServerCert);
+    m_ServerCert = PEM_read_bio_X509(bio, nullptr, nullptr, nullptr);
+    BIO_free_all(bio);
+    if (m_ServerCert == nullptr) {
+        qCritical() << "Failed to load plaincert";
+        m_Http.openConnectionToString(m_Http.m_BaseUrlHttp, "unpair", nullptr, REQUEST_TIMEOUT_MS);
+        return PairState::FAILED;
+    }
+
     // Pin this cert for TLS until pairing is complete. If successful, we will propagate
     // the cert into the NvComputer object and persist it.
     m_Http.setServerCert(unverifiedServerCert);
 
-    QByteArray randomChallenge = generateRandomBytes(16);
+    QByteArray randomChallenge = randomBytes.mid(16, 16);
     QByteArray encryptedChallenge = encrypt(randomChallenge, aesKey);
-    QString challengeXml = m_Http.openConnectionToString(m_Http.m_BaseUrlHttp,
-                                                         "pair",
-                                                         "devicename=roth&updateState=1&clientchallenge=" +
-                                                         encryptedChallenge.toHex(),
-                                                         REQUEST_TIMEOUT_MS);
+    QString challengeXml = openPairingRequest("clientchallenge",
+                                              m_Http.m_BaseUrlHttp,
+                                              "devicename=roth&updateState=1&clientchallenge=" +
+                                              encryptedChallenge.toHex(),
+                                              REQUEST_TIMEOUT_MS);
     NvHTTP::verifyResponseStatus(challengeXml);
     if (NvHTTP::getXmlString(challengeXml, "paired") != "1")
     {
@@ -263,32 +284,22 @@ NvPairingManager::pair(QString appVersion, QString pin, QSslCertificate& serverC
     }
 
     QByteArray challengeResponseData = decrypt(m_Http.getXmlStringFromHex(challengeXml, "challengeresponse"), aesKey);
-    QByteArray clientSecretData = generateRandomBytes(16);
+    QByteArray clientSecretData = randomBytes.mid(32, 16);
     QByteArray challengeResponse;
     QByteArray serverResponse(challengeResponseData.data(), hashLength);
 
-#if (OPENSSL_VERSION_NUMBER < 0x10002000L)
-    ASN1_BIT_STRING *asnSignature = m_Cert->signature;
-#elif (OPENSSL_VERSION_NUMBER < 0x10100000L)
-    ASN1_BIT_STRING *asnSignature;
-    X509_get0_signature(&asnSignature, NULL, m_Cert);
-#else
-    const ASN1_BIT_STRING *asnSignature;
-    X509_get0_signature(&asnSignature, NULL, m_Cert);
-#endif
-
     challengeResponse.append(challengeResponseData.data() + hashLength, 16);
-    challengeResponse.append(reinterpret_cast<char*>(asnSignature->data), asnSignature->length);
+    challengeResponse.append(m_ClientCertSignature);
     challengeResponse.append(clientSecretData);
 
     QByteArray paddedHash = QCryptographicHash::hash(challengeResponse, hashAlgo);
     paddedHash.resize(32);
     QByteArray encryptedChallengeResponseHash = encrypt(paddedHash, aesKey);
-    QString respXml = m_Http.openConnectionToString(m_Http.m_BaseUrlHttp,
-                                                    "pair",
-                                                    "devicename=roth&updateState=1&serverchallengeresp=" +
-                                                    encryptedChallengeResponseHash.toHex(),
-                                                    REQUEST_TIMEOUT_MS);
+    QString respXml = openPairingRequest("serverchallengeresp",
+                                         m_Http.m_BaseUrlHttp,
+                                         "devicename=roth&updateState=1&serverchallengeresp=" +
+                                         encryptedChallengeResponseHash.toHex(),
+                                         REQUEST_TIMEOUT_MS);
     NvHTTP::verifyResponseStatus(respXml);
     if (NvHTTP::getXmlString(respXml, "paired") != "1")
     {
@@ -303,7 +314,7 @@ NvPairingManager::pair(QString appVersion, QString pin, QSslCertificate& serverC
 
     if (!verifySignature(serverSecret,
                          serverSignature,
-                         serverCertStr))
+                         m_ServerCert))
     {
         qCritical() << "MITM detected";
         m_Http.openConnectionToString(m_Http.m_BaseUrlHttp, "unpair", nullptr, REQUEST_TIMEOUT_MS);
@@ -312,7 +323,7 @@ NvPairingManager::pair(QString appVersion, QString pin, QSslCertificate& serverC
 
     QByteArray expectedResponseData;
     expectedResponseData.append(randomChallenge);
-    expectedResponseData.append(getSignatureFromPemCert(serverCertStr));
+    expectedResponseData.append(getSignatureFromCert(m_ServerCert));
     expectedResponseData.append(serverSecret);
     if (QCryptographicHash::hash(expectedResponseData, hashAlgo) != serverResponse)
     {
@@ -325,11 +336,11 @@ NvPairingManager::pair(QString appVersion, QString pin, QSslCertificate& serverC
     clientPairingSecret.append(clientSecretData);
     clientPairingSecret.append(signMessage(clientSecretData));
 
-    QString secretRespXml = m_Http.openConnectionToString(m_Http.m_BaseUrlHttp,
-                                                          "pair",
-                                                          "devicename=roth&updateState=1&clientpairingsecret=" +
-                                                          clientPairingSecret.toHex(),
-                                                          REQUEST_TIMEOUT_MS);
+    QString secretRespXml = openPairingRequest("clientpairingsecret",
+                                               m_Http.m_BaseUrlHttp,
+                                               "devicename=roth&updateState=1&clientpairingsecret=" +
+                                               clientPairingSecret.toHex(),
+                                               REQUEST_TIMEOUT_MS);
     NvHTTP::verifyResponseStatus(secretRespXml);
     if (NvHTTP::getXmlString(secretRespXml, "paired") != "1")
     {
@@ -338,10 +349,10 @@ NvPairingManager::pair(QString appVersion, QString pin, QSslCertificate& serverC
         return PairState::FAILED;
     }
 
-    QString pairChallengeXml = m_Http.openConnectionToString(m_Http.m_BaseUrlHttps,
-                                                             "pair",
-                                                             "devicename=roth&updateState=1&phrase=pairchallenge",
-                                                             REQUEST_TIMEOUT_MS);
+    QString pairChallengeXml = openPairingRequest("pairchallenge",
+                                                  m_Http.m_BaseUrlHttps,
+                                                  "devicename=roth&updateState=1&phrase=pairchallenge",
+                                                  REQUEST_TIMEOUT_MS);
     NvHTTP::verifyResponseStatus(pairChallengeXml);
     if (NvHTTP::getXmlString(pairChallengeXml, "paired") != "1")
     {
@@ -350,6 +361,8 @@ NvPairingManager::pair(QString appVersion, QString pin, QSslCertificate& serverC
         return PairState::FAILED;
     }
 
+    qInfo() << "Pairing took" << m_LocalTimeMs + m_PhaseTimer.elapsed() << "ms locally and" << m_NetworkTimeMs << "ms on the network";
+
     serverCert = std::move(unverifiedServerCert);
     return PairState::PAIRED;
 }
@@ -3,6 +3,8 @@
 #include "identitymanager.h"
 #include "nvhttp.h"
 
+#include <QElapsedTimer>
+
 #include <openssl/x509.h>
 #include <openssl/evp.h>
 
@@ -37,16 +39,36 @@ private:
     QByteArray
     decrypt(const QByteArray& ciphertext, const QByteArray& key);
 
-    QByteArray
-    getSignatureFromPemCert(const QByteArray& certificate);
+    static QByteArray
+    getSignatureFromCert(X509* cert);
+
+    void
+    resetDigestContext();
 
     bool
-    verifySignature(const QByteArray& data, const QByteArray& signature, const QByteArray& serverCertificate);
+    verifySignature(const QByteArray& data, const QByteArray& signature, X509* serverCert);
 
     QByteArray
     signMessage(const QByteArray& message);
 
+    QString
+    openPairingRequest(const char* phase, const QUrl& baseUrl, const QString& arguments, int timeoutMs);
+
     NvHTTP m_Http;
     X509* m_Cert;
     EVP_PKEY* m_PrivateKey;
+    X509* m_ServerCert;
+
+    // Reused for every encryption, signature and verification in a pairing attempt
+    EVP_CIPHER_CTX* m_CipherCtx;
+    EVP_MD_CTX* m_DigestCtx;
+
+    // These don't change between pairing attempts
+    QByteArray m_ClientCertHex;
+    QByteArray m_ClientCertSignature;
+
+    // Splits the time spent in pair() between the network and local work
+    QElapsedTimer m_PhaseTimer;
+    qint64 m_NetworkTimeMs;
+    qint64 m_LocalTimeMs;
 };
@@ -3,6 +3,9 @@
 
 #include <QGuiApplication>
 #include <QLibraryInfo>
+#include <QSettings>
+#include <QThread>
+#include <QTimer>
 
 #include "streaming/session.h"
 #include "streaming/streamutils.h"
@@ -12,7 +15,42 @@
 #include <Windows.h>
 #endif
 
+#define SER_SYSPROPSCACHE "systempropertiescache"
+#define SER_DISPLAYCONFIG "displayconfig"
+#define SER_HWACCEL "hwaccel"
+#define SER_ALWAYSFULLSCREEN "alwaysfullscreen"
+#define SER_HDR "hdr"
+#define SER_MAXRES "maxres"
+
+class QuerySdlVideoThread : public QThread
+{
+public:
+    QuerySdlVideoThread(SystemProperties* me) :
+        QThread(nullptr),
+        m_Me(me) {}
+
+    void run() override
+    {
+        bool hasHardwareAcceleration, rendererAlwaysFullScreen, supportsHdr;
+        QSize maximumResolution;
+
+        if (SystemProperties::probeDecoderInfo(hasHardwareAcceleration, rendererAlwaysFullScreen,
+                                               supportsHdr, maximumResolution)) {
+            QMetaObject::invokeMethod(m_Me, "applyDecoderInfo", Qt::QueuedConnection,
+                                      Q_ARG(bool, hasHardwareAcceleration),
+                                      Q_ARG(bool, rendererAlwaysFullScreen),
+                                      Q_ARG(bool, supportsHdr),
+                                      Q_ARG(QSize, maximumResolution));
+        }
+    }
+
+private:
+    SystemProperties* m_Me;
+};
+
 SystemProperties::SystemProperties()
+    : decoderInfoThread(nullptr),
+      decoderInfoRefreshPending(false)
 {
     versionString = QString(VERSION_STR);
     hasDesktopEnvironment = WMUtils::isRunningDesktopEnvironment();
@@ -77,6 +115,16 @@ SystemProperties::SystemProperties()
     Q_ASSERT(!monitorSafeAreaResolutions.isEmpty());
 }
 
+SystemProperties::~SystemProperties()
+{
+    // Don't let the probe outlive us
+    if (decoderInfoThread != nullptr) {
+        decoderInfoThread->wait();
+        delete decoderInfoThread;
+        SDL_QuitSubSystem(SDL_INIT_VIDEO);
+    }
+}
+
 QRect SystemProperties::getNativeResolution(int displayIndex)
 {
     // Returns default constructed QRect if out of bounds
@@ -98,17 +146,41 @@ int SystemProperties::getRefreshRate(int displayIndex)
 void SystemProperties::querySdlVideoInfo()
 {
     hasHardwareAcceleration = false;
+    rendererAlwaysFullScreen = false;
+    supportsHdr = false;
+
+    // Update display related attributes (max FPS, native resolution, etc).
+    // This is cheap, so we always query it directly.
+    refreshDisplays();
+
+    // The decoder probe is the slow part, so we use the results from the
+    // last launch with this display setup and check them in the background.
+    if (loadCachedDecoderInfo()) {
+        SDL_LogInfo(SDL_LOG_CATEGORY_APPLICATION,
+                    "Using cached decoder info until the background probe completes");
+        startDecoderInfoRefresh();
+    }
+    else if (probeDecoderInfo(hasHardwareAcceleration, rendererAlwaysFullScreen,
+                              supportsHdr, maximumResolution)) {
+        storeCachedDecoderInfo();
+    }
+}
+
+bool SystemProperties::probeDecoderInfo(bool& hasHardwareAcceleration, bool& rendererAlwaysFullScreen,
+                                        bool& supportsHdr, QSize& maximumResolution)
+{
+    hasHardwareAcceleration = false;
+    rendererAlwaysFullScreen = false;
+    supportsHdr = false;
+    maximumResolution = QSize();
 
     if (SDL_InitSubSystem(SDL_INIT_VIDEO) != 0) {
         SDL_LogError(SDL_LOG_CATEGORY_APPLICATION,
                      "SDL_InitSubSystem(SDL_INIT_VIDEO) failed: %s",
                      SDL_GetError());
-        return;
+        return false;
     }
 
-    // Update display related attributes (max FPS, native resolution, etc).
-    refreshDisplays();
-
     SDL_Window* testWindow = SDL_CreateWindow("", 0, 0, 1280, 720,
                                               SDL_WINDOW_HIDDEN | StreamUtils::getPlatformWindowFlags());
     if (!testWindow) {
@@ -122,7 +194,7 @@ void SystemProperties::querySdlVideoInfo()
                          "Failed to create window for hardware decode test: %s",
                          SDL_GetError());
             SDL_QuitSubSystem(SDL_INIT_VIDEO);
-            return;
+            return false;
         }
     }
 
@@ -131,6 +203,117 @@ void SystemProperties::querySdlVideoInfo()
     SDL_DestroyWindow(testWindow);
 
     SDL_QuitSubSystem(SDL_INIT_VIDEO);
+    return true;
+}
+
+bool SystemProperties::loadCachedDecoderInfo()
+{
+    // Set SYSTEM_PROPERTIES_CACHE=0 to always probe synchronously
+    if (qgetenv("SYSTEM_PROPERTIES_CACHE") == "0" || displayConfiguration.isEmpty()) {
+        return false;
+    }
+
+    QSettings settings;
+    settings.beginGroup(SER_SYSPROPSCACHE);
+
+    // A different display setup can change which decoders and renderers
+    // work, so we only trust results from the same one.
+    if (settings.value(SER_DISPLAYCONFIG).toString() != displayConfiguration) {
+        return false;
+    }
+
+    hasHardwareAcceleration = settings.value(SER_HWACCEL).toBool();
+    rendererAlwaysFullScreen = settings.value(SER_ALWAYSFULLSCREEN).toBool();
+    supportsHdr = settings.value(SER_HDR).toBool();
+    maximumResolution = settings.value(SER_MAXRES).toSize();
+    return true;
+}
+
+void SystemProperties::storeCachedDecoderInfo()
+{
+    if (qgetenv("SYSTEM_PROPERTIES_CACHE") == "0" || displayConfiguration.isEmpty()) {
+        return;
+    }
+
+    QSettings settings;
+    settings.beginGroup(SER_SYSPROPSCACHE);
+    settings.setValue(SER_DISPLAYCONFIG, displayConfiguration);
+    settings.setValue(SER_HWACCEL, hasHardwareAcceleration);
+    settings.setValue(SER_ALWAYSFULLSCREEN, rendererAlwaysFullScreen);
+    settings.setValue(SER_HDR, supportsHdr);
+    settings.setValue(SER_MAXRES, maximumResolution);
+}
+
+void SystemProperties::startDecoderInfoRefresh()
+{
+    // Only one probe at a time. If another is requested while one is
+    // running, that one will pick up the new state when it finishes.
+    if (decoderInfoThread != nullptr || decoderInfoRefreshPending) {
+        decoderInfoRefreshPending = true;
+        return;
+    }
+
+#ifdef Q_OS_DARWIN
+    // Cocoa requires windows to be created on the main thread, so we
+    // just defer the probe until the UI is up.
+    decoderInfoRefreshPending = true;
+    QTimer::singleShot(0, this, [this] {
+        bool newHardwareAcceleration, newRendererAlwaysFullScreen, newSupportsHdr;
+        QSize newMaximumResolution;
+
+        decoderInfoRefreshPending = false;
+        if (probeDecoderInfo(newHardwareAcceleration, newRendererAlwaysFullScreen,
+                             newSupportsHdr, newMaximumResolution)) {
+            applyDecoderInfo(newHardwareAcceleration, newRendererAlwaysFullScreen,
+                             newSupportsHdr, newMaximumResolution);
+        }
+    });
+#else
+    // Hold a reference on the video subsystem for the life of the probe,
+    // so its init and quit calls on the worker never actually bring
+    // the subsystem up or down underneath the main thread.
+    if (SDL_InitSubSystem(SDL_INIT_VIDEO) != 0) {
+        SDL_LogError(SDL_LOG_CATEGORY_APPLICATION,
+                     "SDL_InitSubSystem(SDL_INIT_VIDEO) failed: %s",
+                     SDL_GetError());
+        return;
+    }
+
+    decoderInfoThread = new QuerySdlVideoThread(this);
+    connect(decoderInfoThread, &QThread::finished, this, [this] {
+        decoderInfoThread->deleteLater();
+        decoderInfoThread = nullptr;
+        SDL_QuitSubSystem(SDL_INIT_VIDEO);
+
+        // Run again if something changed while we were probing
+        if (decoderInfoRefreshPending) {
+            decoderInfoRefreshPending = false;
+            startDecoderInfoRefresh();
+        }
+    });
+    decoderInfoThread->start(QThread::LowPriority);
+#endif
+}
+
+void SystemProperties::applyDecoderInfo(bool hasHardwareAcceleration, bool rendererAlwaysFullScreen,
+                                        bool supportsHdr, QSize maximumResolution)
+{
+    bool changed = hasHardwareAcceleration != this->hasHardwareAcceleration ||
+                   rendererAlwaysFullScreen != this->rendererAlwaysFullScreen ||
+                   supportsHdr != this->supportsHdr ||
+                   maximumResolution != this->maximumResolution;
+
+    this->hasHardwareAcceleration = hasHardwareAcceleration;
+    this->rendererAlwaysFullScreen = rendererAlwaysFullScreen;
+    this->supportsHdr = supportsHdr;
+    this->maximumResolution = maximumResolution;
+    storeCachedDecoderInfo();
+
+    if (changed) {
+        SDL_LogInfo(SDL_LOG_CATEGORY_APPLICATION,
+                    "Decoder info changed since it was cached");
+        emit decoderInfoChanged();
+    }
 }
 
 void SystemProperties::refreshDisplays()
@@ -143,6 +326,8 @@ void SystemProperties::refreshDisplays()
     }
 
     monitorNativeResolutions.clear();
+    monitorSafeAreaResolutions.clear();
+    monitorRefreshRates.clear();
 
     SDL_DisplayMode bestMode;
     for (int displayIndex = 0; displayIndex < SDL_GetNumVideoDisplays(); displayIndex++) {
@@ -187,5 +372,26 @@ void SystemProperties::refreshDisplays()
         }
     }
 
+    // The video driver, display modes, and Moonlight version all feed into
+    // which decoders and renderers we can use
+    QString newDisplayConfiguration = QString("%1:%2:%3").arg(VERSION_STR, QGuiApplication::platformName(), SDL_GetCurrentVideoDriver());
+    for (int i = 0; i < monitorNativeResolutions.count(); i++) {
+        newDisplayConfiguration += QString(":%1x%2@%3")
+                                       .arg(monitorNativeResolutions[i].width())
+                                       .arg(monitorNativeResolutions[i].height())
+                                       .arg(monitorRefreshRates.value(i));
+    }
+
     SDL_QuitSubSystem(SDL_INIT_VIDEO);
+
+    // Re-probe just the decoders if the displays changed since the last time
+    if (!displayConfiguration.isEmpty() && newDisplayConfiguration != displayConfiguration) {
+        SDL_LogInfo(SDL_LOG_CATEGORY_APPLICATION,
+                    "Display configuration changed; refreshing decoder info");
+        displayConfiguration = newDisplayConfiguration;
+        startDecoderInfoRefresh();
+    }
+    else {
+        displayConfiguration = newDisplayConfiguration;
+    }
 }
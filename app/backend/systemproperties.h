@@ -2,6 +2,9 @@
 
 #include <QObject>
 #include <QRect>
+#include <QSize>
+
+class QThread;
 
 class SystemProperties : public QObject
 {
@@ -13,8 +16,10 @@ class SystemProperties : public QObject
 public:
     SystemProperties();
 
-    Q_PROPERTY(bool hasHardwareAcceleration MEMBER hasHardwareAcceleration CONSTANT)
-    Q_PROPERTY(bool rendererAlwaysFullScreen MEMBER rendererAlwaysFullScreen CONSTANT)
+    ~SystemProperties();
+
+    Q_PROPERTY(bool hasHardwareAcceleration MEMBER hasHardwareAcceleration NOTIFY decoderInfoChanged)
+    Q_PROPERTY(bool rendererAlwaysFullScreen MEMBER rendererAlwaysFullScreen NOTIFY decoderInfoChanged)
     Q_PROPERTY(bool isRunningWayland MEMBER isRunningWayland CONSTANT)
     Q_PROPERTY(bool isRunningXWayland MEMBER isRunningXWayland CONSTANT)
     Q_PROPERTY(bool isWow64 MEMBER isWow64 CONSTANT)
@@ -23,9 +28,9 @@ public:
     Q_PROPERTY(bool hasBrowser MEMBER hasBrowser CONSTANT)
     Q_PROPERTY(bool hasDiscordIntegration MEMBER hasDiscordIntegration CONSTANT)
     Q_PROPERTY(QString unmappedGamepads MEMBER unmappedGamepads NOTIFY unmappedGamepadsChanged)
-    Q_PROPERTY(QSize maximumResolution MEMBER maximumResolution CONSTANT)
+    Q_PROPERTY(QSize maximumResolution MEMBER maximumResolution NOTIFY decoderInfoChanged)
     Q_PROPERTY(QString versionString MEMBER versionString CONSTANT)
-    Q_PROPERTY(bool supportsHdr MEMBER supportsHdr CONSTANT)
+    Q_PROPERTY(bool supportsHdr MEMBER supportsHdr NOTIFY decoderInfoChanged)
     Q_PROPERTY(bool usesMaterial3Theme MEMBER usesMaterial3Theme CONSTANT)
 
     Q_INVOKABLE void refreshDisplays();
@@ -35,10 +40,24 @@ public:
 
 signals:
     void unmappedGamepadsChanged();
+    void decoderInfoChanged();
+
+private slots:
+    void applyDecoderInfo(bool hasHardwareAcceleration, bool rendererAlwaysFullScreen,
+                          bool supportsHdr, QSize maximumResolution);
 
 private:
     void querySdlVideoInfo();
 
+    static bool probeDecoderInfo(bool& hasHardwareAcceleration, bool& rendererAlwaysFullScreen,
+                                 bool& supportsHdr, QSize& maximumResolution);
+
+    bool loadCachedDecoderInfo();
+
+    void storeCachedDecoderInfo();
+
+    void startDecoderInfoRefresh();
+
     bool hasHardwareAcceleration;
     bool rendererAlwaysFullScreen;
     bool isRunningWayland;
@@ -56,5 +75,10 @@ private:
     QString versionString;
     bool supportsHdr;
     bool usesMaterial3Theme;
+
+    // Identifies the display setup the decoder info was probed with
+    QString displayConfiguration;
+    QThread* decoderInfoThread;
+    bool decoderInfoRefreshPending;
 };
 
@@ -0,0 +1,282 @@
+#include "benchmarkaudio.h"
+
+#include "streaming/session.h"
+
+#include <Limelight.h>
+#include <opus_multistream.h>
+
+#include <QCoreApplication>
+
+// Moonlight streams 5 ms Opus frames at 48 kHz
+#define SAMPLE_RATE 48000
+#define SAMPLES_PER_FRAME 240
+
+// One second of packets is looped for the whole run
+#define PACKET_COUNT (SAMPLE_RATE / SAMPLES_PER_FRAME)
+
+#define MAX_PACKET_SIZE 1400
+
+namespace CliBenchmarkAudio
+{
+
+struct BenchmarkResult {
+    bool initialized;
+    uint64_t initTimeUs;
+    int packets;
+    int failedSubmits;
+    uint64_t totalDecodeTimeUs;
+    uint64_t maxDecodeTimeUs;
+    uint64_t totalSubmitTimeUs;
+    uint64_t maxSubmitTimeUs;
+    int latencySamples;
+    uint64_t totalLatencyMs;
+    uint32_t maxLatencyMs;
+    uint32_t targetLatencyMs;
+};
+
+// These match the normal quality Opus configurations that the host sends
+static void getOpusConfig(StreamingPreferences::AudioConfig audioConfig, OPUS_MULTISTREAM_CONFIGURATION* opusConfig)
+{
+    static const unsigned char k_StereoMapping[] = { 0, 1 };
+    static const unsigned char k_51Mapping[] = { 0, 4, 1, 5, 2, 3 };
+    static const unsigned char k_71Mapping[] = { 0, 6, 1, 7, 2, 3, 4, 5 };
+
+    SDL_zerop(opusConfig);
+    opusConfig->sampleRate = SAMPLE_RATE;
+    opusConfig->samplesPerFrame = SAMPLES_PER_FRAME;
+
+    switch (audioConfig) {
+    case StreamingPreferences::AC_51_SURROUND:
+        opusConfig->channelCount = 6;
+        opusConfig->streams = 4;
+        opusConfig->coupledStreams = 2;
+        SDL_memcpy(opusConfig->mapping, k_51Mapping, sizeof(k_51Mapping));
+        break;
+    case StreamingPreferences::AC_71_SURROUND:
+        opusConfig->channelCount = 8;
+        opusConfig->streams = 5;
+        opusConfig->coupledStreams = 3;
+        SDL_memcpy(opusConfig->mapping, k_71Mapping, sizeof(k_71Mapping));
+        break;
+    default:
+        opusConfig->channelCount = 2;
+        opusConfig->streams = 1;
+        opusConfig->coupledStreams = 1;
+        SDL_memcpy(opusConfig->mapping, k_StereoMapping, sizeof(k_StereoMapping));
+        break;
+    }
+}
+
+// Encodes a quiet tone on each channel so the packets are representative of real audio
+static bool encodePackets(const OPUS_MULTISTREAM_CONFIGURATION* opusConfig, QVector<QByteArray>& packets)
+{
+    int error;
+    OpusMSEncoder* encoder = opus_multistream_encoder_create(opusConfig->sampleRate,
+                                                             opusConfig->channelCount,
+                                                             opusConfig->streams,
+                                                             opusConfig->coupledStreams,
+                                                             opusConfig->mapping,
+                                                             OPUS_APPLICATION_RESTRICTED_LOWDELAY,
+                                                             &error);
+    if (encoder == nullptr) {
+        fprintf(stderr, "Failed to create Opus encoder: %d\n", error);
+        return false;
+    }
+
+    QVector<float> pcm(SAMPLES_PER_FRAME * opusConfig->channelCount);
+    unsigned char packet[MAX_PACKET_SIZE];
+
+    for (int i = 0; i < PACKET_COUNT; i++) {
+        for (int s = 0; s < SAMPLES_PER_FRAME; s++) {
+            int t = i * SAMPLES_PER_FRAME + s;
+            for (int ch = 0; ch < opusConfig->channelCount; ch++) {
+                pcm[s * opusConfig->channelCount + ch] = 0.1f * SDL_sinf(2 * 3.14159265f * (220 + 110 * ch) * t / opusConfig->sampleRate);
+            }
+        }
+
+        int length = opus_multistream_encode_float(encoder, pcm.constData(), SAMPLES_PER_FRAME, packet, sizeof(packet));
+        if (length < 0) {
+            fprintf(stderr, "Failed to encode Opus packet: %d\n", length);
+            opus_multistream_encoder_destroy(encoder);
+            return false;
+        }
+
+        packets.append(QByteArray((const char*)packet, length));
+    }
+
+    opus_multistream_encoder_destroy(encoder);
+    return true;
+}
+
+// This mirrors the decode and submit steps of Session::arDecodeAndPlaySample(),
+// delivering packets in real time like moonlight-common-c's audio thread.
+static void benchmarkRenderer(const QString& name,
+                              const OPUS_MULTISTREAM_CONFIGURATION* originalConfig,
+                              const QVector<QByteArray>& packets,
+                              int duration,
+                              BenchmarkResult* result)
+{
+    SDL_zerop(result);
+
+    OPUS_MULTISTREAM_CONFIGURATION opusConfig = *originalConfig;
+
+    uint64_t initStartUs = LiGetMicroseconds();
+    IAudioRenderer* renderer = Session::createAudioRendererByName(name, &opusConfig);
+    result->initTimeUs = LiGetMicroseconds() - initStartUs;
+    if (renderer == nullptr) {
+        return;
+    }
+
+    renderer->remapChannels(&opusConfig);
+
+    int error;
+    OpusMSDecoder* decoder = opus_multistream_decoder_create(opusConfig.sampleRate,
+                                                             opusConfig.channelCount,
+                                                             opusConfig.streams,
+                                                             opusConfig.coupledStreams,
+                                                             opusConfig.mapping,
+                                                             &error);
+    if (decoder == nullptr) {
+        fprintf(stderr, "Failed to create Opus decoder: %d\n", error);
+        delete renderer;
+        return;
+    }
+
+    result->initialized = true;
+
+    int frameSize = renderer->getAudioBufferSampleSize() * opusConfig.channelCount;
+    int packetCount = duration * (opusConfig.sampleRate / opusConfig.samplesPerFrame);
+    uint64_t frameDurationUs = (uint64_t)opusConfig.samplesPerFrame * 1000000 / opusConfig.sampleRate;
+    uint64_t startUs = LiGetMicroseconds();
+
+    for (int i = 0; i < packetCount; i++) {
+        // Wait until this packet would have arrived
+        uint64_t deadlineUs = startUs + i * frameDurationUs;
+        uint64_t nowUs = LiGetMicroseconds();
+        if (deadlineUs > nowUs + 1000) {
+            SDL_Delay((Uint32)((deadlineUs - nowUs) / 1000));
+        }
+
+        const QByteArray& packet = packets[i % packets.size()];
+
+        int desiredBufferSize = frameSize * opusConfig.samplesPerFrame;
+        void* buffer = renderer->getAudioBuffer(&desiredBufferSize);
+        if (buffer == nullptr) {
+            continue;
+        }
+
+        uint64_t decodeStartUs = LiGetMicroseconds();
+        int samplesDecoded;
+        if (renderer->getAudioBufferFormat() == IAudioRenderer::AudioFormat::Float32NE) {
+            samplesDecoded = opus_multistream_decode_float(decoder,
+                                                           (const unsigned char*)packet.constData(),
+                                                           packet.size(),
+                                                           (float*)buffer,
+                                                           desiredBufferSize / frameSize,
+                                                           0);
+        }
+        else {
+            samplesDecoded = opus_multistream_decode(decoder,
+                                                     (const unsigned char*)packet.constData(),
+                                                     packet.size(),
+                                                     (short*)buffer,
+                                                     desiredBufferSize / frameSize,
+                                                     0);
+        }
+        uint64_t decodeTimeUs = LiGetMicroseconds() - decodeStartUs;
+
+        uint64_t submitStartUs = LiGetMicroseconds();
+        bool submitted = renderer->submitAudio(samplesDecoded > 0 ? frameSize * samplesDecoded : 0);
+        uint64_t submitTimeUs = LiGetMicroseconds() - submitStartUs;
+
+        result->packets++;
+        result->totalDecodeTimeUs += decodeTimeUs;
+        result->maxDecodeTimeUs = SDL_max(result->maxDecodeTimeUs, decodeTimeUs);
+        result->totalSubmitTimeUs += submitTimeUs;
+        result->maxSubmitTimeUs = SDL_max(result->maxSubmitTimeUs, submitTimeUs);
+
+        if (!submitted) {
+            result->failedSubmits++;
+            continue;
+        }
+
+        uint32_t latencyMs, targetLatencyMs;
+        if (renderer->getAudioLatency(&latencyMs, &targetLatencyMs)) {
+            result->latencySamples++;
+            result->totalLatencyMs += latencyMs;
+            result->maxLatencyMs = SDL_max(result->maxLatencyMs, latencyMs);
+            result->targetLatencyMs = targetLatencyMs;
+        }
+    }
+
+    opus_multistream_decoder_destroy(decoder);
+
+    // Renderers may require the last one to be gone before the next is created
+    delete renderer;
+}
+
+Launcher::Launcher(BenchmarkAudioCommandLineParser arguments, QObject *parent)
+    : CliBenchmark::Launcher(parent),
+      m_Arguments(arguments)
+{
+}
+
+void Launcher::run()
+{
+    OPUS_MULTISTREAM_CONFIGURATION opusConfig;
+    getOpusConfig(m_Arguments.getAudioConfig(), &opusConfig);
+
+    QVector<QByteArray> packets;
+    if (!encodePackets(&opusConfig, packets)) {
+        QCoreApplication::exit(-1);
+        return;
+    }
+
+    QVector<QPair<QString, BenchmarkResult>> results;
+    for (const QString& name : m_Arguments.getRenderers()) {
+        fprintf(stdout, "Benchmarking %s for %d seconds...\n", qPrintable(name), m_Arguments.getDuration());
+        fflush(stdout);
+
+        BenchmarkResult result;
+        benchmarkRenderer(name, &opusConfig, packets, m_Arguments.getDuration(), &result);
+        results.append(qMakePair(name, result));
+    }
+
+    fprintf(stdout, "\n%d channels, %d samples per frame\n", opusConfig.channelCount, opusConfig.samplesPerFrame);
+    fprintf(stdout, "%-10s %9s %19s %19s %20s %11s %8s\n",
+            "Backend", "Init (ms)", "Decode avg/max (us)", "Submit avg/max (us)",
+            "Latency avg/max (ms)", "Target (ms)", "Failures");
+
+    bool anySucceeded = false;
+    for (const auto& entry : results) {
+        const BenchmarkResult& result = entry.second;
+
+        if (!result.initialized) {
+            fprintf(stdout, "%-10s %9.1f %s\n",
+                    qPrintable(entry.first), result.initTimeUs / 1000.0, "unavailable");
+            continue;
+        }
+
+        anySucceeded = true;
+
+        QString decode = QString("%1/%2").arg(result.packets ? result.totalDecodeTimeUs / result.packets : 0).arg(result.maxDecodeTimeUs);
+        QString submit = QString("%1/%2").arg(result.packets ? result.totalSubmitTimeUs / result.packets : 0).arg(result.maxSubmitTimeUs);
+        QString latency = result.latencySamples ?
+                    QString("%1/%2").arg(result.totalLatencyMs / result.latencySamples).arg(result.maxLatencyMs) :
+                    QString("n/a");
+        QString target = result.latencySamples ? QString::number(result.targetLatencyMs) : QString("n/a");
+
+        fprintf(stdout, "%-10s %9.1f %19s %19s %20s %11s %8d\n",
+                qPrintable(entry.first),
+                result.initTimeUs / 1000.0,
+                qPrintable(decode),
+                qPrintable(submit),
+                qPrintable(latency),
+                qPrintable(target),
+                result.failedSubmits);
+    }
+
+    QCoreApplication::exit(anySucceeded ? 0 : -1);
+}
+
+}
@@ -0,0 +1,20 @@
+#pragma once
+
+#include "benchmarklauncher.h"
+#include "commandlineparser.h"
+
+namespace CliBenchmarkAudio
+{
+
+class Launcher : public CliBenchmark::Launcher
+{
+public:
+    explicit Launcher(BenchmarkAudioCommandLineParser arguments, QObject *parent = nullptr);
+
+private:
+    void run() override;
+
+    BenchmarkAudioCommandLineParser m_Arguments;
+};
+
+}
@@ -0,0 +1,19 @@
+#include "benchmarklauncher.h"
+
+#include <QTimer>
+
+namespace CliBenchmark
+{
+
+Launcher::Launcher(QObject *parent)
+    : QObject(parent)
+{
+}
+
+void Launcher::execute()
+{
+    // QCoreApplication::exit() does nothing until the event loop is running
+    QTimer::singleShot(0, this, [this] { run(); });
+}
+
+}
@@ -0,0 +1,23 @@
+#pragma once
+
+#include <QObject>
+
+namespace CliBenchmark
+{
+
+class Launcher : public QObject
+{
+    Q_OBJECT
+
+public:
+    explicit Launcher(QObject *parent = nullptr);
+
+    // Runs the benchmark once the event loop starts, then exits the application
+    Q_INVOKABLE void execute();
+
+protected:
+    // Calls QCoreApplication::exit() with the result when it's done
+    virtual void run() = 0;
+};
+
+}
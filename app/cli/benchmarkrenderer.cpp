@@ -0,0 +1,518 @@
+#include "benchmarkrenderer.h"
+
+#include "streaming/streamutils.h"
+#include "streaming/video/ffmpeg-renderers/sdlvid.h"
+
+#ifdef Q_OS_WIN32
+#include "streaming/video/ffmpeg-renderers/d3d11va.h"
+#endif
+
+#ifdef HAVE_LIBVA
+#include "streaming/video/ffmpeg-renderers/vaapi.h"
+#endif
+
+#ifdef HAVE_DRM
+#include "streaming/video/ffmpeg-renderers/drm.h"
+#endif
+
+#ifdef HAVE_EGL
+#include "streaming/video/ffmpeg-renderers/eglvid.h"
+#endif
+
+#ifdef HAVE_LIBPLACEBO_VULKAN
+#include "streaming/video/ffmpeg-renderers/plvk.h"
+#endif
+
+#include <Limelight.h>
+
+#include <QCoreApplication>
+#include <QJsonArray>
+#include <QJsonDocument>
+#include <QJsonObject>
+#include <QJsonValue>
+#include <QSysInfo>
+
+extern "C" {
+#include <libavutil/hwcontext.h>
+#include <libavutil/pixdesc.h>
+}
+
+// Frames are uploaded once and cycled, so uploads stay out of the timings
+#define SYNTHETIC_FRAME_COUNT 4
+
+// GPU timings and present feedback lag a few frames behind, and the first
+// frames pay for pipeline and swapchain creation
+#define WARMUP_FRAMES 30
+
+namespace CliBenchmarkRenderer
+{
+
+struct PixelFormatInfo {
+    const char* name;
+    int videoFormat;
+
+    // The layout software decoders output and the one hardware decoders output
+    AVPixelFormat softwareFormat;
+    AVPixelFormat hardwareFormat;
+};
+
+// Hardware decoders output 4:4:4 as packed AYUV (VUYX) and Y410 (XV30)
+static const PixelFormatInfo k_PixelFormats[] = {
+    { "NV12", VIDEO_FORMAT_H265, AV_PIX_FMT_NV12, AV_PIX_FMT_NV12 },
+    { "P010", VIDEO_FORMAT_H265_MAIN10, AV_PIX_FMT_P010, AV_PIX_FMT_P010 },
+#if LIBAVUTIL_VERSION_INT >= AV_VERSION_INT(57, 34, 100)
+    { "YUV444", VIDEO_FORMAT_H265_REXT8_444, AV_PIX_FMT_YUV444P, AV_PIX_FMT_VUYX },
+#else
+    { "YUV444", VIDEO_FORMAT_H265_REXT8_444, AV_PIX_FMT_YUV444P, AV_PIX_FMT_NONE },
+#endif
+#if LIBAVUTIL_VERSION_INT >= AV_VERSION_INT(57, 36, 100)
+    { "YUV444-10bit", VIDEO_FORMAT_H265_REXT10_444, AV_PIX_FMT_YUV444P10, AV_PIX_FMT_XV30 },
+#else
+    { "YUV444-10bit", VIDEO_FORMAT_H265_REXT10_444, AV_PIX_FMT_YUV444P10, AV_PIX_FMT_NONE },
+#endif
+};
+
+struct RendererInfo {
+    const char* name;
+
+    // The hwaccel format of the frames it renders, or AV_PIX_FMT_NONE for software frames
+    AVPixelFormat hwFormat;
+
+    IFFmpegRenderer* (*createBackend)();
+
+    // nullptr if the backend renders to the window itself
+    IFFmpegRenderer* (*createFrontend)(IFFmpegRenderer* backend);
+};
+
+// DXVA2 is missing because its surfaces can only be allocated by the decoder.
+// Use benchmark-video for it.
+static const RendererInfo k_Renderers[] = {
+#ifdef Q_OS_WIN32
+    { "d3d11va", AV_PIX_FMT_D3D11,
+      []() -> IFFmpegRenderer* { return new D3D11VARenderer(0); }, nullptr },
+#endif
+#ifdef HAVE_LIBVA
+    { "vaapi", AV_PIX_FMT_VAAPI,
+      []() -> IFFmpegRenderer* { return new VAAPIRenderer(0); }, nullptr },
+#ifdef HAVE_EGL
+    { "vaapi-egl", AV_PIX_FMT_VAAPI,
+      []() -> IFFmpegRenderer* { return new VAAPIRenderer(0); },
+      [](IFFmpegRenderer* backend) -> IFFmpegRenderer* { return new EGLRenderer(backend); } },
+#endif
+#endif
+#ifdef HAVE_LIBPLACEBO_VULKAN
+    { "vulkan", AV_PIX_FMT_NONE,
+      []() -> IFFmpegRenderer* { return new PlVkRenderer(); }, nullptr },
+#endif
+#ifdef HAVE_DRM
+    { "drm", AV_PIX_FMT_NONE,
+      []() -> IFFmpegRenderer* { return new DrmRenderer(); }, nullptr },
+#endif
+    { "sdl", AV_PIX_FMT_NONE,
+      []() -> IFFmpegRenderer* { return new SdlRenderer(); }, nullptr },
+};
+
+struct RendererState {
+    SDL_Window* window;
+    IFFmpegRenderer* backend;
+    IFFmpegRenderer* frontend;
+    AVCodecContext* context;
+    AVBufferRef* framesContext;
+    AVFrame* frames[SYNTHETIC_FRAME_COUNT];
+};
+
+struct RendererResult {
+    // Empty if the benchmark ran, otherwise why it didn't
+    QString error;
+    QString frameFormat;
+    bool uploaded;
+    int frames;
+    uint64_t totalCpuTimeUs;
+    LATENCY_HISTOGRAM renderTimeHistogram;
+    uint64_t totalGpuTimeUs;
+    int framesWithGpuTime;
+    uint64_t totalPresentLatencyUs;
+    int framesWithPresentLatency;
+};
+
+static AVFrame* allocateSyntheticFrame(AVPixelFormat format, int width, int height, int index)
+{
+    AVFrame* frame = av_frame_alloc();
+    if (frame == nullptr) {
+        return nullptr;
+    }
+
+    frame->format = format;
+    frame->width = width;
+    frame->height = height;
+    if (av_frame_get_buffer(frame, 0) < 0) {
+        av_frame_free(&frame);
+        return nullptr;
+    }
+
+    // Each frame in the cycle gets a different gradient so no renderer can skip it.
+    // The content is only meaningful for planar and semi-planar formats.
+    const AVPixFmtDescriptor* desc = av_pix_fmt_desc_get(format);
+    for (int plane = 0; plane < AV_NUM_DATA_POINTERS && frame->data[plane] != nullptr; plane++) {
+        int planeHeight = plane == 0 ? height : AV_CEIL_RSHIFT(height, desc->log2_chroma_h);
+        for (int y = 0; y < planeHeight; y++) {
+            memset(frame->data[plane] + y * frame->linesize[plane],
+                   plane == 0 ? (uint8_t)(y + index * 32) : 0x80,
+                   frame->linesize[plane]);
+        }
+    }
+
+    return frame;
+}
+
+static bool allocateHardwareFrames(RendererState* state, int width, int height, RendererResult* result)
+{
+    AVHWFramesContext* framesContext = (AVHWFramesContext*)state->context->hw_frames_ctx->data;
+
+    result->frameFormat = av_get_pix_fmt_name(framesContext->sw_format);
+    result->uploaded = true;
+
+    for (int i = 0; i < SYNTHETIC_FRAME_COUNT; i++) {
+        state->frames[i] = av_frame_alloc();
+        if (state->frames[i] == nullptr ||
+                av_hwframe_get_buffer(state->context->hw_frames_ctx, state->frames[i], 0) < 0) {
+            return false;
+        }
+
+        AVFrame* source = allocateSyntheticFrame(framesContext->sw_format,
+                                                 framesContext->width,
+                                                 framesContext->height,
+                                                 i);
+        if (source == nullptr || av_hwframe_transfer_data(state->frames[i], source, 0) < 0) {
+            // The surfaces can still be rendered, they just have undefined contents
+            result->uploaded = false;
+        }
+        av_frame_free(&source);
+
+        // Hardware surfaces are often padded beyond the video size
+        state->frames[i]->width = width;
+        state->frames[i]->height = height;
+    }
+
+    return true;
+}
+
+// Sets the renderer up the way FFmpegVideoDecoder does and creates frames for it.
+// Returns an empty string on success.
+static QString prepareRenderer(const RendererInfo& info,
+                               const PixelFormatInfo& format,
+                               PDECODER_PARAMETERS params,
+                               RendererState* state,
+                               RendererResult* result)
+{
+    state->backend = info.createBackend();
+    if (!state->backend->initialize(params)) {
+        return "initialization failed";
+    }
+
+    if (info.createFrontend != nullptr) {
+        state->frontend = info.createFrontend(state->backend);
+        if (!state->frontend->initialize(params)) {
+            return "frontend initialization failed";
+        }
+    }
+    else if (state->backend->isDirectRenderingSupported()) {
+        state->frontend = state->backend;
+    }
+    else {
+        return "no direct rendering";
+    }
+
+    state->context = avcodec_alloc_context3(nullptr);
+    if (state->context == nullptr) {
+        return "out of memory";
+    }
+    state->context->width = params->width;
+    state->context->height = params->height;
+
+    AVDictionary* options = nullptr;
+    bool prepared = state->backend->prepareDecoderContext(state->context, &options);
+    av_dict_free(&options);
+    if (!prepared) {
+        return "decoder context preparation failed";
+    }
+
+    if (info.hwFormat == AV_PIX_FMT_NONE) {
+        if (!state->backend->isPixelFormatSupported(params->videoFormat, format.softwareFormat)) {
+            return "pixel format unsupported";
+        }
+
+        result->frameFormat = av_get_pix_fmt_name(format.softwareFormat);
+        result->uploaded = true;
+        for (int i = 0; i < SYNTHETIC_FRAME_COUNT; i++) {
+            state->frames[i] = allocateSyntheticFrame(format.softwareFormat, params->width, params->height, i);
+            if (state->frames[i] == nullptr) {
+                return "frame allocation failed";
+            }
+        }
+    }
+    else {
+        // Some renderers supply their own frames context here
+        if (!state->backend->prepareDecoderContextInGetFormat(state->context, info.hwFormat)) {
+            return "frames context preparation failed";
+        }
+
+        if (state->context->hw_frames_ctx == nullptr) {
+            if (state->context->hw_device_ctx == nullptr) {
+                return "no hardware device";
+            }
+            else if (format.hardwareFormat == AV_PIX_FMT_NONE) {
+                return "pixel format unsupported by this FFmpeg";
+            }
+
+            state->framesContext = av_hwframe_ctx_alloc(state->context->hw_device_ctx);
+            if (state->framesContext == nullptr) {
+                return "out of memory";
+            }
+
+            AVHWFramesContext* framesContext = (AVHWFramesContext*)state->framesContext->data;
+            framesContext->format = info.hwFormat;
+            framesContext->sw_format = format.hardwareFormat;
+            framesContext->width = params->width;
+            framesContext->height = params->height;
+            framesContext->initial_pool_size = SYNTHETIC_FRAME_COUNT;
+            if (av_hwframe_ctx_init(state->framesContext) < 0) {
+                return "pixel format unsupported";
+            }
+
+            state->context->hw_frames_ctx = av_buffer_ref(state->framesContext);
+        }
+
+        if (!allocateHardwareFrames(state, params->width, params->height, result)) {
+            return "surface allocation failed";
+        }
+    }
+
+    for (AVFrame* frame : state->frames) {
+        frame->color_range = AVCOL_RANGE_MPEG;
+        frame->colorspace = AVCOL_SPC_BT709;
+        frame->color_primaries = AVCOL_PRI_BT709;
+        frame->color_trc = AVCOL_TRC_BT709;
+        frame->chroma_location = AVCHROMA_LOC_LEFT;
+    }
+
+    state->frontend->prepareToRender();
+    return QString();
+}
+
+static void destroyRenderer(RendererState* state)
+{
+    for (AVFrame*& frame : state->frames) {
+        av_frame_free(&frame);
+    }
+    avcodec_free_context(&state->context);
+    av_buffer_unref(&state->framesContext);
+
+    if (state->frontend != state->backend) {
+        delete state->frontend;
+    }
+    delete state->backend;
+
+    // Renderers may require the last one to be gone before the next is created
+    SDL_DestroyWindow(state->window);
+}
+
+// This mirrors how Pacer renders frames, without pacing or V-Sync so
+// the renderer runs as fast as it can.
+static void benchmarkRenderer(const RendererInfo& info,
+                              const PixelFormatInfo& format,
+                              const BenchmarkRendererCommandLineParser& arguments,
+                              RendererResult* result)
+{
+    result->uploaded = false;
+    result->frames = 0;
+    result->totalCpuTimeUs = 0;
+    SDL_zero(result->renderTimeHistogram);
+    result->totalGpuTimeUs = 0;
+    result->framesWithGpuTime = 0;
+    result->totalPresentLatencyUs = 0;
+    result->framesWithPresentLatency = 0;
+
+    RendererState state = {};
+    state.window = SDL_CreateWindow("Moonlight Renderer Benchmark",
+                                    SDL_WINDOWPOS_UNDEFINED,
+                                    SDL_WINDOWPOS_UNDEFINED,
+                                    arguments.getWidth(),
+                                    arguments.getHeight(),
+                                    StreamUtils::getPlatformWindowFlags());
+    if (state.window == nullptr) {
+        result->error = QString("unable to create window: %1").arg(SDL_GetError());
+        return;
+    }
+
+    DECODER_PARAMETERS params = {};
+    params.window = state.window;
+    params.vds = info.hwFormat != AV_PIX_FMT_NONE ?
+                StreamingPreferences::VDS_FORCE_HARDWARE : StreamingPreferences::VDS_FORCE_SOFTWARE;
+    params.videoFormat = format.videoFormat;
+    params.width = arguments.getWidth();
+    params.height = arguments.getHeight();
+    params.frameRate = 60;
+    params.enableVsync = false;
+    params.enableFramePacing = false;
+    params.enableVrr = false;
+    params.testOnly = false;
+    params.session = nullptr;
+
+    result->error = prepareRenderer(info, format, &params, &state, result);
+    if (!result->error.isEmpty()) {
+        destroyRenderer(&state);
+        return;
+    }
+
+    int totalFrames = WARMUP_FRAMES + arguments.getFrames();
+    for (int i = 0; i < totalFrames; i++) {
+        AVFrame* frame = state.frames[i % SYNTHETIC_FRAME_COUNT];
+        frame->pts = i;
+
+        // Keep the window responsive
+        SDL_PumpEvents();
+
+        state.frontend->waitToRender();
+
+        // Only count CPU time spent rendering
+        StreamUtils::takeThreadCpuTimeUs();
+
+        uint64_t beforeRender = LiGetMicroseconds();
+        state.frontend->renderFrame(frame);
+        uint64_t afterRender = LiGetMicroseconds();
+        uint64_t cpuTimeUs = StreamUtils::takeThreadCpuTimeUs();
+
+        uint64_t gpuTimeUs, presentLatencyUs;
+        bool hasGpuTime = state.frontend->getGpuRenderTime(&gpuTimeUs);
+        bool hasPresentLatency = state.frontend->getPresentLatency(&presentLatencyUs);
+
+        if (i < WARMUP_FRAMES) {
+            continue;
+        }
+
+        result->frames++;
+        result->totalCpuTimeUs += cpuTimeUs;
+        latencyHistogramAdd(result->renderTimeHistogram, afterRender - beforeRender);
+        if (hasGpuTime) {
+            result->totalGpuTimeUs += gpuTimeUs;
+            result->framesWithGpuTime++;
+        }
+        if (hasPresentLatency) {
+            result->totalPresentLatencyUs += presentLatencyUs;
+            result->framesWithPresentLatency++;
+        }
+    }
+
+    destroyRenderer(&state);
+}
+
+static QJsonValue getAverageMs(uint64_t totalUs, int count)
+{
+    return count != 0 ? QJsonValue(totalUs / 1000.0 / count) : QJsonValue();
+}
+
+static QString formatMs(const QJsonValue& value)
+{
+    return value.isDouble() ? QString::number(value.toDouble(), 'f', 2) : "-";
+}
+
+Launcher::Launcher(BenchmarkRendererCommandLineParser arguments, QObject *parent)
+    : CliBenchmark::Launcher(parent),
+      m_Arguments(arguments)
+{
+}
+
+void Launcher::run()
+{
+    if (SDL_InitSubSystem(SDL_INIT_VIDEO) != 0) {
+        fprintf(stderr, "SDL_InitSubSystem(SDL_INIT_VIDEO) failed: %s\n", SDL_GetError());
+        QCoreApplication::exit(-1);
+        return;
+    }
+
+    QJsonArray results;
+    QStringList table;
+    bool anySucceeded = false;
+
+    table.append(QString("%1 %2 %3 %4 %5 %6 %7 %8")
+                 .arg("Renderer", -10).arg("Format", -13).arg("Frames", -10)
+                 .arg("CPU ms", 8).arg("p50 ms", 8).arg("p99 ms", 8)
+                 .arg("GPU ms", 8).arg("Present ms", 11));
+
+    for (const RendererInfo& info : k_Renderers) {
+        if (!m_Arguments.getRenderers().contains(info.name)) {
+            continue;
+        }
+
+        for (const PixelFormatInfo& format : k_PixelFormats) {
+            if (!m_Arguments.getPixelFormats().contains(format.name)) {
+                continue;
+            }
+
+            // Progress goes to stderr to keep stdout parseable
+            fprintf(stderr, "Benchmarking %s with %s frames...\n", info.name, format.name);
+
+            RendererResult result;
+            benchmarkRenderer(info, format, m_Arguments, &result);
+
+            QJsonObject entry;
+            entry["renderer"] = info.name;
+            entry["pixelFormat"] = format.name;
+
+            if (!result.error.isEmpty()) {
+                entry["error"] = result.error;
+                table.append(QString("%1 %2 %3")
+                             .arg(info.name, -10).arg(format.name, -13).arg(result.error));
+            }
+            else {
+                anySucceeded = true;
+
+                QJsonObject renderTime;
+                renderTime["p50"] = latencyHistogramPercentile(result.renderTimeHistogram, 50) / 1000.0;
+                renderTime["p99"] = latencyHistogramPercentile(result.renderTimeHistogram, 99) / 1000.0;
+
+                entry["frameFormat"] = result.frameFormat;
+                entry["contentUploaded"] = result.uploaded;
+                entry["frames"] = result.frames;
+                entry["cpuTimeMs"] = getAverageMs(result.totalCpuTimeUs, result.frames);
+                entry["renderTimeMs"] = renderTime;
+                entry["gpuTimeMs"] = getAverageMs(result.totalGpuTimeUs, result.framesWithGpuTime);
+                entry["presentLatencyMs"] = getAverageMs(result.totalPresentLatencyUs, result.framesWithPresentLatency);
+
+                table.append(QString("%1 %2 %3 %4 %5 %6 %7 %8")
+                             .arg(info.name, -10).arg(format.name, -13).arg(result.frameFormat, -10)
+                             .arg(formatMs(entry["cpuTimeMs"]), 8)
+                             .arg(formatMs(renderTime["p50"]), 8)
+                             .arg(formatMs(renderTime["p99"]), 8)
+                             .arg(formatMs(entry["gpuTimeMs"]), 8)
+                             .arg(formatMs(entry["presentLatencyMs"]), 11));
+            }
+
+            results.append(entry);
+        }
+    }
+
+    QJsonObject machine;
+    machine["os"] = QSysInfo::prettyProductName();
+    machine["cpuArchitecture"] = QSysInfo::currentCpuArchitecture();
+    machine["videoDriver"] = SDL_GetCurrentVideoDriver();
+
+    SDL_QuitSubSystem(SDL_INIT_VIDEO);
+
+    // The comparison table is for people, the JSON is for collecting results across machines
+    fprintf(stderr, "\n%s\n", qPrintable(table.join('\n')));
+
+    QJsonObject root;
+    root["machine"] = machine;
+    root["width"] = m_Arguments.getWidth();
+    root["height"] = m_Arguments.getHeight();
+    root["results"] = results;
+
+    fputs(QJsonDocument(root).toJson().constData(), stdout);
+    fflush(stdout);
+
+    QCoreApplication::exit(anySucceeded ? 0 : -1);
+}
+
+}
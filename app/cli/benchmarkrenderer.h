@@ -0,0 +1,20 @@
+#pragma once
+
+#include "benchmarklauncher.h"
+#include "commandlineparser.h"
+
+namespace CliBenchmarkRenderer
+{
+
+class Launcher : public CliBenchmark::Launcher
+{
+public:
+    explicit Launcher(BenchmarkRendererCommandLineParser arguments, QObject *parent = nullptr);
+
+private:
+    void run() override;
+
+    BenchmarkRendererCommandLineParser m_Arguments;
+};
+
+}
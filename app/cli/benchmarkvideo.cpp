@@ -0,0 +1,501 @@
+#include "benchmarkvideo.h"
+
+#include "streaming/streamutils.h"
+#include "streaming/video/decodeunitcapture.h"
+#include "streaming/video/ffmpeg.h"
+
+#include <Limelight.h>
+
+#include <QCoreApplication>
+#include <QFile>
+#include <QJsonArray>
+#include <QJsonDocument>
+#include <QJsonObject>
+#include <QVector>
+
+extern "C" {
+#include <libavcodec/bsf.h>
+#include <libavformat/avformat.h>
+#include <libavutil/pixdesc.h>
+}
+
+// Caps the memory used by long clips. Shorter runs loop the clip from its first keyframe.
+#define MAX_CLIP_FRAMES 3600
+
+// Time allowed for frames still in the decoder and pacer after the last submission
+#define DRAIN_TIME_MS 500
+
+// The built-in test frames are encoded at 720p
+#define TEST_FRAME_WIDTH 1280
+#define TEST_FRAME_HEIGHT 720
+
+namespace CliBenchmarkVideo
+{
+
+struct EncodedClip {
+    QString source;
+    int videoFormat;
+    int width;
+    int height;
+    int frameRate;
+
+    // Captures are replayed once with their original frame numbers and timing.
+    // Other clips are looped at the requested frame rate.
+    bool originalTiming;
+    QVector<CapturedDecodeUnit> units;
+};
+
+struct BenchmarkResult {
+    bool initialized;
+    uint64_t initTimeUs;
+    QString decoderName;
+    QString rendererName;
+    bool hardwareAccelerated;
+    int submittedFrames;
+    int failedSubmits;
+    uint64_t elapsedUs;
+    VIDEO_STATS stats;
+};
+
+static QString getVideoFormatName(int videoFormat)
+{
+    switch (videoFormat) {
+    case VIDEO_FORMAT_H264:
+        return "H.264";
+    case VIDEO_FORMAT_H265:
+        return "HEVC";
+    case VIDEO_FORMAT_H265_MAIN10:
+        return "HEVC Main10";
+    case VIDEO_FORMAT_AV1_MAIN8:
+        return "AV1";
+    case VIDEO_FORMAT_AV1_MAIN10:
+        return "AV1 10-bit";
+    default:
+        return QString("0x%1").arg(videoFormat, 0, 16);
+    }
+}
+
+static QString getDecoderSelectionName(StreamingPreferences::VideoDecoderSelection vds)
+{
+    switch (vds) {
+    case StreamingPreferences::VDS_FORCE_HARDWARE:
+        return "hardware";
+    case StreamingPreferences::VDS_FORCE_SOFTWARE:
+        return "software";
+    default:
+        return "auto";
+    }
+}
+
+static void addClipFrame(EncodedClip* clip, const uint8_t* data, int size, bool keyFrame)
+{
+    // The loop restarts at the first frame, so it must be a keyframe
+    if (clip->units.isEmpty() && !keyFrame) {
+        return;
+    }
+
+    CapturedDecodeUnit unit = {};
+    unit.frameType = keyFrame ? FRAME_TYPE_IDR : FRAME_TYPE_PFRAME;
+    unit.buffers.append(qMakePair((int)BUFFER_TYPE_PICDATA, QByteArray((const char*)data, size)));
+    clip->units.append(unit);
+}
+
+static bool loadTestFrame(int videoFormat, EncodedClip* clip)
+{
+    const uint8_t* data;
+    int size;
+    if (!FFmpegVideoDecoder::getTestFrame(videoFormat, &data, &size)) {
+        fprintf(stderr, "No built-in test frame for %s\n", qPrintable(getVideoFormatName(videoFormat)));
+        return false;
+    }
+
+    // The test frame is a single IDR frame, so every frame we submit is an IDR frame.
+    // That's a heavier decode than a real stream, which is mostly P-frames.
+    clip->source = "built-in";
+    clip->videoFormat = videoFormat;
+    clip->width = TEST_FRAME_WIDTH;
+    clip->height = TEST_FRAME_HEIGHT;
+    addClipFrame(clip, data, size, true);
+    return true;
+}
+
+static bool loadCapture(const QString& path, EncodedClip* clip)
+{
+    DECODE_UNIT_CAPTURE_INFO info;
+    if (!DecodeUnitCapture::load(path, &info, clip->units)) {
+        fprintf(stderr, "Unable to load decode unit capture %s\n", qPrintable(path));
+        return false;
+    }
+
+    clip->source = path;
+    clip->videoFormat = info.videoFormat;
+    clip->width = info.width;
+    clip->height = info.height;
+    clip->frameRate = info.frameRate;
+    clip->originalTiming = true;
+    return true;
+}
+
+static bool readClip(AVFormatContext* formatContext, EncodedClip* clip)
+{
+    int err = avformat_find_stream_info(formatContext, nullptr);
+    if (err < 0) {
+        fprintf(stderr, "Unable to read stream info: %d\n", err);
+        return false;
+    }
+
+    int streamIndex = av_find_best_stream(formatContext, AVMEDIA_TYPE_VIDEO, -1, -1, nullptr, 0);
+    if (streamIndex < 0) {
+        fprintf(stderr, "No video stream found\n");
+        return false;
+    }
+
+    AVStream* stream = formatContext->streams[streamIndex];
+    AVCodecParameters* codecpar = stream->codecpar;
+
+    const AVPixFmtDescriptor* formatDesc = av_pix_fmt_desc_get((AVPixelFormat)codecpar->format);
+    bool tenBit = formatDesc != nullptr && formatDesc->comp[0].depth > 8;
+
+    // Moonlight decoders take Annex B bitstreams like the host sends
+    const char* bsfName = nullptr;
+    switch (codecpar->codec_id) {
+    case AV_CODEC_ID_H264:
+        clip->videoFormat = VIDEO_FORMAT_H264;
+        bsfName = "h264_mp4toannexb";
+        break;
+    case AV_CODEC_ID_HEVC:
+        clip->videoFormat = tenBit ? VIDEO_FORMAT_H265_MAIN10 : VIDEO_FORMAT_H265;
+        bsfName = "hevc_mp4toannexb";
+        break;
+    case AV_CODEC_ID_AV1:
+        clip->videoFormat = tenBit ? VIDEO_FORMAT_AV1_MAIN10 : VIDEO_FORMAT_AV1_MAIN8;
+        break;
+    default:
+        fprintf(stderr, "Unsupported video codec: %s\n", avcodec_get_name(codecpar->codec_id));
+        return false;
+    }
+
+    clip->width = codecpar->width;
+    clip->height = codecpar->height;
+
+    AVBSFContext* bsfContext = nullptr;
+    if (bsfName != nullptr) {
+        err = av_bsf_alloc(av_bsf_get_by_name(bsfName), &bsfContext);
+        if (err < 0) {
+            fprintf(stderr, "Unable to create %s filter: %d\n", bsfName, err);
+            return false;
+        }
+
+        avcodec_parameters_copy(bsfContext->par_in, codecpar);
+        bsfContext->time_base_in = stream->time_base;
+
+        err = av_bsf_init(bsfContext);
+        if (err < 0) {
+            fprintf(stderr, "Unable to initialize %s filter: %d\n", bsfName, err);
+            av_bsf_free(&bsfContext);
+            return false;
+        }
+    }
+
+    AVPacket* packet = av_packet_alloc();
+    while (clip->units.size() < MAX_CLIP_FRAMES && av_read_frame(formatContext, packet) >= 0) {
+        if (packet->stream_index != streamIndex) {
+            av_packet_unref(packet);
+            continue;
+        }
+
+        if (bsfContext == nullptr) {
+            addClipFrame(clip, packet->data, packet->size, (packet->flags & AV_PKT_FLAG_KEY) != 0);
+            av_packet_unref(packet);
+            continue;
+        }
+
+        // The filter takes ownership of the packet on success
+        if (av_bsf_send_packet(bsfContext, packet) < 0) {
+            av_packet_unref(packet);
+            continue;
+        }
+
+        while (av_bsf_receive_packet(bsfContext, packet) == 0) {
+            addClipFrame(clip, packet->data, packet->size, (packet->flags & AV_PKT_FLAG_KEY) != 0);
+            av_packet_unref(packet);
+        }
+    }
+
+    av_packet_free(&packet);
+    av_bsf_free(&bsfContext);
+
+    if (clip->units.isEmpty()) {
+        fprintf(stderr, "No keyframes found in clip\n");
+        return false;
+    }
+
+    return true;
+}
+
+static bool loadClipFile(const QString& path, EncodedClip* clip)
+{
+    AVFormatContext* formatContext = nullptr;
+    int err = avformat_open_input(&formatContext, QFile::encodeName(path).constData(), nullptr, nullptr);
+    if (err < 0) {
+        fprintf(stderr, "Unable to open %s: %d\n", qPrintable(path), err);
+        return false;
+    }
+
+    clip->source = path;
+    bool ok = readClip(formatContext, clip);
+
+    avformat_close_input(&formatContext);
+    return ok;
+}
+
+// Renders frames the way Session's event loop does while streaming
+static void pumpEvents(FFmpegVideoDecoder* decoder)
+{
+    SDL_Event event;
+    while (SDL_PollEvent(&event)) {
+        if (event.type == SDL_USEREVENT && event.user.code == SDL_CODE_FRAME_READY) {
+            decoder->renderFrameOnMainThread();
+        }
+    }
+}
+
+// This mirrors how moonlight-common-c hands frames to the decoder, submitting
+// each complete frame in real time at the clip's frame rate or captured timing.
+static void benchmarkDecoder(StreamingPreferences::VideoDecoderSelection vds,
+                             const EncodedClip& clip,
+                             const BenchmarkVideoCommandLineParser& arguments,
+                             BenchmarkResult* result)
+{
+    result->initialized = false;
+    result->initTimeUs = 0;
+    result->hardwareAccelerated = false;
+    result->submittedFrames = 0;
+    result->failedSubmits = 0;
+    result->elapsedUs = 0;
+    SDL_zero(result->stats);
+
+    int windowWidth = arguments.getWidth() ? arguments.getWidth() : clip.width;
+    int windowHeight = arguments.getHeight() ? arguments.getHeight() : clip.height;
+
+    SDL_Window* window = SDL_CreateWindow("Moonlight Video Benchmark",
+                                          SDL_WINDOWPOS_UNDEFINED,
+                                          SDL_WINDOWPOS_UNDEFINED,
+                                          windowWidth,
+                                          windowHeight,
+                                          StreamUtils::getPlatformWindowFlags());
+    if (window == nullptr) {
+        fprintf(stderr, "Unable to create window: %s\n", SDL_GetError());
+        return;
+    }
+
+    // Pacing and V-Sync are off so we measure the decoder and renderer rather than the display
+    DECODER_PARAMETERS params = {};
+    params.window = window;
+    params.vds = vds;
+    params.videoFormat = clip.videoFormat;
+    params.width = clip.width;
+    params.height = clip.height;
+    params.frameRate = clip.frameRate;
+    params.enableVsync = false;
+    params.enableFramePacing = false;
+    params.enableVrr = false;
+    params.testOnly = false;
+    params.session = nullptr;
+
+    FFmpegVideoDecoder* decoder = new FFmpegVideoDecoder(false);
+
+    uint64_t initStartUs = LiGetMicroseconds();
+    result->initialized = decoder->initialize(&params);
+    result->initTimeUs = LiGetMicroseconds() - initStartUs;
+    if (!result->initialized) {
+        delete decoder;
+        SDL_DestroyWindow(window);
+        return;
+    }
+
+    result->hardwareAccelerated = decoder->isHardwareAccelerated();
+    result->decoderName = decoder->getBackendRenderer()->getRendererName();
+    result->rendererName = decoder->getFrontendRenderer()->getRendererName();
+
+    int frameCount = clip.originalTiming ? clip.units.size() : arguments.getDuration() * clip.frameRate;
+    uint64_t frameIntervalUs = 1000000 / clip.frameRate;
+    uint64_t startUs = LiGetMicroseconds();
+    QVector<LENTRY> entries;
+
+    for (int i = 0; i < frameCount; i++) {
+        const CapturedDecodeUnit& unit = clip.units[i % clip.units.size()];
+
+        // Captured units are submitted when the decoder originally got them
+        uint64_t offsetUs = clip.originalTiming ?
+                    unit.enqueueTimeUs - clip.units.first().enqueueTimeUs :
+                    i * frameIntervalUs;
+
+        // Render the frames that are ready while we wait for this frame to arrive
+        uint64_t deadlineUs = startUs + offsetUs;
+        for (;;) {
+            pumpEvents(decoder);
+
+            uint64_t nowUs = LiGetMicroseconds();
+            if (nowUs >= deadlineUs) {
+                break;
+            }
+            else if (deadlineUs > nowUs + 1000) {
+                SDL_Delay(1);
+            }
+        }
+
+        DECODE_UNIT du = {};
+
+        entries.resize(unit.buffers.size());
+        for (int j = 0; j < unit.buffers.size(); j++) {
+            entries[j].data = (char*)unit.buffers[j].second.constData();
+            entries[j].length = unit.buffers[j].second.size();
+            entries[j].bufferType = unit.buffers[j].first;
+            entries[j].next = j + 1 < unit.buffers.size() ? &entries[j + 1] : nullptr;
+            du.fullLength += entries[j].length;
+        }
+        du.bufferList = entries.data();
+
+        du.frameType = unit.frameType;
+        du.enqueueTimeUs = LiGetMicroseconds();
+        if (clip.originalTiming) {
+            // Frame number gaps replay the original frame losses
+            du.frameNumber = unit.frameNumber;
+            du.rtpTimestamp = unit.rtpTimestamp;
+            du.frameHostProcessingLatency = unit.frameHostProcessingLatency;
+            du.receiveTimeUs = du.enqueueTimeUs - (unit.enqueueTimeUs - unit.receiveTimeUs);
+        }
+        else {
+            du.frameNumber = i + 1;
+            du.rtpTimestamp = (uint32_t)((uint64_t)i * 90000 / clip.frameRate);
+            du.receiveTimeUs = du.enqueueTimeUs;
+        }
+
+        result->submittedFrames++;
+        if (decoder->submitDecodeUnit(&du) != DR_OK) {
+            result->failedSubmits++;
+        }
+    }
+
+    uint64_t drainEndUs = LiGetMicroseconds() + DRAIN_TIME_MS * 1000;
+    while (LiGetMicroseconds() < drainEndUs) {
+        pumpEvents(decoder);
+        SDL_Delay(1);
+    }
+
+    result->elapsedUs = LiGetMicroseconds() - startUs;
+    decoder->getVideoStats(result->stats);
+
+    // Renderers may require the last one to be gone before the next is created
+    delete decoder;
+    SDL_DestroyWindow(window);
+}
+
+static QJsonObject getPercentiles(const LATENCY_HISTOGRAM& histogram)
+{
+    QJsonObject percentiles;
+    percentiles["p50"] = latencyHistogramPercentile(histogram, 50) / 1000.0;
+    percentiles["p99"] = latencyHistogramPercentile(histogram, 99) / 1000.0;
+    return percentiles;
+}
+
+Launcher::Launcher(BenchmarkVideoCommandLineParser arguments, QObject *parent)
+    : CliBenchmark::Launcher(parent),
+      m_Arguments(arguments)
+{
+}
+
+void Launcher::run()
+{
+    EncodedClip clip;
+    clip.frameRate = m_Arguments.getFps();
+    clip.originalTiming = false;
+
+    bool loaded;
+    if (!m_Arguments.getCaptureFile().isEmpty()) {
+        loaded = loadCapture(m_Arguments.getCaptureFile(), &clip);
+    }
+    else if (!m_Arguments.getFile().isEmpty()) {
+        loaded = loadClipFile(m_Arguments.getFile(), &clip);
+    }
+    else {
+        loaded = loadTestFrame(m_Arguments.getVideoFormat(), &clip);
+    }
+    if (!loaded) {
+        QCoreApplication::exit(-1);
+        return;
+    }
+
+    if (SDL_InitSubSystem(SDL_INIT_VIDEO) != 0) {
+        fprintf(stderr, "SDL_InitSubSystem(SDL_INIT_VIDEO) failed: %s\n", SDL_GetError());
+        QCoreApplication::exit(-1);
+        return;
+    }
+
+    int duration = m_Arguments.getDuration();
+    if (clip.originalTiming) {
+        duration = (int)((clip.units.last().enqueueTimeUs - clip.units.first().enqueueTimeUs + 999999) / 1000000);
+    }
+
+    QJsonArray results;
+    bool anySucceeded = false;
+    for (StreamingPreferences::VideoDecoderSelection vds : m_Arguments.getDecoders()) {
+        // Progress goes to stderr to keep stdout parseable
+        fprintf(stderr, "Benchmarking %s decoding for %d seconds...\n",
+                qPrintable(getDecoderSelectionName(vds)), duration);
+
+        BenchmarkResult result;
+        benchmarkDecoder(vds, clip, m_Arguments, &result);
+
+        QJsonObject entry;
+        entry["videoDecoder"] = getDecoderSelectionName(vds);
+        entry["initialized"] = result.initialized;
+        entry["initTimeMs"] = result.initTimeUs / 1000.0;
+
+        if (result.initialized) {
+            anySucceeded = true;
+
+            const VIDEO_STATS& stats = result.stats;
+            entry["decoder"] = result.decoderName;
+            entry["renderer"] = result.rendererName;
+            entry["hardwareAccelerated"] = result.hardwareAccelerated;
+            entry["submittedFrames"] = result.submittedFrames;
+            entry["failedSubmits"] = result.failedSubmits;
+            entry["decodedFrames"] = (int)stats.decodedFrames;
+            entry["renderedFrames"] = (int)stats.renderedFrames;
+            entry["pacerDroppedFrames"] = (int)stats.pacerDroppedFrames;
+            entry["droppedFrames"] = result.submittedFrames - (int)stats.renderedFrames;
+            entry["renderedFps"] = result.elapsedUs ? stats.renderedFrames * 1000000.0 / result.elapsedUs : 0.0;
+            entry["decodeTimeMs"] = getPercentiles(stats.decodeTimeHistogram);
+            entry["renderTimeMs"] = getPercentiles(stats.renderTimeHistogram);
+        }
+
+        results.append(entry);
+    }
+
+    SDL_QuitSubSystem(SDL_INIT_VIDEO);
+
+    QJsonObject clipInfo;
+    clipInfo["source"] = clip.source;
+    clipInfo["codec"] = getVideoFormatName(clip.videoFormat);
+    clipInfo["width"] = clip.width;
+    clipInfo["height"] = clip.height;
+    clipInfo["frames"] = clip.units.size();
+    clipInfo["originalTiming"] = clip.originalTiming;
+
+    QJsonObject root;
+    root["clip"] = clipInfo;
+    root["fps"] = clip.frameRate;
+    root["duration"] = duration;
+    root["windowWidth"] = m_Arguments.getWidth() ? m_Arguments.getWidth() : clip.width;
+    root["windowHeight"] = m_Arguments.getHeight() ? m_Arguments.getHeight() : clip.height;
+    root["results"] = results;
+
+    fputs(QJsonDocument(root).toJson().constData(), stdout);
+    fflush(stdout);
+
+    QCoreApplication::exit(anySucceeded ? 0 : -1);
+}
+
+}
@@ -0,0 +1,20 @@
+#pragma once
+
+#include "benchmarklauncher.h"
+#include "commandlineparser.h"
+
+namespace CliBenchmarkVideo
+{
+
+class Launcher : public CliBenchmark::Launcher
+{
+public:
+    explicit Launcher(BenchmarkVideoCommandLineParser arguments, QObject *parent = nullptr);
+
+private:
+    void run() override;
+
+    BenchmarkVideoCommandLineParser m_Arguments;
+};
+
+}
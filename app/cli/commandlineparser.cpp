@@ -1,4 +1,7 @@
 #include "commandlineparser.h"
+#include "streaming/session.h"
+
+#include <Limelight.h>
 
 #include <QCommandLineParser>
 #include <QRegularExpression>
@@ -161,6 +164,9 @@ GlobalCommandLineParser::ParseResult GlobalCommandLineParser::parse(const QStrin
         "  quit            Quit the currently running app\n"
         "  stream          Start streaming an app\n"
         "  pair            Pair a new host\n"
+        "  benchmark-audio Measure the latency of each audio backend\n"
+        "  benchmark-video Measure decode and render performance of each video decoder\n"
+        "  benchmark-renderer Measure render performance of each video renderer\n"
         "\n"
         "See 'moonlight <action> --help' for help of specific action."
     );
@@ -192,6 +198,12 @@ GlobalCommandLineParser::ParseResult GlobalCommandLineParser::parse(const QStrin
                 return PairRequested;
             } else if (action == "list") {
                 return ListRequested;
+            } else if (action == "benchmark-audio") {
+                return BenchmarkAudioRequested;
+            } else if (action == "benchmark-video") {
+                return BenchmarkVideoRequested;
+            } else if (action == "benchmark-renderer") {
+                return BenchmarkRendererRequested;
             }
         }
 
@@ -321,6 +333,18 @@ StreamCommandLineParser::StreamCommandLineParser()
         {"fullscreen", StreamingPreferences::CSK_FULLSCREEN},
         {"always",     StreamingPreferences::CSK_ALWAYS},
     };
+    m_RecordingFormatMap = {
+        {"yuv", StreamingPreferences::RF_YUV},
+        {"y4m", StreamingPreferences::RF_Y4M},
+        {"mkv", StreamingPreferences::RF_MKV},
+        {"mp4", StreamingPreferences::RF_MP4},
+        {"ffv1", StreamingPreferences::RF_FFV1},
+    };
+    m_SurroundDownmixMap = {
+        {"off",     StreamingPreferences::SD_OFF},
+        {"stereo",  StreamingPreferences::SD_STEREO},
+        {"virtual", StreamingPreferences::SD_VIRTUAL_SURROUND},
+    };
 }
 
 StreamCommandLineParser::~StreamCommandLineParser()
@@ -352,9 +376,11 @@ void StreamCommandLineParser::parse(const QStringList &args, StreamingPreference
     parser.addValueOption("packet-size", "video packet size");
     parser.addChoiceOption("display-mode", "display mode", m_WindowModeMap.keys());
     parser.addChoiceOption("audio-config", "audio config", m_AudioConfigMap.keys());
+    parser.addChoiceOption("surround-downmix", "surround downmix for stereo devices", m_SurroundDownmixMap.keys());
     parser.addToggleOption("multi-controller", "multiple controller support");
     parser.addToggleOption("quit-after", "quit app after session");
     parser.addToggleOption("absolute-mouse", "remote desktop optimized mouse control");
+    parser.addToggleOption("local-cursor", "local cursor in remote desktop mouse mode");
     parser.addToggleOption("mouse-buttons-swap", "left and right mouse buttons swap");
     parser.addToggleOption("touchscreen-trackpad", "touchscreen in trackpad mode");
     parser.addToggleOption("game-optimization", "game optimizations");
@@ -363,14 +389,18 @@ void StreamCommandLineParser::parse(const QStringList &args, StreamingPreference
     parser.addToggleOption("mute-on-focus-loss", "mute audio when Moonlight window loses focus");
     parser.addToggleOption("background-gamepad", "background gamepad input");
     parser.addToggleOption("reverse-scroll-direction", "inverted scroll direction");
+    parser.addValueOption("mouse-send-rate", "mouse motion send rate in Hz (0 for unlimited)");
     parser.addToggleOption("swap-gamepad-buttons", "swap A/B and X/Y gamepad buttons (Nintendo-style)");
     parser.addToggleOption("keep-awake", "prevent display sleep while streaming");
+    parser.addToggleOption("low-memory", "smaller video queues and caches for low-RAM devices");
     parser.addToggleOption("performance-overlay", "show performance overlay");
     parser.addToggleOption("hdr", "HDR streaming");
     parser.addToggleOption("yuv444", "YUV 4:4:4 sampling, if supported");
     parser.addChoiceOption("capture-system-keys", "capture system key combos", m_CaptureSysKeysModeMap.keys());
     parser.addChoiceOption("video-codec", "video codec", m_VideoCodecMap.keys());
     parser.addChoiceOption("video-decoder", "video decoder", m_VideoDecoderMap.keys());
+    parser.addValueOption("record", "directory to record the stream into");
+    parser.addChoiceOption("record-format", "recording format", m_RecordingFormatMap.keys());
 
     if (!parser.parse(args)) {
         parser.showError(parser.errorText());
@@ -443,6 +473,11 @@ void StreamCommandLineParser::parse(const QStringList &args, StreamingPreference
         preferences->audioConfig = mapValue(m_AudioConfigMap, parser.getChoiceOptionValue("audio-config"));
     }
 
+    // Resolve --surround-downmix option
+    if (parser.isSet("surround-downmix")) {
+        preferences->surroundDownmix = mapValue(m_SurroundDownmixMap, parser.getChoiceOptionValue("surround-downmix"));
+    }
+
     // Resolve --multi-controller and --no-multi-controller options
     preferences->multiController = parser.getToggleOptionValue("multi-controller", preferences->multiController);
 
@@ -452,6 +487,9 @@ void StreamCommandLineParser::parse(const QStringList &args, StreamingPreference
     // Resolve --absolute-mouse and --no-absolute-mouse options
     preferences->absoluteMouseMode = parser.getToggleOptionValue("absolute-mouse", preferences->absoluteMouseMode);
 
+    // Resolve --local-cursor and --no-local-cursor options
+    preferences->localCursor = parser.getToggleOptionValue("local-cursor", preferences->localCursor);
+
     // Resolve --mouse-buttons-swap and --no-mouse-buttons-swap options
     preferences->swapMouseButtons = parser.getToggleOptionValue("mouse-buttons-swap", preferences->swapMouseButtons);
 
@@ -476,12 +514,23 @@ void StreamCommandLineParser::parse(const QStringList &args, StreamingPreference
     // Resolve --reverse-scroll-direction and --no-reverse-scroll-direction options
     preferences->reverseScrollDirection = parser.getToggleOptionValue("reverse-scroll-direction", preferences->reverseScrollDirection);
 
+    // Resolve --mouse-send-rate option
+    if (parser.isSet("mouse-send-rate")) {
+        preferences->mouseSendRate = parser.getIntOption("mouse-send-rate");
+        if (preferences->mouseSendRate < 0) {
+            parser.showError("Mouse send rate must not be negative");
+        }
+    }
+
     // Resolve --swap-gamepad-buttons and --no-swap-gamepad-buttons options
     preferences->swapFaceButtons = parser.getToggleOptionValue("swap-gamepad-buttons", preferences->swapFaceButtons);
 
     // Resolve --keep-awake and --no-keep-awake options
     preferences->keepAwake = parser.getToggleOptionValue("keep-awake", preferences->keepAwake);
 
+    // Resolve --low-memory and --no-low-memory options
+    preferences->lowMemoryMode = parser.getToggleOptionValue("low-memory", preferences->lowMemoryMode);
+
     // Resolve --performance-overlay and --no-performance-overlay options
     preferences->showPerformanceOverlay = parser.getToggleOptionValue("performance-overlay", preferences->showPerformanceOverlay);
 
@@ -506,6 +555,19 @@ void StreamCommandLineParser::parse(const QStringList &args, StreamingPreference
         preferences->videoDecoderSelection = mapValue(m_VideoDecoderMap, parser.getChoiceOptionValue("video-decoder"));
     }
 
+    // Resolve --record option
+    if (parser.isSet("record")) {
+        preferences->recordingDirectory = parser.value("record");
+        if (preferences->recordingDirectory.isEmpty()) {
+            parser.showError("Recording directory must not be empty");
+        }
+    }
+
+    // Resolve --record-format option
+    if (parser.isSet("record-format")) {
+        preferences->recordingFormat = mapValue(m_RecordingFormatMap, parser.getChoiceOptionValue("record-format"));
+    }
+
     // This method will not return and terminates the process if --version or
     // --help is specified
     parser.handleHelpAndVersionOptions();
@@ -547,13 +609,16 @@ void ListCommandLineParser::parse(const QStringList &args)
     parser.setupCommonOptions();
     parser.setApplicationDescription(
         "\n"
-        "List the available apps on the given host."
+        "List the available apps on the given hosts. When more than one host is\n"
+        "given, the hosts are queried in parallel."
     );
     parser.addPositionalArgument("list", "list available apps");
-    parser.addPositionalArgument("host", "Host computer name, UUID, or IP address", "<host>");
+    parser.addPositionalArgument("host", "Host computer names, UUIDs, or IP addresses", "<host> [<host>...]");
 
     parser.addFlagOption("csv",     "Print as CSV with additional information");
+    parser.addFlagOption("json",    "Print as JSON with results for each host");
     parser.addFlagOption("verbose", "Displays additional information");
+    parser.addValueOption("concurrency", "maximum hosts to query at once");
 
     if (!parser.parse(args)) {
         parser.showError(parser.errorText());
@@ -563,8 +628,17 @@ void ListCommandLineParser::parse(const QStringList &args)
 
 
     m_PrintCSV = parser.isSet("csv");
+    m_PrintJSON = parser.isSet("json");
     m_Verbose = parser.isSet("verbose");
 
+    m_Concurrency = 8;
+    if (parser.isSet("concurrency")) {
+        m_Concurrency = parser.getIntOption("concurrency");
+        if (m_Concurrency <= 0) {
+            parser.showError("Concurrency must be greater than 0");
+        }
+    }
+
     // This method will not return and terminates the process if --version or
     // --help is specified
     parser.handleHelpAndVersionOptions();
@@ -574,12 +648,17 @@ void ListCommandLineParser::parse(const QStringList &args)
     if (posArgs.length() < 2) {
         parser.showError("Host not provided");
     }
-    m_Host = parser.positionalArguments().at(1);
+    m_Hosts = posArgs.mid(1);
 }
 
 QString ListCommandLineParser::getHost() const
 {
-    return m_Host;
+    return m_Hosts.first();
+}
+
+QStringList ListCommandLineParser::getHosts() const
+{
+    return m_Hosts;
 }
 
 bool ListCommandLineParser::isPrintCSV() const
@@ -587,7 +666,356 @@ bool ListCommandLineParser::isPrintCSV() const
     return m_PrintCSV;
 }
 
+bool ListCommandLineParser::isPrintJSON() const
+{
+    return m_PrintJSON;
+}
+
 bool ListCommandLineParser::isVerbose() const
 {
     return m_Verbose;
 }
+
+int ListCommandLineParser::getConcurrency() const
+{
+    return m_Concurrency;
+}
+
+BenchmarkAudioCommandLineParser::BenchmarkAudioCommandLineParser()
+{
+    m_AudioConfigMap = {
+        {"stereo",       StreamingPreferences::AC_STEREO},
+        {"5.1-surround", StreamingPreferences::AC_51_SURROUND},
+        {"7.1-surround", StreamingPreferences::AC_71_SURROUND},
+    };
+}
+
+BenchmarkAudioCommandLineParser::~BenchmarkAudioCommandLineParser()
+{
+}
+
+void BenchmarkAudioCommandLineParser::parse(const QStringList &args)
+{
+    QStringList availableRenderers = Session::getAvailableAudioRenderers();
+
+    CommandLineParser parser;
+    parser.setupCommonOptions();
+    parser.setApplicationDescription(
+        "\n"
+        "Plays synthetic audio through each available audio backend and reports\n"
+        "Opus decode time, submission time and renderer-reported latency."
+    );
+    parser.addPositionalArgument("benchmark-audio", "benchmark audio backends");
+
+    parser.addChoiceOption("renderer", "audio backend", availableRenderers);
+    parser.addChoiceOption("audio-config", "audio config", m_AudioConfigMap.keys());
+    parser.addValueOption("duration", "seconds of audio to play per backend");
+
+    if (!parser.parse(args)) {
+        parser.showError(parser.errorText());
+    }
+
+    parser.handleUnknownOptions();
+
+    // This method will not return and terminates the process if --version or
+    // --help is specified
+    parser.handleHelpAndVersionOptions();
+
+    if (parser.isSet("renderer")) {
+        m_Renderers = QStringList(parser.getChoiceOptionValue("renderer").toLower());
+    }
+    else {
+        m_Renderers = availableRenderers;
+    }
+
+    m_AudioConfig = StreamingPreferences::AC_STEREO;
+    if (parser.isSet("audio-config")) {
+        m_AudioConfig = mapValue(m_AudioConfigMap, parser.getChoiceOptionValue("audio-config"));
+    }
+
+    m_Duration = 5;
+    if (parser.isSet("duration")) {
+        m_Duration = parser.getIntOption("duration");
+        if (!inRange(m_Duration, 1, 600)) {
+            parser.showError("Duration must be between 1 and 600 seconds");
+        }
+    }
+}
+
+QStringList BenchmarkAudioCommandLineParser::getRenderers() const
+{
+    return m_Renderers;
+}
+
+StreamingPreferences::AudioConfig BenchmarkAudioCommandLineParser::getAudioConfig() const
+{
+    return m_AudioConfig;
+}
+
+int BenchmarkAudioCommandLineParser::getDuration() const
+{
+    return m_Duration;
+}
+
+BenchmarkVideoCommandLineParser::BenchmarkVideoCommandLineParser()
+{
+    m_VideoFormatMap = {
+        {"H.264", VIDEO_FORMAT_H264},
+        {"HEVC",  VIDEO_FORMAT_H265},
+        {"AV1",   VIDEO_FORMAT_AV1_MAIN8},
+    };
+    m_VideoDecoderMap = {
+        {"software", StreamingPreferences::VDS_FORCE_SOFTWARE},
+        {"hardware", StreamingPreferences::VDS_FORCE_HARDWARE},
+    };
+}
+
+BenchmarkVideoCommandLineParser::~BenchmarkVideoCommandLineParser()
+{
+}
+
+void BenchmarkVideoCommandLineParser::parse(const QStringList &args)
+{
+    CommandLineParser parser;
+    parser.setupCommonOptions();
+    parser.setApplicationDescription(
+        "\n"
+        "Decodes and renders an encoded clip in real time with each video decoder\n"
+        "and prints throughput, decode and render times and dropped frames as JSON.\n"
+        "Without --file, the built-in test frame for --video-codec is repeated.\n"
+        "--capture replays a stream captured with ML_DECODE_UNIT_CAPTURE=<file>\n"
+        "using its original codec, frame numbers and arrival timing."
+    );
+    parser.addPositionalArgument("benchmark-video", "benchmark video decoders");
+
+    parser.addValueOption("file", "H.264, HEVC or AV1 clip");
+    parser.addValueOption("capture", "decode unit capture");
+    parser.addChoiceOption("video-codec", "video codec of the built-in clip", m_VideoFormatMap.keys());
+    parser.addChoiceOption("video-decoder", "video decoder", m_VideoDecoderMap.keys());
+    parser.addValueOption("resolution", "<width>x<height> window size");
+    parser.addValueOption("fps", "frame rate to submit frames at");
+    parser.addValueOption("duration", "seconds of video to play per decoder");
+
+    if (!parser.parse(args)) {
+        parser.showError(parser.errorText());
+    }
+
+    parser.handleUnknownOptions();
+
+    // This method will not return and terminates the process if --version or
+    // --help is specified
+    parser.handleHelpAndVersionOptions();
+
+    m_File = parser.value("file");
+    if (!m_File.isEmpty() && parser.isSet("video-codec")) {
+        parser.showError("The codec of --file is detected from the file");
+    }
+
+    m_CaptureFile = parser.value("capture");
+    if (!m_CaptureFile.isEmpty()) {
+        if (!m_File.isEmpty() || parser.isSet("video-codec")) {
+            parser.showError("--capture can't be combined with --file or --video-codec");
+        }
+        else if (parser.isSet("fps") || parser.isSet("duration")) {
+            parser.showError("--capture is replayed with its original timing");
+        }
+    }
+
+    m_VideoFormat = VIDEO_FORMAT_H264;
+    if (parser.isSet("video-codec")) {
+        m_VideoFormat = mapValue(m_VideoFormatMap, parser.getChoiceOptionValue("video-codec"));
+    }
+
+    if (parser.isSet("video-decoder")) {
+        m_Decoders = { mapValue(m_VideoDecoderMap, parser.getChoiceOptionValue("video-decoder")) };
+    }
+    else {
+        m_Decoders = { StreamingPreferences::VDS_FORCE_HARDWARE, StreamingPreferences::VDS_FORCE_SOFTWARE };
+    }
+
+    // Zero means the window matches the clip
+    m_Width = m_Height = 0;
+    if (parser.isSet("resolution")) {
+        auto resolution = parser.getResolutionOptionValue("resolution");
+        m_Width = resolution.first;
+        m_Height = resolution.second;
+        if (m_Width <= 0 || m_Height <= 0) {
+            parser.showError("Resolution must not be zero");
+        }
+    }
+
+    m_Fps = 60;
+    if (parser.isSet("fps")) {
+        m_Fps = parser.getIntOption("fps");
+        if (!inRange(m_Fps, 10, 480)) {
+            parser.showError("FPS must be between 10 and 480");
+        }
+    }
+
+    m_Duration = 10;
+    if (parser.isSet("duration")) {
+        m_Duration = parser.getIntOption("duration");
+        if (!inRange(m_Duration, 1, 600)) {
+            parser.showError("Duration must be between 1 and 600 seconds");
+        }
+    }
+}
+
+QString BenchmarkVideoCommandLineParser::getFile() const
+{
+    return m_File;
+}
+
+QString BenchmarkVideoCommandLineParser::getCaptureFile() const
+{
+    return m_CaptureFile;
+}
+
+int BenchmarkVideoCommandLineParser::getVideoFormat() const
+{
+    return m_VideoFormat;
+}
+
+QList<StreamingPreferences::VideoDecoderSelection> BenchmarkVideoCommandLineParser::getDecoders() const
+{
+    return m_Decoders;
+}
+
+int BenchmarkVideoCommandLineParser::getWidth() const
+{
+    return m_Width;
+}
+
+int BenchmarkVideoCommandLineParser::getHeight() const
+{
+    return m_Height;
+}
+
+int BenchmarkVideoCommandLineParser::getFps() const
+{
+    return m_Fps;
+}
+
+int BenchmarkVideoCommandLineParser::getDuration() const
+{
+    return m_Duration;
+}
+
+BenchmarkRendererCommandLineParser::BenchmarkRendererCommandLineParser()
+{
+    // Only the renderers built into this binary
+#ifdef Q_OS_WIN32
+    m_AvailableRenderers.append("d3d11va");
+#endif
+#ifdef HAVE_LIBVA
+    m_AvailableRenderers.append("vaapi");
+#ifdef HAVE_EGL
+    m_AvailableRenderers.append("vaapi-egl");
+#endif
+#endif
+#ifdef HAVE_LIBPLACEBO_VULKAN
+    m_AvailableRenderers.append("vulkan");
+#endif
+#ifdef HAVE_DRM
+    m_AvailableRenderers.append("drm");
+#endif
+    m_AvailableRenderers.append("sdl");
+
+    m_AvailablePixelFormats = { "NV12", "P010", "YUV444", "YUV444-10bit" };
+}
+
+BenchmarkRendererCommandLineParser::~BenchmarkRendererCommandLineParser()
+{
+}
+
+void BenchmarkRendererCommandLineParser::parse(const QStringList &args)
+{
+    CommandLineParser parser;
+    parser.setupCommonOptions();
+    parser.setApplicationDescription(
+        "\n"
+        "Renders synthetic frames in each pixel format with each video renderer\n"
+        "and prints CPU, GPU and render times and present latency as JSON,\n"
+        "with a comparison table on stderr. 4:4:4 frames are rendered as AYUV\n"
+        "and Y410 by hardware renderers, as hardware decoders output them."
+    );
+    parser.addPositionalArgument("benchmark-renderer", "benchmark video renderers");
+
+    parser.addChoiceOption("renderer", "video renderer", m_AvailableRenderers);
+    parser.addChoiceOption("pixel-format", "pixel format", m_AvailablePixelFormats);
+    parser.addValueOption("resolution", "<width>x<height> frame and window size");
+    parser.addValueOption("frames", "frames to render per renderer and pixel format");
+
+    if (!parser.parse(args)) {
+        parser.showError(parser.errorText());
+    }
+
+    parser.handleUnknownOptions();
+
+    // This method will not return and terminates the process if --version or
+    // --help is specified
+    parser.handleHelpAndVersionOptions();
+
+    if (parser.isSet("renderer")) {
+        m_Renderers = QStringList(parser.getChoiceOptionValue("renderer").toLower());
+    }
+    else {
+        m_Renderers = m_AvailableRenderers;
+    }
+
+    if (parser.isSet("pixel-format")) {
+        QString pixelFormat = parser.getChoiceOptionValue("pixel-format");
+        for (const QString& availablePixelFormat : m_AvailablePixelFormats) {
+            if (availablePixelFormat.compare(pixelFormat, Qt::CaseInsensitive) == 0) {
+                m_PixelFormats = QStringList(availablePixelFormat);
+            }
+        }
+    }
+    else {
+        m_PixelFormats = m_AvailablePixelFormats;
+    }
+
+    m_Width = 1920;
+    m_Height = 1080;
+    if (parser.isSet("resolution")) {
+        auto resolution = parser.getResolutionOptionValue("resolution");
+        m_Width = resolution.first;
+        m_Height = resolution.second;
+        if (m_Width <= 0 || m_Height <= 0) {
+            parser.showError("Resolution must not be zero");
+        }
+    }
+
+    m_Frames = 600;
+    if (parser.isSet("frames")) {
+        m_Frames = parser.getIntOption("frames");
+        if (!inRange(m_Frames, 10, 100000)) {
+            parser.showError("Frames must be between 10 and 100000");
+        }
+    }
+}
+
+QStringList BenchmarkRendererCommandLineParser::getRenderers() const
+{
+    return m_Renderers;
+}
+
+QStringList BenchmarkRendererCommandLineParser::getPixelFormats() const
+{
+    return m_PixelFormats;
+}
+
+int BenchmarkRendererCommandLineParser::getWidth() const
+{
+    return m_Width;
+}
+
+int BenchmarkRendererCommandLineParser::getHeight() const
+{
+    return m_Height;
+}
+
+int BenchmarkRendererCommandLineParser::getFrames() const
+{
+    return m_Frames;
+}
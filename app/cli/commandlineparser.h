@@ -14,6 +14,9 @@ public:
         QuitRequested,
         PairRequested,
         ListRequested,
+        BenchmarkAudioRequested,
+        BenchmarkVideoRequested,
+        BenchmarkRendererRequested,
     };
 
     GlobalCommandLineParser();
@@ -72,6 +75,8 @@ private:
     QMap<QString, StreamingPreferences::VideoCodecConfig> m_VideoCodecMap;
     QMap<QString, StreamingPreferences::VideoDecoderSelection> m_VideoDecoderMap;
     QMap<QString, StreamingPreferences::CaptureSysKeysMode> m_CaptureSysKeysModeMap;
+    QMap<QString, StreamingPreferences::RecordingFormat> m_RecordingFormatMap;
+    QMap<QString, StreamingPreferences::SurroundDownmix> m_SurroundDownmixMap;
 };
 
 class ListCommandLineParser
@@ -83,11 +88,89 @@ public:
     void parse(const QStringList &args);
 
     QString getHost() const;
+    QStringList getHosts() const;
     bool isPrintCSV() const;
+    bool isPrintJSON() const;
     bool isVerbose() const;
+    int getConcurrency() const;
 
 private:
-    QString m_Host;
+    QStringList m_Hosts;
     bool m_PrintCSV;
+    bool m_PrintJSON;
     bool m_Verbose;
+    int m_Concurrency;
+};
+
+class BenchmarkAudioCommandLineParser
+{
+public:
+    BenchmarkAudioCommandLineParser();
+    virtual ~BenchmarkAudioCommandLineParser();
+
+    void parse(const QStringList &args);
+
+    QStringList getRenderers() const;
+    StreamingPreferences::AudioConfig getAudioConfig() const;
+    int getDuration() const;
+
+private:
+    QStringList m_Renderers;
+    StreamingPreferences::AudioConfig m_AudioConfig;
+    int m_Duration;
+    QMap<QString, StreamingPreferences::AudioConfig> m_AudioConfigMap;
+};
+
+class BenchmarkVideoCommandLineParser
+{
+public:
+    BenchmarkVideoCommandLineParser();
+    virtual ~BenchmarkVideoCommandLineParser();
+
+    void parse(const QStringList &args);
+
+    QString getFile() const;
+    QString getCaptureFile() const;
+    int getVideoFormat() const;
+    QList<StreamingPreferences::VideoDecoderSelection> getDecoders() const;
+    int getWidth() const;
+    int getHeight() const;
+    int getFps() const;
+    int getDuration() const;
+
+private:
+    QString m_File;
+    QString m_CaptureFile;
+    int m_VideoFormat;
+    QList<StreamingPreferences::VideoDecoderSelection> m_Decoders;
+    int m_Width;
+    int m_Height;
+    int m_Fps;
+    int m_Duration;
+    QMap<QString, int> m_VideoFormatMap;
+    QMap<QString, StreamingPreferences::VideoDecoderSelection> m_VideoDecoderMap;
+};
+
+class BenchmarkRendererCommandLineParser
+{
+public:
+    BenchmarkRendererCommandLineParser();
+    virtual ~BenchmarkRendererCommandLineParser();
+
+    void parse(const QStringList &args);
+
+    QStringList getRenderers() const;
+    QStringList getPixelFormats() const;
+    int getWidth() const;
+    int getHeight() const;
+    int getFrames() const;
+
+private:
+    QStringList m_Renderers;
+    QStringList m_PixelFormats;
+    int m_Width;
+    int m_Height;
+    int m_Frames;
+    QStringList m_AvailableRenderers;
+    QStringList m_AvailablePixelFormats;
 };
@@ -5,6 +5,8 @@
 #include "backend/computerseeker.h"
 
 #include <QCoreApplication>
+#include <QJsonArray>
+#include <QJsonDocument>
 
 #define COMPUTER_SEEK_TIMEOUT 30000
 
@@ -137,7 +139,7 @@ public:
                                                           app.isAppCollectorGame ? "true" : "false",
                                                           app.hidden ? "true" : "false",
                                                           app.directLaunch ? "true" : "false",
-                                                          qPrintable(m_BoxArtManager->loadBoxArt(m_Computer, app).toDisplayString()));
+                                                          qPrintable(BoxArtManager::getFileUrl(m_BoxArtManager->loadBoxArt(m_Computer, app)).toDisplayString()));
     }
 
     Launcher *q_ptr;
@@ -193,4 +195,229 @@ void Launcher::onComputerSeekTimeout()
     d->handleEvent(event);
 }
 
+class ListHostAppsTask : public QObject, public QRunnable
+{
+    Q_OBJECT
+
+public:
+    ListHostAppsTask(int index, QString host, NvComputer* computer)
+        : m_Index(index),
+          m_Host(host),
+          m_Known(computer != nullptr)
+    {
+        if (computer != nullptr) {
+            {
+                QReadLocker lock(&computer->lock);
+                m_Name = computer->name;
+                m_Uuid = computer->uuid;
+                m_ServerCert = computer->serverCert;
+            }
+
+            // uniqueAddresses() takes the lock itself
+            m_Addresses = computer->uniqueAddresses();
+        }
+    }
+
+    void run() override
+    {
+        QJsonObject result;
+        result["host"] = m_Host;
+
+        if (!m_Known) {
+            result["error"] = QString("Unknown host %1. Please open Moonlight to add and pair it.").arg(m_Host);
+            emit hostListed(m_Index, result);
+            return;
+        }
+
+        result["name"] = m_Name;
+        result["uuid"] = m_Uuid;
+
+        // Find an address the host answers on, like the poller would
+        QString serverInfo;
+        NvHTTP http(NvAddress(), 0, m_ServerCert);
+        for (const NvAddress& address : m_Addresses) {
+            http.setAddress(address);
+            try {
+                serverInfo = http.getServerInfo(NvHTTP::NVLL_NONE, true);
+                break;
+            } catch (...) {
+                continue;
+            }
+        }
+
+        if (serverInfo.isEmpty()) {
+            result["online"] = false;
+            result["error"] = QString("Failed to connect to %1").arg(m_Host);
+            emit hostListed(m_Index, result);
+            return;
+        }
+
+        NvComputer computer(http, serverInfo);
+        computer.serverCert = m_ServerCert;
+        result["online"] = true;
+        result["paired"] = computer.pairState == NvComputer::PS_PAIRED;
+        result["runningAppId"] = computer.currentGameId;
+
+        if (computer.pairState != NvComputer::PS_PAIRED) {
+            result["error"] = QString("Computer %1 has not been paired. "
+                                      "Please open Moonlight to pair before retrieving games list.").arg(m_Name);
+            emit hostListed(m_Index, result);
+            return;
+        }
+
+        try {
+            NvHTTP appHttp(&computer);
+            QJsonArray apps;
+
+            for (const NvApp& app : appHttp.getAppList()) {
+                QJsonObject appObject;
+                appObject["name"] = app.name;
+                appObject["id"] = app.id;
+                appObject["hdrSupported"] = app.hdrSupported;
+                appObject["appCollectorGame"] = app.isAppCollectorGame;
+                apps.append(appObject);
+            }
+
+            result["apps"] = apps;
+        } catch (std::exception& exception) {
+            result["error"] = QString(exception.what());
+        }
+
+        emit hostListed(m_Index, result);
+    }
+
+signals:
+    void hostListed(int index, QJsonObject result);
+
+private:
+    int m_Index;
+    QString m_Host;
+    bool m_Known;
+    QString m_Name;
+    QString m_Uuid;
+    QSslCertificate m_ServerCert;
+    QVector<NvAddress> m_Addresses;
+};
+
+BatchLauncher::BatchLauncher(ListCommandLineParser arguments, QObject *parent)
+    : QObject(parent),
+      m_Arguments(arguments),
+      m_PendingHosts(0)
+{
+    m_ThreadPool.setMaxThreadCount(m_Arguments.getConcurrency());
+}
+
+static bool matchComputer(NvComputer *computer, QString name)
+{
+    QString value = name.toLower();
+
+    {
+        QReadLocker lock(&computer->lock);
+        if (computer->name.toLower() == value || computer->uuid.toLower() == value) {
+            return true;
+        }
+    }
+
+    for (const NvAddress& addr : computer->uniqueAddresses()) {
+        if (addr.address().toLower() == value || addr.toString().toLower() == value) {
+            return true;
+        }
+    }
+
+    return false;
 }
+
+void BatchLauncher::execute(ComputerManager *manager)
+{
+    QStringList hosts = m_Arguments.getHosts();
+    QVector<NvComputer*> computers = manager->getComputers();
+
+    m_Results.resize(hosts.count());
+    m_PendingHosts = hosts.count();
+
+    if (m_Arguments.isVerbose()) {
+        fprintf(stderr, "Loading app lists from %d hosts...\n", (int)hosts.count());
+    }
+
+    for (int i = 0; i < hosts.count(); i++) {
+        NvComputer* match = nullptr;
+        for (NvComputer* computer : computers) {
+            if (matchComputer(computer, hosts[i])) {
+                match = computer;
+                break;
+            }
+        }
+
+        ListHostAppsTask* task = new ListHostAppsTask(i, hosts[i], match);
+        connect(task, &ListHostAppsTask::hostListed,
+                this, &BatchLauncher::onHostListed);
+        m_ThreadPool.start(task);
+    }
+}
+
+void BatchLauncher::onHostListed(int index, QJsonObject result)
+{
+    m_Results[index] = result;
+    if (--m_PendingHosts > 0) {
+        return;
+    }
+
+    printResults();
+
+    // Fail if any of the hosts did
+    for (const QJsonObject& hostResult : m_Results) {
+        if (hostResult.contains("error")) {
+            QCoreApplication::exit(1);
+            return;
+        }
+    }
+
+    QCoreApplication::exit(0);
+}
+
+void BatchLauncher::printResults()
+{
+    if (m_Arguments.isPrintJSON()) {
+        QJsonArray hosts;
+        for (const QJsonObject& hostResult : m_Results) {
+            hosts.append(hostResult);
+        }
+        fprintf(stdout, "%s", QJsonDocument(hosts).toJson().constData());
+        return;
+    }
+
+    if (m_Arguments.isPrintCSV()) {
+        fprintf(stdout, "Host, Name, ID, HDR Support, App Collection Game\n");
+    }
+
+    for (const QJsonObject& hostResult : m_Results) {
+        QString host = hostResult["host"].toString();
+
+        if (hostResult.contains("error")) {
+            fprintf(stderr, "%s: %s\n", qPrintable(host), qPrintable(hostResult["error"].toString()));
+            continue;
+        }
+
+        if (!m_Arguments.isPrintCSV()) {
+            fprintf(stdout, "%s:\n", qPrintable(host));
+        }
+
+        for (const QJsonValue& appValue : hostResult["apps"].toArray()) {
+            QJsonObject app = appValue.toObject();
+            if (m_Arguments.isPrintCSV()) {
+                fprintf(stdout, "\"%s\",\"%s\",%d,%s,%s\n", qPrintable(host),
+                                                           qPrintable(app["name"].toString()),
+                                                           app["id"].toInt(),
+                                                           app["hdrSupported"].toBool() ? "true" : "false",
+                                                           app["appCollectorGame"].toBool() ? "true" : "false");
+            }
+            else {
+                fprintf(stdout, "    %s\n", qPrintable(app["name"].toString()));
+            }
+        }
+    }
+}
+
+}
+
+#include "listapps.moc"
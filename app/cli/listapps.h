@@ -2,8 +2,11 @@
 
 #include "commandlineparser.h"
 
+#include <QJsonObject>
 #include <QObject>
+#include <QThreadPool>
 #include <QVariant>
+#include <QVector>
 
 class ComputerManager;
 class NvComputer;
@@ -34,4 +37,28 @@ private:
     ListCommandLineParser m_Arguments;
 };
 
+// Lists apps on several hosts at once. Unlike Launcher, this doesn't start
+// ComputerManager polling. Each host is resolved from the saved host list
+// and queried directly, with a bounded number of hosts in flight.
+class BatchLauncher : public QObject
+{
+    Q_OBJECT
+
+public:
+    explicit BatchLauncher(ListCommandLineParser arguments, QObject *parent = nullptr);
+
+    void execute(ComputerManager *manager);
+
+private slots:
+    void onHostListed(int index, QJsonObject result);
+
+private:
+    void printResults();
+
+    ListCommandLineParser m_Arguments;
+    QThreadPool m_ThreadPool;
+    QVector<QJsonObject> m_Results;
+    int m_PendingHosts;
+};
+
 }
@@ -59,6 +59,7 @@ public:
         case Event::Executed:
             if (m_State == StateInit) {
                 m_State = StateSeekComputer;
+                m_ExecutedTimeUs = LiGetMicroseconds();
                 m_ComputerManager = event.computerManager;
 
                 m_ComputerSeeker = new ComputerSeeker(m_ComputerManager, m_ComputerName, q);
@@ -82,6 +83,7 @@ public:
                 if (event.computer->pairState == NvComputer::PS_PAIRED) {
                     m_State = StateSeekApp;
                     m_Computer = event.computer;
+                    m_ComputerFoundTimeUs = LiGetMicroseconds();
                     m_TimeoutTimer->start(APP_SEEK_TIMEOUT);
                     emit q->searchingApp();
                 } else {
@@ -103,6 +105,10 @@ public:
                     if (isNotStreaming() || isStreamingApp(app)) {
                         m_State = StateStartSession;
                         session = new Session(m_Computer, app, m_Preferences);
+
+                        // Include the CLI stages in the launch timeline
+                        session->getLaunchTimeline().addEarlierStage("CLI launch started", m_ExecutedTimeUs);
+                        session->getLaunchTimeline().addEarlierStage("Host found", m_ComputerFoundTimeUs);
                         emit q->sessionCreated(app.name, session);
                     } else {
                         emit q->appQuitRequired(getCurrentAppName());
@@ -179,6 +185,8 @@ public:
     NvComputer *m_Computer;
     State m_State;
     QTimer *m_TimeoutTimer;
+    uint64_t m_ExecutedTimeUs;
+    uint64_t m_ComputerFoundTimeUs;
 };
 
 Launcher::Launcher(QString computer, QString app,
@@ -191,6 +199,8 @@ Launcher::Launcher(QString computer, QString app,
     d->m_AppName = app;
     d->m_Preferences = preferences;
     d->m_State = StateInit;
+    d->m_ExecutedTimeUs = 0;
+    d->m_ComputerFoundTimeUs = 0;
     d->m_TimeoutTimer = new QTimer(this);
     d->m_TimeoutTimer->setSingleShot(true);
     connect(d->m_TimeoutTimer, &QTimer::timeout,
@@ -906,6 +906,54 @@ Flickable {
                     }
                 }
 
+                Label {
+                    width: parent.width
+                    id: resDownmixTitle
+                    text: qsTr("Surround sound on stereo devices")
+                    font.pointSize: 12
+                    wrapMode: Text.Wrap
+                    visible: StreamingPreferences.audioConfig !== StreamingPreferences.AC_STEREO
+                }
+
+                AutoResizingComboBox {
+                    // ignore setting the index at first, and actually set it when the component is loaded
+                    Component.onCompleted: {
+                        var saved_downmix = StreamingPreferences.surroundDownmix
+                        currentIndex = 0
+                        for (var i = 0; i < downmixListModel.count; i++) {
+                            var el_downmix = downmixListModel.get(i).val;
+                            if (saved_downmix === el_downmix) {
+                                currentIndex = i
+                                break
+                            }
+                        }
+                        activated(currentIndex)
+                    }
+
+                    id: downmixComboBox
+                    textRole: "text"
+                    visible: StreamingPreferences.audioConfig !== StreamingPreferences.AC_STEREO
+                    model: ListModel {
+                        id: downmixListModel
+                        ListElement {
+                            text: qsTr("Let the system downmix")
+                            val: StreamingPreferences.SD_OFF
+                        }
+                        ListElement {
+                            text: qsTr("Downmix to stereo")
+                            val: StreamingPreferences.SD_STEREO
+                        }
+                        ListElement {
+                            text: qsTr("Virtual surround for headphones")
+                            val: StreamingPreferences.SD_VIRTUAL_SURROUND
+                        }
+                    }
+                    // ::onActivated must be used, as it only listens for when the index is changed by a human
+                    onActivated : {
+                        StreamingPreferences.surroundDownmix = downmixListModel.get(currentIndex).val
+                    }
+                }
+
 
                 CheckBox {
                     id: audioPcCheck
@@ -1279,6 +1327,22 @@ Flickable {
                     ToolTip.visible: hovered
                     ToolTip.text: qsTr("Prevents the screensaver from starting or the display from going to sleep while streaming.")
                 }
+
+                CheckBox {
+                    id: lowMemoryCheck
+                    width: parent.width
+                    text: qsTr("Reduce memory usage")
+                    font.pointSize: 12
+                    checked: StreamingPreferences.lowMemoryMode
+                    onCheckedChanged: {
+                        StreamingPreferences.lowMemoryMode = checked
+                    }
+
+                    ToolTip.delay: 1000
+                    ToolTip.timeout: 5000
+                    ToolTip.visible: hovered
+                    ToolTip.text: qsTr("Queues fewer video frames and caches less box art. Useful on devices with 1 GB of RAM or less, but may cause more dropped frames.")
+                }
             }
         }
     }
@@ -1321,6 +1385,25 @@ Flickable {
                                   qsTr("NOTE: Due to a bug in GeForce Experience, this option may not work properly if your host PC has multiple monitors.")
                 }
 
+                CheckBox {
+                    id: localCursorCheck
+                    hoverEnabled: true
+                    width: parent.width
+                    text: qsTr("Show local mouse cursor in remote desktop mode")
+                    font.pointSize:  12
+                    enabled: absoluteMouseCheck.checked
+                    checked: StreamingPreferences.localCursor
+                    onCheckedChanged: {
+                        StreamingPreferences.localCursor = checked
+                    }
+
+                    ToolTip.delay: 1000
+                    ToolTip.timeout: 10000
+                    ToolTip.visible: hovered
+                    ToolTip.text: qsTr("Draws the cursor on this device so it moves without waiting for the host's video. Hide the cursor on the host to avoid seeing two.") + " " +
+                                  qsTr("You can toggle this while streaming using Ctrl+Alt+Shift+C.")
+                }
+
                 Row {
                     spacing: 5
                     width: parent.width
@@ -1425,6 +1508,66 @@ Flickable {
                     }
                 }
 
+                Label {
+                    width: parent.width
+                    id: mouseSendRateTitle
+                    text: qsTr("Mouse motion update rate")
+                    font.pointSize: 12
+                    wrapMode: Text.Wrap
+                }
+
+                AutoResizingComboBox {
+                    // ignore setting the index at first, and actually set it when the component is loaded
+                    Component.onCompleted: {
+                        var saved_rate = StreamingPreferences.mouseSendRate
+                        currentIndex = 0
+                        for (var i = 0; i < mouseSendRateListModel.count; i++) {
+                            var el_rate = mouseSendRateListModel.get(i).val;
+                            if (saved_rate === el_rate) {
+                                currentIndex = i
+                                break
+                            }
+                        }
+                        activated(currentIndex)
+                    }
+
+                    id: mouseSendRateComboBox
+                    hoverEnabled: true
+                    textRole: "text"
+                    model: ListModel {
+                        id: mouseSendRateListModel
+                        ListElement {
+                            text: qsTr("1000 Hz (Recommended)")
+                            val: 1000
+                        }
+                        ListElement {
+                            text: qsTr("500 Hz")
+                            val: 500
+                        }
+                        ListElement {
+                            text: qsTr("250 Hz")
+                            val: 250
+                        }
+                        ListElement {
+                            text: qsTr("2000 Hz")
+                            val: 2000
+                        }
+                        ListElement {
+                            text: qsTr("Every mouse report")
+                            val: 0
+                        }
+                    }
+                    // ::onActivated must be used, as it only listens for when the index is changed by a human
+                    onActivated : {
+                        StreamingPreferences.mouseSendRate = mouseSendRateListModel.get(currentIndex).val
+                    }
+
+                    ToolTip.delay: 1000
+                    ToolTip.timeout: 5000
+                    ToolTip.visible: hovered
+                    ToolTip.text: qsTr("Combines motion from high polling rate mice before sending it to the host. Lower rates use less CPU and network bandwidth.")
+                }
+
                 CheckBox {
                     id: reverseScrollButtonsCheck
                     hoverEnabled: true
@@ -19,6 +19,9 @@ void AppModel::initialize(ComputerManager* computerManager, int computerIndex, b
     m_ShowHiddenGames = showHiddenGames;
 
     updateAppList(m_Computer->appList);
+
+    // Fetch the rest of the box art now, so large libraries don't pop in while scrolling
+    m_BoxArtManager.prefetchBoxArt(m_Computer, m_VisibleApps);
 }
 
 int AppModel::getRunningAppId()
@@ -81,7 +84,7 @@ QVariant AppModel::data(const QModelIndex &index, int role) const
     case NameRole:
         return app.name;
     case RunningRole:
-        return m_Computer->currentGameId == app.id;
+        return m_CurrentGameId == app.id;
     case BoxArtRole:
         // FIXME: const-correctness
         return const_cast<BoxArtManager&>(m_BoxArtManager).loadBoxArt(m_Computer, app);
@@ -158,10 +161,27 @@ void AppModel::updateAppList(QVector<NvApp> newList)
         bool found = false;
         for (const NvApp& newApp : newVisibleList) {
             if (existingApp.id == newApp.id) {
-                // If the data changed, update it in our list
+                // If the data changed, update it in our list. Only signal the roles
+                // that changed, so the view doesn't reload box art for this app.
                 if (existingApp != newApp) {
+                    QVector<int> changedRoles;
+                    if (existingApp.name != newApp.name) {
+                        changedRoles << NameRole;
+                    }
+                    if (existingApp.hidden != newApp.hidden) {
+                        changedRoles << HiddenRole;
+                    }
+                    if (existingApp.directLaunch != newApp.directLaunch) {
+                        changedRoles << DirectLaunchRole;
+                    }
+                    if (existingApp.isAppCollectorGame != newApp.isAppCollectorGame) {
+                        changedRoles << AppCollectorGameRole;
+                    }
+
                     m_VisibleApps.replace(i, newApp);
-                    emit dataChanged(createIndex(i, 0), createIndex(i, 0));
+                    if (!changedRoles.isEmpty()) {
+                        emit dataChanged(createIndex(i, 0), createIndex(i, 0), changedRoles);
+                    }
                 }
 
                 found = true;
@@ -270,34 +290,27 @@ void AppModel::handleComputerStateChanged(NvComputer* computer)
     // we can't check that first.
     if (computer->appList != m_AllApps) {
         updateAppList(computer->appList);
+        m_BoxArtManager.prefetchBoxArt(m_Computer, m_VisibleApps);
     }
 
     // Finally, process changes to the active app
     if (computer->currentGameId != m_CurrentGameId) {
-        // First, invalidate the running state of newly running game
+        int oldGameId = m_CurrentGameId;
+
+        // Update our internal state first, since the view reads it back
+        // from data() while handling the signals below.
+        m_CurrentGameId = m_Computer->currentGameId;
+
+        // Invalidate the running state of the newly running game and
+        // the old game (if it exists). Nothing else needs to be refreshed.
         for (int i = 0; i < m_VisibleApps.count(); i++) {
-            if (m_VisibleApps[i].id == computer->currentGameId) {
+            if (m_VisibleApps[i].id == m_CurrentGameId ||
+                    (oldGameId != 0 && m_VisibleApps[i].id == oldGameId)) {
                 emit dataChanged(createIndex(i, 0),
                                  createIndex(i, 0),
                                  QVector<int>() << RunningRole);
-                break;
             }
         }
-
-        // Next, invalidate the running state of the old game (if it exists)
-        if (m_CurrentGameId != 0) {
-            for (int i = 0; i < m_VisibleApps.count(); i++) {
-                if (m_VisibleApps[i].id == m_CurrentGameId) {
-                    emit dataChanged(createIndex(i, 0),
-                                     createIndex(i, 0),
-                                     QVector<int>() << RunningRole);
-                    break;
-                }
-            }
-        }
-
-        // Now update our internal state
-        m_CurrentGameId = m_Computer->currentGameId;
     }
 }
 
@@ -14,6 +14,9 @@ void ComputerModel::initialize(ComputerManager* computerManager)
             this, &ComputerModel::handlePairingCompleted);
 
     m_Computers = m_ComputerManager->getComputers();
+    for (NvComputer* computer : m_Computers) {
+        m_Snapshots.append(takeSnapshot(computer));
+    }
 }
 
 QVariant ComputerModel::data(const QModelIndex& index, int role) const
@@ -22,69 +25,121 @@ QVariant ComputerModel::data(const QModelIndex& index, int role) const
         return QVariant();
     }
 
-    Q_ASSERT(index.row() < m_Computers.count());
+    Q_ASSERT(index.row() < m_Snapshots.count());
 
-    NvComputer* computer = m_Computers[index.row()];
-    QReadLocker lock(&computer->lock);
+    const ComputerSnapshot& snapshot = m_Snapshots[index.row()];
 
     switch (role) {
     case NameRole:
-        return computer->name;
+        return snapshot.name;
     case OnlineRole:
-        return computer->state == NvComputer::CS_ONLINE;
+        return snapshot.online;
     case PairedRole:
-        return computer->pairState == NvComputer::PS_PAIRED;
+        return snapshot.paired;
     case BusyRole:
-        return computer->currentGameId != 0;
+        return snapshot.busy;
     case WakeableRole:
-        return !computer->macAddress.isEmpty();
+        return snapshot.wakeable;
     case StatusUnknownRole:
-        return computer->state == NvComputer::CS_UNKNOWN;
+        return snapshot.statusUnknown;
     case ServerSupportedRole:
-        return computer->isSupportedServerVersion;
-    case DetailsRole: {
-        QString state, pairState;
-
-        switch (computer->state) {
-        case NvComputer::CS_ONLINE:
-            state = tr("Online");
-            break;
-        case NvComputer::CS_OFFLINE:
-            state = tr("Offline");
-            break;
-        default:
-            state = tr("Unknown");
-            break;
-        }
+        return snapshot.serverSupported;
+    case DetailsRole:
+        return snapshot.details;
+    default:
+        return QVariant();
+    }
+}
 
-        switch (computer->pairState) {
-        case NvComputer::PS_PAIRED:
-            pairState = tr("Paired");
-            break;
-        case NvComputer::PS_NOT_PAIRED:
-            pairState = tr("Unpaired");
-            break;
-        default:
-            pairState = tr("Unknown");
-            break;
-        }
+ComputerModel::ComputerSnapshot ComputerModel::takeSnapshot(NvComputer* computer)
+{
+    ComputerSnapshot snapshot;
+    QString state, pairState;
 
-        return tr("Name: %1").arg(computer->name) + '\n' +
-               tr("Status: %1").arg(state) + '\n' +
-               tr("Active Address: %1").arg(computer->activeAddress.toString()) + '\n' +
-               tr("UUID: %1").arg(computer->uuid) + '\n' +
-               tr("Local Address: %1").arg(computer->localAddress.toString()) + '\n' +
-               tr("Remote Address: %1").arg(computer->remoteAddress.toString()) + '\n' +
-               tr("IPv6 Address: %1").arg(computer->ipv6Address.toString()) + '\n' +
-               tr("Manual Address: %1").arg(computer->manualAddress.toString()) + '\n' +
-               tr("MAC Address: %1").arg(computer->macAddress.isEmpty() ? tr("Unknown") : QString(computer->macAddress.toHex(':'))) + '\n' +
-               tr("Pair State: %1").arg(pairState) + '\n' +
-               tr("Running Game ID: %1").arg(computer->state == NvComputer::CS_ONLINE ? QString::number(computer->currentGameId) : tr("Unknown")) + '\n' +
-               tr("HTTPS Port: %1").arg(computer->state == NvComputer::CS_ONLINE ? QString::number(computer->activeHttpsPort) : tr("Unknown"));
+    QReadLocker lock(&computer->lock);
+
+    snapshot.name = computer->name;
+    snapshot.online = computer->state == NvComputer::CS_ONLINE;
+    snapshot.paired = computer->pairState == NvComputer::PS_PAIRED;
+    snapshot.busy = computer->currentGameId != 0;
+    snapshot.wakeable = !computer->macAddress.isEmpty();
+    snapshot.statusUnknown = computer->state == NvComputer::CS_UNKNOWN;
+    snapshot.serverSupported = computer->isSupportedServerVersion;
+
+    switch (computer->state) {
+    case NvComputer::CS_ONLINE:
+        state = tr("Online");
+        break;
+    case NvComputer::CS_OFFLINE:
+        state = tr("Offline");
+        break;
+    default:
+        state = tr("Unknown");
+        break;
     }
+
+    switch (computer->pairState) {
+    case NvComputer::PS_PAIRED:
+        pairState = tr("Paired");
+        break;
+    case NvComputer::PS_NOT_PAIRED:
+        pairState = tr("Unpaired");
+        break;
     default:
-        return QVariant();
+        pairState = tr("Unknown");
+        break;
     }
+
+    snapshot.details =
+            tr("Name: %1").arg(computer->name) + '\n' +
+            tr("Status: %1").arg(state) + '\n' +
+            tr("Active Address: %1").arg(computer->activeAddress.toString()) + '\n' +
+            tr("UUID: %1").arg(computer->uuid) + '\n' +
+            tr("Local Address: %1").arg(computer->localAddress.toString()) + '\n' +
+            tr("Remote Address: %1").arg(computer->remoteAddress.toString()) + '\n' +
+            tr("IPv6 Address: %1").arg(computer->ipv6Address.toString()) + '\n' +
+            tr("Manual Address: %1").arg(computer->manualAddress.toString()) + '\n' +
+            tr("MAC Address: %1").arg(computer->macAddress.isEmpty() ? tr("Unknown") : QString(computer->macAddress.toHex(':'))) + '\n' +
+            tr("Pair State: %1").arg(pairState) + '\n' +
+            tr("Running Game ID: %1").arg(computer->state == NvComputer::CS_ONLINE ? QString::number(computer->currentGameId) : tr("Unknown")) + '\n' +
+            tr("HTTPS Port: %1").arg(computer->state == NvComputer::CS_ONLINE ? QString::number(computer->activeHttpsPort) : tr("Unknown"));
+
+    return snapshot;
+}
+
+QVector<int> ComputerModel::updateSnapshot(int index)
+{
+    ComputerSnapshot newSnapshot = takeSnapshot(m_Computers[index]);
+    ComputerSnapshot& oldSnapshot = m_Snapshots[index];
+    QVector<int> changedRoles;
+
+    if (oldSnapshot.name != newSnapshot.name) {
+        changedRoles << NameRole;
+    }
+    if (oldSnapshot.online != newSnapshot.online) {
+        changedRoles << OnlineRole;
+    }
+    if (oldSnapshot.paired != newSnapshot.paired) {
+        changedRoles << PairedRole;
+    }
+    if (oldSnapshot.busy != newSnapshot.busy) {
+        changedRoles << BusyRole;
+    }
+    if (oldSnapshot.wakeable != newSnapshot.wakeable) {
+        changedRoles << WakeableRole;
+    }
+    if (oldSnapshot.statusUnknown != newSnapshot.statusUnknown) {
+        changedRoles << StatusUnknownRole;
+    }
+    if (oldSnapshot.serverSupported != newSnapshot.serverSupported) {
+        changedRoles << ServerSupportedRole;
+    }
+    if (oldSnapshot.details != newSnapshot.details) {
+        changedRoles << DetailsRole;
+    }
+
+    oldSnapshot = newSnapshot;
+    return changedRoles;
 }
 
 int ComputerModel::rowCount(const QModelIndex& parent) const
@@ -145,6 +200,7 @@ void ComputerModel::deleteComputer(int computerIndex)
 
     // Remove the now invalid item
     m_Computers.removeAt(computerIndex);
+    m_Snapshots.removeAt(computerIndex);
 
     endRemoveRows();
 }
@@ -152,15 +208,20 @@ void ComputerModel::deleteComputer(int computerIndex)
 class DeferredWakeHostTask : public QRunnable
 {
 public:
-    DeferredWakeHostTask(NvComputer* computer)
-        : m_Computer(computer) {}
+    DeferredWakeHostTask(ComputerManager* computerManager, NvComputer* computer)
+        : m_ComputerManager(computerManager),
+          m_Computer(computer) {}
 
     void run()
     {
-        m_Computer->wake();
+        if (m_Computer->wake()) {
+            // Don't leave the host waiting out its offline backoff
+            m_ComputerManager->refreshHost(m_Computer);
+        }
     }
 
 private:
+    ComputerManager* m_ComputerManager;
     NvComputer* m_Computer;
 };
 
@@ -168,7 +229,7 @@ void ComputerModel::wakeComputer(int computerIndex)
 {
     Q_ASSERT(computerIndex < m_Computers.count());
 
-    DeferredWakeHostTask* wakeTask = new DeferredWakeHostTask(m_Computers[computerIndex]);
+    DeferredWakeHostTask* wakeTask = new DeferredWakeHostTask(m_ComputerManager, m_Computers[computerIndex]);
     QThreadPool::globalInstance()->start(wakeTask);
 }
 
@@ -225,20 +286,62 @@ void ComputerModel::handlePairingCompleted(NvComputer*, QString error)
     emit pairingCompleted(error.isEmpty() ? QVariant() : error);
 }
 
+void ComputerModel::updateComputerList(const QVector<NvComputer*>& newList)
+{
+    // Process removals first
+    for (int i = 0; i < m_Computers.count(); i++) {
+        if (!newList.contains(m_Computers[i])) {
+            beginRemoveRows(QModelIndex(), i, i);
+            m_Computers.removeAt(i);
+            m_Snapshots.removeAt(i);
+            endRemoveRows();
+            i--;
+        }
+    }
+
+    // Now walk the new list in order, moving existing hosts into place (after
+    // a rename) and inserting new ones. Everything before index i is already
+    // in the right place, so an existing host can only be found after it.
+    for (int i = 0; i < newList.count(); i++) {
+        if (i < m_Computers.count() && m_Computers[i] == newList[i]) {
+            continue;
+        }
+
+        int existingIndex = m_Computers.indexOf(newList[i], i);
+        if (existingIndex >= 0) {
+            beginMoveRows(QModelIndex(), existingIndex, existingIndex, QModelIndex(), i);
+            m_Computers.move(existingIndex, i);
+            m_Snapshots.move(existingIndex, i);
+            endMoveRows();
+        }
+        else {
+            beginInsertRows(QModelIndex(), i, i);
+            m_Computers.insert(i, newList[i]);
+            m_Snapshots.insert(i, takeSnapshot(newList[i]));
+            endInsertRows();
+        }
+    }
+
+    Q_ASSERT(m_Computers == newList);
+}
+
 void ComputerModel::handleComputerStateChanged(NvComputer* computer)
 {
     QVector<NvComputer*> newComputerList = m_ComputerManager->getComputers();
 
-    // Reset the model if the structural layout of the list has changed
+    // Add, remove, or reorder rows if the structural layout of the list has changed
     if (m_Computers != newComputerList) {
-        beginResetModel();
-        m_Computers = newComputerList;
-        endResetModel();
-    }
-    else {
-        // Let the view know that this specific computer changed
-        int index = m_Computers.indexOf(computer);
-        emit dataChanged(createIndex(index, 0), createIndex(index, 0));
+        updateComputerList(newComputerList);
+    }
+
+    // Let the view know which roles of this specific computer changed. Polls
+    // that didn't change anything the view displays produce no signal at all.
+    int index = m_Computers.indexOf(computer);
+    if (index >= 0) {
+        QVector<int> changedRoles = updateSnapshot(index);
+        if (!changedRoles.isEmpty()) {
+            emit dataChanged(createIndex(index, 0), createIndex(index, 0), changedRoles);
+        }
     }
 }
 
@@ -55,6 +55,28 @@ private slots:
     void handlePairingCompleted(NvComputer* computer, QString error);
 
 private:
+    // Role values for a computer as of its last state change. The view reads
+    // these instead of locking each NvComputer, and we can tell which roles
+    // actually changed when the ComputerManager signals an update.
+    struct ComputerSnapshot
+    {
+        QString name;
+        bool online;
+        bool paired;
+        bool busy;
+        bool wakeable;
+        bool statusUnknown;
+        bool serverSupported;
+        QString details;
+    };
+
+    ComputerSnapshot takeSnapshot(NvComputer* computer);
+
+    QVector<int> updateSnapshot(int index);
+
+    void updateComputerList(const QVector<NvComputer*>& newList);
+
     QVector<NvComputer*> m_Computers;
+    QVector<ComputerSnapshot> m_Snapshots;
     ComputerManager* m_ComputerManager;
 };
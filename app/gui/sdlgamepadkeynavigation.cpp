@@ -7,9 +7,18 @@
 #include "settings/mappingmanager.h"
 
 #define AXIS_NAVIGATION_REPEAT_DELAY 150
+#define AXIS_NAVIGATION_THRESHOLD 30000
+
+// SDL has to pump events on the thread that owns the video subsystem, so
+// gamepad input still arrives by polling. We only need to poll quickly
+// when there's a gamepad that could be producing input. Otherwise we're
+// just waiting for a hotplug event and can wake up much less often.
+#define GAMEPAD_POLLING_INTERVAL 50
+#define HOTPLUG_POLLING_INTERVAL 500
 
 SdlGamepadKeyNavigation::SdlGamepadKeyNavigation(StreamingPreferences* prefs)
     : m_Prefs(prefs),
+      m_HeldAxisKey(Qt::Key_unknown),
       m_Enabled(false),
       m_UiNavMode(false),
       m_FirstPoll(false),
@@ -18,6 +27,11 @@ SdlGamepadKeyNavigation::SdlGamepadKeyNavigation(StreamingPreferences* prefs)
 {
     m_PollingTimer = new QTimer(this);
     connect(m_PollingTimer, &QTimer::timeout, this, &SdlGamepadKeyNavigation::onPollingTimerFired);
+
+    // This only runs while a stick is held in a navigation direction
+    m_AxisRepeatTimer = new QTimer(this);
+    m_AxisRepeatTimer->setInterval(AXIS_NAVIGATION_REPEAT_DELAY);
+    connect(m_AxisRepeatTimer, &QTimer::timeout, this, &SdlGamepadKeyNavigation::onAxisRepeatTimerFired);
 }
 
 SdlGamepadKeyNavigation::~SdlGamepadKeyNavigation()
@@ -80,6 +94,7 @@ void SdlGamepadKeyNavigation::disable()
     m_Enabled = false;
     updateTimerState();
     Q_ASSERT(!m_PollingTimer->isActive());
+    Q_ASSERT(!m_AxisRepeatTimer->isActive());
 
     while (!m_Gamepads.isEmpty()) {
         SDL_GameControllerClose(m_Gamepads[0]);
@@ -192,7 +207,29 @@ void SdlGamepadKeyNavigation::onPollingTimerFired()
             }
             break;
         }
+        case SDL_CONTROLLERAXISMOTION:
+            handleAxisMotion(event.caxis);
+            break;
+        case SDL_CONTROLLERDEVICEREMOVED:
+        {
+            SDL_GameController* gc = SDL_GameControllerFromInstanceID(event.cdevice.which);
+            if (gc != nullptr && m_Gamepads.removeOne(gc)) {
+                SDL_GameControllerClose(gc);
+
+                // Don't keep repeating if the stick was held as it was unplugged
+                stopAxisRepeat();
+
+                // Slow down polling if that was our last gamepad
+                updateTimerState();
+            }
+            break;
+        }
+        case SDL_JOYDEVICEADDED:
+            // This will queue SDL_CONTROLLERDEVICEADDED if we have a mapping
+            MappingManager::applyMappingsForNewJoystick(event.jdevice.which);
+            break;
         case SDL_CONTROLLERDEVICEADDED:
+        {
             SDL_GameController* gc = SDL_GameControllerOpen(event.cdevice.which);
             if (gc != nullptr) {
                 // SDL_CONTROLLERDEVICEADDED can be reported multiple times for the same
@@ -206,54 +243,95 @@ void SdlGamepadKeyNavigation::onPollingTimerFired()
                     // We already have this game controller open
                     SDL_GameControllerClose(gc);
                 }
+
+                // Speed up polling now that we have a gamepad
+                updateTimerState();
             }
             break;
         }
+        }
     }
+}
 
-    // Handle analog sticks by polling
-    for (auto gc : m_Gamepads) {
-        short leftX = SDL_GameControllerGetAxis(gc, SDL_CONTROLLER_AXIS_LEFTX);
-        short leftY = SDL_GameControllerGetAxis(gc, SDL_CONTROLLER_AXIS_LEFTY);
-        if (SDL_GetTicks() - m_LastAxisNavigationEventTime < AXIS_NAVIGATION_REPEAT_DELAY) {
-            // Do nothing
-        }
-        else if (leftY < -30000) {
-            if (m_UiNavMode) {
-                // Back-tab
-                sendKey(QEvent::Type::KeyPress, Qt::Key_Tab, Qt::ShiftModifier);
-                sendKey(QEvent::Type::KeyRelease, Qt::Key_Tab, Qt::ShiftModifier);
-            }
-            else {
-                sendKey(QEvent::Type::KeyPress, Qt::Key_Up);
-                sendKey(QEvent::Type::KeyRelease, Qt::Key_Up);
-            }
+Qt::Key SdlGamepadKeyNavigation::getAxisNavigationKey(SDL_GameController* gc)
+{
+    short leftX = SDL_GameControllerGetAxis(gc, SDL_CONTROLLER_AXIS_LEFTX);
+    short leftY = SDL_GameControllerGetAxis(gc, SDL_CONTROLLER_AXIS_LEFTY);
 
-            m_LastAxisNavigationEventTime = SDL_GetTicks();
-        }
-        else if (leftY > 30000) {
-            if (m_UiNavMode) {
-                sendKey(QEvent::Type::KeyPress, Qt::Key_Tab);
-                sendKey(QEvent::Type::KeyRelease, Qt::Key_Tab);
-            }
-            else {
-                sendKey(QEvent::Type::KeyPress, Qt::Key_Down);
-                sendKey(QEvent::Type::KeyRelease, Qt::Key_Down);
-            }
+    if (leftY < -AXIS_NAVIGATION_THRESHOLD) {
+        return Qt::Key_Up;
+    }
+    else if (leftY > AXIS_NAVIGATION_THRESHOLD) {
+        return Qt::Key_Down;
+    }
+    else if (leftX < -AXIS_NAVIGATION_THRESHOLD) {
+        return Qt::Key_Left;
+    }
+    else if (leftX > AXIS_NAVIGATION_THRESHOLD) {
+        return Qt::Key_Right;
+    }
+    else {
+        return Qt::Key_unknown;
+    }
+}
 
-            m_LastAxisNavigationEventTime = SDL_GetTicks();
-        }
-        else if (leftX < -30000) {
-            sendKey(QEvent::Type::KeyPress, Qt::Key_Left);
-            sendKey(QEvent::Type::KeyRelease, Qt::Key_Left);
-            m_LastAxisNavigationEventTime = SDL_GetTicks();
-        }
-        else if (leftX > 30000) {
-            sendKey(QEvent::Type::KeyPress, Qt::Key_Right);
-            sendKey(QEvent::Type::KeyRelease, Qt::Key_Right);
-            m_LastAxisNavigationEventTime = SDL_GetTicks();
-        }
+void SdlGamepadKeyNavigation::handleAxisMotion(const SDL_ControllerAxisEvent& event)
+{
+    if (event.axis != SDL_CONTROLLER_AXIS_LEFTX && event.axis != SDL_CONTROLLER_AXIS_LEFTY) {
+        return;
+    }
+
+    SDL_GameController* gc = SDL_GameControllerFromInstanceID(event.which);
+    if (gc == nullptr) {
+        return;
     }
+
+    Qt::Key key = getAxisNavigationKey(gc);
+    if (key == m_HeldAxisKey) {
+        // Still held in the same direction (or still centered)
+        return;
+    }
+
+    if (key == Qt::Key_unknown) {
+        stopAxisRepeat();
+        return;
+    }
+
+    // Navigate immediately unless we just did, then repeat for as long
+    // as the stick stays in this direction.
+    m_HeldAxisKey = key;
+    if (SDL_GetTicks() - m_LastAxisNavigationEventTime >= AXIS_NAVIGATION_REPEAT_DELAY) {
+        sendAxisKey(key);
+    }
+    m_AxisRepeatTimer->start();
+}
+
+void SdlGamepadKeyNavigation::onAxisRepeatTimerFired()
+{
+    Q_ASSERT(m_HeldAxisKey != Qt::Key_unknown);
+    sendAxisKey(m_HeldAxisKey);
+}
+
+void SdlGamepadKeyNavigation::stopAxisRepeat()
+{
+    m_AxisRepeatTimer->stop();
+    m_HeldAxisKey = Qt::Key_unknown;
+}
+
+void SdlGamepadKeyNavigation::sendAxisKey(Qt::Key key)
+{
+    if (m_UiNavMode && (key == Qt::Key_Up || key == Qt::Key_Down)) {
+        // Up is back-tab and down is tab
+        Qt::KeyboardModifiers modifiers = key == Qt::Key_Up ? Qt::ShiftModifier : Qt::NoModifier;
+        sendKey(QEvent::Type::KeyPress, Qt::Key_Tab, modifiers);
+        sendKey(QEvent::Type::KeyRelease, Qt::Key_Tab, modifiers);
+    }
+    else {
+        sendKey(QEvent::Type::KeyPress, key);
+        sendKey(QEvent::Type::KeyRelease, key);
+    }
+
+    m_LastAxisNavigationEventTime = SDL_GetTicks();
 }
 
 void SdlGamepadKeyNavigation::sendKey(QEvent::Type type, Qt::Key key, Qt::KeyboardModifiers modifiers)
@@ -268,15 +346,21 @@ void SdlGamepadKeyNavigation::sendKey(QEvent::Type type, Qt::Key key, Qt::Keyboa
 
 void SdlGamepadKeyNavigation::updateTimerState()
 {
-    if (m_PollingTimer->isActive() && (!m_HasFocus || !m_Enabled)) {
+    if (!m_HasFocus || !m_Enabled) {
         m_PollingTimer->stop();
+        stopAxisRepeat();
+        return;
     }
-    else if (!m_PollingTimer->isActive() && m_HasFocus && m_Enabled) {
+
+    int interval = m_Gamepads.isEmpty() ? HOTPLUG_POLLING_INTERVAL : GAMEPAD_POLLING_INTERVAL;
+    if (!m_PollingTimer->isActive()) {
         // Flush events on the first poll
         m_FirstPoll = true;
 
-        // Poll every 50 ms for a new joystick event
-        m_PollingTimer->start(50);
+        m_PollingTimer->start(interval);
+    }
+    else if (m_PollingTimer->interval() != interval) {
+        m_PollingTimer->setInterval(interval);
     }
 }
 
@@ -29,14 +29,26 @@ public:
 private:
     void sendKey(QEvent::Type type, Qt::Key key, Qt::KeyboardModifiers modifiers = Qt::NoModifier);
 
+    void sendAxisKey(Qt::Key key);
+
+    Qt::Key getAxisNavigationKey(SDL_GameController* gc);
+
+    void handleAxisMotion(const SDL_ControllerAxisEvent& event);
+
+    void stopAxisRepeat();
+
     void updateTimerState();
 
 private slots:
     void onPollingTimerFired();
 
+    void onAxisRepeatTimerFired();
+
 private:
     StreamingPreferences* m_Prefs;
     QTimer* m_PollingTimer;
+    QTimer* m_AxisRepeatTimer;
+    Qt::Key m_HeldAxisKey;
     QList<SDL_GameController*> m_Gamepads;
     bool m_Enabled;
     bool m_UiNavMode;
@@ -3,6 +3,8 @@
 #include <QQmlContext>
 #include <QIcon>
 #include <QQuickStyle>
+#include <QQuickWindow>
+#include <QSharedPointer>
 #include <QMutex>
 #include <QtDebug>
 #include <QNetworkProxyFactory>
@@ -19,6 +21,11 @@
 #define SDL_MAIN_HANDLED
 #include "SDL_compat.h"
 
+#ifdef HAVE_MASTERHOOKS
+#include "masterhook.h"
+#include <qpa/qplatformnativeinterface.h>
+#endif
+
 #ifdef HAVE_FFMPEG
 #include "streaming/video/ffmpeg.h"
 #endif
@@ -32,19 +39,28 @@
 #include <openssl/ssl.h>
 #endif
 
+#include "cli/benchmarkaudio.h"
+#ifdef HAVE_FFMPEG
+#include "cli/benchmarkvideo.h"
+#include "cli/benchmarkrenderer.h"
+#endif
 #include "cli/listapps.h"
 #include "cli/quitstream.h"
 #include "cli/startstream.h"
 #include "cli/pair.h"
 #include "cli/commandlineparser.h"
+#include "asynclogger.h"
 #include "path.h"
+#include "startupprofiler.h"
 #include "utils.h"
 #include "gui/computermodel.h"
 #include "gui/appmodel.h"
 #include "backend/autoupdatechecker.h"
+#include "backend/boxartmanager.h"
 #include "backend/computermanager.h"
 #include "backend/systemproperties.h"
 #include "streaming/session.h"
+#include "streaming/streamutils.h"
 #include "settings/streamingpreferences.h"
 #include "gui/sdlgamepadkeynavigation.h"
 
@@ -68,7 +84,7 @@ QAtomicInt g_AsyncLoggingEnabled;
 
 static QElapsedTimer s_LoggerTime;
 static QTextStream s_LoggerStream(stderr);
-static QThreadPool s_LoggerThread;
+static AsyncLogger s_AsyncLogger;
 static QMutex s_SyncLoggerMutex;
 static bool s_SuppressVerboseOutput;
 static QRegularExpression k_RikeyRegex("&rikey=\\w+");
@@ -80,35 +96,42 @@ static QAtomicInteger<uint64_t> s_LogBytesWritten = 0;
 static QFile* s_LoggerFile;
 #endif
 
-class LoggerTask : public QRunnable
+static QString formatLogRecord(const AsyncLogger::Record& record, const QString& text)
 {
-public:
-    LoggerTask(const QString& msg) : m_Msg(msg)
-    {
-        setAutoDelete(true);
+    QString message;
+    QTime logTime = QTime::fromMSecsSinceStartOfDay(record.timeMs);
+
+    switch (record.source) {
+    case AsyncLogger::Sdl:
+        message = QString("%1 - SDL %2 (%3): %4\n").arg(logTime.toString()).arg(record.level).arg(record.category).arg(text);
+        break;
+    case AsyncLogger::Qt:
+        message = QString("%1 - Qt %2: %3\n").arg(logTime.toString()).arg(record.level).arg(text);
+        break;
+    case AsyncLogger::FFmpeg:
+        message = QString("%1 - FFmpeg: %2").arg(logTime.toString()).arg(text);
+        break;
+    default:
+        message = text;
+        break;
     }
 
-    void run() override
-    {
-        // QTextStream is not thread-safe, so we must lock. This will generally
-        // only contend in synchronous logging mode or during a transition
-        // between synchronous and asynchronous. Asynchronous won't contend in
-        // the common case because we only have a single logging thread.
-        QMutexLocker locker(&s_SyncLoggerMutex);
-        s_LoggerStream << m_Msg;
-        s_LoggerStream.flush();
+    // Strip session encryption keys and IVs from the logs
+    if (message.contains(QLatin1String("&rikey"))) {
+        message.replace(k_RikeyRegex, "&rikey=REDACTED");
+        message.replace(k_RikeyIdRegex, "&rikeyid=REDACTED");
     }
 
-private:
-    QString m_Msg;
-};
+    return message;
+}
 
-void logToLoggerStream(QString& message)
+// The caller must hold s_SyncLoggerMutex, since QTextStream is not thread-safe
+static void writeLogMessage(QString& message)
 {
 #if defined(QT_DEBUG) && defined(Q_OS_WIN32)
     // Output log messages to a debugger if attached
     if (IsDebuggerPresent()) {
-        thread_local QString lineBuffer;
+        static QString lineBuffer;
         lineBuffer += message;
         if (message.endsWith('\n')) {
             OutputDebugStringW(lineBuffer.toStdWString().c_str());
@@ -117,10 +140,6 @@ void logToLoggerStream(QString& message)
     }
 #endif
 
-    // Strip session encryption keys and IVs from the logs
-    message.replace(k_RikeyRegex, "&rikey=REDACTED");
-    message.replace(k_RikeyIdRegex, "&rikeyid=REDACTED");
-
 #ifdef LOG_TO_FILE
     auto oldLogSize = s_LogBytesWritten.fetchAndAddRelaxed(message.size());
     if (oldLogSize >= k_MaxLogSizeBytes) {
@@ -132,19 +151,51 @@ void logToLoggerStream(QString& message)
     }
 #endif
 
+    s_LoggerStream << message;
+}
+
+// Called on the logger thread for each queued message
+static void writeAsyncLogRecord(const AsyncLogger::Record& record, const QByteArray& text)
+{
+    QString message = formatLogRecord(record, QString::fromUtf8(text));
+
+    // This will generally only contend during a transition between synchronous and asynchronous
+    QMutexLocker locker(&s_SyncLoggerMutex);
+    writeLogMessage(message);
+}
+
+// Called on the logger thread after each batch of messages
+static void flushAsyncLog()
+{
+    QMutexLocker locker(&s_SyncLoggerMutex);
+    s_LoggerStream.flush();
+}
+
+static void logToLoggerStream(AsyncLogger::Source source, const char* level, int category, const char* text, int length)
+{
+    AsyncLogger::Record record;
+    record.source = source;
+    record.timeMs = (int)s_LoggerTime.elapsed();
+    record.category = category;
+    record.level = level;
+
     if (g_AsyncLoggingEnabled) {
-        // Queue the log message to be written asynchronously
-        s_LoggerThread.start(new LoggerTask(message));
+        // Only the raw text is copied here. The logger thread does the formatting.
+        s_AsyncLogger.log(record, text, length);
     }
     else {
         // Log the message immediately
-        LoggerTask(message).run();
+        QString message = formatLogRecord(record, QString::fromUtf8(text, length));
+
+        QMutexLocker locker(&s_SyncLoggerMutex);
+        writeLogMessage(message);
+        s_LoggerStream.flush();
     }
 }
 
 void sdlLogToDiskHandler(void*, int category, SDL_LogPriority priority, const char* message)
 {
-    QString priorityTxt;
+    const char* priorityTxt;
 
     switch (priority) {
     case SDL_LOG_PRIORITY_VERBOSE:
@@ -182,15 +233,12 @@ void sdlLogToDiskHandler(void*, int category, SDL_LogPriority priority, const ch
         break;
     }
 
-    QTime logTime = QTime::fromMSecsSinceStartOfDay(s_LoggerTime.elapsed());
-    QString txt = QString("%1 - SDL %2 (%3): %4\n").arg(logTime.toString()).arg(priorityTxt).arg(category).arg(message);
-
-    logToLoggerStream(txt);
+    logToLoggerStream(AsyncLogger::Sdl, priorityTxt, category, message, (int)strlen(message));
 }
 
 void qtLogToDiskHandler(QtMsgType type, const QMessageLogContext&, const QString& msg)
 {
-    QString typeTxt;
+    const char* typeTxt = "";
 
     switch (type) {
     case QtDebugMsg:
@@ -219,10 +267,8 @@ void qtLogToDiskHandler(QtMsgType type, const QMessageLogContext&, const QString
         break;
     }
 
-    QTime logTime = QTime::fromMSecsSinceStartOfDay(s_LoggerTime.elapsed());
-    QString txt = QString("%1 - Qt %2: %3\n").arg(logTime.toString()).arg(typeTxt).arg(msg);
-
-    logToLoggerStream(txt);
+    QByteArray text = msg.toUtf8();
+    logToLoggerStream(AsyncLogger::Qt, typeTxt, 0, text.constData(), text.size());
 }
 
 #ifdef HAVE_FFMPEG
@@ -246,15 +292,8 @@ void ffmpegLogToDiskHandler(void* ptr, int level, const char* fmt, va_list vl)
 
     av_log_format_line(ptr, level, fmt, vl, lineBuffer, sizeof(lineBuffer), &printPrefix);
 
-    if (shouldPrefixThisMessage) {
-        QTime logTime = QTime::fromMSecsSinceStartOfDay(s_LoggerTime.elapsed());
-        QString txt = QString("%1 - FFmpeg: %2").arg(logTime.toString()).arg(lineBuffer);
-        logToLoggerStream(txt);
-    }
-    else {
-        QString txt = QString(lineBuffer);
-        logToLoggerStream(txt);
-    }
+    logToLoggerStream(shouldPrefixThisMessage ? AsyncLogger::FFmpeg : AsyncLogger::Raw,
+                      nullptr, 0, lineBuffer, (int)strlen(lineBuffer));
 }
 
 #endif
@@ -322,6 +361,8 @@ LONG WINAPI UnhandledExceptionHandler(struct _EXCEPTION_POINTERS *ExceptionInfo)
 
 int main(int argc, char *argv[])
 {
+    StartupProfiler::markStage("Process start");
+
     SDL_SetMainReady();
 
     // Set the app version for the QCommandLineParser's showVersion() command
@@ -374,8 +415,8 @@ int main(int argc, char *argv[])
     }
 #endif
 
-    // Serialize log messages on a single thread
-    s_LoggerThread.setMaxThreadCount(1);
+    // Serialize async log messages on a single thread
+    s_AsyncLogger.start(writeAsyncLogRecord, flushAsyncLog);
     s_LoggerTime.start();
 
     // Register our logger with all libraries
@@ -392,6 +433,8 @@ int main(int argc, char *argv[])
     av_log_set_callback(ffmpegLogToDiskHandler);
 #endif
 
+    StartupProfiler::markStage("Logging initialized");
+
 #ifdef Q_OS_WIN32
     // Create a crash dump when we crash on Windows
     SetUnhandledExceptionFilter(UnhandledExceptionHandler);
@@ -604,8 +647,16 @@ int main(int argc, char *argv[])
     SDL_SetHint(SDL_HINT_WINDOWS_DISABLE_THREAD_NAMING, "0");
 #endif
 
+    StartupProfiler::markStage("SDL initialized");
+
     QGuiApplication app(argc, argv);
 
+    StartupProfiler::markStage("QGuiApplication created");
+
+    // Start loading our client identity now, so it's ready by the time
+    // the UI needs it and key generation doesn't block the UI thread.
+    IdentityManager::preload();
+
 #ifndef STEAM_LINK
     // Force use of the KMSDRM backend for SDL when using Qt platform plugins
     // that directly draw to the display without a windowing system.
@@ -614,6 +665,22 @@ int main(int argc, char *argv[])
     }
 #endif
 
+#ifdef HAVE_MASTERHOOKS
+    // Hand our DRM master hooks the FD that Qt renders with, so they can pass
+    // master to SDL and back without probing every modesetting call for it.
+    // Only eglfs_kms exposes its FD, so other EGLFS backends and linuxfb still
+    // rely on the hooks to discover it.
+    if (QGuiApplication::platformName() == "eglfs") {
+        void* driFd = QGuiApplication::platformNativeInterface()->nativeResourceForIntegration("dri_fd");
+        if (driFd != nullptr) {
+            MasterHook_RegisterQtDrmFd((int)(qintptr)driFd);
+        }
+    }
+    else if (QGuiApplication::platformName() != "linuxfb") {
+        MasterHook_RegisterQtDrmFd(-1);
+    }
+#endif
+
 #ifdef Q_OS_WIN32
     // If we don't have stdout or stderr handles (which will normally be the case
     // since we're a /SUBSYSTEM:WINDOWS app), attach to our parent console and use
@@ -757,9 +824,6 @@ int main(int argc, char *argv[])
                                                        return StreamingPreferences::get(qmlEngine);
                                                    });
 
-    // Create the identity manager on the main thread
-    IdentityManager::get();
-
     // We require the Material theme
     QQuickStyle::setStyle("Material");
 
@@ -780,7 +844,10 @@ int main(int argc, char *argv[])
         qputenv("QT_QUICK_CONTROLS_MATERIAL_PRIMARY", "#3F51B5");
     }
 
+    StartupProfiler::markStage("QML types registered");
+
     QQmlApplicationEngine engine;
+    engine.addImageProvider("boxart", new BoxArtImageProvider());
     QString initialView;
     bool hasGUI = true;
 
@@ -822,8 +889,51 @@ int main(int argc, char *argv[])
         {
             ListCommandLineParser listParser;
             listParser.parse(app.arguments());
-            auto launcher = new CliListApps::Launcher(listParser.getHost(), listParser, &app);
-            launcher->execute(new ComputerManager(StreamingPreferences::get()));
+            if (listParser.getHosts().count() > 1 || listParser.isPrintJSON()) {
+                auto launcher = new CliListApps::BatchLauncher(listParser, &app);
+                launcher->execute(new ComputerManager(StreamingPreferences::get()));
+            }
+            else {
+                auto launcher = new CliListApps::Launcher(listParser.getHost(), listParser, &app);
+                launcher->execute(new ComputerManager(StreamingPreferences::get()));
+            }
+            hasGUI = false;
+            break;
+        }
+    case GlobalCommandLineParser::BenchmarkAudioRequested:
+        {
+            BenchmarkAudioCommandLineParser benchmarkParser;
+            benchmarkParser.parse(app.arguments());
+            auto launcher = new CliBenchmarkAudio::Launcher(benchmarkParser, &app);
+            launcher->execute();
+            hasGUI = false;
+            break;
+        }
+    case GlobalCommandLineParser::BenchmarkVideoRequested:
+        {
+#ifdef HAVE_FFMPEG
+            BenchmarkVideoCommandLineParser benchmarkParser;
+            benchmarkParser.parse(app.arguments());
+            auto launcher = new CliBenchmarkVideo::Launcher(benchmarkParser, &app);
+            launcher->execute();
+#else
+            fprintf(stderr, "Video benchmarking requires the FFmpeg decoder\n");
+            return -1;
+#endif
+            hasGUI = false;
+            break;
+        }
+    case GlobalCommandLineParser::BenchmarkRendererRequested:
+        {
+#ifdef HAVE_FFMPEG
+            BenchmarkRendererCommandLineParser benchmarkParser;
+            benchmarkParser.parse(app.arguments());
+            auto launcher = new CliBenchmarkRenderer::Launcher(benchmarkParser, &app);
+            launcher->execute();
+#else
+            fprintf(stderr, "Renderer benchmarking requires the FFmpeg decoder\n");
+            return -1;
+#endif
             hasGUI = false;
             break;
         }
@@ -836,10 +946,32 @@ int main(int argc, char *argv[])
         engine.load(QUrl(QStringLiteral("qrc:/gui/main.qml")));
         if (engine.rootObjects().isEmpty())
             return -1;
+
+        StartupProfiler::markStage("QML loaded");
+
+        // Non-essential startup work waits until the first frame is on screen
+        QQuickWindow* window = qobject_cast<QQuickWindow*>(engine.rootObjects().first());
+        if (window != nullptr) {
+            auto connection = QSharedPointer<QMetaObject::Connection>::create();
+            *connection = QObject::connect(window, &QQuickWindow::frameSwapped, &app,
+                                           [connection]() {
+                                               QObject::disconnect(*connection);
+                                               StartupProfiler::notifyInteractive();
+                                           },
+                                           Qt::QueuedConnection);
+        }
+        else {
+            StartupProfiler::notifyInteractive();
+        }
+    }
+    else {
+        StartupProfiler::notifyInteractive();
     }
 
     int err = app.exec();
 
+    StartupProfiler::logStages();
+
     // Give worker tasks time to properly exit. Fixes PendingQuitTask
     // sometimes freezing and blocking process exit.
     QThreadPool::globalInstance()->waitForDone(30000);
@@ -859,7 +991,7 @@ int main(int argc, char *argv[])
     Q_ASSERT(g_AsyncLoggingEnabled == 0);
 
     // Wait for pending log messages to be printed
-    s_LoggerThread.waitForDone();
+    s_AsyncLogger.stop();
 
 #ifdef Q_OS_WIN32
     // Without an explicit flush, console redirection for the list command
@@ -17,6 +17,8 @@
 // redirection that happens when _FILE_OFFSET_BITS=64!
 // See masterhook_internal.c for details.
 
+#include "masterhook.h"
+
 #include "SDL_compat.h"
 #include <dlfcn.h>
 #include <unistd.h>
@@ -67,6 +69,10 @@ static void lookupRealLibCFunctions() {
 int g_QtDrmMasterFd = -1;
 struct stat g_DrmMasterStat;
 
+// Set once Qt's DRM FD has been registered explicitly, so we
+// don't have to probe for it on every modeset or page flip.
+static bool s_QtDrmFdRegistered;
+
 // Last CRTC state for us to restore later
 drmModeCrtcPtr g_QtCrtcState;
 uint32_t* g_QtCrtcConnectors;
@@ -82,23 +88,42 @@ int drmIsMaster(int fd)
     return drmAuthMagic(fd, 0) != -EACCES;
 }
 
-// This hook will handle legacy DRM rendering
-int drmModeSetCrtc(int fd, uint32_t crtcId, uint32_t bufferId,
-                   uint32_t x, uint32_t y, uint32_t *connectors, int count,
-                   drmModeModeInfoPtr mode)
+void MasterHook_RegisterQtDrmFd(int fd)
 {
-    // Lookup the real libdrm function pointers if we haven't yet
-    pthread_once(&s_InitDrmFunctions, lookupRealDrmFunctions);
+    g_QtDrmMasterFd = fd;
+    if (fd >= 0) {
+        fstat(fd, &g_DrmMasterStat);
+        SDL_LogInfo(SDL_LOG_CATEGORY_APPLICATION,
+                    "Registered Qt EGLFS DRM master fd: %d",
+                    fd);
+    }
+    s_QtDrmFdRegistered = true;
+}
 
+// Called by our modesetting hooks to find Qt's DRM master FD if it wasn't registered
+static void captureQtDrmFd(int fd, const char* source)
+{
     // Grab the first DRM Master FD that makes it in here. This will be the Qt
     // EGLFS backend's DRM FD, on which we will call drmDropMaster() later.
-    if (g_QtDrmMasterFd == -1 && drmIsMaster(fd)) {
+    if (!s_QtDrmFdRegistered && g_QtDrmMasterFd == -1 && drmIsMaster(fd)) {
         g_QtDrmMasterFd = fd;
         fstat(g_QtDrmMasterFd, &g_DrmMasterStat);
         SDL_LogInfo(SDL_LOG_CATEGORY_APPLICATION,
-                    "Captured Qt EGLFS DRM master fd (legacy): %d",
+                    "Captured Qt EGLFS DRM master fd (%s): %d",
+                    source,
                     g_QtDrmMasterFd);
     }
+}
+
+// This hook will handle legacy DRM rendering
+int drmModeSetCrtc(int fd, uint32_t crtcId, uint32_t bufferId,
+                   uint32_t x, uint32_t y, uint32_t *connectors, int count,
+                   drmModeModeInfoPtr mode)
+{
+    // Lookup the real libdrm function pointers if we haven't yet
+    pthread_once(&s_InitDrmFunctions, lookupRealDrmFunctions);
+
+    captureQtDrmFd(fd, "legacy");
 
     // Call into the real thing
     int err = fn_drmModeSetCrtc(fd, crtcId, bufferId, x, y, connectors, count, mode);
@@ -148,15 +173,7 @@ int drmModeAtomicCommit(int fd, drmModeAtomicReqPtr req,
     // Lookup the real libdrm function pointers if we haven't yet
     pthread_once(&s_InitDrmFunctions, lookupRealDrmFunctions);
 
-    // Grab the first DRM Master FD that makes it in here. This will be the Qt
-    // EGLFS backend's DRM FD, on which we will call drmDropMaster() later.
-    if (g_QtDrmMasterFd == -1 && drmIsMaster(fd)) {
-        g_QtDrmMasterFd = fd;
-        fstat(g_QtDrmMasterFd, &g_DrmMasterStat);
-        SDL_LogInfo(SDL_LOG_CATEGORY_APPLICATION,
-                    "Captured Qt EGLFS DRM master fd (atomic): %d",
-                    g_QtDrmMasterFd);
-    }
+    captureQtDrmFd(fd, "atomic");
 
     // Call into the real thing
     int err = fn_drmModeAtomicCommit(fd, req, flags, user_data);
@@ -247,4 +264,11 @@ int close(int fd)
     return ret;
 }
 
+#else
+
+void MasterHook_RegisterQtDrmFd(int fd)
+{
+    (void)fd;
+}
+
 #endif
@@ -0,0 +1,15 @@
+#pragma once
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+// Explicitly hands our hooks the DRM FD that Qt's EGLFS backend uses, rather
+// than having them guess at it by probing every modeset call for DRM master.
+// Pass -1 when Qt doesn't render with DRM, which makes the libdrm hooks plain
+// pass-throughs. Must be called before SDL opens the DRM device.
+void MasterHook_RegisterQtDrmFd(int fd);
+
+#ifdef __cplusplus
+}
+#endif
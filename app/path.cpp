@@ -2,6 +2,7 @@
 
 #include <QtDebug>
 #include <QDir>
+#include <QSaveFile>
 #include <QStandardPaths>
 #include <QSettings>
 #include <QCoreApplication>
@@ -38,6 +39,15 @@ QByteArray Path::readDataFile(QString fileName)
     return dataFile.readAll();
 }
 
+QByteArray Path::readCacheFile(QString fileName)
+{
+    QFile dataFile(QDir(s_CacheDir).absoluteFilePath(fileName));
+    if (!dataFile.open(QIODevice::ReadOnly)) {
+        return {};
+    }
+    return dataFile.readAll();
+}
+
 void Path::writeCacheFile(QString fileName, QByteArray data)
 {
     QDir cacheDir(s_CacheDir);
@@ -47,9 +57,11 @@ void Path::writeCacheFile(QString fileName, QByteArray data)
         cacheDir.mkpath(".");
     }
 
-    QFile dataFile(cacheDir.absoluteFilePath(fileName));
+    // Replace the file atomically, so readers never see a partial write
+    QSaveFile dataFile(cacheDir.absoluteFilePath(fileName));
     if (dataFile.open(QIODevice::WriteOnly)) {
         dataFile.write(data);
+        dataFile.commit();
     }
 }
 
@@ -109,7 +121,7 @@ void Path::initialize(bool portable)
         s_BoxArtCacheDir = QDir::currentPath() + "/boxart";
         s_QmlCacheDir = QDir::currentPath() + "/qmlcache";
 
-        // In order for the If-Modified-Since logic to work in MappingFetcher,
+        // In order for the cached downloads in BackgroundFetcher to work,
         // the cache directory must be different than the current directory.
         s_CacheDir = QDir::currentPath() + "/cache";
     }
@@ -11,6 +11,7 @@ public:
     static QString getQmlCacheDir();
 
     static QByteArray readDataFile(QString fileName);
+    static QByteArray readCacheFile(QString fileName);
     static void writeCacheFile(QString fileName, QByteArray data);
     static void deleteCacheFile(QString fileName);
     static QFileInfo getCacheFileInfo(QString fileName);
@@ -1,7 +1,6 @@
 #pragma once
 
 #include <QObject>
-#include <QNetworkAccessManager>
 
 class CompatFetcher : public QObject
 {
@@ -14,9 +13,6 @@ public:
 
     static bool isGfeVersionSupported(QString gfeVersion);
 
-private slots:
-    void handleCompatInfoFetched(QNetworkReply* reply);
-
 private:
-    QNetworkAccessManager* m_Nam;
+    void handleCompatInfoFetched(const QByteArray& data, bool updated);
 };
@@ -1,7 +1,6 @@
 #pragma once
 
 #include <QObject>
-#include <QNetworkAccessManager>
 
 class MappingFetcher : public QObject
 {
@@ -12,9 +11,6 @@ public:
 
     void start();
 
-private slots:
-    void handleMappingListFetched(QNetworkReply* reply);
-
 private:
-    QNetworkAccessManager* m_Nam;
+    void handleMappingListFetched(bool updated);
 };
@@ -1,7 +1,10 @@
 #include "mappingmanager.h"
 #include "path.h"
+#include "startupprofiler.h"
 
+#include <QDataStream>
 #include <QDir>
+#include <QFileInfo>
 
 #include "SDL_compat.h"
 
@@ -10,7 +13,14 @@
 #define SER_GUID "guid"
 #define SER_MAPPING "mapping"
 
+// Bump this if the format of the database index changes
+#define DATABASE_INDEX_VERSION 1
+#define DATABASE_INDEX_FILE "gamecontrollerdb.idx"
+
 MappingFetcher* MappingManager::s_MappingFetcher;
+QHash<QString, QByteArray> MappingManager::s_DatabaseIndex;
+QString MappingManager::s_DatabaseSignature;
+QHash<QString, QByteArray> MappingManager::s_UserMappings;
 
 MappingManager::MappingManager()
 {
@@ -19,7 +29,9 @@ MappingManager::MappingManager()
     // Load updated mappings from the Internet once per Moonlight launch
     if (s_MappingFetcher == nullptr) {
         s_MappingFetcher = new MappingFetcher();
-        s_MappingFetcher->start();
+        StartupProfiler::runWhenInteractive(s_MappingFetcher, []() {
+            s_MappingFetcher->start();
+        });
     }
 
     // First load existing saved mappings. This ensures the user's
@@ -66,53 +78,179 @@ void MappingManager::save()
     settings.endArray();
 }
 
-void MappingManager::applyMappings()
+QString MappingManager::normalizeGuid(const QString& guid)
 {
-    QByteArray mappingData = Path::readDataFile("gamecontrollerdb.txt");
-    if (!mappingData.isEmpty()) {
-        int newMappings = SDL_GameControllerAddMappingsFromRW(
-                    SDL_RWFromConstMem(mappingData.constData(), mappingData.size()), 1);
-
-        if (newMappings > 0) {
-            SDL_LogInfo(SDL_LOG_CATEGORY_APPLICATION,
-                        "Loaded %d new gamepad mappings",
-                        newMappings);
+    // SDL 2.26 and later store a CRC of the device name in bytes 2-3 of the
+    // GUID, but the mapping database doesn't. SDL ignores the CRC when it
+    // matches mappings, so we must too.
+    QString normalizedGuid = guid.toLower();
+    if (normalizedGuid.length() == 32) {
+        normalizedGuid.replace(4, 4, "0000");
+    }
+    return normalizedGuid;
+}
+
+bool MappingManager::buildDatabaseIndex(const QByteArray& mappingData)
+{
+    QByteArray platformField = QByteArray("platform:") + SDL_GetPlatform() + ",";
+
+    s_DatabaseIndex.clear();
+
+    for (const QByteArray& line : mappingData.split('\n')) {
+        QByteArray mapping = line.trimmed();
+        if (mapping.isEmpty() || mapping.startsWith('#')) {
+            continue;
         }
-        else {
-            if (newMappings < 0) {
-                SDL_LogError(SDL_LOG_CATEGORY_APPLICATION,
-                             "Error loading gamepad mappings: %s",
-                             SDL_GetError());
-            }
-            else if (newMappings == 0) {
-                SDL_LogWarn(SDL_LOG_CATEGORY_APPLICATION,
-                            "0 new mappings found in gamecontrollerdb.txt. Is it corrupt?");
-            }
 
-            // Try deleting the cached mapping list just in case it's corrupt
-            Path::deleteCacheFile("gamecontrollerdb.txt");
+        // Skip mappings for other platforms, like SDL would
+        int platformIndex = mapping.indexOf("platform:");
+        if (platformIndex >= 0 && !(mapping + ",").mid(platformIndex).startsWith(platformField)) {
+            continue;
         }
+
+        int guidLength = mapping.indexOf(',');
+        if (guidLength <= 0) {
+            continue;
+        }
+
+        // Later entries override earlier ones, as they do in SDL
+        s_DatabaseIndex.insert(normalizeGuid(QString::fromLatin1(mapping.left(guidLength))), mapping);
     }
-    else {
+
+    return !s_DatabaseIndex.isEmpty();
+}
+
+void MappingManager::loadDatabaseIndex()
+{
+    // The database is either the one we shipped with or a newer one that
+    // MappingFetcher downloaded into the cache. Either way, its location,
+    // size, and modification time tell us whether our index is current.
+    QFileInfo databaseInfo(Path::getDataFilePath("gamecontrollerdb.txt"));
+    QString signature = QString("%1:%2:%3:%4")
+                            .arg(databaseInfo.absoluteFilePath())
+                            .arg(databaseInfo.size())
+                            .arg(databaseInfo.lastModified().toMSecsSinceEpoch())
+                            .arg(SDL_GetPlatform());
+    if (signature == s_DatabaseSignature) {
+        return;
+    }
+
+    // Try the index we saved the last time we parsed this database
+    QByteArray indexData = Path::readCacheFile(DATABASE_INDEX_FILE);
+    if (!indexData.isEmpty()) {
+        QDataStream stream(indexData);
+        quint32 version;
+        QString indexSignature;
+
+        stream >> version;
+        if (version == DATABASE_INDEX_VERSION) {
+            stream >> indexSignature;
+            if (indexSignature == signature) {
+                stream >> s_DatabaseIndex;
+                if (stream.status() == QDataStream::Ok && !s_DatabaseIndex.isEmpty()) {
+                    s_DatabaseSignature = signature;
+                    return;
+                }
+            }
+        }
+    }
+
+    // Parse the database and save an index for the next launch
+    QByteArray mappingData = Path::readDataFile("gamecontrollerdb.txt");
+    if (mappingData.isEmpty()) {
         SDL_LogError(SDL_LOG_CATEGORY_APPLICATION,
                      "Unable to load gamepad mapping file");
+        s_DatabaseIndex.clear();
     }
+    else if (!buildDatabaseIndex(mappingData)) {
+        SDL_LogWarn(SDL_LOG_CATEGORY_APPLICATION,
+                    "0 new mappings found in gamecontrollerdb.txt. Is it corrupt?");
 
-    QList<SdlGamepadMapping> mappings = m_Mappings.values();
-    for (const SdlGamepadMapping& mapping : mappings) {
+        // Try deleting the cached mapping list just in case it's corrupt
+        Path::deleteCacheFile("gamecontrollerdb.txt");
+    }
+    else {
+        SDL_LogInfo(SDL_LOG_CATEGORY_APPLICATION,
+                    "Indexed %d gamepad mappings",
+                    s_DatabaseIndex.count());
+
+        QByteArray newIndexData;
+        QDataStream stream(&newIndexData, QIODevice::WriteOnly);
+        stream << (quint32)DATABASE_INDEX_VERSION << signature << s_DatabaseIndex;
+        Path::writeCacheFile(DATABASE_INDEX_FILE, newIndexData);
+    }
+
+    s_DatabaseSignature = signature;
+}
+
+void MappingManager::applyMappings()
+{
+    loadDatabaseIndex();
+
+    // Our saved and hinted mappings take precedence over the database
+    s_UserMappings.clear();
+    for (const SdlGamepadMapping& mapping : m_Mappings) {
         QString sdlMappingString = mapping.getSdlMappingString();
-        int ret = SDL_GameControllerAddMapping(qPrintable(sdlMappingString));
+        if (!sdlMappingString.isEmpty()) {
+            s_UserMappings.insert(normalizeGuid(mapping.getGuid()), sdlMappingString.toUtf8());
+        }
+    }
+
+    // Only the joysticks that are attached need mappings now
+    int numJoysticks = SDL_NumJoysticks();
+    for (int i = 0; i < numJoysticks; i++) {
+        applyMappingsForJoystick(i);
+    }
+}
+
+bool MappingManager::applyMappingsForJoystick(int deviceIndex)
+{
+    char guidStr[33];
+    SDL_JoystickGetGUIDString(SDL_JoystickGetDeviceGUID(deviceIndex),
+                              guidStr, sizeof(guidStr));
+    QString guid = normalizeGuid(QString::fromLatin1(guidStr));
+    bool added = false;
+
+    for (const QHash<QString, QByteArray>* mappings : { &s_DatabaseIndex, &s_UserMappings }) {
+        auto it = mappings->constFind(guid);
+        if (it == mappings->constEnd()) {
+            continue;
+        }
+
+        int ret = SDL_GameControllerAddMapping(it.value().constData());
         if (ret < 0) {
             SDL_LogWarn(SDL_LOG_CATEGORY_APPLICATION,
                         "Unable to add mapping: %s",
-                        qPrintable(sdlMappingString));
+                        it.value().constData());
         }
-        else if (ret == 1) {
-            SDL_LogInfo(SDL_LOG_CATEGORY_APPLICATION,
-                        "Loaded saved user mapping: %s",
-                        qPrintable(sdlMappingString));
+        else {
+            if (ret == 1 && mappings == &s_UserMappings) {
+                SDL_LogInfo(SDL_LOG_CATEGORY_APPLICATION,
+                            "Loaded saved user mapping: %s",
+                            it.value().constData());
+            }
+            added = true;
         }
     }
+
+    return added;
+}
+
+bool MappingManager::applyMappingsForNewJoystick(int deviceIndex)
+{
+    // SDL already generated SDL_CONTROLLERDEVICEADDED if it had a mapping
+    bool wasGameController = SDL_IsGameController(deviceIndex);
+
+    if (!applyMappingsForJoystick(deviceIndex) || wasGameController ||
+            !SDL_IsGameController(deviceIndex)) {
+        return false;
+    }
+
+    SDL_Event event = {};
+    event.type = SDL_CONTROLLERDEVICEADDED;
+    event.cdevice.which = deviceIndex;
+    SDL_PushEvent(&event);
+    return true;
 }
 
 void MappingManager::addMapping(QString mappingString)
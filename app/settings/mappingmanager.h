@@ -2,6 +2,7 @@
 
 #include "mappingfetcher.h"
 
+#include <QHash>
 #include <QSettings>
 
 class SdlGamepadMapping
@@ -66,13 +67,34 @@ public:
 
     void addMapping(SdlGamepadMapping& gamepadMapping);
 
+    // Applies mappings for the joysticks attached right now. Joysticks
+    // attached later get theirs from applyMappingsForNewJoystick().
     void applyMappings();
 
+    // Call on SDL_JOYDEVICEADDED. If our mappings make the joystick a game
+    // controller, this queues the SDL_CONTROLLERDEVICEADDED event that SDL
+    // couldn't generate itself and returns true.
+    static bool applyMappingsForNewJoystick(int deviceIndex);
+
     void save();
 
 private:
+    static bool applyMappingsForJoystick(int deviceIndex);
+
+    static void loadDatabaseIndex();
+
+    static bool buildDatabaseIndex(const QByteArray& mappingData);
+
+    static QString normalizeGuid(const QString& guid);
+
     QMap<QString, SdlGamepadMapping> m_Mappings;
 
     static MappingFetcher* s_MappingFetcher;
+
+    // gamecontrollerdb.txt entries for this platform and the user's own
+    // mappings, both keyed by normalized GUID
+    static QHash<QString, QByteArray> s_DatabaseIndex;
+    static QString s_DatabaseSignature;
+    static QHash<QString, QByteArray> s_UserMappings;
 };
 
@@ -23,6 +23,7 @@
 #define SER_HOSTAUDIO "hostaudio"
 #define SER_MULTICONT "multicontroller"
 #define SER_AUDIOCFG "audiocfg"
+#define SER_SURROUNDDOWNMIX "surrounddownmix"
 #define SER_VIDEOCFG "videocfg"
 #define SER_HDR "hdr"
 #define SER_YUV444 "yuv444"
@@ -31,6 +32,7 @@
 #define SER_MDNS "mdns"
 #define SER_QUITAPPAFTER "quitAppAfter"
 #define SER_ABSMOUSEMODE "mouseacceleration"
+#define SER_LOCALCURSOR "localcursor"
 #define SER_ABSTOUCHMODE "abstouchmode"
 #define SER_STARTWINDOWED "startwindowed"
 #define SER_FRAMEPACING "framepacing"
@@ -47,10 +49,14 @@
 #define SER_MUTEONFOCUSLOSS "muteonfocusloss"
 #define SER_BACKGROUNDGAMEPAD "backgroundgamepad"
 #define SER_REVERSESCROLL "reversescroll"
+#define SER_MOUSESENDRATE "mousesendrate"
 #define SER_SWAPFACEBUTTONS "swapfacebuttons"
 #define SER_CAPTURESYSKEYS "capturesyskeys"
 #define SER_KEEPAWAKE "keepawake"
+#define SER_LOWMEMORY "lowmemory"
 #define SER_LANGUAGE "language"
+#define SER_RECORDINGDIR "recordingdir"
+#define SER_RECORDINGFORMAT "recordingformat"
 
 #define CURRENT_DEFAULT_VER 2
 
@@ -104,7 +110,19 @@ void StreamingPreferences::reload()
 {
     QSettings settings;
 
-    int defaultVer = settings.value(SER_DEFAULTVER, 0).toInt();
+    // Remember what's stored, so save() can skip writing unchanged values
+    m_SavedValues.clear();
+    auto load = [&](const char* key, const QVariant& defaultValue) -> QVariant {
+        QVariant value = settings.value(key);
+        if (!value.isValid()) {
+            return defaultValue;
+        }
+
+        m_SavedValues.insert(key, value.toString());
+        return value;
+    };
+
+    int defaultVer = load(SER_DEFAULTVER, 0).toInt();
 
 #ifdef Q_OS_DARWIN
     recommendedFullScreenMode = WindowMode::WM_FULLSCREEN_DESKTOP;
@@ -118,53 +136,61 @@ void StreamingPreferences::reload()
     }
 #endif
 
-    width = settings.value(SER_WIDTH, 1280).toInt();
-    height = settings.value(SER_HEIGHT, 720).toInt();
-    fps = settings.value(SER_FPS, 60).toInt();
-    enableYUV444 = settings.value(SER_YUV444, false).toBool();
-    bitrateKbps = settings.value(SER_BITRATE, getDefaultBitrate(width, height, fps, enableYUV444)).toInt();
-    unlockBitrate = settings.value(SER_UNLOCK_BITRATE, false).toBool();
-    autoAdjustBitrate = settings.value(SER_AUTOADJUSTBITRATE, true).toBool();
-    enableVsync = settings.value(SER_VSYNC, true).toBool();
-    gameOptimizations = settings.value(SER_GAMEOPTS, true).toBool();
-    playAudioOnHost = settings.value(SER_HOSTAUDIO, false).toBool();
-    multiController = settings.value(SER_MULTICONT, true).toBool();
-    enableMdns = settings.value(SER_MDNS, true).toBool();
-    quitAppAfter = settings.value(SER_QUITAPPAFTER, false).toBool();
-    absoluteMouseMode = settings.value(SER_ABSMOUSEMODE, false).toBool();
-    absoluteTouchMode = settings.value(SER_ABSTOUCHMODE, true).toBool();
-    framePacing = settings.value(SER_FRAMEPACING, false).toBool();
-    connectionWarnings = settings.value(SER_CONNWARNINGS, true).toBool();
-    configurationWarnings = settings.value(SER_CONFWARNINGS, true).toBool();
-    richPresence = settings.value(SER_RICHPRESENCE, true).toBool();
-    gamepadMouse = settings.value(SER_GAMEPADMOUSE, true).toBool();
-    detectNetworkBlocking = settings.value(SER_DETECTNETBLOCKING, true).toBool();
-    showPerformanceOverlay = settings.value(SER_SHOWPERFOVERLAY, false).toBool();
-    packetSize = settings.value(SER_PACKETSIZE, 0).toInt();
-    swapMouseButtons = settings.value(SER_SWAPMOUSEBUTTONS, false).toBool();
-    muteOnFocusLoss = settings.value(SER_MUTEONFOCUSLOSS, false).toBool();
-    backgroundGamepad = settings.value(SER_BACKGROUNDGAMEPAD, false).toBool();
-    reverseScrollDirection = settings.value(SER_REVERSESCROLL, false).toBool();
-    swapFaceButtons = settings.value(SER_SWAPFACEBUTTONS, false).toBool();
-    keepAwake = settings.value(SER_KEEPAWAKE, true).toBool();
-    enableHdr = settings.value(SER_HDR, false).toBool();
-    captureSysKeysMode = static_cast<CaptureSysKeysMode>(settings.value(SER_CAPTURESYSKEYS,
+    width = load(SER_WIDTH, 1280).toInt();
+    height = load(SER_HEIGHT, 720).toInt();
+    fps = load(SER_FPS, 60).toInt();
+    enableYUV444 = load(SER_YUV444, false).toBool();
+    bitrateKbps = load(SER_BITRATE, getDefaultBitrate(width, height, fps, enableYUV444)).toInt();
+    unlockBitrate = load(SER_UNLOCK_BITRATE, false).toBool();
+    autoAdjustBitrate = load(SER_AUTOADJUSTBITRATE, true).toBool();
+    enableVsync = load(SER_VSYNC, true).toBool();
+    gameOptimizations = load(SER_GAMEOPTS, true).toBool();
+    playAudioOnHost = load(SER_HOSTAUDIO, false).toBool();
+    multiController = load(SER_MULTICONT, true).toBool();
+    enableMdns = load(SER_MDNS, true).toBool();
+    quitAppAfter = load(SER_QUITAPPAFTER, false).toBool();
+    absoluteMouseMode = load(SER_ABSMOUSEMODE, false).toBool();
+    localCursor = load(SER_LOCALCURSOR, false).toBool();
+    absoluteTouchMode = load(SER_ABSTOUCHMODE, true).toBool();
+    framePacing = load(SER_FRAMEPACING, false).toBool();
+    connectionWarnings = load(SER_CONNWARNINGS, true).toBool();
+    configurationWarnings = load(SER_CONFWARNINGS, true).toBool();
+    richPresence = load(SER_RICHPRESENCE, true).toBool();
+    gamepadMouse = load(SER_GAMEPADMOUSE, true).toBool();
+    detectNetworkBlocking = load(SER_DETECTNETBLOCKING, true).toBool();
+    showPerformanceOverlay = load(SER_SHOWPERFOVERLAY, false).toBool();
+    packetSize = load(SER_PACKETSIZE, 0).toInt();
+    swapMouseButtons = load(SER_SWAPMOUSEBUTTONS, false).toBool();
+    muteOnFocusLoss = load(SER_MUTEONFOCUSLOSS, false).toBool();
+    backgroundGamepad = load(SER_BACKGROUNDGAMEPAD, false).toBool();
+    reverseScrollDirection = load(SER_REVERSESCROLL, false).toBool();
+    mouseSendRate = load(SER_MOUSESENDRATE, 1000).toInt();
+    swapFaceButtons = load(SER_SWAPFACEBUTTONS, false).toBool();
+    keepAwake = load(SER_KEEPAWAKE, true).toBool();
+    lowMemoryMode = load(SER_LOWMEMORY, false).toBool();
+    enableHdr = load(SER_HDR, false).toBool();
+    captureSysKeysMode = static_cast<CaptureSysKeysMode>(load(SER_CAPTURESYSKEYS,
                                                          static_cast<int>(CaptureSysKeysMode::CSK_OFF)).toInt());
-    audioConfig = static_cast<AudioConfig>(settings.value(SER_AUDIOCFG,
+    audioConfig = static_cast<AudioConfig>(load(SER_AUDIOCFG,
                                                   static_cast<int>(AudioConfig::AC_STEREO)).toInt());
-    videoCodecConfig = static_cast<VideoCodecConfig>(settings.value(SER_VIDEOCFG,
+    surroundDownmix = static_cast<SurroundDownmix>(load(SER_SURROUNDDOWNMIX,
+                                                   static_cast<int>(SurroundDownmix::SD_OFF)).toInt());
+    videoCodecConfig = static_cast<VideoCodecConfig>(load(SER_VIDEOCFG,
                                                   static_cast<int>(VideoCodecConfig::VCC_AUTO)).toInt());
-    videoDecoderSelection = static_cast<VideoDecoderSelection>(settings.value(SER_VIDEODEC,
+    videoDecoderSelection = static_cast<VideoDecoderSelection>(load(SER_VIDEODEC,
                                                   static_cast<int>(VideoDecoderSelection::VDS_AUTO)).toInt());
-    windowMode = static_cast<WindowMode>(settings.value(SER_WINDOWMODE,
+    windowMode = static_cast<WindowMode>(load(SER_WINDOWMODE,
                                                         // Try to load from the old preference value too
                                                         static_cast<int>(settings.value(SER_FULLSCREEN, true).toBool() ?
                                                                              recommendedFullScreenMode : WindowMode::WM_WINDOWED)).toInt());
-    uiDisplayMode = static_cast<UIDisplayMode>(settings.value(SER_UIDISPLAYMODE,
+    uiDisplayMode = static_cast<UIDisplayMode>(load(SER_UIDISPLAYMODE,
                                                static_cast<int>(settings.value(SER_STARTWINDOWED, true).toBool() ? UIDisplayMode::UI_WINDOWED
                                                                                                                  : UIDisplayMode::UI_MAXIMIZED)).toInt());
-    language = static_cast<Language>(settings.value(SER_LANGUAGE,
+    language = static_cast<Language>(load(SER_LANGUAGE,
                                                     static_cast<int>(Language::LANG_AUTO)).toInt());
+    recordingDirectory = load(SER_RECORDINGDIR, QString()).toString();
+    recordingFormat = static_cast<RecordingFormat>(load(SER_RECORDINGFORMAT,
+                                                   static_cast<int>(RecordingFormat::RF_MKV)).toInt());
 
 
     // Perform default settings updates as required based on last default version
@@ -317,44 +343,63 @@ void StreamingPreferences::save()
 {
     QSettings settings;
 
-    settings.setValue(SER_WIDTH, width);
-    settings.setValue(SER_HEIGHT, height);
-    settings.setValue(SER_FPS, fps);
-    settings.setValue(SER_BITRATE, bitrateKbps);
-    settings.setValue(SER_UNLOCK_BITRATE, unlockBitrate);
-    settings.setValue(SER_AUTOADJUSTBITRATE, autoAdjustBitrate);
-    settings.setValue(SER_VSYNC, enableVsync);
-    settings.setValue(SER_GAMEOPTS, gameOptimizations);
-    settings.setValue(SER_HOSTAUDIO, playAudioOnHost);
-    settings.setValue(SER_MULTICONT, multiController);
-    settings.setValue(SER_MDNS, enableMdns);
-    settings.setValue(SER_QUITAPPAFTER, quitAppAfter);
-    settings.setValue(SER_ABSMOUSEMODE, absoluteMouseMode);
-    settings.setValue(SER_ABSTOUCHMODE, absoluteTouchMode);
-    settings.setValue(SER_FRAMEPACING, framePacing);
-    settings.setValue(SER_CONNWARNINGS, connectionWarnings);
-    settings.setValue(SER_CONFWARNINGS, configurationWarnings);
-    settings.setValue(SER_RICHPRESENCE, richPresence);
-    settings.setValue(SER_GAMEPADMOUSE, gamepadMouse);
-    settings.setValue(SER_PACKETSIZE, packetSize);
-    settings.setValue(SER_DETECTNETBLOCKING, detectNetworkBlocking);
-    settings.setValue(SER_SHOWPERFOVERLAY, showPerformanceOverlay);
-    settings.setValue(SER_AUDIOCFG, static_cast<int>(audioConfig));
-    settings.setValue(SER_HDR, enableHdr);
-    settings.setValue(SER_YUV444, enableYUV444);
-    settings.setValue(SER_VIDEOCFG, static_cast<int>(videoCodecConfig));
-    settings.setValue(SER_VIDEODEC, static_cast<int>(videoDecoderSelection));
-    settings.setValue(SER_WINDOWMODE, static_cast<int>(windowMode));
-    settings.setValue(SER_UIDISPLAYMODE, static_cast<int>(uiDisplayMode));
-    settings.setValue(SER_LANGUAGE, static_cast<int>(language));
-    settings.setValue(SER_DEFAULTVER, CURRENT_DEFAULT_VER);
-    settings.setValue(SER_SWAPMOUSEBUTTONS, swapMouseButtons);
-    settings.setValue(SER_MUTEONFOCUSLOSS, muteOnFocusLoss);
-    settings.setValue(SER_BACKGROUNDGAMEPAD, backgroundGamepad);
-    settings.setValue(SER_REVERSESCROLL, reverseScrollDirection);
-    settings.setValue(SER_SWAPFACEBUTTONS, swapFaceButtons);
-    settings.setValue(SER_CAPTURESYSKEYS, captureSysKeysMode);
-    settings.setValue(SER_KEEPAWAKE, keepAwake);
+    // Each write is a registry access on Windows, so only write the values
+    // that changed since we last loaded or saved them
+    auto store = [&](const char* key, const QVariant& value) {
+        QString serializedValue = value.toString();
+        auto it = m_SavedValues.constFind(key);
+        if (it != m_SavedValues.constEnd() && *it == serializedValue) {
+            return;
+        }
+
+        settings.setValue(key, value);
+        m_SavedValues.insert(key, serializedValue);
+    };
+
+    store(SER_WIDTH, width);
+    store(SER_HEIGHT, height);
+    store(SER_FPS, fps);
+    store(SER_BITRATE, bitrateKbps);
+    store(SER_UNLOCK_BITRATE, unlockBitrate);
+    store(SER_AUTOADJUSTBITRATE, autoAdjustBitrate);
+    store(SER_VSYNC, enableVsync);
+    store(SER_GAMEOPTS, gameOptimizations);
+    store(SER_HOSTAUDIO, playAudioOnHost);
+    store(SER_MULTICONT, multiController);
+    store(SER_MDNS, enableMdns);
+    store(SER_QUITAPPAFTER, quitAppAfter);
+    store(SER_ABSMOUSEMODE, absoluteMouseMode);
+    store(SER_LOCALCURSOR, localCursor);
+    store(SER_ABSTOUCHMODE, absoluteTouchMode);
+    store(SER_FRAMEPACING, framePacing);
+    store(SER_CONNWARNINGS, connectionWarnings);
+    store(SER_CONFWARNINGS, configurationWarnings);
+    store(SER_RICHPRESENCE, richPresence);
+    store(SER_GAMEPADMOUSE, gamepadMouse);
+    store(SER_PACKETSIZE, packetSize);
+    store(SER_DETECTNETBLOCKING, detectNetworkBlocking);
+    store(SER_SHOWPERFOVERLAY, showPerformanceOverlay);
+    store(SER_AUDIOCFG, static_cast<int>(audioConfig));
+    store(SER_SURROUNDDOWNMIX, static_cast<int>(surroundDownmix));
+    store(SER_HDR, enableHdr);
+    store(SER_YUV444, enableYUV444);
+    store(SER_VIDEOCFG, static_cast<int>(videoCodecConfig));
+    store(SER_VIDEODEC, static_cast<int>(videoDecoderSelection));
+    store(SER_WINDOWMODE, static_cast<int>(windowMode));
+    store(SER_UIDISPLAYMODE, static_cast<int>(uiDisplayMode));
+    store(SER_LANGUAGE, static_cast<int>(language));
+    store(SER_DEFAULTVER, CURRENT_DEFAULT_VER);
+    store(SER_SWAPMOUSEBUTTONS, swapMouseButtons);
+    store(SER_MUTEONFOCUSLOSS, muteOnFocusLoss);
+    store(SER_BACKGROUNDGAMEPAD, backgroundGamepad);
+    store(SER_REVERSESCROLL, reverseScrollDirection);
+    store(SER_MOUSESENDRATE, mouseSendRate);
+    store(SER_SWAPFACEBUTTONS, swapFaceButtons);
+    store(SER_CAPTURESYSKEYS, static_cast<int>(captureSysKeysMode));
+    store(SER_KEEPAWAKE, keepAwake);
+    store(SER_LOWMEMORY, lowMemoryMode);
+    store(SER_RECORDINGDIR, recordingDirectory);
+    store(SER_RECORDINGFORMAT, static_cast<int>(recordingFormat));
 }
 
 int StreamingPreferences::getDefaultBitrate(int width, int height, int fps, bool yuv444)
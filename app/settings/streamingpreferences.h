@@ -1,5 +1,6 @@
 #pragma once
 
+#include <QHash>
 #include <QObject>
 #include <QRect>
 #include <QQmlEngine>
@@ -108,6 +109,24 @@ public:
     };
     Q_ENUM(CaptureSysKeysMode);
 
+    enum RecordingFormat
+    {
+        RF_YUV,
+        RF_Y4M,
+        RF_MKV,
+        RF_MP4,
+        RF_FFV1,
+    };
+    Q_ENUM(RecordingFormat);
+
+    enum SurroundDownmix
+    {
+        SD_OFF,
+        SD_STEREO,
+        SD_VIRTUAL_SURROUND,
+    };
+    Q_ENUM(SurroundDownmix);
+
     Q_PROPERTY(int width MEMBER width NOTIFY displayModeChanged)
     Q_PROPERTY(int height MEMBER height NOTIFY displayModeChanged)
     Q_PROPERTY(int fps MEMBER fps NOTIFY displayModeChanged)
@@ -121,6 +140,7 @@ public:
     Q_PROPERTY(bool enableMdns MEMBER enableMdns NOTIFY enableMdnsChanged)
     Q_PROPERTY(bool quitAppAfter MEMBER quitAppAfter NOTIFY quitAppAfterChanged)
     Q_PROPERTY(bool absoluteMouseMode MEMBER absoluteMouseMode NOTIFY absoluteMouseModeChanged)
+    Q_PROPERTY(bool localCursor MEMBER localCursor NOTIFY localCursorChanged)
     Q_PROPERTY(bool absoluteTouchMode MEMBER absoluteTouchMode NOTIFY absoluteTouchModeChanged)
     Q_PROPERTY(bool framePacing MEMBER framePacing NOTIFY framePacingChanged)
     Q_PROPERTY(bool connectionWarnings MEMBER connectionWarnings NOTIFY connectionWarningsChanged)
@@ -130,6 +150,7 @@ public:
     Q_PROPERTY(bool detectNetworkBlocking MEMBER detectNetworkBlocking NOTIFY detectNetworkBlockingChanged)
     Q_PROPERTY(bool showPerformanceOverlay MEMBER showPerformanceOverlay NOTIFY showPerformanceOverlayChanged)
     Q_PROPERTY(AudioConfig audioConfig MEMBER audioConfig NOTIFY audioConfigChanged)
+    Q_PROPERTY(SurroundDownmix surroundDownmix MEMBER surroundDownmix NOTIFY surroundDownmixChanged)
     Q_PROPERTY(VideoCodecConfig videoCodecConfig MEMBER videoCodecConfig NOTIFY videoCodecConfigChanged)
     Q_PROPERTY(bool enableHdr MEMBER enableHdr NOTIFY enableHdrChanged)
     Q_PROPERTY(bool enableYUV444 MEMBER enableYUV444 NOTIFY enableYUV444Changed)
@@ -141,8 +162,10 @@ public:
     Q_PROPERTY(bool muteOnFocusLoss MEMBER muteOnFocusLoss NOTIFY muteOnFocusLossChanged)
     Q_PROPERTY(bool backgroundGamepad MEMBER backgroundGamepad NOTIFY backgroundGamepadChanged)
     Q_PROPERTY(bool reverseScrollDirection MEMBER reverseScrollDirection NOTIFY reverseScrollDirectionChanged)
+    Q_PROPERTY(int mouseSendRate MEMBER mouseSendRate NOTIFY mouseSendRateChanged)
     Q_PROPERTY(bool swapFaceButtons MEMBER swapFaceButtons NOTIFY swapFaceButtonsChanged)
     Q_PROPERTY(bool keepAwake MEMBER keepAwake NOTIFY keepAwakeChanged)
+    Q_PROPERTY(bool lowMemoryMode MEMBER lowMemoryMode NOTIFY lowMemoryModeChanged)
     Q_PROPERTY(CaptureSysKeysMode captureSysKeysMode MEMBER captureSysKeysMode NOTIFY captureSysKeysModeChanged)
     Q_PROPERTY(Language language MEMBER language NOTIFY languageChanged);
 
@@ -162,6 +185,7 @@ public:
     bool enableMdns;
     bool quitAppAfter;
     bool absoluteMouseMode;
+    bool localCursor;
     bool absoluteTouchMode;
     bool framePacing;
     bool connectionWarnings;
@@ -174,10 +198,13 @@ public:
     bool muteOnFocusLoss;
     bool backgroundGamepad;
     bool reverseScrollDirection;
+    int mouseSendRate;
     bool swapFaceButtons;
     bool keepAwake;
+    bool lowMemoryMode;
     int packetSize;
     AudioConfig audioConfig;
+    SurroundDownmix surroundDownmix;
     VideoCodecConfig videoCodecConfig;
     bool enableHdr;
     bool enableYUV444;
@@ -188,6 +215,10 @@ public:
     Language language;
     CaptureSysKeysMode captureSysKeysMode;
 
+    // Recording starts with the session if a directory is set
+    QString recordingDirectory;
+    RecordingFormat recordingFormat;
+
 signals:
     void displayModeChanged();
     void bitrateChanged();
@@ -201,8 +232,10 @@ signals:
     void enableMdnsChanged();
     void quitAppAfterChanged();
     void absoluteMouseModeChanged();
+    void localCursorChanged();
     void absoluteTouchModeChanged();
     void audioConfigChanged();
+    void surroundDownmixChanged();
     void videoCodecConfigChanged();
     void enableHdrChanged();
     void enableYUV444Changed();
@@ -220,9 +253,11 @@ signals:
     void muteOnFocusLossChanged();
     void backgroundGamepadChanged();
     void reverseScrollDirectionChanged();
+    void mouseSendRateChanged();
     void swapFaceButtonsChanged();
     void captureSysKeysModeChanged();
     void keepAwakeChanged();
+    void lowMemoryModeChanged();
     void languageChanged();
 
 private:
@@ -231,5 +266,8 @@ private:
     QString getSuffixFromLanguage(Language lang);
 
     QQmlEngine* m_QmlEngine;
+
+    // String forms of the values last loaded from or saved to QSettings
+    QHash<QString, QString> m_SavedValues;
 };
 
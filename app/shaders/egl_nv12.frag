@@ -5,9 +5,15 @@ out vec4 FragColor;
 
 in vec2 vTextCoord;
 
+#ifdef CSC_SPECIALIZED
+const mat3 yuvmat = CSC_YUVMAT;
+const vec3 offset = CSC_OFFSET;
+const vec2 chromaOffset = CSC_CHROMA_OFFSET;
+#else
 uniform mat3 yuvmat;
 uniform vec3 offset;
 uniform vec2 chromaOffset;
+#endif
 uniform samplerExternalOES plane1;
 uniform samplerExternalOES plane2;
 
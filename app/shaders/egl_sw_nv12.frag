@@ -0,0 +1,27 @@
+#version 300 es
+precision mediump float;
+out vec4 FragColor;
+
+in vec2 vTextCoord;
+
+#ifdef CSC_SPECIALIZED
+const mat3 yuvmat = CSC_YUVMAT;
+const vec3 offset = CSC_OFFSET;
+const vec2 chromaOffset = CSC_CHROMA_OFFSET;
+#else
+uniform mat3 yuvmat;
+uniform vec3 offset;
+uniform vec2 chromaOffset;
+#endif
+uniform sampler2D plane1;
+uniform sampler2D plane2;
+
+void main() {
+	vec3 YCbCr = vec3(
+		texture(plane1, vTextCoord).r,
+		texture(plane2, vTextCoord + chromaOffset).rg
+	);
+
+	YCbCr -= offset;
+	FragColor = vec4(clamp(yuvmat * YCbCr, 0.0, 1.0), 1.0f);
+}
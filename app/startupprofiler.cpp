@@ -0,0 +1,98 @@
+#include "startupprofiler.h"
+
+#include <QCoreApplication>
+#include <QElapsedTimer>
+#include <QMutex>
+#include <QTimer>
+#include <QVector>
+#include <QtDebug>
+
+struct StartupStage {
+    const char* name;
+    qint64 timeMs;
+};
+
+struct DeferredStartupTask {
+    QPointer<QObject> context;
+    std::function<void()> task;
+};
+
+static QMutex s_Lock;
+static QElapsedTimer s_Timer;
+static QVector<StartupStage> s_Stages;
+static QVector<DeferredStartupTask> s_DeferredTasks;
+static bool s_StagedInit = qgetenv("ML_STAGED_INIT") == "1";
+static bool s_Interactive = false;
+
+void StartupProfiler::markStage(const char* name)
+{
+    QMutexLocker locker(&s_Lock);
+
+    // The first stage starts the clock
+    if (!s_Timer.isValid()) {
+        s_Timer.start();
+    }
+
+    s_Stages.append({ name, s_Timer.elapsed() });
+}
+
+bool StartupProfiler::isInteractive()
+{
+    QMutexLocker locker(&s_Lock);
+    return s_Interactive || !s_StagedInit;
+}
+
+void StartupProfiler::runWhenInteractive(QObject* context, std::function<void()> task)
+{
+    {
+        QMutexLocker locker(&s_Lock);
+        if (!s_Interactive && s_StagedInit) {
+            s_DeferredTasks.append({ context, task });
+            return;
+        }
+    }
+
+    task();
+}
+
+void StartupProfiler::notifyInteractive()
+{
+    QVector<DeferredStartupTask> tasks;
+
+    {
+        QMutexLocker locker(&s_Lock);
+        if (s_Interactive) {
+            return;
+        }
+
+        s_Interactive = true;
+        tasks.swap(s_DeferredTasks);
+    }
+
+    markStage("Interactive");
+
+    if (!tasks.isEmpty()) {
+        qInfo() << "Starting" << tasks.count() << "deferred startup tasks";
+    }
+
+    // Start each task from its own event loop iteration, so the UI stays
+    // responsive while they get going
+    for (const DeferredStartupTask& task : tasks) {
+        QTimer::singleShot(0, QCoreApplication::instance(), [task]() {
+            if (!task.context.isNull()) {
+                task.task();
+            }
+        });
+    }
+}
+
+void StartupProfiler::logStages()
+{
+    QMutexLocker locker(&s_Lock);
+
+    qint64 lastTimeMs = 0;
+    for (const StartupStage& stage : s_Stages) {
+        qInfo().nospace() << "Startup stage " << stage.name << ": " << stage.timeMs << " ms (+" << stage.timeMs - lastTimeMs << " ms)";
+        lastTimeMs = stage.timeMs;
+    }
+}
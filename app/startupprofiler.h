@@ -0,0 +1,32 @@
+#pragma once
+
+#include <QObject>
+#include <QPointer>
+
+#include <functional>
+
+// Records how long each stage of startup takes, up to the first frame of
+// the UI, and logs them at exit.
+//
+// With ML_STAGED_INIT=1, work that isn't needed to show the UI (mDNS,
+// host polling, and the compatibility, mapping and update downloads) is
+// held back until the first frame has been presented.
+class StartupProfiler
+{
+public:
+    // Called on the main thread as each stage of startup completes
+    static void markStage(const char* name);
+
+    // True once the UI has shown its first frame, or always when staged
+    // init is disabled
+    static bool isInteractive();
+
+    // Runs the task on the main thread once we're interactive, as long as
+    // the context object still exists. Runs it immediately if we already are.
+    static void runWhenInteractive(QObject* context, std::function<void()> task);
+
+    // Called on the main thread after the first frame (or right away without a UI)
+    static void notifyInteractive();
+
+    static void logStages();
+};
@@ -1,14 +1,37 @@
 #include "../session.h"
+#include "../streamutils.h"
 #include "renderers/renderer.h"
 
 #ifdef HAVE_SLAUDIO
 #include "renderers/slaud.h"
 #endif
 
+#ifdef HAVE_WASAPI
+#include "renderers/wasapi.h"
+#endif
+
+#ifdef HAVE_COREAUDIO
+#include "renderers/coreaudio.h"
+#endif
+
+#ifdef HAVE_PIPEWIRE
+#include "renderers/pipewire.h"
+#endif
+
 #include "renderers/sdl.h"
+#include "renderers/sdlpull.h"
 
 #include <Limelight.h>
 
+#include <QRunnable>
+#include <QThreadPool>
+
+// The most lost frames we'll synthesize when packets resume
+#define MAX_CONCEALED_AUDIO_FRAMES 4
+
+// The most recent packets we hold onto while the audio renderer is recreated
+#define MAX_BUFFERED_AUDIO_PACKETS 4
+
 #define TRY_INIT_RENDERER(renderer, opusConfig)        \
 {                                                      \
     IAudioRenderer* __renderer = new renderer();       \
@@ -17,58 +40,183 @@
     delete __renderer;                                 \
 }
 
-IAudioRenderer* Session::createAudioRenderer(const POPUS_MULTISTREAM_CONFIGURATION opusConfig)
+QStringList Session::getAvailableAudioRenderers()
 {
-    // Handle explicit ML_AUDIO setting and fail if the requested backend fails
-    QString mlAudio = qgetenv("ML_AUDIO").toLower();
-    if (mlAudio == "sdl") {
+    QStringList renderers;
+
+    // These are in order of preference for automatic backend selection
+#if defined(HAVE_SLAUDIO)
+    // Steam Link should always have SLAudio
+    renderers.append("slaudio");
+#endif
+
+    // Native backends can run with much smaller device buffers than SDL
+#if defined(HAVE_WASAPI)
+    renderers.append("wasapi");
+#endif
+#if defined(HAVE_COREAUDIO)
+    renderers.append("coreaudio");
+#endif
+#if defined(HAVE_PIPEWIRE)
+    // This fails if there's no PipeWire daemon, so we fall back to SDL
+    renderers.append("pipewire");
+#endif
+
+    // Default to SDL, preferring callback mode to avoid blocking the decoder thread
+    renderers.append("sdlpull");
+    renderers.append("sdl");
+
+    return renderers;
+}
+
+IAudioRenderer* Session::createAudioRendererByName(const QString& name, const POPUS_MULTISTREAM_CONFIGURATION opusConfig)
+{
+    if (name == "sdl") {
         TRY_INIT_RENDERER(SdlAudioRenderer, opusConfig)
-        return nullptr;
+    }
+    else if (name == "sdlpull") {
+        TRY_INIT_RENDERER(SdlPullAudioRenderer, opusConfig)
     }
 #if defined(HAVE_SLAUDIO)
-    else if (mlAudio == "slaudio") {
+    else if (name == "slaudio") {
         TRY_INIT_RENDERER(SLAudioRenderer, opusConfig)
-        return nullptr;
     }
 #endif
-    else if (!mlAudio.isEmpty()) {
-        SDL_LogError(SDL_LOG_CATEGORY_APPLICATION,
-                     "Unknown audio backend: %s",
-                     SDL_getenv("ML_AUDIO"));
-        return nullptr;
+#if defined(HAVE_WASAPI)
+    else if (name == "wasapi") {
+        TRY_INIT_RENDERER(WasapiAudioRenderer, opusConfig)
+    }
+#endif
+#if defined(HAVE_COREAUDIO)
+    else if (name == "coreaudio") {
+        TRY_INIT_RENDERER(CoreAudioRenderer, opusConfig)
+    }
+#endif
+#if defined(HAVE_PIPEWIRE)
+    else if (name == "pipewire") {
+        TRY_INIT_RENDERER(PipeWireAudioRenderer, opusConfig)
     }
+#endif
 
-    // -------------- Automatic backend selection below this line ---------------
+    return nullptr;
+}
 
-#if defined(HAVE_SLAUDIO)
-    // Steam Link should always have SLAudio
-    TRY_INIT_RENDERER(SLAudioRenderer, opusConfig)
-#endif
+IAudioRenderer* Session::createAudioRenderer(const POPUS_MULTISTREAM_CONFIGURATION opusConfig)
+{
+    // Handle explicit ML_AUDIO setting and fail if the requested backend fails
+    QString mlAudio = qgetenv("ML_AUDIO").toLower();
+    if (!mlAudio.isEmpty()) {
+        if (!getAvailableAudioRenderers().contains(mlAudio)) {
+            SDL_LogError(SDL_LOG_CATEGORY_APPLICATION,
+                         "Unknown audio backend: %s",
+                         SDL_getenv("ML_AUDIO"));
+            return nullptr;
+        }
+
+        return createAudioRendererByName(mlAudio, opusConfig);
+    }
 
-    // Default to SDL
-    TRY_INIT_RENDERER(SdlAudioRenderer, opusConfig)
+    for (const QString& name : getAvailableAudioRenderers()) {
+        IAudioRenderer* renderer = createAudioRendererByName(name, opusConfig);
+        if (renderer != nullptr) {
+            return renderer;
+        }
+    }
 
     return nullptr;
 }
 
-bool Session::initializeAudioRenderer()
+class AudioRendererInitTask : public QRunnable
 {
-    int error;
+public:
+    AudioRendererInitTask(Session* session, IAudioRenderer* oldRenderer) :
+        m_Session(session),
+        m_OldRenderer(oldRenderer) {}
+
+private:
+    void run() override
+    {
+        // Tearing down the old renderer can block too, and some
+        // renderers require that it's gone before we create another.
+        // That includes any renderer retired while the last task was running.
+        delete m_OldRenderer;
+        delete (IAudioRenderer*)SDL_AtomicSetPtr((void**)&m_Session->m_RetiredAudioRenderer, nullptr);
+
+        IAudioRenderer* renderer = m_Session->createAudioRenderer(&m_Session->m_RendererAudioConfig);
+        if (renderer != nullptr) {
+            // The audio thread will pick this up on its next sample
+            SDL_AtomicSetPtr((void**)&m_Session->m_PendingAudioRenderer, renderer);
+        }
+
+        m_Session->m_AudioRendererInitSemaphore.release();
+
+        // Pick up a renderer that failed while we were creating this one. If the
+        // audio thread retires it after this point, the next task or
+        // waitForAudioRendererInit() will.
+        delete (IAudioRenderer*)SDL_AtomicSetPtr((void**)&m_Session->m_RetiredAudioRenderer, nullptr);
+    }
 
+    Session* m_Session;
+    IAudioRenderer* m_OldRenderer;
+};
+
+bool Session::initializeAudioRenderer()
+{
     SDL_assert(m_OriginalAudioConfig.channelCount > 0);
     SDL_assert(m_AudioRenderer == nullptr);
     SDL_assert(m_OpusDecoder == nullptr);
 
-    m_AudioRenderer = createAudioRenderer(&m_OriginalAudioConfig);
+    IAudioRenderer* renderer = createAudioRenderer(&m_RendererAudioConfig);
 
     // We may be unable to create an audio renderer right now
-    if (m_AudioRenderer == nullptr) {
+    if (renderer == nullptr) {
         return false;
     }
 
-    // Allow the chosen renderer to remap Opus channels as needed to ensure proper output
+    return attachAudioRenderer(renderer);
+}
+
+void Session::startAudioRendererInit(IAudioRenderer* oldRenderer)
+{
+    // Only one recreation can be in flight at a time
+    if (!m_AudioRendererInitSemaphore.tryAcquire()) {
+        if (oldRenderer != nullptr) {
+            // Leave the teardown to the pool task rather than blocking the audio
+            // thread. Only one renderer can be attached per task, so the slot is
+            // always empty here.
+            IAudioRenderer* retired =
+                    (IAudioRenderer*)SDL_AtomicSetPtr((void**)&m_RetiredAudioRenderer, oldRenderer);
+            SDL_assert(retired == nullptr);
+            delete retired;
+        }
+        return;
+    }
+
+    QThreadPool::globalInstance()->start(new AudioRendererInitTask(this, oldRenderer));
+}
+
+void Session::waitForAudioRendererInit()
+{
+    m_AudioRendererInitSemaphore.acquire();
+    m_AudioRendererInitSemaphore.release();
+
+    delete (IAudioRenderer*)SDL_AtomicSetPtr((void**)&m_PendingAudioRenderer, nullptr);
+    delete (IAudioRenderer*)SDL_AtomicSetPtr((void**)&m_RetiredAudioRenderer, nullptr);
+}
+
+bool Session::attachAudioRenderer(IAudioRenderer* renderer)
+{
+    int error;
+
+    SDL_assert(m_AudioRenderer == nullptr);
+    SDL_assert(m_OpusDecoder == nullptr);
+
+    // Allow the chosen renderer to remap Opus channels as needed to ensure proper output.
+    // The downmixer needs Moonlight's channel order, and the renderer only sees stereo.
     m_ActiveAudioConfig = m_OriginalAudioConfig;
-    m_AudioRenderer->remapChannels(&m_ActiveAudioConfig);
+    if (!m_Downmixer.isEnabled()) {
+        renderer->remapChannels(&m_ActiveAudioConfig);
+    }
 
     // Create the Opus decoder with the renderer's preferred channel mapping
     m_OpusDecoder =
@@ -79,14 +227,22 @@ bool Session::initializeAudioRenderer()
                                         m_ActiveAudioConfig.mapping,
                                         &error);
     if (m_OpusDecoder == nullptr) {
-        delete m_AudioRenderer;
-        m_AudioRenderer = nullptr;
+        delete renderer;
         SDL_LogError(SDL_LOG_CATEGORY_APPLICATION,
                      "Failed to create decoder: %d",
                      error);
         return false;
     }
 
+    m_AudioRenderer = renderer;
+    m_Downmixer.reset();
+
+    // The new renderer needs any A/V sync delay applied again
+    m_AvSync.resetAudio();
+    m_RequestedAudioDelayMs = 0;
+    m_AppliedAudioDelayMs = 0;
+    m_PendingLostAudioFrames = 0;
+
     SDL_LogInfo(SDL_LOG_CATEGORY_APPLICATION,
                 "Audio stream has %d channels",
                 m_ActiveAudioConfig.channelCount);
@@ -119,6 +275,11 @@ bool Session::testAudio(int audioConfiguration)
     opusConfig.samplesPerFrame = 240;
     opusConfig.channelCount = CHANNEL_COUNT_FROM_AUDIO_CONFIGURATION(audioConfiguration);
 
+    // Surround streams will be downmixed, so the device only needs stereo
+    if (opusConfig.channelCount > 2 && m_Preferences->surroundDownmix != StreamingPreferences::SD_OFF) {
+        opusConfig.channelCount = 2;
+    }
+
     IAudioRenderer* audioRenderer = createAudioRenderer(&opusConfig);
     if (audioRenderer == nullptr) {
         return false;
@@ -134,12 +295,36 @@ int Session::arInit(int /* audioConfiguration */,
                     void* /* arContext */, int /* arFlags */)
 {
     SDL_memcpy(&s_ActiveSession->m_OriginalAudioConfig, opusConfig, sizeof(*opusConfig));
+
+    // Renderers are opened in stereo when we're downmixing
+    s_ActiveSession->m_RendererAudioConfig = *opusConfig;
+    if (s_ActiveSession->m_Downmixer.initialize(s_ActiveSession->m_Preferences->surroundDownmix,
+                                                opusConfig->channelCount,
+                                                opusConfig->sampleRate,
+                                                opusConfig->samplesPerFrame)) {
+        s_ActiveSession->m_RendererAudioConfig.channelCount = 2;
+    }
+
     s_ActiveSession->initializeAudioRenderer();
     return 0;
 }
 
+void Session::reportAudioRendererStats(IAudioRenderer* renderer)
+{
+    uint32_t underruns;
+
+    if (renderer != nullptr && renderer->getUnderrunCount(&underruns)) {
+        m_SessionReport.addAudioUnderruns(underruns);
+    }
+}
+
 void Session::arCleanup()
 {
+    // Don't leak a renderer that's still being created
+    s_ActiveSession->waitForAudioRendererInit();
+    s_ActiveSession->m_BufferedAudioPackets.clear();
+
+    s_ActiveSession->reportAudioRendererStats(s_ActiveSession->m_AudioRenderer);
     delete s_ActiveSession->m_AudioRenderer;
     s_ActiveSession->m_AudioRenderer = nullptr;
 
@@ -147,17 +332,97 @@ void Session::arCleanup()
     s_ActiveSession->m_OpusDecoder = nullptr;
 }
 
-void Session::arDecodeAndPlaySample(char* sampleData, int sampleLength)
+bool Session::playAudioFrame(const unsigned char* data, int length, bool decodeFec)
 {
     int samplesDecoded;
 
+    int sampleSize = m_AudioRenderer->getAudioBufferSampleSize();
+    int frameSize = sampleSize * m_RendererAudioConfig.channelCount;
+    int desiredBufferSize = frameSize * m_ActiveAudioConfig.samplesPerFrame;
+    void* buffer = m_AudioRenderer->getAudioBuffer(&desiredBufferSize);
+    if (buffer == nullptr) {
+        return true;
+    }
+
+    if (m_Downmixer.isEnabled()) {
+        // Decode the surround channels as floats, then mix them into the renderer's buffer
+        samplesDecoded = opus_multistream_decode_float(m_OpusDecoder,
+                                                       data,
+                                                       length,
+                                                       m_Downmixer.getInputBuffer(),
+                                                       SDL_min(desiredBufferSize / frameSize, m_ActiveAudioConfig.samplesPerFrame),
+                                                       decodeFec ? 1 : 0);
+        if (samplesDecoded > 0) {
+            if (m_AudioRenderer->getAudioBufferFormat() == IAudioRenderer::AudioFormat::Float32NE) {
+                m_Downmixer.process(samplesDecoded, (float*)buffer);
+            }
+            else {
+                m_Downmixer.process(samplesDecoded, (int16_t*)buffer);
+            }
+        }
+    }
+    else if (m_AudioRenderer->getAudioBufferFormat() == IAudioRenderer::AudioFormat::Float32NE) {
+        samplesDecoded = opus_multistream_decode_float(m_OpusDecoder,
+                                                       data,
+                                                       length,
+                                                       (float*)buffer,
+                                                       desiredBufferSize / frameSize,
+                                                       decodeFec ? 1 : 0);
+    }
+    else {
+        samplesDecoded = opus_multistream_decode(m_OpusDecoder,
+                                                 data,
+                                                 length,
+                                                 (short*)buffer,
+                                                 desiredBufferSize / frameSize,
+                                                 decodeFec ? 1 : 0);
+    }
+
+    // Update desiredSize with the number of bytes actually populated by the decoding operation
+    if (samplesDecoded > 0) {
+        SDL_assert(desiredBufferSize >= frameSize * samplesDecoded);
+        desiredBufferSize = frameSize * samplesDecoded;
+    }
+    else {
+        desiredBufferSize = 0;
+    }
+
+    bool submitted = m_AudioRenderer->submitAudio(desiredBufferSize);
+
+    // Publish the renderer's latency for the stats overlay
+    uint32_t latencyMs, targetLatencyMs;
+    if (!submitted || !m_AudioRenderer->getAudioLatency(&latencyMs, &targetLatencyMs)) {
+        latencyMs = targetLatencyMs = 0;
+    }
+    SDL_AtomicSet(&m_AudioLatencyMs, (int)latencyMs);
+    SDL_AtomicSet(&m_AudioTargetLatencyMs, (int)targetLatencyMs);
+
+    m_FlightRecorder.record(FlightRecorder::EventAudioSubmitted, LiGetPendingAudioDuration(), latencyMs, submitted);
+
+    // Audio waiting in moonlight-common-c's queue counts towards A/V sync
+    if (latencyMs != 0) {
+        m_AvSync.updateAudioLatency((LiGetPendingAudioDuration() + latencyMs) * 1000,
+                                    m_AppliedAudioDelayMs);
+    }
+
+    return submitted;
+}
+
+void Session::arDecodeAndPlaySample(char* sampleData, int sampleLength)
+{
 #ifndef STEAM_LINK
     // Set this thread to high priority to reduce the chance of missing
     // our sample delivery time. On Steam Link, this causes starvation
     // of other threads due to severely restricted CPU time available,
     // so we will skip it on that platform.
     if (s_ActiveSession->m_AudioSampleCount == 0) {
-        if (SDL_SetThreadPriority(SDL_THREAD_PRIORITY_HIGH) < 0) {
+        // Prefer real-time scheduling with a period of one Opus frame. The thread
+        // belongs to moonlight-common-c and exits with the stream, so we don't revert.
+        uint32_t framePeriodUs = (uint32_t)((uint64_t)s_ActiveSession->m_OriginalAudioConfig.samplesPerFrame * 1000000 /
+                                            s_ActiveSession->m_OriginalAudioConfig.sampleRate);
+        StreamUtils::placeCurrentThread(StreamUtils::TPC_LATENCY_CRITICAL);
+        if (!StreamUtils::enterRealtimeScheduling(StreamUtils::RTC_AUDIO, framePeriodUs, nullptr) &&
+                SDL_SetThreadPriority(SDL_THREAD_PRIORITY_HIGH) < 0) {
             SDL_LogWarn(SDL_LOG_CATEGORY_APPLICATION,
                         "Unable to set audio thread to high priority: %s",
                         SDL_GetError());
@@ -165,22 +430,26 @@ void Session::arDecodeAndPlaySample(char* sampleData, int sampleLength)
     }
 #endif
 
-    // See if we need to drop this sample
-    if (s_ActiveSession->m_DropAudioEndTime != 0) {
-        if (SDL_TICKS_PASSED(SDL_GetTicks(), s_ActiveSession->m_DropAudioEndTime)) {
-            // Avoid calling SDL_GetTicks() now
-            s_ActiveSession->m_DropAudioEndTime = 0;
+    s_ActiveSession->m_AudioSampleCount++;
 
-            SDL_LogInfo(SDL_LOG_CATEGORY_APPLICATION,
-                        "Audio drop window has ended");
-        }
-        else {
-            // We're still in the drop window
-            return;
+    // Swap in a recreated renderer if one is ready
+    IAudioRenderer* pendingRenderer = (IAudioRenderer*)SDL_AtomicSetPtr((void**)&s_ActiveSession->m_PendingAudioRenderer, nullptr);
+    if (pendingRenderer != nullptr && s_ActiveSession->attachAudioRenderer(pendingRenderer)) {
+        SDL_LogInfo(SDL_LOG_CATEGORY_APPLICATION,
+                    "Audio renderer recreated with %d buffered packets",
+                    (int)s_ActiveSession->m_BufferedAudioPackets.size());
+
+        // Start the new renderer off with the most recent audio. Anything
+        // older was dropped, so we haven't built up any latency.
+        for (const QByteArray& packet : s_ActiveSession->m_BufferedAudioPackets) {
+            if (!s_ActiveSession->playAudioFrame((const unsigned char*)packet.constData(), packet.size(), false)) {
+                break;
+            }
         }
     }
-
-    s_ActiveSession->m_AudioSampleCount++;
+    if (s_ActiveSession->m_AudioRenderer != nullptr) {
+        s_ActiveSession->m_BufferedAudioPackets.clear();
+    }
 
     // If audio is muted, don't decode or play the audio
     if (s_ActiveSession->m_AudioMuted) {
@@ -188,68 +457,81 @@ void Session::arDecodeAndPlaySample(char* sampleData, int sampleLength)
     }
 
     if (s_ActiveSession->m_AudioRenderer != nullptr) {
-        int sampleSize = s_ActiveSession->m_AudioRenderer->getAudioBufferSampleSize();
-        int frameSize = sampleSize * s_ActiveSession->m_ActiveAudioConfig.channelCount;
-        int desiredBufferSize = frameSize * s_ActiveSession->m_ActiveAudioConfig.samplesPerFrame;
-        void* buffer = s_ActiveSession->m_AudioRenderer->getAudioBuffer(&desiredBufferSize);
-        if (buffer == nullptr) {
-            return;
-        }
-
-        if (s_ActiveSession->m_AudioRenderer->getAudioBufferFormat() == IAudioRenderer::AudioFormat::Float32NE) {
-            samplesDecoded = opus_multistream_decode_float(s_ActiveSession->m_OpusDecoder,
-                                                           (unsigned char*)sampleData,
-                                                           sampleLength,
-                                                           (float*)buffer,
-                                                           desiredBufferSize / frameSize,
-                                                           0);
-        }
-        else {
-            samplesDecoded = opus_multistream_decode(s_ActiveSession->m_OpusDecoder,
-                                                     (unsigned char*)sampleData,
-                                                     sampleLength,
-                                                     (short*)buffer,
-                                                     desiredBufferSize / frameSize,
-                                                     0);
+        uint32_t audioDelayMs = s_ActiveSession->m_AvSync.getAudioDelayMs();
+        if (audioDelayMs != s_ActiveSession->m_RequestedAudioDelayMs) {
+            if (s_ActiveSession->m_AudioRenderer->setAudioDelay(audioDelayMs)) {
+                s_ActiveSession->m_AppliedAudioDelayMs = audioDelayMs;
+            }
+            else {
+                SDL_LogWarn(SDL_LOG_CATEGORY_APPLICATION,
+                            "Audio renderer doesn't support A/V sync delay");
+            }
+            s_ActiveSession->m_RequestedAudioDelayMs = audioDelayMs;
         }
 
-        // Update desiredSize with the number of bytes actually populated by the decoding operation
-        if (samplesDecoded > 0) {
-            SDL_assert(desiredBufferSize >= frameSize * samplesDecoded);
-            desiredBufferSize = frameSize * samplesDecoded;
+        bool submitted = true;
+
+        if (sampleData == nullptr) {
+            // moonlight-common-c passes a null sample in place of each lost packet.
+            // If FEC is enabled, wait for the next packet to try to recover it.
+            if (s_ActiveSession->m_AudioFecEnabled) {
+                s_ActiveSession->m_PendingLostAudioFrames++;
+            }
+            else {
+                submitted = s_ActiveSession->playAudioFrame(nullptr, 0, false);
+                SDL_AtomicIncRef(&s_ActiveSession->m_AudioConcealedFrames);
+            }
         }
         else {
-            desiredBufferSize = 0;
+            // Don't bother concealing a long outage, since it will underrun anyway
+            int lostFrames = SDL_min(s_ActiveSession->m_PendingLostAudioFrames, MAX_CONCEALED_AUDIO_FRAMES);
+            s_ActiveSession->m_PendingLostAudioFrames = 0;
+
+            while (submitted && lostFrames > 0) {
+                // Only the frame immediately before this packet can be recovered
+                // from its in-band FEC data. Older ones get PLC.
+                if (lostFrames == 1) {
+                    submitted = s_ActiveSession->playAudioFrame((unsigned char*)sampleData, sampleLength, true);
+                    SDL_AtomicIncRef(&s_ActiveSession->m_AudioFecFrames);
+                }
+                else {
+                    submitted = s_ActiveSession->playAudioFrame(nullptr, 0, false);
+                }
+                SDL_AtomicIncRef(&s_ActiveSession->m_AudioConcealedFrames);
+                lostFrames--;
+            }
+
+            if (submitted) {
+                submitted = s_ActiveSession->playAudioFrame((unsigned char*)sampleData, sampleLength, false);
+            }
         }
 
-        if (!s_ActiveSession->m_AudioRenderer->submitAudio(desiredBufferSize)) {
+        if (!submitted) {
             SDL_LogWarn(SDL_LOG_CATEGORY_APPLICATION,
                         "Reinitializing audio renderer after failure");
 
             opus_multistream_decoder_destroy(s_ActiveSession->m_OpusDecoder);
             s_ActiveSession->m_OpusDecoder = nullptr;
 
-            delete s_ActiveSession->m_AudioRenderer;
+            // Recreate the renderer in the background so we don't stall this
+            // thread, which would back up audio in moonlight-common-c.
+            IAudioRenderer* oldRenderer = s_ActiveSession->m_AudioRenderer;
             s_ActiveSession->m_AudioRenderer = nullptr;
+            s_ActiveSession->reportAudioRendererStats(oldRenderer);
+            s_ActiveSession->startAudioRendererInit(oldRenderer);
+            return;
+        }
+    }
+    else if (sampleData != nullptr) {
+        // Hold onto the latest audio for the new renderer
+        s_ActiveSession->m_BufferedAudioPackets.enqueue(QByteArray(sampleData, sampleLength));
+        while (s_ActiveSession->m_BufferedAudioPackets.size() > MAX_BUFFERED_AUDIO_PACKETS) {
+            s_ActiveSession->m_BufferedAudioPackets.dequeue();
         }
     }
 
-    // Only try to recreate the audio renderer every 200 samples (1 second)
-    // to avoid thrashing if the audio device is unavailable. It is
-    // safe to reinitialize here because we can't be torn down while
-    // the audio decoder/playback thread is still alive.
+    // Retry every 200 samples (1 second) if the audio device is unavailable
     if (s_ActiveSession->m_AudioRenderer == nullptr && (s_ActiveSession->m_AudioSampleCount % 200) == 0) {
-        // Since we're doing this inline and audio initialization takes time, we need
-        // to drop samples to account for the time we've spent blocking audio rendering
-        // so we return to real-time playback and don't accumulate latency.
-        Uint32 audioReinitStartTime = SDL_GetTicks();
-        if (s_ActiveSession->initializeAudioRenderer()) {
-            Uint32 audioReinitStopTime = SDL_GetTicks();
-
-            s_ActiveSession->m_DropAudioEndTime = audioReinitStopTime + (audioReinitStopTime - audioReinitStartTime);
-            SDL_LogInfo(SDL_LOG_CATEGORY_APPLICATION,
-                        "Audio reinitialization took %d ms - starting drop window",
-                        audioReinitStopTime - audioReinitStartTime);
-        }
+        s_ActiveSession->startAudioRendererInit(nullptr);
     }
 }
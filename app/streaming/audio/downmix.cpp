@@ -0,0 +1,181 @@
+#include "downmix.h"
+#include "renderers/pcmconvert.h"
+
+// Enough for the largest interaural time difference at up to 96 KHz
+#define MAX_ITD_FRAMES 64
+
+// Interaural time differences from Woodworth's formula for an average head,
+// with the front speakers at 30 degrees and the surrounds at about 100 degrees
+#define FRONT_ITD_US 260
+#define SURROUND_ITD_US 700
+
+// The head shadows high frequencies more as the source moves to the side
+#define FRONT_SHADOW_HZ 6000
+#define SURROUND_SHADOW_HZ 3000
+
+// Near and far ear levels for each speaker pair
+#define FRONT_NEAR_LEVEL 1.0f
+#define FRONT_FAR_LEVEL 0.6f
+#define CENTER_LEVEL 0.70710678f
+#define SURROUND_NEAR_LEVEL 0.8f
+#define SURROUND_FAR_LEVEL 0.4f
+
+SurroundDownmixer::SurroundDownmixer()
+    : m_Mode(StreamingPreferences::SD_OFF),
+      m_ChannelCount(0),
+      m_SamplesPerFrame(0),
+      m_InputBuffer(nullptr),
+      m_OutputBuffer(nullptr),
+      m_FarFrontBuffer(nullptr),
+      m_FarSurroundBuffer(nullptr),
+      m_FrontDelayFrames(0),
+      m_SurroundDelayFrames(0),
+      m_FrontShadowAlpha(0),
+      m_SurroundShadowAlpha(0)
+{
+    reset();
+}
+
+SurroundDownmixer::~SurroundDownmixer()
+{
+    SDL_free(m_InputBuffer);
+    SDL_free(m_OutputBuffer);
+    SDL_free(m_FarFrontBuffer);
+    SDL_free(m_FarSurroundBuffer);
+}
+
+bool SurroundDownmixer::initialize(StreamingPreferences::SurroundDownmix mode,
+                                   int channelCount, int sampleRate, int samplesPerFrame)
+{
+    SDL_assert(m_InputBuffer == nullptr);
+
+    if (mode == StreamingPreferences::SD_OFF || (channelCount != 6 && channelCount != 8)) {
+        return false;
+    }
+
+    m_InputBuffer = (float*)SDL_malloc(samplesPerFrame * channelCount * sizeof(float));
+    m_OutputBuffer = (float*)SDL_malloc(samplesPerFrame * 2 * sizeof(float));
+    if (m_InputBuffer == nullptr || m_OutputBuffer == nullptr) {
+        return false;
+    }
+
+    if (mode == StreamingPreferences::SD_VIRTUAL_SURROUND) {
+        int farBufferSize = (MAX_ITD_FRAMES + samplesPerFrame) * 2 * sizeof(float);
+        m_FarFrontBuffer = (float*)SDL_malloc(farBufferSize);
+        m_FarSurroundBuffer = (float*)SDL_malloc(farBufferSize);
+        if (m_FarFrontBuffer == nullptr || m_FarSurroundBuffer == nullptr) {
+            return false;
+        }
+
+        m_FrontDelayFrames = SDL_min(FRONT_ITD_US * sampleRate / 1000000, MAX_ITD_FRAMES);
+        m_SurroundDelayFrames = SDL_min(SURROUND_ITD_US * sampleRate / 1000000, MAX_ITD_FRAMES);
+        m_FrontShadowAlpha = 1.0f - SDL_expf(-2 * 3.14159265f * FRONT_SHADOW_HZ / sampleRate);
+        m_SurroundShadowAlpha = 1.0f - SDL_expf(-2 * 3.14159265f * SURROUND_SHADOW_HZ / sampleRate);
+
+        // Normalize by everything that reaches one ear so we can't clip
+        int surroundPairs = channelCount == 8 ? 2 : 1;
+        float norm = 1.0f / (FRONT_NEAR_LEVEL + FRONT_FAR_LEVEL + CENTER_LEVEL +
+                             surroundPairs * (SURROUND_NEAR_LEVEL + SURROUND_FAR_LEVEL));
+
+        setCoefficients(m_NearLeft, m_NearRight,
+                        FRONT_NEAR_LEVEL * norm, CENTER_LEVEL * norm, SURROUND_NEAR_LEVEL * norm);
+        setCoefficients(m_FarFrontLeft, m_FarFrontRight,
+                        FRONT_FAR_LEVEL * norm, 0, 0);
+        setCoefficients(m_FarSurroundLeft, m_FarSurroundRight,
+                        0, 0, SURROUND_FAR_LEVEL * norm);
+
+        // The far ear hears the speakers on the opposite side
+        for (int i = 0; i < 8; i++) {
+            float left = m_FarFrontLeft[i];
+            m_FarFrontLeft[i] = m_FarFrontRight[i];
+            m_FarFrontRight[i] = left;
+
+            left = m_FarSurroundLeft[i];
+            m_FarSurroundLeft[i] = m_FarSurroundRight[i];
+            m_FarSurroundRight[i] = left;
+        }
+    }
+
+    m_Mode = mode;
+    m_ChannelCount = channelCount;
+    m_SamplesPerFrame = samplesPerFrame;
+    reset();
+
+    SDL_LogInfo(SDL_LOG_CATEGORY_APPLICATION,
+                "Downmixing %d channel audio to %s",
+                channelCount,
+                mode == StreamingPreferences::SD_VIRTUAL_SURROUND ? "virtual surround" : "stereo");
+    return true;
+}
+
+void SurroundDownmixer::setCoefficients(float* left, float* right,
+                                        float front, float center, float surround)
+{
+    // FL,FR,C,LFE,RL,RR,SL,SR. The LFE is dropped, as with a regular downmix.
+    const float leftCoeffs[8] = { front, 0, center, 0, surround, 0, surround, 0 };
+    const float rightCoeffs[8] = { 0, front, center, 0, 0, surround, 0, surround };
+
+    SDL_memcpy(left, leftCoeffs, sizeof(leftCoeffs));
+    SDL_memcpy(right, rightCoeffs, sizeof(rightCoeffs));
+}
+
+bool SurroundDownmixer::isEnabled()
+{
+    return m_Mode != StreamingPreferences::SD_OFF;
+}
+
+void SurroundDownmixer::reset()
+{
+    if (m_FarFrontBuffer != nullptr) {
+        SDL_memset(m_FarFrontBuffer, 0, MAX_ITD_FRAMES * 2 * sizeof(float));
+        SDL_memset(m_FarSurroundBuffer, 0, MAX_ITD_FRAMES * 2 * sizeof(float));
+    }
+
+    SDL_zeroa(m_FrontShadowState);
+    SDL_zeroa(m_SurroundShadowState);
+}
+
+float* SurroundDownmixer::getInputBuffer()
+{
+    return m_InputBuffer;
+}
+
+void SurroundDownmixer::process(int frameCount, float* out)
+{
+    SDL_assert(isEnabled());
+    SDL_assert(frameCount <= m_SamplesPerFrame);
+
+    if (m_Mode == StreamingPreferences::SD_STEREO) {
+        PcmConvert::downmixToStereo(m_InputBuffer, out, m_ChannelCount, frameCount);
+        return;
+    }
+
+    float* farFront = &m_FarFrontBuffer[MAX_ITD_FRAMES * 2];
+    float* farSurround = &m_FarSurroundBuffer[MAX_ITD_FRAMES * 2];
+
+    PcmConvert::mixToStereo(m_InputBuffer, out, m_ChannelCount, frameCount, m_NearLeft, m_NearRight);
+    PcmConvert::mixToStereo(m_InputBuffer, farFront, m_ChannelCount, frameCount, m_FarFrontLeft, m_FarFrontRight);
+    PcmConvert::mixToStereo(m_InputBuffer, farSurround, m_ChannelCount, frameCount, m_FarSurroundLeft, m_FarSurroundRight);
+
+    // Delay and shadow the far ear paths. Indexing back into the history is
+    // safe because the delays are never longer than MAX_ITD_FRAMES.
+    const float* delayedFront = farFront - m_FrontDelayFrames * 2;
+    const float* delayedSurround = farSurround - m_SurroundDelayFrames * 2;
+    for (int i = 0; i < frameCount * 2; i++) {
+        int ear = i & 1;
+
+        m_FrontShadowState[ear] += m_FrontShadowAlpha * (delayedFront[i] - m_FrontShadowState[ear]);
+        m_SurroundShadowState[ear] += m_SurroundShadowAlpha * (delayedSurround[i] - m_SurroundShadowState[ear]);
+        out[i] += m_FrontShadowState[ear] + m_SurroundShadowState[ear];
+    }
+
+    // Keep the tail of this frame as history for the next one
+    SDL_memmove(m_FarFrontBuffer, &m_FarFrontBuffer[frameCount * 2], MAX_ITD_FRAMES * 2 * sizeof(float));
+    SDL_memmove(m_FarSurroundBuffer, &m_FarSurroundBuffer[frameCount * 2], MAX_ITD_FRAMES * 2 * sizeof(float));
+}
+
+void SurroundDownmixer::process(int frameCount, int16_t* out)
+{
+    process(frameCount, m_OutputBuffer);
+    PcmConvert::floatToS16(m_OutputBuffer, out, frameCount * 2);
+}
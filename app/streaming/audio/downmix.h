@@ -0,0 +1,62 @@
+#pragma once
+
+#include "SDL_compat.h"
+#include "settings/streamingpreferences.h"
+
+// Downmixes decoded surround audio to stereo before it reaches the audio
+// renderer, so a stereo device doesn't need the OS to downmix in its own
+// audio graph (which often adds buffering).
+//
+// SD_VIRTUAL_SURROUND is meant for headphones. It reaches each ear with
+// every speaker, adding a delay and head shadow filter for the far ear.
+// Its cost per frame is fixed: three SIMD matrix mixes, then one delay
+// line and one-pole filter per ear for the front and surround pairs.
+class SurroundDownmixer
+{
+public:
+    SurroundDownmixer();
+
+    ~SurroundDownmixer();
+
+    // Returns false if downmixing isn't needed for this stream
+    bool initialize(StreamingPreferences::SurroundDownmix mode,
+                    int channelCount, int sampleRate, int samplesPerFrame);
+
+    bool isEnabled();
+
+    // Clears filter state, such as when the audio renderer is recreated
+    void reset();
+
+    // Decode samplesPerFrame frames of floats in Moonlight's channel order into this
+    float* getInputBuffer();
+
+    void process(int frameCount, float* out);
+
+    void process(int frameCount, int16_t* out);
+
+private:
+    void setCoefficients(float* left, float* right,
+                         float front, float center, float surround);
+
+    StreamingPreferences::SurroundDownmix m_Mode;
+    int m_ChannelCount;
+    int m_SamplesPerFrame;
+    float* m_InputBuffer;
+
+    // Stereo output, used when the renderer wants 16-bit samples
+    float* m_OutputBuffer;
+
+    // Virtual surround state. The far ear buffers keep MAX_ITD_FRAMES of
+    // history in front of the current frame for the delay lines.
+    float m_NearLeft[8], m_NearRight[8];
+    float m_FarFrontLeft[8], m_FarFrontRight[8];
+    float m_FarSurroundLeft[8], m_FarSurroundRight[8];
+    float* m_FarFrontBuffer;
+    float* m_FarSurroundBuffer;
+    int m_FrontDelayFrames;
+    int m_SurroundDelayFrames;
+    float m_FrontShadowAlpha;
+    float m_SurroundShadowAlpha;
+    float m_FrontShadowState[2];
+    float m_SurroundShadowState[2];
+};
@@ -0,0 +1,57 @@
+#pragma once
+
+#include "renderer.h"
+#include "pcmring.h"
+
+#include <AudioUnit/AudioUnit.h>
+#include <CoreAudio/CoreAudio.h>
+
+// Plays audio through the default output AudioUnit (AUHAL) with its IO
+// buffer shrunk to a single Opus frame, rather than the 512+ sample
+// buffer used by SDL. Override the IO buffer size with AUDIO_COREAUDIO_FRAMES.
+class CoreAudioRenderer : public IAudioRenderer
+{
+public:
+    CoreAudioRenderer();
+
+    virtual ~CoreAudioRenderer();
+
+    virtual bool prepareForPlayback(const OPUS_MULTISTREAM_CONFIGURATION* opusConfig);
+
+    virtual void* getAudioBuffer(int* size);
+
+    virtual bool submitAudio(int bytesWritten);
+
+    virtual AudioFormat getAudioBufferFormat();
+
+    virtual bool getAudioLatency(uint32_t* latencyMs, uint32_t* targetLatencyMs);
+
+    virtual bool setAudioDelay(uint32_t delayMs);
+
+private:
+    static OSStatus renderCallback(void* context,
+                                   AudioUnitRenderActionFlags* actionFlags,
+                                   const AudioTimeStamp* timeStamp,
+                                   UInt32 busNumber,
+                                   UInt32 frameCount,
+                                   AudioBufferList* data);
+
+    static OSStatus defaultDeviceChanged(AudioObjectID objectId,
+                                         UInt32 addressCount,
+                                         const AudioObjectPropertyAddress* addresses,
+                                         void* context);
+
+    bool setChannelLayout(int channelCount);
+
+    AudioUnit m_AudioUnit;
+    bool m_Initialized;
+    bool m_ListenerRegistered;
+    int m_FrameSize;
+    int m_BytesPerSampleFrame;
+    int m_MaxQueuedBytes;
+    int m_SampleRate;
+    int m_DeviceLatencyUs;
+    void* m_AudioBuffer;
+    PcmRing m_Ring;
+    SDL_atomic_t m_DeviceLost;
+};
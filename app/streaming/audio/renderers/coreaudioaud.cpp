@@ -0,0 +1,350 @@
+#include "coreaudio.h"
+
+#include <Limelight.h>
+
+static const AudioObjectPropertyAddress k_DefaultOutputDeviceAddress = {
+    kAudioHardwarePropertyDefaultOutputDevice,
+    kAudioObjectPropertyScopeGlobal,
+    kAudioObjectPropertyElementMaster
+};
+
+CoreAudioRenderer::CoreAudioRenderer()
+    : m_AudioUnit(nullptr),
+      m_Initialized(false),
+      m_ListenerRegistered(false),
+      m_FrameSize(0),
+      m_BytesPerSampleFrame(0),
+      m_MaxQueuedBytes(0),
+      m_SampleRate(0),
+      m_DeviceLatencyUs(0),
+      m_AudioBuffer(nullptr)
+{
+    SDL_AtomicSet(&m_DeviceLost, 0);
+}
+
+CoreAudioRenderer::~CoreAudioRenderer()
+{
+    if (m_ListenerRegistered) {
+        AudioObjectRemovePropertyListener(kAudioObjectSystemObject,
+                                          &k_DefaultOutputDeviceAddress,
+                                          defaultDeviceChanged,
+                                          this);
+    }
+
+    if (m_AudioUnit != nullptr) {
+        // Stopping the unit waits for any render callback in progress
+        AudioOutputUnitStop(m_AudioUnit);
+        if (m_Initialized) {
+            AudioUnitUninitialize(m_AudioUnit);
+        }
+        AudioComponentInstanceDispose(m_AudioUnit);
+    }
+
+    SDL_free(m_AudioBuffer);
+}
+
+bool CoreAudioRenderer::setChannelLayout(int channelCount)
+{
+    // These match the channel order of Moonlight's Opus streams
+    static const AudioChannelLabel k_71Labels[] = {
+        kAudioChannelLabel_Left,
+        kAudioChannelLabel_Right,
+        kAudioChannelLabel_Center,
+        kAudioChannelLabel_LFEScreen,
+        kAudioChannelLabel_RearSurroundLeft,
+        kAudioChannelLabel_RearSurroundRight,
+        kAudioChannelLabel_LeftSurroundDirect,
+        kAudioChannelLabel_RightSurroundDirect,
+    };
+    static const AudioChannelLabel k_51Labels[] = {
+        kAudioChannelLabel_Left,
+        kAudioChannelLabel_Right,
+        kAudioChannelLabel_Center,
+        kAudioChannelLabel_LFEScreen,
+        kAudioChannelLabel_LeftSurround,
+        kAudioChannelLabel_RightSurround,
+    };
+
+    const AudioChannelLabel* labels;
+    switch (channelCount) {
+    case 2:
+        // The default layout is already stereo
+        return true;
+    case 6:
+        labels = k_51Labels;
+        break;
+    case 8:
+        labels = k_71Labels;
+        break;
+    default:
+        SDL_LogError(SDL_LOG_CATEGORY_APPLICATION,
+                     "Unsupported audio channel count: %d",
+                     channelCount);
+        return false;
+    }
+
+    UInt32 layoutSize = offsetof(AudioChannelLayout, mChannelDescriptions) +
+                        channelCount * sizeof(AudioChannelDescription);
+    AudioChannelLayout* layout = (AudioChannelLayout*)SDL_calloc(1, layoutSize);
+    if (layout == nullptr) {
+        return false;
+    }
+
+    layout->mChannelLayoutTag = kAudioChannelLayoutTag_UseChannelDescriptions;
+    layout->mNumberChannelDescriptions = channelCount;
+    for (int i = 0; i < channelCount; i++) {
+        layout->mChannelDescriptions[i].mChannelLabel = labels[i];
+    }
+
+    OSStatus status = AudioUnitSetProperty(m_AudioUnit,
+                                           kAudioUnitProperty_AudioChannelLayout,
+                                           kAudioUnitScope_Input, 0,
+                                           layout, layoutSize);
+    SDL_free(layout);
+
+    if (status != noErr) {
+        // Not fatal, but surround channels may be misplaced
+        SDL_LogWarn(SDL_LOG_CATEGORY_APPLICATION,
+                    "Failed to set audio channel layout: %d",
+                    (int)status);
+    }
+
+    return true;
+}
+
+bool CoreAudioRenderer::prepareForPlayback(const OPUS_MULTISTREAM_CONFIGURATION* opusConfig)
+{
+    OSStatus status;
+
+    AudioComponentDescription desc = {};
+    desc.componentType = kAudioUnitType_Output;
+    desc.componentSubType = kAudioUnitSubType_DefaultOutput;
+    desc.componentManufacturer = kAudioUnitManufacturer_Apple;
+
+    AudioComponent component = AudioComponentFindNext(nullptr, &desc);
+    if (component == nullptr) {
+        SDL_LogError(SDL_LOG_CATEGORY_APPLICATION,
+                     "Unable to find default output AudioUnit");
+        return false;
+    }
+
+    status = AudioComponentInstanceNew(component, &m_AudioUnit);
+    if (status != noErr) {
+        SDL_LogError(SDL_LOG_CATEGORY_APPLICATION,
+                     "AudioComponentInstanceNew() failed: %d",
+                     (int)status);
+        m_AudioUnit = nullptr;
+        return false;
+    }
+
+    m_SampleRate = opusConfig->sampleRate;
+    m_BytesPerSampleFrame = opusConfig->channelCount * getAudioBufferSampleSize();
+    m_FrameSize = opusConfig->samplesPerFrame * m_BytesPerSampleFrame;
+
+    AudioStreamBasicDescription format = {};
+    format.mSampleRate = opusConfig->sampleRate;
+    format.mFormatID = kAudioFormatLinearPCM;
+    format.mFormatFlags = kAudioFormatFlagIsFloat | kAudioFormatFlagIsPacked;
+    format.mFramesPerPacket = 1;
+    format.mChannelsPerFrame = opusConfig->channelCount;
+    format.mBitsPerChannel = 32;
+    format.mBytesPerFrame = m_BytesPerSampleFrame;
+    format.mBytesPerPacket = m_BytesPerSampleFrame;
+
+    status = AudioUnitSetProperty(m_AudioUnit,
+                                  kAudioUnitProperty_StreamFormat,
+                                  kAudioUnitScope_Input, 0,
+                                  &format, sizeof(format));
+    if (status != noErr) {
+        SDL_LogError(SDL_LOG_CATEGORY_APPLICATION,
+                     "Failed to set audio stream format: %d",
+                     (int)status);
+        return false;
+    }
+
+    if (!setChannelLayout(opusConfig->channelCount)) {
+        return false;
+    }
+
+    // Shrink the IO buffer as far as the device allows. The HAL tracks
+    // this per process, so it doesn't outlive us.
+    AudioValueRange bufferRange;
+    UInt32 propertySize = sizeof(bufferRange);
+    UInt32 bufferFrames = opusConfig->samplesPerFrame;
+    bool ok;
+    int framesOverride = qEnvironmentVariableIntValue("AUDIO_COREAUDIO_FRAMES", &ok);
+    if (ok && framesOverride > 0) {
+        bufferFrames = framesOverride;
+    }
+    if (AudioUnitGetProperty(m_AudioUnit,
+                             kAudioDevicePropertyBufferFrameSizeRange,
+                             kAudioUnitScope_Global, 0,
+                             &bufferRange, &propertySize) == noErr) {
+        bufferFrames = SDL_clamp(bufferFrames, (UInt32)bufferRange.mMinimum, (UInt32)bufferRange.mMaximum);
+    }
+    status = AudioUnitSetProperty(m_AudioUnit,
+                                  kAudioDevicePropertyBufferFrameSize,
+                                  kAudioUnitScope_Global, 0,
+                                  &bufferFrames, sizeof(bufferFrames));
+    if (status != noErr) {
+        SDL_LogWarn(SDL_LOG_CATEGORY_APPLICATION,
+                    "Failed to set audio IO buffer size: %d",
+                    (int)status);
+    }
+
+    // Read back what the device actually gave us
+    propertySize = sizeof(bufferFrames);
+    if (AudioUnitGetProperty(m_AudioUnit,
+                             kAudioDevicePropertyBufferFrameSize,
+                             kAudioUnitScope_Global, 0,
+                             &bufferFrames, &propertySize) != noErr) {
+        bufferFrames = opusConfig->samplesPerFrame;
+    }
+    m_DeviceLatencyUs = (int)((uint64_t)bufferFrames * 1000000 / opusConfig->sampleRate);
+
+    // The device pulls a whole IO buffer at a time, so allow one Opus
+    // frame on top of that before we start dropping.
+    m_MaxQueuedBytes = SDL_max(2 * m_FrameSize, m_FrameSize + (int)bufferFrames * m_BytesPerSampleFrame);
+
+    // Leave room in the ring for A/V sync delay too
+    int maxDelayBytes = MAX_AUDIO_DELAY_MS * m_SampleRate / 1000 * m_BytesPerSampleFrame;
+    m_AudioBuffer = SDL_malloc(m_FrameSize);
+    if (m_AudioBuffer == nullptr || !m_Ring.initialize((m_MaxQueuedBytes + maxDelayBytes) * 2)) {
+        return false;
+    }
+
+    AURenderCallbackStruct callback = {};
+    callback.inputProc = renderCallback;
+    callback.inputProcRefCon = this;
+    status = AudioUnitSetProperty(m_AudioUnit,
+                                  kAudioUnitProperty_SetRenderCallback,
+                                  kAudioUnitScope_Input, 0,
+                                  &callback, sizeof(callback));
+    if (status != noErr) {
+        SDL_LogError(SDL_LOG_CATEGORY_APPLICATION,
+                     "Failed to set audio render callback: %d",
+                     (int)status);
+        return false;
+    }
+
+    status = AudioUnitInitialize(m_AudioUnit);
+    if (status != noErr) {
+        SDL_LogError(SDL_LOG_CATEGORY_APPLICATION,
+                     "AudioUnitInitialize() failed: %d",
+                     (int)status);
+        return false;
+    }
+    m_Initialized = true;
+
+    // The default output unit follows default device changes on its own, but
+    // not our buffer size setting, so we recreate the renderer instead.
+    if (AudioObjectAddPropertyListener(kAudioObjectSystemObject,
+                                       &k_DefaultOutputDeviceAddress,
+                                       defaultDeviceChanged,
+                                       this) == noErr) {
+        m_ListenerRegistered = true;
+    }
+
+    status = AudioOutputUnitStart(m_AudioUnit);
+    if (status != noErr) {
+        SDL_LogError(SDL_LOG_CATEGORY_APPLICATION,
+                     "AudioOutputUnitStart() failed: %d",
+                     (int)status);
+        return false;
+    }
+
+    SDL_LogInfo(SDL_LOG_CATEGORY_APPLICATION,
+                "CoreAudio IO buffer: %u frames (%.1f ms)",
+                (unsigned int)bufferFrames,
+                m_DeviceLatencyUs / 1000.0);
+
+    return true;
+}
+
+OSStatus CoreAudioRenderer::renderCallback(void* context,
+                                           AudioUnitRenderActionFlags* actionFlags,
+                                           const AudioTimeStamp*,
+                                           UInt32,
+                                           UInt32 frameCount,
+                                           AudioBufferList* data)
+{
+    auto me = (CoreAudioRenderer*)context;
+
+    // We asked for interleaved samples, so there is only one buffer
+    SDL_assert(data->mNumberBuffers == 1);
+
+    Uint8* output = (Uint8*)data->mBuffers[0].mData;
+    int bytes = SDL_min((int)(frameCount * me->m_BytesPerSampleFrame), (int)data->mBuffers[0].mDataByteSize);
+
+    // Fill in silence if the decoder hasn't caught up
+    int bytesRead = me->m_Ring.read(output, bytes);
+    SDL_memset(output + bytesRead, 0, bytes - bytesRead);
+    if (bytesRead == 0) {
+        *actionFlags |= kAudioUnitRenderAction_OutputIsSilence;
+    }
+
+    return noErr;
+}
+
+OSStatus CoreAudioRenderer::defaultDeviceChanged(AudioObjectID,
+                                                 UInt32,
+                                                 const AudioObjectPropertyAddress*,
+                                                 void* context)
+{
+    auto me = (CoreAudioRenderer*)context;
+    SDL_AtomicSet(&me->m_DeviceLost, 1);
+    return noErr;
+}
+
+void* CoreAudioRenderer::getAudioBuffer(int* size)
+{
+    SDL_assert(*size <= m_FrameSize);
+    *size = m_FrameSize;
+    return m_AudioBuffer;
+}
+
+bool CoreAudioRenderer::submitAudio(int bytesWritten)
+{
+    if (SDL_AtomicGet(&m_DeviceLost)) {
+        return false;
+    }
+
+    if (bytesWritten == 0) {
+        // Nothing to do
+        return true;
+    }
+
+    // Don't let latency build up if the device is consuming slower than we produce
+    // or if there's already more than 30 ms of audio data waiting in Moonlight's
+    // audio queue.
+    if (m_Ring.getQueuedBytes() + bytesWritten > m_MaxQueuedBytes + m_Ring.getDelayBytes() || LiGetPendingAudioDuration() > 30) {
+        return true;
+    }
+
+    m_Ring.write(m_AudioBuffer, bytesWritten);
+    return true;
+}
+
+bool CoreAudioRenderer::getAudioLatency(uint32_t* latencyMs, uint32_t* targetLatencyMs)
+{
+    int queuedUs = (int)((int64_t)m_Ring.getQueuedBytes() / m_BytesPerSampleFrame * 1000000 / m_SampleRate);
+    int frameUs = (int)((int64_t)m_FrameSize / m_BytesPerSampleFrame * 1000000 / m_SampleRate);
+    int delayUs = (int)((int64_t)m_Ring.getDelayBytes() / m_BytesPerSampleFrame * 1000000 / m_SampleRate);
+
+    *latencyMs = (queuedUs + m_DeviceLatencyUs) / 1000;
+    *targetLatencyMs = (frameUs + delayUs + m_DeviceLatencyUs) / 1000;
+    return true;
+}
+
+bool CoreAudioRenderer::setAudioDelay(uint32_t delayMs)
+{
+    // Keep the delay aligned to whole sample frames
+    int delayFrames = (int)SDL_min(delayMs, (uint32_t)MAX_AUDIO_DELAY_MS) * m_SampleRate / 1000;
+    m_Ring.setDelayBytes(delayFrames * m_BytesPerSampleFrame);
+    return true;
+}
+
+IAudioRenderer::AudioFormat CoreAudioRenderer::getAudioBufferFormat()
+{
+    return AudioFormat::Float32NE;
+}
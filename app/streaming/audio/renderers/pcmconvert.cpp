@@ -0,0 +1,155 @@
+#include "pcmconvert.h"
+
+#if defined(__SSE2__) || defined(_M_X64) || (defined(_M_IX86_FP) && _M_IX86_FP >= 2)
+#define HAVE_SSE2_KERNELS
+#include <emmintrin.h>
+#elif defined(__ARM_NEON) || defined(__ARM_NEON__)
+#define HAVE_NEON_KERNELS
+#include <arm_neon.h>
+#endif
+
+// -3 dB for the center and surround channels
+#define DOWNMIX_MIX_LEVEL 0.70710678f
+
+void PcmConvert::floatToS16(const float* in, int16_t* out, int sampleCount)
+{
+    int i = 0;
+
+#if defined(HAVE_SSE2_KERNELS)
+    const __m128 scale = _mm_set1_ps(32767.0f);
+    const __m128 minValue = _mm_set1_ps(-1.0f);
+    const __m128 maxValue = _mm_set1_ps(1.0f);
+    for (; i + 8 <= sampleCount; i += 8) {
+        // Clamp first because out of range values convert to INT_MIN, and
+        // truncate like the scalar tail so results match regardless of position
+        __m128 lo = _mm_min_ps(_mm_max_ps(_mm_loadu_ps(&in[i]), minValue), maxValue);
+        __m128 hi = _mm_min_ps(_mm_max_ps(_mm_loadu_ps(&in[i + 4]), minValue), maxValue);
+        __m128i packed = _mm_packs_epi32(_mm_cvttps_epi32(_mm_mul_ps(lo, scale)),
+                                          _mm_cvttps_epi32(_mm_mul_ps(hi, scale)));
+        _mm_storeu_si128((__m128i*)&out[i], packed);
+    }
+#elif defined(HAVE_NEON_KERNELS)
+    for (; i + 8 <= sampleCount; i += 8) {
+        // The float to int conversion and narrowing both saturate
+        int32x4_t lo = vcvtq_s32_f32(vmulq_n_f32(vld1q_f32(&in[i]), 32767.0f));
+        int32x4_t hi = vcvtq_s32_f32(vmulq_n_f32(vld1q_f32(&in[i + 4]), 32767.0f));
+        vst1q_s16(&out[i], vcombine_s16(vqmovn_s32(lo), vqmovn_s32(hi)));
+    }
+#endif
+
+    for (; i < sampleCount; i++) {
+        float sample = SDL_clamp(in[i], -1.0f, 1.0f);
+        out[i] = (int16_t)(sample * 32767.0f);
+    }
+}
+
+void PcmConvert::s16ToFloat(const int16_t* in, float* out, int sampleCount)
+{
+    int i = 0;
+
+#if defined(HAVE_SSE2_KERNELS)
+    const __m128 scale = _mm_set1_ps(1.0f / 32768.0f);
+    for (; i + 8 <= sampleCount; i += 8) {
+        __m128i samples = _mm_loadu_si128((const __m128i*)&in[i]);
+
+        // Sign extend by unpacking into the high half and shifting back down
+        __m128i lo = _mm_srai_epi32(_mm_unpacklo_epi16(samples, samples), 16);
+        __m128i hi = _mm_srai_epi32(_mm_unpackhi_epi16(samples, samples), 16);
+        _mm_storeu_ps(&out[i], _mm_mul_ps(_mm_cvtepi32_ps(lo), scale));
+        _mm_storeu_ps(&out[i + 4], _mm_mul_ps(_mm_cvtepi32_ps(hi), scale));
+    }
+#elif defined(HAVE_NEON_KERNELS)
+    for (; i + 8 <= sampleCount; i += 8) {
+        int16x8_t samples = vld1q_s16(&in[i]);
+        float32x4_t lo = vcvtq_f32_s32(vmovl_s16(vget_low_s16(samples)));
+        float32x4_t hi = vcvtq_f32_s32(vmovl_s16(vget_high_s16(samples)));
+        vst1q_f32(&out[i], vmulq_n_f32(lo, 1.0f / 32768.0f));
+        vst1q_f32(&out[i + 4], vmulq_n_f32(hi, 1.0f / 32768.0f));
+    }
+#endif
+
+    for (; i < sampleCount; i++) {
+        out[i] = in[i] / 32768.0f;
+    }
+}
+
+void PcmConvert::downmixToStereo(const float* in, float* out, int channelCount, int frameCount)
+{
+    SDL_assert(channelCount == 6 || channelCount == 8);
+
+    // Normalize so a full scale signal on every channel doesn't clip
+    float norm = 1.0f / (1.0f + DOWNMIX_MIX_LEVEL * (channelCount == 8 ? 3 : 2));
+    float front = norm;
+    float mix = DOWNMIX_MIX_LEVEL * norm;
+
+    // FL,FR,C,LFE,RL,RR,SL,SR
+    const float leftCoeffs[8] = { front, 0, mix, 0, mix, 0, mix, 0 };
+    const float rightCoeffs[8] = { 0, front, mix, 0, 0, mix, 0, mix };
+
+    mixToStereo(in, out, channelCount, frameCount, leftCoeffs, rightCoeffs);
+}
+
+void PcmConvert::mixToStereo(const float* in, float* out, int channelCount, int frameCount,
+                             const float leftCoeffs[8], const float rightCoeffs[8])
+{
+    SDL_assert(channelCount == 6 || channelCount == 8);
+
+    // Every output frame is written at or before the input frame that it was
+    // read from, so mixing in place is safe as long as we load first.
+#if defined(HAVE_SSE2_KERNELS)
+    const __m128 kLeftLo = _mm_loadu_ps(leftCoeffs);
+    const __m128 kLeftHi = _mm_loadu_ps(&leftCoeffs[4]);
+    const __m128 kRightLo = _mm_loadu_ps(rightCoeffs);
+    const __m128 kRightHi = _mm_loadu_ps(&rightCoeffs[4]);
+
+    for (int i = 0; i < frameCount; i++) {
+        const float* frame = &in[i * channelCount];
+        __m128 lo = _mm_loadu_ps(frame);
+        __m128 hi = channelCount == 8 ?
+                    _mm_loadu_ps(&frame[4]) :
+                    _mm_loadl_pi(_mm_setzero_ps(), (const __m64*)&frame[4]);
+
+        __m128 left = _mm_add_ps(_mm_mul_ps(lo, kLeftLo), _mm_mul_ps(hi, kLeftHi));
+        __m128 right = _mm_add_ps(_mm_mul_ps(lo, kRightLo), _mm_mul_ps(hi, kRightHi));
+
+        // Horizontal sums without SSE3: [L0+L2, R0+R2, L1+L3, R1+R3] then fold the halves
+        __m128 sums = _mm_add_ps(_mm_unpacklo_ps(left, right), _mm_unpackhi_ps(left, right));
+        sums = _mm_add_ps(sums, _mm_movehl_ps(sums, sums));
+        _mm_storel_pi((__m64*)&out[i * 2], sums);
+    }
+#elif defined(HAVE_NEON_KERNELS)
+    const float32x4_t kLeftLo = vld1q_f32(leftCoeffs);
+    const float32x4_t kLeftHi = vld1q_f32(&leftCoeffs[4]);
+    const float32x4_t kRightLo = vld1q_f32(rightCoeffs);
+    const float32x4_t kRightHi = vld1q_f32(&rightCoeffs[4]);
+
+    for (int i = 0; i < frameCount; i++) {
+        const float* frame = &in[i * channelCount];
+        float32x4_t lo = vld1q_f32(frame);
+        float32x4_t hi = channelCount == 8 ?
+                         vld1q_f32(&frame[4]) :
+                         vcombine_f32(vld1_f32(&frame[4]), vdup_n_f32(0));
+
+        float32x4_t left = vmlaq_f32(vmulq_f32(lo, kLeftLo), hi, kLeftHi);
+        float32x4_t right = vmlaq_f32(vmulq_f32(lo, kRightLo), hi, kRightHi);
+
+        // Pairwise adds work on ARMv7 too, unlike vaddvq_f32()
+        float32x2_t leftPairs = vpadd_f32(vget_low_f32(left), vget_high_f32(left));
+        float32x2_t rightPairs = vpadd_f32(vget_low_f32(right), vget_high_f32(right));
+        vst1_f32(&out[i * 2], vpadd_f32(leftPairs, rightPairs));
+    }
+#else
+    for (int i = 0; i < frameCount; i++) {
+        const float* frame = &in[i * channelCount];
+        float left = 0, right = 0;
+
+        for (int ch = 0; ch < channelCount; ch++) {
+            left += frame[ch] * leftCoeffs[ch];
+            right += frame[ch] * rightCoeffs[ch];
+        }
+
+        out[i * 2] = left;
+        out[i * 2 + 1] = right;
+    }
+#endif
+}
@@ -0,0 +1,29 @@
+#pragma once
+
+#include "SDL_compat.h"
+
+// SSE2/NEON kernels for the PCM processing that renderers do themselves
+// after Opus decoding. Channel reordering doesn't need a kernel, since the
+// Opus multistream mapping can already decode into any channel order (see
+// IAudioRenderer::remapChannels()).
+class PcmConvert
+{
+public:
+    // Converts samples in [-1.0, 1.0] to 16-bit, saturating anything outside that range
+    static void floatToS16(const float* in, int16_t* out, int sampleCount);
+
+    static void s16ToFloat(const int16_t* in, float* out, int sampleCount);
+
+    // Downmixes interleaved audio in Moonlight's channel order
+    // (FL,FR,C,LFE,RL,RR,SL,SR) to stereo using ITU-R BS.775 coefficients.
+    // The LFE channel is dropped. Only 6 and 8 channels are supported.
+    // in and out may point to the same buffer.
+    static void downmixToStereo(const float* in, float* out, int channelCount, int frameCount);
+
+    // Mixes interleaved 6 or 8 channel audio to stereo using a coefficient
+    // per input channel for each output. Coefficients for the 7th and 8th
+    // channels are ignored for 6 channel audio. in and out may point to the
+    // same buffer.
+    static void mixToStereo(const float* in, float* out, int channelCount, int frameCount,
+                            const float leftCoeffs[8], const float rightCoeffs[8]);
+};
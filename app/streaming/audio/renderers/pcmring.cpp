@@ -0,0 +1,103 @@
+#include "pcmring.h"
+
+PcmRing::PcmRing()
+    : m_Buffer(nullptr),
+      m_Capacity(0),
+      m_LastDelayBytes(0),
+      m_Refilling(false)
+{
+    SDL_AtomicSet(&m_WritePos, 0);
+    SDL_AtomicSet(&m_ReadPos, 0);
+    SDL_AtomicSet(&m_DelayBytes, 0);
+}
+
+PcmRing::~PcmRing()
+{
+    SDL_free(m_Buffer);
+}
+
+bool PcmRing::initialize(int capacityBytes)
+{
+    SDL_assert(m_Buffer == nullptr);
+
+    m_Capacity = 1;
+    while (m_Capacity < capacityBytes) {
+        m_Capacity <<= 1;
+    }
+
+    m_Buffer = (Uint8*)SDL_malloc(m_Capacity);
+    if (m_Buffer == nullptr) {
+        SDL_LogError(SDL_LOG_CATEGORY_APPLICATION,
+                     "Failed to allocate %d byte audio ring",
+                     m_Capacity);
+        return false;
+    }
+
+    return true;
+}
+
+int PcmRing::getQueuedBytes()
+{
+    return (int)((unsigned int)SDL_AtomicGet(&m_WritePos) - (unsigned int)SDL_AtomicGet(&m_ReadPos));
+}
+
+void PcmRing::setDelayBytes(int bytes)
+{
+    SDL_AtomicSet(&m_DelayBytes, SDL_min(bytes, m_Capacity / 2));
+}
+
+int PcmRing::getDelayBytes()
+{
+    return SDL_AtomicGet(&m_DelayBytes);
+}
+
+bool PcmRing::write(const void* data, int bytes)
+{
+    unsigned int writePos = (unsigned int)SDL_AtomicGet(&m_WritePos);
+
+    if (getQueuedBytes() + bytes > m_Capacity) {
+        return false;
+    }
+
+    int offset = writePos & (m_Capacity - 1);
+    int firstChunk = SDL_min(bytes, m_Capacity - offset);
+    SDL_memcpy(m_Buffer + offset, data, firstChunk);
+    SDL_memcpy(m_Buffer, (const Uint8*)data + firstChunk, bytes - firstChunk);
+
+    // Make sure the data is visible before the consumer sees the new position
+    SDL_MemoryBarrierRelease();
+    SDL_AtomicSet(&m_WritePos, (int)(writePos + bytes));
+    return true;
+}
+
+int PcmRing::read(void* data, int bytes)
+{
+    unsigned int readPos = (unsigned int)SDL_AtomicGet(&m_ReadPos);
+
+    // Hold off on reading to let the queue grow when the delay increases.
+    // Decreases are handled by the producer dropping data.
+    int delayBytes = SDL_AtomicGet(&m_DelayBytes);
+    if (delayBytes > m_LastDelayBytes) {
+        m_Refilling = true;
+    }
+    m_LastDelayBytes = delayBytes;
+    if (m_Refilling) {
+        if (getQueuedBytes() < delayBytes + bytes) {
+            return 0;
+        }
+        m_Refilling = false;
+    }
+
+    bytes = SDL_min(bytes, getQueuedBytes());
+    SDL_MemoryBarrierAcquire();
+
+    int offset = readPos & (m_Capacity - 1);
+    int firstChunk = SDL_min(bytes, m_Capacity - offset);
+    SDL_memcpy(data, m_Buffer + offset, firstChunk);
+    SDL_memcpy((Uint8*)data + firstChunk, m_Buffer, bytes - firstChunk);
+
+    // Don't let the producer overwrite this region until we're done copying
+    SDL_MemoryBarrierRelease();
+    SDL_AtomicSet(&m_ReadPos, (int)(readPos + bytes));
+    return bytes;
+}
@@ -0,0 +1,48 @@
+#pragma once
+
+#include "SDL_compat.h"
+
+// Lock-free single-producer, single-consumer byte ring for handing decoded
+// PCM from the audio decoder thread to a native audio backend's realtime
+// callback. The callback must never block, so it reads whatever is queued
+// and the caller fills the remainder with silence.
+class PcmRing
+{
+public:
+    PcmRing();
+
+    ~PcmRing();
+
+    // Capacity is rounded up to a power of 2
+    bool initialize(int capacityBytes);
+
+    // Called by the producer. Returns false without writing anything if
+    // there isn't enough room for the entire buffer.
+    bool write(const void* data, int bytes);
+
+    // Called by the consumer. Returns the number of bytes read.
+    int read(void* data, int bytes);
+
+    // Callable from either side
+    int getQueuedBytes();
+
+    // Called by the producer. After the delay increases, the consumer reads
+    // nothing until this many bytes are queued beyond the current read.
+    void setDelayBytes(int bytes);
+
+    int getDelayBytes();
+
+private:
+    Uint8* m_Buffer;
+    int m_Capacity;
+
+    // Both positions only ever increase and are allowed to wrap
+    SDL_atomic_t m_WritePos;
+    SDL_atomic_t m_ReadPos;
+
+    SDL_atomic_t m_DelayBytes;
+
+    // Only touched by the consumer
+    int m_LastDelayBytes;
+    bool m_Refilling;
+};
@@ -0,0 +1,48 @@
+#pragma once
+
+#include "renderer.h"
+#include "pcmring.h"
+
+#include <pipewire/pipewire.h>
+
+// Plays audio through a PipeWire stream that requests a graph quantum of
+// one Opus frame, instead of going through SDL and the PulseAudio
+// compatibility layer. The quantum can be overridden with AUDIO_PIPEWIRE_QUANTUM.
+class PipeWireAudioRenderer : public IAudioRenderer
+{
+public:
+    PipeWireAudioRenderer();
+
+    virtual ~PipeWireAudioRenderer();
+
+    virtual bool prepareForPlayback(const OPUS_MULTISTREAM_CONFIGURATION* opusConfig);
+
+    virtual void* getAudioBuffer(int* size);
+
+    virtual bool submitAudio(int bytesWritten);
+
+    virtual AudioFormat getAudioBufferFormat();
+
+    virtual bool getAudioLatency(uint32_t* latencyMs, uint32_t* targetLatencyMs);
+
+    virtual bool setAudioDelay(uint32_t delayMs);
+
+private:
+    static void onProcess(void* context);
+
+    static void onStateChanged(void* context, enum pw_stream_state oldState,
+                               enum pw_stream_state state, const char* error);
+
+    static const struct pw_stream_events k_StreamEvents;
+
+    struct pw_thread_loop* m_Loop;
+    struct pw_stream* m_Stream;
+    int m_FrameSize;
+    int m_BytesPerSampleFrame;
+    int m_MaxQueuedBytes;
+    int m_SampleRate;
+    int m_QuantumUs;
+    void* m_AudioBuffer;
+    PcmRing m_Ring;
+    SDL_atomic_t m_StreamState;
+};
@@ -0,0 +1,290 @@
+#include "pipewire.h"
+
+#include <Limelight.h>
+
+#include <spa/param/audio/format-utils.h>
+
+// How long to wait for the stream to connect to the PipeWire daemon
+#define PIPEWIRE_CONNECT_TIMEOUT_SEC 2
+
+const struct pw_stream_events PipeWireAudioRenderer::k_StreamEvents = []() {
+    struct pw_stream_events events = {};
+    events.version = PW_VERSION_STREAM_EVENTS;
+    events.state_changed = onStateChanged;
+    events.process = onProcess;
+    return events;
+}();
+
+PipeWireAudioRenderer::PipeWireAudioRenderer()
+    : m_Loop(nullptr),
+      m_Stream(nullptr),
+      m_FrameSize(0),
+      m_BytesPerSampleFrame(0),
+      m_MaxQueuedBytes(0),
+      m_SampleRate(0),
+      m_QuantumUs(0),
+      m_AudioBuffer(nullptr)
+{
+    SDL_AtomicSet(&m_StreamState, PW_STREAM_STATE_UNCONNECTED);
+
+    pw_init(nullptr, nullptr);
+}
+
+PipeWireAudioRenderer::~PipeWireAudioRenderer()
+{
+    if (m_Loop != nullptr) {
+        // Stop the loop first so no callbacks run while we tear down the stream
+        pw_thread_loop_stop(m_Loop);
+    }
+
+    if (m_Stream != nullptr) {
+        pw_stream_destroy(m_Stream);
+    }
+
+    if (m_Loop != nullptr) {
+        pw_thread_loop_destroy(m_Loop);
+    }
+
+    SDL_free(m_AudioBuffer);
+
+    pw_deinit();
+}
+
+bool PipeWireAudioRenderer::prepareForPlayback(const OPUS_MULTISTREAM_CONFIGURATION* opusConfig)
+{
+    struct spa_audio_info_raw info = {};
+    info.format = SPA_AUDIO_FORMAT_F32;
+    info.rate = opusConfig->sampleRate;
+    info.channels = opusConfig->channelCount;
+
+    // These match the channel order of Moonlight's Opus streams
+    switch (opusConfig->channelCount) {
+    case 8:
+        info.position[6] = SPA_AUDIO_CHANNEL_SL;
+        info.position[7] = SPA_AUDIO_CHANNEL_SR;
+        // fall-through
+    case 6:
+        info.position[2] = SPA_AUDIO_CHANNEL_FC;
+        info.position[3] = SPA_AUDIO_CHANNEL_LFE;
+        info.position[4] = SPA_AUDIO_CHANNEL_RL;
+        info.position[5] = SPA_AUDIO_CHANNEL_RR;
+        // fall-through
+    case 2:
+        info.position[0] = SPA_AUDIO_CHANNEL_FL;
+        info.position[1] = SPA_AUDIO_CHANNEL_FR;
+        break;
+    default:
+        SDL_LogError(SDL_LOG_CATEGORY_APPLICATION,
+                     "Unsupported audio channel count: %d",
+                     opusConfig->channelCount);
+        return false;
+    }
+
+    m_SampleRate = opusConfig->sampleRate;
+    m_BytesPerSampleFrame = opusConfig->channelCount * getAudioBufferSampleSize();
+    m_FrameSize = opusConfig->samplesPerFrame * m_BytesPerSampleFrame;
+
+    bool ok;
+    int quantum = qEnvironmentVariableIntValue("AUDIO_PIPEWIRE_QUANTUM", &ok);
+    if (!ok || quantum <= 0) {
+        quantum = opusConfig->samplesPerFrame;
+    }
+    m_QuantumUs = (int)((uint64_t)quantum * 1000000 / opusConfig->sampleRate);
+
+    // The graph pulls a whole quantum at a time, so allow one Opus
+    // frame on top of that before we start dropping.
+    m_MaxQueuedBytes = SDL_max(2 * m_FrameSize, m_FrameSize + quantum * m_BytesPerSampleFrame);
+
+    // Leave room in the ring for A/V sync delay too
+    int maxDelayBytes = MAX_AUDIO_DELAY_MS * m_SampleRate / 1000 * m_BytesPerSampleFrame;
+    m_AudioBuffer = SDL_malloc(m_FrameSize);
+    if (m_AudioBuffer == nullptr || !m_Ring.initialize((m_MaxQueuedBytes + maxDelayBytes) * 2)) {
+        return false;
+    }
+
+    m_Loop = pw_thread_loop_new("Moonlight Audio", nullptr);
+    if (m_Loop == nullptr) {
+        SDL_LogError(SDL_LOG_CATEGORY_APPLICATION,
+                     "pw_thread_loop_new() failed");
+        return false;
+    }
+
+    struct pw_properties* props = pw_properties_new(PW_KEY_MEDIA_TYPE, "Audio",
+                                                    PW_KEY_MEDIA_CATEGORY, "Playback",
+                                                    PW_KEY_MEDIA_ROLE, "Game",
+                                                    nullptr);
+    pw_properties_setf(props, PW_KEY_NODE_LATENCY, "%d/%d", quantum, opusConfig->sampleRate);
+#ifdef PW_KEY_NODE_RATE
+    // Ask the graph to run at our rate so we aren't resampled
+    pw_properties_setf(props, PW_KEY_NODE_RATE, "1/%d", opusConfig->sampleRate);
+#endif
+
+    if (pw_thread_loop_start(m_Loop) < 0) {
+        SDL_LogError(SDL_LOG_CATEGORY_APPLICATION,
+                     "pw_thread_loop_start() failed");
+        pw_properties_free(props);
+        return false;
+    }
+
+    pw_thread_loop_lock(m_Loop);
+
+    // This takes ownership of props
+    m_Stream = pw_stream_new_simple(pw_thread_loop_get_loop(m_Loop),
+                                    "Moonlight",
+                                    props,
+                                    &k_StreamEvents,
+                                    this);
+    if (m_Stream == nullptr) {
+        pw_thread_loop_unlock(m_Loop);
+        SDL_LogError(SDL_LOG_CATEGORY_APPLICATION,
+                     "pw_stream_new_simple() failed");
+        return false;
+    }
+
+    uint8_t podBuffer[1024];
+    struct spa_pod_builder builder = SPA_POD_BUILDER_INIT(podBuffer, sizeof(podBuffer));
+    const struct spa_pod* params[1];
+    params[0] = spa_format_audio_raw_build(&builder, SPA_PARAM_EnumFormat, &info);
+
+    int err = pw_stream_connect(m_Stream,
+                                PW_DIRECTION_OUTPUT,
+                                PW_ID_ANY,
+                                (enum pw_stream_flags)(PW_STREAM_FLAG_AUTOCONNECT |
+                                                       PW_STREAM_FLAG_MAP_BUFFERS |
+                                                       PW_STREAM_FLAG_RT_PROCESS),
+                                params, 1);
+    if (err < 0) {
+        pw_thread_loop_unlock(m_Loop);
+        SDL_LogError(SDL_LOG_CATEGORY_APPLICATION,
+                     "pw_stream_connect() failed: %d",
+                     err);
+        return false;
+    }
+
+    // Wait until we're linked to a sink or we know that we won't be
+    while (SDL_AtomicGet(&m_StreamState) == PW_STREAM_STATE_CONNECTING ||
+           SDL_AtomicGet(&m_StreamState) == PW_STREAM_STATE_UNCONNECTED) {
+        if (pw_thread_loop_timed_wait(m_Loop, PIPEWIRE_CONNECT_TIMEOUT_SEC) != 0) {
+            break;
+        }
+    }
+
+    int state = SDL_AtomicGet(&m_StreamState);
+    pw_thread_loop_unlock(m_Loop);
+
+    if (state != PW_STREAM_STATE_PAUSED && state != PW_STREAM_STATE_STREAMING) {
+        SDL_LogError(SDL_LOG_CATEGORY_APPLICATION,
+                     "PipeWire stream failed to connect (state: %s)",
+                     pw_stream_state_as_string((enum pw_stream_state)state));
+        return false;
+    }
+
+    SDL_LogInfo(SDL_LOG_CATEGORY_APPLICATION,
+                "PipeWire stream requested quantum: %d samples (%.1f ms)",
+                quantum,
+                m_QuantumUs / 1000.0);
+
+    return true;
+}
+
+void PipeWireAudioRenderer::onStateChanged(void* context, enum pw_stream_state,
+                                           enum pw_stream_state state, const char* error)
+{
+    auto me = (PipeWireAudioRenderer*)context;
+
+    if (state == PW_STREAM_STATE_ERROR) {
+        SDL_LogError(SDL_LOG_CATEGORY_APPLICATION,
+                     "PipeWire stream error: %s",
+                     error ? error : "unknown");
+    }
+
+    SDL_AtomicSet(&me->m_StreamState, state);
+    pw_thread_loop_signal(me->m_Loop, false);
+}
+
+void PipeWireAudioRenderer::onProcess(void* context)
+{
+    auto me = (PipeWireAudioRenderer*)context;
+
+    struct pw_buffer* buffer = pw_stream_dequeue_buffer(me->m_Stream);
+    if (buffer == nullptr) {
+        return;
+    }
+
+    struct spa_data* data = &buffer->buffer->datas[0];
+    if (data->data != nullptr) {
+        uint32_t frames = data->maxsize / me->m_BytesPerSampleFrame;
+#if PW_CHECK_VERSION(0, 3, 49)
+        if (buffer->requested != 0) {
+            frames = SDL_min(frames, (uint32_t)buffer->requested);
+        }
+#endif
+
+        // Fill in silence if the decoder hasn't caught up
+        int bytes = frames * me->m_BytesPerSampleFrame;
+        int bytesRead = me->m_Ring.read(data->data, bytes);
+        SDL_memset((Uint8*)data->data + bytesRead, 0, bytes - bytesRead);
+
+        data->chunk->offset = 0;
+        data->chunk->stride = me->m_BytesPerSampleFrame;
+        data->chunk->size = bytes;
+    }
+
+    pw_stream_queue_buffer(me->m_Stream, buffer);
+}
+
+void* PipeWireAudioRenderer::getAudioBuffer(int* size)
+{
+    SDL_assert(*size <= m_FrameSize);
+    *size = m_FrameSize;
+    return m_AudioBuffer;
+}
+
+bool PipeWireAudioRenderer::submitAudio(int bytesWritten)
+{
+    // PipeWire moves the stream between sinks on its own, so we only
+    // need to recreate the renderer if the stream itself has failed.
+    int state = SDL_AtomicGet(&m_StreamState);
+    if (state == PW_STREAM_STATE_ERROR || state == PW_STREAM_STATE_UNCONNECTED) {
+        return false;
+    }
+
+    if (bytesWritten == 0) {
+        // Nothing to do
+        return true;
+    }
+
+    // Don't let latency build up if the graph is consuming slower than we produce
+    // or if there's already more than 30 ms of audio data waiting in Moonlight's
+    // audio queue.
+    if (m_Ring.getQueuedBytes() + bytesWritten > m_MaxQueuedBytes + m_Ring.getDelayBytes() || LiGetPendingAudioDuration() > 30) {
+        return true;
+    }
+
+    m_Ring.write(m_AudioBuffer, bytesWritten);
+    return true;
+}
+
+bool PipeWireAudioRenderer::getAudioLatency(uint32_t* latencyMs, uint32_t* targetLatencyMs)
+{
+    int queuedUs = (int)((int64_t)m_Ring.getQueuedBytes() / m_BytesPerSampleFrame * 1000000 / m_SampleRate);
+    int frameUs = (int)((int64_t)m_FrameSize / m_BytesPerSampleFrame * 1000000 / m_SampleRate);
+    int delayUs = (int)((int64_t)m_Ring.getDelayBytes() / m_BytesPerSampleFrame * 1000000 / m_SampleRate);
+
+    *latencyMs = (queuedUs + m_QuantumUs) / 1000;
+    *targetLatencyMs = (frameUs + delayUs + m_QuantumUs) / 1000;
+    return true;
+}
+
+bool PipeWireAudioRenderer::setAudioDelay(uint32_t delayMs)
+{
+    // Keep the delay aligned to whole sample frames
+    int delayFrames = (int)SDL_min(delayMs, (uint32_t)MAX_AUDIO_DELAY_MS) * m_SampleRate / 1000;
+    m_Ring.setDelayBytes(delayFrames * m_BytesPerSampleFrame);
+    return true;
+}
+
+IAudioRenderer::AudioFormat PipeWireAudioRenderer::getAudioBufferFormat()
+{
+    return AudioFormat::Float32NE;
+}
@@ -3,6 +3,9 @@
 #include <Limelight.h>
 #include <QtGlobal>
 
+// The most latency that setAudioDelay() can add
+#define MAX_AUDIO_DELAY_MS 200
+
 class IAudioRenderer
 {
 public:
@@ -31,6 +34,22 @@ public:
     };
     virtual AudioFormat getAudioBufferFormat() = 0;
 
+    // Return false if the renderer doesn't track its playback latency
+    virtual bool getAudioLatency(uint32_t* /* latencyMs */, uint32_t* /* targetLatencyMs */) {
+        return false;
+    }
+
+    // Return false if the renderer doesn't detect underruns
+    virtual bool getUnderrunCount(uint32_t* /* underruns */) {
+        return false;
+    }
+
+    // Adds latency to audio playback to line it up with video. Renderers may
+    // apply the new delay gradually. Return false if this isn't supported.
+    virtual bool setAudioDelay(uint32_t /* delayMs */) {
+        return false;
+    }
+
     int getAudioBufferSampleSize() {
         switch (getAudioBufferFormat()) {
         case IAudioRenderer::AudioFormat::Sint16NE:
@@ -18,8 +18,13 @@ public:
 
     virtual AudioFormat getAudioBufferFormat();
 
+    virtual bool getAudioLatency(uint32_t* latencyMs, uint32_t* targetLatencyMs);
+
 private:
     SDL_AudioDeviceID m_AudioDevice;
     void* m_AudioBuffer;
     int m_FrameSize;
+    int m_BytesPerSampleFrame;
+    int m_SampleRate;
+    int m_DeviceBufferSamples;
 };
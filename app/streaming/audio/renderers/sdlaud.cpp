@@ -32,9 +32,9 @@ bool SdlAudioRenderer::prepareForPlayback(const OPUS_MULTISTREAM_CONFIGURATION*
     // The buffering helps avoid audio underruns due to network jitter.
     want.samples = SDL_max(480, opusConfig->samplesPerFrame * 3);
 
-    m_FrameSize = opusConfig->samplesPerFrame *
-                  opusConfig->channelCount *
-                  getAudioBufferSampleSize();
+    m_BytesPerSampleFrame = opusConfig->channelCount * getAudioBufferSampleSize();
+    m_FrameSize = opusConfig->samplesPerFrame * m_BytesPerSampleFrame;
+    m_SampleRate = opusConfig->sampleRate;
 
     m_AudioDevice = SDL_OpenAudioDevice(NULL, 0, &want, &have, 0);
     if (m_AudioDevice == 0) {
@@ -56,6 +56,8 @@ bool SdlAudioRenderer::prepareForPlayback(const OPUS_MULTISTREAM_CONFIGURATION*
                 want.samples,
                 want.samples * want.channels * getAudioBufferSampleSize());
 
+    m_DeviceBufferSamples = have.samples;
+
     SDL_LogInfo(SDL_LOG_CATEGORY_APPLICATION,
                 "Obtained audio buffer: %u samples (%u bytes)",
                 have.samples,
@@ -132,6 +134,17 @@ bool SdlAudioRenderer::submitAudio(int bytesWritten)
     return true;
 }
 
+bool SdlAudioRenderer::getAudioLatency(uint32_t* latencyMs, uint32_t* targetLatencyMs)
+{
+    // SDL converts as it dequeues, so the queue is still in our sample format
+    int queuedSamples = SDL_GetQueuedAudioSize(m_AudioDevice) / m_BytesPerSampleFrame;
+    int frameSamples = m_FrameSize / m_BytesPerSampleFrame;
+
+    *latencyMs = (uint32_t)((int64_t)(queuedSamples + m_DeviceBufferSamples) * 1000 / m_SampleRate);
+    *targetLatencyMs = (uint32_t)((int64_t)(frameSamples + m_DeviceBufferSamples) * 1000 / m_SampleRate);
+    return true;
+}
+
 IAudioRenderer::AudioFormat SdlAudioRenderer::getAudioBufferFormat()
 {
     return AudioFormat::Float32NE;
@@ -0,0 +1,95 @@
+#pragma once
+
+#include "renderer.h"
+#include "SDL_compat.h"
+
+// Must be a power of 2
+#define SDL_PULL_AUDIO_SLOTS 32
+
+// Don't let more than this many frames build up in the ring
+#define SDL_PULL_AUDIO_MAX_QUEUED_FRAMES 24
+
+// 7.1 surround
+#define SDL_PULL_AUDIO_MAX_CHANNELS 8
+
+// Plays audio from SDL's audio callback instead of SDL_QueueAudio(). Opus
+// decodes directly into a single-producer, single-consumer ring of frame
+// slots, which the callback drains on SDL's audio thread. The decoder thread
+// never blocks waiting for the device.
+//
+// The ring doubles as an adaptive jitter buffer. The target depth follows
+// the measured packet arrival jitter, and the callback resamples by a small
+// fraction of a percent to steer the ring towards the target. This absorbs
+// clock drift between the host and client without dropping or repeating
+// frames. AUDIO_MIN_LATENCY_MS and AUDIO_MAX_LATENCY_MS bound the target.
+class SdlPullAudioRenderer : public IAudioRenderer
+{
+public:
+    SdlPullAudioRenderer();
+
+    virtual ~SdlPullAudioRenderer();
+
+    virtual bool prepareForPlayback(const OPUS_MULTISTREAM_CONFIGURATION* opusConfig);
+
+    virtual void* getAudioBuffer(int* size);
+
+    virtual bool submitAudio(int bytesWritten);
+
+    virtual AudioFormat getAudioBufferFormat();
+
+    virtual bool getAudioLatency(uint32_t* latencyMs, uint32_t* targetLatencyMs);
+
+    virtual bool getUnderrunCount(uint32_t* underruns);
+
+    virtual bool setAudioDelay(uint32_t delayMs);
+
+private:
+    static void SDLCALL audioCallback(void* userdata, Uint8* stream, int len);
+
+    void updateJitter();
+
+    int getBufferedBytes(int readIndex);
+
+    bool readSampleFrame(float* frame);
+
+    SDL_AudioDeviceID m_AudioDevice;
+    int m_FrameSize;
+    int m_Channels;
+    int m_SampleRate;
+    int m_FrameDurationUs;
+    int m_DevicePeriodUs;
+    int m_MinTargetUs;
+    int m_MaxTargetUs;
+
+    // Each slot holds one decoded frame of m_FrameSize bytes or less.
+    // Slots are written by the decoder thread at m_WriteIndex and read by
+    // the audio callback at m_ReadIndex. Both indices only ever increase.
+    Uint8* m_Slots;
+    int m_SlotBytes[SDL_PULL_AUDIO_SLOTS];
+    SDL_atomic_t m_WriteIndex;
+    SDL_atomic_t m_ReadIndex;
+    int m_ReadOffset; // Only touched by the audio callback
+
+    // Frames are decoded here and discarded when we're too far behind
+    void* m_DropBuffer;
+    bool m_Dropping;
+
+    // Jitter tracking state, only touched by the decoder thread
+    uint64_t m_LastArrivalUs;
+    double m_PeakJitterUs;
+    int m_AudioDelayUs;
+
+    // Published by the decoder thread for the audio callback
+    SDL_atomic_t m_TargetLatencyUs;
+
+    // Resampler state, only touched by the audio callback
+    float m_PrevFrame[SDL_PULL_AUDIO_MAX_CHANNELS];
+    float m_NextFrame[SDL_PULL_AUDIO_MAX_CHANNELS];
+    double m_Phase;
+    bool m_Playing;
+    double m_SmoothedBufferedUs;
+
+    // Published by the audio callback for stats
+    SDL_atomic_t m_LatencyUs;
+    SDL_atomic_t m_Underruns;
+};
@@ -0,0 +1,352 @@
+#include "sdlpull.h"
+
+#include <Limelight.h>
+
+#define DEFAULT_MIN_LATENCY_MS 10
+#define DEFAULT_MAX_LATENCY_MS 60
+
+// The peak jitter estimate decays by this fraction of the frame duration per frame,
+// which takes about 10 seconds for a 30 ms spike to fade on a clean network
+#define JITTER_DECAY 0.003
+
+// Arrival gaps longer than this are a stall or mute, not jitter
+#define JITTER_RESET_US 500000
+
+// Largest playback rate change used to steer the ring towards its target.
+// 0.25% is about 4 cents of pitch and still corrects ~2500 ppm of clock drift.
+#define RESAMPLE_MAX_ADJUST 0.0025
+
+// Playback rate change per microsecond of error from the target depth.
+// The maximum adjustment is reached 10 ms away from the target.
+#define RESAMPLE_GAIN (RESAMPLE_MAX_ADJUST / 10000.0)
+
+SdlPullAudioRenderer::SdlPullAudioRenderer()
+    : m_AudioDevice(0),
+      m_FrameSize(0),
+      m_Channels(0),
+      m_SampleRate(0),
+      m_FrameDurationUs(0),
+      m_DevicePeriodUs(0),
+      m_MinTargetUs(0),
+      m_MaxTargetUs(0),
+      m_Slots(nullptr),
+      m_ReadOffset(0),
+      m_DropBuffer(nullptr),
+      m_Dropping(false),
+      m_LastArrivalUs(0),
+      m_PeakJitterUs(0),
+      m_AudioDelayUs(0),
+      m_Phase(0),
+      m_Playing(false),
+      m_SmoothedBufferedUs(0)
+{
+    SDL_zero(m_SlotBytes);
+    SDL_zero(m_PrevFrame);
+    SDL_zero(m_NextFrame);
+    SDL_AtomicSet(&m_WriteIndex, 0);
+    SDL_AtomicSet(&m_ReadIndex, 0);
+    SDL_AtomicSet(&m_TargetLatencyUs, 0);
+    SDL_AtomicSet(&m_LatencyUs, 0);
+    SDL_AtomicSet(&m_Underruns, 0);
+
+    SDL_assert(!SDL_WasInit(SDL_INIT_AUDIO));
+
+    if (SDL_InitSubSystem(SDL_INIT_AUDIO) != 0) {
+        SDL_LogError(SDL_LOG_CATEGORY_APPLICATION,
+                     "SDL_InitSubSystem(SDL_INIT_AUDIO) failed: %s",
+                     SDL_GetError());
+        SDL_assert(SDL_WasInit(SDL_INIT_AUDIO));
+    }
+}
+
+bool SdlPullAudioRenderer::prepareForPlayback(const OPUS_MULTISTREAM_CONFIGURATION* opusConfig)
+{
+    SDL_AudioSpec want, have;
+
+    if (opusConfig->channelCount > SDL_PULL_AUDIO_MAX_CHANNELS) {
+        SDL_LogError(SDL_LOG_CATEGORY_APPLICATION,
+                     "Unsupported audio channel count: %d",
+                     opusConfig->channelCount);
+        return false;
+    }
+
+    m_Channels = opusConfig->channelCount;
+    m_SampleRate = opusConfig->sampleRate;
+    m_FrameSize = opusConfig->samplesPerFrame *
+                  opusConfig->channelCount *
+                  getAudioBufferSampleSize();
+    m_FrameDurationUs = (int)((uint64_t)opusConfig->samplesPerFrame * 1000000 / opusConfig->sampleRate);
+
+    // Leave room above the target for bursts to land in the ring
+    bool ok;
+    int minLatencyMs = qEnvironmentVariableIntValue("AUDIO_MIN_LATENCY_MS", &ok);
+    if (!ok || minLatencyMs <= 0) {
+        minLatencyMs = DEFAULT_MIN_LATENCY_MS;
+    }
+    int maxLatencyMs = qEnvironmentVariableIntValue("AUDIO_MAX_LATENCY_MS", &ok);
+    if (!ok || maxLatencyMs <= 0) {
+        maxLatencyMs = DEFAULT_MAX_LATENCY_MS;
+    }
+    m_MaxTargetUs = SDL_min(maxLatencyMs * 1000, (SDL_PULL_AUDIO_MAX_QUEUED_FRAMES / 2) * m_FrameDurationUs);
+    m_MinTargetUs = SDL_min(minLatencyMs * 1000, m_MaxTargetUs);
+    SDL_AtomicSet(&m_TargetLatencyUs, m_MinTargetUs);
+
+    // Allocate the ring before the callback can start running
+    m_Slots = (Uint8*)SDL_malloc(m_FrameSize * SDL_PULL_AUDIO_SLOTS);
+    m_DropBuffer = SDL_malloc(m_FrameSize);
+    if (m_Slots == nullptr || m_DropBuffer == nullptr) {
+        SDL_LogError(SDL_LOG_CATEGORY_APPLICATION,
+                     "Failed to allocate audio ring");
+        return false;
+    }
+
+    SDL_zero(want);
+    want.freq = opusConfig->sampleRate;
+    want.format = AUDIO_F32SYS;
+    want.channels = opusConfig->channelCount;
+    want.callback = audioCallback;
+    want.userdata = this;
+
+    // The ring absorbs network jitter, so the device buffer only needs to hold
+    // a single period. We still impose a floor of 480 samples (10 ms) because
+    // smaller values can cause underruns for other PulseAudio clients sharing
+    // this output device.
+    want.samples = SDL_max(480, opusConfig->samplesPerFrame);
+
+    // Resampling in the callback requires that SDL doesn't change the format on us
+    m_AudioDevice = SDL_OpenAudioDevice(NULL, 0, &want, &have, 0);
+    if (m_AudioDevice == 0) {
+        SDL_LogError(SDL_LOG_CATEGORY_APPLICATION,
+                     "Failed to open audio device: %s",
+                     SDL_GetError());
+        return false;
+    }
+
+    m_DevicePeriodUs = (int)((uint64_t)have.samples * 1000000 / have.freq);
+
+    SDL_LogInfo(SDL_LOG_CATEGORY_APPLICATION,
+                "Desired audio buffer: %u samples (%u bytes)",
+                want.samples,
+                want.samples * want.channels * getAudioBufferSampleSize());
+
+    SDL_LogInfo(SDL_LOG_CATEGORY_APPLICATION,
+                "Obtained audio buffer: %u samples (%u bytes)",
+                have.samples,
+                have.size);
+
+    SDL_LogInfo(SDL_LOG_CATEGORY_APPLICATION,
+                "Audio jitter buffer target: %d-%d ms",
+                m_MinTargetUs / 1000,
+                m_MaxTargetUs / 1000);
+
+    SDL_LogInfo(SDL_LOG_CATEGORY_APPLICATION,
+                "SDL audio driver: %s (callback mode)",
+                SDL_GetCurrentAudioDriver());
+
+    // Start playback
+    SDL_PauseAudioDevice(m_AudioDevice, 0);
+
+    return true;
+}
+
+SdlPullAudioRenderer::~SdlPullAudioRenderer()
+{
+    if (m_AudioDevice != 0) {
+        // Stop playback. Closing the device waits for the callback to return.
+        SDL_PauseAudioDevice(m_AudioDevice, 1);
+        SDL_CloseAudioDevice(m_AudioDevice);
+
+        SDL_LogInfo(SDL_LOG_CATEGORY_APPLICATION,
+                    "Audio callback underruns: %d",
+                    SDL_AtomicGet(&m_Underruns));
+    }
+
+    SDL_free(m_Slots);
+    SDL_free(m_DropBuffer);
+
+    SDL_QuitSubSystem(SDL_INIT_AUDIO);
+    SDL_assert(!SDL_WasInit(SDL_INIT_AUDIO));
+}
+
+void SdlPullAudioRenderer::updateJitter()
+{
+    uint64_t now = LiGetMicroseconds();
+
+    if (m_LastArrivalUs != 0 && now - m_LastArrivalUs < JITTER_RESET_US) {
+        // Only late frames matter. Early ones are just catching up.
+        double lateness = SDL_max(0.0, (double)(now - m_LastArrivalUs) - m_FrameDurationUs);
+        m_PeakJitterUs = SDL_max(lateness, m_PeakJitterUs - m_FrameDurationUs * JITTER_DECAY);
+    }
+    m_LastArrivalUs = now;
+
+    // Hold enough audio to ride out the worst recent gap with some margin
+    int targetUs = m_FrameDurationUs + (int)(m_PeakJitterUs * 1.5);
+    targetUs = SDL_clamp(targetUs, m_MinTargetUs, m_MaxTargetUs);
+
+    // Any A/V sync delay goes on top, as long as the ring can hold it
+    targetUs = SDL_min(targetUs + m_AudioDelayUs, (SDL_PULL_AUDIO_MAX_QUEUED_FRAMES - 4) * m_FrameDurationUs);
+    SDL_AtomicSet(&m_TargetLatencyUs, targetUs);
+}
+
+bool SdlPullAudioRenderer::setAudioDelay(uint32_t delayMs)
+{
+    // The resampler steers the ring to the new target over a few seconds,
+    // so the change is inaudible.
+    m_AudioDelayUs = (int)SDL_min(delayMs, (uint32_t)MAX_AUDIO_DELAY_MS) * 1000;
+    return true;
+}
+
+void* SdlPullAudioRenderer::getAudioBuffer(int* size)
+{
+    updateJitter();
+
+    int writeIndex = SDL_AtomicGet(&m_WriteIndex);
+    int queuedFrames = writeIndex - SDL_AtomicGet(&m_ReadIndex);
+    int targetUs = SDL_AtomicGet(&m_TargetLatencyUs);
+
+    SDL_assert(*size <= m_FrameSize);
+    *size = m_FrameSize;
+
+    // Resampling only corrects small errors, so drop frames if a burst puts us
+    // far above the target or if there's already more than 30 ms of audio data
+    // waiting in Moonlight's audio queue. We still decode the frame so the Opus
+    // decoder state stays continuous.
+    m_Dropping = queuedFrames >= SDL_PULL_AUDIO_MAX_QUEUED_FRAMES ||
+                 queuedFrames * m_FrameDurationUs > targetUs * 2 + m_FrameDurationUs ||
+                 LiGetPendingAudioDuration() > 30;
+    if (m_Dropping) {
+        return m_DropBuffer;
+    }
+
+    return m_Slots + (writeIndex & (SDL_PULL_AUDIO_SLOTS - 1)) * m_FrameSize;
+}
+
+bool SdlPullAudioRenderer::submitAudio(int bytesWritten)
+{
+    // Our device may enter a permanent error status upon removal, so we need
+    // to recreate the audio device to pick up the new default audio device.
+    if (SDL_GetAudioDeviceStatus(m_AudioDevice) == SDL_AUDIO_STOPPED) {
+        return false;
+    }
+
+    if (bytesWritten == 0 || m_Dropping) {
+        // Nothing to do
+        return true;
+    }
+
+    int writeIndex = SDL_AtomicGet(&m_WriteIndex);
+    m_SlotBytes[writeIndex & (SDL_PULL_AUDIO_SLOTS - 1)] = bytesWritten;
+
+    // Publish the slot to the audio callback
+    SDL_AtomicSet(&m_WriteIndex, writeIndex + 1);
+
+    return true;
+}
+
+bool SdlPullAudioRenderer::getAudioLatency(uint32_t* latencyMs, uint32_t* targetLatencyMs)
+{
+    // Include the device period, since that's buffered after the ring
+    *latencyMs = (SDL_AtomicGet(&m_LatencyUs) + m_DevicePeriodUs) / 1000;
+    *targetLatencyMs = (SDL_AtomicGet(&m_TargetLatencyUs) + m_DevicePeriodUs) / 1000;
+    return true;
+}
+
+bool SdlPullAudioRenderer::getUnderrunCount(uint32_t* underruns)
+{
+    *underruns = (uint32_t)SDL_AtomicGet(&m_Underruns);
+    return true;
+}
+
+int SdlPullAudioRenderer::getBufferedBytes(int readIndex)
+{
+    int writeIndex = SDL_AtomicGet(&m_WriteIndex);
+    int bytes = -m_ReadOffset;
+
+    for (int i = readIndex; i != writeIndex; i++) {
+        bytes += m_SlotBytes[i & (SDL_PULL_AUDIO_SLOTS - 1)];
+    }
+
+    return SDL_max(bytes, 0);
+}
+
+bool SdlPullAudioRenderer::readSampleFrame(float* frame)
+{
+    int readIndex = SDL_AtomicGet(&m_ReadIndex);
+    if (readIndex == SDL_AtomicGet(&m_WriteIndex)) {
+        return false;
+    }
+
+    int slot = readIndex & (SDL_PULL_AUDIO_SLOTS - 1);
+    int frameBytes = m_Channels * sizeof(float);
+
+    SDL_memcpy(frame, m_Slots + slot * m_FrameSize + m_ReadOffset, frameBytes);
+    m_ReadOffset += frameBytes;
+
+    if (m_ReadOffset >= m_SlotBytes[slot]) {
+        // Return this slot to the decoder thread
+        m_ReadOffset = 0;
+        SDL_AtomicSet(&m_ReadIndex, readIndex + 1);
+    }
+
+    return true;
+}
+
+void SDLCALL SdlPullAudioRenderer::audioCallback(void* userdata, Uint8* stream, int len)
+{
+    auto me = (SdlPullAudioRenderer*)userdata;
+    float* output = (float*)stream;
+    int outputFrames = len / (me->m_Channels * sizeof(float));
+    int targetUs = SDL_AtomicGet(&me->m_TargetLatencyUs);
+
+    int bufferedFrames = me->getBufferedBytes(SDL_AtomicGet(&me->m_ReadIndex)) / (me->m_Channels * sizeof(float));
+    double bufferedUs = (double)bufferedFrames * 1000000 / me->m_SampleRate;
+
+    // Refill to the target before starting (or restarting after an underrun)
+    if (!me->m_Playing) {
+        if (bufferedUs < targetUs ||
+                !me->readSampleFrame(me->m_PrevFrame) ||
+                !me->readSampleFrame(me->m_NextFrame)) {
+            SDL_memset(stream, 0, len);
+            return;
+        }
+
+        me->m_Phase = 0;
+        me->m_SmoothedBufferedUs = bufferedUs;
+        me->m_Playing = true;
+    }
+
+    // The ring level saws up and down with each frame and callback,
+    // so steer based on its average rather than the instantaneous value.
+    me->m_SmoothedBufferedUs += (bufferedUs - me->m_SmoothedBufferedUs) / 16;
+    SDL_AtomicSet(&me->m_LatencyUs, (int)me->m_SmoothedBufferedUs);
+
+    // Consume input slightly faster when above the target and slower when below
+    double ratio = 1.0 + SDL_clamp((me->m_SmoothedBufferedUs - targetUs) * RESAMPLE_GAIN,
+                                   -RESAMPLE_MAX_ADJUST, RESAMPLE_MAX_ADJUST);
+
+    for (int i = 0; i < outputFrames; i++) {
+        // Linear interpolation is transparent at these tiny rate changes
+        for (int ch = 0; ch < me->m_Channels; ch++) {
+            output[ch] = me->m_PrevFrame[ch] + (me->m_NextFrame[ch] - me->m_PrevFrame[ch]) * (float)me->m_Phase;
+        }
+        output += me->m_Channels;
+
+        me->m_Phase += ratio;
+        while (me->m_Phase >= 1.0) {
+            me->m_Phase -= 1.0;
+            SDL_memcpy(me->m_PrevFrame, me->m_NextFrame, sizeof(me->m_PrevFrame));
+            if (!me->readSampleFrame(me->m_NextFrame)) {
+                // We ran dry, so fill the rest with silence. Float silence is all zeros.
+                SDL_memset(output, 0, (outputFrames - i - 1) * me->m_Channels * sizeof(float));
+                SDL_AtomicIncRef(&me->m_Underruns);
+                me->m_Playing = false;
+                return;
+            }
+        }
+    }
+}
+
+IAudioRenderer::AudioFormat SdlPullAudioRenderer::getAudioBufferFormat()
+{
+    return AudioFormat::Float32NE;
+}
@@ -1,11 +1,15 @@
 #include "slaud.h"
+#include "pcmconvert.h"
 
 #include "SDL_compat.h"
 
 SLAudioRenderer::SLAudioRenderer()
     : m_AudioContext(nullptr),
       m_AudioStream(nullptr),
-      m_AudioBuffer(nullptr)
+      m_AudioBuffer(nullptr),
+      m_DownmixBuffer(nullptr),
+      m_DownmixBufferSize(0),
+      m_DownmixChannels(0)
 {
     SLAudio_SetLogFunction(SLAudioRenderer::slLogCallback, nullptr);
 }
@@ -19,16 +23,33 @@ bool SLAudioRenderer::prepareForPlayback(const OPUS_MULTISTREAM_CONFIGURATION* o
         return false;
     }
 
+    int channelCount = opusConfig->channelCount;
+    if (channelCount >= 6 && qgetenv("AUDIO_SLAUDIO_DOWNMIX") == "1") {
+        m_DownmixChannels = channelCount;
+        m_DownmixBufferSize = opusConfig->samplesPerFrame * channelCount * sizeof(float);
+        m_DownmixBuffer = (float*)SDL_malloc(m_DownmixBufferSize);
+        if (m_DownmixBuffer == nullptr) {
+            return false;
+        }
+
+        channelCount = 2;
+
+        SDL_LogInfo(SDL_LOG_CATEGORY_APPLICATION,
+                    "Downmixing %d channel audio to stereo",
+                    m_DownmixChannels);
+    }
+
     // This number is pretty conservative (especially for surround), but
     // it's hard to avoid since we get crushed by CPU limitations.
-    m_MaxQueuedAudioMs = 40 * opusConfig->channelCount / 2;
+    m_MaxQueuedAudioMs = 40 * channelCount / 2;
 
+    // SLAudio frames are always 16-bit
     m_AudioBufferSize = opusConfig->samplesPerFrame *
-                        opusConfig->channelCount *
-                        getAudioBufferSampleSize();
+                        channelCount *
+                        sizeof(short);
     m_AudioStream = SLAudio_CreateStream(m_AudioContext,
                                          opusConfig->sampleRate,
-                                         opusConfig->channelCount,
+                                         channelCount,
                                          m_AudioBufferSize,
                                          1);
     if (m_AudioStream == nullptr) {
@@ -47,6 +68,11 @@ bool SLAudioRenderer::prepareForPlayback(const OPUS_MULTISTREAM_CONFIGURATION* o
 void SLAudioRenderer::remapChannels(POPUS_MULTISTREAM_CONFIGURATION opusConfig) {
     OPUS_MULTISTREAM_CONFIGURATION originalConfig = *opusConfig;
 
+    // The downmix expects Moonlight's channel order
+    if (m_DownmixBuffer != nullptr) {
+        return;
+    }
+
     // The Moonlight's default channel order is FL,FR,C,LFE,RL,RR,SL,SR
     // SLAudio expects FL,C,FR,RL,RR,(SL,SR),LFE for 5.1/7.1 so we swap the channels around to match
 
@@ -69,6 +95,11 @@ void SLAudioRenderer::remapChannels(POPUS_MULTISTREAM_CONFIGURATION opusConfig)
 
 void* SLAudioRenderer::getAudioBuffer(int* size)
 {
+    if (m_DownmixBuffer != nullptr) {
+        SDL_assert(*size == m_DownmixBufferSize);
+        return m_DownmixBuffer;
+    }
+
     SDL_assert(*size == m_AudioBufferSize);
 
     if (m_AudioBuffer == nullptr) {
@@ -92,6 +123,8 @@ SLAudioRenderer::~SLAudioRenderer()
     if (m_AudioContext != nullptr) {
         SLAudio_FreeContext(m_AudioContext);
     }
+
+    SDL_free(m_DownmixBuffer);
 }
 
 bool SLAudioRenderer::submitAudio(int bytesWritten)
@@ -102,6 +135,17 @@ bool SLAudioRenderer::submitAudio(int bytesWritten)
     }
 
     if (LiGetPendingAudioDuration() < m_MaxQueuedAudioMs) {
+        if (m_DownmixBuffer != nullptr) {
+            int frameCount = bytesWritten / (m_DownmixChannels * sizeof(float));
+
+            m_AudioBuffer = SLAudio_BeginFrame(m_AudioStream);
+            PcmConvert::downmixToStereo(m_DownmixBuffer, m_DownmixBuffer, m_DownmixChannels, frameCount);
+            PcmConvert::floatToS16(m_DownmixBuffer, (int16_t*)m_AudioBuffer, frameCount * 2);
+
+            // Pad out a short decode with silence
+            memset((int16_t*)m_AudioBuffer + frameCount * 2, 0, m_AudioBufferSize - frameCount * 2 * sizeof(int16_t));
+        }
+
         SLAudio_SubmitFrame(m_AudioStream);
         m_AudioBuffer = nullptr;
     }
@@ -116,6 +160,11 @@ bool SLAudioRenderer::submitAudio(int bytesWritten)
 
 IAudioRenderer::AudioFormat SLAudioRenderer::getAudioBufferFormat()
 {
+    // The downmix needs headroom that 16-bit samples don't have
+    if (m_DownmixBuffer != nullptr) {
+        return AudioFormat::Float32NE;
+    }
+
     return AudioFormat::Sint16NE;
 }
 
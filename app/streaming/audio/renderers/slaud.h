@@ -3,6 +3,8 @@
 #include "renderer.h"
 #include <SLAudio.h>
 
+// Set AUDIO_SLAUDIO_DOWNMIX=1 to downmix surround streams to stereo before
+// they reach SLAudio, which is cheaper than having it play 6 or 8 channels.
 class SLAudioRenderer : public IAudioRenderer
 {
 public:
@@ -29,4 +31,9 @@ private:
     void* m_AudioBuffer;
     int m_AudioBufferSize;
     int m_MaxQueuedAudioMs;
+
+    // Decoded surround audio when downmixing
+    float* m_DownmixBuffer;
+    int m_DownmixBufferSize;
+    int m_DownmixChannels;
 };
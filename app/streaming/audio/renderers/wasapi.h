@@ -0,0 +1,73 @@
+#pragma once
+
+#include "renderer.h"
+#include "pcmring.h"
+
+#include <mmdeviceapi.h>
+#include <audioclient.h>
+#include <wrl/client.h>
+
+// Event-driven WASAPI output. In shared mode, IAudioClient3 is used to get
+// the smallest engine period the device supports (often 2-3 ms instead of
+// the default 10 ms). Setting AUDIO_WASAPI_EXCLUSIVE=1 opens the device in
+// exclusive mode at its minimum period, bypassing the Windows mixer entirely.
+class WasapiAudioRenderer : public IAudioRenderer
+{
+public:
+    WasapiAudioRenderer();
+
+    virtual ~WasapiAudioRenderer();
+
+    virtual bool prepareForPlayback(const OPUS_MULTISTREAM_CONFIGURATION* opusConfig);
+
+    virtual void* getAudioBuffer(int* size);
+
+    virtual bool submitAudio(int bytesWritten);
+
+    virtual AudioFormat getAudioBufferFormat();
+
+    virtual bool getAudioLatency(uint32_t* latencyMs, uint32_t* targetLatencyMs);
+
+    virtual bool setAudioDelay(uint32_t delayMs);
+
+private:
+    class DeviceNotificationClient;
+
+    static int renderThreadProc(void* context);
+
+    bool initializeClient();
+
+    bool activateClient();
+
+    bool fillBuffer(UINT32 frames);
+
+    void renderLoop();
+
+    const OPUS_MULTISTREAM_CONFIGURATION* m_OpusConfig; // Only valid during prepareForPlayback()
+    int m_FrameSize;
+    int m_BytesPerSampleFrame;
+    int m_MaxQueuedBytes;
+    void* m_AudioBuffer;
+    PcmRing m_Ring;
+    int m_SampleRate;
+    AudioFormat m_Format;
+
+    bool m_Exclusive;
+    UINT32 m_BufferFrames;
+    int m_DevicePeriodUs;
+    int m_StreamLatencyUs;
+
+    SDL_Thread* m_RenderThread;
+    SDL_sem* m_InitSemaphore;
+    bool m_InitSucceeded;
+    SDL_atomic_t m_Stopping;
+    SDL_atomic_t m_DeviceLost;
+
+    // Only touched by the render thread
+    HANDLE m_Event;
+    Microsoft::WRL::ComPtr<IMMDeviceEnumerator> m_Enumerator;
+    Microsoft::WRL::ComPtr<IMMDevice> m_Device;
+    Microsoft::WRL::ComPtr<IAudioClient> m_Client;
+    Microsoft::WRL::ComPtr<IAudioRenderClient> m_RenderClient;
+    DeviceNotificationClient* m_NotificationClient;
+};
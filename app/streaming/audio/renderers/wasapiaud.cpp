@@ -0,0 +1,559 @@
+// minwindef.h defines min() and max() macros that conflict with
+// std::numeric_limits, which Qt uses in some of its headers.
+#define NOMINMAX
+
+#include <initguid.h>
+#include "wasapi.h"
+
+#include <Limelight.h>
+
+#include <avrt.h>
+#include <ksmedia.h>
+
+using Microsoft::WRL::ComPtr;
+
+// How long the render thread waits for a buffer event before checking the device
+#define WASAPI_EVENT_TIMEOUT_MS 200
+
+class WasapiAudioRenderer::DeviceNotificationClient : public IMMNotificationClient
+{
+public:
+    DeviceNotificationClient(SDL_atomic_t* deviceLost)
+        : m_RefCount(1),
+          m_DeviceLost(deviceLost)
+    {
+    }
+
+    ULONG STDMETHODCALLTYPE AddRef() override
+    {
+        return InterlockedIncrement(&m_RefCount);
+    }
+
+    ULONG STDMETHODCALLTYPE Release() override
+    {
+        ULONG refCount = InterlockedDecrement(&m_RefCount);
+        if (refCount == 0) {
+            delete this;
+        }
+        return refCount;
+    }
+
+    HRESULT STDMETHODCALLTYPE QueryInterface(REFIID riid, void** ppvInterface) override
+    {
+        if (riid == __uuidof(IUnknown) || riid == __uuidof(IMMNotificationClient)) {
+            *ppvInterface = static_cast<IMMNotificationClient*>(this);
+            AddRef();
+            return S_OK;
+        }
+
+        *ppvInterface = nullptr;
+        return E_NOINTERFACE;
+    }
+
+    HRESULT STDMETHODCALLTYPE OnDefaultDeviceChanged(EDataFlow flow, ERole role, LPCWSTR) override
+    {
+        // Recreating the renderer will pick up the new default device
+        if (flow == eRender && role == eConsole) {
+            SDL_AtomicSet(m_DeviceLost, 1);
+        }
+        return S_OK;
+    }
+
+    HRESULT STDMETHODCALLTYPE OnDeviceAdded(LPCWSTR) override { return S_OK; }
+    HRESULT STDMETHODCALLTYPE OnDeviceRemoved(LPCWSTR) override { return S_OK; }
+    HRESULT STDMETHODCALLTYPE OnDeviceStateChanged(LPCWSTR, DWORD) override { return S_OK; }
+    HRESULT STDMETHODCALLTYPE OnPropertyValueChanged(LPCWSTR, const PROPERTYKEY) override { return S_OK; }
+
+private:
+    LONG m_RefCount;
+    SDL_atomic_t* m_DeviceLost;
+};
+
+static DWORD getChannelMask(int channelCount)
+{
+    // These match the channel order of Moonlight's Opus streams
+    switch (channelCount) {
+    case 2:
+        return KSAUDIO_SPEAKER_STEREO;
+    case 6:
+        return KSAUDIO_SPEAKER_5POINT1;
+    case 8:
+        return KSAUDIO_SPEAKER_7POINT1_SURROUND;
+    default:
+        return 0;
+    }
+}
+
+static void buildWaveFormat(WAVEFORMATEXTENSIBLE* format, int channelCount, int sampleRate, bool useFloat)
+{
+    SDL_zerop(format);
+
+    format->Format.wFormatTag = WAVE_FORMAT_EXTENSIBLE;
+    format->Format.nChannels = channelCount;
+    format->Format.nSamplesPerSec = sampleRate;
+    format->Format.wBitsPerSample = useFloat ? 32 : 16;
+    format->Format.nBlockAlign = channelCount * format->Format.wBitsPerSample / 8;
+    format->Format.nAvgBytesPerSec = sampleRate * format->Format.nBlockAlign;
+    format->Format.cbSize = sizeof(WAVEFORMATEXTENSIBLE) - sizeof(WAVEFORMATEX);
+    format->Samples.wValidBitsPerSample = format->Format.wBitsPerSample;
+    format->dwChannelMask = getChannelMask(channelCount);
+    format->SubFormat = useFloat ? KSDATAFORMAT_SUBTYPE_IEEE_FLOAT : KSDATAFORMAT_SUBTYPE_PCM;
+}
+
+WasapiAudioRenderer::WasapiAudioRenderer()
+    : m_OpusConfig(nullptr),
+      m_FrameSize(0),
+      m_BytesPerSampleFrame(0),
+      m_MaxQueuedBytes(0),
+      m_AudioBuffer(nullptr),
+      m_SampleRate(0),
+      m_Format(AudioFormat::Float32NE),
+      m_Exclusive(false),
+      m_BufferFrames(0),
+      m_DevicePeriodUs(0),
+      m_StreamLatencyUs(0),
+      m_RenderThread(nullptr),
+      m_InitSemaphore(SDL_CreateSemaphore(0)),
+      m_InitSucceeded(false),
+      m_Event(nullptr),
+      m_NotificationClient(nullptr)
+{
+    SDL_AtomicSet(&m_Stopping, 0);
+    SDL_AtomicSet(&m_DeviceLost, 0);
+}
+
+WasapiAudioRenderer::~WasapiAudioRenderer()
+{
+    if (m_RenderThread != nullptr) {
+        SDL_AtomicSet(&m_Stopping, 1);
+        SDL_WaitThread(m_RenderThread, nullptr);
+    }
+
+    if (m_InitSemaphore != nullptr) {
+        SDL_DestroySemaphore(m_InitSemaphore);
+    }
+
+    SDL_free(m_AudioBuffer);
+}
+
+bool WasapiAudioRenderer::prepareForPlayback(const OPUS_MULTISTREAM_CONFIGURATION* opusConfig)
+{
+    if (getChannelMask(opusConfig->channelCount) == 0) {
+        SDL_LogError(SDL_LOG_CATEGORY_APPLICATION,
+                     "Unsupported audio channel count: %d",
+                     opusConfig->channelCount);
+        return false;
+    }
+
+    m_OpusConfig = opusConfig;
+    m_SampleRate = opusConfig->sampleRate;
+    m_Exclusive = qgetenv("AUDIO_WASAPI_EXCLUSIVE") == "1";
+
+    if (m_InitSemaphore == nullptr) {
+        return false;
+    }
+
+    // All COM objects live on the render thread, since we may be
+    // destroyed on a different thread than the one that created us.
+    m_RenderThread = SDL_CreateThread(renderThreadProc, "WASAPI Render", this);
+    if (m_RenderThread == nullptr) {
+        SDL_LogError(SDL_LOG_CATEGORY_APPLICATION,
+                     "Failed to create WASAPI render thread: %s",
+                     SDL_GetError());
+        return false;
+    }
+
+    SDL_SemWait(m_InitSemaphore);
+    m_OpusConfig = nullptr;
+
+    return m_InitSucceeded;
+}
+
+bool WasapiAudioRenderer::activateClient()
+{
+    m_Client.Reset();
+
+    HRESULT hr = m_Device->Activate(__uuidof(IAudioClient), CLSCTX_ALL, nullptr, &m_Client);
+    if (FAILED(hr)) {
+        SDL_LogError(SDL_LOG_CATEGORY_APPLICATION,
+                     "IMMDevice::Activate() failed: %x",
+                     hr);
+        return false;
+    }
+
+    return true;
+}
+
+bool WasapiAudioRenderer::initializeClient()
+{
+    WAVEFORMATEXTENSIBLE format;
+    HRESULT hr;
+
+    hr = CoCreateInstance(__uuidof(MMDeviceEnumerator), nullptr, CLSCTX_ALL, IID_PPV_ARGS(&m_Enumerator));
+    if (FAILED(hr)) {
+        SDL_LogError(SDL_LOG_CATEGORY_APPLICATION,
+                     "CoCreateInstance(MMDeviceEnumerator) failed: %x",
+                     hr);
+        return false;
+    }
+
+    hr = m_Enumerator->GetDefaultAudioEndpoint(eRender, eConsole, &m_Device);
+    if (FAILED(hr)) {
+        SDL_LogError(SDL_LOG_CATEGORY_APPLICATION,
+                     "GetDefaultAudioEndpoint() failed: %x",
+                     hr);
+        return false;
+    }
+
+    if (!activateClient()) {
+        return false;
+    }
+
+    hr = E_FAIL;
+
+    if (m_Exclusive) {
+        REFERENCE_TIME defaultPeriod, minimumPeriod;
+
+        // Prefer float, which is what Opus decodes to, but most devices only
+        // accept integer formats in exclusive mode so fall back to 16-bit
+        buildWaveFormat(&format, m_OpusConfig->channelCount, m_OpusConfig->sampleRate, true);
+        m_Format = AudioFormat::Float32NE;
+        if (m_Client->IsFormatSupported(AUDCLNT_SHAREMODE_EXCLUSIVE, &format.Format, nullptr) != S_OK) {
+            buildWaveFormat(&format, m_OpusConfig->channelCount, m_OpusConfig->sampleRate, false);
+            m_Format = AudioFormat::Sint16NE;
+        }
+
+        hr = m_Client->GetDevicePeriod(&defaultPeriod, &minimumPeriod);
+        if (SUCCEEDED(hr)) {
+            hr = m_Client->Initialize(AUDCLNT_SHAREMODE_EXCLUSIVE,
+                                      AUDCLNT_STREAMFLAGS_EVENTCALLBACK,
+                                      minimumPeriod, minimumPeriod,
+                                      &format.Format, nullptr);
+            if (hr == AUDCLNT_E_BUFFER_SIZE_NOT_ALIGNED) {
+                // Retry with a period that matches the device's buffer alignment
+                UINT32 alignedFrames;
+                if (SUCCEEDED(m_Client->GetBufferSize(&alignedFrames)) && activateClient()) {
+                    REFERENCE_TIME alignedPeriod = (REFERENCE_TIME)(10000000.0 * alignedFrames / m_OpusConfig->sampleRate + 0.5);
+                    hr = m_Client->Initialize(AUDCLNT_SHAREMODE_EXCLUSIVE,
+                                              AUDCLNT_STREAMFLAGS_EVENTCALLBACK,
+                                              alignedPeriod, alignedPeriod,
+                                              &format.Format, nullptr);
+                }
+            }
+        }
+
+        if (FAILED(hr)) {
+            SDL_LogWarn(SDL_LOG_CATEGORY_APPLICATION,
+                        "Failed to open WASAPI device in exclusive mode: %x",
+                        hr);
+            m_Exclusive = false;
+            if (!activateClient()) {
+                return false;
+            }
+        }
+    }
+
+    if (!m_Exclusive) {
+        ComPtr<IAudioClient3> client3;
+
+        buildWaveFormat(&format, m_OpusConfig->channelCount, m_OpusConfig->sampleRate, true);
+        m_Format = AudioFormat::Float32NE;
+
+        // Ask for the engine's minimum period. This only works when our format
+        // matches the mix format, since the low latency path can't resample.
+        if (SUCCEEDED(m_Client.As(&client3))) {
+            UINT32 defaultPeriodFrames, fundamentalPeriodFrames, minPeriodFrames, maxPeriodFrames;
+
+            hr = client3->GetSharedModeEnginePeriod(&format.Format,
+                                                    &defaultPeriodFrames,
+                                                    &fundamentalPeriodFrames,
+                                                    &minPeriodFrames,
+                                                    &maxPeriodFrames);
+            if (SUCCEEDED(hr)) {
+                hr = client3->InitializeSharedAudioStream(AUDCLNT_STREAMFLAGS_EVENTCALLBACK,
+                                                          minPeriodFrames,
+                                                          &format.Format,
+                                                          nullptr);
+            }
+
+            if (FAILED(hr)) {
+                SDL_LogInfo(SDL_LOG_CATEGORY_APPLICATION,
+                            "Low latency WASAPI shared mode is unavailable: %x",
+                            hr);
+                client3.Reset();
+                if (!activateClient()) {
+                    return false;
+                }
+            }
+        }
+        else {
+            hr = E_NOINTERFACE;
+        }
+
+        if (FAILED(hr)) {
+            hr = m_Client->Initialize(AUDCLNT_SHAREMODE_SHARED,
+                                      AUDCLNT_STREAMFLAGS_EVENTCALLBACK |
+                                          AUDCLNT_STREAMFLAGS_AUTOCONVERTPCM |
+                                          AUDCLNT_STREAMFLAGS_SRC_DEFAULT_QUALITY,
+                                      0, 0, &format.Format, nullptr);
+            if (FAILED(hr)) {
+                SDL_LogError(SDL_LOG_CATEGORY_APPLICATION,
+                             "IAudioClient::Initialize() failed: %x",
+                             hr);
+                return false;
+            }
+        }
+    }
+
+    m_Event = CreateEvent(nullptr, FALSE, FALSE, nullptr);
+    if (m_Event == nullptr) {
+        SDL_LogError(SDL_LOG_CATEGORY_APPLICATION,
+                     "CreateEvent() failed: %d",
+                     GetLastError());
+        return false;
+    }
+
+    hr = m_Client->SetEventHandle(m_Event);
+    if (FAILED(hr)) {
+        SDL_LogError(SDL_LOG_CATEGORY_APPLICATION,
+                     "IAudioClient::SetEventHandle() failed: %x",
+                     hr);
+        return false;
+    }
+
+    hr = m_Client->GetBufferSize(&m_BufferFrames);
+    if (FAILED(hr)) {
+        SDL_LogError(SDL_LOG_CATEGORY_APPLICATION,
+                     "IAudioClient::GetBufferSize() failed: %x",
+                     hr);
+        return false;
+    }
+
+    // This is the latency of the audio engine and driver beyond our buffer
+    REFERENCE_TIME streamLatency;
+    if (SUCCEEDED(m_Client->GetStreamLatency(&streamLatency))) {
+        m_StreamLatencyUs = (int)(streamLatency / 10);
+    }
+
+    hr = m_Client->GetService(IID_PPV_ARGS(&m_RenderClient));
+    if (FAILED(hr)) {
+        SDL_LogError(SDL_LOG_CATEGORY_APPLICATION,
+                     "IAudioClient::GetService(IAudioRenderClient) failed: %x",
+                     hr);
+        return false;
+    }
+
+    m_NotificationClient = new DeviceNotificationClient(&m_DeviceLost);
+    hr = m_Enumerator->RegisterEndpointNotificationCallback(m_NotificationClient);
+    if (FAILED(hr)) {
+        // Not fatal, we just won't follow default device changes
+        SDL_LogWarn(SDL_LOG_CATEGORY_APPLICATION,
+                    "RegisterEndpointNotificationCallback() failed: %x",
+                    hr);
+        m_NotificationClient->Release();
+        m_NotificationClient = nullptr;
+    }
+
+    m_BytesPerSampleFrame = format.Format.nBlockAlign;
+    m_FrameSize = m_OpusConfig->samplesPerFrame * m_BytesPerSampleFrame;
+    m_DevicePeriodUs = (int)((uint64_t)m_BufferFrames * 1000000 / m_OpusConfig->sampleRate);
+
+    // In shared mode, the device consumes up to a whole buffer at a time,
+    // so allow one Opus frame on top of that before we start dropping.
+    m_MaxQueuedBytes = SDL_max(2 * m_FrameSize, m_FrameSize + (int)m_BufferFrames * m_BytesPerSampleFrame);
+
+    // Leave room in the ring for A/V sync delay too
+    int maxDelayBytes = MAX_AUDIO_DELAY_MS * m_SampleRate / 1000 * m_BytesPerSampleFrame;
+    m_AudioBuffer = SDL_malloc(m_FrameSize);
+    if (m_AudioBuffer == nullptr || !m_Ring.initialize((m_MaxQueuedBytes + maxDelayBytes) * 2)) {
+        return false;
+    }
+
+    SDL_LogInfo(SDL_LOG_CATEGORY_APPLICATION,
+                "WASAPI %s mode: %u frame buffer (%.1f ms), %.1f ms stream latency, %s samples",
+                m_Exclusive ? "exclusive" : "shared",
+                m_BufferFrames,
+                m_DevicePeriodUs / 1000.0,
+                m_StreamLatencyUs / 1000.0,
+                m_Format == AudioFormat::Float32NE ? "float" : "16-bit");
+
+    return true;
+}
+
+bool WasapiAudioRenderer::fillBuffer(UINT32 frames)
+{
+    BYTE* data;
+
+    HRESULT hr = m_RenderClient->GetBuffer(frames, &data);
+    if (FAILED(hr)) {
+        SDL_LogError(SDL_LOG_CATEGORY_APPLICATION,
+                     "IAudioRenderClient::GetBuffer() failed: %x",
+                     hr);
+        return false;
+    }
+
+    // Fill in silence if the decoder hasn't caught up
+    int bytes = frames * m_BytesPerSampleFrame;
+    int bytesRead = m_Ring.read(data, bytes);
+    SDL_memset(data + bytesRead, 0, bytes - bytesRead);
+
+    hr = m_RenderClient->ReleaseBuffer(frames, 0);
+    if (FAILED(hr)) {
+        SDL_LogError(SDL_LOG_CATEGORY_APPLICATION,
+                     "IAudioRenderClient::ReleaseBuffer() failed: %x",
+                     hr);
+        return false;
+    }
+
+    return true;
+}
+
+void WasapiAudioRenderer::renderLoop()
+{
+    DWORD taskIndex = 0;
+    HANDLE mmcssHandle = AvSetMmThreadCharacteristicsW(L"Pro Audio", &taskIndex);
+    if (mmcssHandle == nullptr) {
+        SDL_LogWarn(SDL_LOG_CATEGORY_APPLICATION,
+                    "AvSetMmThreadCharacteristics() failed: %d",
+                    GetLastError());
+    }
+
+    // Prime the buffer with silence since the device starts pulling immediately
+    if (!fillBuffer(m_BufferFrames)) {
+        SDL_AtomicSet(&m_DeviceLost, 1);
+    }
+    else if (FAILED(m_Client->Start())) {
+        SDL_LogError(SDL_LOG_CATEGORY_APPLICATION,
+                     "IAudioClient::Start() failed");
+        SDL_AtomicSet(&m_DeviceLost, 1);
+    }
+
+    while (!SDL_AtomicGet(&m_Stopping) && !SDL_AtomicGet(&m_DeviceLost)) {
+        WaitForSingleObject(m_Event, WASAPI_EVENT_TIMEOUT_MS);
+
+        UINT32 frames = m_BufferFrames;
+
+        // In exclusive mode, each event means the entire buffer is ours to fill
+        if (!m_Exclusive) {
+            UINT32 padding;
+
+            HRESULT hr = m_Client->GetCurrentPadding(&padding);
+            if (FAILED(hr)) {
+                // AUDCLNT_E_DEVICE_INVALIDATED when the device is removed
+                SDL_LogWarn(SDL_LOG_CATEGORY_APPLICATION,
+                            "IAudioClient::GetCurrentPadding() failed: %x",
+                            hr);
+                SDL_AtomicSet(&m_DeviceLost, 1);
+                break;
+            }
+
+            frames -= padding;
+        }
+
+        if (frames != 0 && !fillBuffer(frames)) {
+            SDL_AtomicSet(&m_DeviceLost, 1);
+            break;
+        }
+    }
+
+    m_Client->Stop();
+
+    if (mmcssHandle != nullptr) {
+        AvRevertMmThreadCharacteristics(mmcssHandle);
+    }
+}
+
+int WasapiAudioRenderer::renderThreadProc(void* context)
+{
+    auto me = (WasapiAudioRenderer*)context;
+
+    HRESULT hr = CoInitializeEx(nullptr, COINIT_MULTITHREADED);
+    if (FAILED(hr)) {
+        SDL_LogError(SDL_LOG_CATEGORY_APPLICATION,
+                     "CoInitializeEx() failed: %x",
+                     hr);
+        me->m_InitSucceeded = false;
+        SDL_SemPost(me->m_InitSemaphore);
+        return 0;
+    }
+
+    me->m_InitSucceeded = me->initializeClient();
+    SDL_SemPost(me->m_InitSemaphore);
+
+    if (me->m_InitSucceeded) {
+        me->renderLoop();
+    }
+
+    if (me->m_NotificationClient != nullptr) {
+        me->m_Enumerator->UnregisterEndpointNotificationCallback(me->m_NotificationClient);
+        me->m_NotificationClient->Release();
+        me->m_NotificationClient = nullptr;
+    }
+
+    me->m_RenderClient.Reset();
+    me->m_Client.Reset();
+    me->m_Device.Reset();
+    me->m_Enumerator.Reset();
+
+    if (me->m_Event != nullptr) {
+        CloseHandle(me->m_Event);
+        me->m_Event = nullptr;
+    }
+
+    CoUninitialize();
+    return 0;
+}
+
+void* WasapiAudioRenderer::getAudioBuffer(int* size)
+{
+    SDL_assert(*size <= m_FrameSize);
+    *size = m_FrameSize;
+    return m_AudioBuffer;
+}
+
+bool WasapiAudioRenderer::submitAudio(int bytesWritten)
+{
+    // The renderer must be recreated to pick up a new default device
+    if (SDL_AtomicGet(&m_DeviceLost)) {
+        return false;
+    }
+
+    if (bytesWritten == 0) {
+        // Nothing to do
+        return true;
+    }
+
+    // Don't let latency build up if the device is consuming slower than we produce
+    // or if there's already more than 30 ms of audio data waiting in Moonlight's
+    // audio queue.
+    if (m_Ring.getQueuedBytes() + bytesWritten > m_MaxQueuedBytes + m_Ring.getDelayBytes() || LiGetPendingAudioDuration() > 30) {
+        return true;
+    }
+
+    m_Ring.write(m_AudioBuffer, bytesWritten);
+    return true;
+}
+
+bool WasapiAudioRenderer::getAudioLatency(uint32_t* latencyMs, uint32_t* targetLatencyMs)
+{
+    int queuedUs = (int)((int64_t)m_Ring.getQueuedBytes() / m_BytesPerSampleFrame * 1000000 / m_SampleRate);
+    int frameUs = (int)((int64_t)m_FrameSize / m_BytesPerSampleFrame * 1000000 / m_SampleRate);
+    int delayUs = (int)((int64_t)m_Ring.getDelayBytes() / m_BytesPerSampleFrame * 1000000 / m_SampleRate);
+
+    *latencyMs = (queuedUs + m_DevicePeriodUs + m_StreamLatencyUs) / 1000;
+    *targetLatencyMs = (frameUs + delayUs + m_DevicePeriodUs + m_StreamLatencyUs) / 1000;
+    return true;
+}
+
+bool WasapiAudioRenderer::setAudioDelay(uint32_t delayMs)
+{
+    // Keep the delay aligned to whole sample frames
+    int delayFrames = (int)SDL_min(delayMs, (uint32_t)MAX_AUDIO_DELAY_MS) * m_SampleRate / 1000;
+    m_Ring.setDelayBytes(delayFrames * m_BytesPerSampleFrame);
+    return true;
+}
+
+IAudioRenderer::AudioFormat WasapiAudioRenderer::getAudioBufferFormat()
+{
+    return m_Format;
+}
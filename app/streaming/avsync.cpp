@@ -0,0 +1,98 @@
+#include "avsync.h"
+#include "audio/renderers/renderer.h"
+
+#include <Limelight.h>
+
+// Re-align once the residual offset leaves this window. The ITU recommends
+// keeping lip sync within about 20 ms for it to go unnoticed.
+#define AV_SYNC_TOLERANCE_MS 15
+
+// Renderers may ramp to a new delay gradually, so let it settle before re-measuring
+#define AV_SYNC_SETTLE_US 10000000
+
+// Audio latency is sampled per packet, so average across about a second
+#define AUDIO_LATENCY_SMOOTHING 0.005
+
+AvSyncMonitor::AvSyncMonitor()
+    : m_Enabled(qgetenv("AV_SYNC_DELAY_AUDIO") == "1"),
+      m_LastDelayChangeUs(0),
+      m_SmoothedAudioLatencyUs(0)
+{
+    SDL_AtomicSet(&m_AudioLatencyUs, 0);
+    SDL_AtomicSet(&m_VideoLatencyUs, 0);
+    SDL_AtomicSet(&m_AudioDelayMs, 0);
+    SDL_AtomicSet(&m_AppliedAudioDelayMs, 0);
+}
+
+void AvSyncMonitor::updateAudioLatency(uint32_t latencyUs, uint32_t appliedDelayMs)
+{
+    SDL_AtomicSet(&m_AppliedAudioDelayMs, (int)appliedDelayMs);
+
+    if (m_SmoothedAudioLatencyUs == 0) {
+        m_SmoothedAudioLatencyUs = latencyUs;
+    }
+    else {
+        m_SmoothedAudioLatencyUs += (latencyUs - m_SmoothedAudioLatencyUs) * AUDIO_LATENCY_SMOOTHING;
+    }
+
+    SDL_AtomicSet(&m_AudioLatencyUs, (int)m_SmoothedAudioLatencyUs);
+}
+
+void AvSyncMonitor::resetAudio()
+{
+    // The new renderer starts without our delay applied
+    m_SmoothedAudioLatencyUs = 0;
+    SDL_AtomicSet(&m_AudioLatencyUs, 0);
+    SDL_AtomicSet(&m_AppliedAudioDelayMs, 0);
+}
+
+void AvSyncMonitor::updateVideoLatency(uint32_t latencyUs)
+{
+    SDL_AtomicSet(&m_VideoLatencyUs, (int)latencyUs);
+
+    int audioLatencyUs = SDL_AtomicGet(&m_AudioLatencyUs);
+    if (!m_Enabled || audioLatencyUs == 0) {
+        return;
+    }
+
+    uint64_t now = LiGetMicroseconds();
+    if (m_LastDelayChangeUs != 0 && now - m_LastDelayChangeUs < AV_SYNC_SETTLE_US) {
+        return;
+    }
+
+    int offsetMs = ((int)latencyUs - audioLatencyUs) / 1000;
+    if (SDL_abs(offsetMs) <= AV_SYNC_TOLERANCE_MS) {
+        return;
+    }
+
+    // Base this on the delay that was actually applied, so we don't keep
+    // piling on delay if the renderer can't add it
+    int newDelayMs = SDL_clamp(SDL_AtomicGet(&m_AppliedAudioDelayMs) + offsetMs, 0, MAX_AUDIO_DELAY_MS);
+    if (newDelayMs != SDL_AtomicGet(&m_AudioDelayMs)) {
+        SDL_LogInfo(SDL_LOG_CATEGORY_APPLICATION,
+                    "A/V offset is %d ms - changing audio delay to %d ms",
+                    offsetMs,
+                    newDelayMs);
+        SDL_AtomicSet(&m_AudioDelayMs, newDelayMs);
+        m_LastDelayChangeUs = now;
+    }
+}
+
+bool AvSyncMonitor::getOffset(int* offsetMs, uint32_t* audioDelayMs)
+{
+    int audioLatencyUs = SDL_AtomicGet(&m_AudioLatencyUs);
+    int videoLatencyUs = SDL_AtomicGet(&m_VideoLatencyUs);
+
+    if (audioLatencyUs == 0 || videoLatencyUs == 0) {
+        return false;
+    }
+
+    *offsetMs = (videoLatencyUs - audioLatencyUs) / 1000;
+    *audioDelayMs = (uint32_t)SDL_AtomicGet(&m_AppliedAudioDelayMs);
+    return true;
+}
+
+uint32_t AvSyncMonitor::getAudioDelayMs()
+{
+    return (uint32_t)SDL_AtomicGet(&m_AudioDelayMs);
+}
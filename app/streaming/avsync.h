@@ -0,0 +1,48 @@
+#pragma once
+
+#include "SDL_compat.h"
+
+// Estimates lip sync error by comparing how long audio and video each take
+// to get from the network to the speakers and screen, measured on the client
+// clock. The host captures audio and video together, so the difference in
+// these latencies is the A/V offset we add.
+//
+// When AV_SYNC_DELAY_AUDIO=1, audio is delayed to match video whenever the
+// offset exceeds the tolerance. Video usually takes longer, and delaying it
+// would make the stream feel less responsive, so we never delay video.
+class AvSyncMonitor
+{
+public:
+    AvSyncMonitor();
+
+    // Called on the audio thread with the latency from packet arrival to
+    // playout, including the delay that the renderer has applied
+    void updateAudioLatency(uint32_t latencyUs, uint32_t appliedDelayMs);
+
+    // Called on the decoder thread with the latency from packet arrival
+    // to display, averaged over a stats window
+    void updateVideoLatency(uint32_t latencyUs);
+
+    // Called on the audio thread when the audio renderer is recreated
+    void resetAudio();
+
+    // Positive when video is shown after the matching audio is heard.
+    // Returns false until both sides have been measured.
+    bool getOffset(int* offsetMs, uint32_t* audioDelayMs);
+
+    // The delay that the audio renderer should add
+    uint32_t getAudioDelayMs();
+
+private:
+    bool m_Enabled;
+    SDL_atomic_t m_AudioLatencyUs;
+    SDL_atomic_t m_VideoLatencyUs;
+    SDL_atomic_t m_AudioDelayMs;
+    SDL_atomic_t m_AppliedAudioDelayMs;
+
+    // Only touched by the decoder thread
+    uint64_t m_LastDelayChangeUs;
+
+    // Only touched by the audio thread
+    double m_SmoothedAudioLatencyUs;
+};
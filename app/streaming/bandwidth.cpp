@@ -10,41 +10,43 @@ BandwidthTracker::BandwidthTracker(uint32_t windowSeconds, uint32_t bucketInterv
         bucketIntervalMs = 250;
     }
     bucketCount = (windowSeconds * 1000) / bucketIntervalMs;
-    buckets.resize(bucketCount);
+    buckets.reset(new std::atomic<uint64_t>[bucketCount]);
+    for (uint32_t i = 0; i < bucketCount; i++) {
+        buckets[i].store(0, std::memory_order_relaxed);
+    }
 }
 
 // Add bytes recorded at the current time.
 void BandwidthTracker::AddBytes(size_t bytes) {
-    std::lock_guard<std::mutex> lock(mtx);
-    auto now = steady_clock::now();
-    updateBucket(bytes, now);
+    updateBucket(bytes, nowMs());
 }
 
 // We don't want to average the entire window used for peak,
 // so average only the newest 25% of complete buckets
 double BandwidthTracker::GetAverageMbps() {
-    std::lock_guard<std::mutex> lock(mtx);
-    auto now = steady_clock::now();
-    auto ms = duration_cast<milliseconds>(now.time_since_epoch());
-    int currentIndex = (ms.count() / bucketIntervalMs) % bucketCount;
+    auto ms = nowMs();
+    uint32_t currentSequence = (uint32_t)(ms / bucketIntervalMs);
+    int currentIndex = (ms / bucketIntervalMs) % bucketCount;
     int maxBuckets = bucketCount / 4;
     size_t totalBytes = 0;
-    steady_clock::time_point oldestBucket = now;
+    uint32_t oldestAge = 0;
 
     // Sum bytes from 25% most recent buckets as long as they are completed
     for (int i = 0; i < maxBuckets; i++) {
         int idx = (currentIndex - i + bucketCount) % bucketCount;
-        const Bucket &bucket = buckets[idx];
-        if (isValid(bucket, now) && (now - bucket.start >= milliseconds(bucketIntervalMs))) {
+        Bucket bucket = unpack(buckets[idx].load(std::memory_order_relaxed));
+        uint32_t age = currentSequence - bucket.sequence;
+        if (isValid(bucket, currentSequence) && age >= 1) {
             totalBytes += bucket.bytes;
-            if (bucket.start < oldestBucket) {
-                oldestBucket = bucket.start;
+            if (age > oldestAge) {
+                oldestAge = age;
             }
         }
     }
 
-    double elapsed = duration<double>(now - oldestBucket).count();
-    if (elapsed <= 0.0) {
+    // Measure from the start of the oldest bucket until now
+    double elapsed = ((double)oldestAge * bucketIntervalMs + (ms % bucketIntervalMs)) / 1000.0;
+    if (oldestAge == 0 || elapsed <= 0.0) {
         return 0.0;
     }
 
@@ -52,11 +54,11 @@ double BandwidthTracker::GetAverageMbps() {
 }
 
 double BandwidthTracker::GetPeakMbps() {
-    std::lock_guard<std::mutex> lock(mtx);
-    auto now = steady_clock::now();
+    uint32_t currentSequence = (uint32_t)(nowMs() / bucketIntervalMs);
     double peak = 0.0;
-    for (const auto& bucket : buckets) {
-        if (isValid(bucket, now)) {
+    for (uint32_t i = 0; i < bucketCount; i++) {
+        Bucket bucket = unpack(buckets[i].load(std::memory_order_relaxed));
+        if (isValid(bucket, currentSequence)) {
             double throughput = getBucketMbps(bucket);
             if (throughput > peak) {
                 peak = throughput;
@@ -72,33 +74,44 @@ unsigned int BandwidthTracker::GetWindowSeconds() {
 
 /// private methods
 
+inline BandwidthTracker::Bucket BandwidthTracker::unpack(uint64_t value) {
+    return Bucket{ (uint32_t)(value >> 32), (uint32_t)value };
+}
+
+inline int64_t BandwidthTracker::nowMs() const {
+    return duration_cast<milliseconds>(steady_clock::now().time_since_epoch()).count();
+}
+
 inline double BandwidthTracker::getBucketMbps(const Bucket &bucket) const {
     return bucket.bytes * 8.0 / 1000000.0 / (bucketIntervalMs / 1000.0);
 }
 
 // Check if a bucket's data is still valid (within the window)
-inline bool BandwidthTracker::isValid(const Bucket &bucket, steady_clock::time_point now) const {
-    return (now - bucket.start) <= windowSeconds;
+inline bool BandwidthTracker::isValid(const Bucket &bucket, uint32_t currentSequence) const {
+    // Unsigned subtraction handles wraparound of the truncated sequence numbers
+    uint32_t age = currentSequence - bucket.sequence;
+    return (int64_t)age * bucketIntervalMs <= duration_cast<milliseconds>(windowSeconds).count();
 }
 
-void BandwidthTracker::updateBucket(size_t bytes, steady_clock::time_point now) {
-    auto ms          = duration_cast<milliseconds>(now.time_since_epoch()).count();
-    int bucketIndex  = (ms / bucketIntervalMs) % bucketCount;
-    auto aligned_ms  = ms - (ms % bucketIntervalMs);
-    auto bucketStart = steady_clock::time_point(milliseconds(aligned_ms));
-
-    Bucket &bucket = buckets[bucketIndex];
-
-    if (now - bucket.start > windowSeconds) {
-        bucket.bytes = 0;
-        bucket.start = bucketStart;
-    }
-
-    if (bucket.start != bucketStart) {
-        bucket.bytes = bytes;
-        bucket.start = bucketStart;
-    }
-    else {
-        bucket.bytes += bytes;
-    }
+void BandwidthTracker::updateBucket(size_t bytes, int64_t ms) {
+    uint32_t sequence = (uint32_t)(ms / bucketIntervalMs);
+    int bucketIndex   = (ms / bucketIntervalMs) % bucketCount;
+
+    std::atomic<uint64_t> &bucket = buckets[bucketIndex];
+    uint64_t oldValue = bucket.load(std::memory_order_relaxed);
+    uint64_t newValue;
+
+    // The sequence and byte count are swapped in together, so a stale bucket
+    // is reset and new bytes are added atomically even with multiple writers.
+    do {
+        Bucket current = unpack(oldValue);
+        uint64_t total = bytes;
+        if (current.sequence == sequence) {
+            total += current.bytes;
+        }
+        if (total > UINT32_MAX) {
+            total = UINT32_MAX;
+        }
+        newValue = ((uint64_t)sequence << 32) | total;
+    } while (!bucket.compare_exchange_weak(oldValue, newValue, std::memory_order_relaxed));
 }
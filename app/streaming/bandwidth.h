@@ -1,9 +1,9 @@
 #pragma once
 
+#include <atomic>
 #include <chrono>
 #include <cstdint>
-#include <mutex>
-#include <vector>
+#include <memory>
 
 /**
  * @brief The BandwidthTracker class tracks network bandwidth usage over a sliding time window (default 10s).
@@ -17,8 +17,8 @@
  *
  * GetPeakMbps() returns the peak bandwidth seen during any one bucket interval across the full time window.
  *
- * All public methods are thread safe. A typical use case is calling AddBytes() in a data processing thread while
- * calling GetAverageMbps() from a UI thread.
+ * All public methods are thread safe and lock-free. A typical use case is calling AddBytes() in a data processing
+ * thread while calling GetAverageMbps() from a UI thread, and neither will ever block the other.
  *
  * Example usage:
  * @code
@@ -86,22 +86,26 @@ public:
 
 private:
     /**
-     * @brief A structure representing a single time bucket.
+     * @brief A snapshot of a single time bucket.
      *
-     * Each bucket holds the start time of the interval and the total number of bytes recorded during that interval.
+     * Each bucket holds the sequence number of its interval (time since the clock epoch divided by the bucket
+     * interval) and the total number of bytes recorded during that interval. In storage, both are packed into
+     * a single 64-bit atomic word (sequence in the high half, bytes in the low half) so that they can be
+     * updated together with one compare-and-swap.
      */
     struct Bucket {
-        std::chrono::steady_clock::time_point start{}; ///< The start time of the bucket's interval.
-        size_t bytes = 0;                              ///< The number of bytes recorded in this bucket.
+        std::uint32_t sequence;                        ///< The interval this bucket covers (truncated to 32 bits).
+        std::uint32_t bytes;                           ///< The number of bytes recorded in this bucket.
     };
 
-    const std::chrono::seconds windowSeconds;          ///< T he duration of the tracking window.
+    const std::chrono::seconds windowSeconds;          ///< The duration of the tracking window.
     const int bucketIntervalMs;                        ///< The duration of each bucket (in milliseconds).
     std::uint32_t bucketCount;                         ///< The total number of buckets covering the window.
-    std::vector<Bucket> buckets;                       ///< Fixed-size circular buffer of buckets.
-    std::mutex mtx;                                    ///< Mutex to ensure thread-safe access.
+    std::unique_ptr<std::atomic<std::uint64_t>[]> buckets; ///< Fixed-size circular buffer of packed buckets.
 
-    bool isValid(const Bucket &bucket, std::chrono::steady_clock::time_point now) const;
-    void updateBucket(size_t bytes, std::chrono::steady_clock::time_point now);
+    static Bucket unpack(std::uint64_t value);
+    std::int64_t nowMs() const;
+    bool isValid(const Bucket &bucket, std::uint32_t currentSequence) const;
+    void updateBucket(size_t bytes, std::int64_t ms);
     double getBucketMbps(const Bucket &bucket) const;
 };
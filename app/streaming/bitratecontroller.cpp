@@ -0,0 +1,172 @@
+#include "bitratecontroller.h"
+
+#include <QSettings>
+
+#define SER_BITRATECONTROLLER "bitratecontroller"
+
+// Never suggest less than this
+#define ABR_MIN_KBPS 1500
+
+// Stats windows are about 500 ms long
+#define ABR_BAD_WINDOWS_TO_DECREASE 3
+#define ABR_GOOD_WINDOWS_TO_INCREASE 40
+#define ABR_HOLD_WINDOWS_AFTER_CHANGE 10
+
+// Don't remember anything from streams shorter than about 30 seconds
+#define ABR_MIN_WINDOWS_TO_SAVE 60
+
+#define ABR_DECREASE_FACTOR 0.8
+#define ABR_INCREASE_FACTOR 1.1
+
+// Leave some room below the measured throughput when it sets the target
+#define ABR_THROUGHPUT_HEADROOM 0.9
+
+// A window is bad if it loses more than this many frames in a thousand
+#define ABR_MAX_LOSS_PER_MILLE 20
+
+// Queuing delay above the lowest RTT we've seen that counts as congestion
+#define ABR_MAX_RTT_RISE_MS 30
+
+// The decoder is falling behind once it takes this much of the frame time
+#define ABR_MAX_DECODE_TIME_PERCENT 90
+
+BitrateController::BitrateController()
+    : m_Enabled(false),
+      m_ConfiguredKbps(0),
+      m_MinRttMs(0),
+      m_BadWindows(0),
+      m_GoodWindows(0),
+      m_HoldWindows(0),
+      m_TotalWindows(0)
+{
+    SDL_AtomicSet(&m_TargetKbps, 0);
+}
+
+int BitrateController::initialize(const QString& hostUuid, int configuredKbps, bool enabled)
+{
+    m_Enabled = enabled && qgetenv("ML_ABR") != "0";
+    m_HostUuid = hostUuid;
+    m_ConfiguredKbps = configuredKbps;
+
+    int startingKbps = configuredKbps;
+    if (m_Enabled) {
+        // Start where the last stream to this host at this bitrate settled
+        QSettings settings;
+        settings.beginGroup(SER_BITRATECONTROLLER);
+        int savedKbps = settings.value(QString("%1/%2").arg(hostUuid).arg(configuredKbps), 0).toInt();
+        if (savedKbps >= ABR_MIN_KBPS && savedKbps < configuredKbps) {
+            SDL_LogInfo(SDL_LOG_CATEGORY_APPLICATION,
+                        "Starting at %d kbps instead of %d kbps based on previous streams",
+                        savedKbps,
+                        configuredKbps);
+            startingKbps = savedKbps;
+        }
+    }
+
+    SDL_AtomicSet(&m_TargetKbps, startingKbps);
+    return startingKbps;
+}
+
+void BitrateController::updateWindow(const VIDEO_STATS& window, double averageMbps, int frameRate)
+{
+    if (!m_Enabled || window.totalFrames == 0) {
+        return;
+    }
+
+    m_TotalWindows++;
+
+    uint32_t rttMs, rttVarianceMs;
+    if (!LiGetEstimatedRttInfo(&rttMs, &rttVarianceMs)) {
+        rttMs = 0;
+    }
+    if (rttMs != 0 && (m_MinRttMs == 0 || rttMs < m_MinRttMs)) {
+        m_MinRttMs = rttMs;
+    }
+
+    bool lossy = window.networkDroppedFrames * 1000 > window.totalFrames * ABR_MAX_LOSS_PER_MILLE;
+    bool queuing = rttMs != 0 && rttMs > m_MinRttMs + ABR_MAX_RTT_RISE_MS;
+    bool decoderBehind = false;
+    if (window.decodedFrames != 0 && frameRate > 0) {
+        uint64_t avgDecodeTimeUs = window.totalDecodeTimeUs / window.decodedFrames;
+        decoderBehind = avgDecodeTimeUs * 100 > (1000000 / frameRate) * ABR_MAX_DECODE_TIME_PERCENT;
+    }
+
+    if (lossy || queuing || decoderBehind) {
+        m_BadWindows++;
+        m_GoodWindows = 0;
+    }
+    else {
+        m_GoodWindows++;
+        m_BadWindows = 0;
+    }
+
+    // Let the last change take effect before judging it
+    if (m_HoldWindows > 0) {
+        m_HoldWindows--;
+        return;
+    }
+
+    int targetKbps = SDL_AtomicGet(&m_TargetKbps);
+    int newTargetKbps = targetKbps;
+    if (m_BadWindows >= ABR_BAD_WINDOWS_TO_DECREASE) {
+        newTargetKbps = (int)(targetKbps * ABR_DECREASE_FACTOR);
+
+        // While we're losing frames, what still gets through is a good estimate
+        // of what the link can carry. Static scenes can use far less than the
+        // target though, so only trust it when there's loss and cap the step.
+        if (lossy && averageMbps > 0) {
+            int throughputKbps = (int)(averageMbps * 1000 * ABR_THROUGHPUT_HEADROOM);
+            newTargetKbps = SDL_min(newTargetKbps, SDL_max(throughputKbps, targetKbps / 2));
+        }
+
+        newTargetKbps = SDL_max(newTargetKbps, ABR_MIN_KBPS);
+    }
+    else if (m_GoodWindows >= ABR_GOOD_WINDOWS_TO_INCREASE) {
+        newTargetKbps = SDL_min((int)(targetKbps * ABR_INCREASE_FACTOR), m_ConfiguredKbps);
+    }
+
+    if (newTargetKbps != targetKbps) {
+        SDL_LogInfo(SDL_LOG_CATEGORY_APPLICATION,
+                    "Target bitrate changed to %d kbps (loss: %u/%u frames, RTT: %u ms (min %u ms), decoder behind: %d, received: %.2f Mbps)",
+                    newTargetKbps,
+                    window.networkDroppedFrames,
+                    window.totalFrames,
+                    rttMs,
+                    m_MinRttMs,
+                    decoderBehind,
+                    averageMbps);
+        SDL_AtomicSet(&m_TargetKbps, newTargetKbps);
+        m_BadWindows = 0;
+        m_GoodWindows = 0;
+        m_HoldWindows = ABR_HOLD_WINDOWS_AFTER_CHANGE;
+    }
+}
+
+int BitrateController::getTargetKbps()
+{
+    return SDL_AtomicGet(&m_TargetKbps);
+}
+
+int BitrateController::getConfiguredKbps()
+{
+    return m_ConfiguredKbps;
+}
+
+void BitrateController::saveTarget()
+{
+    if (!m_Enabled || m_TotalWindows < ABR_MIN_WINDOWS_TO_SAVE) {
+        return;
+    }
+
+    QSettings settings;
+    settings.beginGroup(SER_BITRATECONTROLLER);
+
+    QString key = QString("%1/%2").arg(m_HostUuid).arg(m_ConfiguredKbps);
+    int targetKbps = getTargetKbps();
+    if (targetKbps < m_ConfiguredKbps) {
+        settings.setValue(key, targetKbps);
+    }
+    else {
+        settings.remove(key);
+    }
+}
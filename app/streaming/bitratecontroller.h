@@ -0,0 +1,51 @@
+#pragma once
+
+#include "SDL_compat.h"
+#include "video/decoder.h"
+
+#include <QString>
+
+// Picks the bitrate the stream should be using from the client's view of
+// the connection: frames lost on the network, RTT rising above the best
+// we've seen, and the decoder falling behind the frame rate. Decreases
+// need a few bad windows in a row and increases need a long run of clean
+// ones, so a single burst of loss doesn't make the target swing.
+//
+// GameStream can't change the bitrate of a stream that has already
+// started, so the target is used to give a concrete suggestion when the
+// connection is poor and, with automatic bitrate adjustment enabled, is
+// remembered per host as the starting bitrate for the next stream.
+//
+// Set ML_ABR=0 to disable the controller.
+class BitrateController
+{
+public:
+    BitrateController();
+
+    // Called before the connection starts. Returns the bitrate to start at.
+    int initialize(const QString& hostUuid, int configuredKbps, bool enabled);
+
+    // Called on the decoder thread at the end of each stats window
+    void updateWindow(const VIDEO_STATS& window, double averageMbps, int frameRate);
+
+    // The bitrate the connection can sustain, or the configured bitrate
+    int getTargetKbps();
+
+    int getConfiguredKbps();
+
+    // Called on the main thread after the decoder has been destroyed
+    void saveTarget();
+
+private:
+    bool m_Enabled;
+    QString m_HostUuid;
+    int m_ConfiguredKbps;
+    SDL_atomic_t m_TargetKbps;
+
+    // Only touched by the decoder thread
+    uint32_t m_MinRttMs;
+    int m_BadWindows;
+    int m_GoodWindows;
+    int m_HoldWindows;
+    int m_TotalWindows;
+};
@@ -0,0 +1,164 @@
+#include "decoderload.h"
+#include "session.h"
+#include "settings/streamingpreferences.h"
+
+// Stats windows are about 500 ms long
+#define OVERLOAD_WINDOWS_TO_REPORT 10
+
+// The decoder or renderer is behind once it takes this much of the frame time
+#define MAX_FRAME_TIME_PERCENT 90
+
+// Or once the pacer is dropping this many frames in a hundred
+#define MAX_PACER_DROP_PERCENT 10
+
+DecoderLoadMonitor::DecoderLoadMonitor()
+    : m_Enabled(false),
+      m_Width(0),
+      m_Height(0),
+      m_Fps(0),
+      m_SuggestedWidth(0),
+      m_SuggestedHeight(0),
+      m_SuggestedFps(0),
+      m_Reported(false),
+      m_OverloadedWindows(0)
+{
+    SDL_AtomicSet(&m_SuggestionReady, 0);
+    SDL_zero(m_OverloadStats);
+}
+
+void DecoderLoadMonitor::initialize(int width, int height, int fps)
+{
+    m_Enabled = qgetenv("ML_DECODER_LOAD_MONITOR") != "0";
+    m_Width = width;
+    m_Height = height;
+    m_Fps = fps;
+}
+
+void DecoderLoadMonitor::updateWindow(const VIDEO_STATS& window)
+{
+    if (!m_Enabled || m_Reported || m_Fps <= 0 || window.decodedFrames == 0) {
+        return;
+    }
+
+    uint64_t frameTimeUs = 1000000 / m_Fps;
+    bool decoderBehind = (window.totalDecodeTimeUs / window.decodedFrames) * 100 > frameTimeUs * MAX_FRAME_TIME_PERCENT;
+    bool rendererBehind = window.renderedFrames != 0 &&
+            (window.totalRenderTimeUs / window.renderedFrames) * 100 > frameTimeUs * MAX_FRAME_TIME_PERCENT;
+    bool pacerDropping = window.pacerDroppedFrames * 100 > window.decodedFrames * MAX_PACER_DROP_PERCENT;
+    bool backlogSkipped = window.decodeBacklogTrims != 0;
+
+    if (!decoderBehind && !rendererBehind && !pacerDropping && !backlogSkipped) {
+        m_OverloadedWindows = 0;
+        SDL_zero(m_OverloadStats);
+        return;
+    }
+
+    m_OverloadedWindows++;
+    m_OverloadStats.decodedFrames += window.decodedFrames;
+    m_OverloadStats.renderedFrames += window.renderedFrames;
+    m_OverloadStats.pacerDroppedFrames += window.pacerDroppedFrames;
+    m_OverloadStats.totalDecodeTimeUs += window.totalDecodeTimeUs;
+    m_OverloadStats.totalRenderTimeUs += window.totalRenderTimeUs;
+    m_OverloadStats.totalDecoderQueueDepth += window.totalDecoderQueueDepth;
+    m_OverloadStats.decoderQueueDepthSamples += window.decoderQueueDepthSamples;
+    m_OverloadStats.decodeBacklogTrims += window.decodeBacklogTrims;
+
+    if (m_OverloadedWindows < OVERLOAD_WINDOWS_TO_REPORT) {
+        return;
+    }
+
+    // Only report this once per stream
+    m_Reported = true;
+
+    SDL_LogWarn(SDL_LOG_CATEGORY_APPLICATION,
+                "Client can't keep up with %dx%d at %d FPS for the last %d ms: "
+                "decode %.2f ms, render %.2f ms, frame time %.2f ms, "
+                "pacer dropped %u of %u decoded frames, average decoder queue depth %.1f, "
+                "backlog skipped %u times",
+                m_Width, m_Height, m_Fps,
+                m_OverloadedWindows * 500,
+                (double)m_OverloadStats.totalDecodeTimeUs / 1000.0 / m_OverloadStats.decodedFrames,
+                m_OverloadStats.renderedFrames != 0 ?
+                    (double)m_OverloadStats.totalRenderTimeUs / 1000.0 / m_OverloadStats.renderedFrames : 0.0,
+                frameTimeUs / 1000.0,
+                m_OverloadStats.pacerDroppedFrames,
+                m_OverloadStats.decodedFrames,
+                m_OverloadStats.decoderQueueDepthSamples != 0 ?
+                    (double)m_OverloadStats.totalDecoderQueueDepth / m_OverloadStats.decoderQueueDepthSamples : 0.0,
+                m_OverloadStats.decodeBacklogTrims);
+
+    char text[128];
+    if (pickSuggestion()) {
+        SDL_LogInfo(SDL_LOG_CATEGORY_APPLICATION,
+                    "Suggesting %dx%d at %d FPS",
+                    m_SuggestedWidth,
+                    m_SuggestedHeight,
+                    m_SuggestedFps);
+        snprintf(text, sizeof(text),
+                 "Your PC can't keep up with this stream\nPress Ctrl+Alt+Shift+A to use %dx%d at %d FPS next time",
+                 m_SuggestedWidth, m_SuggestedHeight, m_SuggestedFps);
+        SDL_AtomicSet(&m_SuggestionReady, 1);
+    }
+    else {
+        snprintf(text, sizeof(text), "Your PC can't keep up with this stream");
+    }
+
+    Session::get()->getOverlayManager().updateOverlayText(Overlay::OverlayStatusUpdate, text);
+    Session::get()->getOverlayManager().setOverlayState(Overlay::OverlayStatusUpdate, true);
+}
+
+bool DecoderLoadMonitor::pickSuggestion()
+{
+    m_SuggestedWidth = m_Width;
+    m_SuggestedHeight = m_Height;
+    m_SuggestedFps = m_Fps;
+
+    // Dropping high refresh rates first keeps the picture sharp
+    if (m_Fps > 60) {
+        m_SuggestedFps = 60;
+        return true;
+    }
+
+    // Then step down the standard resolutions, keeping the aspect ratio
+    static const int heights[] = { 1440, 1080, 720 };
+    for (int height : heights) {
+        if (m_Height > height) {
+            m_SuggestedHeight = height;
+            m_SuggestedWidth = (m_Width * height / m_Height) & ~7;
+            return true;
+        }
+    }
+
+    if (m_Fps > 30) {
+        m_SuggestedFps = 30;
+        return true;
+    }
+
+    return false;
+}
+
+bool DecoderLoadMonitor::applySuggestion(StreamingPreferences* prefs)
+{
+    if (SDL_AtomicGet(&m_SuggestionReady) == 0) {
+        return false;
+    }
+
+    prefs->width = m_SuggestedWidth;
+    prefs->height = m_SuggestedHeight;
+    prefs->fps = m_SuggestedFps;
+    if (prefs->autoAdjustBitrate) {
+        prefs->bitrateKbps = StreamingPreferences::getDefaultBitrate(prefs->width, prefs->height,
+                                                                     prefs->fps, prefs->enableYUV444);
+    }
+    prefs->save();
+
+    emit prefs->displayModeChanged();
+    emit prefs->bitrateChanged();
+
+    SDL_LogInfo(SDL_LOG_CATEGORY_APPLICATION,
+                "Saved %dx%d at %d FPS for the next stream",
+                prefs->width,
+                prefs->height,
+                prefs->fps);
+    return true;
+}
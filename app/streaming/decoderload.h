@@ -0,0 +1,48 @@
+#pragma once
+
+#include "SDL_compat.h"
+#include "video/decoder.h"
+
+class StreamingPreferences;
+
+// Watches the stats windows for the decoder or renderer failing to keep up
+// with the stream, which otherwise only shows up as the pacer quietly
+// dropping frames. Once that has gone on for a while, the stats from the
+// overload are logged and the status overlay suggests a lower resolution
+// or frame rate, which the user can save for the next stream with
+// Ctrl+Alt+Shift+A.
+//
+// Set ML_DECODER_LOAD_MONITOR=0 to disable it.
+class DecoderLoadMonitor
+{
+public:
+    DecoderLoadMonitor();
+
+    // Called before the connection starts
+    void initialize(int width, int height, int fps);
+
+    // Called on the decoder thread at the end of each stats window
+    void updateWindow(const VIDEO_STATS& window);
+
+    // Called on the main thread. Returns false if there's nothing to apply.
+    bool applySuggestion(StreamingPreferences* prefs);
+
+private:
+    bool pickSuggestion();
+
+    bool m_Enabled;
+    int m_Width;
+    int m_Height;
+    int m_Fps;
+
+    // Written by the decoder thread before m_SuggestionReady is set
+    int m_SuggestedWidth;
+    int m_SuggestedHeight;
+    int m_SuggestedFps;
+    SDL_atomic_t m_SuggestionReady;
+
+    // Only touched by the decoder thread
+    bool m_Reported;
+    int m_OverloadedWindows;
+    VIDEO_STATS m_OverloadStats;
+};
@@ -0,0 +1,194 @@
+#include "flightrecorder.h"
+#include "path.h"
+#include "streamutils.h"
+
+#include <Limelight.h>
+
+#include <QDateTime>
+#include <QDir>
+#include <QFile>
+#include <QRunnable>
+#include <QThreadPool>
+#include <QVector>
+
+#include <algorithm>
+#include <string.h>
+
+// The ring covers about 30 seconds, so there's no point dumping more often
+#define MIN_AUTOMATIC_DUMP_INTERVAL_MS 30000
+
+struct FlightRecorderSnapshotEvent {
+    int index;
+    int type;
+    uint64_t timeUs;
+    uint32_t values[4];
+};
+
+struct FlightRecorderEventInfo {
+    const char* name;
+    const char* valueNames[4];
+};
+
+static const FlightRecorderEventInfo k_EventInfo[] = {
+    { "frame_decoded", { "frame", "type", "reassembly_us", "decode_us" } },
+    { "frame_rendered", { "rtp", "pacer_us", "render_us", "interval_us" } },
+    { "pacer_drop", { "rtp", "queue_depth", "drop_target", "render_queue" } },
+    { "audio_submitted", { "pending_ms", "latency_ms", "submitted", nullptr } },
+    { "input_sent", { "latency_us", nullptr, nullptr, nullptr } },
+    { "connection_status", { "status", nullptr, nullptr, nullptr } },
+};
+
+class FlightRecorderDumpTask : public QRunnable
+{
+public:
+    FlightRecorderDumpTask(const QVector<FlightRecorderSnapshotEvent>& events, const QString& reason, uint64_t dumpTimeUs)
+        : m_Events(events),
+          m_Reason(reason),
+          m_DumpTimeUs(dumpTimeUs)
+    {
+        setAutoDelete(true);
+    }
+
+    void run() override
+    {
+        StreamUtils::placeCurrentThread(StreamUtils::TPC_BACKGROUND);
+
+        QString path = QDir(Path::getLogDir()).filePath(QString("moonlight_flight_%1.txt")
+                                                        .arg(QDateTime::currentDateTime().toString("yyyyMMdd_hhmmss_zzz")));
+        QFile file(path);
+        if (!file.open(QIODevice::WriteOnly | QIODevice::Text)) {
+            SDL_LogError(SDL_LOG_CATEGORY_APPLICATION,
+                         "FlightRecorder: Unable to open %s: %s",
+                         path.toUtf8().constData(),
+                         file.errorString().toUtf8().constData());
+            return;
+        }
+
+        char line[256];
+        int length = snprintf(line, sizeof(line), "# Moonlight flight recorder (%s), %d events, times in ms before the dump\n",
+                              m_Reason.toUtf8().constData(), m_Events.size());
+        file.write(line, length);
+
+        for (const FlightRecorderSnapshotEvent& event : m_Events) {
+            const FlightRecorderEventInfo& info = k_EventInfo[event.type];
+
+            length = snprintf(line, sizeof(line), "%.3f %s", -(double)(int64_t)(m_DumpTimeUs - event.timeUs) / 1000.0, info.name);
+            for (int i = 0; i < 4 && info.valueNames[i] != nullptr; i++) {
+                length += snprintf(line + length, sizeof(line) - length, " %s=%u", info.valueNames[i], event.values[i]);
+            }
+            line[length++] = '\n';
+
+            file.write(line, length);
+        }
+
+        SDL_LogInfo(SDL_LOG_CATEGORY_APPLICATION,
+                    "FlightRecorder: Wrote %d events to %s",
+                    m_Events.size(),
+                    path.toUtf8().constData());
+    }
+
+private:
+    QVector<FlightRecorderSnapshotEvent> m_Events;
+    QString m_Reason;
+    uint64_t m_DumpTimeUs;
+};
+
+FlightRecorder::FlightRecorder()
+    : m_Events(nullptr)
+{
+    SDL_AtomicSet(&m_NextIndex, 0);
+    SDL_AtomicSet(&m_LastAutomaticDumpTicks, 0);
+
+    if (qgetenv("ML_FLIGHT_RECORDER") != "0") {
+        m_Events = new Event[FLIGHT_RECORDER_EVENTS];
+        for (int i = 0; i < FLIGHT_RECORDER_EVENTS; i++) {
+            SDL_AtomicSet(&m_Events[i].sequence, 0);
+        }
+    }
+}
+
+FlightRecorder::~FlightRecorder()
+{
+    delete[] m_Events;
+}
+
+void FlightRecorder::record(EventType type, uint32_t a, uint32_t b, uint32_t c, uint32_t d)
+{
+    if (m_Events == nullptr) {
+        return;
+    }
+
+    // Mark the slot as being written so a concurrent dump can skip it
+    int index = SDL_AtomicAdd(&m_NextIndex, 1);
+    Event& event = m_Events[(unsigned int)index % FLIGHT_RECORDER_EVENTS];
+    SDL_AtomicSet(&event.sequence, 0);
+
+    event.type = type;
+    event.timeUs = LiGetMicroseconds();
+    event.values[0] = a;
+    event.values[1] = b;
+    event.values[2] = c;
+    event.values[3] = d;
+
+    SDL_AtomicSet(&event.sequence, index + 1);
+}
+
+bool FlightRecorder::dump(const char* reason, bool automatic)
+{
+    if (m_Events == nullptr) {
+        return false;
+    }
+
+    if (automatic) {
+        Uint32 now = SDL_GetTicks();
+        Uint32 lastDump = (Uint32)SDL_AtomicGet(&m_LastAutomaticDumpTicks);
+        if (lastDump != 0 && now - lastDump < MIN_AUTOMATIC_DUMP_INTERVAL_MS) {
+            return false;
+        }
+        if (!SDL_AtomicCAS(&m_LastAutomaticDumpTicks, (int)lastDump, (int)(now | 1))) {
+            return false;
+        }
+    }
+
+    uint64_t dumpTimeUs = LiGetMicroseconds();
+    QVector<FlightRecorderSnapshotEvent> events;
+    events.reserve(FLIGHT_RECORDER_EVENTS);
+
+    for (int i = 0; i < FLIGHT_RECORDER_EVENTS; i++) {
+        const Event& event = m_Events[i];
+
+        // Skip events that were written while we copied them
+        int sequence = SDL_AtomicGet((SDL_atomic_t*)&event.sequence);
+        if (sequence == 0) {
+            continue;
+        }
+
+        FlightRecorderSnapshotEvent snapshot;
+        snapshot.index = sequence - 1;
+        snapshot.type = event.type;
+        snapshot.timeUs = event.timeUs;
+        memcpy(snapshot.values, event.values, sizeof(snapshot.values));
+
+        if (SDL_AtomicGet((SDL_atomic_t*)&event.sequence) != sequence) {
+            continue;
+        }
+
+        events.append(snapshot);
+    }
+
+    // Order by index relative to the newest, since indexes wrap
+    int nextIndex = SDL_AtomicGet(&m_NextIndex);
+    std::sort(events.begin(), events.end(),
+              [nextIndex](const FlightRecorderSnapshotEvent& x, const FlightRecorderSnapshotEvent& y) {
+        return nextIndex - x.index > nextIndex - y.index;
+    });
+
+    SDL_LogInfo(SDL_LOG_CATEGORY_APPLICATION,
+                "FlightRecorder: Dumping %d events (%s)",
+                events.size(),
+                reason);
+
+    // The global pool is drained before we exit, so the dump is always finished
+    QThreadPool::globalInstance()->start(new FlightRecorderDumpTask(events, reason, dumpTimeUs));
+    return true;
+}
@@ -0,0 +1,49 @@
+#pragma once
+
+#include "SDL_compat.h"
+
+// Enough for about 30 seconds of a 120 FPS stream with 1 kHz mouse input
+#define FLIGHT_RECORDER_EVENTS 65536
+
+// An always-on record of recent per-frame timings, pacer drops, audio queue
+// depth and input sends for diagnosing stutter after the fact. Events are
+// fixed-size binary records written to a ring from any thread without locks,
+// and nothing is formatted until the ring is dumped. Dumps are written to
+// the log directory on Ctrl+Alt+Shift+F and when the connection turns poor.
+//
+// Set ML_FLIGHT_RECORDER=0 to disable it.
+class FlightRecorder
+{
+public:
+    enum EventType {
+        EventFrameDecoded,      // Frame number, frame type, reassembly time (us), decode time (us)
+        EventFrameRendered,     // RTP timestamp, pacer time (us), render time (us), time since last render (us)
+        EventPacerDrop,         // RTP timestamp, queue depth, drop target, 0 for the pacing queue or 1 for the render queue
+        EventAudioSubmitted,    // Pending audio (ms), renderer latency (ms), 1 if submitted
+        EventInputSent,         // Input latency (us)
+        EventConnectionStatus,  // CONN_STATUS_* value
+    };
+
+    FlightRecorder();
+    ~FlightRecorder();
+
+    void record(EventType type, uint32_t a = 0, uint32_t b = 0, uint32_t c = 0, uint32_t d = 0);
+
+    // Copies the ring and writes it out on a background thread. Automatic
+    // dumps are skipped if the last one covers most of the same events.
+    // Returns false if nothing was dumped.
+    bool dump(const char* reason, bool automatic);
+
+private:
+    struct Event {
+        // The event's index plus one once written, or 0 while being written
+        SDL_atomic_t sequence;
+        int type;
+        uint64_t timeUs;
+        uint32_t values[4];
+    };
+
+    Event* m_Events;
+    SDL_atomic_t m_NextIndex;
+    SDL_atomic_t m_LastAutomaticDumpTicks;
+};
@@ -0,0 +1,103 @@
+#include "hostclock.h"
+
+// Publish a new offset estimate this often. Long enough that a window
+// almost always has a frame that wasn't queued anywhere, and short enough
+// that drift between the two clocks (typically well under 100 ppm) stays
+// below 0.2 ms per window.
+#define HOST_CLOCK_WINDOW_US 2000000
+
+// Anything translated outside this range is a frame we don't have a valid
+// RTP timestamp for
+#define HOST_CLOCK_MAX_AGE_US 10000000
+
+// RTP video timestamps use a 90 kHz clock
+#define RTP_TICKS_PER_MS 90
+
+HostClock::HostClock()
+    : m_HaveRtpTimestamp(false),
+      m_LastRtpTimestamp(0),
+      m_ExtendedRtpTimestamp(0),
+      m_WindowMinOffsetUs(0),
+      m_WindowStartUs(0),
+      m_WindowSamples(0),
+      m_Lock(0),
+      m_Synchronized(false),
+      m_OffsetUs(0),
+      m_ReferenceRtpTimestamp(0),
+      m_ReferenceExtendedRtpTimestamp(0)
+{
+}
+
+void HostClock::addFrame(const DECODE_UNIT* du)
+{
+    // Unwrap the 32-bit RTP timestamp, which wraps every 13 hours
+    if (!m_HaveRtpTimestamp) {
+        m_ExtendedRtpTimestamp = du->rtpTimestamp;
+        m_HaveRtpTimestamp = true;
+    }
+    else {
+        m_ExtendedRtpTimestamp += (int32_t)(du->rtpTimestamp - m_LastRtpTimestamp);
+    }
+    m_LastRtpTimestamp = du->rtpTimestamp;
+
+    // We need the control channel RTT to estimate the one-way delay
+    uint32_t rttMs, rttVarianceMs;
+    if (!LiGetEstimatedRttInfo(&rttMs, &rttVarianceMs) || rttMs == 0) {
+        return;
+    }
+
+    // frameHostProcessingLatency is in units of 0.1 ms
+    int64_t offsetUs = (int64_t)du->receiveTimeUs -
+                       (int64_t)du->frameHostProcessingLatency * 100 -
+                       (int64_t)rttMs * 1000 / 2 -
+                       m_ExtendedRtpTimestamp * 1000 / RTP_TICKS_PER_MS;
+    if (m_WindowSamples == 0 || offsetUs < m_WindowMinOffsetUs) {
+        m_WindowMinOffsetUs = offsetUs;
+    }
+    m_WindowSamples++;
+
+    if (m_WindowStartUs == 0) {
+        m_WindowStartUs = du->receiveTimeUs;
+    }
+    if (du->receiveTimeUs - m_WindowStartUs < HOST_CLOCK_WINDOW_US) {
+        return;
+    }
+
+    SDL_AtomicLock(&m_Lock);
+    bool firstEstimate = !m_Synchronized;
+    m_OffsetUs = m_WindowMinOffsetUs;
+    m_ReferenceRtpTimestamp = m_LastRtpTimestamp;
+    m_ReferenceExtendedRtpTimestamp = m_ExtendedRtpTimestamp;
+    m_Synchronized = true;
+    SDL_AtomicUnlock(&m_Lock);
+
+    if (firstEstimate) {
+        SDL_LogInfo(SDL_LOG_CATEGORY_APPLICATION,
+                    "Synchronized with host clock from %u frames (uncertainty: +/- %u ms)",
+                    m_WindowSamples,
+                    rttMs / 2);
+    }
+
+    m_WindowStartUs = du->receiveTimeUs;
+    m_WindowSamples = 0;
+}
+
+uint64_t HostClock::getCaptureTimeUs(uint32_t rtpTimestamp)
+{
+    SDL_AtomicLock(&m_Lock);
+    if (!m_Synchronized) {
+        SDL_AtomicUnlock(&m_Lock);
+        return 0;
+    }
+    int64_t extendedRtpTimestamp = m_ReferenceExtendedRtpTimestamp + (int32_t)(rtpTimestamp - m_ReferenceRtpTimestamp);
+    int64_t offsetUs = m_OffsetUs;
+    SDL_AtomicUnlock(&m_Lock);
+
+    int64_t captureTimeUs = extendedRtpTimestamp * 1000 / RTP_TICKS_PER_MS + offsetUs;
+    int64_t now = (int64_t)LiGetMicroseconds();
+    if (captureTimeUs <= 0 || captureTimeUs > now || now - captureTimeUs > HOST_CLOCK_MAX_AGE_US) {
+        return 0;
+    }
+
+    return (uint64_t)captureTimeUs;
+}
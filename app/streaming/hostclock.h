@@ -0,0 +1,44 @@
+#pragma once
+
+#include <Limelight.h>
+#include "SDL_compat.h"
+
+// Maps the host's RTP video timestamps (its 90 kHz capture clock) onto our
+// LiGetMicroseconds() clock, so we can tell when the host captured a frame
+// we're about to display.
+//
+// GameStream doesn't exchange wall clock time, so this works like an NTP
+// clock filter over the frames themselves. Each frame gives an offset
+// sample: its arrival time, minus the host processing time reported in
+// the RTP header, minus half of the control channel RTT, minus its RTP
+// timestamp. Queuing can only make a frame late, so the smallest sample
+// in each window is the best estimate. Like NTP, this assumes the path is
+// symmetric, so the result is only accurate to within half the RTT.
+class HostClock
+{
+public:
+    HostClock();
+
+    // Called on the decoder thread with each received frame
+    void addFrame(const DECODE_UNIT* du);
+
+    // Returns the client time at which the host captured a recently received
+    // frame, or 0 if the clocks aren't synchronized yet. Callable from any thread.
+    uint64_t getCaptureTimeUs(uint32_t rtpTimestamp);
+
+private:
+    // Only touched by the decoder thread
+    bool m_HaveRtpTimestamp;
+    uint32_t m_LastRtpTimestamp;
+    int64_t m_ExtendedRtpTimestamp;
+    int64_t m_WindowMinOffsetUs;
+    uint64_t m_WindowStartUs;
+    uint32_t m_WindowSamples;
+
+    // Protects the published estimate below
+    SDL_SpinLock m_Lock;
+    bool m_Synchronized;
+    int64_t m_OffsetUs;
+    uint32_t m_ReferenceRtpTimestamp;
+    int64_t m_ReferenceExtendedRtpTimestamp;
+};
@@ -19,6 +19,12 @@
 // How far the finger can move before it can override the double tap deadzone
 #define DOUBLE_TAP_DEAD_ZONE_DELTA 0.025f
 
+// Used when the display doesn't report its refresh rate
+#define DEFAULT_TOUCH_BATCH_INTERVAL_MS 16
+
+// How much each new sample contributes to the smoothed touch velocity
+#define TOUCH_VELOCITY_SMOOTHING 0.5f
+
 Uint32 SdlInputHandler::longPressTimerCallback(Uint32, void*)
 {
     // Raise the left click and start a right click
@@ -114,9 +120,9 @@ void SdlInputHandler::handleAbsoluteFingerEvent(SDL_TouchFingerEvent* event)
 
     // Try to send it as a native pen/touch event, otherwise fall back to our touch emulation
     if (LiGetHostFeatureFlags() & LI_FF_PEN_TOUCH_EVENTS) {
-#if SDL_VERSION_ATLEAST(2, 0, 22)
         bool isPen = false;
 
+#if SDL_VERSION_ATLEAST(2, 0, 22)
         int numTouchDevices = SDL_GetNumTouchDevices();
         for (int i = 0; i < numTouchDevices; i++) {
             if (event->touchId == SDL_GetTouchDevice(i)) {
@@ -128,16 +134,14 @@ void SdlInputHandler::handleAbsoluteFingerEvent(SDL_TouchFingerEvent* event)
                 break;
             }
         }
+#endif
 
-        if (isPen) {
-            LiSendPenEvent(eventType, LI_TOOL_TYPE_PEN, 0, vidrelx / dst.w, vidrely / dst.h, event->pressure,
-                           0.0f, 0.0f, LI_ROT_UNKNOWN, LI_TILT_UNKNOWN);
+        if (m_TouchBatching) {
+            queueNativeTouchEvent(eventType, pointerId, isPen, vidrelx / dst.w, vidrely / dst.h,
+                                  event->pressure, event->timestamp);
         }
-        else
-#endif
-        {
-            LiSendTouchEvent(eventType, pointerId, vidrelx / dst.w, vidrely / dst.h, event->pressure,
-                             0.0f, 0.0f, LI_ROT_UNKNOWN);
+        else {
+            sendNativeTouchEvent(eventType, pointerId, isPen, vidrelx / dst.w, vidrely / dst.h, event->pressure);
         }
 
         if (!m_DisabledTouchFeedback) {
@@ -151,6 +155,120 @@ void SdlInputHandler::handleAbsoluteFingerEvent(SDL_TouchFingerEvent* event)
     }
 }
 
+void SdlInputHandler::sendNativeTouchEvent(uint8_t eventType, uint32_t pointerId, bool isPen, float x, float y, float pressure)
+{
+    if (isPen) {
+        LiSendPenEvent(eventType, LI_TOOL_TYPE_PEN, 0, x, y, pressure,
+                       0.0f, 0.0f, LI_ROT_UNKNOWN, LI_TILT_UNKNOWN);
+    }
+    else {
+        LiSendTouchEvent(eventType, pointerId, x, y, pressure,
+                         0.0f, 0.0f, LI_ROT_UNKNOWN);
+    }
+}
+
+void SdlInputHandler::queueNativeTouchEvent(uint8_t eventType, uint32_t pointerId, bool isPen, float x, float y, float pressure, uint32_t timestamp)
+{
+    NativeTouchState* touch = nullptr;
+    for (int i = 0; i < MAX_NATIVE_TOUCHES; i++) {
+        if (m_NativeTouches[i].active && m_NativeTouches[i].pointerId == pointerId) {
+            touch = &m_NativeTouches[i];
+            break;
+        }
+    }
+
+    if (eventType == LI_TOUCH_EVENT_MOVE && touch != nullptr) {
+        // Track how fast the contact is moving so we can predict ahead of it
+        uint32_t deltaMs = timestamp - touch->lastEventTime;
+        if (deltaMs > 0) {
+            touch->velocityX += ((x - touch->x) / deltaMs - touch->velocityX) * TOUCH_VELOCITY_SMOOTHING;
+            touch->velocityY += ((y - touch->y) / deltaMs - touch->velocityY) * TOUCH_VELOCITY_SMOOTHING;
+            touch->lastEventTime = timestamp;
+        }
+
+        touch->x = x;
+        touch->y = y;
+        touch->pressure = pressure;
+        touch->hasPendingMove = true;
+
+        if (m_TouchFlushTimer == 0) {
+            SDL_DisplayMode mode;
+            Uint32 intervalMs = DEFAULT_TOUCH_BATCH_INTERVAL_MS;
+            if (SDL_GetWindowDisplayMode(m_Window, &mode) == 0 && mode.refresh_rate > 0) {
+                intervalMs = qMax(1000 / mode.refresh_rate, 1);
+            }
+
+            m_TouchFlushTimer = SDL_AddTimer(intervalMs,
+                                             SdlInputHandler::touchFlushTimerCallback,
+                                             nullptr);
+        }
+        return;
+    }
+
+    // Contacts going down or up are sent immediately, after any motion
+    // that came before them so the host sees everything in order.
+    flushTouchMotion();
+    sendNativeTouchEvent(eventType, pointerId, isPen, x, y, pressure);
+
+    if (eventType == LI_TOUCH_EVENT_DOWN) {
+        if (touch == nullptr) {
+            for (int i = 0; i < MAX_NATIVE_TOUCHES; i++) {
+                if (!m_NativeTouches[i].active) {
+                    touch = &m_NativeTouches[i];
+                    break;
+                }
+            }
+        }
+
+        // If we're out of slots, this contact's motion just isn't batched
+        if (touch != nullptr) {
+            SDL_zerop(touch);
+            touch->active = true;
+            touch->isPen = isPen;
+            touch->pointerId = pointerId;
+            touch->x = x;
+            touch->y = y;
+            touch->pressure = pressure;
+            touch->lastEventTime = timestamp;
+        }
+    }
+    else if (touch != nullptr) {
+        touch->active = false;
+    }
+}
+
+Uint32 SdlInputHandler::touchFlushTimerCallback(Uint32, void*)
+{
+    // Flush on the main thread, which owns the touch state
+    SDL_Event event;
+    event.type = SDL_USEREVENT;
+    event.user.code = SDL_CODE_TOUCH_FLUSH_MOTION;
+    SDL_PushEvent(&event);
+
+    return 0;
+}
+
+void SdlInputHandler::flushTouchMotion()
+{
+    SDL_RemoveTimer(m_TouchFlushTimer);
+    m_TouchFlushTimer = 0;
+
+    for (int i = 0; i < MAX_NATIVE_TOUCHES; i++) {
+        NativeTouchState* touch = &m_NativeTouches[i];
+        if (!touch->active || !touch->hasPendingMove) {
+            continue;
+        }
+
+        // Extrapolate drags to hide some of the round trip to the host.
+        // The position in the final up event is always the real one.
+        float x = qBound(0.0f, touch->x + touch->velocityX * m_TouchPredictionMs, 1.0f);
+        float y = qBound(0.0f, touch->y + touch->velocityY * m_TouchPredictionMs, 1.0f);
+
+        sendNativeTouchEvent(LI_TOUCH_EVENT_MOVE, touch->pointerId, touch->isPen, x, y, touch->pressure);
+        touch->hasPendingMove = false;
+    }
+}
+
 void SdlInputHandler::emulateAbsoluteFingerEvent(SDL_TouchFingerEvent* event)
 {
     // Observations on Windows 10: x and y appear to be relative to 0,0 of the window client area.
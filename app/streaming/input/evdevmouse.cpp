@@ -0,0 +1,426 @@
+#include "evdevmouse.h"
+#include "streaming/streamutils.h"
+
+#include <Limelight.h>
+
+#include <QDir>
+
+#include <errno.h>
+#include <fcntl.h>
+#include <poll.h>
+#include <unistd.h>
+#include <linux/input.h>
+#include <sys/eventfd.h>
+#include <sys/ioctl.h>
+#include <time.h>
+
+// Older kernel headers only have the timeval member
+#ifndef input_event_sec
+#define input_event_sec time.tv_sec
+#define input_event_usec time.tv_usec
+#endif
+
+// How often we look for newly attached mice
+#define EVDEV_RESCAN_INTERVAL_MS 1000
+
+#define EVDEV_MAX_DEVICES 16
+
+#define BITS_PER_LONG (sizeof(unsigned long) * 8)
+#define NBITS(x) ((((x) - 1) / BITS_PER_LONG) + 1)
+
+static bool testBit(const unsigned long* bits, int bit)
+{
+    return (bits[bit / BITS_PER_LONG] >> (bit % BITS_PER_LONG)) & 1;
+}
+
+EvdevMouseReader::EvdevMouseReader(bool swapMouseButtons, int mouseSendRate, InputLatencyMonitor* latencyMonitor)
+    : m_SwapMouseButtons(swapMouseButtons),
+      m_LatencyMonitor(latencyMonitor),
+      m_Thread(nullptr),
+      m_WakeFd(-1),
+      m_LastScanTime(0),
+      m_Forwarding(false),
+      m_DroppedEvents(false),
+      m_PendingDeltaX(0),
+      m_PendingDeltaY(0),
+      m_ButtonsDown(0)
+{
+    SDL_AtomicSet(&m_Active, 0);
+    SDL_AtomicSet(&m_Stopping, 0);
+    SDL_AtomicSet(&m_DeviceCount, 0);
+    timerclear(&m_PendingEventTime);
+    m_Motion.setSendRate(mouseSendRate);
+}
+
+EvdevMouseReader::~EvdevMouseReader()
+{
+    if (m_Thread != nullptr) {
+        SDL_AtomicSet(&m_Stopping, 1);
+
+        uint64_t value = 1;
+        if (write(m_WakeFd, &value, sizeof(value)) < 0) {
+            SDL_LogWarn(SDL_LOG_CATEGORY_APPLICATION,
+                        "Failed to wake mouse input thread: %d",
+                        errno);
+        }
+
+        SDL_WaitThread(m_Thread, nullptr);
+    }
+
+    for (const Device& device : m_Devices) {
+        close(device.fd);
+    }
+
+    if (m_WakeFd >= 0) {
+        close(m_WakeFd);
+    }
+}
+
+bool EvdevMouseReader::start()
+{
+    m_WakeFd = eventfd(0, EFD_CLOEXEC | EFD_NONBLOCK);
+    if (m_WakeFd < 0) {
+        SDL_LogError(SDL_LOG_CATEGORY_APPLICATION,
+                     "eventfd() failed: %d",
+                     errno);
+        return false;
+    }
+
+    scanDevices();
+    if (m_Devices.isEmpty()) {
+        SDL_LogWarn(SDL_LOG_CATEGORY_APPLICATION,
+                    "No readable evdev mice found. Is this user in the input group?");
+        return false;
+    }
+
+    m_Thread = SDL_CreateThread(EvdevMouseReader::readerThreadProc, "Mouse Input", this);
+    if (m_Thread == nullptr) {
+        SDL_LogError(SDL_LOG_CATEGORY_APPLICATION,
+                     "SDL_CreateThread() failed: %s",
+                     SDL_GetError());
+        return false;
+    }
+
+    return true;
+}
+
+void EvdevMouseReader::setActive(bool active)
+{
+    SDL_AtomicSet(&m_Active, active ? 1 : 0);
+
+    // Wake the reader so it can release any buttons it has pressed
+    uint64_t value = 1;
+    if (write(m_WakeFd, &value, sizeof(value)) < 0) {
+        SDL_LogWarn(SDL_LOG_CATEGORY_APPLICATION,
+                    "Failed to wake mouse input thread: %d",
+                    errno);
+    }
+}
+
+bool EvdevMouseReader::isActive()
+{
+    return SDL_AtomicGet(&m_Active) && SDL_AtomicGet(&m_DeviceCount) > 0;
+}
+
+void EvdevMouseReader::scanDevices()
+{
+    m_LastScanTime = SDL_GetTicks();
+
+    // Only probe nodes that have appeared since the last scan
+    QStringList nodes = QDir("/dev/input").entryList(QStringList("event*"), QDir::System);
+    for (const QString& node : nodes) {
+        if (m_KnownNodes.contains(node) || m_Devices.size() >= EVDEV_MAX_DEVICES) {
+            continue;
+        }
+
+        QString path = "/dev/input/" + node;
+        int fd = open(path.toUtf8().constData(), O_RDONLY | O_NONBLOCK | O_CLOEXEC);
+        if (fd < 0) {
+            continue;
+        }
+
+        unsigned long evBits[NBITS(EV_MAX + 1)] = {};
+        unsigned long relBits[NBITS(REL_MAX + 1)] = {};
+        unsigned long keyBits[NBITS(KEY_MAX + 1)] = {};
+        if (ioctl(fd, EVIOCGBIT(0, sizeof(evBits)), evBits) < 0 ||
+                ioctl(fd, EVIOCGBIT(EV_REL, sizeof(relBits)), relBits) < 0 ||
+                ioctl(fd, EVIOCGBIT(EV_KEY, sizeof(keyBits)), keyBits) < 0) {
+            close(fd);
+            continue;
+        }
+
+        // Touchpads and tablets report absolute axes, so they're left to SDL
+        if (!testBit(evBits, EV_REL) || !testBit(relBits, REL_X) || !testBit(relBits, REL_Y) ||
+                !testBit(keyBits, BTN_LEFT)) {
+            close(fd);
+            continue;
+        }
+
+        // Stamp events with the same clock we compare them against
+        int clockId = CLOCK_MONOTONIC;
+        ioctl(fd, EVIOCSCLOCKID, &clockId);
+
+        char name[256] = {};
+        ioctl(fd, EVIOCGNAME(sizeof(name) - 1), name);
+        SDL_LogInfo(SDL_LOG_CATEGORY_APPLICATION,
+                    "Reading mouse input from %s (%s)",
+                    path.toUtf8().constData(),
+                    name);
+
+        Device device;
+        device.path = path;
+        device.fd = fd;
+        m_Devices.append(device);
+    }
+
+    m_KnownNodes = nodes;
+    SDL_AtomicSet(&m_DeviceCount, m_Devices.size());
+}
+
+void EvdevMouseReader::closeDevice(int index)
+{
+    SDL_LogInfo(SDL_LOG_CATEGORY_APPLICATION,
+                "Mouse removed: %s",
+                m_Devices[index].path.toUtf8().constData());
+
+    close(m_Devices[index].fd);
+    m_Devices.remove(index);
+    SDL_AtomicSet(&m_DeviceCount, m_Devices.size());
+}
+
+int EvdevMouseReader::readerThreadProc(void* context)
+{
+    auto me = (EvdevMouseReader*)context;
+    struct pollfd fds[1 + EVDEV_MAX_DEVICES];
+    struct input_event events[64];
+
+    StreamUtils::placeCurrentThread(StreamUtils::TPC_LATENCY_CRITICAL);
+    SDL_SetThreadPriority(SDL_THREAD_PRIORITY_HIGH);
+
+    while (!SDL_AtomicGet(&me->m_Stopping)) {
+        if (SDL_GetTicks() - me->m_LastScanTime >= EVDEV_RESCAN_INTERVAL_MS) {
+            me->scanDevices();
+        }
+
+        fds[0].fd = me->m_WakeFd;
+        fds[0].events = POLLIN;
+        for (int i = 0; i < me->m_Devices.size(); i++) {
+            fds[i + 1].fd = me->m_Devices[i].fd;
+            fds[i + 1].events = POLLIN;
+        }
+
+        // Wake up when batched motion is due to be sent
+        struct timespec timeout;
+        if (me->m_Motion.hasPendingMotion()) {
+            uint32_t delayUs = me->m_Motion.getFlushDelayUs();
+            timeout.tv_sec = delayUs / 1000000;
+            timeout.tv_nsec = (delayUs % 1000000) * 1000;
+        }
+        else {
+            timeout.tv_sec = EVDEV_RESCAN_INTERVAL_MS / 1000;
+            timeout.tv_nsec = (EVDEV_RESCAN_INTERVAL_MS % 1000) * 1000000;
+        }
+
+        int deviceCount = me->m_Devices.size();
+        if (ppoll(fds, 1 + deviceCount, &timeout, nullptr) < 0) {
+            if (errno == EINTR) {
+                continue;
+            }
+
+            SDL_LogError(SDL_LOG_CATEGORY_APPLICATION,
+                         "ppoll() failed: %d",
+                         errno);
+            break;
+        }
+
+        if (fds[0].revents & POLLIN) {
+            uint64_t value;
+            if (read(me->m_WakeFd, &value, sizeof(value)) < 0) {
+                // Spurious wakeup
+            }
+        }
+
+        bool active = SDL_AtomicGet(&me->m_Active) != 0;
+        if (me->m_Forwarding && !active) {
+            // Don't leave buttons stuck down on the host when capture ends
+            me->releaseButtons();
+            me->m_PendingDeltaX = me->m_PendingDeltaY = 0;
+            me->m_Motion.reset();
+        }
+        me->m_Forwarding = active;
+
+        // Walk backwards so removing a device doesn't shift the ones we haven't visited
+        for (int i = deviceCount - 1; i >= 0; i--) {
+            if (fds[i + 1].revents & (POLLERR | POLLHUP | POLLNVAL)) {
+                me->closeDevice(i);
+                continue;
+            }
+            else if (!(fds[i + 1].revents & POLLIN)) {
+                continue;
+            }
+
+            for (;;) {
+                ssize_t bytesRead = read(me->m_Devices[i].fd, events, sizeof(events));
+                if (bytesRead < 0) {
+                    if (errno != EAGAIN && errno != EINTR) {
+                        me->closeDevice(i);
+                    }
+                    break;
+                }
+
+                for (size_t j = 0; j < (size_t)bytesRead / sizeof(events[0]); j++) {
+                    me->handleEvent(&events[j]);
+                }
+
+                if ((size_t)bytesRead < sizeof(events)) {
+                    break;
+                }
+            }
+        }
+
+        // Send batched motion if its interval has passed. Motion from a
+        // report that hasn't been completed by SYN_REPORT isn't included.
+        me->flushMotion(false);
+    }
+
+    me->releaseButtons();
+    return 0;
+}
+
+void EvdevMouseReader::handleEvent(const struct input_event* event)
+{
+    if (event->type == EV_SYN) {
+        if (event->code == SYN_DROPPED) {
+            // The kernel's buffer overflowed, so skip to the next report
+            m_DroppedEvents = true;
+            m_PendingDeltaX = m_PendingDeltaY = 0;
+        }
+        else if (event->code == SYN_REPORT) {
+            if (m_DroppedEvents) {
+                m_DroppedEvents = false;
+            }
+            else {
+                m_Motion.addMotion(m_PendingDeltaX, m_PendingDeltaY);
+                m_PendingDeltaX = m_PendingDeltaY = 0;
+                flushMotion(false);
+            }
+        }
+        return;
+    }
+    else if (m_DroppedEvents) {
+        return;
+    }
+
+    if (event->type == EV_REL) {
+        if (event->code != REL_X && event->code != REL_Y) {
+            return;
+        }
+
+        // Latency is measured from the oldest motion we haven't sent
+        if (m_PendingDeltaX == 0 && m_PendingDeltaY == 0 && !m_Motion.hasPendingMotion()) {
+            m_PendingEventTime.tv_sec = event->input_event_sec;
+            m_PendingEventTime.tv_usec = event->input_event_usec;
+        }
+
+        if (event->code == REL_X) {
+            m_PendingDeltaX += event->value;
+        }
+        else {
+            m_PendingDeltaY += event->value;
+        }
+    }
+    else if (event->type == EV_KEY) {
+        int button;
+
+        switch (event->code) {
+        case BTN_LEFT:
+            button = BUTTON_LEFT;
+            break;
+        case BTN_MIDDLE:
+            button = BUTTON_MIDDLE;
+            break;
+        case BTN_RIGHT:
+            button = BUTTON_RIGHT;
+            break;
+        case BTN_SIDE:
+        case BTN_BACK:
+            button = BUTTON_X1;
+            break;
+        case BTN_EXTRA:
+        case BTN_FORWARD:
+            button = BUTTON_X2;
+            break;
+        default:
+            return;
+        }
+
+        if (m_SwapMouseButtons) {
+            if (button == BUTTON_RIGHT)
+                button = BUTTON_LEFT;
+            else if (button == BUTTON_LEFT)
+                button = BUTTON_RIGHT;
+        }
+
+        // Keep the motion that happened before this button ordered ahead of it
+        m_Motion.addMotion(m_PendingDeltaX, m_PendingDeltaY);
+        m_PendingDeltaX = m_PendingDeltaY = 0;
+        flushMotion(true);
+
+        if (event->value == 1 && m_Forwarding && !(m_ButtonsDown & (1 << button))) {
+            m_ButtonsDown |= 1 << button;
+            LiSendMouseButtonEvent(BUTTON_ACTION_PRESS, button);
+            addLatencySample(event);
+
+            if (button == BUTTON_LEFT) {
+                m_LatencyMonitor->notifyClickSent();
+            }
+        }
+        else if (event->value == 0 && (m_ButtonsDown & (1 << button))) {
+            // Releases are sent even when inactive to match the presses we sent
+            m_ButtonsDown &= ~(1 << button);
+            LiSendMouseButtonEvent(BUTTON_ACTION_RELEASE, button);
+            addLatencySample(event);
+        }
+    }
+}
+
+void EvdevMouseReader::flushMotion(bool force)
+{
+    if (!m_Forwarding) {
+        m_PendingDeltaX = m_PendingDeltaY = 0;
+        m_Motion.reset();
+        return;
+    }
+
+    if (m_Motion.flush(force)) {
+        struct input_event event = {};
+        event.input_event_sec = m_PendingEventTime.tv_sec;
+        event.input_event_usec = m_PendingEventTime.tv_usec;
+        addLatencySample(&event);
+    }
+}
+
+void EvdevMouseReader::releaseButtons()
+{
+    for (int button = BUTTON_LEFT; button <= BUTTON_X2; button++) {
+        if (m_ButtonsDown & (1 << button)) {
+            LiSendMouseButtonEvent(BUTTON_ACTION_RELEASE, button);
+        }
+    }
+
+    m_ButtonsDown = 0;
+}
+
+void EvdevMouseReader::addLatencySample(const struct input_event* event)
+{
+    struct timespec now;
+    clock_gettime(CLOCK_MONOTONIC, &now);
+
+    int64_t latencyUs = ((int64_t)now.tv_sec - event->input_event_sec) * 1000000 +
+                        (now.tv_nsec / 1000 - (int64_t)event->input_event_usec);
+
+    // Ignore events from devices that didn't accept our clock
+    if (latencyUs >= 0 && latencyUs < 1000000) {
+        m_LatencyMonitor->addSample((uint32_t)latencyUs);
+    }
+}
@@ -0,0 +1,80 @@
+#pragma once
+
+#include "SDL_compat.h"
+#include "inputlatency.h"
+#include "relativemotion.h"
+
+#include <QStringList>
+#include <QVector>
+
+#include <sys/time.h>
+
+struct input_event;
+
+// Reads relative motion and buttons straight from the evdev mouse nodes on
+// a dedicated thread and sends them to the host at the mouse send rate, so
+// mouse input doesn't wait behind rendering and window events on the main
+// thread. Events are only forwarded while the input handler has relative
+// capture and our window has focus; otherwise SDL handles the mouse as usual.
+//
+// This needs read access to /dev/input/event* (usually by being in the
+// input group) and is enabled with ML_RAW_INPUT_THREAD=1.
+class EvdevMouseReader
+{
+public:
+    EvdevMouseReader(bool swapMouseButtons, int mouseSendRate, InputLatencyMonitor* latencyMonitor);
+
+    ~EvdevMouseReader();
+
+    // Opens the mice and starts the reader thread. Returns false if
+    // no mice could be opened.
+    bool start();
+
+    // Called on the main thread when relative capture starts or stops
+    void setActive(bool active);
+
+    // True when the reader is sending mouse input instead of SDL
+    bool isActive();
+
+private:
+    struct Device {
+        QString path;
+        int fd;
+    };
+
+    static int readerThreadProc(void* context);
+
+    void scanDevices();
+
+    void closeDevice(int index);
+
+    void handleEvent(const struct input_event* event);
+
+    void flushMotion(bool force);
+
+    void releaseButtons();
+
+    void addLatencySample(const struct input_event* event);
+
+    bool m_SwapMouseButtons;
+    InputLatencyMonitor* m_LatencyMonitor;
+    SDL_Thread* m_Thread;
+    int m_WakeFd;
+    SDL_atomic_t m_Active;
+    SDL_atomic_t m_Stopping;
+    SDL_atomic_t m_DeviceCount;
+
+    // Only touched by the reader thread once it has started
+    QVector<Device> m_Devices;
+    QStringList m_KnownNodes;
+    Uint32 m_LastScanTime;
+    bool m_Forwarding;
+    bool m_DroppedEvents;
+    int m_PendingDeltaX;
+    int m_PendingDeltaY;
+    RelativeMotionAccumulator m_Motion;
+
+    // Time of the oldest motion that hasn't been sent yet
+    struct timeval m_PendingEventTime;
+    int m_ButtonsDown;
+};
@@ -18,6 +18,24 @@
 // Determines the maximum motion amount before allowing movement
 #define MOUSE_EMULATION_DEADZONE 2
 
+// How often an unchanged rumble effect may be written again
+#define HAPTICS_REFRESH_INTERVAL_MS 5000
+
+// Gaps between motion sensor samples longer than this aren't integrated
+#define MOTION_SAMPLE_MAX_GAP_US 50000
+
+// How close to 1 g the accelerometer must read for the controller to be still
+#define GYRO_STILL_ACCEL_TOLERANCE 0.5f
+
+// How far from the current bias the gyro may read (in rad/s) while still
+#define GYRO_STILL_RATE_TOLERANCE 0.05f
+
+// How long the controller must be still before we start learning the bias
+#define GYRO_STILL_SETTLE_TIME_US 500000
+
+// How quickly the gyro bias estimate follows the readings while still
+#define GYRO_BIAS_TIME_CONSTANT_US 2000000
+
 // Haptic capabilities (in addition to those from SDL_HapticQuery())
 #define ML_HAPTIC_GC_RUMBLE         (1U << 16)
 #define ML_HAPTIC_SIMPLE_RUMBLE     (1U << 17)
@@ -51,7 +69,15 @@ SdlInputHandler::findStateForGamepad(SDL_JoystickID id)
     return nullptr;
 }
 
-void SdlInputHandler::sendGamepadState(GamepadState* state)
+static bool gamepadReportsEqual(const GamepadReport& a, const GamepadReport& b)
+{
+    return a.buttons == b.buttons &&
+           a.lt == b.lt && a.rt == b.rt &&
+           a.lsX == b.lsX && a.lsY == b.lsY &&
+           a.rsX == b.rsX && a.rsY == b.rsY;
+}
+
+bool SdlInputHandler::sendGamepadState(GamepadState* state)
 {
     SDL_assert(m_GamepadMask == 0x1 || m_MultiController);
 
@@ -68,48 +94,117 @@ void SdlInputHandler::sendGamepadState(GamepadState* state)
         }
     }
 
-    unsigned char lt = state->lt;
-    unsigned char rt = state->rt;
-    short lsX = state->lsX;
-    short lsY = state->lsY;
-    short rsX = state->rsX;
-    short rsY = state->rsY;
-
-    // When in single controller mode, merge all gamepad state together
-    if (!m_MultiController) {
+    GamepadReport report;
+    report.buttons = buttons;
+    report.lt = state->lt;
+    report.rt = state->rt;
+    report.lsX = state->lsX;
+    report.lsY = state->lsY;
+    report.rsX = state->rsX;
+    report.rsY = state->rsY;
+
+    // When in single controller mode, merge all gamepad state together.
+    // With only one gamepad attached, there's nothing to merge.
+    if (!m_MultiController && m_AttachedGamepads > 1) {
         for (int i = 0; i < MAX_GAMEPADS; i++) {
-            if (m_GamepadState[i].index == state->index) {
-                buttons |= m_GamepadState[i].buttons;
-                if (lt < m_GamepadState[i].lt) {
-                    lt = m_GamepadState[i].lt;
+            if (m_GamepadState[i].controller != nullptr && m_GamepadState[i].index == state->index) {
+                report.buttons |= m_GamepadState[i].buttons;
+                if (report.lt < m_GamepadState[i].lt) {
+                    report.lt = m_GamepadState[i].lt;
                 }
-                if (rt < m_GamepadState[i].rt) {
-                    rt = m_GamepadState[i].rt;
+                if (report.rt < m_GamepadState[i].rt) {
+                    report.rt = m_GamepadState[i].rt;
                 }
 
                 // We use abs() here instead of qAbs() for get proper integer promotion to
                 // correctly handle abs(-32768), which is not representable in a short.
-                if (abs(lsX) < abs(m_GamepadState[i].lsX) || abs(lsY) < abs(m_GamepadState[i].lsY)) {
-                    lsX = m_GamepadState[i].lsX;
-                    lsY = m_GamepadState[i].lsY;
+                if (abs(report.lsX) < abs(m_GamepadState[i].lsX) || abs(report.lsY) < abs(m_GamepadState[i].lsY)) {
+                    report.lsX = m_GamepadState[i].lsX;
+                    report.lsY = m_GamepadState[i].lsY;
                 }
-                if (abs(rsX) < abs(m_GamepadState[i].rsX) || abs(rsY) < abs(m_GamepadState[i].rsY)) {
-                    rsX = m_GamepadState[i].rsX;
-                    rsY = m_GamepadState[i].rsY;
+                if (abs(report.rsX) < abs(m_GamepadState[i].rsX) || abs(report.rsY) < abs(m_GamepadState[i].rsY)) {
+                    report.rsX = m_GamepadState[i].rsX;
+                    report.rsY = m_GamepadState[i].rsY;
                 }
             }
         }
     }
 
-    LiSendMultiControllerEvent(state->index,
+    GamepadOutputState* output = &m_GamepadOutputs[state->index];
+    if (output->hasSentReport && gamepadReportsEqual(report, output->sentReport)) {
+        // The host already has this state, including if a held back
+        // change has since returned to it.
+        output->hasPendingReport = false;
+        return false;
+    }
+
+    // Button changes always go out immediately, but analog changes within
+    // the send interval are held until the flush timer fires. Only the
+    // latest state is kept, so we never send stale stick positions.
+    Uint32 now = SDL_GetTicks();
+    if (m_GamepadSendIntervalMs != 0 && output->hasSentReport &&
+            report.buttons == output->sentReport.buttons &&
+            now - output->lastSendTime < m_GamepadSendIntervalMs) {
+        output->pendingReport = report;
+        output->hasPendingReport = true;
+
+        if (m_GamepadFlushTimer == 0) {
+            m_GamepadFlushTimer = SDL_AddTimer(m_GamepadSendIntervalMs - (now - output->lastSendTime),
+                                               SdlInputHandler::gamepadFlushTimerCallback,
+                                               nullptr);
+        }
+        return false;
+    }
+
+    sendGamepadReport(state->index, report);
+    return true;
+}
+
+void SdlInputHandler::sendGamepadReport(short index, const GamepadReport& report)
+{
+    LiSendMultiControllerEvent(index,
                                m_GamepadMask,
-                               buttons,
-                               lt,
-                               rt,
-                               lsX,
-                               lsY,
-                               rsX,
-                               rsY);
+                               report.buttons,
+                               report.lt,
+                               report.rt,
+                               report.lsX,
+                               report.lsY,
+                               report.rsX,
+                               report.rsY);
+
+    GamepadOutputState* output = &m_GamepadOutputs[index];
+    output->sentReport = report;
+    output->hasSentReport = true;
+    output->hasPendingReport = false;
+    output->lastSendTime = SDL_GetTicks();
+}
+
+void SdlInputHandler::resetGamepadOutput(short index)
+{
+    // The next state for this controller number will be sent unconditionally
+    SDL_zero(m_GamepadOutputs[index]);
+}
+
+Uint32 SdlInputHandler::gamepadFlushTimerCallback(Uint32, void*)
+{
+    // Flush on the main thread, which owns the gamepad state
+    SDL_Event event;
+    event.type = SDL_USEREVENT;
+    event.user.code = SDL_CODE_GAMECONTROLLER_FLUSH_STATE;
+    SDL_PushEvent(&event);
+
+    return 0;
+}
+
+void SdlInputHandler::flushGamepadState()
+{
+    m_GamepadFlushTimer = 0;
+
+    for (short i = 0; i < MAX_GAMEPADS; i++) {
+        if (m_GamepadOutputs[i].hasPendingReport) {
+            sendGamepadReport(i, m_GamepadOutputs[i].pendingReport);
+        }
+    }
 }
 
 void SdlInputHandler::sendGamepadBatteryState(GamepadState* state, SDL_JoystickPowerLevel level)
@@ -196,6 +291,9 @@ void SdlInputHandler::handleControllerAxisEvent(SDL_ControllerAxisEvent* event)
         return;
     }
 
+    // Measure latency from the oldest event in the batch
+    Uint32 timestamp = event->timestamp;
+
     // Batch all pending axis motion events for this gamepad to save CPU time
     SDL_Event nextEvent;
     for (;;) {
@@ -247,8 +345,8 @@ void SdlInputHandler::handleControllerAxisEvent(SDL_ControllerAxisEvent* event)
     }
 
     // Only send the gamepad state to the host if it's not in mouse emulation mode
-    if (state->mouseEmulationTimer == 0) {
-        sendGamepadState(state);
+    if (state->mouseEmulationTimer == 0 && sendGamepadState(state)) {
+        Session::get()->getInputLatencyMonitor().addSdlEventSample(timestamp);
     }
 }
 
@@ -377,6 +475,7 @@ void SdlInputHandler::handleControllerButtonEvent(SDL_ControllerButtonEvent* eve
         // Clear buttons down on this gamepad
         LiSendMultiControllerEvent(state->index, m_GamepadMask,
                                    0, 0, 0, 0, 0, 0, 0);
+        resetGamepadOutput(state->index);
         return;
     }
 
@@ -392,17 +491,107 @@ void SdlInputHandler::handleControllerButtonEvent(SDL_ControllerButtonEvent* eve
         // Clear buttons down on this gamepad
         LiSendMultiControllerEvent(state->index, m_GamepadMask,
                                    0, 0, 0, 0, 0, 0, 0);
+        resetGamepadOutput(state->index);
         return;
     }
 
     // Only send the gamepad state to the host if it's not in mouse emulation mode
-    if (state->mouseEmulationTimer == 0) {
-        sendGamepadState(state);
+    if (state->mouseEmulationTimer == 0 && sendGamepadState(state)) {
+        Session::get()->getInputLatencyMonitor().addSdlEventSample(event->timestamp);
     }
 }
 
 #if SDL_VERSION_ATLEAST(2, 0, 14)
 
+static uint64_t getSensorTimestampUs(SDL_ControllerSensorEvent* event)
+{
+#if SDL_VERSION_ATLEAST(2, 26, 0)
+    // Use the hardware timestamp if the controller provides one
+    if (event->timestamp_us != 0) {
+        return event->timestamp_us;
+    }
+#endif
+
+    return (uint64_t)event->timestamp * 1000;
+}
+
+static void integrateMotionSample(MotionSensorState* sensor, const float* data, uint64_t timeUs)
+{
+    if (sensor->lastSampleTimeUs != 0 && timeUs > sensor->lastSampleTimeUs &&
+            timeUs - sensor->lastSampleTimeUs <= MOTION_SAMPLE_MAX_GAP_US) {
+        uint32_t deltaUs = (uint32_t)(timeUs - sensor->lastSampleTimeUs);
+        for (int i = 0; i < 3; i++) {
+            sensor->integratedData[i] += data[i] * deltaUs;
+        }
+        sensor->integratedTimeUs += deltaUs;
+    }
+
+    sensor->lastSampleTimeUs = timeUs;
+}
+
+// Returns true with the average since the last report if a report is due
+static bool takeMotionReport(MotionSensorState* sensor, const float* data, uint64_t timeUs, float* report)
+{
+    if (sensor->reportPeriodUs == 0 || timeUs - sensor->lastReportTimeUs < sensor->reportPeriodUs) {
+        return false;
+    }
+
+    for (int i = 0; i < 3; i++) {
+        report[i] = sensor->integratedTimeUs != 0 ?
+                        sensor->integratedData[i] / sensor->integratedTimeUs :
+                        data[i];
+        sensor->integratedData[i] = 0;
+    }
+    sensor->integratedTimeUs = 0;
+
+    // Keep reports on the host's cadence unless we've fallen behind it
+    sensor->lastReportTimeUs += sensor->reportPeriodUs;
+    if (timeUs - sensor->lastReportTimeUs >= sensor->reportPeriodUs) {
+        sensor->lastReportTimeUs = timeUs;
+    }
+
+    if (memcmp(report, sensor->lastReportData, sizeof(sensor->lastReportData)) == 0) {
+        return false;
+    }
+
+    memcpy(sensor->lastReportData, report, sizeof(sensor->lastReportData));
+    return true;
+}
+
+// Learns the gyro's zero-rate offset while the accelerometer shows the
+// controller resting, so gyro aim doesn't slowly drift on the host.
+static void updateGyroBias(GamepadState* state, const float* gyro, uint64_t timeUs)
+{
+    uint64_t lastSampleTimeUs = state->gyro.lastSampleTimeUs;
+    if (lastSampleTimeUs == 0 || timeUs <= lastSampleTimeUs ||
+            timeUs - lastSampleTimeUs > MOTION_SAMPLE_MAX_GAP_US) {
+        return;
+    }
+
+    bool still = fabsf(state->lastAccelMagnitude - SDL_STANDARD_GRAVITY) < GYRO_STILL_ACCEL_TOLERANCE;
+    for (int i = 0; i < 3; i++) {
+        if (fabsf(gyro[i] - state->gyroBias[i]) > GYRO_STILL_RATE_TOLERANCE) {
+            still = false;
+        }
+    }
+
+    if (!still) {
+        state->stillTimeUs = 0;
+        return;
+    }
+
+    uint32_t deltaUs = (uint32_t)(timeUs - lastSampleTimeUs);
+    if (state->stillTimeUs < GYRO_STILL_SETTLE_TIME_US) {
+        state->stillTimeUs += deltaUs;
+        return;
+    }
+
+    float alpha = (float)deltaUs / GYRO_BIAS_TIME_CONSTANT_US;
+    for (int i = 0; i < 3; i++) {
+        state->gyroBias[i] += (gyro[i] - state->gyroBias[i]) * alpha;
+    }
+}
+
 void SdlInputHandler::handleControllerSensorEvent(SDL_ControllerSensorEvent* event)
 {
     GamepadState* state = findStateForGamepad(event->which);
@@ -410,32 +599,42 @@ void SdlInputHandler::handleControllerSensorEvent(SDL_ControllerSensorEvent* eve
         return;
     }
 
+    uint64_t timeUs = getSensorTimestampUs(event);
+    float report[3];
+
     switch (event->sensor) {
     case SDL_SENSOR_ACCEL:
-        if (state->accelReportPeriodMs &&
-                SDL_TICKS_PASSED(event->timestamp, state->lastAccelEventTime + state->accelReportPeriodMs) &&
-                memcmp(event->data, state->lastAccelEventData, sizeof(event->data)) != 0) {
-            memcpy(state->lastAccelEventData, event->data, sizeof(event->data));
-            state->lastAccelEventTime = event->timestamp;
+        state->lastAccelMagnitude = sqrtf(event->data[0] * event->data[0] +
+                                          event->data[1] * event->data[1] +
+                                          event->data[2] * event->data[2]);
 
-            LiSendControllerMotionEvent((uint8_t)state->index, LI_MOTION_TYPE_ACCEL, event->data[0], event->data[1], event->data[2]);
+        integrateMotionSample(&state->accel, event->data, timeUs);
+        if (takeMotionReport(&state->accel, event->data, timeUs, report)) {
+            LiSendControllerMotionEvent((uint8_t)state->index, LI_MOTION_TYPE_ACCEL, report[0], report[1], report[2]);
         }
         break;
     case SDL_SENSOR_GYRO:
-        if (state->gyroReportPeriodMs &&
-                SDL_TICKS_PASSED(event->timestamp, state->lastGyroEventTime + state->gyroReportPeriodMs) &&
-                memcmp(event->data, state->lastGyroEventData, sizeof(event->data)) != 0) {
-            memcpy(state->lastGyroEventData, event->data, sizeof(event->data));
-            state->lastGyroEventTime = event->timestamp;
+    {
+        float gyro[3];
+
+        if (m_GyroDriftCorrection) {
+            updateGyroBias(state, event->data, timeUs);
+        }
+        for (int i = 0; i < 3; i++) {
+            gyro[i] = event->data[i] - state->gyroBias[i];
+        }
 
+        integrateMotionSample(&state->gyro, gyro, timeUs);
+        if (takeMotionReport(&state->gyro, gyro, timeUs, report)) {
             // Convert rad/s to deg/s
             LiSendControllerMotionEvent((uint8_t)state->index, LI_MOTION_TYPE_GYRO,
-                                        event->data[0] * 57.2957795f,
-                                        event->data[1] * 57.2957795f,
-                                        event->data[2] * 57.2957795f);
+                                        report[0] * 57.2957795f,
+                                        report[1] * 57.2957795f,
+                                        report[2] * 57.2957795f);
         }
         break;
     }
+    }
 }
 
 void SdlInputHandler::handleControllerTouchpadEvent(SDL_ControllerTouchpadEvent* event)
@@ -479,246 +678,124 @@ void SdlInputHandler::handleJoystickBatteryEvent(SDL_JoyBatteryEvent* event)
 
 #endif
 
-void SdlInputHandler::handleControllerDeviceEvent(SDL_ControllerDeviceEvent* event)
+static uint32_t probeHapticCaps(SDL_GameController* controller)
 {
-    GamepadState* state;
+    uint32_t hapticCaps = 0;
 
-    if (event->type == SDL_CONTROLLERDEVICEADDED) {
-        int i;
-        const char* name;
-        SDL_GameController* controller;
-        const char* mapping;
-        char guidStr[33];
-        uint32_t hapticCaps;
+#if SDL_VERSION_ATLEAST(2, 0, 18)
+    hapticCaps |= SDL_GameControllerHasRumble(controller) ? ML_HAPTIC_GC_RUMBLE : 0;
+    hapticCaps |= SDL_GameControllerHasRumbleTriggers(controller) ? ML_HAPTIC_GC_TRIGGER_RUMBLE : 0;
+#elif SDL_VERSION_ATLEAST(2, 0, 9)
+    // Perform a tiny rumbles to see if haptics are supported.
+    // NB: We cannot use zeros for rumble intensity or SDL will not actually call the JS driver
+    // and we'll get a (potentially false) success value returned.
+    hapticCaps |= SDL_GameControllerRumble(controller, 1, 1, 1) == 0 ? ML_HAPTIC_GC_RUMBLE : 0;
+#if SDL_VERSION_ATLEAST(2, 0, 14)
+    hapticCaps |= SDL_GameControllerRumbleTriggers(controller, 1, 1, 1) == 0 ? ML_HAPTIC_GC_TRIGGER_RUMBLE : 0;
+#endif
+#else
+    // Haptics are opened with the gamepad state on older SDL versions
+    Q_UNUSED(controller);
+#endif
 
-        controller = SDL_GameControllerOpen(event->which);
-        if (controller == NULL) {
-            SDL_LogError(SDL_LOG_CATEGORY_APPLICATION,
-                         "Failed to open gamepad: %s",
-                         SDL_GetError());
-            return;
-        }
+    return hapticCaps;
+}
 
-        // SDL_CONTROLLERDEVICEADDED can be reported multiple times for the same
-        // gamepad in rare cases, because SDL doesn't fixup the device index in
-        // the SDL_CONTROLLERDEVICEADDED event if an unopened gamepad disappears
-        // before we've processed the add event.
-        for (int i = 0; i < MAX_GAMEPADS; i++) {
-            if (m_GamepadState[i].controller == controller) {
-                SDL_LogWarn(SDL_LOG_CATEGORY_APPLICATION,
-                            "Received duplicate add event for controller index: %d",
-                            event->which);
-                SDL_GameControllerClose(controller);
-                return;
-            }
-        }
+int SdlInputHandler::gamepadOpenThreadProc(void* context)
+{
+    auto open = (PendingGamepadOpen*)context;
 
-        // We used to use SDL_GameControllerGetPlayerIndex() here but that
-        // can lead to strange issues due to bugs in Windows where an Xbox
-        // controller will join as player 2, even though no player 1 controller
-        // is connected at all. This pretty much screws any attempt to use
-        // the gamepad in single player games, so just assign them in order from 0.
-        i = 0;
+    open->controller = SDL_GameControllerOpen(open->deviceIndex);
+    if (open->controller != nullptr) {
+        open->hapticCaps = probeHapticCaps(open->controller);
+        open->powerLevel = SDL_JoystickCurrentPowerLevel(SDL_GameControllerGetJoystick(open->controller));
+    }
+    else {
+        SDL_LogError(SDL_LOG_CATEGORY_APPLICATION,
+                     "Failed to open gamepad: %s",
+                     SDL_GetError());
+    }
 
-        for (; i < MAX_GAMEPADS; i++) {
-            SDL_assert(m_GamepadState[i].controller != controller);
-            if (m_GamepadState[i].controller == NULL) {
-                // Found an empty slot
-                break;
-            }
-        }
+    // Finish adding the gamepad on the main thread. This is pushed even
+    // if the open failed, so the main thread can clean up this thread.
+    SDL_Event event;
+    event.type = SDL_USEREVENT;
+    event.user.code = SDL_CODE_GAMECONTROLLER_OPENED;
+    event.user.data1 = open;
+    SDL_PushEvent(&event);
 
-        if (i == MAX_GAMEPADS) {
-            SDL_LogError(SDL_LOG_CATEGORY_APPLICATION,
-                         "No open gamepad slots found!");
-            SDL_GameControllerClose(controller);
-            return;
-        }
+    return 0;
+}
 
-        SDL_JoystickGetGUIDString(SDL_JoystickGetGUID(SDL_GameControllerGetJoystick(controller)),
-                                  guidStr, sizeof(guidStr));
-        if (m_IgnoreDeviceGuids.contains(guidStr, Qt::CaseInsensitive))
-        {
-            SDL_LogInfo(SDL_LOG_CATEGORY_APPLICATION,
-                        "Skipping ignored device with GUID: %s",
-                        guidStr);
-            SDL_GameControllerClose(controller);
-            return;
+int SdlInputHandler::discardGamepadOpenEvents(void*, SDL_Event* event)
+{
+    if (event->type == SDL_USEREVENT && event->user.code == SDL_CODE_GAMECONTROLLER_OPENED) {
+        auto open = (PendingGamepadOpen*)event->user.data1;
+        if (open->controller != nullptr) {
+            SDL_GameControllerClose(open->controller);
         }
+        delete open;
+        return 0;
+    }
 
-        state = &m_GamepadState[i];
-        if (m_MultiController) {
-            state->index = i;
+    return 1;
+}
 
-#if SDL_VERSION_ATLEAST(2, 0, 12)
-            // This will change indicators on the controller to show the assigned
-            // player index. For Xbox 360 controllers, that means updating the LED
-            // ring to light up the corresponding quadrant for this player.
-            SDL_GameControllerSetPlayerIndex(controller, state->index);
-#endif
-        }
-        else {
-            // Always player 1 in single controller mode
-            state->index = 0;
-        }
+void SdlInputHandler::handleGamepadOpened(SDL_UserEvent* event)
+{
+    auto open = (PendingGamepadOpen*)event->data1;
 
-        state->controller = controller;
-        state->jsId = SDL_JoystickInstanceID(SDL_GameControllerGetJoystick(state->controller));
+    m_GamepadOpenThreads.removeOne(open->thread);
+    SDL_WaitThread(open->thread, nullptr);
 
-        hapticCaps = 0;
-#if SDL_VERSION_ATLEAST(2, 0, 18)
-        hapticCaps |= SDL_GameControllerHasRumble(controller) ? ML_HAPTIC_GC_RUMBLE : 0;
-        hapticCaps |= SDL_GameControllerHasRumbleTriggers(controller) ? ML_HAPTIC_GC_TRIGGER_RUMBLE : 0;
-#elif SDL_VERSION_ATLEAST(2, 0, 9)
-        // Perform a tiny rumbles to see if haptics are supported.
-        // NB: We cannot use zeros for rumble intensity or SDL will not actually call the JS driver
-        // and we'll get a (potentially false) success value returned.
-        hapticCaps |= SDL_GameControllerRumble(controller, 1, 1, 1) == 0 ? ML_HAPTIC_GC_RUMBLE : 0;
-#if SDL_VERSION_ATLEAST(2, 0, 14)
-        hapticCaps |= SDL_GameControllerRumbleTriggers(controller, 1, 1, 1) == 0 ? ML_HAPTIC_GC_TRIGGER_RUMBLE : 0;
-#endif
-#else
-        state->haptic = SDL_HapticOpenFromJoystick(SDL_GameControllerGetJoystick(state->controller));
-        state->hapticEffectId = -1;
-        state->hapticMethod = GAMEPAD_HAPTIC_METHOD_NONE;
-        if (state->haptic != nullptr) {
-            // Query for supported haptic effects
-            hapticCaps = SDL_HapticQuery(state->haptic);
-            hapticCaps |= SDL_HapticRumbleSupported(state->haptic) ?
-                            ML_HAPTIC_SIMPLE_RUMBLE : 0;
-
-            if ((SDL_HapticQuery(state->haptic) & SDL_HAPTIC_LEFTRIGHT) == 0) {
-                if (SDL_HapticRumbleSupported(state->haptic)) {
-                    if (SDL_HapticRumbleInit(state->haptic) == 0) {
-                        state->hapticMethod = GAMEPAD_HAPTIC_METHOD_SIMPLERUMBLE;
-                    }
-                }
-                if (state->hapticMethod == GAMEPAD_HAPTIC_METHOD_NONE) {
-                    SDL_HapticClose(state->haptic);
-                    state->haptic = nullptr;
-                }
-            } else {
-                state->hapticMethod = GAMEPAD_HAPTIC_METHOD_LEFTRIGHT;
-            }
+    if (open->controller != nullptr) {
+        if (SDL_GameControllerGetAttached(open->controller)) {
+            addGamepad(open->deviceIndex, open->controller, open->hapticCaps, open->powerLevel);
         }
         else {
-            hapticCaps = 0;
+            // It was unplugged while we were opening it
+            SDL_GameControllerClose(open->controller);
         }
-#endif
-
-        mapping = SDL_GameControllerMapping(state->controller);
-        name = SDL_GameControllerName(state->controller);
+    }
 
-        uint16_t vendorId = SDL_GameControllerGetVendor(state->controller);
-        uint16_t productId = SDL_GameControllerGetProduct(state->controller);
-        SDL_LogInfo(SDL_LOG_CATEGORY_APPLICATION,
-                    "Gamepad %d (player %d) is: %s (VID/PID: 0x%.4x/0x%.4x) (haptic capabilities: 0x%x) (mapping: %s -> %s)",
-                    i,
-                    state->index,
-                    name != nullptr ? name : "<null>",
-                    vendorId,
-                    productId,
-                    hapticCaps,
-                    guidStr,
-                    mapping != nullptr ? mapping : "<null>");
-        if (mapping != nullptr) {
-            SDL_free((void*)mapping);
-        }
-
-        // Add this gamepad to the gamepad mask
-        if (m_MultiController) {
-            // NB: Don't assert that it's unset here because we will already
-            // have the mask set for initially attached gamepads to avoid confusing
-            // apps running on the host.
-            m_GamepadMask |= (1 << state->index);
-        }
-        else {
-            SDL_assert(m_GamepadMask == 0x1);
-        }
+    delete open;
+}
 
-        SDL_JoystickPowerLevel powerLevel = SDL_JoystickCurrentPowerLevel(SDL_GameControllerGetJoystick(state->controller));
+void SdlInputHandler::handleControllerDeviceEvent(SDL_ControllerDeviceEvent* event)
+{
+    GamepadState* state;
 
-#if SDL_VERSION_ATLEAST(2, 0, 14)
-        // On SDL 2.0.14 and later, we can provide enhanced controller information to the host PC
-        // for it to use as a hint for the type of controller to emulate.
-        uint32_t supportedButtonFlags = 0;
-        for (int i = 0; i < (int)SDL_arraysize(k_ButtonMap); i++) {
-            if (SDL_GameControllerHasButton(state->controller, (SDL_GameControllerButton)i)) {
-                supportedButtonFlags |= k_ButtonMap[i];
+    if (event->type == SDL_CONTROLLERDEVICEADDED) {
+        if (m_AsyncGamepadOpen) {
+            // Opening and probing a gamepad talks to the device, which can take
+            // tens of milliseconds over Bluetooth, so do that off the main thread.
+            PendingGamepadOpen* open = new PendingGamepadOpen();
+            open->deviceIndex = event->which;
+            open->controller = nullptr;
+            open->hapticCaps = 0;
+            open->powerLevel = SDL_JOYSTICK_POWER_UNKNOWN;
+            open->thread = SDL_CreateThread(SdlInputHandler::gamepadOpenThreadProc, "Gamepad Open", open);
+            if (open->thread != nullptr) {
+                m_GamepadOpenThreads.append(open->thread);
+                return;
             }
-        }
 
-        uint32_t capabilities = 0;
-        if (SDL_GameControllerGetBindForAxis(state->controller, SDL_CONTROLLER_AXIS_TRIGGERLEFT).bindType == SDL_CONTROLLER_BINDTYPE_AXIS ||
-            SDL_GameControllerGetBindForAxis(state->controller, SDL_CONTROLLER_AXIS_TRIGGERRIGHT).bindType == SDL_CONTROLLER_BINDTYPE_AXIS) {
-            // We assume these are analog triggers if the binding is to an axis rather than a button
-            capabilities |= LI_CCAP_ANALOG_TRIGGERS;
-        }
-        if (hapticCaps & ML_HAPTIC_GC_RUMBLE) {
-            capabilities |= LI_CCAP_RUMBLE;
-        }
-        if (hapticCaps & ML_HAPTIC_GC_TRIGGER_RUMBLE) {
-            capabilities |= LI_CCAP_TRIGGER_RUMBLE;
-        }
-        if (SDL_GameControllerGetNumTouchpads(state->controller) > 0) {
-            capabilities |= LI_CCAP_TOUCHPAD;
-        }
-        if (SDL_GameControllerHasSensor(state->controller, SDL_SENSOR_ACCEL)) {
-            capabilities |= LI_CCAP_ACCEL;
-        }
-        if (SDL_GameControllerHasSensor(state->controller, SDL_SENSOR_GYRO)) {
-            capabilities |= LI_CCAP_GYRO;
-        }
-        if (powerLevel != SDL_JOYSTICK_POWER_UNKNOWN || SDL_VERSION_ATLEAST(2, 24, 0)) {
-            capabilities |= LI_CCAP_BATTERY_STATE;
-        }
-        if (SDL_GameControllerHasLED(state->controller)) {
-            capabilities |= LI_CCAP_RGB_LED;
+            SDL_LogWarn(SDL_LOG_CATEGORY_APPLICATION,
+                        "SDL_CreateThread() failed: %s",
+                        SDL_GetError());
+            delete open;
         }
 
-        uint8_t type;
-        switch (SDL_GameControllerGetType(state->controller)) {
-        case SDL_CONTROLLER_TYPE_XBOX360:
-        case SDL_CONTROLLER_TYPE_XBOXONE:
-            type = LI_CTYPE_XBOX;
-            break;
-        case SDL_CONTROLLER_TYPE_PS3:
-        case SDL_CONTROLLER_TYPE_PS4:
-        case SDL_CONTROLLER_TYPE_PS5:
-            type = LI_CTYPE_PS;
-            break;
-        case SDL_CONTROLLER_TYPE_NINTENDO_SWITCH_PRO:
-#if SDL_VERSION_ATLEAST(2, 24, 0)
-        case SDL_CONTROLLER_TYPE_NINTENDO_SWITCH_JOYCON_LEFT:
-        case SDL_CONTROLLER_TYPE_NINTENDO_SWITCH_JOYCON_RIGHT:
-        case SDL_CONTROLLER_TYPE_NINTENDO_SWITCH_JOYCON_PAIR:
-#endif
-            type = LI_CTYPE_NINTENDO;
-            break;
-        default:
-            type = LI_CTYPE_UNKNOWN;
-            break;
+        SDL_GameController* controller = SDL_GameControllerOpen(event->which);
+        if (controller == NULL) {
+            SDL_LogError(SDL_LOG_CATEGORY_APPLICATION,
+                         "Failed to open gamepad: %s",
+                         SDL_GetError());
+            return;
         }
 
-        // If this is a PlayStation controller that doesn't have a touchpad button mapped,
-        // we'll allow the Select+PS button combo to act as the touchpad.
-        state->clickpadButtonEmulationEnabled =
-#if SDL_VERSION_ATLEAST(2, 0, 14)
-            SDL_GameControllerGetBindForButton(state->controller, SDL_CONTROLLER_BUTTON_TOUCHPAD).bindType == SDL_CONTROLLER_BINDTYPE_NONE &&
-#endif
-            type == LI_CTYPE_PS;
-
-        LiSendControllerArrivalEvent(state->index, m_GamepadMask, type, supportedButtonFlags, capabilities);
-#else
-
-        // Send an empty event to tell the PC we've arrived
-        sendGamepadState(state);
-#endif
-
-        // Send a power level if it's known at this time
-        if (powerLevel != SDL_JOYSTICK_POWER_UNKNOWN) {
-            sendGamepadBatteryState(state, powerLevel);
-        }
+        addGamepad(event->which, controller, probeHapticCaps(controller),
+                   SDL_JoystickCurrentPowerLevel(SDL_GameControllerGetJoystick(controller)));
     }
     else if (event->type == SDL_CONTROLLERDEVICEREMOVED) {
         state = findStateForGamepad(event->which);
@@ -752,6 +829,8 @@ void SdlInputHandler::handleControllerDeviceEvent(SDL_ControllerDeviceEvent* eve
             // Send a final event to let the PC know this gamepad is gone
             LiSendMultiControllerEvent(state->index, m_GamepadMask,
                                        0, 0, 0, 0, 0, 0, 0);
+            resetGamepadOutput(state->index);
+            m_AttachedGamepads--;
 
             // Clear all remaining state from this slot
             SDL_memset(state, 0, sizeof(*state));
@@ -759,10 +838,236 @@ void SdlInputHandler::handleControllerDeviceEvent(SDL_ControllerDeviceEvent* eve
     }
 }
 
+void SdlInputHandler::addGamepad(int deviceIndex, SDL_GameController* controller, uint32_t hapticCaps, SDL_JoystickPowerLevel powerLevel)
+{
+    GamepadState* state;
+    int i;
+    const char* name;
+    const char* mapping;
+    char guidStr[33];
+
+    // SDL_CONTROLLERDEVICEADDED can be reported multiple times for the same
+    // gamepad in rare cases, because SDL doesn't fixup the device index in
+    // the SDL_CONTROLLERDEVICEADDED event if an unopened gamepad disappears
+    // before we've processed the add event.
+    for (int i = 0; i < MAX_GAMEPADS; i++) {
+        if (m_GamepadState[i].controller == controller) {
+            SDL_LogWarn(SDL_LOG_CATEGORY_APPLICATION,
+                        "Received duplicate add event for controller index: %d",
+                        deviceIndex);
+            SDL_GameControllerClose(controller);
+            return;
+        }
+    }
+
+    // We used to use SDL_GameControllerGetPlayerIndex() here but that
+    // can lead to strange issues due to bugs in Windows where an Xbox
+    // controller will join as player 2, even though no player 1 controller
+    // is connected at all. This pretty much screws any attempt to use
+    // the gamepad in single player games, so just assign them in order from 0.
+    i = 0;
+
+    for (; i < MAX_GAMEPADS; i++) {
+        SDL_assert(m_GamepadState[i].controller != controller);
+        if (m_GamepadState[i].controller == NULL) {
+            // Found an empty slot
+            break;
+        }
+    }
+
+    if (i == MAX_GAMEPADS) {
+        SDL_LogError(SDL_LOG_CATEGORY_APPLICATION,
+                     "No open gamepad slots found!");
+        SDL_GameControllerClose(controller);
+        return;
+    }
+
+    SDL_JoystickGetGUIDString(SDL_JoystickGetGUID(SDL_GameControllerGetJoystick(controller)),
+                              guidStr, sizeof(guidStr));
+    if (m_IgnoreDeviceGuids.contains(guidStr, Qt::CaseInsensitive))
+    {
+        SDL_LogInfo(SDL_LOG_CATEGORY_APPLICATION,
+                    "Skipping ignored device with GUID: %s",
+                    guidStr);
+        SDL_GameControllerClose(controller);
+        return;
+    }
+
+    state = &m_GamepadState[i];
+    if (m_MultiController) {
+        state->index = i;
+
+#if SDL_VERSION_ATLEAST(2, 0, 12)
+        // This will change indicators on the controller to show the assigned
+        // player index. For Xbox 360 controllers, that means updating the LED
+        // ring to light up the corresponding quadrant for this player.
+        SDL_GameControllerSetPlayerIndex(controller, state->index);
+#endif
+    }
+    else {
+        // Always player 1 in single controller mode
+        state->index = 0;
+    }
+
+    state->controller = controller;
+    state->jsId = SDL_JoystickInstanceID(SDL_GameControllerGetJoystick(state->controller));
+    m_AttachedGamepads++;
+
+#if !SDL_VERSION_ATLEAST(2, 0, 9)
+    state->haptic = SDL_HapticOpenFromJoystick(SDL_GameControllerGetJoystick(state->controller));
+    state->hapticEffectId = -1;
+    state->hapticMethod = GAMEPAD_HAPTIC_METHOD_NONE;
+    if (state->haptic != nullptr) {
+        // Query for supported haptic effects
+        hapticCaps = SDL_HapticQuery(state->haptic);
+        hapticCaps |= SDL_HapticRumbleSupported(state->haptic) ?
+                        ML_HAPTIC_SIMPLE_RUMBLE : 0;
+
+        if ((SDL_HapticQuery(state->haptic) & SDL_HAPTIC_LEFTRIGHT) == 0) {
+            if (SDL_HapticRumbleSupported(state->haptic)) {
+                if (SDL_HapticRumbleInit(state->haptic) == 0) {
+                    state->hapticMethod = GAMEPAD_HAPTIC_METHOD_SIMPLERUMBLE;
+                }
+            }
+            if (state->hapticMethod == GAMEPAD_HAPTIC_METHOD_NONE) {
+                SDL_HapticClose(state->haptic);
+                state->haptic = nullptr;
+            }
+        } else {
+            state->hapticMethod = GAMEPAD_HAPTIC_METHOD_LEFTRIGHT;
+        }
+    }
+    else {
+        hapticCaps = 0;
+    }
+#endif
+
+    mapping = SDL_GameControllerMapping(state->controller);
+    name = SDL_GameControllerName(state->controller);
+
+    uint16_t vendorId = SDL_GameControllerGetVendor(state->controller);
+    uint16_t productId = SDL_GameControllerGetProduct(state->controller);
+    SDL_LogInfo(SDL_LOG_CATEGORY_APPLICATION,
+                "Gamepad %d (player %d) is: %s (VID/PID: 0x%.4x/0x%.4x) (haptic capabilities: 0x%x) (mapping: %s -> %s)",
+                i,
+                state->index,
+                name != nullptr ? name : "<null>",
+                vendorId,
+                productId,
+                hapticCaps,
+                guidStr,
+                mapping != nullptr ? mapping : "<null>");
+    if (mapping != nullptr) {
+        SDL_free((void*)mapping);
+    }
+
+    // Add this gamepad to the gamepad mask
+    if (m_MultiController) {
+        // NB: Don't assert that it's unset here because we will already
+        // have the mask set for initially attached gamepads to avoid confusing
+        // apps running on the host.
+        m_GamepadMask |= (1 << state->index);
+    }
+    else {
+        SDL_assert(m_GamepadMask == 0x1);
+    }
+
+    // The host starts this controller from scratch
+    resetGamepadOutput(state->index);
+
+#if SDL_VERSION_ATLEAST(2, 0, 14)
+    // On SDL 2.0.14 and later, we can provide enhanced controller information to the host PC
+    // for it to use as a hint for the type of controller to emulate.
+    uint32_t supportedButtonFlags = 0;
+    for (int i = 0; i < (int)SDL_arraysize(k_ButtonMap); i++) {
+        if (SDL_GameControllerHasButton(state->controller, (SDL_GameControllerButton)i)) {
+            supportedButtonFlags |= k_ButtonMap[i];
+        }
+    }
+
+    uint32_t capabilities = 0;
+    if (SDL_GameControllerGetBindForAxis(state->controller, SDL_CONTROLLER_AXIS_TRIGGERLEFT).bindType == SDL_CONTROLLER_BINDTYPE_AXIS ||
+        SDL_GameControllerGetBindForAxis(state->controller, SDL_CONTROLLER_AXIS_TRIGGERRIGHT).bindType == SDL_CONTROLLER_BINDTYPE_AXIS) {
+        // We assume these are analog triggers if the binding is to an axis rather than a button
+        capabilities |= LI_CCAP_ANALOG_TRIGGERS;
+    }
+    if (hapticCaps & ML_HAPTIC_GC_RUMBLE) {
+        capabilities |= LI_CCAP_RUMBLE;
+    }
+    if (hapticCaps & ML_HAPTIC_GC_TRIGGER_RUMBLE) {
+        capabilities |= LI_CCAP_TRIGGER_RUMBLE;
+    }
+    if (SDL_GameControllerGetNumTouchpads(state->controller) > 0) {
+        capabilities |= LI_CCAP_TOUCHPAD;
+    }
+    if (SDL_GameControllerHasSensor(state->controller, SDL_SENSOR_ACCEL)) {
+        capabilities |= LI_CCAP_ACCEL;
+    }
+    if (SDL_GameControllerHasSensor(state->controller, SDL_SENSOR_GYRO)) {
+        capabilities |= LI_CCAP_GYRO;
+    }
+    if (powerLevel != SDL_JOYSTICK_POWER_UNKNOWN || SDL_VERSION_ATLEAST(2, 24, 0)) {
+        capabilities |= LI_CCAP_BATTERY_STATE;
+    }
+    if (SDL_GameControllerHasLED(state->controller)) {
+        capabilities |= LI_CCAP_RGB_LED;
+    }
+
+    uint8_t type;
+    switch (SDL_GameControllerGetType(state->controller)) {
+    case SDL_CONTROLLER_TYPE_XBOX360:
+    case SDL_CONTROLLER_TYPE_XBOXONE:
+        type = LI_CTYPE_XBOX;
+        break;
+    case SDL_CONTROLLER_TYPE_PS3:
+    case SDL_CONTROLLER_TYPE_PS4:
+    case SDL_CONTROLLER_TYPE_PS5:
+        type = LI_CTYPE_PS;
+        break;
+    case SDL_CONTROLLER_TYPE_NINTENDO_SWITCH_PRO:
+#if SDL_VERSION_ATLEAST(2, 24, 0)
+    case SDL_CONTROLLER_TYPE_NINTENDO_SWITCH_JOYCON_LEFT:
+    case SDL_CONTROLLER_TYPE_NINTENDO_SWITCH_JOYCON_RIGHT:
+    case SDL_CONTROLLER_TYPE_NINTENDO_SWITCH_JOYCON_PAIR:
+#endif
+        type = LI_CTYPE_NINTENDO;
+        break;
+    default:
+        type = LI_CTYPE_UNKNOWN;
+        break;
+    }
+
+    // If this is a PlayStation controller that doesn't have a touchpad button mapped,
+    // we'll allow the Select+PS button combo to act as the touchpad.
+    state->clickpadButtonEmulationEnabled =
+#if SDL_VERSION_ATLEAST(2, 0, 14)
+        SDL_GameControllerGetBindForButton(state->controller, SDL_CONTROLLER_BUTTON_TOUCHPAD).bindType == SDL_CONTROLLER_BINDTYPE_NONE &&
+#endif
+        type == LI_CTYPE_PS;
+
+    LiSendControllerArrivalEvent(state->index, m_GamepadMask, type, supportedButtonFlags, capabilities);
+#else
+
+    // Send an empty event to tell the PC we've arrived
+    sendGamepadState(state);
+#endif
+
+    // Send a power level if it's known at this time
+    if (powerLevel != SDL_JOYSTICK_POWER_UNKNOWN) {
+        sendGamepadBatteryState(state, powerLevel);
+    }
+}
+
 void SdlInputHandler::handleJoystickArrivalEvent(SDL_JoyDeviceEvent* event)
 {
     SDL_assert(event->type == SDL_JOYDEVICEADDED);
 
+    // We only apply the mappings for attached joysticks, so this one may
+    // become a game controller once its mapping is added.
+    if (MappingManager::applyMappingsForNewJoystick(event->which)) {
+        return;
+    }
+
     if (!SDL_IsGameController(event->which)) {
         char guidStr[33];
         SDL_JoystickGetGUIDString(SDL_JoystickGetDeviceGUID(event->which),
@@ -791,27 +1096,110 @@ void SdlInputHandler::handleJoystickArrivalEvent(SDL_JoyDeviceEvent* event)
 void SdlInputHandler::rumble(unsigned short controllerNumber, unsigned short lowFreqMotor, unsigned short highFreqMotor)
 {
     // Make sure the controller number is within our supported count
-    if (controllerNumber >= MAX_GAMEPADS) {
+    if (controllerNumber >= MAX_GAMEPADS || state->controller == nullptr) {
         return;
     }
 
-#if SDL_VERSION_ATLEAST(2, 0, 9)
-    if (m_GamepadState[controllerNumber].controller != nullptr) {
-        SDL_GameControllerRumble(m_GamepadState[controllerNumber].controller, lowFreqMotor, highFreqMotor, 30000);
+    GamepadState* state = &m_GamepadState[controllerNumber];
+    state->pendingRumble = ((uint32_t)lowFreqMotor << 16) | highFreqMotor;
+    state->hasPendingRumble = true;
+    flushHaptics(state);
+}
+
+void SdlInputHandler::rumbleTriggers(uint16_t controllerNumber, uint16_t leftTrigger, uint16_t rightTrigger)
+{
+    // Make sure the controller number is within our supported count
+    if (controllerNumber >= MAX_GAMEPADS || state->controller == nullptr) {
+        return;
     }
+
+    GamepadState* state = &m_GamepadState[controllerNumber];
+    state->pendingTriggerRumble = ((uint32_t)leftTrigger << 16) | rightTrigger;
+    state->hasPendingTriggerRumble = true;
+    flushHaptics(state);
+}
+
+void SdlInputHandler::flushHaptics(GamepadState* state)
+{
+    Uint32 now = SDL_GetTicks();
+
+    // Drop updates that wouldn't change anything, but let the host refresh
+    // an unchanged effect now and then so it doesn't time out
+    bool refresh = SDL_TICKS_PASSED(now, state->lastHapticsWriteTime + HAPTICS_REFRESH_INTERVAL_MS);
+    if (state->hasPendingRumble && state->pendingRumble == state->sentRumble && !refresh) {
+        state->hasPendingRumble = false;
+    }
+    if (state->hasPendingTriggerRumble && state->pendingTriggerRumble == state->sentTriggerRumble && !refresh) {
+        state->hasPendingTriggerRumble = false;
+    }
+
+    if (!state->hasPendingRumble && !state->hasPendingTriggerRumble) {
+        return;
+    }
+
+    // Writes can block for milliseconds on Bluetooth controllers, so only
+    // the latest state is written once per interval
+    if (!SDL_TICKS_PASSED(now, state->lastHapticsWriteTime + m_HapticsWriteIntervalMs)) {
+        if (m_HapticsFlushTimer == 0) {
+            m_HapticsFlushTimer = SDL_AddTimer(state->lastHapticsWriteTime + m_HapticsWriteIntervalMs - now,
+                                               SdlInputHandler::hapticsFlushTimerCallback,
+                                               nullptr);
+        }
+        return;
+    }
+
+    if (state->hasPendingRumble) {
+        writeRumble(state, state->pendingRumble >> 16, state->pendingRumble & 0xFFFF);
+        state->sentRumble = state->pendingRumble;
+        state->hasPendingRumble = false;
+    }
+    if (state->hasPendingTriggerRumble) {
+        writeTriggerRumble(state, state->pendingTriggerRumble >> 16, state->pendingTriggerRumble & 0xFFFF);
+        state->sentTriggerRumble = state->pendingTriggerRumble;
+        state->hasPendingTriggerRumble = false;
+    }
+    state->lastHapticsWriteTime = now;
+}
+
+Uint32 SdlInputHandler::hapticsFlushTimerCallback(Uint32, void*)
+{
+    // Flush on the main thread, which owns the gamepad state
+    SDL_Event event;
+    event.type = SDL_USEREVENT;
+    event.user.code = SDL_CODE_GAMECONTROLLER_FLUSH_HAPTICS;
+    SDL_PushEvent(&event);
+
+    return 0;
+}
+
+void SdlInputHandler::flushHapticsState()
+{
+    m_HapticsFlushTimer = 0;
+
+    for (int i = 0; i < MAX_GAMEPADS; i++) {
+        if (m_GamepadState[i].controller != nullptr) {
+            flushHaptics(&m_GamepadState[i]);
+        }
+    }
+}
+
+void SdlInputHandler::writeRumble(GamepadState* state, uint16_t lowFreqMotor, uint16_t highFreqMotor)
+{
+#if SDL_VERSION_ATLEAST(2, 0, 9)
+    SDL_GameControllerRumble(state->controller, lowFreqMotor, highFreqMotor, 30000);
 #else
-    // Check if the controller supports haptics (and if the controller exists at all)
-    SDL_Haptic* haptic = m_GamepadState[controllerNumber].haptic;
+    // Check if the controller supports haptics
+    SDL_Haptic* haptic = state->haptic;
     if (haptic == nullptr) {
         return;
     }
 
     // Stop the last effect we played
-    if (m_GamepadState[controllerNumber].hapticMethod == GAMEPAD_HAPTIC_METHOD_LEFTRIGHT) {
-        if (m_GamepadState[controllerNumber].hapticEffectId >= 0) {
-            SDL_HapticDestroyEffect(haptic, m_GamepadState[controllerNumber].hapticEffectId);
+    if (state->hapticMethod == GAMEPAD_HAPTIC_METHOD_LEFTRIGHT) {
+        if (state->hapticEffectId >= 0) {
+            SDL_HapticDestroyEffect(haptic, state->hapticEffectId);
         }
-    } else if (m_GamepadState[controllerNumber].hapticMethod == GAMEPAD_HAPTIC_METHOD_SIMPLERUMBLE) {
+    } else if (state->hapticMethod == GAMEPAD_HAPTIC_METHOD_SIMPLERUMBLE) {
         SDL_HapticRumbleStop(haptic);
     }
 
@@ -820,7 +1208,7 @@ void SdlInputHandler::rumble(unsigned short controllerNumber, unsigned short low
         return;
     }
 
-    if (m_GamepadState[controllerNumber].hapticMethod == GAMEPAD_HAPTIC_METHOD_LEFTRIGHT) {
+    if (state->hapticMethod == GAMEPAD_HAPTIC_METHOD_LEFTRIGHT) {
         SDL_HapticEffect effect;
         SDL_memset(&effect, 0, sizeof(effect));
         effect.type = SDL_HAPTIC_LEFTRIGHT;
@@ -833,11 +1221,11 @@ void SdlInputHandler::rumble(unsigned short controllerNumber, unsigned short low
         effect.leftright.small_magnitude = highFreqMotor / 2;
 
         // Play the new effect
-        m_GamepadState[controllerNumber].hapticEffectId = SDL_HapticNewEffect(haptic, &effect);
-        if (m_GamepadState[controllerNumber].hapticEffectId >= 0) {
-            SDL_HapticRunEffect(haptic, m_GamepadState[controllerNumber].hapticEffectId, 1);
+        state->hapticEffectId = SDL_HapticNewEffect(haptic, &effect);
+        if (state->hapticEffectId >= 0) {
+            SDL_HapticRunEffect(haptic, state->hapticEffectId, 1);
         }
-    } else if (m_GamepadState[controllerNumber].hapticMethod == GAMEPAD_HAPTIC_METHOD_SIMPLERUMBLE) {
+    } else if (state->hapticMethod == GAMEPAD_HAPTIC_METHOD_SIMPLERUMBLE) {
         SDL_HapticRumblePlay(haptic,
                              std::min(1.0, (GAMEPAD_HAPTIC_SIMPLE_HIFREQ_MOTOR_WEIGHT*highFreqMotor +
                                             GAMEPAD_HAPTIC_SIMPLE_LOWFREQ_MOTOR_WEIGHT*lowFreqMotor) / 65535.0),
@@ -846,17 +1234,14 @@ void SdlInputHandler::rumble(unsigned short controllerNumber, unsigned short low
 #endif
 }
 
-void SdlInputHandler::rumbleTriggers(uint16_t controllerNumber, uint16_t leftTrigger, uint16_t rightTrigger)
+void SdlInputHandler::writeTriggerRumble(GamepadState* state, uint16_t leftTrigger, uint16_t rightTrigger)
 {
-    // Make sure the controller number is within our supported count
-    if (controllerNumber >= MAX_GAMEPADS) {
-        return;
-    }
-
 #if SDL_VERSION_ATLEAST(2, 0, 14)
-    if (m_GamepadState[controllerNumber].controller != nullptr) {
-        SDL_GameControllerRumbleTriggers(m_GamepadState[controllerNumber].controller, leftTrigger, rightTrigger, 30000);
-    }
+    SDL_GameControllerRumbleTriggers(state->controller, leftTrigger, rightTrigger, 30000);
+#else
+    Q_UNUSED(state);
+    Q_UNUSED(leftTrigger);
+    Q_UNUSED(rightTrigger);
 #endif
 }
 
@@ -868,20 +1253,32 @@ void SdlInputHandler::setMotionEventState(uint16_t controllerNumber, uint8_t mot
     }
 
 #if SDL_VERSION_ATLEAST(2, 0, 14)
-    if (m_GamepadState[controllerNumber].controller != nullptr) {
-        uint8_t reportPeriodMs = reportRateHz ? (1000 / reportRateHz) : 0;
+    GamepadState* state = &m_GamepadState[controllerNumber];
+    if (state->controller != nullptr) {
+        uint32_t reportPeriodUs = reportRateHz ? (1000000 / reportRateHz) : 0;
 
+        // Start integrating again from scratch at the new rate
         switch (motionType) {
         case LI_MOTION_TYPE_ACCEL:
-            m_GamepadState[controllerNumber].accelReportPeriodMs = reportPeriodMs;
-            SDL_GameControllerSetSensorEnabled(m_GamepadState[controllerNumber].controller, SDL_SENSOR_ACCEL, reportRateHz ? SDL_TRUE : SDL_FALSE);
+            SDL_zero(state->accel);
+            state->accel.reportPeriodUs = reportPeriodUs;
             break;
 
         case LI_MOTION_TYPE_GYRO:
-            m_GamepadState[controllerNumber].gyroReportPeriodMs = reportPeriodMs;
-            SDL_GameControllerSetSensorEnabled(m_GamepadState[controllerNumber].controller, SDL_SENSOR_GYRO, reportRateHz ? SDL_TRUE : SDL_FALSE);
+            SDL_zero(state->gyro);
+            state->gyro.reportPeriodUs = reportPeriodUs;
             break;
+
+        default:
+            return;
         }
+
+        // Drift correction needs the accelerometer even if the host doesn't
+        SDL_GameControllerSetSensorEnabled(state->controller, SDL_SENSOR_GYRO,
+                                           state->gyro.reportPeriodUs ? SDL_TRUE : SDL_FALSE);
+        SDL_GameControllerSetSensorEnabled(state->controller, SDL_SENSOR_ACCEL,
+                                           (state->accel.reportPeriodUs ||
+                                            (state->gyro.reportPeriodUs && m_GyroDriftCorrection)) ? SDL_TRUE : SDL_FALSE);
     }
 #endif
 }
@@ -894,8 +1291,12 @@ void SdlInputHandler::setControllerLED(uint16_t controllerNumber, uint8_t r, uin
     }
 
 #if SDL_VERSION_ATLEAST(2, 0, 14)
-    if (m_GamepadState[controllerNumber].controller != nullptr) {
-        SDL_GameControllerSetLED(m_GamepadState[controllerNumber].controller, r, g, b);
+    GamepadState* state = &m_GamepadState[controllerNumber];
+    uint32_t color = (r << 16) | (g << 8) | b;
+    if (state->controller != nullptr && (!state->hasSentLed || state->sentLed != color)) {
+        SDL_GameControllerSetLED(state->controller, r, g, b);
+        state->sentLed = color;
+        state->hasSentLed = true;
     }
 #endif
 }
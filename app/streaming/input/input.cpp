@@ -9,8 +9,15 @@
 #include <QDir>
 #include <QGuiApplication>
 
+// 0 disables the limit and sends every change
+#define DEFAULT_GAMEPAD_RATE_HZ 250
+
+// 0 disables the limit and writes every haptics update
+#define DEFAULT_HAPTICS_RATE_HZ 100
+
 SdlInputHandler::SdlInputHandler(StreamingPreferences& prefs, int streamWidth, int streamHeight)
-    : m_MultiController(prefs.multiController),
+    : m_Window(nullptr),
+      m_MultiController(prefs.multiController),
       m_GamepadMouse(prefs.gamepadMouse),
       m_SwapMouseButtons(prefs.swapMouseButtons),
       m_ReverseScrollDirection(prefs.reverseScrollDirection),
@@ -19,15 +26,29 @@ SdlInputHandler::SdlInputHandler(StreamingPreferences& prefs, int streamWidth, i
       m_PendingMouseButtonsAllUpOnVideoRegionLeave(false),
       m_PointerRegionLockActive(false),
       m_PointerRegionLockToggledByUser(false),
+      m_AttachedGamepads(0),
+      m_GamepadSendIntervalMs(0),
+      m_GamepadFlushTimer(0),
+      m_GyroDriftCorrection(qgetenv("ML_GYRO_DRIFT_CORRECTION") == "1"),
+      m_HapticsWriteIntervalMs(0),
+      m_HapticsFlushTimer(0),
+      m_AsyncGamepadOpen(qgetenv("ML_ASYNC_GAMEPAD_OPEN") != "0"),
       m_FakeCaptureActive(false),
       m_CaptureSystemKeysMode(prefs.captureSysKeysMode),
-      m_MouseCursorCapturedVisibilityState(SDL_DISABLE),
+      m_MouseCursorCapturedVisibilityState(prefs.localCursor ? SDL_ENABLE : SDL_DISABLE),
+      m_MouseFlushTimer(0),
+#ifdef HAVE_EVDEV_MOUSE
+      m_EvdevMouse(nullptr),
+#endif
       m_LongPressTimer(0),
       m_StreamWidth(streamWidth),
       m_StreamHeight(streamHeight),
       m_AbsoluteMouseMode(prefs.absoluteMouseMode),
       m_AbsoluteTouchMode(prefs.absoluteTouchMode),
       m_DisabledTouchFeedback(false),
+      m_TouchBatching(qgetenv("ML_TOUCH_BATCHING") == "1"),
+      m_TouchPredictionMs(qMax(qEnvironmentVariableIntValue("ML_TOUCH_PREDICTION_MS"), 0)),
+      m_TouchFlushTimer(0),
       m_LeftButtonReleaseTimer(0),
       m_RightButtonReleaseTimer(0),
       m_DragTimer(0),
@@ -116,6 +137,26 @@ SdlInputHandler::SdlInputHandler(StreamingPreferences& prefs, int streamWidth, i
     m_SpecialKeyCombos[KeyComboQuitAndExit].scanCode = SDL_SCANCODE_E;
     m_SpecialKeyCombos[KeyComboQuitAndExit].enabled = true;
 
+    m_SpecialKeyCombos[KeyComboToggleRecording].keyCombo = KeyComboToggleRecording;
+    m_SpecialKeyCombos[KeyComboToggleRecording].keyCode = SDLK_r;
+    m_SpecialKeyCombos[KeyComboToggleRecording].scanCode = SDL_SCANCODE_R;
+    m_SpecialKeyCombos[KeyComboToggleRecording].enabled = true;
+
+    m_SpecialKeyCombos[KeyComboTogglePerfGraph].keyCombo = KeyComboTogglePerfGraph;
+    m_SpecialKeyCombos[KeyComboTogglePerfGraph].keyCode = SDLK_g;
+    m_SpecialKeyCombos[KeyComboTogglePerfGraph].scanCode = SDL_SCANCODE_G;
+    m_SpecialKeyCombos[KeyComboTogglePerfGraph].enabled = true;
+
+    m_SpecialKeyCombos[KeyComboApplySuggestedSettings].keyCombo = KeyComboApplySuggestedSettings;
+    m_SpecialKeyCombos[KeyComboApplySuggestedSettings].keyCode = SDLK_a;
+    m_SpecialKeyCombos[KeyComboApplySuggestedSettings].scanCode = SDL_SCANCODE_A;
+    m_SpecialKeyCombos[KeyComboApplySuggestedSettings].enabled = true;
+
+    m_SpecialKeyCombos[KeyComboDumpFlightRecorder].keyCombo = KeyComboDumpFlightRecorder;
+    m_SpecialKeyCombos[KeyComboDumpFlightRecorder].keyCode = SDLK_f;
+    m_SpecialKeyCombos[KeyComboDumpFlightRecorder].scanCode = SDL_SCANCODE_F;
+    m_SpecialKeyCombos[KeyComboDumpFlightRecorder].enabled = true;
+
     m_OldIgnoreDevices = SDL_GetHint(SDL_HINT_GAMECONTROLLER_IGNORE_DEVICES);
     m_OldIgnoreDevicesExcept = SDL_GetHint(SDL_HINT_GAMECONTROLLER_IGNORE_DEVICES_EXCEPT);
 
@@ -192,13 +233,61 @@ SdlInputHandler::SdlInputHandler(StreamingPreferences& prefs, int streamWidth, i
     m_GamepadMask = getAttachedGamepadMask();
 
     SDL_zero(m_GamepadState);
+    SDL_zero(m_GamepadOutputs);
+
+    // Analog changes from high polling rate gamepads are sent at most this often.
+    // Button changes are always sent immediately.
+    bool ok;
+    int gamepadRateHz = qEnvironmentVariableIntValue("ML_GAMEPAD_RATE_HZ", &ok);
+    if (!ok) {
+        gamepadRateHz = DEFAULT_GAMEPAD_RATE_HZ;
+    }
+    if (gamepadRateHz > 0) {
+        m_GamepadSendIntervalMs = qMax(1000 / gamepadRateHz, 1);
+    }
+
+    // Rumble is written to each controller at most this often, since HID
+    // writes block the main thread and can be slow over Bluetooth
+    int hapticsRateHz = qEnvironmentVariableIntValue("ML_HAPTICS_RATE_HZ", &ok);
+    if (!ok) {
+        hapticsRateHz = DEFAULT_HAPTICS_RATE_HZ;
+    }
+    if (hapticsRateHz > 0) {
+        m_HapticsWriteIntervalMs = qMax(1000 / hapticsRateHz, 1);
+    }
+    m_RelativeMotion.setSendRate(prefs.mouseSendRate);
+
     SDL_zero(m_LastTouchDownEvent);
     SDL_zero(m_LastTouchUpEvent);
     SDL_zero(m_TouchDownEvent);
+    SDL_zero(m_NativeTouches);
+
+#ifdef HAVE_EVDEV_MOUSE
+    // Read the mouse on its own thread so input isn't delayed behind rendering
+    if (qgetenv("ML_RAW_INPUT_THREAD") == "1") {
+        m_EvdevMouse = new EvdevMouseReader(m_SwapMouseButtons, prefs.mouseSendRate, &Session::get()->getInputLatencyMonitor());
+        if (!m_EvdevMouse->start()) {
+            SDL_LogWarn(SDL_LOG_CATEGORY_APPLICATION,
+                        "Falling back to SDL for mouse input");
+            delete m_EvdevMouse;
+            m_EvdevMouse = nullptr;
+        }
+    }
+#endif
 }
 
 SdlInputHandler::~SdlInputHandler()
 {
+#ifdef HAVE_EVDEV_MOUSE
+    delete m_EvdevMouse;
+#endif
+
+    // Close any gamepads that were opened after we stopped handling events
+    for (SDL_Thread* thread : m_GamepadOpenThreads) {
+        SDL_WaitThread(thread, nullptr);
+    }
+    SDL_FilterEvents(SdlInputHandler::discardGamepadOpenEvents, nullptr);
+
     for (int i = 0; i < MAX_GAMEPADS; i++) {
         if (m_GamepadState[i].mouseEmulationTimer != 0) {
             Session::get()->notifyMouseEmulationMode(false);
@@ -218,6 +307,10 @@ SdlInputHandler::~SdlInputHandler()
     SDL_RemoveTimer(m_LeftButtonReleaseTimer);
     SDL_RemoveTimer(m_RightButtonReleaseTimer);
     SDL_RemoveTimer(m_DragTimer);
+    SDL_RemoveTimer(m_GamepadFlushTimer);
+    SDL_RemoveTimer(m_HapticsFlushTimer);
+    SDL_RemoveTimer(m_MouseFlushTimer);
+    SDL_RemoveTimer(m_TouchFlushTimer);
 
 #if !SDL_VERSION_ATLEAST(2, 0, 9)
     SDL_QuitSubSystem(SDL_INIT_HAPTIC);
@@ -302,6 +395,9 @@ void SdlInputHandler::notifyFocusLost()
     // used in shortcuts that cause focus loss (such as Alt+Tab) may get stuck down.
     raiseAllKeys();
 
+    // Stop reading the mouse directly while another window has focus
+    updateRawMouseState();
+
 #ifdef Q_OS_WIN32
     // Re-enable text input when window loses focus as a workaround for an SDL bug.
     // See #1617 for details.
@@ -311,6 +407,8 @@ void SdlInputHandler::notifyFocusLost()
 
 void SdlInputHandler::notifyFocusGained()
 {
+    updateRawMouseState();
+
 #ifdef Q_OS_WIN32
     // Disable text input when window gains focus to prevent IME popup interference.
     // See #1617 for details.
@@ -427,6 +525,11 @@ void SdlInputHandler::setCaptureActive(bool active)
         else {
             SDL_SetRelativeMouseMode(SDL_FALSE);
         }
+
+        // Don't apply motion from before the capture was released
+        SDL_RemoveTimer(m_MouseFlushTimer);
+        m_MouseFlushTimer = 0;
+        m_RelativeMotion.reset();
     }
 
     // Update mouse pointer region constraints
@@ -434,6 +537,33 @@ void SdlInputHandler::setCaptureActive(bool active)
 
     // Now update the keyboard grab
     updateKeyboardGrabState();
+
+    // Hand relative mouse input to or from the raw input thread
+    updateRawMouseState();
+}
+
+bool SdlInputHandler::isRawMouseActive()
+{
+#ifdef HAVE_EVDEV_MOUSE
+    return m_EvdevMouse != nullptr && m_EvdevMouse->isActive();
+#else
+    return false;
+#endif
+}
+
+void SdlInputHandler::updateRawMouseState()
+{
+#ifdef HAVE_EVDEV_MOUSE
+    if (m_EvdevMouse == nullptr || m_Window == nullptr) {
+        return;
+    }
+
+    // The raw input thread only handles relative motion, and it sees
+    // every mouse on the system, so it must stop whenever we lose focus.
+    m_EvdevMouse->setActive(!m_AbsoluteMouseMode &&
+                            SDL_GetRelativeMouseMode() &&
+                            (SDL_GetWindowFlags(m_Window) & SDL_WINDOW_INPUT_FOCUS));
+#endif
 }
 
 void SdlInputHandler::handleTouchFingerEvent(SDL_TouchFingerEvent* event)
@@ -4,6 +4,39 @@
 #include "backend/computermanager.h"
 
 #include "SDL_compat.h"
+#include "relativemotion.h"
+
+#ifdef HAVE_EVDEV_MOUSE
+#include "evdevmouse.h"
+#endif
+
+// Pushed by the gamepad flush timer. This continues the SDL_CODE_GAMECONTROLLER_*
+// user event codes that Session defines for its callbacks.
+#define SDL_CODE_GAMECONTROLLER_FLUSH_STATE 106
+
+// Pushed by the mouse flush timer when batched relative motion is due
+#define SDL_CODE_MOUSE_FLUSH_MOTION 107
+
+// Pushed by the touch flush timer when batched touch motion is due
+#define SDL_CODE_TOUCH_FLUSH_MOTION 108
+
+// Pushed by the haptics flush timer when coalesced rumble is due
+#define SDL_CODE_GAMECONTROLLER_FLUSH_HAPTICS 109
+
+// Pushed by the gamepad open thread with a PendingGamepadOpen in data1
+#define SDL_CODE_GAMECONTROLLER_OPENED 110
+
+// Integrates samples from one motion sensor between reports, so the host
+// gets the average over each report period instead of whichever sample
+// happened to land on the report boundary.
+struct MotionSensorState {
+    uint32_t reportPeriodUs;
+    uint64_t lastReportTimeUs;
+    uint64_t lastSampleTimeUs;
+    float lastReportData[3];
+    float integratedData[3];
+    uint32_t integratedTimeUs;
+};
 
 struct GamepadState {
     SDL_GameController* controller;
@@ -22,14 +55,26 @@ struct GamepadState {
     bool clickpadButtonEmulationEnabled;
     bool emulatedClickpadButtonDown;
 
+    // Latest rumble from the host and what we last wrote to the controller.
+    // Motor values are packed as (low or left) << 16 | (high or right).
+    uint32_t pendingRumble;
+    uint32_t sentRumble;
+    uint32_t pendingTriggerRumble;
+    uint32_t sentTriggerRumble;
+    bool hasPendingRumble;
+    bool hasPendingTriggerRumble;
+    Uint32 lastHapticsWriteTime;
+    uint32_t sentLed;
+    bool hasSentLed;
+
 #if SDL_VERSION_ATLEAST(2, 0, 14)
-    uint8_t gyroReportPeriodMs;
-    float lastGyroEventData[SDL_arraysize(SDL_ControllerSensorEvent::data)];
-    uint32_t lastGyroEventTime;
+    MotionSensorState gyro;
+    MotionSensorState accel;
 
-    uint8_t accelReportPeriodMs;
-    float lastAccelEventData[SDL_arraysize(SDL_ControllerSensorEvent::data)];
-    uint32_t lastAccelEventTime;
+    // Gyro drift correction, estimated while the controller sits still
+    float gyroBias[3];
+    float lastAccelMagnitude;
+    uint32_t stillTimeUs;
 #endif
 
     int buttons;
@@ -39,6 +84,48 @@ struct GamepadState {
 };
 
 
+struct GamepadReport {
+    int buttons;
+    short lsX, lsY;
+    short rsX, rsY;
+    unsigned char lt, rt;
+};
+
+// A gamepad being opened and probed on its own thread
+struct PendingGamepadOpen {
+    int deviceIndex;
+    SDL_GameController* controller;
+    uint32_t hapticCaps;
+    SDL_JoystickPowerLevel powerLevel;
+    SDL_Thread* thread;
+};
+
+// A native touch or pen contact that is down. Motion is coalesced here
+// until the next batch is sent.
+struct NativeTouchState {
+    bool active;
+    bool isPen;
+    bool hasPendingMove;
+    uint32_t pointerId;
+    float x, y;
+    float pressure;
+
+    // Normalized units per millisecond
+    float velocityX, velocityY;
+    uint32_t lastEventTime;
+};
+
+// What the host last received for a controller number, so we can skip
+// updates that don't change anything and hold back analog-only changes
+// until the next send interval.
+struct GamepadOutputState {
+    GamepadReport sentReport;
+    GamepadReport pendingReport;
+    bool hasSentReport;
+    bool hasPendingReport;
+    Uint32 lastSendTime;
+};
+
 struct DualSenseOutputReport{
     uint8_t validFlag0;
     uint8_t validFlag1;
@@ -74,6 +161,8 @@ struct DualSenseOutputReport{
 
 #define MAX_FINGERS 2
 
+#define MAX_NATIVE_TOUCHES 10
+
 #define GAMEPAD_HAPTIC_METHOD_NONE 0
 #define GAMEPAD_HAPTIC_METHOD_LEFTRIGHT 1
 #define GAMEPAD_HAPTIC_METHOD_SIMPLERUMBLE 2
@@ -104,6 +193,8 @@ public:
 
     void handleControllerDeviceEvent(SDL_ControllerDeviceEvent* event);
 
+    void handleGamepadOpened(SDL_UserEvent* event);
+
 #if SDL_VERSION_ATLEAST(2, 0, 14)
     void handleControllerSensorEvent(SDL_ControllerSensorEvent* event);
 
@@ -116,6 +207,14 @@ public:
 
     void handleJoystickArrivalEvent(SDL_JoyDeviceEvent* event);
 
+    void flushGamepadState();
+
+    void flushMouseMotion();
+
+    void flushTouchMotion();
+
+    void flushHapticsState();
+
     void sendText(QString& string);
 
     void rumble(uint16_t controllerNumber, uint16_t lowFreqMotor, uint16_t highFreqMotor);
@@ -167,13 +266,29 @@ private:
         KeyComboPasteText,
         KeyComboTogglePointerRegionLock,
         KeyComboQuitAndExit,
+        KeyComboToggleRecording,
+        KeyComboTogglePerfGraph,
+        KeyComboApplySuggestedSettings,
+        KeyComboDumpFlightRecorder,
         KeyComboMax
     };
 
     GamepadState*
     findStateForGamepad(SDL_JoystickID id);
 
-    void sendGamepadState(GamepadState* state);
+    void addGamepad(int deviceIndex, SDL_GameController* controller, uint32_t hapticCaps, SDL_JoystickPowerLevel powerLevel);
+
+    bool sendGamepadState(GamepadState* state);
+
+    void sendGamepadReport(short index, const GamepadReport& report);
+
+    void resetGamepadOutput(short index);
+
+    void flushHaptics(GamepadState* state);
+
+    void writeRumble(GamepadState* state, uint16_t lowFreqMotor, uint16_t highFreqMotor);
+
+    void writeTriggerRumble(GamepadState* state, uint16_t leftTrigger, uint16_t rightTrigger);
 
     void sendGamepadBatteryState(GamepadState* state, SDL_JoystickPowerLevel level);
 
@@ -181,8 +296,20 @@ private:
 
     void emulateAbsoluteFingerEvent(SDL_TouchFingerEvent* event);
 
+    void sendNativeTouchEvent(uint8_t eventType, uint32_t pointerId, bool isPen, float x, float y, float pressure);
+
+    void queueNativeTouchEvent(uint8_t eventType, uint32_t pointerId, bool isPen, float x, float y, float pressure, uint32_t timestamp);
+
     void disableTouchFeedback();
 
+    bool isRawMouseActive();
+
+    void updateRawMouseState();
+
+    bool sendRelativeMouseMotion(float deltaX, float deltaY);
+
+    void flushRelativeMouseMotion();
+
     void handleRelativeFingerEvent(SDL_TouchFingerEvent* event);
 
     void performSpecialKeyCombo(KeyCombo combo);
@@ -193,6 +320,24 @@ private:
     static
     Uint32 mouseEmulationTimerCallback(Uint32 interval, void* param);
 
+    static
+    Uint32 gamepadFlushTimerCallback(Uint32 interval, void* param);
+
+    static
+    Uint32 hapticsFlushTimerCallback(Uint32 interval, void* param);
+
+    static
+    int gamepadOpenThreadProc(void* context);
+
+    static
+    int discardGamepadOpenEvents(void* userdata, SDL_Event* event);
+
+    static
+    Uint32 mouseFlushTimerCallback(Uint32 interval, void* param);
+
+    static
+    Uint32 touchFlushTimerCallback(Uint32 interval, void* param);
+
     static
     Uint32 releaseLeftButtonTimerCallback(Uint32 interval, void* param);
 
@@ -216,6 +361,15 @@ private:
 
     int m_GamepadMask;
     GamepadState m_GamepadState[MAX_GAMEPADS];
+    GamepadOutputState m_GamepadOutputs[MAX_GAMEPADS];
+    int m_AttachedGamepads;
+    Uint32 m_GamepadSendIntervalMs;
+    SDL_TimerID m_GamepadFlushTimer;
+    bool m_GyroDriftCorrection;
+    Uint32 m_HapticsWriteIntervalMs;
+    SDL_TimerID m_HapticsFlushTimer;
+    bool m_AsyncGamepadOpen;
+    QVector<SDL_Thread*> m_GamepadOpenThreads;
     QSet<short> m_KeysDown;
     bool m_FakeCaptureActive;
     QString m_OldIgnoreDevices;
@@ -223,6 +377,12 @@ private:
     QStringList m_IgnoreDeviceGuids;
     StreamingPreferences::CaptureSysKeysMode m_CaptureSystemKeysMode;
     int m_MouseCursorCapturedVisibilityState;
+    RelativeMotionAccumulator m_RelativeMotion;
+    SDL_TimerID m_MouseFlushTimer;
+
+#ifdef HAVE_EVDEV_MOUSE
+    EvdevMouseReader* m_EvdevMouse;
+#endif
 
     struct {
         KeyCombo keyCombo;
@@ -239,6 +399,10 @@ private:
     bool m_AbsoluteMouseMode;
     bool m_AbsoluteTouchMode;
     bool m_DisabledTouchFeedback;
+    bool m_TouchBatching;
+    int m_TouchPredictionMs;
+    SDL_TimerID m_TouchFlushTimer;
+    NativeTouchState m_NativeTouches[MAX_NATIVE_TOUCHES];
 
     SDL_TouchFingerEvent m_TouchDownEvent[MAX_FINGERS];
     SDL_TimerID m_LeftButtonReleaseTimer;
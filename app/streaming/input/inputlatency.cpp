@@ -0,0 +1,113 @@
+#include "inputlatency.h"
+#include "streaming/flightrecorder.h"
+
+#include <Limelight.h>
+
+#include <QList>
+#include <QtGlobal>
+
+InputLatencyMonitor::InputLatencyMonitor(FlightRecorder* flightRecorder)
+    : m_FlightRecorder(flightRecorder),
+      m_ClickToPhotonEnabled(qgetenv("ML_CLICK_TO_PHOTON") == "1"),
+      m_ClickToPhotonX(-1),
+      m_ClickToPhotonY(-1)
+{
+    SDL_AtomicSet(&m_Events, 0);
+    SDL_AtomicSet(&m_TotalLatencyUs, 0);
+    SDL_AtomicSet(&m_MaxLatencyUs, 0);
+    SDL_AtomicSet(&m_PendingClickUs, 0);
+
+    QList<QByteArray> pixel = qgetenv("ML_CLICK_TO_PHOTON_PIXEL").split(',');
+    if (pixel.size() == 2) {
+        bool xOk, yOk;
+        int x = pixel[0].toInt(&xOk);
+        int y = pixel[1].toInt(&yOk);
+        if (xOk && yOk && x >= 0 && y >= 0) {
+            m_ClickToPhotonX = x;
+            m_ClickToPhotonY = y;
+        }
+    }
+
+    if (m_ClickToPhotonEnabled) {
+        SDL_LogInfo(SDL_LOG_CATEGORY_APPLICATION,
+                    "Click-to-photon measurement enabled");
+    }
+}
+
+void InputLatencyMonitor::addSample(uint32_t latencyUs)
+{
+    SDL_AtomicAdd(&m_Events, 1);
+    SDL_AtomicAdd(&m_TotalLatencyUs, (int)latencyUs);
+
+    int maxLatencyUs = SDL_AtomicGet(&m_MaxLatencyUs);
+    while ((int)latencyUs > maxLatencyUs) {
+        if (SDL_AtomicCAS(&m_MaxLatencyUs, maxLatencyUs, (int)latencyUs)) {
+            break;
+        }
+        maxLatencyUs = SDL_AtomicGet(&m_MaxLatencyUs);
+    }
+
+    m_FlightRecorder->record(FlightRecorder::EventInputSent, latencyUs);
+}
+
+void InputLatencyMonitor::addSdlEventSample(Uint32 eventTimestamp)
+{
+    // SDL stamps events in milliseconds when it pulls them from the OS
+    addSample((SDL_GetTicks() - eventTimestamp) * 1000);
+}
+
+void InputLatencyMonitor::takeWindowStats(uint32_t* events, uint64_t* totalLatencyUs, uint32_t* maxLatencyUs)
+{
+    *events = (uint32_t)SDL_AtomicSet(&m_Events, 0);
+    *totalLatencyUs = (uint32_t)SDL_AtomicSet(&m_TotalLatencyUs, 0);
+    *maxLatencyUs = (uint32_t)SDL_AtomicSet(&m_MaxLatencyUs, 0);
+}
+
+bool InputLatencyMonitor::isClickToPhotonEnabled()
+{
+    return m_ClickToPhotonEnabled;
+}
+
+void InputLatencyMonitor::getClickToPhotonPixel(int streamWidth, int streamHeight, int* x, int* y)
+{
+    if (m_ClickToPhotonX >= 0 && m_ClickToPhotonX < streamWidth &&
+            m_ClickToPhotonY >= 0 && m_ClickToPhotonY < streamHeight) {
+        *x = m_ClickToPhotonX;
+        *y = m_ClickToPhotonY;
+    }
+    else {
+        *x = streamWidth / 2;
+        *y = streamHeight / 2;
+    }
+}
+
+void InputLatencyMonitor::notifyClickSent()
+{
+    if (!m_ClickToPhotonEnabled) {
+        return;
+    }
+
+    // Only time one click at a time. Zero means no click is pending.
+    int now = (int)((uint32_t)LiGetMicroseconds() | 1);
+    SDL_AtomicCAS(&m_PendingClickUs, 0, now);
+}
+
+uint32_t InputLatencyMonitor::takePendingClick()
+{
+    int clickUs = SDL_AtomicSet(&m_PendingClickUs, 0);
+    if (clickUs == 0) {
+        return 0;
+    }
+
+    return (uint32_t)LiGetMicroseconds() - (uint32_t)clickUs;
+}
+
+uint32_t InputLatencyMonitor::getPendingClickAge()
+{
+    int clickUs = SDL_AtomicGet(&m_PendingClickUs);
+    if (clickUs == 0) {
+        return 0;
+    }
+
+    return (uint32_t)LiGetMicroseconds() - (uint32_t)clickUs;
+}
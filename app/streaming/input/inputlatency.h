@@ -0,0 +1,54 @@
+#pragma once
+
+#include "SDL_compat.h"
+
+class FlightRecorder;
+
+// Measures how long input events take from the OS handing them to us until
+// they are sent to the host. Samples may come from the main thread or the
+// raw input thread, and the decoder collects them once per stats window.
+//
+// Setting ML_CLICK_TO_PHOTON=1 also arms a click-to-photon measurement. Run
+// something on the host that flashes the screen on a left click, and each
+// click is timed until the reference pixel (the center of the stream, or
+// ML_CLICK_TO_PHOTON_PIXEL=x,y) changes in a decoded frame.
+class InputLatencyMonitor
+{
+public:
+    explicit InputLatencyMonitor(FlightRecorder* flightRecorder);
+
+    // Called after an event has been sent, with the time the OS delivered it
+    void addSample(uint32_t latencyUs);
+
+    // Called with an SDL event timestamp after the event has been sent
+    void addSdlEventSample(Uint32 eventTimestamp);
+
+    // Returns and clears the samples added since the last call
+    void takeWindowStats(uint32_t* events, uint64_t* totalLatencyUs, uint32_t* maxLatencyUs);
+
+    bool isClickToPhotonEnabled();
+
+    void getClickToPhotonPixel(int streamWidth, int streamHeight, int* x, int* y);
+
+    // Called when a left button press has been sent to the host
+    void notifyClickSent();
+
+    // Returns the microseconds since the pending click was sent and clears it,
+    // or 0 if there's no click waiting for a frame
+    uint32_t takePendingClick();
+
+    // Returns the microseconds since the pending click was sent without clearing it
+    uint32_t getPendingClickAge();
+
+private:
+    FlightRecorder* m_FlightRecorder;
+    bool m_ClickToPhotonEnabled;
+    int m_ClickToPhotonX;
+    int m_ClickToPhotonY;
+    SDL_atomic_t m_Events;
+    SDL_atomic_t m_TotalLatencyUs;
+    SDL_atomic_t m_MaxLatencyUs;
+
+    // Low 32 bits of LiGetMicroseconds() when the click was sent, or 0
+    SDL_atomic_t m_PendingClickUs;
+};
@@ -13,6 +13,125 @@
 #define VK_NUMPAD0 0x60
 #endif
 
+// The host shouldn't convert this key to a scancode using its own layout
+#define KEY_FLAG_NON_NORMALIZED 0x01
+
+// Only sent while system keys are captured
+#define KEY_FLAG_SYSTEM_KEY 0x02
+
+struct KeyTranslation {
+    uint8_t keyCode;
+    uint8_t flags;
+};
+
+// Maps SDL scancodes to VK codes with a single lookup per key event.
+// Entries with a zero key code aren't sent to the host.
+class KeyTranslationTable
+{
+public:
+    KeyTranslationTable()
+    {
+        SDL_zero(m_Entries);
+
+        // SDL defines SDL_SCANCODE_0 > SDL_SCANCODE_9 (and the same for the
+        // keypad), so zero isn't part of these ranges
+        for (int i = 0; i < 9; i++) {
+            set((SDL_Scancode)(SDL_SCANCODE_1 + i), VK_0 + 1 + i);
+            set((SDL_Scancode)(SDL_SCANCODE_KP_1 + i), VK_NUMPAD0 + 1 + i);
+        }
+        for (int i = 0; i < 26; i++) {
+            set((SDL_Scancode)(SDL_SCANCODE_A + i), VK_A + i);
+        }
+        for (int i = 0; i < 12; i++) {
+            set((SDL_Scancode)(SDL_SCANCODE_F1 + i), VK_F1 + i);
+            set((SDL_Scancode)(SDL_SCANCODE_F13 + i), VK_F13 + i);
+        }
+
+        set(SDL_SCANCODE_0, VK_0);
+        set(SDL_SCANCODE_KP_0, VK_NUMPAD0);
+        set(SDL_SCANCODE_BACKSPACE, 0x08);
+        set(SDL_SCANCODE_TAB, 0x09);
+        set(SDL_SCANCODE_CLEAR, 0x0C);
+        set(SDL_SCANCODE_KP_ENTER, 0x0D); // FIXME: Is this correct?
+        set(SDL_SCANCODE_RETURN, 0x0D);
+        set(SDL_SCANCODE_PAUSE, 0x13);
+        set(SDL_SCANCODE_CAPSLOCK, 0x14);
+        set(SDL_SCANCODE_ESCAPE, 0x1B);
+        set(SDL_SCANCODE_SPACE, 0x20);
+        set(SDL_SCANCODE_PAGEUP, 0x21);
+        set(SDL_SCANCODE_PAGEDOWN, 0x22);
+        set(SDL_SCANCODE_END, 0x23);
+        set(SDL_SCANCODE_HOME, 0x24);
+        set(SDL_SCANCODE_LEFT, 0x25);
+        set(SDL_SCANCODE_UP, 0x26);
+        set(SDL_SCANCODE_RIGHT, 0x27);
+        set(SDL_SCANCODE_DOWN, 0x28);
+        set(SDL_SCANCODE_SELECT, 0x29);
+        set(SDL_SCANCODE_EXECUTE, 0x2B);
+        set(SDL_SCANCODE_PRINTSCREEN, 0x2C);
+        set(SDL_SCANCODE_INSERT, 0x2D);
+        set(SDL_SCANCODE_DELETE, 0x2E);
+        set(SDL_SCANCODE_HELP, 0x2F);
+        set(SDL_SCANCODE_KP_MULTIPLY, 0x6A);
+        set(SDL_SCANCODE_KP_PLUS, 0x6B);
+        set(SDL_SCANCODE_KP_COMMA, 0x6C);
+        set(SDL_SCANCODE_KP_MINUS, 0x6D);
+        set(SDL_SCANCODE_KP_PERIOD, 0x6E);
+        set(SDL_SCANCODE_KP_DIVIDE, 0x6F);
+        set(SDL_SCANCODE_NUMLOCKCLEAR, 0x90);
+        set(SDL_SCANCODE_SCROLLLOCK, 0x91);
+        set(SDL_SCANCODE_LSHIFT, 0xA0);
+        set(SDL_SCANCODE_RSHIFT, 0xA1);
+        set(SDL_SCANCODE_LCTRL, 0xA2);
+        set(SDL_SCANCODE_RCTRL, 0xA3);
+        set(SDL_SCANCODE_LALT, 0xA4);
+        set(SDL_SCANCODE_RALT, 0xA5);
+        set(SDL_SCANCODE_LGUI, 0x5B, KEY_FLAG_SYSTEM_KEY);
+        set(SDL_SCANCODE_RGUI, 0x5C, KEY_FLAG_SYSTEM_KEY);
+        set(SDL_SCANCODE_APPLICATION, 0x5D);
+        set(SDL_SCANCODE_AC_BACK, 0xA6);
+        set(SDL_SCANCODE_AC_FORWARD, 0xA7);
+        set(SDL_SCANCODE_AC_REFRESH, 0xA8);
+        set(SDL_SCANCODE_AC_STOP, 0xA9);
+        set(SDL_SCANCODE_AC_SEARCH, 0xAA);
+        set(SDL_SCANCODE_AC_BOOKMARKS, 0xAB);
+        set(SDL_SCANCODE_AC_HOME, 0xAC);
+        set(SDL_SCANCODE_SEMICOLON, 0xBA);
+        set(SDL_SCANCODE_EQUALS, 0xBB);
+        set(SDL_SCANCODE_COMMA, 0xBC);
+        set(SDL_SCANCODE_MINUS, 0xBD);
+        set(SDL_SCANCODE_PERIOD, 0xBE);
+        set(SDL_SCANCODE_SLASH, 0xBF);
+        set(SDL_SCANCODE_GRAVE, 0xC0);
+        set(SDL_SCANCODE_LEFTBRACKET, 0xDB);
+        set(SDL_SCANCODE_INTERNATIONAL3, 0xDC, KEY_FLAG_NON_NORMALIZED);
+        set(SDL_SCANCODE_BACKSLASH, 0xDC);
+        set(SDL_SCANCODE_RIGHTBRACKET, 0xDD);
+        set(SDL_SCANCODE_APOSTROPHE, 0xDE);
+        set(SDL_SCANCODE_INTERNATIONAL1, 0xE2, KEY_FLAG_NON_NORMALIZED);
+        set(SDL_SCANCODE_NONUSBACKSLASH, 0xE2);
+        set(SDL_SCANCODE_LANG1, 0x1C);
+        set(SDL_SCANCODE_LANG2, 0x1D);
+    }
+
+    const KeyTranslation& lookup(SDL_Scancode scancode) const
+    {
+        // SDL_SCANCODE_UNKNOWN is never mapped
+        return (unsigned int)scancode < SDL_NUM_SCANCODES ? m_Entries[scancode] : m_Entries[SDL_SCANCODE_UNKNOWN];
+    }
+
+private:
+    void set(SDL_Scancode scancode, uint8_t keyCode, uint8_t flags = 0)
+    {
+        m_Entries[scancode].keyCode = keyCode;
+        m_Entries[scancode].flags = flags;
+    }
+
+    KeyTranslation m_Entries[SDL_NUM_SCANCODES];
+};
+
+static const KeyTranslationTable s_KeyTranslationTable;
+
 void SdlInputHandler::performSpecialKeyCombo(KeyCombo combo)
 {
     switch (combo) {
@@ -103,18 +222,8 @@ void SdlInputHandler::performSpecialKeyCombo(KeyCombo combo)
 
         char* text;
         if (SDL_HasClipboardText() && (text = SDL_GetClipboardText()) != nullptr) {
-            // Sending both CR and LF will lead to two newlines in the destination for
-            // each newline in the source, so we fix up any CRLFs into just a single LF.
-            for (char* c = text; *c != 0; c++) {
-                if (*c == '\r' && *(c + 1) == '\n') {
-                    // We're using strlen() rather than strlen() - 1 since we need to add 1
-                    // to copy the null terminator which is not included in strlen()'s count.
-                    memmove(c, c + 1, strlen(c));
-                }
-            }
-
-            // Send this text to the PC
-            LiSendUtf8TextEvent(text, (unsigned int)strlen(text));
+            QString string = QString::fromUtf8(text);
+            sendText(string);
 
             // SDL_GetClipboardText() allocates, so we must free
             SDL_free((void*)text);
@@ -153,16 +262,65 @@ void SdlInputHandler::performSpecialKeyCombo(KeyCombo combo)
         SDL_PushEvent(&quitExitEvent);
         break;
 
+    case KeyComboToggleRecording:
+        SDL_LogInfo(SDL_LOG_CATEGORY_APPLICATION,
+                    "Detected recording toggle combo");
+        Session::get()->toggleRecording();
+        break;
+
+    case KeyComboTogglePerfGraph:
+        SDL_LogInfo(SDL_LOG_CATEGORY_APPLICATION,
+                    "Detected performance graph toggle combo");
+
+        // Toggle the performance graph overlay
+        Session::get()->getOverlayManager().setOverlayState(Overlay::OverlayPerfGraph,
+                                                            !Session::get()->getOverlayManager().isOverlayEnabled(Overlay::OverlayPerfGraph));
+        break;
+
+    case KeyComboApplySuggestedSettings:
+        SDL_LogInfo(SDL_LOG_CATEGORY_APPLICATION,
+                    "Detected apply suggested settings combo");
+
+        if (Session::get()->applySuggestedSettings()) {
+            Session::get()->getOverlayManager().updateOverlayText(Overlay::OverlayStatusUpdate,
+                                                                  "Saved for the next stream");
+            Session::get()->getOverlayManager().setOverlayState(Overlay::OverlayStatusUpdate, true);
+        }
+        break;
+
+    case KeyComboDumpFlightRecorder:
+        SDL_LogInfo(SDL_LOG_CATEGORY_APPLICATION,
+                    "Detected flight recorder dump combo");
+
+        if (Session::get()->getFlightRecorder().dump("hotkey", false)) {
+            Session::get()->getOverlayManager().updateOverlayText(Overlay::OverlayStatusUpdate,
+                                                                  "Saved the flight recorder to the log directory");
+            Session::get()->getOverlayManager().setOverlayState(Overlay::OverlayStatusUpdate, true);
+        }
+        break;
+
     default:
         Q_UNREACHABLE();
     }
 }
 
+void SdlInputHandler::sendText(QString& string)
+{
+    // Sending both CR and LF will lead to two newlines in the destination for
+    // each newline in the source, so we fix up any CRLFs into just a single LF.
+    string.replace(QStringLiteral("\r\n"), QStringLiteral("\n"));
+
+    // The whole string goes to the host in one batch rather than a key
+    // event for each character
+    QByteArray utf8 = string.toUtf8();
+    LiSendUtf8TextEvent(utf8.constData(), (unsigned int)utf8.size());
+}
+
 void SdlInputHandler::handleKeyEvent(SDL_KeyboardEvent* event)
 {
     short keyCode;
     char modifiers;
-    bool shouldNotConvertToScanCodeOnServer = false;
+    bool shouldNotConvertToScanCodeOnServer;
 
     if (event->repeat) {
         // Ignore repeat key down events
@@ -221,234 +379,20 @@ void SdlInputHandler::handleKeyEvent(SDL_KeyboardEvent* event)
     // Set keycode. We explicitly use scancode here because GFE will try to correct
     // for AZERTY layouts on the host but it depends on receiving VK_ values matching
     // a QWERTY layout to work.
-    if (event->keysym.scancode >= SDL_SCANCODE_1 && event->keysym.scancode <= SDL_SCANCODE_9) {
-        // SDL defines SDL_SCANCODE_0 > SDL_SCANCODE_9, so we need to handle that manually
-        keyCode = (event->keysym.scancode - SDL_SCANCODE_1) + VK_0 + 1;
-    }
-    else if (event->keysym.scancode >= SDL_SCANCODE_A && event->keysym.scancode <= SDL_SCANCODE_Z) {
-        keyCode = (event->keysym.scancode - SDL_SCANCODE_A) + VK_A;
-    }
-    else if (event->keysym.scancode >= SDL_SCANCODE_F1 && event->keysym.scancode <= SDL_SCANCODE_F12) {
-        keyCode = (event->keysym.scancode - SDL_SCANCODE_F1) + VK_F1;
-    }
-    else if (event->keysym.scancode >= SDL_SCANCODE_F13 && event->keysym.scancode <= SDL_SCANCODE_F24) {
-        keyCode = (event->keysym.scancode - SDL_SCANCODE_F13) + VK_F13;
-    }
-    else if (event->keysym.scancode >= SDL_SCANCODE_KP_1 && event->keysym.scancode <= SDL_SCANCODE_KP_9) {
-        // SDL defines SDL_SCANCODE_KP_0 > SDL_SCANCODE_KP_9, so we need to handle that manually
-        keyCode = (event->keysym.scancode - SDL_SCANCODE_KP_1) + VK_NUMPAD0 + 1;
+    const KeyTranslation& translation = s_KeyTranslationTable.lookup(event->keysym.scancode);
+    if (translation.keyCode == 0) {
+        SDL_LogInfo(SDL_LOG_CATEGORY_APPLICATION,
+                    "Unhandled button event: %d",
+                     event->keysym.scancode);
+        return;
     }
-    else {
-        switch (event->keysym.scancode) {
-            case SDL_SCANCODE_BACKSPACE:
-                keyCode = 0x08;
-                break;
-            case SDL_SCANCODE_TAB:
-                keyCode = 0x09;
-                break;
-            case SDL_SCANCODE_CLEAR:
-                keyCode = 0x0C;
-                break;
-            case SDL_SCANCODE_KP_ENTER: // FIXME: Is this correct?
-            case SDL_SCANCODE_RETURN:
-                keyCode = 0x0D;
-                break;
-            case SDL_SCANCODE_PAUSE:
-                keyCode = 0x13;
-                break;
-            case SDL_SCANCODE_CAPSLOCK:
-                keyCode = 0x14;
-                break;
-            case SDL_SCANCODE_ESCAPE:
-                keyCode = 0x1B;
-                break;
-            case SDL_SCANCODE_SPACE:
-                keyCode = 0x20;
-                break;
-            case SDL_SCANCODE_PAGEUP:
-                keyCode = 0x21;
-                break;
-            case SDL_SCANCODE_PAGEDOWN:
-                keyCode = 0x22;
-                break;
-            case SDL_SCANCODE_END:
-                keyCode = 0x23;
-                break;
-            case SDL_SCANCODE_HOME:
-                keyCode = 0x24;
-                break;
-            case SDL_SCANCODE_LEFT:
-                keyCode = 0x25;
-                break;
-            case SDL_SCANCODE_UP:
-                keyCode = 0x26;
-                break;
-            case SDL_SCANCODE_RIGHT:
-                keyCode = 0x27;
-                break;
-            case SDL_SCANCODE_DOWN:
-                keyCode = 0x28;
-                break;
-            case SDL_SCANCODE_SELECT:
-                keyCode = 0x29;
-                break;
-            case SDL_SCANCODE_EXECUTE:
-                keyCode = 0x2B;
-                break;
-            case SDL_SCANCODE_PRINTSCREEN:
-                keyCode = 0x2C;
-                break;
-            case SDL_SCANCODE_INSERT:
-                keyCode = 0x2D;
-                break;
-            case SDL_SCANCODE_DELETE:
-                keyCode = 0x2E;
-                break;
-            case SDL_SCANCODE_HELP:
-                keyCode = 0x2F;
-                break;
-            case SDL_SCANCODE_KP_0:
-                // See comment above about why we only handle SDL_SCANCODE_KP_0 here
-                keyCode = VK_NUMPAD0;
-                break;
-            case SDL_SCANCODE_0:
-                // See comment above about why we only handle SDL_SCANCODE_0 here
-                keyCode = VK_0;
-                break;
-            case SDL_SCANCODE_KP_MULTIPLY:
-                keyCode = 0x6A;
-                break;
-            case SDL_SCANCODE_KP_PLUS:
-                keyCode = 0x6B;
-                break;
-            case SDL_SCANCODE_KP_COMMA:
-                keyCode = 0x6C;
-                break;
-            case SDL_SCANCODE_KP_MINUS:
-                keyCode = 0x6D;
-                break;
-            case SDL_SCANCODE_KP_PERIOD:
-                keyCode = 0x6E;
-                break;
-            case SDL_SCANCODE_KP_DIVIDE:
-                keyCode = 0x6F;
-                break;
-            case SDL_SCANCODE_NUMLOCKCLEAR:
-                keyCode = 0x90;
-                break;
-            case SDL_SCANCODE_SCROLLLOCK:
-                keyCode = 0x91;
-                break;
-            case SDL_SCANCODE_LSHIFT:
-                keyCode = 0xA0;
-                break;
-            case SDL_SCANCODE_RSHIFT:
-                keyCode = 0xA1;
-                break;
-            case SDL_SCANCODE_LCTRL:
-                keyCode = 0xA2;
-                break;
-            case SDL_SCANCODE_RCTRL:
-                keyCode = 0xA3;
-                break;
-            case SDL_SCANCODE_LALT:
-                keyCode = 0xA4;
-                break;
-            case SDL_SCANCODE_RALT:
-                keyCode = 0xA5;
-                break;
-            case SDL_SCANCODE_LGUI:
-                if (!isSystemKeyCaptureActive()) {
-                    return;
-                }
-                keyCode = 0x5B;
-                break;
-            case SDL_SCANCODE_RGUI:
-                if (!isSystemKeyCaptureActive()) {
-                    return;
-                }
-                keyCode = 0x5C;
-                break;
-            case SDL_SCANCODE_APPLICATION:
-                keyCode = 0x5D;
-                break;
-            case SDL_SCANCODE_AC_BACK:
-                keyCode = 0xA6;
-                break;
-            case SDL_SCANCODE_AC_FORWARD:
-                keyCode = 0xA7;
-                break;
-            case SDL_SCANCODE_AC_REFRESH:
-                keyCode = 0xA8;
-                break;
-            case SDL_SCANCODE_AC_STOP:
-                keyCode = 0xA9;
-                break;
-            case SDL_SCANCODE_AC_SEARCH:
-                keyCode = 0xAA;
-                break;
-            case SDL_SCANCODE_AC_BOOKMARKS:
-                keyCode = 0xAB;
-                break;
-            case SDL_SCANCODE_AC_HOME:
-                keyCode = 0xAC;
-                break;
-            case SDL_SCANCODE_SEMICOLON:
-                keyCode = 0xBA;
-                break;
-            case SDL_SCANCODE_EQUALS:
-                keyCode = 0xBB;
-                break;
-            case SDL_SCANCODE_COMMA:
-                keyCode = 0xBC;
-                break;
-            case SDL_SCANCODE_MINUS:
-                keyCode = 0xBD;
-                break;
-            case SDL_SCANCODE_PERIOD:
-                keyCode = 0xBE;
-                break;
-            case SDL_SCANCODE_SLASH:
-                keyCode = 0xBF;
-                break;
-            case SDL_SCANCODE_GRAVE:
-                keyCode = 0xC0;
-                break;
-            case SDL_SCANCODE_LEFTBRACKET:
-                keyCode = 0xDB;
-                break;
-            case SDL_SCANCODE_INTERNATIONAL3:
-                shouldNotConvertToScanCodeOnServer = true;
-                Q_FALLTHROUGH();
-            case SDL_SCANCODE_BACKSLASH:
-                keyCode = 0xDC;
-                break;
-            case SDL_SCANCODE_RIGHTBRACKET:
-                keyCode = 0xDD;
-                break;
-            case SDL_SCANCODE_APOSTROPHE:
-                keyCode = 0xDE;
-                break;
-            case SDL_SCANCODE_INTERNATIONAL1:
-                shouldNotConvertToScanCodeOnServer = true;
-                Q_FALLTHROUGH();
-            case SDL_SCANCODE_NONUSBACKSLASH:
-                keyCode = 0xE2;
-                break;
-            case SDL_SCANCODE_LANG1:
-                keyCode = 0x1C;
-                break;
-            case SDL_SCANCODE_LANG2:
-                keyCode = 0x1D;
-                break;
-            default:
-                SDL_LogInfo(SDL_LOG_CATEGORY_APPLICATION,
-                            "Unhandled button event: %d",
-                             event->keysym.scancode);
-                return;
-        }
+    else if ((translation.flags & KEY_FLAG_SYSTEM_KEY) && !isSystemKeyCaptureActive()) {
+        return;
     }
 
+    keyCode = translation.keyCode;
+    shouldNotConvertToScanCodeOnServer = (translation.flags & KEY_FLAG_NON_NORMALIZED) != 0;
+
     // Track the key state so we always know which keys are down
     if (event->state == SDL_PRESSED) {
         m_KeysDown.insert(keyCode);
@@ -462,4 +406,6 @@ void SdlInputHandler::handleKeyEvent(SDL_KeyboardEvent* event)
                             KEY_ACTION_DOWN : KEY_ACTION_UP,
                         modifiers,
                         shouldNotConvertToScanCodeOnServer ? SS_KBE_FLAG_NON_NORMALIZED : 0);
+
+    Session::get()->getInputLatencyMonitor().addSdlEventSample(event->timestamp);
 }
@@ -2,6 +2,7 @@
 
 #include <Limelight.h>
 #include "SDL_compat.h"
+#include "streaming/session.h"
 #include "streaming/streamutils.h"
 
 void SdlInputHandler::handleMouseButtonEvent(SDL_MouseButtonEvent* event)
@@ -26,6 +27,10 @@ void SdlInputHandler::handleMouseButtonEvent(SDL_MouseButtonEvent* event)
         // Not capturing
         return;
     }
+    else if (isRawMouseActive()) {
+        // The raw input thread has already sent this
+        return;
+    }
     else if (m_AbsoluteMouseMode && !isMouseInVideoRegion(event->x, event->y) && event->state == SDL_PRESSED) {
         // Ignore button presses outside the video region, but allow button releases
         return;
@@ -62,10 +67,19 @@ void SdlInputHandler::handleMouseButtonEvent(SDL_MouseButtonEvent* event)
             button = BUTTON_RIGHT;
     }
 
+    // Keep any batched motion ordered ahead of the button
+    flushRelativeMouseMotion();
+
     LiSendMouseButtonEvent(event->state == SDL_PRESSED ?
                                BUTTON_ACTION_PRESS :
                                BUTTON_ACTION_RELEASE,
                            button);
+
+    InputLatencyMonitor& latencyMonitor = Session::get()->getInputLatencyMonitor();
+    latencyMonitor.addSdlEventSample(event->timestamp);
+    if (button == BUTTON_LEFT && event->state == SDL_PRESSED) {
+        latencyMonitor.notifyClickSent();
+    }
 }
 
 void SdlInputHandler::handleMouseMotionEvent(SDL_MouseMotionEvent* event)
@@ -78,6 +92,13 @@ void SdlInputHandler::handleMouseMotionEvent(SDL_MouseMotionEvent* event)
         // Ignore synthetic mouse events
         return;
     }
+    else if (isRawMouseActive()) {
+        // The raw input thread has already sent this
+        return;
+    }
+
+    // Measure latency from the oldest event in the batch
+    Uint32 timestamp = event->timestamp;
 
     // Batch all pending mouse motion events to save CPU time
     Sint32 x = event->x, y = event->y, xrel = event->xrel, yrel = event->yrel;
@@ -135,6 +156,7 @@ void SdlInputHandler::handleMouseMotionEvent(SDL_MouseMotionEvent* event)
         }
         if (mouseInVideoRegion || m_MouseWasInVideoRegion || m_PendingMouseButtonsAllUpOnVideoRegionLeave) {
             LiSendMousePositionEvent((short)x, (short)y, dst.w, dst.h);
+            Session::get()->getInputLatencyMonitor().addSdlEventSample(timestamp);
         }
 
         // Adjust the cursor visibility if applicable
@@ -149,11 +171,54 @@ void SdlInputHandler::handleMouseMotionEvent(SDL_MouseMotionEvent* event)
 
         m_MouseWasInVideoRegion = mouseInVideoRegion;
     }
-    else {
-        LiSendMouseMoveEvent(xrel, yrel);
+    else if (sendRelativeMouseMotion(xrel, yrel)) {
+        Session::get()->getInputLatencyMonitor().addSdlEventSample(timestamp);
     }
 }
 
+bool SdlInputHandler::sendRelativeMouseMotion(float deltaX, float deltaY)
+{
+    m_RelativeMotion.addMotion(deltaX, deltaY);
+    if (m_RelativeMotion.flush(false)) {
+        return true;
+    }
+
+    // Send whatever is left once the send interval has passed
+    if (m_MouseFlushTimer == 0 && m_RelativeMotion.hasPendingMotion()) {
+        m_MouseFlushTimer = SDL_AddTimer(qMax((m_RelativeMotion.getFlushDelayUs() + 999) / 1000, 1U),
+                                         SdlInputHandler::mouseFlushTimerCallback,
+                                         nullptr);
+    }
+
+    return false;
+}
+
+void SdlInputHandler::flushRelativeMouseMotion()
+{
+    SDL_RemoveTimer(m_MouseFlushTimer);
+    m_MouseFlushTimer = 0;
+    m_RelativeMotion.flush(true);
+}
+
+Uint32 SdlInputHandler::mouseFlushTimerCallback(Uint32, void*)
+{
+    // Flush on the main thread, which owns the pending motion
+    SDL_Event event;
+    event.type = SDL_USEREVENT;
+    event.user.code = SDL_CODE_MOUSE_FLUSH_MOTION;
+    SDL_PushEvent(&event);
+
+    return 0;
+}
+
+void SdlInputHandler::flushMouseMotion()
+{
+    m_MouseFlushTimer = 0;
+
+    // The timer may have fired slightly early, so try again shortly if it did
+    sendRelativeMouseMotion(0, 0);
+}
+
 void SdlInputHandler::handleMouseWheelEvent(SDL_MouseWheelEvent* event)
 {
     if (!isCaptureActive()) {
@@ -0,0 +1,71 @@
+#include "relativemotion.h"
+
+#include <Limelight.h>
+
+#include <limits.h>
+#include <math.h>
+
+RelativeMotionAccumulator::RelativeMotionAccumulator()
+    : m_SendIntervalUs(0),
+      m_LastSendTimeUs(0),
+      m_PendingDeltaX(0),
+      m_PendingDeltaY(0)
+{
+
+}
+
+void RelativeMotionAccumulator::setSendRate(int sendRateHz)
+{
+    m_SendIntervalUs = sendRateHz > 0 ? 1000000 / sendRateHz : 0;
+}
+
+void RelativeMotionAccumulator::addMotion(float deltaX, float deltaY)
+{
+    m_PendingDeltaX += deltaX;
+    m_PendingDeltaY += deltaY;
+}
+
+bool RelativeMotionAccumulator::hasPendingMotion()
+{
+    // Motion less than a whole unit is a remainder, not something to send
+    return fabsf(m_PendingDeltaX) >= 1.0f || fabsf(m_PendingDeltaY) >= 1.0f;
+}
+
+uint32_t RelativeMotionAccumulator::getFlushDelayUs()
+{
+    uint64_t elapsedUs = LiGetMicroseconds() - m_LastSendTimeUs;
+    if (elapsedUs >= m_SendIntervalUs) {
+        return 0;
+    }
+
+    return (uint32_t)(m_SendIntervalUs - elapsedUs);
+}
+
+bool RelativeMotionAccumulator::flush(bool force)
+{
+    if (!hasPendingMotion()) {
+        return false;
+    }
+
+    uint64_t now = LiGetMicroseconds();
+    if (!force && now - m_LastSendTimeUs < m_SendIntervalUs) {
+        return false;
+    }
+
+    // Round toward zero and keep the remainder for the next send
+    float sendX = truncf(m_PendingDeltaX);
+    float sendY = truncf(m_PendingDeltaY);
+    sendX = fminf(fmaxf(sendX, SHRT_MIN), SHRT_MAX);
+    sendY = fminf(fmaxf(sendY, SHRT_MIN), SHRT_MAX);
+    m_PendingDeltaX -= sendX;
+    m_PendingDeltaY -= sendY;
+
+    LiSendMouseMoveEvent((short)sendX, (short)sendY);
+    m_LastSendTimeUs = now;
+    return true;
+}
+
+void RelativeMotionAccumulator::reset()
+{
+    m_PendingDeltaX = m_PendingDeltaY = 0;
+}
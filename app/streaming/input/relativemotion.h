@@ -0,0 +1,39 @@
+#pragma once
+
+#include <stdint.h>
+
+// Collects relative mouse motion and sends it to the host at a fixed rate,
+// so high polling rate mice (4-8 kHz) don't turn every report into its own
+// packet. Fractional motion (such as from scaled touch deltas) is carried
+// over to the next send instead of being truncated away.
+//
+// This isn't thread-safe. Each thread that sends motion needs its own.
+class RelativeMotionAccumulator
+{
+public:
+    RelativeMotionAccumulator();
+
+    // 0 sends motion as soon as it is added
+    void setSendRate(int sendRateHz);
+
+    void addMotion(float deltaX, float deltaY);
+
+    // Sends the whole units of motion if the send interval has elapsed
+    // (or always if forced). Returns true if motion was sent.
+    bool flush(bool force);
+
+    // True if there is motion that hasn't been sent yet
+    bool hasPendingMotion();
+
+    // Microseconds until the pending motion is due to be sent
+    uint32_t getFlushDelayUs();
+
+    // Drops any pending motion (including fractional remainders)
+    void reset();
+
+private:
+    uint64_t m_SendIntervalUs;
+    uint64_t m_LastSendTimeUs;
+    float m_PendingDeltaX;
+    float m_PendingDeltaY;
+};
@@ -97,11 +97,9 @@ void SdlInputHandler::handleRelativeFingerEvent(SDL_TouchFingerEvent* event)
         // already have normalized values. We'll just multiply them
         // by the stream dimensions to get real X and Y values rather
         // than the client window dimensions.
-        short deltaX = static_cast<short>(event->dx * m_StreamWidth);
-        short deltaY = static_cast<short>(event->dy * m_StreamHeight);
-        if (deltaX != 0 || deltaY != 0) {
-            LiSendMouseMoveEvent(deltaX, deltaY);
-        }
+        // Fractional motion is carried over so slow drags aren't lost.
+        sendRelativeMouseMotion(event->dx * m_StreamWidth,
+                                event->dy * m_StreamHeight);
     }
 
     // Start a drag timer when primary or secondary
@@ -131,6 +129,9 @@ void SdlInputHandler::handleRelativeFingerEvent(SDL_TouchFingerEvent* event)
         SDL_RemoveTimer(m_DragTimer);
         m_DragTimer = 0;
 
+        // Send the rest of the motion before any button changes
+        flushRelativeMouseMotion();
+
         // Release any drag
         if (m_DragButton != 0) {
             LiSendMouseButtonEvent(BUTTON_ACTION_RELEASE, m_DragButton);
@@ -0,0 +1,113 @@
+#include "launchtimeline.h"
+
+#include <Limelight.h>
+
+#include <QJsonArray>
+
+#include <algorithm>
+
+LaunchTimeline::LaunchTimeline()
+    : m_Finished(false),
+      m_SummaryTaken(false)
+{
+    m_Stages.append({ "Launch requested", LiGetMicroseconds() });
+}
+
+void LaunchTimeline::markStage(const char* name)
+{
+    QMutexLocker locker(&m_Lock);
+
+    if (!m_Finished) {
+        m_Stages.append({ name, LiGetMicroseconds() });
+    }
+}
+
+void LaunchTimeline::addEarlierStage(const char* name, uint64_t timeUs)
+{
+    QMutexLocker locker(&m_Lock);
+
+    if (!m_Finished) {
+        Stage stage = { name, timeUs };
+        m_Stages.insert(std::upper_bound(m_Stages.begin(), m_Stages.end(), stage,
+                                         [](const Stage& a, const Stage& b) {
+                                             return a.timeUs < b.timeUs;
+                                         }),
+                        stage);
+    }
+}
+
+void LaunchTimeline::markFirstFrame()
+{
+    QMutexLocker locker(&m_Lock);
+
+    if (m_Finished) {
+        return;
+    }
+
+    m_Stages.append({ "First frame rendered", LiGetMicroseconds() });
+    m_Finished = true;
+
+    uint64_t startUs = m_Stages.first().timeUs;
+    SDL_LogInfo(SDL_LOG_CATEGORY_APPLICATION,
+                "Time to first frame: %.1f ms",
+                (m_Stages.last().timeUs - startUs) / 1000.0);
+
+    uint64_t lastUs = startUs;
+    for (const Stage& stage : m_Stages) {
+        SDL_LogInfo(SDL_LOG_CATEGORY_APPLICATION,
+                    "Launch stage %s: %.1f ms (+%.1f ms)",
+                    stage.name,
+                    ((int64_t)stage.timeUs - (int64_t)startUs) / 1000.0,
+                    ((int64_t)stage.timeUs - (int64_t)lastUs) / 1000.0);
+        lastUs = stage.timeUs;
+    }
+}
+
+bool LaunchTimeline::takeSummary(QByteArray& ndjson)
+{
+    QMutexLocker locker(&m_Lock);
+
+    if (!m_Finished || m_SummaryTaken) {
+        return false;
+    }
+
+    m_SummaryTaken = true;
+
+    // Stage times are relative to the first stage, which
+    // may be a CLI stage from before the launch request
+    uint64_t startUs = m_Stages.first().timeUs;
+    ndjson = "{\"type\":\"launch\",\"start_us\":" + QByteArray::number((qulonglong)startUs) +
+            ",\"total_us\":" + QByteArray::number((qlonglong)(m_Stages.last().timeUs - startUs)) +
+            ",\"stages\":[";
+    for (int i = 0; i < m_Stages.size(); i++) {
+        if (i != 0) {
+            ndjson += ',';
+        }
+        ndjson += "{\"name\":\"" + QByteArray(m_Stages[i].name) +
+                "\",\"us\":" + QByteArray::number((qlonglong)m_Stages[i].timeUs - (qlonglong)startUs) + "}";
+    }
+    ndjson += "]}\n";
+
+    return true;
+}
+
+QJsonObject LaunchTimeline::toJson()
+{
+    QMutexLocker locker(&m_Lock);
+
+    uint64_t startUs = m_Stages.first().timeUs;
+
+    QJsonArray stages;
+    for (const Stage& stage : m_Stages) {
+        QJsonObject json;
+        json["name"] = stage.name;
+        json["us"] = (qint64)stage.timeUs - (qint64)startUs;
+        stages.append(json);
+    }
+
+    QJsonObject timeline;
+    timeline["first_frame_rendered"] = m_Finished;
+    timeline["total_us"] = (qint64)(m_Stages.last().timeUs - startUs);
+    timeline["stages"] = stages;
+    return timeline;
+}
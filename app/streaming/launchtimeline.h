@@ -0,0 +1,46 @@
+#pragma once
+
+#include "SDL_compat.h"
+
+#include <QByteArray>
+#include <QJsonObject>
+#include <QMutex>
+#include <QVector>
+
+// Records when each stage of starting a stream happens, from the launch
+// request until the first frame is rendered. Stages may be marked from
+// any thread. The summary is logged when the first frame is rendered and
+// the decoder forwards it to the metrics sink.
+class LaunchTimeline
+{
+public:
+    LaunchTimeline();
+
+    void markStage(const char* name);
+
+    // For stages that happened before the session was created,
+    // with a time from LiGetMicroseconds()
+    void addEarlierStage(const char* name, uint64_t timeUs);
+
+    // Marks the last stage and logs the summary. Later stages are ignored.
+    void markFirstFrame();
+
+    // Returns the summary as an NDJSON line once the first frame
+    // has been rendered. Only returns it once.
+    bool takeSummary(QByteArray& ndjson);
+
+    // Returns the stages so far for the session report, including
+    // when the stream ended before the first frame was rendered
+    QJsonObject toJson();
+
+private:
+    struct Stage {
+        const char* name;
+        uint64_t timeUs;
+    };
+
+    QMutex m_Lock;
+    QVector<Stage> m_Stages;
+    bool m_Finished;
+    bool m_SummaryTaken;
+};
@@ -0,0 +1,309 @@
+#include "metricsserver.h"
+#include "streamutils.h"
+
+#include <Limelight.h>
+
+#include <QTcpServer>
+#include <QTcpSocket>
+
+// Requests are tiny, so anything longer than this without a newline is bogus
+#define MAX_REQUEST_LINE_LENGTH 4096
+
+MetricsServer::MetricsServer(const QHostAddress& address, quint16 port)
+    : m_Address(address),
+      m_Port(port),
+      m_SessionState("connecting"),
+      m_ConnectionStatus(CONN_STATUS_OKAY),
+      m_HasWindow(false),
+      m_ReceivedFrames(0),
+      m_DecodedFrames(0),
+      m_RenderedFrames(0),
+      m_NetworkDroppedFrames(0),
+      m_PacerDroppedFrames(0),
+      m_IdrFrames(0),
+      m_LossRecoveries(0),
+      m_InputEvents(0)
+{
+    SDL_zero(m_LastWindow);
+    setObjectName("Metrics Server");
+}
+
+MetricsServer::~MetricsServer()
+{
+    quit();
+    wait();
+}
+
+MetricsServer* MetricsServer::createFromEnvironment()
+{
+    QString target = QString::fromLocal8Bit(qgetenv("ML_METRICS_HTTP"));
+    if (target.isEmpty()) {
+        return nullptr;
+    }
+
+    // Only listen on localhost unless an address is given
+    QHostAddress address(QHostAddress::LocalHost);
+    QString portString = target;
+    int separator = target.lastIndexOf(':');
+    if (separator >= 0) {
+        QString host = target.left(separator);
+        if (host.startsWith('[') && host.endsWith(']')) {
+            host = host.mid(1, host.length() - 2);
+        }
+        if (!address.setAddress(host)) {
+            SDL_LogError(SDL_LOG_CATEGORY_APPLICATION,
+                         "Invalid address in ML_METRICS_HTTP: %s",
+                         qPrintable(target));
+            return nullptr;
+        }
+        portString = target.mid(separator + 1);
+    }
+
+    bool ok;
+    uint port = portString.toUInt(&ok);
+    if (!ok || port == 0 || port > 65535) {
+        SDL_LogError(SDL_LOG_CATEGORY_APPLICATION,
+                     "Invalid port in ML_METRICS_HTTP: %s",
+                     qPrintable(target));
+        return nullptr;
+    }
+
+    MetricsServer* server = new MetricsServer(address, (quint16)port);
+    server->start();
+    return server;
+}
+
+void MetricsServer::setSessionState(const char* state)
+{
+    QMutexLocker locker(&m_Lock);
+    m_SessionState = state;
+}
+
+void MetricsServer::setConnectionStatus(int connectionStatus)
+{
+    QMutexLocker locker(&m_Lock);
+    m_ConnectionStatus = connectionStatus;
+}
+
+void MetricsServer::updateWindow(const VIDEO_STATS& stats, const char* decoderName, const char* rendererName)
+{
+    QMutexLocker locker(&m_Lock);
+
+    m_HasWindow = true;
+    m_LastWindow = stats;
+    if (m_DecoderName != decoderName) {
+        m_DecoderName = decoderName;
+    }
+    if (m_RendererName != rendererName) {
+        m_RendererName = rendererName;
+    }
+
+    m_ReceivedFrames += stats.receivedFrames;
+    m_DecodedFrames += stats.decodedFrames;
+    m_RenderedFrames += stats.renderedFrames;
+    m_NetworkDroppedFrames += stats.networkDroppedFrames;
+    m_PacerDroppedFrames += stats.pacerDroppedFrames;
+    m_IdrFrames += stats.idrFrames;
+    m_LossRecoveries += stats.lossRecoveries;
+    m_InputEvents += stats.inputEvents;
+}
+
+void MetricsServer::run()
+{
+    StreamUtils::placeCurrentThread(StreamUtils::TPC_BACKGROUND);
+
+    QTcpServer server;
+    if (!server.listen(m_Address, m_Port)) {
+        SDL_LogError(SDL_LOG_CATEGORY_APPLICATION,
+                     "Unable to serve metrics on %s:%u: %s",
+                     qPrintable(m_Address.toString()),
+                     m_Port,
+                     qPrintable(server.errorString()));
+        return;
+    }
+
+    SDL_LogInfo(SDL_LOG_CATEGORY_APPLICATION,
+                "Serving metrics on http://%s:%u/metrics",
+                qPrintable(m_Address.toString()),
+                m_Port);
+
+    QObject::connect(&server, &QTcpServer::newConnection, &server, [this, &server]() {
+        while (QTcpSocket* socket = server.nextPendingConnection()) {
+            QObject::connect(socket, &QTcpSocket::disconnected, socket, &QObject::deleteLater);
+            QObject::connect(socket, &QTcpSocket::readyRead, socket, [this, socket]() {
+                handleRequest(socket);
+            });
+        }
+    });
+
+    // Pending sockets are children of the server and go away with it
+    exec();
+}
+
+void MetricsServer::handleRequest(QTcpSocket* socket)
+{
+    if (!socket->canReadLine()) {
+        if (socket->bytesAvailable() > MAX_REQUEST_LINE_LENGTH) {
+            socket->abort();
+        }
+        return;
+    }
+
+    // We close the connection after each response, so the headers don't matter
+    QList<QByteArray> request = socket->readLine(MAX_REQUEST_LINE_LENGTH).trimmed().split(' ');
+    QObject::disconnect(socket, &QTcpSocket::readyRead, nullptr, nullptr);
+
+    QByteArray status, body;
+    if (request.size() < 2 || request[0] != "GET") {
+        status = "405 Method Not Allowed";
+    }
+    else if (request[1] != "/metrics" && request[1] != "/") {
+        status = "404 Not Found";
+    }
+    else {
+        status = "200 OK";
+        body = formatMetrics();
+    }
+
+    QByteArray response;
+    response += "HTTP/1.0 " + status + "\r\n";
+    response += "Content-Type: text/plain; version=0.0.4; charset=utf-8\r\n";
+    response += "Content-Length: " + QByteArray::number(body.size()) + "\r\n";
+    response += "Connection: close\r\n\r\n";
+    response += body;
+
+    socket->write(response);
+    socket->disconnectFromHost();
+}
+
+static void appendMetric(QByteArray& out, const char* name, const char* type, const char* help)
+{
+    out += "# HELP ";
+    out += name;
+    out += ' ';
+    out += help;
+    out += "\n# TYPE ";
+    out += name;
+    out += ' ';
+    out += type;
+    out += '\n';
+}
+
+static void appendValue(QByteArray& out, const char* name, const char* labels, double value)
+{
+    char line[256];
+    int length = snprintf(line, sizeof(line), "%s%s %.6g\n", name, labels, value);
+    if (length > 0 && length < (int)sizeof(line)) {
+        out.append(line, length);
+    }
+}
+
+static double average(uint64_t total, uint32_t count)
+{
+    return count != 0 ? (double)total / count : 0;
+}
+
+QByteArray MetricsServer::formatMetrics()
+{
+    QMutexLocker locker(&m_Lock);
+    QByteArray out;
+    char labels[256];
+
+    out.reserve(4096);
+
+    appendMetric(out, "moonlight_session_state", "gauge", "Current state of the streaming session");
+    snprintf(labels, sizeof(labels), "{state=\"%s\"}", m_SessionState);
+    appendValue(out, "moonlight_session_state", labels, 1);
+
+    appendMetric(out, "moonlight_connection_poor", "gauge", "1 if the host reported a poor connection");
+    appendValue(out, "moonlight_connection_poor", "", m_ConnectionStatus == CONN_STATUS_POOR ? 1 : 0);
+
+    // Nothing else is known until the first stats window from the decoder
+    if (!m_HasWindow) {
+        return out;
+    }
+
+    appendMetric(out, "moonlight_video_decoder_info", "gauge", "Video decoder and renderer in use");
+    snprintf(labels, sizeof(labels), "{decoder=\"%s\",renderer=\"%s\"}",
+             m_DecoderName.constData(), m_RendererName.constData());
+    appendValue(out, "moonlight_video_decoder_info", labels, 1);
+
+    appendMetric(out, "moonlight_video_frames_total", "counter", "Video frames by pipeline stage");
+    appendValue(out, "moonlight_video_frames_total", "{stage=\"received\"}", m_ReceivedFrames);
+    appendValue(out, "moonlight_video_frames_total", "{stage=\"decoded\"}", m_DecodedFrames);
+    appendValue(out, "moonlight_video_frames_total", "{stage=\"rendered\"}", m_RenderedFrames);
+
+    appendMetric(out, "moonlight_video_dropped_frames_total", "counter", "Video frames dropped by reason");
+    appendValue(out, "moonlight_video_dropped_frames_total", "{reason=\"network\"}", m_NetworkDroppedFrames);
+    appendValue(out, "moonlight_video_dropped_frames_total", "{reason=\"pacer\"}", m_PacerDroppedFrames);
+
+    appendMetric(out, "moonlight_video_idr_frames_total", "counter", "IDR frames received");
+    appendValue(out, "moonlight_video_idr_frames_total", "", m_IdrFrames);
+
+    appendMetric(out, "moonlight_video_loss_recoveries_total", "counter", "Recoveries from frame loss");
+    appendValue(out, "moonlight_video_loss_recoveries_total", "", m_LossRecoveries);
+
+    appendMetric(out, "moonlight_video_fps", "gauge", "Frame rate by pipeline stage over the last window");
+    appendValue(out, "moonlight_video_fps", "{stage=\"received\"}", m_LastWindow.receivedFps);
+    appendValue(out, "moonlight_video_fps", "{stage=\"decoded\"}", m_LastWindow.decodedFps);
+    appendValue(out, "moonlight_video_fps", "{stage=\"rendered\"}", m_LastWindow.renderedFps);
+
+    appendMetric(out, "moonlight_video_bitrate_mbps", "gauge", "Video bitrate, not including FEC");
+    appendValue(out, "moonlight_video_bitrate_mbps", "", m_LastWindow.videoMegabitsPerSec);
+
+    appendMetric(out, "moonlight_video_time_ms", "gauge", "Average time per frame by pipeline stage over the last window");
+    appendValue(out, "moonlight_video_time_ms", "{stage=\"host\"}",
+                average(m_LastWindow.totalHostProcessingLatency, m_LastWindow.framesWithHostProcessingLatency) / 10.0);
+    appendValue(out, "moonlight_video_time_ms", "{stage=\"reassembly\"}",
+                average(m_LastWindow.totalReassemblyTimeUs, m_LastWindow.receivedFrames) / 1000.0);
+    appendValue(out, "moonlight_video_time_ms", "{stage=\"decode\"}",
+                average(m_LastWindow.totalDecodeTimeUs, m_LastWindow.decodedFrames) / 1000.0);
+    appendValue(out, "moonlight_video_time_ms", "{stage=\"pacer\"}",
+                average(m_LastWindow.totalPacerTimeUs, m_LastWindow.renderedFrames) / 1000.0);
+    appendValue(out, "moonlight_video_time_ms", "{stage=\"render\"}",
+                average(m_LastWindow.totalRenderTimeUs, m_LastWindow.renderedFrames) / 1000.0);
+    if (m_LastWindow.framesWithPresentLatency != 0) {
+        appendValue(out, "moonlight_video_time_ms", "{stage=\"present\"}",
+                    average(m_LastWindow.totalPresentLatencyUs, m_LastWindow.framesWithPresentLatency) / 1000.0);
+    }
+
+    if (m_LastWindow.lastRtt != 0) {
+        appendMetric(out, "moonlight_network_rtt_ms", "gauge", "Estimated network round trip time");
+        appendValue(out, "moonlight_network_rtt_ms", "", m_LastWindow.lastRtt);
+
+        appendMetric(out, "moonlight_network_rtt_variance_ms", "gauge", "Estimated network round trip time variance");
+        appendValue(out, "moonlight_network_rtt_variance_ms", "", m_LastWindow.lastRttVariance);
+    }
+
+    appendMetric(out, "moonlight_audio_latency_ms", "gauge", "Audio renderer latency");
+    appendValue(out, "moonlight_audio_latency_ms", "{kind=\"current\"}", m_LastWindow.audioLatencyMs);
+    appendValue(out, "moonlight_audio_latency_ms", "{kind=\"target\"}", m_LastWindow.audioTargetLatencyMs);
+
+    appendMetric(out, "moonlight_audio_concealed_frames_total", "counter", "Audio frames concealed after packet loss");
+    appendValue(out, "moonlight_audio_concealed_frames_total", "", m_LastWindow.audioConcealedFrames);
+
+    appendMetric(out, "moonlight_audio_fec_frames_total", "counter", "Audio frames recovered with FEC");
+    appendValue(out, "moonlight_audio_fec_frames_total", "", m_LastWindow.audioFecFrames);
+
+    if (m_LastWindow.avOffsetValid) {
+        appendMetric(out, "moonlight_av_offset_ms", "gauge", "A/V offset, positive if video lags audio");
+        appendValue(out, "moonlight_av_offset_ms", "", m_LastWindow.avOffsetMs);
+    }
+
+    if (m_LastWindow.qualityFrames != 0) {
+        appendMetric(out, "moonlight_video_psnr_db", "gauge", "Average luma PSNR against the reference clip over the last window");
+        appendValue(out, "moonlight_video_psnr_db", "", m_LastWindow.totalPsnrDb / m_LastWindow.qualityFrames);
+
+        appendMetric(out, "moonlight_video_ssim", "gauge", "Average luma SSIM against the reference clip over the last window");
+        appendValue(out, "moonlight_video_ssim", "", m_LastWindow.totalSsim / m_LastWindow.qualityFrames);
+    }
+
+    appendMetric(out, "moonlight_input_events_total", "counter", "Input events sent to the host");
+    appendValue(out, "moonlight_input_events_total", "", m_InputEvents);
+
+    appendMetric(out, "moonlight_input_latency_ms", "gauge", "Average input send latency over the last window");
+    appendValue(out, "moonlight_input_latency_ms", "",
+                average(m_LastWindow.totalInputLatencyUs, m_LastWindow.inputEvents) / 1000.0);
+
+    return out;
+}
@@ -0,0 +1,64 @@
+#pragma once
+
+#include "video/decoder.h"
+
+#include <QByteArray>
+#include <QHostAddress>
+#include <QMutex>
+#include <QThread>
+
+class QTcpSocket;
+
+// Serves live stream metrics over HTTP in the Prometheus text format so a
+// fleet of clients can be scraped centrally instead of parsing [METRICS]
+// log lines. The decoder updates it once per 500 ms stats window, and
+// requests are answered from that snapshot on the server's own thread,
+// so nothing is formatted unless someone is scraping.
+//
+// Set ML_METRICS_HTTP to a port to listen on localhost, or to address:port.
+class MetricsServer : private QThread
+{
+public:
+    // Returns nullptr if ML_METRICS_HTTP is not set or is invalid
+    static MetricsServer* createFromEnvironment();
+
+    ~MetricsServer();
+
+    // Must be a string literal
+    void setSessionState(const char* state);
+
+    void setConnectionStatus(int connectionStatus);
+
+    // Called by the decoder with each completed stats window
+    void updateWindow(const VIDEO_STATS& stats, const char* decoderName, const char* rendererName);
+
+private:
+    MetricsServer(const QHostAddress& address, quint16 port);
+
+    void run() override;
+
+    void handleRequest(QTcpSocket* socket);
+
+    QByteArray formatMetrics();
+
+    QHostAddress m_Address;
+    quint16 m_Port;
+
+    QMutex m_Lock;
+    const char* m_SessionState;
+    int m_ConnectionStatus;
+    QByteArray m_DecoderName;
+    QByteArray m_RendererName;
+    bool m_HasWindow;
+    VIDEO_STATS m_LastWindow;
+
+    // Totals for the session, since Prometheus counters must not reset
+    uint64_t m_ReceivedFrames;
+    uint64_t m_DecodedFrames;
+    uint64_t m_RenderedFrames;
+    uint64_t m_NetworkDroppedFrames;
+    uint64_t m_PacerDroppedFrames;
+    uint64_t m_IdrFrames;
+    uint64_t m_LossRecoveries;
+    uint64_t m_InputEvents;
+};
@@ -53,6 +53,9 @@
 #include <QGuiApplication>
 #include <QCursor>
 #include <QScreen>
+#include <QDir>
+#include <QHash>
+#include <QStandardPaths>
 
 #if QT_VERSION >= QT_VERSION_CHECK(6, 0, 0)
 #include <QQuickOpenGLUtils>
@@ -60,6 +63,52 @@
 
 #define CONN_TEST_SERVER "qt.conntest.moonlight-stream.org"
 
+// 1472 byte UDP payloads (1500 byte IPv4 packets) carry 1392 bytes of video by default
+#define PACKET_SIZE_OVERHEAD (1472 - 1392)
+#define MIN_PACKET_SIZE 512
+#define MAX_PACKET_SIZE (8972 - PACKET_SIZE_OVERHEAD)
+
+// Enumerating display modes can take a while on some platforms, and SDL
+// throws away its list each time we quit the video subsystem. This is only
+// touched on the main thread and is cleared when displays come and go.
+static QHash<QString, QVector<SDL_DisplayMode>> s_DisplayModeCache;
+
+static QVector<SDL_DisplayMode> getCachedDisplayModes(int displayIndex, const SDL_DisplayMode& desktopMode)
+{
+    QString key = QString("%1/%2x%3x%4").arg(SDL_GetDisplayName(displayIndex))
+                                        .arg(desktopMode.w).arg(desktopMode.h)
+                                        .arg(desktopMode.refresh_rate);
+
+    auto it = s_DisplayModeCache.constFind(key);
+    if (it != s_DisplayModeCache.constEnd()) {
+        return *it;
+    }
+
+    QVector<SDL_DisplayMode> modes;
+    for (int i = 0; i < SDL_GetNumDisplayModes(displayIndex); i++) {
+        SDL_DisplayMode mode;
+        if (SDL_GetDisplayMode(displayIndex, i, &mode) == 0) {
+            modes.append(mode);
+        }
+    }
+
+    s_DisplayModeCache.insert(key, modes);
+    return modes;
+}
+
+// SDL2 reports integer refresh rates, so fractional rates like 119.88 Hz
+// may come through as 119 or 120. Allow for that when checking whether the
+// display refreshes at a whole multiple of the stream frame rate.
+static bool isRefreshRateMultipleOfFps(int refreshRate, int fps)
+{
+    if (refreshRate <= 0 || fps <= 0) {
+        return false;
+    }
+
+    int multiple = (refreshRate + fps / 2) / fps;
+    return multiple > 0 && qAbs(refreshRate - multiple * fps) <= 1;
+}
+
 CONNECTION_LISTENER_CALLBACKS Session::k_ConnCallbacks = {
     Session::clStageStarting,
     nullptr,
@@ -84,6 +133,7 @@ void Session::clStageStarting(int stage)
     // We know this is called on the same thread as LiStartConnection()
     // which happens to be the main thread, so it's cool to interact
     // with the GUI in these callbacks.
+    s_ActiveSession->m_LaunchTimeline.markStage(LiGetStageName(stage));
     emit s_ActiveSession->stageStarting(QString::fromLocal8Bit(LiGetStageName(stage)));
 }
 
@@ -197,14 +247,33 @@ void Session::clConnectionStatusUpdate(int connectionStatus)
         return;
     }
 
+    s_ActiveSession->m_FlightRecorder.record(FlightRecorder::EventConnectionStatus, connectionStatus);
+    if (s_ActiveSession->m_MetricsServer != nullptr) {
+        s_ActiveSession->m_MetricsServer->setConnectionStatus(connectionStatus);
+    }
+
     switch (connectionStatus)
     {
     case CONN_STATUS_POOR:
-        s_ActiveSession->m_OverlayManager.updateOverlayText(Overlay::OverlayStatusUpdate,
-                                                            s_ActiveSession->m_StreamConfig.bitrate > 5000 ?
-                                                                "Slow connection to PC\nReduce your bitrate" : "Poor connection to PC");
+    {
+        // Keep the frames leading up to this for post-mortem analysis
+        s_ActiveSession->m_FlightRecorder.dump("poor connection", true);
+
+        // Suggest what the bitrate controller thinks the connection can carry
+        int targetKbps = s_ActiveSession->m_BitrateController.getTargetKbps();
+        if (targetKbps != 0 && targetKbps < s_ActiveSession->m_StreamConfig.bitrate) {
+            char text[64];
+            snprintf(text, sizeof(text), "Slow connection to PC\nReduce your bitrate to %.1f Mbps", targetKbps / 1000.0);
+            s_ActiveSession->m_OverlayManager.updateOverlayText(Overlay::OverlayStatusUpdate, text);
+        }
+        else {
+            s_ActiveSession->m_OverlayManager.updateOverlayText(Overlay::OverlayStatusUpdate,
+                                                                s_ActiveSession->m_StreamConfig.bitrate > 5000 ?
+                                                                    "Slow connection to PC\nReduce your bitrate" : "Poor connection to PC");
+        }
         s_ActiveSession->m_OverlayManager.setOverlayState(Overlay::OverlayStatusUpdate, true);
         break;
+    }
     case CONN_STATUS_OKAY:
         s_ActiveSession->m_OverlayManager.setOverlayState(Overlay::OverlayStatusUpdate, false);
         break;
@@ -306,9 +375,13 @@ bool Session::chooseDecoder(StreamingPreferences::VideoDecoderSelection vds,
     params.window = window;
     params.enableVsync = enableVsync;
     params.enableFramePacing = enableFramePacing;
+    params.enableVrr = !testOnly && qEnvironmentVariableIntValue("PACER_VRR") != 0;
     params.testOnly = testOnly;
     params.vds = vds;
 
+    // Decoders keep this rather than calling Session::get() while streaming
+    params.session = s_ActiveSession;
+
     SDL_LogInfo(SDL_LOG_CATEGORY_APPLICATION,
                 "V-sync %s",
                 enableVsync ? "enabled" : "disabled");
@@ -360,11 +433,19 @@ int Session::drSetup(int videoFormat, int width, int height, int frameRate, void
 
     // Defer decoder setup until we've started streaming so we
     // don't have to hide and show the SDL window (which seems to
-    // cause pointer hiding to break on Windows).
+    // cause pointer hiding to break on Windows). If a decoder was
+    // prepared during the handshake, exec() will use it as long
+    // as it matches these parameters.
 
     SDL_LogInfo(SDL_LOG_CATEGORY_APPLICATION, "Video stream is %dx%dx%d (format 0x%x)",
                 width, height, frameRate, videoFormat);
 
+    // Capture the stream for replay with "moonlight benchmark-video --capture"
+    QString capturePath = QString::fromLocal8Bit(qgetenv("ML_DECODE_UNIT_CAPTURE"));
+    if (!capturePath.isEmpty()) {
+        s_ActiveSession->m_DecodeUnitCapture.initialize(capturePath, videoFormat, width, height, frameRate);
+    }
+
     return 0;
 }
 
@@ -378,6 +459,8 @@ int Session::drSubmitDecodeUnit(PDECODE_UNIT du)
     // safely return DR_OK and wait for the IDR frame request by
     // the decoder reinitialization code.
 
+    s_ActiveSession->captureDecodeUnit(du);
+
     if (SDL_TryLockMutex(s_ActiveSession->m_DecoderLock) == 0) {
         IVideoDecoder* decoder = s_ActiveSession->m_VideoDecoder;
         if (decoder != nullptr) {
@@ -492,10 +575,169 @@ void Session::getDecoderInfo(SDL_Window* window,
                  "Failed to find ANY working H.264 or HEVC decoder!");
 }
 
+class DecoderProbeTask : public QRunnable
+{
+public:
+    DecoderProbeTask(SDL_Window* window, Session::DecoderProbeResult* result, QSemaphore* doneSemaphore) :
+        m_Window(window),
+        m_Result(result),
+        m_DoneSemaphore(doneSemaphore) {}
+
+private:
+    void run() override
+    {
+        uint64_t startUs = LiGetMicroseconds();
+        m_Result->availability = Session::probeDecoderAvailability(m_Window,
+                                                                   m_Result->vds,
+                                                                   m_Result->videoFormat,
+                                                                   m_Result->width,
+                                                                   m_Result->height,
+                                                                   m_Result->frameRate);
+        m_Result->durationUs = LiGetMicroseconds() - startUs;
+
+        // The session may not touch the result until this is released
+        m_DoneSemaphore->release();
+    }
+
+    SDL_Window* m_Window;
+    Session::DecoderProbeResult* m_Result;
+    QSemaphore* m_DoneSemaphore;
+};
+
+SDL_Window* Session::createTestWindow(int x, int y, int width, int height)
+{
+    SDL_Window* testWindow = SDL_CreateWindow("", x, y, width, height,
+                                              SDL_WINDOW_HIDDEN | StreamUtils::getPlatformWindowFlags());
+    if (!testWindow) {
+        SDL_LogWarn(SDL_LOG_CATEGORY_APPLICATION,
+                    "Failed to create test window with platform flags: %s",
+                    SDL_GetError());
+
+        testWindow = SDL_CreateWindow("", x, y, width, height, SDL_WINDOW_HIDDEN);
+        if (!testWindow) {
+            SDL_LogError(SDL_LOG_CATEGORY_APPLICATION,
+                         "Failed to create window for hardware decode test: %s",
+                         SDL_GetError());
+        }
+    }
+
+    return testWindow;
+}
+
+bool Session::canProbeDecodersInParallel()
+{
+    // This is opt-in with DECODER_PARALLEL_PROBE=1. The probes create D3D11,
+    // DXVA2 and GL devices on hidden windows owned by the main thread, and the
+    // SDL renderer fallback makes SDL video calls, neither of which is safe
+    // off the main thread on every platform. SDL also doesn't initialize Xlib
+    // for multithreaded use, and several other backends (VideoToolbox, MMAL,
+    // DRM master) either require the main thread or can't have multiple
+    // instances open at once.
+    if (qEnvironmentVariableIntValue("DECODER_PARALLEL_PROBE") == 0) {
+        return false;
+    }
+
+    return SDL_GetCPUCount() >= 2;
+}
+
+void Session::prefetchDecoderAvailability(int x, int y, int width, int height)
+{
+    // Software decoders are cheap to probe and there's nothing to gain here
+    if (m_Preferences->videoDecoderSelection == StreamingPreferences::VDS_FORCE_SOFTWARE ||
+            !canProbeDecodersInParallel()) {
+        return;
+    }
+
+    // These are the probes that initialize() and validateLaunch() are
+    // most likely to perform with the current preferences. Any probes
+    // that aren't prefetched here will just be done serially later.
+    QVector<int> videoFormats;
+    if (m_Preferences->enableHdr) {
+        videoFormats.append(m_Preferences->enableYUV444 ? VIDEO_FORMAT_H265_REXT10_444 : VIDEO_FORMAT_H265_MAIN10);
+        videoFormats.append(m_Preferences->enableYUV444 ? VIDEO_FORMAT_AV1_HIGH10_444 : VIDEO_FORMAT_AV1_MAIN10);
+    }
+    if (m_Preferences->enableYUV444) {
+        videoFormats.append(VIDEO_FORMAT_H265_REXT8_444);
+        videoFormats.append(VIDEO_FORMAT_H264_HIGH8_444);
+    }
+    videoFormats.append(VIDEO_FORMAT_H265);
+    videoFormats.append(VIDEO_FORMAT_H264);
+
+    // The results must not move while the tasks have pointers to them
+    SDL_assert(m_DecoderProbeResults.isEmpty());
+    m_DecoderProbeResults.reserve(videoFormats.size());
+
+    // Each probe gets its own hidden window, since renderers can't share
+    // a window (or its swapchain) with each other. Windows must be created
+    // and destroyed on the main thread.
+    QVector<SDL_Window*> probeWindows;
+    for (int videoFormat : videoFormats) {
+        SDL_Window* window = createTestWindow(x, y, width, height);
+        if (!window) {
+            break;
+        }
+
+        probeWindows.append(window);
+        m_DecoderProbeResults.append({ m_Preferences->videoDecoderSelection,
+                                       videoFormat,
+                                       m_StreamConfig.width,
+                                       m_StreamConfig.height,
+                                       m_StreamConfig.fps,
+                                       DecoderAvailability::None,
+                                       0 });
+    }
+
+    Uint32 startTime = SDL_GetTicks();
+    QSemaphore doneSemaphore;
+
+    for (int i = 0; i < probeWindows.size(); i++) {
+        QThreadPool::globalInstance()->start(new DecoderProbeTask(probeWindows[i], &m_DecoderProbeResults[i], &doneSemaphore));
+    }
+
+    // Wait for all probes to finish before validateLaunch() consumes the results.
+    // We must keep pumping messages for the probe windows while we wait, since
+    // DXGI and other window system calls from the probe threads may send
+    // messages to them and block until this thread processes them.
+    while (!doneSemaphore.tryAcquire(probeWindows.size(), 10)) {
+        SDL_PumpEvents();
+    }
+
+    for (SDL_Window* window : probeWindows) {
+        SDL_DestroyWindow(window);
+    }
+
+    SDL_LogInfo(SDL_LOG_CATEGORY_APPLICATION,
+                "Probed %d video formats in parallel in %u ms",
+                (int)probeWindows.size(),
+                SDL_GetTicks() - startTime);
+}
+
 Session::DecoderAvailability
 Session::getDecoderAvailability(SDL_Window* window,
                                 StreamingPreferences::VideoDecoderSelection vds,
                                 int videoFormat, int width, int height, int frameRate)
+{
+    for (const DecoderProbeResult& result : m_DecoderProbeResults) {
+        if (result.vds == vds && result.videoFormat == videoFormat &&
+                result.width == width && result.height == height &&
+                result.frameRate == frameRate) {
+            return result.availability;
+        }
+    }
+
+    uint64_t startUs = LiGetMicroseconds();
+    DecoderAvailability availability = probeDecoderAvailability(window, vds, videoFormat, width, height, frameRate);
+
+    // Remember this result in case initialize() and validateLaunch() both ask for it
+    m_DecoderProbeResults.append({ vds, videoFormat, width, height, frameRate, availability, LiGetMicroseconds() - startUs });
+
+    return availability;
+}
+
+Session::DecoderAvailability
+Session::probeDecoderAvailability(SDL_Window* window,
+                                  StreamingPreferences::VideoDecoderSelection vds,
+                                  int videoFormat, int width, int height, int frameRate)
 {
     IVideoDecoder* decoder;
 
@@ -525,6 +767,21 @@ bool Session::populateDecoderProperties(SDL_Window* window)
     }
 
     m_VideoCallbacks.capabilities = decoder->getDecoderCapabilities();
+
+    // Without RFI, the host must send an IDR frame to recover from every loss
+    int rfiCapability;
+    if (m_SupportedVideoFormats.first() & VIDEO_FORMAT_MASK_H264) {
+        rfiCapability = CAPABILITY_REFERENCE_FRAME_INVALIDATION_AVC;
+    }
+    else if (m_SupportedVideoFormats.first() & VIDEO_FORMAT_MASK_H265) {
+        rfiCapability = CAPABILITY_REFERENCE_FRAME_INVALIDATION_HEVC;
+    }
+    else {
+        rfiCapability = CAPABILITY_REFERENCE_FRAME_INVALIDATION_AV1;
+    }
+    SDL_LogInfo(SDL_LOG_CATEGORY_APPLICATION,
+                "Reference frame invalidation: %s",
+                (m_VideoCallbacks.capabilities & rfiCapability) ? "supported" : "unsupported (losses require IDR frames)");
     if (m_VideoCallbacks.capabilities & CAPABILITY_PULL_RENDERER) {
         // It is an error to pass a push callback when in pull mode
         m_VideoCallbacks.submitDecodeUnit = nullptr;
@@ -573,6 +830,8 @@ Session::Session(NvComputer* computer, NvApp& app, StreamingPreferences *prefere
       m_App(app),
       m_Window(nullptr),
       m_VideoDecoder(nullptr),
+      m_PreparedDecoder(nullptr),
+      m_PrepareStreamWindow(qgetenv("ML_PREPARE_STREAM") != "0"),
       m_DecoderLock(SDL_CreateMutex()),
       m_AudioMuted(false),
       m_QtWindow(nullptr),
@@ -586,8 +845,25 @@ Session::Session(NvComputer* computer, NvApp& app, StreamingPreferences *prefere
       m_OpusDecoder(nullptr),
       m_AudioRenderer(nullptr),
       m_AudioSampleCount(0),
-      m_DropAudioEndTime(0)
+      m_PendingAudioRenderer(nullptr),
+      m_RetiredAudioRenderer(nullptr),
+      m_AudioRendererInitSemaphore(1),
+      m_InputLatency(&m_FlightRecorder),
+      m_MetricsServer(nullptr),
+      m_RequestedAudioDelayMs(0),
+      m_AppliedAudioDelayMs(0),
+      m_AudioFecEnabled(qgetenv("AUDIO_OPUS_FEC") == "1"),
+      m_PendingLostAudioFrames(0),
+      m_VideoDecryptionThroughputMbps(0)
 {
+    // Only record from the start if the user asked for it
+    SDL_AtomicSet(&m_RecordingRequested, !m_Preferences->recordingDirectory.isEmpty());
+
+    SDL_AtomicSet(&m_AudioLatencyMs, 0);
+    SDL_AtomicSet(&m_AudioTargetLatencyMs, 0);
+    SDL_AtomicSet(&m_AudioConcealedFrames, 0);
+    SDL_AtomicSet(&m_CompositorBypassRequested, 0);
+    SDL_AtomicSet(&m_AudioFecFrames, 0);
 }
 
 Session::~Session()
@@ -659,21 +935,10 @@ bool Session::initialize(QQuickWindow* qtWindow)
     getWindowDimensions(x, y, width, height);
 
     // Create a hidden window to use for decoder initialization tests
-    SDL_Window* testWindow = SDL_CreateWindow("", x, y, width, height,
-                                              SDL_WINDOW_HIDDEN | StreamUtils::getPlatformWindowFlags());
+    SDL_Window* testWindow = createTestWindow(x, y, width, height);
     if (!testWindow) {
-        SDL_LogWarn(SDL_LOG_CATEGORY_APPLICATION,
-                    "Failed to create test window with platform flags: %s",
-                    SDL_GetError());
-
-        testWindow = SDL_CreateWindow("", x, y, width, height, SDL_WINDOW_HIDDEN);
-        if (!testWindow) {
-            SDL_LogError(SDL_LOG_CATEGORY_APPLICATION,
-                         "Failed to create window for hardware decode test: %s",
-                         SDL_GetError());
-            SDL_QuitSubSystem(SDL_INIT_VIDEO);
-            return false;
-        }
+        SDL_QuitSubSystem(SDL_INIT_VIDEO);
+        return false;
     }
 
     qInfo() << "Server GPU:" << m_Computer->gpuModel;
@@ -685,11 +950,31 @@ bool Session::initialize(QQuickWindow* qtWindow)
     m_StreamConfig.fps = m_Preferences->fps;
     m_StreamConfig.bitrate = m_Preferences->bitrateKbps;
 
+    // Run the independent decoder probes concurrently where that's safe
+    prefetchDecoderAvailability(x, y, width, height);
+
 #ifndef STEAM_LINK
-    // Opt-in to all encryption features if we detect that the platform
-    // has AES cryptography acceleration instructions and more than 2 cores.
-    if (StreamUtils::hasFastAes() && SDL_GetCPUCount() > 2) {
+    // Opt-in to all encryption features if decrypting video at the requested
+    // bitrate would take under 5% of one core, and we have more than 2 cores.
+    // Without a benchmark result, we assume that's the case if the platform
+    // has AES cryptography acceleration instructions.
+    double gcmMbps = 0, cbcMbps = 0;
+    bool videoEncryptionAffordable;
+    if (StreamUtils::getAesThroughput(&gcmMbps, &cbcMbps)) {
+        videoEncryptionAffordable = m_StreamConfig.bitrate / 1000.0 <= gcmMbps * 0.05;
+        SDL_LogInfo(SDL_LOG_CATEGORY_APPLICATION,
+                    "Decrypting %d kbps video would take %.1f%% of a CPU core%s",
+                    m_StreamConfig.bitrate,
+                    m_StreamConfig.bitrate / 10.0 / gcmMbps,
+                    videoEncryptionAffordable ? "" : " (too slow for video encryption)");
+    }
+    else {
+        videoEncryptionAffordable = StreamUtils::hasFastAes();
+    }
+
+    if (videoEncryptionAffordable && SDL_GetCPUCount() > 2) {
         m_StreamConfig.encryptionFlags = ENCFLG_ALL;
+        m_VideoDecryptionThroughputMbps = gcmMbps;
     }
     else {
         // Enable audio encryption as long as we're not on Steam Link.
@@ -952,11 +1237,20 @@ bool Session::initialize(QQuickWindow* qtWindow)
 
     SDL_DestroyWindow(testWindow);
 
+    for (const DecoderProbeResult& result : m_DecoderProbeResults) {
+        m_SessionReport.addDecoderProbe(result.videoFormat, result.width, result.height, result.frameRate,
+                                        result.availability == DecoderAvailability::Hardware ? "hardware" :
+                                        result.availability == DecoderAvailability::Software ? "software" : "none",
+                                        result.durationUs);
+    }
+    m_DecoderProbeResults.clear();
+
     if (!ret) {
         SDL_QuitSubSystem(SDL_INIT_VIDEO);
         return false;
     }
 
+    m_LaunchTimeline.markStage("Launch validated");
     return true;
 }
 
@@ -1239,25 +1533,61 @@ bool Session::validateLaunch(SDL_Window* testWindow)
 }
 
 
+// Quits the running app on the host, so it can overlap with LiStopConnection()
+class QuitAppTask : public QRunnable
+{
+public:
+    QuitAppTask(NvComputer* computer, QSemaphore* doneSemaphore) :
+        m_Computer(computer),
+        m_DoneSemaphore(doneSemaphore) {}
+
+    void run() override
+    {
+        NvHTTP http(m_Computer);
+
+        // Logging is already done inside NvHTTP
+        try {
+            http.quitApp();
+        } catch (const GfeHttpResponseException&) {
+        } catch (const QtNetworkReplyException&) {
+        }
+
+        m_DoneSemaphore->release();
+    }
+
+private:
+    NvComputer* m_Computer;
+    QSemaphore* m_DoneSemaphore;
+};
+
 class DeferredSessionCleanupTask : public QRunnable
 {
 public:
     DeferredSessionCleanupTask(Session* session) :
-        m_Session(session) {}
+        m_Session(session),
+        m_StepStartUs(LiGetMicroseconds()) {}
 
 private:
     virtual ~DeferredSessionCleanupTask() override
     {
-        // Allow another session to start now that we're cleaned up
-        Session::s_ActiveSession = nullptr;
-        Session::s_ActiveSessionSemaphore.release();
-
         // Notify that the session is ready to be cleaned up
         emit m_Session->readyForDeletion();
     }
 
+    void endStep(const char* name)
+    {
+        uint64_t now = LiGetMicroseconds();
+        SDL_LogInfo(SDL_LOG_CATEGORY_APPLICATION,
+                    "Session teardown: %s took %u ms",
+                    name,
+                    (uint32_t)((now - m_StepStartUs) / 1000));
+        m_StepStartUs = now;
+    }
+
     void run() override
     {
+        uint64_t teardownStartUs = m_StepStartUs;
+
         // Only quit the running app if our session terminated gracefully
         bool shouldQuit =
                 !m_Session->m_UnexpectedTermination &&
@@ -1277,20 +1607,58 @@ private:
         // LiStartConnection() and LiStopConnection().
         SDL_assert(m_Session->m_VideoDecoder == nullptr);
 
+        // Perform a best-effort app quit. The host is about to end the
+        // stream either way, so this is sent while we stop the connection
+        // rather than waiting for LiStopConnection() to finish first. If
+        // the pool has no spare thread, we quit afterwards instead.
+        QSemaphore quitDoneSemaphore;
+        bool quitInParallel = false;
+        if (shouldQuit) {
+            quitInParallel = QThreadPool::globalInstance()->tryStart(new QuitAppTask(m_Session->m_Computer, &quitDoneSemaphore));
+        }
+
         // Finish cleanup of the connection state
         LiStopConnection();
+        endStep("stopping the connection");
+
+        // No more decode units can arrive now. The next session may
+        // capture to the same file, so this must finish before it starts.
+        m_Session->m_DecodeUnitCapture.finalize();
+
+        // Nothing is left to update the metrics, and its port must be
+        // free before the next session starts
+        delete m_Session->m_MetricsServer;
+        m_Session->m_MetricsServer = nullptr;
+
+        // Every decoder and audio renderer has contributed to the report by now
+        uint32_t audioConcealedFrames, audioFecFrames;
+        m_Session->getAudioConcealmentStats(&audioConcealedFrames, &audioFecFrames);
+        m_Session->m_SessionReport.setStreamConfig(m_Session->m_StreamConfig);
+        m_Session->m_SessionReport.setLaunchTimeline(m_Session->m_LaunchTimeline.toJson());
+        m_Session->m_SessionReport.setAudioStats(audioConcealedFrames, audioFecFrames);
+        m_Session->m_SessionReport.setTermination(m_Session->m_UnexpectedTermination);
+        m_Session->m_SessionReport.setOverlayPeakBytes(m_Session->m_OverlayManager.getPeakSurfaceBytes());
+        m_Session->m_SessionReport.write();
 
-        // Perform a best-effort app quit
         if (shouldQuit) {
-            NvHTTP http(m_Session->m_Computer);
-
-            // Logging is already done inside NvHTTP
-            try {
-                http.quitApp();
-            } catch (const GfeHttpResponseException&) {
-            } catch (const QtNetworkReplyException&) {
+            if (quitInParallel) {
+                quitDoneSemaphore.acquire();
+            }
+            else {
+                QuitAppTask(m_Session->m_Computer, &quitDoneSemaphore).run();
             }
+            endStep("waiting for the app to quit");
+        }
 
+        // Allow another session to start now that the media threads are gone
+        // and the host is done with this one
+        Session::s_ActiveSession = nullptr;
+        Session::s_ActiveSessionSemaphore.release();
+        SDL_LogInfo(SDL_LOG_CATEGORY_APPLICATION,
+                    "Session slot released %u ms after teardown started",
+                    (uint32_t)((LiGetMicroseconds() - teardownStartUs) / 1000));
+
+        if (shouldQuit) {
             // Exit the entire program if requested
             if (m_Session->m_ShouldExitAfterQuit) {
                 QCoreApplication::instance()->quit();
@@ -1302,6 +1670,7 @@ private:
     }
 
     Session* m_Session;
+    uint64_t m_StepStartUs;
 };
 
 void Session::getWindowDimensions(int& x, int& y,
@@ -1389,7 +1758,7 @@ void Session::getWindowDimensions(int& x, int& y,
 
 void Session::updateOptimalWindowDisplayMode()
 {
-    SDL_DisplayMode desktopMode, bestMode, mode;
+    SDL_DisplayMode desktopMode, bestMode;
     int displayIndex = SDL_GetWindowDisplayIndex(m_Window);
 
     // Try the current display mode first. On macOS, this will be the normal
@@ -1411,20 +1780,27 @@ void Session::updateOptimalWindowDisplayMode()
         return;
     }
 
+    // Mode switches can take seconds on some TVs, so don't switch at all
+    // if the desktop mode already refreshes at a multiple of our FPS.
+    if (isRefreshRateMultipleOfFps(desktopMode.refresh_rate, m_StreamConfig.fps)) {
+        SDL_SetWindowDisplayMode(m_Window, &desktopMode);
+        return;
+    }
+
+    QVector<SDL_DisplayMode> modes = getCachedDisplayModes(displayIndex, desktopMode);
+
     // Start with the native desktop resolution and try to find
     // the highest refresh rate that our stream FPS evenly divides.
     bestMode = desktopMode;
     bestMode.refresh_rate = 0;
-    for (int i = 0; i < SDL_GetNumDisplayModes(displayIndex); i++) {
-        if (SDL_GetDisplayMode(displayIndex, i, &mode) == 0) {
-            if (mode.w == desktopMode.w && mode.h == desktopMode.h &&
-                    mode.refresh_rate % m_StreamConfig.fps == 0) {
-                SDL_LogInfo(SDL_LOG_CATEGORY_APPLICATION,
-                            "Found display mode with desktop resolution: %dx%dx%d",
-                            mode.w, mode.h, mode.refresh_rate);
-                if (mode.refresh_rate > bestMode.refresh_rate) {
-                    bestMode = mode;
-                }
+    for (const SDL_DisplayMode& mode : modes) {
+        if (mode.w == desktopMode.w && mode.h == desktopMode.h &&
+                isRefreshRateMultipleOfFps(mode.refresh_rate, m_StreamConfig.fps)) {
+            SDL_LogInfo(SDL_LOG_CATEGORY_APPLICATION,
+                        "Found display mode with desktop resolution: %dx%dx%d",
+                        mode.w, mode.h, mode.refresh_rate);
+            if (mode.refresh_rate > bestMode.refresh_rate) {
+                bestMode = mode;
             }
         }
     }
@@ -1437,19 +1813,17 @@ void Session::updateOptimalWindowDisplayMode()
     if (bestMode.refresh_rate == 0) {
         float bestModeAspectRatio = 0;
         float videoAspectRatio = (float)m_ActiveVideoWidth / (float)m_ActiveVideoHeight;
-        for (int i = 0; i < SDL_GetNumDisplayModes(displayIndex); i++) {
-            if (SDL_GetDisplayMode(displayIndex, i, &mode) == 0) {
-                float modeAspectRatio = (float)mode.w / (float)mode.h;
-                if (mode.w >= m_ActiveVideoWidth && mode.h >= m_ActiveVideoHeight &&
-                        mode.refresh_rate % m_StreamConfig.fps == 0) {
-                    SDL_LogInfo(SDL_LOG_CATEGORY_APPLICATION,
-                                "Found display mode with video resolution: %dx%dx%d",
-                                mode.w, mode.h, mode.refresh_rate);
-                    if (mode.refresh_rate >= bestMode.refresh_rate &&
-                            (bestModeAspectRatio == 0 || fabs(videoAspectRatio - modeAspectRatio) <= fabs(videoAspectRatio - bestModeAspectRatio))) {
-                        bestMode = mode;
-                        bestModeAspectRatio = modeAspectRatio;
-                    }
+        for (const SDL_DisplayMode& mode : modes) {
+            float modeAspectRatio = (float)mode.w / (float)mode.h;
+            if (mode.w >= m_ActiveVideoWidth && mode.h >= m_ActiveVideoHeight &&
+                    isRefreshRateMultipleOfFps(mode.refresh_rate, m_StreamConfig.fps)) {
+                SDL_LogInfo(SDL_LOG_CATEGORY_APPLICATION,
+                            "Found display mode with video resolution: %dx%dx%d",
+                            mode.w, mode.h, mode.refresh_rate);
+                if (mode.refresh_rate >= bestMode.refresh_rate &&
+                        (bestModeAspectRatio == 0 || fabs(videoAspectRatio - modeAspectRatio) <= fabs(videoAspectRatio - bestModeAspectRatio))) {
+                    bestMode = mode;
+                    bestModeAspectRatio = modeAspectRatio;
                 }
             }
         }
@@ -1498,6 +1872,8 @@ void Session::toggleFullscreen()
     // Actually enter/leave fullscreen
     SDL_SetWindowFullscreen(m_Window, fullScreen ? m_FullScreenFlag : 0);
 
+    updateCompositorBypass();
+
 #ifdef Q_OS_DARWIN
     // SDL on macOS has a bug that causes the window size to be reset to crazy
     // large dimensions when exiting out of true fullscreen mode. We can work
@@ -1517,6 +1893,14 @@ void Session::toggleFullscreen()
     m_InputHandler->updatePointerRegionLock();
 }
 
+void Session::updateCompositorBypass()
+{
+    // Bypassing the compositor while full-screen saves a frame of latency
+    bool fullScreen = !!(SDL_GetWindowFlags(m_Window) & SDL_WINDOW_FULLSCREEN);
+    SDL_AtomicSet(&m_CompositorBypassRequested,
+                  WMUtils::setCompositorBypass(m_Window, fullScreen) ? 1 : 0);
+}
+
 void Session::notifyMouseEmulationMode(bool enabled)
 {
     m_MouseEmulationRefCount += enabled ? 1 : -1;
@@ -1553,6 +1937,9 @@ public:
 // Called in a non-main thread
 bool Session::startConnectionAsync()
 {
+    // Serve metrics for the whole session, including the launch
+    m_MetricsServer = MetricsServer::createFromEnvironment();
+
     // Wait 1.5 seconds before connecting to let the user
     // have time to read any messages present on the segue
     SDL_Delay(1500);
@@ -1587,6 +1974,8 @@ bool Session::startConnectionAsync()
 
     QString rtspSessionUrl;
 
+    m_LaunchTimeline.markStage("Launching app");
+
     try {
         NvHTTP http(m_Computer);
         http.startApp(m_Computer->currentGameId != 0 ? "resume" : "launch",
@@ -1644,7 +2033,8 @@ bool Session::startConnectionAsync()
 
         // getActiveAddressReachability() does network I/O, so we only attempt to check
         // reachability if we've already contacted the PC successfully.
-        switch (m_Computer->getActiveAddressReachability()) {
+        NvComputer::ReachabilityType reachability = m_Computer->getActiveAddressReachability();
+        switch (reachability) {
         case NvComputer::RI_LAN:
             // This address is on-link, so treat it as a local address
             // even if it's not in RFC 1918 space or it's an IPv6 address.
@@ -1661,6 +2051,33 @@ bool Session::startConnectionAsync()
             m_StreamConfig.streamingRemotely = STREAM_CFG_AUTO;
             break;
         }
+
+        if (qgetenv("ML_PMTU_PROBE") != "0") {
+            int maxDatagramSize = m_Computer->probeActiveAddressMaxDatagramSize();
+            if (maxDatagramSize != 0) {
+                // Keep the same headroom for the RTP, video and encryption headers
+                // that the 1392 byte default leaves in a 1500 byte IPv4 packet
+                int packetSize = ((maxDatagramSize - PACKET_SIZE_OVERHEAD) / 16) * 16;
+
+                // Shrink to fit anything smaller along the path. Our MTU says nothing
+                // about the host's NIC or any switch in between, which will fragment
+                // or silently drop jumbo packets, so we only go above the default
+                // with ML_PMTU_PROBE_GROW=1. Even then, it's only on the local link
+                // and only for hosts other than GFE, which expect standard sizes.
+                if (packetSize < m_StreamConfig.packetSize ||
+                        (qEnvironmentVariableIntValue("ML_PMTU_PROBE_GROW") != 0 &&
+                         reachability == NvComputer::RI_LAN && !m_Computer->isNvidiaServerSoftware)) {
+                    packetSize = qBound(MIN_PACKET_SIZE, packetSize, MAX_PACKET_SIZE);
+                    if (packetSize != m_StreamConfig.packetSize) {
+                        SDL_LogInfo(SDL_LOG_CATEGORY_APPLICATION,
+                                    "Using %d byte packets for %d byte datagrams",
+                                    packetSize,
+                                    maxDatagramSize);
+                        m_StreamConfig.packetSize = packetSize;
+                    }
+                }
+            }
+        }
     }
 
     // If the user has chosen YUV444 without adjusting the bitrate but the host doesn't
@@ -1681,6 +2098,19 @@ bool Session::startConnectionAsync()
                                                                          false);
     }
 
+    m_StreamConfig.bitrate = m_BitrateController.initialize(m_Computer->uuid,
+                                                            m_StreamConfig.bitrate,
+                                                            m_Preferences->autoAdjustBitrate);
+    m_DecoderLoad.initialize(m_StreamConfig.width, m_StreamConfig.height, m_StreamConfig.fps);
+
+    m_LaunchTimeline.markStage("Starting connection");
+
+    // Create the window and decoder on the main thread while the handshake
+    // is in progress rather than waiting until the stream has started.
+    if (m_PrepareStreamWindow) {
+        QMetaObject::invokeMethod(this, "prepareStreamWindow", Qt::QueuedConnection);
+    }
+
     int err = LiStartConnection(&hostInfo, &m_StreamConfig, &k_ConnCallbacks,
                                 &m_VideoCallbacks, &m_AudioCallbacks,
                                 NULL, 0, NULL, 0);
@@ -1690,6 +2120,10 @@ bool Session::startConnectionAsync()
         return false;
     }
 
+    m_LaunchTimeline.markStage("Connection started");
+    if (m_MetricsServer != nullptr) {
+        m_MetricsServer->setSessionState("streaming");
+    }
     emit connectionStarted();
     return true;
 }
@@ -1716,6 +2150,28 @@ void Session::setShouldExitAfterQuit()
     m_ShouldExitAfterQuit = true;
 }
 
+void Session::toggleRecording()
+{
+    bool requested = !isRecordingRequested();
+
+    SDL_LogInfo(SDL_LOG_CATEGORY_APPLICATION,
+                "%s recording to %s",
+                requested ? "Starting" : "Stopping",
+                getRecordingDirectory().toUtf8().constData());
+
+    SDL_AtomicSet(&m_RecordingRequested, requested);
+}
+
+QString Session::getRecordingDirectory()
+{
+    if (!m_Preferences->recordingDirectory.isEmpty()) {
+        return m_Preferences->recordingDirectory;
+    }
+
+    // Recording was started by hotkey without a configured directory
+    return QDir(QStandardPaths::writableLocation(QStandardPaths::MoviesLocation)).filePath("Moonlight");
+}
+
 void Session::start()
 {
     // Wait for any old session to finish cleanup
@@ -1735,17 +2191,8 @@ void Session::start()
     thread->start();
 }
 
-void Session::exec()
+bool Session::createStreamWindow()
 {
-    // If the connection failed, clean up and abort the connection.
-    if (!m_AsyncConnectionSuccess) {
-        delete m_InputHandler;
-        m_InputHandler = nullptr;
-        SDL_QuitSubSystem(SDL_INIT_VIDEO);
-        QThreadPool::globalInstance()->start(new DeferredSessionCleanupTask(this));
-        return;
-    }
-
     int x, y, width, height;
     getWindowDimensions(x, y, width, height);
 
@@ -1765,6 +2212,10 @@ void Session::exec()
     SDL_GL_SetAttribute(SDL_GL_DEPTH_SIZE, 0);
     SDL_GL_SetAttribute(SDL_GL_STENCIL_SIZE, 0);
 
+    // Use an opaque surface, since Wayland compositors won't scan out
+    // a surface directly if they need to blend it with what's behind it.
+    SDL_GL_SetAttribute(SDL_GL_ALPHA_SIZE, 0);
+
     // We always want a resizable window with High DPI enabled
     Uint32 defaultWindowFlags = SDL_WINDOW_ALLOW_HIGHDPI | SDL_WINDOW_RESIZABLE;
 
@@ -1819,12 +2270,7 @@ void Session::exec()
             SDL_LogError(SDL_LOG_CATEGORY_APPLICATION,
                          "SDL_CreateWindow() failed: %s",
                          SDL_GetError());
-
-            delete m_InputHandler;
-            m_InputHandler = nullptr;
-            SDL_QuitSubSystem(SDL_INIT_VIDEO);
-            QThreadPool::globalInstance()->start(new DeferredSessionCleanupTask(this));
-            return;
+            return false;
         }
     }
 
@@ -1860,8 +2306,6 @@ void Session::exec()
     }
 #endif
 
-    m_InputHandler->setWindow(m_Window);
-
     QSvgRenderer svgIconRenderer(QString(":/res/moonlight.svg"));
     QImage svgImage(ICON_SIZE, ICON_SIZE, QImage::Format_RGBA8888);
     svgImage.fill(0);
@@ -1883,6 +2327,11 @@ void Session::exec()
     }
 #endif
 
+    // SDL keeps its own copy of the icon
+    if (iconSurface != nullptr) {
+        SDL_FreeSurface(iconSurface);
+    }
+
     // Update the window display mode based on our current monitor
     // for if/when we enter full-screen mode.
     updateOptimalWindowDisplayMode();
@@ -1892,6 +2341,100 @@ void Session::exec()
         SDL_SetWindowFullscreen(m_Window, m_FullScreenFlag);
     }
 
+    updateCompositorBypass();
+
+    return true;
+}
+
+void Session::prepareStreamWindow()
+{
+    Uint32 startTime = SDL_GetTicks();
+
+    // If this fails, exec() will try again and report the error
+    if (!createStreamWindow()) {
+        return;
+    }
+
+    m_LaunchTimeline.markStage("Window created");
+
+    // Discard the window events from creating the window and entering full-screen,
+    // since the decoder we create below will already match the window's state.
+    flushWindowEvents();
+
+    // The video format was locked in by initialize(), so the host should set up the
+    // video stream exactly as we requested it. exec() checks that before using it.
+    if (createStreamDecoder(m_StreamConfig.supportedVideoFormats,
+                            m_StreamConfig.width,
+                            m_StreamConfig.height,
+                            m_StreamConfig.fps,
+                            m_PreparedDecoder)) {
+        m_LaunchTimeline.markStage("Decoder prepared");
+    }
+    else {
+        SDL_LogWarn(SDL_LOG_CATEGORY_APPLICATION,
+                    "Unable to prepare video decoder during connection");
+    }
+
+    SDL_LogInfo(SDL_LOG_CATEGORY_APPLICATION,
+                "Prepared streaming window%s in %u ms",
+                m_PreparedDecoder != nullptr ? " and decoder" : "",
+                SDL_GetTicks() - startTime);
+}
+
+bool Session::createStreamDecoder(int videoFormat, int width, int height, int frameRate, IVideoDecoder*& decoder)
+{
+    // If the stream exceeds the display refresh rate (plus some slack),
+    // forcefully disable V-sync to allow the stream to render faster
+    // than the display.
+    int displayHz = StreamUtils::getDisplayRefreshRate(m_Window);
+    bool enableVsync = m_Preferences->enableVsync;
+    if (displayHz + 5 < m_StreamConfig.fps) {
+        SDL_LogWarn(SDL_LOG_CATEGORY_APPLICATION,
+                    "Disabling V-sync because refresh rate limit exceeded");
+        enableVsync = false;
+    }
+
+    return chooseDecoder(m_Preferences->videoDecoderSelection,
+                         m_Window, videoFormat, width, height, frameRate,
+                         enableVsync,
+                         enableVsync && m_Preferences->framePacing,
+                         false,
+                         decoder);
+}
+
+void Session::exec()
+{
+    // If the connection failed, clean up and abort the connection.
+    if (!m_AsyncConnectionSuccess) {
+        delete m_PreparedDecoder;
+        m_PreparedDecoder = nullptr;
+        if (m_Window != nullptr) {
+            SDL_DestroyWindow(m_Window);
+            m_Window = nullptr;
+        }
+        delete m_InputHandler;
+        m_InputHandler = nullptr;
+        SDL_QuitSubSystem(SDL_INIT_VIDEO);
+        QThreadPool::globalInstance()->start(new DeferredSessionCleanupTask(this));
+        return;
+    }
+
+    // The window may have already been created during the connection handshake
+    bool windowPrepared = m_Window != nullptr;
+    if (!windowPrepared) {
+        if (!createStreamWindow()) {
+            delete m_InputHandler;
+            m_InputHandler = nullptr;
+            SDL_QuitSubSystem(SDL_INIT_VIDEO);
+            QThreadPool::globalInstance()->start(new DeferredSessionCleanupTask(this));
+            return;
+        }
+
+        m_LaunchTimeline.markStage("Window created");
+    }
+
+    m_InputHandler->setWindow(m_Window);
+
     bool needsFirstEnterCapture = false;
     bool needsPostDecoderCreationCapture = false;
 
@@ -1930,6 +2473,48 @@ void Session::exec()
 
     int currentDisplayIndex = SDL_GetWindowDisplayIndex(m_Window);
 
+    if (windowPrepared) {
+        SDL_LockMutex(m_DecoderLock);
+
+        // Use the decoder that we prepared during the connection handshake
+        // if the host set up the video stream the way we asked it to.
+        if (m_PreparedDecoder != nullptr &&
+                m_ActiveVideoFormat == m_StreamConfig.supportedVideoFormats &&
+                m_ActiveVideoWidth == m_StreamConfig.width &&
+                m_ActiveVideoHeight == m_StreamConfig.height &&
+                m_ActiveVideoFrameRate == m_StreamConfig.fps) {
+            SDL_LogInfo(SDL_LOG_CATEGORY_APPLICATION,
+                        "Using video decoder prepared during connection");
+
+            m_VideoDecoder = m_PreparedDecoder;
+            m_VideoDecoder->setHdrMode(LiGetCurrentHostDisplayHdrMode());
+            LiRequestIdrFrame();
+
+            m_LaunchTimeline.markStage("Decoder created");
+        }
+        else {
+            if (m_PreparedDecoder != nullptr) {
+                SDL_LogInfo(SDL_LOG_CATEGORY_APPLICATION,
+                            "Discarding prepared video decoder for unexpected video stream");
+                delete m_PreparedDecoder;
+            }
+
+            // The window events that would normally trigger decoder creation
+            // were discarded when the window was prepared, so request it here.
+            SDL_Event resetEvent = {};
+            resetEvent.type = SDL_RENDER_TARGETS_RESET;
+            SDL_PushEvent(&resetEvent);
+        }
+
+        m_PreparedDecoder = nullptr;
+        SDL_UnlockMutex(m_DecoderLock);
+
+        if (m_VideoDecoder != nullptr && needsPostDecoderCreationCapture) {
+            m_InputHandler->setCaptureActive(true);
+            needsPostDecoderCreationCapture = false;
+        }
+    }
+
     // Now that we're about to stream, any SDL_QUIT event is expected
     // unless it comes from the connection termination callback where
     // (m_UnexpectedTermination is set back to true).
@@ -2020,6 +2605,21 @@ void Session::exec()
                 m_InputHandler->setAdaptiveTriggers((uint16_t)(uintptr_t)event.user.data1,
                                                     (DualSenseOutputReport *)event.user.data2);
                 break;
+            case SDL_CODE_GAMECONTROLLER_FLUSH_STATE:
+                m_InputHandler->flushGamepadState();
+                break;
+            case SDL_CODE_MOUSE_FLUSH_MOTION:
+                m_InputHandler->flushMouseMotion();
+                break;
+            case SDL_CODE_TOUCH_FLUSH_MOTION:
+                m_InputHandler->flushTouchMotion();
+                break;
+            case SDL_CODE_GAMECONTROLLER_FLUSH_HAPTICS:
+                m_InputHandler->flushHapticsState();
+                break;
+            case SDL_CODE_GAMECONTROLLER_OPENED:
+                m_InputHandler->handleGamepadOpened(&event.user);
+                break;
             default:
                 SDL_assert(false);
             }
@@ -2157,6 +2757,16 @@ void Session::exec()
 
             SDL_LockMutex(m_DecoderLock);
 
+            // If the decoder itself asked to be reset, it may be able to recover
+            // without tearing down its renderer's device and swapchain.
+            if (event.type == SDL_RENDER_DEVICE_RESET && m_VideoDecoder != nullptr &&
+                    currentDisplayIndex == SDL_GetWindowDisplayIndex(m_Window) &&
+                    m_VideoDecoder->reinitializeDecoder()) {
+                LiRequestIdrFrame();
+                SDL_UnlockMutex(m_DecoderLock);
+                break;
+            }
+
             // Destroy the old decoder
             delete m_VideoDecoder;
 
@@ -2181,26 +2791,11 @@ void Session::exec()
             SDL_FlushEvent(SDL_RENDER_TARGETS_RESET);
 
             {
-                // If the stream exceeds the display refresh rate (plus some slack),
-                // forcefully disable V-sync to allow the stream to render faster
-                // than the display.
-                int displayHz = StreamUtils::getDisplayRefreshRate(m_Window);
-                bool enableVsync = m_Preferences->enableVsync;
-                if (displayHz + 5 < m_StreamConfig.fps) {
-                    SDL_LogWarn(SDL_LOG_CATEGORY_APPLICATION,
-                                "Disabling V-sync because refresh rate limit exceeded");
-                    enableVsync = false;
-                }
-
                 // Choose a new decoder (hopefully the same one, but possibly
                 // not if a GPU was removed or something).
-                if (!chooseDecoder(m_Preferences->videoDecoderSelection,
-                                   m_Window, m_ActiveVideoFormat, m_ActiveVideoWidth,
-                                   m_ActiveVideoHeight, m_ActiveVideoFrameRate,
-                                   enableVsync,
-                                   enableVsync && m_Preferences->framePacing,
-                                   false,
-                                   s_ActiveSession->m_VideoDecoder)) {
+                if (!createStreamDecoder(m_ActiveVideoFormat, m_ActiveVideoWidth,
+                                         m_ActiveVideoHeight, m_ActiveVideoFrameRate,
+                                         s_ActiveSession->m_VideoDecoder)) {
                     SDL_UnlockMutex(m_DecoderLock);
                     SDL_LogError(SDL_LOG_CATEGORY_APPLICATION,
                                  "Failed to recreate decoder after reset");
@@ -2208,6 +2803,8 @@ void Session::exec()
                     goto DispatchDeferredCleanup;
                 }
 
+                m_LaunchTimeline.markStage("Decoder created");
+
                 // As of SDL 2.0.12, SDL_RecreateWindow() doesn't carry over mouse capture
                 // or mouse hiding state to the new window. By capturing after the decoder
                 // is set up, this ensures the window re-creation is already done.
@@ -2285,6 +2882,7 @@ void Session::exec()
             switch (event.display.event) {
             case SDL_DISPLAYEVENT_CONNECTED:
             case SDL_DISPLAYEVENT_DISCONNECTED:
+                s_DisplayModeCache.clear();
                 m_InputHandler->updatePointerRegionLock();
                 break;
             }
@@ -2305,6 +2903,10 @@ DispatchDeferredCleanup:
         QGuiApplication::restoreOverrideCursor();
     }
 
+    if (m_MetricsServer != nullptr) {
+        m_MetricsServer->setSessionState("stopping");
+    }
+
     // Raise any keys that are still down
     m_InputHandler->raiseAllKeys();
 
@@ -2317,10 +2919,17 @@ DispatchDeferredCleanup:
     // Destroy the decoder, since this must be done on the main thread
     // NB: This must happen before LiStopConnection() for pull-based
     // decoders.
+    uint64_t decoderTeardownStartUs = LiGetMicroseconds();
     SDL_LockMutex(m_DecoderLock);
     delete m_VideoDecoder;
     m_VideoDecoder = nullptr;
     SDL_UnlockMutex(m_DecoderLock);
+    SDL_LogInfo(SDL_LOG_CATEGORY_APPLICATION,
+                "Session teardown: destroying the decoder took %u ms",
+                (uint32_t)((LiGetMicroseconds() - decoderTeardownStartUs) / 1000));
+
+    // The decoder thread is gone, so the bitrate controller is done
+    m_BitrateController.saveTarget();
 
     // Propagate state changes from the SDL window back to the Qt window
     //
@@ -2351,10 +2960,6 @@ DispatchDeferredCleanup:
     // the renderer may want to interact with the window
     SDL_DestroyWindow(m_Window);
 
-    if (iconSurface != nullptr) {
-        SDL_FreeSurface(iconSurface);
-    }
-
     SDL_QuitSubSystem(SDL_INIT_VIDEO);
 
     // Cleanup can take a while, so dispatch it to a worker thread.
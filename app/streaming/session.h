@@ -1,5 +1,6 @@
 #pragma once
 
+#include <QQueue>
 #include <QSemaphore>
 #include <QQuickWindow>
 
@@ -8,8 +9,19 @@
 #include "settings/streamingpreferences.h"
 #include "input/input.h"
 #include "video/decoder.h"
+#include "video/decodeunitcapture.h"
 #include "audio/renderers/renderer.h"
+#include "audio/downmix.h"
 #include "video/overlaymanager.h"
+#include "avsync.h"
+#include "hostclock.h"
+#include "bitratecontroller.h"
+#include "decoderload.h"
+#include "launchtimeline.h"
+#include "flightrecorder.h"
+#include "metricsserver.h"
+#include "sessionreport.h"
+#include "input/inputlatency.h"
 
 class SupportedVideoFormatList : public QList<int>
 {
@@ -96,6 +108,8 @@ class Session : public QObject
     friend class SdlInputHandler;
     friend class DeferredSessionCleanupTask;
     friend class AsyncConnectionStartThread;
+    friend class DecoderProbeTask;
+    friend class AudioRendererInitTask;
 
 public:
     explicit Session(NvComputer* computer, NvApp& app, StreamingPreferences *preferences = nullptr);
@@ -115,6 +129,13 @@ public:
         return s_ActiveSession;
     }
 
+    // Audio backend names accepted by ML_AUDIO, in order of preference
+    static QStringList getAvailableAudioRenderers();
+
+    // Returns nullptr if the backend is unknown or fails to initialize
+    static
+    IAudioRenderer* createAudioRendererByName(const QString& name, const POPUS_MULTISTREAM_CONFIGURATION opusConfig);
+
     Overlay::OverlayManager& getOverlayManager()
     {
         return m_OverlayManager;
@@ -124,6 +145,114 @@ public:
 
     void setShouldExitAfterQuit();
 
+    // Called on the main thread to start or stop recording the stream
+    void toggleRecording();
+
+    // Polled by the decoder to apply recording state changes
+    bool isRecordingRequested()
+    {
+        return SDL_AtomicGet(&m_RecordingRequested) != 0;
+    }
+
+    QString getRecordingDirectory();
+
+    StreamingPreferences::RecordingFormat getRecordingFormat()
+    {
+        return m_Preferences->recordingFormat;
+    }
+
+    bool isLowMemoryMode()
+    {
+        return m_Preferences->lowMemoryMode;
+    }
+
+    // Polled by the decoder for the stats overlay
+    bool isCompositorBypassRequested()
+    {
+        return SDL_AtomicGet(&m_CompositorBypassRequested) != 0;
+    }
+
+    // Polled by the decoder for the stats overlay. Returns the benchmarked
+    // AES-GCM throughput if video is encrypted and it is known, or 0.
+    double getVideoDecryptionThroughputMbps()
+    {
+        return m_VideoDecryptionThroughputMbps;
+    }
+
+    // Polled by the decoder for the stats overlay
+    void getAudioConcealmentStats(uint32_t* concealedFrames, uint32_t* fecFrames)
+    {
+        *concealedFrames = (uint32_t)SDL_AtomicGet(&m_AudioConcealedFrames);
+        *fecFrames = (uint32_t)SDL_AtomicGet(&m_AudioFecFrames);
+    }
+
+    AvSyncMonitor& getAvSyncMonitor()
+    {
+        return m_AvSync;
+    }
+
+    HostClock& getHostClock()
+    {
+        return m_HostClock;
+    }
+
+    InputLatencyMonitor& getInputLatencyMonitor()
+    {
+        return m_InputLatency;
+    }
+
+    FlightRecorder& getFlightRecorder()
+    {
+        return m_FlightRecorder;
+    }
+
+    // nullptr unless ML_METRICS_HTTP is set
+    MetricsServer* getMetricsServer()
+    {
+        return m_MetricsServer;
+    }
+
+    BitrateController& getBitrateController()
+    {
+        return m_BitrateController;
+    }
+
+    DecoderLoadMonitor& getDecoderLoadMonitor()
+    {
+        return m_DecoderLoad;
+    }
+
+    LaunchTimeline& getLaunchTimeline()
+    {
+        return m_LaunchTimeline;
+    }
+
+    SessionReport& getSessionReport()
+    {
+        return m_SessionReport;
+    }
+
+    // Called by decoders with each decode unit before decoding it
+    void captureDecodeUnit(PDECODE_UNIT du)
+    {
+        m_DecodeUnitCapture.submitDecodeUnit(du);
+    }
+
+    // Saves the decoder load monitor's suggestion for the next stream
+    bool applySuggestedSettings()
+    {
+        return m_DecoderLoad.applySuggestion(m_Preferences);
+    }
+
+    // Polled by the decoder for the stats overlay. Returns false if the
+    // audio renderer doesn't track its latency.
+    bool getAudioLatency(uint32_t* latencyMs, uint32_t* targetLatencyMs)
+    {
+        *latencyMs = (uint32_t)SDL_AtomicGet(&m_AudioLatencyMs);
+        *targetLatencyMs = (uint32_t)SDL_AtomicGet(&m_AudioTargetLatencyMs);
+        return *latencyMs != 0;
+    }
+
 signals:
     void stageStarting(QString stage);
 
@@ -145,6 +274,14 @@ signals:
 private:
     void exec();
 
+    bool createStreamWindow();
+
+    // Called on the main thread while the connection is being established
+    Q_INVOKABLE void prepareStreamWindow();
+
+    bool createStreamDecoder(int videoFormat, int width, int height, int frameRate,
+                             IVideoDecoder*& decoder);
+
     bool startConnectionAsync();
 
     bool validateLaunch(SDL_Window* testWindow);
@@ -157,6 +294,20 @@ private:
 
     bool initializeAudioRenderer();
 
+    bool attachAudioRenderer(IAudioRenderer* renderer);
+
+    // Deletes oldRenderer and creates a new one on the thread pool
+    void startAudioRendererInit(IAudioRenderer* oldRenderer);
+
+    void waitForAudioRendererInit();
+
+    // Adds a renderer's lifetime stats to the session report before it's destroyed
+    void reportAudioRendererStats(IAudioRenderer* renderer);
+
+    // Decodes one Opus frame (or conceals a lost one if data is null) and
+    // submits it to the audio renderer. Returns false if the renderer failed.
+    bool playAudioFrame(const unsigned char* data, int length, bool decodeFec);
+
     bool testAudio(int audioConfiguration);
 
     int getAudioRendererCapabilities(int audioConfiguration);
@@ -170,17 +321,41 @@ private:
 
     void updateOptimalWindowDisplayMode();
 
+    void updateCompositorBypass();
+
     enum class DecoderAvailability {
         None,
         Software,
         Hardware
     };
 
+    struct DecoderProbeResult {
+        StreamingPreferences::VideoDecoderSelection vds;
+        int videoFormat;
+        int width;
+        int height;
+        int frameRate;
+        DecoderAvailability availability;
+        uint64_t durationUs;
+    };
+
+    static
+    SDL_Window* createTestWindow(int x, int y, int width, int height);
+
     static
+    bool canProbeDecodersInParallel();
+
+    void prefetchDecoderAvailability(int x, int y, int width, int height);
+
     DecoderAvailability getDecoderAvailability(SDL_Window* window,
                                                StreamingPreferences::VideoDecoderSelection vds,
                                                int videoFormat, int width, int height, int frameRate);
 
+    static
+    DecoderAvailability probeDecoderAvailability(SDL_Window* window,
+                                                 StreamingPreferences::VideoDecoderSelection vds,
+                                                 int videoFormat, int width, int height, int frameRate);
+
     static
     bool chooseDecoder(StreamingPreferences::VideoDecoderSelection vds,
                        SDL_Window* window, int videoFormat, int width, int height,
@@ -244,6 +419,7 @@ private:
     StreamingPreferences* m_Preferences;
     bool m_IsFullScreen;
     SupportedVideoFormatList m_SupportedVideoFormats; // Sorted in order of descending priority
+    QVector<DecoderProbeResult> m_DecoderProbeResults; // Only valid during initialize()
     STREAM_CONFIGURATION m_StreamConfig;
     DECODER_RENDERER_CALLBACKS m_VideoCallbacks;
     AUDIO_RENDERER_CALLBACKS m_AudioCallbacks;
@@ -251,6 +427,8 @@ private:
     NvApp m_App;
     SDL_Window* m_Window;
     IVideoDecoder* m_VideoDecoder;
+    IVideoDecoder* m_PreparedDecoder; // Not receiving frames until exec() binds it
+    bool m_PrepareStreamWindow;
     SDL_mutex* m_DecoderLock;
     bool m_AudioDisabled;
     bool m_AudioMuted;
@@ -262,6 +440,7 @@ private:
     int m_FlushingWindowEventsRef;
     QStringList m_LaunchWarnings;
     bool m_ShouldExitAfterQuit;
+    SDL_atomic_t m_RecordingRequested;
 
     bool m_AsyncConnectionSuccess;
     int m_PortTestResults;
@@ -275,8 +454,35 @@ private:
     IAudioRenderer* m_AudioRenderer;
     OPUS_MULTISTREAM_CONFIGURATION m_ActiveAudioConfig;
     OPUS_MULTISTREAM_CONFIGURATION m_OriginalAudioConfig;
+    OPUS_MULTISTREAM_CONFIGURATION m_RendererAudioConfig;
+    SurroundDownmixer m_Downmixer;
     int m_AudioSampleCount;
-    Uint32 m_DropAudioEndTime;
+    IAudioRenderer* m_PendingAudioRenderer;
+    IAudioRenderer* m_RetiredAudioRenderer; // Failed while a recreation was in flight
+    QSemaphore m_AudioRendererInitSemaphore;
+    QQueue<QByteArray> m_BufferedAudioPackets;
+    SDL_atomic_t m_AudioLatencyMs;
+    SDL_atomic_t m_AudioTargetLatencyMs;
+    AvSyncMonitor m_AvSync;
+    HostClock m_HostClock;
+
+    // Must be declared before the monitors that record into it
+    FlightRecorder m_FlightRecorder;
+    InputLatencyMonitor m_InputLatency;
+    BitrateController m_BitrateController;
+    DecoderLoadMonitor m_DecoderLoad;
+    LaunchTimeline m_LaunchTimeline;
+    SessionReport m_SessionReport;
+    DecodeUnitCapture m_DecodeUnitCapture;
+    MetricsServer* m_MetricsServer;
+    uint32_t m_RequestedAudioDelayMs;
+    uint32_t m_AppliedAudioDelayMs;
+    bool m_AudioFecEnabled;
+    int m_PendingLostAudioFrames;
+    SDL_atomic_t m_AudioConcealedFrames;
+    SDL_atomic_t m_CompositorBypassRequested;
+    SDL_atomic_t m_AudioFecFrames;
+    double m_VideoDecryptionThroughputMbps;
 
     Overlay::OverlayManager m_OverlayManager;
 
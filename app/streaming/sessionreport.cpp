@@ -0,0 +1,288 @@
+#include "sessionreport.h"
+#include "path.h"
+#include "streamutils.h"
+
+#include <Limelight.h>
+
+#include <QDir>
+#include <QFile>
+#include <QJsonDocument>
+
+// Bumped whenever a field is renamed or removed, not when one is added
+#define SESSION_REPORT_VERSION 1
+
+static double average(uint64_t total, uint32_t count)
+{
+    return count != 0 ? (double)total / count : 0;
+}
+
+static QJsonObject histogramToJson(const LATENCY_HISTOGRAM& histogram)
+{
+    QJsonObject json;
+    json["count"] = (qint64)histogram.count;
+    json["p50_us"] = latencyHistogramPercentile(histogram, 50);
+    json["p90_us"] = latencyHistogramPercentile(histogram, 90);
+    json["p99_us"] = latencyHistogramPercentile(histogram, 99);
+    json["p999_us"] = latencyHistogramPercentile(histogram, 99.9);
+
+    // Only the buckets that were hit, as [midpoint in us, count] pairs
+    QJsonArray buckets;
+    for (int i = 0; i < LATENCY_HISTOGRAM_BUCKETS; i++) {
+        if (histogram.buckets[i] != 0) {
+            buckets.append(QJsonArray { latencyHistogramBucketValue(i), (qint64)histogram.buckets[i] });
+        }
+    }
+    json["buckets"] = buckets;
+
+    return json;
+}
+
+SessionReport::SessionReport()
+    : m_Enabled(qgetenv("ML_SESSION_REPORT") != "0"),
+      m_StartTime(QDateTime::currentDateTime()),
+      m_StartUs(LiGetMicroseconds()),
+      m_LastBitrateSampleUs(0),
+      m_BitrateWindowSeconds(0),
+      m_TotalBitrateMbps(0),
+      m_PeakBitrateMbps(0),
+      m_InputEvents(0),
+      m_TotalInputLatencyUs(0),
+      m_MaxInputLatencyUs(0),
+      m_HaveAudioUnderruns(false),
+      m_AudioUnderruns(0),
+      m_AudioConcealedFrames(0),
+      m_AudioFecFrames(0),
+      m_UnexpectedTermination(false),
+      m_OverlayPeakBytes(0)
+{
+}
+
+void SessionReport::addDecoderProbe(int videoFormat, int width, int height, int frameRate,
+                                    const char* result, uint64_t durationUs)
+{
+    QJsonObject probe;
+    probe["video_format"] = videoFormat;
+    probe["width"] = width;
+    probe["height"] = height;
+    probe["fps"] = frameRate;
+    probe["result"] = result;
+    probe["duration_us"] = (qint64)durationUs;
+
+    QMutexLocker locker(&m_Lock);
+    m_DecoderProbes.append(probe);
+}
+
+void SessionReport::addVideoDecoder(const char* decoderName,
+                                    const char* frontendRendererName,
+                                    const char* backendRendererName,
+                                    bool hardwareAccelerated,
+                                    const VIDEO_STATS& stats,
+                                    uint64_t decoderPoolBytes,
+                                    uint64_t decodedFrameBytes)
+{
+    QJsonObject decoder;
+    decoder["decoder"] = decoderName;
+    decoder["renderer"] = frontendRendererName;
+    decoder["backend_renderer"] = backendRendererName;
+    decoder["hardware_accelerated"] = hardwareAccelerated;
+    decoder["duration_ms"] = (qint64)((LiGetMicroseconds() - stats.measurementStartUs) / 1000);
+
+    QJsonObject frames;
+    frames["total"] = (qint64)stats.totalFrames;
+    frames["received"] = (qint64)stats.receivedFrames;
+    frames["decoded"] = (qint64)stats.decodedFrames;
+    frames["rendered"] = (qint64)stats.renderedFrames;
+    frames["network_dropped"] = (qint64)stats.networkDroppedFrames;
+    frames["pacer_dropped"] = (qint64)stats.pacerDroppedFrames;
+    frames["recorder_dropped"] = (qint64)stats.recorderDroppedFrames;
+    frames["idr"] = (qint64)stats.idrFrames;
+    frames["received_fps"] = stats.receivedFps;
+    frames["decoded_fps"] = stats.decodedFps;
+    frames["rendered_fps"] = stats.renderedFps;
+    decoder["frames"] = frames;
+
+    QJsonObject pacerDrops;
+    pacerDrops["vsync"] = (qint64)stats.pacerVsyncDrops;
+    pacerDrops["render"] = (qint64)stats.pacerRenderDrops;
+    pacerDrops["overflow"] = (qint64)stats.pacerOverflowDrops;
+    pacerDrops["decode_backlog"] = (qint64)stats.decodeBacklogTrimmedFrames;
+    decoder["pacer_drops"] = pacerDrops;
+
+    QJsonObject latency;
+    latency["host_processing_min_ms"] = stats.minHostProcessingLatency / 10.0;
+    latency["host_processing_max_ms"] = stats.maxHostProcessingLatency / 10.0;
+    latency["host_processing_avg_ms"] = average(stats.totalHostProcessingLatency, stats.framesWithHostProcessingLatency) / 10.0;
+    latency["reassembly_avg_ms"] = average(stats.totalReassemblyTimeUs, stats.receivedFrames) / 1000.0;
+    latency["decode_avg_ms"] = average(stats.totalDecodeTimeUs, stats.decodedFrames) / 1000.0;
+    latency["pacer_avg_ms"] = average(stats.totalPacerTimeUs, stats.renderedFrames) / 1000.0;
+    latency["render_avg_ms"] = average(stats.totalRenderTimeUs, stats.renderedFrames) / 1000.0;
+    if (stats.framesWithPresentLatency != 0) {
+        latency["present_avg_ms"] = average(stats.totalPresentLatencyUs, stats.framesWithPresentLatency) / 1000.0;
+    }
+    if (stats.framesWithEndToEndLatency != 0) {
+        latency["end_to_end_avg_ms"] = average(stats.totalEndToEndLatencyUs, stats.framesWithEndToEndLatency) / 1000.0;
+        latency["end_to_end_max_ms"] = stats.maxEndToEndLatencyUs / 1000.0;
+    }
+    if (stats.lastRtt != 0) {
+        latency["rtt_ms"] = (qint64)stats.lastRtt;
+        latency["rtt_variance_ms"] = (qint64)stats.lastRttVariance;
+    }
+    decoder["latency"] = latency;
+
+    QJsonObject histograms;
+    histograms["reassembly"] = histogramToJson(stats.reassemblyTimeHistogram);
+    histograms["decode"] = histogramToJson(stats.decodeTimeHistogram);
+    histograms["pacer"] = histogramToJson(stats.pacerTimeHistogram);
+    histograms["render"] = histogramToJson(stats.renderTimeHistogram);
+    decoder["latency_histograms"] = histograms;
+
+    QJsonObject lossRecovery;
+    lossRecovery["recoveries"] = (qint64)stats.lossRecoveries;
+    lossRecovery["idr_recoveries"] = (qint64)stats.idrLossRecoveries;
+    lossRecovery["avg_ms"] = average(stats.totalLossRecoveryTimeUs, stats.lossRecoveries) / 1000.0;
+    lossRecovery["max_ms"] = stats.maxLossRecoveryTimeUs / 1000.0;
+    lossRecovery["decode_backlog_trims"] = (qint64)stats.decodeBacklogTrims;
+    decoder["loss_recovery"] = lossRecovery;
+
+    QJsonObject memory;
+    memory["decoder_pool_bytes"] = (qint64)decoderPoolBytes;
+    memory["decoded_frame_bytes"] = (qint64)decodedFrameBytes;
+    memory["max_pacer_queued_frames"] = (qint64)stats.maxPacerQueuedFrames;
+    decoder["memory"] = memory;
+
+    QMutexLocker locker(&m_Lock);
+    m_VideoDecoders.append(decoder);
+
+    // Input is sent to the host no matter which decoder is running
+    m_InputEvents += stats.inputEvents;
+    m_TotalInputLatencyUs += stats.totalInputLatencyUs;
+    m_MaxInputLatencyUs = qMax(m_MaxInputLatencyUs, stats.maxInputLatencyUs);
+}
+
+void SessionReport::addBitrateSample(double averageMbps, double peakMbps, unsigned int windowSeconds)
+{
+    uint64_t now = LiGetMicroseconds();
+
+    QMutexLocker locker(&m_Lock);
+
+    if (m_LastBitrateSampleUs != 0 && now - m_LastBitrateSampleUs < windowSeconds * 1000000ULL) {
+        return;
+    }
+    m_LastBitrateSampleUs = now;
+    m_BitrateWindowSeconds = windowSeconds;
+
+    // Each sample covers the window before it
+    m_BitrateSamples.append(QJsonArray { (qint64)((now - m_StartUs) / 1000), averageMbps, peakMbps });
+    m_TotalBitrateMbps += averageMbps;
+    m_PeakBitrateMbps = qMax(m_PeakBitrateMbps, peakMbps);
+}
+
+void SessionReport::addAudioUnderruns(uint32_t underruns)
+{
+    QMutexLocker locker(&m_Lock);
+    m_HaveAudioUnderruns = true;
+    m_AudioUnderruns += underruns;
+}
+
+void SessionReport::setStreamConfig(const STREAM_CONFIGURATION& config)
+{
+    QMutexLocker locker(&m_Lock);
+    m_Stream["width"] = config.width;
+    m_Stream["height"] = config.height;
+    m_Stream["fps"] = config.fps;
+    m_Stream["bitrate_kbps"] = config.bitrate;
+    m_Stream["supported_video_formats"] = config.supportedVideoFormats;
+}
+
+void SessionReport::setLaunchTimeline(const QJsonObject& timeline)
+{
+    QMutexLocker locker(&m_Lock);
+    m_LaunchTimeline = timeline;
+}
+
+void SessionReport::setAudioStats(uint32_t concealedFrames, uint32_t fecFrames)
+{
+    QMutexLocker locker(&m_Lock);
+    m_AudioConcealedFrames = concealedFrames;
+    m_AudioFecFrames = fecFrames;
+}
+
+void SessionReport::setTermination(bool unexpected)
+{
+    QMutexLocker locker(&m_Lock);
+    m_UnexpectedTermination = unexpected;
+}
+
+void SessionReport::setOverlayPeakBytes(uint64_t bytes)
+{
+    QMutexLocker locker(&m_Lock);
+    m_OverlayPeakBytes = bytes;
+}
+
+void SessionReport::write()
+{
+    if (!m_Enabled) {
+        return;
+    }
+
+    QJsonObject report;
+
+    {
+        QMutexLocker locker(&m_Lock);
+
+        report["version"] = SESSION_REPORT_VERSION;
+        report["start_time"] = m_StartTime.toUTC().toString(Qt::ISODate);
+        report["duration_ms"] = (qint64)((LiGetMicroseconds() - m_StartUs) / 1000);
+        report["unexpected_termination"] = m_UnexpectedTermination;
+        report["stream"] = m_Stream;
+        report["launch_timeline"] = m_LaunchTimeline;
+        report["decoder_probes"] = m_DecoderProbes;
+        report["video"] = m_VideoDecoders;
+
+        QJsonObject bitrate;
+        bitrate["window_seconds"] = (qint64)m_BitrateWindowSeconds;
+        bitrate["average_mbps"] = m_BitrateSamples.isEmpty() ? 0 : m_TotalBitrateMbps / m_BitrateSamples.size();
+        bitrate["peak_mbps"] = m_PeakBitrateMbps;
+        bitrate["samples"] = m_BitrateSamples; // [ms since session start, average Mbps, peak Mbps]
+        report["bitrate"] = bitrate;
+
+        QJsonObject audio;
+        if (m_HaveAudioUnderruns) {
+            audio["underruns"] = (qint64)m_AudioUnderruns;
+        }
+        audio["concealed_frames"] = (qint64)m_AudioConcealedFrames;
+        audio["fec_frames"] = (qint64)m_AudioFecFrames;
+        report["audio"] = audio;
+
+        QJsonObject input;
+        input["events"] = (qint64)m_InputEvents;
+        input["avg_latency_ms"] = average(m_TotalInputLatencyUs, m_InputEvents) / 1000.0;
+        input["max_latency_ms"] = m_MaxInputLatencyUs / 1000.0;
+        report["input"] = input;
+
+        QJsonObject memory;
+        memory["overlay_peak_bytes"] = (qint64)m_OverlayPeakBytes;
+        uint64_t peakRssKb = StreamUtils::getPeakResidentMemoryKb();
+        if (peakRssKb != 0) {
+            memory["process_peak_rss_bytes"] = (qint64)(peakRssKb * 1024);
+        }
+        report["memory"] = memory;
+    }
+
+    QString path = QDir(Path::getLogDir()).filePath(QString("moonlight_session_%1.json")
+                                                    .arg(m_StartTime.toString("yyyyMMdd_hhmmss_zzz")));
+    QFile file(path);
+    if (!file.open(QIODevice::WriteOnly)) {
+        SDL_LogError(SDL_LOG_CATEGORY_APPLICATION,
+                     "Unable to open session report %s: %s",
+                     path.toUtf8().constData(),
+                     file.errorString().toUtf8().constData());
+        return;
+    }
+
+    file.write(QJsonDocument(report).toJson());
+
+    SDL_LogInfo(SDL_LOG_CATEGORY_APPLICATION,
+                "Wrote session report to %s",
+                path.toUtf8().constData());
+}
@@ -0,0 +1,79 @@
+#pragma once
+
+#include "video/decoder.h"
+
+#include <QDateTime>
+#include <QJsonArray>
+#include <QJsonObject>
+#include <QMutex>
+
+// Gathers the decoder and renderer choices, decoder probes, launch timeline,
+// video stats, bitrate profile, audio health and memory peaks of a session,
+// and writes them to the log directory as one JSON document once the session
+// has been torn down. This is what fleet monitoring should ingest instead of
+// scraping the global video stats out of the log.
+//
+// Set ML_SESSION_REPORT=0 to disable it.
+class SessionReport
+{
+public:
+    SessionReport();
+
+    // Called once per decoder probe, possibly from the probe threads
+    void addDecoderProbe(int videoFormat, int width, int height, int frameRate,
+                         const char* result, uint64_t durationUs);
+
+    // Called as each streaming decoder is destroyed with its final global stats
+    void addVideoDecoder(const char* decoderName,
+                         const char* frontendRendererName,
+                         const char* backendRendererName,
+                         bool hardwareAccelerated,
+                         const VIDEO_STATS& stats,
+                         uint64_t decoderPoolBytes,
+                         uint64_t decodedFrameBytes);
+
+    // Called on the decoder thread with each stats window. Only one sample
+    // is kept per BandwidthTracker window, so the profile stays small.
+    void addBitrateSample(double averageMbps, double peakMbps, unsigned int windowSeconds);
+
+    // Called as each audio renderer is destroyed
+    void addAudioUnderruns(uint32_t underruns);
+
+    // The rest are called during teardown, before write()
+    void setStreamConfig(const STREAM_CONFIGURATION& config);
+
+    void setLaunchTimeline(const QJsonObject& timeline);
+
+    void setAudioStats(uint32_t concealedFrames, uint32_t fecFrames);
+
+    void setTermination(bool unexpected);
+
+    void setOverlayPeakBytes(uint64_t bytes);
+
+    // Writes moonlight_session_<start time>.json to the log directory
+    void write();
+
+private:
+    QMutex m_Lock;
+    bool m_Enabled;
+    QDateTime m_StartTime;
+    uint64_t m_StartUs;
+    QJsonObject m_Stream;
+    QJsonObject m_LaunchTimeline;
+    QJsonArray m_DecoderProbes;
+    QJsonArray m_VideoDecoders;
+    QJsonArray m_BitrateSamples;
+    uint64_t m_LastBitrateSampleUs;
+    unsigned int m_BitrateWindowSeconds;
+    double m_TotalBitrateMbps;
+    double m_PeakBitrateMbps;
+    uint32_t m_InputEvents;
+    uint64_t m_TotalInputLatencyUs;
+    uint32_t m_MaxInputLatencyUs;
+    bool m_HaveAudioUnderruns;
+    uint32_t m_AudioUnderruns;
+    uint32_t m_AudioConcealedFrames;
+    uint32_t m_AudioFecFrames;
+    bool m_UnexpectedTermination;
+    uint64_t m_OverlayPeakBytes;
+};
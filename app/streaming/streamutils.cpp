@@ -2,6 +2,11 @@
 
 #include <Qt>
 #include <QDir>
+#include <QSettings>
+#include <QSysInfo>
+
+#include <openssl/crypto.h>
+#include <openssl/evp.h>
 
 #ifdef Q_OS_DARWIN
 #include <ApplicationServices/ApplicationServices.h>
@@ -9,6 +14,16 @@
 
 #ifdef Q_OS_WINDOWS
 #include <Windows.h>
+#include <avrt.h>
+#include <psapi.h>
+#endif
+
+#ifdef Q_OS_DARWIN
+#include <mach/mach.h>
+#include <mach/mach_time.h>
+#include <mach/thread_policy.h>
+#include <pthread.h>
+#include <pthread/qos.h>
 #endif
 
 #ifdef Q_OS_UNIX
@@ -18,6 +33,17 @@
 #include <SDL_syswm.h>
 #endif
 
+#if defined(Q_OS_LINUX) && defined(HAVE_FFMPEG)
+#include "video/softwaredecodeprofile.h"
+
+#include <cerrno>
+#endif
+
+#ifdef Q_OS_UNIX
+#include <time.h>
+#include <sys/resource.h>
+#endif
+
 #ifdef Q_OS_LINUX
 #include <sys/auxv.h>
 
@@ -72,6 +98,11 @@ static int __riscv_hwprobe(struct riscv_hwprobe *pairs, size_t pair_count,
 #include <sys/auxv.h>
 #endif
 
+#ifdef Q_OS_LINUX
+#include <sched.h>
+#include <sys/syscall.h>
+#endif
+
 Uint32 StreamUtils::getPlatformWindowFlags()
 {
 #if defined(Q_OS_DARWIN)
@@ -213,6 +244,111 @@ bool StreamUtils::hasFastAes()
 #endif
 }
 
+// Typical size of the encrypted payload of a video packet
+#define AES_BENCHMARK_PACKET_SIZE 1392
+#define AES_BENCHMARK_PACKET_COUNT 64
+#define AES_BENCHMARK_DURATION_MS 10
+
+static double benchmarkAes(bool gcm)
+{
+    unsigned char key[16] = {};
+    unsigned char iv[16] = {};
+    unsigned char tag[16];
+    unsigned char input[AES_BENCHMARK_PACKET_SIZE] = {};
+    unsigned char output[AES_BENCHMARK_PACKET_SIZE + 16];
+    int outLen;
+
+    EVP_CIPHER_CTX* ctx = EVP_CIPHER_CTX_new();
+    if (ctx == nullptr) {
+        return 0;
+    }
+
+    // Like the streaming code, we set up the key once and reinitialize each packet's IV
+    bool ok = gcm ?
+                  EVP_EncryptInit_ex(ctx, EVP_aes_128_gcm(), nullptr, key, nullptr) == 1 :
+                  EVP_DecryptInit_ex(ctx, EVP_aes_128_cbc(), nullptr, key, iv) == 1;
+    if (ok && !gcm) {
+        EVP_CIPHER_CTX_set_padding(ctx, 0);
+    }
+
+    uint64_t bytes = 0;
+    uint64_t startTime = SDL_GetPerformanceCounter();
+    uint64_t endTime = startTime + SDL_GetPerformanceFrequency() * AES_BENCHMARK_DURATION_MS / 1000;
+    uint64_t now = startTime;
+    while (ok && now < endTime) {
+        for (int i = 0; ok && i < AES_BENCHMARK_PACKET_COUNT; i++) {
+            iv[0] = (unsigned char)i;
+            if (gcm) {
+                ok = EVP_EncryptInit_ex(ctx, nullptr, nullptr, nullptr, iv) == 1 &&
+                     EVP_EncryptUpdate(ctx, output, &outLen, input, sizeof(input)) == 1 &&
+                     EVP_EncryptFinal_ex(ctx, output + outLen, &outLen) == 1 &&
+                     EVP_CIPHER_CTX_ctrl(ctx, EVP_CTRL_GCM_GET_TAG, sizeof(tag), tag) == 1;
+            }
+            else {
+                ok = EVP_DecryptInit_ex(ctx, nullptr, nullptr, nullptr, iv) == 1 &&
+                     EVP_DecryptUpdate(ctx, output, &outLen, input, sizeof(input)) == 1 &&
+                     EVP_DecryptFinal_ex(ctx, output + outLen, &outLen) == 1;
+            }
+            bytes += sizeof(input);
+        }
+
+        now = SDL_GetPerformanceCounter();
+    }
+
+    EVP_CIPHER_CTX_free(ctx);
+
+    if (!ok || now == startTime) {
+        return 0;
+    }
+
+    return (bytes * 8 / 1000000.0) / ((double)(now - startTime) / SDL_GetPerformanceFrequency());
+}
+
+bool StreamUtils::getAesThroughput(double* gcmMbps, double* cbcMbps)
+{
+    static double s_GcmMbps = -1;
+    static double s_CbcMbps = -1;
+
+    if (qgetenv("ML_AES_BENCHMARK") == "0") {
+        return false;
+    }
+
+    if (s_GcmMbps < 0) {
+        // Rerun the benchmark if the CPU or OpenSSL might have changed
+        QString fingerprint = QString("%1:%2:%3")
+                                  .arg(QSysInfo::currentCpuArchitecture())
+                                  .arg(SDL_GetCPUCount())
+                                  .arg(OpenSSL_version_num(), 0, 16);
+
+        QSettings settings;
+        settings.beginGroup("aesbenchmark");
+        if (settings.value("fingerprint").toString() == fingerprint) {
+            s_GcmMbps = settings.value("gcm").toDouble();
+            s_CbcMbps = settings.value("cbc").toDouble();
+        }
+        else {
+            s_GcmMbps = benchmarkAes(true);
+            s_CbcMbps = benchmarkAes(false);
+
+            SDL_LogInfo(SDL_LOG_CATEGORY_APPLICATION,
+                        "AES throughput: %.0f Mbps (GCM), %.0f Mbps (CBC)",
+                        s_GcmMbps,
+                        s_CbcMbps);
+
+            if (s_GcmMbps > 0 && s_CbcMbps > 0) {
+                settings.setValue("fingerprint", fingerprint);
+                settings.setValue("gcm", s_GcmMbps);
+                settings.setValue("cbc", s_CbcMbps);
+            }
+        }
+        settings.endGroup();
+    }
+    *gcmMbps = s_GcmMbps;
+    *cbcMbps = s_CbcMbps;
+
+    return *gcmMbps > 0 && *cbcMbps > 0;
+}
+
 bool StreamUtils::getNativeDesktopMode(int displayIndex, SDL_DisplayMode* mode, SDL_Rect* safeArea)
 {
 #ifdef Q_OS_DARWIN
@@ -429,3 +565,259 @@ void StreamUtils::exitAsyncLoggingMode()
 {
     g_AsyncLoggingEnabled.deref();
 }
+
+bool StreamUtils::enterRealtimeScheduling(RealtimeThreadClass threadClass, uint32_t periodUs, PREALTIME_THREAD_STATE state)
+{
+    if (state != nullptr) {
+        state->realtime = false;
+        state->mmcssHandle = nullptr;
+    }
+
+    QByteArray mode = qgetenv("ML_REALTIME_THREADS").toLower();
+    if (mode == "0" || (threadClass != RTC_AUDIO && mode != "all")) {
+        return false;
+    }
+
+#if defined(Q_OS_WINDOWS)
+    Q_UNUSED(periodUs);
+
+    // MMCSS boosts the thread while it's busy and schedules it ahead of
+    // normal priority work, without the risk of starving the system.
+    DWORD taskIndex = 0;
+    HANDLE mmcssHandle = AvSetMmThreadCharacteristicsW(threadClass == RTC_AUDIO ? L"Pro Audio" : L"Games",
+                                                       &taskIndex);
+    if (mmcssHandle == nullptr) {
+        SDL_LogWarn(SDL_LOG_CATEGORY_APPLICATION,
+                    "AvSetMmThreadCharacteristics() failed: %d",
+                    GetLastError());
+        return false;
+    }
+
+    if (state != nullptr) {
+        state->mmcssHandle = mmcssHandle;
+    }
+#elif defined(Q_OS_DARWIN)
+    mach_timebase_info_data_t timebase;
+    mach_timebase_info(&timebase);
+
+    // The thread needs about half of each period, and the kernel rejects
+    // computation times outside of 50 us to 50 ms
+    uint64_t periodAbs = (uint64_t)periodUs * 1000 * timebase.denom / timebase.numer;
+    uint64_t computationUs = SDL_clamp(periodUs / 2, 50U, 50000U);
+
+    thread_time_constraint_policy_data_t policy;
+    policy.period = (uint32_t)periodAbs;
+    policy.computation = (uint32_t)(computationUs * 1000 * timebase.denom / timebase.numer);
+    policy.constraint = (uint32_t)periodAbs;
+    policy.preemptible = TRUE;
+
+    kern_return_t err = thread_policy_set(pthread_mach_thread_np(pthread_self()),
+                                          THREAD_TIME_CONSTRAINT_POLICY,
+                                          (thread_policy_t)&policy,
+                                          THREAD_TIME_CONSTRAINT_POLICY_COUNT);
+    if (err != KERN_SUCCESS) {
+        SDL_LogWarn(SDL_LOG_CATEGORY_APPLICATION,
+                    "thread_policy_set(THREAD_TIME_CONSTRAINT_POLICY) failed: %d",
+                    err);
+        return false;
+    }
+#elif defined(Q_OS_LINUX) && SDL_VERSION_ATLEAST(2, 0, 18)
+    Q_UNUSED(periodUs);
+
+    // SDL tries SCHED_FIFO directly, then falls back to asking rtkit
+    // over D-Bus, which also sets up RLIMIT_RTTIME so a runaway thread
+    // can't lock up the system.
+#if SDL_VERSION_ATLEAST(3, 0, 0)
+    if (!SDL_SetLinuxThreadPriorityAndPolicy(syscall(SYS_gettid), SDL_THREAD_PRIORITY_TIME_CRITICAL, SCHED_FIFO)) {
+#else
+    if (SDL_LinuxSetThreadPriorityAndPolicy(syscall(SYS_gettid), SDL_THREAD_PRIORITY_TIME_CRITICAL, SCHED_FIFO) < 0) {
+#endif
+        SDL_LogWarn(SDL_LOG_CATEGORY_APPLICATION,
+                    "Unable to enable SCHED_FIFO: %s",
+                    SDL_GetError());
+        return false;
+    }
+#else
+    Q_UNUSED(periodUs);
+    return false;
+#endif
+
+    if (state != nullptr) {
+        state->realtime = true;
+    }
+
+    SDL_LogInfo(SDL_LOG_CATEGORY_APPLICATION,
+                "Enabled real-time scheduling for %s thread (period: %u us)",
+                threadClass == RTC_AUDIO ? "audio" : "video",
+                periodUs);
+    return true;
+}
+
+void StreamUtils::exitRealtimeScheduling(PREALTIME_THREAD_STATE state)
+{
+    if (!state->realtime) {
+        return;
+    }
+
+#if defined(Q_OS_WINDOWS)
+    AvRevertMmThreadCharacteristics(state->mmcssHandle);
+#elif defined(Q_OS_DARWIN)
+    thread_standard_policy_data_t policy = {};
+    thread_policy_set(pthread_mach_thread_np(pthread_self()),
+                      THREAD_STANDARD_POLICY,
+                      (thread_policy_t)&policy,
+                      THREAD_STANDARD_POLICY_COUNT);
+#elif defined(Q_OS_LINUX) && SDL_VERSION_ATLEAST(2, 0, 18)
+#if SDL_VERSION_ATLEAST(3, 0, 0)
+    SDL_SetLinuxThreadPriorityAndPolicy(syscall(SYS_gettid), SDL_THREAD_PRIORITY_NORMAL, SCHED_OTHER);
+#else
+    SDL_LinuxSetThreadPriorityAndPolicy(syscall(SYS_gettid), SDL_THREAD_PRIORITY_NORMAL, SCHED_OTHER);
+#endif
+#endif
+
+    state->realtime = false;
+    state->mmcssHandle = nullptr;
+}
+
+void StreamUtils::placeCurrentThread(ThreadPlacementClass placementClass)
+{
+    if (qgetenv("ML_THREAD_PLACEMENT") != "1") {
+        return;
+    }
+
+    bool background = placementClass == TPC_BACKGROUND;
+
+#if defined(Q_OS_WINDOWS)
+#ifdef THREAD_POWER_THROTTLING_CURRENT_VERSION
+    // On Windows 11, EcoQoS threads are scheduled on the efficiency cores
+    // and opting a thread out of throttling keeps it on the performance cores.
+    THREAD_POWER_THROTTLING_STATE throttlingState = {};
+    throttlingState.Version = THREAD_POWER_THROTTLING_CURRENT_VERSION;
+    throttlingState.ControlMask = THREAD_POWER_THROTTLING_EXECUTION_SPEED;
+    throttlingState.StateMask = background ? THREAD_POWER_THROTTLING_EXECUTION_SPEED : 0;
+    if (!SetThreadInformation(GetCurrentThread(), ThreadPowerThrottling,
+                              &throttlingState, sizeof(throttlingState))) {
+        SDL_LogWarn(SDL_LOG_CATEGORY_APPLICATION,
+                    "SetThreadInformation(ThreadPowerThrottling) failed: %d",
+                    GetLastError());
+        return;
+    }
+#else
+    return;
+#endif
+#elif defined(Q_OS_DARWIN)
+    // Apple Silicon runs utility QoS work on the efficiency cores
+    int err = pthread_set_qos_class_self_np(background ? QOS_CLASS_UTILITY : QOS_CLASS_USER_INTERACTIVE, 0);
+    if (err != 0) {
+        SDL_LogWarn(SDL_LOG_CATEGORY_APPLICATION,
+                    "pthread_set_qos_class_self_np() failed: %d",
+                    err);
+        return;
+    }
+#elif defined(Q_OS_LINUX) && defined(HAVE_FFMPEG)
+    CPU_AFFINITY performanceCores;
+    if (!SoftwareDecodeProfile::getPerformanceCores(&performanceCores)) {
+        return;
+    }
+
+    cpu_set_t mask;
+    if (background) {
+        // The efficiency cores are the ones we're allowed to run on that aren't performance cores
+        cpu_set_t allowed;
+        if (sched_getaffinity(0, sizeof(allowed), &allowed) < 0) {
+            return;
+        }
+
+        CPU_XOR(&mask, &allowed, &performanceCores.mask);
+        CPU_AND(&mask, &mask, &allowed);
+        if (CPU_COUNT(&mask) == 0) {
+            return;
+        }
+    }
+    else {
+        mask = performanceCores.mask;
+    }
+
+    if (sched_setaffinity(0, sizeof(mask), &mask) < 0) {
+        SDL_LogWarn(SDL_LOG_CATEGORY_APPLICATION,
+                    "sched_setaffinity() failed: %d",
+                    errno);
+        return;
+    }
+#else
+    Q_UNUSED(background);
+    return;
+#endif
+
+    SDL_LogInfo(SDL_LOG_CATEGORY_APPLICATION,
+                "Placed %s thread on %s cores",
+                background ? "background" : "latency-critical",
+                background ? "efficiency" : "performance");
+}
+
+uint64_t StreamUtils::takeThreadCpuTimeUs()
+{
+    thread_local uint64_t lastCpuTimeUs = 0;
+    uint64_t cpuTimeUs;
+
+#if defined(Q_OS_WINDOWS)
+    FILETIME creationTime, exitTime, kernelTime, userTime;
+    if (!GetThreadTimes(GetCurrentThread(), &creationTime, &exitTime, &kernelTime, &userTime)) {
+        return 0;
+    }
+
+    // FILETIMEs are in 100 ns units
+    cpuTimeUs = ((((uint64_t)kernelTime.dwHighDateTime << 32) | kernelTime.dwLowDateTime) +
+                 (((uint64_t)userTime.dwHighDateTime << 32) | userTime.dwLowDateTime)) / 10;
+#elif defined(Q_OS_UNIX)
+    struct timespec ts;
+    if (clock_gettime(CLOCK_THREAD_CPUTIME_ID, &ts) < 0) {
+        return 0;
+    }
+
+    cpuTimeUs = (uint64_t)ts.tv_sec * 1000000 + ts.tv_nsec / 1000;
+#else
+    return 0;
+#endif
+
+    uint64_t elapsedUs = cpuTimeUs - lastCpuTimeUs;
+    lastCpuTimeUs = cpuTimeUs;
+    return elapsedUs;
+}
+
+uint64_t StreamUtils::getPeakResidentMemoryKb()
+{
+#if defined(Q_OS_WINDOWS)
+    PROCESS_MEMORY_COUNTERS counters;
+    if (!GetProcessMemoryInfo(GetCurrentProcess(), &counters, sizeof(counters))) {
+        return 0;
+    }
+
+    return counters.PeakWorkingSetSize / 1024;
+#elif defined(Q_OS_UNIX)
+    struct rusage usage;
+    if (getrusage(RUSAGE_SELF, &usage) < 0) {
+        return 0;
+    }
+
+#ifdef Q_OS_DARWIN
+    // Darwin reports this in bytes rather than KB
+    return (uint64_t)usage.ru_maxrss / 1024;
+#else
+    return (uint64_t)usage.ru_maxrss;
+#endif
+#else
+    return 0;
+#endif
+}
+
+int StreamUtils::getStatsSampleInterval()
+{
+#ifdef STEAM_LINK
+    static const bool lowPower = qgetenv("ML_LOW_POWER") != "0";
+#else
+    static const bool lowPower = qgetenv("ML_LOW_POWER") == "1";
+#endif
+
+    return lowPower ? LOW_POWER_STATS_SAMPLE_INTERVAL : 1;
+}
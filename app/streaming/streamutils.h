@@ -2,9 +2,29 @@
 
 #include "SDL_compat.h"
 
+// Detailed stats (latency histograms, renderer GPU timings and thread CPU time)
+// are sampled every Nth frame in the low-power profile. Each of them keeps its
+// own sample count or accumulates across frames, so averages remain correct.
+#define LOW_POWER_STATS_SAMPLE_INTERVAL 8
+
+typedef struct _REALTIME_THREAD_STATE {
+    bool realtime;
+    void* mmcssHandle;
+} REALTIME_THREAD_STATE, *PREALTIME_THREAD_STATE;
+
 class StreamUtils
 {
 public:
+    enum RealtimeThreadClass {
+        RTC_AUDIO,
+        RTC_VIDEO,
+    };
+
+    enum ThreadPlacementClass {
+        TPC_LATENCY_CRITICAL,
+        TPC_BACKGROUND,
+    };
+
     static
     Uint32 getPlatformWindowFlags();
 
@@ -26,6 +46,13 @@ public:
     static
     bool hasFastAes();
 
+    // Measures AES-128-GCM and AES-128-CBC throughput on video packet sized
+    // buffers, in megabits per second. The result is cached in QSettings
+    // until the CPU or OpenSSL version changes. Returns false if the
+    // benchmark is disabled with ML_AES_BENCHMARK=0 or fails.
+    static
+    bool getAesThroughput(double* gcmMbps, double* cbcMbps);
+
     static
     int getDrmFdForWindow(SDL_Window* window, bool* needsClose);
 
@@ -37,4 +64,39 @@ public:
 
     static
     void exitAsyncLoggingMode();
+
+    // Moves the calling thread to real-time scheduling: MMCSS on Windows,
+    // SCHED_FIFO (via rtkit if needed) on Linux, and a time constraint
+    // policy with the given period on macOS. periodUs is how often the
+    // thread wakes up to do work. Audio threads are promoted by default,
+    // and ML_REALTIME_THREADS=all|0 applies it to video threads too or
+    // disables it. Returns false if the thread was left unchanged.
+    // state may be null if the thread will exit without reverting.
+    static
+    bool enterRealtimeScheduling(RealtimeThreadClass threadClass, uint32_t periodUs, PREALTIME_THREAD_STATE state);
+
+    static
+    void exitRealtimeScheduling(PREALTIME_THREAD_STATE state);
+
+    // When ML_THREAD_PLACEMENT=1, keeps latency-critical threads on the
+    // performance cores and background threads on the efficiency cores of
+    // hybrid CPUs. Linux pins the thread's affinity, macOS sets its QoS
+    // class, and Windows clears or sets EcoQoS for it.
+    static
+    void placeCurrentThread(ThreadPlacementClass placementClass);
+
+    // Returns the CPU time used by the calling thread since its previous
+    // call (or since the thread started), in microseconds
+    static
+    uint64_t takeThreadCpuTimeUs();
+
+    // Returns the peak resident set size of the process in KB, or 0 if unknown
+    static
+    uint64_t getPeakResidentMemoryKb();
+
+    // Returns how often (in frames) detailed per-frame stats should be sampled.
+    // This is every frame unless the low-power profile is active (ML_LOW_POWER=1,
+    // or always on Steam Link), which leaves more CPU for network processing.
+    static
+    int getStatsSampleInterval();
 };
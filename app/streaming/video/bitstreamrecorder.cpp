@@ -0,0 +1,322 @@
+#include "bitstreamrecorder.h"
+#include "streaming/streamutils.h"
+
+// Encoded packets are small compared to decoded frames, so we can afford
+// to buffer a couple of seconds of video before giving up on the writer.
+#define MAX_QUEUED_RECORDER_PACKETS 240
+
+// All packets submitted to us are timestamped in the RTP 90 KHz timebase
+static const AVRational k_RtpTimeBase = { 1, 90000 };
+
+BitstreamRecorder::BitstreamRecorder()
+    : m_Recording(false),
+      m_HeaderWritten(false),
+      m_WaitingForKeyFrame(true),
+      m_FormatCtx(nullptr),
+      m_Stream(nullptr),
+      m_LastRtpTimestamp(0),
+      m_NextPts(0),
+      m_PacketCount(0),
+      m_DroppedPacketCount(0),
+      m_WriterThread(nullptr),
+      m_Stopping(false)
+{
+}
+
+BitstreamRecorder::~BitstreamRecorder()
+{
+    finalize();
+}
+
+bool BitstreamRecorder::initialize(const QString& outputPath, int videoFormat, int width, int height, int fps)
+{
+    QMutexLocker locker(&m_Mutex);
+    int err;
+
+    if (m_Recording) {
+        SDL_LogWarn(SDL_LOG_CATEGORY_APPLICATION,
+                    "BitstreamRecorder: Already recording");
+        return false;
+    }
+
+    m_OutputPath = outputPath;
+    m_HeaderWritten = false;
+    m_WaitingForKeyFrame = true;
+    m_NextPts = 0;
+    m_PacketCount = 0;
+    m_DroppedPacketCount = 0;
+
+    QByteArray pathStr = outputPath.toUtf8();
+
+    // Guess the container from the file extension, defaulting to Matroska
+    err = avformat_alloc_output_context2(&m_FormatCtx, nullptr, nullptr, pathStr.constData());
+    if (err < 0 || m_FormatCtx == nullptr) {
+        err = avformat_alloc_output_context2(&m_FormatCtx, nullptr, "matroska", pathStr.constData());
+        if (err < 0) {
+            SDL_LogError(SDL_LOG_CATEGORY_APPLICATION,
+                         "BitstreamRecorder: avformat_alloc_output_context2() failed: %d",
+                         err);
+            return false;
+        }
+    }
+
+    m_Stream = avformat_new_stream(m_FormatCtx, nullptr);
+    if (m_Stream == nullptr) {
+        SDL_LogError(SDL_LOG_CATEGORY_APPLICATION,
+                     "BitstreamRecorder: avformat_new_stream() failed");
+        cleanup();
+        return false;
+    }
+
+    m_Stream->time_base = k_RtpTimeBase;
+    m_Stream->avg_frame_rate = av_make_q(fps, 1);
+    m_Stream->codecpar->codec_type = AVMEDIA_TYPE_VIDEO;
+    m_Stream->codecpar->width = width;
+    m_Stream->codecpar->height = height;
+
+    if (videoFormat & VIDEO_FORMAT_MASK_H264) {
+        m_Stream->codecpar->codec_id = AV_CODEC_ID_H264;
+    }
+    else if (videoFormat & VIDEO_FORMAT_MASK_H265) {
+        m_Stream->codecpar->codec_id = AV_CODEC_ID_HEVC;
+    }
+    else if (videoFormat & VIDEO_FORMAT_MASK_AV1) {
+        m_Stream->codecpar->codec_id = AV_CODEC_ID_AV1;
+    }
+    else {
+        SDL_LogError(SDL_LOG_CATEGORY_APPLICATION,
+                     "BitstreamRecorder: Unsupported video format: %x",
+                     videoFormat);
+        cleanup();
+        return false;
+    }
+
+    if (!(m_FormatCtx->oformat->flags & AVFMT_NOFILE)) {
+        err = avio_open(&m_FormatCtx->pb, pathStr.constData(), AVIO_FLAG_WRITE);
+        if (err < 0) {
+            SDL_LogError(SDL_LOG_CATEGORY_APPLICATION,
+                         "BitstreamRecorder: Could not open output file: %s (error: %d)",
+                         pathStr.constData(),
+                         err);
+            cleanup();
+            return false;
+        }
+    }
+
+    m_Stopping = false;
+    m_WriterThread = SDL_CreateThread(BitstreamRecorder::writerThreadProc, "BitstreamRecorder", this);
+    if (m_WriterThread == nullptr) {
+        SDL_LogError(SDL_LOG_CATEGORY_APPLICATION,
+                     "BitstreamRecorder: Failed to create writer thread: %s",
+                     SDL_GetError());
+        cleanup();
+        return false;
+    }
+
+    m_Recording = true;
+
+    SDL_LogInfo(SDL_LOG_CATEGORY_APPLICATION,
+                "BitstreamRecorder: Started recording %s to %s (%dx%d @ %d fps)",
+                avcodec_get_name(m_Stream->codecpar->codec_id),
+                pathStr.constData(), width, height, fps);
+
+    return true;
+}
+
+bool BitstreamRecorder::submitPacket(const uint8_t* data, int length, int parameterSetLength,
+                                     bool keyFrame, uint32_t rtpTimestamp)
+{
+    if (!m_Recording) {
+        return false;
+    }
+
+    // We can only start (or resume after a drop) on a key frame
+    if (m_WaitingForKeyFrame && !keyFrame) {
+        m_DroppedPacketCount++;
+        return false;
+    }
+
+    m_PacketQueueLock.lock();
+    if (m_PacketQueue.size() >= MAX_QUEUED_RECORDER_PACKETS) {
+        m_PacketQueueLock.unlock();
+
+        // The remainder of the GOP is undecodable without this packet,
+        // so skip everything until the next key frame.
+        m_WaitingForKeyFrame = true;
+        m_DroppedPacketCount++;
+        return false;
+    }
+    m_PacketQueueLock.unlock();
+
+    AVPacket* packet = av_packet_alloc();
+    if (packet == nullptr || av_new_packet(packet, length) < 0) {
+        av_packet_free(&packet);
+        return false;
+    }
+
+    memcpy(packet->data, data, length);
+
+    if (keyFrame) {
+        packet->flags |= AV_PKT_FLAG_KEY;
+
+        // Pass the parameter sets along to the writer to build the container header.
+        // The writer only consumes them on the first key frame.
+        if (parameterSetLength > 0) {
+            uint8_t* extradata = av_packet_new_side_data(packet, AV_PKT_DATA_NEW_EXTRADATA, parameterSetLength);
+            if (extradata != nullptr) {
+                memcpy(extradata, data, parameterSetLength);
+            }
+        }
+    }
+
+    // Convert the 32-bit RTP timestamp into a monotonic 64-bit timestamp.
+    // The signed delta handles wraparound of the RTP clock.
+    if (m_PacketCount != 0 || !m_WaitingForKeyFrame) {
+        int32_t delta = (int32_t)(rtpTimestamp - m_LastRtpTimestamp);
+        m_NextPts += delta > 0 ? delta : 1;
+    }
+    m_LastRtpTimestamp = rtpTimestamp;
+
+    packet->pts = packet->dts = m_NextPts;
+    packet->stream_index = 0;
+
+    m_WaitingForKeyFrame = false;
+    m_PacketCount++;
+
+    m_PacketQueueLock.lock();
+    m_PacketQueue.enqueue(packet);
+    m_PacketQueueLock.unlock();
+
+    m_PacketQueueNotEmpty.wakeOne();
+    return true;
+}
+
+int BitstreamRecorder::writerThreadProc(void* context)
+{
+    BitstreamRecorder* me = reinterpret_cast<BitstreamRecorder*>(context);
+
+    SDL_SetThreadPriority(SDL_THREAD_PRIORITY_LOW);
+    StreamUtils::placeCurrentThread(StreamUtils::TPC_BACKGROUND);
+
+    for (;;) {
+        me->m_PacketQueueLock.lock();
+
+        while (!me->m_Stopping && me->m_PacketQueue.isEmpty()) {
+            me->m_PacketQueueNotEmpty.wait(&me->m_PacketQueueLock);
+        }
+
+        // Drain all remaining packets before exiting
+        if (me->m_PacketQueue.isEmpty()) {
+            SDL_assert(me->m_Stopping);
+            me->m_PacketQueueLock.unlock();
+            break;
+        }
+
+        AVPacket* packet = me->m_PacketQueue.dequeue();
+        me->m_PacketQueueLock.unlock();
+
+        me->writePacket(packet);
+        av_packet_free(&packet);
+    }
+
+    return 0;
+}
+
+bool BitstreamRecorder::writeHeader(const uint8_t* parameterSets, int length)
+{
+    int err;
+
+    if (parameterSets != nullptr && length > 0) {
+        m_Stream->codecpar->extradata = (uint8_t*)av_mallocz(length + AV_INPUT_BUFFER_PADDING_SIZE);
+        if (m_Stream->codecpar->extradata != nullptr) {
+            memcpy(m_Stream->codecpar->extradata, parameterSets, length);
+            m_Stream->codecpar->extradata_size = length;
+        }
+    }
+
+    err = avformat_write_header(m_FormatCtx, nullptr);
+    if (err < 0) {
+        char errorstring[512];
+        av_strerror(err, errorstring, sizeof(errorstring));
+        SDL_LogError(SDL_LOG_CATEGORY_APPLICATION,
+                     "BitstreamRecorder: avformat_write_header() failed: %s",
+                     errorstring);
+        return false;
+    }
+
+    m_HeaderWritten = true;
+    return true;
+}
+
+void BitstreamRecorder::writePacket(AVPacket* packet)
+{
+    if (!m_HeaderWritten) {
+        size_t extradataSize = 0;
+        uint8_t* extradata = av_packet_get_side_data(packet, AV_PKT_DATA_NEW_EXTRADATA, &extradataSize);
+        if (!writeHeader(extradata, (int)extradataSize)) {
+            return;
+        }
+    }
+
+    // The parameter sets are already in-band in the bitstream
+    av_packet_free_side_data(packet);
+
+    // The muxer may have chosen a different timebase in avformat_write_header()
+    av_packet_rescale_ts(packet, k_RtpTimeBase, m_Stream->time_base);
+
+    int err = av_write_frame(m_FormatCtx, packet);
+    if (err < 0) {
+        SDL_LogWarn(SDL_LOG_CATEGORY_APPLICATION,
+                    "BitstreamRecorder: av_write_frame() failed: %d",
+                    err);
+    }
+}
+
+void BitstreamRecorder::finalize()
+{
+    QMutexLocker locker(&m_Mutex);
+
+    if (!m_Recording) {
+        return;
+    }
+
+    m_Recording = false;
+
+    cleanup();
+
+    SDL_LogInfo(SDL_LOG_CATEGORY_APPLICATION,
+                "BitstreamRecorder: Stopped recording. Total packets: %lld, Dropped packets: %lld, Output: %s",
+                (long long)m_PacketCount, (long long)m_DroppedPacketCount,
+                m_OutputPath.toUtf8().constData());
+}
+
+void BitstreamRecorder::cleanup()
+{
+    // Let the writer thread finish any queued packets
+    if (m_WriterThread != nullptr) {
+        m_PacketQueueLock.lock();
+        m_Stopping = true;
+        m_PacketQueueLock.unlock();
+        m_PacketQueueNotEmpty.wakeAll();
+
+        SDL_WaitThread(m_WriterThread, nullptr);
+        m_WriterThread = nullptr;
+    }
+
+    SDL_assert(m_PacketQueue.isEmpty());
+
+    if (m_FormatCtx != nullptr) {
+        if (m_HeaderWritten) {
+            av_write_trailer(m_FormatCtx);
+            m_HeaderWritten = false;
+        }
+
+        if (!(m_FormatCtx->oformat->flags & AVFMT_NOFILE)) {
+            avio_closep(&m_FormatCtx->pb);
+        }
+
+        avformat_free_context(m_FormatCtx);
+        m_FormatCtx = nullptr;
+        m_Stream = nullptr;
+    }
+}
@@ -0,0 +1,69 @@
+#pragma once
+
+#include <QString>
+#include <QMutex>
+#include <QQueue>
+#include <QWaitCondition>
+
+#include <Limelight.h>
+#include "SDL_compat.h"
+
+extern "C" {
+#include <libavcodec/avcodec.h>
+#include <libavformat/avformat.h>
+}
+
+// Records the encoded video bitstream by muxing the reassembled
+// decode units directly into a container without re-encoding.
+class BitstreamRecorder {
+public:
+    BitstreamRecorder();
+    ~BitstreamRecorder();
+
+    // Initialize the recorder. The container is chosen based on the
+    // extension of outputPath (.mkv or .mp4).
+    bool initialize(const QString& outputPath, int videoFormat, int width, int height, int fps);
+
+    // Queue an Annex B access unit for muxing. The first parameterSetLength bytes
+    // of data contain the codec parameter sets (if any) for IDR frames. The caller
+    // retains ownership of data. Returns false if the packet was dropped.
+    bool submitPacket(const uint8_t* data, int length, int parameterSetLength,
+                      bool keyFrame, uint32_t rtpTimestamp);
+
+    // Drain any queued packets, then write the trailer and close the output file
+    void finalize();
+
+    bool isRecording() const { return m_Recording; }
+
+    QString getOutputPath() const { return m_OutputPath; }
+
+private:
+    static int writerThreadProc(void* context);
+
+    bool writeHeader(const uint8_t* parameterSets, int length);
+
+    void writePacket(AVPacket* packet);
+
+    void cleanup();
+
+    bool m_Recording;
+    bool m_HeaderWritten;
+    bool m_WaitingForKeyFrame;
+    QString m_OutputPath;
+
+    AVFormatContext* m_FormatCtx;
+    AVStream* m_Stream;
+
+    uint32_t m_LastRtpTimestamp;
+    int64_t m_NextPts;
+    int64_t m_PacketCount;
+    int64_t m_DroppedPacketCount;
+
+    QMutex m_Mutex;
+
+    QQueue<AVPacket*> m_PacketQueue;
+    QMutex m_PacketQueueLock;
+    QWaitCondition m_PacketQueueNotEmpty;
+    SDL_Thread* m_WriterThread;
+    bool m_Stopping;
+};
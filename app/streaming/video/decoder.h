@@ -3,9 +3,12 @@
 #include <Limelight.h>
 #include "SDL_compat.h"
 #include "settings/streamingpreferences.h"
+#include "latencyhistogram.h"
 
 #define SDL_CODE_FRAME_READY 0
 
+class Session;
+
 #define MAX_SLICES 4
 
 typedef struct _VIDEO_STATS {
@@ -15,6 +18,42 @@ typedef struct _VIDEO_STATS {
     uint32_t totalFrames;
     uint32_t networkDroppedFrames;
     uint32_t pacerDroppedFrames;
+    uint32_t recorderDroppedFrames;
+    uint32_t framePoolHits;
+    uint32_t framePoolMisses;
+    uint32_t totalDecoderQueueDepth;           // sum of frames in flight at each submission
+    uint32_t maxDecoderQueueDepth;
+    uint32_t decoderQueueDepthSamples;
+    uint32_t totalDecodeUnitQueueDepth;        // sum of decode units still waiting to be submitted at each submission
+    uint32_t maxDecodeUnitQueueDepth;
+    uint64_t totalDecodeUnitQueueAgeUs;        // high-res (1us), from reassembly until submission to the decoder
+    uint32_t maxDecodeUnitQueueAgeUs;
+    uint32_t decodeUnitQueueSamples;
+    uint32_t decodeBacklogTrims;               // times the queued backlog was skipped to resync on an IDR frame
+    uint32_t decodeBacklogTrimmedFrames;
+    uint32_t totalPresentQueueDepth;           // sum of presented frames not yet displayed after each render
+    uint32_t maxPresentQueueDepth;
+    uint32_t presentQueueDepthSamples;
+    uint32_t directScanoutFrames;              // sampled frames that bypassed the compositor
+    uint32_t scanoutSamples;                   // sampled frames where the renderer knew how they were displayed
+    uint32_t maxPacerQueuedFrames;             // frames waiting in the Pacer render and pacing queues
+    uint32_t pacerVsyncDrops;                  // pacing queue frames dropped at V-sync to catch up
+    uint32_t pacerRenderDrops;                 // render queue frames dropped after rendering to catch up
+    uint32_t pacerOverflowDrops;               // frames replaced by a newer one in a full Pacer queue
+#define PACER_QUEUE_DEPTH_BUCKETS 4
+    uint32_t pacingQueueDepths[PACER_QUEUE_DEPTH_BUCKETS]; // V-syncs finding 0, 1, 2 or 3+ frames in the pacing queue
+    uint32_t renderQueueDepths[PACER_QUEUE_DEPTH_BUCKETS]; // renders leaving 0, 1, 2 or 3+ frames in the render queue
+    uint64_t totalVsyncWaitTimeUs;             // high-res (1us), from decode until V-sync releases the frame for rendering
+    uint32_t vsyncWaitFrames;
+    uint32_t copiedFrames;                     // rendered frames the renderer had to copy out of the decoder pool
+    uint32_t textureCacheMisses;               // decoder surfaces the renderer had to map as new textures
+    uint32_t idrFrames;                        // IDR frames received, including the first one
+    uint64_t totalIdrBytes;
+    uint32_t maxIdrBytes;
+    uint32_t lossRecoveries;                   // losses followed by a cleanly decoded frame
+    uint32_t idrLossRecoveries;                // recoveries that waited for an IDR frame rather than using RFI
+    uint64_t totalLossRecoveryTimeUs;          // high-res (1us), from the last frame before the loss to the first clean frame
+    uint32_t maxLossRecoveryTimeUs;
     uint16_t minHostProcessingLatency;         // low-res from RTP
     uint16_t maxHostProcessingLatency;         // low-res from RTP
     uint32_t totalHostProcessingLatency;       // low-res from RTP
@@ -23,14 +62,44 @@ typedef struct _VIDEO_STATS {
     uint64_t totalDecodeTimeUs;                // high-res (1us)
     uint64_t totalPacerTimeUs;                 // high-res (1us)
     uint64_t totalRenderTimeUs;                // high-res (1us)
+    uint64_t totalEndToEndLatencyUs;           // high-res (1us), host capture to present, estimated by HostClock
+    uint32_t maxEndToEndLatencyUs;
+    uint32_t framesWithEndToEndLatency;
+    uint64_t totalPresentLatencyUs;            // high-res (1us), from renderer present feedback
+    uint32_t framesWithPresentLatency;
+    uint64_t totalGpuRenderTimeUs;             // high-res (1us), from renderer GPU timers
+    uint32_t framesWithGpuRenderTime;
+    uint64_t totalGpuScaleTimeUs;              // high-res (1us), upscaling part of totalGpuRenderTimeUs
+    uint64_t decoderThreadCpuTimeUs;           // high-res (1us), CPU time of the thread receiving decoded frames
+    uint64_t renderThreadCpuTimeUs;            // high-res (1us), CPU time of the thread rendering frames
+    uint64_t totalGpuUploadTimeUs;             // high-res (1us), from renderer GPU timers
+    uint64_t totalReadbackTimeUs;              // high-res (1us), hwframe readback on the decoder thread
+    uint32_t readbackFrames;
     uint32_t lastRtt;                          // low-res from enet (1ms)
     uint32_t lastRttVariance;                  // low-res from enet (1ms)
+    uint32_t audioLatencyMs;                   // low-res from the audio renderer (1ms)
+    uint32_t audioTargetLatencyMs;             // low-res from the audio renderer (1ms)
+    bool avOffsetValid;
+    int32_t avOffsetMs;                        // low-res from AvSyncMonitor (1ms), positive if video lags audio
+    uint32_t audioDelayMs;                     // low-res from AvSyncMonitor (1ms)
+    uint32_t audioConcealedFrames;             // total for the session
+    uint32_t audioFecFrames;                   // total for the session
+    uint32_t inputEvents;                      // input events sent to the host
+    uint64_t totalInputLatencyUs;              // OS receipt to send, high-res (1us) from evdev, low-res (1ms) from SDL
+    uint32_t maxInputLatencyUs;
+    uint32_t qualityFrames;                    // frames compared against the reference clip (ML_QUALITY_REFERENCE)
+    double totalPsnrDb;
+    double totalSsim;
     double totalFps;                           // high-res
     double receivedFps;                        // high-res
     double decodedFps;                         // high-res
     double renderedFps;                        // high-res
     double videoMegabitsPerSec;                // current video bitrate in Mbps, not including FEC overhead
     uint64_t measurementStartUs;               // microseconds
+    LATENCY_HISTOGRAM reassemblyTimeHistogram; // high-res (1us)
+    LATENCY_HISTOGRAM decodeTimeHistogram;     // high-res (1us)
+    LATENCY_HISTOGRAM pacerTimeHistogram;      // high-res (1us)
+    LATENCY_HISTOGRAM renderTimeHistogram;     // high-res (1us)
 } VIDEO_STATS, *PVIDEO_STATS;
 
 typedef struct _DECODER_PARAMETERS {
@@ -43,7 +112,12 @@ typedef struct _DECODER_PARAMETERS {
     int frameRate;
     bool enableVsync;
     bool enableFramePacing;
+    bool enableVrr;
     bool testOnly;
+
+    // The session that the decoder will stream for, or nullptr
+    // if the decoder is only being probed outside of a session
+    Session* session;
 } DECODER_PARAMETERS, *PDECODER_PARAMETERS;
 
 #define WINDOW_STATE_CHANGE_SIZE 0x01
@@ -76,4 +150,9 @@ public:
     virtual void renderFrameOnMainThread() = 0;
     virtual void setHdrMode(bool enabled) = 0;
     virtual bool notifyWindowChanged(PWINDOW_STATE_CHANGE_INFO info) = 0;
+
+    // Called on the main thread when the decoder asks to be reset. Returns true
+    // if it was able to recover while keeping its renderer, or false if it must
+    // be destroyed and recreated.
+    virtual bool reinitializeDecoder() = 0;
 };
@@ -0,0 +1,109 @@
+#include "decoderprobecache.h"
+
+#include <QSettings>
+
+#define SER_PROBECACHE "decoderprobecache"
+
+DecoderProbeCache::DecoderProbeCache(const AVCodec* decoder, IFFmpegRenderer* renderer,
+                                     int pass, PDECODER_PARAMETERS params)
+    : m_Enabled(qgetenv("DECODER_PROBE_CACHE") != "0")
+{
+    // Bucket resolutions by the common stream sizes, since decoders often
+    // have limits at these boundaries but rarely in between them.
+    int pixels = params->width * params->height;
+    int resolutionClass;
+    if (pixels <= 1280 * 720) {
+        resolutionClass = 720;
+    }
+    else if (pixels <= 1920 * 1080) {
+        resolutionClass = 1080;
+    }
+    else if (pixels <= 2560 * 1440) {
+        resolutionClass = 1440;
+    }
+    else if (pixels <= 3840 * 2160) {
+        resolutionClass = 2160;
+    }
+    else {
+        resolutionClass = 4320;
+    }
+
+    m_Key = QString("%1_%2_%3_%4_%5")
+                .arg(decoder->name)
+                .arg(renderer->getRendererName())
+                .arg(params->videoFormat, 0, 16)
+                .arg(resolutionClass)
+                .arg(pass);
+}
+
+bool DecoderProbeCache::getDriverFingerprint(IFFmpegRenderer* renderer, QString& fingerprint)
+{
+    uint32_t vendorId, deviceId;
+    uint64_t driverVersion;
+
+    if (!renderer->getDriverVersion(&vendorId, &deviceId, &driverVersion)) {
+        return false;
+    }
+
+    // Including the app version invalidates every result when Moonlight is updated
+    fingerprint = QString("%1:%2:%3:%4")
+                      .arg(vendorId, 0, 16)
+                      .arg(deviceId, 0, 16)
+                      .arg((qulonglong)driverVersion, 0, 16)
+                      .arg(VERSION_STR);
+    return true;
+}
+
+bool DecoderProbeCache::hasResult()
+{
+    if (!m_Enabled) {
+        return false;
+    }
+
+    QSettings settings;
+    settings.beginGroup(SER_PROBECACHE);
+    return settings.contains(m_Key);
+}
+
+bool DecoderProbeCache::isResultValid(IFFmpegRenderer* renderer)
+{
+    QString fingerprint;
+
+    if (!m_Enabled || !getDriverFingerprint(renderer, fingerprint)) {
+        return false;
+    }
+
+    QSettings settings;
+    settings.beginGroup(SER_PROBECACHE);
+    if (settings.value(m_Key).toString() == fingerprint) {
+        return true;
+    }
+
+    // Drop results from an old driver or Moonlight version
+    settings.remove(m_Key);
+    return false;
+}
+
+void DecoderProbeCache::storeResult(IFFmpegRenderer* renderer)
+{
+    QString fingerprint;
+
+    if (!m_Enabled || !getDriverFingerprint(renderer, fingerprint)) {
+        return;
+    }
+
+    QSettings settings;
+    settings.beginGroup(SER_PROBECACHE);
+    settings.setValue(m_Key, fingerprint);
+}
+
+void DecoderProbeCache::removeResult()
+{
+    if (!m_Enabled) {
+        return;
+    }
+
+    QSettings settings;
+    settings.beginGroup(SER_PROBECACHE);
+    settings.remove(m_Key);
+}
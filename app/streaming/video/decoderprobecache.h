@@ -0,0 +1,39 @@
+#pragma once
+
+#include <QString>
+
+#include "ffmpeg-renderers/renderer.h"
+
+// Remembers which renderers passed their test frame so later launches can skip
+// the test decode. Results are persisted in QSettings and apply only to the
+// same decoder, renderer, codec, resolution class, GPU driver, and Moonlight
+// version. Only renderers that implement getDriverVersion() are cached.
+//
+// Set DECODER_PROBE_CACHE=0 to ignore and stop updating the cache.
+class DecoderProbeCache {
+public:
+    DecoderProbeCache(const AVCodec* decoder, IFFmpegRenderer* renderer,
+                      int pass, PDECODER_PARAMETERS params);
+
+    // Returns true if a result exists for this configuration with any driver.
+    // This can be called before the renderer is initialized.
+    bool hasResult();
+
+    // Returns true if a result exists and matches the current driver.
+    // The renderer must be initialized.
+    bool isResultValid(IFFmpegRenderer* renderer);
+
+    // Records the test frame passing on the current driver.
+    // The renderer must be initialized.
+    void storeResult(IFFmpegRenderer* renderer);
+
+    void removeResult();
+
+    // Identifies the GPU, driver, and Moonlight version. The renderer must be initialized.
+    static bool getDriverFingerprint(IFFmpegRenderer* renderer, QString& fingerprint);
+
+private:
+
+    QString m_Key;
+    bool m_Enabled;
+};
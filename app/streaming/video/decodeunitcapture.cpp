@@ -0,0 +1,257 @@
+#include "decodeunitcapture.h"
+#include "streaming/streamutils.h"
+
+#include <QDataStream>
+
+#define CAPTURE_MAGIC 0x4D4C4455 // "MLDU"
+#define CAPTURE_VERSION 1
+
+// Decode units are copied as-is, so a couple of seconds of video is all
+// we can reasonably buffer if the disk can't keep up. Units dropped here
+// show up as frame losses when the capture is replayed.
+#define MAX_QUEUED_CAPTURE_UNITS 240
+
+DecodeUnitCapture::DecodeUnitCapture()
+    : m_Capturing(false),
+      m_UnitCount(0),
+      m_DroppedUnitCount(0),
+      m_WriteFailed(false),
+      m_WriterThread(nullptr),
+      m_Stopping(false)
+{
+}
+
+DecodeUnitCapture::~DecodeUnitCapture()
+{
+    finalize();
+}
+
+bool DecodeUnitCapture::initialize(const QString& outputPath, int videoFormat, int width, int height, int frameRate)
+{
+    QMutexLocker locker(&m_Mutex);
+
+    if (m_Capturing) {
+        SDL_LogWarn(SDL_LOG_CATEGORY_APPLICATION,
+                    "DecodeUnitCapture: Already capturing");
+        return false;
+    }
+
+    m_OutputPath = outputPath;
+    m_UnitCount = 0;
+    m_DroppedUnitCount = 0;
+    m_WriteFailed = false;
+
+    m_File.setFileName(outputPath);
+    if (!m_File.open(QIODevice::WriteOnly | QIODevice::Truncate)) {
+        SDL_LogError(SDL_LOG_CATEGORY_APPLICATION,
+                     "DecodeUnitCapture: Unable to open %s: %s",
+                     outputPath.toUtf8().constData(),
+                     m_File.errorString().toUtf8().constData());
+        return false;
+    }
+
+    QDataStream stream(&m_File);
+    stream.setVersion(QDataStream::Qt_5_0);
+    stream << (quint32)CAPTURE_MAGIC << (quint32)CAPTURE_VERSION
+           << (qint32)videoFormat << (qint32)width << (qint32)height << (qint32)frameRate;
+
+    m_Stopping = false;
+    m_WriterThread = SDL_CreateThread(DecodeUnitCapture::writerThreadProc, "DecodeUnitCapture", this);
+    if (m_WriterThread == nullptr) {
+        SDL_LogError(SDL_LOG_CATEGORY_APPLICATION,
+                     "DecodeUnitCapture: Failed to create writer thread: %s",
+                     SDL_GetError());
+        m_File.close();
+        return false;
+    }
+
+    m_Capturing = true;
+
+    SDL_LogInfo(SDL_LOG_CATEGORY_APPLICATION,
+                "DecodeUnitCapture: Capturing decode units to %s",
+                outputPath.toUtf8().constData());
+    return true;
+}
+
+void DecodeUnitCapture::submitDecodeUnit(PDECODE_UNIT du)
+{
+    if (!m_Capturing) {
+        return;
+    }
+
+    QByteArray record;
+    record.reserve(du->fullLength + 64);
+
+    QDataStream stream(&record, QIODevice::WriteOnly);
+    stream.setVersion(QDataStream::Qt_5_0);
+
+    int bufferCount = 0;
+    for (PLENTRY entry = du->bufferList; entry != nullptr; entry = entry->next) {
+        bufferCount++;
+    }
+
+    stream << (qint32)du->frameNumber << (qint32)du->frameType << (quint32)du->rtpTimestamp
+           << (quint16)du->frameHostProcessingLatency
+           << (quint64)du->receiveTimeUs << (quint64)du->enqueueTimeUs
+           << (qint32)bufferCount;
+    for (PLENTRY entry = du->bufferList; entry != nullptr; entry = entry->next) {
+        stream << (qint32)entry->bufferType;
+        stream.writeBytes(entry->data, (uint)entry->length);
+    }
+
+    m_RecordQueueLock.lock();
+    if (m_RecordQueue.size() >= MAX_QUEUED_CAPTURE_UNITS) {
+        m_RecordQueueLock.unlock();
+        m_DroppedUnitCount++;
+        return;
+    }
+    m_RecordQueue.enqueue(record);
+    m_RecordQueueLock.unlock();
+
+    m_RecordQueueNotEmpty.wakeOne();
+}
+
+int DecodeUnitCapture::writerThreadProc(void* context)
+{
+    DecodeUnitCapture* me = reinterpret_cast<DecodeUnitCapture*>(context);
+
+    SDL_SetThreadPriority(SDL_THREAD_PRIORITY_LOW);
+    StreamUtils::placeCurrentThread(StreamUtils::TPC_BACKGROUND);
+
+    for (;;) {
+        me->m_RecordQueueLock.lock();
+
+        while (!me->m_Stopping && me->m_RecordQueue.isEmpty()) {
+            me->m_RecordQueueNotEmpty.wait(&me->m_RecordQueueLock);
+        }
+
+        // Drain all remaining records before exiting
+        if (me->m_RecordQueue.isEmpty()) {
+            SDL_assert(me->m_Stopping);
+            me->m_RecordQueueLock.unlock();
+            break;
+        }
+
+        QByteArray record = me->m_RecordQueue.dequeue();
+        me->m_RecordQueueLock.unlock();
+
+        // Stop writing after a failure so the file still ends on a complete unit
+        if (me->m_WriteFailed) {
+            continue;
+        }
+        else if (me->m_File.write(record) != record.size()) {
+            SDL_LogError(SDL_LOG_CATEGORY_APPLICATION,
+                         "DecodeUnitCapture: Write failed: %s",
+                         me->m_File.errorString().toUtf8().constData());
+            me->m_WriteFailed = true;
+        }
+        else {
+            me->m_UnitCount++;
+        }
+    }
+
+    return 0;
+}
+
+void DecodeUnitCapture::finalize()
+{
+    QMutexLocker locker(&m_Mutex);
+
+    if (!m_Capturing) {
+        return;
+    }
+
+    m_Capturing = false;
+
+    cleanup();
+
+    SDL_LogInfo(SDL_LOG_CATEGORY_APPLICATION,
+                "DecodeUnitCapture: Stopped capturing. Total units: %lld, Dropped units: %lld, Output: %s",
+                (long long)m_UnitCount, (long long)m_DroppedUnitCount,
+                m_OutputPath.toUtf8().constData());
+}
+
+void DecodeUnitCapture::cleanup()
+{
+    // Let the writer thread finish any queued records
+    if (m_WriterThread != nullptr) {
+        m_RecordQueueLock.lock();
+        m_Stopping = true;
+        m_RecordQueueLock.unlock();
+        m_RecordQueueNotEmpty.wakeAll();
+
+        SDL_WaitThread(m_WriterThread, nullptr);
+        m_WriterThread = nullptr;
+    }
+
+    SDL_assert(m_RecordQueue.isEmpty());
+
+    m_File.close();
+}
+
+bool DecodeUnitCapture::load(const QString& path, DECODE_UNIT_CAPTURE_INFO* info, QVector<CapturedDecodeUnit>& units)
+{
+    QFile file(path);
+    if (!file.open(QIODevice::ReadOnly)) {
+        SDL_LogError(SDL_LOG_CATEGORY_APPLICATION,
+                     "DecodeUnitCapture: Unable to open %s: %s",
+                     path.toUtf8().constData(),
+                     file.errorString().toUtf8().constData());
+        return false;
+    }
+
+    QDataStream stream(&file);
+    stream.setVersion(QDataStream::Qt_5_0);
+
+    quint32 magic, version;
+    qint32 videoFormat, width, height, frameRate;
+    stream >> magic >> version >> videoFormat >> width >> height >> frameRate;
+    if (stream.status() != QDataStream::Ok || magic != CAPTURE_MAGIC || version != CAPTURE_VERSION) {
+        SDL_LogError(SDL_LOG_CATEGORY_APPLICATION,
+                     "DecodeUnitCapture: %s is not a decode unit capture",
+                     path.toUtf8().constData());
+        return false;
+    }
+
+    info->videoFormat = videoFormat;
+    info->width = width;
+    info->height = height;
+    info->frameRate = frameRate;
+
+    units.clear();
+    while (!stream.atEnd()) {
+        CapturedDecodeUnit unit;
+        qint32 frameNumber, frameType, bufferCount;
+        quint32 rtpTimestamp;
+        quint16 frameHostProcessingLatency;
+        quint64 receiveTimeUs, enqueueTimeUs;
+
+        stream >> frameNumber >> frameType >> rtpTimestamp >> frameHostProcessingLatency
+               >> receiveTimeUs >> enqueueTimeUs >> bufferCount;
+        for (int i = 0; i < bufferCount && stream.status() == QDataStream::Ok; i++) {
+            qint32 bufferType;
+            QByteArray data;
+            stream >> bufferType >> data;
+            unit.buffers.append(qMakePair((int)bufferType, data));
+        }
+
+        // A capture that was cut short still replays up to the last complete unit
+        if (stream.status() != QDataStream::Ok) {
+            SDL_LogWarn(SDL_LOG_CATEGORY_APPLICATION,
+                        "DecodeUnitCapture: %s is truncated after %d units",
+                        path.toUtf8().constData(),
+                        units.size());
+            break;
+        }
+
+        unit.frameNumber = frameNumber;
+        unit.frameType = frameType;
+        unit.rtpTimestamp = rtpTimestamp;
+        unit.frameHostProcessingLatency = frameHostProcessingLatency;
+        unit.receiveTimeUs = receiveTimeUs;
+        unit.enqueueTimeUs = enqueueTimeUs;
+        units.append(unit);
+    }
+
+    return !units.isEmpty();
+}
@@ -0,0 +1,75 @@
+#pragma once
+
+#include <QByteArray>
+#include <QFile>
+#include <QMutex>
+#include <QPair>
+#include <QQueue>
+#include <QString>
+#include <QVector>
+#include <QWaitCondition>
+
+#include <Limelight.h>
+#include "SDL_compat.h"
+
+typedef struct _DECODE_UNIT_CAPTURE_INFO {
+    int videoFormat;
+    int width;
+    int height;
+    int frameRate;
+} DECODE_UNIT_CAPTURE_INFO, *PDECODE_UNIT_CAPTURE_INFO;
+
+// A decode unit as it arrived from moonlight-common-c
+struct CapturedDecodeUnit {
+    int frameNumber;
+    int frameType;
+    uint32_t rtpTimestamp;
+    uint16_t frameHostProcessingLatency;
+    uint64_t receiveTimeUs;
+    uint64_t enqueueTimeUs;
+
+    // Buffer type and data of each entry in the buffer list
+    QVector<QPair<int, QByteArray>> buffers;
+};
+
+// Writes every decode unit of a stream to a file along with its arrival
+// timing, so the stream can be replayed through the decoder later without
+// a host or network ("moonlight benchmark-video --capture <file>").
+// Sessions capture to the file named by ML_DECODE_UNIT_CAPTURE.
+class DecodeUnitCapture {
+public:
+    DecodeUnitCapture();
+    ~DecodeUnitCapture();
+
+    bool initialize(const QString& outputPath, int videoFormat, int width, int height, int frameRate);
+
+    // Copies the decode unit into the write queue. Called on the thread
+    // that receives decode units from moonlight-common-c.
+    void submitDecodeUnit(PDECODE_UNIT du);
+
+    // Drain any queued decode units, then close the output file
+    void finalize();
+
+    // Reads a whole capture file. Returns false if it isn't a valid capture.
+    static bool load(const QString& path, DECODE_UNIT_CAPTURE_INFO* info, QVector<CapturedDecodeUnit>& units);
+
+private:
+    static int writerThreadProc(void* context);
+
+    void cleanup();
+
+    bool m_Capturing;
+    QString m_OutputPath;
+    QFile m_File;
+    int64_t m_UnitCount;
+    int64_t m_DroppedUnitCount;
+    bool m_WriteFailed;
+
+    QMutex m_Mutex;
+
+    QQueue<QByteArray> m_RecordQueue;
+    QMutex m_RecordQueueLock;
+    QWaitCondition m_RecordQueueNotEmpty;
+    SDL_Thread* m_WriterThread;
+    bool m_Stopping;
+};
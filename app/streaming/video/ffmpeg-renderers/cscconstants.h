@@ -0,0 +1,92 @@
+#pragma once
+
+// YUV to RGB conversion constants shared by all renderers that do their own
+// color conversion, so every backend produces numerically identical output.
+//
+// Matrices are stored column-major (Y, U, V columns), matching what our
+// D3D11, EGL and Metal shaders expect, and are premultiplied by the scale
+// required to expand the color range to full range.
+
+struct CscConstants {
+    float matrix[9];
+    float offsets[3];
+};
+
+namespace CscTable {
+
+// Standard full range color matrices
+constexpr double k_Bt601[9] = {
+    1.0, 1.0, 1.0,
+    0.0, -0.3441, 1.7720,
+    1.4020, -0.7141, 0.0,
+};
+constexpr double k_Bt709[9] = {
+    1.0, 1.0, 1.0,
+    0.0, -0.1873, 1.8556,
+    1.5748, -0.4681, 0.0,
+};
+constexpr double k_Bt2020[9] = {
+    1.0, 1.0, 1.0,
+    0.0, -0.1646, 1.8814,
+    1.4746, -0.5714, 0.0,
+};
+
+constexpr double channelMax(int bits) {
+    return (double)((1 << bits) - 1);
+}
+
+constexpr double yMin(bool fullRange, int bits) {
+    return fullRange ? 0 : (16 << (bits - 8));
+}
+
+constexpr double yScale(bool fullRange, int bits) {
+    return channelMax(bits) / ((fullRange ? channelMax(bits) : (235 << (bits - 8))) - yMin(fullRange, bits));
+}
+
+constexpr double uvScale(bool fullRange, int bits) {
+    return channelMax(bits) / ((fullRange ? channelMax(bits) : (240 << (bits - 8))) - yMin(fullRange, bits));
+}
+
+constexpr double uvOffset(int bits) {
+    return ((1 << bits) / 2) / channelMax(bits);
+}
+
+// Usable at runtime too, for bit depths that aren't in the table
+constexpr CscConstants make(const double (&m)[9], bool fullRange, int bits) {
+    return CscConstants {
+        {
+            (float)(m[0] * yScale(fullRange, bits)),
+            (float)(m[1] * yScale(fullRange, bits)),
+            (float)(m[2] * yScale(fullRange, bits)),
+            (float)(m[3] * uvScale(fullRange, bits)),
+            (float)(m[4] * uvScale(fullRange, bits)),
+            (float)(m[5] * uvScale(fullRange, bits)),
+            (float)(m[6] * uvScale(fullRange, bits)),
+            (float)(m[7] * uvScale(fullRange, bits)),
+            (float)(m[8] * uvScale(fullRange, bits)),
+        },
+        {
+            (float)(yMin(fullRange, bits) / channelMax(bits)),
+            (float)uvOffset(bits),
+            (float)uvOffset(bits),
+        }
+    };
+}
+
+// Indexed by [colorspace][full range][10-bit]
+constexpr CscConstants k_Constants[3][2][2] = {
+    {
+        { make(k_Bt601, false, 8), make(k_Bt601, false, 10) },
+        { make(k_Bt601, true, 8), make(k_Bt601, true, 10) },
+    },
+    {
+        { make(k_Bt709, false, 8), make(k_Bt709, false, 10) },
+        { make(k_Bt709, true, 8), make(k_Bt709, true, 10) },
+    },
+    {
+        { make(k_Bt2020, false, 8), make(k_Bt2020, false, 10) },
+        { make(k_Bt2020, true, 8), make(k_Bt2020, true, 10) },
+    },
+};
+
+}
@@ -2,6 +2,10 @@
 
 #include <SDL_opengl.h>
 
+#ifdef HAVE_LIBPLACEBO_VULKAN
+#include <unistd.h>
+#endif
+
 CUDARenderer::CUDARenderer()
     : IFFmpegRenderer(RendererType::CUDA),
       m_HwContext(nullptr)
@@ -65,6 +69,103 @@ int CUDARenderer::getDecoderCapabilities()
            CAPABILITY_REFERENCE_FRAME_INVALIDATION_AV1;
 }
 
+bool CUDARenderer::isGlInteropSupported()
+{
+    CudaFunctions* funcs = nullptr;
+    AVCUDADeviceContext* cudaContext = (AVCUDADeviceContext*)((AVHWDeviceContext*)m_HwContext->data)->hwctx;
+    bool supported = false;
+
+    cuda_load_functions(&funcs, nullptr);
+    if (funcs == nullptr) {
+        SDL_LogError(SDL_LOG_CATEGORY_APPLICATION, "Failed to initialize CUDA library");
+        return false;
+    }
+
+    // CUDA can only tell which devices a GL context is on while it's current
+    SDL_Window* previousWindow = SDL_GL_GetCurrentWindow();
+    SDL_GLContext previousContext = SDL_GL_GetCurrentContext();
+    SDL_Window* window = SDL_CreateWindow("", SDL_WINDOWPOS_UNDEFINED, SDL_WINDOWPOS_UNDEFINED, 1, 1,
+                                          SDL_WINDOW_HIDDEN | SDL_WINDOW_OPENGL);
+    if (window != nullptr) {
+        SDL_GLContext glContext = SDL_GL_CreateContext(window);
+        if (glContext != nullptr) {
+            if (funcs->cuCtxPushCurrent(cudaContext->cuda_ctx) == CUDA_SUCCESS) {
+                CUdevice cudaDevice;
+                CUdevice glDevices[8];
+                unsigned int glDeviceCount = 0;
+
+                if (funcs->cuCtxGetDevice(&cudaDevice) == CUDA_SUCCESS &&
+                        funcs->cuGLGetDevices(&glDeviceCount, glDevices, SDL_arraysize(glDevices), CU_GL_DEVICE_LIST_ALL) == CUDA_SUCCESS) {
+                    for (unsigned int i = 0; i < glDeviceCount; i++) {
+                        if (glDevices[i] == cudaDevice) {
+                            supported = true;
+                            break;
+                        }
+                    }
+                }
+
+                CUcontext dummy;
+                funcs->cuCtxPopCurrent(&dummy);
+            }
+
+            SDL_GL_MakeCurrent(previousWindow, previousContext);
+            SDL_GL_DeleteContext(glContext);
+        }
+
+        SDL_DestroyWindow(window);
+    }
+
+    cuda_free_functions(&funcs);
+
+    SDL_LogInfo(SDL_LOG_CATEGORY_APPLICATION,
+                "CUDA-GL interop is %s",
+                supported ? "supported" : "not supported");
+    return supported;
+}
+
+bool CUDARenderer::getDeviceUuid(uint8_t uuid[16])
+{
+    CudaFunctions* funcs = nullptr;
+    AVCUDADeviceContext* cudaContext = (AVCUDADeviceContext*)((AVHWDeviceContext*)m_HwContext->data)->hwctx;
+    CUdevice cudaDevice;
+    CUuuid cudaUuid;
+    int err;
+
+    cuda_load_functions(&funcs, nullptr);
+    if (funcs == nullptr) {
+        SDL_LogError(SDL_LOG_CATEGORY_APPLICATION, "Failed to initialize CUDA library");
+        return false;
+    }
+
+    err = funcs->cuCtxPushCurrent(cudaContext->cuda_ctx);
+    if (err != CUDA_SUCCESS) {
+        SDL_LogError(SDL_LOG_CATEGORY_APPLICATION, "cuCtxPushCurrent() failed: %d", err);
+        cuda_free_functions(&funcs);
+        return false;
+    }
+
+    err = funcs->cuCtxGetDevice(&cudaDevice);
+    if (err == CUDA_SUCCESS) {
+        err = funcs->cuDeviceGetUuid(&cudaUuid, cudaDevice);
+        if (err == CUDA_SUCCESS) {
+            memcpy(uuid, cudaUuid.bytes, sizeof(cudaUuid.bytes));
+        }
+        else {
+            SDL_LogError(SDL_LOG_CATEGORY_APPLICATION, "cuDeviceGetUuid() failed: %d", err);
+        }
+    }
+    else {
+        SDL_LogError(SDL_LOG_CATEGORY_APPLICATION, "cuCtxGetDevice() failed: %d", err);
+    }
+
+    {
+        CUcontext dummy;
+        funcs->cuCtxPopCurrent(&dummy);
+    }
+    cuda_free_functions(&funcs);
+    return err == CUDA_SUCCESS;
+}
+
 CUDAGLInteropHelper::CUDAGLInteropHelper(AVHWDeviceContext* context)
     : m_Funcs(nullptr),
       m_Context((AVCUDADeviceContext*)context->hwctx)
@@ -219,3 +320,327 @@ PopCtxExit:
     }
     return err == CUDA_SUCCESS;
 }
+
+#ifdef HAVE_LIBPLACEBO_VULKAN
+
+CUDAVkInteropHelper::CUDAVkInteropHelper(AVHWDeviceContext* context, pl_gpu gpu)
+    : m_Funcs(nullptr),
+      m_Context((AVCUDADeviceContext*)context->hwctx),
+      m_Gpu(gpu),
+      m_Semaphore(VK_NULL_HANDLE),
+      m_ExternalSemaphore(nullptr),
+      m_SemaphoreValue(0),
+      m_Width(0),
+      m_Height(0),
+      m_SwFormat(AV_PIX_FMT_NONE)
+{
+    memset(m_Textures, 0, sizeof(m_Textures));
+    memset(m_ExternalMemory, 0, sizeof(m_ExternalMemory));
+    memset(m_MipmappedArrays, 0, sizeof(m_MipmappedArrays));
+    memset(m_Arrays, 0, sizeof(m_Arrays));
+
+    if (!(gpu->export_caps.tex & PL_HANDLE_FD) || !(gpu->export_caps.sync & PL_HANDLE_FD)) {
+        SDL_LogWarn(SDL_LOG_CATEGORY_APPLICATION,
+                    "Vulkan device can't export memory and semaphores for CUDA interop");
+        return;
+    }
+
+    // One-time init of CUDA library
+    cuda_load_functions(&m_Funcs, nullptr);
+    if (m_Funcs == nullptr) {
+        SDL_LogError(SDL_LOG_CATEGORY_APPLICATION, "Failed to initialize CUDA library");
+        return;
+    }
+}
+
+CUDAVkInteropHelper::~CUDAVkInteropHelper()
+{
+    if (m_Funcs != nullptr) {
+        if (m_Funcs->cuCtxPushCurrent(m_Context->cuda_ctx) == CUDA_SUCCESS) {
+            // Make sure CUDA is done with our textures before we free them
+            m_Funcs->cuStreamSynchronize(m_Context->stream);
+
+            destroyTextures();
+
+            if (m_ExternalSemaphore != nullptr) {
+                m_Funcs->cuDestroyExternalSemaphore(m_ExternalSemaphore);
+            }
+
+            CUcontext dummy;
+            m_Funcs->cuCtxPopCurrent(&dummy);
+        }
+
+        cuda_free_functions(&m_Funcs);
+    }
+
+    if (m_Semaphore != VK_NULL_HANDLE) {
+        pl_vulkan_sem_destroy(m_Gpu, &m_Semaphore);
+    }
+}
+
+// Must be called with the CUDA context pushed
+bool CUDAVkInteropHelper::createTextures(int width, int height, AVPixelFormat swFormat)
+{
+    const char* formatNames[NV12_PLANES];
+    CUarray_format arrayFormat;
+    int err;
+
+    switch (swFormat) {
+    case AV_PIX_FMT_NV12:
+        formatNames[0] = "r8";
+        formatNames[1] = "rg8";
+        arrayFormat = CU_AD_FORMAT_UNSIGNED_INT8;
+        break;
+    case AV_PIX_FMT_P010:
+        formatNames[0] = "r16";
+        formatNames[1] = "rg16";
+        arrayFormat = CU_AD_FORMAT_UNSIGNED_INT16;
+        break;
+    default:
+        SDL_LogError(SDL_LOG_CATEGORY_APPLICATION,
+                     "Unsupported CUDA frame format for Vulkan interop: %d",
+                     swFormat);
+        return false;
+    }
+
+    // The timeline semaphore is created once and reused across texture reallocations
+    if (m_Semaphore == VK_NULL_HANDLE) {
+        union pl_handle semaphoreHandle = {};
+        pl_vulkan_sem_params semParams = {};
+        semParams.type = VK_SEMAPHORE_TYPE_TIMELINE;
+        semParams.export_handle = PL_HANDLE_FD;
+        semParams.out_handle = &semaphoreHandle;
+        semParams.debug_tag = PL_DEBUG_TAG;
+        m_Semaphore = pl_vulkan_sem_create(m_Gpu, &semParams);
+        if (m_Semaphore == VK_NULL_HANDLE) {
+            SDL_LogError(SDL_LOG_CATEGORY_APPLICATION, "pl_vulkan_sem_create() failed");
+            return false;
+        }
+
+        // CUDA takes ownership of the FD if the import succeeds
+        CUDA_EXTERNAL_SEMAPHORE_HANDLE_DESC semDesc = {};
+        semDesc.type = CU_EXTERNAL_SEMAPHORE_HANDLE_TYPE_TIMELINE_SEMAPHORE_FD;
+        semDesc.handle.fd = semaphoreHandle.fd;
+        err = m_Funcs->cuImportExternalSemaphore(&m_ExternalSemaphore, &semDesc);
+        if (err != CUDA_SUCCESS) {
+            SDL_LogError(SDL_LOG_CATEGORY_APPLICATION, "cuImportExternalSemaphore() failed: %d", err);
+            close(semaphoreHandle.fd);
+            m_ExternalSemaphore = nullptr;
+            pl_vulkan_sem_destroy(m_Gpu, &m_Semaphore);
+            return false;
+        }
+
+        m_SemaphoreValue = 0;
+    }
+
+    for (int i = 0; i < NV12_PLANES; i++) {
+        pl_tex_params texParams = {};
+        texParams.w = width >> i;
+        texParams.h = height >> i;
+        texParams.format = pl_find_named_fmt(m_Gpu, formatNames[i]);
+        texParams.sampleable = true;
+        texParams.export_handle = PL_HANDLE_FD;
+        texParams.debug_tag = PL_DEBUG_TAG;
+        if (texParams.format == nullptr) {
+            SDL_LogError(SDL_LOG_CATEGORY_APPLICATION,
+                         "Vulkan device doesn't support texture format: %s",
+                         formatNames[i]);
+            goto Fail;
+        }
+
+        m_Textures[i] = pl_tex_create(m_Gpu, &texParams);
+        if (m_Textures[i] == nullptr) {
+            SDL_LogError(SDL_LOG_CATEGORY_APPLICATION, "pl_tex_create() failed");
+            goto Fail;
+        }
+
+        // libplacebo keeps its own copy of the FD, so give CUDA a duplicate to own
+        const pl_shared_mem& sharedMem = m_Textures[i]->shared_mem;
+        CUDA_EXTERNAL_MEMORY_HANDLE_DESC memDesc = {};
+        memDesc.type = CU_EXTERNAL_MEMORY_HANDLE_TYPE_OPAQUE_FD;
+        memDesc.handle.fd = dup(sharedMem.handle.fd);
+        memDesc.size = sharedMem.size;
+        if (sharedMem.offset == 0) {
+            // libplacebo gives exported images their own allocation
+            memDesc.flags = CUDA_EXTERNAL_MEMORY_DEDICATED;
+        }
+        err = m_Funcs->cuImportExternalMemory(&m_ExternalMemory[i], &memDesc);
+        if (err != CUDA_SUCCESS) {
+            SDL_LogError(SDL_LOG_CATEGORY_APPLICATION, "cuImportExternalMemory() failed: %d", err);
+            close(memDesc.handle.fd);
+            m_ExternalMemory[i] = nullptr;
+            goto Fail;
+        }
+
+        CUDA_EXTERNAL_MEMORY_MIPMAPPED_ARRAY_DESC arrayDesc = {};
+        arrayDesc.offset = sharedMem.offset;
+        arrayDesc.arrayDesc.Width = texParams.w;
+        arrayDesc.arrayDesc.Height = texParams.h;
+        arrayDesc.arrayDesc.Format = arrayFormat;
+        arrayDesc.arrayDesc.NumChannels = i + 1;
+        arrayDesc.numLevels = 1;
+        err = m_Funcs->cuExternalMemoryGetMappedMipmappedArray(&m_MipmappedArrays[i], m_ExternalMemory[i], &arrayDesc);
+        if (err != CUDA_SUCCESS) {
+            SDL_LogError(SDL_LOG_CATEGORY_APPLICATION, "cuExternalMemoryGetMappedMipmappedArray() failed: %d", err);
+            m_MipmappedArrays[i] = nullptr;
+            goto Fail;
+        }
+
+        err = m_Funcs->cuMipmappedArrayGetLevel(&m_Arrays[i], m_MipmappedArrays[i], 0);
+        if (err != CUDA_SUCCESS) {
+            SDL_LogError(SDL_LOG_CATEGORY_APPLICATION, "cuMipmappedArrayGetLevel() failed: %d", err);
+            m_Arrays[i] = nullptr;
+            goto Fail;
+        }
+    }
+
+    m_Width = width;
+    m_Height = height;
+    m_SwFormat = swFormat;
+    return true;
+
+Fail:
+    destroyTextures();
+    return false;
+}
+
+// Must be called with the CUDA context pushed
+void CUDAVkInteropHelper::destroyTextures()
+{
+    for (int i = 0; i < NV12_PLANES; i++) {
+        // m_Arrays[i] is owned by the mipmapped array
+        m_Arrays[i] = nullptr;
+
+        if (m_MipmappedArrays[i] != nullptr) {
+            m_Funcs->cuMipmappedArrayDestroy(m_MipmappedArrays[i]);
+            m_MipmappedArrays[i] = nullptr;
+        }
+
+        if (m_ExternalMemory[i] != nullptr) {
+            m_Funcs->cuDestroyExternalMemory(m_ExternalMemory[i]);
+            m_ExternalMemory[i] = nullptr;
+        }
+
+        pl_tex_destroy(m_Gpu, &m_Textures[i]);
+    }
+}
+
+bool CUDAVkInteropHelper::copyCudaFrameToTextures(AVFrame* frame, pl_frame* mappedFrame)
+{
+    auto framesContext = (AVHWFramesContext*)frame->hw_frames_ctx->data;
+    uint64_t releaseValue;
+    int heldTextures = 0;
+    int err;
+
+    if (m_Funcs == nullptr) {
+        // Already logged in constructor
+        return false;
+    }
+
+    // Push FFmpeg's CUDA context to use for our CUDA operations
+    err = m_Funcs->cuCtxPushCurrent(m_Context->cuda_ctx);
+    if (err != CUDA_SUCCESS) {
+        SDL_LogError(SDL_LOG_CATEGORY_APPLICATION, "cuCtxPushCurrent() failed: %d", err);
+        return false;
+    }
+
+    // (Re)create our textures if the frame format has changed
+    if (m_Textures[0] == nullptr ||
+            m_Width != frame->width || m_Height != frame->height ||
+            m_SwFormat != framesContext->sw_format) {
+        m_Funcs->cuStreamSynchronize(m_Context->stream);
+        destroyTextures();
+
+        if (!createTextures(frame->width, frame->height, framesContext->sw_format)) {
+            err = CUDA_ERROR_NOT_SUPPORTED;
+            goto PopCtxExit;
+        }
+    }
+
+    // Take the textures away from libplacebo. Each hold signals the semaphore
+    // once Vulkan has finished any outstanding work using that texture.
+    for (; heldTextures < NV12_PLANES; heldTextures++) {
+        pl_vulkan_hold_params holdParams = {};
+        holdParams.tex = m_Textures[heldTextures];
+        holdParams.layout = VK_IMAGE_LAYOUT_GENERAL;
+        holdParams.qf = VK_QUEUE_FAMILY_EXTERNAL;
+        holdParams.semaphore = { m_Semaphore, ++m_SemaphoreValue };
+        if (!pl_vulkan_hold_ex(m_Gpu, &holdParams)) {
+            SDL_LogError(SDL_LOG_CATEGORY_APPLICATION, "pl_vulkan_hold_ex() failed");
+            m_SemaphoreValue--;
+            err = CUDA_ERROR_UNKNOWN;
+            goto ReleaseExit;
+        }
+    }
+
+    {
+        CUDA_EXTERNAL_SEMAPHORE_WAIT_PARAMS waitParams = {};
+        waitParams.params.fence.value = m_SemaphoreValue;
+        err = m_Funcs->cuWaitExternalSemaphoresAsync(&m_ExternalSemaphore, &waitParams, 1, m_Context->stream);
+        if (err != CUDA_SUCCESS) {
+            SDL_LogError(SDL_LOG_CATEGORY_APPLICATION, "cuWaitExternalSemaphoresAsync() failed: %d", err);
+            goto ReleaseExit;
+        }
+    }
+
+    for (int i = 0; i < NV12_PLANES; i++) {
+        // Both planes are the same number of bytes wide
+        CUDA_MEMCPY2D cu2d = {
+            .srcMemoryType = CU_MEMORYTYPE_DEVICE,
+            .srcDevice = (CUdeviceptr)frame->data[i],
+            .srcPitch = (size_t)frame->linesize[i],
+            .dstMemoryType = CU_MEMORYTYPE_ARRAY,
+            .dstArray = m_Arrays[i],
+            .WidthInBytes = (size_t)frame->width * (m_SwFormat == AV_PIX_FMT_P010 ? 2 : 1),
+            .Height = (size_t)frame->height >> i
+        };
+        err = m_Funcs->cuMemcpy2DAsync(&cu2d, m_Context->stream);
+        if (err != CUDA_SUCCESS) {
+            SDL_LogError(SDL_LOG_CATEGORY_APPLICATION, "cuMemcpy2DAsync() failed: %d", err);
+            break;
+        }
+    }
+
+    {
+        // Vulkan will wait for this signal before sampling from the textures
+        CUDA_EXTERNAL_SEMAPHORE_SIGNAL_PARAMS signalParams = {};
+        signalParams.params.fence.value = m_SemaphoreValue + 1;
+        int signalErr = m_Funcs->cuSignalExternalSemaphoresAsync(&m_ExternalSemaphore, &signalParams, 1, m_Context->stream);
+        if (signalErr == CUDA_SUCCESS) {
+            m_SemaphoreValue++;
+        }
+        else {
+            // Fall back to waiting on the CPU so Vulkan never sees a partial copy
+            SDL_LogError(SDL_LOG_CATEGORY_APPLICATION, "cuSignalExternalSemaphoresAsync() failed: %d", signalErr);
+            m_Funcs->cuStreamSynchronize(m_Context->stream);
+        }
+    }
+
+ReleaseExit:
+    // Hand the textures back to libplacebo
+    releaseValue = m_SemaphoreValue;
+    for (int i = 0; i < heldTextures; i++) {
+        pl_vulkan_release_params releaseParams = {};
+        releaseParams.tex = m_Textures[i];
+        releaseParams.layout = VK_IMAGE_LAYOUT_GENERAL;
+        releaseParams.qf = VK_QUEUE_FAMILY_EXTERNAL;
+        releaseParams.semaphore = { m_Semaphore, releaseValue };
+        pl_vulkan_release_ex(m_Gpu, &releaseParams);
+    }
+
+    if (err == CUDA_SUCCESS) {
+        SDL_assert(mappedFrame->num_planes == NV12_PLANES);
+        for (int i = 0; i < NV12_PLANES; i++) {
+            mappedFrame->planes[i].texture = m_Textures[i];
+        }
+    }
+
+PopCtxExit:
+    {
+        CUcontext dummy;
+        m_Funcs->cuCtxPopCurrent(&dummy);
+    }
+    return err == CUDA_SUCCESS;
+}
+
+#endif
@@ -8,6 +8,10 @@ extern "C" {
     #include <libavutil/hwcontext_cuda.h>
 }
 
+#ifdef HAVE_LIBPLACEBO_VULKAN
+#include <libplacebo/vulkan.h>
+#endif
+
 class CUDARenderer : public IFFmpegRenderer {
 public:
     CUDARenderer();
@@ -19,6 +23,13 @@ public:
     virtual bool isDirectRenderingSupported() override;
     virtual int getDecoderCapabilities() override;
 
+    // Returns true if a GL context on this window system lives on our CUDA
+    // device, which lets SdlRenderer use CUDA-GL interop instead of read-back
+    bool isGlInteropSupported();
+
+    // Identifies our CUDA device for matching against Vulkan's deviceUUID
+    bool getDeviceUuid(uint8_t uuid[16]);
+
 private:
     AVBufferRef* m_HwContext;
 };
@@ -41,3 +52,41 @@ private:
     AVCUDADeviceContext* m_Context;
     CUgraphicsResource m_Resources[NV12_PLANES];
 };
+
+#ifdef HAVE_LIBPLACEBO_VULKAN
+// Helper class used by PlVkRenderer to import our CUDA frames into Vulkan.
+// CUDA copies each frame into textures exported by libplacebo, so the frame
+// never leaves the GPU. Only NV12 and P010 frames are supported.
+class CUDAVkInteropHelper {
+public:
+    CUDAVkInteropHelper(AVHWDeviceContext* context, pl_gpu gpu);
+    ~CUDAVkInteropHelper();
+
+    // Fills out the planes of a pl_frame (which must already be populated with
+    // the frame metadata) with textures containing the contents of the CUDA frame.
+    // The textures remain valid until the next call or until the helper is destroyed.
+    bool copyCudaFrameToTextures(AVFrame* frame, pl_frame* mappedFrame);
+
+private:
+    bool createTextures(int width, int height, AVPixelFormat swFormat);
+    void destroyTextures();
+
+    CudaFunctions* m_Funcs;
+    AVCUDADeviceContext* m_Context;
+    pl_gpu m_Gpu;
+
+    // Timeline semaphore shared between Vulkan and CUDA to hand off the textures
+    VkSemaphore m_Semaphore;
+    CUexternalSemaphore m_ExternalSemaphore;
+    uint64_t m_SemaphoreValue;
+
+    // Only valid if m_Textures[0] != nullptr
+    int m_Width;
+    int m_Height;
+    AVPixelFormat m_SwFormat;
+    pl_tex m_Textures[NV12_PLANES];
+    CUexternalMemory m_ExternalMemory[NV12_PLANES];
+    CUmipmappedArray m_MipmappedArrays[NV12_PLANES];
+    CUarray m_Arrays[NV12_PLANES];
+};
+#endif
@@ -12,6 +12,9 @@
 #include <VersionHelpers.h>
 
 #include <dwmapi.h>
+#include <setupapi.h>
+
+#include <vector>
 
 using Microsoft::WRL::ComPtr;
 
@@ -25,6 +28,9 @@ typedef struct _VERTEX
     float tu, tv;
 } VERTEX, *PVERTEX;
 
+static_assert(sizeof(VERTEX) == sizeof(Overlay::PERF_GRAPH_VERTEX),
+              "PERF_GRAPH_VERTEX must match our vertex layout");
+
 #define CSC_MATRIX_RAW_ELEMENT_COUNT 9
 #define CSC_MATRIX_PACKED_ELEMENT_COUNT 12
 #define OFFSETS_ELEMENT_COUNT 3
@@ -55,19 +61,168 @@ static const std::array<const char*, D3D11VARenderer::PixelShaders::_COUNT> k_Vi
     "d3d11_y410_pixel.fxc",
 };
 
+// Reads the EDID of a monitor from its device interface path, as returned
+// in DISPLAYCONFIG_TARGET_DEVICE_NAME::monitorDevicePath
+static bool readMonitorEdid(const WCHAR* monitorDevicePath, std::vector<BYTE>& edid)
+{
+    HDEVINFO devInfo = SetupDiCreateDeviceInfoList(nullptr, nullptr);
+    if (devInfo == INVALID_HANDLE_VALUE) {
+        return false;
+    }
+
+    bool ret = false;
+    SP_DEVICE_INTERFACE_DATA interfaceData = {};
+    interfaceData.cbSize = sizeof(interfaceData);
+    if (SetupDiOpenDeviceInterfaceW(devInfo, monitorDevicePath, 0, &interfaceData)) {
+        // This fails for lack of a detail buffer, but still fills in the device info
+        SP_DEVINFO_DATA devInfoData = {};
+        devInfoData.cbSize = sizeof(devInfoData);
+        SetupDiGetDeviceInterfaceDetailW(devInfo, &interfaceData, nullptr, 0, nullptr, &devInfoData);
+
+        HKEY key = SetupDiOpenDevRegKey(devInfo, &devInfoData, DICS_FLAG_GLOBAL, 0, DIREG_DEV, KEY_READ);
+        if (key != INVALID_HANDLE_VALUE) {
+            DWORD size = 0;
+            if (RegQueryValueExW(key, L"EDID", nullptr, nullptr, nullptr, &size) == ERROR_SUCCESS && size >= 128) {
+                edid.resize(size);
+                ret = RegQueryValueExW(key, L"EDID", nullptr, nullptr, edid.data(), &size) == ERROR_SUCCESS;
+                edid.resize(size);
+            }
+            RegCloseKey(key);
+        }
+    }
+
+    SetupDiDestroyDeviceInfoList(devInfo);
+    return ret;
+}
+
+// Checks an EDID for adaptive sync support the same way amdgpu does: either an
+// EDID 1.4 continuous frequency display with a usable vertical range, or an
+// AMD FreeSync vendor-specific data block in a CTA-861 extension.
+static bool isEdidVariableRefresh(const std::vector<BYTE>& edid)
+{
+    if (edid.size() < 128) {
+        return false;
+    }
+
+    // EDID 1.4 "continuous frequency" feature flag
+    if (edid[0x12] == 1 && edid[0x13] >= 4 && (edid[0x18] & 0x01)) {
+        for (int i = 0; i < 4; i++) {
+            const BYTE* desc = &edid[0x36 + i * 18];
+
+            // Display range limits descriptor
+            if (desc[0] == 0 && desc[1] == 0 && desc[2] == 0 && desc[3] == 0xFD) {
+                int minRate = desc[5] + ((desc[4] & 0x01) ? 255 : 0);
+                int maxRate = desc[6] + ((desc[4] & 0x02) ? 255 : 0);
+                if (maxRate - minRate > 10) {
+                    return true;
+                }
+            }
+        }
+    }
+
+    for (size_t ext = 128; ext + 128 <= edid.size(); ext += 128) {
+        const BYTE* block = &edid[ext];
+
+        // CTA-861 extension with data blocks between byte 4 and the DTD offset
+        if (block[0] != 0x02 || block[2] < 4) {
+            continue;
+        }
+
+        for (int i = 4; i < block[2] && i < 127; ) {
+            int tag = block[i] >> 5;
+            int length = block[i] & 0x1F;
+
+            // Vendor-specific data block with AMD's OUI
+            if (tag == 3 && length >= 5 && i + 5 < 128 &&
+                    block[i + 1] == 0x1A && block[i + 2] == 0x00 && block[i + 3] == 0x00) {
+                return true;
+            }
+
+            i += length + 1;
+        }
+    }
+
+    return false;
+}
+
+// Determines whether the monitor connected to a DXGI output reports adaptive
+// sync support. Outputs are matched to their monitor by GDI device name.
+static bool isOutputVariableRefresh(IDXGIOutput* output)
+{
+    DXGI_OUTPUT_DESC outputDesc;
+    if (FAILED(output->GetDesc(&outputDesc))) {
+        return false;
+    }
+
+    UINT32 pathCount, modeCount;
+    if (GetDisplayConfigBufferSizes(QDC_ONLY_ACTIVE_PATHS, &pathCount, &modeCount) != ERROR_SUCCESS) {
+        return false;
+    }
+
+    std::vector<DISPLAYCONFIG_PATH_INFO> paths(pathCount);
+    std::vector<DISPLAYCONFIG_MODE_INFO> modes(modeCount);
+    if (QueryDisplayConfig(QDC_ONLY_ACTIVE_PATHS, &pathCount, paths.data(), &modeCount, modes.data(), nullptr) != ERROR_SUCCESS) {
+        return false;
+    }
+
+    bool foundMonitor = false;
+    for (UINT32 i = 0; i < pathCount; i++) {
+        DISPLAYCONFIG_SOURCE_DEVICE_NAME sourceName = {};
+        sourceName.header.type = DISPLAYCONFIG_DEVICE_INFO_GET_SOURCE_NAME;
+        sourceName.header.size = sizeof(sourceName);
+        sourceName.header.adapterId = paths[i].sourceInfo.adapterId;
+        sourceName.header.id = paths[i].sourceInfo.id;
+        if (DisplayConfigGetDeviceInfo(&sourceName.header) != ERROR_SUCCESS ||
+                wcscmp(sourceName.viewGdiDeviceName, outputDesc.DeviceName) != 0) {
+            continue;
+        }
+
+        DISPLAYCONFIG_TARGET_DEVICE_NAME targetName = {};
+        targetName.header.type = DISPLAYCONFIG_DEVICE_INFO_GET_TARGET_NAME;
+        targetName.header.size = sizeof(targetName);
+        targetName.header.adapterId = paths[i].targetInfo.adapterId;
+        targetName.header.id = paths[i].targetInfo.id;
+        if (DisplayConfigGetDeviceInfo(&targetName.header) != ERROR_SUCCESS) {
+            continue;
+        }
+
+        // With mirrored displays, every monitor must be able to follow us
+        std::vector<BYTE> edid;
+        if (!readMonitorEdid(targetName.monitorDevicePath, edid) || !isEdidVariableRefresh(edid)) {
+            return false;
+        }
+
+        foundMonitor = true;
+    }
+
+    return foundMonitor;
+}
+
 D3D11VARenderer::D3D11VARenderer(int decoderSelectionPass)
     : IFFmpegRenderer(RendererType::D3D11VA),
       m_DecoderSelectionPass(decoderSelectionPass),
       m_DevicesWithFL11Support(0),
       m_DevicesWithCodecSupport(0),
+      m_AdapterVendorId(0),
+      m_AdapterDeviceId(0),
+      m_AdapterDriverVersion(0),
       m_LastColorTrc(AVCOL_TRC_UNSPECIFIED),
       m_AllowTearing(false),
+      m_UseVrr(false),
+      m_LastReportedPresentCount(0),
+      m_FrameLatencyWaitableObject(nullptr),
+      m_GpuTimerQueriesReady(false),
+      m_GpuTimerQueriesIssued(0),
+      m_GpuTimerQueriesRead(0),
       m_OverlayLock(0),
       m_HwDeviceContext(nullptr),
       m_HwFramesContext(nullptr)
 {
     m_ContextLock = SDL_CreateMutex();
 
+    SDL_zero(m_PresentHistory);
+    QueryPerformanceFrequency(&m_QpcFrequency);
+
     DwmEnableMMCSS(TRUE);
 }
 
@@ -88,8 +243,20 @@ D3D11VARenderer::~D3D11VARenderer()
         }
     }
 
+    m_CrossAdapterDecodeMutex.Reset();
+    m_CrossAdapterPresentMutex.Reset();
+    m_CrossAdapterTexture.Reset();
     m_VideoTexture.Reset();
 
+    for (auto& inputView : m_VideoProcessorInputViews) {
+        inputView.Reset();
+    }
+    m_VideoProcessorOutputView.Reset();
+    m_VideoProcessor.Reset();
+    m_VideoProcessorEnumerator.Reset();
+    m_VideoContext.Reset();
+    m_VideoDevice.Reset();
+
     for (auto& buffer : m_OverlayVertexBuffers) {
         buffer.Reset();
     }
@@ -104,7 +271,21 @@ D3D11VARenderer::~D3D11VARenderer()
 
     m_OverlayPixelShader.Reset();
 
+    m_PerfGraphVertexBuffer.Reset();
+    m_PerfGraphPaletteResourceView.Reset();
+
+    for (auto& query : m_GpuTimerQueries) {
+        query.disjoint.Reset();
+        query.start.Reset();
+        query.end.Reset();
+    }
+
     m_RenderTargetView.Reset();
+
+    if (m_FrameLatencyWaitableObject != nullptr) {
+        CloseHandle(m_FrameLatencyWaitableObject);
+    }
+    m_SwapChainMedia.Reset();
     m_SwapChain.Reset();
 
     av_buffer_unref(&m_HwFramesContext);
@@ -118,6 +299,14 @@ D3D11VARenderer::~D3D11VARenderer()
 
     m_Device.Reset();
     m_DeviceContext.Reset();
+
+    if (m_DecodeDeviceContext != nullptr) {
+        m_DecodeDeviceContext->ClearState();
+        m_DecodeDeviceContext->Flush();
+    }
+
+    m_DecodeDevice.Reset();
+    m_DecodeDeviceContext.Reset();
     m_Factory.Reset();
 }
 
@@ -222,6 +411,16 @@ bool D3D11VARenderer::createDeviceByAdapterIndex(int adapterIndex, bool* adapter
                     "Using D3D11VA_FORCE_BIND to override default bind/copy logic");
     }
 
+    // Bind the decoder output textures whenever the driver supports sampling
+    // from them, falling back to copying only if that fails. Unlike
+    // D3D11VA_FORCE_BIND=1, this is safe to use on any driver. We always do
+    // this for YUV 4:4:4, since the full resolution chroma makes each copy
+    // twice as expensive as 4:2:0 and our AYUV and Y410 shaders can sample
+    // the packed decoder output directly.
+    m_PreferBindDecoderOutputTextures = !m_BindDecoderOutputTextures && !ok &&
+                                        (qEnvironmentVariableIntValue("D3D11VA_PREFER_BIND") ||
+                                         (m_DecoderParams.videoFormat & VIDEO_FORMAT_MASK_YUV444));
+
     m_UseFenceHack = !!qEnvironmentVariableIntValue("D3D11VA_FORCE_FENCE", &ok);
     if (!ok) {
         // Old Intel GPUs (HD 4000) require a fence to properly synchronize
@@ -233,6 +432,28 @@ bool D3D11VARenderer::createDeviceByAdapterIndex(int adapterIndex, bool* adapter
                     "Using D3D11VA_FORCE_FENCE to override default fence workaround logic");
     }
 
+    // D3D11VA_VIDEO_PROCESSOR=1 moves color conversion and scaling into the
+    // fixed-function video processor, which may be cheaper than our pixel
+    // shaders on Intel iGPUs. It stays opt-in until it has been measured.
+    m_UseVideoProcessor = !!qEnvironmentVariableIntValue("D3D11VA_VIDEO_PROCESSOR", &ok);
+    if (!ok) {
+        m_UseVideoProcessor = false;
+
+        // Our pixel shaders only scale bilinearly, so use the driver's
+        // (usually multi-tap) video processor scaler for any other upscaler.
+        QByteArray upscaler = qgetenv("ML_UPSCALER");
+        if (!upscaler.isEmpty() && upscaler != "bilinear") {
+            SDL_LogInfo(SDL_LOG_CATEGORY_APPLICATION,
+                        "Using video processor scaling for upscaler: %s",
+                        upscaler.constData());
+            m_UseVideoProcessor = true;
+        }
+    }
+    else {
+        SDL_LogWarn(SDL_LOG_CATEGORY_APPLICATION,
+                    "Using D3D11VA_VIDEO_PROCESSOR to override default video processor logic");
+    }
+
     SDL_LogInfo(SDL_LOG_CATEGORY_APPLICATION,
                 "Decoder texture access: %s (fence: %s)",
                 m_BindDecoderOutputTextures ? "bind" : "copy",
@@ -268,6 +489,20 @@ bool D3D11VARenderer::createDeviceByAdapterIndex(int adapterIndex, bool* adapter
         m_DevicesWithCodecSupport++;
     }
 
+    {
+        m_AdapterVendorId = adapterDesc.VendorId;
+        m_AdapterDeviceId = adapterDesc.DeviceId;
+
+        // This returns the UMD version for any DXGI interface
+        LARGE_INTEGER umdVersion;
+        if (SUCCEEDED(adapter->CheckInterfaceSupport(__uuidof(IDXGIDevice), &umdVersion))) {
+            m_AdapterDriverVersion = umdVersion.QuadPart;
+        }
+        else {
+            m_AdapterDriverVersion = 0;
+        }
+    }
+
     success = true;
 
 Exit:
@@ -277,6 +512,301 @@ Exit:
     return success;
 }
 
+bool D3D11VARenderer::createCrossAdapterPresentDevice(int adapterIndex, bool forced)
+{
+    const D3D_FEATURE_LEVEL supportedFeatureLevels[] = { D3D_FEATURE_LEVEL_11_1, D3D_FEATURE_LEVEL_11_0 };
+    ComPtr<IDXGIAdapter1> adapter;
+    DXGI_ADAPTER_DESC1 adapterDesc;
+    ComPtr<ID3D11Device> device;
+    ComPtr<ID3D11DeviceContext> deviceContext;
+    ComPtr<ID3D11DeviceContext1> deviceContext1;
+    double copyTimeMs;
+    HRESULT hr;
+
+    SDL_assert(m_Device);
+    SDL_assert(!m_DecodeDevice);
+
+    hr = m_Factory->EnumAdapters1(adapterIndex, &adapter);
+    if (FAILED(hr)) {
+        SDL_LogError(SDL_LOG_CATEGORY_APPLICATION,
+                     "IDXGIFactory::EnumAdapters1() failed: %x",
+                     hr);
+        return false;
+    }
+
+    hr = adapter->GetDesc1(&adapterDesc);
+    if (FAILED(hr)) {
+        SDL_LogError(SDL_LOG_CATEGORY_APPLICATION,
+                     "IDXGIAdapter::GetDesc() failed: %x",
+                     hr);
+        return false;
+    }
+
+    if (adapterDesc.Flags & DXGI_ADAPTER_FLAG_SOFTWARE) {
+        return false;
+    }
+
+    // This device only renders and presents, so it doesn't need video support
+    hr = D3D11CreateDevice(adapter.Get(),
+                           D3D_DRIVER_TYPE_UNKNOWN,
+                           nullptr,
+                       #ifdef QT_DEBUG
+                           D3D11_CREATE_DEVICE_DEBUG,
+                       #else
+                           0,
+                       #endif
+                           supportedFeatureLevels,
+                           ARRAYSIZE(supportedFeatureLevels),
+                           D3D11_SDK_VERSION,
+                           &device,
+                           nullptr,
+                           &deviceContext);
+    if (FAILED(hr)) {
+        SDL_LogError(SDL_LOG_CATEGORY_APPLICATION,
+                     "D3D11CreateDevice() failed: %x",
+                     hr);
+        return false;
+    }
+
+    hr = deviceContext.As(&deviceContext1);
+    if (FAILED(hr)) {
+        SDL_LogError(SDL_LOG_CATEGORY_APPLICATION,
+                     "ID3D11DeviceContext::QueryInterface(ID3D11DeviceContext1) failed: %x",
+                     hr);
+        return false;
+    }
+
+    if (!measureCrossAdapterCopy(device.Get(), deviceContext1.Get(), &copyTimeMs)) {
+        SDL_LogWarn(SDL_LOG_CATEGORY_APPLICATION,
+                    "Unable to share video textures with GPU %d (%S)",
+                    adapterIndex,
+                    adapterDesc.Description);
+        return false;
+    }
+
+    // We can't measure the copy DXGI does when presenting from the decoding GPU,
+    // but it's at least a full-screen copy of our swapchain. If our copy won't
+    // fit within half a frame, we're not going to beat it.
+    double frameTimeMs = 1000.0 / m_DecoderParams.frameRate;
+    if (!forced && copyTimeMs > frameTimeMs / 2) {
+        SDL_LogInfo(SDL_LOG_CATEGORY_APPLICATION,
+                    "Cross-adapter copy to GPU %d takes %.2f ms. Presenting from the decoding GPU instead.",
+                    adapterIndex,
+                    copyTimeMs);
+        return false;
+    }
+
+    SDL_LogInfo(SDL_LOG_CATEGORY_APPLICATION,
+                "Presenting on GPU %d (%S) with %.2f ms cross-adapter copies",
+                adapterIndex,
+                adapterDesc.Description,
+                copyTimeMs);
+
+    // From here on, m_Device is the display GPU that we render and present with
+    m_DecodeDevice = std::move(m_Device);
+    m_DecodeDeviceContext = std::move(m_DeviceContext);
+    m_Device = std::move(device);
+    m_DeviceContext = std::move(deviceContext1);
+
+    // Every frame is copied into our shared texture, so neither GPU can bind
+    // the decoder output textures or pass them to its video processor.
+    m_BindDecoderOutputTextures = false;
+    m_PreferBindDecoderOutputTextures = false;
+    m_UseVideoProcessor = false;
+
+    return true;
+}
+
+bool D3D11VARenderer::openCrossAdapterTexture(ID3D11Texture2D* presentTexture, ID3D11Device* decodeDevice, ID3D11Texture2D** decodeTexture)
+{
+    ComPtr<IDXGIResource1> resource;
+    ComPtr<ID3D11Device1> decodeDevice1;
+    HANDLE sharedHandle;
+    HRESULT hr;
+
+    hr = presentTexture->QueryInterface(IID_PPV_ARGS(&resource));
+    if (FAILED(hr)) {
+        SDL_LogError(SDL_LOG_CATEGORY_APPLICATION,
+                     "ID3D11Texture2D::QueryInterface(IDXGIResource1) failed: %x",
+                     hr);
+        return false;
+    }
+
+    hr = resource->CreateSharedHandle(nullptr, DXGI_SHARED_RESOURCE_READ | DXGI_SHARED_RESOURCE_WRITE, nullptr, &sharedHandle);
+    if (FAILED(hr)) {
+        SDL_LogError(SDL_LOG_CATEGORY_APPLICATION,
+                     "IDXGIResource1::CreateSharedHandle() failed: %x",
+                     hr);
+        return false;
+    }
+
+    hr = decodeDevice->QueryInterface(IID_PPV_ARGS(&decodeDevice1));
+    if (SUCCEEDED(hr)) {
+        hr = decodeDevice1->OpenSharedResource1(sharedHandle, IID_PPV_ARGS(decodeTexture));
+    }
+
+    // The opened texture holds its own reference to the shared resource
+    CloseHandle(sharedHandle);
+
+    if (FAILED(hr)) {
+        SDL_LogError(SDL_LOG_CATEGORY_APPLICATION,
+                     "ID3D11Device1::OpenSharedResource1() failed: %x",
+                     hr);
+        return false;
+    }
+
+    return true;
+}
+
+bool D3D11VARenderer::measureCrossAdapterCopy(ID3D11Device* presentDevice, ID3D11DeviceContext* presentDeviceContext, double* copyTimeMs)
+{
+    ComPtr<ID3D11Texture2D> presentTexture;
+    ComPtr<ID3D11Texture2D> decodeTexture;
+    ComPtr<ID3D11Texture2D> sourceTexture;
+    ComPtr<IDXGIKeyedMutex> presentMutex;
+    ComPtr<IDXGIKeyedMutex> decodeMutex;
+    ComPtr<ID3D11Query> query;
+    LARGE_INTEGER start, end;
+    HRESULT hr;
+
+    // m_Device is still the decoding GPU here
+    SDL_assert(m_Device);
+    SDL_assert(!m_DecodeDevice);
+
+    D3D11_TEXTURE2D_DESC texDesc = {};
+    texDesc.Width = m_DecoderParams.width;
+    texDesc.Height = m_DecoderParams.height;
+    texDesc.MipLevels = 1;
+    texDesc.ArraySize = 1;
+    if (m_DecoderParams.videoFormat & VIDEO_FORMAT_MASK_10BIT) {
+        texDesc.Format = (m_DecoderParams.videoFormat & VIDEO_FORMAT_MASK_YUV444) ? DXGI_FORMAT_Y410 : DXGI_FORMAT_P010;
+    }
+    else {
+        texDesc.Format = (m_DecoderParams.videoFormat & VIDEO_FORMAT_MASK_YUV444) ? DXGI_FORMAT_AYUV : DXGI_FORMAT_NV12;
+    }
+    texDesc.SampleDesc.Quality = 0;
+    texDesc.SampleDesc.Count = 1;
+    texDesc.Usage = D3D11_USAGE_DEFAULT;
+    texDesc.BindFlags = D3D11_BIND_SHADER_RESOURCE;
+    texDesc.CPUAccessFlags = 0;
+    texDesc.MiscFlags = D3D11_RESOURCE_MISC_SHARED_NTHANDLE | D3D11_RESOURCE_MISC_SHARED_KEYEDMUTEX;
+
+    hr = presentDevice->CreateTexture2D(&texDesc, nullptr, &presentTexture);
+    if (FAILED(hr)) {
+        SDL_LogError(SDL_LOG_CATEGORY_APPLICATION,
+                     "ID3D11Device::CreateTexture2D() failed: %x",
+                     hr);
+        return false;
+    }
+
+    if (!openCrossAdapterTexture(presentTexture.Get(), m_Device.Get(), &decodeTexture)) {
+        return false;
+    }
+
+    // Stand-in for a decoder output texture
+    texDesc.BindFlags = 0;
+    texDesc.MiscFlags = 0;
+    hr = m_Device->CreateTexture2D(&texDesc, nullptr, &sourceTexture);
+    if (FAILED(hr)) {
+        SDL_LogError(SDL_LOG_CATEGORY_APPLICATION,
+                     "ID3D11Device::CreateTexture2D() failed: %x",
+                     hr);
+        return false;
+    }
+
+    D3D11_QUERY_DESC queryDesc = {};
+    queryDesc.Query = D3D11_QUERY_EVENT;
+    hr = presentDevice->CreateQuery(&queryDesc, &query);
+    if (FAILED(hr)) {
+        SDL_LogError(SDL_LOG_CATEGORY_APPLICATION,
+                     "ID3D11Device::CreateQuery() failed: %x",
+                     hr);
+        return false;
+    }
+
+    if (FAILED(presentTexture.As(&presentMutex)) || FAILED(decodeTexture.As(&decodeMutex))) {
+        SDL_LogError(SDL_LOG_CATEGORY_APPLICATION,
+                     "ID3D11Texture2D::QueryInterface(IDXGIKeyedMutex) failed");
+        return false;
+    }
+
+    // Time a few round trips of the same handoff we do for each frame, from
+    // queuing the copy on the decoding GPU until the display GPU could sample
+    // from it. The first one is just to warm up both drivers.
+#define CROSS_ADAPTER_COPY_ITERATIONS 8
+    *copyTimeMs = 0;
+    for (int i = 0; i <= CROSS_ADAPTER_COPY_ITERATIONS; i++) {
+        QueryPerformanceCounter(&start);
+
+        if (decodeMutex->AcquireSync(0, 1000) != S_OK) {
+            return false;
+        }
+        m_DeviceContext->CopyResource(decodeTexture.Get(), sourceTexture.Get());
+        decodeMutex->ReleaseSync(1);
+
+        if (presentMutex->AcquireSync(1, 1000) != S_OK) {
+            return false;
+        }
+        presentDeviceContext->End(query.Get());
+        presentMutex->ReleaseSync(0);
+
+        while ((hr = presentDeviceContext->GetData(query.Get(), nullptr, 0, 0)) == S_FALSE) {
+            QueryPerformanceCounter(&end);
+            if (end.QuadPart - start.QuadPart > m_QpcFrequency.QuadPart) {
+                // Something is badly wrong if this takes over a second
+                return false;
+            }
+            SwitchToThread();
+        }
+        if (FAILED(hr)) {
+            return false;
+        }
+
+        QueryPerformanceCounter(&end);
+        if (i > 0) {
+            *copyTimeMs += (double)(end.QuadPart - start.QuadPart) * 1000.0 / m_QpcFrequency.QuadPart;
+        }
+    }
+
+    *copyTimeMs /= CROSS_ADAPTER_COPY_ITERATIONS;
+    return true;
+}
+
+bool D3D11VARenderer::copyFrameCrossAdapter(AVFrame* frame)
+{
+    // The decoding GPU writes the video texture while holding key 0, then
+    // hands it to the display GPU with key 1. renderVideo() gives it back
+    // with key 0 once the frame has been drawn.
+    HRESULT hr = m_CrossAdapterDecodeMutex->AcquireSync(0, 100);
+    if (hr != S_OK) {
+        SDL_LogError(SDL_LOG_CATEGORY_APPLICATION,
+                     "IDXGIKeyedMutex::AcquireSync() failed: %x",
+                     hr);
+        return false;
+    }
+
+    m_DecodeDeviceContext->CopySubresourceRegion1(m_CrossAdapterTexture.Get(), 0, 0, 0, 0,
+                                                  (ID3D11Resource*)frame->data[0], (int)(intptr_t)frame->data[1],
+                                                  nullptr, D3D11_COPY_DISCARD);
+    m_CrossAdapterDecodeMutex->ReleaseSync(1);
+
+    // The display GPU waits for the copy to finish before sampling from it
+    hr = m_CrossAdapterPresentMutex->AcquireSync(1, 100);
+    if (hr != S_OK) {
+        SDL_LogError(SDL_LOG_CATEGORY_APPLICATION,
+                     "IDXGIKeyedMutex::AcquireSync() failed: %x",
+                     hr);
+
+        // The decoding GPU can never get the texture back now. Reset the decoder.
+        SDL_Event event;
+        event.type = SDL_RENDER_TARGETS_RESET;
+        SDL_PushEvent(&event);
+        return false;
+    }
+
+    return true;
+}
+
 bool D3D11VARenderer::initialize(PDECODER_PARAMETERS params)
 {
     int adapterIndex, outputIndex;
@@ -313,9 +843,24 @@ bool D3D11VARenderer::initialize(PDECODER_PARAMETERS params)
         return false;
     }
 
+    // D3D11VA_DECODE_ADAPTER forces decoding on a specific GPU, even if the
+    // display GPU could decode this stream itself.
+    bool ok;
+    int decodeAdapterIndex = qEnvironmentVariableIntValue("D3D11VA_DECODE_ADAPTER", &ok);
+    if (ok && decodeAdapterIndex != adapterIndex) {
+        SDL_LogWarn(SDL_LOG_CATEGORY_APPLICATION,
+                    "Using D3D11VA_DECODE_ADAPTER to decode on GPU %d",
+                    decodeAdapterIndex);
+        if (createDeviceByAdapterIndex(decodeAdapterIndex)) {
+            // If we can't present on the display GPU, we'll present from the
+            // decoding GPU and let DXGI copy across adapters for us.
+            createCrossAdapterPresentDevice(adapterIndex, true);
+        }
+    }
+
     // First try the adapter corresponding to the display where our window resides.
     // This will let us avoid a copy if the display GPU has the required decoder.
-    if (!createDeviceByAdapterIndex(adapterIndex)) {
+    if (m_Device == nullptr && !createDeviceByAdapterIndex(adapterIndex)) {
         // If that didn't work, we'll try all GPUs in order until we find one
         // or run out of GPUs (DXGI_ERROR_NOT_FOUND from EnumAdapters())
         bool adapterNotFound = false;
@@ -336,6 +881,14 @@ bool D3D11VARenderer::initialize(PDECODER_PARAMETERS params)
             SDL_assert(!m_DeviceContext);
             return false;
         }
+
+        // Presenting from a GPU that isn't driving our display makes DXGI copy
+        // each frame across adapters at present time. Do that copy ourselves
+        // so the display GPU can render and present locally, unless it turns
+        // out to be slower than presenting from the decoding GPU.
+        if (qgetenv("D3D11VA_CROSS_ADAPTER") != "0") {
+            createCrossAdapterPresentDevice(adapterIndex, qEnvironmentVariableIntValue("D3D11VA_CROSS_ADAPTER"));
+        }
     }
 
     DXGI_SWAP_CHAIN_DESC1 swapChainDesc = {};
@@ -366,6 +919,16 @@ bool D3D11VARenderer::initialize(PDECODER_PARAMETERS params)
     // causes performance issues (buffer starvation) on AMD GPUs.
     swapChainDesc.BufferCount = 3 + 1 + 1;
 
+    // The exception is a swapchain with a frame latency waitable object. Its
+    // maximum frame latency doesn't make Present() block, so we can limit it
+    // to 1 and wait in waitToRender() until the swapchain can take a frame.
+    // This keeps the render thread from latching a frame that would just
+    // sit in the present queue.
+    bool useWaitableSwapchain = !!qEnvironmentVariableIntValue("D3D11VA_WAITABLE_SWAPCHAIN");
+    if (useWaitableSwapchain) {
+        swapChainDesc.Flags |= DXGI_SWAP_CHAIN_FLAG_FRAME_LATENCY_WAITABLE_OBJECT;
+    }
+
     // Use the current window size as the swapchain size
     SDL_GetWindowSize(params->window, (int*)&swapChainDesc.Width, (int*)&swapChainDesc.Height);
 
@@ -379,9 +942,33 @@ bool D3D11VARenderer::initialize(PDECODER_PARAMETERS params)
         swapChainDesc.Format = DXGI_FORMAT_R8G8B8A8_UNORM;
     }
 
+    // Only present to the display as a VRR display if its monitor says it can
+    // follow us. Otherwise tearing presents would just tear on a fixed refresh
+    // display, so we stay V-synced instead. D3D11VA_VRR=1 skips the EDID check
+    // for monitors that support VRR without advertising it.
+    if (params->enableVrr) {
+        ComPtr<IDXGIAdapter1> adapter;
+        ComPtr<IDXGIOutput> output;
+        if (qEnvironmentVariableIntValue("D3D11VA_VRR")) {
+            m_UseVrr = true;
+        }
+        else if (SUCCEEDED(m_Factory->EnumAdapters1(adapterIndex, &adapter)) &&
+                 SUCCEEDED(adapter->EnumOutputs(outputIndex, &output))) {
+            m_UseVrr = isOutputVariableRefresh(output.Get());
+        }
+
+        if (!m_UseVrr) {
+            SDL_LogWarn(SDL_LOG_CATEGORY_APPLICATION,
+                        "VRR was requested, but the display doesn't report adaptive sync support");
+        }
+    }
+
     // Use DXGI_SWAP_CHAIN_FLAG_ALLOW_TEARING with flip mode for non-vsync case, if possible.
+    // This is also how we present to variable refresh rate displays, since VRR with a flip
+    // model swapchain requires tearing support. The display will only tear if the frame
+    // rate leaves the VRR range.
     // NOTE: This is only possible in windowed or borderless windowed mode.
-    if (!params->enableVsync) {
+    if (!params->enableVsync || m_UseVrr) {
         BOOL allowTearing = FALSE;
         hr = m_Factory->CheckFeatureSupport(DXGI_FEATURE_PRESENT_ALLOW_TEARING,
                                             &allowTearing,
@@ -406,7 +993,7 @@ bool D3D11VARenderer::initialize(PDECODER_PARAMETERS params)
 
         // DXVA2 may let us take over for FSE V-sync off cases. However, if we don't have DXGI_FEATURE_PRESENT_ALLOW_TEARING
         // then we should not attempt to do this unless there's no other option (HDR, DXVA2 failed in pass 1, etc).
-        if (!m_AllowTearing && m_DecoderSelectionPass == 0 && !(params->videoFormat & VIDEO_FORMAT_MASK_10BIT) &&
+        if (!m_AllowTearing && !params->enableVsync && m_DecoderSelectionPass == 0 && !(params->videoFormat & VIDEO_FORMAT_MASK_10BIT) &&
                 (SDL_GetWindowFlags(params->window) & SDL_WINDOW_FULLSCREEN_DESKTOP) == SDL_WINDOW_FULLSCREEN) {
             SDL_LogWarn(SDL_LOG_CATEGORY_APPLICATION,
                         "Defaulting to DXVA2 for FSE without DXGI_FEATURE_PRESENT_ALLOW_TEARING support");
@@ -444,6 +1031,32 @@ bool D3D11VARenderer::initialize(PDECODER_PARAMETERS params)
         return false;
     }
 
+    // This lets us report whether DWM promoted us to independent flip.
+    // It's optional, so we just won't report it if it's missing.
+    if (FAILED(swapChain.As(&m_SwapChainMedia))) {
+        m_SwapChainMedia.Reset();
+    }
+
+    if (useWaitableSwapchain) {
+        hr = m_SwapChain->SetMaximumFrameLatency(1);
+        if (FAILED(hr)) {
+            SDL_LogError(SDL_LOG_CATEGORY_APPLICATION,
+                         "IDXGISwapChain::SetMaximumFrameLatency() failed: %x",
+                         hr);
+            return false;
+        }
+
+        m_FrameLatencyWaitableObject = m_SwapChain->GetFrameLatencyWaitableObject();
+        if (m_FrameLatencyWaitableObject == nullptr) {
+            SDL_LogError(SDL_LOG_CATEGORY_APPLICATION,
+                         "IDXGISwapChain::GetFrameLatencyWaitableObject() failed");
+            return false;
+        }
+
+        SDL_LogInfo(SDL_LOG_CATEGORY_APPLICATION,
+                    "Using frame latency waitable swapchain");
+    }
+
     // Disable Alt+Enter, PrintScreen, and window message snooping. This makes
     // it safe to run the renderer on a separate rendering thread rather than
     // requiring the main (message loop) thread.
@@ -471,8 +1084,14 @@ bool D3D11VARenderer::initialize(PDECODER_PARAMETERS params)
         AVD3D11VADeviceContext* d3d11vaDeviceContext = (AVD3D11VADeviceContext*)deviceContext->hwctx;
 
         // FFmpeg will take ownership of these pointers, so we use CopyTo() to bump the ref count
-        m_Device.CopyTo(&d3d11vaDeviceContext->device);
-        m_DeviceContext.CopyTo(&d3d11vaDeviceContext->device_context);
+        if (m_DecodeDevice) {
+            m_DecodeDevice.CopyTo(&d3d11vaDeviceContext->device);
+            m_DecodeDeviceContext.CopyTo(&d3d11vaDeviceContext->device_context);
+        }
+        else {
+            m_Device.CopyTo(&d3d11vaDeviceContext->device);
+            m_DeviceContext.CopyTo(&d3d11vaDeviceContext->device_context);
+        }
 
         // Set lock functions that we will use to synchronize with FFmpeg's usage of our device context
         d3d11vaDeviceContext->lock = lockContext;
@@ -516,6 +1135,29 @@ bool D3D11VARenderer::initialize(PDECODER_PARAMETERS params)
 
         AVD3D11VAFramesContext* d3d11vaFramesContext = (AVD3D11VAFramesContext*)framesContext->hwctx;
 
+        if (m_PreferBindDecoderOutputTextures) {
+            DXGI_FORMAT decoderFormat;
+            switch (framesContext->sw_format) {
+            case AV_PIX_FMT_P010:
+                decoderFormat = DXGI_FORMAT_P010;
+                break;
+            case AV_PIX_FMT_XV30:
+                decoderFormat = DXGI_FORMAT_Y410;
+                break;
+            case AV_PIX_FMT_VUYX:
+                decoderFormat = DXGI_FORMAT_AYUV;
+                break;
+            default:
+                decoderFormat = DXGI_FORMAT_NV12;
+                break;
+            }
+
+            m_BindDecoderOutputTextures = canBindDecoderOutputFormat(decoderFormat);
+            SDL_LogInfo(SDL_LOG_CATEGORY_APPLICATION,
+                        "Preferred decoder texture access: %s",
+                        m_BindDecoderOutputTextures ? "bind" : "copy");
+        }
+
         d3d11vaFramesContext->BindFlags = D3D11_BIND_DECODER;
         if (m_BindDecoderOutputTextures) {
             // We need to override the default D3D11VA bind flags to bind the textures as a shader resources
@@ -540,18 +1182,49 @@ bool D3D11VARenderer::initialize(PDECODER_PARAMETERS params)
             return false;
         }
 
-        if (m_BindDecoderOutputTextures) {
+        if (m_UseVideoProcessor && !setupVideoProcessor(d3d11vaFramesContext)) {
+            SDL_LogWarn(SDL_LOG_CATEGORY_APPLICATION,
+                        "Falling back to shader color conversion");
+            m_UseVideoProcessor = false;
+        }
+
+        // The video processor reads directly from the decoder textures,
+        // so it needs neither the SRVs nor our own copy of the frame.
+        if (!m_UseVideoProcessor && m_BindDecoderOutputTextures) {
             // Create SRVs for all textures in the decoder pool
             if (!setupTexturePoolViews(d3d11vaFramesContext)) {
-                return false;
+                if (!m_PreferBindDecoderOutputTextures) {
+                    return false;
+                }
+
+                // The pool textures are still usable as a copy source
+                SDL_LogWarn(SDL_LOG_CATEGORY_APPLICATION,
+                            "Falling back to copying decoder output textures");
+                for (auto& srvs : m_VideoTextureResourceViews) {
+                    for (auto& srv : srvs) {
+                        srv.Reset();
+                    }
+                }
+                m_BindDecoderOutputTextures = false;
+                if (!setupVideoTexture()) {
+                    return false;
+                }
             }
         }
-        else {
+        else if (!m_UseVideoProcessor) {
             // Create our internal texture to copy and render
             if (!setupVideoTexture()) {
                 return false;
             }
         }
+
+        if (m_DecoderParams.videoFormat & VIDEO_FORMAT_MASK_YUV444) {
+            SDL_LogInfo(SDL_LOG_CATEGORY_APPLICATION,
+                        "YUV 4:4:4 rendering path: %s",
+                        m_UseVideoProcessor ? "video processor" :
+                            m_BindDecoderOutputTextures ? "direct decoder texture sampling" :
+                                                          "copy to video texture");
+        }
     }
 
     return true;
@@ -577,30 +1250,62 @@ bool D3D11VARenderer::prepareDecoderContextInGetFormat(AVCodecContext *context,
 
 void D3D11VARenderer::renderFrame(AVFrame* frame)
 {
+    LARGE_INTEGER renderStartTime;
+    QueryPerformanceCounter(&renderStartTime);
+
     // Acquire the context lock for rendering to prevent concurrent
     // access from inside FFmpeg's decoding code
     lockContext(this);
 
-    // Clear the back buffer
-    const float clearColor[4] = {0.0f, 0.0f, 0.0f, 1.0f};
-    m_DeviceContext->ClearRenderTargetView(m_RenderTargetView.Get(), clearColor);
+    // Reusing a query that hasn't completed just discards its old result
+    GpuTimerQuery* gpuTimerQuery = nullptr;
+    if (m_GpuTimerQueriesReady) {
+        gpuTimerQuery = &m_GpuTimerQueries[m_GpuTimerQueriesIssued % GPU_TIMER_QUERY_COUNT];
+        m_DeviceContext->Begin(gpuTimerQuery->disjoint.Get());
+        m_DeviceContext->End(gpuTimerQuery->start.Get());
+    }
+
+    if (m_UseVideoProcessor) {
+        // The video processor fills the area around the video itself,
+        // so we don't need to clear the back buffer first.
+        renderVideoWithVideoProcessor(frame);
 
-    // Bind the back buffer. This needs to be done each time,
-    // because the render target view will be unbound by Present().
-    m_DeviceContext->OMSetRenderTargets(1, m_RenderTargetView.GetAddressOf(), nullptr);
+        // Bind the back buffer for overlay rendering
+        m_DeviceContext->OMSetRenderTargets(1, m_RenderTargetView.GetAddressOf(), nullptr);
+    }
+    else {
+        // Clear the back buffer
+        const float clearColor[4] = {0.0f, 0.0f, 0.0f, 1.0f};
+        m_DeviceContext->ClearRenderTargetView(m_RenderTargetView.Get(), clearColor);
 
-    // Render our video frame with the aspect-ratio adjusted viewport
-    renderVideo(frame);
+        // Bind the back buffer. This needs to be done each time,
+        // because the render target view will be unbound by Present().
+        m_DeviceContext->OMSetRenderTargets(1, m_RenderTargetView.GetAddressOf(), nullptr);
+
+        // Render our video frame with the aspect-ratio adjusted viewport
+        renderVideo(frame);
+    }
 
     // Render overlays on top of the video stream
     for (int i = 0; i < Overlay::OverlayMax; i++) {
         renderOverlay((Overlay::OverlayType)i);
     }
 
+    if (gpuTimerQuery != nullptr) {
+        m_DeviceContext->End(gpuTimerQuery->end.Get());
+        m_DeviceContext->End(gpuTimerQuery->disjoint.Get());
+
+        // Skip results that were overwritten before we could read them
+        m_GpuTimerQueriesIssued++;
+        if (m_GpuTimerQueriesIssued - m_GpuTimerQueriesRead > GPU_TIMER_QUERY_COUNT) {
+            m_GpuTimerQueriesRead = m_GpuTimerQueriesIssued - GPU_TIMER_QUERY_COUNT;
+        }
+    }
+
     UINT flags;
 
     if (m_AllowTearing) {
-        SDL_assert(!m_DecoderParams.enableVsync);
+        SDL_assert(!m_DecoderParams.enableVsync || m_UseVrr);
 
         // If tearing is allowed, use DXGI_PRESENT_ALLOW_TEARING with syncInterval 0.
         // It is not valid to use any other syncInterval values in tearing mode.
@@ -641,6 +1346,14 @@ void D3D11VARenderer::renderFrame(AVFrame* frame)
     // Present according to the decoder parameters
     hr = m_SwapChain->Present(0, flags);
 
+    // Remember when this present started rendering so getPresentLatency()
+    // can match it up with the frame statistics once it is displayed.
+    UINT presentCount;
+    if (SUCCEEDED(hr) && SUCCEEDED(m_SwapChain->GetLastPresentCount(&presentCount))) {
+        m_PresentHistory[presentCount % PRESENT_HISTORY_SIZE].presentCount = presentCount;
+        m_PresentHistory[presentCount % PRESENT_HISTORY_SIZE].renderStartTime = renderStartTime;
+    }
+
     // Release the context lock
     unlockContext(this);
 
@@ -659,7 +1372,13 @@ void D3D11VARenderer::renderFrame(AVFrame* frame)
 
 void D3D11VARenderer::renderOverlay(Overlay::OverlayType type)
 {
-    if (!Session::get()->getOverlayManager().isOverlayEnabled(type)) {
+    // There are no overlays without a session (like when benchmarking)
+    if (Session::get() == nullptr || !Session::get()->getOverlayManager().isOverlayEnabled(type)) {
+        return;
+    }
+
+    if (type == Overlay::OverlayPerfGraph) {
+        renderPerfGraph();
         return;
     }
 
@@ -696,6 +1415,42 @@ void D3D11VARenderer::renderOverlay(Overlay::OverlayType type)
     m_DeviceContext->DrawIndexed(6, 0, 0);
 }
 
+void D3D11VARenderer::renderPerfGraph()
+{
+    if (!m_PerfGraphVertexBuffer) {
+        return;
+    }
+
+    D3D11_MAPPED_SUBRESOURCE mappedResource;
+    HRESULT hr = m_DeviceContext->Map(m_PerfGraphVertexBuffer.Get(), 0, D3D11_MAP_WRITE_DISCARD, 0, &mappedResource);
+    if (FAILED(hr)) {
+        SDL_LogError(SDL_LOG_CATEGORY_APPLICATION,
+                     "ID3D11DeviceContext::Map() failed: %x",
+                     hr);
+        return;
+    }
+
+    int vertexCount = Session::get()->getOverlayManager().getPerfGraph().buildVertices((Overlay::PERF_GRAPH_VERTEX*)mappedResource.pData,
+                                                                                        m_DisplayWidth, m_DisplayHeight);
+    m_DeviceContext->Unmap(m_PerfGraphVertexBuffer.Get(), 0);
+
+    if (vertexCount == 0) {
+        return;
+    }
+
+    // Bind vertex buffer
+    UINT stride = sizeof(VERTEX);
+    UINT offset = 0;
+    m_DeviceContext->IASetVertexBuffers(0, 1, m_PerfGraphVertexBuffer.GetAddressOf(), &stride, &offset);
+
+    // The graph is drawn with the overlay shader sampling from a palette texture
+    m_DeviceContext->PSSetShader(m_OverlayPixelShader.Get(), nullptr, 0);
+    m_DeviceContext->PSSetShaderResources(0, 1, m_PerfGraphPaletteResourceView.GetAddressOf());
+
+    // Draw the whole graph as a non-indexed triangle list
+    m_DeviceContext->Draw(vertexCount, 0);
+}
+
 void D3D11VARenderer::bindColorConversion(AVFrame* frame)
 {
     bool yuv444 = (m_DecoderParams.videoFormat & VIDEO_FORMAT_MASK_YUV444);
@@ -814,6 +1569,15 @@ void D3D11VARenderer::renderVideo(AVFrame* frame)
             }
         }
     }
+    else if (m_DecodeDevice) {
+        // Copy this frame across adapters into our video texture
+        if (!copyFrameCrossAdapter(frame)) {
+            return;
+        }
+
+        // SRV 0 is always mapped to the video texture
+        srvIndex = 0;
+    }
     else {
         // Copy this frame into our video texture
         m_DeviceContext->CopySubresourceRegion1(m_VideoTexture.Get(), 0, 0, 0, 0,
@@ -837,6 +1601,65 @@ void D3D11VARenderer::renderVideo(AVFrame* frame)
     // Unbind SRVs for this frame
     ID3D11ShaderResourceView* nullSrvs[2] = {};
     m_DeviceContext->PSSetShaderResources(0, 2, nullSrvs);
+
+    if (m_DecodeDevice) {
+        // Hand the video texture back to the decoding GPU for the next frame
+        m_CrossAdapterPresentMutex->ReleaseSync(0);
+    }
+}
+
+DXGI_COLOR_SPACE_TYPE D3D11VARenderer::getVideoProcessorInputColorSpace(const AVFrame* frame)
+{
+    bool fullRange = isFrameFullRange(frame);
+
+    switch (getFrameColorspace(frame)) {
+    case COLORSPACE_REC_2020:
+        if (frame->color_trc == AVCOL_TRC_SMPTE2084) {
+            // There is no full range variant of this colorspace
+            return DXGI_COLOR_SPACE_YCBCR_STUDIO_G2084_LEFT_P2020;
+        }
+        else {
+            return fullRange ? DXGI_COLOR_SPACE_YCBCR_FULL_G22_LEFT_P2020 : DXGI_COLOR_SPACE_YCBCR_STUDIO_G22_LEFT_P2020;
+        }
+    case COLORSPACE_REC_709:
+        return fullRange ? DXGI_COLOR_SPACE_YCBCR_FULL_G22_LEFT_P709 : DXGI_COLOR_SPACE_YCBCR_STUDIO_G22_LEFT_P709;
+    case COLORSPACE_REC_601:
+    default:
+        return fullRange ? DXGI_COLOR_SPACE_YCBCR_FULL_G22_LEFT_P601 : DXGI_COLOR_SPACE_YCBCR_STUDIO_G22_LEFT_P601;
+    }
+}
+
+void D3D11VARenderer::renderVideoWithVideoProcessor(AVFrame* frame)
+{
+    // Our input views map directly to the texture index provided by FFmpeg
+    UINT viewIndex = (uintptr_t)frame->data[1];
+    SDL_assert(viewIndex < m_VideoProcessorInputViews.size());
+    if (viewIndex >= m_VideoProcessorInputViews.size()) {
+        SDL_LogError(SDL_LOG_CATEGORY_APPLICATION,
+                     "Unexpected texture index: %u",
+                     viewIndex);
+        return;
+    }
+
+    if (hasFrameFormatChanged(frame)) {
+        m_VideoContext->VideoProcessorSetStreamColorSpace1(m_VideoProcessor.Get(), 0,
+                                                           getVideoProcessorInputColorSpace(frame));
+        m_VideoContext->VideoProcessorSetOutputColorSpace1(m_VideoProcessor.Get(),
+                                                           frame->color_trc == AVCOL_TRC_SMPTE2084 ?
+                                                               DXGI_COLOR_SPACE_RGB_FULL_G2084_NONE_P2020 :
+                                                               DXGI_COLOR_SPACE_RGB_FULL_G22_NONE_P709);
+    }
+
+    D3D11_VIDEO_PROCESSOR_STREAM stream = {};
+    stream.Enable = TRUE;
+    stream.pInputSurface = m_VideoProcessorInputViews[viewIndex].Get();
+
+    HRESULT hr = m_VideoContext->VideoProcessorBlt(m_VideoProcessor.Get(), m_VideoProcessorOutputView.Get(), 0, 1, &stream);
+    if (FAILED(hr)) {
+        SDL_LogError(SDL_LOG_CATEGORY_APPLICATION,
+                     "ID3D11VideoContext::VideoProcessorBlt() failed: %x",
+                     hr);
+    }
 }
 
 // This function must NOT use any DXGI or ID3D11DeviceContext methods
@@ -852,57 +1675,86 @@ void D3D11VARenderer::notifyOverlayUpdated(Overlay::OverlayType type)
         return;
     }
 
-    SDL_AtomicLock(&m_OverlayLock);
-    ComPtr<ID3D11Texture2D> oldTexture = std::move(m_OverlayTextures[type]);
-    ComPtr<ID3D11Buffer> oldVertexBuffer = std::move(m_OverlayVertexBuffers[type]);
-    ComPtr<ID3D11ShaderResourceView> oldTextureResourceView = std::move(m_OverlayTextureResourceViews[type]);
-    SDL_AtomicUnlock(&m_OverlayLock);
-
-    // If the overlay is disabled, we're done
+    // If the overlay is disabled, free its resources and we're done
     if (!overlayEnabled) {
+        SDL_AtomicLock(&m_OverlayLock);
+        ComPtr<ID3D11Texture2D> oldTexture = std::move(m_OverlayTextures[type]);
+        ComPtr<ID3D11Buffer> oldVertexBuffer = std::move(m_OverlayVertexBuffers[type]);
+        ComPtr<ID3D11ShaderResourceView> oldTextureResourceView = std::move(m_OverlayTextureResourceViews[type]);
+        SDL_AtomicUnlock(&m_OverlayLock);
+
         SDL_FreeSurface(newSurface);
         return;
     }
 
-    // Create a texture with our pixel data
     SDL_assert(!SDL_MUSTLOCK(newSurface));
     SDL_assert(newSurface->format->format == SDL_PIXELFORMAT_ARGB8888);
 
+    SDL_AtomicLock(&m_OverlayLock);
+    ComPtr<ID3D11Texture2D> texture = m_OverlayTextures[type];
+    ComPtr<ID3D11Buffer> vertexBuffer = m_OverlayVertexBuffers[type];
+    ComPtr<ID3D11ShaderResourceView> textureResourceView = m_OverlayTextureResourceViews[type];
+    SDL_AtomicUnlock(&m_OverlayLock);
+
+    // The overlay text changes every time the stats are updated, so we keep
+    // a dynamic texture around and only write the area covered by the new
+    // surface. We only need new resources if the surface outgrows it.
     D3D11_TEXTURE2D_DESC texDesc = {};
-    texDesc.Width = newSurface->w;
-    texDesc.Height = newSurface->h;
-    texDesc.MipLevels = 1;
-    texDesc.ArraySize = 1;
-    texDesc.Format = DXGI_FORMAT_B8G8R8A8_UNORM;
-    texDesc.SampleDesc.Count = 1;
-    texDesc.SampleDesc.Quality = 0;
-    texDesc.Usage = D3D11_USAGE_IMMUTABLE;
-    texDesc.BindFlags = D3D11_BIND_SHADER_RESOURCE;
-    texDesc.CPUAccessFlags = 0;
-    texDesc.MiscFlags = 0;
+    if (texture) {
+        texture->GetDesc(&texDesc);
+    }
+
+    bool newResources = false;
+    if (!texture || (UINT)newSurface->w > texDesc.Width || (UINT)newSurface->h > texDesc.Height) {
+        // Round up to leave some room for the overlay to grow
+        texDesc.Width = qMax(texDesc.Width, (UINT)((newSurface->w + 255) & ~255));
+        texDesc.Height = qMax(texDesc.Height, (UINT)((newSurface->h + 255) & ~255));
+        texDesc.MipLevels = 1;
+        texDesc.ArraySize = 1;
+        texDesc.Format = DXGI_FORMAT_B8G8R8A8_UNORM;
+        texDesc.SampleDesc.Count = 1;
+        texDesc.SampleDesc.Quality = 0;
+        texDesc.Usage = D3D11_USAGE_DYNAMIC;
+        texDesc.BindFlags = D3D11_BIND_SHADER_RESOURCE;
+        texDesc.CPUAccessFlags = D3D11_CPU_ACCESS_WRITE;
+        texDesc.MiscFlags = 0;
+
+        hr = m_Device->CreateTexture2D(&texDesc, nullptr, &texture);
+        if (FAILED(hr)) {
+            SDL_FreeSurface(newSurface);
+            SDL_LogError(SDL_LOG_CATEGORY_APPLICATION,
+                         "ID3D11Device::CreateTexture2D() failed: %x",
+                         hr);
+            return;
+        }
 
-    D3D11_SUBRESOURCE_DATA texData = {};
-    texData.pSysMem = newSurface->pixels;
-    texData.SysMemPitch = newSurface->pitch;
+        hr = m_Device->CreateShaderResourceView((ID3D11Resource*)texture.Get(), nullptr, &textureResourceView);
+        if (FAILED(hr)) {
+            SDL_FreeSurface(newSurface);
+            SDL_LogError(SDL_LOG_CATEGORY_APPLICATION,
+                         "ID3D11Device::CreateShaderResourceView() failed: %x",
+                         hr);
+            return;
+        }
 
-    ComPtr<ID3D11Texture2D> newTexture;
-    hr = m_Device->CreateTexture2D(&texDesc, &texData, &newTexture);
-    if (FAILED(hr)) {
-        SDL_FreeSurface(newSurface);
-        SDL_LogError(SDL_LOG_CATEGORY_APPLICATION,
-                     "ID3D11Device::CreateTexture2D() failed: %x",
-                     hr);
-        return;
-    }
+        D3D11_BUFFER_DESC vbDesc = {};
+        vbDesc.ByteWidth = sizeof(VERTEX) * 4;
+        vbDesc.Usage = D3D11_USAGE_DYNAMIC;
+        vbDesc.BindFlags = D3D11_BIND_VERTEX_BUFFER;
+        vbDesc.CPUAccessFlags = D3D11_CPU_ACCESS_WRITE;
+        vbDesc.MiscFlags = 0;
+        vbDesc.StructureByteStride = sizeof(VERTEX);
+
+        hr = m_Device->CreateBuffer(&vbDesc, nullptr, &vertexBuffer);
+        if (FAILED(hr)) {
+            SDL_FreeSurface(newSurface);
+            SDL_LogError(SDL_LOG_CATEGORY_APPLICATION,
+                         "ID3D11Device::CreateBuffer() failed: %x",
+                         hr);
+            return;
+        }
 
-    ComPtr<ID3D11ShaderResourceView> newTextureResourceView;
-    hr = m_Device->CreateShaderResourceView((ID3D11Resource*)newTexture.Get(), nullptr, &newTextureResourceView);
-    if (FAILED(hr)) {
-        SDL_FreeSurface(newSurface);
-        SDL_LogError(SDL_LOG_CATEGORY_APPLICATION,
-                     "ID3D11Device::CreateShaderResourceView() failed: %x",
-                     hr);
-        return;
+        newResources = true;
     }
 
     SDL_FRect renderRect = {};
@@ -924,42 +1776,63 @@ void D3D11VARenderer::notifyOverlayUpdated(Overlay::OverlayType type)
     // Convert screen space to normalized device coordinates
     StreamUtils::screenSpaceToNormalizedDeviceCoords(&renderRect, m_DisplayWidth, m_DisplayHeight);
 
-    // The surface is no longer required
-    SDL_FreeSurface(newSurface);
-    newSurface = nullptr;
+    // Only sample the part of the texture that the surface covers
+    float maxU = (float)newSurface->w / texDesc.Width;
+    float maxV = (float)newSurface->h / texDesc.Height;
 
     VERTEX verts[] =
     {
-        {renderRect.x, renderRect.y, 0, 1},
+        {renderRect.x, renderRect.y, 0, maxV},
         {renderRect.x, renderRect.y+renderRect.h, 0, 0},
-        {renderRect.x+renderRect.w, renderRect.y, 1, 1},
-        {renderRect.x+renderRect.w, renderRect.y+renderRect.h, 1, 0},
+        {renderRect.x+renderRect.w, renderRect.y, maxU, maxV},
+        {renderRect.x+renderRect.w, renderRect.y+renderRect.h, maxU, 0},
     };
 
-    D3D11_BUFFER_DESC vbDesc = {};
-    vbDesc.ByteWidth = sizeof(verts);
-    vbDesc.Usage = D3D11_USAGE_IMMUTABLE;
-    vbDesc.BindFlags = D3D11_BIND_VERTEX_BUFFER;
-    vbDesc.CPUAccessFlags = 0;
-    vbDesc.MiscFlags = 0;
-    vbDesc.StructureByteStride = sizeof(VERTEX);
+    // The render thread uses the device context while holding this lock,
+    // so this also keeps it from drawing a half-written overlay.
+    lockContext(this);
 
-    D3D11_SUBRESOURCE_DATA vbData = {};
-    vbData.pSysMem = verts;
+    D3D11_MAPPED_SUBRESOURCE mappedTexture;
+    hr = m_DeviceContext->Map(texture.Get(), 0, D3D11_MAP_WRITE_DISCARD, 0, &mappedTexture);
+    if (SUCCEEDED(hr)) {
+        for (int y = 0; y < newSurface->h; y++) {
+            memcpy((uint8_t*)mappedTexture.pData + (y * mappedTexture.RowPitch),
+                   (uint8_t*)newSurface->pixels + (y * newSurface->pitch),
+                   newSurface->w * 4);
+        }
+        m_DeviceContext->Unmap(texture.Get(), 0);
 
-    ComPtr<ID3D11Buffer> newVertexBuffer;
-    hr = m_Device->CreateBuffer(&vbDesc, &vbData, &newVertexBuffer);
-    if (FAILED(hr)) {
+        D3D11_MAPPED_SUBRESOURCE mappedVertices;
+        hr = m_DeviceContext->Map(vertexBuffer.Get(), 0, D3D11_MAP_WRITE_DISCARD, 0, &mappedVertices);
+        if (SUCCEEDED(hr)) {
+            memcpy(mappedVertices.pData, verts, sizeof(verts));
+            m_DeviceContext->Unmap(vertexBuffer.Get(), 0);
+        }
+        else {
+            SDL_LogError(SDL_LOG_CATEGORY_APPLICATION,
+                         "ID3D11DeviceContext::Map(overlay vertices) failed: %x",
+                         hr);
+        }
+    }
+    else {
         SDL_LogError(SDL_LOG_CATEGORY_APPLICATION,
-                     "ID3D11Device::CreateBuffer() failed: %x",
+                     "ID3D11DeviceContext::Map(overlay texture) failed: %x",
                      hr);
+    }
+
+    unlockContext(this);
+
+    // The surface is no longer required
+    SDL_FreeSurface(newSurface);
+
+    if (FAILED(hr) || !newResources) {
         return;
     }
 
     SDL_AtomicLock(&m_OverlayLock);
-    m_OverlayVertexBuffers[type] = std::move(newVertexBuffer);
-    m_OverlayTextures[type] = std::move(newTexture);
-    m_OverlayTextureResourceViews[type] = std::move(newTextureResourceView);
+    m_OverlayVertexBuffers[type] = std::move(vertexBuffer);
+    m_OverlayTextures[type] = std::move(texture);
+    m_OverlayTextureResourceViews[type] = std::move(textureResourceView);
     SDL_AtomicUnlock(&m_OverlayLock);
 }
 
@@ -1134,6 +2007,9 @@ int D3D11VARenderer::getRendererAttributes()
     // This renderer supports HDR
     attributes |= RENDERER_ATTRIBUTE_HDR_SUPPORT;
 
+    // The device and frames context aren't tied to a single codec context
+    attributes |= RENDERER_ATTRIBUTE_REUSABLE_DECODER_CONTEXT;
+
     // This renderer requires frame pacing to synchronize with VBlank when we're in full-screen.
     // In windowed mode, we will render as fast we can and DWM will grab whatever is latest at the
     // time unless the user opts for pacing. We will use pacing in full-screen mode and normal DWM
@@ -1142,9 +2018,147 @@ int D3D11VARenderer::getRendererAttributes()
         attributes |= RENDERER_ATTRIBUTE_FORCE_PACING;
     }
 
+    // With VRR, presenting in tearing mode lets the display refresh as each frame arrives
+    if (m_AllowTearing && m_UseVrr) {
+        attributes |= RENDERER_ATTRIBUTE_VARIABLE_REFRESH;
+    }
+
     return attributes;
 }
 
+bool D3D11VARenderer::getPresentLatency(uint64_t* latencyUs)
+{
+    DXGI_FRAME_STATISTICS frameStats;
+    HRESULT hr;
+
+    lockContext(this);
+    hr = m_SwapChain->GetFrameStatistics(&frameStats);
+    unlockContext(this);
+
+    // This fails before the first present is displayed and returns
+    // DXGI_ERROR_FRAME_STATISTICS_DISJOINT after mode changes.
+    if (FAILED(hr) || frameStats.PresentCount == m_LastReportedPresentCount) {
+        return false;
+    }
+
+    m_LastReportedPresentCount = frameStats.PresentCount;
+
+    // We may have presented several frames since the last one that was displayed
+    auto& present = m_PresentHistory[frameStats.PresentCount % PRESENT_HISTORY_SIZE];
+    if (present.presentCount != frameStats.PresentCount ||
+            frameStats.SyncQPCTime.QuadPart < present.renderStartTime.QuadPart) {
+        return false;
+    }
+
+    *latencyUs = (uint64_t)((frameStats.SyncQPCTime.QuadPart - present.renderStartTime.QuadPart) * 1000000 /
+                            m_QpcFrequency.QuadPart);
+    return true;
+}
+
+bool D3D11VARenderer::getGpuRenderTime(uint64_t* renderTimeUs)
+{
+    bool hasResult = false;
+
+    lockContext(this);
+
+    // Report the newest frame whose queries have completed. DONOTFLUSH keeps
+    // us from forcing the GPU to start on work that we just submitted.
+    while (m_GpuTimerQueriesRead != m_GpuTimerQueriesIssued) {
+        GpuTimerQuery& query = m_GpuTimerQueries[m_GpuTimerQueriesRead % GPU_TIMER_QUERY_COUNT];
+
+        D3D11_QUERY_DATA_TIMESTAMP_DISJOINT disjointData;
+        UINT64 startTime, endTime;
+        if (m_DeviceContext->GetData(query.disjoint.Get(), &disjointData, sizeof(disjointData), D3D11_ASYNC_GETDATA_DONOTFLUSH) != S_OK ||
+                m_DeviceContext->GetData(query.start.Get(), &startTime, sizeof(startTime), D3D11_ASYNC_GETDATA_DONOTFLUSH) != S_OK ||
+                m_DeviceContext->GetData(query.end.Get(), &endTime, sizeof(endTime), D3D11_ASYNC_GETDATA_DONOTFLUSH) != S_OK) {
+            break;
+        }
+
+        m_GpuTimerQueriesRead++;
+
+        // Timestamps are meaningless if the GPU clock changed in between
+        if (!disjointData.Disjoint && disjointData.Frequency != 0 && endTime >= startTime) {
+            *renderTimeUs = (endTime - startTime) * 1000000 / disjointData.Frequency;
+            hasResult = true;
+        }
+    }
+
+    unlockContext(this);
+
+    return hasResult;
+}
+
+bool D3D11VARenderer::getQueuedPresentCount(int* queuedFrames)
+{
+    DXGI_FRAME_STATISTICS frameStats;
+    UINT lastPresentCount;
+    HRESULT hr;
+
+    lockContext(this);
+    hr = m_SwapChain->GetFrameStatistics(&frameStats);
+    if (SUCCEEDED(hr)) {
+        hr = m_SwapChain->GetLastPresentCount(&lastPresentCount);
+    }
+    unlockContext(this);
+
+    if (FAILED(hr)) {
+        return false;
+    }
+
+    // Everything presented after the last displayed frame is still queued
+    *queuedFrames = (int)(lastPresentCount - frameStats.PresentCount);
+    return true;
+}
+
+bool D3D11VARenderer::getDirectScanout(bool* directScanout)
+{
+    DXGI_FRAME_STATISTICS_MEDIA frameStats;
+    HRESULT hr;
+
+    if (!m_SwapChainMedia) {
+        return false;
+    }
+
+    lockContext(this);
+    hr = m_SwapChainMedia->GetFrameStatisticsMedia(&frameStats);
+    unlockContext(this);
+
+    if (FAILED(hr)) {
+        return false;
+    }
+
+    switch (frameStats.CompositionMode) {
+    case DXGI_FRAME_PRESENTATION_MODE_COMPOSED:
+    case DXGI_FRAME_PRESENTATION_MODE_COMPOSITION_FAILURE:
+        *directScanout = false;
+        return true;
+
+    case DXGI_FRAME_PRESENTATION_MODE_OVERLAY:
+    case DXGI_FRAME_PRESENTATION_MODE_NONE:
+        // Either a hardware overlay plane or independent flip
+        *directScanout = true;
+        return true;
+
+    default:
+        return false;
+    }
+}
+
+bool D3D11VARenderer::didCopyLastFrame()
+{
+    // The video processor and bound SRVs both read directly from the decoder pool
+    return !m_UseVideoProcessor && !m_BindDecoderOutputTextures;
+}
+
+void D3D11VARenderer::waitToRender()
+{
+    if (m_FrameLatencyWaitableObject != nullptr) {
+        // The timeout ensures we can't deadlock if the swapchain stops
+        // signalling us (like if the window has been occluded).
+        WaitForSingleObjectEx(m_FrameLatencyWaitableObject, 100, FALSE);
+    }
+}
+
 int D3D11VARenderer::getDecoderCapabilities()
 {
     return CAPABILITY_REFERENCE_FRAME_INVALIDATION_HEVC |
@@ -1160,6 +2174,18 @@ bool D3D11VARenderer::needsTestFrame()
     return true;
 }
 
+bool D3D11VARenderer::getDriverVersion(uint32_t* vendorId, uint32_t* deviceId, uint64_t* driverVersion)
+{
+    if (!m_Device || m_AdapterDriverVersion == 0) {
+        return false;
+    }
+
+    *vendorId = m_AdapterVendorId;
+    *deviceId = m_AdapterDeviceId;
+    *driverVersion = m_AdapterDriverVersion;
+    return true;
+}
+
 IFFmpegRenderer::InitFailureReason D3D11VARenderer::getInitFailureReason()
 {
     // In the specific case where we found at least one D3D11 hardware device but none of the
@@ -1254,6 +2280,59 @@ bool D3D11VARenderer::setupRenderingResources()
         }
     }
 
+    // Create the performance graph resources. The graph is optional, so failures here aren't fatal.
+    {
+        D3D11_TEXTURE2D_DESC texDesc = {};
+        texDesc.Width = Overlay::PerfGraphColorMax;
+        texDesc.Height = 1;
+        texDesc.MipLevels = 1;
+        texDesc.ArraySize = 1;
+        texDesc.Format = DXGI_FORMAT_B8G8R8A8_UNORM;
+        texDesc.SampleDesc.Count = 1;
+        texDesc.SampleDesc.Quality = 0;
+        texDesc.Usage = D3D11_USAGE_IMMUTABLE;
+        texDesc.BindFlags = D3D11_BIND_SHADER_RESOURCE;
+        texDesc.CPUAccessFlags = 0;
+        texDesc.MiscFlags = 0;
+
+        D3D11_SUBRESOURCE_DATA texData = {};
+        texData.pSysMem = Overlay::PerfGraph::getPaletteData();
+        texData.SysMemPitch = Overlay::PerfGraphColorMax * sizeof(uint32_t);
+
+        ComPtr<ID3D11Texture2D> paletteTexture;
+        hr = m_Device->CreateTexture2D(&texDesc, &texData, &paletteTexture);
+        if (SUCCEEDED(hr)) {
+            hr = m_Device->CreateShaderResourceView(paletteTexture.Get(), nullptr, &m_PerfGraphPaletteResourceView);
+            if (FAILED(hr)) {
+                SDL_LogError(SDL_LOG_CATEGORY_APPLICATION,
+                             "ID3D11Device::CreateShaderResourceView() failed: %x",
+                             hr);
+            }
+        }
+        else {
+            SDL_LogError(SDL_LOG_CATEGORY_APPLICATION,
+                         "ID3D11Device::CreateTexture2D() failed: %x",
+                         hr);
+        }
+
+        if (m_PerfGraphPaletteResourceView) {
+            D3D11_BUFFER_DESC vbDesc = {};
+            vbDesc.ByteWidth = PERF_GRAPH_MAX_VERTICES * sizeof(VERTEX);
+            vbDesc.Usage = D3D11_USAGE_DYNAMIC;
+            vbDesc.BindFlags = D3D11_BIND_VERTEX_BUFFER;
+            vbDesc.CPUAccessFlags = D3D11_CPU_ACCESS_WRITE;
+            vbDesc.MiscFlags = 0;
+            vbDesc.StructureByteStride = sizeof(VERTEX);
+
+            hr = m_Device->CreateBuffer(&vbDesc, nullptr, &m_PerfGraphVertexBuffer);
+            if (FAILED(hr)) {
+                SDL_LogError(SDL_LOG_CATEGORY_APPLICATION,
+                             "ID3D11Device::CreateBuffer() failed: %x",
+                             hr);
+            }
+        }
+    }
+
     for (int i = 0; i < PixelShaders::_COUNT; i++)
     {
         QByteArray videoPixelShaderBytecode = Path::readDataFile(k_VideoShaderNames[i]);
@@ -1267,6 +2346,28 @@ bool D3D11VARenderer::setupRenderingResources()
         }
     }
 
+    // Create the GPU timer queries. GPU timing is optional, so failures here aren't fatal.
+    {
+        D3D11_QUERY_DESC disjointDesc = {};
+        disjointDesc.Query = D3D11_QUERY_TIMESTAMP_DISJOINT;
+
+        D3D11_QUERY_DESC timestampDesc = {};
+        timestampDesc.Query = D3D11_QUERY_TIMESTAMP;
+
+        m_GpuTimerQueriesReady = true;
+        for (auto& query : m_GpuTimerQueries) {
+            if (FAILED(hr = m_Device->CreateQuery(&disjointDesc, &query.disjoint)) ||
+                    FAILED(hr = m_Device->CreateQuery(&timestampDesc, &query.start)) ||
+                    FAILED(hr = m_Device->CreateQuery(&timestampDesc, &query.end))) {
+                SDL_LogError(SDL_LOG_CATEGORY_APPLICATION,
+                             "ID3D11Device::CreateQuery() failed: %x",
+                             hr);
+                m_GpuTimerQueriesReady = false;
+                break;
+            }
+        }
+    }
+
     // We use a common sampler for all pixel shaders
     {
         D3D11_SAMPLER_DESC samplerDesc = {};
@@ -1466,7 +2567,7 @@ bool D3D11VARenderer::setupVideoTexture()
     texDesc.Usage = D3D11_USAGE_DEFAULT;
     texDesc.BindFlags = D3D11_BIND_SHADER_RESOURCE;
     texDesc.CPUAccessFlags = 0;
-    texDesc.MiscFlags = 0;
+    texDesc.MiscFlags = m_DecodeDevice ? (D3D11_RESOURCE_MISC_SHARED_NTHANDLE | D3D11_RESOURCE_MISC_SHARED_KEYEDMUTEX) : 0;
 
     hr = m_Device->CreateTexture2D(&texDesc, nullptr, &m_VideoTexture);
     if (FAILED(hr)) {
@@ -1476,6 +2577,23 @@ bool D3D11VARenderer::setupVideoTexture()
         return false;
     }
 
+    if (m_DecodeDevice) {
+        if (!openCrossAdapterTexture(m_VideoTexture.Get(), m_DecodeDevice.Get(), &m_CrossAdapterTexture)) {
+            return false;
+        }
+
+        hr = m_VideoTexture.As(&m_CrossAdapterPresentMutex);
+        if (SUCCEEDED(hr)) {
+            hr = m_CrossAdapterTexture.As(&m_CrossAdapterDecodeMutex);
+        }
+        if (FAILED(hr)) {
+            SDL_LogError(SDL_LOG_CATEGORY_APPLICATION,
+                         "ID3D11Texture2D::QueryInterface(IDXGIKeyedMutex) failed: %x",
+                         hr);
+            return false;
+        }
+    }
+
     // Create SRVs for the texture
     D3D11_SHADER_RESOURCE_VIEW_DESC srvDesc = {};
     srvDesc.ViewDimension = D3D11_SRV_DIMENSION_TEXTURE2D;
@@ -1500,6 +2618,32 @@ bool D3D11VARenderer::setupVideoTexture()
     return true;
 }
 
+bool D3D11VARenderer::canBindDecoderOutputFormat(DXGI_FORMAT format)
+{
+    UINT formatSupport;
+    HRESULT hr = m_Device->CheckFormatSupport(format, &formatSupport);
+    if (FAILED(hr)) {
+        SDL_LogWarn(SDL_LOG_CATEGORY_APPLICATION,
+                    "ID3D11Device::CheckFormatSupport(%d) failed: %x",
+                    format,
+                    hr);
+        return false;
+    }
+
+    const UINT requiredSupport = D3D11_FORMAT_SUPPORT_TEXTURE2D |
+                                 D3D11_FORMAT_SUPPORT_SHADER_SAMPLE |
+                                 D3D11_FORMAT_SUPPORT_DECODER_OUTPUT;
+    if ((formatSupport & requiredSupport) != requiredSupport) {
+        SDL_LogInfo(SDL_LOG_CATEGORY_APPLICATION,
+                    "Decoder output format %d can't be sampled directly (support: %x)",
+                    format,
+                    formatSupport);
+        return false;
+    }
+
+    return true;
+}
+
 bool D3D11VARenderer::setupTexturePoolViews(AVD3D11VAFramesContext* frameContext)
 {
     SDL_assert(m_BindDecoderOutputTextures);
@@ -1540,3 +2684,154 @@ bool D3D11VARenderer::setupTexturePoolViews(AVD3D11VAFramesContext* frameContext
 
     return true;
 }
+
+bool D3D11VARenderer::setupVideoProcessor(AVD3D11VAFramesContext* frameContext)
+{
+    SDL_assert(m_UseVideoProcessor);
+
+    HRESULT hr;
+
+    hr = m_Device.As(&m_VideoDevice);
+    if (FAILED(hr)) {
+        SDL_LogError(SDL_LOG_CATEGORY_APPLICATION,
+                     "ID3D11Device::QueryInterface(ID3D11VideoDevice) failed: %x",
+                     hr);
+        return false;
+    }
+
+    // ID3D11VideoContext1 is required for DXGI colorspaces (including HDR)
+    hr = m_DeviceContext.As(&m_VideoContext);
+    if (FAILED(hr)) {
+        SDL_LogError(SDL_LOG_CATEGORY_APPLICATION,
+                     "ID3D11DeviceContext::QueryInterface(ID3D11VideoContext1) failed: %x",
+                     hr);
+        return false;
+    }
+
+    D3D11_VIDEO_PROCESSOR_CONTENT_DESC contentDesc = {};
+    contentDesc.InputFrameFormat = D3D11_VIDEO_FRAME_FORMAT_PROGRESSIVE;
+    contentDesc.InputWidth = m_DecoderParams.width;
+    contentDesc.InputHeight = m_DecoderParams.height;
+    contentDesc.OutputWidth = m_DisplayWidth;
+    contentDesc.OutputHeight = m_DisplayHeight;
+    contentDesc.Usage = D3D11_VIDEO_USAGE_OPTIMAL_SPEED;
+
+    hr = m_VideoDevice->CreateVideoProcessorEnumerator(&contentDesc, &m_VideoProcessorEnumerator);
+    if (FAILED(hr)) {
+        SDL_LogError(SDL_LOG_CATEGORY_APPLICATION,
+                     "ID3D11VideoDevice::CreateVideoProcessorEnumerator() failed: %x",
+                     hr);
+        return false;
+    }
+
+    UINT formatSupport;
+    hr = m_VideoProcessorEnumerator->CheckVideoProcessorFormat(m_TextureFormat, &formatSupport);
+    if (FAILED(hr) || !(formatSupport & D3D11_VIDEO_PROCESSOR_FORMAT_SUPPORT_INPUT)) {
+        SDL_LogWarn(SDL_LOG_CATEGORY_APPLICATION,
+                    "Video processor doesn't support input format: %d",
+                    m_TextureFormat);
+        return false;
+    }
+
+    DXGI_FORMAT outputFormat = (m_DecoderParams.videoFormat & VIDEO_FORMAT_MASK_10BIT) ?
+                                   DXGI_FORMAT_R10G10B10A2_UNORM : DXGI_FORMAT_R8G8B8A8_UNORM;
+    hr = m_VideoProcessorEnumerator->CheckVideoProcessorFormat(outputFormat, &formatSupport);
+    if (FAILED(hr) || !(formatSupport & D3D11_VIDEO_PROCESSOR_FORMAT_SUPPORT_OUTPUT)) {
+        SDL_LogWarn(SDL_LOG_CATEGORY_APPLICATION,
+                    "Video processor doesn't support output format: %d",
+                    outputFormat);
+        return false;
+    }
+
+    hr = m_VideoDevice->CreateVideoProcessor(m_VideoProcessorEnumerator.Get(), 0, &m_VideoProcessor);
+    if (FAILED(hr)) {
+        SDL_LogError(SDL_LOG_CATEGORY_APPLICATION,
+                     "ID3D11VideoDevice::CreateVideoProcessor() failed: %x",
+                     hr);
+        return false;
+    }
+
+    // Create an output view of the back buffer
+    {
+        ComPtr<ID3D11Resource> backBufferResource;
+        hr = m_SwapChain->GetBuffer(0, __uuidof(ID3D11Resource), (void**)&backBufferResource);
+        if (FAILED(hr)) {
+            SDL_LogError(SDL_LOG_CATEGORY_APPLICATION,
+                         "IDXGISwapChain::GetBuffer() failed: %x",
+                         hr);
+            return false;
+        }
+
+        D3D11_VIDEO_PROCESSOR_OUTPUT_VIEW_DESC outputViewDesc = {};
+        outputViewDesc.ViewDimension = D3D11_VPOV_DIMENSION_TEXTURE2D;
+        outputViewDesc.Texture2D.MipSlice = 0;
+
+        hr = m_VideoDevice->CreateVideoProcessorOutputView(backBufferResource.Get(),
+                                                           m_VideoProcessorEnumerator.Get(),
+                                                           &outputViewDesc,
+                                                           &m_VideoProcessorOutputView);
+        if (FAILED(hr)) {
+            SDL_LogError(SDL_LOG_CATEGORY_APPLICATION,
+                         "ID3D11VideoDevice::CreateVideoProcessorOutputView() failed: %x",
+                         hr);
+            return false;
+        }
+    }
+
+    // Create input views for each texture in the decoder pool
+    for (size_t i = 0; i < m_VideoProcessorInputViews.size(); i++) {
+        // Our rendering logic depends on the texture index working to map into our view array
+        SDL_assert(i == (size_t)frameContext->texture_infos[i].index);
+
+        D3D11_VIDEO_PROCESSOR_INPUT_VIEW_DESC inputViewDesc = {};
+        inputViewDesc.FourCC = 0;
+        inputViewDesc.ViewDimension = D3D11_VPIV_DIMENSION_TEXTURE2D;
+        inputViewDesc.Texture2D.MipSlice = 0;
+        inputViewDesc.Texture2D.ArraySlice = frameContext->texture_infos[i].index;
+
+        hr = m_VideoDevice->CreateVideoProcessorInputView(frameContext->texture_infos[i].texture,
+                                                          m_VideoProcessorEnumerator.Get(),
+                                                          &inputViewDesc,
+                                                          &m_VideoProcessorInputViews[i]);
+        if (FAILED(hr)) {
+            SDL_LogError(SDL_LOG_CATEGORY_APPLICATION,
+                         "ID3D11VideoDevice::CreateVideoProcessorInputView() failed: %x",
+                         hr);
+            return false;
+        }
+    }
+
+    // Scale video to the window size while preserving aspect ratio
+    {
+        SDL_Rect src, dst;
+        src.x = src.y = 0;
+        src.w = m_DecoderParams.width;
+        src.h = m_DecoderParams.height;
+        dst.x = dst.y = 0;
+        dst.w = m_DisplayWidth;
+        dst.h = m_DisplayHeight;
+        StreamUtils::scaleSourceToDestinationSurface(&src, &dst);
+
+        // Don't sample from the alignment padding area
+        RECT sourceRect = { 0, 0, m_DecoderParams.width, m_DecoderParams.height };
+        RECT destRect = { dst.x, dst.y, dst.x + dst.w, dst.y + dst.h };
+        RECT targetRect = { 0, 0, m_DisplayWidth, m_DisplayHeight };
+        m_VideoContext->VideoProcessorSetStreamSourceRect(m_VideoProcessor.Get(), 0, TRUE, &sourceRect);
+        m_VideoContext->VideoProcessorSetStreamDestRect(m_VideoProcessor.Get(), 0, TRUE, &destRect);
+        m_VideoContext->VideoProcessorSetOutputTargetRect(m_VideoProcessor.Get(), TRUE, &targetRect);
+    }
+
+    // Fill the area around the video with black
+    D3D11_VIDEO_COLOR backgroundColor = {};
+    backgroundColor.RGBA.A = 1.0f;
+    m_VideoContext->VideoProcessorSetOutputBackgroundColor(m_VideoProcessor.Get(), FALSE, &backgroundColor);
+
+    m_VideoContext->VideoProcessorSetStreamFrameFormat(m_VideoProcessor.Get(), 0, D3D11_VIDEO_FRAME_FORMAT_PROGRESSIVE);
+
+    // Don't let the driver apply its own "enhancements" to the video
+    m_VideoContext->VideoProcessorSetStreamAutoProcessingMode(m_VideoProcessor.Get(), 0, FALSE);
+
+    SDL_LogInfo(SDL_LOG_CATEGORY_APPLICATION,
+                "Using D3D11 video processor for color conversion and scaling");
+    return true;
+}
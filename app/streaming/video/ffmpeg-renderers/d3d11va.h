@@ -22,9 +22,16 @@ public:
     virtual void renderFrame(AVFrame* frame) override;
     virtual void notifyOverlayUpdated(Overlay::OverlayType) override;
     virtual int getRendererAttributes() override;
+    virtual bool getPresentLatency(uint64_t* latencyUs) override;
+    virtual bool getQueuedPresentCount(int* queuedFrames) override;
+    virtual bool getDirectScanout(bool* directScanout) override;
+    virtual bool didCopyLastFrame() override;
+    virtual void waitToRender() override;
     virtual int getDecoderCapabilities() override;
     virtual bool needsTestFrame() override;
     virtual InitFailureReason getInitFailureReason() override;
+    virtual bool getDriverVersion(uint32_t* vendorId, uint32_t* deviceId, uint64_t* driverVersion) override;
+    virtual bool getGpuRenderTime(uint64_t* renderTimeUs) override;
 
     enum PixelShaders {
         GENERIC_YUV_420,
@@ -41,16 +48,30 @@ private:
     std::vector<DXGI_FORMAT> getVideoTextureSRVFormats();
     bool setupVideoTexture(); // for !m_BindDecoderOutputTextures
     bool setupTexturePoolViews(AVD3D11VAFramesContext* frameContext); // for m_BindDecoderOutputTextures
+    bool canBindDecoderOutputFormat(DXGI_FORMAT format);
     void renderOverlay(Overlay::OverlayType type);
+    void renderPerfGraph();
     void bindColorConversion(AVFrame* frame);
     void renderVideo(AVFrame* frame);
+    bool setupVideoProcessor(AVD3D11VAFramesContext* frameContext); // for m_UseVideoProcessor
+    DXGI_COLOR_SPACE_TYPE getVideoProcessorInputColorSpace(const AVFrame* frame);
+    void renderVideoWithVideoProcessor(AVFrame* frame);
     bool checkDecoderSupport(IDXGIAdapter* adapter);
     bool createDeviceByAdapterIndex(int adapterIndex, bool* adapterNotFound = nullptr);
+    bool createCrossAdapterPresentDevice(int adapterIndex, bool forced);
+    bool openCrossAdapterTexture(ID3D11Texture2D* presentTexture, ID3D11Device* decodeDevice, ID3D11Texture2D** decodeTexture);
+    bool measureCrossAdapterCopy(ID3D11Device* presentDevice, ID3D11DeviceContext* presentDeviceContext, double* copyTimeMs);
+    bool copyFrameCrossAdapter(AVFrame* frame); // for m_DecodeDevice
 
     int m_DecoderSelectionPass;
     int m_DevicesWithFL11Support;
     int m_DevicesWithCodecSupport;
 
+    // Only valid if m_Device != nullptr
+    uint32_t m_AdapterVendorId;
+    uint32_t m_AdapterDeviceId;
+    uint64_t m_AdapterDriverVersion; // 0 if unknown
+
     enum class SupportedFenceType {
         None,
         NonMonitored,
@@ -60,12 +81,15 @@ private:
     Microsoft::WRL::ComPtr<IDXGIFactory5> m_Factory;
     Microsoft::WRL::ComPtr<ID3D11Device> m_Device;
     Microsoft::WRL::ComPtr<IDXGISwapChain4> m_SwapChain;
+    Microsoft::WRL::ComPtr<IDXGISwapChainMedia> m_SwapChainMedia;
     Microsoft::WRL::ComPtr<ID3D11DeviceContext1> m_DeviceContext;
     Microsoft::WRL::ComPtr<ID3D11RenderTargetView> m_RenderTargetView;
     SupportedFenceType m_FenceType;
     SDL_mutex* m_ContextLock;
     bool m_BindDecoderOutputTextures;
+    bool m_PreferBindDecoderOutputTextures;
     bool m_UseFenceHack;
+    bool m_UseVideoProcessor;
 
     DECODER_PARAMETERS m_DecoderParams;
     int m_TextureAlignment;
@@ -77,6 +101,32 @@ private:
     AVColorTransferCharacteristic m_LastColorTrc;
 
     bool m_AllowTearing;
+    bool m_UseVrr;
+
+    // Render start times of recent presents, indexed by present count
+#define PRESENT_HISTORY_SIZE 8
+    struct {
+        UINT presentCount;
+        LARGE_INTEGER renderStartTime;
+    } m_PresentHistory[PRESENT_HISTORY_SIZE];
+    UINT m_LastReportedPresentCount;
+    LARGE_INTEGER m_QpcFrequency;
+
+    // Only valid if D3D11VA_WAITABLE_SWAPCHAIN=1
+    HANDLE m_FrameLatencyWaitableObject;
+
+    // Timestamp queries around each frame's rendering, read back a few frames
+    // later so we never wait on the GPU. Empty if the device can't create them.
+#define GPU_TIMER_QUERY_COUNT 8
+    struct GpuTimerQuery {
+        Microsoft::WRL::ComPtr<ID3D11Query> disjoint;
+        Microsoft::WRL::ComPtr<ID3D11Query> start;
+        Microsoft::WRL::ComPtr<ID3D11Query> end;
+    };
+    std::array<GpuTimerQuery, GPU_TIMER_QUERY_COUNT> m_GpuTimerQueries;
+    bool m_GpuTimerQueriesReady;
+    unsigned int m_GpuTimerQueriesIssued;
+    unsigned int m_GpuTimerQueriesRead;
 
     std::array<Microsoft::WRL::ComPtr<ID3D11PixelShader>, PixelShaders::_COUNT> m_VideoPixelShaders;
     Microsoft::WRL::ComPtr<ID3D11Buffer> m_VideoVertexBuffer;
@@ -88,12 +138,33 @@ private:
 #define DECODER_BUFFER_POOL_SIZE 17
     std::array<std::array<Microsoft::WRL::ComPtr<ID3D11ShaderResourceView>, 2>, DECODER_BUFFER_POOL_SIZE> m_VideoTextureResourceViews;
 
+    // Only valid if m_UseVideoProcessor
+    Microsoft::WRL::ComPtr<ID3D11VideoDevice> m_VideoDevice;
+    Microsoft::WRL::ComPtr<ID3D11VideoContext1> m_VideoContext;
+    Microsoft::WRL::ComPtr<ID3D11VideoProcessorEnumerator> m_VideoProcessorEnumerator;
+    Microsoft::WRL::ComPtr<ID3D11VideoProcessor> m_VideoProcessor;
+    Microsoft::WRL::ComPtr<ID3D11VideoProcessorOutputView> m_VideoProcessorOutputView;
+    std::array<Microsoft::WRL::ComPtr<ID3D11VideoProcessorInputView>, DECODER_BUFFER_POOL_SIZE> m_VideoProcessorInputViews;
+
+    // Only valid when decoding on a different adapter than the one we present
+    // on. FFmpeg decodes on m_DecodeDevice, which copies each frame into the
+    // shared m_VideoTexture that m_Device renders from.
+    Microsoft::WRL::ComPtr<ID3D11Device> m_DecodeDevice;
+    Microsoft::WRL::ComPtr<ID3D11DeviceContext1> m_DecodeDeviceContext;
+    Microsoft::WRL::ComPtr<ID3D11Texture2D> m_CrossAdapterTexture; // m_VideoTexture opened on m_DecodeDevice
+    Microsoft::WRL::ComPtr<IDXGIKeyedMutex> m_CrossAdapterDecodeMutex;
+    Microsoft::WRL::ComPtr<IDXGIKeyedMutex> m_CrossAdapterPresentMutex;
+
     SDL_SpinLock m_OverlayLock;
     std::array<Microsoft::WRL::ComPtr<ID3D11Buffer>, Overlay::OverlayMax> m_OverlayVertexBuffers;
     std::array<Microsoft::WRL::ComPtr<ID3D11Texture2D>, Overlay::OverlayMax> m_OverlayTextures;
     std::array<Microsoft::WRL::ComPtr<ID3D11ShaderResourceView>, Overlay::OverlayMax> m_OverlayTextureResourceViews;
     Microsoft::WRL::ComPtr<ID3D11PixelShader> m_OverlayPixelShader;
 
+    // Dynamic vertex buffer rewritten each frame the performance graph is enabled
+    Microsoft::WRL::ComPtr<ID3D11Buffer> m_PerfGraphVertexBuffer;
+    Microsoft::WRL::ComPtr<ID3D11ShaderResourceView> m_PerfGraphPaletteResourceView;
+
     AVBufferRef* m_HwDeviceContext;
     AVBufferRef* m_HwFramesContext;
 };
@@ -4,6 +4,7 @@
 #endif
 
 #include "drm.h"
+#include "pacer/pacer.h"
 #include "string.h"
 
 extern "C" {
@@ -80,8 +81,11 @@ struct dma_buf_sync {
 
 #include <unistd.h>
 #include <fcntl.h>
+#include <time.h>
 
+#include <poll.h>
 #include <sys/mman.h>
+#include <sys/stat.h>
 
 #include "streaming/streamutils.h"
 #include "streaming/session.h"
@@ -171,9 +175,23 @@ DrmRenderer::DrmRenderer(AVHWDeviceType hwDeviceType, IFFmpegRenderer *backendRe
       m_ColorRangeProp(nullptr),
       m_HdrOutputMetadataProp(nullptr),
       m_ColorspaceProp(nullptr),
+      m_VrrEnabledProp(nullptr),
       m_Version(nullptr),
       m_HdrOutputMetadataBlobId(0),
       m_OutputRect{},
+      m_PresentLatencyUs(0),
+      m_FbCacheFramesContext(nullptr),
+      m_UseAtomic(false),
+      m_PlanePropIds{},
+      m_EventThread(nullptr),
+      m_FlipPending(false),
+      m_FlipTimedOut(false),
+      m_FlipTimedOutFbId(0),
+      m_LastBlockingCommitUs(0),
+      m_FlipSupersededFbId(0),
+      m_RetiredFbId(0),
+      m_FlipRenderStartTimeUs(0),
+      m_VsyncPacer(nullptr),
       m_SwFrameMapper(this),
       m_CurrentSwFrameIdx(0)
 #ifdef HAVE_EGL
@@ -181,10 +199,23 @@ DrmRenderer::DrmRenderer(AVHWDeviceType hwDeviceType, IFFmpegRenderer *backendRe
 #endif
 {
     SDL_zero(m_SwFrame);
+    SDL_AtomicSet(&m_EventThreadStopping, 0);
+    m_EventLock = SDL_CreateMutex();
+    m_FlipDoneCond = SDL_CreateCond();
 }
 
 DrmRenderer::~DrmRenderer()
 {
+    if (m_EventThread != nullptr) {
+        SDL_AtomicSet(&m_EventThreadStopping, 1);
+        SDL_WaitThread(m_EventThread, nullptr);
+    }
+
+    // Apply property changes immediately from here on, since there
+    // won't be another atomic commit to pick them up.
+    m_UseAtomic = false;
+    m_PendingProperties.clear();
+
     // Ensure we're out of HDR mode
     setHdrMode(false);
 
@@ -204,9 +235,12 @@ DrmRenderer::~DrmRenderer()
         }
     }
 
-    if (m_CurrentFbId != 0) {
-        drmModeRmFB(m_DrmFd, m_CurrentFbId);
-    }
+    flushFbCache();
+    av_buffer_unref(&m_FbCacheFramesContext);
+    releaseFb(m_CurrentFbId);
+    releaseFb(m_FlipSupersededFbId);
+    releaseFb(m_RetiredFbId);
+    releaseFb(m_FlipTimedOutFbId);
 
     if (m_HdrOutputMetadataBlobId != 0) {
         drmModeDestroyPropertyBlob(m_DrmFd, m_HdrOutputMetadataBlobId);
@@ -228,6 +262,12 @@ DrmRenderer::~DrmRenderer()
         drmModeFreeProperty(m_ColorspaceProp);
     }
 
+    if (m_VrrEnabledProp != nullptr) {
+        // Restore fixed refresh rate for whoever uses the display next
+        drmModeObjectSetProperty(m_DrmFd, m_CrtcId, DRM_MODE_OBJECT_CRTC, m_VrrEnabledProp->prop_id, 0);
+        drmModeFreeProperty(m_VrrEnabledProp);
+    }
+
     if (m_Plane != nullptr) {
         drmModeFreePlane(m_Plane);
     }
@@ -243,6 +283,9 @@ DrmRenderer::~DrmRenderer()
     if (m_MustCloseDrmFd && m_DrmFd != -1) {
         close(m_DrmFd);
     }
+
+    SDL_DestroyCond(m_FlipDoneCond);
+    SDL_DestroyMutex(m_EventLock);
 }
 
 bool DrmRenderer::prepareDecoderContext(AVCodecContext* context, AVDictionary** options)
@@ -352,6 +395,54 @@ bool DrmRenderer::getPropertyByName(drmModeObjectPropertiesPtr props, const char
     return false;
 }
 
+uint32_t DrmRenderer::getPropertyIdByName(uint32_t objectId, uint32_t objectType, const char* name)
+{
+    uint32_t propId = 0;
+
+    drmModeObjectPropertiesPtr props = drmModeObjectGetProperties(m_DrmFd, objectId, objectType);
+    if (props != nullptr) {
+        for (uint32_t j = 0; j < props->count_props && propId == 0; j++) {
+            drmModePropertyPtr prop = drmModeGetProperty(m_DrmFd, props->props[j]);
+            if (prop != nullptr) {
+                if (!strcmp(prop->name, name)) {
+                    propId = prop->prop_id;
+                }
+
+                drmModeFreeProperty(prop);
+            }
+        }
+
+        drmModeFreeObjectProperties(props);
+    }
+
+    return propId;
+}
+
+int DrmRenderer::setObjectProperty(uint32_t objectId, uint32_t objectType, drmModePropertyPtr prop, uint64_t value)
+{
+    if (m_UseAtomic) {
+        // This will be applied with the next frame's atomic commit. If there's
+        // already a pending value for this property, the new one replaces it.
+        SDL_LockMutex(m_EventLock);
+        bool replaced = false;
+        for (auto& pending : m_PendingProperties) {
+            if (pending.objectId == objectId && pending.propId == prop->prop_id) {
+                pending.value = value;
+                replaced = true;
+                break;
+            }
+        }
+        if (!replaced) {
+            m_PendingProperties.push_back({ objectId, objectType, prop->prop_id, value });
+        }
+        SDL_UnlockMutex(m_EventLock);
+        return 0;
+    }
+    else {
+        return drmModeObjectSetProperty(m_DrmFd, objectId, objectType, prop->prop_id, value);
+    }
+}
+
 bool DrmRenderer::initialize(PDECODER_PARAMETERS params)
 {
     int i;
@@ -719,6 +810,70 @@ bool DrmRenderer::initialize(PDECODER_PARAMETERS params)
         }
     }
 
+    // Enable variable refresh rate if requested and the display supports it
+    if (params->enableVrr) {
+        uint64_t vrrCapable = 0;
+
+        drmModeObjectPropertiesPtr props = drmModeObjectGetProperties(m_DrmFd, m_ConnectorId, DRM_MODE_OBJECT_CONNECTOR);
+        if (props != nullptr) {
+            getPropertyByName(props, "vrr_capable", &vrrCapable);
+            drmModeFreeObjectProperties(props);
+        }
+
+        if (vrrCapable) {
+            drmModePropertyPtr vrrProp = nullptr;
+
+            props = drmModeObjectGetProperties(m_DrmFd, m_CrtcId, DRM_MODE_OBJECT_CRTC);
+            if (props != nullptr) {
+                for (uint32_t j = 0; j < props->count_props && vrrProp == nullptr; j++) {
+                    drmModePropertyPtr prop = drmModeGetProperty(m_DrmFd, props->props[j]);
+                    if (prop != nullptr) {
+                        if (!strcmp(prop->name, "VRR_ENABLED")) {
+                            vrrProp = prop;
+                        }
+                        else {
+                            drmModeFreeProperty(prop);
+                        }
+                    }
+                }
+
+                drmModeFreeObjectProperties(props);
+            }
+
+            if (vrrProp == nullptr) {
+                SDL_LogWarn(SDL_LOG_CATEGORY_APPLICATION,
+                            "Unable to enable variable refresh rate: CRTC has no VRR_ENABLED property");
+            }
+            else if (drmModeObjectSetProperty(m_DrmFd, m_CrtcId, DRM_MODE_OBJECT_CRTC, vrrProp->prop_id, 1) < 0) {
+                SDL_LogWarn(SDL_LOG_CATEGORY_APPLICATION,
+                            "Unable to enable variable refresh rate: %d",
+                            errno);
+                drmModeFreeProperty(vrrProp);
+            }
+            else {
+                SDL_LogInfo(SDL_LOG_CATEGORY_APPLICATION,
+                            "Enabled variable refresh rate");
+                m_VrrEnabledProp = vrrProp;
+            }
+        }
+        else {
+            SDL_LogInfo(SDL_LOG_CATEGORY_APPLICATION,
+                        "Display is not capable of variable refresh rate");
+        }
+    }
+
+    // Atomic mode and page flip events are per-fd, so we can only use them
+    // on an fd we opened ourselves. Otherwise we'd steal SDL's events.
+    if (qEnvironmentVariableIntValue("DRM_ATOMIC")) {
+        if (m_MustCloseDrmFd) {
+            m_UseAtomic = initializeAtomic();
+        }
+        else {
+            SDL_LogWarn(SDL_LOG_CATEGORY_APPLICATION,
+                        "DRM atomic commits are unavailable on SDL's DRM FD");
+        }
+    }
+
     // If we got this far, we can do direct rendering via the DRM FD.
     m_SupportsDirectRendering = true;
 
@@ -786,6 +941,11 @@ int DrmRenderer::getRendererAttributes()
     // This renderer does not buffer any frames in the graphics pipeline
     attributes |= RENDERER_ATTRIBUTE_NO_BUFFERING;
 
+    // Plane updates scan out immediately when the CRTC is in VRR mode
+    if (m_VrrEnabledProp != nullptr) {
+        attributes |= RENDERER_ATTRIBUTE_VARIABLE_REFRESH;
+    }
+
 #ifdef GL_IS_SLOW
     // Restrict streaming resolution to 1080p on the Pi 4 while in the desktop environment.
     // EGL performance is extremely poor and just barely hits 1080p60 on Bookworm. This also
@@ -821,9 +981,8 @@ int DrmRenderer::getRendererAttributes()
 void DrmRenderer::setHdrMode(bool enabled)
 {
     if (m_ColorspaceProp != nullptr) {
-        int err = drmModeObjectSetProperty(m_DrmFd, m_ConnectorId, DRM_MODE_OBJECT_CONNECTOR,
-                                           m_ColorspaceProp->prop_id,
-                                           enabled ? DRM_MODE_COLORIMETRY_BT2020_RGB : DRM_MODE_COLORIMETRY_DEFAULT);
+        int err = setObjectProperty(m_ConnectorId, DRM_MODE_OBJECT_CONNECTOR, m_ColorspaceProp,
+                                    enabled ? DRM_MODE_COLORIMETRY_BT2020_RGB : DRM_MODE_COLORIMETRY_DEFAULT);
         if (err == 0) {
             SDL_LogInfo(SDL_LOG_CATEGORY_APPLICATION,
                         "Set HDMI Colorspace: %s",
@@ -877,9 +1036,8 @@ void DrmRenderer::setHdrMode(bool enabled)
             }
         }
 
-        int err = drmModeObjectSetProperty(m_DrmFd, m_ConnectorId, DRM_MODE_OBJECT_CONNECTOR,
-                                           m_HdrOutputMetadataProp->prop_id,
-                                           enabled ? m_HdrOutputMetadataBlobId : 0);
+        int err = setObjectProperty(m_ConnectorId, DRM_MODE_OBJECT_CONNECTOR, m_HdrOutputMetadataProp,
+                                    enabled ? m_HdrOutputMetadataBlobId : 0);
         if (err == 0) {
             SDL_LogInfo(SDL_LOG_CATEGORY_APPLICATION,
                         "Set display HDR mode: %s", enabled ? "enabled" : "disabled");
@@ -1088,12 +1246,136 @@ Exit:
     return ret;
 }
 
+void DrmRenderer::releaseFb(uint32_t fbId)
+{
+    if (fbId == 0) {
+        return;
+    }
+
+    // Cached FBs are freed when they leave the cache
+    for (auto& cachedFb : m_FbCache) {
+        if (cachedFb.second == fbId) {
+            return;
+        }
+    }
+
+    drmModeRmFB(m_DrmFd, fbId);
+}
+
+bool DrmRenderer::getFbCacheKey(AVFrame* frame, FbCacheKey* key)
+{
+    // Start over if the decoder was reset and gave us a new buffer pool
+    uint8_t* framesContext = frame->hw_frames_ctx != nullptr ? frame->hw_frames_ctx->data : nullptr;
+    if (framesContext != (m_FbCacheFramesContext != nullptr ? m_FbCacheFramesContext->data : nullptr)) {
+        flushFbCache();
+        av_buffer_unref(&m_FbCacheFramesContext);
+        if (frame->hw_frames_ctx != nullptr) {
+            m_FbCacheFramesContext = av_buffer_ref(frame->hw_frames_ctx);
+            if (m_FbCacheFramesContext == nullptr) {
+                return false;
+            }
+        }
+    }
+
+    SDL_zerop(key);
+    key->width = frame->width;
+    key->height = frame->height;
+
+    if (frame->format == AV_PIX_FMT_DRM_PRIME) {
+        AVDRMFrameDescriptor* drmFrame = (AVDRMFrameDescriptor*)frame->data[0];
+        struct stat st;
+
+        // The fd number may be reused for a different buffer once the original
+        // is freed, but the inode uniquely identifies the dma-buf itself.
+        if (fstat(drmFrame->objects[0].fd, &st) < 0) {
+            return false;
+        }
+
+        key->buffer = st.st_ino;
+        key->modifier = drmFrame->objects[0].format_modifier;
+        key->offset = drmFrame->layers[0].planes[0].offset;
+        key->format = drmFrame->layers[0].format;
+        return true;
+    }
+    else if (m_DrmPrimeBackend && frame->format == AV_PIX_FMT_VAAPI) {
+        // VA surface IDs are stable for the lifetime of the frames context
+        key->buffer = (uintptr_t)frame->data[3];
+        key->format = ((AVHWFramesContext*)frame->hw_frames_ctx->data)->sw_format;
+        return true;
+    }
+    else {
+        // Software frames are copied into our own dumb buffers
+        return false;
+    }
+}
+
+uint32_t DrmRenderer::lookupCachedFb(const FbCacheKey& key)
+{
+    for (auto it = m_FbCache.begin(); it != m_FbCache.end(); it++) {
+        if (it->first == key) {
+            // Move this entry to the front of the LRU list
+            m_FbCache.splice(m_FbCache.begin(), m_FbCache, it);
+            return m_FbCache.front().second;
+        }
+    }
+
+    return 0;
+}
+
+void DrmRenderer::insertCachedFb(const FbCacheKey& key, uint32_t fbId)
+{
+    m_FbCache.emplace_front(key, fbId);
+
+    if (m_FbCache.size() > k_MaxCachedFbs) {
+        // If the evicted FB is still on screen, releaseFb() will free it
+        // once it has been superseded.
+        uint32_t evictedFbId = m_FbCache.back().second;
+        m_FbCache.pop_back();
+        if (evictedFbId != m_CurrentFbId) {
+            drmModeRmFB(m_DrmFd, evictedFbId);
+        }
+    }
+}
+
+void DrmRenderer::flushFbCache()
+{
+    for (auto& cachedFb : m_FbCache) {
+        // The current FB is freed by releaseFb() once it's been superseded
+        if (cachedFb.second != m_CurrentFbId) {
+            drmModeRmFB(m_DrmFd, cachedFb.second);
+        }
+    }
+    m_FbCache.clear();
+}
+
 bool DrmRenderer::addFbForFrame(AVFrame *frame, uint32_t* newFbId, bool testMode)
 {
     AVDRMFrameDescriptor mappedFrame;
     AVDRMFrameDescriptor* drmFrame;
     int err;
 
+    // Hardware decoders cycle through a small pool of buffers that keep
+    // the same backing memory for their whole lifetime, so we can reuse
+    // the FB object we created the last time we saw a given buffer.
+    FbCacheKey cacheKey;
+    bool cacheable = !testMode && getFbCacheKey(frame, &cacheKey);
+    if (cacheable) {
+        uint32_t cachedFbId = lookupCachedFb(cacheKey);
+        if (cachedFbId != 0) {
+            if (frame->format != AV_PIX_FMT_DRM_PRIME) {
+                // We still map the frame so the backend waits for decoding to complete
+                SDL_assert(m_DrmPrimeBackend);
+                if (!m_BackendRenderer->mapDrmPrimeFrame(frame, &mappedFrame)) {
+                    return false;
+                }
+                m_BackendRenderer->unmapDrmPrimeFrame(&mappedFrame);
+            }
+
+            *newFbId = cachedFbId;
+            return true;
+        }
+    }
+
     // If we don't have a DRM PRIME frame here, we'll need to map into one
     if (frame->format != AV_PIX_FMT_DRM_PRIME) {
         if (m_DrmPrimeBackend) {
@@ -1198,6 +1480,10 @@ bool DrmRenderer::addFbForFrame(AVFrame *frame, uint32_t* newFbId, bool testMode
         return false;
     }
     else {
+        if (cacheable) {
+            insertCachedFb(cacheKey, *newFbId);
+        }
+
         return true;
     }
 }
@@ -1225,13 +1511,53 @@ bool DrmRenderer::drmFormatMatchesVideoFormat(uint32_t drmFormat, int videoForma
            formatDesc->log2_chroma_h == expectedLog2ChromaH;
 }
 
+// DRM V-blank timestamps use CLOCK_MONOTONIC
+static uint64_t getMonotonicTimeUs()
+{
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return (uint64_t)ts.tv_sec * 1000000 + ts.tv_nsec / 1000;
+}
+
 void DrmRenderer::renderFrame(AVFrame* frame)
 {
     int err;
     SDL_Rect src, dst;
+    uint64_t renderStartTimeUs = getMonotonicTimeUs();
 
     SDL_assert(m_OutputRect.w > 0 && m_OutputRect.h > 0);
 
+    if (m_UseAtomic) {
+        // The kernel rejects non-blocking commits while the previous one is
+        // still pending, so wait for its page flip before we go any further.
+        uint32_t retiredFbId;
+
+        SDL_LockMutex(m_EventLock);
+        while (m_FlipPending) {
+            if (SDL_CondWaitTimeout(m_FlipDoneCond, m_EventLock, 100) == SDL_MUTEX_TIMEDOUT) {
+                SDL_LogWarn(SDL_LOG_CATEGORY_APPLICATION,
+                            "Timed out waiting for DRM page flip. Committing the next frame synchronously.");
+
+                // The FB it superseded may still be on screen, so hold it
+                // until the blocking commit has replaced it
+                SDL_assert(m_FlipTimedOutFbId == 0);
+                m_FlipTimedOut = true;
+                m_FlipTimedOutFbId = m_FlipSupersededFbId;
+                m_FlipSupersededFbId = 0;
+                m_FlipPending = false;
+                break;
+            }
+        }
+        retiredFbId = m_RetiredFbId;
+        m_RetiredFbId = 0;
+        SDL_UnlockMutex(m_EventLock);
+
+        // Free the FB that was superseded by the last page flip
+        if (retiredFbId != m_CurrentFbId) {
+            releaseFb(retiredFbId);
+        }
+    }
+
     src.x = src.y = 0;
     src.w = frame->width;
     src.h = frame->height;
@@ -1243,11 +1569,14 @@ void DrmRenderer::renderFrame(AVFrame* frame)
     // when we are finished rendering this one (if successful).
     uint32_t lastFbId = m_CurrentFbId;
 
-    // Register a frame buffer object for this frame
-    if (!addFbForFrame(frame, &m_CurrentFbId, false)) {
-        m_CurrentFbId = lastFbId;
+    // Register a frame buffer object for this frame. m_CurrentFbId must
+    // still refer to the FB on screen while we do this, so it isn't freed
+    // if it gets evicted from the FB cache.
+    uint32_t newFbId;
+    if (!addFbForFrame(frame, &newFbId, false)) {
         return;
     }
+    m_CurrentFbId = newFbId;
 
     if (hasFrameFormatChanged(frame)) {
         // Set COLOR_RANGE property for the plane
@@ -1259,8 +1588,8 @@ void DrmRenderer::renderFrame(AVFrame* frame)
 
                 for (i = 0; i < m_ColorRangeProp->count_enums; i++) {
                     if (!strcmp(desiredValue, m_ColorRangeProp->enums[i].name)) {
-                        err = drmModeObjectSetProperty(m_DrmFd, m_PlaneId, DRM_MODE_OBJECT_PLANE,
-                                                       m_ColorRangeProp->prop_id, m_ColorRangeProp->enums[i].value);
+                        err = setObjectProperty(m_PlaneId, DRM_MODE_OBJECT_PLANE,
+                                                m_ColorRangeProp, m_ColorRangeProp->enums[i].value);
                         if (err == 0) {
                             SDL_LogInfo(SDL_LOG_CATEGORY_APPLICATION,
                                         "%s: %s",
@@ -1300,8 +1629,8 @@ void DrmRenderer::renderFrame(AVFrame* frame)
 
                 for (i = 0; i < m_ColorEncodingProp->count_enums; i++) {
                     if (!strcmp(desiredValue, m_ColorEncodingProp->enums[i].name)) {
-                        err = drmModeObjectSetProperty(m_DrmFd, m_PlaneId, DRM_MODE_OBJECT_PLANE,
-                                                       m_ColorEncodingProp->prop_id, m_ColorEncodingProp->enums[i].value);
+                        err = setObjectProperty(m_PlaneId, DRM_MODE_OBJECT_PLANE,
+                                                m_ColorEncodingProp, m_ColorEncodingProp->enums[i].value);
                         if (err == 0) {
                             SDL_LogInfo(SDL_LOG_CATEGORY_APPLICATION,
                                         "%s: %s",
@@ -1333,6 +1662,15 @@ void DrmRenderer::renderFrame(AVFrame* frame)
         }
     }
 
+    if (m_UseAtomic) {
+        // The previous FB is freed once this commit's page flip completes
+        if (!commitAtomic(m_CurrentFbId, dst, frame->width, frame->height, lastFbId, renderStartTimeUs)) {
+            releaseFb(m_CurrentFbId);
+            m_CurrentFbId = lastFbId;
+        }
+        return;
+    }
+
     // Update the overlay
     err = drmModeSetPlane(m_DrmFd, m_PlaneId, m_CrtcId, m_CurrentFbId, 0,
                           dst.x, dst.y,
@@ -1344,13 +1682,323 @@ void DrmRenderer::renderFrame(AVFrame* frame)
         SDL_LogError(SDL_LOG_CATEGORY_APPLICATION,
                      "drmModeSetPlane() failed: %d",
                      errno);
-        drmModeRmFB(m_DrmFd, m_CurrentFbId);
+        releaseFb(m_CurrentFbId);
         m_CurrentFbId = lastFbId;
         return;
     }
 
     // Free the previous FB object which has now been superseded
-    drmModeRmFB(m_DrmFd, lastFbId);
+    if (lastFbId != m_CurrentFbId) {
+        releaseFb(lastFbId);
+    }
+
+    // Legacy plane updates on atomic drivers don't return until the new FB is
+    // latched at V-blank, so the timestamp of the latest V-blank is when this
+    // frame reached the display. If that V-blank predates this frame, the
+    // driver updated the plane asynchronously and we can't tell.
+    uint64_t vblankSequence, vblankTimeNs;
+    if (drmCrtcGetSequence(m_DrmFd, m_CrtcId, &vblankSequence, &vblankTimeNs) == 0 &&
+            vblankTimeNs / 1000 >= renderStartTimeUs) {
+        SDL_LockMutex(m_EventLock);
+        m_PresentLatencyUs = vblankTimeNs / 1000 - renderStartTimeUs;
+        SDL_UnlockMutex(m_EventLock);
+    }
+}
+
+bool DrmRenderer::initializeAtomic()
+{
+    if (drmSetClientCap(m_DrmFd, DRM_CLIENT_CAP_ATOMIC, 1) < 0) {
+        SDL_LogWarn(SDL_LOG_CATEGORY_APPLICATION,
+                    "DRM driver doesn't support atomic modesetting: %d",
+                    errno);
+        return false;
+    }
+
+    m_PlanePropIds.fbId = getPropertyIdByName(m_PlaneId, DRM_MODE_OBJECT_PLANE, "FB_ID");
+    m_PlanePropIds.crtcId = getPropertyIdByName(m_PlaneId, DRM_MODE_OBJECT_PLANE, "CRTC_ID");
+    m_PlanePropIds.srcX = getPropertyIdByName(m_PlaneId, DRM_MODE_OBJECT_PLANE, "SRC_X");
+    m_PlanePropIds.srcY = getPropertyIdByName(m_PlaneId, DRM_MODE_OBJECT_PLANE, "SRC_Y");
+    m_PlanePropIds.srcW = getPropertyIdByName(m_PlaneId, DRM_MODE_OBJECT_PLANE, "SRC_W");
+    m_PlanePropIds.srcH = getPropertyIdByName(m_PlaneId, DRM_MODE_OBJECT_PLANE, "SRC_H");
+    m_PlanePropIds.crtcX = getPropertyIdByName(m_PlaneId, DRM_MODE_OBJECT_PLANE, "CRTC_X");
+    m_PlanePropIds.crtcY = getPropertyIdByName(m_PlaneId, DRM_MODE_OBJECT_PLANE, "CRTC_Y");
+    m_PlanePropIds.crtcW = getPropertyIdByName(m_PlaneId, DRM_MODE_OBJECT_PLANE, "CRTC_W");
+    m_PlanePropIds.crtcH = getPropertyIdByName(m_PlaneId, DRM_MODE_OBJECT_PLANE, "CRTC_H");
+    if (!m_PlanePropIds.fbId || !m_PlanePropIds.crtcId ||
+            !m_PlanePropIds.srcX || !m_PlanePropIds.srcY || !m_PlanePropIds.srcW || !m_PlanePropIds.srcH ||
+            !m_PlanePropIds.crtcX || !m_PlanePropIds.crtcY || !m_PlanePropIds.crtcW || !m_PlanePropIds.crtcH) {
+        SDL_LogWarn(SDL_LOG_CATEGORY_APPLICATION,
+                    "DRM plane %u is missing required atomic properties",
+                    m_PlaneId);
+        return false;
+    }
+
+    m_EventThread = SDL_CreateThread(DrmRenderer::eventThreadProc, "DrmEvents", this);
+    if (m_EventThread == nullptr) {
+        SDL_LogError(SDL_LOG_CATEGORY_APPLICATION,
+                     "Failed to create DRM event thread: %s",
+                     SDL_GetError());
+        return false;
+    }
+
+    SDL_LogInfo(SDL_LOG_CATEGORY_APPLICATION,
+                "Using DRM atomic commits with non-blocking page flips");
+    return true;
+}
+
+bool DrmRenderer::commitAtomic(uint32_t fbId, const SDL_Rect& dst, int srcWidth, int srcHeight, uint32_t lastFbId, uint64_t renderStartTimeUs)
+{
+    std::vector<PendingProperty> pendingProperties;
+
+    drmModeAtomicReqPtr req = drmModeAtomicAlloc();
+    if (req == nullptr) {
+        SDL_LogError(SDL_LOG_CATEGORY_APPLICATION,
+                     "drmModeAtomicAlloc() failed");
+        return false;
+    }
+
+    // We hold the event lock until the flip state is updated, so the
+    // event thread can't process this commit's page flip before then.
+    SDL_LockMutex(m_EventLock);
+
+    // Batch up any plane, connector, and CRTC property changes with this frame.
+    // Connector properties like HDR_OUTPUT_METADATA may require a modeset, but
+    // plane property changes never do.
+    bool allowModeset = false;
+    pendingProperties.swap(m_PendingProperties);
+    for (const auto& pending : pendingProperties) {
+        drmModeAtomicAddProperty(req, pending.objectId, pending.propId, pending.value);
+        if (pending.objectType != DRM_MODE_OBJECT_PLANE) {
+            allowModeset = true;
+        }
+    }
+
+    drmModeAtomicAddProperty(req, m_PlaneId, m_PlanePropIds.fbId, fbId);
+    drmModeAtomicAddProperty(req, m_PlaneId, m_PlanePropIds.crtcId, m_CrtcId);
+    drmModeAtomicAddProperty(req, m_PlaneId, m_PlanePropIds.srcX, 0);
+    drmModeAtomicAddProperty(req, m_PlaneId, m_PlanePropIds.srcY, 0);
+    drmModeAtomicAddProperty(req, m_PlaneId, m_PlanePropIds.srcW, (uint64_t)srcWidth << 16);
+    drmModeAtomicAddProperty(req, m_PlaneId, m_PlanePropIds.srcH, (uint64_t)srcHeight << 16);
+    drmModeAtomicAddProperty(req, m_PlaneId, m_PlanePropIds.crtcX, dst.x);
+    drmModeAtomicAddProperty(req, m_PlaneId, m_PlanePropIds.crtcY, dst.y);
+    drmModeAtomicAddProperty(req, m_PlaneId, m_PlanePropIds.crtcW, dst.w);
+    drmModeAtomicAddProperty(req, m_PlaneId, m_PlanePropIds.crtcH, dst.h);
+
+    // After a page flip timed out, a blocking commit waits for the display
+    // to finish any earlier commits as well as this one
+    uint32_t flags = m_FlipTimedOut ? 0 : DRM_MODE_ATOMIC_NONBLOCK | DRM_MODE_PAGE_FLIP_EVENT;
+    if (allowModeset) {
+        flags |= DRM_MODE_ATOMIC_ALLOW_MODESET;
+    }
+
+    uint32_t releasedFbIds[2] = {};
+    int err = drmModeAtomicCommit(m_DrmFd, req, flags, this);
+    if (err == 0 && m_FlipTimedOut) {
+        // Both FBs that the timed out flip could have left on screen are gone now
+        m_LastBlockingCommitUs = getMonotonicTimeUs();
+        m_PresentLatencyUs = m_LastBlockingCommitUs - renderStartTimeUs;
+        releasedFbIds[0] = m_FlipTimedOutFbId;
+        releasedFbIds[1] = lastFbId != fbId ? lastFbId : 0;
+        m_FlipTimedOutFbId = 0;
+        m_FlipTimedOut = false;
+
+        SDL_LogInfo(SDL_LOG_CATEGORY_APPLICATION,
+                    "Recovered from DRM page flip timeout");
+    }
+    else if (err == 0) {
+        m_FlipPending = true;
+        m_FlipSupersededFbId = lastFbId != fbId ? lastFbId : 0;
+        m_FlipRenderStartTimeUs = renderStartTimeUs;
+    }
+    else {
+        SDL_LogError(SDL_LOG_CATEGORY_APPLICATION,
+                     "drmModeAtomicCommit() failed: %d",
+                     errno);
+
+        // Retry our property changes with the next frame unless they've been superseded
+        for (const auto& pending : pendingProperties) {
+            bool superseded = false;
+            for (const auto& newer : m_PendingProperties) {
+                if (newer.objectId == pending.objectId && newer.propId == pending.propId) {
+                    superseded = true;
+                    break;
+                }
+            }
+            if (!superseded) {
+                m_PendingProperties.push_back(pending);
+            }
+        }
+    }
+
+    SDL_UnlockMutex(m_EventLock);
+    drmModeAtomicFree(req);
+
+    for (uint32_t releasedFbId : releasedFbIds) {
+        if (releasedFbId != fbId) {
+            releaseFb(releasedFbId);
+        }
+    }
+
+    return err == 0;
+}
+
+void DrmRenderer::pageFlipHandler(int, unsigned int, unsigned int tvSec, unsigned int tvUsec, unsigned int, void* userData)
+{
+    DrmRenderer* me = (DrmRenderer*)userData;
+
+    // Page flip timestamps are CLOCK_MONOTONIC, like getMonotonicTimeUs()
+    uint64_t flipTimeUs = (uint64_t)tvSec * 1000000 + tvUsec;
+
+    SDL_LockMutex(me->m_EventLock);
+
+    // This is the late event for a flip we gave up on, which the blocking
+    // commit after it already accounted for
+    if (flipTimeUs < me->m_LastBlockingCommitUs) {
+        SDL_UnlockMutex(me->m_EventLock);
+        return;
+    }
+
+    if (flipTimeUs >= me->m_FlipRenderStartTimeUs) {
+        me->m_PresentLatencyUs = flipTimeUs - me->m_FlipRenderStartTimeUs;
+    }
+
+    // The rendering thread frees the superseded FB before its next commit
+    SDL_assert(me->m_RetiredFbId == 0);
+    me->m_RetiredFbId = me->m_FlipSupersededFbId;
+    me->m_FlipSupersededFbId = 0;
+    me->m_FlipPending = false;
+    SDL_CondSignal(me->m_FlipDoneCond);
+    SDL_UnlockMutex(me->m_EventLock);
+}
+
+void DrmRenderer::sequenceHandler(int fd, uint64_t, uint64_t, uint64_t userData)
+{
+    DrmRenderer* me = (DrmRenderer*)(uintptr_t)userData;
+
+    SDL_LockMutex(me->m_EventLock);
+    if (me->m_VsyncPacer != nullptr) {
+        me->m_VsyncPacer->signalVsync();
+
+        // Ask for an event on the next V-blank too
+        if (drmCrtcQueueSequence(fd, me->m_CrtcId, DRM_CRTC_SEQUENCE_RELATIVE, 1, nullptr, userData) < 0) {
+            SDL_LogError(SDL_LOG_CATEGORY_APPLICATION,
+                         "drmCrtcQueueSequence() failed: %d",
+                         errno);
+        }
+    }
+    SDL_UnlockMutex(me->m_EventLock);
+}
+
+int DrmRenderer::eventThreadProc(void* context)
+{
+    DrmRenderer* me = (DrmRenderer*)context;
+
+    drmEventContext eventContext = {};
+    eventContext.version = 4;
+    eventContext.page_flip_handler2 = DrmRenderer::pageFlipHandler;
+    eventContext.sequence_handler = DrmRenderer::sequenceHandler;
+
+    SDL_SetThreadPriority(SDL_THREAD_PRIORITY_HIGH);
+
+    while (!SDL_AtomicGet(&me->m_EventThreadStopping)) {
+        struct pollfd pfd = {};
+        pfd.fd = me->m_DrmFd;
+        pfd.events = POLLIN;
+
+        // Wake up periodically to check if we're stopping
+        int err = poll(&pfd, 1, 100);
+        if (err > 0) {
+            drmHandleEvent(me->m_DrmFd, &eventContext);
+        }
+        else if (err < 0 && errno != EINTR) {
+            SDL_LogError(SDL_LOG_CATEGORY_APPLICATION,
+                         "poll() failed on DRM FD: %d",
+                         errno);
+            break;
+        }
+    }
+
+    return 0;
+}
+
+bool DrmRenderer::setVsyncPacer(Pacer* pacer)
+{
+    bool ret = true;
+
+    SDL_LockMutex(m_EventLock);
+    bool wasStopped = m_VsyncPacer == nullptr;
+    m_VsyncPacer = pacer;
+    if (pacer != nullptr && wasStopped) {
+        // Start the chain of V-blank events that drives Pacer
+        if (drmCrtcQueueSequence(m_DrmFd, m_CrtcId, DRM_CRTC_SEQUENCE_RELATIVE, 1, nullptr, (uint64_t)(uintptr_t)this) < 0) {
+            SDL_LogError(SDL_LOG_CATEGORY_APPLICATION,
+                         "drmCrtcQueueSequence() failed: %d",
+                         errno);
+            m_VsyncPacer = nullptr;
+            ret = false;
+        }
+    }
+    SDL_UnlockMutex(m_EventLock);
+
+    return ret;
+}
+
+// Drives Pacer from V-blank events on our CRTC while using atomic commits
+class DrmVsyncSource : public IVsyncSource
+{
+public:
+    DrmVsyncSource(DrmRenderer* renderer, Pacer* pacer)
+        : m_Renderer(renderer),
+          m_Pacer(pacer)
+    {
+    }
+
+    virtual ~DrmVsyncSource() override
+    {
+        m_Renderer->setVsyncPacer(nullptr);
+    }
+
+    virtual bool initialize(SDL_Window*, int) override
+    {
+        return m_Renderer->setVsyncPacer(m_Pacer);
+    }
+
+    virtual bool isAsync() override
+    {
+        return true;
+    }
+
+private:
+    DrmRenderer* m_Renderer;
+    Pacer* m_Pacer;
+};
+
+IVsyncSource* DrmRenderer::createVsyncSource(Pacer* pacer)
+{
+    // V-blank events are only read by our event thread in atomic mode
+    if (!m_UseAtomic) {
+        return nullptr;
+    }
+
+    return new DrmVsyncSource(this, pacer);
+}
+
+bool DrmRenderer::getDirectScanout(bool* directScanout)
+{
+    // We're only asked this when we're the frontend renderer, and then
+    // we always commit frames straight to a KMS plane.
+    *directScanout = true;
+    return true;
+}
+
+bool DrmRenderer::getPresentLatency(uint64_t* latencyUs)
+{
+    SDL_LockMutex(m_EventLock);
+    *latencyUs = m_PresentLatencyUs;
+    m_PresentLatencyUs = 0;
+    SDL_UnlockMutex(m_EventLock);
+
+    return *latencyUs != 0;
 }
 
 bool DrmRenderer::needsTestFrame()
@@ -1487,4 +2135,8 @@ void DrmRenderer::freeEGLImages(EGLDisplay dpy, EGLImage images[EGL_MAX_PLANES])
     m_EglImageFactory.freeEGLImages(dpy, images);
 }
 
+void DrmRenderer::cleanupEGL(EGLDisplay dpy) {
+    m_EglImageFactory.freeImageCache(dpy);
+}
+
 #endif
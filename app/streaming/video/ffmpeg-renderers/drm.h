@@ -10,7 +10,9 @@
 #include <xf86drm.h>
 #include <xf86drmMode.h>
 
+#include <list>
 #include <set>
+#include <vector>
 
 // Newer libdrm headers have these HDR structs, but some older ones don't.
 namespace DrmDefs
@@ -59,9 +61,12 @@ public:
     virtual enum AVPixelFormat getPreferredPixelFormat(int videoFormat) override;
     virtual bool isPixelFormatSupported(int videoFormat, AVPixelFormat pixelFormat) override;
     virtual int getRendererAttributes() override;
+    virtual bool getPresentLatency(uint64_t* latencyUs) override;
+    virtual bool getDirectScanout(bool* directScanout) override;
     virtual bool needsTestFrame() override;
     virtual bool testRenderFrame(AVFrame* frame) override;
     virtual bool isDirectRenderingSupported() override;
+    virtual IVsyncSource* createVsyncSource(Pacer* pacer) override;
     virtual int getDecoderColorspace() override;
     virtual void setHdrMode(bool enabled) override;
 #ifdef HAVE_EGL
@@ -70,14 +75,46 @@ public:
     virtual bool initializeEGL(EGLDisplay dpy, const EGLExtensions &ext) override;
     virtual ssize_t exportEGLImages(AVFrame *frame, EGLDisplay dpy, EGLImage images[EGL_MAX_PLANES]) override;
     virtual void freeEGLImages(EGLDisplay dpy, EGLImage[EGL_MAX_PLANES]) override;
+    virtual void cleanupEGL(EGLDisplay dpy) override;
 #endif
 
 private:
+    friend class DrmVsyncSource;
+
     bool getPropertyByName(drmModeObjectPropertiesPtr props, const char* name, uint64_t *value);
+    uint32_t getPropertyIdByName(uint32_t objectId, uint32_t objectType, const char* name);
+    int setObjectProperty(uint32_t objectId, uint32_t objectType, drmModePropertyPtr prop, uint64_t value);
+    bool initializeAtomic();
+    bool commitAtomic(uint32_t fbId, const SDL_Rect& dst, int srcWidth, int srcHeight, uint32_t lastFbId, uint64_t renderStartTimeUs);
+    bool setVsyncPacer(Pacer* pacer);
+    static int eventThreadProc(void* context);
+    static void pageFlipHandler(int fd, unsigned int sequence, unsigned int tvSec, unsigned int tvUsec, unsigned int crtcId, void* userData);
+    static void sequenceHandler(int fd, uint64_t sequence, uint64_t ns, uint64_t userData);
     const char* getDrmColorEncodingValue(AVFrame* frame);
     const char* getDrmColorRangeValue(AVFrame* frame);
     bool mapSoftwareFrame(AVFrame* frame, AVDRMFrameDescriptor* mappedFrame);
     bool addFbForFrame(AVFrame* frame, uint32_t* newFbId, bool testMode);
+    void releaseFb(uint32_t fbId);
+
+    struct FbCacheKey {
+        uint64_t buffer;
+        uint64_t modifier;
+        uint32_t offset;
+        uint32_t format;
+        int width;
+        int height;
+
+        bool operator==(const FbCacheKey& other) const {
+            return buffer == other.buffer && modifier == other.modifier &&
+                   offset == other.offset && format == other.format &&
+                   width == other.width && height == other.height;
+        }
+    };
+
+    bool getFbCacheKey(AVFrame* frame, FbCacheKey* key);
+    uint32_t lookupCachedFb(const FbCacheKey& key);
+    void insertCachedFb(const FbCacheKey& key, uint32_t fbId);
+    void flushFbCache();
     static bool drmFormatMatchesVideoFormat(uint32_t drmFormat, int videoFormat);
 
     IFFmpegRenderer* m_BackendRenderer;
@@ -100,11 +137,57 @@ private:
     drmModePropertyPtr m_ColorRangeProp;
     drmModePropertyPtr m_HdrOutputMetadataProp;
     drmModePropertyPtr m_ColorspaceProp;
+    drmModePropertyPtr m_VrrEnabledProp;
     drmVersionPtr m_Version;
     uint32_t m_HdrOutputMetadataBlobId;
     SDL_Rect m_OutputRect;
+    uint64_t m_PresentLatencyUs; // guarded by m_EventLock
     std::set<uint32_t> m_SupportedPlaneFormats;
 
+    // FB objects for hardware decoder buffers, most recently used first.
+    // These stay alive until they're evicted or the decoder's frames context
+    // changes, so releaseFb() must be used instead of drmModeRmFB() for
+    // m_CurrentFbId.
+    static constexpr size_t k_MaxCachedFbs = 32;
+    std::list<std::pair<FbCacheKey, uint32_t>> m_FbCache;
+
+    // Held so the frames context the cached FBs came from can't be freed and
+    // another allocated at the same address while they're cached
+    AVBufferRef* m_FbCacheFramesContext;
+
+    // Atomic commit (DRM_ATOMIC=1) state. Page flip and V-blank events are
+    // read by m_EventThread, which shares the state below m_EventLock with
+    // the rendering thread.
+    bool m_UseAtomic;
+    struct {
+        uint32_t fbId;
+        uint32_t crtcId;
+        uint32_t srcX, srcY, srcW, srcH;
+        uint32_t crtcX, crtcY, crtcW, crtcH;
+    } m_PlanePropIds;
+    SDL_Thread* m_EventThread;
+    SDL_atomic_t m_EventThreadStopping;
+    SDL_mutex* m_EventLock;
+    SDL_cond* m_FlipDoneCond;
+    struct PendingProperty {
+        uint32_t objectId;
+        uint32_t objectType;
+        uint32_t propId;
+        uint64_t value;
+    };
+    std::vector<PendingProperty> m_PendingProperties;
+    bool m_FlipPending;
+    // Set when a page flip never completed. The next commit is made blocking
+    // so we know the display has caught up, and flip events from before it
+    // (by timestamp) are ignored.
+    bool m_FlipTimedOut;
+    uint32_t m_FlipTimedOutFbId;
+    uint64_t m_LastBlockingCommitUs;
+    uint32_t m_FlipSupersededFbId;
+    uint32_t m_RetiredFbId;
+    uint64_t m_FlipRenderStartTimeUs;
+    Pacer* m_VsyncPacer;
+
     static constexpr int k_SwFrameCount = 2;
     SwFrameMapper m_SwFrameMapper;
     int m_CurrentSwFrameIdx;
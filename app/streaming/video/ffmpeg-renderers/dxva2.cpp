@@ -22,6 +22,9 @@ DEFINE_GUID(DXVADDI_Intel_ModeH264_E, 0x604F8E68,0x4951,0x4C54,0x88,0xFE,0xAB,0x
 DEFINE_GUID(DXVA2_ModeAV1_VLD_Profile0,0xb8be4ccb,0xcf53,0x46ba,0x8d,0x59,0xd6,0xb8,0xa6,0xda,0x5d,0x2a);
 DEFINE_GUID(DXVA2_ModeAV1_VLD_Profile1,0x6936ff0f,0x45b1,0x4163,0x9c,0xc1,0x64,0x6e,0xf6,0x94,0x61,0x08);
 
+// How long ffGetBuffer2() will wait for Pacer to release a surface
+#define DXVA2_POOL_WAIT_TIMEOUT_MS 100
+
 // This was incorrectly removed from public headers in FFmpeg 7.0
 #ifndef FF_DXVA2_WORKAROUND_INTEL_CLEARVIDEO
 #define FF_DXVA2_WORKAROUND_INTEL_CLEARVIDEO 2
@@ -38,12 +41,18 @@ typedef struct _VERTEX
 DXVA2Renderer::DXVA2Renderer(int decoderSelectionPass) :
     IFFmpegRenderer(RendererType::DXVA2),
     m_DecoderSelectionPass(decoderSelectionPass),
+    m_SurfaceCount(0),
     m_SurfacesUsed(0),
     m_Pool(nullptr),
+    m_PoolExhaustionWaits({0}),
+    m_PoolExhaustionWaitMs({0}),
     m_OverlayLock(0),
     m_FrameIndex(0),
     m_BlockingPresent(false),
-    m_DeviceQuirks(0)
+    m_DeviceQuirks(0),
+    m_AdapterVendorId(0),
+    m_AdapterDeviceId(0),
+    m_AdapterDriverVersion(0)
 {
     RtlZeroMemory(&m_DXVAContext, sizeof(m_DXVAContext));
 
@@ -55,6 +64,14 @@ DXVA2Renderer::~DXVA2Renderer()
 {
     DwmEnableMMCSS(FALSE);
 
+    if (SDL_AtomicGet(&m_PoolExhaustionWaits) != 0) {
+        SDL_LogWarn(SDL_LOG_CATEGORY_APPLICATION,
+                    "DXVA2 decoder waited for a free surface %d times (%d ms total) with %d surfaces",
+                    SDL_AtomicGet(&m_PoolExhaustionWaits),
+                    SDL_AtomicGet(&m_PoolExhaustionWaitMs),
+                    m_SurfaceCount);
+    }
+
     m_DecService.Reset();
     m_Decoder.Reset();
     m_Device.Reset();
@@ -88,7 +105,7 @@ AVBufferRef* DXVA2Renderer::ffPoolAlloc(void* opaque, FF_POOL_SIZE_TYPE)
 {
     DXVA2Renderer* me = reinterpret_cast<DXVA2Renderer*>(opaque);
 
-    if (me->m_SurfacesUsed < me->m_DecSurfaces.size()) {
+    if (me->m_SurfacesUsed < me->m_SurfaceCount) {
         SDL_LogInfo(SDL_LOG_CATEGORY_APPLICATION,
                     "DXVA2 decoder surface high-water mark: %d",
                     me->m_SurfacesUsed);
@@ -105,7 +122,7 @@ bool DXVA2Renderer::prepareDecoderContext(AVCodecContext* context, AVDictionary*
     m_DXVAContext.decoder = m_Decoder.Get();
     m_DXVAContext.cfg = &m_Config;
     m_DXVAContext.surface = m_DecSurfacesRaw.data();
-    m_DXVAContext.surface_count = (unsigned int)m_DecSurfacesRaw.size();
+    m_DXVAContext.surface_count = (unsigned int)m_SurfaceCount;
 
     context->hwaccel_context = &m_DXVAContext;
 
@@ -116,7 +133,7 @@ bool DXVA2Renderer::prepareDecoderContext(AVCodecContext* context, AVDictionary*
     )
 #endif
 
-    m_Pool = av_buffer_pool_init2(m_DecSurfaces.size(), this, ffPoolAlloc, nullptr);
+    m_Pool = av_buffer_pool_init2(m_SurfaceCount, this, ffPoolAlloc, nullptr);
     if (!m_Pool) {
         SDL_LogError(SDL_LOG_CATEGORY_APPLICATION,
                      "Failed create buffer pool");
@@ -135,7 +152,24 @@ int DXVA2Renderer::ffGetBuffer2(AVCodecContext* context, AVFrame* frame, int)
 
     frame->buf[0] = av_buffer_pool_get(me->m_Pool);
     if (!frame->buf[0]) {
-        return AVERROR(ENOMEM);
+        // Every surface is either a reference frame or held by Pacer. The surfaces
+        // are returned to the pool as Pacer renders or drops frames, so wait for
+        // one rather than failing the decode.
+        Uint32 waitStartTime = SDL_GetTicks();
+        do {
+            SDL_Delay(1);
+            frame->buf[0] = av_buffer_pool_get(me->m_Pool);
+        } while (!frame->buf[0] && !SDL_TICKS_PASSED(SDL_GetTicks(), waitStartTime + DXVA2_POOL_WAIT_TIMEOUT_MS));
+
+        SDL_AtomicIncRef(&me->m_PoolExhaustionWaits);
+        SDL_AtomicAdd(&me->m_PoolExhaustionWaitMs, (int)(SDL_GetTicks() - waitStartTime));
+
+        if (!frame->buf[0]) {
+            SDL_LogError(SDL_LOG_CATEGORY_APPLICATION,
+                         "No DXVA2 decoder surface became available after %d ms",
+                         DXVA2_POOL_WAIT_TIMEOUT_MS);
+            return AVERROR(ENOMEM);
+        }
     }
 
     frame->data[3] = frame->buf[0]->data;
@@ -252,7 +286,7 @@ bool DXVA2Renderer::initializeDecoder()
     SDL_assert(m_Desc.SampleHeight % 16 == 0);
     hr = m_DecService->CreateSurface(m_Desc.SampleWidth,
                                      m_Desc.SampleHeight,
-                                     (UINT)m_DecSurfacesRaw.size() - 1,
+                                     (UINT)m_SurfaceCount - 1,
                                      m_Desc.Format,
                                      D3DPOOL_DEFAULT,
                                      0,
@@ -267,13 +301,13 @@ bool DXVA2Renderer::initializeDecoder()
     }
 
     // Transfer ownership into ComPtrs
-    for (int i = 0; i < m_DecSurfaces.size(); i++) {
+    for (int i = 0; i < m_SurfaceCount; i++) {
         m_DecSurfaces[i].Attach(m_DecSurfacesRaw[i]);
     }
 
     hr = m_DecService->CreateVideoDecoder(chosenDeviceGuid, &m_Desc, &m_Config,
                                           m_DecSurfacesRaw.data(),
-                                          (UINT)m_DecSurfacesRaw.size(),
+                                          (UINT)m_SurfaceCount,
                                           &m_Decoder);
     if (FAILED(hr)) {
         SDL_LogError(SDL_LOG_CATEGORY_APPLICATION,
@@ -417,6 +451,10 @@ bool DXVA2Renderer::initializeQuirksForAdapter(IDirect3D9Ex* d3d9ex, int adapter
 
         hr = d3d9ex->GetAdapterIdentifier(adapterIndex, 0, &id);
         if (SUCCEEDED(hr)) {
+            m_AdapterVendorId = id.VendorId;
+            m_AdapterDeviceId = id.DeviceId;
+            m_AdapterDriverVersion = id.DriverVersion.QuadPart;
+
             if (id.VendorId == 0x8086) {
                 SDL_LogInfo(SDL_LOG_CATEGORY_APPLICATION,
                             "Avoiding IDirectXVideoProcessor API on Intel GPU");
@@ -735,6 +773,20 @@ bool DXVA2Renderer::initialize(PDECODER_PARAMETERS params)
     m_VideoWidth = params->width;
     m_VideoHeight = params->height;
 
+    // DXVA2 decoders are created with a fixed set of surfaces, so we must allocate
+    // enough up front for the codec's maximum reference frames, the frame being
+    // decoded, and every frame that Pacer may be holding for display.
+    bool ok;
+    m_SurfaceCount = qEnvironmentVariableIntValue("DXVA2_SURFACE_COUNT", &ok);
+    if (!ok || m_SurfaceCount <= 0) {
+        int maxRefFrames = (m_VideoFormat & VIDEO_FORMAT_MASK_AV1) ? 8 : 16;
+        m_SurfaceCount = maxRefFrames + 1 + PACER_MAX_HELD_FRAMES(params->enableFramePacing);
+    }
+    m_SurfaceCount = SDL_clamp(m_SurfaceCount, 2, DXVA2_MAX_SURFACES);
+    SDL_LogInfo(SDL_LOG_CATEGORY_APPLICATION,
+                "Using %d DXVA2 decoder surfaces",
+                m_SurfaceCount);
+
     RtlZeroMemory(&m_Desc, sizeof(m_Desc));
 
     int alignment;
@@ -979,6 +1031,18 @@ int DXVA2Renderer::getDecoderColorspace()
     }
 }
 
+bool DXVA2Renderer::getDriverVersion(uint32_t* vendorId, uint32_t* deviceId, uint64_t* driverVersion)
+{
+    if (m_AdapterDriverVersion == 0) {
+        return false;
+    }
+
+    *vendorId = m_AdapterVendorId;
+    *deviceId = m_AdapterDeviceId;
+    *driverVersion = m_AdapterDriverVersion;
+    return true;
+}
+
 int DXVA2Renderer::getDecoderCapabilities()
 {
     return CAPABILITY_REFERENCE_FRAME_INVALIDATION_HEVC |
@@ -23,6 +23,7 @@ public:
     virtual void notifyOverlayUpdated(Overlay::OverlayType type) override;
     virtual int getDecoderColorspace() override;
     virtual int getDecoderCapabilities() override;
+    virtual bool getDriverVersion(uint32_t* vendorId, uint32_t* deviceId, uint64_t* driverVersion) override;
 
 private:
     bool initializeDecoder();
@@ -57,14 +58,20 @@ private:
     int m_DisplayHeight;
 
     struct dxva_context m_DXVAContext;
-    std::array<Microsoft::WRL::ComPtr<IDirect3DSurface9>, 19> m_DecSurfaces;
-    std::array<IDirect3DSurface9*, 19> m_DecSurfacesRaw; // Referenced by m_DecSurfaces
+#define DXVA2_MAX_SURFACES 32
+    int m_SurfaceCount; // Number of valid entries in m_DecSurfaces
+    std::array<Microsoft::WRL::ComPtr<IDirect3DSurface9>, DXVA2_MAX_SURFACES> m_DecSurfaces;
+    std::array<IDirect3DSurface9*, DXVA2_MAX_SURFACES> m_DecSurfacesRaw; // Referenced by m_DecSurfaces
     DXVA2_ConfigPictureDecode m_Config;
     Microsoft::WRL::ComPtr<IDirectXVideoDecoderService> m_DecService;
     Microsoft::WRL::ComPtr<IDirectXVideoDecoder> m_Decoder;
     int m_SurfacesUsed;
     AVBufferPool* m_Pool;
 
+    // Written by the decoder thread when no free surface is available
+    SDL_atomic_t m_PoolExhaustionWaits;
+    SDL_atomic_t m_PoolExhaustionWaitMs;
+
     SDL_SpinLock m_OverlayLock;
     std::array<Microsoft::WRL::ComPtr<IDirect3DVertexBuffer9>, Overlay::OverlayMax> m_OverlayVertexBuffers;
     std::array<Microsoft::WRL::ComPtr<IDirect3DTexture9>, Overlay::OverlayMax> m_OverlayTextures;
@@ -86,4 +93,9 @@ private:
 #define DXVA2_QUIRK_WDDM_20_PLUS 0x04 // Unused
 #define DXVA2_QUIRK_MULTI_GPU 0x08
     int m_DeviceQuirks;
+
+    // Populated by initializeQuirksForAdapter(). 0 if unknown.
+    uint32_t m_AdapterVendorId;
+    uint32_t m_AdapterDeviceId;
+    uint64_t m_AdapterDriverVersion;
 };
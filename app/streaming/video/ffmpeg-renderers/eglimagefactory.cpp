@@ -1,6 +1,8 @@
 #include "eglimagefactory.h"
 
-#include <vector>
+#include <sys/stat.h>
+
+#include <algorithm>
 
 // Don't take a dependency on libdrm just for these constants
 #ifndef DRM_FORMAT_MOD_INVALID
@@ -27,7 +29,9 @@ EglImageFactory::EglImageFactory(IFFmpegRenderer* renderer) :
     m_eglCreateImageKHR(nullptr),
     m_eglDestroyImageKHR(nullptr),
     m_eglQueryDmaBufFormatsEXT(nullptr),
-    m_eglQueryDmaBufModifiersEXT(nullptr)
+    m_eglQueryDmaBufModifiersEXT(nullptr),
+    m_ImageCacheDisplay(EGL_NO_DISPLAY),
+    m_ImportFormatsDisplay(EGL_NO_DISPLAY)
 {
 }
 
@@ -208,31 +212,9 @@ ssize_t EglImageFactory::exportDRMImages(AVFrame* frame, AVDRMFrameDescriptor* d
     SDL_assert(attribIndex <= MAX_ATTRIB_COUNT);
 
     // Our EGLImages are non-planar, so we only populate the first entry
-    if (m_eglCreateImage) {
-        images[0] = m_eglCreateImage(dpy, EGL_NO_CONTEXT,
-                                     EGL_LINUX_DMA_BUF_EXT,
-                                     nullptr, attribs);
-        if (!images[0]) {
-            SDL_LogError(SDL_LOG_CATEGORY_APPLICATION,
-                         "eglCreateImage() Failed: %d", eglGetError());
-            return -1;
-        }
-    }
-    else {
-        // Cast the EGLAttrib array elements to EGLint for the KHR extension
-        EGLint intAttribs[MAX_ATTRIB_COUNT];
-        for (int i = 0; i < MAX_ATTRIB_COUNT; i++) {
-            intAttribs[i] = (EGLint)attribs[i];
-        }
-
-        images[0] = m_eglCreateImageKHR(dpy, EGL_NO_CONTEXT,
-                                        EGL_LINUX_DMA_BUF_EXT,
-                                        nullptr, intAttribs);
-        if (!images[0]) {
-            SDL_LogError(SDL_LOG_CATEGORY_APPLICATION,
-                         "eglCreateImageKHR() Failed: %d", eglGetError());
-            return -1;
-        }
+    images[0] = createImage(dpy, attribs, attribIndex);
+    if (!images[0]) {
+        return -1;
     }
 
     return 1;
@@ -391,31 +373,9 @@ ssize_t EglImageFactory::exportVAImages(AVFrame *frame, VADRMPRIMESurfaceDescrip
         attribs[attribIndex++] = EGL_NONE;
         SDL_assert(attribIndex <= EGL_ATTRIB_COUNT);
 
-        if (m_eglCreateImage) {
-            images[i] = m_eglCreateImage(dpy, EGL_NO_CONTEXT,
-                                         EGL_LINUX_DMA_BUF_EXT,
-                                         nullptr, attribs);
-            if (!images[i]) {
-                SDL_LogError(SDL_LOG_CATEGORY_APPLICATION,
-                             "eglCreateImage() Failed: %d", eglGetError());
-                goto fail;
-            }
-        }
-        else {
-            // Cast the EGLAttrib array elements to EGLint for the KHR extension
-            EGLint intAttribs[EGL_ATTRIB_COUNT];
-            for (int i = 0; i < attribIndex; i++) {
-                intAttribs[i] = (EGLint)attribs[i];
-            }
-
-            images[i] = m_eglCreateImageKHR(dpy, EGL_NO_CONTEXT,
-                                            EGL_LINUX_DMA_BUF_EXT,
-                                            nullptr, intAttribs);
-            if (!images[i]) {
-                SDL_LogError(SDL_LOG_CATEGORY_APPLICATION,
-                             "eglCreateImageKHR() Failed: %d", eglGetError());
-                goto fail;
-            }
+        images[i] = createImage(dpy, attribs, attribIndex);
+        if (!images[i]) {
+            goto fail;
         }
 
         ++count;
@@ -428,43 +388,66 @@ fail:
     return -1;
 }
 
-bool EglImageFactory::supportsImportingFormat(EGLDisplay dpy, EGLint format)
+void EglImageFactory::queryImportFormats(EGLDisplay dpy)
 {
-    if (!m_eglQueryDmaBufFormatsEXT) {
-        // These are the standard formats used for importing separate layers of NV12.
-        // We will assume all EGL implementations can handle these.
-        SDL_LogWarn(SDL_LOG_CATEGORY_APPLICATION,
-                    "Assuming R8 and GR88 format support because eglQueryDmaBufFormatsEXT() is not supported");
-        return format == DRM_FORMAT_R8 || format == DRM_FORMAT_GR88;
-    }
+    m_ImportFormats.clear();
+    m_ImportFormatsDisplay = dpy;
 
     // Get the number of formats
     EGLint numFormats;
     if (!m_eglQueryDmaBufFormatsEXT(dpy, 0, nullptr, &numFormats)) {
         SDL_LogError(SDL_LOG_CATEGORY_APPLICATION,
                      "eglQueryDmaBufFormatsEXT() #1 failed: %d", eglGetError());
-        return false;
+        return;
     }
     else if (numFormats == 0) {
         SDL_LogWarn(SDL_LOG_CATEGORY_APPLICATION,
                     "eglQueryDmaBufFormatsEXT() returned no supported formats!");
-        return false;
+        return;
     }
 
     std::vector<EGLint> formats(numFormats);
     if (!m_eglQueryDmaBufFormatsEXT(dpy, numFormats, formats.data(), &numFormats)) {
         SDL_LogError(SDL_LOG_CATEGORY_APPLICATION,
                      "eglQueryDmaBufFormatsEXT() #2 failed: %d", eglGetError());
-        return false;
+        return;
     }
 
+    m_ImportFormats.reserve(numFormats);
     for (EGLint i = 0; i < numFormats; i++) {
-        if (format == formats[i]) {
-            return true;
-        }
+        m_ImportFormats.push_back({ formats[i], false, {} });
+    }
+
+    std::sort(m_ImportFormats.begin(), m_ImportFormats.end(),
+              [](const ImportFormat& a, const ImportFormat& b) { return a.format < b.format; });
+}
+
+EglImageFactory::ImportFormat* EglImageFactory::findImportFormat(EGLDisplay dpy, EGLint format)
+{
+    if (dpy != m_ImportFormatsDisplay) {
+        queryImportFormats(dpy);
+    }
+
+    auto it = std::lower_bound(m_ImportFormats.begin(), m_ImportFormats.end(), format,
+                               [](const ImportFormat& a, EGLint format) { return a.format < format; });
+    if (it == m_ImportFormats.end() || it->format != format) {
+        return nullptr;
+    }
+
+    return &*it;
+}
+
+bool EglImageFactory::supportsImportingFormat(EGLDisplay dpy, EGLint format)
+{
+    if (!m_eglQueryDmaBufFormatsEXT) {
+        // These are the standard formats used for importing separate layers of NV12.
+        // We will assume all EGL implementations can handle these.
+        SDL_LogWarn(SDL_LOG_CATEGORY_APPLICATION,
+                    "Assuming R8 and GR88 format support because eglQueryDmaBufFormatsEXT() is not supported");
+        return format == DRM_FORMAT_R8 || format == DRM_FORMAT_GR88;
     }
 
-    return false;
+    return findImportFormat(dpy, format) != nullptr;
 }
 
 bool EglImageFactory::supportsImportingModifier(EGLDisplay dpy, EGLint format, EGLuint64KHR modifier)
@@ -474,51 +457,172 @@ bool EglImageFactory::supportsImportingModifier(EGLDisplay dpy, EGLint format, E
         return true;
     }
 
-    if (!m_eglQueryDmaBufModifiersEXT) {
+    if (!m_eglQueryDmaBufModifiersEXT || !m_eglQueryDmaBufFormatsEXT) {
         SDL_LogWarn(SDL_LOG_CATEGORY_APPLICATION,
                     "Assuming linear modifier support because eglQueryDmaBufModifiersEXT() is not supported");
         return false;
     }
 
-    // Get the number of modifiers
-    EGLint numModifiers;
-    if (!m_eglQueryDmaBufModifiersEXT(dpy, format, 0, nullptr, nullptr, &numModifiers)) {
-        SDL_LogError(SDL_LOG_CATEGORY_APPLICATION,
-                     "eglQueryDmaBufModifiersEXT() #1 failed: %d", eglGetError());
+    ImportFormat* importFormat = findImportFormat(dpy, format);
+    if (importFormat == nullptr) {
         return false;
     }
-    else if (numModifiers == 0) {
-        SDL_LogWarn(SDL_LOG_CATEGORY_APPLICATION,
-                    "eglQueryDmaBufModifiersEXT() returned no supported modifiers!");
-        return false;
+
+    if (!importFormat->modifiersQueried) {
+        importFormat->modifiersQueried = true;
+
+        // Get the number of modifiers
+        EGLint numModifiers;
+        if (!m_eglQueryDmaBufModifiersEXT(dpy, format, 0, nullptr, nullptr, &numModifiers)) {
+            SDL_LogError(SDL_LOG_CATEGORY_APPLICATION,
+                         "eglQueryDmaBufModifiersEXT() #1 failed: %d", eglGetError());
+            return false;
+        }
+        else if (numModifiers == 0) {
+            SDL_LogWarn(SDL_LOG_CATEGORY_APPLICATION,
+                        "eglQueryDmaBufModifiersEXT() returned no supported modifiers!");
+            return false;
+        }
+
+        std::vector<EGLuint64KHR> modifiers(numModifiers);
+        std::vector<EGLBoolean> externalOnly(numModifiers);
+        if (!m_eglQueryDmaBufModifiersEXT(dpy, format, numModifiers, modifiers.data(), externalOnly.data(), &numModifiers)) {
+            SDL_LogError(SDL_LOG_CATEGORY_APPLICATION,
+                         "eglQueryDmaBufModifiersEXT() #2 failed: %d", eglGetError());
+            return false;
+        }
+
+        importFormat->modifiers.reserve(numModifiers);
+        for (EGLint i = 0; i < numModifiers; i++) {
+            importFormat->modifiers.push_back({ modifiers[i], externalOnly[i] });
+        }
+
+        std::sort(importFormat->modifiers.begin(), importFormat->modifiers.end(),
+                  [](const ImportModifier& a, const ImportModifier& b) { return a.modifier < b.modifier; });
     }
 
-    std::vector<EGLuint64KHR> modifiers(numModifiers);
-    if (!m_eglQueryDmaBufModifiersEXT(dpy, format, numModifiers, modifiers.data(), nullptr, &numModifiers)) {
-        SDL_LogError(SDL_LOG_CATEGORY_APPLICATION,
-                     "eglQueryDmaBufModifiersEXT() #2 failed: %d", eglGetError());
-        return false;
+    auto it = std::lower_bound(importFormat->modifiers.begin(), importFormat->modifiers.end(), modifier,
+                               [](const ImportModifier& a, EGLuint64KHR modifier) { return a.modifier < modifier; });
+    return it != importFormat->modifiers.end() && it->modifier == modifier;
+}
+
+#endif
+
+static bool isDmaBufFdAttrib(EGLAttrib attrib)
+{
+    return attrib == EGL_DMA_BUF_PLANE0_FD_EXT ||
+           attrib == EGL_DMA_BUF_PLANE1_FD_EXT ||
+           attrib == EGL_DMA_BUF_PLANE2_FD_EXT ||
+           attrib == EGL_DMA_BUF_PLANE3_FD_EXT;
+}
+
+EGLImage EglImageFactory::createImage(EGLDisplay dpy, const EGLAttrib* attribs, int attribCount)
+{
+    EGLImage image;
+
+    // Cached images can't outlive the display they were created on
+    if (dpy != m_ImageCacheDisplay) {
+        freeImageCache(m_ImageCacheDisplay);
+        m_ImageCacheDisplay = dpy;
+    }
+
+    // Build the cache key, leaving it empty if we can't identify the buffers
+    std::vector<EGLAttrib> key(attribs, attribs + attribCount);
+    for (int i = 0; i + 1 < attribCount; i += 2) {
+        if (isDmaBufFdAttrib(key[i])) {
+            struct stat st;
+            if (fstat((int)key[i + 1], &st) < 0) {
+                key.clear();
+                break;
+            }
+
+            key[i + 1] = (EGLAttrib)st.st_ino;
+        }
+    }
+
+    if (!key.empty()) {
+        for (auto it = m_ImageCache.begin(); it != m_ImageCache.end(); it++) {
+            if (it->key == key) {
+                // Move this entry to the front of the LRU list
+                m_ImageCache.splice(m_ImageCache.begin(), m_ImageCache, it);
+                return m_ImageCache.front().image;
+            }
+        }
     }
 
-    for (EGLint i = 0; i < numModifiers; i++) {
-        if (modifier == modifiers[i]) {
-            return true;
+    if (m_eglCreateImage) {
+        image = m_eglCreateImage(dpy, EGL_NO_CONTEXT,
+                                 EGL_LINUX_DMA_BUF_EXT,
+                                 nullptr, attribs);
+        if (!image) {
+            SDL_LogError(SDL_LOG_CATEGORY_APPLICATION,
+                         "eglCreateImage() Failed: %d", eglGetError());
+            return nullptr;
+        }
+    }
+    else {
+        // Cast the EGLAttrib array elements to EGLint for the KHR extension
+        std::vector<EGLint> intAttribs(attribCount);
+        for (int i = 0; i < attribCount; i++) {
+            intAttribs[i] = (EGLint)attribs[i];
+        }
+
+        image = m_eglCreateImageKHR(dpy, EGL_NO_CONTEXT,
+                                    EGL_LINUX_DMA_BUF_EXT,
+                                    nullptr, intAttribs.data());
+        if (!image) {
+            SDL_LogError(SDL_LOG_CATEGORY_APPLICATION,
+                         "eglCreateImageKHR() Failed: %d", eglGetError());
+            return nullptr;
+        }
+    }
+
+    if (!key.empty()) {
+        m_ImageCache.push_front({ std::move(key), image });
+
+        // It's safe to destroy an EGLImage that's still bound to a texture,
+        // since the texture keeps its own reference to the buffer.
+        if (m_ImageCache.size() > k_MaxCachedImages) {
+            destroyImage(dpy, m_ImageCache.back().image);
+            m_ImageCache.pop_back();
         }
     }
 
-    return false;
+    return image;
 }
 
-#endif
+void EglImageFactory::destroyImage(EGLDisplay dpy, EGLImage image)
+{
+    if (m_eglDestroyImage) {
+        m_eglDestroyImage(dpy, image);
+    }
+    else {
+        m_eglDestroyImageKHR(dpy, image);
+    }
+}
+
+void EglImageFactory::freeImageCache(EGLDisplay dpy)
+{
+    for (auto& cachedImage : m_ImageCache) {
+        destroyImage(dpy, cachedImage.image);
+    }
+    m_ImageCache.clear();
+}
 
 void EglImageFactory::freeEGLImages(EGLDisplay dpy, EGLImage images[EGL_MAX_PLANES]) {
     for (size_t i = 0; i < EGL_MAX_PLANES; ++i) {
         if (images[i] != nullptr) {
-            if (m_eglDestroyImage) {
-                m_eglDestroyImage(dpy, images[i]);
+            // Cached images stay alive for the next frame from this surface
+            bool cached = false;
+            for (auto& cachedImage : m_ImageCache) {
+                if (cachedImage.image == images[i]) {
+                    cached = true;
+                    break;
+                }
             }
-            else {
-                m_eglDestroyImageKHR(dpy, images[i]);
+
+            if (!cached) {
+                destroyImage(dpy, images[i]);
             }
         }
     }
@@ -2,6 +2,9 @@
 
 #include "renderer.h"
 
+#include <list>
+#include <vector>
+
 #ifdef HAVE_LIBVA
 #include <va/va_drmcommon.h>
 #endif
@@ -25,7 +28,27 @@ public:
 
     void freeEGLImages(EGLDisplay dpy, EGLImage images[EGL_MAX_PLANES]);
 
+    // Destroys all cached EGLImages. This must be called before the
+    // EGLDisplay is terminated.
+    void freeImageCache(EGLDisplay dpy);
+
 private:
+    EGLImage createImage(EGLDisplay dpy, const EGLAttrib* attribs, int attribCount);
+    void destroyImage(EGLDisplay dpy, EGLImage image);
+
+    struct ImportModifier {
+        EGLuint64KHR modifier;
+        EGLBoolean externalOnly;
+    };
+    struct ImportFormat {
+        EGLint format;
+        bool modifiersQueried;
+        std::vector<ImportModifier> modifiers; // Sorted by modifier
+    };
+
+    void queryImportFormats(EGLDisplay dpy);
+    ImportFormat* findImportFormat(EGLDisplay dpy, EGLint format);
+
     IFFmpegRenderer* m_Renderer;
     bool m_EGLExtDmaBuf;
     PFNEGLCREATEIMAGEPROC m_eglCreateImage;
@@ -34,4 +57,20 @@ private:
     PFNEGLDESTROYIMAGEKHRPROC m_eglDestroyImageKHR;
     PFNEGLQUERYDMABUFFORMATSEXTPROC m_eglQueryDmaBufFormatsEXT;
     PFNEGLQUERYDMABUFMODIFIERSEXTPROC m_eglQueryDmaBufModifiersEXT;
+
+    // EGLImages for decoder surfaces, most recently used first. The key
+    // is the attribute list used to create the image, with dma-buf FDs
+    // replaced by their inodes since each export gets new FDs.
+    static constexpr size_t k_MaxCachedImages = 64;
+    struct CachedImage {
+        std::vector<EGLAttrib> key;
+        EGLImage image;
+    };
+    std::list<CachedImage> m_ImageCache;
+    EGLDisplay m_ImageCacheDisplay;
+
+    // dma-buf formats the EGLDisplay can import, sorted by format. These are
+    // queried once per display, and each format's modifiers on first use.
+    std::vector<ImportFormat> m_ImportFormats;
+    EGLDisplay m_ImportFormatsDisplay;
 };
@@ -6,6 +6,7 @@
 #include "streaming/session.h"
 #include "streaming/streamutils.h"
 
+#include <QCryptographicHash>
 #include <QDir>
 
 #include <Limelight.h>
@@ -17,6 +18,42 @@
 #ifndef GL_UNPACK_ROW_LENGTH_EXT
 #define GL_UNPACK_ROW_LENGTH_EXT 0x0CF2
 #endif
+#ifndef GL_MAP_PERSISTENT_BIT_EXT
+#define GL_MAP_PERSISTENT_BIT_EXT 0x0040
+#endif
+#ifndef GL_MAP_COHERENT_BIT_EXT
+#define GL_MAP_COHERENT_BIT_EXT 0x0080
+#endif
+
+// These are part of OpenGL ES 3.0, which the GLES2 headers don't provide
+#ifndef GL_PIXEL_UNPACK_BUFFER
+#define GL_PIXEL_UNPACK_BUFFER 0x88EC
+#endif
+#ifndef GL_RED
+#define GL_RED 0x1903
+#endif
+#ifndef GL_RG
+#define GL_RG 0x8227
+#endif
+#ifndef GL_R8
+#define GL_R8 0x8229
+#endif
+#ifndef GL_RG8
+#define GL_RG8 0x822B
+#endif
+#ifndef GL_MAP_WRITE_BIT
+#define GL_MAP_WRITE_BIT 0x0002
+#endif
+#ifndef GL_MAP_INVALIDATE_BUFFER_BIT
+#define GL_MAP_INVALIDATE_BUFFER_BIT 0x0008
+#endif
+
+#ifndef GL_PROGRAM_BINARY_LENGTH_OES
+#define GL_PROGRAM_BINARY_LENGTH_OES 0x8741
+#endif
+#ifndef GL_NUM_PROGRAM_BINARY_FORMATS_OES
+#define GL_NUM_PROGRAM_BINARY_FORMATS_OES 0x87FE
+#endif
 
 typedef struct _OVERLAY_VERTEX
 {
@@ -26,7 +63,6 @@ typedef struct _OVERLAY_VERTEX
 
 /* TODO:
  *  - handle more pixel formats
- *  - handle software decoding
  */
 
 /* DOC/misc:
@@ -56,8 +92,13 @@ EGLRenderer::EGLRenderer(IFFmpegRenderer *backendRenderer)
         m_OverlayTextures{0},
         m_OverlayVbos{0},
         m_OverlayHasValidData{},
+        m_OverlayTextureSizes{},
+        m_OverlayViewportSizes{},
         m_ShaderProgram(0),
         m_OverlayShaderProgram(0),
+        m_SpecializeCsc(qgetenv("EGL_DISABLE_CSC_SPECIALIZATION") != "1"),
+        m_glGetProgramBinaryOES(nullptr),
+        m_glProgramBinaryOES(nullptr),
         m_Context(0),
         m_Window(nullptr),
         m_Backend(backendRenderer),
@@ -76,10 +117,27 @@ EGLRenderer::EGLRenderer(IFFmpegRenderer *backendRenderer)
         m_GlesMajorVersion(0),
         m_GlesMinorVersion(0),
         m_HasExtUnpackSubimage(false),
+        m_SwUploadBuffers{},
+        m_SwUploadBufferSize(0),
+        m_SwUploadBufferIndex(0),
+        m_SwTextureWidth(0),
+        m_SwTextureHeight(0),
+        m_UsePersistentMapping(false),
+        m_glMapBufferRange(nullptr),
+        m_glUnmapBuffer(nullptr),
+        m_glBufferStorageEXT(nullptr),
+        m_GpuTimerQueries{},
+        m_GpuTimerQueriesIssued(0),
+        m_GpuTimerQueriesRead(0),
+        m_glGenQueriesEXT(nullptr),
+        m_glDeleteQueriesEXT(nullptr),
+        m_glBeginQueryEXT(nullptr),
+        m_glEndQueryEXT(nullptr),
+        m_glGetQueryObjectuivEXT(nullptr),
+        m_glGetQueryObjectui64vEXT(nullptr),
         m_DummyRenderer(nullptr)
 {
-    SDL_assert(backendRenderer);
-    SDL_assert(backendRenderer->canExportEGL());
+    SDL_assert(!backendRenderer || backendRenderer->canExportEGL());
 
     // Save these global parameters so we can restore them in our destructor
     SDL_GL_GetAttribute(SDL_GL_CONTEXT_PROFILE_MASK, &m_OldContextProfileMask);
@@ -92,6 +150,10 @@ EGLRenderer::~EGLRenderer()
     if (m_Context) {
         // Reattach the GL context to the main thread for destruction
         SDL_GL_MakeCurrent(m_Window, m_Context);
+        if (m_Backend) {
+            m_Backend->cleanupEGL(m_EGLDisplay);
+        }
+        freeSwUploadBuffers();
         if (m_LastRenderSync != EGL_NO_SYNC) {
             SDL_assert(m_eglDestroySync != nullptr);
             m_eglDestroySync(m_EGLDisplay, m_LastRenderSync);
@@ -106,6 +168,10 @@ EGLRenderer::~EGLRenderer()
             SDL_assert(m_glDeleteVertexArraysOES != nullptr);
             m_glDeleteVertexArraysOES(1, &m_VAO);
         }
+        if (m_GpuTimerQueries[0] != 0) {
+            SDL_assert(m_glDeleteQueriesEXT != nullptr);
+            m_glDeleteQueriesEXT(EGL_GPU_TIMER_QUERY_COUNT, m_GpuTimerQueries);
+        }
         for (int i = 0; i < EGL_MAX_PLANES; i++) {
             if (m_Textures[i] != 0) {
                 glDeleteTextures(1, &m_Textures[i]);
@@ -165,26 +231,111 @@ bool EGLRenderer::notifyWindowChanged(PWINDOW_STATE_CHANGE_INFO info)
 
 bool EGLRenderer::isPixelFormatSupported(int videoFormat, AVPixelFormat pixelFormat)
 {
-    // Pixel format support should be determined by the backend renderer
-    return m_Backend->isPixelFormatSupported(videoFormat, pixelFormat);
+    if (m_Backend) {
+        // Pixel format support should be determined by the backend renderer
+        return m_Backend->isPixelFormatSupported(videoFormat, pixelFormat);
+    }
+    else if (videoFormat & (VIDEO_FORMAT_MASK_10BIT | VIDEO_FORMAT_MASK_YUV444)) {
+        return false;
+    }
+    else {
+        // These are the formats that uploadSoftwareFrame() can handle
+        return pixelFormat == AV_PIX_FMT_YUV420P || pixelFormat == AV_PIX_FMT_NV12;
+    }
 }
 
 AVPixelFormat EGLRenderer::getPreferredPixelFormat(int videoFormat)
 {
-    // Pixel format preference should be determined by the backend renderer
-    return m_Backend->getPreferredPixelFormat(videoFormat);
+    if (m_Backend) {
+        // Pixel format preference should be determined by the backend renderer
+        return m_Backend->getPreferredPixelFormat(videoFormat);
+    }
+    else {
+        // This is what software decoders output natively
+        return AV_PIX_FMT_YUV420P;
+    }
+}
+
+void EGLRenderer::updateOverlayVertices(Overlay::OverlayType type, int viewportWidth, int viewportHeight)
+{
+    SDL_FRect overlayRect;
+
+    // These overlay positions differ from the other renderers because OpenGL
+    // places the origin in the lower-left corner instead of the upper-left.
+    if (type == Overlay::OverlayStatusUpdate) {
+        // Bottom Left
+        overlayRect.x = 0;
+        overlayRect.y = 0;
+    }
+    else if (type == Overlay::OverlayDebug) {
+        // Top left
+        overlayRect.x = 0;
+        overlayRect.y = viewportHeight - m_OverlayTextureSizes[type].y;
+    } else {
+        SDL_assert(false);
+    }
+
+    overlayRect.w = m_OverlayTextureSizes[type].x;
+    overlayRect.h = m_OverlayTextureSizes[type].y;
+
+    // Convert screen space to normalized device coordinates
+    StreamUtils::screenSpaceToNormalizedDeviceCoords(&overlayRect, viewportWidth, viewportHeight);
+
+    OVERLAY_VERTEX verts[] =
+    {
+        {overlayRect.x + overlayRect.w, overlayRect.y + overlayRect.h, 1.0f, 0.0f},
+        {overlayRect.x, overlayRect.y + overlayRect.h, 0.0f, 0.0f},
+        {overlayRect.x, overlayRect.y, 0.0f, 1.0f},
+        {overlayRect.x, overlayRect.y, 0.0f, 1.0f},
+        {overlayRect.x + overlayRect.w, overlayRect.y, 1.0f, 1.0f},
+        {overlayRect.x + overlayRect.w, overlayRect.y + overlayRect.h, 1.0f, 0.0f}
+    };
+
+    glBindBuffer(GL_ARRAY_BUFFER, m_OverlayVbos[type]);
+    glBufferData(GL_ARRAY_BUFFER, sizeof(verts), verts, GL_STATIC_DRAW);
+
+    m_OverlayViewportSizes[type].x = viewportWidth;
+    m_OverlayViewportSizes[type].y = viewportHeight;
 }
 
 void EGLRenderer::renderOverlay(Overlay::OverlayType type, int viewportWidth, int viewportHeight)
 {
-    // Do nothing if this overlay is disabled
-    if (!Session::get()->getOverlayManager().isOverlayEnabled(type)) {
+    // Do nothing if this overlay is disabled or there's no session (like when benchmarking)
+    if (Session::get() == nullptr || !Session::get()->getOverlayManager().isOverlayEnabled(type)) {
+        return;
+    }
+
+    if (type == Overlay::OverlayPerfGraph) {
+        renderPerfGraph(viewportWidth, viewportHeight);
         return;
     }
 
     // Upload a new overlay texture if needed
-    SDL_Surface* newSurface = Session::get()->getOverlayManager().getUpdatedOverlaySurface(type);
-    if (newSurface != nullptr) {
+    SDL_Rect dirtyRect;
+    SDL_Surface* newSurface = Session::get()->getOverlayManager().getUpdatedOverlaySurface(type, &dirtyRect);
+    if (newSurface != nullptr &&
+            (m_GlesMajorVersion >= 3 || m_HasExtUnpackSubimage) &&
+            m_OverlayTextureSizes[type].x == newSurface->w &&
+            m_OverlayTextureSizes[type].y == newSurface->h) {
+        SDL_assert(!SDL_MUSTLOCK(newSurface));
+        SDL_assert(newSurface->format->format == SDL_PIXELFORMAT_ARGB8888);
+
+        // The texture already holds the previous overlay, so we only need to
+        // upload the lines that changed. The overlay size is unchanged.
+        if (!SDL_RectEmpty(&dirtyRect)) {
+            glBindTexture(GL_TEXTURE_2D, m_OverlayTextures[type]);
+            glPixelStorei(GL_UNPACK_ROW_LENGTH_EXT, newSurface->pitch / newSurface->format->BytesPerPixel);
+            glTexSubImage2D(GL_TEXTURE_2D, 0, dirtyRect.x, dirtyRect.y, dirtyRect.w, dirtyRect.h,
+                            GL_RGBA, GL_UNSIGNED_BYTE,
+                            (uint8_t*)newSurface->pixels +
+                                (dirtyRect.y * newSurface->pitch) +
+                                (dirtyRect.x * newSurface->format->BytesPerPixel));
+        }
+
+        SDL_FreeSurface(newSurface);
+        SDL_AtomicSet(&m_OverlayHasValidData[type], 1);
+    }
+    else if (newSurface != nullptr) {
         SDL_assert(!SDL_MUSTLOCK(newSurface));
         SDL_assert(newSurface->format->format == SDL_PIXELFORMAT_ARGB8888);
 
@@ -212,48 +363,17 @@ void EGLRenderer::renderOverlay(Overlay::OverlayType type, int viewportWidth, in
 
         glTexImage2D(GL_TEXTURE_2D, 0, GL_RGBA, newSurface->w, newSurface->h, 0, GL_RGBA, GL_UNSIGNED_BYTE,
                      packedPixelData ? packedPixelData : newSurface->pixels);
+        m_OverlayTextureSizes[type].x = newSurface->w;
+        m_OverlayTextureSizes[type].y = newSurface->h;
 
         if (packedPixelData) {
             free(packedPixelData);
         }
 
-        SDL_FRect overlayRect;
-
-        // These overlay positions differ from the other renderers because OpenGL
-        // places the origin in the lower-left corner instead of the upper-left.
-        if (type == Overlay::OverlayStatusUpdate) {
-            // Bottom Left
-            overlayRect.x = 0;
-            overlayRect.y = 0;
-        }
-        else if (type == Overlay::OverlayDebug) {
-            // Top left
-            overlayRect.x = 0;
-            overlayRect.y = viewportHeight - newSurface->h;
-        } else {
-            SDL_assert(false);
-        }
-
-        overlayRect.w = newSurface->w;
-        overlayRect.h = newSurface->h;
-
         SDL_FreeSurface(newSurface);
 
-        // Convert screen space to normalized device coordinates
-        StreamUtils::screenSpaceToNormalizedDeviceCoords(&overlayRect, viewportWidth, viewportHeight);
-
-        OVERLAY_VERTEX verts[] =
-        {
-            {overlayRect.x + overlayRect.w, overlayRect.y + overlayRect.h, 1.0f, 0.0f},
-            {overlayRect.x, overlayRect.y + overlayRect.h, 0.0f, 0.0f},
-            {overlayRect.x, overlayRect.y, 0.0f, 1.0f},
-            {overlayRect.x, overlayRect.y, 0.0f, 1.0f},
-            {overlayRect.x + overlayRect.w, overlayRect.y, 1.0f, 1.0f},
-            {overlayRect.x + overlayRect.w, overlayRect.y + overlayRect.h, 1.0f, 0.0f}
-        };
-
-        glBindBuffer(GL_ARRAY_BUFFER, m_OverlayVbos[type]);
-        glBufferData(GL_ARRAY_BUFFER, sizeof(verts), verts, GL_STATIC_DRAW);
+        // Force the overlay vertices to be recomputed for the new size
+        m_OverlayViewportSizes[type] = {};
 
         SDL_AtomicSet(&m_OverlayHasValidData[type], 1);
     }
@@ -263,6 +383,12 @@ void EGLRenderer::renderOverlay(Overlay::OverlayType type, int viewportWidth, in
         return;
     }
 
+    // The overlay position depends on the viewport size, which may have
+    // changed without a new overlay surface if the window was resized.
+    if (m_OverlayViewportSizes[type].x != viewportWidth || m_OverlayViewportSizes[type].y != viewportHeight) {
+        updateOverlayVertices(type, viewportWidth, viewportHeight);
+    }
+
     // Adjust the viewport to the whole window before rendering the overlays
     glViewport(0, 0, viewportWidth, viewportHeight);
 
@@ -280,17 +406,45 @@ void EGLRenderer::renderOverlay(Overlay::OverlayType type, int viewportWidth, in
     glDrawArrays(GL_TRIANGLES, 0, 6);
 }
 
+void EGLRenderer::renderPerfGraph(int viewportWidth, int viewportHeight)
+{
+    Overlay::PERF_GRAPH_VERTEX* verts = m_PerfGraphVertices;
+    int vertexCount = Session::get()->getOverlayManager().getPerfGraph().buildVertices(verts, viewportWidth, viewportHeight);
+    if (vertexCount == 0) {
+        return;
+    }
+
+    // Adjust the viewport to the whole window before rendering the overlays
+    glViewport(0, 0, viewportWidth, viewportHeight);
+
+    glUseProgram(m_OverlayShaderProgram);
+
+    // The graph changes every frame, so orphan the old buffer storage
+    glBindBuffer(GL_ARRAY_BUFFER, m_OverlayVbos[Overlay::OverlayPerfGraph]);
+    glBufferData(GL_ARRAY_BUFFER, vertexCount * sizeof(verts[0]), verts, GL_STREAM_DRAW);
+    glVertexAttribPointer(0, 2, GL_FLOAT, GL_FALSE, sizeof(verts[0]), (void*)offsetof(Overlay::PERF_GRAPH_VERTEX, x));
+    glEnableVertexAttribArray(0);
+    glVertexAttribPointer(1, 2, GL_FLOAT, GL_FALSE, sizeof(verts[0]), (void*)offsetof(Overlay::PERF_GRAPH_VERTEX, u));
+    glEnableVertexAttribArray(1);
+
+    // The overlay texture for the graph holds the color palette
+    glActiveTexture(GL_TEXTURE0);
+    glBindTexture(GL_TEXTURE_2D, m_OverlayTextures[Overlay::OverlayPerfGraph]);
+
+    glDrawArrays(GL_TRIANGLES, 0, vertexCount);
+}
+
 int EGLRenderer::loadAndBuildShader(int shaderType,
-                                    const char *file) {
+                                    const char *file,
+                                    const QByteArray& source) {
     GLuint shader = glCreateShader(shaderType);
     if (!shader || shader == GL_INVALID_ENUM) {
         EGL_LOG(Error, "Can't create shader: %d", glGetError());
         return 0;
     }
 
-    auto sourceData = Path::readDataFile(file);
-    GLint len = sourceData.size();
-    const char *buf = sourceData.data();
+    GLint len = source.size();
+    const char *buf = source.constData();
 
     glShaderSource(shader, 1, &buf, &len);
     glCompileShader(shader);
@@ -300,20 +454,111 @@ int EGLRenderer::loadAndBuildShader(int shaderType,
         char shaderLog[512];
         glGetShaderInfoLog(shader, sizeof (shaderLog), nullptr, shaderLog);
         EGL_LOG(Error, "Cannot load shader \"%s\": %s", file, shaderLog);
+        glDeleteShader(shader);
         return 0;
     }
 
     return shader;
 }
 
-unsigned EGLRenderer::compileShader(const char* vertexShaderSrc, const char* fragmentShaderSrc) {
+QString EGLRenderer::getProgramCacheFileName(const QByteArray& vertexSource, const QByteArray& fragmentSource) {
+    // Program binaries are only valid for the driver that produced them
+    QCryptographicHash hash(QCryptographicHash::Sha1);
+    hash.addData(m_ProgramCacheKey);
+    hash.addData(vertexSource);
+    hash.addData(fragmentSource);
+    return QString("eglprogram_%1.bin").arg(QString::fromLatin1(hash.result().toHex()));
+}
+
+unsigned EGLRenderer::loadCachedProgram(const QString& cacheFileName) {
+    QByteArray data = Path::readCacheFile(cacheFileName);
+    if (data.size() <= (int)sizeof(GLenum)) {
+        return 0;
+    }
+
+    // The binary format precedes the program binary itself
+    GLenum binaryFormat;
+    memcpy(&binaryFormat, data.constData(), sizeof(binaryFormat));
+
+    GLuint program = glCreateProgram();
+    if (!program) {
+        return 0;
+    }
+
+    m_glProgramBinaryOES(program, binaryFormat,
+                         data.constData() + sizeof(binaryFormat),
+                         data.size() - sizeof(binaryFormat));
+
+    // Drivers will reject binaries produced by a different driver build,
+    // so this isn't an error. We'll just compile the program again.
+    GLint status;
+    glGetProgramiv(program, GL_LINK_STATUS, &status);
+    if (!status) {
+        EGL_LOG(Info, "Discarding stale program binary: %s", qPrintable(cacheFileName));
+        while (glGetError() != GL_NO_ERROR);
+        glDeleteProgram(program);
+        Path::deleteCacheFile(cacheFileName);
+        return 0;
+    }
+
+    return program;
+}
+
+void EGLRenderer::storeCachedProgram(unsigned program, const QString& cacheFileName) {
+    GLint length = 0;
+    glGetProgramiv(program, GL_PROGRAM_BINARY_LENGTH_OES, &length);
+    if (length <= 0) {
+        return;
+    }
+
+    QByteArray data(sizeof(GLenum) + length, 0);
+    GLenum binaryFormat;
+    GLsizei written = 0;
+    m_glGetProgramBinaryOES(program, length, &written, &binaryFormat, data.data() + sizeof(GLenum));
+    if (written <= 0) {
+        while (glGetError() != GL_NO_ERROR);
+        return;
+    }
+
+    memcpy(data.data(), &binaryFormat, sizeof(binaryFormat));
+    data.resize(sizeof(GLenum) + written);
+    Path::writeCacheFile(cacheFileName, data);
+}
+
+unsigned EGLRenderer::compileShader(const char* vertexShaderSrc, const char* fragmentShaderSrc,
+                                    const QByteArray& fragmentDefines) {
     unsigned shader = 0;
+    QString cacheFileName;
+
+    QByteArray vertexSource = Path::readDataFile(vertexShaderSrc);
+    QByteArray fragmentSource = Path::readDataFile(fragmentShaderSrc);
+
+    // Defines go after the #version and #extension directives at the top
+    if (!fragmentDefines.isEmpty()) {
+        int insertPos = 0;
+        while (insertPos < fragmentSource.size() && fragmentSource.at(insertPos) == '#') {
+            int lineEnd = fragmentSource.indexOf('\n', insertPos);
+            if (lineEnd < 0) {
+                break;
+            }
+            insertPos = lineEnd + 1;
+        }
+        fragmentSource.insert(insertPos, fragmentDefines);
+    }
 
-    GLuint vertexShader = loadAndBuildShader(GL_VERTEX_SHADER, vertexShaderSrc);
+    if (m_glProgramBinaryOES != nullptr) {
+        cacheFileName = getProgramCacheFileName(vertexSource, fragmentSource);
+        shader = loadCachedProgram(cacheFileName);
+        if (shader) {
+            return shader;
+        }
+    }
+
+    GLuint vertexShader = loadAndBuildShader(GL_VERTEX_SHADER, vertexShaderSrc, vertexSource);
     if (!vertexShader)
         return false;
 
-    GLuint fragmentShader = loadAndBuildShader(GL_FRAGMENT_SHADER, fragmentShaderSrc);
+    GLuint fragmentShader = loadAndBuildShader(GL_FRAGMENT_SHADER, fragmentShaderSrc, fragmentSource);
     if (!fragmentShader)
         goto fragError;
 
@@ -335,6 +580,9 @@ unsigned EGLRenderer::compileShader(const char* vertexShaderSrc, const char* fra
         glDeleteProgram(shader);
         shader = 0;
     }
+    else if (m_glGetProgramBinaryOES != nullptr) {
+        storeCachedProgram(shader, cacheFileName);
+    }
 
 progFailCreate:
     glDeleteShader(fragmentShader);
@@ -343,30 +591,104 @@ fragError:
     return shader;
 }
 
-bool EGLRenderer::compileShaders() {
+QByteArray EGLRenderer::getCscDefines(const AVFrame* frame) {
+    std::array<float, 9> colorMatrix;
+    std::array<float, 3> yuvOffsets;
+    std::array<float, 2> chromaOffset;
+
+    getFramePremultipliedCscConstants(frame, colorMatrix, yuvOffsets);
+    getFrameChromaCositingOffsets(frame, chromaOffset);
+    chromaOffset[0] /= frame->width;
+    chromaOffset[1] /= frame->height;
+
+    // Always print a decimal point, so these are float literals in GLSL
+    auto toGlsl = [](const char* type, const float* values, size_t count) {
+        QByteArray value = QByteArray(type) + "(";
+        for (size_t i = 0; i < count; i++) {
+            if (i != 0) {
+                value += ", ";
+            }
+            value += QByteArray::number(values[i], 'f', 9);
+        }
+        return value + ")";
+    };
+
+    // mat3() takes its arguments in column-major order, like glUniformMatrix3fv()
+    return "#define CSC_SPECIALIZED 1\n"
+           "#define CSC_YUVMAT " + toGlsl("mat3", colorMatrix.data(), colorMatrix.size()) + "\n"
+           "#define CSC_OFFSET " + toGlsl("vec3", yuvOffsets.data(), yuvOffsets.size()) + "\n"
+           "#define CSC_CHROMA_OFFSET " + toGlsl("vec2", chromaOffset.data(), chromaOffset.size()) + "\n";
+}
+
+bool EGLRenderer::compileYuvShader(const AVFrame* frame) {
+    bool planar = m_EGLImagePixelFormat == AV_PIX_FMT_YUV420P;
+    const char* fragmentShader;
+    if (!m_Backend) {
+        // Software frames are uploaded into regular 2D textures
+        fragmentShader = planar ? "egl_sw_yuv420p.frag" : "egl_sw_nv12.frag";
+    }
+    else {
+        fragmentShader = "egl_nv12.frag";
+    }
+
+    QByteArray defines;
+    if (m_SpecializeCsc) {
+        defines = getCscDefines(frame);
+    }
+
+    // Nothing to do if the current program already matches this frame format
+    if (m_ShaderProgram && defines == m_ShaderProgramDefines) {
+        return true;
+    }
+
+    unsigned program = compileShader("egl_nv12.vert", fragmentShader, defines);
+    if (!program && !defines.isEmpty()) {
+        EGL_LOG(Warn, "Falling back to color conversion constants in uniforms");
+        m_SpecializeCsc = false;
+        defines.clear();
+        program = compileShader("egl_nv12.vert", fragmentShader);
+    }
+    if (!program) {
+        return false;
+    }
+
+    if (m_ShaderProgram) {
+        glDeleteProgram(m_ShaderProgram);
+    }
+    m_ShaderProgram = program;
+    m_ShaderProgramDefines = defines;
+
+    // These will be -1 if the constants were baked into the program
+    m_ShaderProgramParams[NV12_PARAM_YUVMAT] = glGetUniformLocation(m_ShaderProgram, "yuvmat");
+    m_ShaderProgramParams[NV12_PARAM_OFFSET] = glGetUniformLocation(m_ShaderProgram, "offset");
+    m_ShaderProgramParams[NV12_PARAM_CHROMA_OFFSET] = glGetUniformLocation(m_ShaderProgram, "chromaOffset");
+    m_ShaderProgramParams[NV12_PARAM_PLANE1] = glGetUniformLocation(m_ShaderProgram, "plane1");
+    m_ShaderProgramParams[NV12_PARAM_PLANE2] = glGetUniformLocation(m_ShaderProgram, "plane2");
+
+    // Set up constant uniforms
+    glUseProgram(m_ShaderProgram);
+    glUniform1i(m_ShaderProgramParams[NV12_PARAM_PLANE1], 0);
+    glUniform1i(m_ShaderProgramParams[NV12_PARAM_PLANE2], 1);
+    if (planar) {
+        m_ShaderProgramParams[NV12_PARAM_PLANE3] = glGetUniformLocation(m_ShaderProgram, "plane3");
+        glUniform1i(m_ShaderProgramParams[NV12_PARAM_PLANE3], 2);
+    }
+    glUseProgram(0);
+
+    return true;
+}
+
+bool EGLRenderer::compileShaders(const AVFrame* frame) {
     SDL_assert(!m_ShaderProgram);
     SDL_assert(!m_OverlayShaderProgram);
 
     SDL_assert(m_EGLImagePixelFormat != AV_PIX_FMT_NONE);
 
     // XXX: TODO: other formats
-    if (m_EGLImagePixelFormat == AV_PIX_FMT_NV12 || m_EGLImagePixelFormat == AV_PIX_FMT_P010) {
-        m_ShaderProgram = compileShader("egl_nv12.vert", "egl_nv12.frag");
-        if (!m_ShaderProgram) {
+    if (!m_Backend || m_EGLImagePixelFormat == AV_PIX_FMT_NV12 || m_EGLImagePixelFormat == AV_PIX_FMT_P010) {
+        if (!compileYuvShader(frame)) {
             return false;
         }
-
-        m_ShaderProgramParams[NV12_PARAM_YUVMAT] = glGetUniformLocation(m_ShaderProgram, "yuvmat");
-        m_ShaderProgramParams[NV12_PARAM_OFFSET] = glGetUniformLocation(m_ShaderProgram, "offset");
-        m_ShaderProgramParams[NV12_PARAM_CHROMA_OFFSET] = glGetUniformLocation(m_ShaderProgram, "chromaOffset");
-        m_ShaderProgramParams[NV12_PARAM_PLANE1] = glGetUniformLocation(m_ShaderProgram, "plane1");
-        m_ShaderProgramParams[NV12_PARAM_PLANE2] = glGetUniformLocation(m_ShaderProgram, "plane2");
-
-        // Set up constant uniforms
-        glUseProgram(m_ShaderProgram);
-        glUniform1i(m_ShaderProgramParams[NV12_PARAM_PLANE1], 0);
-        glUniform1i(m_ShaderProgramParams[NV12_PARAM_PLANE2], 1);
-        glUseProgram(0);
     }
     else if (m_EGLImagePixelFormat == AV_PIX_FMT_DRM_PRIME) {
         m_ShaderProgram = compileShader("egl_opaque.vert", "egl_opaque.frag");
@@ -426,6 +748,10 @@ bool EGLRenderer::initialize(PDECODER_PARAMETERS params)
         return false;
     }
 
+    if (!qgetenv("ML_UPSCALER").isEmpty() && qgetenv("ML_UPSCALER") != "bilinear") {
+        EGL_LOG(Warn, "Only bilinear upscaling is supported");
+    }
+
     // If we're using X11 GLX (both in SDL and Qt), don't use this renderer.
     // Switching between EGL and GLX can cause interoperability issues.
     if (strcmp(SDL_GetCurrentVideoDriver(), "x11") == 0 && !WMUtils::isX11EGLSafe()) {
@@ -534,23 +860,46 @@ bool EGLRenderer::initialize(PDECODER_PARAMETERS params)
     }
 
     const EGLExtensions eglExtensions(m_EGLDisplay);
-    if (!eglExtensions.isSupported("EGL_KHR_image_base") &&
-        !eglExtensions.isSupported("EGL_KHR_image")) {
-        EGL_LOG(Error, "EGL_KHR_image unsupported");
-        return false;
-    }
-    else if (!SDL_GL_ExtensionSupported("GL_OES_EGL_image")) {
-        EGL_LOG(Error, "GL_OES_EGL_image unsupported");
-        return false;
+    if (m_Backend) {
+        if (!eglExtensions.isSupported("EGL_KHR_image_base") &&
+            !eglExtensions.isSupported("EGL_KHR_image")) {
+            EGL_LOG(Error, "EGL_KHR_image unsupported");
+            return false;
+        }
+        else if (!SDL_GL_ExtensionSupported("GL_OES_EGL_image")) {
+            EGL_LOG(Error, "GL_OES_EGL_image unsupported");
+            return false;
+        }
+
+        if (!m_Backend->initializeEGL(m_EGLDisplay, eglExtensions))
+            return false;
+
+        if (!(m_glEGLImageTargetTexture2DOES = (typeof(m_glEGLImageTargetTexture2DOES))eglGetProcAddress("glEGLImageTargetTexture2DOES"))) {
+            EGL_LOG(Error,
+                    "EGL: cannot retrieve `glEGLImageTargetTexture2DOES` address");
+            return false;
+        }
     }
+    else {
+        // We need GLES 3.0 for single and dual channel textures and PBOs
+        if (m_GlesMajorVersion < 3) {
+            EGL_LOG(Error, "Software frame upload requires OpenGL ES 3.0");
+            return false;
+        }
 
-    if (!m_Backend->initializeEGL(m_EGLDisplay, eglExtensions))
-        return false;
+        m_glMapBufferRange = (typeof(m_glMapBufferRange))eglGetProcAddress("glMapBufferRange");
+        m_glUnmapBuffer = (typeof(m_glUnmapBuffer))eglGetProcAddress("glUnmapBuffer");
+        if (!m_glMapBufferRange || !m_glUnmapBuffer) {
+            EGL_LOG(Warn, "Failed to find buffer mapping functions");
 
-    if (!(m_glEGLImageTargetTexture2DOES = (typeof(m_glEGLImageTargetTexture2DOES))eglGetProcAddress("glEGLImageTargetTexture2DOES"))) {
-        EGL_LOG(Error,
-                "EGL: cannot retrieve `glEGLImageTargetTexture2DOES` address");
-        return false;
+            // We'll upload directly from the frame instead
+            m_glMapBufferRange = nullptr;
+            m_glUnmapBuffer = nullptr;
+        }
+        else if (SDL_GL_ExtensionSupported("GL_EXT_buffer_storage") &&
+                 qgetenv("EGL_DISABLE_PERSISTENT_MAPPING") != "1") {
+            m_glBufferStorageEXT = (typeof(m_glBufferStorageEXT))eglGetProcAddress("glBufferStorageEXT");
+        }
     }
 
     // Vertex arrays are an extension on OpenGL ES 2.0
@@ -595,6 +944,56 @@ bool EGLRenderer::initialize(PDECODER_PARAMETERS params)
         m_eglClientWaitSync = nullptr;
     }
 
+    // GPU timing is optional, so we just skip it if the driver can't do it
+    if (SDL_GL_ExtensionSupported("GL_EXT_disjoint_timer_query")) {
+        m_glGenQueriesEXT = (typeof(m_glGenQueriesEXT))eglGetProcAddress("glGenQueriesEXT");
+        m_glDeleteQueriesEXT = (typeof(m_glDeleteQueriesEXT))eglGetProcAddress("glDeleteQueriesEXT");
+        m_glBeginQueryEXT = (typeof(m_glBeginQueryEXT))eglGetProcAddress("glBeginQueryEXT");
+        m_glEndQueryEXT = (typeof(m_glEndQueryEXT))eglGetProcAddress("glEndQueryEXT");
+        m_glGetQueryObjectuivEXT = (typeof(m_glGetQueryObjectuivEXT))eglGetProcAddress("glGetQueryObjectuivEXT");
+        m_glGetQueryObjectui64vEXT = (typeof(m_glGetQueryObjectui64vEXT))eglGetProcAddress("glGetQueryObjectui64vEXT");
+
+        if (m_glGenQueriesEXT && m_glDeleteQueriesEXT && m_glBeginQueryEXT && m_glEndQueryEXT &&
+                m_glGetQueryObjectuivEXT && m_glGetQueryObjectui64vEXT) {
+            m_glGenQueriesEXT(EGL_GPU_TIMER_QUERY_COUNT, m_GpuTimerQueries);
+        }
+        else {
+            EGL_LOG(Warn, "Failed to find timer query functions");
+        }
+    }
+
+    // Program binaries let us skip compiling shaders on each stream start,
+    // which can take a long time on some embedded GPUs
+    if (SDL_GL_ExtensionSupported("GL_OES_get_program_binary") &&
+            qgetenv("EGL_DISABLE_PROGRAM_BINARY_CACHE") != "1") {
+        // Some drivers expose the extension without supporting any formats
+        GLint binaryFormatCount = 0;
+        glGetIntegerv(GL_NUM_PROGRAM_BINARY_FORMATS_OES, &binaryFormatCount);
+        if (binaryFormatCount > 0) {
+            m_glGetProgramBinaryOES = (typeof(m_glGetProgramBinaryOES))eglGetProcAddress("glGetProgramBinaryOES");
+            m_glProgramBinaryOES = (typeof(m_glProgramBinaryOES))eglGetProcAddress("glProgramBinaryOES");
+        }
+
+        if (m_glGetProgramBinaryOES && m_glProgramBinaryOES) {
+            m_ProgramCacheKey = QByteArray((const char*)glGetString(GL_VENDOR)) + '\n' +
+                                QByteArray((const char*)glGetString(GL_RENDERER)) + '\n' +
+                                QByteArray((const char*)glGetString(GL_VERSION)) + '\n';
+        }
+        else {
+            EGL_LOG(Warn, "Program binaries are unusable");
+            m_glGetProgramBinaryOES = nullptr;
+            m_glProgramBinaryOES = nullptr;
+        }
+    }
+
+    // Persistently mapped buffers require fences to know when the GPU is done with them
+    m_UsePersistentMapping = m_glBufferStorageEXT != nullptr && m_eglClientWaitSync != nullptr;
+    if (!m_Backend) {
+        EGL_LOG(Info, "Software frame upload: %s",
+                m_UsePersistentMapping ? "persistently mapped PBOs" :
+                m_glMapBufferRange ? "PBOs" : "direct");
+    }
+
     // SDL always uses swap interval 0 under the hood on Wayland systems,
     // because the compositor guarantees tear-free rendering. In this
     // situation, swap interval > 0 behaves as a frame pacing option
@@ -627,13 +1026,15 @@ bool EGLRenderer::initialize(PDECODER_PARAMETERS params)
         SDL_GL_SetSwapInterval(0);
     }
 
+    // EGLImages are bound to external textures, while software frames are uploaded to 2D textures
+    GLenum textureTarget = m_Backend ? GL_TEXTURE_EXTERNAL_OES : GL_TEXTURE_2D;
     glGenTextures(EGL_MAX_PLANES, m_Textures);
     for (size_t i = 0; i < EGL_MAX_PLANES; ++i) {
-        glBindTexture(GL_TEXTURE_EXTERNAL_OES, m_Textures[i]);
-        glTexParameteri(GL_TEXTURE_EXTERNAL_OES, GL_TEXTURE_MIN_FILTER, GL_LINEAR);
-        glTexParameteri(GL_TEXTURE_EXTERNAL_OES, GL_TEXTURE_MAG_FILTER, GL_LINEAR);
-        glTexParameteri(GL_TEXTURE_EXTERNAL_OES, GL_TEXTURE_WRAP_S, GL_CLAMP_TO_EDGE);
-        glTexParameteri(GL_TEXTURE_EXTERNAL_OES, GL_TEXTURE_WRAP_T, GL_CLAMP_TO_EDGE);
+        glBindTexture(textureTarget, m_Textures[i]);
+        glTexParameteri(textureTarget, GL_TEXTURE_MIN_FILTER, GL_LINEAR);
+        glTexParameteri(textureTarget, GL_TEXTURE_MAG_FILTER, GL_LINEAR);
+        glTexParameteri(textureTarget, GL_TEXTURE_WRAP_S, GL_CLAMP_TO_EDGE);
+        glTexParameteri(textureTarget, GL_TEXTURE_WRAP_T, GL_CLAMP_TO_EDGE);
     }
 
     glGenBuffers(Overlay::OverlayMax, m_OverlayVbos);
@@ -646,6 +1047,12 @@ bool EGLRenderer::initialize(PDECODER_PARAMETERS params)
         glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_WRAP_T, GL_CLAMP_TO_EDGE);
     }
 
+    // The performance graph samples its colors from a fixed palette texture.
+    // Like the overlay surfaces, it's ARGB8888 and swizzled by the shader.
+    glBindTexture(GL_TEXTURE_2D, m_OverlayTextures[Overlay::OverlayPerfGraph]);
+    glTexImage2D(GL_TEXTURE_2D, 0, GL_RGBA, Overlay::PerfGraphColorMax, 1, 0, GL_RGBA, GL_UNSIGNED_BYTE,
+                 Overlay::PerfGraph::getPaletteData());
+
     glEnable(GL_BLEND);
     glBlendFunc(GL_SRC_ALPHA, GL_ONE_MINUS_SRC_ALPHA);
 
@@ -659,10 +1066,10 @@ bool EGLRenderer::initialize(PDECODER_PARAMETERS params)
     return err == GL_NO_ERROR;
 }
 
-bool EGLRenderer::specialize() {
+bool EGLRenderer::specialize(const AVFrame* frame) {
     SDL_assert(!m_VAO);
 
-    if (!compileShaders())
+    if (!compileShaders(frame))
         return false;
 
     // The viewport should have the aspect ratio of the video stream
@@ -719,6 +1126,198 @@ void EGLRenderer::cleanupRenderContext()
     SDL_GL_MakeCurrent(m_Window, nullptr);
 }
 
+EGLSync EGLRenderer::createSync()
+{
+    if (m_eglCreateSync != nullptr) {
+        return m_eglCreateSync(m_EGLDisplay, EGL_SYNC_FENCE, nullptr);
+    }
+    else {
+        SDL_assert(m_eglCreateSyncKHR != nullptr);
+        return m_eglCreateSyncKHR(m_EGLDisplay, EGL_SYNC_FENCE, nullptr);
+    }
+}
+
+bool EGLRenderer::allocateSwUploadBuffers(size_t size)
+{
+    SDL_assert(m_SwUploadBufferSize == 0);
+
+    for (int i = 0; i < EGL_SW_UPLOAD_BUFFER_COUNT; i++) {
+        glGenBuffers(1, &m_SwUploadBuffers[i].pbo);
+        glBindBuffer(GL_PIXEL_UNPACK_BUFFER, m_SwUploadBuffers[i].pbo);
+
+        if (m_UsePersistentMapping) {
+            // Coherent mappings don't need explicit flushes after we write to them
+            const GLbitfield flags = GL_MAP_WRITE_BIT | GL_MAP_PERSISTENT_BIT_EXT | GL_MAP_COHERENT_BIT_EXT;
+            m_glBufferStorageEXT(GL_PIXEL_UNPACK_BUFFER, size, nullptr, flags);
+            m_SwUploadBuffers[i].mapping = m_glMapBufferRange(GL_PIXEL_UNPACK_BUFFER, 0, size, flags);
+            if (m_SwUploadBuffers[i].mapping == nullptr) {
+                EGL_LOG(Error, "glMapBufferRange() failed: %d", glGetError());
+                glBindBuffer(GL_PIXEL_UNPACK_BUFFER, 0);
+                m_SwUploadBufferSize = size;
+                freeSwUploadBuffers();
+                return false;
+            }
+        }
+        else {
+            glBufferData(GL_PIXEL_UNPACK_BUFFER, size, nullptr, GL_STREAM_DRAW);
+        }
+    }
+
+    glBindBuffer(GL_PIXEL_UNPACK_BUFFER, 0);
+    m_SwUploadBufferSize = size;
+    m_SwUploadBufferIndex = 0;
+    return true;
+}
+
+void EGLRenderer::freeSwUploadBuffers()
+{
+    if (m_SwUploadBufferSize == 0) {
+        return;
+    }
+
+    for (int i = 0; i < EGL_SW_UPLOAD_BUFFER_COUNT; i++) {
+        if (m_SwUploadBuffers[i].fence != EGL_NO_SYNC) {
+            m_eglDestroySync(m_EGLDisplay, m_SwUploadBuffers[i].fence);
+        }
+        if (m_SwUploadBuffers[i].mapping != nullptr) {
+            glBindBuffer(GL_PIXEL_UNPACK_BUFFER, m_SwUploadBuffers[i].pbo);
+            m_glUnmapBuffer(GL_PIXEL_UNPACK_BUFFER);
+        }
+        if (m_SwUploadBuffers[i].pbo != 0) {
+            glDeleteBuffers(1, &m_SwUploadBuffers[i].pbo);
+        }
+    }
+
+    glBindBuffer(GL_PIXEL_UNPACK_BUFFER, 0);
+    SDL_zero(m_SwUploadBuffers);
+    m_SwUploadBufferSize = 0;
+}
+
+bool EGLRenderer::uploadSoftwareFrame(AVFrame* frame)
+{
+    const AVPixFmtDescriptor* desc = av_pix_fmt_desc_get((AVPixelFormat)frame->format);
+    int planeCount = av_pix_fmt_count_planes((AVPixelFormat)frame->format);
+    int planeWidths[EGL_MAX_PLANES];
+    int planeHeights[EGL_MAX_PLANES];
+    size_t planeOffsets[EGL_MAX_PLANES];
+    size_t totalSize = 0;
+
+    if (frame->format != m_EGLImagePixelFormat) {
+        EGL_LOG(Error, "Unexpected software frame format: %d", frame->format);
+        return false;
+    }
+
+    SDL_assert(planeCount <= EGL_MAX_PLANES);
+    for (int i = 0; i < planeCount; i++) {
+        planeWidths[i] = i == 0 ? frame->width : AV_CEIL_RSHIFT(frame->width, desc->log2_chroma_w);
+        planeHeights[i] = i == 0 ? frame->height : AV_CEIL_RSHIFT(frame->height, desc->log2_chroma_h);
+
+        // We copy whole planes including row padding, so GL needs to handle the stride
+        if (frame->linesize[i] <= 0) {
+            EGL_LOG(Error, "Unsupported frame stride: %d", frame->linesize[i]);
+            return false;
+        }
+
+        planeOffsets[i] = totalSize;
+        totalSize += (size_t)frame->linesize[i] * planeHeights[i];
+    }
+
+    // The interleaved chroma plane of NV12 has 2 bytes per pixel
+    auto isChromaPair = [frame](int plane) {
+        return frame->format == AV_PIX_FMT_NV12 && plane == 1;
+    };
+
+    // Reallocate our textures if the frame size changed
+    if (frame->width != m_SwTextureWidth || frame->height != m_SwTextureHeight) {
+        for (int i = 0; i < planeCount; i++) {
+            glBindTexture(GL_TEXTURE_2D, m_Textures[i]);
+            glTexImage2D(GL_TEXTURE_2D, 0,
+                         isChromaPair(i) ? GL_RG8 : GL_R8,
+                         planeWidths[i], planeHeights[i], 0,
+                         isChromaPair(i) ? GL_RG : GL_RED,
+                         GL_UNSIGNED_BYTE, nullptr);
+        }
+
+        m_SwTextureWidth = frame->width;
+        m_SwTextureHeight = frame->height;
+    }
+
+    // Reallocate our upload buffers if the frame layout changed
+    if (m_glMapBufferRange != nullptr && totalSize != m_SwUploadBufferSize) {
+        freeSwUploadBuffers();
+        if (!allocateSwUploadBuffers(totalSize)) {
+            // Fall back to uploading directly from the frame
+            m_glMapBufferRange = nullptr;
+            m_UsePersistentMapping = false;
+        }
+    }
+
+    if (m_SwUploadBufferSize != 0) {
+        auto& buffer = m_SwUploadBuffers[m_SwUploadBufferIndex];
+
+        if (buffer.fence != EGL_NO_SYNC) {
+            // Wait for the GPU to finish the upload from this buffer last time
+            // we used it. With 3 buffers in flight, this should rarely block.
+            m_eglClientWaitSync(m_EGLDisplay, buffer.fence, EGL_SYNC_FLUSH_COMMANDS_BIT, EGL_FOREVER);
+            m_eglDestroySync(m_EGLDisplay, buffer.fence);
+            buffer.fence = EGL_NO_SYNC;
+        }
+
+        glBindBuffer(GL_PIXEL_UNPACK_BUFFER, buffer.pbo);
+
+        uint8_t* mapping;
+        if (m_UsePersistentMapping) {
+            mapping = (uint8_t*)buffer.mapping;
+        }
+        else {
+            // Invalidating the buffer lets the driver hand us new storage
+            // rather than stalling until the GPU has consumed the old contents.
+            mapping = (uint8_t*)m_glMapBufferRange(GL_PIXEL_UNPACK_BUFFER, 0, m_SwUploadBufferSize,
+                                                   GL_MAP_WRITE_BIT | GL_MAP_INVALIDATE_BUFFER_BIT);
+            if (mapping == nullptr) {
+                EGL_LOG(Error, "glMapBufferRange() failed: %d", glGetError());
+                glBindBuffer(GL_PIXEL_UNPACK_BUFFER, 0);
+                return false;
+            }
+        }
+
+        for (int i = 0; i < planeCount; i++) {
+            memcpy(mapping + planeOffsets[i], frame->data[i], (size_t)frame->linesize[i] * planeHeights[i]);
+        }
+
+        if (!m_UsePersistentMapping) {
+            m_glUnmapBuffer(GL_PIXEL_UNPACK_BUFFER);
+        }
+    }
+
+    for (int i = 0; i < planeCount; i++) {
+        // With a PBO bound, the data pointer is an offset within the buffer
+        const void* planeData = m_SwUploadBufferSize != 0 ?
+                    (const void*)planeOffsets[i] : frame->data[i];
+
+        glActiveTexture(GL_TEXTURE0 + i);
+        glBindTexture(GL_TEXTURE_2D, m_Textures[i]);
+        glPixelStorei(GL_UNPACK_ROW_LENGTH_EXT, frame->linesize[i] / (isChromaPair(i) ? 2 : 1));
+        glTexSubImage2D(GL_TEXTURE_2D, 0, 0, 0, planeWidths[i], planeHeights[i],
+                        isChromaPair(i) ? GL_RG : GL_RED,
+                        GL_UNSIGNED_BYTE, planeData);
+    }
+    glPixelStorei(GL_UNPACK_ROW_LENGTH_EXT, 0);
+
+    if (m_SwUploadBufferSize != 0) {
+        glBindBuffer(GL_PIXEL_UNPACK_BUFFER, 0);
+
+        // Persistently mapped buffers must not be overwritten until the GPU is done with them
+        if (m_UsePersistentMapping) {
+            m_SwUploadBuffers[m_SwUploadBufferIndex].fence = createSync();
+        }
+
+        m_SwUploadBufferIndex = (m_SwUploadBufferIndex + 1) % EGL_SW_UPLOAD_BUFFER_COUNT;
+    }
+
+    return true;
+}
+
 void EGLRenderer::waitToRender()
 {
     // Ensure our GL context is active on this thread
@@ -764,12 +1363,12 @@ void EGLRenderer::renderFrame(AVFrame* frame)
 
     // Find the native read-back format and load the shaders
     if (m_EGLImagePixelFormat == AV_PIX_FMT_NONE) {
-        m_EGLImagePixelFormat = m_Backend->getEGLImagePixelFormat();
+        m_EGLImagePixelFormat = m_Backend ? m_Backend->getEGLImagePixelFormat() : (AVPixelFormat)frame->format;
         EGL_LOG(Info, "EGLImage pixel format: %d", m_EGLImagePixelFormat);
 
         SDL_assert(m_EGLImagePixelFormat != AV_PIX_FMT_NONE);
 
-        if (!specialize()) {
+        if (!specialize(frame)) {
             m_EGLImagePixelFormat = AV_PIX_FMT_NONE;
 
             // Failure to specialize is fatal. We must reset the renderer
@@ -787,13 +1386,41 @@ void EGLRenderer::renderFrame(AVFrame* frame)
         }
     }
 
-    ssize_t plane_count = m_Backend->exportEGLImages(frame, m_EGLDisplay, imgs);
-    if (plane_count < 0)
+    if (m_Backend) {
+        ssize_t plane_count = m_Backend->exportEGLImages(frame, m_EGLDisplay, imgs);
+        if (plane_count < 0)
+            return;
+        for (ssize_t i = 0; i < plane_count; ++i) {
+            glActiveTexture(GL_TEXTURE0 + i);
+            glBindTexture(GL_TEXTURE_EXTERNAL_OES, m_Textures[i]);
+            m_glEGLImageTargetTexture2DOES(GL_TEXTURE_EXTERNAL_OES, imgs[i]);
+        }
+    }
+    else if (!uploadSoftwareFrame(frame)) {
         return;
-    for (ssize_t i = 0; i < plane_count; ++i) {
-        glActiveTexture(GL_TEXTURE0 + i);
-        glBindTexture(GL_TEXTURE_EXTERNAL_OES, m_Textures[i]);
-        m_glEGLImageTargetTexture2DOES(GL_TEXTURE_EXTERNAL_OES, imgs[i]);
+    }
+
+    // If the frame format has changed, we'll need to recompute the constants
+    bool updateCscUniforms = false;
+    if (hasFrameFormatChanged(frame) && (m_EGLImagePixelFormat == AV_PIX_FMT_NV12 ||
+                                         m_EGLImagePixelFormat == AV_PIX_FMT_P010 ||
+                                         m_EGLImagePixelFormat == AV_PIX_FMT_YUV420P)) {
+        // A specialized program has the old constants baked in, so swap it
+        // for one built for this format (usually from the program cache).
+        if (!compileYuvShader(frame)) {
+            SDL_Event event;
+            event.type = SDL_RENDER_TARGETS_RESET;
+            SDL_PushEvent(&event);
+            return;
+        }
+
+        updateCscUniforms = m_ShaderProgramDefines.isEmpty();
+    }
+
+    // Time the passes that draw the window. Reusing a query that
+    // hasn't completed just discards its old result.
+    if (m_GpuTimerQueries[0] != 0) {
+        m_glBeginQueryEXT(GL_TIME_ELAPSED_EXT, m_GpuTimerQueries[m_GpuTimerQueriesIssued % EGL_GPU_TIMER_QUERY_COUNT]);
     }
 
     glClear(GL_COLOR_BUFFER_BIT);
@@ -814,8 +1441,7 @@ void EGLRenderer::renderFrame(AVFrame* frame)
     glUseProgram(m_ShaderProgram);
     m_glBindVertexArrayOES(m_VAO);
 
-    // If the frame format has changed, we'll need to recompute the constants
-    if (hasFrameFormatChanged(frame) && (m_EGLImagePixelFormat == AV_PIX_FMT_NV12 || m_EGLImagePixelFormat == AV_PIX_FMT_P010)) {
+    if (updateCscUniforms) {
         std::array<float, 9> colorMatrix;
         std::array<float, 3> yuvOffsets;
         std::array<float, 2> chromaOffset;
@@ -838,6 +1464,16 @@ void EGLRenderer::renderFrame(AVFrame* frame)
         renderOverlay((Overlay::OverlayType)i, drawableWidth, drawableHeight);
     }
 
+    if (m_GpuTimerQueries[0] != 0) {
+        m_glEndQueryEXT(GL_TIME_ELAPSED_EXT);
+
+        // Skip results that were overwritten before we could read them
+        m_GpuTimerQueriesIssued++;
+        if (m_GpuTimerQueriesIssued - m_GpuTimerQueriesRead > EGL_GPU_TIMER_QUERY_COUNT) {
+            m_GpuTimerQueriesRead = m_GpuTimerQueriesIssued - EGL_GPU_TIMER_QUERY_COUNT;
+        }
+    }
+
     SDL_GL_SwapWindow(m_Window);
 
     if (m_BlockingSwapBuffers) {
@@ -856,17 +1492,13 @@ void EGLRenderer::renderFrame(AVFrame* frame)
             }
 
             // Create a new sync object that will be signalled when the buffer swap is completed
-            if (m_eglCreateSync != nullptr) {
-                m_LastRenderSync = m_eglCreateSync(m_EGLDisplay, EGL_SYNC_FENCE, nullptr);
-            }
-            else {
-                SDL_assert(m_eglCreateSyncKHR != nullptr);
-                m_LastRenderSync = m_eglCreateSyncKHR(m_EGLDisplay, EGL_SYNC_FENCE, nullptr);
-            }
+            m_LastRenderSync = createSync();
         }
     }
 
-    m_Backend->freeEGLImages(m_EGLDisplay, imgs);
+    if (m_Backend) {
+        m_Backend->freeEGLImages(m_EGLDisplay, imgs);
+    }
 
     // Free the DMA-BUF backing the last frame now that it is definitely
     // no longer being used anymore. While the PRIME FD stays around until
@@ -877,10 +1509,52 @@ void EGLRenderer::renderFrame(AVFrame* frame)
     av_frame_move_ref(m_LastFrame, frame);
 }
 
+bool EGLRenderer::getGpuRenderTime(uint64_t* renderTimeUs)
+{
+    if (m_GpuTimerQueries[0] == 0) {
+        return false;
+    }
+
+    // Reading the disjoint flag clears it. If it was set, the GPU clock
+    // changed and none of the outstanding results can be trusted.
+    GLint disjoint = 0;
+    glGetIntegerv(GL_GPU_DISJOINT_EXT, &disjoint);
+    if (disjoint) {
+        m_GpuTimerQueriesRead = m_GpuTimerQueriesIssued;
+        return false;
+    }
+
+    // Report the newest frame whose query has completed
+    bool hasResult = false;
+    while (m_GpuTimerQueriesRead != m_GpuTimerQueriesIssued) {
+        unsigned query = m_GpuTimerQueries[m_GpuTimerQueriesRead % EGL_GPU_TIMER_QUERY_COUNT];
+
+        GLuint available = 0;
+        m_glGetQueryObjectuivEXT(query, GL_QUERY_RESULT_AVAILABLE_EXT, &available);
+        if (!available) {
+            break;
+        }
+
+        GLuint64 elapsedNs;
+        m_glGetQueryObjectui64vEXT(query, GL_QUERY_RESULT_EXT, &elapsedNs);
+        m_GpuTimerQueriesRead++;
+
+        *renderTimeUs = elapsedNs / 1000;
+        hasResult = true;
+    }
+
+    return hasResult;
+}
+
 bool EGLRenderer::testRenderFrame(AVFrame* frame)
 {
     EGLImage imgs[EGL_MAX_PLANES];
 
+    if (!m_Backend) {
+        // Software frames are uploaded by us, so we just need to know the format
+        return frame->format == AV_PIX_FMT_YUV420P || frame->format == AV_PIX_FMT_NV12;
+    }
+
     // Make sure we can get working EGLImages from the backend renderer.
     // Some devices (Raspberry Pi) will happily decode into DRM formats that
     // its own GL implementation won't accept in eglCreateImage().
@@ -6,9 +6,13 @@
 #include <SDL_egl.h>
 #include <SDL_opengles2.h>
 
+#include <QByteArray>
+#include <QString>
+
 class EGLRenderer : public IFFmpegRenderer {
 public:
-    EGLRenderer(IFFmpegRenderer *backendRenderer);
+    // If no backend renderer is provided, EGLRenderer uploads software frames itself
+    EGLRenderer(IFFmpegRenderer *backendRenderer = nullptr);
     virtual ~EGLRenderer() override;
     virtual bool initialize(PDECODER_PARAMETERS params) override;
     virtual bool prepareDecoderContext(AVCodecContext* context, AVDictionary** options) override;
@@ -21,14 +25,27 @@ public:
     virtual bool notifyWindowChanged(PWINDOW_STATE_CHANGE_INFO) override;
     virtual bool isPixelFormatSupported(int videoFormat, enum AVPixelFormat pixelFormat) override;
     virtual AVPixelFormat getPreferredPixelFormat(int videoFormat) override;
+    virtual bool getGpuRenderTime(uint64_t* renderTimeUs) override;
 
 private:
 
+    void updateOverlayVertices(Overlay::OverlayType type, int viewportWidth, int viewportHeight);
     void renderOverlay(Overlay::OverlayType type, int viewportWidth, int viewportHeight);
-    unsigned compileShader(const char* vertexShaderSrc, const char* fragmentShaderSrc);
-    bool compileShaders();
-    bool specialize();
-    static int loadAndBuildShader(int shaderType, const char *filename);
+    void renderPerfGraph(int viewportWidth, int viewportHeight);
+    unsigned compileShader(const char* vertexShaderSrc, const char* fragmentShaderSrc,
+                           const QByteArray& fragmentDefines = QByteArray());
+    bool compileShaders(const AVFrame* frame);
+    bool compileYuvShader(const AVFrame* frame);
+    QByteArray getCscDefines(const AVFrame* frame);
+    bool specialize(const AVFrame* frame);
+    static int loadAndBuildShader(int shaderType, const char *filename, const QByteArray& source);
+    QString getProgramCacheFileName(const QByteArray& vertexSource, const QByteArray& fragmentSource);
+    unsigned loadCachedProgram(const QString& cacheFileName);
+    void storeCachedProgram(unsigned program, const QString& cacheFileName);
+    EGLSync createSync();
+    bool allocateSwUploadBuffers(size_t size);
+    void freeSwUploadBuffers();
+    bool uploadSoftwareFrame(AVFrame* frame);
 
     AVPixelFormat m_EGLImagePixelFormat;
     void *m_EGLDisplay;
@@ -36,8 +53,27 @@ private:
     unsigned m_OverlayTextures[Overlay::OverlayMax];
     unsigned m_OverlayVbos[Overlay::OverlayMax];
     SDL_atomic_t m_OverlayHasValidData[Overlay::OverlayMax];
+    SDL_Point m_OverlayTextureSizes[Overlay::OverlayMax];
+    SDL_Point m_OverlayViewportSizes[Overlay::OverlayMax];
     unsigned m_ShaderProgram;
     unsigned m_OverlayShaderProgram;
+
+    // Scratch space for the perf graph, which is too big for the stack
+    Overlay::PERF_GRAPH_VERTEX m_PerfGraphVertices[PERF_GRAPH_MAX_VERTICES];
+
+    // If CSC specialization is enabled, the YUV shader program is compiled with
+    // the color conversion constants of the current frame format baked in, so
+    // the fragment shader doesn't fetch them from uniforms. These are the
+    // defines the current program was built with (empty for the generic one).
+    bool m_SpecializeCsc;
+    QByteArray m_ShaderProgramDefines;
+
+    // Only valid if we have GL_OES_get_program_binary. Linked programs are
+    // cached on disk, keyed by the GL driver and shader source, so we can skip
+    // shader compilation on later stream starts.
+    QByteArray m_ProgramCacheKey;
+    PFNGLGETPROGRAMBINARYOESPROC m_glGetProgramBinaryOES;
+    PFNGLPROGRAMBINARYOESPROC m_glProgramBinaryOES;
     SDL_GLContext m_Context;
     SDL_Window *m_Window;
     IFFmpegRenderer *m_Backend;
@@ -57,13 +93,46 @@ private:
     int m_GlesMinorVersion;
     bool m_HasExtUnpackSubimage;
 
+    // Only valid if we have no backend renderer. Software frames are copied
+    // into a ring of pixel unpack buffers, so the CPU can fill one while the
+    // GPU is still doing the texture upload from the others. If we have
+    // GL_EXT_buffer_storage, the buffers stay persistently mapped.
+#define EGL_SW_UPLOAD_BUFFER_COUNT 3
+    struct {
+        unsigned pbo;
+        void* mapping;
+        EGLSync fence;
+    } m_SwUploadBuffers[EGL_SW_UPLOAD_BUFFER_COUNT];
+    size_t m_SwUploadBufferSize;
+    int m_SwUploadBufferIndex;
+    int m_SwTextureWidth;
+    int m_SwTextureHeight;
+    bool m_UsePersistentMapping;
+    PFNGLMAPBUFFERRANGEEXTPROC m_glMapBufferRange;
+    PFNGLUNMAPBUFFEROESPROC m_glUnmapBuffer;
+    PFNGLBUFFERSTORAGEEXTPROC m_glBufferStorageEXT;
+
+    // Only valid if we have GL_EXT_disjoint_timer_query. Each frame's GPU time
+    // is read back a few frames later, so we never wait on the GPU for it.
+#define EGL_GPU_TIMER_QUERY_COUNT 8
+    unsigned m_GpuTimerQueries[EGL_GPU_TIMER_QUERY_COUNT];
+    unsigned int m_GpuTimerQueriesIssued;
+    unsigned int m_GpuTimerQueriesRead;
+    PFNGLGENQUERIESEXTPROC m_glGenQueriesEXT;
+    PFNGLDELETEQUERIESEXTPROC m_glDeleteQueriesEXT;
+    PFNGLBEGINQUERYEXTPROC m_glBeginQueryEXT;
+    PFNGLENDQUERYEXTPROC m_glEndQueryEXT;
+    PFNGLGETQUERYOBJECTUIVEXTPROC m_glGetQueryObjectuivEXT;
+    PFNGLGETQUERYOBJECTUI64VEXTPROC m_glGetQueryObjectui64vEXT;
+
 #define NV12_PARAM_YUVMAT 0
 #define NV12_PARAM_OFFSET 1
 #define NV12_PARAM_CHROMA_OFFSET 2
 #define NV12_PARAM_PLANE1 3
 #define NV12_PARAM_PLANE2 4
+#define NV12_PARAM_PLANE3 5
 #define OPAQUE_PARAM_TEXTURE 0
-    int m_ShaderProgramParams[5];
+    int m_ShaderProgramParams[6];
 
 #define OVERLAY_PARAM_TEXTURE 0
     int m_OverlayShaderProgramParams[1];
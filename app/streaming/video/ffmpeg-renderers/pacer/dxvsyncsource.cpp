@@ -1,15 +1,36 @@
 #include "dxvsyncsource.h"
 
+#include <cmath>
+
 // Useful references:
 // https://bugs.chromium.org/p/chromium/issues/detail?id=467617
 // https://chromium.googlesource.com/chromium/src.git/+/c564f2fe339b2b2abb0c8773c90c83215670ea71/gpu/ipc/service/gpu_vsync_provider_win.cc
 
+// Our wakeups from D3DKMTWaitForVerticalBlankEvent() are never early, so we
+// pull the vblank phase quickly towards early wakeups and slowly towards late
+// ones. This keeps the estimate near the real vblank rather than averaging in
+// scheduler latency.
+#define VBLANK_PLL_EARLY_GAIN 0.5
+#define VBLANK_PLL_LATE_GAIN 0.02
+
+// Fraction of each phase correction applied to the period estimate
+#define VBLANK_PLL_PERIOD_GAIN 0.1
+
+// The measured period may not stray further than this from the mode's refresh rate
+#define VBLANK_PLL_MAX_PERIOD_DEVIATION 0.02
+
 DxVsyncSource::DxVsyncSource(Pacer* pacer) :
     m_Pacer(pacer),
     m_Gdi32Handle(nullptr),
-    m_LastMonitor(nullptr)
+    m_LastMonitor(nullptr),
+    m_NominalPeriodUs(0),
+    m_VblankPeriodUs(0),
+    m_LastVblankUs(0),
+    m_VblankLocked(false)
 {
+    SDL_AtomicSet(&m_DisplayChanged, 1);
     SDL_zero(m_WaitForVblankEventParams);
+    QueryPerformanceFrequency(&m_QpcFrequency);
 }
 
 DxVsyncSource::~DxVsyncSource()
@@ -25,8 +46,10 @@ DxVsyncSource::~DxVsyncSource()
     }
 }
 
-bool DxVsyncSource::initialize(SDL_Window* window, int)
+bool DxVsyncSource::initialize(SDL_Window* window, int displayFps)
 {
+    m_NominalPeriodUs = 1000000.0 / displayFps;
+
     m_Gdi32Handle = LoadLibraryA("gdi32.dll");
     if (m_Gdi32Handle == nullptr) {
         SDL_LogError(SDL_LOG_CATEGORY_APPLICATION,
@@ -72,68 +95,142 @@ bool DxVsyncSource::isAsync()
     return false;
 }
 
-void DxVsyncSource::waitForVsync()
+void DxVsyncSource::notifyWindowChanged(PWINDOW_STATE_CHANGE_INFO info)
+{
+    // Reopen the adapter on the V-sync thread before the next wait. We keep
+    // the same thread and Pacer state, since the session recreates us if the
+    // new display has a different refresh rate.
+    if (info->stateChangeFlags & WINDOW_STATE_CHANGE_DISPLAY) {
+        SDL_AtomicSet(&m_DisplayChanged, 1);
+    }
+}
+
+bool DxVsyncSource::openAdapterForMonitor(HMONITOR monitor)
 {
     NTSTATUS status;
 
-    // If the monitor has changed from last time, open the new adapter
-    HMONITOR currentMonitor = MonitorFromWindow(m_Window, MONITOR_DEFAULTTONEAREST);
-    if (currentMonitor != m_LastMonitor) {
-        MONITORINFOEXA monitorInfo = {};
-        monitorInfo.cbSize = sizeof(monitorInfo);
-        if (!GetMonitorInfoA(currentMonitor, &monitorInfo)) {
-            SDL_LogError(SDL_LOG_CATEGORY_APPLICATION,
-                         "GetMonitorInfo() failed: %d",
-                         GetLastError());
-            return;
-        }
+    MONITORINFOEXA monitorInfo = {};
+    monitorInfo.cbSize = sizeof(monitorInfo);
+    if (!GetMonitorInfoA(monitor, &monitorInfo)) {
+        SDL_LogError(SDL_LOG_CATEGORY_APPLICATION,
+                     "GetMonitorInfo() failed: %d",
+                     GetLastError());
+        return false;
+    }
 
-        DEVMODEA monitorMode;
-        monitorMode.dmSize = sizeof(monitorMode);
-        if (!EnumDisplaySettingsA(monitorInfo.szDevice, ENUM_CURRENT_SETTINGS, &monitorMode)) {
-            SDL_LogError(SDL_LOG_CATEGORY_APPLICATION,
-                         "EnumDisplaySettings() failed: %d",
-                         GetLastError());
-            return;
-        }
+    DEVMODEA monitorMode;
+    monitorMode.dmSize = sizeof(monitorMode);
+    if (!EnumDisplaySettingsA(monitorInfo.szDevice, ENUM_CURRENT_SETTINGS, &monitorMode)) {
+        SDL_LogError(SDL_LOG_CATEGORY_APPLICATION,
+                     "EnumDisplaySettings() failed: %d",
+                     GetLastError());
+        return false;
+    }
 
-        SDL_LogInfo(SDL_LOG_CATEGORY_APPLICATION,
-                    "Monitor changed: %s %d Hz",
-                    monitorInfo.szDevice,
-                    monitorMode.dmDisplayFrequency);
+    SDL_LogInfo(SDL_LOG_CATEGORY_APPLICATION,
+                "Monitor changed: %s %d Hz",
+                monitorInfo.szDevice,
+                monitorMode.dmDisplayFrequency);
 
-        // Close the old adapter
-        if (m_WaitForVblankEventParams.hAdapter != 0) {
-            D3DKMT_CLOSEADAPTER closeAdapterParams = {};
-            closeAdapterParams.hAdapter = m_WaitForVblankEventParams.hAdapter;
-            m_D3DKMTCloseAdapter(&closeAdapterParams);
-        }
+    // Close the old adapter
+    if (m_WaitForVblankEventParams.hAdapter != 0) {
+        D3DKMT_CLOSEADAPTER closeAdapterParams = {};
+        closeAdapterParams.hAdapter = m_WaitForVblankEventParams.hAdapter;
+        m_D3DKMTCloseAdapter(&closeAdapterParams);
+        m_WaitForVblankEventParams.hAdapter = 0;
+    }
 
-        D3DKMT_OPENADAPTERFROMHDC openAdapterParams = {};
-        openAdapterParams.hDc = CreateDCA(nullptr, monitorInfo.szDevice, nullptr, nullptr);
-        if (!openAdapterParams.hDc) {
-            SDL_LogError(SDL_LOG_CATEGORY_APPLICATION,
-                         "CreateDC() failed: %d",
-                         GetLastError());
-            return;
+    D3DKMT_OPENADAPTERFROMHDC openAdapterParams = {};
+    openAdapterParams.hDc = CreateDCA(nullptr, monitorInfo.szDevice, nullptr, nullptr);
+    if (!openAdapterParams.hDc) {
+        SDL_LogError(SDL_LOG_CATEGORY_APPLICATION,
+                     "CreateDC() failed: %d",
+                     GetLastError());
+        return false;
+    }
+
+    // Open the new adapter
+    status = m_D3DKMTOpenAdapterFromHdc(&openAdapterParams);
+    DeleteDC(openAdapterParams.hDc);
+
+    if (status != STATUS_SUCCESS) {
+        SDL_LogError(SDL_LOG_CATEGORY_APPLICATION,
+                     "D3DKMTOpenAdapterFromHdc() failed: %x",
+                     status);
+        return false;
+    }
+
+    m_WaitForVblankEventParams.hAdapter = openAdapterParams.hAdapter;
+    m_WaitForVblankEventParams.hDevice = 0;
+    m_WaitForVblankEventParams.VidPnSourceId = openAdapterParams.VidPnSourceId;
+
+    // 0 and 1 mean the hardware default refresh rate
+    if (monitorMode.dmDisplayFrequency > 1) {
+        m_NominalPeriodUs = 1000000.0 / monitorMode.dmDisplayFrequency;
+    }
+
+    // The new display's vblanks have an unrelated phase
+    m_VblankLocked = false;
+
+    m_LastMonitor = monitor;
+    return true;
+}
+
+// Called on the V-sync thread right after each vblank wait returns
+void DxVsyncSource::trackVblank(LARGE_INTEGER wakeTime)
+{
+    // Convert the wakeup time from QPC ticks to the LiGetMicroseconds() timebase
+    LARGE_INTEGER now;
+    QueryPerformanceCounter(&now);
+    double wakeUs = (double)LiGetMicroseconds() -
+                    (double)(now.QuadPart - wakeTime.QuadPart) * 1000000.0 / m_QpcFrequency.QuadPart;
+
+    if (!m_VblankLocked) {
+        m_LastVblankUs = wakeUs;
+        m_VblankPeriodUs = m_NominalPeriodUs;
+        m_VblankLocked = true;
+    }
+    else {
+        double predictedUs = m_LastVblankUs + m_VblankPeriodUs;
+        double errorUs = wakeUs - predictedUs;
+
+        // Skip over any vblanks that we missed
+        if (errorUs > m_VblankPeriodUs / 2) {
+            double missedVblanks = floor(errorUs / m_VblankPeriodUs + 0.5);
+            predictedUs += missedVblanks * m_VblankPeriodUs;
+            errorUs -= missedVblanks * m_VblankPeriodUs;
         }
 
-        // Open the new adapter
-        status = m_D3DKMTOpenAdapterFromHdc(&openAdapterParams);
-        DeleteDC(openAdapterParams.hDc);
+        if (fabs(errorUs) > m_VblankPeriodUs / 2) {
+            // We've lost track of the vblank phase, so start over
+            m_LastVblankUs = wakeUs;
+        }
+        else {
+            double correctionUs = errorUs * (errorUs < 0 ? VBLANK_PLL_EARLY_GAIN : VBLANK_PLL_LATE_GAIN);
 
-        if (status != STATUS_SUCCESS) {
-            SDL_LogError(SDL_LOG_CATEGORY_APPLICATION,
-                         "D3DKMTOpenAdapterFromHdc() failed: %x",
-                         status);
-            return;
+            m_LastVblankUs = predictedUs + correctionUs;
+            m_VblankPeriodUs = SDL_clamp(m_VblankPeriodUs + VBLANK_PLL_PERIOD_GAIN * correctionUs,
+                                         m_NominalPeriodUs * (1 - VBLANK_PLL_MAX_PERIOD_DEVIATION),
+                                         m_NominalPeriodUs * (1 + VBLANK_PLL_MAX_PERIOD_DEVIATION));
         }
+    }
 
-        m_WaitForVblankEventParams.hAdapter = openAdapterParams.hAdapter;
-        m_WaitForVblankEventParams.hDevice = 0;
-        m_WaitForVblankEventParams.VidPnSourceId = openAdapterParams.VidPnSourceId;
+    // Let Pacer schedule from the predicted vblank rather than our wakeup
+    m_Pacer->reportPresentation((uint64_t)m_LastVblankUs, (uint32_t)(m_VblankPeriodUs + 0.5));
+}
 
-        m_LastMonitor = currentMonitor;
+void DxVsyncSource::waitForVsync()
+{
+    NTSTATUS status;
+
+    // If the window has moved to another monitor, open the new adapter
+    if (SDL_AtomicSet(&m_DisplayChanged, 0)) {
+        HMONITOR currentMonitor = MonitorFromWindow(m_Window, MONITOR_DEFAULTTONEAREST);
+        if (currentMonitor != m_LastMonitor && !openAdapterForMonitor(currentMonitor)) {
+            // Try again next time
+            SDL_AtomicSet(&m_DisplayChanged, 1);
+            return;
+        }
     }
 
     status = m_D3DKMTWaitForVerticalBlankEvent(&m_WaitForVblankEventParams);
@@ -141,6 +238,11 @@ void DxVsyncSource::waitForVsync()
         SDL_LogError(SDL_LOG_CATEGORY_APPLICATION,
                      "D3DKMTWaitForVerticalBlankEvent() failed: %x",
                      status);
+        m_VblankLocked = false;
         return;
     }
+
+    LARGE_INTEGER wakeTime;
+    QueryPerformanceCounter(&wakeTime);
+    trackVblank(wakeTime);
 }
@@ -41,13 +41,28 @@ public:
 
     virtual void waitForVsync() override;
 
+    virtual void notifyWindowChanged(PWINDOW_STATE_CHANGE_INFO info) override;
+
 private:
+    bool openAdapterForMonitor(HMONITOR monitor);
+
+    void trackVblank(LARGE_INTEGER wakeTime);
+
     Pacer* m_Pacer;
     HMODULE m_Gdi32Handle;
     HWND m_Window;
     HMONITOR m_LastMonitor;
+    SDL_atomic_t m_DisplayChanged;
     D3DKMT_WAITFORVERTICALBLANKEVENT m_WaitForVblankEventParams;
 
+    // Vblank phase-locked loop state, only used by the V-sync thread.
+    // Times are in the LiGetMicroseconds() timebase.
+    LARGE_INTEGER m_QpcFrequency;
+    double m_NominalPeriodUs;
+    double m_VblankPeriodUs;
+    double m_LastVblankUs;
+    bool m_VblankLocked;
+
     PFND3DKMTOPENADAPTERFROMHDC m_D3DKMTOpenAdapterFromHdc;
     PFND3DKMTCLOSEADAPTER m_D3DKMTCloseAdapter;
     PFND3DKMTWAITFORVERTICALBLANKEVENT m_D3DKMTWaitForVerticalBlankEvent;
@@ -1,4 +1,5 @@
 #include "pacer.h"
+#include "streaming/session.h"
 #include "streaming/streamutils.h"
 
 #ifdef Q_OS_WIN32
@@ -14,12 +15,7 @@
 
 #include <SDL_syswm.h>
 
-// Limit the number of queued frames to prevent excessive memory consumption
-// if the V-Sync source or renderer is blocked for a while. It's important
-// that the sum of all queued frames between both pacing and rendering queues
-// must not exceed the number buffer pool size to avoid running the decoder
-// out of available decoding surfaces.
-#define MAX_QUEUED_FRAMES 4
+#include <cmath>
 
 // We may be woken up slightly late so don't go all the way
 // up to the next V-sync since we may accidentally step into
@@ -28,27 +24,186 @@
 // V-sync happens.
 #define TIMER_SLACK_MS 3
 
-Pacer::Pacer(IFFmpegRenderer* renderer, PVIDEO_STATS videoStats) :
+// Weight given to each new sample by the adaptive pacing EWMAs
+#define ADAPTIVE_PACING_ALPHA (1.0 / 16)
+
+// In adaptive mode, we buffer an extra frame if the average arrival time is
+// within this multiple of the mean arrival jitter from a V-sync edge, since frames
+// might then land on either side of it.
+#define ADAPTIVE_PACING_EDGE_JITTER_MULTIPLIER 2.0
+
+// In just-in-time present mode, we start rendering this long before the
+// predicted V-sync in addition to the estimated render cost
+#define JIT_PRESENT_MARGIN_US 1000
+
+// Scanout times reported by the V-sync source are extrapolated forward
+// by the refresh interval, but not after this long without a new report
+#define PRESENTATION_MAX_AGE_US 1000000
+
+// Distance between two queue indices, tolerant of wraparound
+static inline int ringDistance(int a, int b)
+{
+    return (int)((unsigned int)a - (unsigned int)b);
+}
+
+PacerFrameQueue::PacerFrameQueue()
+    : m_Capacity(MAX_QUEUED_FRAMES)
+{
+    for (int i = 0; i < MAX_QUEUED_FRAMES; i++) {
+        SDL_AtomicSetPtr(&m_Slots[i], nullptr);
+    }
+    SDL_AtomicSet(&m_ReadIndex, 0);
+    SDL_AtomicSet(&m_WriteIndex, 0);
+}
+
+void PacerFrameQueue::setCapacity(int capacity)
+{
+    SDL_assert(capacity > 0 && capacity <= MAX_QUEUED_FRAMES);
+    SDL_assert(isEmpty());
+    m_Capacity = capacity;
+}
+
+bool PacerFrameQueue::push(AVFrame* frame)
+{
+    int writeIndex = SDL_AtomicGet(&m_WriteIndex);
+    if (ringDistance(writeIndex, SDL_AtomicGet(&m_ReadIndex)) >= m_Capacity) {
+        return false;
+    }
+
+    // Fill the slot before publishing it to the consumer
+    SDL_AtomicSetPtr(&m_Slots[(unsigned int)writeIndex % MAX_QUEUED_FRAMES], frame);
+    SDL_AtomicSet(&m_WriteIndex, (int)((unsigned int)writeIndex + 1));
+    return true;
+}
+
+AVFrame* PacerFrameQueue::pop()
+{
+    for (;;) {
+        int readIndex = SDL_AtomicGet(&m_ReadIndex);
+        if (readIndex == SDL_AtomicGet(&m_WriteIndex)) {
+            return nullptr;
+        }
+
+        // The producer can't reuse this slot until m_ReadIndex moves past it,
+        // so the frame we read is valid if our CAS succeeds.
+        AVFrame* frame = (AVFrame*)SDL_AtomicGetPtr(&m_Slots[(unsigned int)readIndex % MAX_QUEUED_FRAMES]);
+        if (SDL_AtomicCAS(&m_ReadIndex, readIndex, (int)((unsigned int)readIndex + 1))) {
+            return frame;
+        }
+    }
+}
+
+int PacerFrameQueue::count()
+{
+    // Read the read index first so a concurrent pop can't make this negative
+    int readIndex = SDL_AtomicGet(&m_ReadIndex);
+    return ringDistance(SDL_AtomicGet(&m_WriteIndex), readIndex);
+}
+
+void PacerQueueHistory::add(int queueLength, int maxEntries)
+{
+    maxEntries = SDL_max(1, SDL_min(maxEntries, MAX_QUEUE_HISTORY_ENTRIES));
+
+    // Discard entries beyond the window if it has shrunk
+    while (m_Count >= maxEntries) {
+        m_Head = (m_Head + 1) % MAX_QUEUE_HISTORY_ENTRIES;
+        m_Count--;
+    }
+
+    m_Entries[(m_Head + m_Count) % MAX_QUEUE_HISTORY_ENTRIES] = queueLength;
+    m_Count++;
+}
+
+bool PacerQueueHistory::contains(int maxQueueLength) const
+{
+    for (int i = 0; i < m_Count; i++) {
+        if (m_Entries[(m_Head + i) % MAX_QUEUE_HISTORY_ENTRIES] <= maxQueueLength) {
+            return true;
+        }
+    }
+
+    return false;
+}
+
+PacerWakeup::PacerWakeup()
+    : m_Sem(SDL_CreateSemaphore(0))
+{
+    SDL_AtomicSet(&m_Pending, 0);
+}
+
+PacerWakeup::~PacerWakeup()
+{
+    SDL_DestroySemaphore(m_Sem);
+}
+
+void PacerWakeup::post()
+{
+    // Only the first post since the consumer last woke up reaches the
+    // semaphore, which keeps its count at 1 or less
+    if (SDL_AtomicCAS(&m_Pending, 0, 1)) {
+        SDL_SemPost(m_Sem);
+    }
+}
+
+bool PacerWakeup::wait(int timeoutMs)
+{
+    if ((timeoutMs < 0 ? SDL_SemWait(m_Sem) : SDL_SemWaitTimeout(m_Sem, (Uint32)timeoutMs)) != 0) {
+        return false;
+    }
+
+    // Clear this before the consumer checks its queue, so a push that
+    // arrives after that check is guaranteed to post again
+    SDL_AtomicSet(&m_Pending, 0);
+    return true;
+}
+
+Pacer::Pacer(IFFmpegRenderer* renderer, Session* session, PVIDEO_STATS videoStats, FrameTracer* frameTracer, FramePool* framePool) :
     m_RenderThread(nullptr),
     m_VsyncThread(nullptr),
-    m_Stopping(false),
     m_VsyncSource(nullptr),
     m_VsyncRenderer(renderer),
+    m_Session(session),
     m_MaxVideoFps(0),
     m_DisplayFps(0),
-    m_VideoStats(videoStats)
+    m_VideoStats(videoStats),
+    m_FrameTracer(frameTracer),
+    m_FramePool(framePool),
+    m_LastRenderTimeUs(0),
+    m_StatsSampleInterval(StreamUtils::getStatsSampleInterval()),
+    m_StatsSampleCounter(0),
+    m_AdaptivePacing(qEnvironmentVariableIntValue("PACER_ADAPTIVE") != 0),
+    m_LastVsyncTimeUs(0),
+    m_VsyncPeriodUs(0),
+    m_ArrivalPhaseUs(0),
+    m_ArrivalJitterUs(0),
+    m_AdaptiveFrameDropTarget(1),
+    m_PresentationLock(0),
+    m_PresentTimeUs(0),
+    m_RefreshIntervalUs(0),
+    m_JitPresent(qEnvironmentVariableIntValue("PACER_JIT_PRESENT") != 0),
+    m_MixRepeatFrame(nullptr),
+    m_LastRenderedPts(AV_NOPTS_VALUE)
 {
-
+    SDL_AtomicSet(&m_Stopping, 0);
+    SDL_AtomicSet(&m_DroppedFrames, 0);
+    SDL_AtomicSet(&m_OverflowDrops, 0);
+    SDL_AtomicSet(&m_MaxQueuedFrames, 0);
+    SDL_AtomicSet(&m_RenderCostUs, 0);
+
+    if (m_Session != nullptr && m_Session->isLowMemoryMode()) {
+        m_RenderQueue.setCapacity(LOW_MEMORY_QUEUED_FRAMES);
+        m_PacingQueue.setCapacity(LOW_MEMORY_QUEUED_FRAMES);
+    }
 }
 
 Pacer::~Pacer()
 {
-    m_Stopping = true;
+    SDL_AtomicSet(&m_Stopping, 1);
 
     // Stop the V-sync thread
     if (m_VsyncThread != nullptr) {
-        m_PacingQueueNotEmpty.wakeAll();
-        m_VsyncSignalled.wakeAll();
+        m_PacingQueueWakeup.post();
+        m_VsyncWakeup.post();
         SDL_WaitThread(m_VsyncThread, nullptr);
     }
 
@@ -58,7 +213,7 @@ Pacer::~Pacer()
 
     // Stop the render thread
     if (m_RenderThread != nullptr) {
-        m_RenderQueueNotEmpty.wakeAll();
+        m_RenderQueueWakeup.post();
         SDL_WaitThread(m_RenderThread, nullptr);
     }
     else {
@@ -68,14 +223,24 @@ Pacer::~Pacer()
     }
 
     // Delete any remaining unconsumed frames
-    while (!m_RenderQueue.isEmpty()) {
-        AVFrame* frame = m_RenderQueue.dequeue();
-        av_frame_free(&frame);
+    AVFrame* frame;
+    while ((frame = m_RenderQueue.pop()) != nullptr) {
+        m_FramePool->release(&frame);
     }
-    while (!m_PacingQueue.isEmpty()) {
-        AVFrame* frame = m_PacingQueue.dequeue();
-        av_frame_free(&frame);
+    while ((frame = m_PacingQueue.pop()) != nullptr) {
+        m_FramePool->release(&frame);
     }
+    av_frame_free(&m_MixRepeatFrame);
+
+    // Our threads are gone, so count anything since the last stats window
+    takeWindowStats(m_VideoStats);
+}
+
+void Pacer::takeWindowStats(PVIDEO_STATS stats)
+{
+    stats->pacerDroppedFrames += (uint32_t)SDL_AtomicSet(&m_DroppedFrames, 0);
+    stats->pacerOverflowDrops += (uint32_t)SDL_AtomicSet(&m_OverflowDrops, 0);
+    stats->maxPacerQueuedFrames = qMax(stats->maxPacerQueuedFrames, (uint32_t)SDL_AtomicSet(&m_MaxQueuedFrames, 0));
 }
 
 void Pacer::renderOnMainThread()
@@ -85,23 +250,18 @@ void Pacer::renderOnMainThread()
         return;
     }
 
-    m_FrameQueueLock.lock();
-
-    if (!m_RenderQueue.isEmpty()) {
-        AVFrame* frame = m_RenderQueue.dequeue();
-        m_FrameQueueLock.unlock();
-
+    AVFrame* frame = m_RenderQueue.pop();
+    if (frame != nullptr) {
         renderFrame(frame);
     }
-    else {
-        m_FrameQueueLock.unlock();
-    }
 }
 
 int Pacer::vsyncThread(void *context)
 {
     Pacer* me = reinterpret_cast<Pacer*>(context);
 
+    StreamUtils::placeCurrentThread(StreamUtils::TPC_LATENCY_CRITICAL);
+
 #if SDL_VERSION_ATLEAST(2, 0, 9)
     SDL_SetThreadPriority(SDL_THREAD_PRIORITY_TIME_CRITICAL);
 #else
@@ -109,23 +269,22 @@ int Pacer::vsyncThread(void *context)
 #endif
 
     bool async = me->m_VsyncSource->isAsync();
-    while (!me->m_Stopping) {
+    while (!SDL_AtomicGet(&me->m_Stopping)) {
         if (async) {
-            // Wait for the VSync source to invoke signalVsync() or 100ms to elapse
-            me->m_FrameQueueLock.lock();
-            me->m_VsyncSignalled.wait(&me->m_FrameQueueLock, 100);
-            me->m_FrameQueueLock.unlock();
+            // Wait for the VSync source to invoke signalVsync() or 100ms to elapse.
+            // V-syncs signalled while we were busy are coalesced into one wakeup.
+            me->m_VsyncWakeup.wait(100);
         }
         else {
             // Let the VSync source wait in the context of our thread
             me->m_VsyncSource->waitForVsync();
         }
 
-        if (me->m_Stopping) {
+        if (SDL_AtomicGet(&me->m_Stopping)) {
             break;
         }
 
-        me->handleVsync(1000 / me->m_DisplayFps);
+        me->handleVsync(me->getTimeUntilNextVsyncMillis());
     }
 
     return 0;
@@ -135,34 +294,31 @@ int Pacer::renderThread(void* context)
 {
     Pacer* me = reinterpret_cast<Pacer*>(context);
 
-    if (SDL_SetThreadPriority(SDL_THREAD_PRIORITY_HIGH) < 0) {
+    StreamUtils::placeCurrentThread(StreamUtils::TPC_LATENCY_CRITICAL);
+
+    REALTIME_THREAD_STATE realtimeState;
+    if (!StreamUtils::enterRealtimeScheduling(StreamUtils::RTC_VIDEO, 1000000 / SDL_max(me->m_MaxVideoFps, 1), &realtimeState) &&
+            SDL_SetThreadPriority(SDL_THREAD_PRIORITY_HIGH) < 0) {
         SDL_LogWarn(SDL_LOG_CATEGORY_APPLICATION,
                     "Unable to set render thread to high priority: %s",
                     SDL_GetError());
     }
 
-    while (!me->m_Stopping) {
+    while (!SDL_AtomicGet(&me->m_Stopping)) {
         // Wait for the renderer to be ready for the next frame
         me->m_VsyncRenderer->waitToRender();
 
-        // Acquire the frame queue lock to protect the queue and
-        // the not empty condition
-        me->m_FrameQueueLock.lock();
-
         // Wait for a frame to be ready to render
-        while (!me->m_Stopping && me->m_RenderQueue.isEmpty()) {
-            me->m_RenderQueueNotEmpty.wait(&me->m_FrameQueueLock);
+        AVFrame* frame;
+        while ((frame = me->m_RenderQueue.pop()) == nullptr && !SDL_AtomicGet(&me->m_Stopping)) {
+            me->m_RenderQueueWakeup.wait(-1);
         }
 
-        if (me->m_Stopping) {
+        if (frame == nullptr) {
             // Exit this thread
-            me->m_FrameQueueLock.unlock();
             break;
         }
 
-        AVFrame* frame = me->m_RenderQueue.dequeue();
-        me->m_FrameQueueLock.unlock();
-
         me->renderFrame(frame);
     }
 
@@ -170,18 +326,48 @@ int Pacer::renderThread(void* context)
     // NB: This must happen on the same thread that calls renderFrame().
     me->m_VsyncRenderer->cleanupRenderContext();
 
+    StreamUtils::exitRealtimeScheduling(&realtimeState);
     return 0;
 }
 
-void Pacer::enqueueFrameForRenderingAndUnlock(AVFrame *frame)
+void Pacer::dropFrame(AVFrame* frame)
 {
-    dropFrameForEnqueue(m_RenderQueue);
-    m_RenderQueue.enqueue(frame);
+    SDL_AtomicIncRef(&m_DroppedFrames);
+    if (m_FrameTracer) {
+        m_FrameTracer->dropFrame(frame);
+    }
+    m_FramePool->release(&frame);
+}
 
-    m_FrameQueueLock.unlock();
+// Called by the producer of a queue. If the queue is full, the oldest frame
+// is discarded to make room since the newest frame is always preferable.
+void Pacer::enqueueFrame(PacerFrameQueue& queue, AVFrame* frame)
+{
+    while (!queue.push(frame)) {
+        AVFrame* oldFrame = queue.pop();
+        if (oldFrame != nullptr) {
+            SDL_AtomicIncRef(&m_OverflowDrops);
+            if (m_FrameTracer) {
+                m_FrameTracer->dropFrame(oldFrame);
+            }
+            m_FramePool->release(&oldFrame);
+        }
+    }
+
+    // The other queue may be drained concurrently, so this is only an estimate
+    int queuedFrames = m_RenderQueue.count() + m_PacingQueue.count();
+    int maxQueuedFrames = SDL_AtomicGet(&m_MaxQueuedFrames);
+    while (queuedFrames > maxQueuedFrames && !SDL_AtomicCAS(&m_MaxQueuedFrames, maxQueuedFrames, queuedFrames)) {
+        maxQueuedFrames = SDL_AtomicGet(&m_MaxQueuedFrames);
+    }
+}
+
+void Pacer::enqueueFrameForRendering(AVFrame *frame)
+{
+    enqueueFrame(m_RenderQueue, frame);
 
     if (m_RenderThread != nullptr) {
-        m_RenderQueueNotEmpty.wakeOne();
+        m_RenderQueueWakeup.post();
     }
     else {
         SDL_Event event;
@@ -200,60 +386,224 @@ void Pacer::handleVsync(int timeUntilNextVsyncMillis)
     // Make sure initialize() has been called
     SDL_assert(m_MaxVideoFps != 0);
 
-    m_FrameQueueLock.lock();
+    // We must have a frame on the render queue before the next V-sync
+    uint32_t deadline = SDL_GetTicks() + SDL_max(timeUntilNextVsyncMillis, TIMER_SLACK_MS) - TIMER_SLACK_MS;
+
+    if (m_AdaptivePacing || m_JitPresent) {
+        trackVsync();
+    }
 
     // If the queue length history entries are large, be strict
     // about dropping excess frames.
     int frameDropTarget = 1;
 
+    if (m_JitPresent) {
+        // Hold off until just before the next V-sync, then render only
+        // the newest frame that has arrived by then.
+        waitForJitPresentTime();
+    }
+    else if (m_AdaptivePacing) {
+        frameDropTarget = updateAdaptivePacing();
+    }
     // If we may get more frames per second than we can display, use
     // frame history to drop frames only if consistently above the
     // one queued frame mark.
-    if (m_MaxVideoFps >= m_DisplayFps) {
-        for (int queueHistoryEntry : m_PacingQueueHistory) {
-            if (queueHistoryEntry <= 1) {
-                // Be lenient as long as the queue length
-                // resolves before the end of frame history
-                frameDropTarget = 3;
-                break;
-            }
+    else if (m_MaxVideoFps >= m_DisplayFps) {
+        // Be lenient as long as the queue length
+        // resolves before the end of frame history
+        if (m_PacingQueueHistory.contains(1)) {
+            frameDropTarget = 3;
         }
 
         // Keep a rolling 500 ms window of pacing queue history
-        if (m_PacingQueueHistory.count() == m_DisplayFps / 2) {
-            m_PacingQueueHistory.dequeue();
-        }
-
-        m_PacingQueueHistory.enqueue(m_PacingQueue.count());
+        m_PacingQueueHistory.add(m_PacingQueue.count(), m_DisplayFps / 2);
     }
 
+    m_VideoStats->pacingQueueDepths[SDL_min(m_PacingQueue.count(), PACER_QUEUE_DEPTH_BUCKETS - 1)]++;
+
     // Catch up if we're several frames ahead
     while (m_PacingQueue.count() > frameDropTarget) {
-        AVFrame* frame = m_PacingQueue.dequeue();
+        int queueDepth = m_PacingQueue.count();
+        AVFrame* frame = m_PacingQueue.pop();
+        if (frame == nullptr) {
+            break;
+        }
 
-        // Drop the lock while we call av_frame_free()
-        m_FrameQueueLock.unlock();
-        m_VideoStats->pacerDroppedFrames++;
-        av_frame_free(&frame);
-        m_FrameQueueLock.lock();
+        if (m_AdaptivePacing) {
+            trackFrameArrival(frame);
+        }
+        if (m_Session != nullptr) {
+            m_Session->getFlightRecorder().record(FlightRecorder::EventPacerDrop, (uint32_t)frame->pts, queueDepth, frameDropTarget, 0);
+        }
+        m_VideoStats->pacerVsyncDrops++;
+        dropFrame(frame);
     }
 
-    if (m_PacingQueue.isEmpty()) {
+    AVFrame* frame = m_PacingQueue.pop();
+    if (frame == nullptr) {
         // Wait for a frame to arrive or our V-sync timeout to expire
-        if (!m_PacingQueueNotEmpty.wait(&m_FrameQueueLock, SDL_max(timeUntilNextVsyncMillis, TIMER_SLACK_MS) - TIMER_SLACK_MS)) {
-            // Wait timed out - unlock and bail
-            m_FrameQueueLock.unlock();
-            return;
-        }
+        for (;;) {
+            int remainingMillis = (int)(deadline - SDL_GetTicks());
+            if (remainingMillis <= 0 || !m_PacingQueueWakeup.wait(remainingMillis)) {
+                // Wait timed out - bail
+                repeatFrameForMixing();
+                return;
+            }
+
+            if (SDL_AtomicGet(&m_Stopping)) {
+                return;
+            }
 
-        if (m_Stopping) {
-            m_FrameQueueLock.unlock();
-            return;
+            // We may have been woken for a frame we already consumed
+            frame = m_PacingQueue.pop();
+            if (frame != nullptr) {
+                break;
+            }
         }
     }
 
+    if (m_AdaptivePacing) {
+        trackFrameArrival(frame);
+    }
+
+    m_VideoStats->totalVsyncWaitTimeUs += LiGetMicroseconds() - (uint64_t)frame->pkt_dts;
+    m_VideoStats->vsyncWaitFrames++;
+
+    // Hold our own reference, since the frame is released once it's rendered
+    if (m_MixRepeatFrame != nullptr) {
+        av_frame_unref(m_MixRepeatFrame);
+        av_frame_ref(m_MixRepeatFrame, frame);
+    }
+
     // Place the first frame on the render queue
-    enqueueFrameForRenderingAndUnlock(m_PacingQueue.dequeue());
+    enqueueFrameForRendering(frame);
+}
+
+// Called on the V-sync thread when no new frame arrived for this V-sync. A
+// frame mixing renderer uses the repeat to render the next display time.
+void Pacer::repeatFrameForMixing()
+{
+    if (m_MixRepeatFrame == nullptr || m_MixRepeatFrame->buf[0] == nullptr) {
+        return;
+    }
+
+    bool hit;
+    AVFrame* frame = m_FramePool->get(hit);
+    if (frame == nullptr) {
+        return;
+    }
+
+    if (av_frame_ref(frame, m_MixRepeatFrame) < 0) {
+        m_FramePool->release(&frame);
+        return;
+    }
+
+    enqueueFrameForRendering(frame);
+}
+
+// Wraps a phase difference into (-period/2, period/2]
+static double wrapPhaseDelta(double delta, double period)
+{
+    if (delta > period / 2) {
+        delta -= period;
+    }
+    else if (delta <= -period / 2) {
+        delta += period;
+    }
+    return delta;
+}
+
+// Called on the V-sync thread for each frame leaving the pacing queue
+void Pacer::trackFrameArrival(AVFrame* frame)
+{
+    if (m_LastVsyncTimeUs == 0 || m_VsyncPeriodUs <= 0) {
+        return;
+    }
+
+    // Offset of this frame's arrival (when it was submitted to us) from the
+    // V-sync grid. Frames that arrive shortly after V-sync wait almost a full
+    // period in our queue.
+    double phase = fmod((double)((int64_t)frame->pkt_dts - (int64_t)m_LastVsyncTimeUs), m_VsyncPeriodUs);
+    if (phase < 0) {
+        phase += m_VsyncPeriodUs;
+    }
+    double delta = wrapPhaseDelta(phase - m_ArrivalPhaseUs, m_VsyncPeriodUs);
+
+    m_ArrivalPhaseUs = fmod(m_ArrivalPhaseUs + ADAPTIVE_PACING_ALPHA * delta + m_VsyncPeriodUs, m_VsyncPeriodUs);
+    m_ArrivalJitterUs += ADAPTIVE_PACING_ALPHA * (fabs(delta) - m_ArrivalJitterUs);
+}
+
+// Called on the V-sync thread on each V-sync
+void Pacer::trackVsync()
+{
+    uint64_t now = LiGetMicroseconds();
+
+    SDL_AtomicLock(&m_PresentationLock);
+    uint64_t presentTimeUs = m_PresentTimeUs;
+    uint32_t refreshIntervalUs = m_RefreshIntervalUs;
+    SDL_AtomicUnlock(&m_PresentationLock);
+
+    // Our wakeup time includes compositor and scheduling delays, so use
+    // the real scanout timing instead if the V-sync source provides it
+    if (presentTimeUs != 0 && refreshIntervalUs != 0 &&
+            presentTimeUs <= now && now - presentTimeUs < PRESENTATION_MAX_AGE_US) {
+        m_VsyncPeriodUs = refreshIntervalUs;
+        m_LastVsyncTimeUs = presentTimeUs + (now - presentTimeUs) / refreshIntervalUs * refreshIntervalUs;
+        return;
+    }
+
+    // Measure the real V-sync period, since the reported refresh rate is
+    // rounded (119.88 Hz vs 120 Hz matters for phase tracking).
+    if (m_LastVsyncTimeUs != 0) {
+        double interval = (double)(now - m_LastVsyncTimeUs);
+
+        // Ignore missed V-syncs and spurious wakeups
+        if (interval > m_VsyncPeriodUs / 2 && interval < m_VsyncPeriodUs * 3 / 2) {
+            m_VsyncPeriodUs += ADAPTIVE_PACING_ALPHA * (interval - m_VsyncPeriodUs);
+        }
+    }
+    m_LastVsyncTimeUs = now;
+}
+
+// Called on the V-sync thread after trackVsync(). Sleeps until it's time to
+// start rendering for the next V-sync, based on the recent cost of rendering.
+void Pacer::waitForJitPresentTime()
+{
+    int64_t renderStartTimeUs = (int64_t)m_LastVsyncTimeUs + (int64_t)m_VsyncPeriodUs -
+                                SDL_AtomicGet(&m_RenderCostUs) - JIT_PRESENT_MARGIN_US;
+    int64_t waitTimeUs = renderStartTimeUs - (int64_t)LiGetMicroseconds();
+
+    // SDL_Delay() has millisecond granularity, so round down to wake early
+    // rather than late. If rendering takes nearly a whole V-sync period, we
+    // will start immediately, which is the same as not using this mode.
+    if (waitTimeUs >= 1000) {
+        SDL_Delay((Uint32)(waitTimeUs / 1000));
+    }
+}
+
+// Called on the V-sync thread on each V-sync after trackVsync(). Returns the
+// number of frames we may keep in the pacing queue before dropping.
+int Pacer::updateAdaptivePacing()
+{
+    // If frames consistently land well clear of a V-sync edge, one queued
+    // frame is enough and we get the lowest latency. When the arrival phase
+    // drifts near an edge (as it periodically does when the stream and display
+    // rates differ slightly), buffer one more frame so jitter doesn't cause
+    // alternating repeats and drops.
+    double edgeDistance = qMin(m_ArrivalPhaseUs, m_VsyncPeriodUs - m_ArrivalPhaseUs);
+    int target = edgeDistance < m_ArrivalJitterUs * ADAPTIVE_PACING_EDGE_JITTER_MULTIPLIER ? 2 : 1;
+
+    if (target != m_AdaptiveFrameDropTarget) {
+        SDL_LogInfo(SDL_LOG_CATEGORY_APPLICATION,
+                    "Adaptive pacing: arrival phase %.2f ms (jitter %.2f ms) of %.3f ms V-sync period, buffering %d frame(s)",
+                    m_ArrivalPhaseUs / 1000.0,
+                    m_ArrivalJitterUs / 1000.0,
+                    m_VsyncPeriodUs / 1000.0,
+                    target);
+        m_AdaptiveFrameDropTarget = target;
+    }
+
+    return target;
 }
 
 bool Pacer::initialize(SDL_Window* window, int maxVideoFps, bool enablePacing)
@@ -261,8 +611,22 @@ bool Pacer::initialize(SDL_Window* window, int maxVideoFps, bool enablePacing)
     m_MaxVideoFps = maxVideoFps;
     m_DisplayFps = StreamUtils::getDisplayRefreshRate(window);
     m_RendererAttributes = m_VsyncRenderer->getRendererAttributes();
+    m_VsyncPeriodUs = 1000000.0 / m_DisplayFps;
+
+    if (m_Session != nullptr && m_Session->isLowMemoryMode()) {
+        SDL_LogInfo(SDL_LOG_CATEGORY_APPLICATION,
+                    "Low memory mode: limiting Pacer queues to %d frames",
+                    LOW_MEMORY_QUEUED_FRAMES);
+    }
 
-    if (enablePacing) {
+    if (m_RendererAttributes & RENDERER_ATTRIBUTE_VARIABLE_REFRESH) {
+        // The display will refresh when each frame arrives, so waiting
+        // for V-sync would only add up to a refresh interval of latency.
+        SDL_LogInfo(SDL_LOG_CATEGORY_APPLICATION,
+                    "Frame pacing bypassed for variable refresh rate display: up to %d Hz with %d FPS stream",
+                    m_DisplayFps, m_MaxVideoFps);
+    }
+    else if (enablePacing) {
         SDL_LogInfo(SDL_LOG_CATEGORY_APPLICATION,
                     "Frame pacing: target %d Hz with %d FPS stream",
                     m_DisplayFps, m_MaxVideoFps);
@@ -276,27 +640,32 @@ bool Pacer::initialize(SDL_Window* window, int maxVideoFps, bool enablePacing)
             return false;
         }
 
-        switch (info.subsystem) {
-    #ifdef Q_OS_WIN32
-        case SDL_SYSWM_WINDOWS:
-            // Don't use D3DKMTWaitForVerticalBlankEvent() on Windows 7, because
-            // it blocks during other concurrent DX operations (like actually rendering).
-            if (IsWindows8OrGreater()) {
-                m_VsyncSource = new DxVsyncSource(this);
-            }
-            break;
-    #endif
+        // Prefer V-sync events from the renderer's own display if it has them
+        m_VsyncSource = m_VsyncRenderer->createVsyncSource(this);
+
+        if (m_VsyncSource == nullptr) {
+            switch (info.subsystem) {
+        #ifdef Q_OS_WIN32
+            case SDL_SYSWM_WINDOWS:
+                // Don't use D3DKMTWaitForVerticalBlankEvent() on Windows 7, because
+                // it blocks during other concurrent DX operations (like actually rendering).
+                if (IsWindows8OrGreater()) {
+                    m_VsyncSource = new DxVsyncSource(this);
+                }
+                break;
+        #endif
 
-    #if defined(SDL_VIDEO_DRIVER_WAYLAND) && defined(HAS_WAYLAND)
-        case SDL_SYSWM_WAYLAND:
-            m_VsyncSource = new WaylandVsyncSource(this);
-            break;
-    #endif
+        #if defined(SDL_VIDEO_DRIVER_WAYLAND) && defined(HAS_WAYLAND)
+            case SDL_SYSWM_WAYLAND:
+                m_VsyncSource = new WaylandVsyncSource(this);
+                break;
+        #endif
 
-        default:
-            // Platforms without a VsyncSource will just render frames
-            // immediately like they used to.
-            break;
+            default:
+                // Platforms without a VsyncSource will just render frames
+                // immediately like they used to.
+                break;
+            }
         }
 
         SDL_assert(m_VsyncSource != nullptr || !(m_RendererAttributes & RENDERER_ATTRIBUTE_FORCE_PACING));
@@ -315,7 +684,23 @@ bool Pacer::initialize(SDL_Window* window, int maxVideoFps, bool enablePacing)
     }
 
     if (m_VsyncSource != nullptr) {
+        if (m_RendererAttributes & RENDERER_ATTRIBUTE_FRAME_MIXING) {
+            SDL_LogInfo(SDL_LOG_CATEGORY_APPLICATION,
+                        "Using frame mixing: rendering every V-sync at %d Hz for %d FPS stream",
+                        m_DisplayFps, m_MaxVideoFps);
+            m_MixRepeatFrame = av_frame_alloc();
+        }
+
         m_VsyncThread = SDL_CreateThread(Pacer::vsyncThread, "PacerVsync", this);
+
+        if (m_JitPresent) {
+            SDL_LogInfo(SDL_LOG_CATEGORY_APPLICATION,
+                        "Using just-in-time frame presentation");
+        }
+        else if (m_AdaptivePacing) {
+            SDL_LogInfo(SDL_LOG_CATEGORY_APPLICATION,
+                        "Using adaptive frame pacing");
+        }
     }
 
     if (m_VsyncRenderer->isRenderThreadSupported()) {
@@ -327,11 +712,56 @@ bool Pacer::initialize(SDL_Window* window, int maxVideoFps, bool enablePacing)
 
 void Pacer::signalVsync()
 {
-    m_VsyncSignalled.wakeOne();
+    m_VsyncWakeup.post();
+}
+
+void Pacer::reportPresentation(uint64_t presentTimeUs, uint32_t refreshIntervalUs)
+{
+    SDL_AtomicLock(&m_PresentationLock);
+    m_PresentTimeUs = presentTimeUs;
+    m_RefreshIntervalUs = refreshIntervalUs;
+    SDL_AtomicUnlock(&m_PresentationLock);
+}
+
+void Pacer::notifyWindowChanged(PWINDOW_STATE_CHANGE_INFO info)
+{
+    if (m_VsyncSource != nullptr) {
+        m_VsyncSource->notifyWindowChanged(info);
+    }
+}
+
+// Called on the V-sync thread after the V-sync source returns. Uses the
+// predicted V-sync timing if the source reports it, since our wakeup may
+// be well after the V-sync actually happened.
+int Pacer::getTimeUntilNextVsyncMillis()
+{
+    uint64_t now = LiGetMicroseconds();
+
+    SDL_AtomicLock(&m_PresentationLock);
+    uint64_t presentTimeUs = m_PresentTimeUs;
+    uint32_t refreshIntervalUs = m_RefreshIntervalUs;
+    SDL_AtomicUnlock(&m_PresentationLock);
+
+    if (presentTimeUs != 0 && refreshIntervalUs != 0 &&
+            presentTimeUs <= now && now - presentTimeUs < PRESENTATION_MAX_AGE_US) {
+        uint64_t nextVsyncUs = presentTimeUs + ((now - presentTimeUs) / refreshIntervalUs + 1) * refreshIntervalUs;
+        return (int)((nextVsyncUs - now) / 1000);
+    }
+
+    return 1000 / m_DisplayFps;
 }
 
 void Pacer::renderFrame(AVFrame* frame)
 {
+    // Frame mixing renders a repeated frame at a later display time than
+    // last time. Only new frames are counted in the stats.
+    if (m_MixRepeatFrame != nullptr && frame->pts == m_LastRenderedPts) {
+        m_VsyncRenderer->renderFrame(frame);
+        m_FramePool->release(&frame);
+        return;
+    }
+    m_LastRenderedPts = frame->pts;
+
     // Count time spent in Pacer's queues
     uint64_t beforeRender = LiGetMicroseconds();
     m_VideoStats->totalPacerTimeUs += (beforeRender - (uint64_t)frame->pkt_dts);
@@ -341,12 +771,104 @@ void Pacer::renderFrame(AVFrame* frame)
     uint64_t afterRender = LiGetMicroseconds();
 
     m_VideoStats->totalRenderTimeUs += (afterRender - beforeRender);
+
+    if (m_VsyncRenderer->didCopyLastFrame()) {
+        m_VideoStats->copiedFrames++;
+    }
+
+    uint32_t textureCacheMisses;
+    if (m_VsyncRenderer->getTextureCacheMisses(&textureCacheMisses)) {
+        m_VideoStats->textureCacheMisses += textureCacheMisses;
+    }
+
+    if (m_JitPresent) {
+        // Keep a running estimate of render cost for the V-sync thread
+        int renderCostUs = SDL_AtomicGet(&m_RenderCostUs);
+        renderCostUs += (int)(ADAPTIVE_PACING_ALPHA * ((int)(afterRender - beforeRender) - renderCostUs));
+        SDL_AtomicSet(&m_RenderCostUs, renderCostUs);
+    }
     m_VideoStats->renderedFrames++;
-    av_frame_free(&frame);
 
-    // Drop frames if we have too many queued up for a while
-    m_FrameQueueLock.lock();
+    if (++m_StatsSampleCounter >= m_StatsSampleInterval) {
+        m_StatsSampleCounter = 0;
+
+        latencyHistogramAdd(m_VideoStats->pacerTimeHistogram, beforeRender - (uint64_t)frame->pkt_dts);
+        latencyHistogramAdd(m_VideoStats->renderTimeHistogram, afterRender - beforeRender);
+
+        // Include the time to scanout if the renderer can tell us
+        uint64_t presentLatencyUs;
+        if (m_VsyncRenderer->getPresentLatency(&presentLatencyUs)) {
+            m_VideoStats->totalPresentLatencyUs += presentLatencyUs;
+            m_VideoStats->framesWithPresentLatency++;
+        }
+
+        int queuedPresents;
+        if (m_VsyncRenderer->getQueuedPresentCount(&queuedPresents) && queuedPresents >= 0) {
+            m_VideoStats->totalPresentQueueDepth += queuedPresents;
+            m_VideoStats->maxPresentQueueDepth = qMax(m_VideoStats->maxPresentQueueDepth, (uint32_t)queuedPresents);
+            m_VideoStats->presentQueueDepthSamples++;
+        }
+
+        bool directScanout;
+        if (m_VsyncRenderer->getDirectScanout(&directScanout)) {
+            if (directScanout) {
+                m_VideoStats->directScanoutFrames++;
+            }
+            m_VideoStats->scanoutSamples++;
+        }
+
+        uint64_t gpuTimeUs;
+        if (m_VsyncRenderer->getGpuRenderTime(&gpuTimeUs)) {
+            m_VideoStats->totalGpuRenderTimeUs += gpuTimeUs;
+            m_VideoStats->framesWithGpuRenderTime++;
 
+            if (m_VsyncRenderer->getGpuScaleTime(&gpuTimeUs)) {
+                m_VideoStats->totalGpuScaleTimeUs += gpuTimeUs;
+            }
+        }
+        if (m_VsyncRenderer->getGpuUploadTime(&gpuTimeUs)) {
+            m_VideoStats->totalGpuUploadTimeUs += gpuTimeUs;
+        }
+
+        m_VideoStats->renderThreadCpuTimeUs += StreamUtils::takeThreadCpuTimeUs();
+    }
+
+    // There's no session when benchmarking
+    if (m_Session != nullptr && m_LastRenderTimeUs == 0) {
+        m_Session->getLaunchTimeline().markFirstFrame();
+    }
+
+    if (m_Session != nullptr && m_Session->getOverlayManager().isOverlayEnabled(Overlay::OverlayPerfGraph) && m_LastRenderTimeUs != 0) {
+        m_Session->getOverlayManager().getPerfGraph().addSample(Overlay::PerfGraphFrameTime,
+                                                                     (afterRender - m_LastRenderTimeUs) / 1000.0f);
+    }
+    if (m_Session != nullptr) {
+        m_Session->getFlightRecorder().record(FlightRecorder::EventFrameRendered,
+                                              (uint32_t)frame->pts,
+                                              (uint32_t)(beforeRender - (uint64_t)frame->pkt_dts),
+                                              (uint32_t)(afterRender - beforeRender),
+                                              m_LastRenderTimeUs != 0 ? (uint32_t)(afterRender - m_LastRenderTimeUs) : 0);
+    }
+    m_LastRenderTimeUs = afterRender;
+
+    // Once we're synchronized with the host clock, measure the whole
+    // pipeline from the host capturing the frame to us presenting it
+    uint64_t captureTimeUs = 0;
+    if (m_Session != nullptr) {
+        captureTimeUs = m_Session->getHostClock().getCaptureTimeUs((uint32_t)frame->pts);
+        if (captureTimeUs != 0) {
+            uint64_t endToEndLatencyUs = afterRender - captureTimeUs;
+            m_VideoStats->totalEndToEndLatencyUs += endToEndLatencyUs;
+            m_VideoStats->maxEndToEndLatencyUs = qMax(m_VideoStats->maxEndToEndLatencyUs, (uint32_t)endToEndLatencyUs);
+            m_VideoStats->framesWithEndToEndLatency++;
+        }
+    }
+    if (m_FrameTracer) {
+        m_FrameTracer->completeFrame(frame, beforeRender, afterRender, captureTimeUs);
+    }
+    m_FramePool->release(&frame);
+
+    // Drop frames if we have too many queued up for a while
     int frameDropTarget;
 
     if (m_RendererAttributes & RENDERER_ATTRIBUTE_NO_BUFFERING) {
@@ -355,44 +877,29 @@ void Pacer::renderFrame(AVFrame* frame)
         frameDropTarget = 1;
     }
     else {
-        frameDropTarget = 0;
-        for (int queueHistoryEntry : m_RenderQueueHistory) {
-            if (queueHistoryEntry == 0) {
-                // Be lenient as long as the queue length
-                // resolves before the end of frame history
-                frameDropTarget = 2;
-                break;
-            }
-        }
+        // Be lenient as long as the queue length
+        // resolves before the end of frame history
+        frameDropTarget = m_RenderQueueHistory.contains(0) ? 2 : 0;
 
         // Keep a rolling 500 ms window of render queue history
-        if (m_RenderQueueHistory.count() == m_MaxVideoFps / 2) {
-            m_RenderQueueHistory.dequeue();
-        }
-
-        m_RenderQueueHistory.enqueue(m_RenderQueue.count());
+        m_RenderQueueHistory.add(m_RenderQueue.count(), m_MaxVideoFps / 2);
     }
 
+    m_VideoStats->renderQueueDepths[SDL_min(m_RenderQueue.count(), PACER_QUEUE_DEPTH_BUCKETS - 1)]++;
+
     // Catch up if we're several frames ahead
     while (m_RenderQueue.count() > frameDropTarget) {
-        AVFrame* frame = m_RenderQueue.dequeue();
-
-        // Drop the lock while we call av_frame_free()
-        m_FrameQueueLock.unlock();
-        m_VideoStats->pacerDroppedFrames++;
-        av_frame_free(&frame);
-        m_FrameQueueLock.lock();
-    }
-
-    m_FrameQueueLock.unlock();
-}
+        int queueDepth = m_RenderQueue.count();
+        AVFrame* frame = m_RenderQueue.pop();
+        if (frame == nullptr) {
+            break;
+        }
 
-void Pacer::dropFrameForEnqueue(QQueue<AVFrame*>& queue)
-{
-    SDL_assert(queue.size() <= MAX_QUEUED_FRAMES);
-    if (queue.size() == MAX_QUEUED_FRAMES) {
-        AVFrame* frame = queue.dequeue();
-        av_frame_free(&frame);
+        if (m_Session != nullptr) {
+            m_Session->getFlightRecorder().record(FlightRecorder::EventPacerDrop, (uint32_t)frame->pts, queueDepth, frameDropTarget, 1);
+        }
+        m_VideoStats->pacerRenderDrops++;
+        dropFrame(frame);
     }
 }
 
@@ -402,14 +909,11 @@ void Pacer::submitFrame(AVFrame* frame)
     SDL_assert(m_MaxVideoFps != 0);
 
     // Queue the frame and possibly wake up the render thread
-    m_FrameQueueLock.lock();
     if (m_VsyncSource != nullptr) {
-        dropFrameForEnqueue(m_PacingQueue);
-        m_PacingQueue.enqueue(frame);
-        m_FrameQueueLock.unlock();
-        m_PacingQueueNotEmpty.wakeOne();
+        enqueueFrame(m_PacingQueue, frame);
+        m_PacingQueueWakeup.post();
     }
     else {
-        enqueueFrameForRenderingAndUnlock(frame);
+        enqueueFrameForRendering(frame);
     }
 }
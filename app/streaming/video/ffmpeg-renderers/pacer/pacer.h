@@ -1,11 +1,27 @@
 #pragma once
 
 #include "../../decoder.h"
+#include "../../frametracer.h"
+#include "../../framepool.h"
 #include "../renderer.h"
 
-#include <QQueue>
-#include <QMutex>
-#include <QWaitCondition>
+// Limit the number of queued frames to prevent excessive memory consumption
+// if the V-Sync source or renderer is blocked for a while. It's important
+// that the sum of all queued frames between both pacing and rendering queues
+// must not exceed the number buffer pool size to avoid running the decoder
+// out of available decoding surfaces.
+#define MAX_QUEUED_FRAMES 4
+
+// Queue capacity in low memory mode, which frees two decoder surfaces from
+// each queue at the cost of less tolerance for render and V-sync jitter
+#define LOW_MEMORY_QUEUED_FRAMES 2
+
+// The most frames Pacer can reference at once. This is a full render queue,
+// a full pacing queue if frame pacing is enabled, and the frame being rendered.
+#define PACER_MAX_HELD_FRAMES(pacing) (MAX_QUEUED_FRAMES * ((pacing) ? 2 : 1) + 1)
+
+// Enough for 500 ms of history at 500 FPS
+#define MAX_QUEUE_HISTORY_ENTRIES 250
 
 class IVsyncSource {
 public:
@@ -20,12 +36,81 @@ public:
         // Synchronous sources must implement waitForVsync()!
         SDL_assert(false);
     }
+
+    // Called on the main thread when the renderer handled a window state
+    // change without being recreated (for example, moving to a new display).
+    virtual void notifyWindowChanged(PWINDOW_STATE_CHANGE_INFO) {}
+};
+
+// Bounded lock-free frame queue with a single producer. Frames may be popped
+// by the consumer or by the producer (to drop the oldest frame when the queue
+// is full), so pops claim their slot with a compare-and-swap.
+class PacerFrameQueue
+{
+public:
+    PacerFrameQueue();
+
+    // Must be called before the queue is in use. Capacity may not exceed MAX_QUEUED_FRAMES.
+    void setCapacity(int capacity);
+
+    // Producer only. Returns false if the queue is full.
+    bool push(AVFrame* frame);
+
+    // Returns nullptr if the queue is empty
+    AVFrame* pop();
+
+    int count();
+
+    bool isEmpty() { return count() == 0; }
+
+private:
+    void* m_Slots[MAX_QUEUED_FRAMES];
+    int m_Capacity;
+    SDL_atomic_t m_ReadIndex;
+    SDL_atomic_t m_WriteIndex;
+};
+
+// Fixed-size rolling window of queue lengths. Only accessed by one thread.
+class PacerQueueHistory
+{
+public:
+    PacerQueueHistory() : m_Head(0), m_Count(0) {}
+
+    // Adds an entry, discarding the oldest once maxEntries are present
+    void add(int queueLength, int maxEntries);
+
+    bool contains(int maxQueueLength) const;
+
+private:
+    int m_Entries[MAX_QUEUE_HISTORY_ENTRIES];
+    int m_Head;
+    int m_Count;
+};
+
+// Wakes a single consumer thread. Posts made before the consumer gets around
+// to waiting are coalesced into one wakeup, so consumers that find a frame
+// without waiting don't leave the semaphore counting up stale wakeups.
+class PacerWakeup
+{
+public:
+    PacerWakeup();
+
+    ~PacerWakeup();
+
+    void post();
+
+    // Returns false if the timeout expired. A negative timeout waits forever.
+    bool wait(int timeoutMs);
+
+private:
+    SDL_sem* m_Sem;
+    SDL_atomic_t m_Pending;
 };
 
 class Pacer
 {
 public:
-    Pacer(IFFmpegRenderer* renderer, PVIDEO_STATS videoStats);
+    Pacer(IFFmpegRenderer* renderer, Session* session, PVIDEO_STATS videoStats, FrameTracer* frameTracer, FramePool* framePool);
 
     ~Pacer();
 
@@ -35,8 +120,18 @@ public:
 
     void signalVsync();
 
+    // Called by V-sync sources that learn when frames actually reached the
+    // display. Times are in the LiGetMicroseconds() timebase.
+    void reportPresentation(uint64_t presentTimeUs, uint32_t refreshIntervalUs);
+
+    void notifyWindowChanged(PWINDOW_STATE_CHANGE_INFO info);
+
     void renderOnMainThread();
 
+    // Adds the stats that several Pacer threads update to the stats window.
+    // Called on the decoder thread as each window closes.
+    void takeWindowStats(PVIDEO_STATS stats);
+
 private:
     static int vsyncThread(void* context);
 
@@ -44,28 +139,84 @@ private:
 
     void handleVsync(int timeUntilNextVsyncMillis);
 
-    void enqueueFrameForRenderingAndUnlock(AVFrame* frame);
+    int getTimeUntilNextVsyncMillis();
+
+    void enqueueFrameForRendering(AVFrame* frame);
 
     void renderFrame(AVFrame* frame);
 
-    void dropFrameForEnqueue(QQueue<AVFrame*>& queue);
+    void dropFrame(AVFrame* frame);
+
+    void enqueueFrame(PacerFrameQueue& queue, AVFrame* frame);
+
+    void trackFrameArrival(AVFrame* frame);
+
+    void trackVsync();
 
-    QQueue<AVFrame*> m_RenderQueue;
-    QQueue<AVFrame*> m_PacingQueue;
-    QQueue<int> m_PacingQueueHistory;
-    QQueue<int> m_RenderQueueHistory;
-    QMutex m_FrameQueueLock;
-    QWaitCondition m_RenderQueueNotEmpty;
-    QWaitCondition m_PacingQueueNotEmpty;
-    QWaitCondition m_VsyncSignalled;
+    void waitForJitPresentTime();
+
+    int updateAdaptivePacing();
+
+    void repeatFrameForMixing();
+
+    // The pacing queue is fed by the decoder thread and drained by the V-sync
+    // thread. The render queue is fed by one of those (depending on whether we
+    // have a V-sync source) and drained by the render thread or main thread.
+    // The wakeups are posted after each push to wake a waiting consumer.
+    PacerFrameQueue m_RenderQueue;
+    PacerFrameQueue m_PacingQueue;
+    PacerQueueHistory m_PacingQueueHistory;
+    PacerQueueHistory m_RenderQueueHistory;
+    PacerWakeup m_RenderQueueWakeup;
+    PacerWakeup m_PacingQueueWakeup;
+    PacerWakeup m_VsyncWakeup;
     SDL_Thread* m_RenderThread;
     SDL_Thread* m_VsyncThread;
-    bool m_Stopping;
+    SDL_atomic_t m_Stopping;
+
+    // Stats updated by more than one thread. The rest are only written by
+    // one Pacer thread and go straight into m_VideoStats.
+    SDL_atomic_t m_DroppedFrames;
+    SDL_atomic_t m_OverflowDrops;
+    SDL_atomic_t m_MaxQueuedFrames;
 
     IVsyncSource* m_VsyncSource;
     IFFmpegRenderer* m_VsyncRenderer;
+    Session* m_Session;
     int m_MaxVideoFps;
     int m_DisplayFps;
     PVIDEO_STATS m_VideoStats;
+    FrameTracer* m_FrameTracer;
+    FramePool* m_FramePool;
+
+    // Only used by the rendering thread to sample frame times for the performance graph
+    uint64_t m_LastRenderTimeUs;
+
+    // Detailed render stats are only collected every m_StatsSampleInterval frames
+    int m_StatsSampleInterval;
+    int m_StatsSampleCounter;
+
+    // Adaptive pacing (PACER_ADAPTIVE=1) state, only used by the V-sync thread
+    bool m_AdaptivePacing;
+    uint64_t m_LastVsyncTimeUs;
+    double m_VsyncPeriodUs;
+    double m_ArrivalPhaseUs;
+    double m_ArrivalJitterUs;
+    int m_AdaptiveFrameDropTarget;
+
+    // Last scanout reported by the V-sync source, or 0 if it can't tell us
+    SDL_SpinLock m_PresentationLock;
+    uint64_t m_PresentTimeUs;
+    uint32_t m_RefreshIntervalUs;
+
+    // Just-in-time present (PACER_JIT_PRESENT=1) state. The render cost
+    // estimate is written by the rendering thread and read on V-sync.
+    bool m_JitPresent;
+    SDL_atomic_t m_RenderCostUs;
     int m_RendererAttributes;
+
+    // Frame mixing state. The V-sync thread keeps a reference to the last frame
+    // it queued, and the rendering thread uses the PTS to recognize repeats.
+    AVFrame* m_MixRepeatFrame;
+    int64_t m_LastRenderedPts;
 };
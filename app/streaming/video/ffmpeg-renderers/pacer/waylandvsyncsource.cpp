@@ -1,7 +1,11 @@
 #include "waylandvsyncsource.h"
 
+#include <Limelight.h>
 #include <SDL_syswm.h>
 
+#include <cstring>
+#include <ctime>
+
 #ifndef SDL_VIDEO_DRIVER_WAYLAND
 #warning Unable to use WaylandVsyncSource without SDL support
 #else
@@ -10,19 +14,59 @@ const struct wl_callback_listener WaylandVsyncSource::s_FrameListener = {
     .done = WaylandVsyncSource::frameDone,
 };
 
+#ifdef HAS_WP_PRESENTATION
+const struct wl_registry_listener WaylandVsyncSource::s_RegistryListener = {
+    .global = WaylandVsyncSource::registryGlobal,
+    .global_remove = WaylandVsyncSource::registryGlobalRemove,
+};
+
+const struct wp_presentation_listener WaylandVsyncSource::s_PresentationListener = {
+    .clock_id = WaylandVsyncSource::presentationClockId,
+};
+
+const struct wp_presentation_feedback_listener WaylandVsyncSource::s_FeedbackListener = {
+    .sync_output = WaylandVsyncSource::feedbackSyncOutput,
+    .presented = WaylandVsyncSource::feedbackPresented,
+    .discarded = WaylandVsyncSource::feedbackDiscarded,
+};
+#endif
+
 WaylandVsyncSource::WaylandVsyncSource(Pacer* pacer)
     : m_Pacer(pacer),
       m_Display(nullptr),
       m_Surface(nullptr),
       m_Callback(nullptr)
+#ifdef HAS_WP_PRESENTATION
+      , m_Presentation(nullptr),
+      m_PresentationClock(CLOCK_MONOTONIC)
+#endif
 {
 
 }
 
 WaylandVsyncSource::~WaylandVsyncSource()
 {
+    bool needsRoundtrip = false;
+
     if (m_Callback != nullptr) {
         wl_callback_destroy(m_Callback);
+        needsRoundtrip = true;
+    }
+
+#ifdef HAS_WP_PRESENTATION
+    for (struct wp_presentation_feedback* feedback : m_PendingFeedback) {
+        wp_presentation_feedback_destroy(feedback);
+        needsRoundtrip = true;
+    }
+    m_PendingFeedback.clear();
+
+    if (m_Presentation != nullptr) {
+        wp_presentation_destroy(m_Presentation);
+        needsRoundtrip = true;
+    }
+#endif
+
+    if (needsRoundtrip) {
         wl_display_roundtrip(m_Display);
     }
 }
@@ -46,11 +90,19 @@ bool WaylandVsyncSource::initialize(SDL_Window* window, int)
     m_Display = info.info.wl.display;
     m_Surface = info.info.wl.surface;
 
+#ifdef HAS_WP_PRESENTATION
+    bindPresentation();
+#endif
+
     // Enqueue our first frame callback
     m_Callback = wl_surface_frame(m_Surface);
     wl_callback_add_listener(m_Callback, &s_FrameListener, this);
     wl_surface_commit(m_Surface);
 
+#ifdef HAS_WP_PRESENTATION
+    requestPresentationFeedback();
+#endif
+
     return true;
 }
 
@@ -75,7 +127,118 @@ void WaylandVsyncSource::frameDone(void* data, struct wl_callback* oldCb, uint32
     me->m_Callback = wl_surface_frame(me->m_Surface);
     wl_callback_add_listener(me->m_Callback, &s_FrameListener, data);
     wl_surface_commit(me->m_Surface);
+
+#ifdef HAS_WP_PRESENTATION
+    me->requestPresentationFeedback();
+#endif
+
     wl_display_flush(me->m_Display);
 }
 
+#ifdef HAS_WP_PRESENTATION
+
+void WaylandVsyncSource::bindPresentation()
+{
+    // Use our own queue so we don't dispatch SDL's events on this thread
+    wl_event_queue* queue = wl_display_create_queue(m_Display);
+    wl_registry* registry = wl_display_get_registry(m_Display);
+    wl_proxy_set_queue((wl_proxy*)registry, queue);
+    wl_registry_add_listener(registry, &s_RegistryListener, this);
+
+    // The first roundtrip binds wp_presentation and the second delivers its clock ID
+    wl_display_roundtrip_queue(m_Display, queue);
+    if (m_Presentation != nullptr) {
+        wl_display_roundtrip_queue(m_Display, queue);
+
+        // Feedback events are dispatched along with our frame callbacks
+        wl_proxy_set_queue((wl_proxy*)m_Presentation, nullptr);
+
+        SDL_LogInfo(SDL_LOG_CATEGORY_APPLICATION,
+                    "Using Wayland presentation feedback for V-sync timing");
+    }
+    else {
+        SDL_LogInfo(SDL_LOG_CATEGORY_APPLICATION,
+                    "Wayland compositor doesn't support presentation feedback");
+    }
+
+    wl_registry_destroy(registry);
+    wl_event_queue_destroy(queue);
+}
+
+void WaylandVsyncSource::requestPresentationFeedback()
+{
+    if (m_Presentation == nullptr) {
+        return;
+    }
+
+    // This is requested after our own commit, so it applies to the renderer's
+    // next commit. That's the content update we want to know the timing of.
+    struct wp_presentation_feedback* feedback = wp_presentation_feedback(m_Presentation, m_Surface);
+    wp_presentation_feedback_add_listener(feedback, &s_FeedbackListener, this);
+    m_PendingFeedback.insert(feedback);
+}
+
+void WaylandVsyncSource::registryGlobal(void* data, struct wl_registry* registry, uint32_t name,
+                                        const char* interface, uint32_t)
+{
+    auto me = (WaylandVsyncSource*)data;
+
+    if (strcmp(interface, wp_presentation_interface.name) == 0 && me->m_Presentation == nullptr) {
+        me->m_Presentation = (wp_presentation*)wl_registry_bind(registry, name, &wp_presentation_interface, 1);
+        wp_presentation_add_listener(me->m_Presentation, &s_PresentationListener, data);
+    }
+}
+
+void WaylandVsyncSource::registryGlobalRemove(void*, struct wl_registry*, uint32_t)
+{
+}
+
+void WaylandVsyncSource::presentationClockId(void* data, struct wp_presentation*, uint32_t clockId)
+{
+    auto me = (WaylandVsyncSource*)data;
+
+    me->m_PresentationClock = (clockid_t)clockId;
+}
+
+void WaylandVsyncSource::feedbackSyncOutput(void*, struct wp_presentation_feedback*, struct wl_output*)
+{
+}
+
+void WaylandVsyncSource::feedbackPresented(void* data, struct wp_presentation_feedback* feedback,
+                                           uint32_t tvSecHi, uint32_t tvSecLo, uint32_t tvNsec,
+                                           uint32_t refresh, uint32_t, uint32_t, uint32_t)
+{
+    auto me = (WaylandVsyncSource*)data;
+
+    me->m_PendingFeedback.remove(feedback);
+    wp_presentation_feedback_destroy(feedback);
+
+    // Convert the presentation clock to our timebase by measuring how long ago
+    // the presentation happened, since the compositor may use any clock
+    struct timespec now;
+    if (clock_gettime(me->m_PresentationClock, &now) != 0) {
+        return;
+    }
+
+    uint64_t presentedNs = ((((uint64_t)tvSecHi << 32) | tvSecLo) * 1000000000ULL) + tvNsec;
+    uint64_t nowNs = ((uint64_t)now.tv_sec * 1000000000ULL) + (uint64_t)now.tv_nsec;
+    if (presentedNs > nowNs) {
+        return;
+    }
+
+    // A refresh of 0 means the output has no constant refresh rate (VRR)
+    me->m_Pacer->reportPresentation(LiGetMicroseconds() - (nowNs - presentedNs) / 1000, refresh / 1000);
+}
+
+void WaylandVsyncSource::feedbackDiscarded(void* data, struct wp_presentation_feedback* feedback)
+{
+    auto me = (WaylandVsyncSource*)data;
+
+    // The update was replaced before it was shown, so there's no timing for it
+    me->m_PendingFeedback.remove(feedback);
+    wp_presentation_feedback_destroy(feedback);
+}
+
+#endif
+
 #endif
@@ -5,6 +5,12 @@
 #include <wayland-client-core.h>
 #include <wayland-client-protocol.h>
 
+#ifdef HAS_WP_PRESENTATION
+#include "presentation-time-client-protocol.h"
+
+#include <QSet>
+#endif
+
 class WaylandVsyncSource : public IVsyncSource
 {
 public:
@@ -21,9 +27,41 @@ private:
 
     static const struct wl_callback_listener s_FrameListener;
 
+#ifdef HAS_WP_PRESENTATION
+    void bindPresentation();
+
+    void requestPresentationFeedback();
+
+    static void registryGlobal(void* data, struct wl_registry* registry, uint32_t name,
+                               const char* interface, uint32_t version);
+
+    static void registryGlobalRemove(void* data, struct wl_registry* registry, uint32_t name);
+
+    static void presentationClockId(void* data, struct wp_presentation* presentation, uint32_t clockId);
+
+    static void feedbackSyncOutput(void* data, struct wp_presentation_feedback* feedback, struct wl_output* output);
+
+    static void feedbackPresented(void* data, struct wp_presentation_feedback* feedback,
+                                  uint32_t tvSecHi, uint32_t tvSecLo, uint32_t tvNsec,
+                                  uint32_t refresh, uint32_t seqHi, uint32_t seqLo, uint32_t flags);
+
+    static void feedbackDiscarded(void* data, struct wp_presentation_feedback* feedback);
+
+    static const struct wl_registry_listener s_RegistryListener;
+    static const struct wp_presentation_listener s_PresentationListener;
+    static const struct wp_presentation_feedback_listener s_FeedbackListener;
+#endif
+
     Pacer* m_Pacer;
     wl_display* m_Display;
     wl_surface* m_Surface;
     wl_callback* m_Callback;
-};
 
+#ifdef HAS_WP_PRESENTATION
+    wp_presentation* m_Presentation;
+    clockid_t m_PresentationClock;
+
+    // Only touched by the thread dispatching the default event queue
+    QSet<struct wp_presentation_feedback*> m_PendingFeedback;
+#endif
+};
@@ -2,6 +2,7 @@
 
 #include "streaming/session.h"
 #include "streaming/streamutils.h"
+#include "path.h"
 
 // Implementation in plvk_c.c
 #define PL_LIBAV_IMPLEMENTATION 0
@@ -14,6 +15,13 @@
 #include <vector>
 #include <set>
 
+#include <QFile>
+
+// Frame mixing tracks the offset between our clock and the stream's timestamps
+// with this smoothing factor, and resyncs if a frame is this far from it.
+#define FRAME_MIX_CLOCK_ALPHA 0.05
+#define FRAME_MIX_RESYNC_SECS 0.1
+
 #ifndef VK_KHR_video_decode_av1
 #define VK_KHR_VIDEO_DECODE_AV1_EXTENSION_NAME "VK_KHR_video_decode_av1"
 #define VK_VIDEO_CODEC_OPERATION_DECODE_AV1_BIT_KHR ((VkVideoCodecOperationFlagBitsKHR)0x00000004)
@@ -98,6 +106,24 @@ void PlVkRenderer::overlayUploadComplete(void* opaque)
     SDL_FreeSurface((SDL_Surface*)opaque);
 }
 
+void PlVkRenderer::renderInfoCallback(void* priv, const pl_render_info* info)
+{
+    auto me = (PlVkRenderer*)priv;
+
+    // This is the most recent GPU time measured for this pass, which may
+    // be from a previous frame since timer queries complete asynchronously.
+    me->m_RenderGpuTimeNs += info->pass->last;
+
+    // libplacebo labels the passes that resample the image with the filter or hook name
+    pl_shader_info shader = info->pass->shader;
+    for (int i = 0; i < shader->num_steps; i++) {
+        if (strstr(shader->steps[i], "sampling") || strstr(shader->steps[i], "scaling")) {
+            me->m_ScaleGpuTimeNs += info->pass->last;
+            break;
+        }
+    }
+}
+
 PlVkRenderer::PlVkRenderer(bool hwaccel, IFFmpegRenderer *backendRenderer) :
     IFFmpegRenderer(RendererType::Vulkan),
     m_Backend(backendRenderer),
@@ -125,20 +151,38 @@ PlVkRenderer::~PlVkRenderer()
     SDL_assert(!m_HasPendingSwapchainFrame);
 
     if (m_Vulkan != nullptr) {
+        // This unmaps and frees any frames still in the queue
+        pl_queue_destroy(&m_FrameQueue);
+        pl_mpv_user_shader_destroy(&m_UpscalerHook);
+
         for (int i = 0; i < (int)SDL_arraysize(m_Overlays); i++) {
             pl_tex_destroy(m_Vulkan->gpu, &m_Overlays[i].overlay.tex);
             pl_tex_destroy(m_Vulkan->gpu, &m_Overlays[i].stagingOverlay.tex);
+            pl_timer_destroy(m_Vulkan->gpu, &m_Overlays[i].uploadTimer);
         }
 
+        pl_tex_destroy(m_Vulkan->gpu, &m_PerfGraphMask);
+
+#ifdef HAVE_CUDA
+        delete m_CudaInterop;
+#endif
+
         for (int i = 0; i < (int)SDL_arraysize(m_Textures); i++) {
             pl_tex_destroy(m_Vulkan->gpu, &m_Textures[i]);
         }
     }
 
+    savePipelineCache();
+
     pl_renderer_destroy(&m_Renderer);
     pl_swapchain_destroy(&m_Swapchain);
     pl_vulkan_destroy(&m_Vulkan);
 
+#if PL_API_VER >= 338
+    // The GPU is gone, so nothing references the cache anymore
+    pl_cache_destroy(&m_PipelineCache);
+#endif
+
     // This surface was created by SDL, so there's no libplacebo API to destroy it
     if (fn_vkDestroySurfaceKHR && m_VkSurface) {
         fn_vkDestroySurfaceKHR(m_PlVkInstance->instance, m_VkSurface, nullptr);
@@ -154,6 +198,68 @@ PlVkRenderer::~PlVkRenderer()
     pl_log_destroy(&m_Log);
 }
 
+void PlVkRenderer::loadPipelineCache()
+{
+#if PL_API_VER >= 338
+    if (qgetenv("PLVK_PIPELINE_CACHE") == "0") {
+        return;
+    }
+
+    pl_cache_params cacheParams = {};
+    cacheParams.log = m_Log;
+    m_PipelineCache = pl_cache_create(&cacheParams);
+    if (m_PipelineCache == nullptr) {
+        return;
+    }
+
+    // Pipeline binaries are only valid for the device and driver that made
+    // them, which is what pipelineCacheUUID identifies
+    VkPhysicalDeviceProperties deviceProps;
+    fn_vkGetPhysicalDeviceProperties(m_Vulkan->phys_device, &deviceProps);
+    m_PipelineCacheFileName = QString("plvk_%1.cache")
+            .arg(QString(QByteArray((const char*)deviceProps.pipelineCacheUUID, VK_UUID_SIZE).toHex()));
+
+    QByteArray cacheData = Path::readCacheFile(m_PipelineCacheFileName);
+    if (!cacheData.isEmpty()) {
+        int objects = pl_cache_load(m_PipelineCache, (const uint8_t*)cacheData.constData(), cacheData.size());
+        if (objects < 0) {
+            SDL_LogWarn(SDL_LOG_CATEGORY_APPLICATION,
+                        "Discarding invalid Vulkan pipeline cache");
+        }
+        else {
+            SDL_LogInfo(SDL_LOG_CATEGORY_APPLICATION,
+                        "Loaded %d cached shaders and pipelines",
+                        objects);
+        }
+    }
+
+    // Remember what we loaded, so we only write the cache back if it changed
+    m_PipelineCacheSignature = pl_cache_signature(m_PipelineCache);
+
+    // Everything that compiles shaders on this GPU, including the renderer,
+    // checks this cache first
+    pl_gpu_set_cache(m_Vulkan->gpu, m_PipelineCache);
+#endif
+}
+
+void PlVkRenderer::savePipelineCache()
+{
+#if PL_API_VER >= 338
+    if (m_PipelineCache == nullptr || pl_cache_signature(m_PipelineCache) == m_PipelineCacheSignature) {
+        return;
+    }
+
+    QByteArray cacheData(pl_cache_save(m_PipelineCache, nullptr, 0), Qt::Uninitialized);
+    cacheData.resize(pl_cache_save(m_PipelineCache, (uint8_t*)cacheData.data(), cacheData.size()));
+    Path::writeCacheFile(m_PipelineCacheFileName, cacheData);
+
+    SDL_LogInfo(SDL_LOG_CATEGORY_APPLICATION,
+                "Saved %d shaders and pipelines to the Vulkan pipeline cache",
+                pl_cache_objects(m_PipelineCache));
+    m_PipelineCacheSignature = pl_cache_signature(m_PipelineCache);
+#endif
+}
+
 bool PlVkRenderer::chooseVulkanDevice(PDECODER_PARAMETERS params, bool hdrOutputRequired)
 {
     uint32_t physicalDeviceCount = 0;
@@ -313,6 +419,17 @@ bool PlVkRenderer::tryInitializeDevice(VkPhysicalDevice device, VkPhysicalDevice
         return false;
     }
 
+#ifdef HAVE_CUDA
+    // CUDA can only share memory and semaphores with a device on the same GPU
+    if (m_Backend != nullptr && m_Backend->getRendererType() == IFFmpegRenderer::RendererType::CUDA &&
+            !isCudaBackendDevice(device)) {
+        SDL_LogWarn(SDL_LOG_CATEGORY_APPLICATION,
+                    "Vulkan device '%s' is not the CUDA decoding device",
+                    deviceProps->deviceName);
+        return false;
+    }
+#endif
+
     pl_vulkan_params vkParams = pl_vulkan_default_params;
     vkParams.instance = m_PlVkInstance->instance;
     vkParams.get_proc_addr = m_PlVkInstance->get_proc_addr;
@@ -321,6 +438,13 @@ bool PlVkRenderer::tryInitializeDevice(VkPhysicalDevice device, VkPhysicalDevice
     vkParams.opt_extensions = k_OptionalDeviceExtensions;
     vkParams.num_opt_extensions = SDL_arraysize(k_OptionalDeviceExtensions);
     vkParams.extra_queues = m_HwAccelBackend ? VK_QUEUE_FLAG_BITS_MAX_ENUM : 0;
+
+    // Let libplacebo run texture uploads (overlays and software frames) on a
+    // dedicated transfer queue if the device has one, so they can execute
+    // concurrently with rendering instead of being serialized on the
+    // graphics queue.
+    vkParams.async_transfer = qgetenv("PLVK_ASYNC_TRANSFER") != "0";
+    vkParams.async_compute = true;
     m_Vulkan = pl_vulkan_create(m_Log, &vkParams);
     if (m_Vulkan == nullptr) {
         SDL_LogError(SDL_LOG_CATEGORY_APPLICATION,
@@ -351,6 +475,27 @@ bool PlVkRenderer::isExtensionSupportedByPhysicalDevice(VkPhysicalDevice device,
     return false;
 }
 
+#ifdef HAVE_CUDA
+bool PlVkRenderer::isCudaBackendDevice(VkPhysicalDevice device)
+{
+    uint8_t cudaUuid[VK_UUID_SIZE];
+    if (!static_cast<CUDARenderer*>(m_Backend)->getDeviceUuid(cudaUuid)) {
+        // This function logs internally
+        return false;
+    }
+
+    VkPhysicalDeviceIDProperties idProps = {};
+    idProps.sType = VK_STRUCTURE_TYPE_PHYSICAL_DEVICE_ID_PROPERTIES;
+
+    VkPhysicalDeviceProperties2 deviceProps = {};
+    deviceProps.sType = VK_STRUCTURE_TYPE_PHYSICAL_DEVICE_PROPERTIES_2;
+    deviceProps.pNext = &idProps;
+    fn_vkGetPhysicalDeviceProperties2(device, &deviceProps);
+
+    return memcmp(idProps.deviceUUID, cudaUuid, VK_UUID_SIZE) == 0;
+}
+#endif
+
 #define POPULATE_FUNCTION(name) \
     fn_##name = (PFN_##name)m_PlVkInstance->get_proc_addr(m_PlVkInstance->instance, #name); \
     if (fn_##name == nullptr) { \
@@ -404,6 +549,7 @@ bool PlVkRenderer::initialize(PDECODER_PARAMETERS params)
     POPULATE_FUNCTION(vkGetPhysicalDeviceSurfaceFormatsKHR);
     POPULATE_FUNCTION(vkEnumeratePhysicalDevices);
     POPULATE_FUNCTION(vkGetPhysicalDeviceProperties);
+    POPULATE_FUNCTION(vkGetPhysicalDeviceProperties2);
     POPULATE_FUNCTION(vkGetPhysicalDeviceSurfaceSupportKHR);
     POPULATE_FUNCTION(vkEnumerateDeviceExtensionProperties);
 
@@ -462,10 +608,50 @@ bool PlVkRenderer::initialize(PDECODER_PARAMETERS params)
         }
     }
 
+#ifdef Q_OS_WIN32
+    // Waiting for the previous present before acquiring the next swapchain image
+    // gives the lowest latency, but it seems to cause performance problems with the
+    // Windows display stack (particularly on Nvidia), so it's opt-in on Windows.
+    m_SwapBeforeAcquire = qgetenv("PLVK_SWAP_BEFORE_ACQUIRE") == "1";
+#else
+    m_SwapBeforeAcquire = qgetenv("PLVK_SWAP_BEFORE_ACQUIRE") != "0";
+#endif
+    SDL_LogInfo(SDL_LOG_CATEGORY_APPLICATION,
+                "Waiting for previous present %s acquiring swapchain images",
+                m_SwapBeforeAcquire ? "before" : "after");
+
+    // Tone mapping HDR content for an SDR display normally builds a 3D gamut
+    // mapping LUT and adapts to the source's metadata. This mode instead uses a
+    // 1D tone curve from the static HDR10 metadata and clips out of gamut colors,
+    // which costs the same every frame and is cheap enough for weak GPUs.
+    m_FastToneMapping = qEnvironmentVariableIntValue("PLVK_FAST_TONE_MAPPING") != 0;
+    if (m_FastToneMapping) {
+        m_FastColorMapParams = pl_color_map_default_params;
+#if PL_API_VER >= 269
+        m_FastColorMapParams.gamut_mapping = &pl_gamut_map_clip;
+        m_FastColorMapParams.metadata = PL_HDR_METADATA_HDR10;
+#endif
+        SDL_LogInfo(SDL_LOG_CATEGORY_APPLICATION,
+                    "Using fast tone mapping for HDR content on SDR displays");
+    }
+
+    // By default, we allow no queued frames to minimize latency. GPUs that can't
+    // keep up with that can be given more frames in flight at the cost of latency.
+    bool ok;
+    int framesInFlight = qEnvironmentVariableIntValue("PLVK_FRAMES_IN_FLIGHT", &ok);
+    if (!ok || framesInFlight < 1) {
+        framesInFlight = 1;
+    }
+    else {
+        SDL_LogInfo(SDL_LOG_CATEGORY_APPLICATION,
+                    "Using %d frames in flight due to environment variable",
+                    framesInFlight);
+    }
+
     pl_vulkan_swapchain_params vkSwapchainParams = {};
     vkSwapchainParams.surface = m_VkSurface;
     vkSwapchainParams.present_mode = presentMode;
-    vkSwapchainParams.swapchain_depth = 1; // No queued frames
+    vkSwapchainParams.swapchain_depth = framesInFlight;
 #if PL_API_VER >= 338
     vkSwapchainParams.disable_10bit_sdr = true; // Some drivers don't dither 10-bit SDR output correctly
 #endif
@@ -476,6 +662,9 @@ bool PlVkRenderer::initialize(PDECODER_PARAMETERS params)
         return false;
     }
 
+    // Do this before creating anything that compiles shaders
+    loadPipelineCache();
+
     m_Renderer = pl_renderer_create(m_Log, m_Vulkan->gpu);
     if (m_Renderer == nullptr) {
         SDL_LogError(SDL_LOG_CATEGORY_APPLICATION,
@@ -483,6 +672,86 @@ bool PlVkRenderer::initialize(PDECODER_PARAMETERS params)
         return false;
     }
 
+    // ML_UPSCALER picks the filter for scaling the stream up to the window size,
+    // such as lanczos, ewa_lanczos or spline36. An mpv-style user shader (like
+    // the FSR or NIS ports) can also be loaded with ML_UPSCALER_SHADER.
+    QByteArray upscalerName = qgetenv("ML_UPSCALER");
+    if (!upscalerName.isEmpty()) {
+        m_Upscaler = pl_find_filter_config(upscalerName.constData(), PL_FILTER_UPSCALING);
+        if (m_Upscaler != nullptr) {
+            SDL_LogInfo(SDL_LOG_CATEGORY_APPLICATION,
+                        "Using upscaler: %s",
+                        m_Upscaler->name);
+        }
+        else {
+            SDL_LogWarn(SDL_LOG_CATEGORY_APPLICATION,
+                        "Unknown upscaler: %s",
+                        upscalerName.constData());
+        }
+    }
+
+    QString upscalerShaderPath = QString::fromLocal8Bit(qgetenv("ML_UPSCALER_SHADER"));
+    if (!params->testOnly && !upscalerShaderPath.isEmpty()) {
+        QFile shaderFile(upscalerShaderPath);
+        if (shaderFile.open(QIODevice::ReadOnly)) {
+            QByteArray shaderSource = shaderFile.readAll();
+            m_UpscalerHook = pl_mpv_user_shader_parse(m_Vulkan->gpu, shaderSource.constData(), shaderSource.size());
+            if (m_UpscalerHook != nullptr) {
+                SDL_LogInfo(SDL_LOG_CATEGORY_APPLICATION,
+                            "Using upscaler shader: %s",
+                            qPrintable(upscalerShaderPath));
+            }
+            else {
+                SDL_LogError(SDL_LOG_CATEGORY_APPLICATION,
+                             "pl_mpv_user_shader_parse() failed: %s",
+                             qPrintable(upscalerShaderPath));
+            }
+        }
+        else {
+            SDL_LogError(SDL_LOG_CATEGORY_APPLICATION,
+                         "Unable to open upscaler shader: %s",
+                         qPrintable(upscalerShaderPath));
+        }
+    }
+
+    // When the display refreshes faster than the stream, Pacer can render each
+    // V-sync and we blend the neighboring frames for each display time instead
+    // of repeating frames unevenly (like 60 FPS on a 144 Hz display).
+    if (!params->testOnly && params->enableFramePacing && qEnvironmentVariableIntValue("ML_FRAME_MIXING") != 0) {
+        int displayHz = StreamUtils::getDisplayRefreshRate(params->window);
+        if (params->frameRate < displayHz) {
+            m_FrameQueue = pl_queue_create(m_Vulkan->gpu);
+            m_MixFrameDurationSecs = 1.0 / params->frameRate;
+            m_MixVsyncDurationSecs = 1.0 / displayHz;
+        }
+        else {
+            SDL_LogInfo(SDL_LOG_CATEGORY_APPLICATION,
+                        "Frame mixing not needed for %d FPS stream on %d Hz display",
+                        params->frameRate, displayHz);
+        }
+    }
+
+    // The performance graph is drawn as monochrome overlay parts,
+    // which only need an opaque 1x1 mask texture to sample from.
+    pl_fmt maskFormat = pl_find_named_fmt(m_Vulkan->gpu, "r8");
+    if (maskFormat) {
+        static const uint8_t k_OpaqueMask = 0xFF;
+
+        pl_tex_params texParams = {};
+        texParams.w = 1;
+        texParams.h = 1;
+        texParams.format = maskFormat;
+        texParams.sampleable = true;
+        texParams.initial_data = &k_OpaqueMask;
+        texParams.debug_tag = PL_DEBUG_TAG;
+        m_PerfGraphMask = pl_tex_create(m_Vulkan->gpu, &texParams);
+    }
+    if (m_PerfGraphMask == nullptr) {
+        // Not fatal. We just won't be able to draw the performance graph.
+        SDL_LogWarn(SDL_LOG_CATEGORY_APPLICATION,
+                    "Unable to create performance graph mask texture");
+    }
+
     // We only need an hwaccel device context if we're going to act as the backend renderer too
     if (m_HwAccelBackend) {
         m_HwDeviceCtx = av_hwdevice_ctx_alloc(AV_HWDEVICE_TYPE_VULKAN);
@@ -543,15 +812,44 @@ bool PlVkRenderer::prepareDecoderContext(AVCodecContext *context, AVDictionary *
 
 bool PlVkRenderer::mapAvFrameToPlacebo(const AVFrame *frame, pl_frame* mappedFrame)
 {
-    pl_avframe_params mapParams = {};
-    mapParams.frame = frame;
-    mapParams.tex = m_Textures;
-    if (!pl_map_avframe_ex(m_Vulkan->gpu, mappedFrame, &mapParams)) {
-        SDL_LogError(SDL_LOG_CATEGORY_APPLICATION,
-                     "pl_map_avframe_ex() failed");
-        return false;
+#ifdef HAVE_CUDA
+    if (frame->format == AV_PIX_FMT_CUDA) {
+        // libplacebo can't map CUDA frames itself, so we copy them into
+        // Vulkan textures on the GPU using CUDA's external memory support.
+        if (m_CudaInterop == nullptr) {
+            auto framesContext = (AVHWFramesContext*)frame->hw_frames_ctx->data;
+            m_CudaInterop = new CUDAVkInteropHelper(framesContext->device_ctx, m_Vulkan->gpu);
+        }
+
+        // This populates everything but the plane textures. Since we don't
+        // go through pl_map_avframe_ex(), user_data remains null.
+        pl_frame_from_avframe(mappedFrame, frame);
+        SDL_assert(mappedFrame->user_data == nullptr);
+
+        if (!m_CudaInterop->copyCudaFrameToTextures((AVFrame*)frame, mappedFrame)) {
+            // This function logs internally
+            return false;
+        }
     }
+    else
+#endif
+    {
+        pl_avframe_params mapParams = {};
+        mapParams.frame = frame;
+        mapParams.tex = m_Textures;
+        if (!pl_map_avframe_ex(m_Vulkan->gpu, mappedFrame, &mapParams)) {
+            SDL_LogError(SDL_LOG_CATEGORY_APPLICATION,
+                         "pl_map_avframe_ex() failed");
+            return false;
+        }
+    }
+
+    fixupMappedFrame(frame, mappedFrame);
+    return true;
+}
 
+void PlVkRenderer::fixupMappedFrame(const AVFrame* frame, pl_frame* mappedFrame)
+{
     // libplacebo assumes a minimum luminance value of 0 means the actual value was unknown.
     // Since we assume the host values are correct, we use the PL_COLOR_HDR_BLACK constant to
     // indicate infinite contrast.
@@ -567,8 +865,113 @@ bool PlVkRenderer::mapAvFrameToPlacebo(const AVFrame *frame, pl_frame* mappedFra
     //
     // As a workaround, set full range manually in the mapped frame ourselves.
     mappedFrame->repr.levels = PL_COLOR_LEVELS_FULL;
+}
 
-    return true;
+bool PlVkRenderer::mapQueuedFrame(pl_gpu gpu, pl_tex* tex, const pl_source_frame* src, pl_frame* outFrame)
+{
+    AVFrame* frame = (AVFrame*)src->frame_data;
+
+    // The queue provides textures for each frame, since several are mapped at once
+    pl_avframe_params mapParams = {};
+    mapParams.frame = frame;
+    mapParams.tex = tex;
+    bool ok = pl_map_avframe_ex(gpu, outFrame, &mapParams);
+    if (ok) {
+        fixupMappedFrame(frame, outFrame);
+    }
+    else {
+        SDL_LogError(SDL_LOG_CATEGORY_APPLICATION,
+                     "pl_map_avframe_ex() failed");
+    }
+
+    // The mapped frame holds its own reference to the AVFrame
+    av_frame_free(&frame);
+    return ok;
+}
+
+void PlVkRenderer::unmapQueuedFrame(pl_gpu gpu, pl_frame* frame, const pl_source_frame*)
+{
+    pl_unmap_avframe(gpu, frame);
+}
+
+void PlVkRenderer::discardQueuedFrame(const pl_source_frame* src)
+{
+    AVFrame* frame = (AVFrame*)src->frame_data;
+    av_frame_free(&frame);
+}
+
+bool PlVkRenderer::updateFrameMix(AVFrame* frame, const pl_render_params* renderParams, pl_frame_mix* mix)
+{
+    double nowSecs = LiGetMicroseconds() / 1000000.0;
+
+    // Pacer gives us the last frame again on V-syncs without a new one
+    if (frame->pts != m_MixLastPts) {
+        if (m_MixFirstPts == AV_NOPTS_VALUE) {
+            m_MixFirstPts = frame->pts;
+        }
+
+        // Frame timestamps are 90 kHz RTP timestamps, which wrap at 32 bits
+        double ptsSecs = (uint32_t)(frame->pts - m_MixFirstPts) / 90000.0;
+        if (m_MixLastPts != AV_NOPTS_VALUE && ptsSecs <= m_MixLastPtsSecs) {
+            // The timestamps wrapped or went backwards, so start over
+            pl_queue_reset(m_FrameQueue);
+            m_MixFirstPts = frame->pts;
+            m_MixLastPts = AV_NOPTS_VALUE;
+            ptsSecs = 0;
+        }
+
+        // Smooth out network jitter in the arrival times
+        double offsetSecs = ptsSecs - nowSecs;
+        if (m_MixLastPts == AV_NOPTS_VALUE || SDL_fabs(offsetSecs - m_MixClockOffsetSecs) > FRAME_MIX_RESYNC_SECS) {
+            m_MixClockOffsetSecs = offsetSecs;
+        }
+        else {
+            m_MixClockOffsetSecs += FRAME_MIX_CLOCK_ALPHA * (offsetSecs - m_MixClockOffsetSecs);
+        }
+
+        pl_source_frame source = {};
+        source.pts = ptsSecs;
+        source.duration = m_MixFrameDurationSecs;
+        source.frame_data = av_frame_clone(frame);
+        source.map = mapQueuedFrame;
+        source.unmap = unmapQueuedFrame;
+        source.discard = discardQueuedFrame;
+        if (source.frame_data == nullptr) {
+            return false;
+        }
+
+        pl_queue_push(m_FrameQueue, &source);
+        m_MixLastPts = frame->pts;
+        m_MixLastPtsSecs = ptsSecs;
+    }
+
+    // Display one frame interval behind the newest frame, so the frame after
+    // the one being shown has usually arrived by the time it's blended in.
+    pl_queue_params queueParams = {};
+    queueParams.pts = nowSecs + m_MixClockOffsetSecs - m_MixFrameDurationSecs;
+    queueParams.radius = pl_frame_mix_radius(renderParams);
+    queueParams.vsync_duration = m_MixVsyncDurationSecs;
+    queueParams.timeout = 0;
+
+    switch (pl_queue_update(m_FrameQueue, mix, &queueParams)) {
+    case PL_QUEUE_OK:
+    case PL_QUEUE_MORE:
+        // If the next frame is late, we'll render what we have
+        return mix->num_frames > 0;
+    default:
+        SDL_LogError(SDL_LOG_CATEGORY_APPLICATION,
+                     "pl_queue_update() failed");
+        return false;
+    }
+}
+
+void PlVkRenderer::unmapAvFrameFromPlacebo(pl_frame* mappedFrame)
+{
+    // Frames imported from CUDA aren't mapped by libplacebo, and their
+    // textures are owned by m_CudaInterop.
+    if (mappedFrame->user_data != nullptr) {
+        pl_unmap_avframe(m_Vulkan->gpu, mappedFrame);
+    }
 }
 
 bool PlVkRenderer::populateQueues(int videoFormat)
@@ -714,16 +1117,13 @@ void PlVkRenderer::waitToRender()
         return;
     }
 
-#ifndef Q_OS_WIN32
     // With libplacebo's Vulkan backend, all swap_buffers does is wait for queued
     // presents to finish. This happens to be exactly what we want to do here, since
     // it lets us wait to select a queued frame for rendering until we know that we
     // can present without blocking in renderFrame().
-    //
-    // NB: This seems to cause performance problems with the Windows display stack
-    // (particularly on Nvidia) so we will only do this for non-Windows platforms.
-    pl_swapchain_swap_buffers(m_Swapchain);
-#endif
+    if (m_SwapBeforeAcquire) {
+        pl_swapchain_swap_buffers(m_Swapchain);
+    }
 
     // Handle the swapchain being resized
     int vkDrawableW, vkDrawableH;
@@ -757,6 +1157,11 @@ void PlVkRenderer::cleanupRenderContext()
 void PlVkRenderer::renderFrame(AVFrame *frame)
 {
     pl_frame mappedFrame, targetFrame;
+    pl_frame_mix frameMix = {};
+    pl_render_params renderParams = pl_render_fast_params;
+
+    // CUDA frames are copied into our own textures, so they can't be queued
+    bool mixFrames = m_FrameQueue != nullptr && frame->format != AV_PIX_FMT_CUDA;
 
     // If waitToRender() failed to get the next swapchain frame, skip
     // rendering this frame. It probably means the window is occluded.
@@ -764,7 +1169,19 @@ void PlVkRenderer::renderFrame(AVFrame *frame)
         return;
     }
 
-    if (!mapAvFrameToPlacebo(frame, &mappedFrame)) {
+    if (mixFrames) {
+        renderParams.frame_mixer = &pl_filter_oversample;
+
+        // If there's nothing to blend yet, just render this frame
+        mixFrames = updateFrameMix(frame, &renderParams, &frameMix);
+    }
+
+    if (mixFrames) {
+        // The frame nearest to the display time determines the colorspace and crop.
+        // NB: The queue owns this mapping, so we must not unmap it ourselves.
+        mappedFrame = *pl_frame_mix_current(&frameMix);
+    }
+    else if (!mapAvFrameToPlacebo(frame, &mappedFrame)) {
         // This function logs internally
         return;
     }
@@ -834,6 +1251,42 @@ void PlVkRenderer::renderFrame(AVFrame *frame)
     }
     SDL_AtomicUnlock(&m_OverlayLock);
 
+    if (m_PerfGraphMask != nullptr && Session::get() != nullptr &&
+            Session::get()->getOverlayManager().isOverlayEnabled(Overlay::OverlayPerfGraph)) {
+        Overlay::PERF_GRAPH_RECT rects[PERF_GRAPH_MAX_RECTS];
+        int viewportWidth = (int)targetFrame.crop.x1;
+        int viewportHeight = (int)targetFrame.crop.y1;
+        int rectCount = Session::get()->getOverlayManager().getPerfGraph().buildRects(rects, viewportWidth, viewportHeight);
+
+        m_PerfGraphParts.resize(rectCount);
+        for (int i = 0; i < rectCount; i++) {
+            uint32_t color = Overlay::PerfGraph::getPaletteData()[rects[i].color];
+
+            // Graph rects have their origin in the lower-left corner
+            m_PerfGraphParts[i].src = { 0, 0, 1, 1 };
+            m_PerfGraphParts[i].dst.x0 = rects[i].rect.x;
+            m_PerfGraphParts[i].dst.y0 = viewportHeight - (rects[i].rect.y + rects[i].rect.h);
+            m_PerfGraphParts[i].dst.x1 = rects[i].rect.x + rects[i].rect.w;
+            m_PerfGraphParts[i].dst.y1 = viewportHeight - rects[i].rect.y;
+            m_PerfGraphParts[i].color[0] = ((color >> 16) & 0xFF) / 255.0f;
+            m_PerfGraphParts[i].color[1] = ((color >> 8) & 0xFF) / 255.0f;
+            m_PerfGraphParts[i].color[2] = (color & 0xFF) / 255.0f;
+            m_PerfGraphParts[i].color[3] = ((color >> 24) & 0xFF) / 255.0f;
+        }
+
+        if (rectCount > 0) {
+            pl_overlay graphOverlay = {};
+            graphOverlay.tex = m_PerfGraphMask;
+            graphOverlay.mode = PL_OVERLAY_MONOCHROME;
+            graphOverlay.coords = PL_OVERLAY_COORDS_DST_FRAME;
+            graphOverlay.repr = pl_color_repr_rgb;
+            graphOverlay.color = pl_color_space_srgb;
+            graphOverlay.parts = m_PerfGraphParts.data();
+            graphOverlay.num_parts = rectCount;
+            overlays.push_back(graphOverlay);
+        }
+    }
+
     SDL_Rect src;
     src.x = mappedFrame.crop.x0;
     src.y = mappedFrame.crop.y0;
@@ -857,9 +1310,32 @@ void PlVkRenderer::renderFrame(AVFrame *frame)
     // Render the video image and overlays into the swapchain buffer
     targetFrame.num_overlays = (int)overlays.size();
     targetFrame.overlays = overlays.data();
-    if (!pl_render_image(m_Renderer, &mappedFrame, &targetFrame, &pl_render_fast_params)) {
+
+    if (m_Upscaler != nullptr) {
+        renderParams.upscaler = m_Upscaler;
+    }
+    if (m_UpscalerHook != nullptr) {
+        renderParams.hooks = &m_UpscalerHook;
+        renderParams.num_hooks = 1;
+    }
+
+    // pl_render_fast_params never runs peak detection, so this only
+    // replaces the color mapping for HDR frames on an SDR swapchain.
+    if (m_FastToneMapping && pl_color_space_is_hdr(&mappedFrame.color) &&
+            !pl_color_space_is_hdr(&targetFrame.color)) {
+        renderParams.color_map_params = &m_FastColorMapParams;
+    }
+
+    renderParams.info_callback = renderInfoCallback;
+    renderParams.info_priv = this;
+    m_RenderGpuTimeNs = 0;
+    m_ScaleGpuTimeNs = 0;
+    if (mixFrames ?
+            !pl_render_image_mix(m_Renderer, &frameMix, &targetFrame, &renderParams) :
+            !pl_render_image(m_Renderer, &mappedFrame, &targetFrame, &renderParams)) {
         SDL_LogError(SDL_LOG_CATEGORY_APPLICATION,
-                     "pl_render_image() failed");
+                     "%s failed",
+                     mixFrames ? "pl_render_image_mix()" : "pl_render_image()");
         // NB: We must fallthrough to call pl_swapchain_submit_frame()
     }
 
@@ -876,11 +1352,11 @@ void PlVkRenderer::renderFrame(AVFrame *frame)
         goto UnmapExit;
     }
 
-#ifdef Q_OS_WIN32
-    // On Windows, we swap buffers here instead of waitToRender()
-    // to avoid some performance problems on Nvidia GPUs.
-    pl_swapchain_swap_buffers(m_Swapchain);
-#endif
+    if (!m_SwapBeforeAcquire) {
+        // On Windows, we swap buffers here instead of waitToRender()
+        // to avoid some performance problems on Nvidia GPUs.
+        pl_swapchain_swap_buffers(m_Swapchain);
+    }
 
 UnmapExit:
     // Delete any textures that need to be destroyed
@@ -888,7 +1364,9 @@ UnmapExit:
         pl_tex_destroy(m_Vulkan->gpu, &texture);
     }
 
-    pl_unmap_avframe(m_Vulkan->gpu, &mappedFrame);
+    if (!mixFrames) {
+        unmapAvFrameFromPlacebo(&mappedFrame);
+    }
 }
 
 bool PlVkRenderer::testRenderFrame(AVFrame *frame)
@@ -899,7 +1377,7 @@ bool PlVkRenderer::testRenderFrame(AVFrame *frame)
         return false;
     }
 
-    pl_unmap_avframe(m_Vulkan->gpu, &mappedFrame);
+    unmapAvFrameFromPlacebo(&mappedFrame);
     return true;
 }
 
@@ -957,6 +1435,17 @@ void PlVkRenderer::notifyOverlayUpdated(Overlay::OverlayType type)
         return;
     }
 
+    // Collect the GPU time of previous uploads before we reuse the timer
+    if (m_Overlays[type].uploadTimer == nullptr) {
+        m_Overlays[type].uploadTimer = pl_timer_create(m_Vulkan->gpu);
+    }
+    else {
+        uint64_t uploadTimeNs;
+        while ((uploadTimeNs = pl_timer_query(m_Vulkan->gpu, m_Overlays[type].uploadTimer)) != 0) {
+            SDL_AtomicAdd(&m_UploadGpuTimeUs, (int)(uploadTimeNs / 1000));
+        }
+    }
+
     // Upload the surface data to the new texture
     SDL_assert(!SDL_MUSTLOCK(newSurface));
     pl_tex_transfer_params xferParams = {};
@@ -965,6 +1454,7 @@ void PlVkRenderer::notifyOverlayUpdated(Overlay::OverlayType type)
     xferParams.ptr = newSurface->pixels;
     xferParams.callback = overlayUploadComplete;
     xferParams.priv = newSurface;
+    xferParams.timer = m_Overlays[type].uploadTimer;
     if (!pl_tex_upload(m_Vulkan->gpu, &xferParams)) {
         pl_tex_destroy(m_Vulkan->gpu, &m_Overlays[type].stagingOverlay.tex);
         SDL_zero(m_Overlays[type].stagingOverlay);
@@ -990,6 +1480,38 @@ void PlVkRenderer::notifyOverlayUpdated(Overlay::OverlayType type)
     SDL_AtomicUnlock(&m_OverlayLock);
 }
 
+bool PlVkRenderer::getGpuRenderTime(uint64_t* renderTimeUs)
+{
+    // No timings are available until the first timer queries complete
+    if (m_RenderGpuTimeNs == 0) {
+        return false;
+    }
+
+    *renderTimeUs = m_RenderGpuTimeNs / 1000;
+    return true;
+}
+
+bool PlVkRenderer::getGpuScaleTime(uint64_t* scaleTimeUs)
+{
+    if (m_ScaleGpuTimeNs == 0) {
+        return false;
+    }
+
+    *scaleTimeUs = m_ScaleGpuTimeNs / 1000;
+    return true;
+}
+
+bool PlVkRenderer::getGpuUploadTime(uint64_t* uploadTimeUs)
+{
+    int uploadTime = SDL_AtomicSet(&m_UploadGpuTimeUs, 0);
+    if (uploadTime == 0) {
+        return false;
+    }
+
+    *uploadTimeUs = (uint64_t)uploadTime;
+    return true;
+}
+
 bool PlVkRenderer::notifyWindowChanged(PWINDOW_STATE_CHANGE_INFO info)
 {
     // We can transparently handle size and display changes
@@ -999,7 +1521,14 @@ bool PlVkRenderer::notifyWindowChanged(PWINDOW_STATE_CHANGE_INFO info)
 int PlVkRenderer::getRendererAttributes()
 {
     // This renderer supports HDR (including tone mapping to SDR displays)
-    return RENDERER_ATTRIBUTE_HDR_SUPPORT;
+    // and its Vulkan device isn't tied to a single codec context.
+    int attributes = RENDERER_ATTRIBUTE_HDR_SUPPORT | RENDERER_ATTRIBUTE_REUSABLE_DECODER_CONTEXT;
+
+    if (m_FrameQueue != nullptr) {
+        attributes |= RENDERER_ATTRIBUTE_FRAME_MIXING;
+    }
+
+    return attributes;
 }
 
 int PlVkRenderer::getDecoderColorspace()
@@ -1015,6 +1544,21 @@ int PlVkRenderer::getDecoderColorRange()
     return COLOR_RANGE_FULL;
 }
 
+bool PlVkRenderer::getDriverVersion(uint32_t* vendorId, uint32_t* deviceId, uint64_t* driverVersion)
+{
+    if (m_Vulkan == nullptr) {
+        return false;
+    }
+
+    VkPhysicalDeviceProperties deviceProps;
+    fn_vkGetPhysicalDeviceProperties(m_Vulkan->phys_device, &deviceProps);
+
+    *vendorId = deviceProps.vendorID;
+    *deviceId = deviceProps.deviceID;
+    *driverVersion = deviceProps.driverVersion;
+    return true;
+}
+
 int PlVkRenderer::getDecoderCapabilities()
 {
     return CAPABILITY_REFERENCE_FRAME_INVALIDATION_HEVC |
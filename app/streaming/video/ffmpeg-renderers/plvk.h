@@ -9,6 +9,18 @@
 #include <libplacebo/log.h>
 #include <libplacebo/renderer.h>
 #include <libplacebo/vulkan.h>
+#include <libplacebo/utils/frame_queue.h>
+#include <libplacebo/shaders/custom.h>
+
+#if PL_API_VER >= 338
+#include <libplacebo/cache.h>
+#endif
+
+#include <vector>
+
+#ifdef HAVE_CUDA
+#include "cuda.h"
+#endif
 
 class PlVkRenderer : public IFFmpegRenderer {
 public:
@@ -29,13 +41,24 @@ public:
     virtual bool needsTestFrame() override;
     virtual bool isPixelFormatSupported(int videoFormat, enum AVPixelFormat pixelFormat) override;
     virtual AVPixelFormat getPreferredPixelFormat(int videoFormat) override;
+    virtual bool getGpuRenderTime(uint64_t* renderTimeUs) override;
+    virtual bool getGpuUploadTime(uint64_t* uploadTimeUs) override;
+    virtual bool getGpuScaleTime(uint64_t* scaleTimeUs) override;
+    virtual bool getDriverVersion(uint32_t* vendorId, uint32_t* deviceId, uint64_t* driverVersion) override;
 
 private:
     static void lockQueue(AVHWDeviceContext *dev_ctx, uint32_t queue_family, uint32_t index);
     static void unlockQueue(AVHWDeviceContext *dev_ctx, uint32_t queue_family, uint32_t index);
     static void overlayUploadComplete(void* opaque);
+    static void renderInfoCallback(void* priv, const pl_render_info* info);
+    static bool mapQueuedFrame(pl_gpu gpu, pl_tex* tex, const pl_source_frame* src, pl_frame* outFrame);
+    static void unmapQueuedFrame(pl_gpu gpu, pl_frame* frame, const pl_source_frame* src);
+    static void discardQueuedFrame(const pl_source_frame* src);
+    static void fixupMappedFrame(const AVFrame* frame, pl_frame* mappedFrame);
 
     bool mapAvFrameToPlacebo(const AVFrame *frame, pl_frame* mappedFrame);
+    bool updateFrameMix(AVFrame* frame, const pl_render_params* renderParams, pl_frame_mix* mix);
+    void unmapAvFrameFromPlacebo(pl_frame* mappedFrame);
     bool populateQueues(int videoFormat);
     bool chooseVulkanDevice(PDECODER_PARAMETERS params, bool hdrOutputRequired);
     bool tryInitializeDevice(VkPhysicalDevice device, VkPhysicalDeviceProperties* deviceProps,
@@ -44,6 +67,11 @@ private:
     bool isPresentModeSupportedByPhysicalDevice(VkPhysicalDevice device, VkPresentModeKHR presentMode);
     bool isColorSpaceSupportedByPhysicalDevice(VkPhysicalDevice device, VkColorSpaceKHR colorSpace);
     bool isSurfacePresentationSupportedByPhysicalDevice(VkPhysicalDevice device);
+#ifdef HAVE_CUDA
+    bool isCudaBackendDevice(VkPhysicalDevice device);
+#endif
+    void loadPipelineCache();
+    void savePipelineCache();
 
     // The backend renderer if we're frontend-only
     IFFmpegRenderer* m_Backend;
@@ -59,6 +87,14 @@ private:
     pl_vulkan m_Vulkan = nullptr;
     pl_swapchain m_Swapchain = nullptr;
     pl_renderer m_Renderer = nullptr;
+
+#if PL_API_VER >= 338
+    // Compiled shaders and pipelines, persisted across streams in a cache
+    // file named after the device's pipelineCacheUUID
+    pl_cache m_PipelineCache = nullptr;
+    uint64_t m_PipelineCacheSignature = 0;
+    QString m_PipelineCacheFileName;
+#endif
     pl_tex m_Textures[PL_MAX_PLANES] = {};
     pl_color_space m_LastColorspace = {};
 
@@ -66,6 +102,35 @@ private:
     pl_swapchain_frame m_SwapchainFrame = {};
     bool m_HasPendingSwapchainFrame = false;
 
+    // Determines whether waitToRender() or renderFrame() waits for queued presents
+    bool m_SwapBeforeAcquire = true;
+
+    // Fixed-cost HDR to SDR tone mapping (PLVK_FAST_TONE_MAPPING=1)
+    bool m_FastToneMapping = false;
+    pl_color_map_params m_FastColorMapParams = {};
+
+    // Scaling filter and user shader selected with ML_UPSCALER and ML_UPSCALER_SHADER
+    const pl_filter_config* m_Upscaler = nullptr;
+    const pl_hook* m_UpscalerHook = nullptr;
+
+    // GPU time of the sampling and scaling passes, which is part of m_RenderGpuTimeNs
+    uint64_t m_ScaleGpuTimeNs = 0;
+
+    // Frame mixing (ML_FRAME_MIXING=1) state, only used by the render thread
+    pl_queue m_FrameQueue = nullptr;
+    int64_t m_MixFirstPts = AV_NOPTS_VALUE;
+    int64_t m_MixLastPts = AV_NOPTS_VALUE;
+    double m_MixLastPtsSecs = 0;
+    double m_MixClockOffsetSecs = 0;
+    double m_MixFrameDurationSecs = 0;
+    double m_MixVsyncDurationSecs = 0;
+
+    // GPU time of the render passes, accumulated by renderInfoCallback() during pl_render_image()
+    uint64_t m_RenderGpuTimeNs = 0;
+
+    // GPU time of completed overlay uploads in microseconds, written by the overlay update thread
+    SDL_atomic_t m_UploadGpuTimeUs = {};
+
     // Overlay state
     SDL_SpinLock m_OverlayLock = 0;
     struct {
@@ -87,11 +152,23 @@ private:
         // as long as hasStagingOverlay is false.
         bool hasStagingOverlay;
         pl_overlay stagingOverlay;
+
+        // Times uploads of the staging overlay. Only used by the overlay update thread.
+        pl_timer uploadTimer;
     } m_Overlays[Overlay::OverlayMax] = {};
 
+    // Performance graph state, only used by the render thread
+    pl_tex m_PerfGraphMask = nullptr;
+    std::vector<pl_overlay_part> m_PerfGraphParts;
+
     // Device context used for hwaccel decoders
     AVBufferRef* m_HwDeviceCtx = nullptr;
 
+#ifdef HAVE_CUDA
+    // Imports frames from the CUDA backend renderer. Created on the first CUDA frame.
+    CUDAVkInteropHelper* m_CudaInterop = nullptr;
+#endif
+
     // Vulkan functions we call directly
     PFN_vkDestroySurfaceKHR fn_vkDestroySurfaceKHR = nullptr;
     PFN_vkGetPhysicalDeviceQueueFamilyProperties2 fn_vkGetPhysicalDeviceQueueFamilyProperties2 = nullptr;
@@ -99,6 +176,7 @@ private:
     PFN_vkGetPhysicalDeviceSurfaceFormatsKHR fn_vkGetPhysicalDeviceSurfaceFormatsKHR = nullptr;
     PFN_vkEnumeratePhysicalDevices fn_vkEnumeratePhysicalDevices = nullptr;
     PFN_vkGetPhysicalDeviceProperties fn_vkGetPhysicalDeviceProperties = nullptr;
+    PFN_vkGetPhysicalDeviceProperties2 fn_vkGetPhysicalDeviceProperties2 = nullptr;
     PFN_vkGetPhysicalDeviceSurfaceSupportKHR fn_vkGetPhysicalDeviceSurfaceSupportKHR = nullptr;
     PFN_vkEnumerateDeviceExtensionProperties fn_vkEnumerateDeviceExtensionProperties = nullptr;
 };
@@ -1,8 +1,11 @@
 #pragma once
 
 #include "SDL_compat.h"
+#include "cscconstants.h"
 
+#include <algorithm>
 #include <array>
+#include <iterator>
 
 #include "streaming/video/decoder.h"
 #include "streaming/video/overlaymanager.h"
@@ -125,6 +128,21 @@ private:
 #define RENDERER_ATTRIBUTE_NO_BUFFERING 0x08
 #define RENDERER_ATTRIBUTE_FORCE_PACING 0x10
 
+// The renderer presents immediately to a display with variable refresh
+// rate (adaptive sync) active, so Pacer must not hold frames for V-sync
+#define RENDERER_ATTRIBUTE_VARIABLE_REFRESH 0x20
+
+// prepareDecoderContext() may be called again for a new AVCodecContext after the
+// old one is freed, so a failed decoder can be rebuilt without the renderer
+#define RENDERER_ATTRIBUTE_REUSABLE_DECODER_CONTEXT 0x40
+
+// The renderer blends neighboring frames for display times in between them,
+// so Pacer should render the last frame again on V-syncs without a new one
+#define RENDERER_ATTRIBUTE_FRAME_MIXING 0x80
+
+class IVsyncSource;
+class Pacer;
+
 class IFFmpegRenderer : public Overlay::IOverlayRenderer {
 public:
     enum class RendererType {
@@ -181,6 +199,78 @@ public:
         // Don't wait by default
     }
 
+    // Called on the same thread after each renderFrame(). If the renderer has
+    // learned when a previously rendered frame actually reached the display,
+    // it returns the time from that frame's renderFrame() call to scanout.
+    // Each frame is reported at most once, and some may never be reported.
+    virtual bool getPresentLatency(uint64_t*) {
+        // Present timing is unknown by default
+        return false;
+    }
+
+    // Called on the same thread after each renderFrame(). Returns the number
+    // of presented frames that are still waiting to be displayed.
+    virtual bool getQueuedPresentCount(int*) {
+        // Present queue depth is unknown by default
+        return false;
+    }
+
+    // Called on the same thread after each renderFrame(). If the renderer can
+    // tell how the last displayed frame reached the screen, it returns true in
+    // the argument if the frame bypassed composition (independent flip, a
+    // hardware overlay, or a KMS plane) and false if the compositor copied it.
+    virtual bool getDirectScanout(bool*) {
+        // Composition is unknown by default
+        return false;
+    }
+
+    // Called on the same thread after each renderFrame(). Returns true if the
+    // renderer copied the decoded frame into its own texture to render it,
+    // rather than sampling from the decoder's output directly.
+    virtual bool didCopyLastFrame() {
+        // Assume zero-copy by default
+        return false;
+    }
+
+    // Called on the same thread after each renderFrame(). Returns how many
+    // decoder surfaces had to be newly mapped as textures since the last call.
+    virtual bool getTextureCacheMisses(uint32_t*) {
+        // Texture caching is unknown by default
+        return false;
+    }
+
+    // Called on the same thread after each renderFrame(). If the renderer
+    // times its GPU work, it returns the GPU execution time of the render
+    // passes for the last frame. GPU timings may lag a few frames behind.
+    virtual bool getGpuRenderTime(uint64_t*) {
+        // GPU timing is unknown by default
+        return false;
+    }
+
+    // Called on the same thread after each renderFrame(). Returns the part
+    // of the GPU render time spent scaling the video to the window size.
+    virtual bool getGpuScaleTime(uint64_t*) {
+        // GPU timing is unknown by default
+        return false;
+    }
+
+    // Called on the same thread after each renderFrame(). Returns the GPU
+    // execution time of texture uploads that completed since the last call.
+    virtual bool getGpuUploadTime(uint64_t*) {
+        // GPU timing is unknown by default
+        return false;
+    }
+
+    // Called on the decoder thread for each frame before it is queued for
+    // rendering. Renderers that must read hardware frames back into system
+    // memory can do it here by replacing the frame in place, so the readback
+    // overlaps with rendering the previous frame rather than delaying this
+    // one. Returns true if the frame was read back.
+    virtual bool readBackFrame(AVFrame*) {
+        // No readback is required by default
+        return false;
+    }
+
     // Called on the same thread as renderFrame() during destruction of the renderer
     virtual void cleanupRenderContext() {
         // Nothing
@@ -193,6 +283,13 @@ public:
         return true;
     }
 
+    // Returns the PCI IDs and driver version of the GPU used for decoding.
+    // Renderers that provide this can have their test frame results cached.
+    virtual bool getDriverVersion(uint32_t*, uint32_t*, uint64_t*) {
+        // Driver version is unknown by default
+        return false;
+    }
+
     // NOTE: This can be called BEFORE initialize()!
     virtual bool needsTestFrame() {
         // No test frame required by default
@@ -249,6 +346,14 @@ public:
         return true;
     }
 
+    // Called by Pacer during initialization. Renderers that get V-sync
+    // events from the display they render to can return a source here
+    // to use instead of the platform's default V-sync source.
+    virtual IVsyncSource* createVsyncSource(Pacer*) {
+        // Use the platform V-sync source by default
+        return nullptr;
+    }
+
     virtual bool isDirectRenderingSupported() {
         // The renderer can render directly to the display
         return true;
@@ -351,58 +456,37 @@ public:
     }
 
     void getFramePremultipliedCscConstants(const AVFrame* frame, std::array<float, 9> &cscMatrix, std::array<float, 3> &offsets) {
-        static const std::array<float, 9> k_CscMatrix_Bt601 = {
-            1.0f, 1.0f, 1.0f,
-            0.0f, -0.3441f, 1.7720f,
-            1.4020f, -0.7141f, 0.0f,
-        };
-        static const std::array<float, 9> k_CscMatrix_Bt709 = {
-            1.0f, 1.0f, 1.0f,
-            0.0f, -0.1873f, 1.8556f,
-            1.5748f, -0.4681f, 0.0f,
-        };
-        static const std::array<float, 9> k_CscMatrix_Bt2020 = {
-            1.0f, 1.0f, 1.0f,
-            0.0f, -0.1646f, 1.8814f,
-            1.4746f, -0.5714f, 0.0f,
-        };
-
-        bool fullRange = isFrameFullRange(frame);
-        int bitsPerChannel = getFrameBitsPerChannel(frame);
-        int channelRange = (1 << bitsPerChannel);
-        double yMin = (fullRange ? 0 : (16 << (bitsPerChannel - 8)));
-        double yMax = (fullRange ? (channelRange - 1) : (235 << (bitsPerChannel - 8)));
-        double yScale = (channelRange - 1) / (yMax - yMin);
-        double uvMin = (fullRange ? 0 : (16 << (bitsPerChannel - 8)));
-        double uvMax = (fullRange ? (channelRange - 1) : (240 << (bitsPerChannel - 8)));
-        double uvScale = (channelRange - 1) / (uvMax - uvMin);
-
-        // Calculate YUV offsets
-        offsets[0] = yMin / (double)(channelRange - 1);
-        offsets[1] = (channelRange / 2) / (double)(channelRange - 1);
-        offsets[2] = (channelRange / 2) / (double)(channelRange - 1);
-
-        // Start with the standard full range color matrix
+        int colorspaceIndex;
         switch (getFrameColorspace(frame)) {
         default:
         case COLORSPACE_REC_601:
-            cscMatrix = k_CscMatrix_Bt601;
+            colorspaceIndex = 0;
             break;
         case COLORSPACE_REC_709:
-            cscMatrix = k_CscMatrix_Bt709;
+            colorspaceIndex = 1;
             break;
         case COLORSPACE_REC_2020:
-            cscMatrix = k_CscMatrix_Bt2020;
+            colorspaceIndex = 2;
             break;
         }
 
-        // Scale the color matrix according to the color range
-        for (int i = 0; i < 3; i++) {
-            cscMatrix[i] *= yScale;
+        bool fullRange = isFrameFullRange(frame);
+        int bitsPerChannel = getFrameBitsPerChannel(frame);
+
+        // Everything we decode is 8 or 10-bit, but compute anything else on the fly
+        CscConstants computed;
+        const CscConstants* constants;
+        if (bitsPerChannel == 8 || bitsPerChannel == 10) {
+            constants = &CscTable::k_Constants[colorspaceIndex][fullRange][bitsPerChannel == 10];
         }
-        for (int i = 3; i < 9; i++) {
-            cscMatrix[i] *= uvScale;
+        else {
+            const double (*matrices[])[9] = { &CscTable::k_Bt601, &CscTable::k_Bt709, &CscTable::k_Bt2020 };
+            computed = CscTable::make(*matrices[colorspaceIndex], fullRange, bitsPerChannel);
+            constants = &computed;
         }
+
+        std::copy(std::begin(constants->matrix), std::end(constants->matrix), cscMatrix.begin());
+        std::copy(std::begin(constants->offsets), std::end(constants->offsets), offsets.begin());
     }
 
     void getFrameChromaCositingOffsets(const AVFrame* frame, std::array<float, 2> &chromaOffsets) {
@@ -506,6 +590,10 @@ public:
 
     // Free the resources allocated during the last `exportEGLImages` call
     virtual void freeEGLImages(EGLDisplay, EGLImage[EGL_MAX_PLANES]) {}
+
+    // Free any EGL resources that outlive `freeEGLImages` before the
+    // EGLDisplay and context are torn down
+    virtual void cleanupEGL(EGLDisplay) {}
 #endif
 
 #ifdef HAVE_DRM
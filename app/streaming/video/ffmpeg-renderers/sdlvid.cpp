@@ -16,12 +16,14 @@ SdlRenderer::SdlRenderer()
     : IFFmpegRenderer(RendererType::SDL),
       m_VideoFormat(0),
       m_Renderer(nullptr),
-      m_Texture(nullptr),
+      m_TextureCount(0),
+      m_TextureIndex(0),
       m_NeedsYuvToRgbConversion(false),
       m_SwsContext(nullptr),
       m_RgbFrame(av_frame_alloc()),
       m_SwFrameMapper(this)
 {
+    SDL_zero(m_Textures);
     SDL_zero(m_OverlayTextures);
 
 #ifdef HAVE_CUDA
@@ -46,9 +48,7 @@ SdlRenderer::~SdlRenderer()
     av_frame_free(&m_RgbFrame);
     sws_freeContext(m_SwsContext);
 
-    if (m_Texture != nullptr) {
-        SDL_DestroyTexture(m_Texture);
-    }
+    destroyTextures();
 
     if (m_Renderer != nullptr) {
         SDL_DestroyRenderer(m_Renderer);
@@ -223,12 +223,28 @@ bool SdlRenderer::initialize(PDECODER_PARAMETERS params)
 
 void SdlRenderer::renderOverlay(Overlay::OverlayType type)
 {
-    if (Session::get()->getOverlayManager().isOverlayEnabled(type)) {
+    // There are no overlays without a session (like when benchmarking)
+    if (Session::get() != nullptr && Session::get()->getOverlayManager().isOverlayEnabled(type)) {
         // If a new surface has been created for updated overlay data, convert it into a texture.
         // NB: We have to do this conversion at render-time because we can only interact
         // with the renderer on a single thread.
-        SDL_Surface* newSurface = Session::get()->getOverlayManager().getUpdatedOverlaySurface(type);
-        if (newSurface != nullptr) {
+        SDL_Rect dirtyRect;
+        SDL_Surface* newSurface = Session::get()->getOverlayManager().getUpdatedOverlaySurface(type, &dirtyRect);
+        if (newSurface != nullptr &&
+                m_OverlayTextures[type] != nullptr &&
+                m_OverlayRects[type].w == newSurface->w &&
+                m_OverlayRects[type].h == newSurface->h) {
+            // Only the lines that changed need to be uploaded to the existing texture
+            if (!SDL_RectEmpty(&dirtyRect)) {
+                SDL_UpdateTexture(m_OverlayTextures[type], &dirtyRect,
+                                  (uint8_t*)newSurface->pixels +
+                                      (dirtyRect.y * newSurface->pitch) +
+                                      (dirtyRect.x * newSurface->format->BytesPerPixel),
+                                  newSurface->pitch);
+            }
+            SDL_FreeSurface(newSurface);
+        }
+        else if (newSurface != nullptr) {
             if (m_OverlayTextures[type] != nullptr) {
                 SDL_DestroyTexture(m_OverlayTextures[type]);
             }
@@ -265,10 +281,61 @@ void SdlRenderer::ffNoopFree(void*, uint8_t*)
     // Nothing
 }
 
+void SdlRenderer::destroyTextures()
+{
+    for (int i = 0; i < SDL_MAX_TEXTURE_COUNT; i++) {
+        if (m_Textures[i] != nullptr) {
+            SDL_DestroyTexture(m_Textures[i]);
+            m_Textures[i] = nullptr;
+        }
+    }
+
+    m_TextureCount = 0;
+    m_TextureIndex = 0;
+}
+
+void SdlRenderer::copyPlane(uint8_t* dst, int dstPitch,
+                            const uint8_t* src, int srcPitch,
+                            int rowBytes, int rows)
+{
+    // If the pitches match, we can use a single memcpy() to transfer
+    // the data. If not, we'll need to do separate memcpy() calls for each
+    // line to ensure the pitch doesn't get screwed up.
+    if (srcPitch == dstPitch) {
+        memcpy(dst, src, srcPitch * rows);
+    }
+    else {
+        rowBytes = SDL_min(rowBytes, SDL_min(srcPitch, dstPitch));
+        for (int i = 0; i < rows; i++) {
+            memcpy(dst + (dstPitch * i), src + (srcPitch * i), rowBytes);
+        }
+    }
+}
+
+bool SdlRenderer::readBackFrame(AVFrame* frame)
+{
+    // CUDA frames may be rendered via GL interop in renderFrame()
+    if (frame->hw_frames_ctx == nullptr || frame->format == AV_PIX_FMT_CUDA) {
+        return false;
+    }
+
+    // If this fails, renderFrame() will try again and log the error
+    AVFrame* swFrame = m_SwFrameMapper.getSwFrameFromHwFrame(frame);
+    if (swFrame == nullptr) {
+        return false;
+    }
+
+    av_frame_unref(frame);
+    av_frame_move_ref(frame, swFrame);
+    av_frame_free(&swFrame);
+    return true;
+}
+
 void SdlRenderer::renderFrame(AVFrame* frame)
 {
     int err;
     AVFrame* swFrame = nullptr;
+    SDL_Texture* texture;
 
     if (frame->hw_frames_ctx != nullptr && frame->format != AV_PIX_FMT_CUDA) {
 #ifdef HAVE_CUDA
@@ -294,13 +361,10 @@ ReadbackRetry:
         }
 #endif
 
-        if (m_Texture != nullptr) {
-            SDL_DestroyTexture(m_Texture);
-            m_Texture = nullptr;
-        }
+        destroyTextures();
     }
 
-    if (m_Texture == nullptr) {
+    if (m_TextureCount == 0) {
         Uint32 sdlFormat;
 
         // Remember to keep this in sync with SdlRenderer::isPixelFormatSupported()!
@@ -405,34 +469,57 @@ ReadbackRetry:
             }
         }
 
-        m_Texture = SDL_CreateTexture(m_Renderer,
-                                      sdlFormat,
-                                      SDL_TEXTUREACCESS_STREAMING,
-                                      frame->width,
-                                      frame->height);
-        if (!m_Texture) {
-            SDL_LogError(SDL_LOG_CATEGORY_APPLICATION,
-                         "SDL_CreateTexture() failed: %s",
-                         SDL_GetError());
-            goto Exit;
+        // CUDA interop registers a single GL texture that the CUDA helper
+        // copies into, so we can't rotate between textures in that case.
+        int textureCount;
+        if (frame->format == AV_PIX_FMT_CUDA) {
+            textureCount = 1;
+        }
+        else {
+            bool ok;
+            textureCount = qEnvironmentVariableIntValue("SDL_TEXTURE_COUNT", &ok);
+            if (!ok) {
+                textureCount = 2;
+            }
+            textureCount = SDL_clamp(textureCount, 1, SDL_MAX_TEXTURE_COUNT);
+        }
+
+        for (int i = 0; i < textureCount; i++) {
+            m_Textures[i] = SDL_CreateTexture(m_Renderer,
+                                              sdlFormat,
+                                              SDL_TEXTUREACCESS_STREAMING,
+                                              frame->width,
+                                              frame->height);
+            if (!m_Textures[i]) {
+                SDL_LogError(SDL_LOG_CATEGORY_APPLICATION,
+                             "SDL_CreateTexture() failed: %s",
+                             SDL_GetError());
+                destroyTextures();
+                goto Exit;
+            }
         }
 
+        m_TextureCount = textureCount;
+        m_TextureIndex = 0;
+
 #ifdef HAVE_CUDA
         if (frame->format == AV_PIX_FMT_CUDA) {
             SDL_assert(m_CudaGLHelper == nullptr);
             m_CudaGLHelper = new CUDAGLInteropHelper(((AVHWFramesContext*)frame->hw_frames_ctx->data)->device_ctx);
 
-            SDL_GL_BindTexture(m_Texture, nullptr, nullptr);
+            SDL_GL_BindTexture(m_Textures[0], nullptr, nullptr);
             if (!m_CudaGLHelper->registerBoundTextures()) {
                 // If we can't register textures, fall back to normal read-back rendering
                 delete m_CudaGLHelper;
                 m_CudaGLHelper = nullptr;
             }
-            SDL_GL_UnbindTexture(m_Texture);
+            SDL_GL_UnbindTexture(m_Textures[0]);
         }
 #endif
     }
 
+    texture = m_Textures[m_TextureIndex];
+
     if (frame->format == AV_PIX_FMT_CUDA) {
 #ifdef HAVE_CUDA
         if (m_CudaGLHelper == nullptr || !m_CudaGLHelper->copyCudaFrameToTextures(frame)) {
@@ -444,73 +531,50 @@ ReadbackRetry:
         goto Exit;
 #endif
     }
-    else if (frame->format == AV_PIX_FMT_YUV420P || frame->format == AV_PIX_FMT_YUVJ420P) {
-        SDL_UpdateYUVTexture(m_Texture, nullptr,
-                             frame->data[0],
-                             frame->linesize[0],
-                             frame->data[1],
-                             frame->linesize[1],
-                             frame->data[2],
-                             frame->linesize[2]);
-    }
     else if (!m_NeedsYuvToRgbConversion) {
-#if SDL_VERSION_ATLEAST(2, 0, 15)
-        // SDL_UpdateNVTexture is not supported on all renderer backends,
-        // (notably not DX9), so we must have a fallback in case it's not
-        // supported and for earlier versions of SDL.
-        if (SDL_UpdateNVTexture(m_Texture,
-                                nullptr,
-                                frame->data[0],
-                                frame->linesize[0],
-                                frame->data[1],
-                                frame->linesize[1]) != 0)
-#endif
-        {
-            char* pixels;
-            int texturePitch;
-
-            err = SDL_LockTexture(m_Texture, nullptr, (void**)&pixels, &texturePitch);
-            if (err < 0) {
-                SDL_LogError(SDL_LOG_CATEGORY_APPLICATION,
-                             "SDL_LockTexture() failed: %s",
-                             SDL_GetError());
-                goto Exit;
-            }
-
-            // If the planar pitches match, we can use a single memcpy() to transfer
-            // the data. If not, we'll need to do separate memcpy() calls for each
-            // line to ensure the pitch doesn't get screwed up.
-
-            if (frame->linesize[0] == texturePitch) {
-                memcpy(pixels,
-                       frame->data[0],
-                       frame->linesize[0] * frame->height);
-            }
-            else {
-                int pitch = SDL_min(frame->linesize[0], texturePitch);
-                for (int i = 0; i < frame->height; i++) {
-                    memcpy(pixels + (texturePitch * i),
-                           frame->data[0] + (frame->linesize[0] * i),
-                           pitch);
-                }
-            }
+        // Write the planes straight into the locked texture buffer rather than
+        // using SDL_UpdateYUVTexture()/SDL_UpdateNVTexture(). Since we rotate
+        // textures each frame, the lock won't have to wait on the GPU to finish
+        // reading the texture we rendered last frame.
+        uint8_t* pixels;
+        int texturePitch;
 
-            if (frame->linesize[1] == texturePitch) {
-                memcpy(pixels + (texturePitch * frame->height),
-                       frame->data[1],
-                       frame->linesize[1] * frame->height / 2);
-            }
-            else {
-                int pitch = SDL_min(frame->linesize[1], texturePitch);
-                for (int i = 0; i < frame->height / 2; i++) {
-                    memcpy(pixels + (texturePitch * (frame->height + i)),
-                           frame->data[1] + (frame->linesize[1] * i),
-                           pitch);
-                }
-            }
+        err = SDL_LockTexture(texture, nullptr, (void**)&pixels, &texturePitch);
+        if (err < 0) {
+            SDL_LogError(SDL_LOG_CATEGORY_APPLICATION,
+                         "SDL_LockTexture() failed: %s",
+                         SDL_GetError());
+            goto Exit;
+        }
 
-            SDL_UnlockTexture(m_Texture);
+        int chromaWidth = (frame->width + 1) / 2;
+        int chromaHeight = (frame->height + 1) / 2;
+
+        copyPlane(pixels, texturePitch,
+                  frame->data[0], frame->linesize[0],
+                  frame->width, frame->height);
+        pixels += texturePitch * frame->height;
+
+        if (frame->format == AV_PIX_FMT_YUV420P || frame->format == AV_PIX_FMT_YUVJ420P) {
+            // SDL's YV12 layout stores the V plane before the U plane
+            int chromaPitch = (texturePitch + 1) / 2;
+
+            copyPlane(pixels, chromaPitch,
+                      frame->data[2], frame->linesize[2],
+                      chromaWidth, chromaHeight);
+            pixels += chromaPitch * chromaHeight;
+            copyPlane(pixels, chromaPitch,
+                      frame->data[1], frame->linesize[1],
+                      chromaWidth, chromaHeight);
         }
+        else {
+            // NV12 and NV21 have a single interleaved chroma plane
+            copyPlane(pixels, ((texturePitch + 1) / 2) * 2,
+                      frame->data[1], frame->linesize[1],
+                      chromaWidth * 2, chromaHeight);
+        }
+
+        SDL_UnlockTexture(texture);
     }
     else {
         // We have a pixel format that SDL doesn't natively support, so we must use
@@ -518,7 +582,7 @@ ReadbackRetry:
         uint8_t* pixels;
         int texturePitch;
 
-        err = SDL_LockTexture(m_Texture, nullptr, (void**)&pixels, &texturePitch);
+        err = SDL_LockTexture(texture, nullptr, (void**)&pixels, &texturePitch);
         if (err < 0) {
             SDL_LogError(SDL_LOG_CATEGORY_APPLICATION,
                          "SDL_LockTexture() failed: %s",
@@ -541,7 +605,7 @@ ReadbackRetry:
 #endif
 
         av_buffer_unref(&m_RgbFrame->buf[0]);
-        SDL_UnlockTexture(m_Texture);
+        SDL_UnlockTexture(texture);
 
         if (err < 0) {
             char string[AV_ERROR_MAX_STRING_SIZE];
@@ -568,7 +632,7 @@ ReadbackRetry:
     SDL_RenderSetViewport(m_Renderer, &dst);
 
     // Draw the video content itself
-    SDL_RenderCopy(m_Renderer, m_Texture, nullptr, nullptr);
+    SDL_RenderCopy(m_Renderer, texture, nullptr, nullptr);
 
     // Reset the viewport to the full window for overlay rendering
     SDL_RenderSetViewport(m_Renderer, nullptr);
@@ -580,6 +644,9 @@ ReadbackRetry:
 
     SDL_RenderPresent(m_Renderer);
 
+    // Upload the next frame into a different texture
+    m_TextureIndex = (m_TextureIndex + 1) % m_TextureCount;
+
 Exit:
     if (swFrame != nullptr) {
         av_frame_free(&swFrame);
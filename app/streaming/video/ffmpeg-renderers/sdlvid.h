@@ -19,6 +19,7 @@ public:
     virtual bool prepareDecoderContext(AVCodecContext* context, AVDictionary** options) override;
     virtual void prepareToRender() override;
     virtual void renderFrame(AVFrame* frame) override;
+    virtual bool readBackFrame(AVFrame* frame) override;
     virtual bool isRenderThreadSupported() override;
     virtual bool isPixelFormatSupported(int videoFormat, enum AVPixelFormat pixelFormat) override;
     virtual bool testRenderFrame(AVFrame* frame) override;
@@ -29,9 +30,23 @@ private:
 
     static void ffNoopFree(void *opaque, uint8_t *data);
 
+    static void copyPlane(uint8_t* dst, int dstPitch,
+                          const uint8_t* src, int srcPitch,
+                          int rowBytes, int rows);
+
+    void destroyTextures();
+
     int m_VideoFormat;
     SDL_Renderer* m_Renderer;
-    SDL_Texture* m_Texture;
+
+    // Frames are uploaded into a ring of streaming textures so the texture
+    // we're writing to is never the one the GPU is still sampling from the
+    // previous frame. Only the first m_TextureCount entries are valid.
+#define SDL_MAX_TEXTURE_COUNT 3
+    SDL_Texture* m_Textures[SDL_MAX_TEXTURE_COUNT];
+    int m_TextureCount;
+    int m_TextureIndex;
+
     SDL_Texture* m_OverlayTextures[Overlay::OverlayMax];
     SDL_Rect m_OverlayRects[Overlay::OverlayMax];
 
@@ -4,10 +4,19 @@ SwFrameMapper::SwFrameMapper(IFFmpegRenderer* renderer)
     : m_Renderer(renderer),
       m_VideoFormat(0),
       m_SwPixelFormat(AV_PIX_FMT_NONE),
-      m_MapFrame(false)
+      m_MapFrame(false),
+      m_FramePoolLock(0)
 {
 }
 
+SwFrameMapper::~SwFrameMapper()
+{
+    // Frames handed out to callers hold their own buffer references
+    for (AVFrame* frame : m_FramePool) {
+        av_frame_free(&frame);
+    }
+}
+
 void SwFrameMapper::setVideoFormat(int videoFormat)
 {
     m_VideoFormat = videoFormat;
@@ -96,9 +105,76 @@ Exit:
                 "Selected hwframe->swframe format: %d (mapping: %s)",
                 m_SwPixelFormat,
                 m_MapFrame ? "yes" : "no");
+
+    // Preallocate the frames we'll copy into if we're not mapping
+    if (!m_MapFrame) {
+        for (int i = 0; i < k_InitialPoolFrames; i++) {
+            AVFrame* frame = av_frame_alloc();
+            if (frame == nullptr) {
+                break;
+            }
+
+            frame->format = m_SwPixelFormat;
+            frame->width = testFrame->width;
+            frame->height = testFrame->height;
+            if (av_frame_get_buffer(frame, 0) < 0) {
+                av_frame_free(&frame);
+                break;
+            }
+
+            m_FramePool.push_back(frame);
+        }
+    }
+
     return true;
 }
 
+AVFrame* SwFrameMapper::getPooledFrame(int width, int height)
+{
+    AVFrame* frame = nullptr;
+
+    SDL_AtomicLock(&m_FramePoolLock);
+
+    // Drop pooled frames that no longer match the stream dimensions
+    for (auto it = m_FramePool.begin(); it != m_FramePool.end();) {
+        if ((*it)->width != width || (*it)->height != height) {
+            av_frame_free(&*it);
+            it = m_FramePool.erase(it);
+        }
+        else {
+            it++;
+        }
+    }
+
+    // Find a frame that nobody else holds a reference to
+    for (AVFrame* pooledFrame : m_FramePool) {
+        if (av_frame_is_writable(pooledFrame)) {
+            frame = av_frame_clone(pooledFrame);
+            break;
+        }
+    }
+
+    if (frame == nullptr && m_FramePool.size() < k_MaxPoolFrames) {
+        AVFrame* pooledFrame = av_frame_alloc();
+        if (pooledFrame != nullptr) {
+            pooledFrame->format = m_SwPixelFormat;
+            pooledFrame->width = width;
+            pooledFrame->height = height;
+            if (av_frame_get_buffer(pooledFrame, 0) == 0) {
+                m_FramePool.push_back(pooledFrame);
+                frame = av_frame_clone(pooledFrame);
+            }
+            else {
+                av_frame_free(&pooledFrame);
+            }
+        }
+    }
+
+    SDL_AtomicUnlock(&m_FramePoolLock);
+
+    return frame;
+}
+
 AVFrame* SwFrameMapper::getSwFrameFromHwFrame(AVFrame* hwFrame)
 {
     int err;
@@ -113,9 +189,13 @@ AVFrame* SwFrameMapper::getSwFrameFromHwFrame(AVFrame* hwFrame)
         }
     }
 
-    AVFrame* swFrame = av_frame_alloc();
+    // If the pool is exhausted, av_hwframe_transfer_data() will allocate new buffers
+    AVFrame* swFrame = m_MapFrame ? nullptr : getPooledFrame(hwFrame->width, hwFrame->height);
     if (swFrame == nullptr) {
-        return nullptr;
+        swFrame = av_frame_alloc();
+        if (swFrame == nullptr) {
+            return nullptr;
+        }
     }
 
     swFrame->format = m_SwPixelFormat;
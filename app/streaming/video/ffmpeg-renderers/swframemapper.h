@@ -2,18 +2,33 @@
 
 #include "renderer.h"
 
+#include <vector>
+
 class SwFrameMapper
 {
 public:
     explicit SwFrameMapper(IFFmpegRenderer* renderer);
+    ~SwFrameMapper();
     void setVideoFormat(int videoFormat);
+
+    // This may be called concurrently from multiple threads after the
+    // first call has returned.
     AVFrame* getSwFrameFromHwFrame(AVFrame* hwFrame);
 
 private:
     bool initializeReadBackFormat(AVBufferRef* hwFrameCtxRef, AVFrame* testFrame);
+    AVFrame* getPooledFrame(int width, int height);
 
     IFFmpegRenderer* m_Renderer;
     int m_VideoFormat;
     enum AVPixelFormat m_SwPixelFormat;
     bool m_MapFrame;
+
+    // System memory frames that av_hwframe_transfer_data() copies into,
+    // so we don't allocate new frame buffers for every readback. A pooled
+    // frame can be reused once all references we handed out are freed.
+    static constexpr int k_InitialPoolFrames = 3;
+    static constexpr int k_MaxPoolFrames = 8;
+    SDL_SpinLock m_FramePoolLock;
+    std::vector<AVFrame*> m_FramePool;
 };
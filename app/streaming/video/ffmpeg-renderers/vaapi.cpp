@@ -24,7 +24,13 @@ VAAPIRenderer::VAAPIRenderer(int decoderSelectionPass)
       m_HwContext(nullptr),
       m_BlacklistedForDirectRendering(false),
       m_RequiresExplicitPixelFormat(false),
-      m_OverlayMutex(nullptr)
+      m_OverlayMutex(nullptr),
+      m_UseVpp(false),
+      m_VppConfig(VA_INVALID_ID),
+      m_VppContext(VA_INVALID_ID),
+      m_VppOutputSurface(VA_INVALID_SURFACE),
+      m_VppOutputWidth(0),
+      m_VppOutputHeight(0)
 #ifdef HAVE_EGL
     , m_EglExportType(EglExportType::Unknown),
       m_EglImageFactory(this)
@@ -46,6 +52,10 @@ VAAPIRenderer::VAAPIRenderer(int decoderSelectionPass)
     SDL_zero(m_OverlayImage);
     SDL_zero(m_OverlaySubpicture);
     SDL_zero(m_OverlayFormat);
+
+    for (int i = 0; i < Overlay::OverlayMax; i++) {
+        m_OverlayVppSurface[i] = VA_INVALID_SURFACE;
+    }
 }
 
 VAAPIRenderer::~VAAPIRenderer()
@@ -66,6 +76,8 @@ VAAPIRenderer::~VAAPIRenderer()
             }
         }
 
+        destroyVpp(display);
+
         av_buffer_unref(&m_HwContext);
 
         if (display) {
@@ -585,9 +597,13 @@ VAAPIRenderer::needsTestFrame()
 bool
 VAAPIRenderer::isDirectRenderingSupported()
 {
+    AVHWDeviceContext* deviceContext = (AVHWDeviceContext*)m_HwContext->data;
+    AVVAAPIDeviceContext* vaDeviceContext = (AVVAAPIDeviceContext*)deviceContext->hwctx;
+
     if (qgetenv("VAAPI_FORCE_DIRECT") == "1") {
         SDL_LogInfo(SDL_LOG_CATEGORY_APPLICATION,
                     "Using direct rendering due to environment variable");
+        initializeVpp(vaDeviceContext->display);
         return true;
     }
     else if (qgetenv("VAAPI_FORCE_INDIRECT") == "1") {
@@ -622,8 +638,6 @@ VAAPIRenderer::isDirectRenderingSupported()
         return false;
     }
 
-    AVHWDeviceContext* deviceContext = (AVHWDeviceContext*)m_HwContext->data;
-    AVVAAPIDeviceContext* vaDeviceContext = (AVVAAPIDeviceContext*)deviceContext->hwctx;
     std::vector<VAEntrypoint> entrypoints(vaMaxNumEntrypoints(vaDeviceContext->display));
     int entrypointCount;
     VAStatus status = vaQueryConfigEntrypoints(vaDeviceContext->display, VAProfileNone, entrypoints.data(), &entrypointCount);
@@ -633,6 +647,7 @@ VAAPIRenderer::isDirectRenderingSupported()
             if (entrypoints[i] == VAEntrypointVideoProc) {
                 SDL_LogInfo(SDL_LOG_CATEGORY_APPLICATION,
                             "Using direct rendering with VAEntrypointVideoProc");
+                initializeVpp(vaDeviceContext->display);
                 return true;
             }
         }
@@ -689,8 +704,19 @@ void VAAPIRenderer::notifyOverlayUpdated(Overlay::OverlayType type)
 
     VASubpictureID oldSubpictureId = m_OverlaySubpicture[type];
     m_OverlaySubpicture[type] = 0;
+
+    VASurfaceID oldVppSurface = m_OverlayVppSurface[type];
+    m_OverlayVppSurface[type] = VA_INVALID_SURFACE;
+
+    bool useVpp = m_UseVpp;
     SDL_UnlockMutex(m_OverlayMutex);
 
+    if (oldVppSurface != VA_INVALID_SURFACE) {
+        // The last composited frame may still be reading from it
+        vaSyncSurface(vaDeviceContext->display, oldVppSurface);
+        vaDestroySurfaces(vaDeviceContext->display, &oldVppSurface, 1);
+    }
+
     if (oldSubpictureId != 0) {
         status = vaDestroySubpicture(vaDeviceContext->display, oldSubpictureId);
         if (status != VA_STATUS_SUCCESS) {
@@ -713,7 +739,40 @@ void VAAPIRenderer::notifyOverlayUpdated(Overlay::OverlayType type)
         return;
     }
 
-    if (newSurface != nullptr) {
+    if (newSurface != nullptr && useVpp) {
+        SDL_assert(!SDL_MUSTLOCK(newSurface));
+
+        SDL_Rect overlayRect;
+
+        if (type == Overlay::OverlayStatusUpdate) {
+            // Bottom Left
+            overlayRect.x = 0;
+            overlayRect.y = -newSurface->h;
+        }
+        else if (type == Overlay::OverlayDebug) {
+            // Top left
+            overlayRect.x = 0;
+            overlayRect.y = 0;
+        }
+
+        overlayRect.w = newSurface->w;
+        overlayRect.h = newSurface->h;
+
+        VASurfaceID newVppSurface = createVppOverlaySurface(vaDeviceContext->display, newSurface);
+
+        // Surface data is no longer needed
+        SDL_FreeSurface(newSurface);
+
+        if (newVppSurface == VA_INVALID_SURFACE) {
+            return;
+        }
+
+        SDL_LockMutex(m_OverlayMutex);
+        m_OverlayVppSurface[type] = newVppSurface;
+        m_OverlayRect[type] = overlayRect;
+        SDL_UnlockMutex(m_OverlayMutex);
+    }
+    else if (newSurface != nullptr) {
         VAImage newImage;
 
         SDL_assert(!SDL_MUSTLOCK(newSurface));
@@ -835,6 +894,21 @@ VAAPIRenderer::renderFrame(AVFrame* frame)
             break;
         }
 
+        // Blend the overlays in with the video processing pipeline, which also
+        // scales the frame to the window. That leaves vaPutSurface() with a plain
+        // copy instead of having to composite subpictures on every frame.
+        if (m_UseVpp && compositeWithVpp(vaDeviceContext->display, frame, surface, src, dst, windowWidth, windowHeight)) {
+            vaPutSurface(vaDeviceContext->display,
+                         m_VppOutputSurface,
+                         m_XWindow,
+                         0, 0,
+                         m_VppOutputWidth, m_VppOutputHeight,
+                         0, 0,
+                         m_VppOutputWidth, m_VppOutputHeight,
+                         NULL, 0, flags);
+            return;
+        }
+
         SDL_LockMutex(m_OverlayMutex);
 
         VAImage associatedOverlayImages[Overlay::OverlayMax] = {};
@@ -964,6 +1038,282 @@ VAAPIRenderer::renderFrame(AVFrame* frame)
     }
 }
 
+void VAAPIRenderer::initializeVpp(VADisplay display)
+{
+    VAStatus status;
+
+    // We may be asked more than once
+    if (m_VppConfig != VA_INVALID_ID) {
+        return;
+    }
+
+    if (qgetenv("VAAPI_VPP_OVERLAY") == "0") {
+        SDL_LogInfo(SDL_LOG_CATEGORY_APPLICATION,
+                    "Using overlay subpictures due to environment variable");
+        return;
+    }
+
+    status = vaCreateConfig(display, VAProfileNone, VAEntrypointVideoProc, nullptr, 0, &m_VppConfig);
+    if (status != VA_STATUS_SUCCESS) {
+        SDL_LogWarn(SDL_LOG_CATEGORY_APPLICATION,
+                    "vaCreateConfig() failed for VAEntrypointVideoProc: %d",
+                    status);
+        m_VppConfig = VA_INVALID_ID;
+        return;
+    }
+
+    status = vaCreateContext(display, m_VppConfig, 0, 0, 0, nullptr, 0, &m_VppContext);
+    if (status != VA_STATUS_SUCCESS) {
+        SDL_LogWarn(SDL_LOG_CATEGORY_APPLICATION,
+                    "vaCreateContext() failed for VAEntrypointVideoProc: %d",
+                    status);
+        vaDestroyConfig(display, m_VppConfig);
+        m_VppConfig = VA_INVALID_ID;
+        m_VppContext = VA_INVALID_ID;
+        return;
+    }
+
+    SDL_LogInfo(SDL_LOG_CATEGORY_APPLICATION,
+                "Compositing overlays with the VAAPI video processing pipeline");
+    m_UseVpp = true;
+}
+
+void VAAPIRenderer::destroyVpp(VADisplay display)
+{
+    for (int i = 0; i < Overlay::OverlayMax; i++) {
+        if (m_OverlayVppSurface[i] != VA_INVALID_SURFACE) {
+            vaDestroySurfaces(display, &m_OverlayVppSurface[i], 1);
+            m_OverlayVppSurface[i] = VA_INVALID_SURFACE;
+        }
+    }
+
+    if (m_VppOutputSurface != VA_INVALID_SURFACE) {
+        vaDestroySurfaces(display, &m_VppOutputSurface, 1);
+        m_VppOutputSurface = VA_INVALID_SURFACE;
+    }
+
+    if (m_VppContext != VA_INVALID_ID) {
+        vaDestroyContext(display, m_VppContext);
+        m_VppContext = VA_INVALID_ID;
+    }
+
+    if (m_VppConfig != VA_INVALID_ID) {
+        vaDestroyConfig(display, m_VppConfig);
+        m_VppConfig = VA_INVALID_ID;
+    }
+
+    m_UseVpp = false;
+}
+
+VASurfaceID VAAPIRenderer::createVppOverlaySurface(VADisplay display, SDL_Surface* overlaySurface)
+{
+    VAStatus status;
+
+    // BGRA in memory, which is ARGB8888 to SDL on little endian
+    VAImageFormat format = {};
+    format.fourcc = VA_FOURCC_BGRA;
+    format.byte_order = VA_LSB_FIRST;
+    format.bits_per_pixel = 32;
+    format.depth = 32;
+    format.red_mask = 0x00ff0000;
+    format.green_mask = 0x0000ff00;
+    format.blue_mask = 0x000000ff;
+    format.alpha_mask = 0xff000000;
+
+    VASurfaceAttrib attrib = {};
+    attrib.type = VASurfaceAttribPixelFormat;
+    attrib.flags = VA_SURFACE_ATTRIB_SETTABLE;
+    attrib.value.type = VAGenericValueTypeInteger;
+    attrib.value.value.i = VA_FOURCC_BGRA;
+
+    VASurfaceID surface;
+    status = vaCreateSurfaces(display, VA_RT_FORMAT_RGB32,
+                              overlaySurface->w, overlaySurface->h,
+                              &surface, 1, &attrib, 1);
+    if (status != VA_STATUS_SUCCESS) {
+        SDL_LogError(SDL_LOG_CATEGORY_APPLICATION,
+                     "vaCreateSurfaces() failed for overlay: %d",
+                     status);
+        return VA_INVALID_SURFACE;
+    }
+
+    VAImage image;
+    status = vaCreateImage(display, &format, overlaySurface->w, overlaySurface->h, &image);
+    if (status != VA_STATUS_SUCCESS) {
+        SDL_LogError(SDL_LOG_CATEGORY_APPLICATION,
+                     "vaCreateImage() failed: %d",
+                     status);
+        vaDestroySurfaces(display, &surface, 1);
+        return VA_INVALID_SURFACE;
+    }
+
+    void* imageData;
+    status = vaMapBuffer(display, image.buf, &imageData);
+    if (status != VA_STATUS_SUCCESS) {
+        SDL_LogError(SDL_LOG_CATEGORY_APPLICATION,
+                     "vaMapBuffer() failed: %d",
+                     status);
+        vaDestroyImage(display, image.image_id);
+        vaDestroySurfaces(display, &surface, 1);
+        return VA_INVALID_SURFACE;
+    }
+
+    uint8_t* imagePixels = (uint8_t*)imageData + image.offsets[0];
+    SDL_ConvertPixels(overlaySurface->w, overlaySurface->h, overlaySurface->format->format,
+                      overlaySurface->pixels, overlaySurface->pitch, SDL_PIXELFORMAT_ARGB8888,
+                      imagePixels, (int)image.pitches[0]);
+
+    // Blending with VA_BLEND_PREMULTIPLIED_ALPHA is the only kind that
+    // respects per-pixel alpha, so premultiply it here once per update
+    for (int y = 0; y < overlaySurface->h; y++) {
+        uint32_t* row = (uint32_t*)(imagePixels + y * image.pitches[0]);
+        for (int x = 0; x < overlaySurface->w; x++) {
+            uint32_t alpha = row[x] >> 24;
+            if (alpha != 0xff) {
+                uint32_t red = ((row[x] >> 16) & 0xff) * alpha / 0xff;
+                uint32_t green = ((row[x] >> 8) & 0xff) * alpha / 0xff;
+                uint32_t blue = (row[x] & 0xff) * alpha / 0xff;
+                row[x] = (alpha << 24) | (red << 16) | (green << 8) | blue;
+            }
+        }
+    }
+
+    vaUnmapBuffer(display, image.buf);
+
+    status = vaPutImage(display, surface, image.image_id,
+                        0, 0, overlaySurface->w, overlaySurface->h,
+                        0, 0, overlaySurface->w, overlaySurface->h);
+    vaDestroyImage(display, image.image_id);
+    if (status != VA_STATUS_SUCCESS) {
+        SDL_LogError(SDL_LOG_CATEGORY_APPLICATION,
+                     "vaPutImage() failed: %d",
+                     status);
+        vaDestroySurfaces(display, &surface, 1);
+        return VA_INVALID_SURFACE;
+    }
+
+    return surface;
+}
+
+bool VAAPIRenderer::compositeWithVpp(VADisplay display, AVFrame* frame, VASurfaceID surface,
+                                     const SDL_Rect& src, const SDL_Rect& dst, int windowWidth, int windowHeight)
+{
+    VAStatus status;
+
+    // The output matches the window, so vaPutSurface() doesn't need to scale
+    if (m_VppOutputSurface == VA_INVALID_SURFACE || m_VppOutputWidth != windowWidth || m_VppOutputHeight != windowHeight) {
+        if (m_VppOutputSurface != VA_INVALID_SURFACE) {
+            vaDestroySurfaces(display, &m_VppOutputSurface, 1);
+            m_VppOutputSurface = VA_INVALID_SURFACE;
+        }
+
+        status = vaCreateSurfaces(display, VA_RT_FORMAT_YUV420, windowWidth, windowHeight,
+                                  &m_VppOutputSurface, 1, nullptr, 0);
+        if (status != VA_STATUS_SUCCESS) {
+            SDL_LogError(SDL_LOG_CATEGORY_APPLICATION,
+                         "vaCreateSurfaces() failed for VPP output: %d",
+                         status);
+            m_VppOutputSurface = VA_INVALID_SURFACE;
+            SDL_LockMutex(m_OverlayMutex);
+            m_UseVpp = false;
+            SDL_UnlockMutex(m_OverlayMutex);
+            return false;
+        }
+
+        m_VppOutputWidth = windowWidth;
+        m_VppOutputHeight = windowHeight;
+    }
+
+    VAProcColorStandardType colorStandard =
+            getFrameColorspace(frame) == COLORSPACE_REC_709 ? VAProcColorStandardBT709 : VAProcColorStandardBT601;
+
+    // Drivers may not read these until vaEndPicture(), so they all must
+    // stay valid until then
+    VAProcPipelineParameterBuffer params[1 + Overlay::OverlayMax] = {};
+    VARectangle surfaceRegions[1 + Overlay::OverlayMax];
+    VARectangle outputRegions[1 + Overlay::OverlayMax];
+    VABlendState blendState = {};
+    VABufferID buffers[1 + Overlay::OverlayMax];
+    int layerCount = 0;
+
+    blendState.flags = VA_BLEND_PREMULTIPLIED_ALPHA;
+
+    // Hold the lock until the pipeline is submitted, so notifyOverlayUpdated()
+    // can't destroy an overlay surface before the driver has it
+    SDL_LockMutex(m_OverlayMutex);
+
+    // The video is the bottom layer and fills in the letterbox too
+    surfaceRegions[0] = { (int16_t)src.x, (int16_t)src.y, (uint16_t)src.w, (uint16_t)src.h };
+    outputRegions[0] = { (int16_t)dst.x, (int16_t)dst.y, (uint16_t)dst.w, (uint16_t)dst.h };
+    params[0].surface = surface;
+    params[0].surface_region = &surfaceRegions[0];
+    params[0].surface_color_standard = colorStandard;
+    params[0].output_region = &outputRegions[0];
+    params[0].output_background_color = 0xff000000;
+    params[0].output_color_standard = colorStandard;
+    layerCount++;
+
+    for (int type = 0; type < Overlay::OverlayMax; type++) {
+        if (m_OverlayVppSurface[type] == VA_INVALID_SURFACE) {
+            continue;
+        }
+
+        SDL_Rect overlayRect = m_OverlayRect[type];
+
+        // Negative values are relative to the other side of the window
+        if (overlayRect.x < 0) {
+            overlayRect.x += windowWidth;
+        }
+        if (overlayRect.y < 0) {
+            overlayRect.y += windowHeight;
+        }
+
+        surfaceRegions[layerCount] = { 0, 0, (uint16_t)overlayRect.w, (uint16_t)overlayRect.h };
+        outputRegions[layerCount] = { (int16_t)overlayRect.x, (int16_t)overlayRect.y, (uint16_t)overlayRect.w, (uint16_t)overlayRect.h };
+        params[layerCount].surface = m_OverlayVppSurface[type];
+        params[layerCount].surface_region = &surfaceRegions[layerCount];
+        params[layerCount].output_region = &outputRegions[layerCount];
+        params[layerCount].output_color_standard = colorStandard;
+        params[layerCount].blend_state = &blendState;
+        layerCount++;
+    }
+
+    int bufferCount = 0;
+    status = vaBeginPicture(display, m_VppContext, m_VppOutputSurface);
+    if (status == VA_STATUS_SUCCESS) {
+        for (int i = 0; i < layerCount && status == VA_STATUS_SUCCESS; i++) {
+            status = vaCreateBuffer(display, m_VppContext, VAProcPipelineParameterBufferType,
+                                    sizeof(params[i]), 1, &params[i], &buffers[bufferCount]);
+            if (status == VA_STATUS_SUCCESS) {
+                status = vaRenderPicture(display, m_VppContext, &buffers[bufferCount++], 1);
+            }
+        }
+
+        // Always end the picture we started, even if a layer failed
+        VAStatus endStatus = vaEndPicture(display, m_VppContext);
+        if (status == VA_STATUS_SUCCESS) {
+            status = endStatus;
+        }
+    }
+
+    for (int i = 0; i < bufferCount; i++) {
+        vaDestroyBuffer(display, buffers[i]);
+    }
+
+    if (status != VA_STATUS_SUCCESS) {
+        // Go back to subpictures for future overlay updates. Any overlays we
+        // have now won't be shown again until they're updated.
+        SDL_LogError(SDL_LOG_CATEGORY_APPLICATION,
+                     "VAAPI overlay compositing failed: %d",
+                     status);
+        m_UseVpp = false;
+    }
+
+    SDL_UnlockMutex(m_OverlayMutex);
+
+    return status == VA_STATUS_SUCCESS;
+}
+
 #if defined(HAVE_EGL) || defined(HAVE_DRM)
 
 // Ensure that vaExportSurfaceHandle() is supported by the VA-API driver
@@ -1209,6 +1559,11 @@ VAAPIRenderer::freeEGLImages(EGLDisplay dpy, EGLImage images[EGL_MAX_PLANES]) {
     m_PrimeDescriptor.num_objects = 0;
 }
 
+void
+VAAPIRenderer::cleanupEGL(EGLDisplay dpy) {
+    m_EglImageFactory.freeImageCache(dpy);
+}
+
 #endif
 
 #ifdef HAVE_DRM
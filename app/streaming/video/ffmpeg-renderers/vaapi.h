@@ -38,6 +38,7 @@
 
 extern "C" {
 #include <va/va.h>
+#include <va/va_vpp.h>
 #ifdef HAVE_LIBVA_X11
 #include <va/va_x11.h>
 #endif
@@ -74,6 +75,7 @@ public:
     virtual bool initializeEGL(EGLDisplay dpy, const EGLExtensions &ext) override;
     virtual ssize_t exportEGLImages(AVFrame *frame, EGLDisplay dpy, EGLImage images[EGL_MAX_PLANES]) override;
     virtual void freeEGLImages(EGLDisplay dpy, EGLImage[EGL_MAX_PLANES]) override;
+    virtual void cleanupEGL(EGLDisplay dpy) override;
 #endif
 
 #ifdef HAVE_DRM
@@ -86,6 +88,11 @@ private:
     VADisplay openDisplay(SDL_Window* window);
     VAStatus tryVaInitialize(AVVAAPIDeviceContext* vaDeviceContext, PDECODER_PARAMETERS params, int* major, int* minor);
     void renderOverlay(VADisplay display, VASurfaceID surface, Overlay::OverlayType type);
+    void initializeVpp(VADisplay display);
+    VASurfaceID createVppOverlaySurface(VADisplay display, SDL_Surface* overlaySurface);
+    bool compositeWithVpp(VADisplay display, AVFrame* frame, VASurfaceID surface,
+                          const SDL_Rect& src, const SDL_Rect& dst, int windowWidth, int windowHeight);
+    void destroyVpp(VADisplay display);
 
 #if defined(HAVE_EGL) || defined(HAVE_DRM)
     bool canExportSurfaceHandle(int layerTypeFlag, VADRMPRIMESurfaceDescriptor* descriptor);
@@ -105,6 +112,17 @@ private:
     VASubpictureID m_OverlaySubpicture[Overlay::OverlayMax];
     SDL_Rect m_OverlayRect[Overlay::OverlayMax];
 
+    // When direct rendering, overlays are blended into the frame by the video
+    // processing pipeline instead of being attached as subpictures. This is
+    // only set up by isDirectRenderingSupported(), before any overlays arrive.
+    bool m_UseVpp;
+    VAConfigID m_VppConfig;
+    VAContextID m_VppContext;
+    VASurfaceID m_VppOutputSurface;
+    int m_VppOutputWidth;
+    int m_VppOutputHeight;
+    VASurfaceID m_OverlayVppSurface[Overlay::OverlayMax];
+
 #ifdef HAVE_LIBVA_X11
     Display* m_XDisplay;
     Window m_XWindow;
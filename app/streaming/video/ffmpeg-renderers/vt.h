@@ -34,3 +34,28 @@ public:
     static
     IFFmpegRenderer* createRenderer();
 };
+
+// Decodes H.264 and HEVC with our own VTDecompressionSession rather than
+// FFmpeg's VideoToolbox hwaccel (VT_DIRECT_DECODE=1), so we can decode
+// asynchronously with real-time session properties. Output frames are
+// AV_PIX_FMT_VIDEOTOOLBOX frames just like the hwaccel produces.
+class IVTDirectDecoder {
+public:
+    virtual ~IVTDirectDecoder() {}
+
+    // Same semantics as avcodec_send_packet()
+    virtual int sendPacket(const AVPacket* packet) = 0;
+
+    // Same semantics as avcodec_receive_frame()
+    virtual int receiveFrame(AVFrame* frame) = 0;
+
+    // Waits up to timeoutMs for a frame to be ready for receiveFrame()
+    virtual void waitForFrame(int timeoutMs) = 0;
+};
+
+class VTDirectDecoderFactory {
+public:
+    static
+    IVTDirectDecoder* createDecoder(PDECODER_PARAMETERS params, AVBufferRef* hwDeviceContext,
+                                    int colorspace, bool fullRange);
+};
@@ -401,6 +401,11 @@ public:
 
     void updateOverlayOnMainThread(Overlay::OverlayType type)
     { @autoreleasepool {
+        // Overlays are drawn as text fields, so we can't show the performance graph
+        if (type == Overlay::OverlayPerfGraph) {
+            return;
+        }
+
         // Lazy initialization for the overlay
         if (m_OverlayTextFields[type] == nullptr) {
             m_OverlayTextFields[type] = [[NSTextField alloc] initWithFrame:m_StreamView.bounds];
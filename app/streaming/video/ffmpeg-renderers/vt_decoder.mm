@@ -0,0 +1,599 @@
+// Nasty hack to avoid conflict between AVFoundation and
+// libavutil both defining AVMediaType
+#define AVMediaType AVMediaType_FFmpeg
+#include "vt.h"
+#undef AVMediaType
+
+#include <Limelight.h>
+
+#include <QByteArray>
+#include <QQueue>
+
+#include <vector>
+
+#import <VideoToolbox/VideoToolbox.h>
+
+extern "C" {
+    #include <libavutil/hwcontext.h>
+    #include <libavutil/hwcontext_videotoolbox.h>
+}
+
+class VTDirectDecoder : public IVTDirectDecoder
+{
+public:
+    VTDirectDecoder(int videoFormat, AVBufferRef* hwDeviceContext, int colorspace, bool fullRange)
+        : m_VideoFormat(videoFormat),
+          m_Colorspace(colorspace),
+          m_FullRange(fullRange),
+          m_HwDeviceContext(av_buffer_ref(hwDeviceContext)),
+          m_HwFramesContext(nullptr),
+          m_FormatDesc(nullptr),
+          m_Session(nullptr),
+          m_NextSequence(1),
+          m_OutputLock(SDL_CreateMutex()),
+          m_OutputReady(SDL_CreateCond()),
+          m_AbandonedSequence(0)
+    {
+    }
+
+    virtual ~VTDirectDecoder() override
+    {
+        destroySession();
+
+        while (!m_Output.isEmpty()) {
+            DecodedFrame output = m_Output.dequeue();
+            if (output.pixelBuffer != nullptr) {
+                CVPixelBufferRelease(output.pixelBuffer);
+            }
+        }
+
+        if (m_FormatDesc != nullptr) {
+            CFRelease(m_FormatDesc);
+        }
+
+        av_buffer_unref(&m_HwFramesContext);
+        av_buffer_unref(&m_HwDeviceContext);
+
+        SDL_DestroyCond(m_OutputReady);
+        SDL_DestroyMutex(m_OutputLock);
+    }
+
+    virtual int sendPacket(const AVPacket* packet) override
+    {
+        std::vector<const uint8_t*> parameterSets;
+        std::vector<size_t> parameterSetSizes;
+
+        // VideoToolbox wants length-prefixed NAL units without the parameter sets
+        m_SampleData.clear();
+        findNalUnits(packet->data, packet->size);
+        for (const NalUnit& nal : m_NalUnits) {
+            if (isParameterSet(nal.data[0])) {
+                parameterSets.push_back(nal.data);
+                parameterSetSizes.push_back(nal.size);
+            }
+            else {
+                uint32_t length = (uint32_t)nal.size;
+                uint8_t prefix[4] = { (uint8_t)(length >> 24), (uint8_t)(length >> 16), (uint8_t)(length >> 8), (uint8_t)length };
+                m_SampleData.insert(m_SampleData.end(), prefix, prefix + sizeof(prefix));
+                m_SampleData.insert(m_SampleData.end(), nal.data, nal.data + nal.size);
+            }
+        }
+
+        if (!parameterSets.empty() && !updateFormatDescription(parameterSets, parameterSetSizes)) {
+            return AVERROR_INVALIDDATA;
+        }
+
+        // We can't decode anything until we've seen an IDR frame
+        if (m_FormatDesc == nullptr || m_SampleData.empty()) {
+            return AVERROR_INVALIDDATA;
+        }
+
+        if (m_Session == nullptr && !createSession()) {
+            return AVERROR_EXTERNAL;
+        }
+
+        CMBlockBufferRef blockBuffer;
+        OSStatus status = CMBlockBufferCreateWithMemoryBlock(kCFAllocatorDefault, nullptr, m_SampleData.size(),
+                                                             kCFAllocatorDefault, nullptr, 0, m_SampleData.size(),
+                                                             kCMBlockBufferAssureMemoryNowFlag, &blockBuffer);
+        if (status != noErr) {
+            SDL_LogError(SDL_LOG_CATEGORY_APPLICATION,
+                         "CMBlockBufferCreateWithMemoryBlock() failed: %d",
+                         status);
+            return AVERROR(ENOMEM);
+        }
+
+        status = CMBlockBufferReplaceDataBytes(m_SampleData.data(), blockBuffer, 0, m_SampleData.size());
+        if (status != noErr) {
+            SDL_LogError(SDL_LOG_CATEGORY_APPLICATION,
+                         "CMBlockBufferReplaceDataBytes() failed: %d",
+                         status);
+            CFRelease(blockBuffer);
+            return AVERROR(ENOMEM);
+        }
+
+        CMSampleBufferRef sampleBuffer;
+        size_t sampleSize = m_SampleData.size();
+        status = CMSampleBufferCreateReady(kCFAllocatorDefault, blockBuffer, m_FormatDesc, 1, 0, nullptr, 1, &sampleSize, &sampleBuffer);
+        CFRelease(blockBuffer);
+        if (status != noErr) {
+            SDL_LogError(SDL_LOG_CATEGORY_APPLICATION,
+                         "CMSampleBufferCreateReady() failed: %d",
+                         status);
+            return AVERROR(ENOMEM);
+        }
+
+        // Decode asynchronously so we return as soon as the frame is queued
+        // to the hardware. The output callback will deliver the frame.
+        uintptr_t sequence = m_NextSequence++;
+        VTDecodeInfoFlags infoFlags;
+        status = VTDecompressionSessionDecodeFrame(m_Session, sampleBuffer,
+                                                   kVTDecodeFrame_EnableAsynchronousDecompression | kVTDecodeFrame_1xRealTimePlayback,
+                                                   (void*)sequence, &infoFlags);
+        CFRelease(sampleBuffer);
+
+        if (status != noErr) {
+            SDL_LogWarn(SDL_LOG_CATEGORY_APPLICATION,
+                        "VTDecompressionSessionDecodeFrame() failed: %d",
+                        status);
+
+            // The caller won't wait for this frame, so discard any output
+            // that the callback may have already delivered for it
+            SDL_LockMutex(m_OutputLock);
+            m_AbandonedSequence = sequence;
+            if (!m_Output.isEmpty() && m_Output.last().sequence == sequence) {
+                DecodedFrame output = m_Output.takeLast();
+                if (output.pixelBuffer != nullptr) {
+                    CVPixelBufferRelease(output.pixelBuffer);
+                }
+            }
+            SDL_UnlockMutex(m_OutputLock);
+
+            // The session won't recover once it has been invalidated
+            // (after sleep, for example), so make a new one with the next IDR frame
+            if (status == kVTInvalidSessionErr) {
+                destroySession();
+            }
+
+            return AVERROR_UNKNOWN;
+        }
+
+        return 0;
+    }
+
+    virtual int receiveFrame(AVFrame* frame) override
+    {
+        SDL_LockMutex(m_OutputLock);
+        if (m_Output.isEmpty()) {
+            SDL_UnlockMutex(m_OutputLock);
+            return AVERROR(EAGAIN);
+        }
+        DecodedFrame output = m_Output.dequeue();
+        SDL_UnlockMutex(m_OutputLock);
+
+        if (output.pixelBuffer == nullptr) {
+            SDL_LogWarn(SDL_LOG_CATEGORY_APPLICATION,
+                        "VideoToolbox decode failed: %d",
+                        output.status);
+            return AVERROR_INVALIDDATA;
+        }
+
+        av_frame_unref(frame);
+
+        if (!updateFramesContext(output.pixelBuffer)) {
+            CVPixelBufferRelease(output.pixelBuffer);
+            return AVERROR(ENOMEM);
+        }
+
+        // The frame owns our reference to the CVPixelBuffer
+        frame->buf[0] = av_buffer_create((uint8_t*)output.pixelBuffer, sizeof(output.pixelBuffer),
+                                         releasePixelBuffer, nullptr, AV_BUFFER_FLAG_READONLY);
+        if (frame->buf[0] == nullptr) {
+            CVPixelBufferRelease(output.pixelBuffer);
+            return AVERROR(ENOMEM);
+        }
+
+        frame->hw_frames_ctx = av_buffer_ref(m_HwFramesContext);
+        if (frame->hw_frames_ctx == nullptr) {
+            av_frame_unref(frame);
+            return AVERROR(ENOMEM);
+        }
+
+        frame->data[3] = (uint8_t*)output.pixelBuffer;
+        frame->format = AV_PIX_FMT_VIDEOTOOLBOX;
+        frame->width = (int)CVPixelBufferGetWidth(output.pixelBuffer);
+        frame->height = (int)CVPixelBufferGetHeight(output.pixelBuffer);
+        setFrameColorProperties(frame, output.pixelBuffer);
+
+        return 0;
+    }
+
+    virtual void waitForFrame(int timeoutMs) override
+    {
+        SDL_LockMutex(m_OutputLock);
+        if (m_Output.isEmpty()) {
+            SDL_CondWaitTimeout(m_OutputReady, m_OutputLock, timeoutMs);
+        }
+        SDL_UnlockMutex(m_OutputLock);
+    }
+
+private:
+    struct NalUnit {
+        const uint8_t* data;
+        size_t size;
+    };
+
+    struct DecodedFrame {
+        uintptr_t sequence;
+        OSStatus status;
+        CVPixelBufferRef pixelBuffer; // nullptr if decoding failed
+    };
+
+    static void outputCallback(void* decompressionOutputRefCon,
+                               void* sourceFrameRefCon,
+                               OSStatus status,
+                               VTDecodeInfoFlags infoFlags,
+                               CVImageBufferRef imageBuffer,
+                               CMTime,
+                               CMTime)
+    {
+        auto me = reinterpret_cast<VTDirectDecoder*>(decompressionOutputRefCon);
+        DecodedFrame output;
+
+        output.sequence = (uintptr_t)sourceFrameRefCon;
+        output.status = status;
+        if (status == noErr && imageBuffer != nullptr && !(infoFlags & kVTDecodeInfo_FrameDropped)) {
+            output.pixelBuffer = CVPixelBufferRetain(imageBuffer);
+        }
+        else {
+            output.pixelBuffer = nullptr;
+        }
+
+        SDL_LockMutex(me->m_OutputLock);
+        if (output.sequence != me->m_AbandonedSequence) {
+            me->m_Output.enqueue(output);
+            SDL_CondSignal(me->m_OutputReady);
+        }
+        else if (output.pixelBuffer != nullptr) {
+            CVPixelBufferRelease(output.pixelBuffer);
+        }
+        SDL_UnlockMutex(me->m_OutputLock);
+    }
+
+    static void releasePixelBuffer(void*, uint8_t* data)
+    {
+        CVPixelBufferRelease((CVPixelBufferRef)data);
+    }
+
+    void findNalUnits(const uint8_t* data, int size)
+    {
+        m_NalUnits.clear();
+
+        int nalStart = -1;
+        int i = 0;
+        while (i + 2 < size) {
+            if (data[i] == 0 && data[i + 1] == 0 && data[i + 2] == 1) {
+                if (nalStart >= 0) {
+                    addNalUnit(data, nalStart, i);
+                }
+
+                i += 3;
+                nalStart = i;
+            }
+            else {
+                i++;
+            }
+        }
+
+        if (nalStart >= 0) {
+            addNalUnit(data, nalStart, size);
+        }
+    }
+
+    void addNalUnit(const uint8_t* data, int start, int end)
+    {
+        // Strip the leading zero of a 4-byte start code and any trailing zero
+        // bytes, which can never be part of the NAL unit's RBSP
+        while (end > start && data[end - 1] == 0) {
+            end--;
+        }
+
+        if (end > start) {
+            m_NalUnits.push_back({ &data[start], (size_t)(end - start) });
+        }
+    }
+
+    bool isParameterSet(uint8_t nalHeader)
+    {
+        if (m_VideoFormat & VIDEO_FORMAT_MASK_H264) {
+            int type = nalHeader & 0x1F;
+            return type == 7 || type == 8; // SPS, PPS
+        }
+        else {
+            int type = (nalHeader >> 1) & 0x3F;
+            return type == 32 || type == 33 || type == 34; // VPS, SPS, PPS
+        }
+    }
+
+    bool updateFormatDescription(const std::vector<const uint8_t*>& parameterSets, const std::vector<size_t>& parameterSetSizes)
+    {
+        // Parameter sets are repeated with every IDR frame, but usually unchanged
+        QByteArray parameterSetData;
+        for (size_t i = 0; i < parameterSets.size(); i++) {
+            parameterSetData.append((const char*)parameterSets[i], (int)parameterSetSizes[i]);
+        }
+        if (m_FormatDesc != nullptr && parameterSetData == m_ParameterSetData) {
+            return true;
+        }
+
+        CMVideoFormatDescriptionRef formatDesc;
+        OSStatus status;
+        if (m_VideoFormat & VIDEO_FORMAT_MASK_H264) {
+            status = CMVideoFormatDescriptionCreateFromH264ParameterSets(kCFAllocatorDefault,
+                                                                         parameterSets.size(),
+                                                                         parameterSets.data(),
+                                                                         parameterSetSizes.data(),
+                                                                         4, &formatDesc);
+        }
+        else {
+            status = CMVideoFormatDescriptionCreateFromHEVCParameterSets(kCFAllocatorDefault,
+                                                                         parameterSets.size(),
+                                                                         parameterSets.data(),
+                                                                         parameterSetSizes.data(),
+                                                                         4, nullptr, &formatDesc);
+        }
+        if (status != noErr) {
+            SDL_LogError(SDL_LOG_CATEGORY_APPLICATION,
+                         "Failed to create format description from parameter sets: %d",
+                         status);
+            return false;
+        }
+
+        // Keep the existing session if it can handle the new parameters
+        if (m_Session != nullptr && !VTDecompressionSessionCanAcceptFormatDescription(m_Session, formatDesc)) {
+            destroySession();
+        }
+
+        if (m_FormatDesc != nullptr) {
+            CFRelease(m_FormatDesc);
+        }
+        m_FormatDesc = formatDesc;
+        m_ParameterSetData = parameterSetData;
+        return true;
+    }
+
+    OSType getOutputPixelFormat()
+    {
+        bool yuv444 = !!(m_VideoFormat & VIDEO_FORMAT_MASK_YUV444);
+
+        if (m_VideoFormat & VIDEO_FORMAT_MASK_10BIT) {
+            if (yuv444) {
+                return m_FullRange ? kCVPixelFormatType_444YpCbCr10BiPlanarFullRange : kCVPixelFormatType_444YpCbCr10BiPlanarVideoRange;
+            }
+            else {
+                return m_FullRange ? kCVPixelFormatType_420YpCbCr10BiPlanarFullRange : kCVPixelFormatType_420YpCbCr10BiPlanarVideoRange;
+            }
+        }
+        else {
+            if (yuv444) {
+                return m_FullRange ? kCVPixelFormatType_444YpCbCr8BiPlanarFullRange : kCVPixelFormatType_444YpCbCr8BiPlanarVideoRange;
+            }
+            else {
+                return m_FullRange ? kCVPixelFormatType_420YpCbCr8BiPlanarFullRange : kCVPixelFormatType_420YpCbCr8BiPlanarVideoRange;
+            }
+        }
+    }
+
+    bool createSession()
+    {
+        SDL_assert(m_Session == nullptr);
+        SDL_assert(m_FormatDesc != nullptr);
+
+        CFMutableDictionaryRef decoderSpec = CFDictionaryCreateMutable(kCFAllocatorDefault, 0,
+                                                                       &kCFTypeDictionaryKeyCallBacks,
+                                                                       &kCFTypeDictionaryValueCallBacks);
+        CFDictionarySetValue(decoderSpec, kVTVideoDecoderSpecification_EnableHardwareAcceleratedVideoDecoder, kCFBooleanTrue);
+        CFDictionarySetValue(decoderSpec, kVTVideoDecoderSpecification_RequireHardwareAcceleratedVideoDecoder, kCFBooleanTrue);
+
+        // Ask for IOSurface-backed buffers that Metal can sample from directly
+        OSType pixelFormat = getOutputPixelFormat();
+        CFNumberRef pixelFormatNumber = CFNumberCreate(kCFAllocatorDefault, kCFNumberSInt32Type, &pixelFormat);
+        CFDictionaryRef ioSurfaceProperties = CFDictionaryCreate(kCFAllocatorDefault, nullptr, nullptr, 0,
+                                                                 &kCFTypeDictionaryKeyCallBacks,
+                                                                 &kCFTypeDictionaryValueCallBacks);
+        CFMutableDictionaryRef imageBufferAttributes = CFDictionaryCreateMutable(kCFAllocatorDefault, 0,
+                                                                                 &kCFTypeDictionaryKeyCallBacks,
+                                                                                 &kCFTypeDictionaryValueCallBacks);
+        CFDictionarySetValue(imageBufferAttributes, kCVPixelBufferPixelFormatTypeKey, pixelFormatNumber);
+        CFDictionarySetValue(imageBufferAttributes, kCVPixelBufferIOSurfacePropertiesKey, ioSurfaceProperties);
+        CFDictionarySetValue(imageBufferAttributes, kCVPixelBufferMetalCompatibilityKey, kCFBooleanTrue);
+        CFRelease(ioSurfaceProperties);
+        CFRelease(pixelFormatNumber);
+
+        VTDecompressionOutputCallbackRecord callback = { outputCallback, this };
+        OSStatus status = VTDecompressionSessionCreate(kCFAllocatorDefault, m_FormatDesc, decoderSpec,
+                                                       imageBufferAttributes, &callback, &m_Session);
+        CFRelease(imageBufferAttributes);
+        CFRelease(decoderSpec);
+
+        if (status != noErr) {
+            SDL_LogError(SDL_LOG_CATEGORY_APPLICATION,
+                         "VTDecompressionSessionCreate() failed: %d",
+                         status);
+            m_Session = nullptr;
+            return false;
+        }
+
+        // Decode each frame as soon as it arrives instead of batching for throughput
+        status = VTSessionSetProperty(m_Session, kVTDecompressionPropertyKey_RealTime, kCFBooleanTrue);
+        if (status != noErr) {
+            SDL_LogWarn(SDL_LOG_CATEGORY_APPLICATION,
+                        "Failed to enable real-time decoding: %d",
+                        status);
+        }
+
+        // Don't trade decode latency for power savings
+        if (@available(macOS 10.14, *)) {
+            status = VTSessionSetProperty(m_Session, kVTDecompressionPropertyKey_MaximizePowerEfficiency, kCFBooleanFalse);
+            if (status != noErr) {
+                SDL_LogWarn(SDL_LOG_CATEGORY_APPLICATION,
+                            "Failed to disable power efficient decoding: %d",
+                            status);
+            }
+        }
+
+        SDL_LogInfo(SDL_LOG_CATEGORY_APPLICATION,
+                    "Created VTDecompressionSession for direct decoding");
+        return true;
+    }
+
+    void destroySession()
+    {
+        if (m_Session == nullptr) {
+            return;
+        }
+
+        // Deliver any frames still in flight before tearing down
+        VTDecompressionSessionWaitForAsynchronousFrames(m_Session);
+        VTDecompressionSessionInvalidate(m_Session);
+        CFRelease(m_Session);
+        m_Session = nullptr;
+    }
+
+    bool updateFramesContext(CVPixelBufferRef pixelBuffer)
+    {
+        AVPixelFormat swFormat = av_map_videotoolbox_format_to_pixfmt(CVPixelBufferGetPixelFormatType(pixelBuffer));
+        int width = (int)CVPixelBufferGetWidth(pixelBuffer);
+        int height = (int)CVPixelBufferGetHeight(pixelBuffer);
+
+        if (m_HwFramesContext != nullptr) {
+            auto framesContext = (AVHWFramesContext*)m_HwFramesContext->data;
+            if (framesContext->sw_format == swFormat && framesContext->width == width && framesContext->height == height) {
+                return true;
+            }
+
+            av_buffer_unref(&m_HwFramesContext);
+        }
+
+        // Renderers look up the underlying format of the frame here,
+        // just as they do for frames from the hwaccel
+        m_HwFramesContext = av_hwframe_ctx_alloc(m_HwDeviceContext);
+        if (m_HwFramesContext == nullptr) {
+            return false;
+        }
+
+        auto framesContext = (AVHWFramesContext*)m_HwFramesContext->data;
+        framesContext->format = AV_PIX_FMT_VIDEOTOOLBOX;
+        framesContext->sw_format = swFormat;
+        framesContext->width = width;
+        framesContext->height = height;
+
+        int err = av_hwframe_ctx_init(m_HwFramesContext);
+        if (err < 0) {
+            SDL_LogError(SDL_LOG_CATEGORY_APPLICATION,
+                         "av_hwframe_ctx_init() failed: %d",
+                         err);
+            av_buffer_unref(&m_HwFramesContext);
+            return false;
+        }
+
+        return true;
+    }
+
+    void setFrameColorProperties(AVFrame* frame, CVPixelBufferRef pixelBuffer)
+    {
+        switch (CVPixelBufferGetPixelFormatType(pixelBuffer)) {
+        case kCVPixelFormatType_420YpCbCr8BiPlanarFullRange:
+        case kCVPixelFormatType_444YpCbCr8BiPlanarFullRange:
+        case kCVPixelFormatType_420YpCbCr10BiPlanarFullRange:
+        case kCVPixelFormatType_444YpCbCr10BiPlanarFullRange:
+            frame->color_range = AVCOL_RANGE_JPEG;
+            break;
+        default:
+            frame->color_range = AVCOL_RANGE_MPEG;
+            break;
+        }
+
+        // Start from what we asked the host to send
+        switch (m_Colorspace) {
+        case COLORSPACE_REC_2020:
+            frame->colorspace = AVCOL_SPC_BT2020_NCL;
+            frame->color_primaries = AVCOL_PRI_BT2020;
+            frame->color_trc = (m_VideoFormat & VIDEO_FORMAT_MASK_10BIT) ? AVCOL_TRC_SMPTE2084 : AVCOL_TRC_BT2020_10;
+            break;
+        case COLORSPACE_REC_709:
+            frame->colorspace = AVCOL_SPC_BT709;
+            frame->color_primaries = AVCOL_PRI_BT709;
+            frame->color_trc = AVCOL_TRC_BT709;
+            break;
+        default:
+            frame->colorspace = AVCOL_SPC_SMPTE170M;
+            frame->color_primaries = AVCOL_PRI_SMPTE170M;
+            frame->color_trc = AVCOL_TRC_SMPTE170M;
+            break;
+        }
+
+        // VideoToolbox attaches the VUI color description from the bitstream,
+        // which uses the same H.273 code points as FFmpeg
+        CFTypeRef matrix = CVBufferGetAttachment(pixelBuffer, kCVImageBufferYCbCrMatrixKey, nullptr);
+        if (matrix != nullptr) {
+            int codePoint = CVYCbCrMatrixGetIntegerCodePointForString((CFStringRef)matrix);
+            if (codePoint != AVCOL_SPC_UNSPECIFIED) {
+                frame->colorspace = (AVColorSpace)codePoint;
+            }
+        }
+
+        CFTypeRef primaries = CVBufferGetAttachment(pixelBuffer, kCVImageBufferColorPrimariesKey, nullptr);
+        if (primaries != nullptr) {
+            int codePoint = CVColorPrimariesGetIntegerCodePointForString((CFStringRef)primaries);
+            if (codePoint != AVCOL_PRI_UNSPECIFIED) {
+                frame->color_primaries = (AVColorPrimaries)codePoint;
+            }
+        }
+
+        CFTypeRef transfer = CVBufferGetAttachment(pixelBuffer, kCVImageBufferTransferFunctionKey, nullptr);
+        if (transfer != nullptr) {
+            int codePoint = CVTransferFunctionGetIntegerCodePointForString((CFStringRef)transfer);
+            if (codePoint != AVCOL_TRC_UNSPECIFIED) {
+                frame->color_trc = (AVColorTransferCharacteristic)codePoint;
+            }
+        }
+
+        // Both H.264 and HEVC default to co-sited chroma on the left
+        frame->chroma_location = AVCHROMA_LOC_LEFT;
+    }
+
+    int m_VideoFormat;
+    int m_Colorspace;
+    bool m_FullRange;
+    AVBufferRef* m_HwDeviceContext;
+    AVBufferRef* m_HwFramesContext;
+    CMVideoFormatDescriptionRef m_FormatDesc;
+    QByteArray m_ParameterSetData;
+    VTDecompressionSessionRef m_Session;
+    std::vector<NalUnit> m_NalUnits;
+    std::vector<uint8_t> m_SampleData;
+    uintptr_t m_NextSequence;
+
+    // Written by the VideoToolbox output callback
+    SDL_mutex* m_OutputLock;
+    SDL_cond* m_OutputReady;
+    QQueue<DecodedFrame> m_Output;
+    uintptr_t m_AbandonedSequence;
+};
+
+IVTDirectDecoder* VTDirectDecoderFactory::createDecoder(PDECODER_PARAMETERS params, AVBufferRef* hwDeviceContext,
+                                                        int colorspace, bool fullRange)
+{
+    // AV1 needs an av1C configuration record built from the sequence header,
+    // so we leave that to FFmpeg's hwaccel
+    if (!(params->videoFormat & (VIDEO_FORMAT_MASK_H264 | VIDEO_FORMAT_MASK_H265))) {
+        SDL_LogInfo(SDL_LOG_CATEGORY_APPLICATION,
+                    "Direct VideoToolbox decoding is only supported for H.264 and HEVC");
+        return nullptr;
+    }
+
+    SDL_LogInfo(SDL_LOG_CATEGORY_APPLICATION,
+                "Using direct VideoToolbox decoding (VT_DIRECT_DECODE)");
+    return new VTDirectDecoder(params->videoFormat, hwDeviceContext, colorspace, fullRange);
+}
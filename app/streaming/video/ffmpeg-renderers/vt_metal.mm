@@ -43,6 +43,15 @@ struct Vertex
 
 #define MAX_VIDEO_PLANES 3
 
+// Enough for the decoder's reference frames plus every frame Pacer can hold
+#define MAX_CACHED_SURFACES 32
+
+struct CachedSurface {
+    IOSurfaceRef surface;
+    OSType pixelFormat;
+    id<MTLTexture> planeTextures[MAX_VIDEO_PLANES];
+};
+
 class VTMetalRenderer;
 
 @interface DisplayLinkDelegate : NSObject <CAMetalDisplayLinkDelegate>
@@ -61,6 +70,7 @@ public:
           m_HwContext(nullptr),
           m_MetalLayer(nullptr),
           m_MetalDisplayLink(nullptr),
+          m_FrameInterval(0),
           m_LatestUnrenderedFrame(nullptr),
           m_FrameLock(SDL_CreateMutex()),
           m_FrameReady(SDL_CreateCond()),
@@ -71,14 +81,25 @@ public:
           m_OverlayLock(0),
           m_VideoPipelineState(nullptr),
           m_OverlayPipelineState(nullptr),
+          m_PerfGraphVertexBuffer(nullptr),
+          m_PerfGraphPaletteTexture(nullptr),
           m_ShaderLibrary(nullptr),
           m_CommandQueue(nullptr),
           m_SwMappingTextures{},
+          m_CachedSurfaces{},
+          m_NextCachedSurface(0),
+          m_TextureCacheMisses{},
           m_MetalView(nullptr),
           m_LastFrameWidth(-1),
           m_LastFrameHeight(-1),
           m_LastDrawableWidth(-1),
-          m_LastDrawableHeight(-1)
+          m_LastDrawableHeight(-1),
+          m_GpuRenderTimeUs{},
+          m_VsyncPacer(nullptr),
+          m_PacedDrawable(nullptr),
+          m_PacedPresentTime(0),
+          m_PtsAnchor(AV_NOPTS_VALUE),
+          m_PtsAnchorTime(0)
     {
     }
 
@@ -87,6 +108,9 @@ public:
         // Stop the display link and free associated state
         stopDisplayLink();
         av_frame_free(&m_LatestUnrenderedFrame);
+        if (m_PacedDrawable != nullptr) {
+            [m_PacedDrawable release];
+        }
         SDL_DestroyCond(m_FrameReady);
         SDL_DestroyMutex(m_FrameLock);
 
@@ -118,10 +142,20 @@ public:
             }
         }
 
+        flushSurfaceCache();
+
         if (m_OverlayPipelineState != nullptr) {
             [m_OverlayPipelineState release];
         }
 
+        if (m_PerfGraphVertexBuffer != nullptr) {
+            [m_PerfGraphVertexBuffer release];
+        }
+
+        if (m_PerfGraphPaletteTexture != nullptr) {
+            [m_PerfGraphPaletteTexture release];
+        }
+
         if (m_ShaderLibrary != nullptr) {
             [m_ShaderLibrary release];
         }
@@ -402,36 +436,151 @@ public:
         return m_SwMappingTextures[planeIndex];
     }
 
-    // Caller frees frame after we return
-    virtual void renderFrameIntoDrawable(AVFrame* frame, id<CAMetalDrawable> drawable)
+    static MTLPixelFormat getPlanePixelFormat(OSType pixelFormat, size_t planeIndex)
+    {
+        switch (pixelFormat) {
+        case kCVPixelFormatType_420YpCbCr8BiPlanarVideoRange:
+        case kCVPixelFormatType_444YpCbCr8BiPlanarVideoRange:
+        case kCVPixelFormatType_420YpCbCr8BiPlanarFullRange:
+        case kCVPixelFormatType_444YpCbCr8BiPlanarFullRange:
+            return (planeIndex == 0) ? MTLPixelFormatR8Unorm : MTLPixelFormatRG8Unorm;
+
+        case kCVPixelFormatType_420YpCbCr10BiPlanarFullRange:
+        case kCVPixelFormatType_444YpCbCr10BiPlanarFullRange:
+        case kCVPixelFormatType_420YpCbCr10BiPlanarVideoRange:
+        case kCVPixelFormatType_444YpCbCr10BiPlanarVideoRange:
+            return (planeIndex == 0) ? MTLPixelFormatR16Unorm : MTLPixelFormatRG16Unorm;
+
+        default:
+            return MTLPixelFormatInvalid;
+        }
+    }
+
+    void flushSurfaceCache()
+    {
+        for (int i = 0; i < MAX_CACHED_SURFACES; i++) {
+            CachedSurface& cachedSurface = m_CachedSurfaces[i];
+            if (cachedSurface.surface == nullptr) {
+                continue;
+            }
+
+            for (int j = 0; j < MAX_VIDEO_PLANES; j++) {
+                if (cachedSurface.planeTextures[j] != nullptr) {
+                    [cachedSurface.planeTextures[j] release];
+                }
+            }
+            CFRelease(cachedSurface.surface);
+            cachedSurface = {};
+        }
+
+        m_NextCachedSurface = 0;
+    }
+
+    // VideoToolbox recycles a small pool of IOSurfaces for its output, so we keep
+    // the plane textures for each surface we've seen rather than asking
+    // CVMetalTextureCache to wrap every frame again. Textures alias the surface
+    // memory, so they always see the latest decoded contents. Returns nullptr
+    // if the frame can't be mapped this way.
+    CachedSurface* getCachedSurface(CVPixelBufferRef pixBuf, size_t planes)
+    {
+        IOSurfaceRef surface = CVPixelBufferGetIOSurface(pixBuf);
+        if (surface == nullptr) {
+            return nullptr;
+        }
+
+        OSType pixelFormat = CVPixelBufferGetPixelFormatType(pixBuf);
+        for (int i = 0; i < MAX_CACHED_SURFACES; i++) {
+            if (m_CachedSurfaces[i].surface == surface && m_CachedSurfaces[i].pixelFormat == pixelFormat) {
+                return &m_CachedSurfaces[i];
+            }
+        }
+
+        id<MTLTexture> planeTextures[MAX_VIDEO_PLANES] = {};
+        for (size_t i = 0; i < planes; i++) {
+            MTLPixelFormat fmt = getPlanePixelFormat(pixelFormat, i);
+            if (fmt == MTLPixelFormatInvalid) {
+                break;
+            }
+
+            auto texDesc = [MTLTextureDescriptor texture2DDescriptorWithPixelFormat:fmt
+                                                                              width:IOSurfaceGetWidthOfPlane(surface, i)
+                                                                             height:IOSurfaceGetHeightOfPlane(surface, i)
+                                                                          mipmapped:NO];
+            texDesc.usage = MTLTextureUsageShaderRead;
+            texDesc.storageMode = MTLStorageModeShared;
+            planeTextures[i] = [m_MetalLayer.device newTextureWithDescriptor:texDesc iosurface:surface plane:i];
+            if (planeTextures[i] == nullptr) {
+                break;
+            }
+        }
+
+        if (planeTextures[planes - 1] == nullptr) {
+            // Let the caller fall back to CVMetalTextureCache
+            for (size_t i = 0; i < planes; i++) {
+                if (planeTextures[i] != nullptr) {
+                    [planeTextures[i] release];
+                }
+            }
+            return nullptr;
+        }
+
+        // A new surface size or format means the decoder replaced its pool,
+        // so don't keep the old surfaces alive any longer
+        IOSurfaceRef lastSurface = m_CachedSurfaces[(m_NextCachedSurface + MAX_CACHED_SURFACES - 1) % MAX_CACHED_SURFACES].surface;
+        if (lastSurface != nullptr &&
+                (IOSurfaceGetWidth(lastSurface) != IOSurfaceGetWidth(surface) ||
+                 IOSurfaceGetHeight(lastSurface) != IOSurfaceGetHeight(surface) ||
+                 IOSurfaceGetPixelFormat(lastSurface) != IOSurfaceGetPixelFormat(surface))) {
+            flushSurfaceCache();
+        }
+
+        // Otherwise the cache is large enough that surfaces evicted in
+        // round-robin order are normally no longer in use by the decoder
+        CachedSurface& cachedSurface = m_CachedSurfaces[m_NextCachedSurface];
+        if (cachedSurface.surface != nullptr) {
+            for (int j = 0; j < MAX_VIDEO_PLANES; j++) {
+                if (cachedSurface.planeTextures[j] != nullptr) {
+                    [cachedSurface.planeTextures[j] release];
+                }
+            }
+            CFRelease(cachedSurface.surface);
+        }
+
+        cachedSurface.surface = (IOSurfaceRef)CFRetain(surface);
+        cachedSurface.pixelFormat = pixelFormat;
+        for (int i = 0; i < MAX_VIDEO_PLANES; i++) {
+            cachedSurface.planeTextures[i] = planeTextures[i];
+        }
+        m_NextCachedSurface = (m_NextCachedSurface + 1) % MAX_CACHED_SURFACES;
+
+        SDL_AtomicIncRef(&m_TextureCacheMisses);
+        return &cachedSurface;
+    }
+
+    // Caller frees frame after we return. The drawable is presented at
+    // presentTime, or as soon as possible if presentTime is 0.
+    virtual void renderFrameIntoDrawable(AVFrame* frame, id<CAMetalDrawable> drawable, CFTimeInterval presentTime = 0)
     { @autoreleasepool {
-        std::array<CVMetalTextureRef, MAX_VIDEO_PLANES> cvMetalTextures;
+        std::array<CVMetalTextureRef, MAX_VIDEO_PLANES> cvMetalTextures = {};
+        std::array<id<MTLTexture>, MAX_VIDEO_PLANES> hwPlaneTextures = {};
         size_t planes = getFramePlaneCount(frame);
         SDL_assert(planes <= MAX_VIDEO_PLANES);
 
         if (frame->format == AV_PIX_FMT_VIDEOTOOLBOX) {
             CVPixelBufferRef pixBuf = reinterpret_cast<CVPixelBufferRef>(frame->data[3]);
+            CachedSurface* cachedSurface = getCachedSurface(pixBuf, planes);
 
-            // Create Metal textures for the planes of the CVPixelBuffer
-            for (size_t i = 0; i < planes; i++) {
-                MTLPixelFormat fmt;
-
-                switch (CVPixelBufferGetPixelFormatType(pixBuf)) {
-                case kCVPixelFormatType_420YpCbCr8BiPlanarVideoRange:
-                case kCVPixelFormatType_444YpCbCr8BiPlanarVideoRange:
-                case kCVPixelFormatType_420YpCbCr8BiPlanarFullRange:
-                case kCVPixelFormatType_444YpCbCr8BiPlanarFullRange:
-                    fmt = (i == 0) ? MTLPixelFormatR8Unorm : MTLPixelFormatRG8Unorm;
-                    break;
-
-                case kCVPixelFormatType_420YpCbCr10BiPlanarFullRange:
-                case kCVPixelFormatType_444YpCbCr10BiPlanarFullRange:
-                case kCVPixelFormatType_420YpCbCr10BiPlanarVideoRange:
-                case kCVPixelFormatType_444YpCbCr10BiPlanarVideoRange:
-                    fmt = (i == 0) ? MTLPixelFormatR16Unorm : MTLPixelFormatRG16Unorm;
-                    break;
-
-                default:
+            if (cachedSurface != nullptr) {
+                for (size_t i = 0; i < planes; i++) {
+                    hwPlaneTextures[i] = cachedSurface->planeTextures[i];
+                }
+            }
+
+            // Create Metal textures for the planes of the CVPixelBuffer if it
+            // isn't backed by an IOSurface that we can keep mapped
+            for (size_t i = 0; cachedSurface == nullptr && i < planes; i++) {
+                MTLPixelFormat fmt = getPlanePixelFormat(CVPixelBufferGetPixelFormatType(pixBuf), i);
+                if (fmt == MTLPixelFormatInvalid) {
                     SDL_LogError(SDL_LOG_CATEGORY_APPLICATION,
                                  "Unknown pixel format: %x",
                                  CVPixelBufferGetPixelFormatType(pixBuf));
@@ -447,8 +596,14 @@ public:
                     SDL_LogError(SDL_LOG_CATEGORY_APPLICATION,
                                  "CVMetalTextureCacheCreateTextureFromImage() failed: %d",
                                  err);
+                    for (size_t j = 0; j < i; j++) {
+                        CFRelease(cvMetalTextures[j]);
+                    }
                     return;
                 }
+
+                hwPlaneTextures[i] = CVMetalTextureGetTexture(cvMetalTextures[i]);
+                SDL_AtomicIncRef(&m_TextureCacheMisses);
             }
         }
 
@@ -465,14 +620,16 @@ public:
         [renderEncoder setRenderPipelineState:m_VideoPipelineState];
         if (frame->format == AV_PIX_FMT_VIDEOTOOLBOX) {
             for (size_t i = 0; i < planes; i++) {
-                [renderEncoder setFragmentTexture:CVMetalTextureGetTexture(cvMetalTextures[i]) atIndex:i];
+                [renderEncoder setFragmentTexture:hwPlaneTextures[i] atIndex:i];
+            }
+            if (cvMetalTextures[0] != nullptr) {
+                [commandBuffer addCompletedHandler:^(id<MTLCommandBuffer>) {
+                    // Free textures after completion of rendering per CVMetalTextureCache requirements
+                    for (size_t i = 0; i < planes; i++) {
+                        CFRelease(cvMetalTextures[i]);
+                    }
+                }];
             }
-            [commandBuffer addCompletedHandler:^(id<MTLCommandBuffer>) {
-                // Free textures after completion of rendering per CVMetalTextureCache requirements
-                for (size_t i = 0; i < planes; i++) {
-                    CFRelease(cvMetalTextures[i]);
-                }
-            }];
         }
         else {
             for (size_t i = 0; i < planes; i++) {
@@ -528,14 +685,48 @@ public:
             }
         }
 
+        if (Session::get() != nullptr &&
+                Session::get()->getOverlayManager().isOverlayEnabled(Overlay::OverlayPerfGraph) &&
+                m_PerfGraphVertexBuffer != nullptr && m_PerfGraphPaletteTexture != nullptr) {
+            Overlay::PERF_GRAPH_VERTEX* graphVerts = m_PerfGraphVertices;
+            int vertexCount = Session::get()->getOverlayManager().getPerfGraph().buildVertices(graphVerts,
+                                                                                               m_LastDrawableWidth,
+                                                                                               m_LastDrawableHeight);
+            if (vertexCount > 0) {
+                Vertex* verts = (Vertex*)m_PerfGraphVertexBuffer.contents;
+                for (int i = 0; i < vertexCount; i++) {
+                    verts[i] = { { graphVerts[i].x, graphVerts[i].y, 0.0f, 1.0f }, { graphVerts[i].u, graphVerts[i].v } };
+                }
+
+                // The graph is drawn with the overlay pipeline sampling from a palette texture
+                [renderEncoder setRenderPipelineState:m_OverlayPipelineState];
+                [renderEncoder setFragmentTexture:m_PerfGraphPaletteTexture atIndex:0];
+                [renderEncoder setVertexBuffer:m_PerfGraphVertexBuffer offset:0 atIndex:0];
+                [renderEncoder drawPrimitives:MTLPrimitiveTypeTriangle vertexStart:0 vertexCount:vertexCount];
+            }
+        }
+
         [renderEncoder endEncoding];
 
         // Flip to the newly rendered buffer
-        [commandBuffer presentDrawable:drawable];
+        if (presentTime != 0) {
+            [commandBuffer presentDrawable:drawable atTime:presentTime];
+        }
+        else {
+            [commandBuffer presentDrawable:drawable];
+        }
         [commandBuffer commit];
 
         // Wait for the command buffer to complete and free our CVMetalTextureCache references
         [commandBuffer waitUntilCompleted];
+
+        // We may be on the display link thread, so this is picked up by getGpuRenderTime() later
+        if (@available(macOS 10.15, *)) {
+            if (commandBuffer.status == MTLCommandBufferStatusCompleted && commandBuffer.GPUEndTime > commandBuffer.GPUStartTime) {
+                SDL_AtomicSet(&m_GpuRenderTimeUs,
+                              SDL_max((int)((commandBuffer.GPUEndTime - commandBuffer.GPUStartTime) * 1000000), 1));
+            }
+        }
     }}
 
     // Caller frees frame after we return
@@ -559,6 +750,25 @@ public:
             return;
         }
 
+        // When the display link drives Pacer, this frame was released for the
+        // V-sync that just handed us a drawable, so render it straight into that
+        SDL_LockMutex(m_FrameLock);
+        bool paced = m_VsyncPacer != nullptr;
+        id<CAMetalDrawable> pacedDrawable = m_PacedDrawable;
+        CFTimeInterval pacedPresentTime = m_PacedPresentTime;
+        m_PacedDrawable = nullptr;
+        SDL_UnlockMutex(m_FrameLock);
+
+        if (paced) {
+            // If we already used this V-sync's drawable, Pacer will hand us
+            // a newer frame on the next one
+            if (pacedDrawable != nullptr) {
+                renderFrameIntoDrawable(frame, pacedDrawable, getPresentTimeForFrame(frame, pacedPresentTime));
+                [pacedDrawable release];
+            }
+            return;
+        }
+
         // Start the display link if necessary
         startDisplayLink();
 
@@ -634,6 +844,7 @@ public:
 
         m_Window = params->window;
         m_FrameRateRange = CAFrameRateRangeMake(params->frameRate, params->frameRate, params->frameRate);
+        m_FrameInterval = 1.0 / params->frameRate;
 
         id<MTLDevice> device = getMetalDevice();
         if (!device) {
@@ -706,6 +917,24 @@ public:
 
         // Create a command queue for submission
         m_CommandQueue = [m_MetalLayer.device newCommandQueue];
+
+        // Create the performance graph resources. We wait for each frame to finish
+        // rendering, so a single shared vertex buffer can be rewritten every frame.
+        m_PerfGraphVertexBuffer = [m_MetalLayer.device newBufferWithLength:PERF_GRAPH_MAX_VERTICES * sizeof(Vertex)
+                                                                   options:MTLCPUCacheModeWriteCombined | MTLResourceStorageModeShared];
+
+        auto texDesc = [MTLTextureDescriptor texture2DDescriptorWithPixelFormat:MTLPixelFormatBGRA8Unorm
+                                                                          width:Overlay::PerfGraphColorMax
+                                                                         height:1
+                                                                      mipmapped:NO];
+        texDesc.cpuCacheMode = MTLCPUCacheModeWriteCombined;
+        texDesc.storageMode = MTLStorageModeManaged;
+        texDesc.usage = MTLTextureUsageShaderRead;
+        m_PerfGraphPaletteTexture = [m_MetalLayer.device newTextureWithDescriptor:texDesc];
+        [m_PerfGraphPaletteTexture replaceRegion:MTLRegionMake2D(0, 0, Overlay::PerfGraphColorMax, 1)
+                                     mipmapLevel:0
+                                       withBytes:Overlay::PerfGraph::getPaletteData()
+                                     bytesPerRow:Overlay::PerfGraphColorMax * sizeof(uint32_t)];
         return true;
     }}
 
@@ -809,6 +1038,85 @@ public:
         return false;
     }
 
+    // Makes the display link drive Pacer instead of rendering on its own.
+    // Passing nullptr returns the display link to rendering the latest frame.
+    bool setVsyncPacer(Pacer* pacer)
+    {
+        if (pacer != nullptr) {
+            // Pacer won't render anything until the first V-sync, so the
+            // display link must be running before the first frame arrives
+            startDisplayLink();
+            if (!hasDisplayLink()) {
+                return false;
+            }
+        }
+
+        SDL_LockMutex(m_FrameLock);
+        m_VsyncPacer = pacer;
+        if (m_PacedDrawable != nullptr) {
+            [m_PacedDrawable release];
+            m_PacedDrawable = nullptr;
+        }
+        SDL_UnlockMutex(m_FrameLock);
+
+        return true;
+    }
+
+    IVsyncSource* createVsyncSource(Pacer* pacer) override;
+
+    // Called on the main thread for each display link update
+    void handleDisplayLinkUpdate(id<CAMetalDrawable> drawable, CFTimeInterval targetTimestamp, CFTimeInterval targetPresentationTimestamp)
+    {
+        SDL_LockMutex(m_FrameLock);
+        if (m_VsyncPacer != nullptr) {
+            // Replace any drawable that the render thread didn't get to in time
+            if (m_PacedDrawable != nullptr) {
+                [m_PacedDrawable release];
+            }
+            m_PacedDrawable = [drawable retain];
+            m_PacedPresentTime = targetPresentationTimestamp;
+            m_VsyncPacer->signalVsync();
+            SDL_UnlockMutex(m_FrameLock);
+            return;
+        }
+        SDL_UnlockMutex(m_FrameLock);
+
+        renderLatestFrameOnDrawable(drawable, targetTimestamp);
+    }
+
+    // Returns when to present this frame so the stream's frame cadence is
+    // kept on the display, rather than presenting at whichever refresh the
+    // frame happened to arrive for. Render thread only.
+    CFTimeInterval getPresentTimeForFrame(AVFrame* frame, CFTimeInterval targetPresentTime)
+    {
+        if (frame->pts == AV_NOPTS_VALUE) {
+            return targetPresentTime;
+        }
+
+        if (m_PtsAnchor != AV_NOPTS_VALUE) {
+            // RTP timestamps are 32-bit in a 90 kHz timebase
+            int32_t elapsedPts = (int32_t)((uint32_t)frame->pts - (uint32_t)m_PtsAnchor);
+            CFTimeInterval presentTime = m_PtsAnchorTime + elapsedPts / 90000.0;
+
+            if (presentTime > targetPresentTime - m_FrameInterval &&
+                    presentTime < targetPresentTime + m_FrameInterval) {
+                if (presentTime < targetPresentTime) {
+                    // This frame can't be shown any sooner, so follow the
+                    // host's clock drifting behind the display's
+                    m_PtsAnchorTime += targetPresentTime - presentTime;
+                    return targetPresentTime;
+                }
+
+                return presentTime;
+            }
+        }
+
+        // Start over from this frame after a stall or a jump in timestamps
+        m_PtsAnchor = frame->pts;
+        m_PtsAnchorTime = targetPresentTime;
+        return targetPresentTime;
+    }
+
     virtual bool needsTestFrame() override
     {
         // We used to trust VT to tell us whether decode will work, but
@@ -830,6 +1138,25 @@ public:
                CAPABILITY_REFERENCE_FRAME_INVALIDATION_AV1;
     }
 
+    bool getTextureCacheMisses(uint32_t* misses) override
+    {
+        // Frames may be rendered on the display link thread
+        *misses = SDL_AtomicSet(&m_TextureCacheMisses, 0);
+        return true;
+    }
+
+    bool getGpuRenderTime(uint64_t* renderTimeUs) override
+    {
+        // Only report each command buffer once
+        int gpuRenderTimeUs = SDL_AtomicSet(&m_GpuRenderTimeUs, 0);
+        if (gpuRenderTimeUs == 0) {
+            return false;
+        }
+
+        *renderTimeUs = gpuRenderTimeUs;
+        return true;
+    }
+
     int getRendererAttributes() override
     {
         // Metal supports HDR output
@@ -916,16 +1243,23 @@ private:
     CAMetalLayer* m_MetalLayer;
     CAMetalDisplayLink* m_MetalDisplayLink API_AVAILABLE(macos(14.0));
     CAFrameRateRange m_FrameRateRange;
+    CFTimeInterval m_FrameInterval;
     AVFrame* m_LatestUnrenderedFrame;
     SDL_mutex* m_FrameLock;
     SDL_cond* m_FrameReady;
     CVMetalTextureCacheRef m_TextureCache;
+    CachedSurface m_CachedSurfaces[MAX_CACHED_SURFACES];
+    int m_NextCachedSurface;
+    SDL_atomic_t m_TextureCacheMisses;
     id<MTLBuffer> m_CscParamsBuffer;
     id<MTLBuffer> m_VideoVertexBuffer;
     id<MTLTexture> m_OverlayTextures[Overlay::OverlayMax];
     SDL_SpinLock m_OverlayLock;
     id<MTLRenderPipelineState> m_VideoPipelineState;
     id<MTLRenderPipelineState> m_OverlayPipelineState;
+    id<MTLBuffer> m_PerfGraphVertexBuffer;
+    id<MTLTexture> m_PerfGraphPaletteTexture;
+    Overlay::PERF_GRAPH_VERTEX m_PerfGraphVertices[PERF_GRAPH_MAX_VERTICES]; // Too big for the stack
     id<MTLLibrary> m_ShaderLibrary;
     id<MTLCommandQueue> m_CommandQueue;
     id<MTLTexture> m_SwMappingTextures[MAX_VIDEO_PLANES];
@@ -934,8 +1268,58 @@ private:
     int m_LastFrameHeight;
     int m_LastDrawableWidth;
     int m_LastDrawableHeight;
+
+    // GPU time of the last command buffer, or 0 if it was already reported
+    SDL_atomic_t m_GpuRenderTimeUs;
+
+    // Display link pacing state. The first three are protected by m_FrameLock.
+    Pacer* m_VsyncPacer;
+    id<CAMetalDrawable> m_PacedDrawable;
+    CFTimeInterval m_PacedPresentTime;
+    int64_t m_PtsAnchor;
+    CFTimeInterval m_PtsAnchorTime;
+};
+
+// Drives Pacer from CAMetalDisplayLink updates, so each paced frame is
+// rendered into the drawable for the refresh it was released for
+class VTMetalVsyncSource : public IVsyncSource
+{
+public:
+    VTMetalVsyncSource(VTMetalRenderer* renderer, Pacer* pacer)
+        : m_Renderer(renderer),
+          m_Pacer(pacer)
+    {
+    }
+
+    virtual ~VTMetalVsyncSource() override
+    {
+        m_Renderer->setVsyncPacer(nullptr);
+    }
+
+    virtual bool initialize(SDL_Window*, int) override
+    {
+        return m_Renderer->setVsyncPacer(m_Pacer);
+    }
+
+    virtual bool isAsync() override
+    {
+        return true;
+    }
+
+private:
+    VTMetalRenderer* m_Renderer;
+    Pacer* m_Pacer;
 };
 
+IVsyncSource* VTMetalRenderer::createVsyncSource(Pacer* pacer)
+{
+    if (qgetenv("VT_DISPLAY_LINK_PACING") == "0") {
+        return nullptr;
+    }
+
+    return new VTMetalVsyncSource(this, pacer);
+}
+
 @implementation DisplayLinkDelegate {
     VTMetalRenderer* _renderer;
 }
@@ -947,7 +1331,7 @@ private:
 
 - (void)metalDisplayLink:(CAMetalDisplayLink *)link
              needsUpdate:(CAMetalDisplayLinkUpdate *)update API_AVAILABLE(macos(14.0)) {
-    _renderer->renderLatestFrameOnDrawable(update.drawable, update.targetTimestamp);
+    _renderer->handleDisplayLinkUpdate(update.drawable, update.targetTimestamp, update.targetPresentationTimestamp);
 }
 
 @end
@@ -1,6 +1,12 @@
 #include <Limelight.h>
 #include "ffmpeg.h"
+#include "decoderprobecache.h"
+#include "rendererpreferencecache.h"
+#include "softwaredecodeprofile.h"
+#include "spsrewriter.h"
 #include "streaming/session.h"
+#include "streaming/streamutils.h"
+#include "backend/boxartmanager.h"
 
 #include <QDir>
 #include <QDateTime>
@@ -8,6 +14,7 @@
 #include <h264_stream.h>
 
 extern "C" {
+#include <libavutil/imgutils.h>
 #include <libavutil/mastering_display_metadata.h>
 #include <libavutil/pixdesc.h>
 }
@@ -18,6 +25,7 @@ extern "C" {
 #ifdef Q_OS_WIN32
 #include "ffmpeg-renderers/dxva2.h"
 #include "ffmpeg-renderers/d3d11va.h"
+#include "antihookingprotection.h"
 #endif
 
 #ifdef Q_OS_DARWIN
@@ -61,6 +69,36 @@ extern "C" {
 
 #define FAILED_DECODES_RESET_THRESHOLD 20
 
+// How often the pipelined output thread rechecks an asynchronous decoder
+#define PIPELINED_OUTPUT_POLL_MS 1
+
+// Upper bound for the DECODER_MAX_SLICES override
+#define MAX_SLICES_OVERRIDE 16
+
+// How much the click-to-photon reference pixel's luma must change to count as
+// the host's response, and how long we'll wait for it
+#define CLICK_TO_PHOTON_LUMA_THRESHOLD 48
+#define CLICK_TO_PHOTON_TIMEOUT_US 2000000
+
+// Renderer trials skip the first frames, which pay for pipeline setup
+#define RENDERER_TRIAL_WARMUP_FRAMES 10
+#define RENDERER_TRIAL_FRAMES 60
+
+// How long a decode unit may wait in the queue before we skip the backlog
+// and resync on an IDR frame, unless overridden by ML_DECODE_BACKLOG_LIMIT_MS
+#define DEFAULT_DECODE_BACKLOG_LIMIT_MS 100
+
+// The backlog must stay over the limit for this many frames in a row before
+// we skip it, so a single stall doesn't cost us an IDR frame
+#define DECODE_BACKLOG_LATE_FRAMES 5
+
+// IDR frames are the most expensive to decode, so a decoder that is just too
+// slow would keep skipping and falling behind again. Skips are at least this
+// far apart, and the interval doubles (up to the max) each time a skip is
+// needed again within twice the current interval.
+#define DECODE_BACKLOG_MIN_TRIM_INTERVAL_US 2000000
+#define DECODE_BACKLOG_MAX_TRIM_INTERVAL_US 32000000
+
 // Note: This is NOT an exhaustive list of all decoders
 // that Moonlight could pick. It will pick any working
 // decoder that matches the codec ID and outputs one of
@@ -107,7 +145,56 @@ void FFmpegVideoDecoder::setHdrMode(bool enabled)
 
 bool FFmpegVideoDecoder::notifyWindowChanged(PWINDOW_STATE_CHANGE_INFO info)
 {
-    return m_FrontendRenderer->notifyWindowChanged(info);
+    if (!m_FrontendRenderer->notifyWindowChanged(info)) {
+        return false;
+    }
+
+    // The V-sync source may need to follow the window to a new display
+    if (m_Pacer != nullptr) {
+        m_Pacer->notifyWindowChanged(info);
+    }
+
+    return true;
+}
+
+// Returns the number of slices to request from the encoder (and decode in
+// parallel) when using software decoding. By default this is one slice per
+// core up to MAX_SLICES, but DECODER_MAX_SLICES allows many-core machines to
+// split high resolution streams further to reduce per-frame decode time.
+static int getSoftwareDecodeSlices()
+{
+    bool ok;
+    int maxSlices = qEnvironmentVariableIntValue("DECODER_MAX_SLICES", &ok);
+    if (!ok || maxSlices <= 0) {
+        maxSlices = MAX_SLICES;
+    }
+    else {
+        maxSlices = qMin(maxSlices, MAX_SLICES_OVERRIDE);
+    }
+
+    return qMin(maxSlices, SDL_GetCPUCount());
+}
+
+// H.264 RFI needs the decoder to keep more than one reference frame, so it can't
+// be combined with our SPS fixup. It's opt-in for FFmpeg's software H.264 decoder
+// with DECODER_AVC_RFI=1 since it has seen far less testing than HEVC and AV1 RFI.
+static bool isSoftwareAvcRfiEnabled()
+{
+    return qEnvironmentVariableIntValue("DECODER_AVC_RFI") != 0;
+}
+
+// Once the decoder falls far enough behind, catching up by decoding every
+// late frame takes longer than waiting for a new IDR frame. Setting
+// ML_DECODE_BACKLOG_LIMIT_MS=0 decodes every frame no matter how late.
+static uint64_t getDecodeBacklogLimitUs()
+{
+    bool ok;
+    int limitMs = qEnvironmentVariableIntValue("ML_DECODE_BACKLOG_LIMIT_MS", &ok);
+    if (!ok || limitMs < 0) {
+        limitMs = DEFAULT_DECODE_BACKLOG_LIMIT_MS;
+    }
+
+    return (uint64_t)limitMs * 1000;
 }
 
 int FFmpegVideoDecoder::getDecoderCapabilities()
@@ -125,8 +212,8 @@ int FFmpegVideoDecoder::getDecoderCapabilities()
         capabilities = m_BackendRenderer->getDecoderCapabilities();
 
         if (!isHardwareAccelerated()) {
-            // Slice up to 4 times for parallel CPU decoding, once slice per core
-            int slices = qMin(MAX_SLICES, SDL_GetCPUCount());
+            // Slice for parallel CPU decoding, one slice per core
+            int slices = getSoftwareDecodeSlices();
             SDL_LogInfo(SDL_LOG_CATEGORY_APPLICATION,
                         "Encoder configured for %d slices per frame",
                         slices);
@@ -137,6 +224,10 @@ int FFmpegVideoDecoder::getDecoderCapabilities()
 
             // Enable AV1 RFI when using the libdav1d software decoder
             capabilities |= CAPABILITY_REFERENCE_FRAME_INVALIDATION_AV1;
+
+            if (isSoftwareAvcRfiEnabled()) {
+                capabilities |= CAPABILITY_REFERENCE_FRAME_INVALIDATION_AVC;
+            }
         }
         else if (m_HwDecodeCfg == nullptr) {
             // We have a non-hwaccel hardware decoder. This will always
@@ -224,45 +315,72 @@ FFmpegVideoDecoder::FFmpegVideoDecoder(bool testOnly)
     : m_Pkt(av_packet_alloc()),
       m_VideoDecoderCtx(nullptr),
       m_RequiredPixelFormat(AV_PIX_FMT_NONE),
-      m_DecodeBuffer(1024 * 1024, 0),
+      m_DecodeBufferPool(nullptr),
+      m_DecodeBufferPoolSize(0),
       m_HwDecodeCfg(nullptr),
       m_BackendRenderer(nullptr),
       m_FrontendRenderer(nullptr),
       m_ConsecutiveFailedDecodes(0),
+      m_DecoderContextRecreated(false),
+      m_Session(nullptr),
       m_Pacer(nullptr),
       m_BwTracker(10, 250),
       m_FramesIn(0),
       m_FramesOut(0),
+      m_StatsSampleInterval(StreamUtils::getStatsSampleInterval()),
+      m_SubmitStatsSampleCounter(0),
+      m_DecodeStatsSampleCounter(0),
+      m_PerfGraphEnabled(false),
       m_LastFrameNumber(0),
+      m_LastFrameReceiveTimeUs(0),
+      m_LossStartUs(0),
+      m_LossRecoveryFrameNumber(0),
+      m_DecodeBacklogLimitUs(getDecodeBacklogLimitUs()),
+      m_DecodeBacklogLateFrames(0),
+      m_LastDecodeBacklogTrimUs(0),
+      m_DecodeBacklogTrimIntervalUs(DECODE_BACKLOG_MIN_TRIM_INTERVAL_US),
       m_StreamFps(0),
       m_VideoFormat(0),
       m_NeedsSpsFixup(false),
       m_TestOnly(testOnly),
+      m_SkipTestFrame(false),
+      m_RunRendererTrial(false),
+      m_RendererTrialUs(0),
       m_DecoderThread(nullptr),
-      m_VideoRecorder(nullptr)
+      m_DecoderOutputThread(nullptr),
+      m_PipelinedDecode(qEnvironmentVariableIntValue("DECODER_PIPELINED") != 0),
+      m_DirectDecoder(nullptr),
+      m_MasteringDisplayBuf(nullptr),
+      m_ContentLightBuf(nullptr),
+      m_VideoRecorder(nullptr),
+      m_BitstreamRecorder(nullptr),
+      m_RecordingRequested(false),
+      m_MetricsSink(testOnly ? nullptr : MetricsSink::createFromEnvironment()),
+      m_FrameTracer(testOnly ? nullptr : FrameTracer::createFromEnvironment()),
+      m_QualityAnalyzer(testOnly ? nullptr : QualityAnalyzer::createFromEnvironment()),
+      m_ClickToPhotonLuma(-1),
+      m_ClickToPhotonUnsupported(false),
+      m_LastHwFramesContext(nullptr),
+      m_DecoderPoolSurfaces(0),
+      m_DecoderPoolBytes(0),
+      m_DecodedFrameBytes(0)
 {
     SDL_zero(m_ActiveWndVideoStats);
     SDL_zero(m_LastWndVideoStats);
     SDL_zero(m_GlobalVideoStats);
 
     SDL_AtomicSet(&m_DecoderThreadShouldQuit, 0);
+    SDL_AtomicSet(&m_DecoderContextResetRequested, 0);
+    SDL_zero(m_DecoderParams);
+    SDL_zero(m_HdrMetadata);
 
     // Use linear filtering when renderer scaling is required
     SDL_SetHint(SDL_HINT_RENDER_SCALE_QUALITY, "1");
 
-    // Initialize video recorder
-    m_VideoRecorder = new VideoRecorder();
 }
 
 FFmpegVideoDecoder::~FFmpegVideoDecoder()
 {
-    // Stop video recording
-    if (m_VideoRecorder) {
-        m_VideoRecorder->finalize();
-        delete m_VideoRecorder;
-        m_VideoRecorder = nullptr;
-    }
-
     reset();
 
     // Set log level back to default.
@@ -272,6 +390,19 @@ FFmpegVideoDecoder::~FFmpegVideoDecoder()
     av_log_set_level(AV_LOG_INFO);
 
     av_packet_free(&m_Pkt);
+
+    // Buffers still referenced by the decoder keep the pool alive until released
+    av_buffer_pool_uninit(&m_DecodeBufferPool);
+
+    av_buffer_unref(&m_MasteringDisplayBuf);
+    av_buffer_unref(&m_ContentLightBuf);
+
+    delete m_MetricsSink;
+
+    // This must happen after reset() to ensure Pacer is no longer submitting records
+    delete m_FrameTracer;
+
+    delete m_QualityAnalyzer;
 }
 
 IFFmpegRenderer* FFmpegVideoDecoder::getBackendRenderer()
@@ -279,21 +410,132 @@ IFFmpegRenderer* FFmpegVideoDecoder::getBackendRenderer()
     return m_BackendRenderer;
 }
 
-void FFmpegVideoDecoder::reset()
+IFFmpegRenderer* FFmpegVideoDecoder::getFrontendRenderer()
+{
+    return m_FrontendRenderer;
+}
+
+void FFmpegVideoDecoder::getVideoStats(VIDEO_STATS& stats)
+{
+    SDL_zero(stats);
+    addVideoStats(m_GlobalVideoStats, stats);
+    addVideoStats(m_ActiveWndVideoStats, stats);
+}
+
+void FFmpegVideoDecoder::stopDecoderThreads()
 {
-    // Terminate the decoder thread before doing anything else.
-    // It might be touching things we're about to free.
     if (m_DecoderThread != nullptr) {
         SDL_AtomicSet(&m_DecoderThreadShouldQuit, 1);
         LiWakeWaitForVideoFrame();
         SDL_WaitThread(m_DecoderThread, NULL);
+
+        if (m_DecoderOutputThread != nullptr) {
+            // Taking the lock ensures the output thread can't miss the wakeup
+            m_CodecLock.lock();
+            m_FramesSubmitted.wakeAll();
+            m_CodecLock.unlock();
+
+            SDL_WaitThread(m_DecoderOutputThread, NULL);
+            m_DecoderOutputThread = nullptr;
+        }
+
         SDL_AtomicSet(&m_DecoderThreadShouldQuit, 0);
         m_DecoderThread = nullptr;
     }
+}
+
+bool FFmpegVideoDecoder::startDecoderThreads()
+{
+    m_DecoderThread = SDL_CreateThread(FFmpegVideoDecoder::decoderThreadProcThunk, "FFDecoder", (void*)this);
+    if (m_DecoderThread == nullptr) {
+        SDL_LogError(SDL_LOG_CATEGORY_APPLICATION,
+                     "Failed to create decoder thread: %s", SDL_GetError());
+        return false;
+    }
+
+    if (m_PipelinedDecode) {
+        m_DecoderOutputThread = SDL_CreateThread(FFmpegVideoDecoder::decoderOutputThreadProcThunk, "FFDecoderOutput", (void*)this);
+        if (m_DecoderOutputThread == nullptr) {
+            SDL_LogError(SDL_LOG_CATEGORY_APPLICATION,
+                         "Failed to create decoder output thread: %s", SDL_GetError());
+            return false;
+        }
+
+        SDL_LogInfo(SDL_LOG_CATEGORY_APPLICATION,
+                    "Using pipelined decoding with separate input and output threads");
+    }
+
+    return true;
+}
+
+bool FFmpegVideoDecoder::reinitializeDecoder()
+{
+    // Resets requested by the renderer mean its device or swapchain is no
+    // longer usable, so we can only handle the ones we asked for ourselves.
+    if (!SDL_AtomicGet(&m_DecoderContextResetRequested) ||
+            !(m_BackendRenderer->getRendererAttributes() & RENDERER_ATTRIBUTE_REUSABLE_DECODER_CONTEXT) ||
+            qgetenv("DECODER_FAST_RESET") == "0") {
+        return false;
+    }
+
+    SDL_LogInfo(SDL_LOG_CATEGORY_APPLICATION,
+                "Recreating decoder context with existing '%s' renderer",
+                m_BackendRenderer->getRendererName());
+
+    stopDecoderThreads();
+
+    m_FramesIn = m_FramesOut = 0;
+    m_FrameInfoQueue.clear();
+    m_ConsecutiveFailedDecodes = 0;
+    SDL_AtomicSet(&m_DecoderContextResetRequested, 0);
+
+    // The recorders may be holding references to decoder surfaces.
+    // Recording will resume on the next frame if it's still requested.
+    stopRecording();
+
+    // Pacer and the renderer keep their references to any frames that were
+    // already decoded, so they can be released after the context is gone.
+    const AVCodec* decoder = m_VideoDecoderCtx->codec;
+    destroyDirectDecoder();
+    avcodec_free_context(&m_VideoDecoderCtx);
+
+    // Increase log level until the first frame is decoded
+    av_log_set_level(AV_LOG_DEBUG);
+
+    if (!openDecoderContext(decoder, &m_DecoderParams) || !startDecoderThreads()) {
+        return false;
+    }
+
+    // If this context fails too, the next reset will rebuild everything
+    m_DecoderContextRecreated = true;
+    return true;
+}
+
+void FFmpegVideoDecoder::reset()
+{
+    // Terminate the decoder thread before doing anything else.
+    // It might be touching things we're about to free.
+    stopDecoderThreads();
 
     m_FramesIn = m_FramesOut = 0;
     m_FrameInfoQueue.clear();
 
+    // The recorders may be holding references to decoder surfaces,
+    // so they must finish before the codec context is freed.
+    stopRecording();
+
+    // The decoder thread is gone, so the global stats are final. Report
+    // them while the codec context and renderers are still around.
+    if (!m_TestOnly && m_Session != nullptr && m_GlobalVideoStats.totalFrames != 0) {
+        m_Session->getSessionReport().addVideoDecoder(m_VideoDecoderCtx->codec->name,
+                                                      m_FrontendRenderer->getRendererName(),
+                                                      m_BackendRenderer->getRendererName(),
+                                                      isHardwareAccelerated(),
+                                                      m_GlobalVideoStats,
+                                                      m_DecoderPoolBytes,
+                                                      m_DecodedFrameBytes);
+    }
+
     delete m_Pacer;
     m_Pacer = nullptr;
 
@@ -302,10 +544,11 @@ void FFmpegVideoDecoder::reset()
     // However, it must be called before deleting the IFFmpegRenderer
     // since the codec context may be referencing objects that we
     // need to delete in the renderer destructor.
+    destroyDirectDecoder();
     avcodec_free_context(&m_VideoDecoderCtx);
 
-    if (!m_TestOnly) {
-        Session::get()->getOverlayManager().setOverlayRenderer(nullptr);
+    if (!m_TestOnly && m_Session != nullptr) {
+        m_Session->getOverlayManager().setOverlayRenderer(nullptr);
     }
 
     // If we have a separate frontend renderer, free that first
@@ -319,6 +562,11 @@ void FFmpegVideoDecoder::reset()
 
     if (!m_TestOnly) {
         logVideoStats(m_GlobalVideoStats, "Global video stats");
+        logBlockedModules(m_GlobalVideoStats);
+
+        if (m_MetricsSink && m_GlobalVideoStats.totalFrames != 0) {
+            m_MetricsSink->submitStats(m_GlobalVideoStats, true);
+        }
     }
     else {
         // Test-only decoders can't have any frames submitted
@@ -430,14 +678,27 @@ bool FFmpegVideoDecoder::createFrontendRenderer(PDECODER_PARAMETERS params, bool
         // The backend renderer cannot directly render to the display, so
         // we will create an SDL or DRM renderer to draw the frames.
 
-#if (defined(VULKAN_IS_SLOW) || defined(GL_IS_SLOW)) && defined(HAVE_DRM)
+#ifdef HAVE_DRM
+#if defined(VULKAN_IS_SLOW) || defined(GL_IS_SLOW)
         // Try DrmRenderer first if we have a slow GPU
-        m_FrontendRenderer = new DrmRenderer(AV_HWDEVICE_TYPE_NONE, m_BackendRenderer);
-        if (initializeRendererInternal(m_FrontendRenderer, params)) {
-            return true;
+        bool tryDrmFirst = true;
+#else
+        // If the backend can hand us DRM PRIME frames, we can scan them out on
+        // a KMS plane without touching the GPU at all. Prefer that when there's
+        // no compositor to go through anyway, or if the user asked for it.
+        const char* videoDriver = SDL_GetCurrentVideoDriver();
+        bool tryDrmFirst = m_BackendRenderer->canExportDrmPrime() &&
+                           (qgetenv("PREFER_DRM_SCANOUT") == "1" ||
+                            (videoDriver != nullptr && strcmp(videoDriver, "KMSDRM") == 0));
+#endif
+        if (tryDrmFirst) {
+            m_FrontendRenderer = new DrmRenderer(AV_HWDEVICE_TYPE_NONE, m_BackendRenderer);
+            if (initializeRendererInternal(m_FrontendRenderer, params)) {
+                return true;
+            }
+            delete m_FrontendRenderer;
+            m_FrontendRenderer = nullptr;
         }
-        delete m_FrontendRenderer;
-        m_FrontendRenderer = nullptr;
 #endif
 
 
@@ -461,6 +722,22 @@ bool FFmpegVideoDecoder::createFrontendRenderer(PDECODER_PARAMETERS params, bool
         }
         delete m_FrontendRenderer;
         m_FrontendRenderer = nullptr;
+#elif defined(HAVE_LIBPLACEBO_VULKAN) && defined(HAVE_CUDA)
+        // PlVkRenderer can import CUDA frames without reading them back to system
+        // memory, which SdlRenderer must do if it can't use CUDA-GL interop. We
+        // only prefer it when GL interop isn't available, unless PLVK_CUDA_INTEROP=1.
+        // PlVkRenderer rejects Vulkan devices that aren't our CUDA device.
+        if (m_BackendRenderer->getRendererType() == IFFmpegRenderer::RendererType::CUDA &&
+                qgetenv("PLVK_CUDA_INTEROP") != "0" &&
+                (qgetenv("PLVK_CUDA_INTEROP") == "1" ||
+                 !static_cast<CUDARenderer*>(m_BackendRenderer)->isGlInteropSupported())) {
+            m_FrontendRenderer = new PlVkRenderer(false, m_BackendRenderer);
+            if (initializeRendererInternal(m_FrontendRenderer, params)) {
+                return true;
+            }
+            delete m_FrontendRenderer;
+            m_FrontendRenderer = nullptr;
+        }
 #endif
 
         m_FrontendRenderer = new SdlRenderer();
@@ -472,29 +749,8 @@ bool FFmpegVideoDecoder::createFrontendRenderer(PDECODER_PARAMETERS params, bool
     return true;
 }
 
-bool FFmpegVideoDecoder::completeInitialization(const AVCodec* decoder, enum AVPixelFormat requiredFormat, PDECODER_PARAMETERS params, bool testFrame, bool useAlternateFrontend)
+bool FFmpegVideoDecoder::openDecoderContext(const AVCodec* decoder, PDECODER_PARAMETERS params)
 {
-    // In test-only mode, we should only see test frames
-    SDL_assert(!m_TestOnly || testFrame);
-
-    // Create the frontend renderer based on the capabilities of the backend renderer
-    if (!createFrontendRenderer(params, useAlternateFrontend)) {
-        return false;
-    }
-
-    m_RequiredPixelFormat = requiredFormat;
-    m_StreamFps = params->frameRate;
-    m_VideoFormat = params->videoFormat;
-
-    // Don't bother initializing Pacer if we're not actually going to render
-    if (!testFrame) {
-        m_Pacer = new Pacer(m_FrontendRenderer, &m_ActiveWndVideoStats);
-        if (!m_Pacer->initialize(params->window, params->frameRate,
-                                 params->enableFramePacing || (params->enableVsync && (m_FrontendRenderer->getRendererAttributes() & RENDERER_ATTRIBUTE_FORCE_PACING)))) {
-            return false;
-        }
-    }
-
     m_VideoDecoderCtx = avcodec_alloc_context3(decoder);
     if (!m_VideoDecoderCtx) {
         SDL_LogError(SDL_LOG_CATEGORY_APPLICATION,
@@ -518,10 +774,11 @@ bool FFmpegVideoDecoder::completeInitialization(const AVCodec* decoder, enum AVP
     // runs out of output buffers.
     m_VideoDecoderCtx->err_recognition = AV_EF_EXPLODE;
 
-    // Enable slice multi-threading for software decoding
+    AVDictionary* options = nullptr;
+
+    // Enable multi-threading for software decoding
     if (!isHardwareAccelerated()) {
-        m_VideoDecoderCtx->thread_type = FF_THREAD_SLICE;
-        m_VideoDecoderCtx->thread_count = qMin(MAX_SLICES, SDL_GetCPUCount());
+        SoftwareDecodeProfile::prepareDecoderContext(m_VideoDecoderCtx, params, getSoftwareDecodeSlices(), &options);
     }
     else {
         // No threading for HW decode
@@ -542,12 +799,10 @@ bool FFmpegVideoDecoder::completeInitialization(const AVCodec* decoder, enum AVP
     // FFmpeg 7.0-8.0 to incorrectly believe ff_get_format() was called.
     // See #1511.
     if (m_HwDecodeCfg == nullptr) {
-        m_VideoDecoderCtx->pix_fmt = (requiredFormat != AV_PIX_FMT_NONE) ?
-            requiredFormat : m_FrontendRenderer->getPreferredPixelFormat(params->videoFormat);
+        m_VideoDecoderCtx->pix_fmt = (m_RequiredPixelFormat != AV_PIX_FMT_NONE) ?
+            m_RequiredPixelFormat : m_FrontendRenderer->getPreferredPixelFormat(params->videoFormat);
     }
 
-    AVDictionary* options = nullptr;
-
     // Allow the backend renderer to attach data to this decoder
     if (!m_BackendRenderer->prepareDecoderContext(m_VideoDecoderCtx, &options)) {
         return false;
@@ -560,8 +815,16 @@ bool FFmpegVideoDecoder::completeInitialization(const AVCodec* decoder, enum AVP
     SDL_assert(m_VideoDecoderCtx->opaque == nullptr);
     m_VideoDecoderCtx->opaque = this;
 
+    // FFmpeg's decoder threads are created here and inherit our affinity
+    CPU_AFFINITY previousAffinity;
+    bool pinned = !isHardwareAccelerated() && SoftwareDecodeProfile::pinThreadToPerformanceCores(&previousAffinity);
+
     int err = avcodec_open2(m_VideoDecoderCtx, decoder, &options);
     av_dict_free(&options);
+
+    if (pinned) {
+        SoftwareDecodeProfile::restoreThreadAffinity(&previousAffinity);
+    }
     if (err < 0) {
         SDL_LogError(SDL_LOG_CATEGORY_APPLICATION,
                      "Unable to open decoder for format: %x",
@@ -569,59 +832,66 @@ bool FFmpegVideoDecoder::completeInitialization(const AVCodec* decoder, enum AVP
         return false;
     }
 
+#ifdef Q_OS_DARWIN
+    // Streamed frames can bypass FFmpeg's hwaccel for our own VTDecompressionSession.
+    // The codec context is still used for the test frame and as a fallback.
+    if (!m_TestOnly && m_HwDecodeCfg != nullptr && m_HwDecodeCfg->device_type == AV_HWDEVICE_TYPE_VIDEOTOOLBOX &&
+            m_VideoDecoderCtx->hw_device_ctx != nullptr && qEnvironmentVariableIntValue("VT_DIRECT_DECODE") != 0) {
+        SDL_assert(m_DirectDecoder == nullptr);
+        m_DirectDecoder = VTDirectDecoderFactory::createDecoder(params, m_VideoDecoderCtx->hw_device_ctx,
+                                                                m_BackendRenderer->getDecoderColorspace(),
+                                                                m_BackendRenderer->getDecoderColorRange() == COLOR_RANGE_FULL);
+    }
+#endif
+
+    return true;
+}
+
+bool FFmpegVideoDecoder::completeInitialization(const AVCodec* decoder, enum AVPixelFormat requiredFormat, PDECODER_PARAMETERS params, bool testFrame, bool useAlternateFrontend)
+{
+    // In test-only mode, we should only see test frames
+    SDL_assert(!m_TestOnly || testFrame);
+
+    // Create the frontend renderer based on the capabilities of the backend renderer
+    if (!createFrontendRenderer(params, useAlternateFrontend)) {
+        return false;
+    }
+
+    m_RequiredPixelFormat = requiredFormat;
+    m_StreamFps = params->frameRate;
+    m_VideoFormat = params->videoFormat;
+
+    // Don't bother initializing Pacer if we're not actually going to render
+    if (!testFrame) {
+        m_Pacer = new Pacer(m_FrontendRenderer, m_Session, &m_ActiveWndVideoStats, m_FrameTracer, &m_FramePool);
+        if (!m_Pacer->initialize(params->window, params->frameRate,
+                                 params->enableFramePacing || (params->enableVsync && (m_FrontendRenderer->getRendererAttributes() & RENDERER_ATTRIBUTE_FORCE_PACING)))) {
+            return false;
+        }
+    }
+
+    if (!openDecoderContext(decoder, params)) {
+        return false;
+    }
+
     // FFMpeg doesn't completely initialize the codec until the codec
     // config data comes in. This would be too late for us to change
     // our minds on the selected video codec, so we'll do a trial run
     // now to see if things will actually work when the video stream
     // comes in.
-    if (testFrame) {
-        switch (params->videoFormat) {
-        case VIDEO_FORMAT_H264:
-            m_Pkt->data = (uint8_t*)k_H264TestFrame;
-            m_Pkt->size = sizeof(k_H264TestFrame);
-            break;
-        case VIDEO_FORMAT_H265:
-            m_Pkt->data = (uint8_t*)k_HEVCMainTestFrame;
-            m_Pkt->size = sizeof(k_HEVCMainTestFrame);
-            break;
-        case VIDEO_FORMAT_H265_MAIN10:
-            m_Pkt->data = (uint8_t*)k_HEVCMain10TestFrame;
-            m_Pkt->size = sizeof(k_HEVCMain10TestFrame);
-            break;
-        case VIDEO_FORMAT_AV1_MAIN8:
-            m_Pkt->data = (uint8_t*)k_AV1Main8TestFrame;
-            m_Pkt->size = sizeof(k_AV1Main8TestFrame);
-            break;
-        case VIDEO_FORMAT_AV1_MAIN10:
-            m_Pkt->data = (uint8_t*)k_AV1Main10TestFrame;
-            m_Pkt->size = sizeof(k_AV1Main10TestFrame);
-            break;
-        case VIDEO_FORMAT_H264_HIGH8_444:
-            m_Pkt->data = (uint8_t*)k_h264High_444TestFrame;
-            m_Pkt->size = sizeof(k_h264High_444TestFrame);
-            break;
-        case VIDEO_FORMAT_H265_REXT8_444:
-            m_Pkt->data = (uint8_t*)k_HEVCRExt8_444TestFrame;
-            m_Pkt->size = sizeof(k_HEVCRExt8_444TestFrame);
-            break;
-        case VIDEO_FORMAT_H265_REXT10_444:
-            m_Pkt->data = (uint8_t*)k_HEVCRExt10_444TestFrame;
-            m_Pkt->size = sizeof(k_HEVCRExt10_444TestFrame);
-            break;
-        case VIDEO_FORMAT_AV1_HIGH8_444:
-            m_Pkt->data = (uint8_t*)k_AV1High8_444TestFrame;
-            m_Pkt->size = sizeof(k_AV1High8_444TestFrame);
-            break;
-        case VIDEO_FORMAT_AV1_HIGH10_444:
-            m_Pkt->data = (uint8_t*)k_AV1High10_444TestFrame;
-            m_Pkt->size = sizeof(k_AV1High10_444TestFrame);
-            break;
-        default:
+    if (testFrame && m_SkipTestFrame) {
+        SDL_LogInfo(SDL_LOG_CATEGORY_APPLICATION,
+                    "Skipping test decode due to cached probe result");
+    }
+    else if (testFrame) {
+        const uint8_t* testFrameData;
+        if (!getTestFrame(params->videoFormat, &testFrameData, &m_Pkt->size)) {
             SDL_LogError(SDL_LOG_CATEGORY_APPLICATION,
                          "No test frame for format: %x",
                          params->videoFormat);
             return false;
         }
+        m_Pkt->data = (uint8_t*)testFrameData;
 
         AVFrame* frame = av_frame_alloc();
         if (!frame) {
@@ -632,7 +902,9 @@ bool FFmpegVideoDecoder::completeInitialization(const AVCodec* decoder, enum AVP
 
         // Some decoders won't output on the first frame, so we'll submit
         // a few test frames if we get an EAGAIN error.
-        for (int retries = 0; retries < 5; retries++) {
+        int err = 0;
+        int retries;
+        for (retries = 0; retries < 5; retries++) {
             // Most FFmpeg decoders process input using a "push" model.
             // We'll see those fail here if the format is not supported.
             err = avcodec_send_packet(m_VideoDecoderCtx, m_Pkt);
@@ -667,6 +939,26 @@ bool FFmpegVideoDecoder::completeInitialization(const AVCodec* decoder, enum AVP
             return false;
         }
 
+        // Time a second decode of the test frame so software decoders can be tuned
+        // for the stream. The first one includes decoder warm-up, and retries include
+        // our own delays, so neither is a useful measurement.
+        if (retries == 0 && !isHardwareAccelerated()) {
+            AVFrame* warmFrame = av_frame_alloc();
+            if (warmFrame != nullptr) {
+                uint64_t decodeStartUs = LiGetMicroseconds();
+                if (avcodec_send_packet(m_VideoDecoderCtx, m_Pkt) == 0 &&
+                        avcodec_receive_frame(m_VideoDecoderCtx, warmFrame) == 0) {
+                    SoftwareDecodeProfile::recordTestDecode(decoder, params->width, params->height,
+                                                            LiGetMicroseconds() - decodeStartUs);
+                }
+                else {
+                    // Don't leave the repeated frame queued up ahead of the stream
+                    avcodec_flush_buffers(m_VideoDecoderCtx);
+                }
+                av_frame_free(&warmFrame);
+            }
+        }
+
         // Allow the renderer to do any validation it wants on this frame
         if (!m_FrontendRenderer->testRenderFrame(frame)) {
             SDL_LogWarn(SDL_LOG_CATEGORY_APPLICATION,
@@ -675,11 +967,16 @@ bool FFmpegVideoDecoder::completeInitialization(const AVCodec* decoder, enum AVP
             return false;
         }
 
+        if (m_RunRendererTrial) {
+            m_RendererTrialUs = measureRendererTrial(frame);
+        }
+
         av_frame_free(&frame);
     }
     else {
         if ((params->videoFormat & VIDEO_FORMAT_MASK_H264) &&
-                !(m_BackendRenderer->getDecoderCapabilities() & CAPABILITY_REFERENCE_FRAME_INVALIDATION_AVC)) {
+                !(m_BackendRenderer->getDecoderCapabilities() & CAPABILITY_REFERENCE_FRAME_INVALIDATION_AVC) &&
+                (isHardwareAccelerated() || !isSoftwareAvcRfiEnabled())) {
             SDL_LogInfo(SDL_LOG_CATEGORY_APPLICATION,
                         "Using H.264 SPS fixup");
             m_NeedsSpsFixup = true;
@@ -689,17 +986,19 @@ bool FFmpegVideoDecoder::completeInitialization(const AVCodec* decoder, enum AVP
         }
 
         // Tell overlay manager to use this frontend renderer
-        Session::get()->getOverlayManager().setOverlayRenderer(m_FrontendRenderer);
+        if (m_Session != nullptr) {
+            m_Session->getOverlayManager().setOverlayRenderer(m_FrontendRenderer);
+        }
 
         // Allow the renderer to perform final preparations for rendering
         m_FrontendRenderer->prepareToRender();
 
+        // Kept for reinitializeDecoder()
+        m_DecoderParams = *params;
+
         // Only create the decoder thread when instantiating the decoder for real. It will use APIs from
         // moonlight-common-c that can only be legally called with an established connection.
-        m_DecoderThread = SDL_CreateThread(FFmpegVideoDecoder::decoderThreadProcThunk, "FFDecoder", (void*)this);
-        if (m_DecoderThread == nullptr) {
-            SDL_LogError(SDL_LOG_CATEGORY_APPLICATION,
-                         "Failed to create decoder thread: %s", SDL_GetError());
+        if (!startDecoderThreads()) {
             return false;
         }
 
@@ -719,6 +1018,91 @@ bool FFmpegVideoDecoder::completeInitialization(const AVCodec* decoder, enum AVP
     return true;
 }
 
+uint64_t FFmpegVideoDecoder::getDisplayLatencyUs(VIDEO_STATS& stats)
+{
+    if (stats.receivedFrames == 0 || stats.decodedFrames == 0 || stats.renderedFrames == 0) {
+        return 0;
+    }
+
+    // Sum the average time spent in each stage from packet arrival to the display
+    uint64_t latencyUs = stats.totalReassemblyTimeUs / stats.receivedFrames +
+                         stats.totalDecodeTimeUs / stats.decodedFrames +
+                         (stats.totalPacerTimeUs + stats.totalRenderTimeUs) / stats.renderedFrames;
+    if (stats.framesWithPresentLatency != 0) {
+        latencyUs += stats.totalPresentLatencyUs / stats.framesWithPresentLatency;
+    }
+
+    // The host only reports capture and encode time for video. Audio encoding
+    // is much cheaper, so we treat it as negligible.
+    if (stats.framesWithHostProcessingLatency != 0) {
+        latencyUs += (uint64_t)stats.totalHostProcessingLatency * 100 / stats.framesWithHostProcessingLatency;
+    }
+
+    return latencyUs;
+}
+
+void FFmpegVideoDecoder::checkClickToPhoton(AVFrame* frame)
+{
+    if (m_TestOnly || m_Session == nullptr || !m_Session->getInputLatencyMonitor().isClickToPhotonEnabled()) {
+        return;
+    }
+
+    InputLatencyMonitor& monitor = m_Session->getInputLatencyMonitor();
+
+    // We can only look at the reference pixel in frames that are in system memory
+    const AVPixFmtDescriptor* desc = av_pix_fmt_desc_get((enum AVPixelFormat)frame->format);
+    if (desc == nullptr || (desc->flags & (AV_PIX_FMT_FLAG_HWACCEL | AV_PIX_FMT_FLAG_RGB))) {
+        if (!m_ClickToPhotonUnsupported) {
+            SDL_LogWarn(SDL_LOG_CATEGORY_APPLICATION,
+                        "Click-to-photon measurement needs frames in system memory. Try software decoding.");
+            m_ClickToPhotonUnsupported = true;
+        }
+        return;
+    }
+
+    int x, y;
+    monitor.getClickToPhotonPixel(frame->width, frame->height, &x, &y);
+
+    const AVComponentDescriptor& comp = desc->comp[0];
+    const uint8_t* pixel = frame->data[comp.plane] + y * frame->linesize[comp.plane] + x * comp.step + comp.offset;
+    int luma = comp.depth > 8 ? (*(const uint16_t*)pixel >> comp.shift) >> (comp.depth - 8) : *pixel;
+
+    uint32_t clickAgeUs = monitor.getPendingClickAge();
+    if (clickAgeUs == 0 || m_ClickToPhotonLuma < 0) {
+        // Follow the reference pixel until there's a click to time
+        m_ClickToPhotonLuma = luma;
+        return;
+    }
+
+    if (SDL_abs(luma - m_ClickToPhotonLuma) >= CLICK_TO_PHOTON_LUMA_THRESHOLD) {
+        uint32_t clickToDecodeUs = monitor.takePendingClick();
+
+        // We can't see photons, so add the average time it takes
+        // a decoded frame to get to the display.
+        uint64_t displayUs = 0;
+        if (m_LastWndVideoStats.renderedFrames != 0) {
+            displayUs += (m_LastWndVideoStats.totalPacerTimeUs + m_LastWndVideoStats.totalRenderTimeUs) / m_LastWndVideoStats.renderedFrames;
+        }
+        if (m_LastWndVideoStats.framesWithPresentLatency != 0) {
+            displayUs += m_LastWndVideoStats.totalPresentLatencyUs / m_LastWndVideoStats.framesWithPresentLatency;
+        }
+
+        SDL_LogInfo(SDL_LOG_CATEGORY_APPLICATION,
+                    "Click-to-photon: %.1f ms (%.1f ms until decoded, %.1f ms to display)",
+                    (clickToDecodeUs + displayUs) / 1000.0,
+                    clickToDecodeUs / 1000.0,
+                    displayUs / 1000.0);
+
+        m_ClickToPhotonLuma = luma;
+    }
+    else if (clickAgeUs > CLICK_TO_PHOTON_TIMEOUT_US) {
+        monitor.takePendingClick();
+        SDL_LogWarn(SDL_LOG_CATEGORY_APPLICATION,
+                    "Click-to-photon: reference pixel (%d, %d) didn't change after a click",
+                    x, y);
+    }
+}
+
 void FFmpegVideoDecoder::addVideoStats(VIDEO_STATS& src, VIDEO_STATS& dst)
 {
     dst.receivedFrames += src.receivedFrames;
@@ -727,10 +1111,71 @@ void FFmpegVideoDecoder::addVideoStats(VIDEO_STATS& src, VIDEO_STATS& dst)
     dst.totalFrames += src.totalFrames;
     dst.networkDroppedFrames += src.networkDroppedFrames;
     dst.pacerDroppedFrames += src.pacerDroppedFrames;
+    dst.recorderDroppedFrames += src.recorderDroppedFrames;
+    dst.framePoolHits += src.framePoolHits;
+    dst.framePoolMisses += src.framePoolMisses;
+    dst.totalDecoderQueueDepth += src.totalDecoderQueueDepth;
+    dst.maxDecoderQueueDepth = qMax(dst.maxDecoderQueueDepth, src.maxDecoderQueueDepth);
+    dst.decoderQueueDepthSamples += src.decoderQueueDepthSamples;
+    dst.totalDecodeUnitQueueDepth += src.totalDecodeUnitQueueDepth;
+    dst.maxDecodeUnitQueueDepth = qMax(dst.maxDecodeUnitQueueDepth, src.maxDecodeUnitQueueDepth);
+    dst.totalDecodeUnitQueueAgeUs += src.totalDecodeUnitQueueAgeUs;
+    dst.maxDecodeUnitQueueAgeUs = qMax(dst.maxDecodeUnitQueueAgeUs, src.maxDecodeUnitQueueAgeUs);
+    dst.decodeUnitQueueSamples += src.decodeUnitQueueSamples;
+    dst.decodeBacklogTrims += src.decodeBacklogTrims;
+    dst.decodeBacklogTrimmedFrames += src.decodeBacklogTrimmedFrames;
+    dst.totalPresentQueueDepth += src.totalPresentQueueDepth;
+    dst.maxPresentQueueDepth = qMax(dst.maxPresentQueueDepth, src.maxPresentQueueDepth);
+    dst.presentQueueDepthSamples += src.presentQueueDepthSamples;
+    dst.directScanoutFrames += src.directScanoutFrames;
+    dst.scanoutSamples += src.scanoutSamples;
+    dst.maxPacerQueuedFrames = qMax(dst.maxPacerQueuedFrames, src.maxPacerQueuedFrames);
+    dst.pacerVsyncDrops += src.pacerVsyncDrops;
+    dst.pacerRenderDrops += src.pacerRenderDrops;
+    dst.pacerOverflowDrops += src.pacerOverflowDrops;
+    for (int i = 0; i < PACER_QUEUE_DEPTH_BUCKETS; i++) {
+        dst.pacingQueueDepths[i] += src.pacingQueueDepths[i];
+        dst.renderQueueDepths[i] += src.renderQueueDepths[i];
+    }
+    dst.totalVsyncWaitTimeUs += src.totalVsyncWaitTimeUs;
+    dst.vsyncWaitFrames += src.vsyncWaitFrames;
+    dst.copiedFrames += src.copiedFrames;
+    dst.textureCacheMisses += src.textureCacheMisses;
+    dst.idrFrames += src.idrFrames;
+    dst.totalIdrBytes += src.totalIdrBytes;
+    dst.maxIdrBytes = qMax(dst.maxIdrBytes, src.maxIdrBytes);
+    dst.lossRecoveries += src.lossRecoveries;
+    dst.idrLossRecoveries += src.idrLossRecoveries;
+    dst.totalLossRecoveryTimeUs += src.totalLossRecoveryTimeUs;
+    dst.maxLossRecoveryTimeUs = qMax(dst.maxLossRecoveryTimeUs, src.maxLossRecoveryTimeUs);
     dst.totalReassemblyTimeUs += src.totalReassemblyTimeUs;
     dst.totalDecodeTimeUs += src.totalDecodeTimeUs;
     dst.totalPacerTimeUs += src.totalPacerTimeUs;
     dst.totalRenderTimeUs += src.totalRenderTimeUs;
+    dst.totalEndToEndLatencyUs += src.totalEndToEndLatencyUs;
+    dst.maxEndToEndLatencyUs = qMax(dst.maxEndToEndLatencyUs, src.maxEndToEndLatencyUs);
+    dst.framesWithEndToEndLatency += src.framesWithEndToEndLatency;
+    dst.totalPresentLatencyUs += src.totalPresentLatencyUs;
+    dst.framesWithPresentLatency += src.framesWithPresentLatency;
+    dst.totalGpuRenderTimeUs += src.totalGpuRenderTimeUs;
+    dst.framesWithGpuRenderTime += src.framesWithGpuRenderTime;
+    dst.totalGpuScaleTimeUs += src.totalGpuScaleTimeUs;
+    dst.decoderThreadCpuTimeUs += src.decoderThreadCpuTimeUs;
+    dst.renderThreadCpuTimeUs += src.renderThreadCpuTimeUs;
+    dst.totalGpuUploadTimeUs += src.totalGpuUploadTimeUs;
+    dst.totalReadbackTimeUs += src.totalReadbackTimeUs;
+    dst.readbackFrames += src.readbackFrames;
+    dst.inputEvents += src.inputEvents;
+    dst.totalInputLatencyUs += src.totalInputLatencyUs;
+    dst.maxInputLatencyUs = qMax(dst.maxInputLatencyUs, src.maxInputLatencyUs);
+    dst.qualityFrames += src.qualityFrames;
+    dst.totalPsnrDb += src.totalPsnrDb;
+    dst.totalSsim += src.totalSsim;
+
+    latencyHistogramMerge(src.reassemblyTimeHistogram, dst.reassemblyTimeHistogram);
+    latencyHistogramMerge(src.decodeTimeHistogram, dst.decodeTimeHistogram);
+    latencyHistogramMerge(src.pacerTimeHistogram, dst.pacerTimeHistogram);
+    latencyHistogramMerge(src.renderTimeHistogram, dst.renderTimeHistogram);
 
     if (dst.minHostProcessingLatency == 0) {
         dst.minHostProcessingLatency = src.minHostProcessingLatency;
@@ -752,6 +1197,19 @@ void FFmpegVideoDecoder::addVideoStats(VIDEO_STATS& src, VIDEO_STATS& dst)
         SDL_assert(dst.lastRtt > 0);
     }
 
+    if (m_Session == nullptr ||
+            !m_Session->getAudioLatency(&dst.audioLatencyMs, &dst.audioTargetLatencyMs)) {
+        dst.audioLatencyMs = 0;
+        dst.audioTargetLatencyMs = 0;
+    }
+
+    dst.avOffsetValid = m_Session != nullptr &&
+            m_Session->getAvSyncMonitor().getOffset(&dst.avOffsetMs, &dst.audioDelayMs);
+
+    if (m_Session != nullptr) {
+        m_Session->getAudioConcealmentStats(&dst.audioConcealedFrames, &dst.audioFecFrames);
+    }
+
     // Initialize the measurement start point if this is the first video stat window
     if (!dst.measurementStartUs) {
         dst.measurementStartUs = src.measurementStartUs;
@@ -877,6 +1335,22 @@ void FFmpegVideoDecoder::stringifyVideoStats(VIDEO_STATS& stats, char* output, i
             offset += ret;
         }
 
+        double decryptionMbps = m_Session != nullptr ? m_Session->getVideoDecryptionThroughputMbps() : 0;
+        if (decryptionMbps > 0) {
+            // Estimated from the benchmarked throughput, since decryption
+            // happens inside moonlight-common-c
+            ret = snprintf(&output[offset],
+                           length - offset,
+                           "Video decryption: ~%.1f%% of a CPU core\n",
+                           m_BwTracker.GetAverageMbps() * 100.0 / decryptionMbps);
+            if (ret < 0 || ret >= length - offset) {
+                SDL_assert(false);
+                return;
+            }
+
+            offset += ret;
+        }
+
         ret = snprintf(&output[offset],
                        length - offset,
                        "Incoming frame rate from network: %.2f FPS\n"
@@ -908,8 +1382,24 @@ void FFmpegVideoDecoder::stringifyVideoStats(VIDEO_STATS& stats, char* output, i
         offset += ret;
     }
 
-    if (stats.renderedFrames != 0) {
-        char rttString[32];
+    if (stats.framesWithEndToEndLatency > 0) {
+        // Only accurate to within half the RTT, since we can't know how
+        // the RTT splits between the two directions
+        ret = snprintf(&output[offset],
+                       length - offset,
+                       "Capture to present latency average/max: %.1f/%.1f ms (estimated)\n",
+                       (double)(stats.totalEndToEndLatencyUs / 1000.0) / stats.framesWithEndToEndLatency,
+                       stats.maxEndToEndLatencyUs / 1000.0);
+        if (ret < 0 || ret >= length - offset) {
+            SDL_assert(false);
+            return;
+        }
+
+        offset += ret;
+    }
+
+    if (stats.renderedFrames != 0) {
+        char rttString[32];
 
         if (stats.lastRtt != 0) {
             snprintf(rttString, sizeof(rttString), "%u ms (variance: %u ms)", stats.lastRtt, stats.lastRttVariance);
@@ -938,19 +1428,550 @@ void FFmpegVideoDecoder::stringifyVideoStats(VIDEO_STATS& stats, char* output, i
         }
 
         offset += ret;
+
+        // Drops at V-sync or with a deep pacing queue point at pacing policy,
+        // while drops after rendering or a deep render queue mean a slow renderer.
+        ret = snprintf(&output[offset],
+                       length - offset,
+                       "Pacer drops: %u at V-sync, %u after rendering, %u queue overflows\n",
+                       stats.pacerVsyncDrops,
+                       stats.pacerRenderDrops,
+                       stats.pacerOverflowDrops);
+        if (ret < 0 || ret >= length - offset) {
+            SDL_assert(false);
+            return;
+        }
+
+        offset += ret;
+
+        const struct {
+            const char* name;
+            const uint32_t* depths;
+        } queues[] = {
+            { "Pacing", stats.pacingQueueDepths },
+            { "Render", stats.renderQueueDepths },
+        };
+        for (const auto& queue : queues) {
+            uint32_t samples = 0;
+            for (int i = 0; i < PACER_QUEUE_DEPTH_BUCKETS; i++) {
+                samples += queue.depths[i];
+            }
+            if (samples == 0) {
+                continue;
+            }
+
+            ret = snprintf(&output[offset],
+                           length - offset,
+                           "%s queue depth (0/1/2/3+): %.0f%%/%.0f%%/%.0f%%/%.0f%%\n",
+                           queue.name,
+                           queue.depths[0] * 100.0 / samples,
+                           queue.depths[1] * 100.0 / samples,
+                           queue.depths[2] * 100.0 / samples,
+                           queue.depths[3] * 100.0 / samples);
+            if (ret < 0 || ret >= length - offset) {
+                SDL_assert(false);
+                return;
+            }
+
+            offset += ret;
+        }
+
+        if (stats.vsyncWaitFrames != 0) {
+            ret = snprintf(&output[offset],
+                           length - offset,
+                           "Average V-sync wait: %.2f ms\n",
+                           (double)(stats.totalVsyncWaitTimeUs / 1000.0) / stats.vsyncWaitFrames);
+            if (ret < 0 || ret >= length - offset) {
+                SDL_assert(false);
+                return;
+            }
+
+            offset += ret;
+        }
+    }
+
+    if (stats.audioLatencyMs != 0) {
+        ret = snprintf(&output[offset],
+                       length - offset,
+                       "Audio latency: %u ms (target: %u ms)\n",
+                       stats.audioLatencyMs,
+                       stats.audioTargetLatencyMs);
+        if (ret < 0 || ret >= length - offset) {
+            SDL_assert(false);
+            return;
+        }
+
+        offset += ret;
+    }
+
+    if (stats.audioConcealedFrames != 0) {
+        ret = snprintf(&output[offset],
+                       length - offset,
+                       "Lost audio frames concealed: %u (%u using FEC)\n",
+                       stats.audioConcealedFrames,
+                       stats.audioFecFrames);
+        if (ret < 0 || ret >= length - offset) {
+            SDL_assert(false);
+            return;
+        }
+
+        offset += ret;
+    }
+
+    if (stats.avOffsetValid) {
+        ret = snprintf(&output[offset],
+                       length - offset,
+                       "A/V offset: %+d ms (audio delay: %u ms)\n",
+                       stats.avOffsetMs,
+                       stats.audioDelayMs);
+        if (ret < 0 || ret >= length - offset) {
+            SDL_assert(false);
+            return;
+        }
+
+        offset += ret;
+    }
+
+    if (stats.inputEvents != 0) {
+        ret = snprintf(&output[offset],
+                       length - offset,
+                       "Input latency (OS to host send): %.2f ms average, %.2f ms max\n",
+                       (double)(stats.totalInputLatencyUs / 1000.0) / stats.inputEvents,
+                       stats.maxInputLatencyUs / 1000.0);
+        if (ret < 0 || ret >= length - offset) {
+            SDL_assert(false);
+            return;
+        }
+
+        offset += ret;
+    }
+
+    if (stats.framesWithPresentLatency != 0) {
+        ret = snprintf(&output[offset],
+                       length - offset,
+                       "Average present latency (rendering to display): %.2f ms\n",
+                       (double)(stats.totalPresentLatencyUs / 1000.0) / stats.framesWithPresentLatency);
+        if (ret < 0 || ret >= length - offset) {
+            SDL_assert(false);
+            return;
+        }
+
+        offset += ret;
+    }
+
+    if (stats.readbackFrames != 0) {
+        ret = snprintf(&output[offset],
+                       length - offset,
+                       "Average hardware frame readback time: %.2f ms\n",
+                       (double)(stats.totalReadbackTimeUs / 1000.0) / stats.readbackFrames);
+        if (ret < 0 || ret >= length - offset) {
+            SDL_assert(false);
+            return;
+        }
+
+        offset += ret;
+    }
+
+    if (stats.framesWithGpuRenderTime != 0) {
+        ret = snprintf(&output[offset],
+                       length - offset,
+                       "Average GPU time: %.2f ms rendering, %.2f ms uploading\n",
+                       (double)(stats.totalGpuRenderTimeUs / 1000.0) / stats.framesWithGpuRenderTime,
+                       (double)(stats.totalGpuUploadTimeUs / 1000.0) / stats.framesWithGpuRenderTime);
+        if (ret < 0 || ret >= length - offset) {
+            SDL_assert(false);
+            return;
+        }
+
+        offset += ret;
+    }
+
+    if (stats.totalGpuScaleTimeUs != 0) {
+        ret = snprintf(&output[offset],
+                       length - offset,
+                       "Average GPU upscaling time: %.2f ms\n",
+                       (double)(stats.totalGpuScaleTimeUs / 1000.0) / stats.framesWithGpuRenderTime);
+        if (ret < 0 || ret >= length - offset) {
+            SDL_assert(false);
+            return;
+        }
+
+        offset += ret;
+    }
+
+    if (stats.decodedFrames != 0 && stats.renderedFrames != 0) {
+        ret = snprintf(&output[offset],
+                       length - offset,
+                       "Thread CPU time per frame: %.2f ms decoder, %.2f ms renderer\n",
+                       (double)(stats.decoderThreadCpuTimeUs / 1000.0) / stats.decodedFrames,
+                       (double)(stats.renderThreadCpuTimeUs / 1000.0) / stats.renderedFrames);
+        if (ret < 0 || ret >= length - offset) {
+            SDL_assert(false);
+            return;
+        }
+
+        offset += ret;
+    }
+
+    if (stats.renderedFrames != 0) {
+        ret = snprintf(&output[offset],
+                       length - offset,
+                       "Network reassembly time p50/p95/p99: %.2f/%.2f/%.2f ms\n"
+                       "Decoding time p50/p95/p99: %.2f/%.2f/%.2f ms\n"
+                       "Frame queue delay p50/p95/p99: %.2f/%.2f/%.2f ms\n"
+                       "Rendering time p50/p95/p99: %.2f/%.2f/%.2f ms\n",
+                       latencyHistogramPercentile(stats.reassemblyTimeHistogram, 50) / 1000.0,
+                       latencyHistogramPercentile(stats.reassemblyTimeHistogram, 95) / 1000.0,
+                       latencyHistogramPercentile(stats.reassemblyTimeHistogram, 99) / 1000.0,
+                       latencyHistogramPercentile(stats.decodeTimeHistogram, 50) / 1000.0,
+                       latencyHistogramPercentile(stats.decodeTimeHistogram, 95) / 1000.0,
+                       latencyHistogramPercentile(stats.decodeTimeHistogram, 99) / 1000.0,
+                       latencyHistogramPercentile(stats.pacerTimeHistogram, 50) / 1000.0,
+                       latencyHistogramPercentile(stats.pacerTimeHistogram, 95) / 1000.0,
+                       latencyHistogramPercentile(stats.pacerTimeHistogram, 99) / 1000.0,
+                       latencyHistogramPercentile(stats.renderTimeHistogram, 50) / 1000.0,
+                       latencyHistogramPercentile(stats.renderTimeHistogram, 95) / 1000.0,
+                       latencyHistogramPercentile(stats.renderTimeHistogram, 99) / 1000.0);
+        if (ret < 0 || ret >= length - offset) {
+            SDL_assert(false);
+            return;
+        }
+
+        offset += ret;
+    }
+
+    if (stats.decoderQueueDepthSamples != 0) {
+        ret = snprintf(&output[offset],
+                       length - offset,
+                       "Decoder queue depth average/max: %.1f/%u frames\n",
+                       (float)stats.totalDecoderQueueDepth / stats.decoderQueueDepthSamples,
+                       stats.maxDecoderQueueDepth);
+        if (ret < 0 || ret >= length - offset) {
+            SDL_assert(false);
+            return;
+        }
+
+        offset += ret;
+    }
+
+    if (stats.decodeUnitQueueSamples != 0) {
+        ret = snprintf(&output[offset],
+                       length - offset,
+                       "Decode unit queue depth average/max: %.1f/%u frames (waited %.2f/%.2f ms)\n",
+                       (float)stats.totalDecodeUnitQueueDepth / stats.decodeUnitQueueSamples,
+                       stats.maxDecodeUnitQueueDepth,
+                       (double)stats.totalDecodeUnitQueueAgeUs / stats.decodeUnitQueueSamples / 1000.0,
+                       stats.maxDecodeUnitQueueAgeUs / 1000.0);
+        if (ret < 0 || ret >= length - offset) {
+            SDL_assert(false);
+            return;
+        }
+
+        offset += ret;
+    }
+
+    if (stats.decodeBacklogTrims != 0) {
+        ret = snprintf(&output[offset],
+                       length - offset,
+                       "Decode backlog skipped: %u times (%u frames)\n",
+                       stats.decodeBacklogTrims,
+                       stats.decodeBacklogTrimmedFrames);
+        if (ret < 0 || ret >= length - offset) {
+            SDL_assert(false);
+            return;
+        }
+
+        offset += ret;
+    }
+
+    if (stats.presentQueueDepthSamples != 0) {
+        ret = snprintf(&output[offset],
+                       length - offset,
+                       "Present queue depth average/max: %.1f/%u frames\n",
+                       (float)stats.totalPresentQueueDepth / stats.presentQueueDepthSamples,
+                       stats.maxPresentQueueDepth);
+        if (ret < 0 || ret >= length - offset) {
+            SDL_assert(false);
+            return;
+        }
+
+        offset += ret;
+    }
+
+    if (stats.scanoutSamples != 0) {
+        ret = snprintf(&output[offset],
+                       length - offset,
+                       "Direct scanout: %.1f%% of frames\n",
+                       (float)stats.directScanoutFrames * 100 / stats.scanoutSamples);
+        if (ret < 0 || ret >= length - offset) {
+            SDL_assert(false);
+            return;
+        }
+
+        offset += ret;
+    }
+    else if (m_Session != nullptr && m_Session->isCompositorBypassRequested()) {
+        // We asked for it but the renderer can't tell us if we got it
+        ret = snprintf(&output[offset],
+                       length - offset,
+                       "Direct scanout: requested\n");
+        if (ret < 0 || ret >= length - offset) {
+            SDL_assert(false);
+            return;
+        }
+
+        offset += ret;
+    }
+
+    if (stats.copiedFrames != 0) {
+        ret = snprintf(&output[offset],
+                       length - offset,
+                       "Frames copied from decoder before rendering: %u/%u\n",
+                       stats.copiedFrames,
+                       stats.renderedFrames);
+        if (ret < 0 || ret >= length - offset) {
+            SDL_assert(false);
+            return;
+        }
+
+        offset += ret;
+    }
+
+    if (stats.textureCacheMisses != 0) {
+        ret = snprintf(&output[offset],
+                       length - offset,
+                       "Texture cache misses: %u/%u frames\n",
+                       stats.textureCacheMisses,
+                       stats.renderedFrames);
+        if (ret < 0 || ret >= length - offset) {
+            SDL_assert(false);
+            return;
+        }
+
+        offset += ret;
+    }
+
+    if (stats.idrFrames != 0) {
+        ret = snprintf(&output[offset],
+                       length - offset,
+                       "IDR frames: %u (average/max size: %.1f/%.1f KB)\n",
+                       stats.idrFrames,
+                       (double)stats.totalIdrBytes / stats.idrFrames / 1024.0,
+                       stats.maxIdrBytes / 1024.0);
+        if (ret < 0 || ret >= length - offset) {
+            SDL_assert(false);
+            return;
+        }
+
+        offset += ret;
+    }
+
+    if (stats.lossRecoveries != 0) {
+        ret = snprintf(&output[offset],
+                       length - offset,
+                       "Loss recovery time average/max: %.1f/%.1f ms (%u/%u needed an IDR frame)\n",
+                       (double)stats.totalLossRecoveryTimeUs / stats.lossRecoveries / 1000.0,
+                       stats.maxLossRecoveryTimeUs / 1000.0,
+                       stats.idrLossRecoveries,
+                       stats.lossRecoveries);
+        if (ret < 0 || ret >= length - offset) {
+            SDL_assert(false);
+            return;
+        }
+
+        offset += ret;
+    }
+
+    if (stats.framePoolMisses != 0) {
+        ret = snprintf(&output[offset],
+                       length - offset,
+                       "Frame pool misses: %u (%.2f%% hit rate)\n",
+                       stats.framePoolMisses,
+                       (float)stats.framePoolHits / (stats.framePoolHits + stats.framePoolMisses) * 100);
+        if (ret < 0 || ret >= length - offset) {
+            SDL_assert(false);
+            return;
+        }
+
+        offset += ret;
+    }
+
+    if (stats.recorderDroppedFrames != 0) {
+        ret = snprintf(&output[offset],
+                       length - offset,
+                       "Frames dropped by recorder: %.2f%%\n",
+                       (float)stats.recorderDroppedFrames / stats.decodedFrames * 100);
+        if (ret < 0 || ret >= length - offset) {
+            SDL_assert(false);
+            return;
+        }
+
+        offset += ret;
+    }
+
+    if (stats.qualityFrames != 0) {
+        ret = snprintf(&output[offset],
+                       length - offset,
+                       "Quality vs. reference: %.2f dB PSNR, %.4f SSIM (%u frames)\n",
+                       stats.totalPsnrDb / stats.qualityFrames,
+                       stats.totalSsim / stats.qualityFrames,
+                       stats.qualityFrames);
+        if (ret < 0 || ret >= length - offset) {
+            SDL_assert(false);
+            return;
+        }
+
+        offset += ret;
     }
 }
 
 void FFmpegVideoDecoder::logVideoStats(VIDEO_STATS& stats, const char* title)
 {
     if (stats.renderedFps > 0 || stats.renderedFrames != 0) {
-        char videoStatsStr[512];
+        char videoStatsStr[4096];
         stringifyVideoStats(stats, videoStatsStr, sizeof(videoStatsStr));
 
         SDL_LogInfo(SDL_LOG_CATEGORY_APPLICATION,
-                    "\n%s\n------------------\n%s",
-                    title, videoStatsStr);
+                    "\n%s\n------------------\n%s",
+                    title, videoStatsStr);
+
+        logMemoryUsage(stats);
+    }
+}
+
+void FFmpegVideoDecoder::trackFrameMemory(AVFrame* frame)
+{
+    uint64_t frameBytes = 0;
+    if (frame->hw_frames_ctx != nullptr) {
+        // Hardware frames only change size along with their surface pool
+        if (frame->hw_frames_ctx->data == m_LastHwFramesContext) {
+            return;
+        }
+        m_LastHwFramesContext = frame->hw_frames_ctx->data;
+
+        auto framesContext = (AVHWFramesContext*)frame->hw_frames_ctx->data;
+        int size = av_image_get_buffer_size(framesContext->sw_format, framesContext->width, framesContext->height, 1);
+        if (size > 0) {
+            frameBytes = (uint64_t)size;
+
+            // Pools that grow on demand report no initial size
+            if (framesContext->initial_pool_size > 0 &&
+                    frameBytes * framesContext->initial_pool_size > m_DecoderPoolBytes) {
+                m_DecoderPoolSurfaces = framesContext->initial_pool_size;
+                m_DecoderPoolBytes = frameBytes * framesContext->initial_pool_size;
+            }
+        }
+    }
+    else {
+        for (int i = 0; i < AV_NUM_DATA_POINTERS && frame->buf[i] != nullptr; i++) {
+            frameBytes += frame->buf[i]->size;
+        }
+    }
+
+    m_DecodedFrameBytes = qMax(m_DecodedFrameBytes, frameBytes);
+}
+
+void FFmpegVideoDecoder::logMemoryUsage(VIDEO_STATS& stats)
+{
+    char output[1024];
+    int offset = 0;
+    int ret;
+
+    if (m_DecoderPoolSurfaces != 0) {
+        ret = snprintf(&output[offset], sizeof(output) - offset,
+                       "Decoder surfaces: %d (%.1f MB)\n",
+                       m_DecoderPoolSurfaces,
+                       m_DecoderPoolBytes / (1024.0 * 1024.0));
+    }
+    else {
+        ret = snprintf(&output[offset], sizeof(output) - offset,
+                       "Decoder surfaces: %.1f MB each, pool managed by decoder\n",
+                       m_DecodedFrameBytes / (1024.0 * 1024.0));
+    }
+    if (ret < 0 || ret >= (int)sizeof(output) - offset) {
+        SDL_assert(false);
+        return;
+    }
+    offset += ret;
+
+    ret = snprintf(&output[offset], sizeof(output) - offset,
+                   "Frames queued in Pacer: %u (%.1f MB)\n",
+                   stats.maxPacerQueuedFrames,
+                   stats.maxPacerQueuedFrames * m_DecodedFrameBytes / (1024.0 * 1024.0));
+    if (ret < 0 || ret >= (int)sizeof(output) - offset) {
+        SDL_assert(false);
+        return;
+    }
+    offset += ret;
+
+    if (m_Session != nullptr) {
+        ret = snprintf(&output[offset], sizeof(output) - offset,
+                       "Overlay surfaces: %.1f KB\n",
+                       m_Session->getOverlayManager().getPeakSurfaceBytes() / 1024.0);
+        if (ret < 0 || ret >= (int)sizeof(output) - offset) {
+            SDL_assert(false);
+            return;
+        }
+        offset += ret;
+    }
+
+    int boxArtUsedKb, boxArtBudgetKb;
+    BoxArtManager::getImageCacheUsage(&boxArtUsedKb, &boxArtBudgetKb);
+    ret = snprintf(&output[offset], sizeof(output) - offset,
+                   "Box art cache: %.1f of %.1f MB\n",
+                   boxArtUsedKb / 1024.0,
+                   boxArtBudgetKb / 1024.0);
+    if (ret < 0 || ret >= (int)sizeof(output) - offset) {
+        SDL_assert(false);
+        return;
+    }
+    offset += ret;
+
+    uint64_t peakRssKb = StreamUtils::getPeakResidentMemoryKb();
+    if (peakRssKb != 0) {
+        ret = snprintf(&output[offset], sizeof(output) - offset,
+                       "Process peak resident memory: %.1f MB\n",
+                       peakRssKb / 1024.0);
+        if (ret < 0 || ret >= (int)sizeof(output) - offset) {
+            SDL_assert(false);
+            return;
+        }
+        offset += ret;
+    }
+
+    SDL_LogInfo(SDL_LOG_CATEGORY_APPLICATION,
+                "\nPeak memory usage%s\n------------------\n%s",
+                (m_Session != nullptr && m_Session->isLowMemoryMode()) ? " (low memory mode)" : "",
+                output);
+}
+
+void FFmpegVideoDecoder::logBlockedModules(VIDEO_STATS& stats)
+{
+#ifdef Q_OS_WIN32
+    AH_BLOCKED_MODULE modules[32];
+    int count = AntiHookingGetBlockedModules(modules, SDL_arraysize(modules));
+    for (int i = 0; i < count; i++) {
+        SDL_LogWarn(SDL_LOG_CATEGORY_APPLICATION,
+                    "Blocked injected module %s (%u load attempts)",
+                    QString::fromWCharArray(modules[i].name).toUtf8().constData(),
+                    modules[i].attempts);
+    }
+
+    // Report what the filter itself cost relative to our render time, so
+    // it's clear that blocking these modules isn't costing us frames.
+    unsigned int filterCalls;
+    unsigned long long filterTimeUs;
+    AntiHookingGetFilterStats(&filterCalls, &filterTimeUs);
+    if (filterCalls != 0 && stats.totalRenderTimeUs != 0) {
+        SDL_LogInfo(SDL_LOG_CATEGORY_APPLICATION,
+                    "Module load filter: %u calls, %.2f ms total (%.3f%% of render time)",
+                    filterCalls,
+                    filterTimeUs / 1000.0,
+                    filterTimeUs * 100.0 / stats.totalRenderTimeUs);
     }
+#else
+    Q_UNUSED(stats);
+#endif
 }
 
 IFFmpegRenderer* FFmpegVideoDecoder::createHwAccelRenderer(const AVCodecHWConfig* hwDecodeCfg, int pass)
@@ -1100,12 +2121,30 @@ bool FFmpegVideoDecoder::tryInitializeRenderer(const AVCodec* decoder,
 
     // i == 0 - Indirect via EGL or DRM frontend with zero-copy DMA-BUF passing
     // i == 1 - Direct rendering or indirect via SDL read-back
-    bool backendInitFailure = false;
+    RendererPreferenceCache preferenceCache(decoder, hwConfig, requiredFormat, params);
 #ifdef HAVE_EGL
-    for (int i = 0; i < 2 && !backendInitFailure; i++) {
+    int modes[] = { 0, 1 };
+
+    // Try the mode that was fastest in a renderer trial first, if we have one
+    if (!m_TestOnly) {
+        int preferredMode = preferenceCache.getPreferredMode();
+        if (preferredMode < 0 && RendererPreferenceCache::isTrialEnabled()) {
+            preferredMode = runRendererTrial(decoder, requiredFormat, params, preferenceCache, createRendererFunc);
+        }
+
+        if (preferredMode == 1) {
+            modes[0] = 1;
+            modes[1] = 0;
+        }
+    }
 #else
-    for (int i = 1; i < 2 && !backendInitFailure; i++) {
+    int modes[] = { 1 };
 #endif
+
+    bool backendInitFailure = false;
+    for (int mode = 0; mode < (int)SDL_arraysize(modes) && !backendInitFailure; mode++) {
+        int i = modes[mode];
+
         SDL_assert(m_BackendRenderer == nullptr);
 
         if ((m_BackendRenderer = createRendererFunc()) == nullptr) {
@@ -1113,12 +2152,46 @@ bool FFmpegVideoDecoder::tryInitializeRenderer(const AVCodec* decoder,
             break;
         }
 
+        DecoderProbeCache probeCache(decoder, m_BackendRenderer, i, params);
+        m_SkipTestFrame = false;
+
+        // If this renderer passed its test frame on a previous run, initialize it for
+        // real right away. We can only check that the driver hasn't changed since then
+        // after the renderer is initialized, so we must start over if it has.
+        if (!m_TestOnly && m_BackendRenderer->needsTestFrame() && probeCache.hasResult()) {
+            if (initializeRendererInternal(m_BackendRenderer, params) && probeCache.isResultValid(m_BackendRenderer)) {
+                SDL_LogInfo(SDL_LOG_CATEGORY_APPLICATION,
+                            "Skipping test frame due to cached probe result");
+                if (completeInitialization(decoder, requiredFormat, params, false, i == 0 /* EGL/DRM */)) {
+                    preferenceCache.checkResult(i, m_BackendRenderer);
+                    return true;
+                }
+
+                // The cached result was wrong, so go back to testing this renderer
+                probeCache.removeResult();
+            }
+
+            reset();
+
+            if ((m_BackendRenderer = createRendererFunc()) == nullptr) {
+                // Out of memory
+                break;
+            }
+        }
+
         // Initialize the backend renderer itself
         if (initializeRendererInternal(m_BackendRenderer, (m_TestOnly || m_BackendRenderer->needsTestFrame()) ? &testFrameDecoderParams : params)) {
+            // Test-only decoders don't need to decode the test frame if it worked last time
+            m_SkipTestFrame = m_TestOnly && probeCache.isResultValid(m_BackendRenderer);
+
             if (completeInitialization(decoder, requiredFormat,
                                        (m_TestOnly || m_BackendRenderer->needsTestFrame()) ? &testFrameDecoderParams : params,
                                        m_TestOnly || m_BackendRenderer->needsTestFrame(),
                                        i == 0 /* EGL/DRM */)) {
+                if (!m_SkipTestFrame && (m_TestOnly || m_BackendRenderer->needsTestFrame())) {
+                    probeCache.storeResult(m_BackendRenderer);
+                }
+
                 if (m_TestOnly) {
                     // This decoder is only for testing capabilities, so don't bother
                     // creating a usable renderer
@@ -1136,6 +2209,7 @@ bool FFmpegVideoDecoder::tryInitializeRenderer(const AVCodec* decoder,
 
                     if (initializeRendererInternal(m_BackendRenderer, params) &&
                         completeInitialization(decoder, requiredFormat, params, false, i == 0 /* EGL/DRM */)) {
+                        preferenceCache.checkResult(i, m_BackendRenderer);
                         return true;
                     }
                     else {
@@ -1145,6 +2219,7 @@ bool FFmpegVideoDecoder::tryInitializeRenderer(const AVCodec* decoder,
                 }
                 else {
                     // No test required. Good to go now.
+                    preferenceCache.checkResult(i, m_BackendRenderer);
                     return true;
                 }
             }
@@ -1169,6 +2244,103 @@ bool FFmpegVideoDecoder::tryInitializeRenderer(const AVCodec* decoder,
     return false;
 }
 
+int FFmpegVideoDecoder::runRendererTrial(const AVCodec* decoder,
+                                         enum AVPixelFormat requiredFormat,
+                                         PDECODER_PARAMETERS params,
+                                         RendererPreferenceCache& preferenceCache,
+                                         std::function<IFFmpegRenderer*()> createRendererFunc)
+{
+    // Trials render the 720p test frame as fast as possible, since V-Sync
+    // would make every mode take a whole refresh interval
+    DECODER_PARAMETERS trialParams = *params;
+    trialParams.width = 1280;
+    trialParams.height = 720;
+    trialParams.enableVsync = false;
+    trialParams.enableFramePacing = false;
+
+    int bestMode = -1;
+    uint64_t bestTimeUs = UINT64_MAX;
+
+    for (int mode = 0; mode < 2; mode++) {
+        SDL_assert(m_BackendRenderer == nullptr);
+
+        if ((m_BackendRenderer = createRendererFunc()) == nullptr) {
+            // Out of memory
+            break;
+        }
+
+        m_SkipTestFrame = false;
+        m_RunRendererTrial = true;
+        m_RendererTrialUs = 0;
+
+        bool backendInitialized = initializeRendererInternal(m_BackendRenderer, &trialParams);
+        if (backendInitialized &&
+                completeInitialization(decoder, requiredFormat, &trialParams, true, mode == 0 /* EGL/DRM */) &&
+                m_RendererTrialUs != 0) {
+            SDL_LogInfo(SDL_LOG_CATEGORY_APPLICATION,
+                        "Renderer trial: '%s' with '%s' backend took %.2f ms per frame",
+                        m_FrontendRenderer->getRendererName(),
+                        m_BackendRenderer->getRendererName(),
+                        m_RendererTrialUs / 1000.0);
+
+            if (m_RendererTrialUs < bestTimeUs) {
+                bestTimeUs = m_RendererTrialUs;
+                bestMode = mode;
+                preferenceCache.storeResult(mode, m_BackendRenderer);
+            }
+        }
+
+        m_RunRendererTrial = false;
+        reset();
+
+        // A different frontend won't help if the backend itself failed
+        if (!backendInitialized) {
+            break;
+        }
+    }
+
+    return bestMode;
+}
+
+uint64_t FFmpegVideoDecoder::measureRendererTrial(AVFrame* frame)
+{
+    LATENCY_HISTOGRAM histogram;
+    SDL_zero(histogram);
+
+    m_FrontendRenderer->prepareToRender();
+
+    // Decode and render the test frame over and over like a stream would
+    for (int i = 0; i < RENDERER_TRIAL_WARMUP_FRAMES + RENDERER_TRIAL_FRAMES; i++) {
+        uint64_t startUs = LiGetMicroseconds();
+
+        if (avcodec_send_packet(m_VideoDecoderCtx, m_Pkt) < 0) {
+            return 0;
+        }
+
+        av_frame_unref(frame);
+        int err = avcodec_receive_frame(m_VideoDecoderCtx, frame);
+        if (err == AVERROR(EAGAIN)) {
+            // Decoders with output delay will catch up on later iterations
+            continue;
+        }
+        else if (err < 0) {
+            return 0;
+        }
+
+        m_FrontendRenderer->renderFrame(frame);
+
+        if (i >= RENDERER_TRIAL_WARMUP_FRAMES) {
+            latencyHistogramAdd(histogram, LiGetMicroseconds() - startUs);
+        }
+    }
+
+    // Use the median so a single compositor hiccup doesn't decide the trial
+    if (histogram.count == 0) {
+        return 0;
+    }
+    return SDL_max((uint64_t)latencyHistogramPercentile(histogram, 50), 1);
+}
+
 #define TRY_PREFERRED_PIXEL_FORMAT(RENDERER_TYPE) \
     { \
         RENDERER_TYPE renderer; \
@@ -1305,6 +2477,10 @@ bool FFmpegVideoDecoder::tryInitializeRendererForUnknownDecoder(const AVCodec* d
         TRY_PREFERRED_PIXEL_FORMAT(PlVkRenderer);
 #endif
 #ifndef GL_IS_SLOW
+#ifdef HAVE_EGL
+        // EGLRenderer can upload software frames asynchronously via PBOs
+        TRY_PREFERRED_PIXEL_FORMAT(EGLRenderer);
+#endif
         TRY_PREFERRED_PIXEL_FORMAT(SdlRenderer);
 #endif
     }
@@ -1378,7 +2554,16 @@ bool FFmpegVideoDecoder::isDecoderMatchForParams(const AVCodec *decoder, PDECODE
     // would rather show the missing hardware acceleration warning when the user
     // is in Full KMS mode rather than try to use a poorly performing hwaccel.
     // See discussion on https://github.com/jc-kynesim/rpi-ffmpeg/pull/25
-    if (strcmp(decoder->name, "h264_v4l2m2m") == 0) {
+    //
+    // On a Pi 4 or 5 running the KMS stack, the V4L2 decoders hand us DRM PRIME
+    // frames that DrmRenderer scans out on a plane without EGL, and MMAL is on
+    // its way out. RPI_PREFER_V4L2=1 uses that pipeline for both codecs instead.
+    if (qgetenv("RPI_PREFER_V4L2") == "1") {
+        if (strcmp(decoder->name, "h264_mmal") == 0) {
+            return false;
+        }
+    }
+    else if (strcmp(decoder->name, "h264_v4l2m2m") == 0) {
         return false;
     }
 #endif
@@ -1511,8 +2696,60 @@ bool FFmpegVideoDecoder::tryInitializeNonHwAccelDecoder(PDECODER_PARAMETERS para
     return false;
 }
 
+bool FFmpegVideoDecoder::getTestFrame(int videoFormat, const uint8_t** data, int* size)
+{
+    switch (videoFormat) {
+    case VIDEO_FORMAT_H264:
+        *data = k_H264TestFrame;
+        *size = sizeof(k_H264TestFrame);
+        break;
+    case VIDEO_FORMAT_H265:
+        *data = k_HEVCMainTestFrame;
+        *size = sizeof(k_HEVCMainTestFrame);
+        break;
+    case VIDEO_FORMAT_H265_MAIN10:
+        *data = k_HEVCMain10TestFrame;
+        *size = sizeof(k_HEVCMain10TestFrame);
+        break;
+    case VIDEO_FORMAT_AV1_MAIN8:
+        *data = k_AV1Main8TestFrame;
+        *size = sizeof(k_AV1Main8TestFrame);
+        break;
+    case VIDEO_FORMAT_AV1_MAIN10:
+        *data = k_AV1Main10TestFrame;
+        *size = sizeof(k_AV1Main10TestFrame);
+        break;
+    case VIDEO_FORMAT_H264_HIGH8_444:
+        *data = k_h264High_444TestFrame;
+        *size = sizeof(k_h264High_444TestFrame);
+        break;
+    case VIDEO_FORMAT_H265_REXT8_444:
+        *data = k_HEVCRExt8_444TestFrame;
+        *size = sizeof(k_HEVCRExt8_444TestFrame);
+        break;
+    case VIDEO_FORMAT_H265_REXT10_444:
+        *data = k_HEVCRExt10_444TestFrame;
+        *size = sizeof(k_HEVCRExt10_444TestFrame);
+        break;
+    case VIDEO_FORMAT_AV1_HIGH8_444:
+        *data = k_AV1High8_444TestFrame;
+        *size = sizeof(k_AV1High8_444TestFrame);
+        break;
+    case VIDEO_FORMAT_AV1_HIGH10_444:
+        *data = k_AV1High10_444TestFrame;
+        *size = sizeof(k_AV1High10_444TestFrame);
+        break;
+    default:
+        return false;
+    }
+
+    return true;
+}
+
 bool FFmpegVideoDecoder::initialize(PDECODER_PARAMETERS params)
 {
+    m_Session = params->session;
+
     // Increase log level until the first frame is decoded
     av_log_set_level(AV_LOG_DEBUG);
 
@@ -1632,233 +2869,672 @@ bool FFmpegVideoDecoder::initialize(PDECODER_PARAMETERS params)
                 continue;
             }
 
-            // Try this decoder without hwaccel
-            if (tryInitializeRendererForUnknownDecoder(decoder, params, false)) {
-                return true;
+            // Try this decoder without hwaccel
+            if (tryInitializeRendererForUnknownDecoder(decoder, params, false)) {
+                return true;
+            }
+        }
+    }
+
+    SDL_LogError(SDL_LOG_CATEGORY_APPLICATION,
+                 "Unable to find working decoder for format: %x",
+                 params->videoFormat);
+    return false;
+}
+
+void FFmpegVideoDecoder::writeBuffer(PLENTRY entry, uint8_t* buffer, int& offset)
+{
+    if (m_NeedsSpsFixup && entry->bufferType == BUFFER_TYPE_SPS &&
+            m_FixedUpSpsInput.size() == entry->length &&
+            memcmp(m_FixedUpSpsInput.constData(), entry->data, entry->length) == 0) {
+        // The host sends the same SPS with every IDR frame, so reuse the
+        // last rewritten copy rather than parsing it again.
+        memcpy(&buffer[offset],
+               m_FixedUpSpsOutput.constData(),
+               m_FixedUpSpsOutput.size());
+        offset += m_FixedUpSpsOutput.size();
+    }
+    else if (m_NeedsSpsFixup && entry->bufferType == BUFFER_TYPE_SPS) {
+        int nalStart, nalEnd;
+        int initialOffset = offset;
+
+        find_nal_unit((uint8_t*)entry->data, entry->length, &nalStart, &nalEnd);
+
+        SDL_assert(nalStart == 3 || nalStart == 4); // 3 or 4 byte Annex B start sequence
+        SDL_assert(nalEnd == entry->length);
+
+        // Fixup the SPS to what OS X needs to use hardware acceleration. Try
+        // our minimal rewriter first, and fall back to a full parse with
+        // h264bitstream if it can't handle this SPS.
+        int rewrittenLength = 0;
+        if (qgetenv("ML_SPS_REWRITER") != "0") {
+            rewrittenLength = SpsRewriter::rewriteH264((const uint8_t*)entry->data, entry->length, nalStart,
+                                                       1, 1, &buffer[initialOffset],
+                                                       MAX_SPS_EXTRA_SIZE + entry->length);
+        }
+
+        if (rewrittenLength > 0) {
+            offset += rewrittenLength;
+        }
+        else {
+            h264_stream_t* stream = h264_new();
+
+            // Read the old NALU
+            read_nal_unit(stream,
+                          (unsigned char *)&entry->data[nalStart],
+                          nalEnd - nalStart);
+
+            stream->sps->num_ref_frames = 1;
+            stream->sps->vui.max_dec_frame_buffering = 1;
+
+            // Copy the modified NALU data. This clobbers byte 0 and starts NALU data at byte 1.
+            // Since it prepended one extra byte, subtract one from the returned length.
+            offset += write_nal_unit(stream, &buffer[initialOffset + nalStart - 1],
+                                     MAX_SPS_EXTRA_SIZE + entry->length - nalStart) - 1;
+
+            // Copy the NALU prefix over from the original SPS
+            memcpy(&buffer[initialOffset], entry->data, nalStart);
+            offset += nalStart;
+
+            h264_free(stream);
+        }
+
+        // Remember the result for the next IDR frame
+        m_FixedUpSpsInput = QByteArray(entry->data, entry->length);
+        m_FixedUpSpsOutput = QByteArray((const char*)&buffer[initialOffset], offset - initialOffset);
+    }
+    else {
+        // Write the buffer as-is
+        memcpy(&buffer[offset],
+               entry->data,
+               entry->length);
+        offset += entry->length;
+    }
+}
+
+int FFmpegVideoDecoder::decoderThreadProcThunk(void *context)
+{
+    FFmpegVideoDecoder* me = (FFmpegVideoDecoder*)context;
+
+    StreamUtils::placeCurrentThread(StreamUtils::TPC_LATENCY_CRITICAL);
+
+    // Software decoders do some of their work on this thread too
+    if (!me->isHardwareAccelerated()) {
+        SoftwareDecodeProfile::pinThreadToPerformanceCores(nullptr);
+    }
+
+    REALTIME_THREAD_STATE realtimeState;
+    StreamUtils::enterRealtimeScheduling(StreamUtils::RTC_VIDEO, 1000000 / SDL_max(me->m_StreamFps, 1), &realtimeState);
+
+    if (me->m_PipelinedDecode) {
+        me->pipelinedInputThreadProc();
+    }
+    else {
+        me->decoderThreadProc();
+    }
+
+    StreamUtils::exitRealtimeScheduling(&realtimeState);
+    return 0;
+}
+
+void FFmpegVideoDecoder::decoderThreadProc()
+{
+    while (!SDL_AtomicGet(&m_DecoderThreadShouldQuit)) {
+        if (m_FramesIn == m_FramesOut) {
+            VIDEO_FRAME_HANDLE handle;
+            PDECODE_UNIT du;
+
+            // Waiting for input. All output frames have been received.
+            // Block until we receive a new frame from the host.
+            if (!LiWaitForNextVideoFrame(&handle, &du)) {
+                // This might be a signal from the main thread to exit
+                continue;
+            }
+
+            LiCompleteVideoFrame(handle, submitDecodeUnit(du));
+        }
+
+        if (m_FramesIn != m_FramesOut) {
+            SDL_assert(m_FramesIn > m_FramesOut);
+
+            // We have output frames to receive. Let's poll until we get one,
+            // and submit new input data if/when we get it.
+            AVFrame* frame = getOutputFrame();
+            if (!frame) {
+                // Failed to allocate a frame but we did submit,
+                // so we can return DR_OK
+                SDL_LogWarn(SDL_LOG_CATEGORY_APPLICATION,
+                            "Failed to allocate frame");
+                continue;
+            }
+
+            int err;
+            do {
+                err = receiveFrame(frame);
+                if (err == 0) {
+                    SDL_assert(m_FrameInfoQueue.size() == m_FramesIn - m_FramesOut);
+                    m_FramesOut++;
+
+                    handleDecodedFrame(frame);
+                }
+                else if (err == AVERROR(EAGAIN)) {
+                    VIDEO_FRAME_HANDLE handle;
+                    PDECODE_UNIT du;
+
+                    // No output data, so let's try to submit more input data,
+                    // while we're waiting for this to frame to come back.
+                    if (LiPollNextVideoFrame(&handle, &du)) {
+                        // FIXME: Handle EAGAIN on avcodec_send_packet() properly?
+                        LiCompleteVideoFrame(handle, submitDecodeUnit(du));
+                    }
+                    else {
+                        // No output data or input data. Let's wait a little bit.
+                        waitForOutputFrame(2);
+                    }
+                }
+                else {
+                    handleReceiveError(err);
+                }
+            } while (err == AVERROR(EAGAIN) && !SDL_AtomicGet(&m_DecoderThreadShouldQuit));
+
+            if (err != 0) {
+                // Free the frame if we failed to submit it
+                m_FramePool.release(&frame);
+            }
+        }
+    }
+}
+
+int FFmpegVideoDecoder::decoderOutputThreadProcThunk(void *context)
+{
+    FFmpegVideoDecoder* me = (FFmpegVideoDecoder*)context;
+
+    StreamUtils::placeCurrentThread(StreamUtils::TPC_LATENCY_CRITICAL);
+
+    REALTIME_THREAD_STATE realtimeState;
+    StreamUtils::enterRealtimeScheduling(StreamUtils::RTC_VIDEO, 1000000 / SDL_max(me->m_StreamFps, 1), &realtimeState);
+
+    me->decoderOutputThreadProc();
+
+    StreamUtils::exitRealtimeScheduling(&realtimeState);
+    return 0;
+}
+
+void FFmpegVideoDecoder::pipelinedInputThreadProc()
+{
+    while (!SDL_AtomicGet(&m_DecoderThreadShouldQuit)) {
+        VIDEO_FRAME_HANDLE handle;
+        PDECODE_UNIT du;
+
+        // Block until we receive a new frame from the host. Unlike decoderThreadProc(),
+        // we never have to poll here because output is handled by the other thread.
+        if (!LiWaitForNextVideoFrame(&handle, &du)) {
+            // This might be a signal from the main thread to exit
+            continue;
+        }
+
+        m_CodecLock.lock();
+        int ret = submitDecodeUnit(du);
+        m_CodecLock.unlock();
+
+        // Let the output thread know there's something new to receive
+        m_FramesSubmitted.wakeOne();
+
+        LiCompleteVideoFrame(handle, ret);
+    }
+}
+
+void FFmpegVideoDecoder::decoderOutputThreadProc()
+{
+    AVFrame* frame = nullptr;
+
+    m_CodecLock.lock();
+    while (!SDL_AtomicGet(&m_DecoderThreadShouldQuit)) {
+        if (m_FramesIn == m_FramesOut) {
+            // Nothing is in flight, so sleep until the input thread submits
+            // a frame or we're told to quit.
+            m_FramesSubmitted.wait(&m_CodecLock);
+            continue;
+        }
+
+        if (frame == nullptr) {
+            frame = getOutputFrame();
+            if (frame == nullptr) {
+                SDL_LogWarn(SDL_LOG_CATEGORY_APPLICATION,
+                            "Failed to allocate frame");
+                m_FramesSubmitted.wait(&m_CodecLock, PIPELINED_OUTPUT_POLL_MS);
+                continue;
+            }
+        }
+
+        int err = receiveFrame(frame);
+        if (err == 0) {
+            SDL_assert(m_FrameInfoQueue.size() == m_FramesIn - m_FramesOut);
+            m_FramesOut++;
+
+            prepareDecodedFrame(frame);
+
+            // Don't hold up the input thread while the frame is read back or,
+            // without pacing, rendered inline
+            m_CodecLock.unlock();
+            presentDecodedFrame(frame);
+            m_CodecLock.lock();
+
+            frame = nullptr;
+        }
+        else if (err == AVERROR(EAGAIN) && m_DirectDecoder != nullptr) {
+            // The direct decoder signals us as soon as a frame is output,
+            // so wait for that without blocking the input thread
+            m_CodecLock.unlock();
+            waitForOutputFrame(PIPELINED_OUTPUT_POLL_MS);
+            m_CodecLock.lock();
+        }
+        else if (err == AVERROR(EAGAIN)) {
+            // Most decoders only produce output in response to input, so sleep until
+            // the input thread submits the next packet. Hardware wrapper decoders and
+            // frame threads complete frames on their own without telling us, so we
+            // must recheck those after a short interval.
+            if ((m_VideoDecoderCtx->codec->capabilities & AV_CODEC_CAP_HARDWARE) ||
+                    (m_VideoDecoderCtx->active_thread_type & FF_THREAD_FRAME)) {
+                m_FramesSubmitted.wait(&m_CodecLock, PIPELINED_OUTPUT_POLL_MS);
             }
+            else {
+                m_FramesSubmitted.wait(&m_CodecLock);
+            }
+        }
+        else {
+            handleReceiveError(err);
         }
     }
+    m_CodecLock.unlock();
 
-    SDL_LogError(SDL_LOG_CATEGORY_APPLICATION,
-                 "Unable to find working decoder for format: %x",
-                 params->videoFormat);
-    return false;
+    m_FramePool.release(&frame);
 }
 
-void FFmpegVideoDecoder::writeBuffer(PLENTRY entry, int& offset)
+int FFmpegVideoDecoder::sendPacket(AVPacket* packet)
 {
-    if (m_NeedsSpsFixup && entry->bufferType == BUFFER_TYPE_SPS) {
-        h264_stream_t* stream = h264_new();
-        int nalStart, nalEnd;
+#ifdef Q_OS_DARWIN
+    if (m_DirectDecoder != nullptr) {
+        return m_DirectDecoder->sendPacket(packet);
+    }
+#endif
 
-        // Read the old NALU
-        find_nal_unit((uint8_t*)entry->data, entry->length, &nalStart, &nalEnd);
-        read_nal_unit(stream,
-                      (unsigned char *)&entry->data[nalStart],
-                      nalEnd - nalStart);
+    return avcodec_send_packet(m_VideoDecoderCtx, packet);
+}
 
-        SDL_assert(nalStart == 3 || nalStart == 4); // 3 or 4 byte Annex B start sequence
-        SDL_assert(nalEnd == entry->length);
+int FFmpegVideoDecoder::receiveFrame(AVFrame* frame)
+{
+#ifdef Q_OS_DARWIN
+    if (m_DirectDecoder != nullptr) {
+        return m_DirectDecoder->receiveFrame(frame);
+    }
+#endif
 
-        // Fixup the SPS to what OS X needs to use hardware acceleration
-        stream->sps->num_ref_frames = 1;
-        stream->sps->vui.max_dec_frame_buffering = 1;
+    return avcodec_receive_frame(m_VideoDecoderCtx, frame);
+}
 
-        int initialOffset = offset;
+void FFmpegVideoDecoder::waitForOutputFrame(int timeoutMs)
+{
+#ifdef Q_OS_DARWIN
+    if (m_DirectDecoder != nullptr) {
+        m_DirectDecoder->waitForFrame(timeoutMs);
+        return;
+    }
+#endif
+
+    SDL_Delay(timeoutMs);
+}
 
-        // Copy the modified NALU data. This clobbers byte 0 and starts NALU data at byte 1.
-        // Since it prepended one extra byte, subtract one from the returned length.
-        offset += write_nal_unit(stream, (uint8_t*)&m_DecodeBuffer.data()[initialOffset + nalStart - 1],
-                                 MAX_SPS_EXTRA_SIZE + entry->length - nalStart) - 1;
+void FFmpegVideoDecoder::destroyDirectDecoder()
+{
+#ifdef Q_OS_DARWIN
+    delete m_DirectDecoder;
+    m_DirectDecoder = nullptr;
+#endif
+}
 
-        // Copy the NALU prefix over from the original SPS
-        memcpy(&m_DecodeBuffer.data()[initialOffset], entry->data, nalStart);
-        offset += nalStart;
+AVFrame* FFmpegVideoDecoder::getOutputFrame()
+{
+    bool poolHit;
+    AVFrame* frame = m_FramePool.get(poolHit);
 
-        h264_free(stream);
+    if (poolHit) {
+        m_ActiveWndVideoStats.framePoolHits++;
     }
     else {
-        // Write the buffer as-is
-        memcpy(&m_DecodeBuffer.data()[offset],
-               entry->data,
-               entry->length);
-        offset += entry->length;
+        m_ActiveWndVideoStats.framePoolMisses++;
     }
+
+    return frame;
 }
 
-int FFmpegVideoDecoder::decoderThreadProcThunk(void *context)
+// Attaches HDR metadata to the frame if it's not already present. We will defer to
+// any metadata contained in the bitstream itself since that is guaranteed to be
+// correctly synchronized to each frame, unlike our async HDR metadata message.
+void FFmpegVideoDecoder::attachHdrMetadata(AVFrame* frame)
 {
-    ((FFmpegVideoDecoder*)context)->decoderThreadProc();
-    return 0;
+    SS_HDR_METADATA hdrMetadata;
+    if (!LiGetHdrMetadata(&hdrMetadata)) {
+        return;
+    }
+
+    // The metadata rarely changes, so we build the side data once and give each
+    // frame a reference to it rather than allocating new side data every frame.
+    if (memcmp(&hdrMetadata, &m_HdrMetadata, sizeof(hdrMetadata)) != 0 ||
+            (m_MasteringDisplayBuf == nullptr && m_ContentLightBuf == nullptr)) {
+        av_buffer_unref(&m_MasteringDisplayBuf);
+        av_buffer_unref(&m_ContentLightBuf);
+        m_HdrMetadata = hdrMetadata;
+
+        AVMasteringDisplayMetadata* mdm = av_mastering_display_metadata_alloc();
+        if (mdm != nullptr) {
+            mdm->display_primaries[0][0] = av_make_q(hdrMetadata.displayPrimaries[0].x, 50000);
+            mdm->display_primaries[0][1] = av_make_q(hdrMetadata.displayPrimaries[0].y, 50000);
+            mdm->display_primaries[1][0] = av_make_q(hdrMetadata.displayPrimaries[1].x, 50000);
+            mdm->display_primaries[1][1] = av_make_q(hdrMetadata.displayPrimaries[1].y, 50000);
+            mdm->display_primaries[2][0] = av_make_q(hdrMetadata.displayPrimaries[2].x, 50000);
+            mdm->display_primaries[2][1] = av_make_q(hdrMetadata.displayPrimaries[2].y, 50000);
+
+            mdm->white_point[0] = av_make_q(hdrMetadata.whitePoint.x, 50000);
+            mdm->white_point[1] = av_make_q(hdrMetadata.whitePoint.y, 50000);
+
+            mdm->min_luminance = av_make_q(hdrMetadata.minDisplayLuminance, 10000);
+            mdm->max_luminance = av_make_q(hdrMetadata.maxDisplayLuminance, 1);
+
+            mdm->has_luminance = hdrMetadata.maxDisplayLuminance != 0 ? 1 : 0;
+            mdm->has_primaries = hdrMetadata.displayPrimaries[0].x != 0 ? 1 : 0;
+
+            m_MasteringDisplayBuf = av_buffer_create((uint8_t*)mdm, sizeof(*mdm), av_buffer_default_free, nullptr, 0);
+            if (m_MasteringDisplayBuf == nullptr) {
+                av_free(mdm);
+            }
+        }
+
+        if (hdrMetadata.maxContentLightLevel != 0 || hdrMetadata.maxFrameAverageLightLevel != 0) {
+            size_t clmSize;
+            AVContentLightMetadata* clm = av_content_light_metadata_alloc(&clmSize);
+            if (clm != nullptr) {
+                clm->MaxCLL = hdrMetadata.maxContentLightLevel;
+                clm->MaxFALL = hdrMetadata.maxFrameAverageLightLevel;
+
+                m_ContentLightBuf = av_buffer_create((uint8_t*)clm, clmSize, av_buffer_default_free, nullptr, 0);
+                if (m_ContentLightBuf == nullptr) {
+                    av_free(clm);
+                }
+            }
+        }
+    }
+
+    if (m_MasteringDisplayBuf != nullptr &&
+            av_frame_get_side_data(frame, AV_FRAME_DATA_MASTERING_DISPLAY_METADATA) == nullptr) {
+        AVBufferRef* buf = av_buffer_ref(m_MasteringDisplayBuf);
+        if (buf != nullptr && av_frame_new_side_data_from_buf(frame, AV_FRAME_DATA_MASTERING_DISPLAY_METADATA, buf) == nullptr) {
+            av_buffer_unref(&buf);
+        }
+    }
+
+    if (m_ContentLightBuf != nullptr &&
+            av_frame_get_side_data(frame, AV_FRAME_DATA_CONTENT_LIGHT_LEVEL) == nullptr) {
+        AVBufferRef* buf = av_buffer_ref(m_ContentLightBuf);
+        if (buf != nullptr && av_frame_new_side_data_from_buf(frame, AV_FRAME_DATA_CONTENT_LIGHT_LEVEL, buf) == nullptr) {
+            av_buffer_unref(&buf);
+        }
+    }
 }
 
-void FFmpegVideoDecoder::decoderThreadProc()
+void FFmpegVideoDecoder::handleDecodedFrame(AVFrame* frame)
 {
-    while (!SDL_AtomicGet(&m_DecoderThreadShouldQuit)) {
-        if (m_FramesIn == m_FramesOut) {
-            VIDEO_FRAME_HANDLE handle;
-            PDECODE_UNIT du;
+    prepareDecodedFrame(frame);
+    presentDecodedFrame(frame);
+}
 
-            // Waiting for input. All output frames have been received.
-            // Block until we receive a new frame from the host.
-            if (!LiWaitForNextVideoFrame(&handle, &du)) {
-                // This might be a signal from the main thread to exit
-                continue;
-            }
+void FFmpegVideoDecoder::prepareDecodedFrame(AVFrame* frame)
+{
+    attachHdrMetadata(frame);
 
-            LiCompleteVideoFrame(handle, submitDecodeUnit(du));
+    // Reset failed decodes count if we reached this far
+    m_ConsecutiveFailedDecodes = 0;
+    m_DecoderContextRecreated = false;
+
+    // Restore default log level after a successful decode
+    av_log_set_level(AV_LOG_INFO);
+
+    // Capture a frame timestamp to measuring pacing delay
+    frame->pkt_dts = LiGetMicroseconds();
+
+    if (!m_FrameInfoQueue.isEmpty()) {
+        // Data buffers in the DU are not valid here!
+        DECODE_UNIT du = m_FrameInfoQueue.dequeue();
+
+        // Count time in avcodec_send_packet() and avcodec_receive_frame()
+        // as time spent decoding. Also count time spent in the decode unit
+        // queue because that's directly caused by decoder latency.
+        uint64_t decodeTimeUs = LiGetMicroseconds() - du.enqueueTimeUs;
+        m_ActiveWndVideoStats.totalDecodeTimeUs += decodeTimeUs;
+        if (m_DecodeStatsSampleCounter == 0) {
+            latencyHistogramAdd(m_ActiveWndVideoStats.decodeTimeHistogram, decodeTimeUs);
         }
 
-        if (m_FramesIn != m_FramesOut) {
-            SDL_assert(m_FramesIn > m_FramesOut);
+        if (m_Session != nullptr) {
+            m_Session->getFlightRecorder().record(FlightRecorder::EventFrameDecoded,
+                                                  du.frameNumber,
+                                                  du.frameType,
+                                                  (uint32_t)(du.enqueueTimeUs - du.receiveTimeUs),
+                                                  (uint32_t)decodeTimeUs);
+        }
 
-            // We have output frames to receive. Let's poll until we get one,
-            // and submit new input data if/when we get it.
-            AVFrame* frame = av_frame_alloc();
-            if (!frame) {
-                // Failed to allocate a frame but we did submit,
-                // so we can return DR_OK
-                SDL_LogWarn(SDL_LOG_CATEGORY_APPLICATION,
-                            "Failed to allocate frame");
-                continue;
+        if (m_LossStartUs != 0 && du.frameNumber >= m_LossRecoveryFrameNumber &&
+                frame->decode_error_flags == 0) {
+            uint64_t recoveryTimeUs = LiGetMicroseconds() - m_LossStartUs;
+            m_ActiveWndVideoStats.lossRecoveries++;
+            if (du.frameType == FRAME_TYPE_IDR) {
+                m_ActiveWndVideoStats.idrLossRecoveries++;
             }
+            m_ActiveWndVideoStats.totalLossRecoveryTimeUs += recoveryTimeUs;
+            m_ActiveWndVideoStats.maxLossRecoveryTimeUs = qMax(m_ActiveWndVideoStats.maxLossRecoveryTimeUs, (uint32_t)recoveryTimeUs);
+            m_LossStartUs = 0;
+        }
 
-            int err;
-            do {
-                err = avcodec_receive_frame(m_VideoDecoderCtx, frame);
-                if (err == 0) {
-                    SDL_assert(m_FrameInfoQueue.size() == m_FramesIn - m_FramesOut);
-                    m_FramesOut++;
+        if (m_PerfGraphEnabled) {
+            m_Session->getOverlayManager().getPerfGraph().addSample(Overlay::PerfGraphDecodeTime,
+                                                                         decodeTimeUs / 1000.0f);
+        }
 
-                    // Attach HDR metadata to the frame if it's not already present. We will defer to
-                    // any metadata contained in the bitstream itself since that is guaranteed to be
-                    // correctly synchronized to each frame, unlike our async HDR metadata message.
-                    SS_HDR_METADATA hdrMetadata;
-                    if (LiGetHdrMetadata(&hdrMetadata)) {
-                        if (av_frame_get_side_data(frame, AV_FRAME_DATA_MASTERING_DISPLAY_METADATA) == nullptr) {
-                            auto mdm = av_mastering_display_metadata_create_side_data(frame);
-
-                            mdm->display_primaries[0][0] = av_make_q(hdrMetadata.displayPrimaries[0].x, 50000);
-                            mdm->display_primaries[0][1] = av_make_q(hdrMetadata.displayPrimaries[0].y, 50000);
-                            mdm->display_primaries[1][0] = av_make_q(hdrMetadata.displayPrimaries[1].x, 50000);
-                            mdm->display_primaries[1][1] = av_make_q(hdrMetadata.displayPrimaries[1].y, 50000);
-                            mdm->display_primaries[2][0] = av_make_q(hdrMetadata.displayPrimaries[2].x, 50000);
-                            mdm->display_primaries[2][1] = av_make_q(hdrMetadata.displayPrimaries[2].y, 50000);
-
-                            mdm->white_point[0] = av_make_q(hdrMetadata.whitePoint.x, 50000);
-                            mdm->white_point[1] = av_make_q(hdrMetadata.whitePoint.y, 50000);
-
-                            mdm->min_luminance = av_make_q(hdrMetadata.minDisplayLuminance, 10000);
-                            mdm->max_luminance = av_make_q(hdrMetadata.maxDisplayLuminance, 1);
-
-                            mdm->has_luminance = hdrMetadata.maxDisplayLuminance != 0 ? 1 : 0;
-                            mdm->has_primaries = hdrMetadata.displayPrimaries[0].x != 0 ? 1 : 0;
-                        }
-
-                        if ((hdrMetadata.maxContentLightLevel != 0 || hdrMetadata.maxFrameAverageLightLevel != 0) &&
-                                av_frame_get_side_data(frame, AV_FRAME_DATA_CONTENT_LIGHT_LEVEL) == nullptr) {
-                            auto clm = av_content_light_metadata_create_side_data(frame);
-
-                            clm->MaxCLL = hdrMetadata.maxContentLightLevel;
-                            clm->MaxFALL = hdrMetadata.maxFrameAverageLightLevel;
-                        }
-                    }
+        // Store the presentation time (90 kHz timebase)
+        frame->pts = (int64_t)du.rtpTimestamp;
 
-                    // Reset failed decodes count if we reached this far
-                    m_ConsecutiveFailedDecodes = 0;
+        if (m_FrameTracer) {
+            m_FrameTracer->attachFrame(frame, du, (uint64_t)frame->pkt_dts);
+        }
+    }
 
-                    // Restore default log level after a successful decode
-                    av_log_set_level(AV_LOG_INFO);
+    m_ActiveWndVideoStats.decodedFrames++;
+    if (m_DecodeStatsSampleCounter == 0) {
+        m_ActiveWndVideoStats.decoderThreadCpuTimeUs += StreamUtils::takeThreadCpuTimeUs();
+    }
+    if (++m_DecodeStatsSampleCounter >= m_StatsSampleInterval) {
+        m_DecodeStatsSampleCounter = 0;
+    }
 
-                    // Capture a frame timestamp to measuring pacing delay
-                    frame->pkt_dts = LiGetMicroseconds();
+    trackFrameMemory(frame);
 
-                    if (!m_FrameInfoQueue.isEmpty()) {
-                        // Data buffers in the DU are not valid here!
-                        DECODE_UNIT du = m_FrameInfoQueue.dequeue();
+    // This only takes a reference for the recorder thread, so the
+    // live frame is never delayed by readback or disk I/O.
+    if (m_VideoRecorder && !m_VideoRecorder->submitFrame(frame)) {
+        m_ActiveWndVideoStats.recorderDroppedFrames++;
+    }
 
-                        // Count time in avcodec_send_packet() and avcodec_receive_frame()
-                        // as time spent decoding. Also count time spent in the decode unit
-                        // queue because that's directly caused by decoder latency.
-                        m_ActiveWndVideoStats.totalDecodeTimeUs += (LiGetMicroseconds() - du.enqueueTimeUs);
+    // Likewise, the analyzer skips frames rather than waiting for readback
+    if (m_QualityAnalyzer) {
+        m_QualityAnalyzer->submitFrame(frame);
+    }
+}
 
-                        // Store the presentation time (90 kHz timebase)
-                        frame->pts = (int64_t)du.rtpTimestamp;
-                    }
+void FFmpegVideoDecoder::presentDecodedFrame(AVFrame* frame)
+{
+    // Read the frame back now if the renderer needs it in system memory,
+    // so it overlaps with rendering of the previous frame
+    uint64_t readbackStartUs = LiGetMicroseconds();
+    bool readBack = m_FrontendRenderer->readBackFrame(frame);
+    uint64_t readbackTimeUs = LiGetMicroseconds() - readbackStartUs;
 
-                    m_ActiveWndVideoStats.decodedFrames++;
-
-                    // Record frame to file if recording is enabled
-                    if (m_VideoRecorder) {
-                        // Start recording on first frame if not already started
-                        if (!m_VideoRecorder->isRecording() && m_VideoDecoderCtx) {
-                            // Save to recorded_session directory in the moonlight-qt folder
-                            QString recordDir = "/Users/ushasighosh/Desktop/moonlight-qt/recorded_session";
-                            QDir().mkpath(recordDir);
-                            QString outputPath = QString("%1/moonlight_recording_%2.yuv")
-                                .arg(recordDir)
-                                .arg(QDateTime::currentDateTime().toString("yyyyMMdd_hhmmss"));
-                            m_VideoRecorder->initialize(outputPath,
-                                                       m_VideoDecoderCtx->width,
-                                                       m_VideoDecoderCtx->height,
-                                                       m_StreamFps > 0 ? m_StreamFps : 60);
-                        }
-                        m_VideoRecorder->writeFrame(frame);
-                    }
+    // The pipelined input thread rolls over the stats windows
+    if (m_PipelinedDecode) {
+        m_CodecLock.lock();
+    }
 
-                    // Queue the frame for rendering (or render now if pacer is disabled)
-                    m_Pacer->submitFrame(frame);
-                }
-                else if (err == AVERROR(EAGAIN)) {
-                    VIDEO_FRAME_HANDLE handle;
-                    PDECODE_UNIT du;
+    if (readBack) {
+        m_ActiveWndVideoStats.totalReadbackTimeUs += readbackTimeUs;
+        m_ActiveWndVideoStats.readbackFrames++;
+    }
 
-                    // No output data, so let's try to submit more input data,
-                    // while we're waiting for this to frame to come back.
-                    if (LiPollNextVideoFrame(&handle, &du)) {
-                        // FIXME: Handle EAGAIN on avcodec_send_packet() properly?
-                        LiCompleteVideoFrame(handle, submitDecodeUnit(du));
-                    }
-                    else {
-                        // No output data or input data. Let's wait a little bit.
-                        SDL_Delay(2);
-                    }
-                }
-                else {
-                    char errorstring[512];
+    checkClickToPhoton(frame);
+
+    if (m_PipelinedDecode) {
+        m_CodecLock.unlock();
+    }
+
+    // Queue the frame for rendering (or render now if pacer is disabled)
+    FrameTracer::markPacerEnqueue(frame);
+    m_Pacer->submitFrame(frame);
+}
+
+void FFmpegVideoDecoder::requestDecoderReset()
+{
+    SDL_LogError(SDL_LOG_CATEGORY_APPLICATION,
+                 "Resetting decoder due to consistent failure");
 
-                    // FIXME: Should we pop an entry off m_FrameInfoQueue here?
+    // A fresh codec context is usually enough to recover, so let the
+    // session try that first unless it already failed to help.
+    if (!m_DecoderContextRecreated) {
+        SDL_AtomicSet(&m_DecoderContextResetRequested, 1);
+    }
 
-                    av_strerror(err, errorstring, sizeof(errorstring));
-                    SDL_LogWarn(SDL_LOG_CATEGORY_APPLICATION,
-                                "avcodec_receive_frame() failed: %s (frame %d)",
-                                errorstring,
-                                !m_FrameInfoQueue.isEmpty() ? m_FrameInfoQueue.head().frameNumber : -1);
+    SDL_Event event;
+    event.type = SDL_RENDER_DEVICE_RESET;
+    SDL_PushEvent(&event);
 
-                    if (++m_ConsecutiveFailedDecodes == FAILED_DECODES_RESET_THRESHOLD) {
-                        SDL_LogError(SDL_LOG_CATEGORY_APPLICATION,
-                                     "Resetting decoder due to consistent failure");
+    // Don't consume any additional data
+    SDL_AtomicSet(&m_DecoderThreadShouldQuit, 1);
+}
 
-                        SDL_Event event;
-                        event.type = SDL_RENDER_DEVICE_RESET;
-                        SDL_PushEvent(&event);
+void FFmpegVideoDecoder::handleReceiveError(int err)
+{
+    char errorstring[512];
 
-                        // Don't consume any additional data
-                        SDL_AtomicSet(&m_DecoderThreadShouldQuit, 1);
-                    }
+    // The direct decoder reports exactly one result for each frame it accepted,
+    // so its failures must be accounted for like a received frame.
+    // FIXME: Should we pop an entry off m_FrameInfoQueue for FFmpeg too?
+    if (m_DirectDecoder != nullptr && !m_FrameInfoQueue.isEmpty()) {
+        m_FrameInfoQueue.dequeue();
+        m_FramesOut++;
+    }
 
-                    // Just in case the error resulted in the loss of the frame,
-                    // request an IDR frame to reset our decoder state.
-                    LiRequestIdrFrame();
-                }
-            } while (err == AVERROR(EAGAIN) && !SDL_AtomicGet(&m_DecoderThreadShouldQuit));
+    av_strerror(err, errorstring, sizeof(errorstring));
+    SDL_LogWarn(SDL_LOG_CATEGORY_APPLICATION,
+                "avcodec_receive_frame() failed: %s (frame %d)",
+                errorstring,
+                !m_FrameInfoQueue.isEmpty() ? m_FrameInfoQueue.head().frameNumber : -1);
 
-            if (err != 0) {
-                // Free the frame if we failed to submit it
-                av_frame_free(&frame);
-            }
+    if (++m_ConsecutiveFailedDecodes == FAILED_DECODES_RESET_THRESHOLD) {
+        requestDecoderReset();
+    }
+
+    // Just in case the error resulted in the loss of the frame,
+    // request an IDR frame to reset our decoder state.
+    LiRequestIdrFrame();
+}
+
+void FFmpegVideoDecoder::startRecording()
+{
+    QString recordDir = m_Session->getRecordingDirectory();
+    if (!QDir().mkpath(recordDir)) {
+        SDL_LogError(SDL_LOG_CATEGORY_APPLICATION,
+                     "Unable to create recording directory: %s",
+                     recordDir.toUtf8().constData());
+        return;
+    }
+
+    StreamingPreferences::RecordingFormat format = m_Session->getRecordingFormat();
+    const char* extension;
+    switch (format) {
+    case StreamingPreferences::RF_YUV:
+        extension = "yuv";
+        break;
+    case StreamingPreferences::RF_Y4M:
+        extension = "y4m";
+        break;
+    case StreamingPreferences::RF_MP4:
+        extension = "mp4";
+        break;
+    case StreamingPreferences::RF_MKV:
+    case StreamingPreferences::RF_FFV1:
+    default:
+        extension = "mkv";
+        break;
+    }
+
+    QString outputPath = QDir(recordDir).filePath(QString("moonlight_recording_%1.%2")
+                                                  .arg(QDateTime::currentDateTime().toString("yyyyMMdd_hhmmss"))
+                                                  .arg(extension));
+    int fps = m_StreamFps > 0 ? m_StreamFps : 60;
+
+    if (format == StreamingPreferences::RF_MKV || format == StreamingPreferences::RF_MP4) {
+        // Recording the encoded bitstream is much cheaper than recording decoded
+        // frames since it requires no readback, conversion, or large writes.
+        m_BitstreamRecorder = new BitstreamRecorder();
+        if (!m_BitstreamRecorder->initialize(outputPath, m_VideoFormat,
+                                             m_VideoDecoderCtx->width, m_VideoDecoderCtx->height, fps)) {
+            delete m_BitstreamRecorder;
+            m_BitstreamRecorder = nullptr;
+            return;
+        }
+
+        // The recording can't start until the next IDR frame
+        if (m_FramesIn != 0) {
+            LiRequestIdrFrame();
+        }
+    }
+    else {
+        VideoRecorder::OutputType outputType;
+        switch (format) {
+        case StreamingPreferences::RF_Y4M:
+            outputType = VideoRecorder::OT_Y4M;
+            break;
+        case StreamingPreferences::RF_FFV1:
+            outputType = VideoRecorder::OT_LOSSLESS;
+            break;
+        default:
+            outputType = VideoRecorder::OT_RAW;
+            break;
         }
+
+        m_VideoRecorder = new VideoRecorder();
+        if (!m_VideoRecorder->initialize(outputPath,
+                                         m_VideoDecoderCtx->width, m_VideoDecoderCtx->height, fps,
+                                         outputType)) {
+            delete m_VideoRecorder;
+            m_VideoRecorder = nullptr;
+            return;
+        }
+    }
+}
+
+void FFmpegVideoDecoder::stopRecording()
+{
+    if (m_VideoRecorder) {
+        m_VideoRecorder->finalize();
+        delete m_VideoRecorder;
+        m_VideoRecorder = nullptr;
+    }
+
+    if (m_BitstreamRecorder) {
+        m_BitstreamRecorder->finalize();
+        delete m_BitstreamRecorder;
+        m_BitstreamRecorder = nullptr;
     }
+
+    m_RecordingRequested = false;
 }
 
 int FFmpegVideoDecoder::submitDecodeUnit(PDECODE_UNIT du)
@@ -1868,11 +3544,28 @@ int FFmpegVideoDecoder::submitDecodeUnit(PDECODE_UNIT du)
 
     SDL_assert(!m_TestOnly);
 
+    // We pull decode units ourselves, so they don't pass through Session::drSubmitDecodeUnit()
+    if (m_Session != nullptr) {
+        m_Session->captureDecodeUnit(du);
+    }
+
     // If this is the first frame, reject anything that's not an IDR frame
     if (m_FramesIn == 0 && du->frameType != FRAME_TYPE_IDR) {
         return DR_NEED_IDR;
     }
 
+    // Apply any changes to the recording state requested by the user.
+    // If starting fails, we won't retry until the user toggles it again.
+    if (m_Session != nullptr && m_Session->isRecordingRequested() != m_RecordingRequested) {
+        if (!m_RecordingRequested) {
+            startRecording();
+            m_RecordingRequested = true;
+        }
+        else {
+            stopRecording();
+        }
+    }
+
     if (!m_LastFrameNumber) {
         m_ActiveWndVideoStats.measurementStartUs = LiGetMicroseconds();
         m_LastFrameNumber = du->frameNumber;
@@ -1881,28 +3574,105 @@ int FFmpegVideoDecoder::submitDecodeUnit(PDECODE_UNIT du)
         // Any frame number greater than m_LastFrameNumber + 1 represents a dropped frame
         m_ActiveWndVideoStats.networkDroppedFrames += du->frameNumber - (m_LastFrameNumber + 1);
         m_ActiveWndVideoStats.totalFrames += du->frameNumber - (m_LastFrameNumber + 1);
+
+        // We're recovered once a frame after the gap decodes cleanly. The host
+        // either invalidates the lost references (RFI) or sends an IDR frame.
+        if (du->frameNumber > m_LastFrameNumber + 1) {
+            if (m_LossStartUs == 0) {
+                m_LossStartUs = m_LastFrameReceiveTimeUs;
+            }
+            m_LossRecoveryFrameNumber = du->frameNumber;
+        }
+
         m_LastFrameNumber = du->frameNumber;
     }
 
+    m_LastFrameReceiveTimeUs = du->receiveTimeUs;
+
     m_BwTracker.AddBytes(du->fullLength);
 
+    if (m_PerfGraphEnabled) {
+        // Plot each frame's size as the bitrate it would represent if every frame
+        // were that size, which makes IDR frames and rate control swings stand out.
+        int fps = m_StreamFps > 0 ? m_StreamFps : 60;
+        m_Session->getOverlayManager().getPerfGraph().addSample(Overlay::PerfGraphBitrate,
+                                                                     (du->fullLength * 8.0f * fps) / 1000000.0f);
+    }
+
     // Flip stats windows roughly every 500ms
     if (LiGetMicroseconds() > m_ActiveWndVideoStats.measurementStartUs + 500000) {
+        // Input is sent from other threads, so collect its latency for this window now
+        if (m_Session != nullptr) {
+            m_Session->getInputLatencyMonitor().takeWindowStats(&m_ActiveWndVideoStats.inputEvents,
+                                                                &m_ActiveWndVideoStats.totalInputLatencyUs,
+                                                                &m_ActiveWndVideoStats.maxInputLatencyUs);
+        }
+
+        if (m_Pacer != nullptr) {
+            m_Pacer->takeWindowStats(&m_ActiveWndVideoStats);
+        }
+
+        if (m_QualityAnalyzer) {
+            m_QualityAnalyzer->takeWindowStats(&m_ActiveWndVideoStats.qualityFrames,
+                                               &m_ActiveWndVideoStats.totalPsnrDb,
+                                               &m_ActiveWndVideoStats.totalSsim);
+        }
+
+        m_PerfGraphEnabled = m_Session != nullptr && m_Session->getOverlayManager().isOverlayEnabled(Overlay::OverlayPerfGraph);
+
         // Update overlay stats if it's enabled
-        if (Session::get()->getOverlayManager().isOverlayEnabled(Overlay::OverlayDebug)) {
+        if (m_Session != nullptr && m_Session->getOverlayManager().isOverlayEnabled(Overlay::OverlayDebug)) {
             VIDEO_STATS lastTwoWndStats = {};
             addVideoStats(m_LastWndVideoStats, lastTwoWndStats);
             addVideoStats(m_ActiveWndVideoStats, lastTwoWndStats);
 
             stringifyVideoStats(lastTwoWndStats,
-                                Session::get()->getOverlayManager().getOverlayText(Overlay::OverlayDebug),
-                                Session::get()->getOverlayManager().getOverlayMaxTextLength());
-            Session::get()->getOverlayManager().setOverlayTextUpdated(Overlay::OverlayDebug);
+                                m_Session->getOverlayManager().getOverlayText(Overlay::OverlayDebug),
+                                m_Session->getOverlayManager().getOverlayMaxTextLength());
+            m_Session->getOverlayManager().setOverlayTextUpdated(Overlay::OverlayDebug);
 
             // Log metrics to stdout/file
             SDL_LogInfo(SDL_LOG_CATEGORY_APPLICATION,
                         "[METRICS] %s",
-                        Session::get()->getOverlayManager().getOverlayText(Overlay::OverlayDebug));
+                        m_Session->getOverlayManager().getOverlayText(Overlay::OverlayDebug));
+        }
+
+        // Export this window to the metrics sink if one is configured
+        QByteArray launchTimeline;
+        if (m_Session != nullptr && m_Session->getLaunchTimeline().takeSummary(launchTimeline) && m_MetricsSink) {
+            m_MetricsSink->submitLaunchTimeline(launchTimeline);
+        }
+        MetricsServer* metricsServer = m_Session != nullptr ? m_Session->getMetricsServer() : nullptr;
+        if (m_MetricsSink || metricsServer) {
+            VIDEO_STATS windowStats = {};
+            addVideoStats(m_ActiveWndVideoStats, windowStats);
+            windowStats.videoMegabitsPerSec = m_BwTracker.GetAverageMbps();
+            if (m_MetricsSink) {
+                m_MetricsSink->submitStats(windowStats, false);
+            }
+            if (metricsServer) {
+                metricsServer->updateWindow(windowStats,
+                                            m_VideoDecoderCtx->codec->name,
+                                            m_FrontendRenderer->getRendererName());
+            }
+        }
+
+        if (m_Session != nullptr) {
+            m_Session->getSessionReport().addBitrateSample(m_BwTracker.GetAverageMbps(),
+                                                           m_BwTracker.GetPeakMbps(),
+                                                           m_BwTracker.GetWindowSeconds());
+
+            // Let the bitrate controller judge the connection over this window
+            m_Session->getBitrateController().updateWindow(m_ActiveWndVideoStats,
+                                                           m_BwTracker.GetAverageMbps(),
+                                                           m_StreamFps);
+            m_Session->getDecoderLoadMonitor().updateWindow(m_ActiveWndVideoStats);
+
+            // Feed this window's display latency to A/V sync
+            uint64_t displayLatencyUs = getDisplayLatencyUs(m_ActiveWndVideoStats);
+            if (displayLatencyUs != 0) {
+                m_Session->getAvSyncMonitor().updateVideoLatency((uint32_t)displayLatencyUs);
+            }
         }
 
         // Accumulate these values into the global stats
@@ -1926,25 +3696,119 @@ int FFmpegVideoDecoder::submitDecodeUnit(PDECODE_UNIT du)
     m_ActiveWndVideoStats.maxHostProcessingLatency = qMax(m_ActiveWndVideoStats.maxHostProcessingLatency, du->frameHostProcessingLatency);
     m_ActiveWndVideoStats.totalHostProcessingLatency += du->frameHostProcessingLatency;
 
+    if (m_Session != nullptr) {
+        m_Session->getHostClock().addFrame(du);
+    }
+
     m_ActiveWndVideoStats.receivedFrames++;
     m_ActiveWndVideoStats.totalFrames++;
 
+    if (du->frameType == FRAME_TYPE_IDR) {
+        m_ActiveWndVideoStats.idrFrames++;
+        m_ActiveWndVideoStats.totalIdrBytes += du->fullLength;
+        m_ActiveWndVideoStats.maxIdrBytes = qMax(m_ActiveWndVideoStats.maxIdrBytes, (uint32_t)du->fullLength);
+    }
+
+    // The decode unit queue is FIFO, so this is the oldest frame that was
+    // waiting and the rest of the backlog is still queued behind it
+    uint32_t pendingFrames = (uint32_t)LiGetPendingVideoFrames();
+    uint64_t now = LiGetMicroseconds();
+    uint64_t queueAgeUs = now - du->enqueueTimeUs;
+    m_ActiveWndVideoStats.totalDecodeUnitQueueDepth += pendingFrames;
+    m_ActiveWndVideoStats.maxDecodeUnitQueueDepth = qMax(m_ActiveWndVideoStats.maxDecodeUnitQueueDepth, pendingFrames);
+    m_ActiveWndVideoStats.totalDecodeUnitQueueAgeUs += queueAgeUs;
+    m_ActiveWndVideoStats.maxDecodeUnitQueueAgeUs = qMax(m_ActiveWndVideoStats.maxDecodeUnitQueueAgeUs, (uint32_t)queueAgeUs);
+    m_ActiveWndVideoStats.decodeUnitQueueSamples++;
+
+    if (m_DecodeBacklogLimitUs != 0 && queueAgeUs > m_DecodeBacklogLimitUs && pendingFrames != 0) {
+        m_DecodeBacklogLateFrames++;
+    }
+    else {
+        m_DecodeBacklogLateFrames = 0;
+    }
+
+    // If we've stayed too far behind, skip the backlog rather than showing every
+    // frame late. Returning DR_NEED_IDR makes moonlight-common-c flush the queued
+    // frames and drop everything until the IDR frame it requests arrives. We
+    // never skip an IDR frame, since that's where we'd resume anyway.
+    if (m_DecodeBacklogLateFrames >= DECODE_BACKLOG_LATE_FRAMES && du->frameType != FRAME_TYPE_IDR &&
+            (m_LastDecodeBacklogTrimUs == 0 || now - m_LastDecodeBacklogTrimUs >= m_DecodeBacklogTrimIntervalUs)) {
+        // Back off if we keep ending up here
+        if (m_LastDecodeBacklogTrimUs != 0 && now - m_LastDecodeBacklogTrimUs < m_DecodeBacklogTrimIntervalUs * 2) {
+            m_DecodeBacklogTrimIntervalUs = qMin(m_DecodeBacklogTrimIntervalUs * 2, (uint64_t)DECODE_BACKLOG_MAX_TRIM_INTERVAL_US);
+        }
+        else {
+            m_DecodeBacklogTrimIntervalUs = DECODE_BACKLOG_MIN_TRIM_INTERVAL_US;
+        }
+        m_LastDecodeBacklogTrimUs = now;
+        m_DecodeBacklogLateFrames = 0;
+
+        SDL_LogWarn(SDL_LOG_CATEGORY_APPLICATION,
+                    "Skipping %u late frames (frame %d waited %.1f ms to be decoded)",
+                    pendingFrames + 1,
+                    du->frameNumber,
+                    queueAgeUs / 1000.0);
+
+        m_ActiveWndVideoStats.decodeBacklogTrims++;
+        m_ActiveWndVideoStats.decodeBacklogTrimmedFrames += pendingFrames + 1;
+
+        // The IDR frame we're about to request will end this loss
+        if (m_LossStartUs == 0) {
+            m_LossStartUs = du->receiveTimeUs;
+        }
+        m_LossRecoveryFrameNumber = du->frameNumber + 1;
+
+        return DR_NEED_IDR;
+    }
+
     int requiredBufferSize = du->fullLength;
     if (du->frameType == FRAME_TYPE_IDR) {
         // Add some extra space in case we need to do an SPS fixup
         requiredBufferSize += MAX_SPS_EXTRA_SIZE;
     }
 
-    // Ensure the decoder buffer is large enough
-    m_DecodeBuffer.reserve(requiredBufferSize + AV_INPUT_BUFFER_PADDING_SIZE);
+    // Ensure the pooled decode buffers are large enough. Outstanding buffers from
+    // the old pool remain valid until the decoder releases them.
+    if (m_DecodeBufferPool == nullptr || requiredBufferSize + AV_INPUT_BUFFER_PADDING_SIZE > m_DecodeBufferPoolSize) {
+        av_buffer_pool_uninit(&m_DecodeBufferPool);
+
+        // Leave headroom so we don't reallocate for every slightly larger IDR frame
+        m_DecodeBufferPoolSize = qMax(1024 * 1024, (requiredBufferSize + AV_INPUT_BUFFER_PADDING_SIZE) * 3 / 2);
+        m_DecodeBufferPool = av_buffer_pool_init(m_DecodeBufferPoolSize, nullptr);
+        if (m_DecodeBufferPool == nullptr) {
+            SDL_LogError(SDL_LOG_CATEGORY_APPLICATION,
+                         "Failed to allocate decode buffer pool");
+            m_DecodeBufferPoolSize = 0;
+            return DR_NEED_IDR;
+        }
+    }
+
+    AVBufferRef* decodeBuffer = av_buffer_pool_get(m_DecodeBufferPool);
+    if (decodeBuffer == nullptr) {
+        SDL_LogError(SDL_LOG_CATEGORY_APPLICATION,
+                     "Failed to allocate decode buffer");
+        return DR_NEED_IDR;
+    }
 
     int offset = 0;
+    int parameterSetLength = 0;
     while (entry != nullptr) {
-        writeBuffer(entry, offset);
+        writeBuffer(entry, decodeBuffer->data, offset);
+
+        // Parameter sets always precede the picture data in IDR frames
+        if (entry->bufferType != BUFFER_TYPE_PICDATA) {
+            parameterSetLength = offset;
+        }
+
         entry = entry->next;
     }
 
-    m_Pkt->data = reinterpret_cast<uint8_t*>(m_DecodeBuffer.data());
+    // FFmpeg requires the padding to be zeroed
+    memset(&decodeBuffer->data[offset], 0, AV_INPUT_BUFFER_PADDING_SIZE);
+
+    // The packet owns our reference to the buffer until we unref it below
+    m_Pkt->buf = decodeBuffer;
+    m_Pkt->data = decodeBuffer->data;
     m_Pkt->size = offset;
 
     if (du->frameType == FRAME_TYPE_IDR) {
@@ -1955,8 +3819,22 @@ int FFmpegVideoDecoder::submitDecodeUnit(PDECODE_UNIT du)
     }
 
     m_ActiveWndVideoStats.totalReassemblyTimeUs += (du->enqueueTimeUs - du->receiveTimeUs);
+    if (++m_SubmitStatsSampleCounter >= m_StatsSampleInterval) {
+        m_SubmitStatsSampleCounter = 0;
+        latencyHistogramAdd(m_ActiveWndVideoStats.reassemblyTimeHistogram, du->enqueueTimeUs - du->receiveTimeUs);
+    }
+
+    // The writer thread takes a copy, so the decode path only pays for a memcpy
+    if (m_BitstreamRecorder && !m_BitstreamRecorder->submitPacket(m_Pkt->data, m_Pkt->size, parameterSetLength,
+                                                                  du->frameType == FRAME_TYPE_IDR, du->rtpTimestamp)) {
+        m_ActiveWndVideoStats.recorderDroppedFrames++;
+    }
+
+    err = sendPacket(m_Pkt);
+
+    // The decoder holds its own reference if it still needs the data
+    av_buffer_unref(&m_Pkt->buf);
 
-    err = avcodec_send_packet(m_VideoDecoderCtx, m_Pkt);
     if (err < 0) {
         char errorstring[512];
         av_strerror(err, errorstring, sizeof(errorstring));
@@ -1969,16 +3847,14 @@ int FFmpegVideoDecoder::submitDecodeUnit(PDECODE_UNIT du)
         // clearly unhealthy, so let's generate a synthetic reset event to trigger
         // the event loop to destroy and recreate the decoder.
         if (++m_ConsecutiveFailedDecodes == FAILED_DECODES_RESET_THRESHOLD) {
-            SDL_LogError(SDL_LOG_CATEGORY_APPLICATION,
-                         "Resetting decoder due to consistent failure");
-
-            SDL_Event event;
-            event.type = SDL_RENDER_DEVICE_RESET;
-            SDL_PushEvent(&event);
+            requestDecoderReset();
+        }
 
-            // Don't consume any additional data
-            SDL_AtomicSet(&m_DecoderThreadShouldQuit, 1);
+        // The IDR frame we're about to request will end this loss
+        if (m_LossStartUs == 0) {
+            m_LossStartUs = du->receiveTimeUs;
         }
+        m_LossRecoveryFrameNumber = du->frameNumber + 1;
 
         return DR_NEED_IDR;
     }
@@ -1986,6 +3862,12 @@ int FFmpegVideoDecoder::submitDecodeUnit(PDECODE_UNIT du)
     m_FrameInfoQueue.enqueue(*du);
 
     m_FramesIn++;
+
+    // Track how many frames are in flight inside the decoder
+    uint32_t queueDepth = m_FramesIn - m_FramesOut;
+    m_ActiveWndVideoStats.totalDecoderQueueDepth += queueDepth;
+    m_ActiveWndVideoStats.maxDecoderQueueDepth = qMax(m_ActiveWndVideoStats.maxDecoderQueueDepth, queueDepth);
+    m_ActiveWndVideoStats.decoderQueueDepthSamples++;
     return DR_OK;
 }
 
@@ -1,7 +1,10 @@
 #pragma once
 
 #include <functional>
+#include <QByteArray>
+#include <QMutex>
 #include <QQueue>
+#include <QWaitCondition>
 #include <set>
 
 #include "../bandwidth.h"
@@ -9,11 +12,19 @@
 #include "ffmpeg-renderers/renderer.h"
 #include "ffmpeg-renderers/pacer/pacer.h"
 #include "videorecorder.h"
+#include "bitstreamrecorder.h"
+#include "metricssink.h"
+#include "frametracer.h"
+#include "qualityanalyzer.h"
+#include "framepool.h"
 
 extern "C" {
 #include <libavcodec/avcodec.h>
 }
 
+class RendererPreferenceCache;
+class IVTDirectDecoder;
+
 class FFmpegVideoDecoder : public IVideoDecoder {
 public:
     FFmpegVideoDecoder(bool testOnly);
@@ -30,9 +41,18 @@ public:
     virtual void renderFrameOnMainThread() override;
     virtual void setHdrMode(bool enabled) override;
     virtual bool notifyWindowChanged(PWINDOW_STATE_CHANGE_INFO info) override;
+    virtual bool reinitializeDecoder() override;
 
     virtual IFFmpegRenderer* getBackendRenderer();
 
+    IFFmpegRenderer* getFrontendRenderer();
+
+    // Returns the stats for the whole stream so far, including the current window
+    void getVideoStats(VIDEO_STATS& stats);
+
+    // Returns one of the 720p test frames, which decode as a short clip starting with an IDR frame
+    static bool getTestFrame(int videoFormat, const uint8_t** data, int* size);
+
 private:
     bool completeInitialization(const AVCodec* decoder,
                                 enum AVPixelFormat requiredFormat,
@@ -46,6 +66,16 @@ private:
 
     void addVideoStats(VIDEO_STATS& src, VIDEO_STATS& dst);
 
+    uint64_t getDisplayLatencyUs(VIDEO_STATS& stats);
+
+    void checkClickToPhoton(AVFrame* frame);
+
+    void trackFrameMemory(AVFrame* frame);
+
+    void logMemoryUsage(VIDEO_STATS& stats);
+
+    void logBlockedModules(VIDEO_STATS& stats);
+
     bool createFrontendRenderer(PDECODER_PARAMETERS params, bool useAlternateFrontend);
 
     static
@@ -76,13 +106,31 @@ private:
                                IFFmpegRenderer::InitFailureReason* failureReason,
                                std::function<IFFmpegRenderer*()> createRendererFunc);
 
+    int runRendererTrial(const AVCodec* decoder,
+                         enum AVPixelFormat requiredFormat,
+                         PDECODER_PARAMETERS params,
+                         RendererPreferenceCache& preferenceCache,
+                         std::function<IFFmpegRenderer*()> createRendererFunc);
+
+    uint64_t measureRendererTrial(AVFrame* frame);
+
     static IFFmpegRenderer* createHwAccelRenderer(const AVCodecHWConfig* hwDecodeCfg, int pass);
 
     bool initializeRendererInternal(IFFmpegRenderer* renderer, PDECODER_PARAMETERS params);
 
     void reset();
 
-    void writeBuffer(PLENTRY entry, int& offset);
+    bool openDecoderContext(const AVCodec* decoder, PDECODER_PARAMETERS params);
+
+    bool startDecoderThreads();
+
+    void stopDecoderThreads();
+
+    void writeBuffer(PLENTRY entry, uint8_t* buffer, int& offset);
+
+    void startRecording();
+
+    void stopRecording();
 
     static
     enum AVPixelFormat ffGetFormat(AVCodecContext* context,
@@ -92,14 +140,51 @@ private:
 
     static int decoderThreadProcThunk(void* context);
 
+    void pipelinedInputThreadProc();
+
+    void decoderOutputThreadProc();
+
+    static int decoderOutputThreadProcThunk(void* context);
+
+    AVFrame* getOutputFrame();
+
+    int sendPacket(AVPacket* packet);
+
+    int receiveFrame(AVFrame* frame);
+
+    void waitForOutputFrame(int timeoutMs);
+
+    void destroyDirectDecoder();
+
+    void handleDecodedFrame(AVFrame* frame);
+
+    // handleDecodedFrame() in two halves. Only the first touches state that
+    // the pipelined input thread shares under m_CodecLock.
+    void prepareDecodedFrame(AVFrame* frame);
+
+    void presentDecodedFrame(AVFrame* frame);
+
+    void attachHdrMetadata(AVFrame* frame);
+
+    void handleReceiveError(int err);
+
+    void requestDecoderReset();
+
     AVPacket* m_Pkt;
     AVCodecContext* m_VideoDecoderCtx;
     enum AVPixelFormat m_RequiredPixelFormat;
-    QByteArray m_DecodeBuffer;
+    // Reassembled frames are written into refcounted pool buffers so
+    // avcodec_send_packet() can take a reference instead of copying.
+    AVBufferPool* m_DecodeBufferPool;
+    int m_DecodeBufferPoolSize;
     const AVCodecHWConfig* m_HwDecodeCfg;
     IFFmpegRenderer* m_BackendRenderer;
     IFFmpegRenderer* m_FrontendRenderer;
     int m_ConsecutiveFailedDecodes;
+    SDL_atomic_t m_DecoderContextResetRequested; // Set when a new codec context may fix a failed decoder
+    bool m_DecoderContextRecreated; // Cleared by the first frame decoded after reinitializeDecoder()
+    Session* m_Session;
+    DECODER_PARAMETERS m_DecoderParams; // Only valid if not test-only
     Pacer* m_Pacer;
     BandwidthTracker m_BwTracker;
     VIDEO_STATS m_ActiveWndVideoStats;
@@ -110,14 +195,51 @@ private:
     int m_FramesIn;
     int m_FramesOut;
 
+    // Detailed stats sampling for the low-power profile. The counters are
+    // separate because pipelined mode submits and receives on different threads.
+    int m_StatsSampleInterval;
+    int m_SubmitStatsSampleCounter;
+    int m_DecodeStatsSampleCounter;
+
+    // Refreshed with each stats window to keep overlay checks off the per-frame path
+    bool m_PerfGraphEnabled;
+
     int m_LastFrameNumber;
+    uint64_t m_LastFrameReceiveTimeUs;
+    uint64_t m_LossStartUs; // 0 unless we're waiting to recover from a loss
+    int m_LossRecoveryFrameNumber;
+    uint64_t m_DecodeBacklogLimitUs; // 0 to decode every frame no matter how late
+    int m_DecodeBacklogLateFrames;
+    uint64_t m_LastDecodeBacklogTrimUs;
+    uint64_t m_DecodeBacklogTrimIntervalUs;
     int m_StreamFps;
     int m_VideoFormat;
     bool m_NeedsSpsFixup;
+    QByteArray m_FixedUpSpsInput;
+    QByteArray m_FixedUpSpsOutput;
     bool m_TestOnly;
+    bool m_SkipTestFrame; // Set when a cached probe result says the test frame will pass
+    bool m_RunRendererTrial; // Set to time the test frame after it passes (ML_RENDERER_TRIAL)
+    uint64_t m_RendererTrialUs; // Median decode and render time of the last trial, or 0 if it failed
     SDL_Thread* m_DecoderThread;
     SDL_atomic_t m_DecoderThreadShouldQuit;
 
+    // Pipelined mode (DECODER_PIPELINED=1) splits decoding into an input thread
+    // that submits packets and an output thread that receives frames. The codec
+    // context and frame accounting are only touched under m_CodecLock.
+    SDL_Thread* m_DecoderOutputThread;
+    bool m_PipelinedDecode;
+    QMutex m_CodecLock;
+    QWaitCondition m_FramesSubmitted;
+
+    // Replaces the codec context for streamed frames (VT_DIRECT_DECODE=1)
+    IVTDirectDecoder* m_DirectDecoder;
+
+    // HDR side data shared by all frames until the host's metadata changes
+    SS_HDR_METADATA m_HdrMetadata;
+    AVBufferRef* m_MasteringDisplayBuf;
+    AVBufferRef* m_ContentLightBuf;
+
     // Data buffers in the queued DU are not valid
     QQueue<DECODE_UNIT> m_FrameInfoQueue;
 
@@ -134,4 +256,28 @@ private:
 
     // Video recording
     VideoRecorder* m_VideoRecorder;
+    BitstreamRecorder* m_BitstreamRecorder;
+    bool m_RecordingRequested;
+
+    // Structured stats export (VIDEO_METRICS_SINK)
+    MetricsSink* m_MetricsSink;
+
+    // Per-frame latency tracing (VIDEO_FRAME_TRACE)
+    FrameTracer* m_FrameTracer;
+
+    // Live PSNR/SSIM against a reference clip (ML_QUALITY_REFERENCE)
+    QualityAnalyzer* m_QualityAnalyzer;
+
+    // Click-to-photon measurement (ML_CLICK_TO_PHOTON)
+    int m_ClickToPhotonLuma;
+    bool m_ClickToPhotonUnsupported;
+
+    // Shared with Pacer, which returns frames here once they're rendered or dropped
+    FramePool m_FramePool;
+
+    // Decoded frame sizes for the memory usage report (decoder thread only)
+    const uint8_t* m_LastHwFramesContext;
+    int m_DecoderPoolSurfaces;
+    uint64_t m_DecoderPoolBytes;
+    uint64_t m_DecodedFrameBytes;
 };
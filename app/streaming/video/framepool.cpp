@@ -0,0 +1,57 @@
+#include "framepool.h"
+
+FramePool::FramePool(int capacity)
+    : m_Lock(0),
+      m_Capacity(capacity),
+      m_Count(0)
+{
+    m_Frames = new AVFrame*[capacity];
+}
+
+FramePool::~FramePool()
+{
+    while (m_Count > 0) {
+        av_frame_free(&m_Frames[--m_Count]);
+    }
+
+    delete[] m_Frames;
+}
+
+AVFrame* FramePool::get(bool& hit)
+{
+    AVFrame* frame = nullptr;
+
+    SDL_AtomicLock(&m_Lock);
+    if (m_Count > 0) {
+        frame = m_Frames[--m_Count];
+    }
+    SDL_AtomicUnlock(&m_Lock);
+
+    hit = frame != nullptr;
+    if (!hit) {
+        frame = av_frame_alloc();
+    }
+
+    return frame;
+}
+
+void FramePool::release(AVFrame** frame)
+{
+    if (*frame == nullptr) {
+        return;
+    }
+
+    // Drop the buffer references outside of the lock, since
+    // this may free the underlying surfaces back to their pool.
+    av_frame_unref(*frame);
+
+    SDL_AtomicLock(&m_Lock);
+    if (m_Count < m_Capacity) {
+        m_Frames[m_Count++] = *frame;
+        *frame = nullptr;
+    }
+    SDL_AtomicUnlock(&m_Lock);
+
+    // The pool is full
+    av_frame_free(frame);
+}
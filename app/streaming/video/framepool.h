@@ -0,0 +1,30 @@
+#pragma once
+
+#include "SDL_compat.h"
+
+extern "C" {
+#include <libavutil/frame.h>
+}
+
+// Recycles AVFrame shells between the decoder thread and Pacer so that
+// steady-state decoding doesn't hit the allocator for every frame. Only
+// the AVFrame struct itself is pooled. The data buffers are unreferenced
+// on release as usual, and remain managed by the decoder's own pools.
+class FramePool {
+public:
+    FramePool(int capacity = 16);
+    ~FramePool();
+
+    // Returns an empty frame. hit is set to true if it came from the pool.
+    AVFrame* get(bool& hit);
+
+    // Unreferences the frame and returns it to the pool (or frees it if
+    // the pool is full). Callable from any thread.
+    void release(AVFrame** frame);
+
+private:
+    SDL_SpinLock m_Lock;
+    AVFrame** m_Frames;
+    int m_Capacity;
+    int m_Count;
+};
@@ -0,0 +1,298 @@
+#include "frametracer.h"
+#include "streaming/streamutils.h"
+
+#include <QDir>
+
+extern "C" {
+#include <libavutil/buffer.h>
+}
+
+// Thread IDs used to place each pipeline stage on its own track
+#define TRACE_TID_REASSEMBLY 1
+#define TRACE_TID_DECODE 2
+#define TRACE_TID_PACER 3
+#define TRACE_TID_RENDER 4
+#define TRACE_TID_HOST 5
+#define TRACE_TID_END_TO_END 6
+
+// How often the flush thread drains the ring buffer
+#define TRACE_FLUSH_INTERVAL_MS 100
+
+static_assert((FRAME_TRACE_RING_SIZE & (FRAME_TRACE_RING_SIZE - 1)) == 0,
+              "FRAME_TRACE_RING_SIZE must be a power of two");
+
+// Distance between two ring positions, tolerant of wraparound
+static inline int ringDiff(int a, int b)
+{
+    return (int)((unsigned int)a - (unsigned int)b);
+}
+
+FrameTracer::FrameTracer()
+    : m_DequeuePos(0),
+      m_FirstEvent(true),
+      m_Stopping(false),
+      m_FlushThread(nullptr)
+{
+    for (int i = 0; i < FRAME_TRACE_RING_SIZE; i++) {
+        SDL_AtomicSet(&m_Ring[i].sequence, i);
+    }
+    SDL_AtomicSet(&m_EnqueuePos, 0);
+    SDL_AtomicSet(&m_DroppedRecords, 0);
+}
+
+FrameTracer::~FrameTracer()
+{
+    if (m_FlushThread != nullptr) {
+        m_FlushLock.lock();
+        m_Stopping = true;
+        m_FlushLock.unlock();
+        m_FlushWake.wakeAll();
+
+        SDL_WaitThread(m_FlushThread, nullptr);
+    }
+
+    if (m_File.isOpen()) {
+        // Terminate the JSON array. Trace viewers also accept files
+        // without this, so a crash doesn't lose the trace.
+        m_File.write(m_FirstEvent ? "]\n" : "\n]\n");
+        m_File.close();
+
+        int droppedRecords = SDL_AtomicGet(&m_DroppedRecords);
+        if (droppedRecords != 0) {
+            SDL_LogWarn(SDL_LOG_CATEGORY_APPLICATION,
+                        "Frame trace dropped %d records due to ring buffer overflow",
+                        droppedRecords);
+        }
+
+        SDL_LogInfo(SDL_LOG_CATEGORY_APPLICATION,
+                    "Frame trace written to: %s",
+                    qPrintable(QDir::toNativeSeparators(m_File.fileName())));
+    }
+}
+
+FrameTracer* FrameTracer::createFromEnvironment()
+{
+    QString path = qgetenv("VIDEO_FRAME_TRACE");
+    if (path.isEmpty()) {
+        return nullptr;
+    }
+
+    FrameTracer* tracer = new FrameTracer();
+    if (!tracer->initialize(path)) {
+        delete tracer;
+        return nullptr;
+    }
+
+    return tracer;
+}
+
+bool FrameTracer::initialize(const QString& path)
+{
+    m_File.setFileName(path);
+    if (!m_File.open(QIODevice::WriteOnly | QIODevice::Truncate)) {
+        SDL_LogError(SDL_LOG_CATEGORY_APPLICATION,
+                     "Failed to open frame trace file: %s",
+                     qPrintable(m_File.errorString()));
+        return false;
+    }
+
+    // Name the tracks so each stage is labeled in the trace viewer
+    static const char* k_TrackNames[] = { "Reassembly", "Decode", "Pacer", "Render", "Host (estimated)", "End to end (estimated)" };
+    m_File.write("[\n");
+    for (int i = 0; i < (int)SDL_arraysize(k_TrackNames); i++) {
+        char event[256];
+        snprintf(event, sizeof(event),
+                 "%s{\"name\":\"thread_name\",\"ph\":\"M\",\"pid\":1,\"tid\":%d,\"args\":{\"name\":\"%s\"}}",
+                 m_FirstEvent ? "" : ",\n", i + 1, k_TrackNames[i]);
+        m_File.write(event);
+        m_FirstEvent = false;
+    }
+
+    m_FlushThread = SDL_CreateThread(FrameTracer::flushThreadProc, "FrameTraceFlush", this);
+    if (m_FlushThread == nullptr) {
+        SDL_LogError(SDL_LOG_CATEGORY_APPLICATION,
+                     "Failed to create frame trace thread: %s",
+                     SDL_GetError());
+        m_File.close();
+        return false;
+    }
+
+    SDL_LogInfo(SDL_LOG_CATEGORY_APPLICATION,
+                "Tracing per-frame latency to: %s",
+                qPrintable(QDir::toNativeSeparators(path)));
+    return true;
+}
+
+void FrameTracer::attachFrame(AVFrame* frame, const DECODE_UNIT& du, uint64_t decodeCompleteTimeUs)
+{
+    av_buffer_unref(&frame->opaque_ref);
+    frame->opaque_ref = av_buffer_allocz(sizeof(FRAME_TRACE_RECORD));
+    if (frame->opaque_ref == nullptr) {
+        return;
+    }
+
+    PFRAME_TRACE_RECORD record = (PFRAME_TRACE_RECORD)frame->opaque_ref->data;
+    record->frameNumber = du.frameNumber;
+    record->frameType = du.frameType;
+    record->receiveTimeUs = du.receiveTimeUs;
+    record->enqueueTimeUs = du.enqueueTimeUs;
+    record->decodeCompleteTimeUs = decodeCompleteTimeUs;
+}
+
+void FrameTracer::markPacerEnqueue(AVFrame* frame)
+{
+    if (frame->opaque_ref != nullptr) {
+        ((PFRAME_TRACE_RECORD)frame->opaque_ref->data)->pacerEnqueueTimeUs = LiGetMicroseconds();
+    }
+}
+
+void FrameTracer::completeFrame(const AVFrame* frame, uint64_t renderStartTimeUs, uint64_t presentTimeUs, uint64_t captureTimeUs)
+{
+    if (frame->opaque_ref == nullptr) {
+        return;
+    }
+
+    FRAME_TRACE_RECORD record = *(PFRAME_TRACE_RECORD)frame->opaque_ref->data;
+    record.captureTimeUs = captureTimeUs;
+    record.renderStartTimeUs = renderStartTimeUs;
+    record.presentTimeUs = presentTimeUs;
+
+    if (!pushRecord(record)) {
+        SDL_AtomicIncRef(&m_DroppedRecords);
+    }
+}
+
+void FrameTracer::dropFrame(const AVFrame* frame)
+{
+    if (frame->opaque_ref == nullptr) {
+        return;
+    }
+
+    FRAME_TRACE_RECORD record = *(PFRAME_TRACE_RECORD)frame->opaque_ref->data;
+    record.flags |= FRAME_TRACE_FLAG_DROPPED;
+    record.renderStartTimeUs = record.presentTimeUs = LiGetMicroseconds();
+
+    if (!pushRecord(record)) {
+        SDL_AtomicIncRef(&m_DroppedRecords);
+    }
+}
+
+bool FrameTracer::pushRecord(const FRAME_TRACE_RECORD& record)
+{
+    // Frames can complete on the render thread, the V-sync thread, the decoder
+    // thread (for drops), or the main thread, so multiple producers must be able
+    // to claim cells without taking a lock.
+    int pos = SDL_AtomicGet(&m_EnqueuePos);
+    RingCell* cell;
+
+    for (;;) {
+        cell = &m_Ring[pos & (FRAME_TRACE_RING_SIZE - 1)];
+        int diff = ringDiff(SDL_AtomicGet(&cell->sequence), pos);
+        if (diff == 0) {
+            if (SDL_AtomicCAS(&m_EnqueuePos, pos, pos + 1)) {
+                break;
+            }
+        }
+        else if (diff < 0) {
+            // The flush thread hasn't caught up yet
+            return false;
+        }
+
+        pos = SDL_AtomicGet(&m_EnqueuePos);
+    }
+
+    cell->record = record;
+
+    // Publish the cell to the consumer
+    SDL_AtomicSet(&cell->sequence, pos + 1);
+    return true;
+}
+
+bool FrameTracer::popRecord(FRAME_TRACE_RECORD& record)
+{
+    // Only the flush thread consumes, so m_DequeuePos needs no synchronization
+    RingCell* cell = &m_Ring[m_DequeuePos & (FRAME_TRACE_RING_SIZE - 1)];
+    if (ringDiff(SDL_AtomicGet(&cell->sequence), m_DequeuePos + 1) < 0) {
+        return false;
+    }
+
+    record = cell->record;
+
+    // Release the cell for the producer that wraps around to it
+    SDL_AtomicSet(&cell->sequence, m_DequeuePos + FRAME_TRACE_RING_SIZE);
+    m_DequeuePos++;
+    return true;
+}
+
+void FrameTracer::writeSlice(const char* name, int tid, uint64_t startUs, uint64_t endUs, int frameNumber)
+{
+    char event[256];
+
+    // Skip stages that we didn't see a timestamp for
+    if (startUs == 0 || endUs < startUs) {
+        return;
+    }
+
+    snprintf(event, sizeof(event),
+             "%s{\"name\":\"%s\",\"ph\":\"X\",\"pid\":1,\"tid\":%d,\"ts\":%llu,\"dur\":%llu,\"args\":{\"frame\":%d}}",
+             m_FirstEvent ? "" : ",\n", name, tid,
+             (unsigned long long)startUs, (unsigned long long)(endUs - startUs), frameNumber);
+    m_File.write(event);
+    m_FirstEvent = false;
+}
+
+void FrameTracer::writeRecord(const FRAME_TRACE_RECORD& record)
+{
+    writeSlice(record.frameType == FRAME_TYPE_IDR ? "Reassembly (IDR)" : "Reassembly",
+               TRACE_TID_REASSEMBLY, record.receiveTimeUs, record.enqueueTimeUs, record.frameNumber);
+    writeSlice("Decode", TRACE_TID_DECODE,
+               record.enqueueTimeUs, record.decodeCompleteTimeUs, record.frameNumber);
+
+    if (record.flags & FRAME_TRACE_FLAG_DROPPED) {
+        writeSlice("Pacer (dropped)", TRACE_TID_PACER,
+                   record.pacerEnqueueTimeUs, record.renderStartTimeUs, record.frameNumber);
+    }
+    else {
+        writeSlice("Pacer", TRACE_TID_PACER,
+                   record.pacerEnqueueTimeUs, record.renderStartTimeUs, record.frameNumber);
+        writeSlice("Render", TRACE_TID_RENDER,
+                   record.renderStartTimeUs, record.presentTimeUs, record.frameNumber);
+
+        // Capture, encode and transmission on the host, then the whole pipeline
+        writeSlice("Host", TRACE_TID_HOST,
+                   record.captureTimeUs, record.receiveTimeUs, record.frameNumber);
+        writeSlice("Capture to present", TRACE_TID_END_TO_END,
+                   record.captureTimeUs, record.presentTimeUs, record.frameNumber);
+    }
+}
+
+int FrameTracer::flushThreadProc(void* context)
+{
+    FrameTracer* me = (FrameTracer*)context;
+    FRAME_TRACE_RECORD record;
+
+    SDL_SetThreadPriority(SDL_THREAD_PRIORITY_LOW);
+    StreamUtils::placeCurrentThread(StreamUtils::TPC_BACKGROUND);
+
+    for (;;) {
+        // Wait for the next flush interval or until we're told to stop.
+        // Producers never signal us because that would require taking a lock.
+        me->m_FlushLock.lock();
+        if (!me->m_Stopping) {
+            me->m_FlushWake.wait(&me->m_FlushLock, TRACE_FLUSH_INTERVAL_MS);
+        }
+        bool stopping = me->m_Stopping;
+        me->m_FlushLock.unlock();
+
+        while (me->popRecord(record)) {
+            me->writeRecord(record);
+        }
+        me->m_File.flush();
+
+        if (stopping) {
+            break;
+        }
+    }
+
+    return 0;
+}
@@ -0,0 +1,92 @@
+#pragma once
+
+#include <QFile>
+#include <QMutex>
+#include <QWaitCondition>
+
+#include <Limelight.h>
+#include "SDL_compat.h"
+
+extern "C" {
+#include <libavutil/frame.h>
+}
+
+#define FRAME_TRACE_FLAG_DROPPED 0x01
+
+// Pipeline timestamps for a single frame (all in LiGetMicroseconds() time)
+typedef struct _FRAME_TRACE_RECORD {
+    int frameNumber;
+    int frameType;
+    uint32_t flags;
+    uint64_t captureTimeUs;     // estimated by HostClock, 0 if unknown
+    uint64_t receiveTimeUs;
+    uint64_t enqueueTimeUs;
+    uint64_t decodeCompleteTimeUs;
+    uint64_t pacerEnqueueTimeUs;
+    uint64_t renderStartTimeUs;
+    uint64_t presentTimeUs;
+} FRAME_TRACE_RECORD, *PFRAME_TRACE_RECORD;
+
+// Should be a power of two
+#define FRAME_TRACE_RING_SIZE 1024
+
+// Captures per-frame pipeline timestamps and writes them out as a Chrome
+// trace (JSON array format) that can be loaded into chrome://tracing or
+// Perfetto. Partial timestamps travel with each AVFrame in its opaque_ref
+// and the completed record is pushed into a lock-free ring buffer that is
+// drained to disk by a separate thread, so the render path never does I/O.
+class FrameTracer {
+public:
+    // Returns nullptr unless VIDEO_FRAME_TRACE is set to an output path
+    static FrameTracer* createFromEnvironment();
+
+    ~FrameTracer();
+
+    // Called on the decoder thread once the frame has been decoded. The
+    // DU data buffers need not be valid.
+    void attachFrame(AVFrame* frame, const DECODE_UNIT& du, uint64_t decodeCompleteTimeUs);
+
+    // Called on the decoder thread just before the frame is handed to Pacer
+    static void markPacerEnqueue(AVFrame* frame);
+
+    // Called from any thread when the frame leaves the pipeline. Never blocks.
+    // captureTimeUs is when the host captured the frame, or 0 if unknown.
+    void completeFrame(const AVFrame* frame, uint64_t renderStartTimeUs, uint64_t presentTimeUs, uint64_t captureTimeUs);
+
+    // Equivalent to completeFrame() for frames dropped by Pacer
+    void dropFrame(const AVFrame* frame);
+
+private:
+    FrameTracer();
+
+    bool initialize(const QString& path);
+
+    bool pushRecord(const FRAME_TRACE_RECORD& record);
+
+    bool popRecord(FRAME_TRACE_RECORD& record);
+
+    void writeRecord(const FRAME_TRACE_RECORD& record);
+
+    void writeSlice(const char* name, int tid, uint64_t startUs, uint64_t endUs, int frameNumber);
+
+    static int flushThreadProc(void* context);
+
+    // Bounded MPSC queue (Vyukov). Each cell's sequence number tells
+    // producers and the consumer whether the cell is free or filled.
+    struct RingCell {
+        SDL_atomic_t sequence;
+        FRAME_TRACE_RECORD record;
+    };
+    RingCell m_Ring[FRAME_TRACE_RING_SIZE];
+    SDL_atomic_t m_EnqueuePos;
+    int m_DequeuePos;
+    SDL_atomic_t m_DroppedRecords;
+
+    QFile m_File;
+    bool m_FirstEvent;
+
+    QMutex m_FlushLock;
+    QWaitCondition m_FlushWake;
+    bool m_Stopping;
+    SDL_Thread* m_FlushThread;
+};
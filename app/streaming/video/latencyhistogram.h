@@ -0,0 +1,90 @@
+#pragma once
+
+#include "SDL_compat.h"
+
+// Log-linear latency histogram in microseconds. Values below
+// LATENCY_HISTOGRAM_LINEAR_LIMIT get exact buckets, and each power of two
+// above that is split into LATENCY_HISTOGRAM_SUB_BUCKETS equal buckets,
+// bounding the error of reported percentiles to about 6%. Everything is
+// fixed size so histograms can live inside VIDEO_STATS and be zeroed,
+// copied and merged without allocating.
+#define LATENCY_HISTOGRAM_SUB_BUCKET_BITS 3
+#define LATENCY_HISTOGRAM_SUB_BUCKETS (1 << LATENCY_HISTOGRAM_SUB_BUCKET_BITS)
+#define LATENCY_HISTOGRAM_LINEAR_LIMIT (2 * LATENCY_HISTOGRAM_SUB_BUCKETS)
+#define LATENCY_HISTOGRAM_MAX_EXPONENT 21  // ~2 seconds
+#define LATENCY_HISTOGRAM_BUCKETS \
+    (LATENCY_HISTOGRAM_LINEAR_LIMIT + \
+     (LATENCY_HISTOGRAM_MAX_EXPONENT - LATENCY_HISTOGRAM_SUB_BUCKET_BITS - 1) * LATENCY_HISTOGRAM_SUB_BUCKETS + \
+     1) // Overflow bucket
+
+typedef struct _LATENCY_HISTOGRAM {
+    uint32_t count;
+    uint32_t buckets[LATENCY_HISTOGRAM_BUCKETS];
+} LATENCY_HISTOGRAM, *PLATENCY_HISTOGRAM;
+
+static inline int latencyHistogramBucketIndex(uint64_t valueUs)
+{
+    if (valueUs < LATENCY_HISTOGRAM_LINEAR_LIMIT) {
+        return (int)valueUs;
+    }
+    else if (valueUs >= (1ULL << LATENCY_HISTOGRAM_MAX_EXPONENT)) {
+        return LATENCY_HISTOGRAM_BUCKETS - 1;
+    }
+
+    int exponent = SDL_MostSignificantBitIndex32((uint32_t)valueUs);
+    int subBucket = (int)(valueUs >> (exponent - LATENCY_HISTOGRAM_SUB_BUCKET_BITS)) & (LATENCY_HISTOGRAM_SUB_BUCKETS - 1);
+    return LATENCY_HISTOGRAM_LINEAR_LIMIT +
+            (exponent - LATENCY_HISTOGRAM_SUB_BUCKET_BITS - 1) * LATENCY_HISTOGRAM_SUB_BUCKETS +
+            subBucket;
+}
+
+// Returns the midpoint of the range of values covered by a bucket
+static inline double latencyHistogramBucketValue(int index)
+{
+    if (index < LATENCY_HISTOGRAM_LINEAR_LIMIT) {
+        return index;
+    }
+
+    int exponent = (index - LATENCY_HISTOGRAM_LINEAR_LIMIT) / LATENCY_HISTOGRAM_SUB_BUCKETS + LATENCY_HISTOGRAM_SUB_BUCKET_BITS + 1;
+    int subBucket = (index - LATENCY_HISTOGRAM_LINEAR_LIMIT) % LATENCY_HISTOGRAM_SUB_BUCKETS;
+    uint64_t bucketWidth = 1ULL << (exponent - LATENCY_HISTOGRAM_SUB_BUCKET_BITS);
+    return (double)((1ULL << exponent) + subBucket * bucketWidth) + bucketWidth / 2.0;
+}
+
+static inline void latencyHistogramAdd(LATENCY_HISTOGRAM& histogram, uint64_t valueUs)
+{
+    histogram.buckets[latencyHistogramBucketIndex(valueUs)]++;
+    histogram.count++;
+}
+
+static inline void latencyHistogramMerge(const LATENCY_HISTOGRAM& src, LATENCY_HISTOGRAM& dst)
+{
+    for (int i = 0; i < LATENCY_HISTOGRAM_BUCKETS; i++) {
+        dst.buckets[i] += src.buckets[i];
+    }
+    dst.count += src.count;
+}
+
+// Returns the approximate value in microseconds at the given percentile (0-100)
+static inline double latencyHistogramPercentile(const LATENCY_HISTOGRAM& histogram, double percentile)
+{
+    if (histogram.count == 0) {
+        return 0;
+    }
+
+    // Rank of the target sample, rounded up so p100 is the last sample
+    uint64_t targetRank = (uint64_t)(histogram.count * percentile / 100.0 + 0.999999);
+    if (targetRank == 0) {
+        targetRank = 1;
+    }
+
+    uint64_t rank = 0;
+    for (int i = 0; i < LATENCY_HISTOGRAM_BUCKETS; i++) {
+        rank += histogram.buckets[i];
+        if (rank >= targetRank) {
+            return latencyHistogramBucketValue(i);
+        }
+    }
+
+    return latencyHistogramBucketValue(LATENCY_HISTOGRAM_BUCKETS - 1);
+}
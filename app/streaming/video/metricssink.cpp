@@ -0,0 +1,253 @@
+#include "metricssink.h"
+
+#include <QUrl>
+#include <QtEndian>
+
+#ifndef Q_OS_WIN32
+#include <errno.h>
+#include <fcntl.h>
+#include <netdb.h>
+#include <unistd.h>
+#endif
+
+#ifdef Q_OS_WIN32
+#define INVALID_FD INVALID_SOCKET
+#define closesocket_compat closesocket
+#else
+#define INVALID_FD (-1)
+#define closesocket_compat ::close
+#endif
+
+MetricsSink::MetricsSink(bool binary)
+    : m_Binary(binary),
+      m_LoggedWriteError(false),
+#ifndef Q_OS_WIN32
+      m_Fd(-1),
+#endif
+      m_Socket(INVALID_FD),
+      m_AddressLength(0)
+{
+    SDL_zero(m_Address);
+}
+
+MetricsSink::~MetricsSink()
+{
+#ifdef Q_OS_WIN32
+    if (m_File.isOpen()) {
+        m_File.close();
+    }
+#else
+    if (m_Fd >= 0) {
+        ::close(m_Fd);
+    }
+#endif
+
+    if (m_Socket != INVALID_FD) {
+        closesocket_compat(m_Socket);
+    }
+}
+
+MetricsSink* MetricsSink::createFromEnvironment()
+{
+    QString target = qgetenv("VIDEO_METRICS_SINK");
+    if (target.isEmpty()) {
+        return nullptr;
+    }
+
+    QString format = qgetenv("VIDEO_METRICS_FORMAT");
+    bool binary = format.compare("binary", Qt::CaseInsensitive) == 0;
+    if (!format.isEmpty() && !binary && format.compare("ndjson", Qt::CaseInsensitive) != 0) {
+        SDL_LogWarn(SDL_LOG_CATEGORY_APPLICATION,
+                    "Unknown VIDEO_METRICS_FORMAT: %s (using ndjson)",
+                    qPrintable(format));
+    }
+
+    MetricsSink* sink = new MetricsSink(binary);
+    bool ok;
+
+    if (target.startsWith("udp://", Qt::CaseInsensitive)) {
+        QUrl url(target);
+        ok = url.isValid() && url.port() > 0 && sink->openUdp(url.host(), url.port());
+    }
+    else {
+        ok = sink->openFile(target);
+    }
+
+    if (!ok) {
+        SDL_LogError(SDL_LOG_CATEGORY_APPLICATION,
+                     "Unable to open metrics sink: %s",
+                     qPrintable(target));
+        delete sink;
+        return nullptr;
+    }
+
+    SDL_LogInfo(SDL_LOG_CATEGORY_APPLICATION,
+                "Exporting %s video metrics to %s",
+                binary ? "binary" : "NDJSON",
+                qPrintable(target));
+    return sink;
+}
+
+bool MetricsSink::openFile(const QString& path)
+{
+#ifdef Q_OS_WIN32
+    // This also handles named pipes (\\.\pipe\name)
+    m_File.setFileName(path);
+    return m_File.open(QIODevice::WriteOnly | QIODevice::Append | QIODevice::Unbuffered);
+#else
+    // O_NONBLOCK makes opening a FIFO without a reader fail rather than hang,
+    // and ensures we never stall the decoder thread if the reader falls behind.
+    m_Fd = ::open(path.toUtf8().constData(), O_WRONLY | O_CREAT | O_APPEND | O_NONBLOCK, 0644);
+    if (m_Fd < 0) {
+        SDL_LogError(SDL_LOG_CATEGORY_APPLICATION,
+                     "open() failed for metrics sink: %d",
+                     errno);
+        return false;
+    }
+
+    return true;
+#endif
+}
+
+bool MetricsSink::openUdp(const QString& host, int port)
+{
+    struct addrinfo hints, *result;
+    int err;
+
+    SDL_zero(hints);
+    hints.ai_family = AF_UNSPEC;
+    hints.ai_socktype = SOCK_DGRAM;
+
+    err = getaddrinfo(host.toUtf8().constData(), QByteArray::number(port).constData(), &hints, &result);
+    if (err != 0 || result == nullptr) {
+        SDL_LogError(SDL_LOG_CATEGORY_APPLICATION,
+                     "getaddrinfo() failed for metrics sink: %d",
+                     err);
+        return false;
+    }
+
+    m_Socket = socket(result->ai_family, SOCK_DGRAM, IPPROTO_UDP);
+    if (m_Socket != INVALID_FD) {
+        SDL_memcpy(&m_Address, result->ai_addr, result->ai_addrlen);
+        m_AddressLength = (int)result->ai_addrlen;
+
+        // Sends must never block the decoder thread
+#ifdef Q_OS_WIN32
+        u_long nonBlocking = 1;
+        ioctlsocket(m_Socket, FIONBIO, &nonBlocking);
+#else
+        fcntl(m_Socket, F_SETFL, fcntl(m_Socket, F_GETFL) | O_NONBLOCK);
+#endif
+    }
+
+    freeaddrinfo(result);
+    return m_Socket != INVALID_FD;
+}
+
+void MetricsSink::submitLaunchTimeline(const QByteArray& ndjson)
+{
+    if (!m_Binary) {
+        writeRecord(ndjson.constData(), ndjson.size());
+    }
+}
+
+void MetricsSink::writeRecord(const void* data, int length)
+{
+    bool ok;
+
+    if (m_Socket != INVALID_FD) {
+        ok = sendto(m_Socket, (const char*)data, length, 0, (struct sockaddr*)&m_Address, m_AddressLength) == length;
+    }
+    else {
+#ifdef Q_OS_WIN32
+        ok = m_File.write((const char*)data, length) == length;
+#else
+        ok = ::write(m_Fd, data, length) == length;
+#endif
+    }
+
+    // Only log the first failure to avoid spamming the log every 500 ms
+    if (!ok && !m_LoggedWriteError) {
+        SDL_LogWarn(SDL_LOG_CATEGORY_APPLICATION,
+                    "Failed to write video metrics record (dropping)");
+        m_LoggedWriteError = true;
+    }
+}
+
+void MetricsSink::submitStats(const VIDEO_STATS& stats, bool isGlobal)
+{
+    uint64_t nowUs = LiGetMicroseconds();
+
+    if (m_Binary) {
+        METRICS_RECORD record;
+
+        SDL_zero(record);
+        record.magic = qToLittleEndian<quint32>(METRICS_RECORD_MAGIC);
+        record.version = qToLittleEndian<quint16>(METRICS_RECORD_VERSION);
+        record.size = qToLittleEndian<quint16>(sizeof(record));
+        record.isGlobal = isGlobal ? 1 : 0;
+        record.measurementStartUs = qToLittleEndian<quint64>(stats.measurementStartUs);
+        record.measurementEndUs = qToLittleEndian<quint64>(nowUs);
+        record.receivedFrames = qToLittleEndian<quint32>(stats.receivedFrames);
+        record.decodedFrames = qToLittleEndian<quint32>(stats.decodedFrames);
+        record.renderedFrames = qToLittleEndian<quint32>(stats.renderedFrames);
+        record.totalFrames = qToLittleEndian<quint32>(stats.totalFrames);
+        record.networkDroppedFrames = qToLittleEndian<quint32>(stats.networkDroppedFrames);
+        record.pacerDroppedFrames = qToLittleEndian<quint32>(stats.pacerDroppedFrames);
+        record.recorderDroppedFrames = qToLittleEndian<quint32>(stats.recorderDroppedFrames);
+        record.minHostProcessingLatency = qToLittleEndian<quint16>(stats.minHostProcessingLatency);
+        record.maxHostProcessingLatency = qToLittleEndian<quint16>(stats.maxHostProcessingLatency);
+        record.totalHostProcessingLatency = qToLittleEndian<quint32>(stats.totalHostProcessingLatency);
+        record.framesWithHostProcessingLatency = qToLittleEndian<quint32>(stats.framesWithHostProcessingLatency);
+        record.totalReassemblyTimeUs = qToLittleEndian<quint64>(stats.totalReassemblyTimeUs);
+        record.totalDecodeTimeUs = qToLittleEndian<quint64>(stats.totalDecodeTimeUs);
+        record.totalPacerTimeUs = qToLittleEndian<quint64>(stats.totalPacerTimeUs);
+        record.totalRenderTimeUs = qToLittleEndian<quint64>(stats.totalRenderTimeUs);
+        record.lastRtt = qToLittleEndian<quint32>(stats.lastRtt);
+        record.lastRttVariance = qToLittleEndian<quint32>(stats.lastRttVariance);
+        record.videoKilobitsPerSec = qToLittleEndian<quint32>((quint32)(stats.videoMegabitsPerSec * 1000.0));
+        record.totalPresentLatencyUs = qToLittleEndian<quint64>(stats.totalPresentLatencyUs);
+        record.framesWithPresentLatency = qToLittleEndian<quint32>(stats.framesWithPresentLatency);
+        record.idrFrames = qToLittleEndian<quint32>(stats.idrFrames);
+        record.totalIdrBytes = qToLittleEndian<quint64>(stats.totalIdrBytes);
+        record.lossRecoveries = qToLittleEndian<quint32>(stats.lossRecoveries);
+        record.idrLossRecoveries = qToLittleEndian<quint32>(stats.idrLossRecoveries);
+        record.totalLossRecoveryTimeUs = qToLittleEndian<quint64>(stats.totalLossRecoveryTimeUs);
+        record.maxLossRecoveryTimeUs = qToLittleEndian<quint32>(stats.maxLossRecoveryTimeUs);
+
+        writeRecord(&record, sizeof(record));
+    }
+    else {
+        char line[2048];
+        int length = snprintf(line, sizeof(line),
+                              "{\"type\":\"%s\",\"start_us\":%llu,\"end_us\":%llu,"
+                              "\"received_frames\":%u,\"decoded_frames\":%u,\"rendered_frames\":%u,\"total_frames\":%u,"
+                              "\"network_dropped_frames\":%u,\"pacer_dropped_frames\":%u,\"recorder_dropped_frames\":%u,"
+                              "\"received_fps\":%.2f,\"decoded_fps\":%.2f,\"rendered_fps\":%.2f,\"total_fps\":%.2f,"
+                              "\"host_latency_min_ms\":%.1f,\"host_latency_max_ms\":%.1f,\"host_latency_total_ms\":%.1f,\"host_latency_frames\":%u,"
+                              "\"reassembly_time_total_us\":%llu,\"decode_time_total_us\":%llu,"
+                              "\"pacer_time_total_us\":%llu,\"render_time_total_us\":%llu,"
+                              "\"present_latency_total_us\":%llu,\"present_latency_frames\":%u,"
+                              "\"idr_frames\":%u,\"idr_bytes_total\":%llu,"
+                              "\"loss_recoveries\":%u,\"idr_loss_recoveries\":%u,"
+                              "\"loss_recovery_total_us\":%llu,\"loss_recovery_max_us\":%u,"
+                              "\"rtt_ms\":%u,\"rtt_variance_ms\":%u,\"video_mbps\":%.2f}\n",
+                              isGlobal ? "session" : "window",
+                              (unsigned long long)stats.measurementStartUs, (unsigned long long)nowUs,
+                              stats.receivedFrames, stats.decodedFrames, stats.renderedFrames, stats.totalFrames,
+                              stats.networkDroppedFrames, stats.pacerDroppedFrames, stats.recorderDroppedFrames,
+                              stats.receivedFps, stats.decodedFps, stats.renderedFps, stats.totalFps,
+                              stats.minHostProcessingLatency / 10.0, stats.maxHostProcessingLatency / 10.0,
+                              stats.totalHostProcessingLatency / 10.0, stats.framesWithHostProcessingLatency,
+                              (unsigned long long)stats.totalReassemblyTimeUs, (unsigned long long)stats.totalDecodeTimeUs,
+                              (unsigned long long)stats.totalPacerTimeUs, (unsigned long long)stats.totalRenderTimeUs,
+                              (unsigned long long)stats.totalPresentLatencyUs, stats.framesWithPresentLatency,
+                              stats.idrFrames, (unsigned long long)stats.totalIdrBytes,
+                              stats.lossRecoveries, stats.idrLossRecoveries,
+                              (unsigned long long)stats.totalLossRecoveryTimeUs, stats.maxLossRecoveryTimeUs,
+                              stats.lastRtt, stats.lastRttVariance, stats.videoMegabitsPerSec);
+        if (length > 0 && length < (int)sizeof(line)) {
+            writeRecord(line, length);
+        }
+    }
+}
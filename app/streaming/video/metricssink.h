@@ -0,0 +1,96 @@
+#pragma once
+
+#include <QString>
+
+#include "decoder.h"
+
+#ifdef Q_OS_WIN32
+#include <winsock2.h>
+#include <ws2tcpip.h>
+#include <QFile>
+#else
+#include <sys/socket.h>
+#endif
+
+// Compact binary form of a VIDEO_STATS window. All fields are little-endian.
+#pragma pack(push, 1)
+typedef struct _METRICS_RECORD {
+    uint32_t magic;                      // METRICS_RECORD_MAGIC
+    uint16_t version;                    // METRICS_RECORD_VERSION
+    uint16_t size;                       // sizeof(METRICS_RECORD)
+    uint8_t isGlobal;                    // 1 for the end-of-session summary
+    uint8_t reserved[3];
+    uint64_t measurementStartUs;
+    uint64_t measurementEndUs;
+    uint32_t receivedFrames;
+    uint32_t decodedFrames;
+    uint32_t renderedFrames;
+    uint32_t totalFrames;
+    uint32_t networkDroppedFrames;
+    uint32_t pacerDroppedFrames;
+    uint32_t recorderDroppedFrames;
+    uint16_t minHostProcessingLatency;   // 0.1 ms units
+    uint16_t maxHostProcessingLatency;   // 0.1 ms units
+    uint32_t totalHostProcessingLatency; // 0.1 ms units
+    uint32_t framesWithHostProcessingLatency;
+    uint64_t totalReassemblyTimeUs;
+    uint64_t totalDecodeTimeUs;
+    uint64_t totalPacerTimeUs;
+    uint64_t totalRenderTimeUs;
+    uint32_t lastRtt;                    // ms
+    uint32_t lastRttVariance;            // ms
+    uint32_t videoKilobitsPerSec;        // 0 if unknown
+    uint64_t totalPresentLatencyUs;      // Added in version 2
+    uint32_t framesWithPresentLatency;   // Added in version 2
+    uint32_t idrFrames;                  // Added in version 3
+    uint64_t totalIdrBytes;              // Added in version 3
+    uint32_t lossRecoveries;             // Added in version 3
+    uint32_t idrLossRecoveries;          // Added in version 3
+    uint64_t totalLossRecoveryTimeUs;    // Added in version 3
+    uint32_t maxLossRecoveryTimeUs;      // Added in version 3
+} METRICS_RECORD, *PMETRICS_RECORD;
+#pragma pack(pop)
+
+#define METRICS_RECORD_MAGIC 0x5356544D // 'MTVS'
+#define METRICS_RECORD_VERSION 3
+
+// Exports each VIDEO_STATS window as NDJSON or METRICS_RECORD structs to a
+// file, named pipe, or UDP socket. This is independent of the stats overlay
+// so telemetry can be collected without rendering or formatting overlay text.
+class MetricsSink {
+public:
+    // Returns nullptr if VIDEO_METRICS_SINK is not set or can't be opened.
+    // VIDEO_METRICS_SINK is a file/pipe path or udp://host:port, and
+    // VIDEO_METRICS_FORMAT selects "ndjson" (default) or "binary".
+    static MetricsSink* createFromEnvironment();
+
+    ~MetricsSink();
+
+    // Never blocks. Records are dropped if the destination isn't keeping up.
+    void submitStats(const VIDEO_STATS& stats, bool isGlobal);
+
+    // Writes a launch timeline summary line. Only NDJSON sinks receive these.
+    void submitLaunchTimeline(const QByteArray& ndjson);
+
+private:
+    MetricsSink(bool binary);
+
+    bool openFile(const QString& path);
+
+    bool openUdp(const QString& host, int port);
+
+    void writeRecord(const void* data, int length);
+
+    bool m_Binary;
+    bool m_LoggedWriteError;
+
+#ifdef Q_OS_WIN32
+    QFile m_File;
+    SOCKET m_Socket;
+#else
+    int m_Fd;
+    int m_Socket;
+#endif
+    struct sockaddr_storage m_Address;
+    int m_AddressLength;
+};
@@ -8,6 +8,7 @@ OverlayManager::OverlayManager() :
     m_FontData(Path::readDataFile("ModeSeven.ttf"))
 {
     memset(m_Overlays, 0, sizeof(m_Overlays));
+    SDL_AtomicSet(&m_PeakSurfaceKb, 0);
 
     m_Overlays[OverlayType::OverlayDebug].color = {0xD0, 0xD0, 0x00, 0xFF};
     m_Overlays[OverlayType::OverlayDebug].fontSize = 20;
@@ -31,6 +32,7 @@ OverlayManager::OverlayManager() :
 OverlayManager::~OverlayManager()
 {
     for (int i = 0; i < OverlayType::OverlayMax; i++) {
+        freeRenderCache((OverlayType)i);
         if (m_Overlays[i].surface != nullptr) {
             SDL_FreeSurface(m_Overlays[i].surface);
         }
@@ -76,11 +78,22 @@ int OverlayManager::getOverlayFontSize(OverlayType type)
     return m_Overlays[type].fontSize;
 }
 
-SDL_Surface* OverlayManager::getUpdatedOverlaySurface(OverlayType type)
+SDL_Surface* OverlayManager::getUpdatedOverlaySurface(OverlayType type, SDL_Rect* dirtyRect)
 {
     // If a new surface is available, return it. If not, return nullptr.
     // Caller must free the surface on success.
-    return (SDL_Surface*)SDL_AtomicSetPtr((void**)&m_Overlays[type].surface, nullptr);
+    SDL_AtomicLock(&m_Overlays[type].surfaceLock);
+    SDL_Surface* surface = m_Overlays[type].surface;
+    m_Overlays[type].surface = nullptr;
+    if (surface != nullptr) {
+        if (dirtyRect != nullptr) {
+            *dirtyRect = m_Overlays[type].dirtyRect;
+        }
+        SDL_zero(m_Overlays[type].dirtyRect);
+    }
+    SDL_AtomicUnlock(&m_Overlays[type].surfaceLock);
+
+    return surface;
 }
 
 void OverlayManager::setOverlayTextUpdated(OverlayType type)
@@ -118,12 +131,28 @@ void OverlayManager::setOverlayRenderer(IOverlayRenderer* renderer)
     m_Renderer = renderer;
 }
 
+PerfGraph& OverlayManager::getPerfGraph()
+{
+    return m_PerfGraph;
+}
+
 void OverlayManager::notifyOverlayUpdated(OverlayType type)
 {
     if (m_Renderer == nullptr) {
         return;
     }
 
+    // The performance graph has no text. Renderers draw it directly from our samples.
+    if (type == OverlayPerfGraph) {
+        if (m_Overlays[type].enabled) {
+            // Don't show stale samples from the last time the graph was enabled
+            m_PerfGraph.reset();
+        }
+
+        m_Renderer->notifyOverlayUpdated(type);
+        return;
+    }
+
     // Construct the required font to render the overlay
     if (m_Overlays[type].font == nullptr) {
         if (m_FontData.isEmpty()) {
@@ -146,22 +175,216 @@ void OverlayManager::notifyOverlayUpdated(OverlayType type)
         }
     }
 
-    SDL_Surface* oldSurface = (SDL_Surface*)SDL_AtomicSetPtr((void**)&m_Overlays[type].surface, nullptr);
+    SDL_Surface* surface = nullptr;
+    SDL_Rect dirtyRect = {};
+    if (m_Overlays[type].enabled) {
+        surface = renderOverlaySurface(type, &dirtyRect);
+    }
+    else {
+        freeRenderCache(type);
+    }
+
+    SDL_AtomicLock(&m_Overlays[type].surfaceLock);
+    SDL_Surface* oldSurface = m_Overlays[type].surface;
+    m_Overlays[type].surface = surface;
+    if (oldSurface != nullptr) {
+        // The renderer never saw the old surface, so it must also pick up
+        // the regions that changed in it.
+        SDL_UnionRect(&m_Overlays[type].dirtyRect, &dirtyRect, &m_Overlays[type].dirtyRect);
+    }
+    else {
+        m_Overlays[type].dirtyRect = dirtyRect;
+    }
+    SDL_AtomicUnlock(&m_Overlays[type].surfaceLock);
 
     // Free the old surface
     if (oldSurface != nullptr) {
         SDL_FreeSurface(oldSurface);
     }
 
-    if (m_Overlays[type].enabled) {
-        // The _Wrapped variant is required for line breaks to work
-        SDL_Surface* surface = TTF_RenderText_Blended_Wrapped(m_Overlays[type].font,
-                                                              m_Overlays[type].text,
-                                                              m_Overlays[type].color,
-                                                              1024);
-        SDL_AtomicSetPtr((void**)&m_Overlays[type].surface, surface);
+    // Track the peak across all overlays. A concurrent update of another
+    // overlay can at worst make us miss a peak by a single update.
+    m_Overlays[type].surfaceBytes = getSurfaceBytes(type);
+    size_t totalBytes = 0;
+    for (int i = 0; i < OverlayType::OverlayMax; i++) {
+        totalBytes += m_Overlays[i].surfaceBytes;
+    }
+    if ((int)(totalBytes / 1024) > SDL_AtomicGet(&m_PeakSurfaceKb)) {
+        SDL_AtomicSet(&m_PeakSurfaceKb, (int)(totalBytes / 1024));
     }
 
     // Notify the renderer
     m_Renderer->notifyOverlayUpdated(type);
 }
+
+size_t OverlayManager::getSurfaceBytes(OverlayType type)
+{
+    size_t bytes = 0;
+
+    for (const OverlayLine& line : m_RenderCache[type].lines) {
+        if (line.surface != nullptr) {
+            bytes += (size_t)line.surface->pitch * line.surface->h;
+        }
+    }
+
+    SDL_Surface* canvas = m_RenderCache[type].canvas;
+    if (canvas != nullptr) {
+        // At worst, the copy handed to the renderer and the renderer's
+        // texture are alive at the same time as the canvas
+        bytes += (size_t)canvas->pitch * canvas->h * 3;
+    }
+
+    return bytes;
+}
+
+size_t OverlayManager::getPeakSurfaceBytes()
+{
+    return (size_t)SDL_AtomicGet(&m_PeakSurfaceKb) * 1024;
+}
+
+void OverlayManager::freeRenderCache(OverlayType type)
+{
+    for (const OverlayLine& line : m_RenderCache[type].lines) {
+        if (line.surface != nullptr) {
+            SDL_FreeSurface(line.surface);
+        }
+    }
+    m_RenderCache[type].lines.clear();
+
+    if (m_RenderCache[type].canvas != nullptr) {
+        SDL_FreeSurface(m_RenderCache[type].canvas);
+        m_RenderCache[type].canvas = nullptr;
+    }
+}
+
+SDL_Surface* OverlayManager::renderOverlaySurface(OverlayType type, SDL_Rect* dirtyRect)
+{
+    TTF_Font* font = m_Overlays[type].font;
+    QVector<OverlayLine>& lines = m_RenderCache[type].lines;
+    QList<QByteArray> newLines = QByteArray(m_Overlays[type].text).split('\n');
+
+    // Ignore the empty line after a trailing newline
+    if (!newLines.isEmpty() && newLines.last().isEmpty()) {
+        newLines.removeLast();
+    }
+
+    // The canvas can be patched in place as long as every line keeps its
+    // position. Otherwise, we'll start over with a new canvas.
+    bool relayout = newLines.size() != lines.size();
+    if (relayout) {
+        for (const OverlayLine& line : lines) {
+            if (line.surface != nullptr) {
+                SDL_FreeSurface(line.surface);
+            }
+        }
+        lines.clear();
+        lines.resize(newLines.size());
+    }
+
+    // Rasterize only the lines that changed
+    QVector<int> changedLines;
+    QVector<int> oldWidths;
+    int y = 0;
+    int maxWidth = 0;
+    for (int i = 0; i < newLines.size(); i++) {
+        OverlayLine& line = lines[i];
+
+        if (relayout || line.text != newLines[i]) {
+            oldWidths.append(line.surface != nullptr ? line.surface->w : 0);
+            changedLines.append(i);
+
+            if (line.surface != nullptr) {
+                SDL_FreeSurface(line.surface);
+                line.surface = nullptr;
+            }
+
+            line.text = newLines[i];
+            if (!line.text.isEmpty()) {
+                // The _Wrapped variant lets a line too long for the overlay wrap
+                line.surface = TTF_RenderText_Blended_Wrapped(font,
+                                                              line.text.constData(),
+                                                              m_Overlays[type].color,
+                                                              1024);
+            }
+
+            int height = line.surface != nullptr ?
+                        SDL_max(line.surface->h, TTF_FontLineSkip(font)) : TTF_FontLineSkip(font);
+            if (line.height != height) {
+                relayout = true;
+            }
+            line.height = height;
+        }
+
+        // A line that changed height moves all of the lines below it
+        if (line.y != y) {
+            relayout = true;
+        }
+        line.y = y;
+
+        if (line.surface != nullptr) {
+            maxWidth = SDL_max(maxWidth, line.surface->w);
+        }
+        y += line.height;
+    }
+
+    int totalHeight = y;
+    if (maxWidth == 0) {
+        // Nothing to draw
+        freeRenderCache(type);
+        return nullptr;
+    }
+
+    // The canvas is allowed to be wider than necessary to avoid reallocating
+    // it every time the longest line changes length. The extra area is transparent.
+    SDL_Surface* canvas = m_RenderCache[type].canvas;
+    if (relayout || canvas == nullptr || canvas->w < maxWidth || canvas->h != totalHeight) {
+        if (canvas != nullptr) {
+            SDL_FreeSurface(canvas);
+        }
+
+        canvas = m_RenderCache[type].canvas =
+                SDL_CreateRGBSurfaceWithFormat(0, maxWidth, totalHeight, 32, SDL_PIXELFORMAT_ARGB8888);
+        if (canvas == nullptr) {
+            SDL_LogError(SDL_LOG_CATEGORY_APPLICATION,
+                         "SDL_CreateRGBSurfaceWithFormat() failed: %s",
+                         SDL_GetError());
+            freeRenderCache(type);
+            return nullptr;
+        }
+
+        // Every line must be drawn on the new canvas
+        changedLines.clear();
+        oldWidths.clear();
+        for (int i = 0; i < lines.size(); i++) {
+            changedLines.append(i);
+            oldWidths.append(canvas->w);
+        }
+        SDL_FillRect(canvas, nullptr, 0);
+    }
+
+    SDL_zerop(dirtyRect);
+    for (int i = 0; i < changedLines.size(); i++) {
+        const OverlayLine& line = lines[changedLines[i]];
+
+        // Clear the old line, including any area it covered beyond the new line
+        SDL_Rect lineRect;
+        lineRect.x = 0;
+        lineRect.y = line.y;
+        lineRect.w = SDL_min(canvas->w,
+                             SDL_max(oldWidths[i], line.surface != nullptr ? line.surface->w : 0));
+        lineRect.h = line.height;
+        SDL_FillRect(canvas, &lineRect, 0);
+
+        if (line.surface != nullptr) {
+            // Copy the line as-is, including alpha, rather than blending it
+            SDL_Rect dstRect = { 0, line.y, line.surface->w, line.surface->h };
+            SDL_SetSurfaceBlendMode(line.surface, SDL_BLENDMODE_NONE);
+            SDL_BlitSurface(line.surface, nullptr, canvas, &dstRect);
+        }
+
+        SDL_UnionRect(dirtyRect, &lineRect, dirtyRect);
+    }
+
+    // The canvas is retained for the next update, so hand out a copy
+    return SDL_ConvertSurfaceFormat(canvas, SDL_PIXELFORMAT_ARGB8888, 0);
+}
@@ -1,15 +1,19 @@
 #pragma once
 
 #include <QString>
+#include <QVector>
 
 #include "SDL_compat.h"
 #include <SDL_ttf.h>
 
+#include "perfgraph.h"
+
 namespace Overlay {
 
 enum OverlayType {
     OverlayDebug,
     OverlayStatusUpdate,
+    OverlayPerfGraph, // Drawn by renderers from PerfGraph data rather than a surface
     OverlayMax
 };
 
@@ -35,24 +39,60 @@ public:
     void setOverlayState(OverlayType type, bool enabled);
     SDL_Color getOverlayColor(OverlayType type);
     int getOverlayFontSize(OverlayType type);
-    SDL_Surface* getUpdatedOverlaySurface(OverlayType type);
+
+    // If dirtyRect is provided, it receives the region of the surface that
+    // changed since the previous surface returned for this overlay type. If
+    // the caller still has the previous surface's contents and the dimensions
+    // match, it only needs to upload that region.
+    SDL_Surface* getUpdatedOverlaySurface(OverlayType type, SDL_Rect* dirtyRect = nullptr);
 
     void setOverlayRenderer(IOverlayRenderer* renderer);
 
+    PerfGraph& getPerfGraph();
+
+    // Returns the most memory used by overlay surfaces at once, including
+    // the copies handed to the renderer for upload
+    size_t getPeakSurfaceBytes();
+
 private:
     void notifyOverlayUpdated(OverlayType type);
+    SDL_Surface* renderOverlaySurface(OverlayType type, SDL_Rect* dirtyRect);
+    void freeRenderCache(OverlayType type);
+    size_t getSurfaceBytes(OverlayType type);
 
     struct {
         bool enabled;
         int fontSize;
         SDL_Color color;
-        char text[1024];
+        char text[4096];
 
         TTF_Font* font;
+
+        // Protects surface and dirtyRect, which are handed off to the renderer
+        SDL_SpinLock surfaceLock;
         SDL_Surface* surface;
+        SDL_Rect dirtyRect;
+
+        // Memory used by this overlay's surfaces after its last update
+        size_t surfaceBytes;
     } m_Overlays[OverlayMax];
+
+    // Rasterized lines of the last overlay text, so only lines that changed
+    // need to be re-rendered and copied into the canvas
+    struct OverlayLine {
+        QByteArray text;
+        SDL_Surface* surface = nullptr; // nullptr for empty lines
+        int y = 0;
+        int height = 0;
+    };
+    struct {
+        QVector<OverlayLine> lines;
+        SDL_Surface* canvas = nullptr;
+    } m_RenderCache[OverlayMax];
     IOverlayRenderer* m_Renderer;
+    SDL_atomic_t m_PeakSurfaceKb;
     QByteArray m_FontData;
+    PerfGraph m_PerfGraph;
 };
 
 }
@@ -0,0 +1,124 @@
+#include "perfgraph.h"
+#include "streaming/streamutils.h"
+
+using namespace Overlay;
+
+#define PERF_GRAPH_BAR_WIDTH 2
+#define PERF_GRAPH_PANEL_HEIGHT 48
+#define PERF_GRAPH_PANEL_SPACING 4
+
+static const uint32_t k_Palette[PerfGraphColorMax] = {
+    0xA0000000, // PerfGraphColorBackground
+    0xFF00D000, // PerfGraphColorFrameTime
+    0xFFD0D000, // PerfGraphColorDecodeTime
+    0xFF00A0FF, // PerfGraphColorBitrate
+};
+
+// Each panel is scaled to fit its largest sample, but never
+// zooms in beyond these values to keep small jitter readable
+static const float k_MinimumScale[PerfGraphSeriesMax] = {
+    33.3f, // PerfGraphFrameTime
+    16.7f, // PerfGraphDecodeTime
+    20.0f, // PerfGraphBitrate
+};
+
+PerfGraph::PerfGraph()
+    : m_Lock(0)
+{
+    SDL_zero(m_Series);
+}
+
+void PerfGraph::addSample(PerfGraphSeries series, float value)
+{
+    SDL_AtomicLock(&m_Lock);
+    m_Series[series].samples[m_Series[series].nextSample] = value;
+    m_Series[series].nextSample = (m_Series[series].nextSample + 1) % PERF_GRAPH_SAMPLES;
+    m_Series[series].sampleCount = SDL_min(m_Series[series].sampleCount + 1, PERF_GRAPH_SAMPLES);
+    SDL_AtomicUnlock(&m_Lock);
+}
+
+void PerfGraph::reset()
+{
+    SDL_AtomicLock(&m_Lock);
+    SDL_zero(m_Series);
+    SDL_AtomicUnlock(&m_Lock);
+}
+
+const uint32_t* PerfGraph::getPaletteData()
+{
+    return k_Palette;
+}
+
+int PerfGraph::buildRects(PERF_GRAPH_RECT* rects, int viewportWidth, int viewportHeight)
+{
+    float samples[PerfGraphSeriesMax][PERF_GRAPH_SAMPLES];
+    int sampleCounts[PerfGraphSeriesMax];
+
+    // Copy the samples out in chronological order so we hold the lock briefly
+    SDL_AtomicLock(&m_Lock);
+    for (int i = 0; i < PerfGraphSeriesMax; i++) {
+        sampleCounts[i] = m_Series[i].sampleCount;
+        int firstSample = (m_Series[i].nextSample - sampleCounts[i] + PERF_GRAPH_SAMPLES) % PERF_GRAPH_SAMPLES;
+        for (int j = 0; j < sampleCounts[i]; j++) {
+            samples[i][j] = m_Series[i].samples[(firstSample + j) % PERF_GRAPH_SAMPLES];
+        }
+    }
+    SDL_AtomicUnlock(&m_Lock);
+
+    const float panelWidth = PERF_GRAPH_SAMPLES * PERF_GRAPH_BAR_WIDTH;
+    const float panelX = SDL_max(0.0f, viewportWidth - panelWidth);
+    int rectCount = 0;
+
+    for (int i = 0; i < PerfGraphSeriesMax; i++) {
+        // Stack the panels downwards from the top of the viewport
+        float panelY = viewportHeight - (i + 1) * PERF_GRAPH_PANEL_HEIGHT - i * PERF_GRAPH_PANEL_SPACING;
+
+        rects[rectCount].rect = { panelX, panelY, panelWidth, PERF_GRAPH_PANEL_HEIGHT };
+        rects[rectCount].color = PerfGraphColorBackground;
+        rectCount++;
+
+        float scale = k_MinimumScale[i];
+        for (int j = 0; j < sampleCounts[i]; j++) {
+            scale = SDL_max(scale, samples[i][j]);
+        }
+
+        // The newest sample is drawn at the right edge
+        float barX = panelX + (PERF_GRAPH_SAMPLES - sampleCounts[i]) * PERF_GRAPH_BAR_WIDTH;
+        for (int j = 0; j < sampleCounts[i]; j++, barX += PERF_GRAPH_BAR_WIDTH) {
+            float barHeight = SDL_max(1.0f, (samples[i][j] / scale) * PERF_GRAPH_PANEL_HEIGHT);
+
+            rects[rectCount].rect = { barX, panelY, PERF_GRAPH_BAR_WIDTH, barHeight };
+            rects[rectCount].color = (PerfGraphColor)(PerfGraphColorFrameTime + i);
+            rectCount++;
+        }
+    }
+
+    SDL_assert(rectCount <= PERF_GRAPH_MAX_RECTS);
+    return rectCount;
+}
+
+int PerfGraph::buildVertices(PERF_GRAPH_VERTEX* verts, int viewportWidth, int viewportHeight)
+{
+    PERF_GRAPH_RECT rects[PERF_GRAPH_MAX_RECTS];
+    int rectCount = buildRects(rects, viewportWidth, viewportHeight);
+    int vertexCount = 0;
+
+    for (int i = 0; i < rectCount; i++) {
+        // Convert screen space to normalized device coordinates
+        SDL_FRect rect = rects[i].rect;
+        StreamUtils::screenSpaceToNormalizedDeviceCoords(&rect, viewportWidth, viewportHeight);
+
+        float x = rect.x, y = rect.y, w = rect.w, h = rect.h;
+        float u = getPaletteU(rects[i].color);
+
+        // Same winding as the overlay quads: {0, 1, 2, 3, 2, 1}
+        verts[vertexCount++] = { x, y, u, 0.5f };
+        verts[vertexCount++] = { x, y + h, u, 0.5f };
+        verts[vertexCount++] = { x + w, y, u, 0.5f };
+        verts[vertexCount++] = { x + w, y + h, u, 0.5f };
+        verts[vertexCount++] = { x + w, y, u, 0.5f };
+        verts[vertexCount++] = { x, y + h, u, 0.5f };
+    }
+
+    return vertexCount;
+}
@@ -0,0 +1,85 @@
+#pragma once
+
+#include "SDL_compat.h"
+
+namespace Overlay {
+
+enum PerfGraphSeries {
+    PerfGraphFrameTime,  // Milliseconds between rendered frames
+    PerfGraphDecodeTime, // Milliseconds
+    PerfGraphBitrate,    // Size of each frame in Mbps at the stream frame rate
+    PerfGraphSeriesMax
+};
+
+// Number of samples kept for each series
+#define PERF_GRAPH_SAMPLES 180
+
+// The graph is made of solid colored rectangles. Each rectangle samples
+// a single texel of a small palette texture, so renderers can draw it with
+// the same textured quad shaders that they use for the text overlays.
+enum PerfGraphColor {
+    PerfGraphColorBackground,
+    PerfGraphColorFrameTime,
+    PerfGraphColorDecodeTime,
+    PerfGraphColorBitrate,
+    PerfGraphColorMax
+};
+
+typedef struct _PERF_GRAPH_RECT {
+    // Screen space with the origin in the lower-left corner
+    SDL_FRect rect;
+    PerfGraphColor color;
+} PERF_GRAPH_RECT, *PPERF_GRAPH_RECT;
+
+// Layout compatible with the overlay vertex formats of the D3D11 and EGL renderers
+typedef struct _PERF_GRAPH_VERTEX {
+    // Normalized device coordinates
+    float x, y;
+    float u, v;
+} PERF_GRAPH_VERTEX, *PPERF_GRAPH_VERTEX;
+
+// Maximum number of rects returned by PerfGraph::buildRects()
+#define PERF_GRAPH_MAX_RECTS (PerfGraphSeriesMax * (PERF_GRAPH_SAMPLES + 1))
+
+// Maximum number of vertices returned by PerfGraph::buildVertices()
+#define PERF_GRAPH_MAX_VERTICES (PERF_GRAPH_MAX_RECTS * 6)
+
+class PerfGraph
+{
+public:
+    PerfGraph();
+
+    // May be called from any thread
+    void addSample(PerfGraphSeries series, float value);
+
+    void reset();
+
+    // Fills rects (which must have room for PERF_GRAPH_MAX_RECTS) with the
+    // graph laid out in the top-right corner of the viewport. Returns the
+    // number of rects written.
+    int buildRects(PERF_GRAPH_RECT* rects, int viewportWidth, int viewportHeight);
+
+    // Equivalent to buildRects(), but emits a triangle list for renderers
+    // that draw the graph as a single vertex buffer. verts must have room
+    // for PERF_GRAPH_MAX_VERTICES. Returns the number of vertices written.
+    int buildVertices(PERF_GRAPH_VERTEX* verts, int viewportWidth, int viewportHeight);
+
+    // Palette texture data in SDL_PIXELFORMAT_ARGB8888, PerfGraphColorMax texels wide and 1 texel high
+    static const uint32_t* getPaletteData();
+
+    // Returns the texture coordinate of the center of a palette texel
+    static float getPaletteU(PerfGraphColor color)
+    {
+        return (color + 0.5f) / PerfGraphColorMax;
+    }
+
+private:
+    SDL_SpinLock m_Lock;
+    struct {
+        float samples[PERF_GRAPH_SAMPLES];
+        int nextSample;
+        int sampleCount;
+    } m_Series[PerfGraphSeriesMax];
+};
+
+}
@@ -0,0 +1,547 @@
+#include "qualityanalyzer.h"
+#include "streaming/streamutils.h"
+
+#include <QFile>
+
+#include <math.h>
+
+extern "C" {
+#include <libavcodec/avcodec.h>
+#include <libavformat/avformat.h>
+#include <libavutil/hwcontext.h>
+#include <libavutil/pixdesc.h>
+}
+
+#if defined(__SSE2__) || defined(_M_X64) || (defined(_M_IX86_FP) && _M_IX86_FP >= 2)
+#include <emmintrin.h>
+#define QUALITY_USE_SSE2
+#elif defined(__ARM_NEON) || defined(__ARM_NEON__) || defined(_M_ARM64)
+#include <arm_neon.h>
+#define QUALITY_USE_NEON
+#endif
+
+// The analysis plane is this wide, with the height following the reference
+// clip's aspect ratio. It must be a multiple of 16 for the SIMD kernels.
+#define QUALITY_ANALYSIS_WIDTH 320
+
+// 15 seconds at 60 FPS, which is about 53 MB of luma at 320x184
+#define QUALITY_MAX_REFERENCE_FRAMES 900
+
+// Reference frames searched on each side of the expected position
+#define QUALITY_SEARCH_RADIUS 2
+
+// Frames between full searches, to catch the host seeking or restarting the clip
+#define QUALITY_RESYNC_INTERVAL 600
+
+#define QUALITY_BLOCK_SIZE 8
+
+// PSNR of identical frames, rather than infinity
+#define QUALITY_MAX_PSNR_DB 100.0
+
+// Standard SSIM stabilizers for 8-bit samples: (0.01 * 255)^2 and (0.03 * 255)^2
+#define SSIM_C1 6.5025
+#define SSIM_C2 58.5225
+
+namespace {
+
+struct BlockSums {
+    uint32_t a;
+    uint32_t b;
+    uint32_t aa;
+    uint32_t bb;
+    uint32_t ab;
+};
+
+// Sum of absolute differences over length bytes (a multiple of 16)
+uint32_t sumAbsDiff(const uint8_t* a, const uint8_t* b, int length)
+{
+#if defined(QUALITY_USE_SSE2)
+    __m128i total = _mm_setzero_si128();
+    for (int i = 0; i < length; i += 16) {
+        __m128i va = _mm_loadu_si128((const __m128i*)&a[i]);
+        __m128i vb = _mm_loadu_si128((const __m128i*)&b[i]);
+        total = _mm_add_epi64(total, _mm_sad_epu8(va, vb));
+    }
+    return (uint32_t)(_mm_cvtsi128_si32(total) + _mm_cvtsi128_si32(_mm_srli_si128(total, 8)));
+#elif defined(QUALITY_USE_NEON)
+    uint32x4_t total = vdupq_n_u32(0);
+    for (int i = 0; i < length; i += 16) {
+        uint8x16_t va = vld1q_u8(&a[i]);
+        uint8x16_t vb = vld1q_u8(&b[i]);
+        uint16x8_t diff = vabdl_u8(vget_low_u8(va), vget_low_u8(vb));
+        diff = vabal_u8(diff, vget_high_u8(va), vget_high_u8(vb));
+        total = vpadalq_u16(total, diff);
+    }
+    return vgetq_lane_u32(total, 0) + vgetq_lane_u32(total, 1) +
+           vgetq_lane_u32(total, 2) + vgetq_lane_u32(total, 3);
+#else
+    uint32_t total = 0;
+    for (int i = 0; i < length; i++) {
+        total += (uint32_t)abs(a[i] - b[i]);
+    }
+    return total;
+#endif
+}
+
+// Sums, squares and cross products of an 8x8 block, from which both
+// the squared error and the SSIM terms are derived
+void blockSums(const uint8_t* a, const uint8_t* b, int stride, BlockSums* sums)
+{
+#if defined(QUALITY_USE_SSE2)
+    const __m128i zero = _mm_setzero_si128();
+    __m128i sumA = zero, sumB = zero, sumAA = zero, sumBB = zero, sumAB = zero;
+    for (int y = 0; y < QUALITY_BLOCK_SIZE; y++) {
+        __m128i va = _mm_unpacklo_epi8(_mm_loadl_epi64((const __m128i*)&a[y * stride]), zero);
+        __m128i vb = _mm_unpacklo_epi8(_mm_loadl_epi64((const __m128i*)&b[y * stride]), zero);
+
+        // 8 rows of 255 still fit in each 16-bit lane
+        sumA = _mm_add_epi16(sumA, va);
+        sumB = _mm_add_epi16(sumB, vb);
+        sumAA = _mm_add_epi32(sumAA, _mm_madd_epi16(va, va));
+        sumBB = _mm_add_epi32(sumBB, _mm_madd_epi16(vb, vb));
+        sumAB = _mm_add_epi32(sumAB, _mm_madd_epi16(va, vb));
+    }
+
+    const __m128i ones = _mm_set1_epi16(1);
+    sumA = _mm_madd_epi16(sumA, ones);
+    sumB = _mm_madd_epi16(sumB, ones);
+
+    uint32_t lanes[4];
+    auto horizontalSum = [&lanes](__m128i v) {
+        _mm_storeu_si128((__m128i*)lanes, v);
+        return lanes[0] + lanes[1] + lanes[2] + lanes[3];
+    };
+    sums->a = horizontalSum(sumA);
+    sums->b = horizontalSum(sumB);
+    sums->aa = horizontalSum(sumAA);
+    sums->bb = horizontalSum(sumBB);
+    sums->ab = horizontalSum(sumAB);
+#elif defined(QUALITY_USE_NEON)
+    uint16x8_t sumA = vdupq_n_u16(0), sumB = vdupq_n_u16(0);
+    uint32x4_t sumAA = vdupq_n_u32(0), sumBB = vdupq_n_u32(0), sumAB = vdupq_n_u32(0);
+    for (int y = 0; y < QUALITY_BLOCK_SIZE; y++) {
+        uint16x8_t va = vmovl_u8(vld1_u8(&a[y * stride]));
+        uint16x8_t vb = vmovl_u8(vld1_u8(&b[y * stride]));
+
+        sumA = vaddq_u16(sumA, va);
+        sumB = vaddq_u16(sumB, vb);
+        sumAA = vmlal_u16(sumAA, vget_low_u16(va), vget_low_u16(va));
+        sumAA = vmlal_u16(sumAA, vget_high_u16(va), vget_high_u16(va));
+        sumBB = vmlal_u16(sumBB, vget_low_u16(vb), vget_low_u16(vb));
+        sumBB = vmlal_u16(sumBB, vget_high_u16(vb), vget_high_u16(vb));
+        sumAB = vmlal_u16(sumAB, vget_low_u16(va), vget_low_u16(vb));
+        sumAB = vmlal_u16(sumAB, vget_high_u16(va), vget_high_u16(vb));
+    }
+
+    auto horizontalSum = [](uint32x4_t v) {
+        return vgetq_lane_u32(v, 0) + vgetq_lane_u32(v, 1) +
+               vgetq_lane_u32(v, 2) + vgetq_lane_u32(v, 3);
+    };
+    sums->a = horizontalSum(vpaddlq_u16(sumA));
+    sums->b = horizontalSum(vpaddlq_u16(sumB));
+    sums->aa = horizontalSum(sumAA);
+    sums->bb = horizontalSum(sumBB);
+    sums->ab = horizontalSum(sumAB);
+#else
+    SDL_zerop(sums);
+    for (int y = 0; y < QUALITY_BLOCK_SIZE; y++) {
+        for (int x = 0; x < QUALITY_BLOCK_SIZE; x++) {
+            uint32_t va = a[y * stride + x];
+            uint32_t vb = b[y * stride + x];
+            sums->a += va;
+            sums->b += vb;
+            sums->aa += va * va;
+            sums->bb += vb * vb;
+            sums->ab += va * vb;
+        }
+    }
+#endif
+}
+
+}
+
+QualityAnalyzer* QualityAnalyzer::createFromEnvironment()
+{
+    QString referencePath = QString::fromLocal8Bit(qgetenv("ML_QUALITY_REFERENCE"));
+    if (referencePath.isEmpty()) {
+        return nullptr;
+    }
+
+    if (!QFile::exists(referencePath)) {
+        SDL_LogError(SDL_LOG_CATEGORY_APPLICATION,
+                     "Quality reference clip does not exist: %s",
+                     qPrintable(referencePath));
+        return nullptr;
+    }
+
+    QualityAnalyzer* analyzer = new QualityAnalyzer(referencePath);
+    if (analyzer->m_AnalyzerThread == nullptr) {
+        delete analyzer;
+        return nullptr;
+    }
+
+    return analyzer;
+}
+
+QualityAnalyzer::QualityAnalyzer(const QString& referencePath)
+    : m_ReferencePath(referencePath),
+      m_AnalyzerThread(nullptr),
+      m_Width(0),
+      m_Height(0),
+      m_ReferenceFrameCount(0),
+      m_ReferenceFps(0),
+      m_SwsContext(nullptr),
+      m_TransferFrame(nullptr),
+      m_MatchedIndex(-1),
+      m_MatchedPts(AV_NOPTS_VALUE),
+      m_FramesSinceResync(0),
+      m_TransferFailed(false),
+      m_PendingFrame(nullptr),
+      m_Stopping(false),
+      m_WindowFrames(0),
+      m_WindowTotalPsnrDb(0),
+      m_WindowTotalSsim(0)
+{
+    m_AnalyzerThread = SDL_CreateThread(QualityAnalyzer::analyzerThreadProc, "QualityAnalyzer", this);
+    if (m_AnalyzerThread == nullptr) {
+        SDL_LogError(SDL_LOG_CATEGORY_APPLICATION,
+                     "Failed to create quality analyzer thread: %s",
+                     SDL_GetError());
+    }
+}
+
+QualityAnalyzer::~QualityAnalyzer()
+{
+    if (m_AnalyzerThread != nullptr) {
+        m_Lock.lock();
+        m_Stopping = true;
+        m_Lock.unlock();
+        m_FrameAvailable.wakeAll();
+
+        SDL_WaitThread(m_AnalyzerThread, nullptr);
+    }
+
+    av_frame_free(&m_PendingFrame);
+    av_frame_free(&m_TransferFrame);
+    sws_freeContext(m_SwsContext);
+}
+
+void QualityAnalyzer::submitFrame(const AVFrame* frame)
+{
+    {
+        QMutexLocker locker(&m_Lock);
+
+        // Skip this frame if the analyzer hasn't gotten to the last one yet
+        if (m_Stopping || m_PendingFrame != nullptr) {
+            return;
+        }
+    }
+
+    // Take our own reference so the live frame can continue on to Pacer
+    AVFrame* pendingFrame = av_frame_alloc();
+    if (pendingFrame == nullptr) {
+        return;
+    }
+    if (av_frame_ref(pendingFrame, frame) < 0) {
+        av_frame_free(&pendingFrame);
+        return;
+    }
+
+    m_Lock.lock();
+    SDL_assert(m_PendingFrame == nullptr);
+    m_PendingFrame = pendingFrame;
+    m_Lock.unlock();
+
+    m_FrameAvailable.wakeOne();
+}
+
+void QualityAnalyzer::takeWindowStats(uint32_t* frames, double* totalPsnrDb, double* totalSsim)
+{
+    QMutexLocker locker(&m_Lock);
+
+    *frames = m_WindowFrames;
+    *totalPsnrDb = m_WindowTotalPsnrDb;
+    *totalSsim = m_WindowTotalSsim;
+
+    m_WindowFrames = 0;
+    m_WindowTotalPsnrDb = 0;
+    m_WindowTotalSsim = 0;
+}
+
+int QualityAnalyzer::analyzerThreadProc(void* context)
+{
+    QualityAnalyzer* me = reinterpret_cast<QualityAnalyzer*>(context);
+
+    // Analysis must never compete with the decoder or render threads
+    SDL_SetThreadPriority(SDL_THREAD_PRIORITY_LOW);
+    StreamUtils::placeCurrentThread(StreamUtils::TPC_BACKGROUND);
+
+    if (!me->loadReference()) {
+        // Stop accepting frames, since nothing will ever consume them
+        QMutexLocker locker(&me->m_Lock);
+        me->m_Stopping = true;
+        av_frame_free(&me->m_PendingFrame);
+        return -1;
+    }
+
+    for (;;) {
+        me->m_Lock.lock();
+
+        while (!me->m_Stopping && me->m_PendingFrame == nullptr) {
+            me->m_FrameAvailable.wait(&me->m_Lock);
+        }
+
+        if (me->m_Stopping) {
+            me->m_Lock.unlock();
+            break;
+        }
+
+        AVFrame* frame = me->m_PendingFrame;
+        me->m_PendingFrame = nullptr;
+        me->m_Lock.unlock();
+
+        me->analyzeFrame(frame);
+        av_frame_free(&frame);
+    }
+
+    return 0;
+}
+
+bool QualityAnalyzer::loadReference()
+{
+    AVFormatContext* formatContext = nullptr;
+    AVCodecContext* codecContext = nullptr;
+    SwsContext* swsContext = nullptr;
+    AVPacket* packet = av_packet_alloc();
+    AVFrame* frame = av_frame_alloc();
+    const AVCodec* codec = nullptr;
+    int streamIndex;
+    int err;
+    bool draining = false;
+
+    if (packet == nullptr || frame == nullptr) {
+        goto Exit;
+    }
+
+    err = avformat_open_input(&formatContext, m_ReferencePath.toUtf8().constData(), nullptr, nullptr);
+    if (err < 0) {
+        SDL_LogError(SDL_LOG_CATEGORY_APPLICATION,
+                     "Unable to open quality reference clip: %d",
+                     err);
+        goto Exit;
+    }
+
+    err = avformat_find_stream_info(formatContext, nullptr);
+    if (err < 0) {
+        SDL_LogError(SDL_LOG_CATEGORY_APPLICATION,
+                     "Unable to read quality reference clip: %d",
+                     err);
+        goto Exit;
+    }
+
+    streamIndex = av_find_best_stream(formatContext, AVMEDIA_TYPE_VIDEO, -1, -1, &codec, 0);
+    if (streamIndex < 0) {
+        SDL_LogError(SDL_LOG_CATEGORY_APPLICATION,
+                     "Quality reference clip has no decodable video stream");
+        goto Exit;
+    }
+
+    codecContext = avcodec_alloc_context3(codec);
+    if (codecContext == nullptr ||
+            avcodec_parameters_to_context(codecContext, formatContext->streams[streamIndex]->codecpar) < 0 ||
+            avcodec_open2(codecContext, codec, nullptr) < 0) {
+        SDL_LogError(SDL_LOG_CATEGORY_APPLICATION,
+                     "Unable to open decoder for quality reference clip");
+        goto Exit;
+    }
+
+    m_ReferenceFps = av_q2d(formatContext->streams[streamIndex]->avg_frame_rate);
+    if (!(m_ReferenceFps > 0)) {
+        m_ReferenceFps = 60;
+    }
+
+    while (m_ReferenceFrameCount < QUALITY_MAX_REFERENCE_FRAMES) {
+        if (!draining) {
+            err = av_read_frame(formatContext, packet);
+            if (err < 0) {
+                // Flush the last frames out of the decoder
+                draining = true;
+                avcodec_send_packet(codecContext, nullptr);
+            }
+            else if (packet->stream_index != streamIndex) {
+                av_packet_unref(packet);
+                continue;
+            }
+            else {
+                avcodec_send_packet(codecContext, packet);
+                av_packet_unref(packet);
+            }
+        }
+
+        err = avcodec_receive_frame(codecContext, frame);
+        if (err == AVERROR(EAGAIN) && !draining) {
+            continue;
+        }
+        else if (err < 0) {
+            break;
+        }
+
+        if (m_Width == 0) {
+            m_Width = QUALITY_ANALYSIS_WIDTH;
+            m_Height = qMax(QUALITY_BLOCK_SIZE,
+                            (QUALITY_ANALYSIS_WIDTH * frame->height / frame->width + QUALITY_BLOCK_SIZE / 2) &
+                                ~(QUALITY_BLOCK_SIZE - 1));
+            m_ReferenceLuma.resize(m_Width * m_Height * QUALITY_MAX_REFERENCE_FRAMES);
+        }
+
+        if (scaleLuma(frame, &swsContext,
+                      (uint8_t*)m_ReferenceLuma.data() + m_Width * m_Height * m_ReferenceFrameCount)) {
+            m_ReferenceFrameCount++;
+        }
+        av_frame_unref(frame);
+    }
+
+Exit:
+    if (m_ReferenceFrameCount != 0) {
+        m_ReferenceLuma.resize(m_Width * m_Height * m_ReferenceFrameCount);
+        m_FrameLuma.resize(m_Width * m_Height);
+
+        SDL_LogInfo(SDL_LOG_CATEGORY_APPLICATION,
+                    "Quality analyzer loaded %d reference frames (%.2f FPS) at %dx%d",
+                    m_ReferenceFrameCount, m_ReferenceFps, m_Width, m_Height);
+    }
+    else {
+        m_ReferenceLuma.clear();
+    }
+
+    sws_freeContext(swsContext);
+    avcodec_free_context(&codecContext);
+    avformat_close_input(&formatContext);
+    av_frame_free(&frame);
+    av_packet_free(&packet);
+
+    return m_ReferenceFrameCount != 0;
+}
+
+bool QualityAnalyzer::scaleLuma(const AVFrame* frame, SwsContext** context, uint8_t* output)
+{
+    // Area averaging keeps small encoder artifacts from aliasing into the result
+    *context = sws_getCachedContext(*context,
+                                    frame->width, frame->height, (AVPixelFormat)frame->format,
+                                    m_Width, m_Height, AV_PIX_FMT_GRAY8,
+                                    SWS_AREA, nullptr, nullptr, nullptr);
+    if (*context == nullptr) {
+        return false;
+    }
+
+    uint8_t* dstData[4] = { output, nullptr, nullptr, nullptr };
+    int dstLinesize[4] = { m_Width, 0, 0, 0 };
+    return sws_scale(*context, frame->data, frame->linesize, 0, frame->height, dstData, dstLinesize) > 0;
+}
+
+int QualityAnalyzer::findReferenceFrame(const uint8_t* luma, int first, int count)
+{
+    int planeSize = m_Width * m_Height;
+    int bestIndex = -1;
+    uint32_t bestSad = UINT32_MAX;
+
+    for (int i = 0; i < count; i++) {
+        int index = ((first + i) % m_ReferenceFrameCount + m_ReferenceFrameCount) % m_ReferenceFrameCount;
+        uint32_t sad = sumAbsDiff(luma, (const uint8_t*)m_ReferenceLuma.constData() + planeSize * index, planeSize);
+        if (sad < bestSad) {
+            bestSad = sad;
+            bestIndex = index;
+        }
+    }
+
+    return bestIndex;
+}
+
+void QualityAnalyzer::analyzeFrame(AVFrame* frame)
+{
+    AVFrame* swFrame = frame;
+
+    if (m_TransferFailed) {
+        return;
+    }
+
+    const AVPixFmtDescriptor* desc = av_pix_fmt_desc_get((AVPixelFormat)frame->format);
+    if (desc != nullptr && (desc->flags & AV_PIX_FMT_FLAG_HWACCEL)) {
+        if (m_TransferFrame == nullptr) {
+            m_TransferFrame = av_frame_alloc();
+        }
+
+        av_frame_unref(m_TransferFrame);
+        if (m_TransferFrame == nullptr || frame->hw_frames_ctx == nullptr ||
+                av_hwframe_transfer_data(m_TransferFrame, frame, 0) < 0) {
+            SDL_LogWarn(SDL_LOG_CATEGORY_APPLICATION,
+                        "Quality analyzer can't read back %s frames",
+                        desc->name);
+            m_TransferFailed = true;
+            return;
+        }
+
+        swFrame = m_TransferFrame;
+    }
+
+    uint8_t* luma = (uint8_t*)m_FrameLuma.data();
+    if (!scaleLuma(swFrame, &m_SwsContext, luma)) {
+        return;
+    }
+
+    // Frames arrive in order, so the match should land close to where the
+    // elapsed stream time says it will. A full search is only needed at the
+    // start, after a timestamp discontinuity, and periodically in case the
+    // host restarted the clip.
+    int index;
+    if (m_MatchedIndex < 0 || frame->pts == AV_NOPTS_VALUE || frame->pts < m_MatchedPts ||
+            m_FramesSinceResync >= QUALITY_RESYNC_INTERVAL) {
+        index = findReferenceFrame(luma, 0, m_ReferenceFrameCount);
+        m_FramesSinceResync = 0;
+    }
+    else {
+        // Stream timestamps are in the 90 kHz RTP timebase
+        int64_t expected = m_MatchedIndex + (int64_t)llround((frame->pts - m_MatchedPts) * m_ReferenceFps / 90000.0);
+        index = findReferenceFrame(luma,
+                                   (int)(expected % m_ReferenceFrameCount) - QUALITY_SEARCH_RADIUS,
+                                   QUALITY_SEARCH_RADIUS * 2 + 1);
+        m_FramesSinceResync++;
+    }
+
+    m_MatchedIndex = index;
+    m_MatchedPts = frame->pts;
+
+    const uint8_t* reference = (const uint8_t*)m_ReferenceLuma.constData() + m_Width * m_Height * index;
+    uint64_t totalSquaredError = 0;
+    double totalSsim = 0;
+    int blocks = 0;
+
+    for (int y = 0; y < m_Height; y += QUALITY_BLOCK_SIZE) {
+        for (int x = 0; x < m_Width; x += QUALITY_BLOCK_SIZE) {
+            BlockSums sums;
+            blockSums(&reference[y * m_Width + x], &luma[y * m_Width + x], m_Width, &sums);
+
+            totalSquaredError += (uint64_t)sums.aa + sums.bb - 2 * (uint64_t)sums.ab;
+
+            const double n = QUALITY_BLOCK_SIZE * QUALITY_BLOCK_SIZE;
+            double meanA = sums.a / n;
+            double meanB = sums.b / n;
+            double varianceA = sums.aa / n - meanA * meanA;
+            double varianceB = sums.bb / n - meanB * meanB;
+            double covariance = sums.ab / n - meanA * meanB;
+            totalSsim += ((2 * meanA * meanB + SSIM_C1) * (2 * covariance + SSIM_C2)) /
+                         ((meanA * meanA + meanB * meanB + SSIM_C1) * (varianceA + varianceB + SSIM_C2));
+            blocks++;
+        }
+    }
+
+    double meanSquaredError = (double)totalSquaredError / (m_Width * m_Height);
+    double psnrDb = meanSquaredError > 0 ?
+                        qMin(QUALITY_MAX_PSNR_DB, 10 * log10(255.0 * 255.0 / meanSquaredError)) :
+                        QUALITY_MAX_PSNR_DB;
+
+    QMutexLocker locker(&m_Lock);
+    m_WindowFrames++;
+    m_WindowTotalPsnrDb += psnrDb;
+    m_WindowTotalSsim += totalSsim / blocks;
+}
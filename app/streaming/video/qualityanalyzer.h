@@ -0,0 +1,80 @@
+#pragma once
+
+#include <QByteArray>
+#include <QMutex>
+#include <QString>
+#include <QWaitCondition>
+
+#include "SDL_compat.h"
+
+extern "C" {
+#include <libavutil/frame.h>
+#include <libswscale/swscale.h>
+}
+
+// Measures stream quality live while the host plays a known test clip, so
+// the visual cost of a bitrate setting can be seen without recording the
+// stream and comparing it in ffmpeg afterwards. The reference clip and the
+// decoded frames are both scaled down to a small luma plane. Each frame is
+// matched to the closest reference frame near its expected position, then
+// compared with PSNR and SSIM over 8x8 blocks. All of this happens on the
+// analyzer's own thread, and frames are skipped while it is busy.
+//
+// Set ML_QUALITY_REFERENCE to the path of the reference clip. The clip
+// should be short enough to loop on the host, since only the first
+// QUALITY_MAX_REFERENCE_FRAMES frames are kept.
+class QualityAnalyzer {
+public:
+    // Returns nullptr unless ML_QUALITY_REFERENCE is set
+    static QualityAnalyzer* createFromEnvironment();
+
+    ~QualityAnalyzer();
+
+    // Called on the decoder thread with each decoded frame. The caller
+    // retains ownership of the frame. Never blocks.
+    void submitFrame(const AVFrame* frame);
+
+    // Returns the totals for frames analyzed since the last call
+    void takeWindowStats(uint32_t* frames, double* totalPsnrDb, double* totalSsim);
+
+private:
+    QualityAnalyzer(const QString& referencePath);
+
+    static int analyzerThreadProc(void* context);
+
+    // Decodes the reference clip into m_ReferenceLuma (analyzer thread only)
+    bool loadReference();
+
+    // Scales the luma plane of a software frame down to the analysis size
+    bool scaleLuma(const AVFrame* frame, SwsContext** context, uint8_t* output);
+
+    // Returns the reference frame closest to luma among count frames starting at first
+    int findReferenceFrame(const uint8_t* luma, int first, int count);
+
+    void analyzeFrame(AVFrame* frame);
+
+    QString m_ReferencePath;
+    SDL_Thread* m_AnalyzerThread;
+
+    // Only touched by the analyzer thread once it has started
+    int m_Width;
+    int m_Height;
+    int m_ReferenceFrameCount;
+    double m_ReferenceFps;
+    QByteArray m_ReferenceLuma;
+    QByteArray m_FrameLuma;
+    SwsContext* m_SwsContext;
+    AVFrame* m_TransferFrame;
+    int m_MatchedIndex;
+    int64_t m_MatchedPts;
+    int m_FramesSinceResync;
+    bool m_TransferFailed;
+
+    QMutex m_Lock;
+    QWaitCondition m_FrameAvailable;
+    AVFrame* m_PendingFrame;
+    bool m_Stopping;
+    uint32_t m_WindowFrames;
+    double m_WindowTotalPsnrDb;
+    double m_WindowTotalSsim;
+};
@@ -0,0 +1,417 @@
+#include "recordingfilewriter.h"
+#include "streaming/streamutils.h"
+
+#ifndef Q_OS_WIN32
+#include <errno.h>
+#include <fcntl.h>
+#include <limits.h>
+#include <unistd.h>
+#include <sys/uio.h>
+#endif
+
+#include <stdlib.h>
+
+#ifndef IOV_MAX
+#define IOV_MAX 1024
+#endif
+
+#ifdef Q_OS_LINUX
+// O_DIRECT requires the buffer address, length, and file offset to be
+// aligned to the logical block size. 4K covers all common NVMe devices.
+#define DIRECT_IO_ALIGNMENT 4096
+
+// Large enough to amortize the syscall, small enough to keep latency bounded
+#define DIRECT_IO_BUFFER_SIZE (8 * 1024 * 1024)
+#endif
+
+RecordingFileWriter::RecordingFileWriter()
+#ifndef Q_OS_WIN32
+    : m_Fd(-1)
+#endif
+{
+#ifdef Q_OS_LINUX
+    m_DirectIo = false;
+    m_DirectBuffers[0] = m_DirectBuffers[1] = nullptr;
+    m_ActiveBuffer = 0;
+    m_ActiveBufferFill = 0;
+    m_PendingBuffer = -1;
+    m_FlushFailed = false;
+    m_FlushStopping = false;
+    m_FlushThread = nullptr;
+#endif
+}
+
+RecordingFileWriter::~RecordingFileWriter()
+{
+    close();
+}
+
+bool RecordingFileWriter::open(const QString& path, bool directIo)
+{
+    SDL_assert(!isOpen());
+
+#ifdef Q_OS_WIN32
+    if (directIo) {
+        SDL_LogWarn(SDL_LOG_CATEGORY_APPLICATION,
+                    "RecordingFileWriter: Direct I/O is not supported on this platform");
+    }
+
+    m_File.setFileName(path);
+    if (!m_File.open(QIODevice::WriteOnly)) {
+        SDL_LogError(SDL_LOG_CATEGORY_APPLICATION,
+                     "RecordingFileWriter: Could not open %s: %s",
+                     path.toUtf8().constData(),
+                     m_File.errorString().toUtf8().constData());
+        return false;
+    }
+#else
+    int flags = O_WRONLY | O_CREAT | O_TRUNC;
+#ifdef Q_OS_LINUX
+    if (directIo) {
+        flags |= O_DIRECT;
+    }
+#endif
+
+    m_Fd = ::open(path.toUtf8().constData(), flags, 0644);
+    if (m_Fd < 0) {
+        SDL_LogError(SDL_LOG_CATEGORY_APPLICATION,
+                     "RecordingFileWriter: Could not open %s: %d",
+                     path.toUtf8().constData(),
+                     errno);
+        return false;
+    }
+
+#if defined(Q_OS_DARWIN)
+    // macOS has no O_DIRECT, but F_NOCACHE keeps recordings out of the UBC
+    if (directIo && fcntl(m_Fd, F_NOCACHE, 1) < 0) {
+        SDL_LogWarn(SDL_LOG_CATEGORY_APPLICATION,
+                    "RecordingFileWriter: F_NOCACHE failed: %d",
+                    errno);
+    }
+#elif defined(Q_OS_LINUX)
+    if (directIo) {
+        for (int i = 0; i < 2; i++) {
+            void* buffer;
+            if (posix_memalign(&buffer, DIRECT_IO_ALIGNMENT, DIRECT_IO_BUFFER_SIZE) != 0) {
+                SDL_LogError(SDL_LOG_CATEGORY_APPLICATION,
+                             "RecordingFileWriter: Could not allocate direct I/O buffer");
+                close();
+                return false;
+            }
+            m_DirectBuffers[i] = (uint8_t*)buffer;
+        }
+
+        m_ActiveBuffer = 0;
+        m_ActiveBufferFill = 0;
+        m_PendingBuffer = -1;
+        m_FlushFailed = false;
+        m_FlushStopping = false;
+        m_DirectIo = true;
+
+        m_FlushThread = SDL_CreateThread(RecordingFileWriter::flushThreadProc, "RecordingFlush", this);
+        if (m_FlushThread == nullptr) {
+            SDL_LogError(SDL_LOG_CATEGORY_APPLICATION,
+                         "RecordingFileWriter: Failed to create flush thread: %s",
+                         SDL_GetError());
+            close();
+            return false;
+        }
+    }
+#else
+    if (directIo) {
+        SDL_LogWarn(SDL_LOG_CATEGORY_APPLICATION,
+                    "RecordingFileWriter: Direct I/O is not supported on this platform");
+    }
+#endif
+#endif
+
+    return true;
+}
+
+bool RecordingFileWriter::isOpen() const
+{
+#ifdef Q_OS_WIN32
+    return m_File.isOpen();
+#else
+    return m_Fd >= 0;
+#endif
+}
+
+bool RecordingFileWriter::writeContiguous(const void* data, size_t length)
+{
+#ifdef Q_OS_WIN32
+    return m_File.write((const char*)data, length) == (qint64)length;
+#else
+    const uint8_t* ptr = (const uint8_t*)data;
+
+    while (length > 0) {
+        ssize_t ret = ::write(m_Fd, ptr, length);
+        if (ret < 0) {
+            if (errno == EINTR) {
+                continue;
+            }
+
+            SDL_LogError(SDL_LOG_CATEGORY_APPLICATION,
+                         "RecordingFileWriter: write() failed: %d",
+                         errno);
+            return false;
+        }
+
+        ptr += ret;
+        length -= ret;
+    }
+
+    return true;
+#endif
+}
+
+bool RecordingFileWriter::write(const void* data, size_t length)
+{
+#ifdef Q_OS_LINUX
+    if (m_DirectIo) {
+        return appendDirect((const uint8_t*)data, length);
+    }
+#endif
+
+    return writeContiguous(data, length);
+}
+
+bool RecordingFileWriter::writePlanes(const uint8_t* const* planes, const int* strides,
+                                      const int* rowBytes, const int* rows, int planeCount)
+{
+#ifdef Q_OS_LINUX
+    if (m_DirectIo) {
+        // Everything has to be staged in the aligned buffers anyway
+        for (int i = 0; i < planeCount; i++) {
+            if (strides[i] == rowBytes[i]) {
+                if (!appendDirect(planes[i], (size_t)rowBytes[i] * rows[i])) {
+                    return false;
+                }
+            }
+            else {
+                for (int y = 0; y < rows[i]; y++) {
+                    if (!appendDirect(planes[i] + (size_t)y * strides[i], rowBytes[i])) {
+                        return false;
+                    }
+                }
+            }
+        }
+
+        return true;
+    }
+#endif
+
+    // If the planes are tightly packed and adjacent in memory (as they
+    // are for our own conversion buffer), this is a single write.
+    bool contiguous = true;
+    for (int i = 0; i < planeCount && contiguous; i++) {
+        if (strides[i] != rowBytes[i]) {
+            contiguous = false;
+        }
+        else if (i + 1 < planeCount && planes[i] + (size_t)rowBytes[i] * rows[i] != planes[i + 1]) {
+            contiguous = false;
+        }
+    }
+
+    if (contiguous) {
+        size_t totalLength = 0;
+        for (int i = 0; i < planeCount; i++) {
+            totalLength += (size_t)rowBytes[i] * rows[i];
+        }
+
+        return writeContiguous(planes[0], totalLength);
+    }
+
+#ifdef Q_OS_WIN32
+    // WriteFileGather() requires page-sized unbuffered writes, so just
+    // pack the rows together and issue one write for the whole frame.
+    size_t totalLength = 0;
+    for (int i = 0; i < planeCount; i++) {
+        totalLength += (size_t)rowBytes[i] * rows[i];
+    }
+
+    if ((size_t)m_PackBuffer.size() < totalLength) {
+        m_PackBuffer.resize((int)totalLength);
+    }
+
+    char* dst = m_PackBuffer.data();
+    for (int i = 0; i < planeCount; i++) {
+        for (int y = 0; y < rows[i]; y++) {
+            memcpy(dst, planes[i] + (size_t)y * strides[i], rowBytes[i]);
+            dst += rowBytes[i];
+        }
+    }
+
+    return writeContiguous(m_PackBuffer.constData(), totalLength);
+#else
+    // Gather the rows (or whole planes when they're packed) into iovecs
+    struct iovec iov[IOV_MAX];
+    int iovCount = 0;
+
+    for (int i = 0; i < planeCount; i++) {
+        int segments = strides[i] == rowBytes[i] ? 1 : rows[i];
+        size_t segmentLength = strides[i] == rowBytes[i] ? (size_t)rowBytes[i] * rows[i] : rowBytes[i];
+
+        for (int y = 0; y < segments; y++) {
+            iov[iovCount].iov_base = (void*)(planes[i] + (size_t)y * strides[i]);
+            iov[iovCount].iov_len = segmentLength;
+            iovCount++;
+
+            if (iovCount == IOV_MAX || (i == planeCount - 1 && y == segments - 1)) {
+                struct iovec* next = iov;
+                int remaining = iovCount;
+
+                while (remaining > 0) {
+                    ssize_t ret = ::writev(m_Fd, next, remaining);
+                    if (ret < 0) {
+                        if (errno == EINTR) {
+                            continue;
+                        }
+
+                        SDL_LogError(SDL_LOG_CATEGORY_APPLICATION,
+                                     "RecordingFileWriter: writev() failed: %d",
+                                     errno);
+                        return false;
+                    }
+
+                    // Skip past the fully written iovecs and adjust a partial one
+                    while (remaining > 0 && (size_t)ret >= next->iov_len) {
+                        ret -= next->iov_len;
+                        next++;
+                        remaining--;
+                    }
+                    if (remaining > 0) {
+                        next->iov_base = (uint8_t*)next->iov_base + ret;
+                        next->iov_len -= ret;
+                    }
+                }
+
+                iovCount = 0;
+            }
+        }
+    }
+
+    return true;
+#endif
+}
+
+#ifdef Q_OS_LINUX
+bool RecordingFileWriter::appendDirect(const uint8_t* data, size_t length)
+{
+    while (length > 0) {
+        size_t copyLength = qMin(length, (size_t)DIRECT_IO_BUFFER_SIZE - m_ActiveBufferFill);
+
+        memcpy(m_DirectBuffers[m_ActiveBuffer] + m_ActiveBufferFill, data, copyLength);
+        m_ActiveBufferFill += copyLength;
+        data += copyLength;
+        length -= copyLength;
+
+        if (m_ActiveBufferFill == DIRECT_IO_BUFFER_SIZE && !submitDirectBuffer()) {
+            return false;
+        }
+    }
+
+    return true;
+}
+
+bool RecordingFileWriter::submitDirectBuffer()
+{
+    QMutexLocker locker(&m_FlushLock);
+
+    // Wait for the other buffer to finish flushing before we hand this one off
+    while (m_PendingBuffer >= 0) {
+        m_FlushCompleted.wait(&m_FlushLock);
+    }
+
+    if (m_FlushFailed) {
+        return false;
+    }
+
+    m_PendingBuffer = m_ActiveBuffer;
+    m_FlushRequested.wakeOne();
+
+    m_ActiveBuffer ^= 1;
+    m_ActiveBufferFill = 0;
+    return true;
+}
+
+int RecordingFileWriter::flushThreadProc(void* context)
+{
+    RecordingFileWriter* me = reinterpret_cast<RecordingFileWriter*>(context);
+
+    SDL_SetThreadPriority(SDL_THREAD_PRIORITY_LOW);
+    StreamUtils::placeCurrentThread(StreamUtils::TPC_BACKGROUND);
+
+    me->m_FlushLock.lock();
+    for (;;) {
+        while (me->m_PendingBuffer < 0 && !me->m_FlushStopping) {
+            me->m_FlushRequested.wait(&me->m_FlushLock);
+        }
+
+        if (me->m_PendingBuffer < 0) {
+            SDL_assert(me->m_FlushStopping);
+            break;
+        }
+
+        int buffer = me->m_PendingBuffer;
+        me->m_FlushLock.unlock();
+
+        bool ok = me->writeContiguous(me->m_DirectBuffers[buffer], DIRECT_IO_BUFFER_SIZE);
+
+        me->m_FlushLock.lock();
+        if (!ok) {
+            me->m_FlushFailed = true;
+        }
+        me->m_PendingBuffer = -1;
+        me->m_FlushCompleted.wakeAll();
+    }
+    me->m_FlushLock.unlock();
+
+    return 0;
+}
+#endif
+
+void RecordingFileWriter::close()
+{
+#ifdef Q_OS_LINUX
+    if (m_FlushThread != nullptr) {
+        m_FlushLock.lock();
+        m_FlushStopping = true;
+        m_FlushLock.unlock();
+        m_FlushRequested.wakeAll();
+
+        // The flush thread finishes any pending buffer before exiting
+        SDL_WaitThread(m_FlushThread, nullptr);
+        m_FlushThread = nullptr;
+    }
+
+    if (m_DirectIo) {
+        // Every flush so far was a whole aligned buffer, so the file offset is
+        // aligned. The unaligned tail is written normally after dropping O_DIRECT.
+        if (m_ActiveBufferFill > 0 && !m_FlushFailed) {
+            fcntl(m_Fd, F_SETFL, fcntl(m_Fd, F_GETFL) & ~O_DIRECT);
+            writeContiguous(m_DirectBuffers[m_ActiveBuffer], m_ActiveBufferFill);
+        }
+
+        m_DirectIo = false;
+        m_ActiveBufferFill = 0;
+    }
+
+    for (int i = 0; i < 2; i++) {
+        free(m_DirectBuffers[i]);
+        m_DirectBuffers[i] = nullptr;
+    }
+#endif
+
+#ifdef Q_OS_WIN32
+    if (m_File.isOpen()) {
+        m_File.close();
+    }
+    m_PackBuffer.clear();
+#else
+    if (m_Fd >= 0) {
+        ::close(m_Fd);
+        m_Fd = -1;
+    }
+#endif
+}
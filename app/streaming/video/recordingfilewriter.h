@@ -0,0 +1,71 @@
+#pragma once
+
+#include <QString>
+#include <QMutex>
+#include <QWaitCondition>
+
+#include "SDL_compat.h"
+
+#ifdef Q_OS_WIN32
+#include <QFile>
+#endif
+
+// Writes raw video planes to disk using as few system calls as possible.
+// Contiguous planes are written in a single call, padded planes use
+// scatter-gather I/O where available, and direct I/O mode bypasses the
+// page cache using aligned double buffers flushed by a separate thread.
+class RecordingFileWriter {
+public:
+    RecordingFileWriter();
+    ~RecordingFileWriter();
+
+    // Direct I/O is only honored on platforms that support it (Linux O_DIRECT
+    // and macOS F_NOCACHE). Elsewhere it falls back to buffered output.
+    bool open(const QString& path, bool directIo);
+
+    bool write(const void* data, size_t length);
+
+    // Write planeCount planes of rows[i] rows each, with rowBytes[i] bytes
+    // of visible data in each row spaced strides[i] bytes apart.
+    bool writePlanes(const uint8_t* const* planes, const int* strides,
+                     const int* rowBytes, const int* rows, int planeCount);
+
+    void close();
+
+    bool isOpen() const;
+
+private:
+    bool writeContiguous(const void* data, size_t length);
+
+#ifdef Q_OS_LINUX
+    bool appendDirect(const uint8_t* data, size_t length);
+
+    bool submitDirectBuffer();
+
+    static int flushThreadProc(void* context);
+#endif
+
+#ifdef Q_OS_WIN32
+    QFile m_File;
+    QByteArray m_PackBuffer;
+#else
+    int m_Fd;
+#endif
+
+#ifdef Q_OS_LINUX
+    bool m_DirectIo;
+    uint8_t* m_DirectBuffers[2];
+    int m_ActiveBuffer;
+    size_t m_ActiveBufferFill;
+
+    // Protected by m_FlushLock
+    int m_PendingBuffer;
+    bool m_FlushFailed;
+    bool m_FlushStopping;
+
+    QMutex m_FlushLock;
+    QWaitCondition m_FlushRequested;
+    QWaitCondition m_FlushCompleted;
+    SDL_Thread* m_FlushThread;
+#endif
+};
@@ -0,0 +1,91 @@
+#include "rendererpreferencecache.h"
+#include "decoderprobecache.h"
+
+#include <QSettings>
+
+extern "C" {
+#include <libavutil/hwcontext.h>
+#include <libavutil/pixdesc.h>
+}
+
+#define SER_RENDERERPREFS "rendererpreferences"
+
+RendererPreferenceCache::RendererPreferenceCache(const AVCodec* decoder, const AVCodecHWConfig* hwConfig,
+                                                 enum AVPixelFormat requiredFormat, PDECODER_PARAMETERS params)
+    : m_Enabled(qgetenv("ML_RENDERER_TRIAL") != "0")
+{
+    const char* displayName = SDL_GetDisplayName(SDL_GetWindowDisplayIndex(params->window));
+
+    // QSettings treats slashes as groups, and some display names contain them
+    m_Key = QString("%1_%2_%3_%4_%5")
+                .arg(decoder->name)
+                .arg(hwConfig != nullptr ?
+                         av_hwdevice_get_type_name(hwConfig->device_type) :
+                         av_get_pix_fmt_name(requiredFormat))
+                .arg(params->videoFormat, 0, 16)
+                .arg(SDL_GetCurrentVideoDriver())
+                .arg(displayName != nullptr ? displayName : "unknown")
+                .replace('/', '_')
+                .replace('\\', '_');
+}
+
+bool RendererPreferenceCache::isTrialEnabled()
+{
+    return qgetenv("ML_RENDERER_TRIAL") == "1";
+}
+
+QString RendererPreferenceCache::getDriverFingerprint(IFFmpegRenderer* renderer)
+{
+    QString fingerprint;
+
+    // Renderers that can't report their driver share a result for any GPU
+    if (!DecoderProbeCache::getDriverFingerprint(renderer, fingerprint)) {
+        fingerprint = "any";
+    }
+
+    return fingerprint;
+}
+
+int RendererPreferenceCache::getPreferredMode()
+{
+    if (!m_Enabled) {
+        return -1;
+    }
+
+    QSettings settings;
+    settings.beginGroup(SER_RENDERERPREFS);
+
+    bool ok;
+    int mode = settings.value(m_Key).toString().section(';', 0, 0).toInt(&ok);
+    return ok ? mode : -1;
+}
+
+void RendererPreferenceCache::storeResult(int mode, IFFmpegRenderer* renderer)
+{
+    if (!m_Enabled) {
+        return;
+    }
+
+    QSettings settings;
+    settings.beginGroup(SER_RENDERERPREFS);
+    settings.setValue(m_Key, QString("%1;%2").arg(mode).arg(getDriverFingerprint(renderer)));
+}
+
+void RendererPreferenceCache::checkResult(int mode, IFFmpegRenderer* renderer)
+{
+    if (!m_Enabled) {
+        return;
+    }
+
+    QSettings settings;
+    settings.beginGroup(SER_RENDERERPREFS);
+
+    QString result = settings.value(m_Key).toString();
+    if (result.isEmpty() || result == QString("%1;%2").arg(mode).arg(getDriverFingerprint(renderer))) {
+        return;
+    }
+
+    SDL_LogInfo(SDL_LOG_CATEGORY_APPLICATION,
+                "Renderer trial result is out of date and will be run again");
+    settings.remove(m_Key);
+}
@@ -0,0 +1,39 @@
+#pragma once
+
+#include <QString>
+
+#include "ffmpeg-renderers/renderer.h"
+
+// Remembers which frontend mode rendered fastest in a timed trial, so later
+// launches try it first instead of following the static order. Mode 0 is the
+// EGL/DRM/Vulkan frontend with zero-copy frame passing and mode 1 is direct
+// rendering or SDL read-back. Results are persisted in QSettings and apply
+// only to the same decoder, hwaccel, codec, video driver, display, and GPU
+// driver (for renderers that implement getDriverVersion()).
+//
+// Set ML_RENDERER_TRIAL=1 to run a trial when there is no result yet, or
+// ML_RENDERER_TRIAL=0 to ignore stored results.
+class RendererPreferenceCache {
+public:
+    RendererPreferenceCache(const AVCodec* decoder, const AVCodecHWConfig* hwConfig,
+                            enum AVPixelFormat requiredFormat, PDECODER_PARAMETERS params);
+
+    static bool isTrialEnabled();
+
+    // Returns the mode that won the trial, or -1 if there is no result.
+    // This can be called before the renderer is initialized.
+    int getPreferredMode();
+
+    // Records the winning mode. The renderer must be initialized.
+    void storeResult(int mode, IFFmpegRenderer* renderer);
+
+    // Drops the result if a different mode was chosen or the GPU driver has
+    // changed, so the next launch runs a new trial. The renderer must be initialized.
+    void checkResult(int mode, IFFmpegRenderer* renderer);
+
+private:
+    static QString getDriverFingerprint(IFFmpegRenderer* renderer);
+
+    QString m_Key;
+    bool m_Enabled;
+};
@@ -34,6 +34,11 @@ public:
         return false;
     }
 
+    // SLVideo has no separate decoder state to recreate
+    virtual bool reinitializeDecoder() override {
+        return false;
+    }
+
 private:
     static void slLogCallback(void* context, ESLVideoLog logLevel, const char* message);
 
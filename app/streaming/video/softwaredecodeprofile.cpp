@@ -0,0 +1,319 @@
+#include "softwaredecodeprofile.h"
+
+#include <climits>
+#include <cerrno>
+
+#include <QFile>
+#include <QHash>
+#include <QString>
+
+// Upper bound on FFmpeg frame threads. Each thread beyond the first adds a
+// frame of latency, so we only use enough to get over the frame interval.
+#define MAX_FRAME_THREADS 3
+
+static SDL_SpinLock s_TestDecodeLock;
+
+// Fastest test decode observed for each decoder in nanoseconds per pixel.
+// We keep the minimum because probes can run concurrently with each other.
+static QHash<QString, double> s_TestDecodeNsPerPixel;
+
+void SoftwareDecodeProfile::recordTestDecode(const AVCodec* decoder, int width, int height, uint64_t decodeTimeUs)
+{
+    double nsPerPixel = (decodeTimeUs * 1000.0) / (width * height);
+
+    SDL_LogInfo(SDL_LOG_CATEGORY_APPLICATION,
+                "Software test decode with %s took %.2f ms (~%.0f FPS at %dx%d on one thread)",
+                decoder->name,
+                decodeTimeUs / 1000.0,
+                decodeTimeUs ? 1000000.0 / decodeTimeUs : 0.0,
+                width, height);
+
+    SDL_AtomicLock(&s_TestDecodeLock);
+    auto it = s_TestDecodeNsPerPixel.find(decoder->name);
+    if (it == s_TestDecodeNsPerPixel.end() || nsPerPixel < it.value()) {
+        s_TestDecodeNsPerPixel.insert(decoder->name, nsPerPixel);
+    }
+    SDL_AtomicUnlock(&s_TestDecodeLock);
+}
+
+uint64_t SoftwareDecodeProfile::estimateDecodeTimeUs(const AVCodec* decoder, int width, int height)
+{
+    double nsPerPixel;
+
+    SDL_AtomicLock(&s_TestDecodeLock);
+    nsPerPixel = s_TestDecodeNsPerPixel.value(decoder->name, 0.0);
+    SDL_AtomicUnlock(&s_TestDecodeLock);
+
+    return (uint64_t)(nsPerPixel * width * height / 1000.0);
+}
+
+void SoftwareDecodeProfile::prepareDecoderContext(AVCodecContext* context, PDECODER_PARAMETERS params,
+                                                  int slices, AVDictionary** options)
+{
+    QByteArray threadType = qgetenv("DECODER_THREAD_TYPE");
+    bool useFrameThreads;
+
+    if (threadType == "frame" || threadType == "slice") {
+        SDL_LogWarn(SDL_LOG_CATEGORY_APPLICATION,
+                    "Using software decoder thread type override: %s",
+                    threadType.constData());
+        useFrameThreads = threadType == "frame";
+    }
+    else if (params->testOnly || threadType != "auto") {
+        // Test frames must be decoded without frame delay, and streams
+        // only take on frame threading latency if the user opted in.
+        useFrameThreads = false;
+    }
+    else {
+        uint64_t singleThreadUs = estimateDecodeTimeUs(context->codec, params->width, params->height);
+        if (singleThreadUs != 0) {
+            // Each slice is decoded on its own thread, so this is the best case for slice threading
+            uint64_t sliceThreadedUs = singleThreadUs / slices;
+
+            SDL_LogInfo(SDL_LOG_CATEGORY_APPLICATION,
+                        "Estimated software decode rate at %dx%d: ~%.0f FPS with %d slices",
+                        params->width, params->height,
+                        sliceThreadedUs ? 1000000.0 / sliceThreadedUs : 0.0,
+                        slices);
+
+            // Leave some of the frame interval for the rest of the pipeline
+            useFrameThreads = sliceThreadedUs > (750000 / params->frameRate);
+        }
+        else {
+            useFrameThreads = false;
+        }
+    }
+
+    CPU_AFFINITY performanceCores;
+    int cpuCount = SDL_GetCPUCount();
+#ifdef Q_OS_LINUX
+    if (getPerformanceCores(&performanceCores)) {
+        cpuCount = CPU_COUNT(&performanceCores.mask);
+    }
+#else
+    (void)performanceCores;
+#endif
+
+    if (useFrameThreads) {
+        context->thread_type = FF_THREAD_FRAME;
+        context->thread_count = qMin(cpuCount, MAX_FRAME_THREADS);
+
+        // FFmpeg silently disables frame threading for low delay decoding
+        context->flags &= ~AV_CODEC_FLAG_LOW_DELAY;
+    }
+    else {
+        context->thread_type = FF_THREAD_SLICE;
+        context->thread_count = slices;
+    }
+
+    if (strcmp(context->codec->name, "libdav1d") == 0) {
+        bool ok;
+
+        int threads = qEnvironmentVariableIntValue("DAV1D_THREADS", &ok);
+        if (ok && threads >= 0) {
+            context->thread_count = threads;
+        }
+
+        // dav1d lets frames queue up in its frame threads unless told otherwise
+        int maxFrameDelay = qEnvironmentVariableIntValue("DAV1D_MAX_FRAME_DELAY", &ok);
+        if (!ok || maxFrameDelay < 0) {
+            maxFrameDelay = useFrameThreads ? 0 : 1;
+        }
+        if (maxFrameDelay != 0) {
+            av_dict_set_int(options, "max_frame_delay", maxFrameDelay, 0);
+        }
+    }
+
+    if (useFrameThreads) {
+        SDL_LogWarn(SDL_LOG_CATEGORY_APPLICATION,
+                    "Software decoding with frame threading (%d threads) adds up to %d frames of latency",
+                    context->thread_count,
+                    SDL_max(context->thread_count - 1, 0));
+    }
+    else {
+        SDL_LogInfo(SDL_LOG_CATEGORY_APPLICATION,
+                    "Software decoding with slice threading (%d threads)",
+                    context->thread_count);
+    }
+}
+
+#ifdef Q_OS_LINUX
+
+// Cores this far below the fastest core's capacity or maximum frequency
+// are considered efficiency cores
+#define PERFORMANCE_CORE_GAP_PERCENT 25
+
+// Parses the kernel's CPU list format (e.g. "0-7,16,18-19")
+static bool parseCpuList(const QByteArray& list, cpu_set_t* set)
+{
+    CPU_ZERO(set);
+
+    for (const QByteArray& range : list.trimmed().split(',')) {
+        QList<QByteArray> bounds = range.split('-');
+        bool ok1, ok2 = true;
+        int first = bounds[0].toInt(&ok1);
+        int last = bounds.size() > 1 ? bounds[1].toInt(&ok2) : first;
+        if (!ok1 || !ok2 || first > last || last >= CPU_SETSIZE) {
+            return false;
+        }
+
+        for (int cpu = first; cpu <= last; cpu++) {
+            CPU_SET(cpu, set);
+        }
+    }
+
+    return CPU_COUNT(set) != 0;
+}
+
+// Selects the cores whose value in the given per-CPU sysfs file is within
+// PERFORMANCE_CORE_GAP_PERCENT of the highest. Returns false if no core is
+// that far below the highest, so per-core boost bins on homogeneous CPUs
+// (AMD preferred cores, Intel Turbo Boost Max 3.0) aren't mistaken for a
+// big.LITTLE design.
+static bool findCoresByValue(const char* fileFormat, const cpu_set_t* allowed, cpu_set_t* set)
+{
+    int values[CPU_SETSIZE] = {};
+    int lowestValue = INT_MAX;
+    int highestValue = 0;
+
+    for (int cpu = 0; cpu < CPU_SETSIZE; cpu++) {
+        if (!CPU_ISSET(cpu, allowed)) {
+            continue;
+        }
+
+        QFile file(QString::asprintf(fileFormat, cpu));
+        if (!file.open(QIODevice::ReadOnly)) {
+            continue;
+        }
+
+        values[cpu] = file.readAll().trimmed().toInt();
+        if (values[cpu] > 0) {
+            lowestValue = qMin(lowestValue, values[cpu]);
+            highestValue = qMax(highestValue, values[cpu]);
+        }
+    }
+
+    int threshold = highestValue - highestValue * PERFORMANCE_CORE_GAP_PERCENT / 100;
+    if (highestValue == 0 || lowestValue > threshold) {
+        // All cores are about the same (or we couldn't tell)
+        return false;
+    }
+
+    CPU_ZERO(set);
+    for (int cpu = 0; cpu < CPU_SETSIZE; cpu++) {
+        if (values[cpu] > threshold) {
+            CPU_SET(cpu, set);
+        }
+    }
+
+    return true;
+}
+
+static CPU_AFFINITY findPerformanceCores()
+{
+    CPU_AFFINITY cores = {};
+    cpu_set_t allowed;
+
+    if (sched_getaffinity(0, sizeof(allowed), &allowed) < 0) {
+        return cores;
+    }
+
+    // Intel hybrid CPUs list their P-cores directly
+    QFile coreList("/sys/devices/cpu_core/cpus");
+    if (coreList.open(QIODevice::ReadOnly) && parseCpuList(coreList.readAll(), &cores.mask)) {
+        cores.valid = true;
+    }
+    // ARM big.LITTLE designs report each core's relative capacity, which
+    // is the scheduler's own view of which cores are the LITTLE ones
+    else if (findCoresByValue("/sys/devices/system/cpu/cpu%d/cpu_capacity", &allowed, &cores.mask)) {
+        cores.valid = true;
+    }
+    // Otherwise exclude the cores with a much lower maximum frequency
+    else if (findCoresByValue("/sys/devices/system/cpu/cpu%d/cpufreq/cpuinfo_max_freq", &allowed, &cores.mask)) {
+        cores.valid = true;
+    }
+    else {
+        return cores;
+    }
+
+    CPU_AND(&cores.mask, &cores.mask, &allowed);
+
+    // Pinning to a single core would hurt more than the slower cores do
+    if (CPU_COUNT(&cores.mask) < 2 || CPU_EQUAL(&cores.mask, &allowed)) {
+        cores.valid = false;
+    }
+    else {
+        SDL_LogInfo(SDL_LOG_CATEGORY_APPLICATION,
+                    "Found %d performance cores for software decoding",
+                    CPU_COUNT(&cores.mask));
+    }
+
+    return cores;
+}
+
+#endif
+
+bool SoftwareDecodeProfile::getPerformanceCores(PCPU_AFFINITY cores)
+{
+#ifdef Q_OS_LINUX
+    static const CPU_AFFINITY s_PerformanceCores = findPerformanceCores();
+
+    if (qgetenv("DECODER_PIN_PERFORMANCE_CORES") == "0") {
+        return false;
+    }
+
+    *cores = s_PerformanceCores;
+    return cores->valid;
+#else
+    // Threads don't inherit affinity from their creator on Windows or macOS,
+    // so we can't reach FFmpeg's worker threads. Their schedulers already
+    // prefer performance cores for foreground work.
+    (void)cores;
+    return false;
+#endif
+}
+
+bool SoftwareDecodeProfile::pinThreadToPerformanceCores(PCPU_AFFINITY previous)
+{
+    CPU_AFFINITY cores;
+
+    if (previous != nullptr) {
+        previous->valid = false;
+    }
+
+    if (!getPerformanceCores(&cores)) {
+        return false;
+    }
+
+#ifdef Q_OS_LINUX
+    if (previous != nullptr && sched_getaffinity(0, sizeof(previous->mask), &previous->mask) < 0) {
+        return false;
+    }
+
+    if (sched_setaffinity(0, sizeof(cores.mask), &cores.mask) < 0) {
+        SDL_LogWarn(SDL_LOG_CATEGORY_APPLICATION,
+                    "sched_setaffinity() failed: %d",
+                    errno);
+        return false;
+    }
+
+    if (previous != nullptr) {
+        previous->valid = true;
+    }
+    return true;
+#else
+    return false;
+#endif
+}
+
+void SoftwareDecodeProfile::restoreThreadAffinity(PCPU_AFFINITY previous)
+{
+#ifdef Q_OS_LINUX
+    if (previous->valid) {
+        sched_setaffinity(0, sizeof(previous->mask), &previous->mask);
+        previous->valid = false;
+    }
+#else
+    (void)previous;
+#endif
+}
@@ -0,0 +1,56 @@
+#pragma once
+
+#include "SDL_compat.h"
+#include "decoder.h"
+
+#ifdef Q_OS_LINUX
+#include <sched.h>
+#endif
+
+extern "C" {
+#include <libavcodec/avcodec.h>
+}
+
+typedef struct _CPU_AFFINITY {
+    bool valid;
+#ifdef Q_OS_LINUX
+    cpu_set_t mask;
+#endif
+} CPU_AFFINITY, *PCPU_AFFINITY;
+
+// Chooses how software decoders use the CPU. Slice threading is used by
+// default because it adds no latency. With DECODER_THREAD_TYPE=auto, if the
+// test frame probes show that the CPU can't keep up with the stream that way,
+// frame threading is used to trade up to two frames of latency for throughput.
+// On CPUs with a mix of performance and efficiency cores, the decoder threads
+// are kept on the performance cores.
+//
+// DECODER_THREAD_TYPE=slice|frame forces the threading mode and
+// DECODER_PIN_PERFORMANCE_CORES=0 disables core pinning. For libdav1d,
+// DAV1D_THREADS and DAV1D_MAX_FRAME_DELAY override its thread settings.
+class SoftwareDecodeProfile {
+public:
+    // Records the time taken to decode a warm test frame of the given size
+    // with a single thread. Callable from any thread.
+    static void recordTestDecode(const AVCodec* decoder, int width, int height, uint64_t decodeTimeUs);
+
+    // Sets the threading options on a software decoder context prior to avcodec_open2()
+    static void prepareDecoderContext(AVCodecContext* context, PDECODER_PARAMETERS params,
+                                      int slices, AVDictionary** options);
+
+    // Restricts the calling thread (and any threads that it creates) to the
+    // performance cores. If previous is non-null, the old affinity is stored
+    // there for restoreThreadAffinity(). Returns false if the CPU doesn't
+    // have distinct performance cores or pinning is disabled.
+    static bool pinThreadToPerformanceCores(PCPU_AFFINITY previous);
+
+    static void restoreThreadAffinity(PCPU_AFFINITY previous);
+
+    // Returns false if the CPU doesn't have distinct performance cores or pinning is disabled
+    static bool getPerformanceCores(PCPU_AFFINITY cores);
+
+private:
+
+    // Estimated time to decode a frame of this size with one thread, or 0 if unknown
+    static uint64_t estimateDecodeTimeUs(const AVCodec* decoder, int width, int height);
+};
@@ -0,0 +1,368 @@
+#include "spsrewriter.h"
+
+// Copies the RBSP bits of a NALU from the input to the output, removing
+// emulation prevention bytes as it reads and inserting them as it writes.
+// Fields can be read and rewritten with a different value along the way.
+class SpsBitCopier {
+public:
+    SpsBitCopier(const uint8_t* input, int inputLength, uint8_t* output, int outputCapacity)
+        : m_Input(input),
+          m_InputLength(inputLength),
+          m_InputIndex(0),
+          m_InputZeroCount(0),
+          m_InputByte(0),
+          m_InputBitsLeft(0),
+          m_Output(output),
+          m_OutputCapacity(outputCapacity),
+          m_OutputIndex(0),
+          m_OutputZeroCount(0),
+          m_OutputByte(0),
+          m_OutputBits(0),
+          m_Error(false)
+    {
+    }
+
+    bool hasError()
+    {
+        return m_Error;
+    }
+
+    // Position of the next bit to read, counting emulation prevention bytes
+    int inputPosition()
+    {
+        return m_InputIndex * 8 - m_InputBitsLeft;
+    }
+
+    int outputLength()
+    {
+        return m_OutputIndex;
+    }
+
+    uint32_t readBit()
+    {
+        if (m_InputBitsLeft == 0) {
+            if (m_InputIndex < m_InputLength && m_InputZeroCount >= 2 && m_Input[m_InputIndex] == 0x03) {
+                m_InputIndex++;
+                m_InputZeroCount = 0;
+            }
+            if (m_InputIndex >= m_InputLength) {
+                m_Error = true;
+                return 0;
+            }
+
+            m_InputByte = m_Input[m_InputIndex++];
+            m_InputZeroCount = m_InputByte == 0 ? m_InputZeroCount + 1 : 0;
+            m_InputBitsLeft = 8;
+        }
+
+        m_InputBitsLeft--;
+        return (m_InputByte >> m_InputBitsLeft) & 1;
+    }
+
+    uint32_t readUe()
+    {
+        int leadingZeros = 0;
+        while (!readBit()) {
+            if (m_Error || ++leadingZeros > 31) {
+                m_Error = true;
+                return 0;
+            }
+        }
+
+        uint32_t value = 0;
+        for (int i = 0; i < leadingZeros; i++) {
+            value = (value << 1) | readBit();
+        }
+        return (uint32_t)((1ULL << leadingZeros) - 1 + value);
+    }
+
+    void writeBit(uint32_t bit)
+    {
+        m_OutputByte = (uint8_t)((m_OutputByte << 1) | bit);
+        if (++m_OutputBits == 8) {
+            // Escape anything that could look like a start code
+            if (m_OutputZeroCount >= 2 && m_OutputByte <= 0x03) {
+                putByte(0x03);
+                m_OutputZeroCount = 0;
+            }
+
+            putByte(m_OutputByte);
+            m_OutputZeroCount = m_OutputByte == 0 ? m_OutputZeroCount + 1 : 0;
+            m_OutputByte = 0;
+            m_OutputBits = 0;
+        }
+    }
+
+    void writeUe(uint32_t value)
+    {
+        uint64_t codeNum = (uint64_t)value + 1;
+        int bits = 0;
+        while ((codeNum >> bits) > 1) {
+            bits++;
+        }
+
+        for (int i = 0; i < bits; i++) {
+            writeBit(0);
+        }
+        for (int i = bits; i >= 0; i--) {
+            writeBit((codeNum >> i) & 1);
+        }
+    }
+
+    uint32_t copyBits(int count)
+    {
+        uint32_t value = 0;
+        for (int i = 0; i < count; i++) {
+            uint32_t bit = readBit();
+            writeBit(bit);
+            value = (value << 1) | bit;
+        }
+        return value;
+    }
+
+    uint32_t copyUe()
+    {
+        uint32_t value = readUe();
+        writeUe(value);
+        return value;
+    }
+
+    int32_t copySe()
+    {
+        uint32_t value = copyUe();
+        return (value & 1) ? (int32_t)((value + 1) / 2) : -(int32_t)(value / 2);
+    }
+
+    uint32_t replaceUe(uint32_t newValue)
+    {
+        uint32_t value = readUe();
+        writeUe(newValue);
+        return value;
+    }
+
+    void copyHrdParameters()
+    {
+        uint32_t cpbCount = copyUe() + 1;
+        if (cpbCount > 32) {
+            m_Error = true;
+            return;
+        }
+
+        copyBits(4); // bit_rate_scale
+        copyBits(4); // cpb_size_scale
+        for (uint32_t i = 0; i < cpbCount && !m_Error; i++) {
+            copyUe(); // bit_rate_value_minus1
+            copyUe(); // cpb_size_value_minus1
+            copyBits(1); // cbr_flag
+        }
+        copyBits(5); // initial_cpb_removal_delay_length_minus1
+        copyBits(5); // cpb_removal_delay_length_minus1
+        copyBits(5); // dpb_output_delay_length_minus1
+        copyBits(5); // time_offset_length
+    }
+
+    void writeTrailingBits()
+    {
+        writeBit(1);
+        while (m_OutputBits != 0) {
+            writeBit(0);
+        }
+    }
+
+private:
+    void putByte(uint8_t value)
+    {
+        if (m_OutputIndex >= m_OutputCapacity) {
+            m_Error = true;
+            return;
+        }
+
+        m_Output[m_OutputIndex++] = value;
+    }
+
+    const uint8_t* m_Input;
+    int m_InputLength;
+    int m_InputIndex;
+    int m_InputZeroCount;
+    uint8_t m_InputByte;
+    int m_InputBitsLeft;
+
+    uint8_t* m_Output;
+    int m_OutputCapacity;
+    int m_OutputIndex;
+    int m_OutputZeroCount;
+    uint8_t m_OutputByte;
+    int m_OutputBits;
+
+    bool m_Error;
+};
+
+int SpsRewriter::rewriteH264(const uint8_t* sps, int length, int nalStart,
+                             uint32_t numRefFrames, uint32_t maxDecFrameBuffering,
+                             uint8_t* output, int outputCapacity)
+{
+    // The RBSP starts after the 1 byte NAL header
+    int rbspStart = nalStart + 1;
+    if (rbspStart >= length || rbspStart >= outputCapacity) {
+        return 0;
+    }
+
+    // Find the rbsp_stop_one_bit, which is the last set bit of the NALU
+    int lastByte = length - 1;
+    while (lastByte >= rbspStart && sps[lastByte] == 0) {
+        lastByte--;
+    }
+    if (lastByte < rbspStart) {
+        return 0;
+    }
+
+    int stopBitPosition = (lastByte - rbspStart) * 8 + 7;
+    for (uint8_t value = sps[lastByte]; !(value & 1); value >>= 1) {
+        stopBitPosition--;
+    }
+
+    SpsBitCopier copier(&sps[rbspStart], length - rbspStart,
+                        &output[rbspStart], outputCapacity - rbspStart);
+
+    uint32_t profileIdc = copier.copyBits(8);
+    copier.copyBits(8); // constraint_set flags and reserved_zero_2bits
+    copier.copyBits(8); // level_idc
+    copier.copyUe(); // seq_parameter_set_id
+
+    if (profileIdc == 100 || profileIdc == 110 || profileIdc == 122 ||
+            profileIdc == 244 || profileIdc == 44 || profileIdc == 83 ||
+            profileIdc == 86 || profileIdc == 118 || profileIdc == 128 ||
+            profileIdc == 138 || profileIdc == 139 || profileIdc == 134 ||
+            profileIdc == 135) {
+        uint32_t chromaFormatIdc = copier.copyUe();
+        if (chromaFormatIdc == 3) {
+            copier.copyBits(1); // separate_colour_plane_flag
+        }
+        copier.copyUe(); // bit_depth_luma_minus8
+        copier.copyUe(); // bit_depth_chroma_minus8
+        copier.copyBits(1); // qpprime_y_zero_transform_bypass_flag
+
+        if (copier.copyBits(1)) { // seq_scaling_matrix_present_flag
+            for (int i = 0; i < (chromaFormatIdc != 3 ? 8 : 12) && !copier.hasError(); i++) {
+                if (copier.copyBits(1)) { // seq_scaling_list_present_flag
+                    int lastScale = 8, nextScale = 8;
+                    for (int j = 0; j < (i < 6 ? 16 : 64) && !copier.hasError(); j++) {
+                        if (nextScale != 0) {
+                            nextScale = (lastScale + copier.copySe() + 256) % 256;
+                        }
+                        lastScale = (nextScale == 0) ? lastScale : nextScale;
+                    }
+                }
+            }
+        }
+    }
+
+    copier.copyUe(); // log2_max_frame_num_minus4
+
+    uint32_t picOrderCntType = copier.copyUe();
+    if (picOrderCntType == 0) {
+        copier.copyUe(); // log2_max_pic_order_cnt_lsb_minus4
+    }
+    else if (picOrderCntType == 1) {
+        copier.copyBits(1); // delta_pic_order_always_zero_flag
+        copier.copySe(); // offset_for_non_ref_pic
+        copier.copySe(); // offset_for_top_to_bottom_field
+        uint32_t refFramesInPicOrderCntCycle = copier.copyUe();
+        if (refFramesInPicOrderCntCycle > 255) {
+            return 0;
+        }
+        for (uint32_t i = 0; i < refFramesInPicOrderCntCycle && !copier.hasError(); i++) {
+            copier.copySe(); // offset_for_ref_frame
+        }
+    }
+
+    copier.replaceUe(numRefFrames);
+
+    copier.copyBits(1); // gaps_in_frame_num_value_allowed_flag
+    copier.copyUe(); // pic_width_in_mbs_minus1
+    copier.copyUe(); // pic_height_in_map_units_minus1
+    if (!copier.copyBits(1)) { // frame_mbs_only_flag
+        copier.copyBits(1); // mb_adaptive_frame_field_flag
+    }
+    copier.copyBits(1); // direct_8x8_inference_flag
+    if (copier.copyBits(1)) { // frame_cropping_flag
+        copier.copyUe();
+        copier.copyUe();
+        copier.copyUe();
+        copier.copyUe();
+    }
+
+    if (copier.copyBits(1)) { // vui_parameters_present_flag
+        if (copier.copyBits(1)) { // aspect_ratio_info_present_flag
+            if (copier.copyBits(8) == 255) { // aspect_ratio_idc is Extended_SAR
+                copier.copyBits(16); // sar_width
+                copier.copyBits(16); // sar_height
+            }
+        }
+        if (copier.copyBits(1)) { // overscan_info_present_flag
+            copier.copyBits(1); // overscan_appropriate_flag
+        }
+        if (copier.copyBits(1)) { // video_signal_type_present_flag
+            copier.copyBits(3); // video_format
+            copier.copyBits(1); // video_full_range_flag
+            if (copier.copyBits(1)) { // colour_description_present_flag
+                copier.copyBits(8); // colour_primaries
+                copier.copyBits(8); // transfer_characteristics
+                copier.copyBits(8); // matrix_coefficients
+            }
+        }
+        if (copier.copyBits(1)) { // chroma_loc_info_present_flag
+            copier.copyUe();
+            copier.copyUe();
+        }
+        if (copier.copyBits(1)) { // timing_info_present_flag
+            copier.copyBits(32); // num_units_in_tick
+            copier.copyBits(32); // time_scale
+            copier.copyBits(1); // fixed_frame_rate_flag
+        }
+
+        bool nalHrdPresent = copier.copyBits(1);
+        if (nalHrdPresent) {
+            copier.copyHrdParameters();
+        }
+        bool vclHrdPresent = copier.copyBits(1);
+        if (vclHrdPresent) {
+            copier.copyHrdParameters();
+        }
+        if (nalHrdPresent || vclHrdPresent) {
+            copier.copyBits(1); // low_delay_hrd_flag
+        }
+
+        copier.copyBits(1); // pic_struct_present_flag
+        if (copier.copyBits(1)) { // bitstream_restriction_flag
+            copier.copyBits(1); // motion_vectors_over_pic_boundaries_flag
+            copier.copyUe(); // max_bytes_per_pic_denom
+            copier.copyUe(); // max_bits_per_mb_denom
+            copier.copyUe(); // log2_max_mv_length_horizontal
+            copier.copyUe(); // log2_max_mv_length_vertical
+            copier.copyUe(); // max_num_reorder_frames
+            copier.replaceUe(maxDecFrameBuffering);
+        }
+    }
+
+    if (copier.hasError() || copier.inputPosition() > stopBitPosition) {
+        return 0;
+    }
+
+    // Pass through anything we don't parse, like SPS extensions
+    while (copier.inputPosition() < stopBitPosition && !copier.hasError()) {
+        copier.copyBits(1);
+    }
+    copier.writeTrailingBits();
+
+    if (copier.hasError()) {
+        return 0;
+    }
+
+    // Copy the start code and NAL header as-is
+    for (int i = 0; i < rbspStart; i++) {
+        output[i] = sps[i];
+    }
+
+    return rbspStart + copier.outputLength();
+}
@@ -0,0 +1,18 @@
+#pragma once
+
+#include <stdint.h>
+
+// Patches num_ref_frames and (if the VUI has bitstream restrictions)
+// max_dec_frame_buffering in an H.264 SPS. It streams the exp-Golomb
+// coded fields straight from the input NALU to the output buffer,
+// handling emulation prevention on the fly, so it needs neither a heap
+// allocation nor a full parsed SPS like h264bitstream does.
+class SpsRewriter {
+public:
+    // sps is an Annex B NALU whose NAL header starts at nalStart. Returns
+    // the number of bytes written to output, or 0 if the SPS is malformed
+    // or the result doesn't fit in outputCapacity.
+    static int rewriteH264(const uint8_t* sps, int length, int nalStart,
+                           uint32_t numRefFrames, uint32_t maxDecFrameBuffering,
+                           uint8_t* output, int outputCapacity);
+};
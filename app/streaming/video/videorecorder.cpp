@@ -1,21 +1,54 @@
 #include "videorecorder.h"
+#include "streaming/streamutils.h"
 
 #include <SDL.h>
 #include <QDateTime>
 #include <QDir>
+#include <QFile>
 #include <QTextStream>
 
+extern "C" {
+#include <libavutil/opt.h>
+#include <libavutil/pixdesc.h>
+}
+
+// Limit the number of frames waiting for the writer thread. Each queued frame
+// holds a reference to a decoder surface, so this must stay small to avoid
+// starving the decoder's surface pool (see MAX_QUEUED_FRAMES in Pacer).
+#define MAX_QUEUED_RECORDER_FRAMES 3
+
+// Length of each lossless recording segment, unless overridden by
+// ML_RECORDING_SEGMENT_SECONDS
+#define DEFAULT_SEGMENT_SECONDS 60
+
+// Decoded frames carry their RTP timestamp in the 90 KHz timebase
+static const AVRational k_RtpTimeBase = { 1, 90000 };
+
 VideoRecorder::VideoRecorder()
     : m_Recording(false),
-      m_OutputFile(nullptr),
+      m_OutputType(OT_RAW),
       m_SwsCtx(nullptr),
       m_ConvertedFrame(nullptr),
-      m_FrameBuffer(nullptr),
+      m_MappedFrame(nullptr),
+      m_StagingFrame(nullptr),
+      m_ReadBackFormat(AV_PIX_FMT_NONE),
+      m_MapFrame(false),
       m_Width(0),
       m_Height(0),
       m_Fps(0),
       m_FrameCount(0),
-      m_LastInputFormat(AV_PIX_FMT_NONE)
+      m_DroppedFrameCount(0),
+      m_LastInputFormat(AV_PIX_FMT_NONE),
+      m_OutputFormat(AV_PIX_FMT_NONE),
+      m_Encoder(nullptr),
+      m_EncoderCtx(nullptr),
+      m_FormatCtx(nullptr),
+      m_Stream(nullptr),
+      m_Packet(nullptr),
+      m_LastRtpTimestamp(0),
+      m_NextPts(0),
+      m_WriterThread(nullptr),
+      m_Stopping(false)
 {
 }
 
@@ -24,7 +57,7 @@ VideoRecorder::~VideoRecorder()
     finalize();
 }
 
-bool VideoRecorder::initialize(const QString& outputPath, int width, int height, int fps)
+bool VideoRecorder::initialize(const QString& outputPath, int width, int height, int fps, OutputType outputType)
 {
     QMutexLocker locker(&m_Mutex);
 
@@ -35,154 +68,744 @@ bool VideoRecorder::initialize(const QString& outputPath, int width, int height,
     }
 
     m_OutputPath = outputPath;
+    m_OutputType = outputType;
     m_Width = width;
     m_Height = height;
     m_Fps = fps;
     m_FrameCount = 0;
+    m_DroppedFrameCount = 0;
+    m_NextPts = 0;
+
+    if (m_OutputType == OT_LOSSLESS) {
+        // The encoder and muxer are opened on the first frame, but make
+        // sure we can encode before claiming that we're recording
+        QByteArray codecName = qgetenv("ML_LOSSLESS_CODEC");
+        m_Encoder = avcodec_find_encoder_by_name(codecName.isEmpty() ? "ffv1" : codecName.constData());
+        if (m_Encoder == nullptr) {
+            SDL_LogError(SDL_LOG_CATEGORY_APPLICATION,
+                         "VideoRecorder: Lossless encoder '%s' is not available",
+                         codecName.isEmpty() ? "ffv1" : codecName.constData());
+            return false;
+        }
 
-    // Open the output file for raw YUV data
-    m_OutputFile = new QFile(outputPath);
-    if (!m_OutputFile->open(QIODevice::WriteOnly)) {
+        m_Packet = av_packet_alloc();
+        if (!m_Packet) {
+            SDL_LogError(SDL_LOG_CATEGORY_APPLICATION,
+                         "VideoRecorder: Could not allocate packet");
+            cleanup();
+            return false;
+        }
+    }
+    // Open the output file for raw YUV data. Direct I/O avoids thrashing the
+    // page cache during long captures, but requires a fast disk to keep up.
+    else if (!m_OutputFile.open(outputPath, qEnvironmentVariableIntValue("RECORDING_DIRECT_IO") != 0)) {
         SDL_LogError(SDL_LOG_CATEGORY_APPLICATION,
                      "VideoRecorder: Could not open output file: %s",
                      outputPath.toUtf8().constData());
-        delete m_OutputFile;
-        m_OutputFile = nullptr;
         return false;
     }
 
-    // Allocate frame for format conversion to YUV420P
+    // Allocate frame for format conversion (if the decoder format can't be written directly)
     m_ConvertedFrame = av_frame_alloc();
     if (!m_ConvertedFrame) {
         SDL_LogError(SDL_LOG_CATEGORY_APPLICATION,
                      "VideoRecorder: Could not allocate converted frame");
-        finalize();
+        cleanup();
         return false;
     }
 
-    m_ConvertedFrame->format = AV_PIX_FMT_YUV420P;
-    m_ConvertedFrame->width = width;
-    m_ConvertedFrame->height = height;
-
-    // Allocate buffer for converted frame
-    int bufferSize = av_image_get_buffer_size(AV_PIX_FMT_YUV420P, width, height, 1);
-    m_FrameBuffer = (uint8_t*)av_malloc(bufferSize);
-    if (!m_FrameBuffer) {
+    m_MappedFrame = av_frame_alloc();
+    m_StagingFrame = av_frame_alloc();
+    if (!m_MappedFrame || !m_StagingFrame) {
         SDL_LogError(SDL_LOG_CATEGORY_APPLICATION,
-                     "VideoRecorder: Could not allocate frame buffer");
-        finalize();
+                     "VideoRecorder: Could not allocate readback frames");
+        cleanup();
         return false;
     }
 
-    av_image_fill_arrays(m_ConvertedFrame->data, m_ConvertedFrame->linesize,
-                         m_FrameBuffer, AV_PIX_FMT_YUV420P, width, height, 1);
+    m_ReadBackFormat = AV_PIX_FMT_NONE;
+    m_MapFrame = false;
+
+    // The output format is chosen once we see the first frame from the decoder
+    m_OutputFormat = AV_PIX_FMT_NONE;
+    m_LastInputFormat = AV_PIX_FMT_NONE;
+
+    m_Stopping = false;
+    m_WriterThread = SDL_CreateThread(VideoRecorder::writerThreadProc, "VideoRecorder", this);
+    if (m_WriterThread == nullptr) {
+        SDL_LogError(SDL_LOG_CATEGORY_APPLICATION,
+                     "VideoRecorder: Failed to create writer thread: %s",
+                     SDL_GetError());
+        cleanup();
+        return false;
+    }
 
     m_Recording = true;
 
+    SDL_LogInfo(SDL_LOG_CATEGORY_APPLICATION,
+                "VideoRecorder: Started recording %s to %s (%dx%d @ %d fps)",
+                m_OutputType == OT_LOSSLESS ? m_Encoder->name : (m_OutputType == OT_Y4M ? "Y4M" : "YUV"),
+                outputPath.toUtf8().constData(), width, height, fps);
+
+    return true;
+}
+
+bool VideoRecorder::submitFrame(AVFrame* frame)
+{
+    if (!m_Recording || !frame) {
+        return false;
+    }
+
+    m_FrameQueueLock.lock();
+
+    // Never block the decoder thread waiting on disk I/O. If the writer
+    // has fallen behind, drop this frame from the recording instead.
+    if (m_FrameQueue.size() >= MAX_QUEUED_RECORDER_FRAMES) {
+        m_DroppedFrameCount++;
+        m_FrameQueueLock.unlock();
+        return false;
+    }
+
+    m_FrameQueueLock.unlock();
+
+    // Take our own reference so the live frame can continue on to Pacer
+    AVFrame* recordFrame = av_frame_alloc();
+    if (!recordFrame) {
+        return false;
+    }
+
+    if (av_frame_ref(recordFrame, frame) < 0) {
+        av_frame_free(&recordFrame);
+        return false;
+    }
+
+    m_FrameQueueLock.lock();
+    m_FrameQueue.enqueue(recordFrame);
+    m_FrameQueueLock.unlock();
+
+    m_FrameQueueNotEmpty.wakeOne();
+    return true;
+}
+
+int VideoRecorder::writerThreadProc(void* context)
+{
+    VideoRecorder* me = reinterpret_cast<VideoRecorder*>(context);
+
+    // Recording must never compete with the decoder or render threads
+    SDL_SetThreadPriority(SDL_THREAD_PRIORITY_LOW);
+    StreamUtils::placeCurrentThread(StreamUtils::TPC_BACKGROUND);
+
+    for (;;) {
+        me->m_FrameQueueLock.lock();
+
+        while (!me->m_Stopping && me->m_FrameQueue.isEmpty()) {
+            me->m_FrameQueueNotEmpty.wait(&me->m_FrameQueueLock);
+        }
+
+        // Drain all remaining frames before exiting
+        if (me->m_FrameQueue.isEmpty()) {
+            SDL_assert(me->m_Stopping);
+            me->m_FrameQueueLock.unlock();
+            break;
+        }
+
+        AVFrame* frame = me->m_FrameQueue.dequeue();
+        me->m_FrameQueueLock.unlock();
+
+        me->writeFrame(frame);
+        av_frame_free(&frame);
+    }
+
+    return 0;
+}
+
+bool VideoRecorder::initializeReadBackFormat(AVFrame* hwFrame)
+{
+    auto hwFrameCtx = (AVHWFramesContext*)hwFrame->hw_frames_ctx->data;
+    enum AVPixelFormat *formats;
+    int err;
+
+    SDL_assert(m_ReadBackFormat == AV_PIX_FMT_NONE);
+
+    // Prefer mapping the surface over copying it, since a copy stalls until
+    // the GPU is done with the frame and costs an extra pass over memory.
+    err = av_hwframe_map(m_MappedFrame, hwFrame, AV_HWFRAME_MAP_READ);
+    if (err == 0) {
+        enum AVPixelFormat mappedFormat = (AVPixelFormat)m_MappedFrame->format;
+        av_frame_unref(m_MappedFrame);
+
+        if (sws_isSupportedInput(mappedFormat)) {
+            m_ReadBackFormat = mappedFormat;
+            m_MapFrame = true;
+            goto Exit;
+        }
+    }
+
+    err = av_hwframe_transfer_get_formats(hwFrame->hw_frames_ctx, AV_HWFRAME_TRANSFER_DIRECTION_FROM, &formats, 0);
+    if (err == 0) {
+        for (int i = 0; formats[i] != AV_PIX_FMT_NONE; i++) {
+            if (sws_isSupportedInput(formats[i])) {
+                m_ReadBackFormat = formats[i];
+                break;
+            }
+        }
+
+        av_freep(&formats);
+    }
+
+    if (m_ReadBackFormat == AV_PIX_FMT_NONE) {
+        if (!sws_isSupportedInput(hwFrameCtx->sw_format)) {
+            SDL_LogError(SDL_LOG_CATEGORY_APPLICATION,
+                         "VideoRecorder: Unable to find compatible hwframe transfer format (sw_format = %d)",
+                         hwFrameCtx->sw_format);
+            return false;
+        }
+
+        m_ReadBackFormat = hwFrameCtx->sw_format;
+    }
+
+Exit:
+    SDL_LogInfo(SDL_LOG_CATEGORY_APPLICATION,
+                "VideoRecorder: Selected hwframe readback format: %d (mapping: %s)",
+                m_ReadBackFormat,
+                m_MapFrame ? "yes" : "no");
+    return true;
+}
+
+AVFrame* VideoRecorder::getSwFrameFromHwFrame(AVFrame* hwFrame)
+{
+    int err;
+
+    if (m_ReadBackFormat == AV_PIX_FMT_NONE && !initializeReadBackFormat(hwFrame)) {
+        return nullptr;
+    }
+
+    if (m_MapFrame) {
+        // Like SwFrameMapper, we avoid AV_HWFRAME_MAP_DIRECT because direct
+        // mappings can be uncached memory that is extremely slow to read.
+        m_MappedFrame->format = m_ReadBackFormat;
+        err = av_hwframe_map(m_MappedFrame, hwFrame, AV_HWFRAME_MAP_READ);
+        if (err < 0) {
+            SDL_LogError(SDL_LOG_CATEGORY_APPLICATION,
+                         "VideoRecorder: av_hwframe_map() failed: %d",
+                         err);
+            av_frame_unref(m_MappedFrame);
+            return nullptr;
+        }
+
+        return m_MappedFrame;
+    }
+
+    // (Re)allocate the staging frame if the stream geometry changed. Since we have
+    // a single writer thread, one staging frame is reused for every transfer.
+    if (m_StagingFrame->width != hwFrame->width || m_StagingFrame->height != hwFrame->height) {
+        av_frame_unref(m_StagingFrame);
+
+        m_StagingFrame->format = m_ReadBackFormat;
+        m_StagingFrame->width = hwFrame->width;
+        m_StagingFrame->height = hwFrame->height;
+
+        err = av_frame_get_buffer(m_StagingFrame, 0);
+        if (err < 0) {
+            SDL_LogError(SDL_LOG_CATEGORY_APPLICATION,
+                         "VideoRecorder: Could not allocate staging frame: %d",
+                         err);
+            av_frame_unref(m_StagingFrame);
+            return nullptr;
+        }
+    }
+
+    // Transferring into a frame with existing buffers avoids allocating per frame
+    err = av_hwframe_transfer_data(m_StagingFrame, hwFrame, 0);
+    if (err < 0) {
+        char errstr[AV_ERROR_MAX_STRING_SIZE];
+        av_strerror(err, errstr, sizeof(errstr));
+        SDL_LogError(SDL_LOG_CATEGORY_APPLICATION,
+                     "VideoRecorder: Failed to transfer hw frame: %s", errstr);
+        return nullptr;
+    }
+
+    return m_StagingFrame;
+}
+
+// Colorspace tags for the formats that Y4M can represent natively
+static const char* getY4mColorspace(enum AVPixelFormat format)
+{
+    switch (format) {
+    case AV_PIX_FMT_YUV420P:
+    case AV_PIX_FMT_YUVJ420P:
+        // H.264 and HEVC default to left-sited chroma
+        return "420mpeg2";
+    case AV_PIX_FMT_YUV420P10LE:
+        return "420p10 XYSCSS=420P10";
+    case AV_PIX_FMT_YUV444P:
+    case AV_PIX_FMT_YUVJ444P:
+        return "444";
+    case AV_PIX_FMT_YUV444P10LE:
+        return "444p10 XYSCSS=444P10";
+    case AV_PIX_FMT_GRAY8:
+        return "mono";
+    default:
+        return nullptr;
+    }
+}
+
+enum AVPixelFormat VideoRecorder::selectOutputFormat(enum AVPixelFormat inputFormat)
+{
+    const AVPixFmtDescriptor* desc = av_pix_fmt_desc_get(inputFormat);
+    if (desc == nullptr) {
+        SDL_LogError(SDL_LOG_CATEGORY_APPLICATION,
+                     "VideoRecorder: Unknown input format: %d",
+                     inputFormat);
+        return AV_PIX_FMT_NONE;
+    }
+
+    // Raw output can store any software layout as-is (NV12, P010, etc).
+    // The .meta file tells the reader which format it is.
+    if (m_OutputType == OT_RAW || (m_OutputType == OT_Y4M && getY4mColorspace(inputFormat) != nullptr)) {
+        return inputFormat;
+    }
+
+    const enum AVPixelFormat* encoderFormats = nullptr;
+    if (m_OutputType == OT_LOSSLESS) {
+#if LIBAVCODEC_VERSION_INT >= AV_VERSION_INT(61, 13, 100)
+        avcodec_get_supported_config(nullptr, m_Encoder, AV_CODEC_CONFIG_PIX_FORMAT, 0,
+                                     (const void**)&encoderFormats, nullptr);
+#else
+        encoderFormats = m_Encoder->pix_fmts;
+#endif
+        for (int i = 0; encoderFormats != nullptr && encoderFormats[i] != AV_PIX_FMT_NONE; i++) {
+            if (encoderFormats[i] == inputFormat) {
+                return inputFormat;
+            }
+        }
+    }
+
+    // Otherwise pick the closest planar format that Y4M supports, so
+    // we never lose chroma resolution or bit depth in the conversion.
+    bool highBitDepth = desc->comp[0].depth > 8;
+    bool fullChroma = desc->log2_chroma_w == 0 && desc->log2_chroma_h == 0;
+    enum AVPixelFormat outputFormat;
+    if (fullChroma) {
+        outputFormat = highBitDepth ? AV_PIX_FMT_YUV444P10LE : AV_PIX_FMT_YUV444P;
+    }
+    else {
+        outputFormat = highBitDepth ? AV_PIX_FMT_YUV420P10LE : AV_PIX_FMT_YUV420P;
+    }
+
+    // FFV1 takes all of these, but other lossless encoders may not
+    // (UTVideo has no 10-bit support, for example)
+    if (encoderFormats != nullptr) {
+        for (int i = 0; encoderFormats[i] != AV_PIX_FMT_NONE; i++) {
+            if (encoderFormats[i] == outputFormat) {
+                return outputFormat;
+            }
+        }
+
+        enum AVPixelFormat closestFormat = avcodec_find_best_pix_fmt_of_list(encoderFormats, outputFormat, 0, nullptr);
+        SDL_LogWarn(SDL_LOG_CATEGORY_APPLICATION,
+                    "VideoRecorder: %s can't encode %s. Recording will be converted to %s.",
+                    m_Encoder->name,
+                    av_get_pix_fmt_name(outputFormat),
+                    av_get_pix_fmt_name(closestFormat));
+        outputFormat = closestFormat;
+    }
+
+    return outputFormat;
+}
+
+bool VideoRecorder::writeHeader(AVFrame* frame)
+{
+    // Use the real frame geometry rather than the negotiated stream size
+    m_Width = frame->width;
+    m_Height = frame->height;
+
+    SDL_LogInfo(SDL_LOG_CATEGORY_APPLICATION,
+                "VideoRecorder: Writing %s (decoder format: %s, conversion: %s)",
+                av_get_pix_fmt_name(m_OutputFormat),
+                av_get_pix_fmt_name((AVPixelFormat)frame->format),
+                frame->format == m_OutputFormat ? "no" : "yes");
+
+    if (m_OutputType == OT_LOSSLESS) {
+        return initializeEncoder(frame);
+    }
+
+    if (m_OutputType == OT_Y4M) {
+        // Y4M carries the frame geometry in the stream header, so no .meta file is needed
+        QByteArray header = QString("YUV4MPEG2 W%1 H%2 F%3:1 Ip A1:1 C%4 XCOLORRANGE=%5\n")
+                                .arg(m_Width).arg(m_Height).arg(m_Fps)
+                                .arg(getY4mColorspace(m_OutputFormat))
+                                .arg(frame->color_range == AVCOL_RANGE_JPEG ? "FULL" : "LIMITED")
+                                .toLatin1();
+        return m_OutputFile.write(header.constData(), header.size());
+    }
+
     // Write metadata file alongside the YUV file
-    QString metaPath = outputPath + ".meta";
+    const char* formatName = av_get_pix_fmt_name(m_OutputFormat);
+    QString metaPath = m_OutputPath + ".meta";
     QFile metaFile(metaPath);
     if (metaFile.open(QIODevice::WriteOnly | QIODevice::Text)) {
         QTextStream out(&metaFile);
-        out << "width=" << width << "\n";
-        out << "height=" << height << "\n";
-        out << "fps=" << fps << "\n";
-        out << "format=yuv420p\n";
+        out << "width=" << m_Width << "\n";
+        out << "height=" << m_Height << "\n";
+        out << "fps=" << m_Fps << "\n";
+        out << "format=" << formatName << "\n";
         out << "# To convert to MP4, run:\n";
-        out << "# ffmpeg -f rawvideo -pix_fmt yuv420p -s " << width << "x" << height 
-            << " -r " << fps << " -i \"" << outputPath << "\" -c:v libx264 -pix_fmt yuv420p output.mp4\n";
+        out << "# ffmpeg -f rawvideo -pix_fmt " << formatName << " -s " << m_Width << "x" << m_Height
+            << " -r " << m_Fps << " -i \"" << m_OutputPath << "\" -c:v libx264 -pix_fmt yuv420p output.mp4\n";
         metaFile.close();
     }
 
-    SDL_LogInfo(SDL_LOG_CATEGORY_APPLICATION,
-                "VideoRecorder: Started recording YUV to %s (%dx%d @ %d fps)",
-                outputPath.toUtf8().constData(), width, height, fps);
-
     return true;
 }
 
-bool VideoRecorder::writeFrame(AVFrame* frame)
+bool VideoRecorder::initializeEncoder(AVFrame* frame)
 {
-    QMutexLocker locker(&m_Mutex);
+    int err;
+
+    // Number each segment before the extension. The segment muxer treats the
+    // path as a pattern, so any '%' that is already in it must be escaped.
+    QString pattern = m_OutputPath;
+    pattern.replace("%", "%%");
+    int extensionIndex = pattern.lastIndexOf('.');
+    pattern.insert(extensionIndex >= 0 ? extensionIndex : pattern.size(), "_%03d");
+    QByteArray patternStr = pattern.toUtf8();
+
+    err = avformat_alloc_output_context2(&m_FormatCtx, nullptr, "segment", patternStr.constData());
+    if (err < 0) {
+        SDL_LogError(SDL_LOG_CATEGORY_APPLICATION,
+                     "VideoRecorder: avformat_alloc_output_context2() failed: %d",
+                     err);
+        closeEncoder();
+        return false;
+    }
 
-    if (!m_Recording || !frame || !m_OutputFile) {
+    m_EncoderCtx = avcodec_alloc_context3(m_Encoder);
+    if (!m_EncoderCtx) {
+        SDL_LogError(SDL_LOG_CATEGORY_APPLICATION,
+                     "VideoRecorder: avcodec_alloc_context3() failed");
+        closeEncoder();
         return false;
     }
 
-    AVFrame* swFrame = frame;
-    AVFrame* tempFrame = nullptr;
-
-    // Check if frame is in hardware format (e.g., VideoToolbox)
-    // Hardware formats have frame->hw_frames_ctx set or format is a hw format
-    if (frame->hw_frames_ctx || frame->format == AV_PIX_FMT_VIDEOTOOLBOX) {
-        // Transfer from GPU to CPU
-        tempFrame = av_frame_alloc();
-        if (!tempFrame) {
+    m_EncoderCtx->width = m_Width;
+    m_EncoderCtx->height = m_Height;
+    m_EncoderCtx->pix_fmt = m_OutputFormat;
+    m_EncoderCtx->time_base = k_RtpTimeBase;
+    m_EncoderCtx->framerate = av_make_q(m_Fps, 1);
+    m_EncoderCtx->color_range = frame->color_range;
+    m_EncoderCtx->colorspace = frame->colorspace;
+    m_EncoderCtx->color_primaries = frame->color_primaries;
+    m_EncoderCtx->color_trc = frame->color_trc;
+    m_EncoderCtx->chroma_sample_location = frame->chroma_location;
+
+    // A key frame every second lets each segment end close to its target length
+    m_EncoderCtx->gop_size = m_Fps;
+
+    // Leave a couple of cores for the decoder and renderer. Slice threading
+    // spreads each frame across the encoder's thread pool and, unlike frame
+    // threading, doesn't hold on to our frames once the packet is out.
+    int threads = qBound(1, SDL_GetCPUCount() - 2, 16);
+    m_EncoderCtx->thread_count = threads;
+    m_EncoderCtx->thread_type = FF_THREAD_SLICE;
+
+    if (m_Encoder->id == AV_CODEC_ID_FFV1) {
+        // FFV1 only threads across slices, and 4, 9 and 16 are all valid counts.
+        // The range coder compresses noticeably better than Golomb-Rice, and
+        // slice CRCs let a damaged file be decoded around the damage.
+        m_EncoderCtx->slices = threads > 9 ? 16 : (threads > 4 ? 9 : 4);
+        av_opt_set(m_EncoderCtx->priv_data, "coder", "range_def", 0);
+        av_opt_set_int(m_EncoderCtx->priv_data, "slicecrc", 1, 0);
+    }
+
+    if (m_FormatCtx->oformat->flags & AVFMT_GLOBALHEADER) {
+        m_EncoderCtx->flags |= AV_CODEC_FLAG_GLOBAL_HEADER;
+    }
+
+    err = avcodec_open2(m_EncoderCtx, m_Encoder, nullptr);
+    if (err < 0) {
+        char string[AV_ERROR_MAX_STRING_SIZE];
+        SDL_LogError(SDL_LOG_CATEGORY_APPLICATION,
+                     "VideoRecorder: avcodec_open2() failed: %s",
+                     av_make_error_string(string, sizeof(string), err));
+        closeEncoder();
+        return false;
+    }
+
+    AVStream* stream = avformat_new_stream(m_FormatCtx, nullptr);
+    if (stream == nullptr) {
+        SDL_LogError(SDL_LOG_CATEGORY_APPLICATION,
+                     "VideoRecorder: avformat_new_stream() failed");
+        closeEncoder();
+        return false;
+    }
+
+    avcodec_parameters_from_context(stream->codecpar, m_EncoderCtx);
+    stream->time_base = m_EncoderCtx->time_base;
+    stream->avg_frame_rate = m_EncoderCtx->framerate;
+
+    int segmentSeconds = qEnvironmentVariableIntValue("ML_RECORDING_SEGMENT_SECONDS");
+    if (segmentSeconds <= 0) {
+        segmentSeconds = DEFAULT_SEGMENT_SECONDS;
+    }
+
+    // Every segment is a complete Matroska file starting at time zero,
+    // so a crash only loses the segment that was being written
+    AVDictionary* options = nullptr;
+    av_dict_set(&options, "segment_format", "matroska", 0);
+    av_dict_set_int(&options, "segment_time", segmentSeconds, 0);
+    av_dict_set(&options, "reset_timestamps", "1", 0);
+    err = avformat_write_header(m_FormatCtx, &options);
+    av_dict_free(&options);
+    if (err < 0) {
+        char string[AV_ERROR_MAX_STRING_SIZE];
+        SDL_LogError(SDL_LOG_CATEGORY_APPLICATION,
+                     "VideoRecorder: avformat_write_header() failed: %s",
+                     av_make_error_string(string, sizeof(string), err));
+        closeEncoder();
+        return false;
+    }
+
+    // The muxer may have chosen a different timebase in avformat_write_header()
+    m_Stream = stream;
+
+    SDL_LogInfo(SDL_LOG_CATEGORY_APPLICATION,
+                "VideoRecorder: Encoding with %s on %d threads into %d second segments: %s",
+                m_Encoder->name,
+                threads,
+                segmentSeconds,
+                patternStr.constData());
+    return true;
+}
+
+bool VideoRecorder::encodeFrame(AVFrame* frame)
+{
+    int err = avcodec_send_frame(m_EncoderCtx, frame);
+    if (err < 0) {
+        char string[AV_ERROR_MAX_STRING_SIZE];
+        SDL_LogError(SDL_LOG_CATEGORY_APPLICATION,
+                     "VideoRecorder: avcodec_send_frame() failed: %s",
+                     av_make_error_string(string, sizeof(string), err));
+        return false;
+    }
+
+    for (;;) {
+        err = avcodec_receive_packet(m_EncoderCtx, m_Packet);
+        if (err == AVERROR(EAGAIN) || err == AVERROR_EOF) {
+            return true;
+        }
+        else if (err < 0) {
+            char string[AV_ERROR_MAX_STRING_SIZE];
             SDL_LogError(SDL_LOG_CATEGORY_APPLICATION,
-                         "VideoRecorder: Could not allocate temp frame");
+                         "VideoRecorder: avcodec_receive_packet() failed: %s",
+                         av_make_error_string(string, sizeof(string), err));
             return false;
         }
 
-        int ret = av_hwframe_transfer_data(tempFrame, frame, 0);
-        if (ret < 0) {
-            char errstr[AV_ERROR_MAX_STRING_SIZE];
-            av_strerror(ret, errstr, sizeof(errstr));
-            SDL_LogError(SDL_LOG_CATEGORY_APPLICATION,
-                         "VideoRecorder: Failed to transfer hw frame: %s", errstr);
-            av_frame_free(&tempFrame);
+        av_packet_rescale_ts(m_Packet, m_EncoderCtx->time_base, m_Stream->time_base);
+        m_Packet->stream_index = m_Stream->index;
+
+        err = av_write_frame(m_FormatCtx, m_Packet);
+        av_packet_unref(m_Packet);
+        if (err < 0) {
+            SDL_LogWarn(SDL_LOG_CATEGORY_APPLICATION,
+                        "VideoRecorder: av_write_frame() failed: %d",
+                        err);
             return false;
         }
+    }
+}
 
-        tempFrame->width = frame->width;
-        tempFrame->height = frame->height;
-        swFrame = tempFrame;
+void VideoRecorder::closeEncoder()
+{
+    // m_Stream is only set once the header has been written
+    if (m_Stream != nullptr) {
+        encodeFrame(nullptr);
+        av_write_trailer(m_FormatCtx);
+        m_Stream = nullptr;
     }
 
+    avcodec_free_context(&m_EncoderCtx);
+    avformat_free_context(m_FormatCtx);
+    m_FormatCtx = nullptr;
+}
+
+bool VideoRecorder::convertFrame(AVFrame* swFrame)
+{
+    int err;
+
     // Create or update sws context if needed for format conversion
     if (!m_SwsCtx || m_LastInputFormat != swFrame->format) {
-        if (m_SwsCtx) {
-            sws_freeContext(m_SwsCtx);
+        sws_freeContext(m_SwsCtx);
+        m_SwsCtx = nullptr;
+
+        av_frame_unref(m_ConvertedFrame);
+        m_ConvertedFrame->format = m_OutputFormat;
+        m_ConvertedFrame->width = m_Width;
+        m_ConvertedFrame->height = m_Height;
+
+        err = av_frame_get_buffer(m_ConvertedFrame, 0);
+        if (err < 0) {
+            SDL_LogError(SDL_LOG_CATEGORY_APPLICATION,
+                         "VideoRecorder: Could not allocate converted frame buffer: %d",
+                         err);
+            return false;
+        }
+
+#if LIBSWSCALE_VERSION_INT >= AV_VERSION_INT(6, 1, 100)
+        m_SwsCtx = sws_alloc_context();
+        if (!m_SwsCtx) {
+            SDL_LogError(SDL_LOG_CATEGORY_APPLICATION,
+                         "VideoRecorder: sws_alloc_context() failed");
+            return false;
         }
 
-        m_SwsCtx = sws_getContext(
-            swFrame->width, swFrame->height, (AVPixelFormat)swFrame->format,
-            m_Width, m_Height, AV_PIX_FMT_YUV420P,
-            SWS_BILINEAR, nullptr, nullptr, nullptr);
+        AVDictionary *options { nullptr };
+        av_dict_set_int(&options, "srcw", swFrame->width, 0);
+        av_dict_set_int(&options, "srch", swFrame->height, 0);
+        av_dict_set_int(&options, "src_format", swFrame->format, 0);
+        av_dict_set_int(&options, "dstw", m_ConvertedFrame->width, 0);
+        av_dict_set_int(&options, "dsth", m_ConvertedFrame->height, 0);
+        av_dict_set_int(&options, "dst_format", m_ConvertedFrame->format, 0);
+
+        // Leave some cores free for the decoder and renderer
+        av_dict_set_int(&options, "threads", qBound(1, SDL_GetCPUCount() / 2, 4), 0);
+
+        err = av_opt_set_dict(m_SwsCtx, &options);
+        av_dict_free(&options);
+        if (err < 0) {
+            char string[AV_ERROR_MAX_STRING_SIZE];
+            SDL_LogError(SDL_LOG_CATEGORY_APPLICATION,
+                         "VideoRecorder: av_opt_set_dict() failed: %s",
+                         av_make_error_string(string, sizeof(string), err));
+            sws_freeContext(m_SwsCtx);
+            m_SwsCtx = nullptr;
+            return false;
+        }
 
+        err = sws_init_context(m_SwsCtx, nullptr, nullptr);
+        if (err < 0) {
+            char string[AV_ERROR_MAX_STRING_SIZE];
+            SDL_LogError(SDL_LOG_CATEGORY_APPLICATION,
+                         "VideoRecorder: sws_init_context() failed: %s",
+                         av_make_error_string(string, sizeof(string), err));
+            sws_freeContext(m_SwsCtx);
+            m_SwsCtx = nullptr;
+            return false;
+        }
+#else
+        m_SwsCtx = sws_getContext(swFrame->width, swFrame->height, (AVPixelFormat)swFrame->format,
+                                  m_ConvertedFrame->width, m_ConvertedFrame->height, m_OutputFormat,
+                                  SWS_BILINEAR, nullptr, nullptr, nullptr);
         if (!m_SwsCtx) {
             SDL_LogError(SDL_LOG_CATEGORY_APPLICATION,
                          "VideoRecorder: Could not create sws context for format %d",
                          swFrame->format);
-            if (tempFrame) av_frame_free(&tempFrame);
             return false;
         }
+#endif
 
         m_LastInputFormat = swFrame->format;
     }
 
-    // Convert the frame to YUV420P
-    sws_scale(m_SwsCtx,
-              swFrame->data, swFrame->linesize, 0, swFrame->height,
-              m_ConvertedFrame->data, m_ConvertedFrame->linesize);
+#if LIBSWSCALE_VERSION_INT >= AV_VERSION_INT(6, 1, 100)
+    // Perform multi-threaded conversion
+    err = sws_scale_frame(m_SwsCtx, m_ConvertedFrame, swFrame);
+#else
+    err = sws_scale(m_SwsCtx, swFrame->data, swFrame->linesize, 0, swFrame->height,
+                    m_ConvertedFrame->data, m_ConvertedFrame->linesize);
+#endif
+    if (err < 0) {
+        char string[AV_ERROR_MAX_STRING_SIZE];
+        SDL_LogError(SDL_LOG_CATEGORY_APPLICATION,
+                     "VideoRecorder: sws_scale_frame() failed: %s",
+                     av_make_error_string(string, sizeof(string), err));
+        return false;
+    }
 
-    // Free temp frame if we allocated one
-    if (tempFrame) {
-        av_frame_free(&tempFrame);
+    return true;
+}
+
+bool VideoRecorder::writePlanes(AVFrame* frame)
+{
+    const AVPixFmtDescriptor* desc = av_pix_fmt_desc_get((AVPixelFormat)frame->format);
+    int planeCount = av_pix_fmt_count_planes((AVPixelFormat)frame->format);
+    int rowBytes[AV_NUM_DATA_POINTERS];
+    int rows[AV_NUM_DATA_POINTERS];
+
+    SDL_assert(planeCount > 0 && planeCount <= 4);
+
+    for (int i = 0; i < planeCount; i++) {
+        rowBytes[i] = av_image_get_linesize((AVPixelFormat)frame->format, m_Width, i);
+
+        // Planes 1 and 2 are chroma (including the interleaved plane of NV12/P010)
+        rows[i] = (i == 1 || i == 2) ? AV_CEIL_RSHIFT(m_Height, desc->log2_chroma_h) : m_Height;
     }
 
-    // Write Y plane
-    for (int y = 0; y < m_Height; y++) {
-        m_OutputFile->write((const char*)(m_ConvertedFrame->data[0] + y * m_ConvertedFrame->linesize[0]), m_Width);
+    return m_OutputFile.writePlanes(frame->data, frame->linesize, rowBytes, rows, planeCount);
+}
+
+bool VideoRecorder::writeFrame(AVFrame* frame)
+{
+    if (m_OutputType != OT_LOSSLESS && !m_OutputFile.isOpen()) {
+        return false;
     }
 
-    // Write U plane
-    for (int y = 0; y < m_Height / 2; y++) {
-        m_OutputFile->write((const char*)(m_ConvertedFrame->data[1] + y * m_ConvertedFrame->linesize[1]), m_Width / 2);
+    AVFrame* swFrame = frame;
+
+    // Read back hardware frames into a reusable CPU-side frame
+    if (frame->hw_frames_ctx) {
+        swFrame = getSwFrameFromHwFrame(frame);
+        if (!swFrame) {
+            return false;
+        }
     }
 
-    // Write V plane
-    for (int y = 0; y < m_Height / 2; y++) {
-        m_OutputFile->write((const char*)(m_ConvertedFrame->data[2] + y * m_ConvertedFrame->linesize[2]), m_Width / 2);
+    // Pick the output format and write the header on the first frame
+    if (m_OutputFormat == AV_PIX_FMT_NONE) {
+        m_OutputFormat = selectOutputFormat((AVPixelFormat)swFrame->format);
+        if (m_OutputFormat == AV_PIX_FMT_NONE || !writeHeader(swFrame)) {
+            m_OutputFormat = AV_PIX_FMT_NONE;
+            av_frame_unref(m_MappedFrame);
+            return false;
+        }
+    }
+
+    AVFrame* outputFrame = swFrame;
+
+    // Convert only if the decoder's layout can't be written directly
+    if (swFrame->format != m_OutputFormat) {
+        if (!convertFrame(swFrame)) {
+            av_frame_unref(m_MappedFrame);
+            return false;
+        }
+
+        outputFrame = m_ConvertedFrame;
+    }
+
+    bool ok;
+    if (m_OutputType == OT_LOSSLESS) {
+        // Convert the 32-bit RTP timestamp into a monotonic 64-bit timestamp.
+        // The signed delta handles wraparound of the RTP clock.
+        if (m_FrameCount != 0) {
+            int32_t delta = (int32_t)((uint32_t)frame->pts - m_LastRtpTimestamp);
+            m_NextPts += delta > 0 ? delta : 1;
+        }
+        m_LastRtpTimestamp = (uint32_t)frame->pts;
+
+        outputFrame->pts = m_NextPts;
+        outputFrame->pict_type = AV_PICTURE_TYPE_NONE;
+        ok = encodeFrame(outputFrame);
+    }
+    else {
+        ok = (m_OutputType != OT_Y4M || m_OutputFile.write("FRAME\n", 6)) && writePlanes(outputFrame);
+    }
+
+    // Release the mapping (if any) so the surface can return to the decoder
+    av_frame_unref(m_MappedFrame);
+
+    if (!ok) {
+        return false;
     }
 
     m_FrameCount++;
@@ -200,30 +823,49 @@ void VideoRecorder::finalize()
 
     m_Recording = false;
 
-    // Close output file
-    if (m_OutputFile) {
-        m_OutputFile->close();
-        delete m_OutputFile;
-        m_OutputFile = nullptr;
-    }
+    cleanup();
 
-    // Clean up
-    if (m_FrameBuffer) {
-        av_free(m_FrameBuffer);
-        m_FrameBuffer = nullptr;
+    SDL_LogInfo(SDL_LOG_CATEGORY_APPLICATION,
+                "VideoRecorder: Stopped recording. Total frames: %lld, Dropped frames: %lld, Output: %s",
+                (long long)m_FrameCount, (long long)m_DroppedFrameCount,
+                m_OutputPath.toUtf8().constData());
+}
+
+void VideoRecorder::cleanup()
+{
+    // Let the writer thread finish any queued frames
+    if (m_WriterThread != nullptr) {
+        m_FrameQueueLock.lock();
+        m_Stopping = true;
+        m_FrameQueueLock.unlock();
+        m_FrameQueueNotEmpty.wakeAll();
+
+        SDL_WaitThread(m_WriterThread, nullptr);
+        m_WriterThread = nullptr;
     }
 
+    SDL_assert(m_FrameQueue.isEmpty());
+
+    // Finish the last lossless segment
+    closeEncoder();
+    av_packet_free(&m_Packet);
+    m_Encoder = nullptr;
+
+    // Close output file
+    m_OutputFile.close();
+
+    // Clean up
     if (m_ConvertedFrame) {
         av_frame_free(&m_ConvertedFrame);
         m_ConvertedFrame = nullptr;
     }
 
+    av_frame_free(&m_MappedFrame);
+    av_frame_free(&m_StagingFrame);
+
     if (m_SwsCtx) {
         sws_freeContext(m_SwsCtx);
         m_SwsCtx = nullptr;
     }
 
-    SDL_LogInfo(SDL_LOG_CATEGORY_APPLICATION,
-                "VideoRecorder: Stopped recording. Total frames: %lld, Output: %s",
-                (long long)m_FrameCount, m_OutputPath.toUtf8().constData());
 }
@@ -2,10 +2,15 @@
 
 #include <QString>
 #include <QMutex>
-#include <QFile>
+#include <QQueue>
+#include <QWaitCondition>
+
+#include "SDL_compat.h"
+#include "recordingfilewriter.h"
 
 extern "C" {
 #include <libavcodec/avcodec.h>
+#include <libavformat/avformat.h>
 #include <libswscale/swscale.h>
 #include <libavutil/imgutils.h>
 #include <libavutil/hwcontext.h>
@@ -14,16 +19,32 @@ extern "C" {
 
 class VideoRecorder {
 public:
+    enum OutputType {
+        // Raw frames in the decoder's layout, described by a .meta file
+        OT_RAW,
+
+        // YUV4MPEG2 stream
+        OT_Y4M,
+
+        // Losslessly compressed with FFV1 (or the encoder named by
+        // ML_LOSSLESS_CODEC) into Matroska files split every
+        // ML_RECORDING_SEGMENT_SECONDS, so a crash loses at most a segment
+        OT_LOSSLESS,
+    };
+
     VideoRecorder();
     ~VideoRecorder();
 
-    // Initialize the recorder with output path and video parameters
-    bool initialize(const QString& outputPath, int width, int height, int fps);
+    // Initialize the recorder with output path and video parameters. For
+    // OT_LOSSLESS, a segment number is added before the file extension.
+    bool initialize(const QString& outputPath, int width, int height, int fps, OutputType outputType);
 
-    // Write a decoded frame to the output file
-    bool writeFrame(AVFrame* frame);
+    // Queue a decoded frame for the writer thread. The caller retains
+    // ownership of the frame. Returns false if the frame was dropped
+    // because the writer thread is falling behind.
+    bool submitFrame(AVFrame* frame);
 
-    // Finalize and close the output file
+    // Drain any queued frames, then finalize and close the output file
     void finalize();
 
     // Check if recording is active
@@ -33,19 +54,76 @@ public:
     QString getOutputPath() const { return m_OutputPath; }
 
 private:
+    static int writerThreadProc(void* context);
+
+    // Select how hardware frames are read back (writer thread only)
+    bool initializeReadBackFormat(AVFrame* hwFrame);
+
+    // Returns a mapped or staged CPU copy of hwFrame. The result is owned
+    // by the recorder and is only valid until the next call.
+    AVFrame* getSwFrameFromHwFrame(AVFrame* hwFrame);
+
+    // Choose the layout to write, preferring the decoder's own format
+    enum AVPixelFormat selectOutputFormat(enum AVPixelFormat inputFormat);
+
+    // Write the Y4M stream header or the .meta file for raw output
+    bool writeHeader(AVFrame* frame);
+
+    // Convert swFrame into m_ConvertedFrame in m_OutputFormat
+    bool convertFrame(AVFrame* swFrame);
+
+    bool writePlanes(AVFrame* frame);
+
+    // Open the lossless encoder and segment muxer for the first frame
+    bool initializeEncoder(AVFrame* frame);
+
+    // Encode a frame, or flush the encoder if frame is null
+    bool encodeFrame(AVFrame* frame);
+
+    // Flush the encoder, finish the last segment and free the encoder
+    void closeEncoder();
+
+    // Write a decoded frame to the output file (writer thread only)
+    bool writeFrame(AVFrame* frame);
+
+    // Stop the writer thread and release all output resources
+    void cleanup();
+
     bool m_Recording;
+    OutputType m_OutputType;
     QString m_OutputPath;
 
-    QFile* m_OutputFile;
+    RecordingFileWriter m_OutputFile;
     SwsContext* m_SwsCtx;
     AVFrame* m_ConvertedFrame;
-    uint8_t* m_FrameBuffer;
+    AVFrame* m_MappedFrame;
+    AVFrame* m_StagingFrame;
+    enum AVPixelFormat m_ReadBackFormat;
+    bool m_MapFrame;
 
     int m_Width;
     int m_Height;
     int m_Fps;
     int64_t m_FrameCount;
+    int64_t m_DroppedFrameCount;
     int m_LastInputFormat;
+    enum AVPixelFormat m_OutputFormat;
 
+    // Lossless output (writer thread only, once initialized)
+    const AVCodec* m_Encoder;
+    AVCodecContext* m_EncoderCtx;
+    AVFormatContext* m_FormatCtx;
+    AVStream* m_Stream;
+    AVPacket* m_Packet;
+    uint32_t m_LastRtpTimestamp;
+    int64_t m_NextPts;
+
+    // Protects m_Recording transitions against concurrent initialize()/finalize()
     QMutex m_Mutex;
+
+    QQueue<AVFrame*> m_FrameQueue;
+    QMutex m_FrameQueueLock;
+    QWaitCondition m_FrameQueueNotEmpty;
+    SDL_Thread* m_WriterThread;
+    bool m_Stopping;
 };
@@ -5,6 +5,8 @@
 #define THROW_BAD_ALLOC_IF_NULL(x) \
     if ((x) == nullptr) throw std::bad_alloc()
 
+struct SDL_Window;
+
 namespace WMUtils {
     bool isRunningX11();
     bool isRunningNvidiaProprietaryDriverX11();
@@ -13,4 +15,5 @@ namespace WMUtils {
     bool isRunningDesktopEnvironment();
     bool isX11EGLSafe();
     QString getDrmCardOverride();
+    bool setCompositorBypass(SDL_Window* window, bool enabled);
 }
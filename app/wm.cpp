@@ -4,9 +4,11 @@
 #include "utils.h"
 
 #include "SDL_compat.h"
+#include <SDL_syswm.h>
 
 #ifdef HAS_X11
 #include <X11/Xlib.h>
+#include <X11/Xatom.h>
 #endif
 
 #ifdef HAS_WAYLAND
@@ -190,3 +192,50 @@ bool WMUtils::isX11EGLSafe()
     // https://github.com/moonlight-stream/moonlight-qt/issues/1751
     return !WMUtils::isRunningNvidiaProprietaryDriverX11();
 }
+
+bool WMUtils::setCompositorBypass(SDL_Window* window, bool enabled)
+{
+    if (qgetenv("COMPOSITOR_BYPASS") == "0") {
+        return false;
+    }
+
+    SDL_SysWMinfo info;
+    SDL_VERSION(&info.version);
+
+    if (!SDL_GetWindowWMInfo(window, &info)) {
+        SDL_LogWarn(SDL_LOG_CATEGORY_APPLICATION,
+                    "SDL_GetWindowWMInfo() failed: %s",
+                    SDL_GetError());
+        return false;
+    }
+
+    switch (info.subsystem) {
+#ifdef HAS_X11
+    case SDL_SYSWM_X11:
+    {
+        // Ask the compositor to unredirect us while we're full-screen. 1 requests
+        // bypass and 0 means no preference, which lets windowed mode composite.
+        // https://specifications.freedesktop.org/wm-spec/1.5/ar01s05.html
+        Atom bypassAtom = XInternAtom(info.info.x11.display, "_NET_WM_BYPASS_COMPOSITOR", False);
+        long value = enabled ? 1 : 0;
+        XChangeProperty(info.info.x11.display, info.info.x11.window, bypassAtom,
+                        XA_CARDINAL, 32, PropModeReplace,
+                        reinterpret_cast<unsigned char*>(&value), 1);
+        XFlush(info.info.x11.display);
+        return enabled;
+    }
+#endif
+
+#ifdef HAS_WAYLAND
+    case SDL_SYSWM_WAYLAND:
+        // There's no protocol to request this. Compositors scan out opaque
+        // full-screen surfaces on their own, and our GL surfaces have no alpha.
+        return enabled;
+#endif
+
+    default:
+        // On Windows, our flip model swapchains are promoted to independent
+        // flip by DWM automatically, and the renderer reports whether it was.
+        return false;
+    }
+}
@@ -3,10 +3,12 @@ SUBDIRS = \
     moonlight-common-c \
     qmdnsengine \
     app \
-    h264bitstream
+    h264bitstream \
+    tests
 
 # Build the dependencies in parallel before the final app
 app.depends = qmdnsengine moonlight-common-c h264bitstream
+tests.depends = h264bitstream
 win32:!winrt {
     SUBDIRS += AntiHooking
     app.depends += AntiHooking
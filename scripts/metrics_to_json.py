@@ -16,6 +16,19 @@ Usage:
     
     # Continuously monitor a log file
     python3 metrics_to_json.py --input overlay_log.txt --output metrics.json --watch
+
+Note: scraping requires the debug overlay to be enabled. Moonlight can also export
+structured stats directly without the overlay by setting VIDEO_METRICS_SINK to a
+file, named pipe, or udp://host:port destination (VIDEO_METRICS_FORMAT=ndjson|binary).
+For central monitoring, ML_METRICS_HTTP=[address:]port serves live metrics for
+Prometheus at http://<address>:<port>/metrics while a stream is running.
+Setting ML_QUALITY_REFERENCE to the clip the host is playing adds live PSNR/SSIM
+against that clip to the overlay and the HTTP metrics.
+At the end of each session, Moonlight also writes a complete JSON report
+(decoder/renderer, launch timeline, latency histograms, pacer drops, bitrate
+profile, audio and input stats, memory peaks) to moonlight_session_*.json in
+its log directory, so no scraping is needed for per-session summaries. Set
+ML_SESSION_REPORT=0 to disable it.
 """
 
 import re
@@ -175,6 +188,26 @@ def parse_metrics(text: str, log_timestamp: str = None) -> dict:
     if render_time_match:
         metrics["timing"]["average_render_time_ms"] = float(render_time_match.group(1))
     
+    # Average present latency (rendering to display): X.XX ms
+    present_latency_match = re.search(
+        r'Average present latency.*?:\s*([\d.]+)\s*ms',
+        text
+    )
+    if present_latency_match:
+        metrics["timing"]["average_present_latency_ms"] = float(present_latency_match.group(1))
+    
+    # Quality vs. reference: X.XX dB PSNR, X.XXXX SSIM (N frames) (if ML_QUALITY_REFERENCE is set)
+    quality_match = re.search(
+        r'Quality vs\. reference:\s*([\d.]+)\s*dB PSNR,\s*([\d.]+)\s*SSIM\s*\((\d+)\s*frames\)',
+        text
+    )
+    if quality_match:
+        metrics["quality"] = {
+            "psnr_db": float(quality_match.group(1)),
+            "ssim": float(quality_match.group(2)),
+            "frames": int(quality_match.group(3))
+        }
+    
     # Remove empty sub-dictionaries
     metrics = {k: v for k, v in metrics.items() if v}
     
@@ -0,0 +1,19 @@
+QT -= gui
+CONFIG += console c++11
+CONFIG -= app_bundle
+
+TARGET = benchmarkbandwidth
+TEMPLATE = app
+
+include(../../globaldefs.pri)
+
+APP_DIR = $$PWD/../../app
+
+INCLUDEPATH += $$APP_DIR/streaming
+
+SOURCES += \
+    main.cpp \
+    $$APP_DIR/streaming/bandwidth.cpp
+
+HEADERS += \
+    $$APP_DIR/streaming/bandwidth.h
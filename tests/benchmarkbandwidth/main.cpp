@@ -0,0 +1,279 @@
+// Calls BandwidthTracker::AddBytes() at the stream frame rate while another
+// thread polls the bitrate like the stats overlay does, then reports the cost
+// of each call for both the lock-free tracker and the mutex-based one it
+// replaced.
+
+#include "bandwidth.h"
+
+#include <QCommandLineParser>
+#include <QCoreApplication>
+#include <QPair>
+
+#include <algorithm>
+#include <atomic>
+#include <chrono>
+#include <cstdio>
+#include <cstdlib>
+#include <mutex>
+#include <thread>
+#include <vector>
+
+// AddBytes() calls made back to back to measure the cost of a single call
+#define THROUGHPUT_CALLS 2000000
+
+using namespace std::chrono;
+
+// The mutex-based BandwidthTracker that the lock-free one replaced,
+// kept here so the two can be compared on the same machine.
+class LockedBandwidthTracker
+{
+public:
+    LockedBandwidthTracker(uint32_t windowSeconds = 10, uint32_t bucketIntervalMs = 250)
+      : windowSeconds(seconds(windowSeconds)),
+        bucketIntervalMs(bucketIntervalMs)
+    {
+        bucketCount = (windowSeconds * 1000) / bucketIntervalMs;
+        buckets.resize(bucketCount);
+    }
+
+    void AddBytes(size_t bytes) {
+        std::lock_guard<std::mutex> lock(mtx);
+        auto now = steady_clock::now();
+        auto ms          = duration_cast<milliseconds>(now.time_since_epoch()).count();
+        int bucketIndex  = (ms / bucketIntervalMs) % bucketCount;
+        auto aligned_ms  = ms - (ms % bucketIntervalMs);
+        auto bucketStart = steady_clock::time_point(milliseconds(aligned_ms));
+
+        Bucket &bucket = buckets[bucketIndex];
+
+        if (now - bucket.start > windowSeconds) {
+            bucket.bytes = 0;
+            bucket.start = bucketStart;
+        }
+
+        if (bucket.start != bucketStart) {
+            bucket.bytes = bytes;
+            bucket.start = bucketStart;
+        }
+        else {
+            bucket.bytes += bytes;
+        }
+    }
+
+    double GetAverageMbps() {
+        std::lock_guard<std::mutex> lock(mtx);
+        auto now = steady_clock::now();
+        auto ms = duration_cast<milliseconds>(now.time_since_epoch());
+        int currentIndex = (ms.count() / bucketIntervalMs) % bucketCount;
+        int maxBuckets = bucketCount / 4;
+        size_t totalBytes = 0;
+        steady_clock::time_point oldestBucket = now;
+
+        for (int i = 0; i < maxBuckets; i++) {
+            int idx = (currentIndex - i + bucketCount) % bucketCount;
+            const Bucket &bucket = buckets[idx];
+            if (isValid(bucket, now) && (now - bucket.start >= milliseconds(bucketIntervalMs))) {
+                totalBytes += bucket.bytes;
+                if (bucket.start < oldestBucket) {
+                    oldestBucket = bucket.start;
+                }
+            }
+        }
+
+        double elapsed = duration<double>(now - oldestBucket).count();
+        if (elapsed <= 0.0) {
+            return 0.0;
+        }
+
+        return totalBytes * 8.0 / 1000000.0 / elapsed;
+    }
+
+    double GetPeakMbps() {
+        std::lock_guard<std::mutex> lock(mtx);
+        auto now = steady_clock::now();
+        double peak = 0.0;
+        for (const auto& bucket : buckets) {
+            if (isValid(bucket, now)) {
+                double throughput = bucket.bytes * 8.0 / 1000000.0 / (bucketIntervalMs / 1000.0);
+                if (throughput > peak) {
+                    peak = throughput;
+                }
+            }
+        }
+        return peak;
+    }
+
+private:
+    struct Bucket {
+        steady_clock::time_point start{};
+        size_t bytes = 0;
+    };
+
+    bool isValid(const Bucket &bucket, steady_clock::time_point now) const {
+        return (now - bucket.start) <= windowSeconds;
+    }
+
+    const seconds windowSeconds;
+    const int bucketIntervalMs;
+    uint32_t bucketCount;
+    std::vector<Bucket> buckets;
+    std::mutex mtx;
+};
+
+struct BenchmarkResult {
+    int pacedCalls;
+    double pacedAvgNs;
+    double pacedP99Ns;
+    double pacedMaxNs;
+    double throughputNsPerCall;
+    double readerPollsPerSecond;
+    double averageMbps;
+    double peakMbps;
+};
+
+// Polls the tracker as fast as possible, which is the worst case for
+// contention with AddBytes() that an overlay refresh can cause.
+template <typename Tracker>
+static void readerThreadProc(Tracker* tracker, std::atomic<bool>* stop, uint64_t* polls)
+{
+    while (!stop->load(std::memory_order_relaxed)) {
+        tracker->GetAverageMbps();
+        tracker->GetPeakMbps();
+        (*polls)++;
+    }
+}
+
+// Roughly the sizes of the frames of a 150 Mbps stream at 240 FPS
+static size_t frameBytes(int i)
+{
+    return 60000 + (i % 16) * 2500;
+}
+
+template <typename Tracker>
+static void benchmarkTracker(int fps, int durationSeconds, BenchmarkResult* result)
+{
+    *result = {};
+
+    Tracker tracker(10, 250);
+
+    std::atomic<bool> stop(false);
+    uint64_t polls = 0;
+    std::thread reader(readerThreadProc<Tracker>, &tracker, &stop, &polls);
+
+    auto startTime = steady_clock::now();
+
+    // Deliver frames at the stream's frame rate like the decoder thread does
+    std::vector<double> callNs;
+    int frameCount = fps * durationSeconds;
+    auto frameInterval = duration_cast<steady_clock::duration>(duration<double>(1.0 / fps));
+    callNs.reserve(frameCount);
+    for (int i = 0; i < frameCount; i++) {
+        auto deadline = startTime + i * frameInterval;
+        auto now = steady_clock::now();
+        if (deadline > now + milliseconds(1)) {
+            std::this_thread::sleep_until(deadline);
+        }
+
+        auto callStart = steady_clock::now();
+        tracker.AddBytes(frameBytes(i));
+        callNs.push_back(duration<double, std::nano>(steady_clock::now() - callStart).count());
+    }
+
+    result->averageMbps = tracker.GetAverageMbps();
+    result->peakMbps = tracker.GetPeakMbps();
+
+    // Then hammer it to measure the cost of a call
+    auto throughputStart = steady_clock::now();
+    for (int i = 0; i < THROUGHPUT_CALLS; i++) {
+        tracker.AddBytes(frameBytes(i));
+    }
+    result->throughputNsPerCall = duration<double, std::nano>(steady_clock::now() - throughputStart).count() / THROUGHPUT_CALLS;
+
+    stop = true;
+    reader.join();
+
+    result->readerPollsPerSecond = polls / duration<double>(steady_clock::now() - startTime).count();
+
+    std::sort(callNs.begin(), callNs.end());
+    result->pacedCalls = (int)callNs.size();
+    if (!callNs.empty()) {
+        double total = 0;
+        for (double ns : callNs) {
+            total += ns;
+        }
+        result->pacedAvgNs = total / callNs.size();
+        result->pacedP99Ns = callNs[(callNs.size() * 99) / 100];
+        result->pacedMaxNs = callNs.back();
+    }
+}
+
+static int parseIntOption(QCommandLineParser& parser, const QString& name, int defaultValue, int min, int max)
+{
+    if (!parser.isSet(name)) {
+        return defaultValue;
+    }
+
+    bool ok;
+    int value = parser.value(name).toInt(&ok);
+    if (!ok || value < min || value > max) {
+        fprintf(stderr, "%s must be between %d and %d\n", qPrintable(name), min, max);
+        exit(1);
+    }
+
+    return value;
+}
+
+int main(int argc, char *argv[])
+{
+    QCoreApplication app(argc, argv);
+
+    QCommandLineParser parser;
+    parser.setApplicationDescription("Compares BandwidthTracker with the mutex-based tracker it replaced");
+    parser.addHelpOption();
+    parser.addOption(QCommandLineOption("fps", "Frames per second to deliver (default 240)", "fps"));
+    parser.addOption(QCommandLineOption("duration", "Seconds to run each tracker (default 5)", "duration"));
+    parser.process(app);
+
+    int fps = parseIntOption(parser, "fps", 240, 1, 1000);
+    int durationSeconds = parseIntOption(parser, "duration", 5, 1, 600);
+
+    BenchmarkResult locked, lockFree;
+
+    fprintf(stdout, "Benchmarking the mutex BandwidthTracker at %d FPS for %d seconds...\n", fps, durationSeconds);
+    fflush(stdout);
+    benchmarkTracker<LockedBandwidthTracker>(fps, durationSeconds, &locked);
+
+    fprintf(stdout, "Benchmarking the lock-free BandwidthTracker at %d FPS for %d seconds...\n", fps, durationSeconds);
+    fflush(stdout);
+    benchmarkTracker<BandwidthTracker>(fps, durationSeconds, &lockFree);
+
+    fprintf(stdout, "\nAddBytes() with a reader thread polling GetAverageMbps()/GetPeakMbps() continuously\n");
+    fprintf(stdout, "%-10s %8s %26s %17s %15s %20s\n",
+            "Tracker", "Calls", "Paced avg/p99/max (ns)", "Unpaced (ns/call)", "Reader polls/s", "Avg/peak Mbps");
+
+    const QPair<const char*, const BenchmarkResult*> results[] = {
+        { "mutex", &locked },
+        { "lock-free", &lockFree },
+    };
+    for (const auto& entry : results) {
+        const BenchmarkResult* result = entry.second;
+
+        QString paced = QString("%1/%2/%3")
+                .arg(result->pacedAvgNs, 0, 'f', 0)
+                .arg(result->pacedP99Ns, 0, 'f', 0)
+                .arg(result->pacedMaxNs, 0, 'f', 0);
+        QString mbps = QString("%1/%2")
+                .arg(result->averageMbps, 0, 'f', 1)
+                .arg(result->peakMbps, 0, 'f', 1);
+
+        fprintf(stdout, "%-10s %8d %26s %17.1f %15.0f %20s\n",
+                entry.first,
+                result->pacedCalls,
+                qPrintable(paced),
+                result->throughputNsPerCall,
+                result->readerPollsPerSecond,
+                qPrintable(mbps));
+    }
+
+    return 0;
+}
@@ -0,0 +1,28 @@
+QT -= gui
+CONFIG += console c++11
+CONFIG -= app_bundle
+
+TARGET = fuzzsps
+TEMPLATE = app
+
+# Build with CONFIG+="sanitizer sanitize_address sanitize_undefined"
+# to catch memory errors too
+include(../../globaldefs.pri)
+
+APP_DIR = $$PWD/../../app
+
+INCLUDEPATH += $$APP_DIR/streaming/video
+
+SOURCES += \
+    main.cpp \
+    $$APP_DIR/streaming/video/spsrewriter.cpp
+
+HEADERS += \
+    $$APP_DIR/streaming/video/spsrewriter.h
+
+win32:CONFIG(release, debug|release): LIBS += -L$$OUT_PWD/../../h264bitstream/release/ -lh264bitstream
+else:win32:CONFIG(debug, debug|release): LIBS += -L$$OUT_PWD/../../h264bitstream/debug/ -lh264bitstream
+else:unix: LIBS += -L$$OUT_PWD/../../h264bitstream/ -lh264bitstream
+
+INCLUDEPATH += $$PWD/../../h264bitstream/h264bitstream
+DEPENDPATH += $$PWD/../../h264bitstream/h264bitstream
@@ -0,0 +1,350 @@
+// Feeds mutated H.264 SPS NALUs to the SPS rewriter and checks that it never
+// writes out of bounds and that its rewrites are stable. SPS variants that
+// h264bitstream can encode are also checked byte for byte against the
+// h264bitstream fixup path in FFmpegVideoDecoder::writeBuffer(). The built-in
+// SPS seeds can be extended with the SPS NALUs of an Annex B --file.
+
+#include "spsrewriter.h"
+
+#include <h264_stream.h>
+
+#include <QCommandLineParser>
+#include <QCoreApplication>
+#include <QFile>
+#include <QRandomGenerator>
+#include <QVector>
+
+#include <cstdio>
+
+// Room that writeBuffer() leaves for the SPS to grow (MAX_SPS_EXTRA_SIZE in ffmpeg.cpp)
+#define SPS_EXTRA_SIZE 16
+
+// Canary bytes after the output capacity to catch the rewriter writing past it
+#define GUARD_SIZE 64
+#define GUARD_BYTE 0xA5
+
+// All seeds use a 4 byte Annex B start code
+#define NAL_START 4
+
+#define MAX_REPORTED_FAILURES 10
+
+struct SeedSps {
+    const char* name;
+    const uint8_t* data;
+    int length;
+};
+
+static const uint8_t k_BaselineSps[] = {
+    0x00, 0x00, 0x00, 0x01, 0x67, 0x42, 0xc0, 0x1f, 0xda, 0x01, 0x40, 0x16, 0xe4
+};
+static const uint8_t k_MainSps[] = {
+    0x00, 0x00, 0x00, 0x01, 0x67, 0x4d, 0x40, 0x28, 0x96, 0x52, 0x80, 0xf0, 0x04, 0x4f, 0xcb, 0x35,
+    0x01, 0x01, 0x01, 0x40, 0x00, 0x00, 0x03, 0x00, 0x40, 0x00, 0x00, 0x1e, 0x23, 0xc2, 0x21, 0x19,
+    0x60
+};
+static const uint8_t k_HighHrdSps[] = {
+    0x00, 0x00, 0x00, 0x01, 0x67, 0x64, 0x00, 0x33, 0xac, 0x2a, 0x16, 0xd1, 0x08, 0x01, 0xe0, 0x02,
+    0x1f, 0x60, 0x22, 0x00, 0x00, 0x07, 0xd2, 0x00, 0x03, 0xa9, 0x80, 0xd1, 0x80, 0x1f, 0x40, 0x01,
+    0xf4, 0x17, 0xbd, 0xf0, 0x76, 0x87, 0x0c, 0x92
+};
+static const uint8_t k_High10Sps[] = {
+    0x00, 0x00, 0x00, 0x01, 0x67, 0x6e, 0x00, 0x2a, 0xa6, 0xc2, 0xca, 0xc0, 0x78, 0x02, 0x27, 0xe5,
+    0x9a, 0x84, 0x88, 0x04, 0x81
+};
+static const uint8_t k_InterlacedSps[] = {
+    0x00, 0x00, 0x00, 0x01, 0x67, 0x4d, 0x00, 0x28, 0x96, 0x56, 0x03, 0xc0, 0x22, 0x64
+};
+
+// These cover each branch of the SPS syntax that the rewriter has to walk
+// to reach num_ref_frames and max_dec_frame_buffering.
+static const SeedSps k_SeedSps[] = {
+    { "Baseline 720p, no VUI", k_BaselineSps, sizeof(k_BaselineSps) },
+    { "Main 1080p, cropping, VUI with bitstream restrictions", k_MainSps, sizeof(k_MainSps) },
+    { "High 4K, POC type 1, VUI with NAL HRD", k_HighHrdSps, sizeof(k_HighHrdSps) },
+    { "High 10 1080p, VUI without bitstream restrictions", k_High10Sps, sizeof(k_High10Sps) },
+    { "Main 1080i, no VUI", k_InterlacedSps, sizeof(k_InterlacedSps) },
+};
+
+struct FuzzResult {
+    int mutatedInputs;
+    int validInputs;
+    int rewritten;
+    int failures;
+};
+
+// Collects the SPS NALUs of an Annex B stream, each with a 4 byte start code
+static bool readSeedsFromFile(const QString& fileName, QVector<QByteArray>& seeds)
+{
+    QFile file(fileName);
+    if (!file.open(QIODevice::ReadOnly)) {
+        fprintf(stderr, "Failed to open %s\n", qPrintable(fileName));
+        return false;
+    }
+
+    QByteArray data = file.readAll();
+    uint8_t* p = (uint8_t*)data.data();
+    int remaining = data.size();
+    int nalStart, nalEnd;
+    int found = 0;
+
+    while (find_nal_unit(p, remaining, &nalStart, &nalEnd) > 0) {
+        if ((p[nalStart] & 0x1F) == NAL_UNIT_TYPE_SPS) {
+            seeds.append(QByteArray("\x00\x00\x00\x01", NAL_START) +
+                         QByteArray((const char*)&p[nalStart], nalEnd - nalStart));
+            found++;
+        }
+
+        p += nalEnd;
+        remaining -= nalEnd;
+    }
+
+    fprintf(stdout, "Found %d SPS NALUs in %s\n", found, qPrintable(fileName));
+    return true;
+}
+
+// Encodes the parsed SPS back into an Annex B NALU, like the fallback path in
+// writeBuffer(). write_nal_unit() clobbers the byte before the NAL header.
+static QByteArray writeSps(h264_stream_t* stream, int capacity)
+{
+    QByteArray output(capacity, 0);
+    int length = write_nal_unit(stream, (uint8_t*)output.data() + NAL_START - 1, capacity - NAL_START) - 1;
+    if (length <= 0) {
+        return QByteArray();
+    }
+
+    memcpy(output.data(), "\x00\x00\x00\x01", NAL_START);
+    output.resize(NAL_START + length);
+    return output;
+}
+
+// This is what writeBuffer() does when the rewriter can't handle an SPS
+static QByteArray referenceRewrite(const QByteArray& sps, uint32_t numRefFrames, uint32_t maxDecFrameBuffering)
+{
+    h264_stream_t* stream = h264_new();
+
+    read_nal_unit(stream, (uint8_t*)sps.data() + NAL_START, sps.size() - NAL_START);
+    stream->sps->num_ref_frames = numRefFrames;
+    stream->sps->vui.max_dec_frame_buffering = maxDecFrameBuffering;
+
+    QByteArray output = writeSps(stream, sps.size() + SPS_EXTRA_SIZE);
+    h264_free(stream);
+    return output;
+}
+
+// Re-encodes a seed with h264bitstream after changing fields around the ones
+// we rewrite, so the reference parser is guaranteed to understand the result.
+// h264bitstream isn't hardened against malformed input, so this is how we get
+// inputs that both parsers can be compared on.
+static QByteArray makeValidVariant(const QByteArray& seed, QRandomGenerator& rng)
+{
+    h264_stream_t* stream = h264_new();
+
+    read_nal_unit(stream, (uint8_t*)seed.data() + NAL_START, seed.size() - NAL_START);
+
+    sps_t* sps = stream->sps;
+    sps->log2_max_frame_num_minus4 = rng.bounded(13);
+    sps->num_ref_frames = rng.bounded(17);
+    sps->pic_width_in_mbs_minus1 = rng.bounded(512);
+    sps->pic_height_in_map_units_minus1 = rng.bounded(512);
+    if (sps->vui_parameters_present_flag) {
+        sps->vui.bitstream_restriction_flag = rng.bounded(2);
+        sps->vui.num_reorder_frames = rng.bounded(17);
+        sps->vui.max_dec_frame_buffering = rng.bounded(17);
+    }
+
+    // ue(v) fields can at most double in size, so this always fits
+    QByteArray output = writeSps(stream, seed.size() * 2 + SPS_EXTRA_SIZE);
+    h264_free(stream);
+    return output;
+}
+
+// Damages the RBSP of a seed the ways a corrupt or hostile SPS might look.
+// The start code and NAL header are kept, like writeBuffer() asserts.
+static QByteArray mutate(const QByteArray& seed, QRandomGenerator& rng)
+{
+    QByteArray input = seed;
+    int mutations = 1 + rng.bounded(8);
+
+    for (int i = 0; i < mutations; i++) {
+        int rbspLength = input.size() - (NAL_START + 1);
+        int position = NAL_START + 1 + (rbspLength > 0 ? rng.bounded(rbspLength) : 0);
+
+        switch (rng.bounded(6)) {
+        case 0:
+            if (rbspLength > 0) {
+                input[position] = (char)(input[position] ^ (1 << rng.bounded(8)));
+            }
+            break;
+        case 1:
+            if (rbspLength > 0) {
+                input[position] = (char)rng.bounded(256);
+            }
+            break;
+        case 2:
+            input.insert(position, (char)rng.bounded(256));
+            break;
+        case 3:
+            if (rbspLength > 1) {
+                input.remove(position, 1);
+            }
+            break;
+        case 4:
+            // Emulation prevention and start code lookalikes
+            input.insert(position, QByteArray("\x00\x00\x03", rng.bounded(2, 4)));
+            break;
+        case 5:
+            input.truncate(qMax(NAL_START + 2, position));
+            break;
+        }
+    }
+
+    return input;
+}
+
+static void reportFailure(FuzzResult* result, const char* reason, const QByteArray& input,
+                          uint32_t numRefFrames, uint32_t maxDecFrameBuffering)
+{
+    if (result->failures++ < MAX_REPORTED_FAILURES) {
+        fprintf(stderr, "FAILED: %s (num_ref_frames %u, max_dec_frame_buffering %u)\n  %s\n",
+                reason, numRefFrames, maxDecFrameBuffering,
+                input.toHex(' ').constData());
+    }
+}
+
+static void fuzzInput(const QByteArray& input, bool valid, QRandomGenerator& rng, FuzzResult* result)
+{
+    uint32_t numRefFrames = rng.bounded(17);
+    uint32_t maxDecFrameBuffering = rng.bounded(17);
+    int capacity = input.size() + SPS_EXTRA_SIZE;
+
+    QByteArray output(capacity + GUARD_SIZE, (char)GUARD_BYTE);
+    int length = SpsRewriter::rewriteH264((const uint8_t*)input.constData(), input.size(), NAL_START,
+                                          numRefFrames, maxDecFrameBuffering,
+                                          (uint8_t*)output.data(), capacity);
+
+    if (length < 0 || length > capacity || output.mid(capacity) != QByteArray(GUARD_SIZE, (char)GUARD_BYTE)) {
+        reportFailure(result, "wrote past the output capacity", input, numRefFrames, maxDecFrameBuffering);
+        return;
+    }
+
+    if (length == 0) {
+        if (valid) {
+            reportFailure(result, "rejected a valid SPS", input, numRefFrames, maxDecFrameBuffering);
+        }
+        return;
+    }
+
+    result->rewritten++;
+    output.truncate(length);
+
+    if (!output.startsWith(input.left(NAL_START + 1))) {
+        reportFailure(result, "changed the start code or NAL header", input, numRefFrames, maxDecFrameBuffering);
+        return;
+    }
+
+    // Rewriting our own output must not change it
+    QByteArray again(length + SPS_EXTRA_SIZE, 0);
+    int againLength = SpsRewriter::rewriteH264((const uint8_t*)output.constData(), output.size(), NAL_START,
+                                               numRefFrames, maxDecFrameBuffering,
+                                               (uint8_t*)again.data(), again.size());
+    if (againLength != length || again.left(againLength) != output) {
+        reportFailure(result, "rewrite is not idempotent", input, numRefFrames, maxDecFrameBuffering);
+        return;
+    }
+
+    if (valid && output != referenceRewrite(input, numRefFrames, maxDecFrameBuffering)) {
+        reportFailure(result, "differs from the h264bitstream rewrite", input, numRefFrames, maxDecFrameBuffering);
+    }
+}
+
+int main(int argc, char *argv[])
+{
+    QCoreApplication app(argc, argv);
+
+    QCommandLineParser parser;
+    parser.setApplicationDescription("Fuzzes the H.264 SPS rewriter against h264bitstream");
+    parser.addHelpOption();
+    parser.addOption(QCommandLineOption("file", "Annex B H.264 stream with extra SPS seeds", "file"));
+    parser.addOption(QCommandLineOption("iterations", "Number of SPS inputs to try (default 100000)", "iterations"));
+    parser.addOption(QCommandLineOption("seed", "Random seed to reproduce a run", "seed"));
+    parser.process(app);
+
+    int iterations = 100000;
+    if (parser.isSet("iterations")) {
+        bool ok;
+        iterations = parser.value("iterations").toInt(&ok);
+        if (!ok || iterations < 1) {
+            fprintf(stderr, "Invalid iterations value: %s\n", qPrintable(parser.value("iterations")));
+            return 1;
+        }
+    }
+
+    quint32 rngSeed;
+    if (parser.isSet("seed")) {
+        bool ok;
+        rngSeed = parser.value("seed").toUInt(&ok);
+        if (!ok) {
+            fprintf(stderr, "Invalid seed value: %s\n", qPrintable(parser.value("seed")));
+            return 1;
+        }
+    }
+    else {
+        rngSeed = QRandomGenerator::system()->generate();
+    }
+
+    QVector<QByteArray> seeds;
+    for (const SeedSps& seed : k_SeedSps) {
+        seeds.append(QByteArray((const char*)seed.data, seed.length));
+    }
+
+    if (parser.isSet("file") && !readSeedsFromFile(parser.value("file"), seeds)) {
+        return 1;
+    }
+
+    FuzzResult result = {};
+    QRandomGenerator rng(rngSeed);
+
+    fprintf(stdout, "Fuzzing the SPS rewriter with %d inputs from %d seeds (--seed %u)...\n",
+            iterations, (int)seeds.size(), rngSeed);
+    fflush(stdout);
+
+    // Every seed must round trip through the rewriter unchanged
+    for (const QByteArray& seed : seeds) {
+        h264_stream_t* stream = h264_new();
+        read_nal_unit(stream, (uint8_t*)seed.data() + NAL_START, seed.size() - NAL_START);
+
+        QByteArray output(seed.size() + SPS_EXTRA_SIZE, 0);
+        int length = SpsRewriter::rewriteH264((const uint8_t*)seed.constData(), seed.size(), NAL_START,
+                                              stream->sps->num_ref_frames,
+                                              stream->sps->vui.max_dec_frame_buffering,
+                                              (uint8_t*)output.data(), output.size());
+        if (length != seed.size() || output.left(length) != seed) {
+            reportFailure(&result, "seed didn't round trip", seed,
+                          stream->sps->num_ref_frames, stream->sps->vui.max_dec_frame_buffering);
+        }
+
+        h264_free(stream);
+    }
+
+    for (int i = 0; i < iterations; i++) {
+        const QByteArray& seed = seeds[rng.bounded((int)seeds.size())];
+
+        // A quarter of the inputs are valid and checked against h264bitstream
+        if (rng.bounded(4) == 0) {
+            QByteArray input = makeValidVariant(seed, rng);
+            if (!input.isEmpty()) {
+                result.validInputs++;
+                fuzzInput(input, true, rng, &result);
+            }
+        }
+        else {
+            result.mutatedInputs++;
+            fuzzInput(mutate(seed, rng), false, rng, &result);
+        }
+    }
+
+    fprintf(stdout, "%d mutated and %d valid inputs, %d rewritten, %d failures\n",
+            result.mutatedInputs, result.validInputs, result.rewritten, result.failures);
+
+    return result.failures == 0 ? 0 : 1;
+}
@@ -0,0 +1,6 @@
+# Developer tools that check the app's performance and correctness claims.
+# They build against individual app sources and aren't shipped with the app.
+TEMPLATE = subdirs
+SUBDIRS = \
+    benchmarkbandwidth \
+    fuzzsps